@@ -0,0 +1,35 @@
+AC_ARG_ENABLE([pcre],
+              [AS_HELP_STRING([--enable-pcre=@<:@auto/yes/no@:>@],
+                              [Use PCRE for $regex in mongoc_matcher_t.])],
+              [],
+              [enable_pcre=auto])
+
+PCRE_CFLAGS=
+PCRE_LIBS=
+
+AS_IF([test "$enable_pcre" != "no"],[
+  PKG_CHECK_MODULES(PCRE, [libpcre], [enable_pcre=yes], [
+    AC_CHECK_LIB([pcre],[pcre_compile],[have_pcre_lib=yes],[have_pcre_lib=no])
+    AC_CHECK_HEADER([pcre.h],[have_pcre_headers=yes],[have_pcre_headers=no])
+
+    if test "$have_pcre_lib" = "yes" -a "$have_pcre_headers" = "yes" ; then
+      PCRE_LIBS=-lpcre
+      enable_pcre=yes
+    elif test "$enable_pcre" = "yes" ; then
+      AC_MSG_ERROR([You must install the PCRE libraries and development headers to enable PCRE.])
+    else
+      enable_pcre=no
+    fi
+  ])
+])
+
+AM_CONDITIONAL([ENABLE_PCRE], [test "$enable_pcre" = "yes"])
+AC_SUBST(PCRE_CFLAGS)
+AC_SUBST(PCRE_LIBS)
+
+dnl Let mongoc-config.h.in know about PCRE status.
+if test "$enable_pcre" = "yes" ; then
+  AC_SUBST(MONGOC_ENABLE_PCRE, 1)
+else
+  AC_SUBST(MONGOC_ENABLE_PCRE, 0)
+fi
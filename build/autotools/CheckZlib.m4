@@ -0,0 +1,35 @@
+AC_ARG_ENABLE([zlib],
+              [AS_HELP_STRING([--enable-zlib=@<:@auto/yes/no@:>@],
+                              [Use zlib for wire protocol compression.])],
+              [],
+              [enable_zlib=auto])
+
+ZLIB_CFLAGS=
+ZLIB_LIBS=
+
+AS_IF([test "$enable_zlib" != "no"],[
+  PKG_CHECK_MODULES(ZLIB, [zlib], [enable_zlib=yes], [
+    AC_CHECK_LIB([z],[deflate],[have_zlib_lib=yes],[have_zlib_lib=no])
+    AC_CHECK_HEADER([zlib.h],[have_zlib_headers=yes],[have_zlib_headers=no])
+
+    if test "$have_zlib_lib" = "yes" -a "$have_zlib_headers" = "yes" ; then
+      ZLIB_LIBS=-lz
+      enable_zlib=yes
+    elif test "$enable_zlib" = "yes" ; then
+      AC_MSG_ERROR([You must install the zlib libraries and development headers to enable compression.])
+    else
+      enable_zlib=no
+    fi
+  ])
+])
+
+AM_CONDITIONAL([ENABLE_ZLIB], [test "$enable_zlib" = "yes"])
+AC_SUBST(ZLIB_CFLAGS)
+AC_SUBST(ZLIB_LIBS)
+
+dnl Let mongoc-config.h.in know about zlib status.
+if test "$enable_zlib" = "yes" ; then
+  AC_SUBST(MONGOC_ENABLE_ZLIB, 1)
+else
+  AC_SUBST(MONGOC_ENABLE_ZLIB, 0)
+fi
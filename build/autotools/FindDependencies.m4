@@ -22,6 +22,9 @@ AC_SUBST([SHM_LIB])
 # Check for sched_getcpu
 AC_CHECK_FUNCS([sched_getcpu])
 
+# Check for the rseq area of glibc 2.35, for the CPU of counter slots
+AC_CHECK_HEADERS([sys/rseq.h])
+
 # Check for clock_gettime
 AC_SEARCH_LIBS([clock_gettime], [rt], [
     AC_DEFINE(HAVE_CLOCK_GETTIME, 1, [Have clock_gettime])
@@ -40,3 +40,5 @@ AS_IF([test $"enable_debug" = "no"],
 
 AS_IF([test "$enable_tracing" = "yes"],
       [CPPFLAGS="$CPPFLAGS -DMONGOC_TRACE"])
+AS_IF([test "$enable_tracing" = "log"],
+      [CPPFLAGS="$CPPFLAGS -DMONGOC_TRACE -DMONGOC_TRACE_LOG"])
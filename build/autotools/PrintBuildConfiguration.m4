@@ -36,6 +36,8 @@ Build configuration:
   Shared memory performance counters               : ${enable_shm_counters}
   SASL                                             : ${sasl_mode}
   SSL                                              : ${enable_ssl}
+  Zlib compression                                 : ${enable_zlib}
+  PCRE regular expressions                         : ${enable_pcre}
   Libbson                                          : ${with_libbson}
 
 Documentation:
@@ -6,7 +6,7 @@ AC_MSG_RESULT([$enable_debug])
 
 AC_MSG_CHECKING([whether to enable tracing])
 AC_ARG_ENABLE(tracing, 
-    AC_HELP_STRING([--enable-tracing], [turn on tracing [default=no]]),
+    AC_HELP_STRING([--enable-tracing=@<:@no/yes/log@:>@], [turn on tracing into per-thread ring buffers, or "log" for log messages [default=no]]),
     [],[enable_tracing="no"])
 AC_MSG_RESULT([$enable_tracing])
 
@@ -20,13 +20,234 @@
 #include <mongoc.h>
 #include <stdio.h>
 
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <pthread.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 
 /*
  * This is an example that reads BSON documents from STDIN and prints them
  * to standard output as JSON if they match {'hello': 'world'}.
+ *
+ * Given a file instead, it is mapped into memory and split into chunks
+ * at document boundaries, which -j threads match concurrently. Their
+ * output is printed in the order of the file.
  */
 
 
+#ifndef _WIN32
+
+#define CHUNK_SIZE (16 * 1024 * 1024)
+
+
+typedef struct
+{
+   const uint8_t *data;
+   size_t         len;
+   bson_string_t *out;
+   bool           done;
+} chunk_t;
+
+
+typedef struct
+{
+   const bson_t    *spec;
+   chunk_t         *chunks;
+   size_t           n_chunks;
+
+   /* chunks are taken in order, at most max_ahead past the printed one */
+   pthread_mutex_t  mutex;
+   pthread_cond_t   cond;
+   size_t           next_chunk;
+   size_t           printed;
+   size_t           max_ahead;
+} filter_t;
+
+
+static void *
+filter_worker (void *data)
+{
+   mongoc_matcher_t *matcher;
+   bson_reader_t *reader;
+   const bson_t *bson;
+   filter_t *filter = data;
+   chunk_t *chunk;
+   char *str;
+
+   matcher = mongoc_matcher_new (filter->spec, NULL);
+
+   for (;;) {
+      pthread_mutex_lock (&filter->mutex);
+      while (filter->next_chunk < filter->n_chunks &&
+             filter->next_chunk >= filter->printed + filter->max_ahead) {
+         pthread_cond_wait (&filter->cond, &filter->mutex);
+      }
+      chunk = (filter->next_chunk < filter->n_chunks) ?
+              &filter->chunks [filter->next_chunk++] : NULL;
+      pthread_mutex_unlock (&filter->mutex);
+
+      if (!chunk) {
+         break;
+      }
+
+      chunk->out = bson_string_new (NULL);
+      reader = bson_reader_new_from_data (chunk->data, chunk->len);
+
+      while ((bson = bson_reader_read (reader, NULL))) {
+         if (mongoc_matcher_match (matcher, bson)) {
+            str = bson_as_json (bson, NULL);
+            bson_string_append (chunk->out, str);
+            bson_string_append_c (chunk->out, '\n');
+            bson_free (str);
+         }
+      }
+
+      bson_reader_destroy (reader);
+
+      pthread_mutex_lock (&filter->mutex);
+      chunk->done = true;
+      pthread_cond_broadcast (&filter->cond);
+      pthread_mutex_unlock (&filter->mutex);
+   }
+
+   mongoc_matcher_destroy (matcher);
+
+   return NULL;
+}
+
+
+/*
+ * Splits @data into chunks of about CHUNK_SIZE bytes by walking the
+ * length prefix of each document, so a chunk holds whole documents.
+ */
+static chunk_t *
+filter_split (const uint8_t *data,
+              size_t         len,
+              size_t        *n_chunks)
+{
+   chunk_t *chunks = NULL;
+   size_t offset = 0;
+   size_t start = 0;
+   int32_t doc_len;
+
+   *n_chunks = 0;
+
+   while (offset + 4 <= len) {
+      memcpy (&doc_len, data + offset, 4);
+      doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+      if (doc_len < 5 || (size_t)doc_len > len - offset) {
+         fprintf (stderr, "Corrupt document at offset %llu.\n",
+                  (unsigned long long)offset);
+         break;
+      }
+
+      offset += doc_len;
+
+      if (offset - start >= CHUNK_SIZE || offset + 4 > len) {
+         chunks = bson_realloc (chunks, (*n_chunks + 1) * sizeof *chunks);
+         memset (&chunks [*n_chunks], 0, sizeof *chunks);
+         chunks [*n_chunks].data = data + start;
+         chunks [(*n_chunks)++].len = offset - start;
+         start = offset;
+      }
+   }
+
+   if (start < offset) {
+      chunks = bson_realloc (chunks, (*n_chunks + 1) * sizeof *chunks);
+      memset (&chunks [*n_chunks], 0, sizeof *chunks);
+      chunks [*n_chunks].data = data + start;
+      chunks [(*n_chunks)++].len = offset - start;
+   }
+
+   return chunks;
+}
+
+
+static int
+filter_file (const char   *path,
+             const bson_t *spec,
+             uint32_t      n_threads)
+{
+   filter_t filter = { 0 };
+   pthread_t *threads;
+   struct stat st;
+   uint8_t *data;
+   uint32_t i;
+   int fd;
+
+   if (-1 == (fd = open (path, O_RDONLY)) || -1 == fstat (fd, &st)) {
+      perror ("Failed to open file");
+      return EXIT_FAILURE;
+   }
+
+   if (!st.st_size) {
+      close (fd);
+      return EXIT_SUCCESS;
+   }
+
+   data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close (fd);
+
+   if (data == MAP_FAILED) {
+      perror ("Failed to map file");
+      return EXIT_FAILURE;
+   }
+
+   madvise (data, st.st_size, MADV_SEQUENTIAL);
+
+   filter.spec = spec;
+   filter.chunks = filter_split (data, st.st_size, &filter.n_chunks);
+   filter.max_ahead = 2 * n_threads;
+   pthread_mutex_init (&filter.mutex, NULL);
+   pthread_cond_init (&filter.cond, NULL);
+
+   threads = bson_malloc (n_threads * sizeof *threads);
+
+   for (i = 0; i < n_threads; i++) {
+      pthread_create (&threads [i], NULL, filter_worker, &filter);
+   }
+
+   pthread_mutex_lock (&filter.mutex);
+
+   while (filter.printed < filter.n_chunks) {
+      chunk_t *chunk = &filter.chunks [filter.printed];
+
+      while (!chunk->done) {
+         pthread_cond_wait (&filter.cond, &filter.mutex);
+      }
+
+      pthread_mutex_unlock (&filter.mutex);
+      fwrite (chunk->out->str, 1, chunk->out->len, stdout);
+      bson_string_free (chunk->out, true);
+      pthread_mutex_lock (&filter.mutex);
+
+      filter.printed++;
+      pthread_cond_broadcast (&filter.cond);
+   }
+
+   pthread_mutex_unlock (&filter.mutex);
+
+   for (i = 0; i < n_threads; i++) {
+      pthread_join (threads [i], NULL);
+   }
+
+   bson_free (threads);
+   bson_free (filter.chunks);
+   pthread_cond_destroy (&filter.cond);
+   pthread_mutex_destroy (&filter.mutex);
+   munmap (data, st.st_size);
+
+   return EXIT_SUCCESS;
+}
+
+#endif
+
+
 int
 main (int   argc,
       char *argv[])
@@ -37,9 +258,35 @@ main (int   argc,
    bson_t *spec;
    char *str;
    int fd;
+#ifndef _WIN32
+   uint32_t n_threads = 4;
+   int ret;
+
+   if (argc > 2 && 0 == strcmp (argv [1], "-j")) {
+      n_threads = atoi (argv [2]);
+      argc -= 2;
+      argv += 2;
+   }
+
+   if (argc > 2 || !n_threads) {
+      fprintf (stderr, "usage: filter-bsondump [-j THREADS] [FILE]\n");
+      return EXIT_FAILURE;
+   }
+#endif
 
    mongoc_init ();
 
+   spec = BCON_NEW ("hello", "world");
+
+#ifndef _WIN32
+   if (argc == 2) {
+      ret = filter_file (argv [1], spec, n_threads);
+      bson_destroy (spec);
+      mongoc_cleanup ();
+      return ret;
+   }
+#endif
+
 #ifdef _WIN32
    fd = fileno (stdin);
 #else
@@ -48,7 +295,6 @@ main (int   argc,
 
    reader = bson_reader_new_from_fd (fd, false);
 
-   spec = BCON_NEW ("hello", "world");
    matcher = mongoc_matcher_new (spec, NULL);
 
    while ((bson = bson_reader_read (reader, NULL))) {
@@ -20,6 +20,78 @@
 #include <mongoc.h>
 
 
+#if !defined(_WIN32)
+#  include <pthread.h>
+#  define Mutex                   pthread_mutex_t
+#  define Mutex_Init(_n)          pthread_mutex_init((_n), NULL)
+#  define Mutex_Lock              pthread_mutex_lock
+#  define Mutex_Unlock            pthread_mutex_unlock
+#  define Mutex_Destroy           pthread_mutex_destroy
+#  define Thread                  pthread_t
+#  define Thread_Create(_t,_f,_d) pthread_create((_t), NULL, (_f), (_d))
+#  define Thread_Join(_n)         pthread_join((_n), NULL)
+#else
+#  define Mutex                   CRITICAL_SECTION
+#  define Mutex_Init              InitializeCriticalSection
+#  define Mutex_Lock              EnterCriticalSection
+#  define Mutex_Unlock            LeaveCriticalSection
+#  define Mutex_Destroy           DeleteCriticalSection
+#  define Thread                  HANDLE
+#  define Thread_Create(_t,_f,_d) \
+      ((*(_t) = CreateThread (NULL, 0, (LPTHREAD_START_ROUTINE)(_f), \
+                              (_d), 0, NULL)) ? 0 : -1)
+#  define Thread_Join(_n)         WaitForSingleObject ((_n), INFINITE)
+#endif
+
+
+/*
+ * Documents are gathered into chunks of this size before they are
+ * written, so the files are written sequentially in large blocks. It is
+ * the largest document size, so that any document fits in a chunk.
+ */
+#define DUMP_CHUNK_SIZE (16 * 1024 * 1024)
+
+
+typedef struct
+{
+   char *database;
+   char *collection;
+} dump_task_t;
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   const char           *compressor;
+   uint32_t              n_scanners;
+
+   /* the next task to hand out, and whether any failed */
+   Mutex                 mutex;
+   dump_task_t          *tasks;
+   size_t                n_tasks;
+   size_t                next_task;
+   bool                  failed;
+} dump_t;
+
+
+/*
+ * The output file of one collection, written to by the scanners of
+ * mongoc_client_pool_parallel_find(). A full chunk is swapped out under
+ * @mutex and written under @write_mutex, so scanners keep filling the
+ * next chunk while one is written.
+ */
+typedef struct
+{
+   const char      *path;
+   mongoc_stream_t *stream;
+   Mutex            mutex;
+   Mutex            write_mutex;
+   uint8_t         *chunk;
+   size_t           chunk_len;
+   bool             failed;
+} dump_output_t;
+
+
 static bool
 mongoc_dump_mkdir_p (const char *path,
 int         mode)
@@ -42,75 +114,189 @@ int         mode)
 }
 
 
-static int
-mongoc_dump_collection (mongoc_client_t *client,
-                        const char      *database,
-                        const char      *collection)
+static bool
+mongoc_dump_write_chunk (dump_output_t *output,
+                         uint8_t       *chunk,
+                         size_t         chunk_len)
 {
-   mongoc_collection_t *col;
-   mongoc_cursor_t *cursor;
-   const bson_t *doc;
+   bool ret = true;
+
+   Mutex_Lock (&output->write_mutex);
+
+   if (output->failed ||
+       (ssize_t)chunk_len != mongoc_stream_write (output->stream, chunk,
+                                                  chunk_len, -1)) {
+      if (!output->failed) {
+         fprintf (stderr, "Failed to write %u bytes to %s\n",
+                  (unsigned)chunk_len, output->path);
+      }
+      output->failed = true;
+      ret = false;
+   }
+
+   Mutex_Unlock (&output->write_mutex);
+
+   bson_free (chunk);
+
+   return ret;
+}
+
+
+static bool
+mongoc_dump_document (const bson_t *doc,
+                      void         *data)
+{
+   dump_output_t *output = data;
+   uint8_t *full = NULL;
+   size_t full_len = 0;
+
+   Mutex_Lock (&output->mutex);
+
+   if (output->chunk_len && output->chunk_len + doc->len > DUMP_CHUNK_SIZE) {
+      full = output->chunk;
+      full_len = output->chunk_len;
+      output->chunk = bson_malloc (DUMP_CHUNK_SIZE);
+      output->chunk_len = 0;
+   }
+
+   memcpy (output->chunk + output->chunk_len, bson_get_data (doc), doc->len);
+   output->chunk_len += doc->len;
+
+   Mutex_Unlock (&output->mutex);
+
+   if (full) {
+      return mongoc_dump_write_chunk (output, full, full_len);
+   }
+
+   return true;
+}
+
+
+static bool
+mongoc_dump_collection (dump_t     *dump,
+                        const char *database,
+                        const char *collection)
+{
+   dump_output_t output = { 0 };
+   mongoc_stream_t *file;
    bson_error_t error;
    bson_t query = BSON_INITIALIZER;
-   FILE *stream;
    char *path;
-   int ret = EXIT_SUCCESS;
+   bool ret;
 
-   path = bson_strdup_printf ("dump/%s/%s.bson", database, collection);
-#ifdef _WIN32
-   if (0 == _access (path, 0)) {
-      _unlink (path);
-   }
-#else
-   if (0 == access (path, F_OK)) {
-      unlink (path);
+   path = bson_strdup_printf ("dump/%s/%s.bson%s", database, collection,
+                              dump->compressor ? ".z" : "");
+
+   file = mongoc_stream_file_new_for_path (path, O_WRONLY | O_CREAT | O_TRUNC,
+                                           0640);
+   if (!file) {
+      fprintf (stderr, "Failed to open \"%s\".\n", path);
+      bson_free (path);
+      return false;
    }
-#endif
 
-   stream = fopen (path, "w");
-   if (!stream) {
-      fprintf (stderr, "Failed to open \"%s\", aborting.\n", path);
-      exit (EXIT_FAILURE);
+   output.path = path;
+   output.stream = file;
+
+   if (dump->compressor &&
+       !(output.stream = mongoc_stream_compressed_new (file,
+                                                       dump->compressor))) {
+      fprintf (stderr, "Unsupported compressor \"%s\".\n", dump->compressor);
+      mongoc_stream_destroy (file);
+      bson_free (path);
+      return false;
    }
 
-   col = mongoc_client_get_collection (client, database, collection);
-   cursor = mongoc_collection_find (col, MONGOC_QUERY_NONE, 0, 0, 0,
-                                    &query, NULL, NULL);
+   Mutex_Init (&output.mutex);
+   Mutex_Init (&output.write_mutex);
+   output.chunk = bson_malloc (DUMP_CHUNK_SIZE);
 
-   while (mongoc_cursor_next (cursor, &doc)) {
-      if (BSON_UNLIKELY (doc->len != fwrite (bson_get_data (doc), 1, doc->len, stream))) {
-         fprintf (stderr, "Failed to write %u bytes to %s\n",
-                  doc->len, path);
-         ret = EXIT_FAILURE;
-         goto cleanup;
-      }
+   ret = mongoc_client_pool_parallel_find (dump->pool, database, collection,
+                                           &query, NULL, dump->n_scanners,
+                                           mongoc_dump_document, &output,
+                                           &error);
+   if (!ret && !output.failed) {
+      fprintf (stderr, "Failed to dump %s.%s: %s\n", database, collection,
+               error.message);
    }
 
-   if (mongoc_cursor_error (cursor, &error)) {
-      fprintf (stderr, "ERROR: %s\n", error.message);
-      ret = EXIT_FAILURE;
+   if (ret && output.chunk_len) {
+      ret = mongoc_dump_write_chunk (&output, output.chunk, output.chunk_len);
+   } else {
+      bson_free (output.chunk);
    }
 
-cleanup:
+   if (ret && 0 != mongoc_stream_flush (output.stream)) {
+      fprintf (stderr, "Failed to flush %s\n", path);
+      ret = false;
+   }
+
+   mongoc_stream_close (output.stream);
+   mongoc_stream_destroy (output.stream);
+   Mutex_Destroy (&output.write_mutex);
+   Mutex_Destroy (&output.mutex);
    bson_free (path);
-   fclose (stream);
-   mongoc_cursor_destroy (cursor);
-   mongoc_collection_destroy (col);
 
-   return ret;
+   return ret && !output.failed;
 }
 
 
-static int
-mongoc_dump_database (mongoc_client_t *client,
-                      const char      *database,
-                      const char      *collection)
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+mongoc_dump_worker (void *data)
+{
+   dump_t *dump = data;
+   dump_task_t *task;
+
+   for (;;) {
+      Mutex_Lock (&dump->mutex);
+      task = (dump->failed || dump->next_task == dump->n_tasks) ?
+             NULL : &dump->tasks [dump->next_task++];
+      Mutex_Unlock (&dump->mutex);
+
+      if (!task) {
+         break;
+      }
+
+      if (!mongoc_dump_collection (dump, task->database, task->collection)) {
+         Mutex_Lock (&dump->mutex);
+         dump->failed = true;
+         Mutex_Unlock (&dump->mutex);
+      }
+   }
+
+   return 0;
+}
+
+
+static void
+mongoc_dump_add_task (dump_t     *dump,
+                      const char *database,
+                      const char *collection)
+{
+   dump_task_t *task;
+
+   dump->tasks = bson_realloc (dump->tasks,
+                               (dump->n_tasks + 1) * sizeof *dump->tasks);
+   task = &dump->tasks [dump->n_tasks++];
+   task->database = bson_strdup (database);
+   task->collection = bson_strdup (collection);
+}
+
+
+static bool
+mongoc_dump_add_database (dump_t          *dump,
+                          mongoc_client_t *client,
+                          const char      *database,
+                          const char      *collection)
 {
    mongoc_database_t *db;
    bson_error_t error;
    char *path;
    char **str;
-   int ret = EXIT_SUCCESS;
    int i;
 
    BSON_ASSERT (database);
@@ -119,66 +305,88 @@ mongoc_dump_database (mongoc_client_t *client,
    if (!mongoc_dump_mkdir_p (path, 0750)) {
       fprintf (stderr, "failed to create directory \"%s\"", path);
       bson_free (path);
-      return EXIT_FAILURE;
+      return false;
    }
 
    bson_free (path);
 
    if (collection) {
-      return mongoc_dump_collection (client, database, collection);
+      mongoc_dump_add_task (dump, database, collection);
+      return true;
    }
 
    db = mongoc_client_get_database (client, database);
    str = mongoc_database_get_collection_names (db, &error);
+   mongoc_database_destroy (db);
+
+   if (!str) {
+      fprintf (stderr, "Failed to fetch collection names of %s: %s\n",
+               database, error.message);
+      return false;
+   }
+
    for (i = 0; str [i]; i++) {
-      if (EXIT_SUCCESS != mongoc_dump_collection (client, database, str [i])) {
-         ret = EXIT_FAILURE;
-         goto cleanup;
-      }
+      mongoc_dump_add_task (dump, database, str [i]);
    }
 
-cleanup:
-   mongoc_database_destroy (db);
    bson_strfreev (str);
 
-   return ret;
+   return true;
 }
 
 
 static int
-mongoc_dump (mongoc_client_t *client,
-             const char      *database,
-             const char      *collection)
+mongoc_dump (dump_t     *dump,
+             const char *database,
+             const char *collection,
+             uint32_t    n_jobs)
 {
+   mongoc_client_t *client;
    bson_error_t error;
+   Thread *threads;
+   bool ok = true;
    char **str;
-   int i;
+   size_t i;
 
    if (!mongoc_dump_mkdir_p ("dump", 0750)) {
       perror ("Failed to create directory \"dump\"");
       return EXIT_FAILURE;
    }
 
-   if (database) {
-      return mongoc_dump_database (client, database, collection);
-   }
+   client = mongoc_client_pool_pop (dump->pool);
 
-   if (!(str = mongoc_client_get_database_names (client, &error))) {
+   if (database) {
+      ok = mongoc_dump_add_database (dump, client, database, collection);
+   } else if ((str = mongoc_client_get_database_names (client, &error))) {
+      for (i = 0; ok && str [i]; i++) {
+         ok = mongoc_dump_add_database (dump, client, str [i], NULL);
+      }
+      bson_strfreev (str);
+   } else {
       fprintf (stderr, "Failed to fetch database names: %s\n",
                error.message);
+      ok = false;
+   }
+
+   mongoc_client_pool_push (dump->pool, client);
+
+   if (!ok) {
       return EXIT_FAILURE;
    }
 
-   for (i = 0; str [i]; i++) {
-      if (EXIT_SUCCESS != mongoc_dump_database (client, str [i], NULL)) {
-         bson_strfreev (str);
-         return EXIT_FAILURE;
-      }
+   threads = bson_malloc (n_jobs * sizeof *threads);
+
+   for (i = 0; i < n_jobs; i++) {
+      Thread_Create (&threads [i], mongoc_dump_worker, dump);
    }
 
-   bson_strfreev (str);
+   for (i = 0; i < n_jobs; i++) {
+      Thread_Join (threads [i]);
+   }
 
-   return EXIT_SUCCESS;
+   bson_free (threads);
+
+   return dump->failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 
@@ -194,6 +402,9 @@ usage (FILE *stream)
 "  -p PORT      Optional port to connect to [27017].\n"
 "  -d DBNAME    Optional database name to dump.\n"
 "  -c COLNAME   Optional collection name to dump.\n"
+"  -j JOBS      Optional number of collections dumped at once [4].\n"
+"  -s SCANNERS  Optional number of scanners per collection [4].\n"
+"  -z CODEC     Optional compressor for the output, such as zlib.\n"
 "  --ssl        Use SSL when connecting to server.\n"
 "\n");
 }
@@ -203,18 +414,23 @@ int
 main (int argc,
       char *argv[])
 {
-   mongoc_client_t *client;
+   dump_t dump = { 0 };
+   mongoc_uri_t *uri;
    const char *collection = NULL;
    const char *database = NULL;
    const char *host = "127.0.0.1";
    uint16_t port = 27017;
+   uint32_t n_jobs = 4;
    bool ssl = false;
-   char *uri;
+   char *uri_str;
+   size_t j;
    int ret;
    int i;
 
    mongoc_init ();
 
+   dump.n_scanners = 4;
+
    for (i = 1; i < argc; i++) {
       if (0 == strcmp (argv [i], "-c") && ((i + 1) < argc)) {
          collection = argv [++i];
@@ -225,6 +441,20 @@ main (int argc,
          return EXIT_SUCCESS;
       } else if (0 == strcmp (argv [i], "-h") && ((i + 1) < argc)) {
          host = argv [++i];
+      } else if (0 == strcmp (argv [i], "-j") && ((i + 1) < argc)) {
+         n_jobs = atoi (argv [++i]);
+         if (!n_jobs) {
+            fprintf (stderr, "Invalid number of jobs \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "-s") && ((i + 1) < argc)) {
+         dump.n_scanners = atoi (argv [++i]);
+         if (!dump.n_scanners) {
+            fprintf (stderr, "Invalid number of scanners \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "-z") && ((i + 1) < argc)) {
+         dump.compressor = argv [++i];
       } else if (0 == strcmp (argv [i], "--ssl")) {
          ssl = true;
       } else if (0 == strcmp (argv [i], "-p") && ((i + 1) < argc)) {
@@ -239,20 +469,36 @@ main (int argc,
       }
    }
 
-   uri = bson_strdup_printf ("mongodb://%s:%hu/%s?ssl=%s",
-                             host,
-                             port,
-                             database ? database : "",
-                             ssl ? "true" : "false");
+   /* each job's scanners hold a client, plus one to list collections */
+   uri_str = bson_strdup_printf ("mongodb://%s:%hu/%s?ssl=%s&maxpoolsize=%u",
+                                 host,
+                                 port,
+                                 database ? database : "",
+                                 ssl ? "true" : "false",
+                                 n_jobs * dump.n_scanners + 1);
 
-   if (!(client = mongoc_client_new (uri))) {
-      fprintf (stderr, "Invalid connection URI: %s\n", uri);
+   if (!(uri = mongoc_uri_new (uri_str))) {
+      fprintf (stderr, "Invalid connection URI: %s\n", uri_str);
       return EXIT_FAILURE;
    }
 
-   ret = mongoc_dump (client, database, collection);
+   dump.pool = mongoc_client_pool_new (uri);
+   Mutex_Init (&dump.mutex);
+
+   ret = mongoc_dump (&dump, database, collection, n_jobs);
+
+   for (j = 0; j < dump.n_tasks; j++) {
+      bson_free (dump.tasks [j].database);
+      bson_free (dump.tasks [j].collection);
+   }
+   bson_free (dump.tasks);
+
+   Mutex_Destroy (&dump.mutex);
+   mongoc_client_pool_destroy (dump.pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
 
-   mongoc_client_destroy (client);
+   mongoc_cleanup ();
 
    return ret;
 }
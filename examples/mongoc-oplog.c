@@ -0,0 +1,776 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Incremental backups from the oplog of a replica set member.
+ *
+ * "mongoc-oplog backup" tails local.oplog.rs and appends its entries to
+ * segment files oplog-00000000.bson, oplog-00000001.bson... in the output
+ * directory. Start it before taking a snapshot with mongoc-dump, and the
+ * dump plus the segments restore the data to any point after the dump
+ * finished. Started again on the same directory, it resumes after the
+ * last entry of the last segment.
+ *
+ * "mongoc-oplog replay" applies the segments, after mongoc-restore of the
+ * snapshot, in ordered bulk operations of consecutive entries on the same
+ * collection. Inserts are replayed as upserts by _id, so entries that the
+ * snapshot already contains are applied again harmlessly.
+ */
+
+
+#include <bson.h>
+#include <fcntl.h>
+#include <mongoc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Entries are gathered into chunks of this size before they are written,
+ * so the segments are written sequentially in large blocks. It is the
+ * largest document size, so that any entry fits in a chunk.
+ */
+#define OPLOG_CHUNK_SIZE (16 * 1024 * 1024)
+
+
+typedef struct
+{
+   uint32_t t;
+   uint32_t i;
+} oplog_ts_t;
+
+
+typedef struct
+{
+   const char      *dir;
+   uint32_t         segment;
+   size_t           segment_len;
+   size_t           segment_size;
+   mongoc_stream_t *stream;
+   char            *path;
+   uint8_t         *chunk;
+   size_t           chunk_len;
+} oplog_output_t;
+
+
+typedef struct
+{
+   mongoc_client_t          *client;
+   mongoc_collection_t      *collection;
+   mongoc_bulk_operation_t  *bulk;
+   char                      ns [128];
+   uint32_t                  n_ops;
+   uint32_t                  batch_size;
+   uint64_t                  n_applied;
+} oplog_replay_t;
+
+
+static volatile sig_atomic_t gStop;
+
+
+static void
+mongoc_oplog_sigint (int sig)
+{
+   gStop = 1;
+}
+
+
+static bool
+mongoc_oplog_parse_ts (const char *str,
+                       oplog_ts_t *ts)
+{
+   char *end;
+
+   ts->t = (uint32_t)strtoul (str, &end, 10);
+   ts->i = 0;
+
+   if (*end == ':') {
+      ts->i = (uint32_t)strtoul (end + 1, &end, 10);
+   }
+
+   return (end != str && *end == '\0');
+}
+
+
+static bool
+mongoc_oplog_entry_ts (const bson_t *entry,
+                       oplog_ts_t   *ts)
+{
+   bson_iter_t iter;
+
+   if (!bson_iter_init_find (&iter, entry, "ts") ||
+       !BSON_ITER_HOLDS_TIMESTAMP (&iter)) {
+      return false;
+   }
+
+   bson_iter_timestamp (&iter, &ts->t, &ts->i);
+
+   return true;
+}
+
+
+static int
+mongoc_oplog_ts_cmp (const oplog_ts_t *a,
+                     const oplog_ts_t *b)
+{
+   if (a->t != b->t) {
+      return a->t < b->t ? -1 : 1;
+   }
+
+   return (a->i > b->i) - (a->i < b->i);
+}
+
+
+static char *
+mongoc_oplog_segment_path (const char *dir,
+                           uint32_t    segment)
+{
+   return bson_strdup_printf ("%s/oplog-%08u.bson", dir, segment);
+}
+
+
+/*
+ * Find the number of segments in @dir and the last entry they hold, so
+ * a backup can resume where the previous one stopped.
+ */
+static bool
+mongoc_oplog_scan_segments (const char *dir,
+                            uint32_t   *n_segments,
+                            oplog_ts_t *last,
+                            bool       *has_last)
+{
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_error_t error;
+   char *path;
+   bool eof = false;
+
+   *n_segments = 0;
+   *has_last = false;
+
+   for (;;) {
+      path = mongoc_oplog_segment_path (dir, *n_segments);
+      reader = bson_reader_new_from_file (path, &error);
+      bson_free (path);
+
+      if (!reader) {
+         return true;
+      }
+
+      while ((doc = bson_reader_read (reader, &eof))) {
+         if (mongoc_oplog_entry_ts (doc, last)) {
+            *has_last = true;
+         }
+      }
+
+      bson_reader_destroy (reader);
+
+      if (!eof) {
+         fprintf (stderr, "Segment %u of \"%s\" is corrupt.\n",
+                  *n_segments, dir);
+         return false;
+      }
+
+      (*n_segments)++;
+   }
+}
+
+
+static bool
+mongoc_oplog_open_segment (oplog_output_t *output)
+{
+   bson_free (output->path);
+   output->path = mongoc_oplog_segment_path (output->dir, output->segment);
+   output->segment_len = 0;
+
+   output->stream = mongoc_stream_file_new_for_path (output->path,
+                                                     O_WRONLY | O_CREAT |
+                                                     O_EXCL, 0640);
+   if (!output->stream) {
+      fprintf (stderr, "Failed to open \"%s\".\n", output->path);
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool
+mongoc_oplog_close_segment (oplog_output_t *output)
+{
+   bool ret = true;
+
+   if (!output->stream) {
+      return true;
+   }
+
+   if (0 != mongoc_stream_flush (output->stream)) {
+      fprintf (stderr, "Failed to flush %s\n", output->path);
+      ret = false;
+   }
+
+   mongoc_stream_close (output->stream);
+   mongoc_stream_destroy (output->stream);
+   output->stream = NULL;
+
+   return ret;
+}
+
+
+/*
+ * Write the chunk to the current segment, first starting a new segment
+ * if the chunk would take the current one past its size.
+ */
+static bool
+mongoc_oplog_write_chunk (oplog_output_t *output)
+{
+   if (!output->chunk_len) {
+      return true;
+   }
+
+   if (output->stream && output->segment_len &&
+       output->segment_len + output->chunk_len > output->segment_size) {
+      if (!mongoc_oplog_close_segment (output)) {
+         return false;
+      }
+      output->segment++;
+   }
+
+   if (!output->stream && !mongoc_oplog_open_segment (output)) {
+      return false;
+   }
+
+   if ((ssize_t)output->chunk_len != mongoc_stream_write (output->stream,
+                                                          output->chunk,
+                                                          output->chunk_len,
+                                                          -1) ||
+       0 != mongoc_stream_flush (output->stream)) {
+      fprintf (stderr, "Failed to write %u bytes to %s\n",
+               (unsigned)output->chunk_len, output->path);
+      return false;
+   }
+
+   output->segment_len += output->chunk_len;
+   output->chunk_len = 0;
+
+   return true;
+}
+
+
+static bool
+mongoc_oplog_latest (mongoc_client_pool_t *pool,
+                     oplog_ts_t           *ts)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t *query;
+   bool ret = false;
+
+   client = mongoc_client_pool_pop (pool);
+   collection = mongoc_client_get_collection (client, "local", "oplog.rs");
+
+   query = BCON_NEW ("$query", "{", "}",
+                     "$orderby", "{", "$natural", BCON_INT32 (-1), "}");
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_SLAVE_OK, 0, 1,
+                                    0, query, NULL, NULL);
+
+   if (mongoc_cursor_next (cursor, &doc)) {
+      ret = mongoc_oplog_entry_ts (doc, ts);
+   } else if (mongoc_cursor_error (cursor, &error)) {
+      fprintf (stderr, "Failed to read the oplog: %s\n", error.message);
+   } else {
+      fprintf (stderr, "The oplog is empty.\n");
+   }
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (query);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+
+   return ret;
+}
+
+
+static int
+mongoc_oplog_backup (mongoc_client_pool_t *pool,
+                     const char           *dir,
+                     const oplog_ts_t     *since,
+                     size_t                segment_size,
+                     int64_t               flush_msec)
+{
+   oplog_output_t output = { 0 };
+   mongoc_tailer_t *tailer;
+   const bson_t *doc;
+   bson_error_t error;
+   oplog_ts_t start;
+   bool has_last;
+   bool ok = true;
+   bson_t query;
+   bson_t gt;
+
+   output.dir = dir;
+   output.segment_size = segment_size;
+
+   if (!mongoc_oplog_scan_segments (dir, &output.segment, &start, &has_last)) {
+      return EXIT_FAILURE;
+   }
+
+   if (has_last) {
+      fprintf (stderr, "Resuming after %u:%u in segment %u.\n",
+               start.t, start.i, output.segment);
+   } else if (since) {
+      start = *since;
+   } else if (!mongoc_oplog_latest (pool, &start)) {
+      return EXIT_FAILURE;
+   } else {
+      fprintf (stderr, "Tailing the oplog after %u:%u, the snapshot can "
+                       "be taken now.\n", start.t, start.i);
+   }
+
+   bson_init (&query);
+   bson_append_document_begin (&query, "ts", 2, &gt);
+   bson_append_timestamp (&gt, "$gt", 3, start.t, start.i);
+   bson_append_document_end (&query, &gt);
+
+   tailer = mongoc_tailer_new (pool, "local", "oplog.rs", &query, "ts",
+                               (MONGOC_QUERY_OPLOG_REPLAY |
+                                MONGOC_QUERY_SLAVE_OK),
+                               0);
+
+   bson_destroy (&query);
+
+   output.chunk = bson_malloc (OPLOG_CHUNK_SIZE);
+
+   signal (SIGINT, mongoc_oplog_sigint);
+   signal (SIGTERM, mongoc_oplog_sigint);
+
+   while (ok && !gStop) {
+      if (!(doc = mongoc_tailer_next (tailer, flush_msec))) {
+         if (mongoc_tailer_error (tailer, &error)) {
+            fprintf (stderr, "Failed to tail the oplog: %s\n",
+                     error.message);
+            ok = false;
+         } else {
+            /* idle, make what we have durable */
+            ok = mongoc_oplog_write_chunk (&output);
+         }
+         continue;
+      }
+
+      if (output.chunk_len + doc->len > OPLOG_CHUNK_SIZE) {
+         ok = mongoc_oplog_write_chunk (&output);
+      }
+
+      memcpy (output.chunk + output.chunk_len, bson_get_data (doc), doc->len);
+      output.chunk_len += doc->len;
+   }
+
+   ok = mongoc_oplog_write_chunk (&output) && ok;
+   ok = mongoc_oplog_close_segment (&output) && ok;
+
+   mongoc_tailer_destroy (tailer);
+   bson_free (output.chunk);
+   bson_free (output.path);
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static bool
+mongoc_oplog_flush (oplog_replay_t *replay)
+{
+   bson_error_t error;
+   bool ret = true;
+
+   if (replay->bulk) {
+      if (!mongoc_bulk_operation_execute (replay->bulk, NULL, &error)) {
+         fprintf (stderr, "Failed to apply entries to %s: %s\n",
+                  replay->ns, error.message);
+         ret = false;
+      }
+
+      mongoc_bulk_operation_destroy (replay->bulk);
+      replay->bulk = NULL;
+      replay->n_applied += replay->n_ops;
+      replay->n_ops = 0;
+   }
+
+   return ret;
+}
+
+
+/*
+ * Start a bulk operation for @ns, unless the pending one is for @ns and
+ * has room for another entry.
+ */
+static bool
+mongoc_oplog_bulk_for (oplog_replay_t *replay,
+                       const char     *ns)
+{
+   const char *dot;
+   char *db;
+
+   if (replay->bulk && !strcmp (replay->ns, ns) &&
+       replay->n_ops < replay->batch_size) {
+      return true;
+   }
+
+   if (!mongoc_oplog_flush (replay)) {
+      return false;
+   }
+
+   if (strcmp (replay->ns, ns)) {
+      if (!(dot = strchr (ns, '.')) || strlen (ns) >= sizeof replay->ns) {
+         fprintf (stderr, "Invalid namespace \"%s\".\n", ns);
+         return false;
+      }
+
+      if (replay->collection) {
+         mongoc_collection_destroy (replay->collection);
+      }
+
+      db = bson_strndup (ns, dot - ns);
+      replay->collection = mongoc_client_get_collection (replay->client, db,
+                                                         dot + 1);
+      bson_free (db);
+      bson_strncpy (replay->ns, ns, sizeof replay->ns);
+   }
+
+   replay->bulk = mongoc_collection_create_bulk_operation (replay->collection,
+                                                           true, NULL);
+
+   return true;
+}
+
+
+static bool
+mongoc_oplog_apply_command (oplog_replay_t *replay,
+                            const char     *ns,
+                            const bson_t   *command)
+{
+   bson_error_t error;
+   const char *dot;
+   char *db;
+   bool ret;
+
+   if (!mongoc_oplog_flush (replay)) {
+      return false;
+   }
+
+   dot = strchr (ns, '.');
+   db = dot ? bson_strndup (ns, dot - ns) : bson_strdup (ns);
+
+   if (!(ret = mongoc_client_command_simple (replay->client, db, command,
+                                             NULL, NULL, &error))) {
+      fprintf (stderr, "Failed to apply a command to %s: %s\n", db,
+               error.message);
+   } else {
+      replay->n_applied++;
+   }
+
+   bson_free (db);
+
+   return ret;
+}
+
+
+static bool
+mongoc_oplog_apply (oplog_replay_t *replay,
+                    const bson_t   *entry)
+{
+   bson_iter_t iter;
+   bson_iter_t id;
+   const uint8_t *data;
+   uint32_t len;
+   const char *op = NULL;
+   const char *ns = NULL;
+   bson_t o = BSON_INITIALIZER;
+   bson_t o2 = BSON_INITIALIZER;
+   bson_t selector = BSON_INITIALIZER;
+   bool ret = true;
+
+   if (!bson_iter_init (&iter, entry)) {
+      return false;
+   }
+
+   while (bson_iter_next (&iter)) {
+      if (!strcmp (bson_iter_key (&iter), "op") &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         op = bson_iter_utf8 (&iter, NULL);
+      } else if (!strcmp (bson_iter_key (&iter), "ns") &&
+                 BSON_ITER_HOLDS_UTF8 (&iter)) {
+         ns = bson_iter_utf8 (&iter, NULL);
+      } else if (!strcmp (bson_iter_key (&iter), "o") &&
+                 BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         bson_destroy (&o);
+         bson_init_static (&o, data, len);
+      } else if (!strcmp (bson_iter_key (&iter), "o2") &&
+                 BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         bson_iter_document (&iter, &len, &data);
+         bson_destroy (&o2);
+         bson_init_static (&o2, data, len);
+      }
+   }
+
+   if (!op || !ns || !strcmp (op, "n")) {
+      /* no-ops, and a heartbeat has no namespace */
+   } else if (!strcmp (op, "c")) {
+      ret = mongoc_oplog_apply_command (replay, ns, &o);
+   } else if (!mongoc_oplog_bulk_for (replay, ns)) {
+      ret = false;
+   } else if (!strcmp (op, "i")) {
+      if (!bson_iter_init_find (&id, &o, "_id")) {
+         fprintf (stderr, "Insert into %s without an _id.\n", ns);
+         ret = false;
+      } else {
+         BSON_APPEND_VALUE (&selector, "_id", bson_iter_value (&id));
+         mongoc_bulk_operation_replace_one (replay->bulk, &selector, &o, true);
+         replay->n_ops++;
+      }
+   } else if (!strcmp (op, "u")) {
+      if (bson_iter_init (&iter, &o) && bson_iter_next (&iter) &&
+          bson_iter_key (&iter)[0] == '$') {
+         mongoc_bulk_operation_update_one (replay->bulk, &o2, &o, false);
+      } else {
+         mongoc_bulk_operation_replace_one (replay->bulk, &o2, &o, false);
+      }
+      replay->n_ops++;
+   } else if (!strcmp (op, "d")) {
+      mongoc_bulk_operation_remove_one (replay->bulk, &o);
+      replay->n_ops++;
+   } else {
+      fprintf (stderr, "Skipping an entry with op \"%s\".\n", op);
+   }
+
+   bson_destroy (&o);
+   bson_destroy (&o2);
+   bson_destroy (&selector);
+
+   return ret;
+}
+
+
+static int
+mongoc_oplog_replay (mongoc_client_pool_t *pool,
+                     const char           *dir,
+                     const oplog_ts_t     *until,
+                     uint32_t              batch_size)
+{
+   oplog_replay_t replay = { 0 };
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_error_t error;
+   oplog_ts_t ts;
+   uint32_t segment;
+   bool done = false;
+   bool eof;
+   bool ok = true;
+   char *path;
+
+   replay.client = mongoc_client_pool_pop (pool);
+   replay.batch_size = batch_size;
+
+   for (segment = 0; ok && !done; segment++) {
+      path = mongoc_oplog_segment_path (dir, segment);
+
+      if (!(reader = bson_reader_new_from_file (path, &error))) {
+         if (!segment) {
+            fprintf (stderr, "Failed to open \"%s\": %s\n", path,
+                     error.message);
+            ok = false;
+         }
+         bson_free (path);
+         break;
+      }
+
+      eof = false;
+
+      while (ok && (doc = bson_reader_read (reader, &eof))) {
+         if (until && mongoc_oplog_entry_ts (doc, &ts) &&
+             mongoc_oplog_ts_cmp (&ts, until) > 0) {
+            done = true;
+            break;
+         }
+
+         ok = mongoc_oplog_apply (&replay, doc);
+      }
+
+      if (ok && !done && !eof) {
+         fprintf (stderr, "\"%s\" is corrupt.\n", path);
+         ok = false;
+      }
+
+      bson_reader_destroy (reader);
+      bson_free (path);
+   }
+
+   ok = mongoc_oplog_flush (&replay) && ok;
+
+   fprintf (stderr, "Applied %llu entries.\n",
+            (unsigned long long)replay.n_applied);
+
+   if (replay.collection) {
+      mongoc_collection_destroy (replay.collection);
+   }
+
+   mongoc_client_pool_push (pool, replay.client);
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static void
+usage (FILE *stream)
+{
+   fprintf (stream,
+"Usage: mongoc-oplog backup [OPTIONS] DIR\n"
+"       mongoc-oplog replay [OPTIONS] DIR\n"
+"\n"
+"Options:\n"
+"\n"
+"  -h HOST      Optional hostname to connect to [127.0.0.1].\n"
+"  -p PORT      Optional port to connect to [27017].\n"
+"  --ssl        Use SSL when connecting to server.\n"
+"\n"
+"Backup options:\n"
+"\n"
+"  -t T[:I]     Optional timestamp to tail the oplog after, if DIR holds\n"
+"               no segments yet [the newest entry].\n"
+"  -s MB        Optional size of the segment files [256].\n"
+"  -f MSEC      Optional longest time new entries are kept in memory "
+"[1000].\n"
+"\n"
+"Replay options:\n"
+"\n"
+"  -t T[:I]     Optional timestamp of the last entry to apply [all].\n"
+"  -b SIZE      Optional number of entries per bulk operation [1000].\n"
+"\n");
+}
+
+
+int
+main (int argc,
+      char *argv[])
+{
+   mongoc_client_pool_t *pool;
+   mongoc_uri_t *uri;
+   const char *host = "127.0.0.1";
+   const char *dir = NULL;
+   const char *mode;
+   uint16_t port = 27017;
+   uint32_t batch_size = 1000;
+   size_t segment_size = 256 * 1024 * 1024;
+   int64_t flush_msec = 1000;
+   oplog_ts_t ts;
+   bool has_ts = false;
+   bool ssl = false;
+   char *uri_str;
+   int ret;
+   int i;
+
+   if (argc < 2 || (strcmp (argv [1], "backup") &&
+                    strcmp (argv [1], "replay"))) {
+      usage (stderr);
+      return EXIT_FAILURE;
+   }
+
+   mode = argv [1];
+
+   for (i = 2; i < argc; i++) {
+      if (0 == strcmp (argv [i], "--help")) {
+         usage (stdout);
+         return EXIT_SUCCESS;
+      } else if (0 == strcmp (argv [i], "-h") && ((i + 1) < argc)) {
+         host = argv [++i];
+      } else if (0 == strcmp (argv [i], "-p") && ((i + 1) < argc)) {
+         port = atoi (argv [++i]);
+         if (!port) {
+            fprintf (stderr, "Invalid port \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "--ssl")) {
+         ssl = true;
+      } else if (0 == strcmp (argv [i], "-t") && ((i + 1) < argc)) {
+         if (!mongoc_oplog_parse_ts (argv [++i], &ts)) {
+            fprintf (stderr, "Invalid timestamp \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+         has_ts = true;
+      } else if (0 == strcmp (argv [i], "-s") && ((i + 1) < argc)) {
+         segment_size = (size_t)atoi (argv [++i]) * 1024 * 1024;
+         if (!segment_size) {
+            fprintf (stderr, "Invalid segment size \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "-f") && ((i + 1) < argc)) {
+         flush_msec = atoi (argv [++i]);
+         if (flush_msec <= 0) {
+            fprintf (stderr, "Invalid flush interval \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "-b") && ((i + 1) < argc)) {
+         batch_size = atoi (argv [++i]);
+         if (!batch_size) {
+            fprintf (stderr, "Invalid batch size \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (!dir && argv [i][0] != '-') {
+         dir = argv [i];
+      } else {
+         fprintf (stderr, "Unknown argument \"%s\"\n", argv [i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (!dir) {
+      usage (stderr);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   uri_str = bson_strdup_printf ("mongodb://%s:%hu/?ssl=%s",
+                                 host, port, ssl ? "true" : "false");
+
+   if (!(uri = mongoc_uri_new (uri_str))) {
+      fprintf (stderr, "Invalid connection URI: %s\n", uri_str);
+      return EXIT_FAILURE;
+   }
+
+   pool = mongoc_client_pool_new (uri);
+
+   if (!strcmp (mode, "backup")) {
+      ret = mongoc_oplog_backup (pool, dir, has_ts ? &ts : NULL,
+                                 segment_size, flush_msec);
+   } else {
+      ret = mongoc_oplog_replay (pool, dir, has_ts ? &ts : NULL, batch_size);
+   }
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
+
+   mongoc_cleanup ();
+
+   return ret;
+}
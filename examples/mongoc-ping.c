@@ -18,6 +18,486 @@
 #include <mongoc.h>
 #include <stdio.h>
 
+#ifdef _WIN32
+#  define usleep(_usec) Sleep ((DWORD)((_usec) / 1000))
+#else
+#  include <unistd.h>
+#endif
+
+
+/*
+ * Without options, this example pings the server once and prints the
+ * reply. With -n or -r it becomes a latency probe: every member listed
+ * by the seed's isMaster is pinged repeatedly and the min, average and
+ * 99th percentile round trip of each is reported. With --phases, each
+ * sample connects anew, and its time is split into TCP connect, TLS
+ * handshake, the driver's isMaster and authentication, and the command.
+ */
+
+
+#define PHASE_CONNECT 0
+#define PHASE_TLS     1
+#define PHASE_AUTH    2
+#define PHASE_COMMAND 3
+#define N_PHASES      4
+
+
+static const char *phase_names [N_PHASES] = {
+   "connect", "tls", "auth", "command",
+};
+
+
+typedef struct
+{
+   int64_t *samples;
+   size_t   n_samples;
+} stats_t;
+
+
+typedef struct
+{
+   char            *host_and_port;
+   mongoc_uri_t    *uri;
+   mongoc_client_t *client;
+   stats_t          stats [N_PHASES];
+   uint32_t         n_failures;
+
+   /* set by ping_initiator() for the sample being taken */
+   int64_t          connect_usec;
+   int64_t          tls_usec;
+} member_t;
+
+
+static void
+stats_add (stats_t *stats,
+           int64_t  usec)
+{
+   stats->samples = bson_realloc (stats->samples,
+                                  (stats->n_samples + 1) *
+                                  sizeof *stats->samples);
+   stats->samples [stats->n_samples++] = usec;
+}
+
+
+static int
+stats_cmp (const void *a,
+           const void *b)
+{
+   int64_t x = *(const int64_t *)a;
+   int64_t y = *(const int64_t *)b;
+
+   return (x > y) - (x < y);
+}
+
+
+static void
+stats_print (const char    *name,
+             const stats_t *stats)
+{
+   int64_t *sorted;
+   int64_t sum = 0;
+   size_t i;
+
+   if (!stats->n_samples) {
+      return;
+   }
+
+   sorted = bson_malloc (stats->n_samples * sizeof *sorted);
+   memcpy (sorted, stats->samples, stats->n_samples * sizeof *sorted);
+   qsort (sorted, stats->n_samples, sizeof *sorted, stats_cmp);
+
+   for (i = 0; i < stats->n_samples; i++) {
+      sum += sorted [i];
+   }
+
+   fprintf (stdout, "  %-8s min %8.3fms  avg %8.3fms  p99 %8.3fms\n",
+            name,
+            sorted [0] / 1000.0,
+            (sum / (double)stats->n_samples) / 1000.0,
+            sorted [(stats->n_samples - 1) * 99 / 100] / 1000.0);
+
+   bson_free (sorted);
+}
+
+
+/*
+ * A stream initiator that times the TCP connect and the TLS handshake of
+ * the connection the driver opens for a sample.
+ */
+static mongoc_stream_t *
+ping_initiator (const mongoc_uri_t       *uri,
+                const mongoc_host_list_t *host,
+                void                     *user_data,
+                bson_error_t             *error)
+{
+   struct addrinfo hints = { 0 };
+   struct addrinfo *result;
+   member_t *member = user_data;
+   mongoc_socket_t *sock;
+   mongoc_stream_t *stream;
+   int64_t start;
+   char portstr [8];
+   int flag = 1;
+
+   bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
+   hints.ai_family = host->family;
+   hints.ai_socktype = SOCK_STREAM;
+
+   start = bson_get_monotonic_time ();
+
+   if (0 != getaddrinfo (host->host, portstr, &hints, &result)) {
+      bson_set_error (error, MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NAME_RESOLUTION,
+                      "Failed to resolve %s", host->host);
+      return NULL;
+   }
+
+   sock = mongoc_socket_new (result->ai_family, SOCK_STREAM, 0);
+
+   if (!sock ||
+       0 != mongoc_socket_connect (sock, result->ai_addr,
+                                   (socklen_t)result->ai_addrlen,
+                                   start + 10 * 1000 * 1000)) {
+      bson_set_error (error, MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_CONNECT,
+                      "Failed to connect to %s", host->host_and_port);
+      if (sock) {
+         mongoc_socket_destroy (sock);
+      }
+      freeaddrinfo (result);
+      return NULL;
+   }
+
+   freeaddrinfo (result);
+   mongoc_socket_setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &flag,
+                             sizeof flag);
+   stream = mongoc_stream_socket_new (sock);
+
+   member->connect_usec = bson_get_monotonic_time () - start;
+   member->tls_usec = 0;
+
+#ifdef MONGOC_ENABLE_SSL
+   if (mongoc_uri_get_ssl (uri)) {
+      start = bson_get_monotonic_time ();
+      stream = mongoc_stream_tls_new (stream,
+                                      (mongoc_ssl_opt_t *)
+                                      mongoc_ssl_opt_get_default (),
+                                      true);
+
+      if (!stream ||
+          !mongoc_stream_tls_do_handshake (stream, 10 * 1000) ||
+          !mongoc_stream_tls_check_cert (stream, host->host)) {
+         bson_set_error (error, MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Failed the TLS handshake with %s",
+                         host->host_and_port);
+         if (stream) {
+            mongoc_stream_destroy (stream);
+         }
+         return NULL;
+      }
+
+      member->tls_usec = bson_get_monotonic_time () - start;
+   }
+#endif
+
+   return mongoc_stream_buffered_new (stream, 1024);
+}
+
+
+static bool
+ping_command (mongoc_client_t *client,
+              int64_t         *usec,
+              bson_error_t    *error)
+{
+   int64_t start;
+   bson_t ping;
+   bool ret;
+
+   bson_init (&ping);
+   bson_append_int32 (&ping, "ping", 4, 1);
+
+   start = bson_get_monotonic_time ();
+   ret = mongoc_client_command_simple (client, "admin", &ping, NULL, NULL,
+                                       error);
+   *usec = bson_get_monotonic_time () - start;
+
+   bson_destroy (&ping);
+
+   return ret;
+}
+
+
+static bool
+ping_member (member_t     *member,
+             bool          phases,
+             bson_error_t *error)
+{
+   int64_t first;
+   int64_t command;
+   bool ret;
+
+   if (!phases) {
+      if (!member->client) {
+         /* connect first, so every sample times the command only */
+         member->client = mongoc_client_new_from_uri (member->uri);
+         if (!ping_command (member->client, &command, error)) {
+            mongoc_client_destroy (member->client);
+            member->client = NULL;
+            return false;
+         }
+      }
+
+      if (!ping_command (member->client, &command, error)) {
+         return false;
+      }
+
+      stats_add (&member->stats [PHASE_COMMAND], command);
+
+      return true;
+   }
+
+   /* the first ping connects, the second times the command alone */
+   member->client = mongoc_client_new_from_uri (member->uri);
+   mongoc_client_set_stream_initiator (member->client, ping_initiator, member);
+
+   ret = ping_command (member->client, &first, error) &&
+         ping_command (member->client, &command, error);
+
+   if (ret) {
+      stats_add (&member->stats [PHASE_CONNECT], member->connect_usec);
+      stats_add (&member->stats [PHASE_TLS], member->tls_usec);
+      stats_add (&member->stats [PHASE_AUTH],
+                 BSON_MAX (0, first - command - member->connect_usec -
+                           member->tls_usec));
+      stats_add (&member->stats [PHASE_COMMAND], command);
+   }
+
+   mongoc_client_destroy (member->client);
+   member->client = NULL;
+
+   return ret;
+}
+
+
+static char *
+member_uri_string (const mongoc_uri_t *seed,
+                   const char         *host_and_port)
+{
+   const char *mechanism;
+   const char *password;
+   const char *source;
+   const char *user;
+   bson_string_t *str;
+
+   str = bson_string_new ("mongodb://");
+
+   if ((user = mongoc_uri_get_username (seed))) {
+      password = mongoc_uri_get_password (seed);
+      bson_string_append_printf (str, "%s:%s@", user,
+                                 password ? password : "");
+   }
+
+   bson_string_append_printf (str, "%s/", host_and_port);
+
+   if ((source = mongoc_uri_get_auth_source (seed))) {
+      bson_string_append (str, source);
+   }
+
+   bson_string_append_printf (str, "?ssl=%s",
+                              mongoc_uri_get_ssl (seed) ? "true" : "false");
+
+   if ((mechanism = mongoc_uri_get_auth_mechanism (seed))) {
+      bson_string_append_printf (str, "&authMechanism=%s", mechanism);
+   }
+
+   return bson_string_free (str, false);
+}
+
+
+static void
+members_add (member_t           **members,
+             size_t              *n_members,
+             const mongoc_uri_t  *seed,
+             const char          *host_and_port)
+{
+   member_t *member;
+   char *uri_str;
+   size_t i;
+
+   for (i = 0; i < *n_members; i++) {
+      if (!strcmp ((*members) [i].host_and_port, host_and_port)) {
+         return;
+      }
+   }
+
+   *members = bson_realloc (*members, (*n_members + 1) * sizeof **members);
+   member = &(*members) [(*n_members)++];
+   memset (member, 0, sizeof *member);
+
+   uri_str = member_uri_string (seed, host_and_port);
+   member->host_and_port = bson_strdup (host_and_port);
+   member->uri = mongoc_uri_new (uri_str);
+   bson_free (uri_str);
+}
+
+
+/*
+ * Lists the members the seed knows of, or the seeds themselves when it's
+ * a standalone or a mongos.
+ */
+static member_t *
+members_discover (mongoc_client_t *client,
+                  size_t          *n_members)
+{
+   const mongoc_host_list_t *host;
+   const mongoc_uri_t *seed;
+   member_t *members = NULL;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t reply;
+   const char *fields [] = { "hosts", "passives" };
+   int i;
+
+   *n_members = 0;
+   seed = mongoc_client_get_uri (client);
+
+   bson_append_int32 (&cmd, "isMaster", 8, 1);
+
+   if (mongoc_client_command_simple (client, "admin", &cmd, NULL, &reply,
+                                     &error)) {
+      for (i = 0; i < 2; i++) {
+         if (bson_iter_init_find (&iter, &reply, fields [i]) &&
+             BSON_ITER_HOLDS_ARRAY (&iter) &&
+             bson_iter_recurse (&iter, &child)) {
+            while (bson_iter_next (&child)) {
+               if (BSON_ITER_HOLDS_UTF8 (&child)) {
+                  members_add (&members, n_members, seed,
+                               bson_iter_utf8 (&child, NULL));
+               }
+            }
+         }
+      }
+   } else {
+      fprintf (stderr, "isMaster failure: %s\n", error.message);
+   }
+
+   if (!*n_members) {
+      for (host = mongoc_uri_get_hosts (seed); host; host = host->next) {
+         members_add (&members, n_members, seed, host->host_and_port);
+      }
+   }
+
+   bson_destroy (&reply);
+   bson_destroy (&cmd);
+
+   return members;
+}
+
+
+static void
+members_report (member_t *members,
+                size_t    n_members,
+                bool      phases)
+{
+   size_t i;
+   int j;
+
+   for (i = 0; i < n_members; i++) {
+      fprintf (stdout, "%s: %u samples, %u failures\n",
+               members [i].host_and_port,
+               (unsigned)members [i].stats [PHASE_COMMAND].n_samples,
+               members [i].n_failures);
+
+      for (j = phases ? 0 : PHASE_COMMAND; j < N_PHASES; j++) {
+         stats_print (phase_names [j], &members [i].stats [j]);
+      }
+   }
+
+   fflush (stdout);
+}
+
+
+static int
+probe (mongoc_client_t *client,
+       uint32_t         count,
+       double           rate,
+       bool             phases)
+{
+   member_t *members;
+   bson_error_t error;
+   size_t n_members;
+   int64_t interval;
+   int64_t next;
+   int64_t now;
+   uint32_t round;
+   size_t i;
+   int j;
+
+   if (!(members = members_discover (client, &n_members))) {
+      return 3;
+   }
+
+   interval = (int64_t)(1000000 / rate);
+   next = bson_get_monotonic_time ();
+
+   for (round = 1; !count || round <= count; round++) {
+      for (i = 0; i < n_members; i++) {
+         if (!ping_member (&members [i], phases, &error)) {
+            fprintf (stderr, "%s: ping failure: %s\n",
+                     members [i].host_and_port, error.message);
+            members [i].n_failures++;
+         }
+      }
+
+      /* in continuous mode, report every 10 seconds worth of rounds */
+      if (!count && round % BSON_MAX (1, (uint32_t)(rate * 10)) == 0) {
+         members_report (members, n_members, phases);
+      }
+
+      next += interval;
+      now = bson_get_monotonic_time ();
+
+      if (next > now) {
+         usleep (next - now);
+      } else {
+         next = now;
+      }
+   }
+
+   members_report (members, n_members, phases);
+
+   for (i = 0; i < n_members; i++) {
+      for (j = 0; j < N_PHASES; j++) {
+         bson_free (members [i].stats [j].samples);
+      }
+      if (members [i].client) {
+         mongoc_client_destroy (members [i].client);
+      }
+      mongoc_uri_destroy (members [i].uri);
+      bson_free (members [i].host_and_port);
+   }
+
+   bson_free (members);
+
+   return 0;
+}
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [OPTIONS] HOSTNAME|URI [PORT]\n"
+            "\n"
+            "  -n COUNT   Ping every member COUNT times, 0 for no end.\n"
+            "  -r RATE    Rounds of pings per second [1].\n"
+            "  --phases   Connect for each ping and time each phase.\n",
+            prog);
+}
+
 
 int
 main (int   argc,
@@ -32,9 +512,35 @@ main (int   argc,
    bson_t ping;
    char *host_and_port;
    char *str;
+   const char *prog = argv[0];
+   uint32_t count = 1;
+   double rate = 1;
+   bool probing = false;
+   bool phases = false;
+   int ret = 0;
 
-   if (argc < 2 || argc > 3) {
-      fprintf(stderr, "usage: %s HOSTNAME [PORT]\n", argv[0]);
+   while (argc > 1 && argv[1][0] == '-') {
+      if (0 == strcmp (argv[1], "-n") && argc > 2) {
+         count = atoi (argv[2]);
+      } else if (0 == strcmp (argv[1], "-r") && argc > 2) {
+         rate = atof (argv[2]);
+      } else if (0 == strcmp (argv[1], "--phases")) {
+         phases = true;
+         argc--;
+         argv++;
+         probing = true;
+         continue;
+      } else {
+         usage (prog);
+         return 1;
+      }
+      argc -= 2;
+      argv += 2;
+      probing = true;
+   }
+
+   if (argc < 2 || argc > 3 || rate <= 0) {
+      usage (prog);
       return 1;
    }
 
@@ -55,6 +561,14 @@ main (int   argc,
       return 2;
    }
 
+   if (probing) {
+      ret = probe (client, count, rate, phases);
+      mongoc_client_destroy (client);
+      bson_free (host_and_port);
+      mongoc_cleanup ();
+      return ret;
+   }
+
    bson_init(&ping);
    bson_append_int32(&ping, "ping", 4, 1);
    database = mongoc_client_get_database(client, "test");
@@ -73,5 +587,5 @@ main (int   argc,
    mongoc_client_destroy(client);
    bson_free(host_and_port);
 
-   return 0;
+   return ret;
 }
@@ -0,0 +1,784 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <bson.h>
+#include <fcntl.h>
+#include <mongoc.h>
+
+#if !defined(_WIN32)
+#  include <dirent.h>
+#  include <pthread.h>
+#  include <unistd.h>
+#  define Mutex                   pthread_mutex_t
+#  define Mutex_Init(_n)          pthread_mutex_init((_n), NULL)
+#  define Mutex_Lock              pthread_mutex_lock
+#  define Mutex_Unlock            pthread_mutex_unlock
+#  define Mutex_Destroy           pthread_mutex_destroy
+#  define Cond                    pthread_cond_t
+#  define Cond_Init(_n)           pthread_cond_init((_n), NULL)
+#  define Cond_Wait               pthread_cond_wait
+#  define Cond_Broadcast          pthread_cond_broadcast
+#  define Cond_Destroy            pthread_cond_destroy
+#  define Thread                  pthread_t
+#  define Thread_Create(_t,_f,_d) pthread_create((_t), NULL, (_f), (_d))
+#  define Thread_Join(_n)         pthread_join((_n), NULL)
+#else
+#  include <io.h>
+#  define Mutex                   CRITICAL_SECTION
+#  define Mutex_Init              InitializeCriticalSection
+#  define Mutex_Lock              EnterCriticalSection
+#  define Mutex_Unlock            LeaveCriticalSection
+#  define Mutex_Destroy           DeleteCriticalSection
+#  define Cond                    CONDITION_VARIABLE
+#  define Cond_Init               InitializeConditionVariable
+#  define Cond_Wait(_c,_m)        SleepConditionVariableCS((_c), (_m), INFINITE)
+#  define Cond_Broadcast          WakeAllConditionVariable
+#  define Cond_Destroy(_c)
+#  define Thread                  HANDLE
+#  define Thread_Create(_t,_f,_d) \
+      ((*(_t) = CreateThread (NULL, 0, (LPTHREAD_START_ROUTINE)(_f), \
+                              (_d), 0, NULL)) ? 0 : -1)
+#  define Thread_Join(_n)         WaitForSingleObject ((_n), INFINITE)
+#endif
+
+
+/*
+ * The number of batches read ahead of the writers. Reading is much
+ * faster than inserting, so this only needs to keep every writer busy.
+ */
+#define RESTORE_QUEUE_LEN 16
+
+
+typedef struct
+{
+   char     *database;
+   char     *collection;
+   bson_t  **docs;
+   uint32_t  n_docs;
+} restore_batch_t;
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   uint32_t              batch_size;
+
+   /* batches waiting for a writer */
+   Mutex                 mutex;
+   Cond                  cond;
+   restore_batch_t      *queue [RESTORE_QUEUE_LEN];
+   size_t                queue_head;
+   size_t                queue_len;
+   bool                  done;
+   bool                  failed;
+} restore_t;
+
+
+static char *
+restore_strip_suffix (const char *name,
+                      const char *suffix)
+{
+   size_t name_len = strlen (name);
+   size_t suffix_len = strlen (suffix);
+
+   if (name_len <= suffix_len ||
+       0 != strcmp (name + name_len - suffix_len, suffix)) {
+      return NULL;
+   }
+
+   return bson_strndup (name, name_len - suffix_len);
+}
+
+
+static char **
+restore_list_dir (const char *path)
+{
+   char **names = NULL;
+   size_t n_names = 0;
+#ifdef _WIN32
+   WIN32_FIND_DATAA data;
+   HANDLE handle;
+   char *pattern;
+
+   pattern = bson_strdup_printf ("%s\\*", path);
+   handle = FindFirstFileA (pattern, &data);
+   bson_free (pattern);
+
+   if (handle == INVALID_HANDLE_VALUE) {
+      return NULL;
+   }
+
+   do {
+      if (0 != strcmp (data.cFileName, ".") &&
+          0 != strcmp (data.cFileName, "..")) {
+         names = bson_realloc (names, (n_names + 2) * sizeof *names);
+         names [n_names++] = bson_strdup (data.cFileName);
+      }
+   } while (FindNextFileA (handle, &data));
+
+   FindClose (handle);
+#else
+   struct dirent *entry;
+   DIR *dir;
+
+   if (!(dir = opendir (path))) {
+      return NULL;
+   }
+
+   while ((entry = readdir (dir))) {
+      if (0 != strcmp (entry->d_name, ".") &&
+          0 != strcmp (entry->d_name, "..")) {
+         names = bson_realloc (names, (n_names + 2) * sizeof *names);
+         names [n_names++] = bson_strdup (entry->d_name);
+      }
+   }
+
+   closedir (dir);
+#endif
+
+   if (!names) {
+      names = bson_malloc (sizeof *names);
+   }
+
+   names [n_names] = NULL;
+
+   return names;
+}
+
+
+static void
+restore_batch_destroy (restore_batch_t *batch)
+{
+   uint32_t i;
+
+   for (i = 0; i < batch->n_docs; i++) {
+      bson_destroy (batch->docs [i]);
+   }
+
+   bson_free (batch->docs);
+   bson_free (batch->database);
+   bson_free (batch->collection);
+   bson_free (batch);
+}
+
+
+/*
+ * Hands @batch to the writers, waiting while the queue is full. Returns
+ * false once a writer failed, and @batch is dropped.
+ */
+static bool
+restore_push_batch (restore_t       *restore,
+                    restore_batch_t *batch)
+{
+   bool ret;
+
+   Mutex_Lock (&restore->mutex);
+
+   while (!restore->failed && restore->queue_len == RESTORE_QUEUE_LEN) {
+      Cond_Wait (&restore->cond, &restore->mutex);
+   }
+
+   if ((ret = !restore->failed)) {
+      restore->queue [(restore->queue_head + restore->queue_len++) %
+                      RESTORE_QUEUE_LEN] = batch;
+      Cond_Broadcast (&restore->cond);
+   }
+
+   Mutex_Unlock (&restore->mutex);
+
+   if (!ret) {
+      restore_batch_destroy (batch);
+   }
+
+   return ret;
+}
+
+
+static restore_batch_t *
+restore_pop_batch (restore_t *restore)
+{
+   restore_batch_t *batch = NULL;
+
+   Mutex_Lock (&restore->mutex);
+
+   while (!restore->failed && !restore->done && !restore->queue_len) {
+      Cond_Wait (&restore->cond, &restore->mutex);
+   }
+
+   if (!restore->failed && restore->queue_len) {
+      batch = restore->queue [restore->queue_head];
+      restore->queue_head = (restore->queue_head + 1) % RESTORE_QUEUE_LEN;
+      restore->queue_len--;
+      Cond_Broadcast (&restore->cond);
+   }
+
+   Mutex_Unlock (&restore->mutex);
+
+   return batch;
+}
+
+
+static void
+restore_fail (restore_t *restore)
+{
+   Mutex_Lock (&restore->mutex);
+   restore->failed = true;
+   Cond_Broadcast (&restore->cond);
+   Mutex_Unlock (&restore->mutex);
+}
+
+
+static bool
+restore_write_batch (mongoc_client_t *client,
+                     restore_batch_t *batch)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   bson_error_t error;
+   bson_t reply;
+   bool ret;
+   uint32_t i;
+
+   collection = mongoc_client_get_collection (client, batch->database,
+                                              batch->collection);
+
+   /* unordered, so the server needn't stop at the first error */
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+
+   for (i = 0; i < batch->n_docs; i++) {
+      mongoc_bulk_operation_insert (bulk, batch->docs [i]);
+   }
+
+   if (!(ret = !!mongoc_bulk_operation_execute (bulk, &reply, &error))) {
+      fprintf (stderr, "Failed to restore %s.%s: %s\n", batch->database,
+               batch->collection, error.message);
+   }
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+
+   return ret;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI
+#else
+static void *
+#endif
+restore_writer (void *data)
+{
+   restore_t *restore = data;
+   restore_batch_t *batch;
+   mongoc_client_t *client;
+
+   client = mongoc_client_pool_pop (restore->pool);
+
+   while ((batch = restore_pop_batch (restore))) {
+      if (!restore_write_batch (client, batch)) {
+         restore_fail (restore);
+      }
+      restore_batch_destroy (batch);
+   }
+
+   mongoc_client_pool_push (restore->pool, client);
+
+   return 0;
+}
+
+
+static ssize_t
+restore_stream_read (void   *handle,
+                     void   *buf,
+                     size_t  count)
+{
+   return mongoc_stream_read (handle, buf, count, 0, -1);
+}
+
+
+static void
+restore_stream_destroy (void *handle)
+{
+   mongoc_stream_destroy (handle);
+}
+
+
+/*
+ * Opens a file written by mongoc-dump, .bson.z files having been written
+ * through a zlib compressed stream.
+ */
+static bson_reader_t *
+restore_open (const char *path,
+              bool        compressed)
+{
+   mongoc_stream_t *stream;
+   mongoc_stream_t *file;
+   int fd;
+
+   if (!compressed) {
+#ifdef _WIN32
+      fd = _open (path, _O_RDONLY | _O_BINARY);
+#else
+      fd = open (path, O_RDONLY);
+#endif
+      return fd == -1 ? NULL : bson_reader_new_from_fd (fd, true);
+   }
+
+   if (!(file = mongoc_stream_file_new_for_path (path, O_RDONLY, 0))) {
+      return NULL;
+   }
+
+   if (!(stream = mongoc_stream_compressed_new (file, "zlib"))) {
+      mongoc_stream_destroy (file);
+      return NULL;
+   }
+
+   return bson_reader_new_from_handle (stream, restore_stream_read,
+                                       restore_stream_destroy);
+}
+
+
+static bool
+restore_collection (restore_t  *restore,
+                    const char *database,
+                    const char *collection,
+                    const char *path,
+                    bool        compressed)
+{
+   restore_batch_t *batch = NULL;
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bool eof = false;
+   bool ret = true;
+
+   if (!(reader = restore_open (path, compressed))) {
+      fprintf (stderr, "Failed to open \"%s\".\n", path);
+      return false;
+   }
+
+   while (ret && (doc = bson_reader_read (reader, &eof))) {
+      if (!batch) {
+         batch = bson_malloc0 (sizeof *batch);
+         batch->database = bson_strdup (database);
+         batch->collection = bson_strdup (collection);
+         batch->docs = bson_malloc (restore->batch_size * sizeof *batch->docs);
+      }
+
+      batch->docs [batch->n_docs++] = bson_copy (doc);
+
+      if (batch->n_docs == restore->batch_size) {
+         ret = restore_push_batch (restore, batch);
+         batch = NULL;
+      }
+   }
+
+   if (ret && !eof) {
+      fprintf (stderr, "Corrupt document in \"%s\".\n", path);
+      ret = false;
+   }
+
+   if (batch) {
+      if (ret) {
+         ret = restore_push_batch (restore, batch);
+      } else {
+         restore_batch_destroy (batch);
+      }
+   }
+
+   bson_reader_destroy (reader);
+
+   return ret;
+}
+
+
+/*
+ * Creates the indexes saved in a system.indexes file, once the data are
+ * loaded, which is much faster than maintaining them during the load.
+ * The indexes of each collection are built by one createIndexes command.
+ */
+static bool
+restore_indexes (mongoc_client_t *client,
+                 const char      *database,
+                 const char      *path)
+{
+   mongoc_collection_t *collection;
+   mongoc_index_opt_t *opts = NULL;
+   const mongoc_index_opt_t **coll_opts;
+   const bson_t **coll_keys;
+   bson_reader_t *reader;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   uint32_t data_len;
+   const uint8_t *data;
+   const char *key;
+   size_t db_len;
+   bson_t **keys = NULL;
+   char **names = NULL;
+   char **colls = NULL;
+   bool *done;
+   bool eof = false;
+   bool ret = true;
+   size_t n = 0;
+   size_t i;
+   size_t j;
+   uint32_t k;
+
+   if (!(reader = bson_reader_new_from_file (path, &error))) {
+      fprintf (stderr, "Failed to open \"%s\": %s\n", path, error.message);
+      return false;
+   }
+
+   db_len = strlen (database);
+
+   while ((doc = bson_reader_read (reader, &eof))) {
+      keys = bson_realloc (keys, (n + 1) * sizeof *keys);
+      names = bson_realloc (names, (n + 1) * sizeof *names);
+      colls = bson_realloc (colls, (n + 1) * sizeof *colls);
+      opts = bson_realloc (opts, (n + 1) * sizeof *opts);
+
+      keys [n] = NULL;
+      names [n] = NULL;
+      colls [n] = NULL;
+      mongoc_index_opt_init (&opts [n]);
+
+      if (bson_iter_init (&iter, doc)) {
+         while (bson_iter_next (&iter)) {
+            key = bson_iter_key (&iter);
+
+            if (!strcmp (key, "key") && BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+               bson_iter_document (&iter, &data_len, &data);
+               keys [n] = bson_new_from_data (data, data_len);
+            } else if (!strcmp (key, "ns") && BSON_ITER_HOLDS_UTF8 (&iter)) {
+               key = bson_iter_utf8 (&iter, NULL);
+               if (!strncmp (key, database, db_len) && key [db_len] == '.') {
+                  colls [n] = bson_strdup (key + db_len + 1);
+               }
+            } else if (!strcmp (key, "name") && BSON_ITER_HOLDS_UTF8 (&iter)) {
+               names [n] = bson_strdup (bson_iter_utf8 (&iter, NULL));
+            } else if (!strcmp (key, "unique")) {
+               opts [n].unique = bson_iter_as_bool (&iter);
+            } else if (!strcmp (key, "sparse")) {
+               opts [n].sparse = bson_iter_as_bool (&iter);
+            } else if (!strcmp (key, "dropDups")) {
+               opts [n].drop_dups = bson_iter_as_bool (&iter);
+            } else if (!strcmp (key, "expireAfterSeconds")) {
+               opts [n].expire_after_seconds =
+                  (int32_t)bson_iter_as_int64 (&iter);
+            } else if (!strcmp (key, "v")) {
+               opts [n].v = (int32_t)bson_iter_as_int64 (&iter);
+            }
+         }
+      }
+
+      opts [n].name = names [n];
+
+      /* the _id index was built with the collection */
+      if (!keys [n] || !colls [n] || !names [n] ||
+          !strcmp (names [n], "_id_")) {
+         if (keys [n]) {
+            bson_destroy (keys [n]);
+         }
+         bson_free (names [n]);
+         bson_free (colls [n]);
+         continue;
+      }
+
+      n++;
+   }
+
+   bson_reader_destroy (reader);
+
+   if (!eof) {
+      fprintf (stderr, "Corrupt document in \"%s\".\n", path);
+      ret = false;
+   }
+
+   done = bson_malloc0 (n * sizeof *done);
+   coll_keys = bson_malloc (n * sizeof *coll_keys);
+   coll_opts = bson_malloc (n * sizeof *coll_opts);
+
+   for (i = 0; ret && i < n; i++) {
+      if (done [i]) {
+         continue;
+      }
+
+      for (j = i, k = 0; j < n; j++) {
+         if (!done [j] && !strcmp (colls [i], colls [j])) {
+            coll_keys [k] = keys [j];
+            coll_opts [k++] = &opts [j];
+            done [j] = true;
+         }
+      }
+
+      collection = mongoc_client_get_collection (client, database, colls [i]);
+
+      if (!mongoc_collection_create_indexes (collection, coll_keys, coll_opts,
+                                             k, &error)) {
+         fprintf (stderr, "Failed to create the indexes of %s.%s: %s\n",
+                  database, colls [i], error.message);
+         ret = false;
+      }
+
+      mongoc_collection_destroy (collection);
+   }
+
+   for (i = 0; i < n; i++) {
+      bson_destroy (keys [i]);
+      bson_free (names [i]);
+      bson_free (colls [i]);
+   }
+
+   bson_free (coll_opts);
+   bson_free (coll_keys);
+   bson_free (done);
+   bson_free (opts);
+   bson_free (colls);
+   bson_free (names);
+   bson_free (keys);
+
+   return ret;
+}
+
+
+static bool
+restore_database (restore_t  *restore,
+                  const char *database)
+{
+   char *collection;
+   char *path;
+   char **str;
+   bool compressed;
+   bool ret = true;
+   int i;
+
+   path = bson_strdup_printf ("dump/%s", database);
+   str = restore_list_dir (path);
+   bson_free (path);
+
+   if (!str) {
+      fprintf (stderr, "Failed to list \"dump/%s\".\n", database);
+      return false;
+   }
+
+   for (i = 0; ret && str [i]; i++) {
+      compressed = false;
+
+      if (!(collection = restore_strip_suffix (str [i], ".bson"))) {
+         if (!(collection = restore_strip_suffix (str [i], ".bson.z"))) {
+            continue;
+         }
+         compressed = true;
+      }
+
+      /* indexes are created once every collection is loaded */
+      if (strcmp (collection, "system.indexes") != 0) {
+         path = bson_strdup_printf ("dump/%s/%s", database, str [i]);
+         ret = restore_collection (restore, database, collection, path,
+                                   compressed);
+         bson_free (path);
+      }
+
+      bson_free (collection);
+   }
+
+   bson_strfreev (str);
+
+   return ret;
+}
+
+
+static int
+restore (restore_t  *restore,
+         const char *database,
+         uint32_t    n_writers)
+{
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t reply;
+   bson_t cmd = BSON_INITIALIZER;
+   Thread *threads;
+   char **databases;
+   char *path;
+   bool ok = true;
+   size_t n_threads = 0;
+   size_t i;
+
+   if (database) {
+      databases = bson_malloc0 (2 * sizeof *databases);
+      databases [0] = bson_strdup (database);
+   } else if (!(databases = restore_list_dir ("dump"))) {
+      perror ("Failed to list \"dump\"");
+      return EXIT_FAILURE;
+   }
+
+   /* batches are made as large as the server takes in one command */
+   client = mongoc_client_pool_pop (restore->pool);
+   restore->batch_size = 1000;
+
+   BSON_APPEND_INT32 (&cmd, "isMaster", 1);
+   if (mongoc_client_command_simple (client, "admin", &cmd, NULL, &reply,
+                                     &error)) {
+      if (bson_iter_init_find (&iter, &reply, "maxWriteBatchSize") &&
+          BSON_ITER_HOLDS_INT32 (&iter) &&
+          bson_iter_int32 (&iter) > 0) {
+         restore->batch_size = (uint32_t)bson_iter_int32 (&iter);
+      }
+   } else {
+      fprintf (stderr, "Failed to connect: %s\n", error.message);
+      ok = false;
+   }
+   bson_destroy (&reply);
+   bson_destroy (&cmd);
+
+   threads = bson_malloc (n_writers * sizeof *threads);
+
+   for (i = 0; ok && i < n_writers; i++) {
+      Thread_Create (&threads [n_threads++], restore_writer, restore);
+   }
+
+   for (i = 0; ok && databases [i]; i++) {
+      ok = restore_database (restore, databases [i]);
+   }
+
+   Mutex_Lock (&restore->mutex);
+   restore->done = true;
+   Cond_Broadcast (&restore->cond);
+   Mutex_Unlock (&restore->mutex);
+
+   for (i = 0; i < n_threads; i++) {
+      Thread_Join (threads [i]);
+   }
+
+   bson_free (threads);
+
+   ok = ok && !restore->failed;
+
+   for (i = 0; ok && databases [i]; i++) {
+      path = bson_strdup_printf ("dump/%s/system.indexes.bson",
+                                 databases [i]);
+#ifdef _WIN32
+      if (0 == _access (path, 0)) {
+#else
+      if (0 == access (path, F_OK)) {
+#endif
+         ok = restore_indexes (client, databases [i], path);
+      }
+      bson_free (path);
+   }
+
+   mongoc_client_pool_push (restore->pool, client);
+   bson_strfreev (databases);
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+static void
+usage (FILE *stream)
+{
+   fprintf (stream,
+"Usage: mongoc-restore [OPTIONS]\n"
+"\n"
+"Restores the \"dump\" directory written by mongoc-dump.\n"
+"\n"
+"Options:\n"
+"\n"
+"  -h HOST      Optional hostname to connect to [127.0.0.1].\n"
+"  -p PORT      Optional port to connect to [27017].\n"
+"  -d DBNAME    Optional database name to restore.\n"
+"  -j JOBS      Optional number of concurrent bulk writers [4].\n"
+"  --ssl        Use SSL when connecting to server.\n"
+"\n");
+}
+
+
+int
+main (int argc,
+      char *argv[])
+{
+   restore_t rs = { 0 };
+   mongoc_uri_t *uri;
+   const char *database = NULL;
+   const char *host = "127.0.0.1";
+   uint16_t port = 27017;
+   uint32_t n_writers = 4;
+   bool ssl = false;
+   char *uri_str;
+   int ret;
+   int i;
+
+   mongoc_init ();
+
+   for (i = 1; i < argc; i++) {
+      if (0 == strcmp (argv [i], "-d") && ((i + 1) < argc)) {
+         database = argv [++i];
+      } else if (0 == strcmp (argv [i], "--help")) {
+         usage (stdout);
+         return EXIT_SUCCESS;
+      } else if (0 == strcmp (argv [i], "-h") && ((i + 1) < argc)) {
+         host = argv [++i];
+      } else if (0 == strcmp (argv [i], "-j") && ((i + 1) < argc)) {
+         n_writers = atoi (argv [++i]);
+         if (!n_writers) {
+            fprintf (stderr, "Invalid number of jobs \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else if (0 == strcmp (argv [i], "--ssl")) {
+         ssl = true;
+      } else if (0 == strcmp (argv [i], "-p") && ((i + 1) < argc)) {
+         port = atoi (argv [++i]);
+         if (!port) {
+            fprintf (stderr, "Invalid port \"%s\"", argv [i]);
+            return EXIT_FAILURE;
+         }
+      } else {
+         fprintf (stderr, "Unknown argument \"%s\"\n", argv [i]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   /* a client for each writer, plus one to create the indexes */
+   uri_str = bson_strdup_printf ("mongodb://%s:%hu/?ssl=%s&maxpoolsize=%u",
+                                 host,
+                                 port,
+                                 ssl ? "true" : "false",
+                                 n_writers + 1);
+
+   if (!(uri = mongoc_uri_new (uri_str))) {
+      fprintf (stderr, "Invalid connection URI: %s\n", uri_str);
+      return EXIT_FAILURE;
+   }
+
+   rs.pool = mongoc_client_pool_new (uri);
+   Mutex_Init (&rs.mutex);
+   Cond_Init (&rs.cond);
+
+   ret = restore (&rs, database, n_writers);
+
+   Cond_Destroy (&rs.cond);
+   Mutex_Destroy (&rs.mutex);
+   mongoc_client_pool_destroy (rs.pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
+
+   mongoc_cleanup ();
+
+   return ret;
+}
@@ -2,10 +2,7 @@
 #include <mongoc.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-#ifdef _WIN32
-#define sleep(_n) Sleep((_n) * 1000)
-#endif
+#include <time.h>
 
 
 static void
@@ -19,73 +16,42 @@ print_bson (const bson_t *b)
 }
 
 
-static mongoc_cursor_t *
-query_collection (mongoc_collection_t *collection,
-                  uint32_t        last_time)
+static void
+tail_oplog (mongoc_client_pool_t *pool)
 {
-   mongoc_cursor_t *cursor;
+   mongoc_tailer_t *tailer;
+   const bson_t *doc;
+   bson_error_t error;
    bson_t query;
    bson_t gt;
 
-   BSON_ASSERT(collection);
+   BSON_ASSERT(pool);
 
    bson_init(&query);
    bson_append_document_begin(&query, "ts", 2, &gt);
-   bson_append_timestamp(&gt, "$gt", 3, last_time, 0);
+   bson_append_timestamp(&gt, "$gt", 3, (uint32_t)time(NULL), 0);
    bson_append_document_end(&query, &gt);
 
-   cursor = mongoc_collection_find(collection,
-                                   (MONGOC_QUERY_TAILABLE_CURSOR |
-                                    MONGOC_QUERY_AWAIT_DATA |
-                                    MONGOC_QUERY_SLAVE_OK),
-                                   0,
-                                   0,
-                                   0,
-                                   &query,
-                                   NULL,
-                                   NULL);
+   /*
+    * The tailer resumes after the last "ts" it received whenever the
+    * cursor is lost, so there is no need to query again by hand.
+    */
+   tailer = mongoc_tailer_new(pool, "local", "oplog.rs", &query, "ts",
+                              (MONGOC_QUERY_OPLOG_REPLAY |
+                               MONGOC_QUERY_SLAVE_OK),
+                              0);
 
    bson_destroy(&query);
 
-   return cursor;
-}
-
+   while ((doc = mongoc_tailer_next(tailer, -1))) {
+      print_bson(doc);
+   }
 
-static void
-tail_collection (mongoc_collection_t *collection)
-{
-   mongoc_cursor_t *cursor;
-   uint32_t last_time;
-   const bson_t *doc;
-   bson_error_t error;
-   bson_iter_t iter;
-
-   BSON_ASSERT(collection);
-
-   last_time = (uint32_t)time(NULL);
-
-   while (true) {
-      cursor = query_collection(collection, last_time);
-      while (!mongoc_cursor_error(cursor, &error) &&
-             mongoc_cursor_more(cursor)) {
-         if (mongoc_cursor_next(cursor, &doc)) {
-            if (bson_iter_init_find(&iter, doc, "ts") &&
-                BSON_ITER_HOLDS_TIMESTAMP(&iter)) {
-               bson_iter_timestamp(&iter, &last_time, NULL);
-            }
-            print_bson(doc);
-         }
-      }
-      if (mongoc_cursor_error(cursor, &error)) {
-         if ((error.domain == MONGOC_ERROR_QUERY) &&
-             (error.code == MONGOC_ERROR_QUERY_NOT_TAILABLE)) {
-            fprintf(stderr, "%s\n", error.message);
-            exit(1);
-         }
-      }
-      mongoc_cursor_destroy(cursor);
-      sleep(1);
+   if (mongoc_tailer_error(tailer, &error)) {
+      fprintf(stderr, "%s\n", error.message);
    }
+
+   mongoc_tailer_destroy(tailer);
 }
 
 
@@ -93,8 +59,8 @@ int
 main (int   argc,
       char *argv[])
 {
-   mongoc_collection_t *collection;
-   mongoc_client_t *client;
+   mongoc_client_pool_t *pool;
+   mongoc_uri_t *uri;
 
    if (argc != 2) {
       fprintf(stderr, "usage: %s MONGO_URI\n", argv[0]);
@@ -103,18 +69,20 @@ main (int   argc,
 
    mongoc_init();
 
-   client = mongoc_client_new(argv[1]);
-   if (!client) {
+   uri = mongoc_uri_new(argv[1]);
+   if (!uri) {
       fprintf(stderr, "Invalid URI: \"%s\"\n", argv[1]);
       return EXIT_FAILURE;
    }
 
-   collection = mongoc_client_get_collection(client, "local", "oplog.rs");
+   pool = mongoc_client_pool_new(uri);
+
+   tail_oplog(pool);
 
-   tail_collection(collection);
+   mongoc_client_pool_destroy(pool);
+   mongoc_uri_destroy(uri);
 
-   mongoc_collection_destroy(collection);
-   mongoc_client_destroy(client);
+   mongoc_cleanup();
 
-   return 0;
+   return EXIT_FAILURE;
 }
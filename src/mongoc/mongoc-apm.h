@@ -0,0 +1,190 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_APM_H
+#define MONGOC_APM_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-host-list.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Events only live for the duration of the callback. Their strings point
+ * into the request or into the client, and must be copied to be kept.
+ */
+typedef struct
+{
+   const char               *command_name;
+   const char               *ns;
+   int32_t                   request_id;
+   const mongoc_host_list_t *host;
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_command_started_t;
+
+
+typedef struct
+{
+   const char               *command_name;
+   const char               *ns;
+   int32_t                   request_id;
+   const mongoc_host_list_t *host;
+   int64_t                   duration_usec;
+   int32_t                   reply_len;
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_command_succeeded_t;
+
+
+typedef struct
+{
+   const char               *command_name;
+   const char               *ns;
+   int32_t                   request_id;
+   const mongoc_host_list_t *host;
+   int64_t                   duration_usec;
+   const bson_error_t       *error;
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_command_failed_t;
+
+
+typedef void (*mongoc_apm_command_started_cb_t)   (const mongoc_apm_command_started_t   *event);
+typedef void (*mongoc_apm_command_succeeded_cb_t) (const mongoc_apm_command_succeeded_t *event);
+typedef void (*mongoc_apm_command_failed_cb_t)    (const mongoc_apm_command_failed_t    *event);
+
+
+typedef struct
+{
+   mongoc_apm_command_started_cb_t   started;
+   mongoc_apm_command_succeeded_cb_t succeeded;
+   mongoc_apm_command_failed_cb_t    failed;
+   void                             *padding [8];
+} mongoc_apm_callbacks_t;
+
+
+/*
+ * An operation that took at least the threshold given to
+ * mongoc_client_set_slow_op_log(), and where its time went: selecting a
+ * node, reconnecting or refreshing the topology inline, writing the
+ * request, waiting for the first bytes of the reply and reading the rest.
+ * The phases add up to about @duration_usec.
+ */
+typedef struct
+{
+   char     command_name [32];
+   char     ns [120];
+   char     host [BSON_HOST_NAME_MAX + 7];
+   int32_t  request_id;
+   bool     failed;
+   int64_t  duration_usec;
+   int64_t  selection_usec;
+   int64_t  reconnect_usec;
+   int64_t  send_usec;
+   int64_t  wait_usec;
+   int64_t  receive_usec;
+   int32_t  bytes_sent;
+   int32_t  bytes_received;
+   void    *padding [8];
+} mongoc_apm_slow_op_t;
+
+
+typedef void (*mongoc_apm_slow_op_cb_t) (const mongoc_apm_slow_op_t *op,
+                                         void                       *context);
+
+
+/*
+ * One of the last operations of a client, from the ring that every client
+ * keeps, see mongoc_client_get_flight_records(). The times are those of
+ * bson_get_monotonic_time() when the operation was handed to the cluster,
+ * was written, and its reply was read, or zero if it got no further.
+ */
+typedef struct
+{
+   int32_t  opcode;
+   char     ns [64];
+   char     host [BSON_HOST_NAME_MAX + 7];
+   int32_t  request_id;
+   int64_t  started_usec;
+   int64_t  sent_usec;
+   int64_t  replied_usec;
+   int32_t  bytes_sent;
+   int32_t  bytes_received;
+   uint32_t error_domain;
+   uint32_t error_code;
+   void    *padding [8];
+} mongoc_apm_flight_record_t;
+
+
+/*
+ * Events of the topology of a client pool and of the pool itself, see
+ * mongoc_client_pool_set_topology_callbacks(). They are delivered by the
+ * thread that monitors the topology of the pool, never by a thread that
+ * runs an operation, and only live for the duration of the callback.
+ */
+typedef struct
+{
+   const mongoc_host_list_t *host;
+   bool                      is_primary;
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_node_discovered_t;
+
+
+typedef struct
+{
+   const mongoc_host_list_t *old_primary;  /* or NULL */
+   const mongoc_host_list_t *new_primary;  /* or NULL */
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_primary_changed_t;
+
+
+typedef struct
+{
+   uint32_t                  n_clients;
+   void                     *context;
+   void                     *padding [8];
+} mongoc_apm_pool_client_event_t;
+
+
+typedef void (*mongoc_apm_node_discovered_cb_t) (const mongoc_apm_node_discovered_t   *event);
+typedef void (*mongoc_apm_primary_changed_cb_t) (const mongoc_apm_primary_changed_t   *event);
+typedef void (*mongoc_apm_pool_client_cb_t)     (const mongoc_apm_pool_client_event_t *event);
+
+
+typedef struct
+{
+   mongoc_apm_node_discovered_cb_t   node_discovered;
+   mongoc_apm_primary_changed_cb_t   primary_changed;
+   mongoc_apm_pool_client_cb_t       pool_client_created;
+   mongoc_apm_pool_client_cb_t       pool_client_destroyed;
+   void                             *padding [8];
+} mongoc_apm_topology_callbacks_t;
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_APM_H */
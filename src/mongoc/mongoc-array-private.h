@@ -32,10 +32,12 @@ typedef struct _mongoc_array_t mongoc_array_t;
 
 struct _mongoc_array_t
 {
-   size_t  len;
-   size_t  element_size;
-   size_t  allocated;
-   void   *data;
+   size_t             len;
+   size_t             element_size;
+   size_t             allocated;
+   void              *data;
+   bson_realloc_func  realloc_func;
+   void              *realloc_data;
 };
 
 
@@ -44,12 +46,16 @@ struct _mongoc_array_t
 #define _mongoc_array_clear(a)         (a)->len = 0
 
 
-void _mongoc_array_init        (mongoc_array_t *array,
-                                size_t          element_size);
-void _mongoc_array_append_vals (mongoc_array_t *array,
-                                const void     *data,
-                                uint32_t        n_elements);
-void _mongoc_array_destroy     (mongoc_array_t *array);
+void _mongoc_array_init              (mongoc_array_t    *array,
+                                      size_t             element_size);
+void _mongoc_array_init_with_realloc (mongoc_array_t    *array,
+                                      size_t             element_size,
+                                      bson_realloc_func  realloc_func,
+                                      void              *realloc_data);
+void _mongoc_array_append_vals       (mongoc_array_t    *array,
+                                      const void        *data,
+                                      uint32_t           n_elements);
+void _mongoc_array_destroy           (mongoc_array_t    *array);
 
 
 BSON_END_DECLS
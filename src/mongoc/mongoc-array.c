@@ -21,14 +21,35 @@
 void
 _mongoc_array_init (mongoc_array_t *array,
                     size_t          element_size)
+{
+   _mongoc_array_init_with_realloc (array, element_size, NULL, NULL);
+}
+
+
+/*
+ * Like _mongoc_array_init(), but the memory of @array is allocated,
+ * grown and freed with @realloc_func, as mongoc_buffer_t does.
+ */
+void
+_mongoc_array_init_with_realloc (mongoc_array_t    *array,
+                                 size_t             element_size,
+                                 bson_realloc_func  realloc_func,
+                                 void              *realloc_data)
 {
    bson_return_if_fail(array);
    bson_return_if_fail(element_size);
 
+   if (!realloc_func) {
+      realloc_func = bson_realloc_ctx;
+   }
+
    array->len = 0;
    array->element_size = element_size;
    array->allocated = 128;
-   array->data = bson_malloc0(array->allocated);
+   array->realloc_func = realloc_func;
+   array->realloc_data = realloc_data;
+   array->data = realloc_func(NULL, array->allocated, realloc_data);
+   memset(array->data, 0, array->allocated);
 }
 
 
@@ -36,7 +57,7 @@ void
 _mongoc_array_destroy (mongoc_array_t *array)
 {
    if (array && array->data) {
-      bson_free(array->data);
+      array->realloc_func(array->data, 0, array->realloc_data);
    }
 }
 
@@ -57,7 +78,8 @@ _mongoc_array_append_vals (mongoc_array_t *array,
    len = (size_t)n_elements * array->element_size;
    if ((off + len) > array->allocated) {
       next_size = bson_next_power_of_two(off + len);
-      array->data = bson_realloc(array->data, next_size);
+      array->data = array->realloc_func(array->data, next_size,
+                                        array->realloc_data);
       array->allocated = next_size;
    }
 
@@ -0,0 +1,935 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-async.h"
+#include "mongoc-buffer-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-error.h"
+#include "mongoc-list-private.h"
+#include "mongoc-log.h"
+#include "mongoc-rpc-private.h"
+#include "mongoc-socket-private.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-stream-socket.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "async"
+
+
+#ifndef MONGOC_ASYNC_READ_SIZE
+# define MONGOC_ASYNC_READ_SIZE 4096
+#endif
+
+
+/*
+ * A request that has been written and is waiting for its reply.
+ */
+typedef struct
+{
+   uint32_t           request_id;
+   int64_t            expire_at;
+   mongoc_async_cb_t  cb;
+   void              *cb_data;
+} mongoc_async_op_t;
+
+
+/*
+ * A connection owned by the async context. Every request sent to the
+ * same node by the same client is pipelined over one connection and the
+ * replies are matched to requests by responseTo.
+ */
+typedef struct
+{
+   mongoc_client_t    *client;
+   mongoc_host_list_t  host;
+   mongoc_stream_t    *stream;
+   mongoc_stream_t    *base_stream;
+   mongoc_socket_t    *socket;
+   mongoc_buffer_t     buffer;
+   mongoc_list_t      *ops;
+   uint32_t            n_ops;
+   bool                failed;
+   bson_error_t        error;
+} mongoc_async_conn_t;
+
+
+struct _mongoc_async_t
+{
+   mongoc_list_t *conns;
+   uint32_t       n_ops;
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_op_complete --
+ *
+ *       Detach @op from @conn and report its outcome to the caller.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @op is freed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_async_op_complete (mongoc_async_t      *async,
+                           mongoc_async_conn_t *conn,
+                           mongoc_async_op_t   *op,
+                           bool                 success,
+                           const bson_t        *reply,
+                           const bson_error_t  *error)
+{
+   conn->ops = _mongoc_list_remove (conn->ops, op);
+   conn->n_ops--;
+   async->n_ops--;
+
+   op->cb (async, success, reply, error, op->cb_data);
+
+   bson_free (op);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_conn_destroy --
+ *
+ *       Fail every request still waiting on @conn, then close it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @conn is freed. It must already have been removed from the
+ *       context's list of connections.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_async_conn_destroy (mongoc_async_t      *async,
+                            mongoc_async_conn_t *conn)
+{
+   while (conn->ops) {
+      _mongoc_async_op_complete (async, conn, conn->ops->data, false, NULL,
+                                 &conn->error);
+   }
+
+   mongoc_stream_close (conn->stream);
+   mongoc_stream_destroy (conn->stream);
+   _mongoc_buffer_destroy (&conn->buffer);
+
+   bson_free (conn);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_get_conn --
+ *
+ *       Find the connection to @node for @client, or open a new one.
+ *
+ *       The connection must be a plain socket, since readiness of the
+ *       descriptor has to mean that reply bytes can be read. TLS keeps
+ *       decrypted data of its own and is not supported.
+ *
+ * Returns:
+ *       A mongoc_async_conn_t, or NULL and @error is set.
+ *
+ * Side effects:
+ *       A connection may be established and authenticated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_async_conn_t *
+_mongoc_async_get_conn (mongoc_async_t        *async,
+                        mongoc_client_t       *client,
+                        mongoc_cluster_node_t *node,
+                        bson_error_t          *error)
+{
+   mongoc_async_conn_t *conn;
+   mongoc_stream_t *stream;
+   mongoc_stream_t *base;
+   mongoc_list_t *iter;
+
+   for (iter = async->conns; iter; iter = iter->next) {
+      conn = iter->data;
+
+      if (!conn->failed &&
+          (conn->client == client) &&
+          !strcmp (conn->host.host_and_port, node->host.host_and_port)) {
+         return conn;
+      }
+   }
+
+   stream = _mongoc_cluster_node_connect_stream (&client->cluster, node,
+                                                 error);
+   if (!stream) {
+      return NULL;
+   }
+
+   for (base = stream; base; base = mongoc_stream_get_base_stream (base)) {
+      if ((base->type == MONGOC_STREAM_SOCKET) ||
+          (base->type == MONGOC_STREAM_TLS)) {
+         break;
+      }
+   }
+
+   if (!base || (base->type != MONGOC_STREAM_SOCKET)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "Asynchronous operations require a plain socket "
+                      "connection to %s.",
+                      node->host.host_and_port);
+      mongoc_stream_close (stream);
+      mongoc_stream_destroy (stream);
+      return NULL;
+   }
+
+   conn = bson_malloc0 (sizeof *conn);
+   conn->client = client;
+   conn->host = node->host;
+   conn->stream = stream;
+   conn->base_stream = base;
+   conn->socket = mongoc_stream_socket_get_socket (
+      (mongoc_stream_socket_t *)base);
+   _mongoc_buffer_init (&conn->buffer, NULL, 0, NULL, NULL);
+
+   async->conns = _mongoc_list_append (async->conns, conn);
+
+   return conn;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_reply_error --
+ *
+ *       Check a command reply for failure, the same way a synchronous
+ *       command cursor does.
+ *
+ * Returns:
+ *       true if @reply describes a failure and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_async_reply_error (const mongoc_rpc_t *rpc,
+                           const bson_t       *reply,
+                           bson_error_t       *error)
+{
+   uint32_t code = MONGOC_ERROR_QUERY_FAILURE;
+   const char *msg = "Unknown query failure";
+   bson_iter_t iter;
+
+   if (!(rpc->reply.flags & MONGOC_REPLY_QUERY_FAILURE) &&
+       (!bson_iter_init_find (&iter, reply, "ok") ||
+        bson_iter_as_bool (&iter))) {
+      return false;
+   }
+
+   if (bson_iter_init_find (&iter, reply, "code") &&
+       BSON_ITER_HOLDS_INT32 (&iter)) {
+      code = bson_iter_int32 (&iter);
+   }
+
+   if (bson_iter_init_find (&iter, reply, "$err") &&
+       BSON_ITER_HOLDS_UTF8 (&iter)) {
+      msg = bson_iter_utf8 (&iter, NULL);
+   }
+
+   if (bson_iter_init_find (&iter, reply, "errmsg") &&
+       BSON_ITER_HOLDS_UTF8 (&iter)) {
+      msg = bson_iter_utf8 (&iter, NULL);
+   }
+
+   bson_set_error (error, MONGOC_ERROR_QUERY, code, "%s", msg);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_conn_dispatch --
+ *
+ *       Hand every complete reply buffered on @conn to the request it
+ *       answers. Replies to requests that already timed out are dropped.
+ *
+ * Returns:
+ *       true if successful; otherwise false and conn->error is set.
+ *
+ * Side effects:
+ *       Callbacks are invoked.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_async_conn_dispatch (mongoc_async_t      *async,
+                             mongoc_async_conn_t *conn)
+{
+   mongoc_async_op_t *op;
+   mongoc_list_t *iter;
+   mongoc_rpc_t rpc;
+   bson_error_t error;
+   int32_t msg_len;
+   bson_t b;
+
+   while (conn->buffer.len >= 4) {
+      memcpy (&msg_len, &conn->buffer.data[conn->buffer.off], 4);
+      msg_len = BSON_UINT32_FROM_LE (msg_len);
+
+      if ((msg_len < 16) ||
+          (msg_len > conn->client->cluster.max_msg_size)) {
+         bson_set_error (&conn->error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Corrupt or malicious reply received.");
+         mongoc_counter_protocol_ingress_error_inc ();
+         return false;
+      }
+
+      if (conn->buffer.len < (size_t)msg_len) {
+         break;
+      }
+
+      if (!_mongoc_rpc_scatter (&rpc, &conn->buffer.data[conn->buffer.off],
+                                msg_len)) {
+         bson_set_error (&conn->error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Failed to decode reply from server.");
+         mongoc_counter_protocol_ingress_error_inc ();
+         return false;
+      }
+
+      _mongoc_rpc_swab_from_le (&rpc);
+
+      if (rpc.header.opcode != MONGOC_OPCODE_REPLY) {
+         bson_set_error (&conn->error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Received rpc other than OP_REPLY.");
+         mongoc_counter_protocol_ingress_error_inc ();
+         return false;
+      }
+
+      mongoc_counter_op_ingress_reply_inc ();
+      mongoc_counter_op_ingress_total_inc ();
+
+      for (op = NULL, iter = conn->ops; iter; iter = iter->next) {
+         if (((mongoc_async_op_t *)iter->data)->request_id ==
+             (uint32_t)rpc.header.response_to) {
+            op = iter->data;
+            break;
+         }
+      }
+
+      if (!op) {
+         TRACE ("Dropping reply to expired request %d",
+                rpc.header.response_to);
+      } else if (!_mongoc_rpc_reply_get_first (&rpc.reply, &b)) {
+         bson_set_error (&error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Failed to decode document from the server.");
+         _mongoc_async_op_complete (async, conn, op, false, NULL, &error);
+      } else {
+         if (_mongoc_async_reply_error (&rpc, &b, &error)) {
+            _mongoc_async_op_complete (async, conn, op, false, &b, &error);
+         } else {
+            _mongoc_async_op_complete (async, conn, op, true, &b, NULL);
+         }
+         bson_destroy (&b);
+      }
+
+      conn->buffer.off += msg_len;
+      conn->buffer.len -= msg_len;
+   }
+
+   if (!conn->buffer.len) {
+      conn->buffer.off = 0;
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_conn_read --
+ *
+ *       Read everything available on @conn without blocking and dispatch
+ *       the replies that are complete.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       conn->failed is set upon failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_async_conn_read (mongoc_async_t      *async,
+                         mongoc_async_conn_t *conn)
+{
+   ssize_t ret;
+
+   while (!conn->failed) {
+      ret = _mongoc_buffer_try_append_from_stream (&conn->buffer,
+                                                   conn->base_stream,
+                                                   MONGOC_ASYNC_READ_SIZE,
+                                                   &conn->error);
+
+      if (ret < 0) {
+         conn->failed = true;
+      } else if (ret == 0) {
+         break;
+      } else if (!_mongoc_async_conn_dispatch (async, conn)) {
+         conn->failed = true;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_expire --
+ *
+ *       Fail the requests whose socket timeout has passed. The connection
+ *       stays open; a late reply is dropped when it arrives.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Callbacks are invoked.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_async_expire (mongoc_async_t *async)
+{
+   mongoc_async_conn_t *conn;
+   mongoc_async_op_t *op;
+   mongoc_list_t *citer;
+   mongoc_list_t *oiter;
+   bson_error_t error;
+   int64_t now;
+
+again:
+   now = bson_get_monotonic_time ();
+
+   for (citer = async->conns; citer; citer = citer->next) {
+      conn = citer->data;
+
+      for (oiter = conn->ops; oiter; oiter = oiter->next) {
+         op = oiter->data;
+
+         if (op->expire_at <= now) {
+            bson_set_error (&error,
+                            MONGOC_ERROR_STREAM,
+                            MONGOC_ERROR_STREAM_SOCKET,
+                            "Timed out waiting for reply from %s.",
+                            conn->host.host_and_port);
+            mongoc_counter_streams_timeout_inc ();
+            _mongoc_async_op_complete (async, conn, op, false, NULL, &error);
+
+            /* the callback may have changed any of the lists */
+            goto again;
+         }
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_async_reap --
+ *
+ *       Close connections that failed, failing the requests on them.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Callbacks are invoked.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_async_reap (mongoc_async_t *async)
+{
+   mongoc_async_conn_t *conn;
+   mongoc_list_t *iter;
+
+again:
+   for (iter = async->conns; iter; iter = iter->next) {
+      conn = iter->data;
+
+      if (conn->failed) {
+         MONGOC_DEBUG ("Closing asynchronous connection to %s: %s",
+                       conn->host.host_and_port, conn->error.message);
+         async->conns = _mongoc_list_remove (async->conns, conn);
+         _mongoc_async_conn_destroy (async, conn);
+         goto again;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_new --
+ *
+ *       Create a context that drives asynchronous operations. A single
+ *       context can be shared by any number of clients, but like a
+ *       mongoc_client_t it must only be used from one thread at a time.
+ *
+ * Returns:
+ *       A newly allocated mongoc_async_t that should be freed with
+ *       mongoc_async_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_async_t *
+mongoc_async_new (void)
+{
+   return bson_malloc0 (sizeof (mongoc_async_t));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_destroy --
+ *
+ *       Close all connections of @async. Operations still in flight
+ *       complete with an error.
+ *
+ *       This must be called before destroying any client that submitted
+ *       operations to @async, and not from within a callback.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Callbacks are invoked.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_async_destroy (mongoc_async_t *async)
+{
+   mongoc_async_conn_t *conn;
+
+   ENTRY;
+
+   bson_return_if_fail (async);
+
+   while (async->conns) {
+      conn = async->conns->data;
+      async->conns = _mongoc_list_remove (async->conns, conn);
+
+      if (!conn->failed) {
+         bson_set_error (&conn->error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_NOT_READY,
+                         "The asynchronous context was destroyed.");
+      }
+
+      _mongoc_async_conn_destroy (async, conn);
+   }
+
+   bson_free (async);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_get_pollfds --
+ *
+ *       Fetch the descriptors that @async is waiting on, so they can be
+ *       registered with an event loop. When any of them becomes ready,
+ *       or mongoc_async_get_timeout() elapses, call
+ *       mongoc_async_perform() with a timeout of 0.
+ *
+ *       The set changes as operations are submitted and completed, so it
+ *       should be fetched again after each call to mongoc_async_perform().
+ *
+ * Returns:
+ *       The number of descriptors, which may be larger than @n_fds. At
+ *       most @n_fds elements of @fds are filled in.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_async_get_pollfds (mongoc_async_t        *async,
+                          mongoc_async_pollfd_t *fds,
+                          size_t                 n_fds)
+{
+   mongoc_async_conn_t *conn;
+   mongoc_list_t *iter;
+   size_t n = 0;
+
+   bson_return_val_if_fail (async, 0);
+   bson_return_val_if_fail (fds || !n_fds, 0);
+
+   for (iter = async->conns; iter; iter = iter->next) {
+      conn = iter->data;
+
+      if (conn->n_ops && !conn->failed) {
+         if (n < n_fds) {
+            fds[n].fd = _mongoc_socket_get_fd (conn->socket);
+            fds[n].events = POLLIN;
+         }
+         n++;
+      }
+   }
+
+   return n;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_get_timeout --
+ *
+ *       Get the time until the next operation times out.
+ *
+ * Returns:
+ *       The number of milliseconds, 0 if mongoc_async_perform() should be
+ *       called right away, or -1 if no operation is in flight.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int32_t
+mongoc_async_get_timeout (mongoc_async_t *async)
+{
+   mongoc_async_conn_t *conn;
+   mongoc_async_op_t *op;
+   mongoc_list_t *citer;
+   mongoc_list_t *oiter;
+   int64_t expire_at = 0;
+   int64_t now;
+
+   bson_return_val_if_fail (async, -1);
+
+   for (citer = async->conns; citer; citer = citer->next) {
+      conn = citer->data;
+
+      if (conn->failed) {
+         return 0;
+      }
+
+      for (oiter = conn->ops; oiter; oiter = oiter->next) {
+         op = oiter->data;
+
+         if (!expire_at || (op->expire_at < expire_at)) {
+            expire_at = op->expire_at;
+         }
+      }
+   }
+
+   if (!expire_at) {
+      return -1;
+   }
+
+   now = bson_get_monotonic_time ();
+
+   if (expire_at <= now) {
+      return 0;
+   }
+
+   return (int32_t)(((expire_at - now) + 999L) / 1000L);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_async_perform --
+ *
+ *       Make progress on every operation in flight: read the replies that
+ *       have arrived, run their callbacks and expire operations whose
+ *       socket timeout has passed.
+ *
+ *       @timeout_msec is how long to wait for a reply if none has arrived
+ *       yet. Pass 0 from an event loop that has already seen one of the
+ *       descriptors from mongoc_async_get_pollfds() become ready, or -1 to
+ *       wait until at least one operation completes or times out.
+ *
+ * Returns:
+ *       The number of operations still in flight.
+ *
+ * Side effects:
+ *       Callbacks are invoked.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+mongoc_async_perform (mongoc_async_t *async,
+                      int32_t         timeout_msec)
+{
+   mongoc_async_conn_t **conns;
+   mongoc_async_conn_t *conn;
+   mongoc_socket_poll_t *sds;
+   mongoc_list_t *iter;
+   int32_t next;
+   size_t n = 0;
+   size_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (async, 0);
+
+   for (iter = async->conns; iter; iter = iter->next) {
+      conn = iter->data;
+      if (conn->n_ops && !conn->failed) {
+         n++;
+      }
+   }
+
+   if (n) {
+      sds = bson_malloc0 (n * sizeof *sds);
+      conns = bson_malloc0 (n * sizeof *conns);
+
+      for (iter = async->conns, i = 0; iter; iter = iter->next) {
+         conn = iter->data;
+         if (conn->n_ops && !conn->failed) {
+            sds[i].socket = conn->socket;
+            sds[i].events = POLLIN;
+            conns[i] = conn;
+            i++;
+         }
+      }
+
+      next = mongoc_async_get_timeout (async);
+      if ((next >= 0) && ((timeout_msec < 0) || (next < timeout_msec))) {
+         timeout_msec = next;
+      }
+
+      if (_mongoc_socket_poll (sds, n, timeout_msec) > 0) {
+         /*
+          * Callbacks may submit operations and open connections, but
+          * connections are only freed by _mongoc_async_reap(), so the
+          * pointers in @conns stay valid.
+          */
+         for (i = 0; i < n; i++) {
+            if (sds[i].revents) {
+               _mongoc_async_conn_read (async, conns[i]);
+            }
+         }
+      }
+
+      bson_free (sds);
+      bson_free (conns);
+   }
+
+   _mongoc_async_expire (async);
+   _mongoc_async_reap (async);
+
+   RETURN (async->n_ops);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_async_command --
+ *
+ *       Send @command to the database @db_name without waiting for the
+ *       reply. @cb is called from mongoc_async_perform() once the reply
+ *       arrives, the operation times out after sockettimeoutms, or the
+ *       connection fails.
+ *
+ *       Selecting a node may block while @client first connects to the
+ *       cluster. Requests are written immediately and only waiting for
+ *       the reply is asynchronous.
+ *
+ * Returns:
+ *       true if the command was sent; otherwise false, @error is set and
+ *       @cb will not be called.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_async_command (mongoc_client_t           *client,
+                             mongoc_async_t            *async,
+                             const char                *db_name,
+                             const bson_t              *command,
+                             const mongoc_read_prefs_t *read_prefs,
+                             mongoc_async_cb_t          cb,
+                             void                      *cb_data,
+                             bson_error_t              *error)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_async_conn_t *conn;
+   mongoc_async_op_t *op;
+   mongoc_array_t iov;
+   mongoc_rpc_t rpc;
+   uint32_t request_id;
+   uint32_t hint;
+   char ns[MONGOC_NAMESPACE_MAX];
+   bool ret = false;
+
+   ENTRY;
+
+   bson_return_val_if_fail (client, false);
+   bson_return_val_if_fail (async, false);
+   bson_return_val_if_fail (db_name, false);
+   bson_return_val_if_fail (command, false);
+   bson_return_val_if_fail (cb, false);
+
+   if (!(hint = _mongoc_cluster_preselect (&client->cluster,
+                                           MONGOC_OPCODE_QUERY, NULL,
+                                           read_prefs, error))) {
+      RETURN (false);
+   }
+
+   node = &client->cluster.nodes[hint - 1];
+
+   if (!(conn = _mongoc_async_get_conn (async, client, node, error))) {
+      RETURN (false);
+   }
+
+   bson_snprintf (ns, sizeof ns, "%s.$cmd", db_name);
+
+   request_id = ++client->cluster.request_id;
+
+   rpc.query.msg_len = 0;
+   rpc.query.request_id = request_id;
+   rpc.query.response_to = 0;
+   rpc.query.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_NONE;
+   rpc.query.collection = ns;
+   rpc.query.skip = 0;
+   rpc.query.n_return = -1;
+   rpc.query.query = bson_get_data (command);
+   rpc.query.fields = NULL;
+
+   if (read_prefs &&
+       (mongoc_read_prefs_get_mode (read_prefs) != MONGOC_READ_PRIMARY)) {
+      rpc.query.flags |= MONGOC_QUERY_SLAVE_OK;
+   }
+
+   _mongoc_array_init (&iov, sizeof (mongoc_iovec_t));
+   _mongoc_rpc_gather (&rpc, &iov);
+
+   if (rpc.header.msg_len > client->cluster.max_msg_size) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_TOO_BIG,
+                      "Attempted to send an RPC larger than the "
+                      "max allowed message size. Was %u, allowed %u.",
+                      rpc.header.msg_len,
+                      client->cluster.max_msg_size);
+      GOTO (cleanup);
+   }
+
+   _mongoc_rpc_swab_to_le (&rpc);
+
+   errno = 0;
+
+   if (!mongoc_stream_writev (conn->stream, iov.data, iov.len,
+                              client->cluster.sockettimeoutms)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failure during socket delivery: %s",
+                      strerror (errno));
+      if (error) {
+         memcpy (&conn->error, error, sizeof conn->error);
+      }
+      conn->failed = true;
+      GOTO (cleanup);
+   }
+
+   mongoc_counter_op_egress_query_inc ();
+   mongoc_counter_op_egress_total_inc ();
+
+   op = bson_malloc0 (sizeof *op);
+   op->request_id = request_id;
+   op->expire_at = bson_get_monotonic_time () +
+                   ((int64_t)client->cluster.sockettimeoutms * 1000L);
+   op->cb = cb;
+   op->cb_data = cb_data;
+
+   conn->ops = _mongoc_list_append (conn->ops, op);
+   conn->n_ops++;
+   async->n_ops++;
+
+   ret = true;
+
+cleanup:
+   _mongoc_array_destroy (&iov);
+
+   RETURN (ret);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_ASYNC_H
+#define MONGOC_ASYNC_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-client.h"
+#include "mongoc-read-prefs.h"
+#include "mongoc-socket.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_async_t mongoc_async_t;
+
+
+typedef void (*mongoc_async_cb_t) (mongoc_async_t     *async,
+                                   bool                success,
+                                   const bson_t       *reply,
+                                   const bson_error_t *error,
+                                   void               *data);
+
+
+typedef struct
+{
+#ifdef _WIN32
+   SOCKET fd;
+#else
+   int    fd;
+#endif
+   int    events;
+} mongoc_async_pollfd_t;
+
+
+mongoc_async_t *mongoc_async_new            (void);
+void            mongoc_async_destroy        (mongoc_async_t              *async);
+size_t          mongoc_async_get_pollfds    (mongoc_async_t              *async,
+                                             mongoc_async_pollfd_t       *fds,
+                                             size_t                       n_fds);
+int32_t         mongoc_async_get_timeout    (mongoc_async_t              *async);
+uint32_t        mongoc_async_perform        (mongoc_async_t              *async,
+                                             int32_t                      timeout_msec);
+bool            mongoc_client_async_command (mongoc_client_t             *client,
+                                             mongoc_async_t              *async,
+                                             const char                  *db_name,
+                                             const bson_t                *command,
+                                             const mongoc_read_prefs_t   *read_prefs,
+                                             mongoc_async_cb_t            cb,
+                                             void                        *cb_data,
+                                             bson_error_t                *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_ASYNC_H */
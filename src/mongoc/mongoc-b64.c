@@ -119,30 +119,26 @@ mongoc_b64_ntop (uint8_t const *src,
    size_t datalength = 0;
    uint8_t input[3];
    uint8_t output[4];
+   uint32_t group;
    size_t i;
 
+   /*
+    * The output size is known up front, so check it once instead of once
+    * every four characters.
+    */
+   if (((srclength + 2) / 3) * 4 >= targsize) {
+      return -1;
+   }
+
    while (2 < srclength) {
-      input[0] = *src++;
-      input[1] = *src++;
-      input[2] = *src++;
+      group = ((uint32_t)src[0] << 16) | ((uint32_t)src[1] << 8) | src[2];
+      src += 3;
       srclength -= 3;
 
-      output[0] = input[0] >> 2;
-      output[1] = ((input[0] & 0x03) << 4) + (input[1] >> 4);
-      output[2] = ((input[1] & 0x0f) << 2) + (input[2] >> 6);
-      output[3] = input[2] & 0x3f;
-      Assert (output[0] < 64);
-      Assert (output[1] < 64);
-      Assert (output[2] < 64);
-      Assert (output[3] < 64);
-
-      if (datalength + 4 > targsize) {
-         return -1;
-      }
-      target[datalength++] = Base64[output[0]];
-      target[datalength++] = Base64[output[1]];
-      target[datalength++] = Base64[output[2]];
-      target[datalength++] = Base64[output[3]];
+      target[datalength++] = Base64[group >> 18];
+      target[datalength++] = Base64[(group >> 12) & 0x3f];
+      target[datalength++] = Base64[(group >> 6) & 0x3f];
+      target[datalength++] = Base64[group & 0x3f];
    }
 
    /* Now we worry about padding. */
@@ -296,14 +292,32 @@ static int
 mongoc_b64_pton_do(char const *src, uint8_t *target, size_t targsize)
 {
 	int tarindex, state, ch;
-	uint8_t ofs;
+	uint8_t ofs, q0, q1, q2, q3;
 
 	state = 0;
 	tarindex = 0;
 
 	while (1)
 	{
-		ch = *src++;
+		/*
+		 * Decode whole quantums of four base64 characters at once, as
+		 * long as they fit. Anything else, whitespace, padding, the
+		 * end of the string or an error, is left to the loop below.
+		 */
+		if (state == 0) {
+			while ((size_t)tarindex + 3 <= targsize &&
+			       (q0 = mongoc_b64rmap[(uint8_t)src[0]]) < 64 &&
+			       (q1 = mongoc_b64rmap[(uint8_t)src[1]]) < 64 &&
+			       (q2 = mongoc_b64rmap[(uint8_t)src[2]]) < 64 &&
+			       (q3 = mongoc_b64rmap[(uint8_t)src[3]]) < 64) {
+				target[tarindex++] = (q0 << 2) | (q1 >> 4);
+				target[tarindex++] = (q1 << 4) | (q2 >> 2);
+				target[tarindex++] = (q2 << 6) | q3;
+				src += 4;
+			}
+		}
+
+		ch = (uint8_t)*src++;
 		ofs = mongoc_b64rmap[ch];
 
 		if (ofs >= mongoc_b64rmap_special) {
@@ -360,7 +374,7 @@ mongoc_b64_pton_do(char const *src, uint8_t *target, size_t targsize)
 	 */
 
 	if (ch == Pad64) {		/* We got a pad char. */
-		ch = *src++;		/* Skip it, get next. */
+		ch = (uint8_t)*src++;		/* Skip it, get next. */
 		switch (state) {
 		case 0:		/* Invalid = in first position */
 		case 1:		/* Invalid = in second position */
@@ -368,13 +382,13 @@ mongoc_b64_pton_do(char const *src, uint8_t *target, size_t targsize)
 
 		case 2:		/* Valid, means one byte of info */
 			/* Skip any number of spaces. */
-			for ((void)NULL; ch != '\0'; ch = *src++)
+			for ((void)NULL; ch != '\0'; ch = (uint8_t)*src++)
 				if (mongoc_b64rmap[ch] != mongoc_b64rmap_space)
 					break;
 			/* Make sure there is another trailing = sign. */
 			if (ch != Pad64)
 				return (-1);
-			ch = *src++;		/* Skip the = */
+			ch = (uint8_t)*src++;		/* Skip the = */
 			/* Fall through to "single trailing =" case. */
 			/* FALLTHROUGH */
 
@@ -383,7 +397,7 @@ mongoc_b64_pton_do(char const *src, uint8_t *target, size_t targsize)
 			 * We know this char is an =.  Is there anything but
 			 * whitespace after it?
 			 */
-			for ((void)NULL; ch != '\0'; ch = *src++)
+			for ((void)NULL; ch != '\0'; ch = (uint8_t)*src++)
 				if (mongoc_b64rmap[ch] != mongoc_b64rmap_space)
 					return (-1);
 
@@ -422,7 +436,7 @@ mongoc_b64_pton_len(char const *src)
 
 	while (1)
 	{
-		ch = *src++;
+		ch = (uint8_t)*src++;
 		ofs = mongoc_b64rmap[ch];
 
 		if (ofs >= mongoc_b64rmap_special) {
@@ -463,7 +477,7 @@ mongoc_b64_pton_len(char const *src)
 	 */
 
 	if (ch == Pad64) {		/* We got a pad char. */
-		ch = *src++;		/* Skip it, get next. */
+		ch = (uint8_t)*src++;		/* Skip it, get next. */
 		switch (state) {
 		case 0:		/* Invalid = in first position */
 		case 1:		/* Invalid = in second position */
@@ -471,13 +485,13 @@ mongoc_b64_pton_len(char const *src)
 
 		case 2:		/* Valid, means one byte of info */
 			/* Skip any number of spaces. */
-			for ((void)NULL; ch != '\0'; ch = *src++)
+			for ((void)NULL; ch != '\0'; ch = (uint8_t)*src++)
 				if (mongoc_b64rmap[ch] != mongoc_b64rmap_space)
 					break;
 			/* Make sure there is another trailing = sign. */
 			if (ch != Pad64)
 				return (-1);
-			ch = *src++;		/* Skip the = */
+			ch = (uint8_t)*src++;		/* Skip the = */
 			/* Fall through to "single trailing =" case. */
 			/* FALLTHROUGH */
 
@@ -486,7 +500,7 @@ mongoc_b64_pton_len(char const *src)
 			 * We know this char is an =.  Is there anything but
 			 * whitespace after it?
 			 */
-			for ((void)NULL; ch != '\0'; ch = *src++)
+			for ((void)NULL; ch != '\0'; ch = (uint8_t)*src++)
 				if (mongoc_b64rmap[ch] != mongoc_b64rmap_space)
 					return (-1);
 
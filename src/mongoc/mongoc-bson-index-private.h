@@ -0,0 +1,75 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_BSON_INDEX_PRIVATE_H
+#define MONGOC_BSON_INDEX_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-array-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef enum
+{
+   MONGOC_BSON_INDEX_NONE          = 0,
+   MONGOC_BSON_INDEX_CHECK_NUL     = 1 << 0,  /* each ends with a NUL */
+   MONGOC_BSON_INDEX_ALLOW_PARTIAL = 1 << 1,  /* stop at a cut document */
+} mongoc_bson_index_flags_t;
+
+
+/*
+ * The offsets of the documents of a run of BSON documents laid end to
+ * end, as in a reply, an insert or a dump file, so that they can be
+ * reached at random or split among threads without parsing them. The
+ * buffer is borrowed and must outlive the index.
+ */
+typedef struct
+{
+   const uint8_t  *data;
+   size_t          len;       /* indexed, up to the end of the last one */
+   mongoc_array_t  offsets;   /* of size_t */
+} mongoc_bson_index_t;
+
+
+void   _mongoc_bson_index_init      (mongoc_bson_index_t       *index);
+void   _mongoc_bson_index_destroy   (mongoc_bson_index_t       *index);
+bool   _mongoc_bson_index_docs      (mongoc_bson_index_t       *index,
+                                     const uint8_t             *data,
+                                     size_t                     len,
+                                     mongoc_bson_index_flags_t  flags,
+                                     bson_error_t              *error);
+size_t _mongoc_bson_index_count     (const mongoc_bson_index_t *index);
+bool   _mongoc_bson_index_get       (const mongoc_bson_index_t *index,
+                                     size_t                     i,
+                                     bson_t                    *doc);
+void   _mongoc_bson_index_partition (const mongoc_bson_index_t *index,
+                                     uint32_t                   n_parts,
+                                     uint32_t                   part,
+                                     size_t                    *first,
+                                     size_t                    *last);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_BSON_INDEX_PRIVATE_H */
@@ -0,0 +1,281 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-bson-index-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace.h"
+
+
+/* offsets are gathered on the stack and appended this many at a time */
+#define MONGOC_BSON_INDEX_BATCH 64
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "bson-index"
+
+
+void
+_mongoc_bson_index_init (mongoc_bson_index_t *index)
+{
+   BSON_ASSERT (index);
+
+   index->data = NULL;
+   index->len = 0;
+   _mongoc_array_init (&index->offsets, sizeof (size_t));
+}
+
+
+void
+_mongoc_bson_index_destroy (mongoc_bson_index_t *index)
+{
+   if (index) {
+      _mongoc_array_destroy (&index->offsets);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bson_index_docs --
+ *
+ *       Index the documents of the @len bytes at @data, replacing what
+ *       @index held. Only the length prefixes are read, one per document,
+ *       and checked to be at least 5 and to fit in the buffer. With
+ *       MONGOC_BSON_INDEX_CHECK_NUL the last byte of each document must
+ *       be its terminating NUL too.
+ *
+ *       A document cut short at the end of the buffer is an error, unless
+ *       MONGOC_BSON_INDEX_ALLOW_PARTIAL is given, in which case indexing
+ *       stops before it and index->len tells where it starts, so that the
+ *       caller can read more after it.
+ *
+ *       The documents themselves are not validated, bson_init_static()
+ *       and bson_validate() do that when each one is used.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @index holds the documents up to the first invalid one on
+ *       failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_bson_index_docs (mongoc_bson_index_t       *index,
+                         const uint8_t             *data,
+                         size_t                     len,
+                         mongoc_bson_index_flags_t  flags,
+                         bson_error_t              *error)
+{
+   size_t batch [MONGOC_BSON_INDEX_BATCH];
+   uint32_t batch_len = 0;
+   size_t offset = 0;
+   size_t remaining;
+   int32_t doc_len;
+   bool ret = true;
+
+   ENTRY;
+
+   BSON_ASSERT (index);
+   BSON_ASSERT (data || !len);
+
+   index->data = data;
+   index->len = 0;
+   _mongoc_array_clear (&index->offsets);
+
+   while (offset < len) {
+      remaining = len - offset;
+
+      if (remaining < 4) {
+         doc_len = 5;
+      } else {
+         memcpy (&doc_len, data + offset, 4);
+         doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+         if (doc_len < 5) {
+            bson_set_error (error,
+                            MONGOC_ERROR_BSON,
+                            MONGOC_ERROR_BSON_INVALID,
+                            "Invalid document length %d at offset %llu.",
+                            doc_len, (unsigned long long)offset);
+            ret = false;
+            break;
+         }
+      }
+
+      if ((size_t)doc_len > remaining) {
+         if (!(flags & MONGOC_BSON_INDEX_ALLOW_PARTIAL)) {
+            bson_set_error (error,
+                            MONGOC_ERROR_BSON,
+                            MONGOC_ERROR_BSON_INVALID,
+                            "Document at offset %llu is cut short.",
+                            (unsigned long long)offset);
+            ret = false;
+         }
+         break;
+      }
+
+      if ((flags & MONGOC_BSON_INDEX_CHECK_NUL) &&
+          data [offset + doc_len - 1] != '\0') {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Document at offset %llu is not terminated.",
+                         (unsigned long long)offset);
+         ret = false;
+         break;
+      }
+
+      batch [batch_len++] = offset;
+
+      if (batch_len == MONGOC_BSON_INDEX_BATCH) {
+         _mongoc_array_append_vals (&index->offsets, batch, batch_len);
+         batch_len = 0;
+      }
+
+      offset += doc_len;
+   }
+
+   if (batch_len) {
+      _mongoc_array_append_vals (&index->offsets, batch, batch_len);
+   }
+
+   index->len = offset;
+
+   RETURN (ret);
+}
+
+
+size_t
+_mongoc_bson_index_count (const mongoc_bson_index_t *index)
+{
+   BSON_ASSERT (index);
+
+   return index->offsets.len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bson_index_get --
+ *
+ *       Point @doc at the @i'th document of @index, without copying it.
+ *
+ * Returns:
+ *       true if successful; otherwise false if @i is out of range.
+ *
+ * Side effects:
+ *       @doc is initialized with bson_init_static() if successful.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_bson_index_get (const mongoc_bson_index_t *index,
+                        size_t                     i,
+                        bson_t                    *doc)
+{
+   size_t offset;
+   size_t end;
+
+   BSON_ASSERT (index);
+   BSON_ASSERT (doc);
+
+   if (i >= index->offsets.len) {
+      return false;
+   }
+
+   offset = _mongoc_array_index (&index->offsets, size_t, i);
+   end = (i + 1 < index->offsets.len) ?
+         _mongoc_array_index (&index->offsets, size_t, i + 1) : index->len;
+
+   return bson_init_static (doc, index->data + offset, end - offset);
+}
+
+
+/*
+ * The first document that starts at or after @offset, or the count of
+ * documents if none does.
+ */
+static size_t
+_mongoc_bson_index_lower_bound (const mongoc_bson_index_t *index,
+                                size_t                     offset)
+{
+   const size_t *offsets = (const size_t *)index->offsets.data;
+   size_t lo = 0;
+   size_t hi = index->offsets.len;
+   size_t mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+
+      if (offsets [mid] < offset) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return lo;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bson_index_partition --
+ *
+ *       Split the documents of @index into @n_parts runs of about as many
+ *       bytes each, rather than as many documents, since the work per
+ *       document follows its size. Each consumer thread takes one @part,
+ *       counting from 0, and handles documents @first up to but not
+ *       including @last. Every document is in exactly one part, and a
+ *       part may be empty.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @first and @last are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_bson_index_partition (const mongoc_bson_index_t *index,
+                              uint32_t                   n_parts,
+                              uint32_t                   part,
+                              size_t                    *first,
+                              size_t                    *last)
+{
+   BSON_ASSERT (index);
+   BSON_ASSERT (part < n_parts);
+   BSON_ASSERT (first);
+   BSON_ASSERT (last);
+
+   *first = part ? _mongoc_bson_index_lower_bound (
+      index, (size_t)((double)index->len * part / n_parts)) : 0;
+   *last = (part + 1 < n_parts) ? _mongoc_bson_index_lower_bound (
+      index, (size_t)((double)index->len * (part + 1) / n_parts)) :
+      index->offsets.len;
+}
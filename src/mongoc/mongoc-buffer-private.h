@@ -29,6 +29,15 @@
 BSON_BEGIN_DECLS
 
 
+/*
+ * Buffers larger than this are given back to the buffer pool by
+ * _mongoc_buffer_shrink() after an operation.
+ */
+#ifndef MONGOC_BUFFER_SHRINK_SIZE
+# define MONGOC_BUFFER_SHRINK_SIZE (1024 * 1024)
+#endif
+
+
 typedef struct _mongoc_buffer_t mongoc_buffer_t;
 
 
@@ -50,6 +59,24 @@ _mongoc_buffer_init (mongoc_buffer_t   *buffer,
                      bson_realloc_func  realloc_func,
                      void              *realloc_data);
 
+void
+_mongoc_buffer_pool_init (void);
+
+void
+_mongoc_buffer_pool_cleanup (void);
+
+void
+_mongoc_buffer_reserve (mongoc_buffer_t *buffer,
+                        size_t           size);
+
+void
+_mongoc_buffer_shrink (mongoc_buffer_t *buffer);
+
+void
+_mongoc_buffer_append (mongoc_buffer_t *buffer,
+                       const uint8_t   *data,
+                       size_t           data_size);
+
 bool
 _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
                                    mongoc_stream_t *stream,
@@ -57,6 +84,12 @@ _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
                                    int32_t     timeout_msec,
                                    bson_error_t    *error);
 
+ssize_t
+_mongoc_buffer_try_append_from_stream (mongoc_buffer_t *buffer,
+                                       mongoc_stream_t *stream,
+                                       size_t           size,
+                                       bson_error_t    *error);
+
 ssize_t
 _mongoc_buffer_fill (mongoc_buffer_t *buffer,
                      mongoc_stream_t *stream,
@@ -20,7 +20,10 @@
 #include <stdarg.h>
 
 #include "mongoc-error.h"
+#include "mongoc-errno-private.h"
 #include "mongoc-buffer-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-trace.h"
 
 
@@ -35,6 +38,133 @@
 #define SPACE_FOR(_b, _sz) (((ssize_t)(_b)->datalen - (ssize_t)(_b)->off - (ssize_t)(_b)->len) >= (ssize_t)(_sz))
 
 
+/*
+ * Buffers that use the default allocator get their memory from a
+ * process-wide pool of power-of-two size classes, so that a buffer that
+ * grew for one large reply can give its memory back and another buffer
+ * can pick it up, rather than each client or cursor keeping its own.
+ *
+ * Free blocks are kept in a list per size class, linked through their
+ * first bytes. The pool never holds more than MONGOC_BUFFER_POOL_MAX_BYTES;
+ * anything beyond that, or outside of the size classes, is freed.
+ */
+#ifndef MONGOC_BUFFER_POOL_MAX_BYTES
+# define MONGOC_BUFFER_POOL_MAX_BYTES (32 * 1024 * 1024)
+#endif
+
+#define MONGOC_BUFFER_POOL_MIN_SHIFT 12
+#define MONGOC_BUFFER_POOL_MAX_SHIFT 24
+#define MONGOC_BUFFER_POOL_N_CLASSES \
+   (MONGOC_BUFFER_POOL_MAX_SHIFT - MONGOC_BUFFER_POOL_MIN_SHIFT + 1)
+
+#define IS_POOLED(_b) ((_b)->realloc_func == bson_realloc_ctx)
+
+
+static mongoc_mutex_t  gBufferPoolMutex;
+static void           *gBufferPool[MONGOC_BUFFER_POOL_N_CLASSES];
+static size_t          gBufferPoolBytes;
+
+
+void
+_mongoc_buffer_pool_init (void)
+{
+   mongoc_mutex_init (&gBufferPoolMutex);
+}
+
+
+void
+_mongoc_buffer_pool_cleanup (void)
+{
+   void *block;
+   int i;
+
+   mongoc_mutex_lock (&gBufferPoolMutex);
+   for (i = 0; i < MONGOC_BUFFER_POOL_N_CLASSES; i++) {
+      while ((block = gBufferPool[i])) {
+         memcpy (&gBufferPool[i], block, sizeof (void *));
+         bson_free (block);
+      }
+   }
+   mongoc_counter_buffer_pool_bytes_held_add (-(int64_t)gBufferPoolBytes);
+   gBufferPoolBytes = 0;
+   mongoc_mutex_unlock (&gBufferPoolMutex);
+}
+
+
+/*
+ * Returns the size class of @size, or -1 if blocks of @size are not
+ * pooled.
+ */
+static int
+_mongoc_buffer_pool_class (size_t size)
+{
+   int shift;
+
+   for (shift = MONGOC_BUFFER_POOL_MIN_SHIFT;
+        shift <= MONGOC_BUFFER_POOL_MAX_SHIFT;
+        shift++) {
+      if (size == ((size_t)1 << shift)) {
+         return shift - MONGOC_BUFFER_POOL_MIN_SHIFT;
+      }
+   }
+
+   return -1;
+}
+
+
+static uint8_t *
+_mongoc_buffer_pool_take (size_t size)
+{
+   void *block = NULL;
+   int i;
+
+   if ((i = _mongoc_buffer_pool_class (size)) >= 0) {
+      mongoc_mutex_lock (&gBufferPoolMutex);
+      if ((block = gBufferPool[i])) {
+         memcpy (&gBufferPool[i], block, sizeof (void *));
+         gBufferPoolBytes -= size;
+      }
+      mongoc_mutex_unlock (&gBufferPoolMutex);
+
+      if (block) {
+         mongoc_counter_buffer_pool_bytes_held_add (-(int64_t)size);
+         mongoc_counter_buffer_pool_hits_inc ();
+         return block;
+      }
+
+      mongoc_counter_buffer_pool_misses_inc ();
+   }
+
+   return bson_malloc (size);
+}
+
+
+static void
+_mongoc_buffer_pool_give (uint8_t *data,
+                          size_t   size)
+{
+   bool pooled = false;
+   int i;
+
+   if ((i = _mongoc_buffer_pool_class (size)) >= 0) {
+      mongoc_mutex_lock (&gBufferPoolMutex);
+      if ((gBufferPoolBytes + size) <= MONGOC_BUFFER_POOL_MAX_BYTES) {
+         memcpy (data, &gBufferPool[i], sizeof (void *));
+         gBufferPool[i] = data;
+         gBufferPoolBytes += size;
+         pooled = true;
+      }
+      mongoc_mutex_unlock (&gBufferPoolMutex);
+   }
+
+   if (pooled) {
+      mongoc_counter_buffer_pool_bytes_held_add (size);
+   } else {
+      bson_free (data);
+   }
+}
+
+
 /**
  * _mongoc_buffer_init:
  * @buffer: A mongoc_buffer_t to initialize.
@@ -67,7 +197,11 @@ _mongoc_buffer_init (mongoc_buffer_t   *buffer,
    }
 
    if (!buf) {
-      buf = realloc_func (NULL, buflen, NULL);
+      if (realloc_func == bson_realloc_ctx) {
+         buf = _mongoc_buffer_pool_take (buflen);
+      } else {
+         buf = realloc_func (NULL, buflen, realloc_data);
+      }
    }
 
    memset (buffer, 0, sizeof *buffer);
@@ -78,6 +212,8 @@ _mongoc_buffer_init (mongoc_buffer_t   *buffer,
    buffer->off = 0;
    buffer->realloc_func = realloc_func;
    buffer->realloc_data = realloc_data;
+
+   mongoc_counter_memory_buffers_add (buflen);
 }
 
 
@@ -92,7 +228,13 @@ _mongoc_buffer_destroy (mongoc_buffer_t *buffer)
 {
    bson_return_if_fail(buffer);
 
-   if (buffer->data && buffer->realloc_func) {
+   if (buffer->data) {
+      mongoc_counter_memory_buffers_add (-(int64_t)buffer->datalen);
+   }
+
+   if (buffer->data && IS_POOLED (buffer)) {
+      _mongoc_buffer_pool_give (buffer->data, buffer->datalen);
+   } else if (buffer->data && buffer->realloc_func) {
       buffer->realloc_func (buffer->data, 0, buffer->realloc_data);
    }
 
@@ -124,6 +266,112 @@ _mongoc_buffer_clear (mongoc_buffer_t *buffer,
 }
 
 
+/**
+ * _mongoc_buffer_shrink:
+ * @buffer: A mongoc_buffer_t.
+ *
+ * Gives the memory of an empty @buffer back to the buffer pool if it grew
+ * past MONGOC_BUFFER_SHRINK_SIZE, such as for a single large reply, and
+ * starts over with a buffer of the default size. Call this once an
+ * operation is done with the contents of a long-lived buffer.
+ */
+void
+_mongoc_buffer_shrink (mongoc_buffer_t *buffer)
+{
+   bson_return_if_fail (buffer);
+
+   if (!buffer->len &&
+       IS_POOLED (buffer) &&
+       (buffer->datalen > MONGOC_BUFFER_SHRINK_SIZE)) {
+      _mongoc_buffer_pool_give (buffer->data, buffer->datalen);
+      mongoc_counter_memory_buffers_add (
+         (int64_t)MONGOC_BUFFER_DEFAULT_SIZE - (int64_t)buffer->datalen);
+      buffer->datalen = MONGOC_BUFFER_DEFAULT_SIZE;
+      buffer->data = _mongoc_buffer_pool_take (buffer->datalen);
+      buffer->off = 0;
+   }
+}
+
+
+/**
+ * _mongoc_buffer_reserve:
+ * @buffer: A mongoc_buffer_t.
+ * @size: The number of bytes that will be appended.
+ *
+ * Makes room for @size bytes past the end of the buffered data, moving the
+ * data to the front of @buffer or growing it as necessary.
+ *
+ * When growing, a buffer that holds little or no data is replaced rather
+ * than resized, so that realloc does not copy the stale contents of the
+ * old allocation, such as the previous reply of a reused receive buffer.
+ */
+void
+_mongoc_buffer_reserve (mongoc_buffer_t *buffer,
+                        size_t           size)
+{
+   uint8_t *data;
+   size_t datalen;
+
+   BSON_ASSERT (buffer->datalen);
+   BSON_ASSERT ((buffer->datalen + size) < INT_MAX);
+
+   if (!SPACE_FOR (buffer, size)) {
+      if (buffer->len) {
+         memmove(&buffer->data[0], &buffer->data[buffer->off], buffer->len);
+      }
+      buffer->off = 0;
+      if (!SPACE_FOR (buffer, size)) {
+         datalen = bson_next_power_of_two (size + buffer->len);
+         if (IS_POOLED (buffer)) {
+            data = _mongoc_buffer_pool_take (datalen);
+            memcpy (data, buffer->data, buffer->len);
+            _mongoc_buffer_pool_give (buffer->data, buffer->datalen);
+            buffer->data = data;
+         } else if (buffer->len < (buffer->datalen / 2)) {
+            data = buffer->realloc_func (NULL, datalen, buffer->realloc_data);
+            memcpy (data, buffer->data, buffer->len);
+            buffer->realloc_func (buffer->data, 0, buffer->realloc_data);
+            buffer->data = data;
+         } else {
+            buffer->data = buffer->realloc_func (buffer->data, datalen,
+                                                 buffer->realloc_data);
+         }
+         mongoc_counter_memory_buffers_add (
+            (int64_t)datalen - (int64_t)buffer->datalen);
+         buffer->datalen = datalen;
+      }
+   }
+}
+
+
+/**
+ * _mongoc_buffer_append:
+ * @buffer: A mongoc_buffer_t.
+ * @data: The bytes to append.
+ * @data_size: The number of bytes in @data.
+ *
+ * Copies @data_size bytes from @data to the end of @buffer, as if they had
+ * been read from a stream with _mongoc_buffer_append_from_stream().
+ */
+void
+_mongoc_buffer_append (mongoc_buffer_t *buffer,
+                       const uint8_t   *data,
+                       size_t           data_size)
+{
+   bson_return_if_fail (buffer);
+   bson_return_if_fail (data || !data_size);
+
+   if (!data_size) {
+      return;
+   }
+
+   _mongoc_buffer_reserve (buffer, data_size);
+
+   memcpy (&buffer->data[buffer->off + buffer->len], data, data_size);
+   buffer->len += data_size;
+}
+
+
 /**
  * mongoc_buffer_append_from_stream:
  * @buffer; A mongoc_buffer_t.
@@ -154,19 +402,7 @@ _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
    bson_return_val_if_fail (stream, false);
    bson_return_val_if_fail (size, false);
 
-   BSON_ASSERT (buffer->datalen);
-   BSON_ASSERT ((buffer->datalen + size) < INT_MAX);
-
-   if (!SPACE_FOR (buffer, size)) {
-      if (buffer->len) {
-         memmove(&buffer->data[0], &buffer->data[buffer->off], buffer->len);
-      }
-      buffer->off = 0;
-      if (!SPACE_FOR (buffer, size)) {
-         buffer->datalen = bson_next_power_of_two (size + buffer->len + buffer->off);
-         buffer->data = buffer->realloc_func (buffer->data, buffer->datalen, NULL);
-      }
-   }
+   _mongoc_buffer_reserve (buffer, size);
 
    buf = &buffer->data[buffer->off + buffer->len];
 
@@ -188,6 +424,75 @@ _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
 }
 
 
+/**
+ * _mongoc_buffer_try_append_from_stream:
+ * @buffer; A mongoc_buffer_t.
+ * @stream: The stream to read from.
+ * @size: The maximum number of bytes to read.
+ * @error: A location for a bson_error_t, or NULL.
+ *
+ * Reads whatever is available from @stream, up to @size bytes, without
+ * blocking and stores it in @buffer. This is meant for streams that are
+ * driven by a poll loop and have just been reported readable. @stream
+ * must not buffer internally, or data it holds will go unnoticed.
+ *
+ * Returns: The number of bytes read, 0 if no data was available, or -1 if
+ *   the stream failed or was closed by the peer and @error is set.
+ */
+ssize_t
+_mongoc_buffer_try_append_from_stream (mongoc_buffer_t *buffer,
+                                       mongoc_stream_t *stream,
+                                       size_t           size,
+                                       bson_error_t    *error)
+{
+   uint8_t *buf;
+   ssize_t ret;
+   char errbuf[128];
+
+   ENTRY;
+
+   bson_return_val_if_fail (buffer, -1);
+   bson_return_val_if_fail (stream, -1);
+   bson_return_val_if_fail (size, -1);
+
+   _mongoc_buffer_reserve (buffer, size);
+
+   buf = &buffer->data[buffer->off + buffer->len];
+
+   /*
+    * A peer that closed the connection looks like a short read, so clear
+    * errno to tell it apart from a read that would have blocked.
+    */
+   errno = 0;
+
+   ret = mongoc_stream_read (stream, buf, size, 1, 0);
+
+   if (ret < 0) {
+      if (MONGOC_ERRNO_IS_AGAIN (errno) && errno) {
+         RETURN (0);
+      }
+
+      if (errno) {
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Failed to read from socket: %s",
+                         bson_strerror_r (errno, errbuf, sizeof errbuf));
+      } else {
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Connection closed by peer.");
+      }
+      RETURN (-1);
+   }
+
+   buffer->len += ret;
+
+   RETURN (ret);
+}
+
+
 /**
  * _mongoc_buffer_fill:
  * @buffer: A mongoc_buffer_t.
@@ -195,7 +500,7 @@ _mongoc_buffer_append_from_stream (mongoc_buffer_t *buffer,
  * @min_bytes: The minumum number of bytes to read.
  * @error: A location for a bson_error_t or NULL.
  *
- * Attempts to fill the entire buffer, or at least @min_bytes.
+ * Attempts to fill the rest of the buffer, or at least @min_bytes.
  *
  * Returns: The number of buffered bytes, or -1 on failure.
  */
@@ -224,19 +529,18 @@ _mongoc_buffer_fill (mongoc_buffer_t *buffer,
 
    min_bytes -= buffer->len;
 
-   if (buffer->len) {
-      memmove (&buffer->data[0], &buffer->data[buffer->off], buffer->len);
+   /*
+    * Only move the unread data to the front once the space after it can
+    * no longer hold @min_bytes, rather than on every fill. Small reads
+    * from a buffered stream then usually land after the data in place.
+    */
+   if (!buffer->len) {
+      buffer->off = 0;
    }
 
-   buffer->off = 0;
-
-   if (!SPACE_FOR (buffer, min_bytes)) {
-      buffer->datalen = bson_next_power_of_two (buffer->len + min_bytes);
-      buffer->data = buffer->realloc_func (buffer->data, buffer->datalen,
-                                           buffer->realloc_data);
-   }
+   _mongoc_buffer_reserve (buffer, min_bytes);
 
-   avail_bytes = buffer->datalen - buffer->len;
+   avail_bytes = buffer->datalen - buffer->off - buffer->len;
 
    ret = mongoc_stream_read (stream,
                              &buffer->data[buffer->off + buffer->len],
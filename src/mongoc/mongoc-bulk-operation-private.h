@@ -40,6 +40,14 @@ struct _mongoc_bulk_operation_t
    mongoc_array_t          commands;
    mongoc_write_result_t   result;
    bool                    executed;
+   uint32_t                operation_timeout_msec;
+   bool                    skip_validation;
+   size_t                  max_memory;
+   size_t                  memory_used;
+   bool                    spilled;
+   uint32_t                offset;
+   bool                    memory_exceeded;
+   bson_error_t            memory_error;
 };
 
 
@@ -18,6 +18,7 @@
 #include "mongoc-bulk-operation.h"
 #include "mongoc-bulk-operation-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-counters-private.h"
 #include "mongoc-error.h"
 #include "mongoc-opcode.h"
 #include "mongoc-trace.h"
@@ -76,7 +77,7 @@ _mongoc_bulk_operation_new (mongoc_client_t              *client,        /* IN *
    bulk->database = bson_strdup (database);
    bulk->collection = bson_strdup (collection);
    bulk->hint = hint;
-   bulk->write_concern = mongoc_write_concern_copy (write_concern);
+   bulk->write_concern = _mongoc_write_concern_share (write_concern);
    bulk->executed = false;
 
    return bulk;
@@ -96,6 +97,8 @@ mongoc_bulk_operation_destroy (mongoc_bulk_operation_t *bulk) /* IN */
          _mongoc_write_command_destroy (command);
       }
 
+      mongoc_counter_bulk_bytes_held_add (-(int64_t)bulk->memory_used);
+
       bson_free (bulk->database);
       bson_free (bulk->collection);
       mongoc_write_concern_destroy (bulk->write_concern);
@@ -110,6 +113,187 @@ mongoc_bulk_operation_destroy (mongoc_bulk_operation_t *bulk) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_operation_run --
+ *
+ *       Execute the pending commands of @bulk, merging their results into
+ *       bulk->result. Document indexes continue from bulk->offset so that
+ *       commands executed early by _mongoc_bulk_operation_spill() and the
+ *       ones executed later by mongoc_bulk_operation_execute() report
+ *       indexes relative to the whole bulk operation.
+ *
+ * Returns:
+ *       The hint of the node the last command was executed on.
+ *
+ * Side effects:
+ *       bulk->offset is advanced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_bulk_operation_run (mongoc_bulk_operation_t *bulk) /* IN */
+{
+   mongoc_write_command_t *command;
+   uint32_t hint = 0;
+   int64_t deadline;
+   int i;
+
+   ENTRY;
+
+   deadline = _mongoc_cluster_set_deadline (&bulk->client->cluster,
+                                            bulk->operation_timeout_msec);
+
+   for (i = 0; i < bulk->commands.len; i++) {
+      command = &_mongoc_array_index (&bulk->commands,
+                                      mongoc_write_command_t, i);
+
+      if (bulk->ordered) {
+         _mongoc_write_command_execute (command, bulk->client, hint,
+                                        bulk->database, bulk->collection,
+                                        bulk->write_concern, bulk->offset,
+                                        &bulk->result);
+      } else {
+         _mongoc_write_command_execute_concurrent (command, bulk->client, hint,
+                                                   bulk->database,
+                                                   bulk->collection,
+                                                   bulk->write_concern,
+                                                   bulk->offset,
+                                                   &bulk->result);
+      }
+
+      hint = command->hint;
+
+      if (bulk->result.failed && bulk->ordered) {
+         break;
+      }
+
+      bulk->offset += command->n_documents;
+   }
+
+   _mongoc_cluster_restore_deadline (&bulk->client->cluster, deadline);
+
+   RETURN (hint);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_operation_spill --
+ *
+ *       Execute the commands queued so far on an unordered bulk operation
+ *       and release them, so that the bulk operation can keep growing
+ *       without holding more than its memory ceiling. The results are
+ *       kept and reported by the next mongoc_bulk_operation_execute().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Queued commands are sent to the server and destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_bulk_operation_spill (mongoc_bulk_operation_t *bulk) /* IN */
+{
+   mongoc_write_command_t *command;
+   int i;
+
+   ENTRY;
+
+   BSON_ASSERT (!bulk->ordered);
+
+   if (!bulk->spilled) {
+      if (bulk->executed) {
+         _mongoc_write_result_destroy (&bulk->result);
+      }
+
+      _mongoc_write_result_init (&bulk->result);
+      bulk->executed = true;
+      bulk->spilled = true;
+      bulk->offset = 0;
+   }
+
+   _mongoc_bulk_operation_run (bulk);
+
+   for (i = 0; i < bulk->commands.len; i++) {
+      command = &_mongoc_array_index (&bulk->commands,
+                                      mongoc_write_command_t, i);
+      _mongoc_write_command_destroy (command);
+   }
+
+   _mongoc_array_clear (&bulk->commands);
+
+   mongoc_counter_bulk_bytes_held_add (-(int64_t)bulk->memory_used);
+   bulk->memory_used = 0;
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_operation_reserve --
+ *
+ *       Account for @len more bytes of operations about to be queued on
+ *       @bulk. If that would take the bulk operation over its memory
+ *       ceiling, an unordered bulk operation executes what it has queued
+ *       so far, while an ordered one cannot and fails instead.
+ *
+ *       A single operation larger than the ceiling is always accepted
+ *       into an empty bulk operation so that it can make progress.
+ *
+ * Returns:
+ *       true if the operation may be queued, false if it must be dropped.
+ *
+ * Side effects:
+ *       On failure the error is recorded and returned by
+ *       mongoc_bulk_operation_execute(); every later operation is dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_bulk_operation_reserve (mongoc_bulk_operation_t *bulk, /* IN */
+                                size_t                   len)  /* IN */
+{
+   if (bulk->memory_exceeded) {
+      return false;
+   }
+
+   if (bulk->max_memory &&
+       bulk->commands.len &&
+       (bulk->memory_used + len) > bulk->max_memory) {
+      if (bulk->ordered ||
+          !bulk->client ||
+          !bulk->database ||
+          !bulk->collection) {
+         bson_set_error (&bulk->memory_error,
+                         MONGOC_ERROR_COMMAND,
+                         MONGOC_ERROR_COMMAND_INVALID_ARG,
+                         "Bulk operation exceeds its memory limit of "
+                         "%" PRIu64 " bytes.",
+                         (uint64_t)bulk->max_memory);
+         bulk->memory_exceeded = true;
+         return false;
+      }
+
+      _mongoc_bulk_operation_spill (bulk);
+   }
+
+   bulk->memory_used += len;
+   mongoc_counter_bulk_bytes_held_add (len);
+
+   return true;
+}
+
+
 void
 mongoc_bulk_operation_remove (mongoc_bulk_operation_t *bulk,     /* IN */
                               const bson_t            *selector) /* IN */
@@ -122,6 +306,10 @@ mongoc_bulk_operation_remove (mongoc_bulk_operation_t *bulk,     /* IN */
    bson_return_if_fail (bulk);
    bson_return_if_fail (selector);
 
+   if (!_mongoc_bulk_operation_reserve (bulk, selector->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
@@ -153,6 +341,10 @@ mongoc_bulk_operation_remove_one (mongoc_bulk_operation_t *bulk,     /* IN */
    bson_return_if_fail (bulk);
    bson_return_if_fail (selector);
 
+   if (!_mongoc_bulk_operation_reserve (bulk, selector->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
@@ -208,19 +400,26 @@ mongoc_bulk_operation_insert (mongoc_bulk_operation_t *bulk,
    bson_return_if_fail (bulk);
    bson_return_if_fail (document);
 
+   if (!_mongoc_bulk_operation_reserve (bulk, document->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
                                    bulk->commands.len - 1);
 
       if (last->type == MONGOC_WRITE_COMMAND_INSERT) {
+         last->oid_gen = bulk->client ? bulk->client->oid_gen : NULL;
          _mongoc_write_command_insert_append (last, &document, 1);
          EXIT;
       }
    }
 
-   _mongoc_write_command_init_insert (&command, &document, 1, bulk->ordered,
+   _mongoc_write_command_init_insert (&command, NULL, 0, bulk->ordered,
       !_mongoc_write_concern_needs_gle (bulk->write_concern));
+   command.oid_gen = bulk->client ? bulk->client->oid_gen : NULL;
+   _mongoc_write_command_insert_append (&command, &document, 1);
 
    _mongoc_array_append_val (&bulk->commands, command);
 
@@ -244,7 +443,8 @@ mongoc_bulk_operation_replace_one (mongoc_bulk_operation_t *bulk,
 
    ENTRY;
 
-   if (!bson_validate (document,
+   if (!bulk->skip_validation &&
+       !bson_validate (document,
                        (BSON_VALIDATE_DOT_KEYS | BSON_VALIDATE_DOLLAR_KEYS),
                        &err_off)) {
       MONGOC_WARNING ("%s(): replacement document may not contain "
@@ -253,6 +453,10 @@ mongoc_bulk_operation_replace_one (mongoc_bulk_operation_t *bulk,
       EXIT;
    }
 
+   if (!_mongoc_bulk_operation_reserve (bulk, selector->len + document->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
@@ -271,6 +475,99 @@ mongoc_bulk_operation_replace_one (mongoc_bulk_operation_t *bulk,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_operation_upsert_many_by_key --
+ *
+ *       Queue a replace_one() upsert of each of @documents, selected by the
+ *       value found at @key_path in the document itself. The selectors are
+ *       never built as separate documents; each update statement is
+ *       written straight into the queued update command.
+ *
+ *       Documents that lack @key_path, or that may not be stored as a
+ *       replacement, are skipped with a warning.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_bulk_operation_upsert_many_by_key (mongoc_bulk_operation_t  *bulk,
+                                          const char               *key_path,
+                                          const bson_t            **documents,
+                                          uint32_t                  n_documents)
+{
+   mongoc_write_command_t command = { 0 };
+   mongoc_write_command_t *last;
+   const bson_t *document;
+   bson_iter_t iter;
+   bson_iter_t value;
+   size_t err_off;
+   size_t key_len;
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_if_fail (bulk);
+   bson_return_if_fail (key_path);
+   bson_return_if_fail (documents || !n_documents);
+
+   key_len = strlen (key_path);
+
+   for (i = 0; i < n_documents; i++) {
+      document = documents [i];
+
+      if (!bson_iter_init (&iter, document) ||
+          !bson_iter_find_descendant (&iter, key_path, &value)) {
+         MONGOC_WARNING ("%s(): document %u has no \"%s\" field. "
+                         "Ignoring document.",
+                         __FUNCTION__, i, key_path);
+         continue;
+      }
+
+      if (!bulk->skip_validation &&
+          !bson_validate (document,
+                          (BSON_VALIDATE_DOT_KEYS | BSON_VALIDATE_DOLLAR_KEYS),
+                          &err_off)) {
+         MONGOC_WARNING ("%s(): replacement document may not contain "
+                         "$ or . in keys. Ingoring document.",
+                         __FUNCTION__);
+         continue;
+      }
+
+      /* the selector holds the key and its value over again */
+      if (!_mongoc_bulk_operation_reserve (
+             bulk, 5 + key_len + (value.next_off - value.off) +
+             document->len)) {
+         EXIT;
+      }
+
+      if (bulk->commands.len) {
+         last = &_mongoc_array_index (&bulk->commands,
+                                      mongoc_write_command_t,
+                                      bulk->commands.len - 1);
+         if (last->type == MONGOC_WRITE_COMMAND_UPDATE) {
+            _mongoc_write_command_upsert_append (last, key_path, &value,
+                                                 document);
+            continue;
+         }
+      }
+
+      _mongoc_write_command_init_upsert (&command, key_path, &value,
+                                         document, bulk->ordered);
+      _mongoc_array_append_val (&bulk->commands, command);
+   }
+
+   EXIT;
+}
+
+
 void
 mongoc_bulk_operation_update (mongoc_bulk_operation_t *bulk,
                               const bson_t            *selector,
@@ -298,6 +595,10 @@ mongoc_bulk_operation_update (mongoc_bulk_operation_t *bulk,
       }
    }
 
+   if (!_mongoc_bulk_operation_reserve (bulk, selector->len + document->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
@@ -341,6 +642,10 @@ mongoc_bulk_operation_update_one (mongoc_bulk_operation_t *bulk,
       }
    }
 
+   if (!_mongoc_bulk_operation_reserve (bulk, selector->len + document->len)) {
+      EXIT;
+   }
+
    if (bulk->commands.len) {
       last = &_mongoc_array_index (&bulk->commands,
                                    mongoc_write_command_t,
@@ -363,21 +668,29 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk,  /* IN */
                                bson_t                  *reply, /* OUT */
                                bson_error_t            *error) /* OUT */
 {
-   mongoc_write_command_t *command;
-   uint32_t hint = 0;
+   uint32_t hint;
+   bool spilled;
    bool ret;
-   uint32_t offset = 0;
-   int i;
 
    ENTRY;
 
    bson_return_val_if_fail (bulk, false);
 
-   if (bulk->executed) {
-      _mongoc_write_result_destroy (&bulk->result);
-   }
+   /*
+    * Commands executed early to stay under the memory ceiling have already
+    * merged their results, keep those rather than starting over.
+    */
+   spilled = bulk->spilled;
+   bulk->spilled = false;
+
+   if (!spilled) {
+      if (bulk->executed) {
+         _mongoc_write_result_destroy (&bulk->result);
+      }
 
-   _mongoc_write_result_init (&bulk->result);
+      _mongoc_write_result_init (&bulk->result);
+      bulk->offset = 0;
+   }
 
    bulk->executed = true;
 
@@ -408,7 +721,14 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk,  /* IN */
       bson_init (reply);
    }
 
-   if (!bulk->commands.len) {
+   if (bulk->memory_exceeded) {
+      if (error) {
+         memcpy (error, &bulk->memory_error, sizeof *error);
+      }
+      RETURN (false);
+   }
+
+   if (!bulk->commands.len && !spilled) {
       bson_set_error (error,
                       MONGOC_ERROR_COMMAND,
                       MONGOC_ERROR_COMMAND_INVALID_ARG,
@@ -416,25 +736,8 @@ mongoc_bulk_operation_execute (mongoc_bulk_operation_t *bulk,  /* IN */
       RETURN (false);
    }
 
-   for (i = 0; i < bulk->commands.len; i++) {
-      command = &_mongoc_array_index (&bulk->commands,
-                                      mongoc_write_command_t, i);
-
-      _mongoc_write_command_execute (command, bulk->client, hint,
-                                     bulk->database, bulk->collection,
-                                     bulk->write_concern, offset,
-                                     &bulk->result);
+   hint = _mongoc_bulk_operation_run (bulk);
 
-      hint = command->hint;
-
-      if (bulk->result.failed && bulk->ordered) {
-         GOTO (cleanup);
-      }
-
-      offset += command->n_documents;
-   }
-
-cleanup:
    ret = _mongoc_write_result_complete (&bulk->result, reply, error);
 
    RETURN (ret ? hint : 0);
@@ -451,7 +754,7 @@ mongoc_bulk_operation_set_write_concern (mongoc_bulk_operation_t      *bulk,
    }
 
    if (write_concern) {
-      bulk->write_concern = mongoc_write_concern_copy (write_concern);
+      bulk->write_concern = _mongoc_write_concern_share (write_concern);
    } else {
       bulk->write_concern = mongoc_write_concern_new ();
    }
@@ -512,3 +815,22 @@ mongoc_bulk_operation_set_hint (mongoc_bulk_operation_t *bulk,
 
    bulk->hint = hint;
 }
+
+
+void
+mongoc_bulk_operation_set_max_memory (mongoc_bulk_operation_t *bulk,
+                                      size_t                   max_bytes)
+{
+   bson_return_if_fail (bulk);
+
+   bulk->max_memory = max_bytes;
+}
+
+
+size_t
+mongoc_bulk_operation_get_memory_usage (const mongoc_bulk_operation_t *bulk)
+{
+   bson_return_val_if_fail (bulk, 0);
+
+   return bulk->memory_used;
+}
@@ -58,6 +58,11 @@ void mongoc_bulk_operation_update_one  (mongoc_bulk_operation_t       *bulk,
                                         const bson_t                  *selector,
                                         const bson_t                  *document,
                                         bool                           upsert);
+void mongoc_bulk_operation_upsert_many_by_key
+                                       (mongoc_bulk_operation_t       *bulk,
+                                        const char                    *key_path,
+                                        const bson_t                 **documents,
+                                        uint32_t                       n_documents);
 
 
 /*
@@ -76,6 +81,9 @@ void                          mongoc_bulk_operation_set_client        (mongoc_bu
                                                                        void                          *client);
 void                          mongoc_bulk_operation_set_hint          (mongoc_bulk_operation_t       *bulk,
                                                                        uint32_t                       hint);
+void                          mongoc_bulk_operation_set_max_memory    (mongoc_bulk_operation_t       *bulk,
+                                                                       size_t                         max_bytes);
+size_t                        mongoc_bulk_operation_get_memory_usage  (const mongoc_bulk_operation_t *bulk);
 
 BSON_END_DECLS
 
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_BULK_WRITER_PRIVATE_H
+#define MONGOC_BULK_WRITER_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include "mongoc-bulk-writer.h"
+#include "mongoc-client.h"
+#include "mongoc-write-command-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Room left in a batch for the field names and array keys that wrap each
+ * operation, on top of the documents themselves.
+ */
+#define MONGOC_BULK_WRITER_OP_OVERHEAD 64
+
+
+struct _mongoc_bulk_writer_t
+{
+   mongoc_client_t        *client;
+   char                   *database;
+   char                   *collection;
+   mongoc_write_concern_t *write_concern;
+   bool                    ordered;
+   bool                    pipelined;
+   uint32_t                hint;
+   uint32_t                operation_timeout_msec;
+   bool                    skip_validation;
+
+   /* the batch being built */
+   mongoc_write_command_t  command;
+   bool                    has_command;
+
+   /* the previous batch, sent but its reply not read yet, and what was
+    * taken from the memory budget to keep it */
+   mongoc_write_command_t  in_flight;
+   bool                    has_in_flight;
+   uint32_t                in_flight_request_id;
+   uint32_t                in_flight_offset;
+   size_t                  in_flight_reserved;
+
+   /* the number of operations in the batches already sent */
+   uint32_t                offset;
+   mongoc_write_result_t   result;
+};
+
+
+mongoc_bulk_writer_t *_mongoc_bulk_writer_new  (mongoc_client_t              *client,
+                                                const char                   *database,
+                                                const char                   *collection,
+                                                bool                          ordered,
+                                                const mongoc_write_concern_t *write_concern);
+void                  _mongoc_bulk_writer_recv (mongoc_bulk_writer_t         *writer);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_BULK_WRITER_PRIVATE_H */
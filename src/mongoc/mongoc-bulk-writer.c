@@ -0,0 +1,608 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-bulk-writer.h"
+#include "mongoc-bulk-writer-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-error.h"
+#include "mongoc-memory-budget-private.h"
+#include "mongoc-trace.h"
+#include "mongoc-write-command-private.h"
+#include "mongoc-write-concern-private.h"
+
+
+/*
+ * A bulk writer is a mongoc_bulk_operation_t that does not wait for
+ * execute(). Operations are gathered into a write command like a bulk
+ * operation does, but the command is sent as soon as one more operation
+ * would take it past the limits of the server, so memory use is bounded by
+ * the size of one batch.
+ *
+ * When pipelined, a full batch is sent without waiting for its reply and
+ * the next one is built meanwhile. Its reply is read right before the next
+ * batch is sent, or before anything else is sent on the client, so there is
+ * never more than one batch in flight and an ordered write still stops at
+ * the first batch that fails. A batch is only left in flight if it fits in
+ * the memory budget; otherwise its reply is waited for as if the writer
+ * were not pipelined.
+ */
+
+
+#define MAX_WRITE_BATCH 1000
+
+
+mongoc_bulk_writer_t *
+_mongoc_bulk_writer_new (mongoc_client_t              *client,        /* IN */
+                         const char                   *database,      /* IN */
+                         const char                   *collection,    /* IN */
+                         bool                          ordered,       /* IN */
+                         const mongoc_write_concern_t *write_concern) /* IN */
+{
+   mongoc_bulk_writer_t *writer;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (collection);
+
+   writer = bson_malloc0 (sizeof *writer);
+   writer->client = client;
+   writer->database = bson_strdup (database);
+   writer->collection = bson_strdup (collection);
+   writer->write_concern = _mongoc_write_concern_share (write_concern);
+   writer->ordered = ordered;
+
+   _mongoc_write_result_init (&writer->result);
+
+   return writer;
+}
+
+
+void
+mongoc_bulk_writer_destroy (mongoc_bulk_writer_t *writer) /* IN */
+{
+   if (writer) {
+      /* the reply has to be taken off the socket either way */
+      _mongoc_bulk_writer_recv (writer);
+
+      if (writer->has_command) {
+         _mongoc_write_command_destroy (&writer->command);
+      }
+
+      bson_free (writer->database);
+      bson_free (writer->collection);
+      mongoc_write_concern_destroy (writer->write_concern);
+      _mongoc_write_result_destroy (&writer->result);
+
+      bson_free (writer);
+   }
+}
+
+
+void
+mongoc_bulk_writer_set_pipelined (mongoc_bulk_writer_t *writer,    /* IN */
+                                  bool                  pipelined) /* IN */
+{
+   bson_return_if_fail (writer);
+
+   writer->pipelined = pipelined;
+}
+
+
+bool
+mongoc_bulk_writer_get_pipelined (const mongoc_bulk_writer_t *writer) /* IN */
+{
+   bson_return_val_if_fail (writer, false);
+
+   return writer->pipelined;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_writer_recv --
+ *
+ *       Read the reply to the batch @writer has in flight, if any, and
+ *       merge it into the results so far.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A failure is recorded in @writer->result.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_bulk_writer_recv (mongoc_bulk_writer_t *writer) /* IN */
+{
+   ENTRY;
+
+   BSON_ASSERT (writer);
+
+   if (!writer->has_in_flight) {
+      EXIT;
+   }
+
+   if (writer->client->bulk_writer == writer) {
+      writer->client->bulk_writer = NULL;
+   }
+
+   _mongoc_write_command_recv (&writer->in_flight, writer->client,
+                               writer->in_flight_request_id,
+                               writer->in_flight_offset, &writer->result);
+
+   _mongoc_write_command_destroy (&writer->in_flight);
+   writer->has_in_flight = false;
+
+   _mongoc_memory_budget_release (writer->in_flight_reserved);
+   writer->in_flight_reserved = 0;
+
+   EXIT;
+}
+
+
+static bool
+_mongoc_bulk_writer_stopped (mongoc_bulk_writer_t *writer, /* IN */
+                             bson_error_t         *error)  /* OUT */
+{
+   if (writer->ordered && writer->result.failed) {
+      _mongoc_write_result_complete (&writer->result, NULL, error);
+      return true;
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_writer_send --
+ *
+ *       Send the batch being built. If the writer is pipelined and the
+ *       server supports write commands it is left in flight, otherwise
+ *       this waits for the reply.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A failure is recorded in @writer->result.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_bulk_writer_send (mongoc_bulk_writer_t *writer) /* IN */
+{
+   mongoc_write_command_t *command = &writer->command;
+   mongoc_client_t *client = writer->client;
+   uint32_t request_id;
+   int64_t deadline;
+   size_t reserved = 0;
+
+   ENTRY;
+
+   if (!writer->has_command) {
+      EXIT;
+   }
+
+   _mongoc_bulk_writer_recv (writer);
+
+   if (writer->ordered && writer->result.failed) {
+      GOTO (cleanup);
+   }
+
+   deadline = _mongoc_cluster_set_deadline (&client->cluster,
+                                            writer->operation_timeout_msec);
+
+   if (writer->pipelined &&
+       _mongoc_memory_budget_reserve (command->documents->len)) {
+      reserved = command->documents->len;
+   }
+
+   if (reserved &&
+       _mongoc_write_command_send (command, client, writer->hint,
+                                   writer->database, writer->collection,
+                                   writer->write_concern, &request_id,
+                                   &writer->result)) {
+      if (request_id) {
+         memcpy (&writer->in_flight, command, sizeof *command);
+         writer->has_in_flight = true;
+         writer->in_flight_request_id = request_id;
+         writer->in_flight_offset = writer->offset;
+         writer->in_flight_reserved = reserved;
+         client->bulk_writer = writer;
+         command = NULL;
+         reserved = 0;
+      }
+   } else {
+      _mongoc_write_command_execute (command, client, writer->hint,
+                                     writer->database, writer->collection,
+                                     writer->write_concern, writer->offset,
+                                     &writer->result);
+   }
+
+   _mongoc_cluster_restore_deadline (&client->cluster, deadline);
+   _mongoc_memory_budget_release (reserved);
+
+   writer->hint = writer->has_in_flight ? writer->in_flight.hint
+                                        : writer->command.hint;
+   writer->offset += writer->command.n_documents;
+
+cleanup:
+   if (command) {
+      _mongoc_write_command_destroy (command);
+   }
+
+   writer->has_command = false;
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_bulk_writer_prepare --
+ *
+ *       Make room for an operation of type @type taking about @len bytes.
+ *       The batch being built is sent first if the operation can't join
+ *       it, or if it would then exceed the batch size, document size or
+ *       message size limits of the node it is going to.
+ *
+ * Returns:
+ *       true if the operation may be appended; otherwise false and
+ *       @error is set because an ordered write has already failed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_bulk_writer_prepare (mongoc_bulk_writer_t *writer, /* IN */
+                             int                   type,   /* IN */
+                             bool                  multi,  /* IN */
+                             uint32_t              len,    /* IN */
+                             bson_error_t         *error)  /* OUT */
+{
+   mongoc_cluster_node_t *node = NULL;
+   mongoc_cluster_t *cluster;
+   int32_t max_batch = MAX_WRITE_BATCH;
+   int32_t max_size;
+   bool full;
+
+   ENTRY;
+
+   if (_mongoc_bulk_writer_stopped (writer, error)) {
+      RETURN (false);
+   }
+
+   if (!writer->has_command) {
+      RETURN (true);
+   }
+
+   cluster = &writer->client->cluster;
+
+   if (writer->hint && (writer->hint <= cluster->nodes_len)) {
+      node = &cluster->nodes [writer->hint - 1];
+      if (_mongoc_cluster_max_write_batch_size (cluster, node)) {
+         max_batch = _mongoc_cluster_max_write_batch_size (cluster, node);
+      }
+   }
+
+   max_size = BSON_MIN (cluster->max_bson_size, cluster->max_msg_size);
+   len += MONGOC_BULK_WRITER_OP_OVERHEAD;
+
+   full = ((writer->command.n_documents >= (uint32_t)max_batch) ||
+           (writer->command.documents->len + len > (uint32_t)max_size));
+
+   if (full ||
+       (writer->command.type != type) ||
+       ((type == MONGOC_WRITE_COMMAND_DELETE) &&
+        (writer->command.u.delete.multi != multi))) {
+      _mongoc_bulk_writer_send (writer);
+
+      if (_mongoc_bulk_writer_stopped (writer, error)) {
+         RETURN (false);
+      }
+   }
+
+   RETURN (true);
+}
+
+
+bool
+mongoc_bulk_writer_insert (mongoc_bulk_writer_t *writer,   /* IN */
+                           const bson_t         *document, /* IN */
+                           bson_error_t         *error)    /* OUT */
+{
+   ENTRY;
+
+   bson_return_val_if_fail (writer, false);
+   bson_return_val_if_fail (document, false);
+
+   if (!_mongoc_bulk_writer_prepare (writer, MONGOC_WRITE_COMMAND_INSERT,
+                                     false, document->len, error)) {
+      RETURN (false);
+   }
+
+   if (!writer->has_command) {
+      _mongoc_write_command_init_insert (
+         &writer->command, NULL, 0, writer->ordered,
+         !_mongoc_write_concern_needs_gle (writer->write_concern));
+      writer->has_command = true;
+   }
+
+   writer->command.oid_gen = writer->client->oid_gen;
+   _mongoc_write_command_insert_append (&writer->command, &document, 1);
+
+   RETURN (true);
+}
+
+
+static bool
+_mongoc_bulk_writer_remove (mongoc_bulk_writer_t *writer,   /* IN */
+                            const bson_t         *selector, /* IN */
+                            bool                  multi,    /* IN */
+                            bson_error_t         *error)    /* OUT */
+{
+   ENTRY;
+
+   bson_return_val_if_fail (writer, false);
+   bson_return_val_if_fail (selector, false);
+
+   if (!_mongoc_bulk_writer_prepare (writer, MONGOC_WRITE_COMMAND_DELETE,
+                                     multi, selector->len, error)) {
+      RETURN (false);
+   }
+
+   if (writer->has_command) {
+      _mongoc_write_command_delete_append (&writer->command, selector);
+   } else {
+      _mongoc_write_command_init_delete (&writer->command, selector, multi,
+                                         writer->ordered);
+      writer->has_command = true;
+   }
+
+   RETURN (true);
+}
+
+
+bool
+mongoc_bulk_writer_remove (mongoc_bulk_writer_t *writer,   /* IN */
+                           const bson_t         *selector, /* IN */
+                           bson_error_t         *error)    /* OUT */
+{
+   return _mongoc_bulk_writer_remove (writer, selector, true, error);
+}
+
+
+bool
+mongoc_bulk_writer_remove_one (mongoc_bulk_writer_t *writer,   /* IN */
+                               const bson_t         *selector, /* IN */
+                               bson_error_t         *error)    /* OUT */
+{
+   return _mongoc_bulk_writer_remove (writer, selector, false, error);
+}
+
+
+static bool
+_mongoc_bulk_writer_update (mongoc_bulk_writer_t *writer,   /* IN */
+                            const bson_t         *selector, /* IN */
+                            const bson_t         *document, /* IN */
+                            bool                  upsert,   /* IN */
+                            bool                  multi,    /* IN */
+                            bson_error_t         *error)    /* OUT */
+{
+   ENTRY;
+
+   if (!_mongoc_bulk_writer_prepare (writer, MONGOC_WRITE_COMMAND_UPDATE,
+                                     multi, selector->len + document->len,
+                                     error)) {
+      RETURN (false);
+   }
+
+   if (writer->has_command) {
+      _mongoc_write_command_update_append (&writer->command, selector,
+                                           document, upsert, multi);
+   } else {
+      _mongoc_write_command_init_update (&writer->command, selector,
+                                         document, upsert, multi,
+                                         writer->ordered);
+      writer->has_command = true;
+   }
+
+   RETURN (true);
+}
+
+
+static bool
+_mongoc_bulk_writer_check_operators (const bson_t *document, /* IN */
+                                     bson_error_t *error)    /* OUT */
+{
+   bson_iter_t iter;
+
+   if (bson_iter_init (&iter, document)) {
+      while (bson_iter_next (&iter)) {
+         if (!strchr (bson_iter_key (&iter), '$')) {
+            bson_set_error (error,
+                            MONGOC_ERROR_COMMAND,
+                            MONGOC_ERROR_COMMAND_INVALID_ARG,
+                            "An update only works with $ operators.");
+            return false;
+         }
+      }
+   }
+
+   return true;
+}
+
+
+bool
+mongoc_bulk_writer_replace_one (mongoc_bulk_writer_t *writer,   /* IN */
+                                const bson_t         *selector, /* IN */
+                                const bson_t         *document, /* IN */
+                                bool                  upsert,   /* IN */
+                                bson_error_t         *error)    /* OUT */
+{
+   size_t err_off;
+
+   bson_return_val_if_fail (writer, false);
+   bson_return_val_if_fail (selector, false);
+   bson_return_val_if_fail (document, false);
+
+   if (!writer->skip_validation &&
+       !bson_validate (document,
+                       (BSON_VALIDATE_DOT_KEYS | BSON_VALIDATE_DOLLAR_KEYS),
+                       &err_off)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "A replacement document may not contain "
+                      "$ or . in keys.");
+      return false;
+   }
+
+   return _mongoc_bulk_writer_update (writer, selector, document, upsert,
+                                      false, error);
+}
+
+
+bool
+mongoc_bulk_writer_update (mongoc_bulk_writer_t *writer,   /* IN */
+                           const bson_t         *selector, /* IN */
+                           const bson_t         *document, /* IN */
+                           bool                  upsert,   /* IN */
+                           bson_error_t         *error)    /* OUT */
+{
+   bson_return_val_if_fail (writer, false);
+   bson_return_val_if_fail (selector, false);
+   bson_return_val_if_fail (document, false);
+
+   if (!_mongoc_bulk_writer_check_operators (document, error)) {
+      return false;
+   }
+
+   return _mongoc_bulk_writer_update (writer, selector, document, upsert,
+                                      true, error);
+}
+
+
+bool
+mongoc_bulk_writer_update_one (mongoc_bulk_writer_t *writer,   /* IN */
+                               const bson_t         *selector, /* IN */
+                               const bson_t         *document, /* IN */
+                               bool                  upsert,   /* IN */
+                               bson_error_t         *error)    /* OUT */
+{
+   bson_return_val_if_fail (writer, false);
+   bson_return_val_if_fail (selector, false);
+   bson_return_val_if_fail (document, false);
+
+   if (!_mongoc_bulk_writer_check_operators (document, error)) {
+      return false;
+   }
+
+   return _mongoc_bulk_writer_update (writer, selector, document, upsert,
+                                      false, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_writer_flush --
+ *
+ *       Send the operations gathered so far and wait for all replies,
+ *       including that of a batch in flight.
+ *
+ * Returns:
+ *       false and @error is set if an ordered write has failed; otherwise
+ *       true. Failures of an unordered write are reported by
+ *       mongoc_bulk_writer_finish().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_bulk_writer_flush (mongoc_bulk_writer_t *writer, /* IN */
+                          bson_error_t         *error)  /* OUT */
+{
+   ENTRY;
+
+   bson_return_val_if_fail (writer, false);
+
+   _mongoc_bulk_writer_send (writer);
+   _mongoc_bulk_writer_recv (writer);
+
+   RETURN (!_mongoc_bulk_writer_stopped (writer, error));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_bulk_writer_finish --
+ *
+ *       Flush @writer and report the outcome of every operation pushed
+ *       to it, like mongoc_bulk_operation_execute().
+ *
+ * Returns:
+ *       true if all operations succeeded; otherwise false and @error is
+ *       set.
+ *
+ * Side effects:
+ *       @reply is initialized with the aggregated results if not NULL.
+ *       The results are reset, so @writer can be used for another write.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_bulk_writer_finish (mongoc_bulk_writer_t *writer, /* IN */
+                           bson_t               *reply,  /* OUT */
+                           bson_error_t         *error)  /* OUT */
+{
+   bool ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (writer, false);
+
+   if (reply) {
+      bson_init (reply);
+   }
+
+   _mongoc_bulk_writer_send (writer);
+   _mongoc_bulk_writer_recv (writer);
+
+   ret = _mongoc_write_result_complete (&writer->result, reply, error);
+
+   _mongoc_write_result_destroy (&writer->result);
+   _mongoc_write_result_init (&writer->result);
+   writer->offset = 0;
+
+   RETURN (ret);
+}
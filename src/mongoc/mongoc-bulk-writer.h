@@ -0,0 +1,69 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MONGOC_BULK_WRITER_H
+#define MONGOC_BULK_WRITER_H
+
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_bulk_writer_t mongoc_bulk_writer_t;
+
+
+void mongoc_bulk_writer_destroy       (mongoc_bulk_writer_t       *writer);
+void mongoc_bulk_writer_set_pipelined (mongoc_bulk_writer_t       *writer,
+                                       bool                        pipelined);
+bool mongoc_bulk_writer_get_pipelined (const mongoc_bulk_writer_t *writer);
+bool mongoc_bulk_writer_insert        (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *document,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_remove        (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *selector,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_remove_one    (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *selector,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_replace_one   (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *selector,
+                                       const bson_t               *document,
+                                       bool                        upsert,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_update        (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *selector,
+                                       const bson_t               *document,
+                                       bool                        upsert,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_update_one    (mongoc_bulk_writer_t       *writer,
+                                       const bson_t               *selector,
+                                       const bson_t               *document,
+                                       bool                        upsert,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_flush         (mongoc_bulk_writer_t       *writer,
+                                       bson_error_t               *error);
+bool mongoc_bulk_writer_finish        (mongoc_bulk_writer_t       *writer,
+                                       bson_t                     *reply,
+                                       bson_error_t               *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_BULK_WRITER_H */
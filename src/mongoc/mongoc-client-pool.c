@@ -16,26 +16,175 @@
 
 
 #include "mongoc-counters-private.h"
+#include "mongoc-error.h"
 #include "mongoc-client-pool-private.h"
 #include "mongoc-queue-private.h"
 #include "mongoc-thread-private.h"
 #include "mongoc-cluster-private.h"
+#include "mongoc-cluster-monitor-private.h"
 #include "mongoc-client-private.h"
 #include "mongoc-trace.h"
+#include "mongoc-write-command-private.h"
 
+#ifdef MONGOC_ENABLE_SSL
+#include "mongoc-stream-tls-private.h"
+#endif
 
-struct _mongoc_client_pool_t
+
+#ifndef MONGOC_CLIENT_POOL_HEARTBEAT_FREQUENCY_MSEC
+/*
+ * How often the shared topology of a pool is refreshed when the URI does
+ * not set heartbeatFrequencyMS.
+ */
+#define MONGOC_CLIENT_POOL_HEARTBEAT_FREQUENCY_MSEC 10000
+#endif
+
+
+#ifndef MONGOC_CLIENT_POOL_N_SHARDS
+/*
+ * How many lists the idle clients of a pool are spread over, so that
+ * threads popping and pushing clients rarely contend for the same lock.
+ */
+#define MONGOC_CLIENT_POOL_N_SHARDS 8
+#endif
+
+
+typedef struct
 {
    mongoc_mutex_t    mutex;
-   mongoc_cond_t     cond;
    mongoc_queue_t    queue;
+} mongoc_client_pool_shard_t;
+
+
+/*
+ * The client a thread pushed last, kept for that thread to pop again
+ * when the pool has thread affinity. Slots live as long as the pool, and
+ * other threads take their client once the shards run dry.
+ */
+typedef struct _mongoc_client_pool_slot_t
+{
+   mongoc_mutex_t                     mutex;
+   mongoc_client_t                   *client;
+   struct _mongoc_client_pool_slot_t *next;
+} mongoc_client_pool_slot_t;
+
+
+/*
+ * A thread waiting in line for a client of an exhausted pool.
+ */
+typedef struct _mongoc_client_pool_waiter_t
+{
+   mongoc_cond_t                        cond;
+   struct _mongoc_client_pool_waiter_t *prev;
+   struct _mongoc_client_pool_waiter_t *next;
+} mongoc_client_pool_waiter_t;
+
+
+/*
+ * An insert submitted to mongoc_client_pool_insert(), waiting to go out
+ * with the next batch of its group.
+ */
+typedef struct _mongoc_client_pool_insert_t
+{
+   const bson_t                        *document;
+   mongoc_cond_t                        cond;
+   bool                                 done;
+   bool                                 ret;
+   bson_error_t                         error;
+   struct _mongoc_client_pool_insert_t *next;
+} mongoc_client_pool_insert_t;
+
+
+/*
+ * The inserts into one namespace with one write concern. One submitting
+ * thread at a time flushes the group, sending all that was submitted so
+ * far as a single unordered insert, while the others queue up the next
+ * batch behind it.
+ */
+typedef struct _mongoc_client_pool_group_t
+{
+   char                               *database;
+   char                               *collection;
+   const mongoc_write_concern_t       *write_concern;
+   mongoc_client_pool_insert_t        *head;
+   mongoc_client_pool_insert_t        *tail;
+   uint32_t                            n_pending;
+   bool                                flushing;
+   struct _mongoc_client_pool_group_t *next;
+} mongoc_client_pool_group_t;
+
+
+#define MONGOC_CLIENT_POOL_N_LANES 3
+
+
+/*
+ * The clients reserved for a lane, created as they are needed up to
+ * opts.max_size. They are only handed out by mongoc_client_pool_pop_lane()
+ * and do not count towards the size of the pool.
+ */
+typedef struct
+{
+   mongoc_mutex_t                 mutex;
+   mongoc_cond_t                  cond;
+   mongoc_queue_t                 queue;
+   bool                           enabled;
+   mongoc_client_pool_lane_opts_t opts;
+   uint32_t                       size;
+   uint32_t                       waiters;
+   uint64_t                       n_waits;
+   uint64_t                       n_exhausted;
+   volatile int64_t               checkout_usec [MONGOC_CLIENT_POOL_STATS_N_BUCKETS];
+} mongoc_client_pool_reserve_t;
+
+
+/*
+ * Idle clients live in the shards, each with a lock of its own. The pool
+ * mutex is only taken to create a client, to wait for one when the pool
+ * is exhausted, and to change the pool settings. size and waiters are
+ * updated atomically so that pushing a client need not take it.
+ */
+struct _mongoc_client_pool_t
+{
+   mongoc_mutex_t    mutex;
+   mongoc_client_pool_shard_t shards [MONGOC_CLIENT_POOL_N_SHARDS];
+   volatile int32_t  next_shard;
+   volatile int32_t  waiters;
+   mongoc_client_pool_waiter_t *waiter_head;
+   mongoc_client_pool_waiter_t *waiter_tail;
+   uint32_t          max_waiters;
+   int32_t           wait_queue_timeout_msec;
+   volatile int64_t  n_waits;
+   volatile int64_t  n_exhausted;
+   volatile int64_t  checkout_usec [MONGOC_CLIENT_POOL_STATS_N_BUCKETS];
    mongoc_uri_t     *uri;
    uint32_t          min_pool_size;
    uint32_t          max_pool_size;
-   uint32_t          size;
+   int64_t           max_idle_time_usec;
+   volatile int32_t  size;
+   mongoc_client_t  *topology_client;
+   mongoc_cluster_monitor_t *monitor;
+   bool              local_oids;
+   bool              thread_affinity;
+   bool              query_coalescing;
+   mongoc_query_flights_t query_flights;
+   mongoc_node_limiter_t node_limiter;
+   mongoc_apm_callbacks_t apm;
+   void             *apm_context;
+   mongoc_apm_topology_callbacks_t topology_callbacks;
+   void             *topology_context;
+   int32_t           slow_op_msec;
+   mongoc_apm_slow_op_cb_t slow_op_cb;
+   void             *slow_op_context;
+   bool              has_slot_key;
+   mongoc_thread_key_t slot_key;
+   mongoc_client_pool_slot_t *slots;
+   mongoc_mutex_t    group_mutex;
+   mongoc_client_pool_group_t *groups;
+   mongoc_client_pool_reserve_t lanes [MONGOC_CLIENT_POOL_N_LANES];
 #ifdef MONGOC_ENABLE_SSL
    bool              ssl_opts_set;
    mongoc_ssl_opt_t  ssl_opts;
+   SSL_CTX          *ssl_ctx;
 #endif
 };
 
@@ -52,10 +201,17 @@ mongoc_client_pool_set_ssl_opts (mongoc_client_pool_t   *pool,
    memset (&pool->ssl_opts, 0, sizeof pool->ssl_opts);
    pool->ssl_opts_set = false;
 
+   if (pool->ssl_ctx) {
+      SSL_CTX_free (pool->ssl_ctx);
+      pool->ssl_ctx = NULL;
+   }
+
    if (opts) {
       memcpy (&pool->ssl_opts, opts, sizeof pool->ssl_opts);
       pool->ssl_opts_set = true;
 
+      /* built once and shared by the TLS streams of every client */
+      pool->ssl_ctx = _mongoc_stream_tls_ctx_new (&pool->ssl_opts);
    }
 
    mongoc_mutex_unlock (&pool->mutex);
@@ -63,181 +219,2028 @@ mongoc_client_pool_set_ssl_opts (mongoc_client_pool_t   *pool,
 #endif
 
 
-mongoc_client_pool_t *
-mongoc_client_pool_new (const mongoc_uri_t *uri)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_local_oids --
+ *
+ *       Have each client popped from @pool generate the "_id" of inserted
+ *       documents with an ObjectId generator of its own, instead of the
+ *       default bson_context_t that all threads share. A client is only
+ *       used by one thread at a time, so this takes _id generation off
+ *       the shared state.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes effect for each client the next time it is popped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_set_local_oids (mongoc_client_pool_t *pool,
+                                   bool                  local_oids)
 {
-   mongoc_client_pool_t *pool;
-   const bson_t *b;
-   bson_iter_t iter;
+   bson_return_if_fail (pool);
 
-   ENTRY;
+   mongoc_mutex_lock (&pool->mutex);
+   pool->local_oids = local_oids;
+   mongoc_mutex_unlock (&pool->mutex);
+}
 
-   bson_return_val_if_fail(uri, NULL);
 
-   pool = bson_malloc0(sizeof *pool);
-   mongoc_mutex_init(&pool->mutex);
-   _mongoc_queue_init(&pool->queue);
-   pool->uri = mongoc_uri_copy(uri);
-   pool->min_pool_size = 0;
-   pool->max_pool_size = 100;
-   pool->size = 0;
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_apm_callbacks --
+ *
+ *       Set the command monitoring callbacks of each client popped from
+ *       @pool, see mongoc_client_set_apm_callbacks(). @callbacks is copied,
+ *       and NULL turns monitoring off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes effect for each client the next time it is popped.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   b = mongoc_uri_get_options(pool->uri);
+void
+mongoc_client_pool_set_apm_callbacks (mongoc_client_pool_t         *pool,
+                                      const mongoc_apm_callbacks_t *callbacks,
+                                      void                         *context)
+{
+   bson_return_if_fail (pool);
 
-   if (bson_iter_init_find_case(&iter, b, "minpoolsize")) {
-      if (BSON_ITER_HOLDS_INT32(&iter)) {
-         pool->min_pool_size = BSON_MAX(0, bson_iter_int32(&iter));
-      }
-   }
+   mongoc_mutex_lock (&pool->mutex);
 
-   if (bson_iter_init_find_case(&iter, b, "maxpoolsize")) {
-      if (BSON_ITER_HOLDS_INT32(&iter)) {
-         pool->max_pool_size = BSON_MAX(1, bson_iter_int32(&iter));
-      }
+   memset (&pool->apm, 0, sizeof pool->apm);
+   if (callbacks) {
+      memcpy (&pool->apm, callbacks, sizeof pool->apm);
    }
+   pool->apm_context = context;
 
-   mongoc_counter_client_pools_active_inc();
-
-   RETURN(pool);
+   mongoc_mutex_unlock (&pool->mutex);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_topology_callbacks --
+ *
+ *       Set the callbacks told when the monitor of @pool connects to a
+ *       node it was not connected to, when the primary changes, and when
+ *       the pool creates or destroys a client. They are called by the
+ *       monitor thread, so an application can start warming up a new
+ *       primary without holding up any operation. @callbacks is copied,
+ *       and NULL turns them off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
-mongoc_client_pool_destroy (mongoc_client_pool_t *pool)
+mongoc_client_pool_set_topology_callbacks (mongoc_client_pool_t                  *pool,
+                                           const mongoc_apm_topology_callbacks_t *callbacks,
+                                           void                                  *context)
 {
-   mongoc_client_t *client;
-
-   ENTRY;
+   bson_return_if_fail (pool);
 
-   bson_return_if_fail(pool);
+   mongoc_mutex_lock (&pool->mutex);
 
-   while ((client = _mongoc_queue_pop_head(&pool->queue))) {
-      mongoc_client_destroy(client);
+   memset (&pool->topology_callbacks, 0, sizeof pool->topology_callbacks);
+   if (callbacks) {
+      memcpy (&pool->topology_callbacks, callbacks,
+              sizeof pool->topology_callbacks);
    }
+   pool->topology_context = context;
 
-   mongoc_uri_destroy(pool->uri);
-   mongoc_mutex_destroy(&pool->mutex);
-   mongoc_cond_destroy(&pool->cond);
-   bson_free(pool);
-
-   mongoc_counter_client_pools_active_dec();
-   mongoc_counter_client_pools_disposed_inc();
+   if (pool->monitor) {
+      _mongoc_cluster_monitor_set_callbacks (pool->monitor,
+                                             &pool->topology_callbacks,
+                                             context);
+   }
 
-   EXIT;
+   mongoc_mutex_unlock (&pool->mutex);
 }
 
 
-mongoc_client_t *
-mongoc_client_pool_pop (mongoc_client_pool_t *pool)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_slow_op_log --
+ *
+ *       Set the slow operation log of each client popped from @pool, see
+ *       mongoc_client_set_slow_op_log(). Clients keep their own slow
+ *       operations if @callback is NULL.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes effect for each client the next time it is popped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_set_slow_op_log (mongoc_client_pool_t    *pool,
+                                    int32_t                  threshold_msec,
+                                    mongoc_apm_slow_op_cb_t  callback,
+                                    void                    *context)
 {
-   mongoc_client_t *client;
+   bson_return_if_fail (pool);
 
-   ENTRY;
+   mongoc_mutex_lock (&pool->mutex);
+   pool->slow_op_msec = threshold_msec;
+   pool->slow_op_cb = callback;
+   pool->slow_op_context = context;
+   mongoc_mutex_unlock (&pool->mutex);
+}
 
-   bson_return_val_if_fail(pool, NULL);
 
-   mongoc_mutex_lock(&pool->mutex);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_thread_affinity --
+ *
+ *       Have each thread keep the client it pushed to @pool last, and get
+ *       it back from its next pop without going through the shared idle
+ *       list, so that its connections and their state stay warm. A kept
+ *       client is handed to other threads once no other client is idle.
+ *
+ *       Call this before any client is popped.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A thread-local key is allocated for @pool.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_set_thread_affinity (mongoc_client_pool_t *pool,
+                                        bool                  thread_affinity)
+{
+   bson_return_if_fail (pool);
 
-again:
-   if (!(client = _mongoc_queue_pop_head(&pool->queue))) {
-      if (pool->size < pool->max_pool_size) {
-         client = mongoc_client_new_from_uri(pool->uri);
-#ifdef MONGOC_ENABLE_SSL
-         if (pool->ssl_opts_set) {
-            mongoc_client_set_ssl_opts (client, &pool->ssl_opts);
-         }
-#endif
-         pool->size++;
+   mongoc_mutex_lock (&pool->mutex);
+
+   if (thread_affinity && !pool->has_slot_key) {
+      if (mongoc_thread_key_create (&pool->slot_key) == 0) {
+         pool->has_slot_key = true;
       } else {
-         mongoc_cond_wait(&pool->cond, &pool->mutex);
-         GOTO(again);
+         MONGOC_WARNING ("Failed to allocate a thread-local key, "
+                         "ignoring thread affinity.");
+         thread_affinity = false;
       }
    }
 
-   mongoc_mutex_unlock(&pool->mutex);
+   /* clients already kept in slots are still handed out to any thread */
+   pool->thread_affinity = thread_affinity;
 
-   RETURN(client);
+   mongoc_mutex_unlock (&pool->mutex);
 }
 
 
-mongoc_client_t *
-mongoc_client_pool_try_pop (mongoc_client_pool_t *pool)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_query_coalescing --
+ *
+ *       Have identical finds on clients of @pool share one round trip.
+ *       A find started while another client waits for the reply to the
+ *       same query, on the same namespace with the same fields, flags,
+ *       skip, limit and read preferences, waits for that reply too and
+ *       iterates a copy of its documents instead of querying.
+ *
+ *       Only results that fit in the first reply are shared; otherwise
+ *       the waiters send their own query once the reply is in.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes effect for each client the next time it is popped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_set_query_coalescing (mongoc_client_pool_t *pool,
+                                         bool                  coalescing)
+{
+   bson_return_if_fail (pool);
+
+   mongoc_mutex_lock (&pool->mutex);
+   pool->query_coalescing = coalescing;
+   mongoc_mutex_unlock (&pool->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_new_client --
+ *
+ *       Create a new client for @pool. All clients of a pool share one
+ *       topology monitor, so the cluster is discovered and pinged only
+ *       once for the whole pool while each client opens its own streams.
+ *
+ *       The monitor connects through a client of its own that lives as
+ *       long as the pool, since pooled clients may be destroyed at any
+ *       time. It is created on the first call so that the SSL options
+ *       set on the pool are honored.
+ *
+ *       The caller must hold pool->mutex.
+ *
+ * Returns:
+ *       A newly allocated mongoc_client_t.
+ *
+ * Side effects:
+ *       The monitor thread is started on the first call.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_new_client (mongoc_client_pool_t *pool)
 {
    mongoc_client_t *client;
+   int64_t interval_msec = MONGOC_CLIENT_POOL_HEARTBEAT_FREQUENCY_MSEC;
+   const bson_t *b;
+   bson_iter_t iter;
 
    ENTRY;
 
-   bson_return_val_if_fail(pool, NULL);
+   if (!pool->monitor) {
+      b = mongoc_uri_get_options (pool->uri);
 
-   mongoc_mutex_lock(&pool->mutex);
+      if (bson_iter_init_find_case (&iter, b, "heartbeatfrequencyms") &&
+          BSON_ITER_HOLDS_INT32 (&iter) &&
+          (bson_iter_int32 (&iter) > 0)) {
+         interval_msec = bson_iter_int32 (&iter);
+      }
 
-   if (!(client = _mongoc_queue_pop_head(&pool->queue))) {
-      if (pool->size < pool->max_pool_size) {
-         client = mongoc_client_new_from_uri(pool->uri);
+      pool->topology_client = mongoc_client_new_from_uri (pool->uri);
 #ifdef MONGOC_ENABLE_SSL
-         if (pool->ssl_opts_set) {
-            mongoc_client_set_ssl_opts (client, &pool->ssl_opts);
-         }
-#endif
-         pool->size++;
+      if (pool->ssl_opts_set) {
+         _mongoc_client_set_ssl_opts_with_ctx (pool->topology_client,
+                                               &pool->ssl_opts,
+                                               pool->ssl_ctx);
       }
+#endif
+
+      pool->monitor = _mongoc_cluster_monitor_new (pool->uri,
+                                                   pool->topology_client,
+                                                   interval_msec);
+      pool->monitor->shared = true;
+      _mongoc_cluster_monitor_set_callbacks (pool->monitor,
+                                             &pool->topology_callbacks,
+                                             pool->topology_context);
+   }
+
+   client = mongoc_client_new_from_uri (pool->uri);
+#ifdef MONGOC_ENABLE_SSL
+   if (pool->ssl_opts_set) {
+      _mongoc_client_set_ssl_opts_with_ctx (client, &pool->ssl_opts,
+                                            pool->ssl_ctx);
    }
+#endif
 
-   mongoc_mutex_unlock(&pool->mutex);
+   client->cluster.monitor = _mongoc_cluster_monitor_ref (pool->monitor);
+   _mongoc_cluster_monitor_client_added (pool->monitor);
 
-   RETURN(client);
+   RETURN (client);
 }
 
 
-void
-mongoc_client_pool_push (mongoc_client_pool_t *pool,
-                         mongoc_client_t      *client)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_next_shard --
+ *
+ *       Pick the shard a pop or push starts from. Successive calls go
+ *       round the shards so that concurrent threads spread over them.
+ *
+ * Returns:
+ *       A shard index.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_client_pool_next_shard (mongoc_client_pool_t *pool)
 {
-   ENTRY;
+   return ((uint32_t)bson_atomic_int_add (&pool->next_shard, 1)) %
+          MONGOC_CLIENT_POOL_N_SHARDS;
+}
 
-   bson_return_if_fail(pool);
-   bson_return_if_fail(client);
 
-   mongoc_mutex_lock(&pool->mutex);
-   if (pool->size > pool->min_pool_size) {
-      mongoc_client_t *old_client;
-      old_client = _mongoc_queue_pop_head (&pool->queue);
-      if (old_client) {
-          mongoc_client_destroy (old_client);
-          pool->size--;
-      }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_take_idle --
+ *
+ *       Take an idle client from the shards of @pool, starting from a
+ *       shard of its own and moving on to the others while they are
+ *       empty.
+ *
+ * Returns:
+ *       A client, or NULL if none is idle.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_take_idle (mongoc_client_pool_t *pool)
+{
+   mongoc_client_pool_shard_t *shard;
+   mongoc_client_t *client = NULL;
+   uint32_t start;
+   uint32_t i;
+
+   start = _mongoc_client_pool_next_shard (pool);
+
+   for (i = 0; !client && i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      shard = &pool->shards [(start + i) % MONGOC_CLIENT_POOL_N_SHARDS];
+
+      mongoc_mutex_lock (&shard->mutex);
+      client = _mongoc_queue_pop_head_item (&shard->queue);
+      mongoc_mutex_unlock (&shard->mutex);
    }
-   mongoc_mutex_unlock(&pool->mutex);
 
-   if ((client->cluster.state == MONGOC_CLUSTER_STATE_HEALTHY) ||
-       (client->cluster.state == MONGOC_CLUSTER_STATE_BORN)) {
-      mongoc_mutex_lock (&pool->mutex);
-      _mongoc_queue_push_tail (&pool->queue, client);
-   } else if (_mongoc_cluster_reconnect (&client->cluster, NULL)) {
-      mongoc_mutex_lock (&pool->mutex);
-      _mongoc_queue_push_tail (&pool->queue, client);
+   return client;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_take_kept --
+ *
+ *       Take the client kept in the slot of the calling thread, or with
+ *       @any_thread the client kept by any thread. The caller must hold
+ *       pool->mutex when @any_thread is true.
+ *
+ * Returns:
+ *       A client, or NULL if none is kept.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_take_kept (mongoc_client_pool_t *pool,
+                               bool                  any_thread)
+{
+   mongoc_client_pool_slot_t *slot;
+   mongoc_client_t *client = NULL;
+
+   if (any_thread) {
+      slot = pool->slots;
+   } else if (pool->thread_affinity) {
+      slot = mongoc_thread_key_get (pool->slot_key);
    } else {
-      mongoc_client_destroy (client);
-      mongoc_mutex_lock (&pool->mutex);
-      pool->size--;
+      return NULL;
    }
 
-   mongoc_cond_signal(&pool->cond);
-   mongoc_mutex_unlock(&pool->mutex);
+   for (; !client && slot; slot = any_thread ? slot->next : NULL) {
+      mongoc_mutex_lock (&slot->mutex);
+      client = slot->client;
+      slot->client = NULL;
+      mongoc_mutex_unlock (&slot->mutex);
+   }
 
-   EXIT;
+   return client;
 }
 
-size_t
-mongoc_client_pool_get_size (mongoc_client_pool_t *pool)
-{
-   size_t size = 0;
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_keep --
+ *
+ *       Keep @client in the slot of the calling thread, if the pool has
+ *       thread affinity, in place of the client kept there before.
+ *
+ * Returns:
+ *       The client to add to the shared idle list: the one @client
+ *       replaced in the slot, @client itself without thread affinity, or
+ *       NULL.
+ *
+ * Side effects:
+ *       The slot of the calling thread is created on its first push.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_keep (mongoc_client_pool_t *pool,
+                          mongoc_client_t      *client)
+{
+   mongoc_client_pool_slot_t *slot;
+   mongoc_client_t *replaced;
+
+   if (!pool->thread_affinity) {
+      return client;
+   }
+
+   if (!(slot = mongoc_thread_key_get (pool->slot_key))) {
+      slot = bson_malloc0 (sizeof *slot);
+      mongoc_mutex_init (&slot->mutex);
+
+      mongoc_mutex_lock (&pool->mutex);
+      slot->next = pool->slots;
+      pool->slots = slot;
+      mongoc_mutex_unlock (&pool->mutex);
+
+      mongoc_thread_key_set (pool->slot_key, slot);
+   }
+
+   mongoc_mutex_lock (&slot->mutex);
+   replaced = slot->client;
+   slot->client = client;
+   mongoc_mutex_unlock (&slot->mutex);
+
+   return replaced;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_check_idle --
+ *
+ *       Make sure the streams of @client, which sat idle in @pool, are
+ *       still worth using. All streams of a client idle for longer than
+ *       maxIdleTimeMS are closed, and otherwise the streams the server or
+ *       a middlebox hung up on are. Checking a stream polls its socket
+ *       without a round trip. Closed nodes are reconnected by the next
+ *       operation, from the topology of the pool monitor.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Streams of @client may be closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_client_pool_check_idle (mongoc_client_pool_t *pool,
+                                mongoc_client_t      *client)
+{
+   mongoc_cluster_node_t *node;
+   bool expired;
+   uint32_t i;
+
+   if (!client->pool_idle_since) {
+      return;
+   }
+
+   expired = pool->max_idle_time_usec &&
+             (bson_get_monotonic_time () - client->pool_idle_since >
+              pool->max_idle_time_usec);
+   client->pool_idle_since = 0;
+
+   for (i = 0; i < client->cluster.nodes_len; i++) {
+      node = &client->cluster.nodes [i];
+
+      if (node->stream &&
+          (expired || mongoc_stream_check_closed (node->stream))) {
+         _mongoc_cluster_disconnect_node (&client->cluster, node);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_reap --
+ *
+ *       Destroy the clients that have been idle in @pool for longer than
+ *       maxIdleTimeMS, as long as the pool holds more than minPoolSize
+ *       clients. The oldest client of each shard is at its head, so each
+ *       shard is only walked up to its first client still in its time.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Clients are destroyed and their connections closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_client_pool_reap (mongoc_client_pool_t *pool)
+{
+   mongoc_client_pool_shard_t *shard;
+   mongoc_client_t *client;
+   int64_t deadline;
+   int i;
+
+   if (!pool->max_idle_time_usec) {
+      return;
+   }
+
+   deadline = bson_get_monotonic_time () - pool->max_idle_time_usec;
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      shard = &pool->shards [i];
+
+      for (;;) {
+         if ((uint32_t)bson_atomic_int_add (&pool->size, 0) <=
+             pool->min_pool_size) {
+            return;
+         }
+
+         mongoc_mutex_lock (&shard->mutex);
+         client = _mongoc_queue_pop_head_item (&shard->queue);
+         if (client && client->pool_idle_since >= deadline) {
+            _mongoc_queue_push_head_item (&shard->queue, &client->pool_item,
+                                          client);
+            client = NULL;
+         }
+         mongoc_mutex_unlock (&shard->mutex);
+
+         if (!client) {
+            break;
+         }
+
+         mongoc_client_destroy (client);
+         bson_atomic_int_add (&pool->size, -1);
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_find_client --
+ *
+ *       Take any client of @pool that is idle or kept by a thread, or
+ *       create one while the pool is below its maximum size. The caller
+ *       must hold pool->mutex.
+ *
+ * Returns:
+ *       A client, or NULL if the pool is exhausted.
+ *
+ * Side effects:
+ *       May create a client.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_find_client (mongoc_client_pool_t *pool)
+{
+   mongoc_client_t *client;
+
+   if ((client = _mongoc_client_pool_take_idle (pool)) ||
+       (client = _mongoc_client_pool_take_kept (pool, true))) {
+      return client;
+   }
+
+   if ((uint32_t)bson_atomic_int_add (&pool->size, 0) < pool->max_pool_size) {
+      client = _mongoc_client_pool_new_client (pool);
+      bson_atomic_int_add (&pool->size, 1);
+   }
+
+   return client;
+}
+
+
+/*
+ * Count a checkout that began at @started in the latency histogram
+ * @checkout_usec of a pool or lane. Bucket i holds the checkouts that
+ * took a number of microseconds with i significant bits, that is from
+ * 2^(i-1) up to 2^i - 1.
+ */
+static void
+_mongoc_client_pool_count_checkout (volatile int64_t *checkout_usec,
+                                    int64_t           started)
+{
+   uint64_t usec;
+   int i = 0;
+
+   usec = (uint64_t)BSON_MAX (0, bson_get_monotonic_time () - started);
+
+   while (usec && (i < MONGOC_CLIENT_POOL_STATS_N_BUCKETS - 1)) {
+      usec >>= 1;
+      i++;
+   }
+
+   bson_atomic_int64_add (&checkout_usec [i], 1);
+   mongoc_counter_client_pools_checked_out_inc ();
+}
+
+
+/*
+ * Apply the settings of @pool to @client as it is checked out.
+ */
+static void
+_mongoc_client_pool_prepare (mongoc_client_pool_t *pool,
+                             mongoc_client_t      *client)
+{
+   _mongoc_client_pool_check_idle (pool, client);
+   _mongoc_client_set_local_oids (client, pool->local_oids);
+   client->query_flights = pool->query_coalescing ? &pool->query_flights
+                                                  : NULL;
+   client->cluster.limiter = pool->node_limiter.max ? &pool->node_limiter
+                                                    : NULL;
+   mongoc_client_set_apm_callbacks (client, &pool->apm, pool->apm_context);
+   mongoc_client_set_slow_op_log (client, pool->slow_op_msec,
+                                  pool->slow_op_cb, pool->slow_op_context);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_checkout --
+ *
+ *       Hand out an idle client of @pool, or a new one while the pool is
+ *       below its maximum size. Once the pool is exhausted, wait up to
+ *       @timeout_msec for a client to be pushed back, forever if it is
+ *       negative.
+ *
+ *       Waiting threads line up in pool->waiter_head, each on a condition
+ *       of its own, and only the thread at the head may take a client, so
+ *       they are served in the order they came. A thread only takes the
+ *       fast path, without pool->mutex, while nobody waits.
+ *
+ *       A waiter counts itself in pool->waiters before looking at the
+ *       shards a last time, and a push looks at pool->waiters after
+ *       filling its shard, so one of the two always sees the other.
+ *
+ * Returns:
+ *       A client, or NULL if the pool stayed exhausted or too many threads
+ *       are waiting already, in which case @error is set.
+ *
+ * Side effects:
+ *       May create a client.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_t *
+_mongoc_client_pool_checkout (mongoc_client_pool_t *pool,
+                              int64_t               timeout_msec,
+                              bson_error_t         *error)
+{
+   mongoc_client_pool_waiter_t waiter;
+   mongoc_client_t *client = NULL;
+   int64_t deadline = 0;
+   int64_t started;
+   int64_t now;
+
+   ENTRY;
+
+   started = bson_get_monotonic_time ();
+
+   if (!bson_atomic_int_add (&pool->waiters, 0) &&
+       ((client = _mongoc_client_pool_take_kept (pool, false)) ||
+        (client = _mongoc_client_pool_take_idle (pool)))) {
+      GOTO (done);
+   }
+
+   mongoc_mutex_lock (&pool->mutex);
+
+   if (!pool->waiter_head &&
+       (client = _mongoc_client_pool_find_client (pool))) {
+      mongoc_mutex_unlock (&pool->mutex);
+      GOTO (done);
+   }
+
+   if (!timeout_msec) {
+      mongoc_mutex_unlock (&pool->mutex);
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_POOL_EXHAUSTED,
+                      "No client is available in the pool.");
+      GOTO (done);
+   }
+
+   if (pool->max_waiters &&
+       ((uint32_t)bson_atomic_int_add (&pool->waiters, 0) >=
+        pool->max_waiters)) {
+      mongoc_mutex_unlock (&pool->mutex);
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_POOL_EXHAUSTED,
+                      "Too many threads are waiting for a client.");
+      GOTO (done);
+   }
+
+   if (timeout_msec > 0) {
+      deadline = started + (timeout_msec * 1000);
+   }
+
+   mongoc_cond_init (&waiter.cond);
+   waiter.next = NULL;
+   waiter.prev = pool->waiter_tail;
+   if (pool->waiter_tail) {
+      pool->waiter_tail->next = &waiter;
+   } else {
+      pool->waiter_head = &waiter;
+   }
+   pool->waiter_tail = &waiter;
+   bson_atomic_int_add (&pool->waiters, 1);
+   bson_atomic_int64_add (&pool->n_waits, 1);
+   mongoc_counter_client_pools_waits_inc ();
+   mongoc_counter_client_pools_waiting_inc ();
+
+   for (;;) {
+      if ((pool->waiter_head == &waiter) &&
+          (client = _mongoc_client_pool_find_client (pool))) {
+         break;
+      }
+
+      if (timeout_msec < 0) {
+         mongoc_cond_wait (&waiter.cond, &pool->mutex);
+         continue;
+      }
+
+      if ((now = bson_get_monotonic_time ()) >= deadline) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_POOL_EXHAUSTED,
+                         "Timed out waiting for a client from the pool.");
+         break;
+      }
+
+      mongoc_cond_timedwait (&waiter.cond, &pool->mutex,
+                             BSON_MAX (1, (deadline - now) / 1000));
+   }
+
+   if (waiter.prev) {
+      waiter.prev->next = waiter.next;
+   } else {
+      pool->waiter_head = waiter.next;
+   }
+   if (waiter.next) {
+      waiter.next->prev = waiter.prev;
+   } else {
+      pool->waiter_tail = waiter.prev;
+   }
+   bson_atomic_int_add (&pool->waiters, -1);
+   mongoc_counter_client_pools_waiting_dec ();
+   mongoc_counter_client_pools_wait_usec_add (bson_get_monotonic_time () -
+                                              started);
+
+   /* let the next in line look for a client that came in meanwhile */
+   if (pool->waiter_head) {
+      mongoc_cond_signal (&pool->waiter_head->cond);
+   }
+
+   mongoc_mutex_unlock (&pool->mutex);
+   mongoc_cond_destroy (&waiter.cond);
+
+done:
+   if (client) {
+      _mongoc_client_pool_prepare (pool, client);
+      _mongoc_client_pool_count_checkout (pool->checkout_usec, started);
+   } else {
+      bson_atomic_int64_add (&pool->n_exhausted, 1);
+      mongoc_counter_client_pools_exhausted_inc ();
+   }
+
+   RETURN (client);
+}
+
+
+/*
+ * Wake the thread at the head of the wait queue, if there is one.
+ */
+static void
+_mongoc_client_pool_wake_waiter (mongoc_client_pool_t *pool)
+{
+   if (bson_atomic_int_add (&pool->waiters, 0) > 0) {
+      mongoc_mutex_lock (&pool->mutex);
+      if (pool->waiter_head) {
+         mongoc_cond_signal (&pool->waiter_head->cond);
+      }
+      mongoc_mutex_unlock (&pool->mutex);
+   }
+}
+
+
+mongoc_client_pool_t *
+mongoc_client_pool_new (const mongoc_uri_t *uri)
+{
+   mongoc_client_pool_t *pool;
+   const bson_t *b;
+   bson_iter_t iter;
+   int i;
+
+   ENTRY;
+
+   bson_return_val_if_fail(uri, NULL);
+
+   pool = bson_malloc0(sizeof *pool);
+   mongoc_mutex_init(&pool->mutex);
+   mongoc_mutex_init(&pool->group_mutex);
+   _mongoc_query_flights_init(&pool->query_flights);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      mongoc_mutex_init(&pool->shards[i].mutex);
+      _mongoc_queue_init(&pool->shards[i].queue);
+   }
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_LANES; i++) {
+      mongoc_mutex_init(&pool->lanes[i].mutex);
+      mongoc_cond_init(&pool->lanes[i].cond);
+      _mongoc_queue_init(&pool->lanes[i].queue);
+   }
+
+   pool->uri = mongoc_uri_copy(uri);
+   pool->min_pool_size = 0;
+   pool->max_pool_size = 100;
+   pool->size = 0;
+
+   b = mongoc_uri_get_options(pool->uri);
+
+   if (bson_iter_init_find_case(&iter, b, "minpoolsize")) {
+      if (BSON_ITER_HOLDS_INT32(&iter)) {
+         pool->min_pool_size = BSON_MAX(0, bson_iter_int32(&iter));
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "maxpoolsize")) {
+      if (BSON_ITER_HOLDS_INT32(&iter)) {
+         pool->max_pool_size = BSON_MAX(1, bson_iter_int32(&iter));
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "waitqueuetimeoutms")) {
+      if (BSON_ITER_HOLDS_INT32(&iter)) {
+         pool->wait_queue_timeout_msec = BSON_MAX(0, bson_iter_int32(&iter));
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "waitqueuemultiple")) {
+      if (BSON_ITER_HOLDS_INT32(&iter) && (bson_iter_int32(&iter) > 0)) {
+         pool->max_waiters =
+            (uint32_t)bson_iter_int32(&iter) * pool->max_pool_size;
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "maxidletimems")) {
+      if (BSON_ITER_HOLDS_INT32(&iter)) {
+         pool->max_idle_time_usec =
+            1000 * (int64_t)BSON_MAX(0, bson_iter_int32(&iter));
+      }
+   }
+
+   _mongoc_node_limiter_init(&pool->node_limiter, 0);
+
+   if (bson_iter_init_find_case(&iter, b, "maxconcurrentopspernode")) {
+      if (BSON_ITER_HOLDS_INT32(&iter) && (bson_iter_int32(&iter) > 0)) {
+         pool->node_limiter.max = (uint32_t)bson_iter_int32(&iter);
+      }
+   }
+
+   mongoc_counter_client_pools_active_inc();
+
+   RETURN(pool);
+}
+
+
+void
+mongoc_client_pool_destroy (mongoc_client_pool_t *pool)
+{
+   mongoc_client_pool_group_t *group;
+   mongoc_client_pool_slot_t *slot;
+   mongoc_client_t *client;
+   int i;
+
+   ENTRY;
+
+   bson_return_if_fail(pool);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      while ((client = _mongoc_queue_pop_head_item(&pool->shards[i].queue))) {
+         mongoc_client_destroy(client);
+      }
+
+      mongoc_mutex_destroy(&pool->shards[i].mutex);
+   }
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_LANES; i++) {
+      while ((client = _mongoc_queue_pop_head_item(&pool->lanes[i].queue))) {
+         mongoc_client_destroy(client);
+      }
+
+      mongoc_cond_destroy(&pool->lanes[i].cond);
+      mongoc_mutex_destroy(&pool->lanes[i].mutex);
+   }
+
+   while ((slot = pool->slots)) {
+      pool->slots = slot->next;
+
+      if (slot->client) {
+         mongoc_client_destroy (slot->client);
+      }
+
+      mongoc_mutex_destroy (&slot->mutex);
+      bson_free (slot);
+   }
+
+   if (pool->has_slot_key) {
+      mongoc_thread_key_delete (pool->slot_key);
+   }
+
+   while ((group = pool->groups)) {
+      pool->groups = group->next;
+      bson_free (group->database);
+      bson_free (group->collection);
+      bson_free (group);
+   }
+
+   mongoc_mutex_destroy (&pool->group_mutex);
+   _mongoc_query_flights_destroy (&pool->query_flights);
+   _mongoc_node_limiter_destroy (&pool->node_limiter);
+
+   /*
+    * The monitor still uses the topology client until it is stopped.
+    */
+   if (pool->monitor) {
+      _mongoc_cluster_monitor_unref (pool->monitor);
+   }
+
+   mongoc_client_destroy (pool->topology_client);
+
+#ifdef MONGOC_ENABLE_SSL
+   if (pool->ssl_ctx) {
+      SSL_CTX_free (pool->ssl_ctx);
+   }
+#endif
+
+   mongoc_uri_destroy(pool->uri);
+   mongoc_mutex_destroy(&pool->mutex);
+   bson_free(pool);
+
+   mongoc_counter_client_pools_active_dec();
+   mongoc_counter_client_pools_disposed_inc();
+
+   EXIT;
+}
+
+
+mongoc_client_t *
+mongoc_client_pool_pop (mongoc_client_pool_t *pool)
+{
+   bson_return_val_if_fail(pool, NULL);
+
+   return _mongoc_client_pool_checkout (pool,
+                                        pool->wait_queue_timeout_msec ?
+                                        pool->wait_queue_timeout_msec : -1,
+                                        NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_pop_timeout --
+ *
+ *       Pop a client from @pool like mongoc_client_pool_pop(), but wait
+ *       no longer than @timeout_msec for one once the pool is exhausted.
+ *       A negative @timeout_msec waits forever and zero does not wait.
+ *
+ * Returns:
+ *       A client, or NULL and @error is set on timeout or when more
+ *       threads than waitQueueMultiple allows are waiting already.
+ *
+ * Side effects:
+ *       May create a client.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_client_t *
+mongoc_client_pool_pop_timeout (mongoc_client_pool_t *pool,
+                                int32_t               timeout_msec,
+                                bson_error_t         *error)
+{
+   bson_return_val_if_fail(pool, NULL);
+
+   return _mongoc_client_pool_checkout (pool, timeout_msec, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_run --
+ *
+ *       Run one operation on a client of @pool: pop a client as
+ *       mongoc_client_pool_pop_timeout() does, call @func with it, @data
+ *       and @error, then push the client back.
+ *
+ *       This makes @pool a handle that any number of threads can share,
+ *       each operation borrowing a client with its connections for just
+ *       as long as it runs. The clients share the topology monitored by
+ *       @pool, and their number, with their sockets, stays within
+ *       maxPoolSize however many threads there are.
+ *
+ *       The client must not be used once @func returns, nor pushed by
+ *       @func. Cursors made by @func must be destroyed before it returns.
+ *
+ * Returns:
+ *       What @func returns, or false and @error is set if no client could
+ *       be popped within @timeout_msec.
+ *
+ * Side effects:
+ *       Those of @func.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_pool_run (mongoc_client_pool_t      *pool,
+                        int32_t                    timeout_msec,
+                        mongoc_client_pool_func_t  func,
+                        void                      *data,
+                        bson_error_t              *error)
+{
+   mongoc_client_t *client;
+   bool ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, false);
+   bson_return_val_if_fail (func, false);
+
+   if (!(client = _mongoc_client_pool_checkout (pool, timeout_msec, error))) {
+      RETURN (false);
+   }
+
+   ret = func (client, data, error);
+
+   mongoc_client_pool_push (pool, client);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_get_group --
+ *
+ *       Find the group of inserts into @collection of @database with
+ *       @write_concern, creating it the first time. Must be called with
+ *       @pool->group_mutex held.
+ *
+ * Returns:
+ *       The group, which lives as long as @pool.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_client_pool_group_t *
+_mongoc_client_pool_get_group (mongoc_client_pool_t         *pool,          /* IN */
+                               const char                   *database,      /* IN */
+                               const char                   *collection,    /* IN */
+                               const mongoc_write_concern_t *write_concern) /* IN */
+{
+   mongoc_client_pool_group_t *group;
+
+   for (group = pool->groups; group; group = group->next) {
+      if (group->write_concern == write_concern &&
+          !strcmp (group->collection, collection) &&
+          !strcmp (group->database, database)) {
+         return group;
+      }
+   }
+
+   group = bson_malloc0 (sizeof *group);
+   group->database = bson_strdup (database);
+   group->collection = bson_strdup (collection);
+   group->write_concern = write_concern;
+   group->next = pool->groups;
+   pool->groups = group;
+
+   return group;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_pool_flush_group --
+ *
+ *       Send every insert pending in @group as one unordered insert on a
+ *       client of @pool, and hand each submitter its own result: a write
+ *       error is reported to the submitter of the document at its index,
+ *       any other failure to all of them.
+ *
+ *       Called with @pool->group_mutex held, which is released while the
+ *       insert is under way so that the next batch can build up.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The submitters of the batch are done and woken up, and the first
+ *       one waiting in the next batch is woken up to flush it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_client_pool_flush_group (mongoc_client_pool_t         *pool,          /* IN */
+                                 mongoc_client_pool_group_t   *group,         /* IN */
+                                 const mongoc_write_concern_t *write_concern) /* IN */
+{
+   mongoc_client_pool_insert_t **inserts;
+   mongoc_client_pool_insert_t *insert;
+   mongoc_write_command_t command;
+   mongoc_write_result_t result;
+   mongoc_write_error_t *write_error;
+   const bson_t **documents;
+   mongoc_client_t *client;
+   const char *msg = "Write concern error";
+   bson_error_t error;
+   bson_iter_t iter;
+   uint32_t code = 0;
+   uint32_t n_inserts;
+   uint32_t i;
+   bool failed;
+
+   ENTRY;
+
+   n_inserts = group->n_pending;
+   inserts = bson_malloc (n_inserts * sizeof *inserts);
+   documents = bson_malloc (n_inserts * sizeof *documents);
+
+   for (i = 0, insert = group->head; insert; insert = insert->next, i++) {
+      inserts [i] = insert;
+      documents [i] = insert->document;
+   }
+
+   group->head = group->tail = NULL;
+   group->n_pending = 0;
+   group->flushing = true;
+
+   mongoc_mutex_unlock (&pool->group_mutex);
+
+   _mongoc_write_result_init (&result);
+
+   client = _mongoc_client_pool_checkout (pool,
+                                          pool->wait_queue_timeout_msec ?
+                                          pool->wait_queue_timeout_msec : -1,
+                                          &result.error);
+
+   if (client) {
+      _mongoc_write_command_init_insert_borrowed (&command, documents,
+                                                  n_inserts, false, false,
+                                                  client->oid_gen);
+      _mongoc_write_command_execute (&command, client, 0, group->database,
+                                     group->collection, write_concern, 0,
+                                     &result);
+      _mongoc_write_command_destroy (&command);
+      mongoc_client_pool_push (pool, client);
+   } else {
+      result.failed = true;
+   }
+
+   /* failures other than write errors belong to the whole batch */
+   failed = true;
+
+   if (result.failed && !result.writeErrors.len) {
+      memcpy (&error, &result.error, sizeof error);
+   } else if (!bson_empty0 (&result.writeConcernError)) {
+      if (bson_iter_init_find (&iter, &result.writeConcernError, "code") &&
+          BSON_ITER_HOLDS_INT32 (&iter)) {
+         code = bson_iter_int32 (&iter);
+      }
+
+      if (bson_iter_init_find (&iter, &result.writeConcernError, "errmsg") &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         msg = bson_iter_utf8 (&iter, NULL);
+      }
+
+      bson_set_error (&error, MONGOC_ERROR_COMMAND, code, "%s", msg);
+   } else {
+      failed = false;
+   }
+
+   mongoc_mutex_lock (&pool->group_mutex);
+
+   for (i = 0; i < n_inserts; i++) {
+      inserts [i]->ret = !failed;
+      if (failed) {
+         memcpy (&inserts [i]->error, &error, sizeof error);
+      }
+   }
+
+   for (i = 0; i < result.writeErrors.len; i++) {
+      write_error = &_mongoc_array_index (&result.writeErrors,
+                                          mongoc_write_error_t, i);
+      if (write_error->index < n_inserts) {
+         insert = inserts [write_error->index];
+         insert->ret = false;
+         bson_set_error (&insert->error, MONGOC_ERROR_COMMAND,
+                         write_error->code, "%s",
+                         write_error->errmsg ? write_error->errmsg
+                                             : "Unknown write error");
+      }
+   }
+
+   for (i = 0; i < n_inserts; i++) {
+      inserts [i]->done = true;
+      mongoc_cond_signal (&inserts [i]->cond);
+   }
+
+   group->flushing = false;
+
+   if (group->head) {
+      mongoc_cond_signal (&group->head->cond);
+   }
+
+   _mongoc_write_result_destroy (&result);
+   bson_free (documents);
+   bson_free (inserts);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_insert --
+ *
+ *       Insert @document into @collection of @database like
+ *       mongoc_collection_insert(), on a client of @pool, and group it
+ *       with the inserts other threads submit meanwhile.
+ *
+ *       The inserts into a namespace with a write concern are sent by one
+ *       thread at a time as a single unordered insert of everything
+ *       submitted since the last one was sent, so that threads inserting
+ *       single documents share a round trip instead of each taking its
+ *       own. The thread that finds none under way sends the batch; the
+ *       others wait for it and the first of them sends the next batch.
+ *
+ * Returns:
+ *       true if @document was inserted; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_pool_insert (mongoc_client_pool_t         *pool,
+                           const char                   *database,
+                           const char                   *collection,
+                           mongoc_insert_flags_t         flags,
+                           const bson_t                 *document,
+                           const mongoc_write_concern_t *write_concern,
+                           bson_error_t                 *error)
+{
+   mongoc_client_pool_insert_t insert = { 0 };
+   mongoc_client_pool_group_t *group;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, false);
+   bson_return_val_if_fail (database, false);
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (document, false);
+
+   if (!(flags & MONGOC_INSERT_NO_VALIDATE) &&
+       !bson_validate (document,
+                       (BSON_VALIDATE_UTF8 |
+                        BSON_VALIDATE_UTF8_ALLOW_NULL |
+                        BSON_VALIDATE_DOLLAR_KEYS |
+                        BSON_VALIDATE_DOT_KEYS),
+                       NULL)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "A document was corrupt or contained "
+                      "invalid characters . or $");
+      RETURN (false);
+   }
+
+   insert.document = document;
+   mongoc_cond_init (&insert.cond);
+
+   mongoc_mutex_lock (&pool->group_mutex);
+
+   group = _mongoc_client_pool_get_group (pool, database, collection,
+                                          write_concern);
+
+   if (group->tail) {
+      group->tail->next = &insert;
+   } else {
+      group->head = &insert;
+   }
+   group->tail = &insert;
+   group->n_pending++;
+
+   while (!insert.done) {
+      if (!group->flushing) {
+         _mongoc_client_pool_flush_group (pool, group, write_concern);
+      } else {
+         mongoc_cond_wait (&insert.cond, &pool->group_mutex);
+      }
+   }
+
+   mongoc_mutex_unlock (&pool->group_mutex);
+
+   mongoc_cond_destroy (&insert.cond);
+
+   if (!insert.ret && error) {
+      memcpy (error, &insert.error, sizeof *error);
+   }
+
+   RETURN (insert.ret);
+}
+
+
+mongoc_client_t *
+mongoc_client_pool_try_pop (mongoc_client_pool_t *pool)
+{
+   bson_return_val_if_fail(pool, NULL);
+
+   return _mongoc_client_pool_checkout (pool, 0, NULL);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_set_lane --
+ *
+ *       Reserve up to @opts->max_size clients of @pool for @lane, in
+ *       addition to maxPoolSize. They have connections of their own and
+ *       are only popped with mongoc_client_pool_pop_lane(), so work in
+ *       one lane never waits for a client or a socket held by another.
+ *
+ *       If @opts->socket_timeout_msec is set it replaces socketTimeoutMS
+ *       for the clients of @lane, and if @opts->max_write_batch_size is
+ *       set their write batches hold no more documents than that.
+ *
+ *       A NULL @opts lets @lane share the clients of the pool again.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Clients already in @lane keep their timeouts and are destroyed
+ *       as they are pushed if @lane was shrunk or released.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_set_lane (mongoc_client_pool_t                 *pool,
+                             mongoc_client_pool_lane_t             lane,
+                             const mongoc_client_pool_lane_opts_t *opts)
+{
+   mongoc_client_pool_reserve_t *reserve;
+
+   bson_return_if_fail (pool);
+   bson_return_if_fail (lane > MONGOC_CLIENT_POOL_LANE_DEFAULT &&
+                        lane < MONGOC_CLIENT_POOL_N_LANES);
+   bson_return_if_fail (!opts || opts->max_size);
+
+   reserve = &pool->lanes [lane];
+
+   mongoc_mutex_lock (&reserve->mutex);
+
+   if (opts) {
+      memcpy (&reserve->opts, opts, sizeof reserve->opts);
+      reserve->enabled = true;
+   } else {
+      memset (&reserve->opts, 0, sizeof reserve->opts);
+      reserve->enabled = false;
+   }
+
+   /* waiters may now make a client, or go to the pool */
+   mongoc_cond_broadcast (&reserve->cond);
+
+   mongoc_mutex_unlock (&reserve->mutex);
+}
+
+
+/*
+ * Make a client for @lane. The caller holds the lock of @reserve and has
+ * counted the client in its size already.
+ */
+static mongoc_client_t *
+_mongoc_client_pool_new_lane_client (mongoc_client_pool_t         *pool,
+                                     mongoc_client_pool_reserve_t *reserve,
+                                     mongoc_client_pool_lane_t     lane)
+{
+   mongoc_client_t *client;
+
+   mongoc_mutex_lock (&pool->mutex);
+   client = _mongoc_client_pool_new_client (pool);
+   mongoc_mutex_unlock (&pool->mutex);
+
+   client->pool_lane = (uint32_t)lane;
+
+   if (reserve->opts.socket_timeout_msec > 0) {
+      client->cluster.sockettimeoutms =
+         (uint32_t)reserve->opts.socket_timeout_msec;
+   }
+
+   if (reserve->opts.max_write_batch_size > 0) {
+      client->cluster.max_write_batch_size =
+         reserve->opts.max_write_batch_size;
+   }
+
+   return client;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_pop_lane --
+ *
+ *       Pop a client reserved for @lane with mongoc_client_pool_set_lane(),
+ *       waiting no longer than @timeout_msec once all of them are checked
+ *       out. A negative @timeout_msec waits forever and zero does not
+ *       wait. Clients are pushed back with mongoc_client_pool_push().
+ *
+ *       The default lane, and a lane nothing was reserved for, pop a
+ *       client of the pool as mongoc_client_pool_pop_timeout() does.
+ *
+ * Returns:
+ *       A client, or NULL and @error is set on timeout.
+ *
+ * Side effects:
+ *       May create a client.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_client_t *
+mongoc_client_pool_pop_lane (mongoc_client_pool_t      *pool,
+                             mongoc_client_pool_lane_t  lane,
+                             int32_t                    timeout_msec,
+                             bson_error_t              *error)
+{
+   mongoc_client_pool_reserve_t *reserve;
+   mongoc_client_t *client = NULL;
+   int64_t deadline = 0;
+   int64_t started;
+   int64_t now;
+   bool waited = false;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, NULL);
+   bson_return_val_if_fail (lane < MONGOC_CLIENT_POOL_N_LANES, NULL);
+
+   if (lane == MONGOC_CLIENT_POOL_LANE_DEFAULT) {
+      RETURN (_mongoc_client_pool_checkout (pool, timeout_msec, error));
+   }
+
+   reserve = &pool->lanes [lane];
+   started = bson_get_monotonic_time ();
+
+   if (timeout_msec > 0) {
+      deadline = started + (timeout_msec * 1000L);
+   }
+
+   mongoc_mutex_lock (&reserve->mutex);
+
+   for (;;) {
+      if (!reserve->enabled) {
+         mongoc_mutex_unlock (&reserve->mutex);
+         RETURN (_mongoc_client_pool_checkout (pool, timeout_msec, error));
+      }
+
+      if ((client = _mongoc_queue_pop_head_item (&reserve->queue))) {
+         break;
+      }
+
+      if (reserve->size < reserve->opts.max_size) {
+         reserve->size++;
+         client = _mongoc_client_pool_new_lane_client (pool, reserve, lane);
+         break;
+      }
+
+      if (!timeout_msec ||
+          ((timeout_msec > 0) &&
+           ((now = bson_get_monotonic_time ()) >= deadline))) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_POOL_EXHAUSTED,
+                         "No client of this lane is available in the pool.");
+         break;
+      }
+
+      if (!waited) {
+         reserve->n_waits++;
+         waited = true;
+      }
+
+      reserve->waiters++;
+
+      if (timeout_msec < 0) {
+         mongoc_cond_wait (&reserve->cond, &reserve->mutex);
+      } else {
+         mongoc_cond_timedwait (&reserve->cond, &reserve->mutex,
+                                BSON_MAX (1, (deadline - now) / 1000));
+      }
+
+      reserve->waiters--;
+   }
+
+   if (!client) {
+      reserve->n_exhausted++;
+   }
+
+   mongoc_mutex_unlock (&reserve->mutex);
+
+   if (client) {
+      _mongoc_client_pool_prepare (pool, client);
+      _mongoc_client_pool_count_checkout (reserve->checkout_usec, started);
+   } else {
+      mongoc_counter_client_pools_exhausted_inc ();
+   }
+
+   RETURN (client);
+}
+
+
+/*
+ * Put @client back in its lane, or destroy it if the lane no longer has
+ * room for it.
+ */
+static void
+_mongoc_client_pool_push_lane (mongoc_client_pool_t *pool,
+                               mongoc_client_t      *client)
+{
+   mongoc_client_pool_reserve_t *reserve;
+
+   BSON_ASSERT (client->pool_lane < MONGOC_CLIENT_POOL_N_LANES);
+
+   reserve = &pool->lanes [client->pool_lane];
+
+   mongoc_mutex_lock (&reserve->mutex);
+
+   if (!reserve->enabled || (reserve->size > reserve->opts.max_size)) {
+      reserve->size--;
+      mongoc_mutex_unlock (&reserve->mutex);
+      mongoc_client_destroy (client);
+      return;
+   }
+
+   client->pool_idle_since = bson_get_monotonic_time ();
+   _mongoc_queue_push_tail_item (&reserve->queue, &client->pool_item, client);
+
+   if (reserve->waiters) {
+      mongoc_cond_signal (&reserve->cond);
+   }
+
+   mongoc_mutex_unlock (&reserve->mutex);
+}
+
+
+void
+mongoc_client_pool_push (mongoc_client_pool_t *pool,
+                         mongoc_client_t      *client)
+{
+   mongoc_client_pool_shard_t *shard;
+   mongoc_client_t *old_client = NULL;
+
+   ENTRY;
+
+   bson_return_if_fail(pool);
+   bson_return_if_fail(client);
+
+   /*
+    * Kill the cursors the client was done with now, rather than whenever
+    * it is next popped, along with those it was not done with.
+    */
+   _mongoc_client_abandon_cursors (client);
+   mongoc_counter_client_pools_checked_out_dec ();
+
+   if (client->pool_lane) {
+      _mongoc_client_pool_push_lane (pool, client);
+      EXIT;
+   }
+
+   _mongoc_client_pool_reap (pool);
+
+   if ((uint32_t)bson_atomic_int_add (&pool->size, 0) > pool->min_pool_size) {
+      old_client = _mongoc_client_pool_take_idle (pool);
+
+      if (old_client) {
+         mongoc_client_destroy (old_client);
+         bson_atomic_int_add (&pool->size, -1);
+      }
+   }
+
+   /*
+    * A client that shares the pool monitor picks up a fresh topology from
+    * it on its next operation, so there is no need to reconnect here.
+    */
+   if ((client->cluster.state == MONGOC_CLUSTER_STATE_HEALTHY) ||
+       (client->cluster.state == MONGOC_CLUSTER_STATE_BORN) ||
+       client->cluster.monitor ||
+       _mongoc_cluster_reconnect (&client->cluster, NULL)) {
+      client->pool_idle_since = bson_get_monotonic_time ();
+
+      if ((client = _mongoc_client_pool_keep (pool, client))) {
+         shard = &pool->shards [_mongoc_client_pool_next_shard (pool)];
+
+         mongoc_mutex_lock (&shard->mutex);
+         _mongoc_queue_push_tail_item (&shard->queue, &client->pool_item, client);
+         mongoc_mutex_unlock (&shard->mutex);
+      }
+   } else {
+      mongoc_client_destroy (client);
+      bson_atomic_int_add (&pool->size, -1);
+   }
+
+   _mongoc_client_pool_wake_waiter (pool);
+
+   EXIT;
+}
+
+typedef struct
+{
+   mongoc_client_t *client;
+   mongoc_thread_t  thread;
+   bson_error_t     error;
+   bool             ok;
+} mongoc_client_pool_warmer_t;
+
+
+static void *
+_mongoc_client_pool_warm_one (void *data)
+{
+   mongoc_client_pool_warmer_t *warmer = data;
+
+   warmer->ok = _mongoc_client_warm_up (warmer->client, &warmer->error);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_warm --
+ *
+ *       Create clients until @pool holds minPoolSize of them, and connect
+ *       them all at once from a thread each, so that the first operations
+ *       do not each wait for a connection handshake and authentication.
+ *       Connecting is bounded by the connectTimeoutMS of the URI.
+ *
+ * Returns:
+ *       true if every new client connected; otherwise false, @error is
+ *       set from the first that failed and the failed clients are
+ *       discarded.
+ *
+ * Side effects:
+ *       The connected clients are added to the idle clients of @pool.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_pool_warm (mongoc_client_pool_t *pool,
+                         bson_error_t         *error)
+{
+   mongoc_client_pool_warmer_t *warmers;
+   mongoc_client_pool_shard_t *shard;
+   uint32_t size;
+   uint32_t n = 0;
+   uint32_t i;
+   bool ret = true;
 
    ENTRY;
 
+   bson_return_val_if_fail (pool, false);
+
    mongoc_mutex_lock (&pool->mutex);
-   size = pool->size;
+
+   size = (uint32_t)bson_atomic_int_add (&pool->size, 0);
+
+   if (size < pool->min_pool_size) {
+      n = BSON_MIN (pool->min_pool_size, pool->max_pool_size) - size;
+   }
+
+   warmers = bson_malloc0 (BSON_MAX (n, 1) * sizeof *warmers);
+
+   for (i = 0; i < n; i++) {
+      warmers[i].client = _mongoc_client_pool_new_client (pool);
+      _mongoc_client_set_local_oids (warmers[i].client, pool->local_oids);
+   }
+
+   bson_atomic_int_add (&pool->size, (int32_t)n);
+
    mongoc_mutex_unlock (&pool->mutex);
 
+   for (i = 0; i < n; i++) {
+      mongoc_thread_create (&warmers[i].thread, _mongoc_client_pool_warm_one,
+                            &warmers[i]);
+   }
+
+   for (i = 0; i < n; i++) {
+      mongoc_thread_join (warmers[i].thread);
+
+      if (warmers[i].ok) {
+         shard = &pool->shards [_mongoc_client_pool_next_shard (pool)];
+
+         mongoc_mutex_lock (&shard->mutex);
+         _mongoc_queue_push_tail_item (&shard->queue,
+                                       &warmers[i].client->pool_item,
+                                       warmers[i].client);
+         mongoc_mutex_unlock (&shard->mutex);
+      } else {
+         if (ret && error) {
+            memcpy (error, &warmers[i].error, sizeof *error);
+         }
+
+         ret = false;
+         mongoc_client_destroy (warmers[i].client);
+         bson_atomic_int_add (&pool->size, -1);
+      }
+
+      _mongoc_client_pool_wake_waiter (pool);
+   }
+
+   bson_free (warmers);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_reset_after_fork --
+ *
+ *       Make @pool usable in a child process created by fork(). Each idle
+ *       client drops the connections it inherited without sending on
+ *       them, see mongoc_client_reset_after_fork(), and the topology
+ *       monitor, whose thread did not survive the fork, is restarted.
+ *       The URI and the nodes known to the pool are kept, and clients
+ *       connect again as they are used, or by mongoc_client_pool_warm().
+ *
+ *       This must be called in the child before @pool is used, and no
+ *       client of @pool may have been checked out when the parent forked.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A thread is spawned for the monitor if @pool has one.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_reset_after_fork (mongoc_client_pool_t *pool)
+{
+   mongoc_client_pool_group_t *group;
+   mongoc_client_pool_slot_t *slot;
+   mongoc_queue_item_t *item;
+   int i;
+
+   ENTRY;
+
+   bson_return_if_fail (pool);
+
+   /*
+    * Locks held by threads of the parent would never be released here.
+    */
+   mongoc_mutex_init (&pool->mutex);
+   pool->waiter_head = NULL;
+   pool->waiter_tail = NULL;
+   pool->waiters = 0;
+
+   /* nor would inserts submitted by them ever be flushed */
+   mongoc_mutex_init (&pool->group_mutex);
+
+   for (group = pool->groups; group; group = group->next) {
+      group->head = group->tail = NULL;
+      group->n_pending = 0;
+      group->flushing = false;
+   }
+
+   /* the flights of the parent never land, the waiters being gone too */
+   _mongoc_query_flights_init (&pool->query_flights);
+
+   /* nor do the operations they had in flight */
+   _mongoc_node_limiter_reset_after_fork (&pool->node_limiter);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      mongoc_mutex_init (&pool->shards[i].mutex);
+
+      for (item = pool->shards[i].queue.head; item; item = item->next) {
+         mongoc_client_reset_after_fork (item->data);
+      }
+   }
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_LANES; i++) {
+      mongoc_mutex_init (&pool->lanes[i].mutex);
+      mongoc_cond_init (&pool->lanes[i].cond);
+      pool->lanes[i].waiters = 0;
+
+      for (item = pool->lanes[i].queue.head; item; item = item->next) {
+         mongoc_client_reset_after_fork (item->data);
+      }
+   }
+
+   for (slot = pool->slots; slot; slot = slot->next) {
+      mongoc_mutex_init (&slot->mutex);
+
+      if (slot->client) {
+         mongoc_client_reset_after_fork (slot->client);
+      }
+   }
+
+   if (pool->monitor) {
+      mongoc_client_reset_after_fork (pool->topology_client);
+      _mongoc_cluster_monitor_reset_after_fork (pool->monitor, pool->uri,
+                                                pool->topology_client);
+   }
+
+   EXIT;
+}
+
+
+size_t
+mongoc_client_pool_get_size (mongoc_client_pool_t *pool)
+{
+   size_t size = 0;
+
+   ENTRY;
+
+   size = (size_t)bson_atomic_int_add (&pool->size, 0);
+
    RETURN (size);
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_get_stats --
+ *
+ *       Fill @stats with the number of clients of @pool, how many of them
+ *       are idle or checked out, how many threads wait for one, and the
+ *       latency of the checkouts so far.
+ *
+ *       The counts are sampled one after the other while other threads
+ *       keep using the pool, so they need not add up exactly.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_get_stats (mongoc_client_pool_t       *pool,
+                              mongoc_client_pool_stats_t *stats)
+{
+   mongoc_client_pool_slot_t *slot;
+   uint32_t idle = 0;
+   int i;
+
+   ENTRY;
+
+   bson_return_if_fail (pool);
+   bson_return_if_fail (stats);
+
+   memset (stats, 0, sizeof *stats);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_N_SHARDS; i++) {
+      mongoc_mutex_lock (&pool->shards [i].mutex);
+      idle += _mongoc_queue_get_length (&pool->shards [i].queue);
+      mongoc_mutex_unlock (&pool->shards [i].mutex);
+   }
+
+   mongoc_mutex_lock (&pool->mutex);
+   for (slot = pool->slots; slot; slot = slot->next) {
+      mongoc_mutex_lock (&slot->mutex);
+      idle += !!slot->client;
+      mongoc_mutex_unlock (&slot->mutex);
+   }
+   mongoc_mutex_unlock (&pool->mutex);
+
+   stats->size = (uint32_t)bson_atomic_int_add (&pool->size, 0);
+   stats->idle = BSON_MIN (idle, stats->size);
+   stats->checked_out = stats->size - stats->idle;
+   stats->waiting = (uint32_t)bson_atomic_int_add (&pool->waiters, 0);
+   stats->n_waits = (uint64_t)bson_atomic_int64_add (&pool->n_waits, 0);
+   stats->n_exhausted = (uint64_t)bson_atomic_int64_add (&pool->n_exhausted,
+                                                         0);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_STATS_N_BUCKETS; i++) {
+      stats->checkout_usec [i] =
+         (uint64_t)bson_atomic_int64_add (&pool->checkout_usec [i], 0);
+      stats->n_checkouts += stats->checkout_usec [i];
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_get_lane_stats --
+ *
+ *       Fill @stats like mongoc_client_pool_get_stats() does, for the
+ *       clients reserved for @lane only. For the default lane these are
+ *       the stats of the pool.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_pool_get_lane_stats (mongoc_client_pool_t       *pool,
+                                   mongoc_client_pool_lane_t   lane,
+                                   mongoc_client_pool_stats_t *stats)
+{
+   mongoc_client_pool_reserve_t *reserve;
+   int i;
+
+   ENTRY;
+
+   bson_return_if_fail (pool);
+   bson_return_if_fail (lane < MONGOC_CLIENT_POOL_N_LANES);
+   bson_return_if_fail (stats);
+
+   if (lane == MONGOC_CLIENT_POOL_LANE_DEFAULT) {
+      mongoc_client_pool_get_stats (pool, stats);
+      EXIT;
+   }
+
+   reserve = &pool->lanes [lane];
+
+   memset (stats, 0, sizeof *stats);
+
+   mongoc_mutex_lock (&reserve->mutex);
+
+   stats->size = reserve->size;
+   stats->idle = BSON_MIN (_mongoc_queue_get_length (&reserve->queue),
+                           stats->size);
+   stats->checked_out = stats->size - stats->idle;
+   stats->waiting = reserve->waiters;
+   stats->n_waits = reserve->n_waits;
+   stats->n_exhausted = reserve->n_exhausted;
+
+   mongoc_mutex_unlock (&reserve->mutex);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_STATS_N_BUCKETS; i++) {
+      stats->checkout_usec [i] =
+         (uint64_t)bson_atomic_int64_add (&reserve->checkout_usec [i], 0);
+      stats->n_checkouts += stats->checkout_usec [i];
+   }
+
+   EXIT;
+}
@@ -37,12 +37,102 @@ BSON_BEGIN_DECLS
 typedef struct _mongoc_client_pool_t mongoc_client_pool_t;
 
 
+#define MONGOC_CLIENT_POOL_STATS_N_BUCKETS 24
+
+
+typedef struct
+{
+   uint32_t size;
+   uint32_t idle;
+   uint32_t checked_out;
+   uint32_t waiting;
+   uint64_t n_checkouts;
+   uint64_t n_waits;
+   uint64_t n_exhausted;
+   uint64_t checkout_usec [MONGOC_CLIENT_POOL_STATS_N_BUCKETS];
+   void    *padding [8];
+} mongoc_client_pool_stats_t;
+
+
+/*
+ * Lanes are clients of a pool set aside for one class of work, on top of
+ * maxPoolSize, so that bulk writes and latency-sensitive reads do not wait
+ * behind each other for a client or a connection.
+ */
+typedef enum
+{
+   MONGOC_CLIENT_POOL_LANE_DEFAULT     = 0,
+   MONGOC_CLIENT_POOL_LANE_INTERACTIVE = 1,
+   MONGOC_CLIENT_POOL_LANE_BULK        = 2,
+} mongoc_client_pool_lane_t;
+
+
+typedef struct
+{
+   uint32_t max_size;
+   int32_t  socket_timeout_msec;
+   int32_t  max_write_batch_size;
+   void    *padding [8];
+} mongoc_client_pool_lane_opts_t;
+
+
+typedef bool (*mongoc_client_pool_func_t) (mongoc_client_t *client,
+                                           void            *data,
+                                           bson_error_t    *error);
+
+
 mongoc_client_pool_t *mongoc_client_pool_new     (const mongoc_uri_t   *uri);
 void                  mongoc_client_pool_destroy (mongoc_client_pool_t *pool);
 mongoc_client_t      *mongoc_client_pool_pop     (mongoc_client_pool_t *pool);
 void                  mongoc_client_pool_push    (mongoc_client_pool_t *pool,
                                                   mongoc_client_t      *client);
 mongoc_client_t      *mongoc_client_pool_try_pop (mongoc_client_pool_t *pool);
+mongoc_client_t      *mongoc_client_pool_pop_timeout (mongoc_client_pool_t *pool,
+                                                      int32_t               timeout_msec,
+                                                      bson_error_t         *error);
+bool                  mongoc_client_pool_run     (mongoc_client_pool_t      *pool,
+                                                  int32_t                    timeout_msec,
+                                                  mongoc_client_pool_func_t  func,
+                                                  void                      *data,
+                                                  bson_error_t              *error);
+bool                  mongoc_client_pool_warm    (mongoc_client_pool_t *pool,
+                                                  bson_error_t         *error);
+void                  mongoc_client_pool_reset_after_fork (mongoc_client_pool_t *pool);
+void                  mongoc_client_pool_get_stats (mongoc_client_pool_t       *pool,
+                                                    mongoc_client_pool_stats_t *stats);
+void                  mongoc_client_pool_get_lane_stats (mongoc_client_pool_t       *pool,
+                                                         mongoc_client_pool_lane_t   lane,
+                                                         mongoc_client_pool_stats_t *stats);
+mongoc_client_t      *mongoc_client_pool_pop_lane (mongoc_client_pool_t      *pool,
+                                                   mongoc_client_pool_lane_t  lane,
+                                                   int32_t                    timeout_msec,
+                                                   bson_error_t              *error);
+void                  mongoc_client_pool_set_lane (mongoc_client_pool_t                 *pool,
+                                                   mongoc_client_pool_lane_t             lane,
+                                                   const mongoc_client_pool_lane_opts_t *opts);
+bool                  mongoc_client_pool_insert  (mongoc_client_pool_t         *pool,
+                                                  const char                   *database,
+                                                  const char                   *collection,
+                                                  mongoc_insert_flags_t         flags,
+                                                  const bson_t                 *document,
+                                                  const mongoc_write_concern_t *write_concern,
+                                                  bson_error_t                 *error);
+void                  mongoc_client_pool_set_apm_callbacks (mongoc_client_pool_t         *pool,
+                                                            const mongoc_apm_callbacks_t *callbacks,
+                                                            void                         *context);
+void                  mongoc_client_pool_set_topology_callbacks (mongoc_client_pool_t                  *pool,
+                                                                 const mongoc_apm_topology_callbacks_t *callbacks,
+                                                                 void                                  *context);
+void                  mongoc_client_pool_set_local_oids (mongoc_client_pool_t *pool,
+                                                         bool                  local_oids);
+void                  mongoc_client_pool_set_slow_op_log (mongoc_client_pool_t    *pool,
+                                                          int32_t                  threshold_msec,
+                                                          mongoc_apm_slow_op_cb_t  callback,
+                                                          void                    *context);
+void                  mongoc_client_pool_set_query_coalescing (mongoc_client_pool_t *pool,
+                                                               bool                  coalescing);
+void                  mongoc_client_pool_set_thread_affinity (mongoc_client_pool_t *pool,
+                                                              bool                  thread_affinity);
 #ifdef MONGOC_ENABLE_SSL
 void                  mongoc_client_pool_set_ssl_opts (mongoc_client_pool_t   *pool,
                                                        const mongoc_ssl_opt_t *opts);
@@ -31,16 +31,84 @@
 #include "mongoc-read-prefs.h"
 #include "mongoc-rpc-private.h"
 #include "mongoc-opcode.h"
+#include "mongoc-oplog-watcher.h"
+#include "mongoc-query-cache-private.h"
+#include "mongoc-queue-private.h"
+#include "mongoc-shard-router-private.h"
 #ifdef MONGOC_ENABLE_SSL
+#include <openssl/ssl.h>
+
 #include "mongoc-ssl.h"
 #endif
 #include "mongoc-stream.h"
+#include "mongoc-write-command-private.h"
 #include "mongoc-write-concern.h"
 
 
 BSON_BEGIN_DECLS
 
 
+/*
+ * Receive buffers released by cursors are kept on the client so that the
+ * next cursor can take one that is already large enough for its replies.
+ */
+#define MONGOC_CLIENT_RECV_BUFFERS_MAX     4
+#define MONGOC_CLIENT_RECV_BUFFER_MAX_SIZE (16 * 1024 * 1024)
+
+
+/*
+ * Likewise destroyed cursors are kept for reuse, along with the storage
+ * of their query and fields, by cursors created later on the client.
+ */
+#define MONGOC_CLIENT_FREE_CURSORS_MAX     8
+
+
+/*
+ * Unacknowledged inserts buffered by mongoc_client_set_write_coalescing(),
+ * one insert command per namespace.
+ */
+typedef struct
+{
+   char                      *database;
+   char                      *collection;
+   mongoc_write_command_t     command;
+} mongoc_client_coalesced_t;
+
+
+/*
+ * A count from mongoc_collection_estimated_count(), reused until
+ * @expire_at, see mongoc_client_set_estimated_count_ttl().
+ */
+typedef struct
+{
+   char                       ns [140];
+   int64_t                    count;
+   int64_t                    expire_at;
+} mongoc_client_estimated_count_t;
+
+
+typedef enum
+{
+   MONGOC_CLIENT_METADATA_COLLECTIONS,
+   MONGOC_CLIENT_METADATA_INDEXES,
+} mongoc_client_metadata_kind_t;
+
+
+/*
+ * The collections of database @ns matching @filter, or the indexes of
+ * collection @ns, as an array document, reused until @expire_at, see
+ * mongoc_client_set_metadata_cache_ttl().
+ */
+typedef struct
+{
+   mongoc_client_metadata_kind_t  kind;
+   char                           ns [140];
+   bson_t                        *filter;  /* or NULL */
+   bson_t                        *docs;
+   int64_t                        expire_at;
+} mongoc_client_metadata_t;
+
+
 struct _mongoc_client_t
 {
    uint32_t                   request_id;
@@ -48,6 +116,11 @@ struct _mongoc_client_t
    mongoc_uri_t              *uri;
    mongoc_cluster_t           cluster;
    bool                       in_exhaust;
+   struct _mongoc_cursor_t   *prefetch_cursor;
+   struct _mongoc_bulk_writer_t *bulk_writer;
+   mongoc_list_t             *write_futures;  /* in flight, oldest first */
+   bool                       in_write_future;
+   mongoc_oid_gen_t          *oid_gen;
 
    mongoc_stream_initiator_t  initiator;
    void                      *initiator_data;
@@ -55,10 +128,51 @@ struct _mongoc_client_t
 #ifdef MONGOC_ENABLE_SSL
    mongoc_ssl_opt_t           ssl_opts;
    char                      *pem_subject;
+   SSL_CTX                   *ssl_ctx;
 #endif
 
    mongoc_read_prefs_t       *read_prefs;
    mongoc_write_concern_t    *write_concern;
+
+   mongoc_list_t             *borrowed_databases;
+   mongoc_list_t             *borrowed_collections;
+
+   bson_realloc_func          realloc_func;
+   void                      *realloc_data;
+
+   mongoc_buffer_t            recv_buffers[MONGOC_CLIENT_RECV_BUFFERS_MAX];
+   uint32_t                   recv_buffers_len;
+
+   struct _mongoc_cursor_t   *free_cursors[MONGOC_CLIENT_FREE_CURSORS_MAX];
+   uint32_t                   free_cursors_len;
+
+   struct _mongoc_cursor_t   *live_cursors;  /* not yet destroyed */
+
+   mongoc_array_t             coalesced;
+   uint32_t                   coalesced_bytes;
+   uint32_t                   coalesce_max_bytes;
+   int64_t                    coalesce_interval_usec;
+   int64_t                    coalesce_deadline;
+   bool                       in_coalesce_flush;
+
+   mongoc_query_cache_t       query_cache;
+   mongoc_query_flights_t    *query_flights;  /* of the pool, or NULL */
+   mongoc_oplog_watcher_t    *cache_watcher;
+   uint64_t                   cache_watcher_seq;
+
+   mongoc_array_t             estimated_counts;
+   int64_t                    estimated_count_ttl_usec;
+
+   mongoc_array_t             metadata;
+   int64_t                    metadata_ttl_usec;
+
+   mongoc_shard_router_t     *shard_router;   /* or NULL */
+   mongoc_shard_router_t     *routed_by;      /* if a shard client of one */
+   bool                       scatter_gather;
+
+   int64_t                    pool_idle_since;
+   uint32_t                   pool_lane;      /* its lane, or 0 */
+   mongoc_queue_item_t        pool_item;      /* link in an idle queue */
 };
 
 
@@ -72,11 +186,22 @@ uint32_t         _mongoc_client_sendv         (mongoc_client_t              *cli
                                                const mongoc_write_concern_t *write_concern,
                                                const mongoc_read_prefs_t    *read_prefs,
                                                bson_error_t                 *error);
+uint32_t         _mongoc_client_try_sendv     (mongoc_client_t              *client,
+                                               mongoc_rpc_t                 *rpcs,
+                                               size_t                        rpcs_len,
+                                               uint32_t                      hint,
+                                               const mongoc_write_concern_t *write_concern,
+                                               const mongoc_read_prefs_t    *read_prefs,
+                                               bson_error_t                 *error);
 bool             _mongoc_client_recv          (mongoc_client_t              *client,
                                                mongoc_rpc_t                 *rpc,
                                                mongoc_buffer_t              *buffer,
                                                uint32_t                      hint,
                                                bson_error_t                 *error);
+void             _mongoc_client_recv_buffer_take    (mongoc_client_t        *client,
+                                                     mongoc_buffer_t        *buffer);
+void             _mongoc_client_recv_buffer_release (mongoc_client_t        *client,
+                                                     mongoc_buffer_t        *buffer);
 bool             _mongoc_client_recv_gle      (mongoc_client_t              *client,
                                                uint32_t                      hint,
                                                bson_t                      **gle_doc,
@@ -90,6 +215,43 @@ uint32_t         _mongoc_client_preselect     (mongoc_client_t              *cli
                                                const mongoc_write_concern_t *write_concern,
                                                const mongoc_read_prefs_t    *read_prefs,
                                                bson_error_t                 *error);
+bool             _mongoc_client_get_estimated_count  (mongoc_client_t       *client,
+                                                      const char            *ns,
+                                                      int64_t               *count);
+void             _mongoc_client_set_estimated_count  (mongoc_client_t       *client,
+                                                      const char            *ns,
+                                                      int64_t                count);
+mongoc_cursor_t *_mongoc_client_get_metadata        (mongoc_client_t       *client,
+                                                      mongoc_client_metadata_kind_t kind,
+                                                      const char            *ns,
+                                                      const bson_t          *filter);
+mongoc_cursor_t *_mongoc_client_set_metadata        (mongoc_client_t       *client,
+                                                      mongoc_client_metadata_kind_t kind,
+                                                      const char            *ns,
+                                                      const bson_t          *filter,
+                                                      mongoc_cursor_t       *cursor);
+void             _mongoc_client_invalidate_metadata (mongoc_client_t       *client,
+                                                      const char            *db,
+                                                      const char            *collection);
+void             _mongoc_client_kill_cursor_deferred (mongoc_client_t       *client,
+                                                      uint32_t               hint,
+                                                      int64_t                cursor_id);
+void             _mongoc_client_flush_dead_cursors   (mongoc_client_t       *client);
+void             _mongoc_client_abandon_cursors      (mongoc_client_t       *client);
+void             _mongoc_client_set_local_oids       (mongoc_client_t       *client,
+                                                      bool                   local_oids);
+bool             _mongoc_client_coalesce_insert      (mongoc_client_t       *client,
+                                                      const char            *database,
+                                                      const char            *collection,
+                                                      const bson_t          *document,
+                                                      bson_error_t          *error);
+mongoc_client_t *_mongoc_client_new_for_shard        (mongoc_client_t       *client,
+                                                      const char            *uri_string);
+#ifdef MONGOC_ENABLE_SSL
+void             _mongoc_client_set_ssl_opts_with_ctx (mongoc_client_t        *client,
+                                                       const mongoc_ssl_opt_t *opts,
+                                                       SSL_CTX                *ssl_ctx);
+#endif
 
 
 BSON_END_DECLS
@@ -19,8 +19,11 @@
 #ifndef _WIN32
 # include <netdb.h>
 # include <netinet/tcp.h>
+# include <sys/stat.h>
+# include <unistd.h>
 #endif
 
+#include "mongoc-bulk-writer-private.h"
 #include "mongoc-cursor-array-private.h"
 #include "mongoc-client.h"
 #include "mongoc-client-private.h"
@@ -30,20 +33,26 @@
 #include "mongoc-counters-private.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-database-private.h"
+#include "mongoc-dns-cache-private.h"
 #include "mongoc-gridfs-private.h"
 #include "mongoc-error.h"
 #include "mongoc-list-private.h"
 #include "mongoc-log.h"
 #include "mongoc-opcode.h"
+#include "mongoc-oplog-watcher-private.h"
 #include "mongoc-queue-private.h"
-#include "mongoc-socket.h"
+#include "mongoc-read-prefs-private.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream-buffered.h"
 #include "mongoc-stream-socket.h"
 #include "mongoc-thread-private.h"
 #include "mongoc-trace.h"
+#include "mongoc-write-concern-private.h"
+#include "mongoc-write-future-private.h"
 
 #ifdef MONGOC_ENABLE_SSL
 #include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
 #include "mongoc-ssl-private.h"
 #endif
 
@@ -52,6 +61,264 @@
 #define MONGOC_LOG_DOMAIN "client"
 
 
+/*
+ * How long a connection attempt may run before the next address is raced
+ * against it. This is the default recommended by RFC 8305.
+ */
+#ifndef MONGOC_CONNECTION_ATTEMPT_DELAY_MS
+# define MONGOC_CONNECTION_ATTEMPT_DELAY_MS 250
+#endif
+
+
+static bool
+_mongoc_client_flush_coalesced (mongoc_client_t *client,
+                                bson_error_t    *error);
+static void
+_mongoc_client_clear_metadata  (mongoc_client_t *client);
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_sort_addrinfo --
+ *
+ *       Order the results of getaddrinfo() so that address families
+ *       alternate, starting with the family of the first result, as
+ *       described in RFC 8305 section 4.
+ *
+ * Returns:
+ *       The number of addresses stored in @addrs, which must have room
+ *       for every element of @result.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static size_t
+mongoc_client_sort_addrinfo (struct addrinfo  *result,
+                             struct addrinfo **addrs)
+{
+   struct addrinfo *preferred = result;
+   struct addrinfo *other = result;
+   size_t n = 0;
+
+   for (;;) {
+      while (preferred && (preferred->ai_family != result->ai_family)) {
+         preferred = preferred->ai_next;
+      }
+
+      while (other && (other->ai_family == result->ai_family)) {
+         other = other->ai_next;
+      }
+
+      if (!preferred && !other) {
+         break;
+      }
+
+      if (preferred) {
+         addrs[n++] = preferred;
+         preferred = preferred->ai_next;
+      }
+
+      if (other) {
+         addrs[n++] = other;
+         other = other->ai_next;
+      }
+   }
+
+   return n;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_warn_connect_failure --
+ *
+ *       Log why connecting @sock to the address @rp of @host failed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+mongoc_client_warn_connect_failure (const struct addrinfo    *rp,
+                                    const mongoc_host_list_t *host,
+                                    mongoc_socket_t          *sock)
+{
+   char *errmsg;
+   char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
+   char ip[255];
+
+   mongoc_socket_inet_ntop ((struct addrinfo *)rp, ip, sizeof ip);
+   errmsg = bson_strerror_r (
+      mongoc_socket_errno (sock), errmsg_buf, sizeof errmsg_buf);
+   MONGOC_WARNING ("Failed to connect to: %s:%d, error: %d, %s\n",
+                   ip,
+                   host->port,
+                   mongoc_socket_errno(sock),
+                   errmsg);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_enable_zerocopy --
+ *
+ *       Turn on SO_ZEROCOPY for @sock, so large sends are made with
+ *       MSG_ZEROCOPY instead of being copied into the socket buffer.
+ *       Kernels without zero-copy support simply keep copying.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+mongoc_client_enable_zerocopy (mongoc_socket_t *sock)
+{
+#ifdef SO_ZEROCOPY
+   int one = 1;
+
+   if (0 != mongoc_socket_setsockopt (sock, SOL_SOCKET, SO_ZEROCOPY,
+                                      &one, sizeof one)) {
+      MONGOC_WARNING ("zeroCopySend is not supported by this kernel.");
+   }
+#else
+   MONGOC_WARNING ("zeroCopySend is not supported on this platform.");
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_setsockopt_int --
+ *
+ *       Set the socket option @level/@optname of @sock to the int32 URI
+ *       option @key, if @options has one greater than zero. @scale
+ *       divides the URI value, rounding up, for options the kernel takes
+ *       in coarser units than the URI does.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A warning is logged if the option could not be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+mongoc_client_setsockopt_int (mongoc_socket_t *sock,
+                              const bson_t    *options,
+                              const char      *key,
+                              int              level,
+                              int              optname,
+                              int32_t          scale)
+{
+   bson_iter_t iter;
+   int32_t value;
+   int optval;
+
+   if (!bson_iter_init_find_case (&iter, options, key) ||
+       !BSON_ITER_HOLDS_INT32 (&iter) ||
+       ((value = bson_iter_int32 (&iter)) <= 0)) {
+      return;
+   }
+
+   optval = (int)((value + scale - 1) / scale);
+
+   if (0 != mongoc_socket_setsockopt (sock, level, optname,
+                                      &optval, sizeof optval)) {
+      MONGOC_WARNING ("Failed to set socket option %s=%d: %d",
+                      key, (int)value, mongoc_socket_errno (sock));
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_tune_socket --
+ *
+ *       Apply the socket tuning options of @options to @sock before it
+ *       connects, so that buffer sizes are taken into account for TCP
+ *       window scaling and TCP Fast Open can carry the first request in
+ *       the SYN. Options the platform lacks are ignored.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+mongoc_client_tune_socket (mongoc_socket_t *sock,
+                           const bson_t    *options)
+{
+   bson_iter_t iter;
+   int one = 1;
+
+   if (!options) {
+      return;
+   }
+
+   mongoc_client_setsockopt_int (sock, options, "socketsendbuffersize",
+                                 SOL_SOCKET, SO_SNDBUF, 1);
+   mongoc_client_setsockopt_int (sock, options, "socketreceivebuffersize",
+                                 SOL_SOCKET, SO_RCVBUF, 1);
+
+   if (bson_iter_init_find_case (&iter, options, "keepalive") &&
+       BSON_ITER_HOLDS_BOOL (&iter) &&
+       bson_iter_bool (&iter)) {
+      mongoc_socket_setsockopt (sock, SOL_SOCKET, SO_KEEPALIVE,
+                                &one, sizeof one);
+#ifdef TCP_KEEPIDLE
+      mongoc_client_setsockopt_int (sock, options, "keepaliveidlems",
+                                    IPPROTO_TCP, TCP_KEEPIDLE, 1000);
+#endif
+#ifdef TCP_KEEPINTVL
+      mongoc_client_setsockopt_int (sock, options, "keepaliveintervalms",
+                                    IPPROTO_TCP, TCP_KEEPINTVL, 1000);
+#endif
+#ifdef TCP_KEEPCNT
+      mongoc_client_setsockopt_int (sock, options, "keepalivecount",
+                                    IPPROTO_TCP, TCP_KEEPCNT, 1);
+#endif
+   }
+
+#ifdef SO_BUSY_POLL
+   mongoc_client_setsockopt_int (sock, options, "busypollus",
+                                 SOL_SOCKET, SO_BUSY_POLL, 1);
+#endif
+
+#ifdef TCP_FASTOPEN_CONNECT
+   if (bson_iter_init_find_case (&iter, options, "tcpfastopen") &&
+       BSON_ITER_HOLDS_BOOL (&iter) &&
+       bson_iter_bool (&iter)) {
+      mongoc_socket_setsockopt (sock, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                                &one, sizeof one);
+   }
+#endif
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -59,6 +326,13 @@
  *
  *       Connect to a host using a TCP socket.
  *
+ *       Host names are resolved for every address family, through the
+ *       process-wide cache in mongoc-dns-cache.c. Addresses are
+ *       tried in parallel, staggered by MONGOC_CONNECTION_ATTEMPT_DELAY_MS
+ *       and alternating between families, so that an unreachable IPv6
+ *       route does not stall the connection for the whole connect timeout
+ *       ("Happy Eyeballs", RFC 8305). The first socket to connect wins.
+ *
  *       This will be performed synchronously and return a mongoc_stream_t
  *       that can be used to connect with the remote host.
  *
@@ -77,13 +351,27 @@ mongoc_client_connect_tcp (const mongoc_uri_t       *uri,
                            const mongoc_host_list_t *host,
                            bson_error_t             *error)
 {
+   mongoc_socket_poll_t *sds;
    mongoc_socket_t *sock = NULL;
+   mongoc_socket_t *attempt;
    struct addrinfo hints;
    struct addrinfo *result, *rp;
+   struct addrinfo **addrs;
+   struct addrinfo **attempt_addrs;
    int32_t connecttimeoutms = MONGOC_DEFAULT_CONNECTTIMEOUTMS;
+   int64_t dns_ttl_msec = MONGOC_DEFAULT_DNS_CACHE_TTL_MS;
+   int64_t dns_negative_ttl_msec = MONGOC_DEFAULT_DNS_NEGATIVE_CACHE_TTL_MS;
    int64_t expire_at;
+   int64_t next_attempt_at = 0;
+   int64_t wait_until;
+   int64_t now;
+   int32_t timeout_msec;
    const bson_t *options;
    bson_iter_t iter;
+   size_t n_addrs = 0;
+   size_t n_sds = 0;
+   size_t next = 0;
+   size_t i;
    char portstr [8];
    int s;
 
@@ -100,21 +388,38 @@ mongoc_client_connect_tcp (const mongoc_uri_t       *uri,
       }
    }
 
+   if (options &&
+       bson_iter_init_find_case (&iter, options, "dnscachettlms") &&
+       BSON_ITER_HOLDS_INT32 (&iter)) {
+      dns_ttl_msec = bson_iter_int32 (&iter);
+   }
+
+   if (options &&
+       bson_iter_init_find_case (&iter, options, "dnsnegativecachettlms") &&
+       BSON_ITER_HOLDS_INT32 (&iter)) {
+      dns_negative_ttl_msec = bson_iter_int32 (&iter);
+   }
+
    BSON_ASSERT (connecttimeoutms);
    expire_at = bson_get_monotonic_time () + (connecttimeoutms * 1000L);
 
    bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
 
+   /*
+    * Anything that isn't an IPv6 literal is parsed as AF_INET, but a host
+    * name may well resolve to IPv6 addresses too.
+    */
    memset (&hints, 0, sizeof hints);
-   hints.ai_family = host->family;
+   hints.ai_family = (host->family == AF_INET) ? AF_UNSPEC : host->family;
    hints.ai_socktype = SOCK_STREAM;
    hints.ai_flags = 0;
    hints.ai_protocol = 0;
 
-   s = getaddrinfo (host->host, portstr, &hints, &result);
+   s = _mongoc_dns_cache_getaddrinfo (host->host, portstr, &hints,
+                                      dns_ttl_msec, dns_negative_ttl_msec,
+                                      &result);
 
    if (s != 0) {
-      mongoc_counter_dns_failure_inc ();
       bson_set_error(error,
                      MONGOC_ERROR_STREAM,
                      MONGOC_ERROR_STREAM_NAME_RESOLUTION,
@@ -123,56 +428,128 @@ mongoc_client_connect_tcp (const mongoc_uri_t       *uri,
       RETURN (NULL);
    }
 
-   mongoc_counter_dns_success_inc ();
-
    for (rp = result; rp; rp = rp->ai_next) {
+      n_addrs++;
+   }
+
+   addrs = bson_malloc0 (n_addrs * sizeof *addrs);
+   attempt_addrs = bson_malloc0 (n_addrs * sizeof *attempt_addrs);
+   sds = bson_malloc0 (n_addrs * sizeof *sds);
+
+   n_addrs = mongoc_client_sort_addrinfo (result, addrs);
+
+   while (!sock) {
+      now = bson_get_monotonic_time ();
+
+      if (now >= expire_at) {
+         break;
+      }
+
       /*
-       * Create a new non-blocking socket.
+       * Start the next attempt if nothing is in flight, or if the attempts
+       * in flight have had their head start.
        */
-      if (!(sock = mongoc_socket_new (rp->ai_family,
-                                      rp->ai_socktype,
-                                      rp->ai_protocol))) {
+      if ((next < n_addrs) && (!n_sds || (now >= next_attempt_at))) {
+         rp = addrs[next++];
+
+         /*
+          * Create a new non-blocking socket.
+          */
+         if (!(attempt = mongoc_socket_new (rp->ai_family,
+                                            rp->ai_socktype,
+                                            rp->ai_protocol))) {
+            continue;
+         }
+
+         mongoc_client_tune_socket (attempt, options);
+
+         s = _mongoc_socket_connect_begin (attempt,
+                                           rp->ai_addr,
+                                           (socklen_t)rp->ai_addrlen);
+
+         if (s == 0) {
+            sock = attempt;
+         } else if (s < 0) {
+            mongoc_client_warn_connect_failure (rp, host, attempt);
+            mongoc_socket_destroy (attempt);
+         } else {
+            sds[n_sds].socket = attempt;
+            sds[n_sds].events = POLLOUT;
+            attempt_addrs[n_sds] = rp;
+            n_sds++;
+            next_attempt_at = now +
+                              (MONGOC_CONNECTION_ATTEMPT_DELAY_MS * 1000L);
+         }
+
          continue;
       }
 
-      /*
-       * Try to connect to the peer.
-       */
-      if (0 != mongoc_socket_connect (sock,
-                                      rp->ai_addr,
-                                      (socklen_t)rp->ai_addrlen,
-                                      expire_at)) {
-         char *errmsg;
-         char errmsg_buf[BSON_ERROR_BUFFER_SIZE];
-         char ip[255];
-
-         mongoc_socket_inet_ntop (rp, ip, sizeof ip);
-         errmsg = bson_strerror_r (
-            mongoc_socket_errno (sock), errmsg_buf, sizeof errmsg_buf);
-         MONGOC_WARNING ("Failed to connect to: %s:%d, error: %d, %s\n",
-                         ip,
-                         host->port,
-                         mongoc_socket_errno(sock),
-                         errmsg);
-         mongoc_socket_destroy (sock);
-         sock = NULL;
+      if (!n_sds) {
+         break;
+      }
+
+      wait_until = expire_at;
+      if ((next < n_addrs) && (next_attempt_at < wait_until)) {
+         wait_until = next_attempt_at;
+      }
+
+      timeout_msec = (int32_t)((wait_until - now + 999L) / 1000L);
+
+      if (_mongoc_socket_poll (sds, n_sds, timeout_msec) <= 0) {
          continue;
       }
 
-      break;
+      for (i = 0; i < n_sds;) {
+         if (!sds[i].revents) {
+            i++;
+            continue;
+         }
+
+         attempt = sds[i].socket;
+         rp = attempt_addrs[i];
+
+         n_sds--;
+         sds[i] = sds[n_sds];
+         attempt_addrs[i] = attempt_addrs[n_sds];
+
+         if (0 == _mongoc_socket_connect_finish (attempt)) {
+            sock = attempt;
+            break;
+         }
+
+         mongoc_client_warn_connect_failure (rp, host, attempt);
+         mongoc_socket_destroy (attempt);
+
+         /* don't wait out the head start of a failed attempt */
+         next_attempt_at = now;
+      }
    }
 
+   for (i = 0; i < n_sds; i++) {
+      mongoc_socket_destroy (sds[i].socket);
+   }
+
+   bson_free (sds);
+   bson_free (attempt_addrs);
+   bson_free (addrs);
+
+   _mongoc_dns_cache_freeaddrinfo (result);
+
    if (!sock) {
       bson_set_error (error,
                       MONGOC_ERROR_STREAM,
                       MONGOC_ERROR_STREAM_CONNECT,
                       "Failed to connect to target host: %s",
                       host->host_and_port);
-      freeaddrinfo (result);
       RETURN (NULL);
    }
 
-   freeaddrinfo (result);
+   if (options &&
+       bson_iter_init_find_case (&iter, options, "zerocopysend") &&
+       BSON_ITER_HOLDS_BOOL (&iter) &&
+       bson_iter_bool (&iter)) {
+      mongoc_client_enable_zerocopy (sock);
+   }
 
    return mongoc_stream_socket_new (sock);
 }
@@ -254,80 +631,222 @@ mongoc_client_connect_unix (const mongoc_uri_t       *uri,
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_default_stream_initiator --
- *
- *       A mongoc_stream_initiator_t that will handle the various type
- *       of supported sockets by MongoDB including TCP and UNIX.
+ * mongoc_client_host_is_local --
  *
- *       Language binding authors may want to implement an alternate
- *       version of this method to use their native stream format.
+ *       Checks whether @host names this machine: "localhost", the name
+ *       returned by gethostname(), or a name or address that resolves to
+ *       a loopback address.
  *
  * Returns:
- *       A mongoc_stream_t if successful; otherwise NULL and @error is set.
+ *       true if @host is this machine.
  *
  * Side effects:
- *       @error is set if return value is NULL.
+ *       @host may be resolved through the process-wide DNS cache, which
+ *       mongoc_client_connect_tcp() would have done anyway.
  *
  *--------------------------------------------------------------------------
  */
 
-static mongoc_stream_t *
-mongoc_client_default_stream_initiator (const mongoc_uri_t       *uri,
-                                        const mongoc_host_list_t *host,
-                                        void                     *user_data,
-                                        bson_error_t             *error)
+#ifndef _WIN32
+static bool
+mongoc_client_host_is_local (const mongoc_host_list_t *host)
 {
-   mongoc_stream_t *base_stream = NULL;
-#ifdef MONGOC_ENABLE_SSL
-   mongoc_client_t *client = user_data;
-   const bson_t *options;
-   bson_iter_t iter;
-   const char *mechanism;
-   int32_t connecttimeoutms = MONGOC_DEFAULT_CONNECTTIMEOUTMS;
-#endif
+   struct addrinfo hints;
+   struct addrinfo *result, *rp;
+   char hostname [256];
+   char portstr [8];
+   bool ret = false;
 
-   bson_return_val_if_fail (uri, NULL);
-   bson_return_val_if_fail (host, NULL);
+   if (!strcasecmp (host->host, "localhost")) {
+      return true;
+   }
 
-#ifndef MONGOC_ENABLE_SSL
-   if (mongoc_uri_get_ssl (uri)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                      "SSL is not enabled in this build of mongo-c-driver.");
-      return NULL;
+   if (0 == gethostname (hostname, sizeof hostname)) {
+      hostname [sizeof hostname - 1] = '\0';
+      if (!strcasecmp (host->host, hostname)) {
+         return true;
+      }
    }
-#endif
 
+   /* the same query as mongoc_client_connect_tcp(), to share its answer */
+   bson_snprintf (portstr, sizeof portstr, "%hu", host->port);
 
-   switch (host->family) {
+   memset (&hints, 0, sizeof hints);
+   hints.ai_family = (host->family == AF_INET) ? AF_UNSPEC : host->family;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if (0 != _mongoc_dns_cache_getaddrinfo (
+          host->host, portstr, &hints, MONGOC_DEFAULT_DNS_CACHE_TTL_MS,
+          MONGOC_DEFAULT_DNS_NEGATIVE_CACHE_TTL_MS, &result)) {
+      return false;
+   }
+
+   for (rp = result; rp && !ret; rp = rp->ai_next) {
+      if (rp->ai_family == AF_INET) {
+         ret = (ntohl (((struct sockaddr_in *)rp->ai_addr)->sin_addr.s_addr)
+                >> 24) == 127;
 #if defined(AF_INET6)
-   case AF_INET6:
+      } else if (rp->ai_family == AF_INET6) {
+         ret = !!IN6_IS_ADDR_LOOPBACK (
+            &((struct sockaddr_in6 *)rp->ai_addr)->sin6_addr);
 #endif
-   case AF_INET:
-      base_stream = mongoc_client_connect_tcp (uri, host, error);
-      break;
-   case AF_UNIX:
-      base_stream = mongoc_client_connect_unix (uri, host, error);
-      break;
-   default:
-      bson_set_error (error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_INVALID_TYPE,
-                      "Invalid address family: 0x%02x", host->family);
-      break;
+      }
    }
 
-#ifdef MONGOC_ENABLE_SSL
-   if (base_stream) {
-      options = mongoc_uri_get_options (uri);
-      mechanism = mongoc_uri_get_auth_mechanism (uri);
+   _mongoc_dns_cache_freeaddrinfo (result);
 
-      if ((bson_iter_init_find_case (&iter, options, "ssl") &&
-           bson_iter_as_bool (&iter)) ||
-          (mechanism && (0 == strcmp (mechanism, "MONGODB-X509")))) {
-         base_stream = mongoc_stream_tls_new (base_stream, &client->ssl_opts,
-                                              true);
+   return ret;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_connect_local_unix --
+ *
+ *       If the "preferUnixSocket" option of @uri is set and @host is this
+ *       machine, connect to the UNIX domain socket a mongod or mongos
+ *       listening on the port of @host creates, /tmp/mongodb-<port>.sock,
+ *       instead of going through TCP loopback.
+ *
+ * Returns:
+ *       A newly allocated mongoc_stream_t if successful; otherwise NULL,
+ *       in which case the caller connects with TCP.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_stream_t *
+mongoc_client_connect_local_unix (const mongoc_uri_t       *uri,
+                                  const mongoc_host_list_t *host)
+{
+#ifdef _WIN32
+   return NULL;
+#else
+   mongoc_host_list_t local;
+   const bson_t *options;
+   bson_iter_t iter;
+   struct stat st;
+
+   ENTRY;
+
+   if (!(options = mongoc_uri_get_options (uri)) ||
+       !bson_iter_init_find_case (&iter, options, "preferunixsocket") ||
+       !BSON_ITER_HOLDS_BOOL (&iter) ||
+       !bson_iter_bool (&iter)) {
+      RETURN (NULL);
+   }
+
+   memset (&local, 0, sizeof local);
+   bson_snprintf (local.host, sizeof local.host, "/tmp/mongodb-%hu.sock",
+                  host->port);
+   bson_snprintf (local.host_and_port, sizeof local.host_and_port, "%s",
+                  local.host);
+   local.port = host->port;
+   local.family = AF_UNIX;
+
+   if ((0 != stat (local.host, &st)) ||
+       !S_ISSOCK (st.st_mode) ||
+       (0 != access (local.host, R_OK | W_OK)) ||
+       !mongoc_client_host_is_local (host)) {
+      RETURN (NULL);
+   }
+
+   RETURN (mongoc_client_connect_unix (uri, &local, NULL));
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_default_stream_initiator --
+ *
+ *       A mongoc_stream_initiator_t that will handle the various type
+ *       of supported sockets by MongoDB including TCP and UNIX.
+ *
+ *       Language binding authors may want to implement an alternate
+ *       version of this method to use their native stream format.
+ *
+ * Returns:
+ *       A mongoc_stream_t if successful; otherwise NULL and @error is set.
+ *
+ * Side effects:
+ *       @error is set if return value is NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_stream_t *
+mongoc_client_default_stream_initiator (const mongoc_uri_t       *uri,
+                                        const mongoc_host_list_t *host,
+                                        void                     *user_data,
+                                        bson_error_t             *error)
+{
+   mongoc_stream_t *base_stream = NULL;
+#ifdef MONGOC_ENABLE_SSL
+   mongoc_client_t *client = user_data;
+   const bson_t *options;
+   bson_iter_t iter;
+   const char *mechanism;
+   int32_t connecttimeoutms = MONGOC_DEFAULT_CONNECTTIMEOUTMS;
+#endif
+
+   bson_return_val_if_fail (uri, NULL);
+   bson_return_val_if_fail (host, NULL);
+
+#ifndef MONGOC_ENABLE_SSL
+   if (mongoc_uri_get_ssl (uri)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                      "SSL is not enabled in this build of mongo-c-driver.");
+      return NULL;
+   }
+#endif
+
+
+   switch (host->family) {
+#if defined(AF_INET6)
+   case AF_INET6:
+#endif
+   case AF_INET:
+      if (!(base_stream = mongoc_client_connect_local_unix (uri, host))) {
+         base_stream = mongoc_client_connect_tcp (uri, host, error);
+      }
+      break;
+   case AF_UNIX:
+      base_stream = mongoc_client_connect_unix (uri, host, error);
+      break;
+   default:
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_INVALID_TYPE,
+                      "Invalid address family: 0x%02x", host->family);
+      break;
+   }
+
+#ifdef MONGOC_ENABLE_SSL
+   if (base_stream) {
+      options = mongoc_uri_get_options (uri);
+      mechanism = mongoc_uri_get_auth_mechanism (uri);
+
+      if ((bson_iter_init_find_case (&iter, options, "ssl") &&
+           bson_iter_as_bool (&iter)) ||
+          (mechanism && (0 == strcmp (mechanism, "MONGODB-X509")))) {
+         if (client->ssl_ctx) {
+            base_stream = _mongoc_stream_tls_new_with_ctx (base_stream,
+                                                           &client->ssl_opts,
+                                                           client->ssl_ctx,
+                                                           true);
+         } else {
+            base_stream = mongoc_stream_tls_new (base_stream,
+                                                 &client->ssl_opts, true);
+         }
 
          if (!base_stream) {
             bson_set_error (error,
@@ -344,6 +863,9 @@ mongoc_client_default_stream_initiator (const mongoc_uri_t       *uri,
             }
          }
 
+         _mongoc_stream_tls_set_session_key (base_stream,
+                                             host->host_and_port);
+
          if (!mongoc_stream_tls_do_handshake (base_stream, connecttimeoutms) ||
              !mongoc_stream_tls_check_cert (base_stream, host->host)) {
             bson_set_error (error,
@@ -397,37 +919,19 @@ _mongoc_client_create_stream (mongoc_client_t          *client,
 
 
 /*
- *--------------------------------------------------------------------------
- *
- * _mongoc_client_sendv --
- *
- *       INTERNAL API
- *
- *       This function is used to deliver one or more RPCs to the remote
- *       MongoDB server.
- *
- *       Based on the cluster state and operation type, the request may
- *       be retried. This is handled by the cluster instance.
- *
- * Returns:
- *       0 upon failure and @error is set. Otherwise non-zero indicating
- *       the cluster node that performed the request.
- *
- * Side effects:
- *       @error is set if return value is 0.
- *       @rpcs is mutated and therefore invalid after calling.
- *
- *--------------------------------------------------------------------------
+ * The body of _mongoc_client_sendv() and _mongoc_client_try_sendv(),
+ * @try_only selects the latter.
  */
 
-uint32_t
-_mongoc_client_sendv (mongoc_client_t              *client,
-                      mongoc_rpc_t                 *rpcs,
-                      size_t                        rpcs_len,
-                      uint32_t                      hint,
-                      const mongoc_write_concern_t *write_concern,
-                      const mongoc_read_prefs_t    *read_prefs,
-                      bson_error_t                 *error)
+static uint32_t
+_mongoc_client_do_sendv (mongoc_client_t              *client,
+                         mongoc_rpc_t                 *rpcs,
+                         size_t                        rpcs_len,
+                         uint32_t                      hint,
+                         const mongoc_write_concern_t *write_concern,
+                         const mongoc_read_prefs_t    *read_prefs,
+                         bool                          try_only,
+                         bson_error_t                 *error)
 {
    size_t i;
 
@@ -443,6 +947,33 @@ _mongoc_client_sendv (mongoc_client_t              *client,
       RETURN(false);
    }
 
+   /*
+    * A cursor's prefetched OP_GET_MORE reply, or the reply to a batch a
+    * bulk writer left in flight, must be read before anything else is
+    * sent, or it would be mistaken for the reply to this request.
+    * Failures are recorded on that cursor or writer.
+    */
+   if (client->prefetch_cursor) {
+      _mongoc_cursor_prefetch_recv (client->prefetch_cursor);
+   }
+
+   if (client->bulk_writer) {
+      _mongoc_bulk_writer_recv (client->bulk_writer);
+   }
+
+   /*
+    * So must the acknowledgements of writes left in flight by
+    * mongoc_collection_insert_async(), unless this is one more of them.
+    */
+   if (client->write_futures && !client->in_write_future) {
+      _mongoc_write_future_collect_all (client);
+   }
+
+   /*
+    * Likewise coalesced inserts go out before anything sent after them.
+    */
+   _mongoc_client_flush_coalesced (client, NULL);
+
    for (i = 0; i < rpcs_len; i++) {
       rpcs[i].header.msg_len = 0;
       rpcs[i].header.request_id = ++client->request_id;
@@ -452,6 +983,15 @@ _mongoc_client_sendv (mongoc_client_t              *client,
    case MONGOC_CLUSTER_STATE_BORN:
    case MONGOC_CLUSTER_STATE_HEALTHY:
    case MONGOC_CLUSTER_STATE_UNHEALTHY:
+      if (try_only || client->write_futures) {
+         /*
+          * No pings or reconnects, they would read the acknowledgements
+          * still in flight.
+          */
+         return _mongoc_cluster_try_sendv(&client->cluster, rpcs, rpcs_len,
+                                          hint, write_concern, read_prefs,
+                                          error);
+      }
       return _mongoc_cluster_sendv(&client->cluster, rpcs, rpcs_len, hint,
                                    write_concern, read_prefs, error);
    case MONGOC_CLUSTER_STATE_DEAD:
@@ -467,6 +1007,81 @@ _mongoc_client_sendv (mongoc_client_t              *client,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_sendv --
+ *
+ *       INTERNAL API
+ *
+ *       This function is used to deliver one or more RPCs to the remote
+ *       MongoDB server.
+ *
+ *       Based on the cluster state and operation type, the request may
+ *       be retried. This is handled by the cluster instance.
+ *
+ * Returns:
+ *       0 upon failure and @error is set. Otherwise non-zero indicating
+ *       the cluster node that performed the request.
+ *
+ * Side effects:
+ *       @error is set if return value is 0.
+ *       @rpcs is mutated and therefore invalid after calling.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_client_sendv (mongoc_client_t              *client,
+                      mongoc_rpc_t                 *rpcs,
+                      size_t                        rpcs_len,
+                      uint32_t                      hint,
+                      const mongoc_write_concern_t *write_concern,
+                      const mongoc_read_prefs_t    *read_prefs,
+                      bson_error_t                 *error)
+{
+   return _mongoc_client_do_sendv (client, rpcs, rpcs_len, hint,
+                                   write_concern, read_prefs, false, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_try_sendv --
+ *
+ *       INTERNAL API
+ *
+ *       Like _mongoc_client_sendv(), but never pings, probes or
+ *       reconnects before sending. Use it to pipeline a request behind
+ *       others whose replies have not been read yet, a ping written to
+ *       the same stream would read one of them as its own reply.
+ *
+ * Returns:
+ *       0 upon failure and @error is set. Otherwise non-zero indicating
+ *       the cluster node that performed the request.
+ *
+ * Side effects:
+ *       @error is set if return value is 0.
+ *       @rpcs is mutated and therefore invalid after calling.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_client_try_sendv (mongoc_client_t              *client,
+                          mongoc_rpc_t                 *rpcs,
+                          size_t                        rpcs_len,
+                          uint32_t                      hint,
+                          const mongoc_write_concern_t *write_concern,
+                          const mongoc_read_prefs_t    *read_prefs,
+                          bson_error_t                 *error)
+{
+   return _mongoc_client_do_sendv (client, rpcs, rpcs_len, hint,
+                                   write_concern, read_prefs, true, error);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -503,6 +1118,90 @@ _mongoc_client_recv (mongoc_client_t *client,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_recv_buffer_take --
+ *
+ *       Initialize @buffer for receiving replies, reusing the memory of a
+ *       buffer previously released to @client if there is one. Replies
+ *       are read into it in place and never copied, so a buffer that has
+ *       already grown to the size of a batch avoids any reallocation.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @buffer is initialized and must be given back with
+ *       _mongoc_client_recv_buffer_release().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_recv_buffer_take (mongoc_client_t *client,
+                                 mongoc_buffer_t *buffer)
+{
+   bson_return_if_fail (client);
+   bson_return_if_fail (buffer);
+
+   if (client->recv_buffers_len) {
+      client->recv_buffers_len--;
+      memcpy (buffer, &client->recv_buffers[client->recv_buffers_len],
+              sizeof *buffer);
+      _mongoc_buffer_clear (buffer, false);
+   } else {
+      _mongoc_buffer_init (buffer, NULL, 0, client->realloc_func,
+                           client->realloc_data);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_recv_buffer_release --
+ *
+ *       Give @buffer back to @client for reuse, or free it if @client
+ *       already holds enough buffers or @buffer has grown very large.
+ *       The memory of a buffer that grew for an unusually large reply
+ *       goes back to the process-wide buffer pool instead of staying
+ *       with @client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @buffer is no longer valid.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_recv_buffer_release (mongoc_client_t *client,
+                                    mongoc_buffer_t *buffer)
+{
+   bson_return_if_fail (client);
+   bson_return_if_fail (buffer);
+
+   _mongoc_buffer_clear (buffer, false);
+   _mongoc_buffer_shrink (buffer);
+
+   if (buffer->data &&
+       (buffer->realloc_func == client->realloc_func) &&
+       (buffer->realloc_data == client->realloc_data) &&
+       (buffer->datalen <= MONGOC_CLIENT_RECV_BUFFER_MAX_SIZE) &&
+       (client->recv_buffers_len < MONGOC_CLIENT_RECV_BUFFERS_MAX)) {
+      memcpy (&client->recv_buffers[client->recv_buffers_len], buffer,
+              sizeof *buffer);
+      client->recv_buffers_len++;
+      memset (buffer, 0, sizeof *buffer);
+   } else {
+      _mongoc_buffer_destroy (buffer);
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -681,14 +1380,8 @@ cleanup:
 mongoc_client_t *
 mongoc_client_new (const char *uri_string)
 {
-   const mongoc_write_concern_t *write_concern;
    mongoc_client_t *client;
-   const bson_t *read_prefs_tags;
    mongoc_uri_t *uri;
-   const bson_t *options;
-   bson_iter_t iter;
-   bool has_ssl = false;
-   bool slave_okay = false;
 
    if (!uri_string) {
       uri_string = "mongodb://127.0.0.1/";
@@ -698,6 +1391,125 @@ mongoc_client_new (const char *uri_string)
       return NULL;
    }
 
+   client = mongoc_client_new_from_uri (uri);
+   mongoc_uri_destroy (uri);
+
+   return client;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_set_ssl_opts_with_ctx --
+ *
+ *       Set the SSL options of @client along with the SSL_CTX its TLS
+ *       streams share. @ssl_ctx must have been created from @opts with
+ *       _mongoc_stream_tls_ctx_new(), and @client takes a reference on
+ *       it. This is how the clients of a pool share one context.
+ *
+ *       If @ssl_ctx is NULL, a context is created from @opts. If that
+ *       fails, each stream tries to create a context of its own, and
+ *       fails to connect with the same error.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The certificates named by @opts are loaded if @ssl_ctx is NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+#ifdef MONGOC_ENABLE_SSL
+void
+_mongoc_client_set_ssl_opts_with_ctx (mongoc_client_t        *client,
+                                      const mongoc_ssl_opt_t *opts,
+                                      SSL_CTX                *ssl_ctx)
+{
+   BSON_ASSERT (client);
+   BSON_ASSERT (opts);
+
+   memcpy (&client->ssl_opts, opts, sizeof client->ssl_opts);
+
+   bson_free (client->pem_subject);
+   client->pem_subject = NULL;
+
+   if (opts->pem_file) {
+      client->pem_subject = _mongoc_ssl_extract_subject (opts->pem_file);
+   }
+
+   if (client->ssl_ctx) {
+      SSL_CTX_free (client->ssl_ctx);
+   }
+
+   client->ssl_ctx = ssl_ctx ? _mongoc_ssl_ctx_ref (ssl_ctx)
+                             : _mongoc_stream_tls_ctx_new (&client->ssl_opts);
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_ssl_opts
+ *
+ *       set ssl opts for a client. The SSL_CTX shared by the TLS streams
+ *       of the client is created from them now, so that the certificates
+ *       are loaded and parsed once rather than on each connection.
+ *
+ * Returns:
+ *       Nothing
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+#ifdef MONGOC_ENABLE_SSL
+void
+mongoc_client_set_ssl_opts (mongoc_client_t        *client,
+                            const mongoc_ssl_opt_t *opts)
+{
+   BSON_ASSERT (client);
+   BSON_ASSERT (opts);
+
+   _mongoc_client_set_ssl_opts_with_ctx (client, opts, NULL);
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_new_from_uri --
+ *
+ *       Create a new mongoc_client_t for a mongoc_uri_t. The client
+ *       shares @uri, which is not parsed again, see mongoc_uri_copy().
+ *
+ * Returns:
+ *       A newly allocated mongoc_client_t.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_client_t *
+mongoc_client_new_from_uri (const mongoc_uri_t *uri)
+{
+   const mongoc_write_concern_t *write_concern;
+   mongoc_client_t *client;
+   const bson_t *read_prefs_tags;
+   const bson_t *options;
+   bson_iter_t iter;
+   bool has_ssl = false;
+   bool slave_okay = false;
+
+   bson_return_val_if_fail(uri, NULL);
+
    options = mongoc_uri_get_options (uri);
 
    if (bson_iter_init_find (&iter, options, "ssl") &&
@@ -713,13 +1525,20 @@ mongoc_client_new (const char *uri_string)
    }
 
    client = bson_malloc0(sizeof *client);
-   client->uri = uri;
+   client->uri = mongoc_uri_copy (uri);
    client->request_id = rand ();
    client->initiator = mongoc_client_default_stream_initiator;
    client->initiator_data = client;
+   client->realloc_func = bson_realloc_ctx;
+
+   _mongoc_array_init (&client->coalesced, sizeof (mongoc_client_coalesced_t));
+   _mongoc_query_cache_init (&client->query_cache);
+   _mongoc_array_init (&client->estimated_counts,
+                       sizeof (mongoc_client_estimated_count_t));
+   _mongoc_array_init (&client->metadata, sizeof (mongoc_client_metadata_t));
 
    write_concern = mongoc_uri_get_write_concern (uri);
-   client->write_concern = mongoc_write_concern_copy (write_concern);
+   client->write_concern = _mongoc_write_concern_share (write_concern);
 
    if (slave_okay) {
       client->read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY_PREFERRED);
@@ -732,6 +1551,15 @@ mongoc_client_new (const char *uri_string)
       mongoc_read_prefs_set_tags (client->read_prefs, read_prefs_tags);
    }
 
+   if (bson_iter_init_find_case (&iter, options, "maxstalenessms") &&
+       BSON_ITER_HOLDS_INT32 (&iter) &&
+       (bson_iter_int32 (&iter) > 0)) {
+      mongoc_read_prefs_set_max_staleness_ms (client->read_prefs,
+                                              bson_iter_int32 (&iter));
+   }
+
+   _mongoc_read_prefs_freeze (client->read_prefs);
+
    _mongoc_cluster_init (&client->cluster, client->uri, client);
 
 #ifdef MONGOC_ENABLE_SSL
@@ -749,65 +1577,39 @@ mongoc_client_new (const char *uri_string)
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_set_ssl_opts
+ * _mongoc_client_release_borrowed --
  *
- *       set ssl opts for a client
+ *       Destroy the handles lent by mongoc_client_borrow_database() and
+ *       mongoc_client_borrow_collection(), since they were built with
+ *       read preferences or a write concern that no longer apply.
  *
  * Returns:
- *       Nothing
+ *       None.
  *
  * Side effects:
- *       None.
+ *       Borrowed handles are no longer valid.
  *
  *--------------------------------------------------------------------------
  */
 
-#ifdef MONGOC_ENABLE_SSL
-void
-mongoc_client_set_ssl_opts (mongoc_client_t        *client,
-                            const mongoc_ssl_opt_t *opts)
+static void
+_mongoc_client_release_borrowed (mongoc_client_t *client)
 {
+   mongoc_list_t *iter;
 
-   BSON_ASSERT (client);
-   BSON_ASSERT (opts);
-
-   memcpy (&client->ssl_opts, opts, sizeof client->ssl_opts);
-
-   bson_free (client->pem_subject);
-   client->pem_subject = NULL;
-
-   if (opts->pem_file) {
-      client->pem_subject = _mongoc_ssl_extract_subject (opts->pem_file);
+   for (iter = client->borrowed_databases; iter; iter = iter->next) {
+      mongoc_database_destroy ((mongoc_database_t *)iter->data);
    }
-}
-#endif
-
-
-/*
- *--------------------------------------------------------------------------
- *
- * mongoc_client_new_from_uri --
- *
- *       Create a new mongoc_client_t for a mongoc_uri_t.
- *
- * Returns:
- *       A newly allocated mongoc_client_t.
- *
- * Side effects:
- *       None.
- *
- *--------------------------------------------------------------------------
- */
 
-mongoc_client_t *
-mongoc_client_new_from_uri (const mongoc_uri_t *uri)
-{
-   const char *uristr;
+   for (iter = client->borrowed_collections; iter; iter = iter->next) {
+      mongoc_collection_destroy ((mongoc_collection_t *)iter->data);
+   }
 
-   bson_return_val_if_fail(uri, NULL);
+   _mongoc_list_destroy (client->borrowed_databases);
+   _mongoc_list_destroy (client->borrowed_collections);
 
-   uristr = mongoc_uri_get_string(uri);
-   return mongoc_client_new(uristr);
+   client->borrowed_databases = NULL;
+   client->borrowed_collections = NULL;
 }
 
 
@@ -832,13 +1634,46 @@ void
 mongoc_client_destroy (mongoc_client_t *client)
 {
    if (client) {
+      _mongoc_write_future_collect_all (client);
+      _mongoc_client_flush_coalesced (client, NULL);
+      _mongoc_client_flush_dead_cursors (client);
+      _mongoc_client_release_borrowed (client);
+      _mongoc_shard_router_destroy (client->shard_router);
+
+      /*
+       * Destroy the cluster first, it may have a topology monitor thread
+       * that is still authenticating with client->pem_subject.
+       */
+      _mongoc_cluster_destroy (&client->cluster);
+
 #ifdef MONGOC_ENABLE_SSL
       bson_free (client->pem_subject);
+
+      if (client->ssl_ctx) {
+         SSL_CTX_free (client->ssl_ctx);
+      }
 #endif
 
+      while (client->free_cursors_len) {
+         client->free_cursors_len--;
+         _mongoc_cursor_dispose (
+            client->free_cursors[client->free_cursors_len]);
+      }
+
+      while (client->recv_buffers_len) {
+         client->recv_buffers_len--;
+         _mongoc_buffer_destroy (
+            &client->recv_buffers[client->recv_buffers_len]);
+      }
+
+      _mongoc_array_destroy (&client->coalesced);
+      _mongoc_query_cache_destroy (&client->query_cache);
+      _mongoc_array_destroy (&client->estimated_counts);
+      _mongoc_client_clear_metadata (client);
+      _mongoc_array_destroy (&client->metadata);
+      bson_free (client->oid_gen);
       mongoc_write_concern_destroy (client->write_concern);
       mongoc_read_prefs_destroy (client->read_prefs);
-      _mongoc_cluster_destroy (&client->cluster);
       mongoc_uri_destroy (client->uri);
       bson_free (client);
 
@@ -975,6 +1810,105 @@ mongoc_client_get_collection (mongoc_client_t *client,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_borrow_database --
+ *
+ *       Like mongoc_client_get_database(), but the handle is owned by
+ *       @client and returned again by later calls for the same @name,
+ *       so that code which needs a handle per request does not allocate
+ *       one each time.
+ *
+ *       The handle must not be modified or destroyed. It is valid until
+ *       the read preferences or write concern of @client are changed, or
+ *       @client is destroyed.
+ *
+ * Returns:
+ *       A mongoc_database_t owned by @client.
+ *
+ * Side effects:
+ *       The handle is created on first use.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_database_t *
+mongoc_client_borrow_database (mongoc_client_t *client,
+                               const char      *name)
+{
+   mongoc_database_t *database;
+   mongoc_list_t *iter;
+
+   bson_return_val_if_fail (client, NULL);
+   bson_return_val_if_fail (name, NULL);
+
+   for (iter = client->borrowed_databases; iter; iter = iter->next) {
+      database = (mongoc_database_t *)iter->data;
+
+      if (!strcmp (database->name, name)) {
+         return database;
+      }
+   }
+
+   database = mongoc_client_get_database (client, name);
+   client->borrowed_databases = _mongoc_list_prepend (
+      client->borrowed_databases, database);
+
+   return database;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_borrow_collection --
+ *
+ *       Like mongoc_client_get_collection(), but the handle is owned by
+ *       @client and returned again by later calls for the same namespace,
+ *       as with mongoc_client_borrow_database().
+ *
+ *       The handle must not be modified or destroyed. It is valid until
+ *       the read preferences or write concern of @client are changed, or
+ *       @client is destroyed.
+ *
+ * Returns:
+ *       A mongoc_collection_t owned by @client.
+ *
+ * Side effects:
+ *       The handle is created on first use.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_collection_t *
+mongoc_client_borrow_collection (mongoc_client_t *client,
+                                 const char      *db,
+                                 const char      *collection)
+{
+   mongoc_collection_t *col;
+   mongoc_list_t *iter;
+
+   bson_return_val_if_fail (client, NULL);
+   bson_return_val_if_fail (db, NULL);
+   bson_return_val_if_fail (collection, NULL);
+
+   for (iter = client->borrowed_collections; iter; iter = iter->next) {
+      col = (mongoc_collection_t *)iter->data;
+
+      if (!strcmp (col->collection, collection) && !strcmp (col->db, db)) {
+         return col;
+      }
+   }
+
+   col = mongoc_client_get_collection (client, db, collection);
+   client->borrowed_collections = _mongoc_list_prepend (
+      client->borrowed_collections, col);
+
+   return col;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1010,68 +1944,1180 @@ mongoc_client_get_gridfs (mongoc_client_t *client,
    bson_return_val_if_fail(client, NULL);
    bson_return_val_if_fail(db, NULL);
 
-   if (! prefix) {
-      prefix = "fs";
+   if (! prefix) {
+      prefix = "fs";
+   }
+
+   return _mongoc_gridfs_new(client, db, prefix, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_get_write_concern --
+ *
+ *       Fetches the default write concern for @client.
+ *
+ * Returns:
+ *       A mongoc_write_concern_t that should not be modified or freed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const mongoc_write_concern_t *
+mongoc_client_get_write_concern (const mongoc_client_t *client)
+{
+   bson_return_val_if_fail(client, NULL);
+
+   return client->write_concern;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_write_concern --
+ *
+ *       Sets the default write concern for @client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Handles borrowed from @client are destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_write_concern (mongoc_client_t              *client,
+                                 const mongoc_write_concern_t *write_concern)
+{
+   bson_return_if_fail(client);
+
+   if (write_concern != client->write_concern) {
+      _mongoc_client_release_borrowed (client);
+
+      if (client->write_concern) {
+         mongoc_write_concern_destroy(client->write_concern);
+      }
+      client->write_concern = write_concern ?
+         _mongoc_write_concern_share(write_concern) :
+         mongoc_write_concern_new();
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_get_read_prefs --
+ *
+ *       Fetch the default read preferences for @client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const mongoc_read_prefs_t *
+mongoc_client_get_read_prefs (const mongoc_client_t *client)
+{
+   bson_return_val_if_fail (client, NULL);
+
+   return client->read_prefs;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_read_prefs --
+ *
+ *       Set the default read preferences for @client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Handles borrowed from @client are destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_read_prefs (mongoc_client_t           *client,
+                              const mongoc_read_prefs_t *read_prefs)
+{
+   bson_return_if_fail (client);
+
+   if (read_prefs != client->read_prefs) {
+      _mongoc_client_release_borrowed (client);
+
+      if (client->read_prefs) {
+         mongoc_read_prefs_destroy(client->read_prefs);
+      }
+      client->read_prefs = read_prefs ?
+         _mongoc_read_prefs_share(read_prefs) :
+         mongoc_read_prefs_new(MONGOC_READ_PRIMARY);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_set_local_oids --
+ *
+ *       Give @client an ObjectId generator of its own for the "_id" of
+ *       inserted documents, or go back to the default bson_context_t,
+ *       which every thread of the process shares.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_set_local_oids (mongoc_client_t *client,
+                               bool             local_oids)
+{
+   BSON_ASSERT (client);
+
+   if (local_oids && !client->oid_gen) {
+      client->oid_gen = bson_malloc (sizeof *client->oid_gen);
+      _mongoc_oid_gen_init (client->oid_gen);
+   } else if (!local_oids && client->oid_gen) {
+      bson_free (client->oid_gen);
+      client->oid_gen = NULL;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_flush_coalesced --
+ *
+ *       Send every insert buffered by _mongoc_client_coalesce_insert(),
+ *       one write per namespace.
+ *
+ * Returns:
+ *       true if every write was sent; otherwise false and @error is set
+ *       from the first failure.
+ *
+ * Side effects:
+ *       The buffer is emptied, even on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_client_flush_coalesced (mongoc_client_t *client,
+                                bson_error_t    *error)
+{
+   mongoc_client_coalesced_t *coalesced;
+   mongoc_write_concern_t *write_concern;
+   mongoc_write_result_t result;
+   bson_error_t tmp;
+   bool ret = true;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+
+   if (!client->coalesced.len || client->in_coalesce_flush) {
+      RETURN (true);
+   }
+
+   write_concern = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (write_concern,
+                               MONGOC_WRITE_CONCERN_W_UNACKNOWLEDGED);
+
+   client->in_coalesce_flush = true;
+
+   for (i = 0; i < client->coalesced.len; i++) {
+      coalesced = &_mongoc_array_index (&client->coalesced,
+                                        mongoc_client_coalesced_t, i);
+
+      _mongoc_write_result_init (&result);
+      _mongoc_write_command_execute (&coalesced->command, client, 0,
+                                     coalesced->database,
+                                     coalesced->collection,
+                                     write_concern, 0, &result);
+
+      if (!_mongoc_write_result_complete (&result, NULL, &tmp) && ret) {
+         if (error) {
+            memcpy (error, &tmp, sizeof *error);
+         }
+         ret = false;
+      }
+
+      _mongoc_write_result_destroy (&result);
+      _mongoc_write_command_destroy (&coalesced->command);
+      bson_free (coalesced->database);
+      bson_free (coalesced->collection);
+   }
+
+   _mongoc_array_clear (&client->coalesced);
+   client->coalesced_bytes = 0;
+   client->in_coalesce_flush = false;
+
+   mongoc_write_concern_destroy (write_concern);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_coalesce_insert --
+ *
+ *       Buffer an unacknowledged insert of @document into
+ *       @database.@collection, to be sent with the other inserts buffered
+ *       for that namespace once the size or time limit set with
+ *       mongoc_client_set_write_coalescing() is reached, before any other
+ *       message is sent on @client, or by mongoc_client_flush().
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set by a flush
+ *       that failed.
+ *
+ * Side effects:
+ *       @document is copied.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_client_coalesce_insert (mongoc_client_t *client,
+                                const char      *database,
+                                const char      *collection,
+                                const bson_t    *document,
+                                bson_error_t    *error)
+{
+   mongoc_client_coalesced_t *coalesced = NULL;
+   mongoc_client_coalesced_t tmp;
+   int64_t now;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (client->coalesce_max_bytes);
+   BSON_ASSERT (database);
+   BSON_ASSERT (collection);
+   BSON_ASSERT (document);
+
+   for (i = 0; i < client->coalesced.len; i++) {
+      coalesced = &_mongoc_array_index (&client->coalesced,
+                                        mongoc_client_coalesced_t, i);
+      if (!strcmp (coalesced->collection, collection) &&
+          !strcmp (coalesced->database, database)) {
+         break;
+      }
+      coalesced = NULL;
+   }
+
+   now = bson_get_monotonic_time ();
+
+   if (!coalesced) {
+      if (!client->coalesced.len) {
+         client->coalesce_deadline = now + client->coalesce_interval_usec;
+      }
+
+      tmp.database = bson_strdup (database);
+      tmp.collection = bson_strdup (collection);
+      /* unordered, as each insert would have been applied on its own */
+      _mongoc_write_command_init_insert (&tmp.command, NULL, 0, false, true);
+      _mongoc_array_append_val (&client->coalesced, tmp);
+
+      coalesced = &_mongoc_array_index (&client->coalesced,
+                                        mongoc_client_coalesced_t,
+                                        client->coalesced.len - 1);
+   }
+
+   coalesced->command.oid_gen = client->oid_gen;
+   _mongoc_write_command_insert_append (&coalesced->command, &document, 1);
+   client->coalesced_bytes += document->len;
+
+   if ((client->coalesced_bytes >= client->coalesce_max_bytes) ||
+       (client->coalesce_interval_usec && (now >= client->coalesce_deadline))) {
+      RETURN (_mongoc_client_flush_coalesced (client, error));
+   }
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_realloc_func --
+ *
+ *       Allocate the scratch memory of the operations of @client with
+ *       @realloc_func: the buffers replies are read into and the I/O
+ *       vectors messages are gathered into. @realloc_func is called with
+ *       a NULL pointer to allocate and with a size of 0 to free, and is
+ *       passed @realloc_data. As with mongoc_buffer_t, memory allocated
+ *       with it does not go to the process-wide buffer pool.
+ *
+ *       Reply buffers are kept by @client for reuse, so after the first
+ *       operations the request path stops allocating from @realloc_func.
+ *
+ *       A NULL @realloc_func restores the default, bson_realloc_ctx().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The reply buffers held by @client for reuse are freed. Buffers
+ *       of open cursors are freed with the function they were allocated
+ *       with.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_realloc_func (mongoc_client_t   *client,
+                                bson_realloc_func  realloc_func,
+                                void              *realloc_data)
+{
+   bson_return_if_fail (client);
+
+   if (!realloc_func) {
+      realloc_func = bson_realloc_ctx;
+      realloc_data = NULL;
+   }
+
+   while (client->recv_buffers_len) {
+      client->recv_buffers_len--;
+      _mongoc_buffer_destroy (&client->recv_buffers[client->recv_buffers_len]);
+   }
+
+   client->realloc_func = realloc_func;
+   client->realloc_data = realloc_data;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_reset_after_fork --
+ *
+ *       Make @client usable in a child process created by fork() after
+ *       @client connected in the parent. The inherited connections are
+ *       dropped without sending anything on them, so the parent can go on
+ *       using its own copies, and new ones are opened lazily by the next
+ *       operation. The URI, options and known nodes of @client are kept.
+ *
+ *       This must be called in the child before @client is used, and no
+ *       operation on @client may have been in progress in another thread
+ *       of the parent when it forked.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Coalesced writes not yet flushed by the parent are discarded.
+ *       Cursors and bulk writers created in the parent fail in the child.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_reset_after_fork (mongoc_client_t *client)
+{
+   mongoc_client_coalesced_t *coalesced;
+   size_t i;
+
+   ENTRY;
+
+   bson_return_if_fail (client);
+
+   _mongoc_cluster_reset_after_fork (&client->cluster);
+
+   client->in_exhaust = false;
+
+   /*
+    * The parent sends these itself, sending them here too would apply
+    * each write twice.
+    */
+   for (i = 0; i < client->coalesced.len; i++) {
+      coalesced = &_mongoc_array_index (&client->coalesced,
+                                        mongoc_client_coalesced_t, i);
+      _mongoc_write_command_destroy (&coalesced->command);
+      bson_free (coalesced->database);
+      bson_free (coalesced->collection);
+   }
+
+   _mongoc_array_clear (&client->coalesced);
+   client->coalesced_bytes = 0;
+   client->coalesce_deadline = 0;
+
+   /*
+    * The process bytes of the ids must be those of the child.
+    */
+   if (client->oid_gen) {
+      _mongoc_oid_gen_init (client->oid_gen);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_apm_callbacks --
+ *
+ *       Have @callbacks called as each operation of @client is sent, and
+ *       as its reply comes back or the operation fails. @context is passed
+ *       along in each event. The callbacks run on the thread using
+ *       @client, in the middle of the operation, so they should be quick.
+ *
+ *       A NULL @callbacks turns monitoring off, which is the default.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_apm_callbacks (mongoc_client_t              *client,
+                                 const mongoc_apm_callbacks_t *callbacks,
+                                 void                         *context)
+{
+   bson_return_if_fail (client);
+
+   _mongoc_cluster_set_apm_callbacks (&client->cluster, callbacks, context);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_slow_op_log --
+ *
+ *       Log each operation of @client that takes @threshold_msec or
+ *       longer from the time it is handed to the cluster to the time its
+ *       reply is read, with a breakdown of where the time went. Such
+ *       operations are passed to @callback along with @context, or if
+ *       @callback is NULL, the last ones are kept for
+ *       mongoc_client_get_slow_ops().
+ *
+ *       A @threshold_msec of zero or less turns the log off, which is the
+ *       default.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_slow_op_log (mongoc_client_t         *client,
+                               int32_t                  threshold_msec,
+                               mongoc_apm_slow_op_cb_t  callback,
+                               void                    *context)
+{
+   bson_return_if_fail (client);
+
+   _mongoc_cluster_set_slow_op_log (&client->cluster,
+                                    (int64_t)threshold_msec * 1000,
+                                    callback, context);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_get_slow_ops --
+ *
+ *       Copy up to @n_ops of the slow operations kept since the last call
+ *       into @ops, oldest first. See mongoc_client_set_slow_op_log().
+ *
+ * Returns:
+ *       The number of operations copied.
+ *
+ * Side effects:
+ *       The operations copied are no longer kept.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_client_get_slow_ops (mongoc_client_t      *client,
+                            mongoc_apm_slow_op_t *ops,
+                            size_t                n_ops)
+{
+   bson_return_val_if_fail (client, 0);
+   bson_return_val_if_fail (ops || !n_ops, 0);
+
+   return _mongoc_cluster_get_slow_ops (&client->cluster, ops, n_ops);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_get_flight_records --
+ *
+ *       Copy up to @n_records of the last operations of @client into
+ *       @records, oldest first: their opcode, namespace, node, request
+ *       id, when they were started, sent and replied to, their sizes and
+ *       how they failed. Every client keeps its last 64 operations, at the
+ *       cost of a few stores each, so that whatever led up to a slow or
+ *       failed operation can be dumped once it is noticed, for instance
+ *       from the callback of mongoc_client_set_slow_op_log().
+ *
+ * Returns:
+ *       The number of records copied.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+mongoc_client_get_flight_records (mongoc_client_t            *client,
+                                  mongoc_apm_flight_record_t *records,
+                                  size_t                      n_records)
+{
+   bson_return_val_if_fail (client, 0);
+   bson_return_val_if_fail (records || !n_records, 0);
+
+   return _mongoc_cluster_get_flights (&client->cluster, records, n_records);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_write_coalescing --
+ *
+ *       Buffer the unacknowledged single-document inserts made with
+ *       collections of @client and send them as one batch per namespace
+ *       once @max_bytes of documents are buffered, or when an insert is
+ *       made @interval_msec or more after the first buffered one. There
+ *       is no timer thread: buffered inserts are otherwise sent before
+ *       the next message on @client, or by mongoc_client_flush().
+ *
+ *       A @max_bytes of 0 turns coalescing off, which is the default.
+ *       An @interval_msec of 0 leaves only the size limit.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Anything already buffered is sent.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_write_coalescing (mongoc_client_t *client,
+                                    uint32_t         max_bytes,
+                                    uint32_t         interval_msec)
+{
+   bson_return_if_fail (client);
+
+   _mongoc_client_flush_coalesced (client, NULL);
+
+   client->coalesce_max_bytes = max_bytes;
+   client->coalesce_interval_usec = (int64_t)interval_msec * 1000;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_flush --
+ *
+ *       Send the inserts buffered since mongoc_client_set_write_coalescing()
+ *       was called.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set. The
+ *       inserts are unacknowledged, so only a failure to send them is
+ *       reported.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_flush (mongoc_client_t *client,
+                     bson_error_t    *error)
+{
+   bson_return_val_if_fail (client, false);
+
+   return _mongoc_client_flush_coalesced (client, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_query_cache --
+ *
+ *       Cache the results of up to @max_entries distinct finds made with
+ *       mongoc_collection_find() on collections of @client, for
+ *       @ttl_msec each, or until evicted or invalidated if @ttl_msec is
+ *       0. Repeating a cached find then returns a cursor over the cached
+ *       documents without contacting the server.
+ *
+ *       Finds are keyed by namespace, flags, skip, limit, query, fields
+ *       and read preferences. Only results that fit in the first reply
+ *       are cached, and tailable or exhaust finds are not.
+ *
+ *       Writes made through @client drop the results cached for their
+ *       collection. Other changes must be dealt with by
+ *       mongoc_client_invalidate_query_cache() or the @ttl_msec.
+ *
+ *       A @max_entries of 0 turns the cache off, which is the default.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The least recently used results over @max_entries are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_query_cache (mongoc_client_t *client,
+                               uint32_t         max_entries,
+                               int64_t          ttl_msec)
+{
+   bson_return_if_fail (client);
+
+   _mongoc_query_cache_configure (&client->query_cache, max_entries, ttl_msec);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_estimated_count_ttl --
+ *
+ *       Reuse the result of mongoc_collection_estimated_count() on a
+ *       collection of @client for @ttl_msec instead of asking the server
+ *       again. Writes do not expire the counts early, they are only
+ *       estimates anyway.
+ *
+ *       A @ttl_msec of 0 turns caching off, which is the default.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The counts cached so far are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_estimated_count_ttl (mongoc_client_t *client,
+                                       int64_t          ttl_msec)
+{
+   bson_return_if_fail (client);
+
+   client->estimated_count_ttl_usec = BSON_MAX (0, ttl_msec) * 1000;
+   _mongoc_array_clear (&client->estimated_counts);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_direct_shard_routing --
+ *
+ *       When @client is connected to mongos, send finds, inserts,
+ *       updates and removes that target a single chunk straight to the
+ *       shard that owns it instead of through mongos. The driver reads
+ *       the shard key and chunks of each collection from the config
+ *       database, keeps them for @ttl_msec, and reads them again sooner
+ *       if a shard reports its configuration is stale.
+ *
+ *       A find or selector targets a chunk if it has an equality on
+ *       every field of a ranged shard key; inserts always do. Anything
+ *       else, tailable and exhaust cursors, hashed shard keys and
+ *       unsharded collections still go through mongos.
+ *
+ *       Routed operations carry no shard version, so a chunk that moved
+ *       since the map was read is only noticed when the map expires or
+ *       the old shard refuses the operation. This is for workloads that
+ *       can tolerate that, such as shard key point lookups on a cluster
+ *       whose balancer is off or slow.
+ *
+ *       A @ttl_msec of 0 turns routing off, which is the default.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The chunk maps read so far and the clients connected to shards
+ *       are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_direct_shard_routing (mongoc_client_t *client,
+                                        int64_t          ttl_msec)
+{
+   bson_return_if_fail (client);
+
+   _mongoc_shard_router_destroy (client->shard_router);
+   client->shard_router = NULL;
+
+   if (ttl_msec > 0) {
+      client->shard_router = _mongoc_shard_router_new (client, ttl_msec);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_set_scatter_gather --
+ *
+ *       With direct shard routing on, run each find that does not target
+ *       a single chunk on every shard that owns a chunk of the collection
+ *       at the same time, over the clients connected to the shards,
+ *       rather than through mongos. The results of the shards are merged
+ *       here: interleaved, or if the query has an $orderby on fields
+ *       sorted up or down, merged in that order.
+ *
+ *       Documents a shard returns from chunks it no longer owns are
+ *       dropped by the chunk map of the router, which has the same
+ *       staleness as routed operations. Explains, tailable and exhaust
+ *       cursors, unsharded collections and those with a hashed shard key
+ *       still go through mongos.
+ *
+ *       Direct shard routing must not be changed while such cursors
+ *       exist, they use the clients of the router.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_client_set_scatter_gather (mongoc_client_t *client,
+                                  bool             scatter_gather)
+{
+   bson_return_if_fail (client);
+
+   client->scatter_gather = !!scatter_gather;
+}
+
+
+bool
+mongoc_client_get_scatter_gather (const mongoc_client_t *client)
+{
+   bson_return_val_if_fail (client, false);
+
+   return client->scatter_gather;
+}
+
+
+/*
+ * A client connected to a shard directly, for operations routed there by
+ * mongoc_client_set_direct_shard_routing(). It connects with the SSL
+ * options and stream initiator of @client, the mongos client.
+ */
+mongoc_client_t *
+_mongoc_client_new_for_shard (mongoc_client_t *client,
+                              const char      *uri_string)
+{
+   mongoc_client_t *shard;
+   mongoc_uri_t *uri;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (uri_string);
+
+   if (!(uri = mongoc_uri_new (uri_string))) {
+      return NULL;
+   }
+
+   shard = mongoc_client_new_from_uri (uri);
+   mongoc_uri_destroy (uri);
+
+   if (client->initiator != mongoc_client_default_stream_initiator) {
+      shard->initiator = client->initiator;
+      shard->initiator_data = client->initiator_data;
+   }
+
+#ifdef MONGOC_ENABLE_SSL
+   if (client->ssl_ctx) {
+      _mongoc_client_set_ssl_opts_with_ctx (shard, &client->ssl_opts,
+                                            client->ssl_ctx);
+   }
+#endif
+
+   return shard;
+}
+
+
+/*
+ * Look up the estimated count of @ns cached on @client, if it has not
+ * expired.
+ */
+bool
+_mongoc_client_get_estimated_count (mongoc_client_t *client,
+                                    const char      *ns,
+                                    int64_t         *count)
+{
+   mongoc_client_estimated_count_t *entry;
+   int64_t now;
+   size_t i;
+
+   if (!client->estimated_count_ttl_usec) {
+      return false;
+   }
+
+   now = bson_get_monotonic_time ();
+
+   for (i = 0; i < client->estimated_counts.len; i++) {
+      entry = &_mongoc_array_index (&client->estimated_counts,
+                                    mongoc_client_estimated_count_t, i);
+
+      if ((entry->expire_at > now) && !strcmp (entry->ns, ns)) {
+         *count = entry->count;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ * Cache @count as the estimated count of @ns, in the place of an expired
+ * entry if there is one.
+ */
+void
+_mongoc_client_set_estimated_count (mongoc_client_t *client,
+                                    const char      *ns,
+                                    int64_t          count)
+{
+   mongoc_client_estimated_count_t *entry;
+   mongoc_client_estimated_count_t tmp;
+   int64_t now;
+   size_t i;
+
+   if (!client->estimated_count_ttl_usec) {
+      return;
+   }
+
+   now = bson_get_monotonic_time ();
+
+   for (i = 0; i < client->estimated_counts.len; i++) {
+      entry = &_mongoc_array_index (&client->estimated_counts,
+                                    mongoc_client_estimated_count_t, i);
+
+      if ((entry->expire_at <= now) || !strcmp (entry->ns, ns)) {
+         bson_strncpy (entry->ns, ns, sizeof entry->ns);
+         entry->count = count;
+         entry->expire_at = now + client->estimated_count_ttl_usec;
+         return;
+      }
    }
 
-   return _mongoc_gridfs_new(client, db, prefix, error);
+   bson_strncpy (tmp.ns, ns, sizeof tmp.ns);
+   tmp.count = count;
+   tmp.expire_at = now + client->estimated_count_ttl_usec;
+   _mongoc_array_append_val (&client->estimated_counts, tmp);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_get_write_concern --
+ * mongoc_client_set_metadata_cache_ttl --
  *
- *       Fetches the default write concern for @client.
+ *       Reuse the results of mongoc_database_find_collections(),
+ *       mongoc_database_get_collection_names() and
+ *       mongoc_collection_find_indexes() on @client for @ttl_msec instead
+ *       of asking the server again.
+ *
+ *       Creating, dropping or renaming collections, and creating or
+ *       dropping indexes, through @client drops the listings they change.
+ *       Collections created implicitly by a write, and changes made by
+ *       other clients, are only seen once the listing expires.
+ *
+ *       A @ttl_msec of 0 turns caching off, which is the default.
  *
  * Returns:
- *       A mongoc_write_concern_t that should not be modified or freed.
+ *       None.
  *
  * Side effects:
- *       None.
+ *       The listings cached so far are dropped.
  *
  *--------------------------------------------------------------------------
  */
 
-const mongoc_write_concern_t *
-mongoc_client_get_write_concern (const mongoc_client_t *client)
+void
+mongoc_client_set_metadata_cache_ttl (mongoc_client_t *client,
+                                      int64_t          ttl_msec)
 {
-   bson_return_val_if_fail(client, NULL);
+   bson_return_if_fail (client);
 
-   return client->write_concern;
+   client->metadata_ttl_usec = BSON_MAX (0, ttl_msec) * 1000;
+   _mongoc_client_clear_metadata (client);
+}
+
+
+static void
+_mongoc_client_metadata_destroy (mongoc_client_metadata_t *entry)
+{
+   if (entry->filter) {
+      bson_destroy (entry->filter);
+   }
+
+   bson_destroy (entry->docs);
+}
+
+
+static void
+_mongoc_client_clear_metadata (mongoc_client_t *client)
+{
+   size_t i;
+
+   for (i = 0; i < client->metadata.len; i++) {
+      _mongoc_client_metadata_destroy (
+         &_mongoc_array_index (&client->metadata, mongoc_client_metadata_t, i));
+   }
+
+   _mongoc_array_clear (&client->metadata);
+}
+
+
+/* remove the entry at @i, moving the last one in its place */
+static void
+_mongoc_client_remove_metadata (mongoc_client_t *client,
+                                size_t           i)
+{
+   mongoc_client_metadata_t *entries;
+
+   entries = (mongoc_client_metadata_t *)client->metadata.data;
+   _mongoc_client_metadata_destroy (&entries [i]);
+   entries [i] = entries [--client->metadata.len];
+}
+
+
+/* a cursor iterating the documents of @entry, without a server */
+static mongoc_cursor_t *
+_mongoc_client_metadata_cursor (mongoc_client_t          *client,
+                                mongoc_client_metadata_t *entry)
+{
+   mongoc_cursor_t *cursor;
+   bson_t query = BSON_INITIALIZER;
+
+   cursor = _mongoc_cursor_new (client, entry->ns, MONGOC_QUERY_NONE, 0, 0,
+                                0, false, &query, NULL, NULL);
+   _mongoc_cursor_array_init (cursor, NULL);
+   _mongoc_cursor_array_set_bson (cursor, entry->docs);
+
+   return cursor;
+}
+
+
+static mongoc_client_metadata_t *
+_mongoc_client_find_metadata (mongoc_client_t               *client,
+                              mongoc_client_metadata_kind_t  kind,
+                              const char                    *ns,
+                              const bson_t                  *filter)
+{
+   mongoc_client_metadata_t *entry;
+   int64_t now;
+   size_t i;
+
+   now = bson_get_monotonic_time ();
+
+   for (i = 0; i < client->metadata.len; i++) {
+      entry = &_mongoc_array_index (&client->metadata,
+                                    mongoc_client_metadata_t, i);
+
+      if (entry->kind != kind || strcmp (entry->ns, ns) ||
+          !(filter ? (entry->filter && bson_equal (entry->filter, filter))
+                   : !entry->filter)) {
+         continue;
+      }
+
+      if (entry->expire_at <= now) {
+         _mongoc_client_remove_metadata (client, i);
+         return NULL;
+      }
+
+      return entry;
+   }
+
+   return NULL;
+}
+
+
+/*
+ * A cursor over the listing of @kind for @ns and @filter cached on
+ * @client, or NULL if there is none or it has expired.
+ */
+mongoc_cursor_t *
+_mongoc_client_get_metadata (mongoc_client_t               *client,
+                             mongoc_client_metadata_kind_t  kind,
+                             const char                    *ns,
+                             const bson_t                  *filter)
+{
+   mongoc_client_metadata_t *entry;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (ns);
+
+   if (!client->metadata_ttl_usec ||
+       !(entry = _mongoc_client_find_metadata (client, kind, ns, filter))) {
+      return NULL;
+   }
+
+   return _mongoc_client_metadata_cursor (client, entry);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_set_write_concern --
+ * _mongoc_client_set_metadata --
  *
- *       Sets the default write concern for @client.
+ *       Read the listing of @kind for @ns and @filter from @cursor, a
+ *       cursor that has not been iterated, and cache it on @client.
  *
  * Returns:
- *       None.
+ *       A cursor over the same documents, which replaces @cursor. If
+ *       @cursor failed it is returned as is, to report its error.
  *
  * Side effects:
- *       None.
+ *       @cursor is iterated, and destroyed unless it is returned.
  *
  *--------------------------------------------------------------------------
  */
 
+mongoc_cursor_t *
+_mongoc_client_set_metadata (mongoc_client_t               *client,
+                             mongoc_client_metadata_kind_t  kind,
+                             const char                    *ns,
+                             const bson_t                  *filter,
+                             mongoc_cursor_t               *cursor)
+{
+   mongoc_client_metadata_t *entry;
+   mongoc_client_metadata_t tmp;
+   const bson_t *doc;
+   const char *key;
+   char str [16];
+   uint32_t i = 0;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (ns);
+
+   if (!client->metadata_ttl_usec || !cursor ||
+       strlen (ns) >= sizeof tmp.ns) {
+      return cursor;
+   }
+
+   memset (&tmp, 0, sizeof tmp);
+   tmp.docs = bson_new ();
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      bson_uint32_to_string (i++, &key, str, sizeof str);
+      bson_append_document (tmp.docs, key, -1, doc);
+   }
+
+   if (mongoc_cursor_error (cursor, NULL)) {
+      bson_destroy (tmp.docs);
+      return cursor;
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   if ((entry = _mongoc_client_find_metadata (client, kind, ns, filter))) {
+      _mongoc_client_remove_metadata (
+         client, entry - (mongoc_client_metadata_t *)client->metadata.data);
+   }
+
+   tmp.kind = kind;
+   bson_strncpy (tmp.ns, ns, sizeof tmp.ns);
+   tmp.filter = filter ? bson_copy (filter) : NULL;
+   tmp.expire_at = bson_get_monotonic_time () + client->metadata_ttl_usec;
+   _mongoc_array_append_val (&client->metadata, tmp);
+
+   return _mongoc_client_metadata_cursor (
+      client, &_mongoc_array_index (&client->metadata,
+                                    mongoc_client_metadata_t,
+                                    client->metadata.len - 1));
+}
+
+
+/*
+ * Drop the listings cached on @client that creating, dropping or renaming
+ * @collection of @db can change: that of the collections of @db and that
+ * of the indexes of @collection, or of every collection of @db if
+ * @collection is NULL.
+ */
 void
-mongoc_client_set_write_concern (mongoc_client_t              *client,
-                                 const mongoc_write_concern_t *write_concern)
+_mongoc_client_invalidate_metadata (mongoc_client_t *client,
+                                    const char      *db,
+                                    const char      *collection)
 {
-   bson_return_if_fail(client);
+   mongoc_client_metadata_t *entry;
+   size_t db_len;
+   size_t i = 0;
 
-   if (write_concern != client->write_concern) {
-      if (client->write_concern) {
-         mongoc_write_concern_destroy(client->write_concern);
+   BSON_ASSERT (client);
+   BSON_ASSERT (db);
+
+   db_len = strlen (db);
+
+   while (i < client->metadata.len) {
+      entry = &_mongoc_array_index (&client->metadata,
+                                    mongoc_client_metadata_t, i);
+
+      if (entry->kind == MONGOC_CLIENT_METADATA_COLLECTIONS
+          ? !strcmp (entry->ns, db)
+          : (!strncmp (entry->ns, db, db_len) &&
+             entry->ns [db_len] == '.' &&
+             (!collection || !strcmp (entry->ns + db_len + 1, collection)))) {
+         _mongoc_client_remove_metadata (client, i);
+      } else {
+         i++;
       }
-      client->write_concern = write_concern ?
-         mongoc_write_concern_copy(write_concern) :
-         mongoc_write_concern_new();
    }
 }
 
@@ -1079,9 +3125,11 @@ mongoc_client_set_write_concern (mongoc_client_t              *client,
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_get_read_prefs --
+ * mongoc_client_invalidate_query_cache --
  *
- *       Fetch the default read preferences for @client.
+ *       Drop the results cached by mongoc_client_set_query_cache() for
+ *       @collection in @db, for every collection in @db if @collection
+ *       is NULL, or all of them if @db is NULL too.
  *
  * Returns:
  *       None.
@@ -1092,45 +3140,50 @@ mongoc_client_set_write_concern (mongoc_client_t              *client,
  *--------------------------------------------------------------------------
  */
 
-const mongoc_read_prefs_t *
-mongoc_client_get_read_prefs (const mongoc_client_t *client)
+void
+mongoc_client_invalidate_query_cache (mongoc_client_t *client,
+                                      const char      *db,
+                                      const char      *collection)
 {
-   bson_return_val_if_fail (client, NULL);
+   bson_return_if_fail (client);
 
-   return client->read_prefs;
+   _mongoc_query_cache_invalidate (&client->query_cache, db, collection);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_client_set_read_prefs --
+ * mongoc_client_set_query_cache_watcher --
  *
- *       Set the default read preferences for @client.
+ *       Have the query cache of @client drop the results for namespaces
+ *       that @watcher sees written in the oplog, by any client, before
+ *       each lookup. Results can then be cached for long and still
+ *       reflect writes made elsewhere once the primary has logged them.
+ *
+ *       @watcher may be shared by many clients and must outlive them, or
+ *       be unset with NULL first.
  *
  * Returns:
  *       None.
  *
  * Side effects:
- *       None.
+ *       The results already cached are dropped.
  *
  *--------------------------------------------------------------------------
  */
 
 void
-mongoc_client_set_read_prefs (mongoc_client_t           *client,
-                              const mongoc_read_prefs_t *read_prefs)
+mongoc_client_set_query_cache_watcher (mongoc_client_t        *client,
+                                       mongoc_oplog_watcher_t *watcher)
 {
    bson_return_if_fail (client);
 
-   if (read_prefs != client->read_prefs) {
-      if (client->read_prefs) {
-         mongoc_read_prefs_destroy(client->read_prefs);
-      }
-      client->read_prefs = read_prefs ?
-         mongoc_read_prefs_copy(read_prefs) :
-         mongoc_read_prefs_new(MONGOC_READ_PRIMARY);
-   }
+   _mongoc_query_cache_invalidate (&client->query_cache, NULL, NULL);
+
+   client->cache_watcher = watcher;
+   client->cache_watcher_seq = watcher ? _mongoc_oplog_watcher_seq (watcher)
+                                       : 0;
 }
 
 
@@ -1269,6 +3322,84 @@ mongoc_client_command_simple (mongoc_client_t           *client,
    return ret;
 }
 
+
+/**
+ * mongoc_client_commands_pipelined:
+ * @client: A mongoc_client_t.
+ * @db_name: The namespace, such as "admin".
+ * @commands: An array of @n_commands commands to execute.
+ * @n_commands: The number of commands, at least one.
+ * @read_prefs: The read preferences or NULL.
+ * @replies: A location for @n_commands reply documents or NULL.
+ * @errors: A location for @n_commands errors or NULL.
+ *
+ * Runs each of @commands as mongoc_client_command_simple() would, but all of
+ * them are written to the same node in a single write before any reply is
+ * read, so the batch costs about one round trip instead of one per command.
+ * If one of the commands must run on the primary, the whole batch goes there.
+ *
+ * Each element of @replies is always set, either to the resulting document
+ * or an empty bson document upon failure, and must be released with
+ * bson_destroy(). Each element of @errors is set for a command that failed.
+ *
+ * Returns: true if every command executed and resulted in success. Otherwise
+ *   false, and the failed commands have their element of @errors set.
+ */
+bool
+mongoc_client_commands_pipelined (mongoc_client_t           *client,
+                                  const char                *db_name,
+                                  const bson_t             **commands,
+                                  uint32_t                   n_commands,
+                                  const mongoc_read_prefs_t *read_prefs,
+                                  bson_t                    *replies,
+                                  bson_error_t              *errors)
+{
+   mongoc_cursor_t **cursors;
+   const bson_t *doc;
+   uint32_t i;
+   bool ret = true;
+   bool r;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (db_name);
+   BSON_ASSERT (commands);
+   BSON_ASSERT (n_commands);
+
+   cursors = bson_malloc (n_commands * sizeof *cursors);
+
+   for (i = 0; i < n_commands; i++) {
+      cursors[i] = mongoc_client_command (client, db_name, MONGOC_QUERY_NONE,
+                                          0, 1, 0, commands[i], NULL,
+                                          read_prefs);
+   }
+
+   /* failures are reported by each cursor */
+   _mongoc_cursor_query_many (cursors, n_commands, NULL);
+
+   for (i = 0; i < n_commands; i++) {
+      r = mongoc_cursor_next (cursors[i], &doc);
+
+      if (replies) {
+         if (r) {
+            bson_copy_to (doc, &replies[i]);
+         } else {
+            bson_init (&replies[i]);
+         }
+      }
+
+      if (!r) {
+         mongoc_cursor_error (cursors[i], errors ? &errors[i] : NULL);
+         ret = false;
+      }
+
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   bson_free (cursors);
+
+   return ret;
+}
+
 void
 mongoc_client_kill_cursor (mongoc_client_t *client,
                            int64_t          cursor_id)
@@ -1294,6 +3425,128 @@ mongoc_client_kill_cursor (mongoc_client_t *client,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_kill_cursor_deferred --
+ *
+ *       Kills @cursor_id, opened on the node specified by @hint, without
+ *       blocking on a write of its own. The id goes out in a batched
+ *       OP_KILL_CURSORS ahead of the next request to that node, or when
+ *       the client is pushed back to its pool or destroyed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Queued cursors are flushed if there are too many.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_kill_cursor_deferred (mongoc_client_t *client,
+                                     uint32_t         hint,
+                                     int64_t          cursor_id)
+{
+   ENTRY;
+
+   bson_return_if_fail (client);
+   bson_return_if_fail (cursor_id);
+
+   if (_mongoc_cluster_kill_cursor_deferred (&client->cluster, hint,
+                                             cursor_id)) {
+      _mongoc_client_flush_dead_cursors (client);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_flush_dead_cursors --
+ *
+ *       Sends the cursor ids queued by _mongoc_client_kill_cursor_deferred()
+ *       right away. Nothing is sent while a cursor is in exhaust; the ids
+ *       wait for the next flush.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_flush_dead_cursors (mongoc_client_t *client)
+{
+   ENTRY;
+
+   bson_return_if_fail (client);
+
+   if (client->in_exhaust || !client->cluster.dead_cursors.len) {
+      EXIT;
+   }
+
+   if (client->prefetch_cursor) {
+      _mongoc_cursor_prefetch_recv (client->prefetch_cursor);
+   }
+
+   if (client->bulk_writer) {
+      _mongoc_bulk_writer_recv (client->bulk_writer);
+   }
+
+   _mongoc_write_future_collect_all (client);
+   _mongoc_cluster_flush_dead_cursors (&client->cluster);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_client_abandon_cursors --
+ *
+ *       Release the server cursors of the cursors of @client that were not
+ *       destroyed, and send the kills of those and of the destroyed ones
+ *       in one OP_KILL_CURSORS per node. Used when @client goes back to
+ *       its pool, since whichever thread pops it next knows nothing of
+ *       them, and the server would otherwise keep them until they time
+ *       out.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Such cursors fail from then on, see _mongoc_cursor_abandon().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_client_abandon_cursors (mongoc_client_t *client)
+{
+   mongoc_cursor_t *cursor;
+
+   ENTRY;
+
+   bson_return_if_fail (client);
+
+   for (cursor = client->live_cursors; cursor; cursor = cursor->live_next) {
+      _mongoc_cursor_abandon (cursor);
+   }
+
+   _mongoc_client_flush_dead_cursors (client);
+
+   EXIT;
+}
+
+
 char **
 mongoc_client_get_database_names (mongoc_client_t *client,
                                   bson_error_t    *error)
@@ -23,6 +23,7 @@
 
 #include <bson.h>
 
+#include "mongoc-apm.h"
 #include "mongoc-collection.h"
 #include "mongoc-config.h"
 #include "mongoc-cursor.h"
@@ -113,7 +114,19 @@ bool                           mongoc_client_command_simple       (mongoc_client
                                                                    const mongoc_read_prefs_t    *read_prefs,
                                                                    bson_t                       *reply,
                                                                    bson_error_t                 *error);
+bool                           mongoc_client_commands_pipelined   (mongoc_client_t              *client,
+                                                                   const char                   *db_name,
+                                                                   const bson_t                **commands,
+                                                                   uint32_t                      n_commands,
+                                                                   const mongoc_read_prefs_t    *read_prefs,
+                                                                   bson_t                       *replies,
+                                                                   bson_error_t                 *errors);
 void                           mongoc_client_destroy              (mongoc_client_t              *client);
+mongoc_database_t             *mongoc_client_borrow_database      (mongoc_client_t              *client,
+                                                                   const char                   *name);
+mongoc_collection_t           *mongoc_client_borrow_collection    (mongoc_client_t              *client,
+                                                                   const char                   *db,
+                                                                   const char                   *collection);
 mongoc_database_t             *mongoc_client_get_database         (mongoc_client_t              *client,
                                                                    const char                   *name);
 mongoc_gridfs_t               *mongoc_client_get_gridfs           (mongoc_client_t              *client,
@@ -139,6 +152,43 @@ void                           mongoc_client_set_write_concern    (mongoc_client
 const mongoc_read_prefs_t     *mongoc_client_get_read_prefs       (const mongoc_client_t        *client);
 void                           mongoc_client_set_read_prefs       (mongoc_client_t              *client,
                                                                    const mongoc_read_prefs_t    *read_prefs);
+void                           mongoc_client_set_write_coalescing (mongoc_client_t              *client,
+                                                                   uint32_t                      max_bytes,
+                                                                   uint32_t                      interval_msec);
+bool                           mongoc_client_flush                (mongoc_client_t              *client,
+                                                                   bson_error_t                 *error);
+void                           mongoc_client_set_query_cache      (mongoc_client_t              *client,
+                                                                   uint32_t                      max_entries,
+                                                                   int64_t                       ttl_msec);
+void                           mongoc_client_invalidate_query_cache (mongoc_client_t            *client,
+                                                                     const char                 *db,
+                                                                     const char                 *collection);
+void                           mongoc_client_set_estimated_count_ttl (mongoc_client_t           *client,
+                                                                      int64_t                    ttl_msec);
+void                           mongoc_client_set_metadata_cache_ttl (mongoc_client_t            *client,
+                                                                     int64_t                     ttl_msec);
+void                           mongoc_client_set_direct_shard_routing (mongoc_client_t          *client,
+                                                                       int64_t                   ttl_msec);
+void                           mongoc_client_set_scatter_gather   (mongoc_client_t              *client,
+                                                                   bool                          scatter_gather);
+bool                           mongoc_client_get_scatter_gather   (const mongoc_client_t        *client);
+void                           mongoc_client_set_realloc_func     (mongoc_client_t              *client,
+                                                                   bson_realloc_func             realloc_func,
+                                                                   void                         *realloc_data);
+void                           mongoc_client_reset_after_fork     (mongoc_client_t              *client);
+void                           mongoc_client_set_apm_callbacks    (mongoc_client_t              *client,
+                                                                   const mongoc_apm_callbacks_t *callbacks,
+                                                                   void                         *context);
+void                           mongoc_client_set_slow_op_log      (mongoc_client_t              *client,
+                                                                   int32_t                       threshold_msec,
+                                                                   mongoc_apm_slow_op_cb_t       callback,
+                                                                   void                         *context);
+size_t                         mongoc_client_get_slow_ops         (mongoc_client_t              *client,
+                                                                   mongoc_apm_slow_op_t         *ops,
+                                                                   size_t                        n_ops);
+size_t                         mongoc_client_get_flight_records   (mongoc_client_t              *client,
+                                                                   mongoc_apm_flight_record_t   *records,
+                                                                   size_t                        n_records);
 #ifdef MONGOC_ENABLE_SSL
 void                           mongoc_client_set_ssl_opts         (mongoc_client_t              *client,
                                                                    const mongoc_ssl_opt_t       *opts);
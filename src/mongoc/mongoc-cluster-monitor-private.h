@@ -0,0 +1,111 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CLUSTER_MONITOR_PRIVATE_H
+#define MONGOC_CLUSTER_MONITOR_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-cluster-private.h"
+#include "mongoc-thread-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The monitor owns a private "standby" cluster that it keeps connected and
+ * refreshes with isMaster and ping every heartbeatFrequencyMS. Operation
+ * threads never rescan the topology themselves; they copy ping times and
+ * primary flags out of the standby, or swap nodes with it when their own
+ * connections have gone bad.
+ *
+ * The standby is only touched by other threads while it is parked in
+ * @standby. While the monitor is refreshing it, @standby is NULL.
+ *
+ * A monitor that is @shared, such as the one of a client pool, is
+ * referenced by many clusters. They copy the standby nodes rather than
+ * swapping with them, and open their own streams.
+ *
+ * The monitor thread is the only one that rescans, however many clusters
+ * ask it to. After a refresh that left the standby unusable, wakeups are
+ * not honored again before @failures worth of exponential backoff with
+ * jitter has elapsed, so that the members still up are not flooded with
+ * connections while a node is down.
+ *
+ * The monitor thread also delivers the topology callbacks. @known and
+ * @primary are the nodes it had a connection to after the last refresh,
+ * and only it touches them. The pool clients created and destroyed since
+ * the callbacks were last delivered are counted in @clients_created and
+ * @clients_destroyed.
+ */
+typedef struct _mongoc_cluster_monitor_t
+{
+   mongoc_mutex_t     mutex;
+   mongoc_cond_t      cond;
+   mongoc_cond_t      published;
+   mongoc_thread_t    thread;
+   mongoc_cluster_t  *standby;
+   int64_t            interval_msec;
+   uint32_t           generation;
+   bson_error_t       error;
+   uint32_t           failures;
+   uint32_t           rand;
+   int                ref_count;
+   bool               shared;
+   bool               shutdown;
+   bool               wakeup;
+   mongoc_apm_topology_callbacks_t callbacks;
+   void              *callbacks_context;
+   mongoc_array_t     known;
+   mongoc_host_list_t primary;
+   bool               has_primary;
+   uint32_t           n_clients;
+   uint32_t           clients_created;
+   uint32_t           clients_destroyed;
+} mongoc_cluster_monitor_t;
+
+
+mongoc_cluster_monitor_t *_mongoc_cluster_monitor_new     (const mongoc_uri_t       *uri,
+                                                           mongoc_client_t          *client,
+                                                           int64_t                   interval_msec);
+mongoc_cluster_monitor_t *_mongoc_cluster_monitor_ref     (mongoc_cluster_monitor_t *monitor);
+void                      _mongoc_cluster_monitor_unref   (mongoc_cluster_monitor_t *monitor);
+void                      _mongoc_cluster_monitor_wakeup  (mongoc_cluster_monitor_t *monitor);
+void                      _mongoc_cluster_monitor_reset_after_fork (mongoc_cluster_monitor_t *monitor,
+                                                                    const mongoc_uri_t       *uri,
+                                                                    mongoc_client_t          *client);
+void                      _mongoc_cluster_monitor_sync    (mongoc_cluster_monitor_t *monitor,
+                                                           mongoc_cluster_t         *cluster);
+bool                      _mongoc_cluster_monitor_adopt   (mongoc_cluster_monitor_t *monitor,
+                                                           mongoc_cluster_t         *cluster,
+                                                           int64_t                   timeout_msec,
+                                                           bson_error_t             *error);
+void                      _mongoc_cluster_monitor_set_callbacks (mongoc_cluster_monitor_t              *monitor,
+                                                                 const mongoc_apm_topology_callbacks_t *callbacks,
+                                                                 void                                  *context);
+void                      _mongoc_cluster_monitor_client_added   (mongoc_cluster_monitor_t *monitor);
+void                      _mongoc_cluster_monitor_client_removed (mongoc_cluster_monitor_t *monitor);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_CLUSTER_MONITOR_PRIVATE_H */
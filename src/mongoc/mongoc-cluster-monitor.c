@@ -0,0 +1,875 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-cluster-monitor-private.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "monitor"
+
+
+#ifdef _WIN32
+# define strcasecmp _stricmp
+#endif
+
+
+#ifndef MIN_REFRESH_BACKOFF_MSEC
+/*
+ * Wait at least this long before rescanning again after a failed refresh.
+ * The delay doubles with each consecutive failure up to the heartbeat
+ * interval.
+ */
+#define MIN_REFRESH_BACKOFF_MSEC 100
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_backoff --
+ *
+ *       Compute how long the monitor should ignore wakeups after its last
+ *       refresh. Nothing is held back once the standby is healthy again.
+ *       Otherwise the delay grows exponentially with the number of
+ *       consecutive failures, capped at the heartbeat interval, and is
+ *       drawn at random from its upper half so that the monitors of
+ *       several pools or processes do not rescan in lockstep.
+ *
+ *       @monitor->mutex must be held.
+ *
+ * Returns:
+ *       The delay in microseconds.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int64_t
+_mongoc_cluster_monitor_backoff (mongoc_cluster_monitor_t *monitor)
+{
+   int64_t delay_msec;
+   uint32_t x;
+
+   if (!monitor->failures) {
+      return 0;
+   }
+
+   delay_msec = MIN_REFRESH_BACKOFF_MSEC;
+   delay_msec <<= BSON_MIN (monitor->failures - 1, 16);
+   delay_msec = BSON_MIN (delay_msec, monitor->interval_msec);
+
+   /* xorshift32 */
+   x = monitor->rand;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   monitor->rand = x;
+
+   delay_msec = (delay_msec / 2) + (x % ((delay_msec / 2) + 1));
+
+   return delay_msec * 1000L;
+}
+
+
+/*
+ * A node the monitor got a connection to that it did not have at the
+ * previous refresh.
+ */
+typedef struct
+{
+   mongoc_host_list_t host;
+   bool               is_primary;
+} mongoc_cluster_monitor_node_t;
+
+
+/*
+ * What a refresh changed, for the topology callbacks.
+ */
+typedef struct
+{
+   mongoc_array_t     discovered;
+   bool               primary_changed;
+   bool               had_primary;
+   mongoc_host_list_t old_primary;
+   bool               has_primary;
+   mongoc_host_list_t new_primary;
+} mongoc_cluster_monitor_changes_t;
+
+
+/*
+ * Compare the nodes of @standby, which the monitor thread has checked
+ * out, with those it was connected to after the previous refresh, and
+ * remember them for the next one.
+ */
+static void
+_mongoc_cluster_monitor_observe (mongoc_cluster_monitor_t         *monitor,
+                                 const mongoc_cluster_t           *standby,
+                                 mongoc_cluster_monitor_changes_t *changes)
+{
+   mongoc_cluster_monitor_node_t found;
+   const mongoc_cluster_node_t *node;
+   mongoc_host_list_t *known_host;
+   mongoc_host_list_t primary;
+   mongoc_host_list_t host;
+   mongoc_array_t known;
+   bool has_primary = false;
+   uint32_t i;
+   size_t j;
+
+   _mongoc_array_clear (&changes->discovered);
+   changes->primary_changed = false;
+
+   memset (&primary, 0, sizeof primary);
+   _mongoc_array_init (&known, sizeof (mongoc_host_list_t));
+
+   for (i = 0; i < standby->nodes_len; i++) {
+      node = &standby->nodes[i];
+
+      if (!node->stream) {
+         continue;
+      }
+
+      host = node->host;
+      host.next = NULL;
+
+      if (node->primary && !has_primary) {
+         primary = host;
+         has_primary = true;
+      }
+
+      for (j = 0; j < monitor->known.len; j++) {
+         known_host = &_mongoc_array_index (&monitor->known,
+                                            mongoc_host_list_t, j);
+
+         if (!strcasecmp (known_host->host_and_port, host.host_and_port)) {
+            break;
+         }
+      }
+
+      if (j == monitor->known.len) {
+         found.host = host;
+         found.is_primary = node->primary;
+         _mongoc_array_append_val (&changes->discovered, found);
+      }
+
+      _mongoc_array_append_val (&known, host);
+   }
+
+   _mongoc_array_destroy (&monitor->known);
+   memcpy (&monitor->known, &known, sizeof known);
+
+   if ((has_primary != monitor->has_primary) ||
+       (has_primary && strcasecmp (primary.host_and_port,
+                                   monitor->primary.host_and_port))) {
+      changes->primary_changed = true;
+      changes->had_primary = monitor->has_primary;
+      changes->old_primary = monitor->primary;
+      changes->has_primary = has_primary;
+      changes->new_primary = primary;
+
+      monitor->has_primary = has_primary;
+      monitor->primary = primary;
+   }
+}
+
+
+static void
+_mongoc_cluster_monitor_deliver (const mongoc_apm_topology_callbacks_t  *callbacks,
+                                 void                                   *context,
+                                 const mongoc_cluster_monitor_changes_t *changes)
+{
+   mongoc_apm_node_discovered_t discovered;
+   mongoc_apm_primary_changed_t changed;
+   mongoc_cluster_monitor_node_t *node;
+   size_t i;
+
+   if (callbacks->node_discovered) {
+      for (i = 0; i < changes->discovered.len; i++) {
+         node = &_mongoc_array_index (&changes->discovered,
+                                      mongoc_cluster_monitor_node_t, i);
+
+         memset (&discovered, 0, sizeof discovered);
+         discovered.host = &node->host;
+         discovered.is_primary = node->is_primary;
+         discovered.context = context;
+         callbacks->node_discovered (&discovered);
+      }
+   }
+
+   if (callbacks->primary_changed && changes->primary_changed) {
+      memset (&changed, 0, sizeof changed);
+      changed.old_primary = changes->had_primary ? &changes->old_primary
+                                                 : NULL;
+      changed.new_primary = changes->has_primary ? &changes->new_primary
+                                                 : NULL;
+      changed.context = context;
+      callbacks->primary_changed (&changed);
+   }
+}
+
+
+/*
+ * Deliver the events of the pool clients created and destroyed since the
+ * last time. @monitor->mutex is held, and released while the callbacks
+ * run.
+ */
+static void
+_mongoc_cluster_monitor_deliver_clients (mongoc_cluster_monitor_t *monitor)
+{
+   mongoc_apm_topology_callbacks_t callbacks;
+   mongoc_apm_pool_client_event_t event;
+   uint32_t created;
+   uint32_t destroyed;
+
+   created = monitor->clients_created;
+   destroyed = monitor->clients_destroyed;
+   monitor->clients_created = 0;
+   monitor->clients_destroyed = 0;
+   memcpy (&callbacks, &monitor->callbacks, sizeof callbacks);
+
+   memset (&event, 0, sizeof event);
+   event.n_clients = monitor->n_clients;
+   event.context = monitor->callbacks_context;
+
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   for (; callbacks.pool_client_created && created; created--) {
+      callbacks.pool_client_created (&event);
+   }
+
+   for (; callbacks.pool_client_destroyed && destroyed; destroyed--) {
+      callbacks.pool_client_destroyed (&event);
+   }
+
+   mongoc_mutex_lock (&monitor->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_run --
+ *
+ *       Thread entry point for the topology monitor. The standby cluster
+ *       is checked out, refreshed without holding the lock, and then
+ *       published again. Between refreshes we sleep for the heartbeat
+ *       interval or until an operation thread asks for an early refresh,
+ *       which is deferred while backing off from failed refreshes.
+ *
+ * Returns:
+ *       NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+_mongoc_cluster_monitor_run (void *data)
+{
+   mongoc_cluster_monitor_t *monitor = data;
+   mongoc_apm_topology_callbacks_t callbacks;
+   mongoc_cluster_monitor_changes_t changes;
+   mongoc_cluster_t *standby;
+   bson_error_t error;
+   void *context;
+   int64_t refresh_at;
+   int64_t wakeup_at;
+   int64_t now;
+
+   BSON_ASSERT (monitor);
+
+   _mongoc_array_init (&changes.discovered,
+                       sizeof (mongoc_cluster_monitor_node_t));
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   while (!monitor->shutdown) {
+      standby = monitor->standby;
+      monitor->standby = NULL;
+      monitor->wakeup = false;
+      mongoc_mutex_unlock (&monitor->mutex);
+
+      memset (&error, 0, sizeof error);
+
+      if ((standby->state != MONGOC_CLUSTER_STATE_HEALTHY) ||
+          !_mongoc_cluster_check_nodes (standby, &error)) {
+         memset (&error, 0, sizeof error);
+         if (!_mongoc_cluster_reconnect (standby, &error)) {
+            MONGOC_DEBUG ("Topology refresh failed: %s", error.message);
+         }
+      }
+
+      _mongoc_cluster_monitor_observe (monitor, standby, &changes);
+
+      mongoc_mutex_lock (&monitor->mutex);
+      monitor->standby = standby;
+      monitor->generation++;
+      memcpy (&monitor->error, &error, sizeof error);
+      mongoc_cond_broadcast (&monitor->published);
+
+      if (standby->state & MONGOC_CLUSTER_STATE_HEALTHY) {
+         monitor->failures = 0;
+      } else {
+         monitor->failures++;
+      }
+
+      /* operations go on with the new topology while the callbacks run */
+      if (changes.discovered.len || changes.primary_changed) {
+         memcpy (&callbacks, &monitor->callbacks, sizeof callbacks);
+         context = monitor->callbacks_context;
+         mongoc_mutex_unlock (&monitor->mutex);
+         _mongoc_cluster_monitor_deliver (&callbacks, context, &changes);
+         mongoc_mutex_lock (&monitor->mutex);
+      }
+
+      /*
+       * Each cluster that finds its nodes gone asks for a rescan. Serve
+       * them all with one refresh per backoff period rather than one each.
+       */
+      now = bson_get_monotonic_time ();
+      refresh_at = now + (monitor->interval_msec * 1000L);
+      wakeup_at = now + _mongoc_cluster_monitor_backoff (monitor);
+
+      while (!monitor->shutdown && (now < refresh_at) &&
+             !(monitor->wakeup && (now >= wakeup_at))) {
+         if (monitor->clients_created || monitor->clients_destroyed) {
+            _mongoc_cluster_monitor_deliver_clients (monitor);
+         } else {
+            mongoc_cond_timedwait (&monitor->cond, &monitor->mutex,
+                                   BSON_MAX (1, ((monitor->wakeup ? wakeup_at
+                                                                  : refresh_at)
+                                                 - now) / 1000L));
+         }
+         now = bson_get_monotonic_time ();
+      }
+   }
+
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   _mongoc_array_destroy (&changes.discovered);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_new --
+ *
+ *       Create a new topology monitor for @uri and start its thread.
+ *       Connections are created through @client so that the stream
+ *       initiator and SSL options of the client are honored.
+ *
+ * Returns:
+ *       A newly allocated mongoc_cluster_monitor_t holding one reference
+ *       that should be dropped with _mongoc_cluster_monitor_unref().
+ *
+ * Side effects:
+ *       A thread is spawned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cluster_monitor_t *
+_mongoc_cluster_monitor_new (const mongoc_uri_t *uri,
+                             mongoc_client_t    *client,
+                             int64_t             interval_msec)
+{
+   mongoc_cluster_monitor_t *monitor;
+
+   ENTRY;
+
+   BSON_ASSERT (uri);
+   BSON_ASSERT (interval_msec > 0);
+
+   monitor = bson_malloc0 (sizeof *monitor);
+   monitor->ref_count = 1;
+   monitor->interval_msec = interval_msec;
+   monitor->rand = (uint32_t)bson_get_monotonic_time () | 1;
+   monitor->standby = bson_malloc0 (sizeof *monitor->standby);
+   _mongoc_array_init (&monitor->known, sizeof (mongoc_host_list_t));
+
+   _mongoc_cluster_init (monitor->standby, uri, client);
+   monitor->standby->heartbeat_frequency_msec = 0;
+
+   mongoc_mutex_init (&monitor->mutex);
+   mongoc_cond_init (&monitor->cond);
+   mongoc_cond_init (&monitor->published);
+
+   mongoc_thread_create (&monitor->thread, _mongoc_cluster_monitor_run,
+                         monitor);
+
+   RETURN (monitor);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_reset_after_fork --
+ *
+ *       Bring @monitor back to life in a child process, where its thread
+ *       no longer exists. The standby cluster drops the connections it
+ *       inherited and keeps its nodes, then a new thread is started to
+ *       refresh it. If the old thread had the standby checked out at the
+ *       time of the fork, a new one is created from @uri and @client.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A thread is spawned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_monitor_reset_after_fork (mongoc_cluster_monitor_t *monitor,
+                                          const mongoc_uri_t       *uri,
+                                          mongoc_client_t          *client)
+{
+   ENTRY;
+
+   BSON_ASSERT (monitor);
+   BSON_ASSERT (uri);
+
+   /*
+    * The old thread may have held the lock, and nobody waits on the
+    * conditions in a process that has a single thread.
+    */
+   mongoc_mutex_init (&monitor->mutex);
+   mongoc_cond_init (&monitor->cond);
+   mongoc_cond_init (&monitor->published);
+
+   if (monitor->standby) {
+      _mongoc_cluster_reset_after_fork (monitor->standby);
+   } else {
+      monitor->standby = bson_malloc0 (sizeof *monitor->standby);
+      _mongoc_cluster_init (monitor->standby, uri, client);
+      monitor->standby->heartbeat_frequency_msec = 0;
+   }
+
+   monitor->shutdown = false;
+   monitor->wakeup = false;
+   monitor->failures = 0;
+   monitor->rand = (uint32_t)bson_get_monotonic_time () | 1;
+
+   mongoc_thread_create (&monitor->thread, _mongoc_cluster_monitor_run,
+                         monitor);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_ref --
+ *
+ *       Take a reference on @monitor, so that it can be shared by the
+ *       clusters of several clients.
+ *
+ * Returns:
+ *       @monitor.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cluster_monitor_t *
+_mongoc_cluster_monitor_ref (mongoc_cluster_monitor_t *monitor)
+{
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   BSON_ASSERT (monitor->ref_count > 0);
+   monitor->ref_count++;
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   return monitor;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_unref --
+ *
+ *       Drop a reference on @monitor. When the last reference is dropped
+ *       the monitor thread is stopped and all resources are released,
+ *       including the connections held by the standby cluster.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Blocks until any refresh in progress has completed if this was
+ *       the last reference.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_monitor_unref (mongoc_cluster_monitor_t *monitor)
+{
+   ENTRY;
+
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   BSON_ASSERT (monitor->ref_count > 0);
+
+   if (--monitor->ref_count) {
+      mongoc_mutex_unlock (&monitor->mutex);
+      EXIT;
+   }
+
+   monitor->shutdown = true;
+   mongoc_cond_signal (&monitor->cond);
+   mongoc_cond_broadcast (&monitor->published);
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   mongoc_thread_join (monitor->thread);
+
+   BSON_ASSERT (monitor->standby);
+
+   _mongoc_cluster_destroy (monitor->standby);
+   bson_free (monitor->standby);
+   _mongoc_array_destroy (&monitor->known);
+
+   mongoc_cond_destroy (&monitor->published);
+   mongoc_cond_destroy (&monitor->cond);
+   mongoc_mutex_destroy (&monitor->mutex);
+
+   bson_free (monitor);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_wakeup --
+ *
+ *       Ask the monitor to refresh the topology now rather than at the
+ *       end of the current heartbeat interval.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_monitor_wakeup (mongoc_cluster_monitor_t *monitor)
+{
+   ENTRY;
+
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   monitor->wakeup = true;
+   mongoc_cond_signal (&monitor->cond);
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_sync --
+ *
+ *       Copy the ping times, primary flags and last write dates most
+ *       recently published by the monitor into the matching nodes of
+ *       @cluster. This never blocks on network I/O and does nothing if the
+ *       monitor has not published anything new since the last call.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_monitor_sync (mongoc_cluster_monitor_t *monitor,
+                              mongoc_cluster_t         *cluster)
+{
+   mongoc_cluster_node_t *standby_node;
+   mongoc_cluster_node_t *node;
+   mongoc_cluster_t *standby;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (monitor);
+   BSON_ASSERT (cluster);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   standby = monitor->standby;
+
+   if (!standby || (monitor->generation == cluster->monitor_generation)) {
+      mongoc_mutex_unlock (&monitor->mutex);
+      EXIT;
+   }
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+
+      if (!node->stream && !node->lazy) {
+         continue;
+      }
+
+      for (j = 0; j < standby->nodes_len; j++) {
+         standby_node = &standby->nodes[j];
+
+         if (standby_node->stream &&
+             !strcasecmp (node->host.host_and_port,
+                          standby_node->host.host_and_port)) {
+            node->rtt_msec = standby_node->rtt_msec;
+            node->ping_avg_msec = standby_node->ping_avg_msec;
+            node->primary = standby_node->primary;
+            node->last_write_date = standby_node->last_write_date;
+            node->last_update_msec = standby_node->last_update_msec;
+            break;
+         }
+      }
+   }
+
+   cluster->monitor_generation = monitor->generation;
+   _mongoc_cluster_topology_changed (cluster);
+
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_adopt --
+ *
+ *       Swap the nodes of @cluster with those of the standby cluster if
+ *       the standby is in better shape. The nodes given up by @cluster are
+ *       handed to the monitor, which is woken to reconnect them.
+ *
+ *       A shared monitor keeps its nodes and @cluster gets a copy of them
+ *       without their streams instead, see _mongoc_cluster_copy_nodes().
+ *
+ *       If no suitable topology has been published yet, wait up to
+ *       @timeout_msec for the monitor to find one.
+ *
+ * Returns:
+ *       true if the topology of @cluster was replaced, otherwise false
+ *       and @error is set.
+ *
+ * Side effects:
+ *       @error is set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_monitor_adopt (mongoc_cluster_monitor_t *monitor,
+                               mongoc_cluster_t         *cluster,
+                               int64_t                   timeout_msec,
+                               bson_error_t             *error)
+{
+   mongoc_cluster_t *standby;
+   uint32_t generation;
+   int64_t expire_at;
+   int64_t now;
+   bool adopt;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (monitor);
+   BSON_ASSERT (cluster);
+
+   expire_at = bson_get_monotonic_time () + (timeout_msec * 1000L);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   generation = monitor->generation;
+
+   for (;;) {
+      standby = monitor->standby;
+
+      if (standby && monitor->generation) {
+         if (cluster->state & MONGOC_CLUSTER_STATE_HEALTHY) {
+            adopt = (standby->state == MONGOC_CLUSTER_STATE_HEALTHY);
+         } else {
+            adopt = !!(standby->state & MONGOC_CLUSTER_STATE_HEALTHY);
+         }
+
+         if (adopt && monitor->shared) {
+            _mongoc_cluster_copy_nodes (cluster, standby);
+            cluster->monitor_generation = monitor->generation;
+            ret = true;
+            break;
+         } else if (adopt) {
+            _mongoc_cluster_swap_nodes (cluster, standby);
+            cluster->monitor_generation = monitor->generation;
+            monitor->wakeup = true;
+            mongoc_cond_signal (&monitor->cond);
+            ret = true;
+            break;
+         }
+
+         /*
+          * The monitor published a new topology since we started waiting
+          * and it still isn't usable. Don't keep the caller waiting.
+          */
+         if (monitor->generation != generation) {
+            break;
+         }
+      }
+
+      now = bson_get_monotonic_time ();
+
+      if (monitor->shutdown || (now >= expire_at)) {
+         break;
+      }
+
+      monitor->wakeup = true;
+      mongoc_cond_signal (&monitor->cond);
+      mongoc_cond_timedwait (&monitor->published, &monitor->mutex,
+                             (expire_at - now) / 1000L);
+   }
+
+   if (!ret) {
+      if (monitor->error.domain) {
+         if (error) {
+            memcpy (error, &monitor->error, sizeof *error);
+         }
+      } else {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_NOT_READY,
+                         "No suitable servers found by topology monitor.");
+      }
+   }
+
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_monitor_set_callbacks --
+ *
+ *       Set the topology callbacks the monitor thread delivers events to.
+ *       @callbacks is copied, and NULL turns them off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_monitor_set_callbacks (mongoc_cluster_monitor_t              *monitor,
+                                       const mongoc_apm_topology_callbacks_t *callbacks,
+                                       void                                  *context)
+{
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   memset (&monitor->callbacks, 0, sizeof monitor->callbacks);
+
+   if (callbacks) {
+      memcpy (&monitor->callbacks, callbacks, sizeof monitor->callbacks);
+   }
+
+   monitor->callbacks_context = context;
+
+   mongoc_mutex_unlock (&monitor->mutex);
+}
+
+
+/*
+ * Count a client of the pool that shares @monitor, and have the monitor
+ * thread report it rather than the thread that created it.
+ */
+void
+_mongoc_cluster_monitor_client_added (mongoc_cluster_monitor_t *monitor)
+{
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   monitor->n_clients++;
+
+   if (monitor->callbacks.pool_client_created) {
+      monitor->clients_created++;
+      mongoc_cond_signal (&monitor->cond);
+   }
+
+   mongoc_mutex_unlock (&monitor->mutex);
+}
+
+
+void
+_mongoc_cluster_monitor_client_removed (mongoc_cluster_monitor_t *monitor)
+{
+   BSON_ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+
+   if (monitor->n_clients) {
+      monitor->n_clients--;
+   }
+
+   if (monitor->callbacks.pool_client_destroyed) {
+      monitor->clients_destroyed++;
+      mongoc_cond_signal (&monitor->cond);
+   }
+
+   mongoc_mutex_unlock (&monitor->mutex);
+}
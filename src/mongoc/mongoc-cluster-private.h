@@ -23,16 +23,20 @@
 
 #include <bson.h>
 
+#include "mongoc-apm.h"
 #include "mongoc-array-private.h"
 #include "mongoc-buffer-private.h"
 #include "mongoc-config.h"
 #include "mongoc-client.h"
+#include "mongoc-counters-private.h"
 #include "mongoc-host-list.h"
 #include "mongoc-list-private.h"
+#include "mongoc-node-limiter-private.h"
 #include "mongoc-opcode.h"
 #include "mongoc-read-prefs.h"
 #include "mongoc-rpc-private.h"
 #include "mongoc-stream.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-uri.h"
 #include "mongoc-write-concern.h"
 
@@ -40,7 +44,11 @@
 BSON_BEGIN_DECLS
 
 
-#define MONGOC_CLUSTER_PING_NUM_SAMPLES 5
+#define MONGOC_CLUSTER_RTT_ALPHA 0.2
+#define MONGOC_CLUSTER_SELECT_CACHE_SIZE 4
+#define MONGOC_CLUSTER_TAG_SETS_MAX 64
+#define MONGOC_CLUSTER_SLOW_OPS_MAX 32
+#define MONGOC_CLUSTER_FLIGHTS_MAX 64  /* a power of two */
 
 
 typedef enum
@@ -61,27 +69,178 @@ typedef enum
 } mongoc_cluster_state_t;
 
 
+/*
+ * Extra connections to a node, in addition to node->stream, for callers
+ * that need several requests in flight to the same node at once. Streams
+ * are borrowed with _mongoc_cluster_node_checkout() and returned with
+ * _mongoc_cluster_node_checkin(). Idle streams are kept on a free list and
+ * closed whenever the node is disconnected.
+ */
+typedef struct
+{
+   mongoc_mutex_t      mutex;
+   mongoc_stream_t   **idle;
+   uint32_t            idle_len;
+   uint32_t            in_use;
+   uint32_t            generation;
+} mongoc_cluster_conn_set_t;
+
+
+/*
+ * How the operations sent to a node have fared. Once a node fails too
+ * often its breaker opens and node selection passes it over until
+ * @open_until. The next operation sent to it after that is a probe: it
+ * closes the breaker if it succeeds, or reopens it for twice as long.
+ *
+ * This outlives the connections of the node so that a node which keeps
+ * failing stays out of the way across reconnects.
+ */
+typedef struct
+{
+   uint32_t            failures;
+   uint32_t            timeouts;
+   uint32_t            consecutive_failures;
+   double              failure_rate;
+   uint32_t            trips;
+   int64_t             open_until;
+   bool                half_open;
+} mongoc_cluster_breaker_t;
+
+
+/*
+ * An entry of the flight recorder, the ring of the last operations of the
+ * cluster. Writing one is a handful of stores, so it is always on. @seq
+ * counts from 1 and tells whether the entry still holds the operation
+ * that a node expects a reply to.
+ */
+typedef struct
+{
+   uint32_t            seq;
+   int32_t             opcode;
+   uint32_t            hint;
+   int32_t             request_id;
+   int64_t             started;
+   int64_t             sent;
+   int64_t             replied;
+   int32_t             bytes_sent;
+   int32_t             bytes_received;
+   uint32_t            error_domain;
+   uint32_t            error_code;
+   char                ns [64];
+} mongoc_cluster_flight_t;
+
+
 typedef struct
 {
    uint32_t            index;
    mongoc_host_list_t  host;
    mongoc_stream_t    *stream;
+   mongoc_cluster_conn_set_t *conns;
    int32_t             ping_avg_msec;
-   int32_t             pings[MONGOC_CLUSTER_PING_NUM_SAMPLES];
-   int32_t             pings_pos;
+   double              rtt_msec;
+   double              op_latency_msec;
+   int64_t             op_started;
+   mongoc_histogram_t *op_histogram;
+   mongoc_scoped_counters_t *op_ns_counters;
+   mongoc_scoped_counters_t *counters;
+   bool                counters_checked;
+   bool                apm_pending;
+   int32_t             apm_request_id;
+   int64_t             apm_started;
+   char                apm_command_name [32];
+   char                apm_ns [120];
+   int64_t             apm_selection_usec;
+   int64_t             apm_reconnect_usec;
+   int64_t             apm_send_usec;
+   int64_t             apm_sent;
+   int32_t             apm_bytes_sent;
+   uint32_t            flight_seq;
    uint32_t            stamp;
    bson_t              tags;
+   uint64_t            tag_sets_checked;
+   uint64_t            tag_sets_matched;
    unsigned            primary    : 1;
    unsigned            needs_auth : 1;
    unsigned            isdbgrid   : 1;
+   unsigned            lazy       : 1;
+   unsigned            electable  : 1;
+   unsigned            compressed : 1;
    int32_t             min_wire_version;
    int32_t             max_wire_version;
    int32_t             max_write_batch_size;
    char               *replSet;
    int64_t             last_read_msec;
+   int64_t             last_write_date;
+   int64_t             last_update_msec;
+   int64_t             staleness_msec;
+   int64_t             avoid_until;
+   mongoc_cluster_breaker_t breaker;
+   mongoc_node_limit_t *limit_slot;
+   mongoc_list_t      *pending_replies;
+   uint32_t            pending_replies_len;
+   mongoc_list_t      *hedges;
 } mongoc_cluster_node_t;
 
 
+/*
+ * The nodes that are eligible for a given read mode and tag set, before
+ * the latency window is applied. Entries are valid while
+ * topology_version matches the cluster's topology_version.
+ */
+typedef struct
+{
+   uint32_t            topology_version;
+   bool                has_read_prefs;
+   bool                need_secondary;
+   mongoc_read_mode_t  read_mode;
+   bson_t              tags;
+   int64_t             max_staleness_msec;
+   uint32_t           *eligible;
+   uint32_t            eligible_len;
+} mongoc_cluster_select_cache_t;
+
+
+/*
+ * A getlasterror OP_QUERY serialized once per write concern and database.
+ * @data holds the message after its 16 byte header, which is the only part
+ * written for each send.
+ */
+typedef struct
+{
+   uint8_t            *data;
+   uint32_t            len;
+   uint32_t            ns_len;
+} mongoc_cluster_gle_t;
+
+
+typedef struct
+{
+   int32_t             msg_len;
+   int32_t             request_id;
+   int32_t             response_to;
+   int32_t             opcode;
+} mongoc_cluster_gle_header_t;
+
+
+#define MONGOC_CLUSTER_GLE_CACHE_MAX 16
+
+
+/*
+ * Cursors are killed in batches rather than one OP_KILL_CURSORS each.
+ * Cursors abandoned on a node are queued, and their ids are sent ahead of
+ * the next request to that node, or all at once when this many have
+ * piled up.
+ */
+#define MONGOC_CLUSTER_DEAD_CURSORS_MAX 64
+
+
+typedef struct
+{
+   int64_t             cursor_id;
+   char                host_and_port [BSON_HOST_NAME_MAX + 7];
+} mongoc_cluster_dead_cursor_t;
+
+
 typedef struct
 {
    mongoc_cluster_mode_t   mode;
@@ -89,8 +248,15 @@ typedef struct
 
    uint32_t                request_id;
    uint32_t                sockettimeoutms;
+   uint32_t                connecttimeoutms;
+   int32_t                 serverselectiontimeoutms;
+   int                     connecting;
+   int64_t                 deadline;
 
    int64_t                 last_reconnect;
+   int64_t                 last_ping;
+   int64_t                 last_primary_probe;
+   bool                    needs_primary_probe;
 
    mongoc_uri_t           *uri;
 
@@ -101,16 +267,123 @@ typedef struct
    mongoc_client_t        *client;
    int32_t                 max_bson_size;
    int32_t                 max_msg_size;
+   int32_t                 max_write_batch_size;
    uint32_t                sec_latency_ms;
+   bool                    track_op_latency;
+   uint32_t                max_conns_per_node;
+   bool                    lazy_connect;
+   bool                    standby_connections;
+   uint32_t                mongos_next;
+   bool                    hedged_reads;
+   bool                    retry_reads;
+   bool                    retry_writes;
+   int32_t                 hedge_delay_msec;
+   int32_t                 compressor_id;
+   int32_t                 compression_level;
+   mongoc_buffer_t         compress_in;
+   mongoc_buffer_t         compress_out;
    mongoc_array_t          iov;
+   size_t                  iov_bytes_counted;
+   mongoc_array_t          gle_cache;
+   mongoc_cluster_gle_header_t *gle_headers;
+   uint32_t                gle_headers_len;
+   mongoc_array_t          dead_cursors;
+   mongoc_array_t          kill_ids;
+
+   mongoc_scoped_counters_t *ns_counters;
+   char                    ns_counters_key [120];
+
+   bool                    apm_enabled;
+   mongoc_apm_callbacks_t  apm;
+   void                   *apm_context;
+   mongoc_array_t          apm_ops;
+
+   int64_t                 slow_op_usec;
+   mongoc_apm_slow_op_cb_t slow_op_cb;
+   void                   *slow_op_context;
+   mongoc_apm_slow_op_t   *slow_ops;
+   uint32_t                slow_ops_len;
+   uint32_t                slow_ops_next;
+
+   int64_t                 op_reconnect_usec;
+   int64_t                 op_selected;
+   int64_t                 op_sent;
+   int64_t                 op_first_byte;
+
+   mongoc_cluster_flight_t flights [MONGOC_CLUSTER_FLIGHTS_MAX];
+   uint32_t                flights_seq;
 
    mongoc_list_t          *peers;
 
+   /* of the pool, or NULL unless maxConcurrentOpsPerNode is set */
+   mongoc_node_limiter_t  *limiter;
+
    char                   *replSet;
+
+   uint32_t                topology_version;
+   mongoc_cluster_select_cache_t select_cache[MONGOC_CLUSTER_SELECT_CACHE_SIZE];
+   uint32_t                select_cache_next;
+   int                    *select_scores;
+   uint32_t                select_capacity;
+
+   /*
+    * Read preference tag sets seen so far. Each node records, one bit per
+    * entry, which of them its tags satisfy.
+    */
+   bson_t                 *tag_sets [MONGOC_CLUSTER_TAG_SETS_MAX];
+   uint32_t                tag_sets_len;
+
+   int64_t                 heartbeat_frequency_msec;
+   struct _mongoc_cluster_monitor_t *monitor;
+   uint32_t                monitor_generation;
 } mongoc_cluster_t;
 
 
+/*
+ * Invalidate anything derived from the set of nodes, their connections
+ * or their roles, such as the server selection cache.
+ */
+static BSON_INLINE void
+_mongoc_cluster_topology_changed (mongoc_cluster_t *cluster)
+{
+   if (!++cluster->topology_version) {
+      cluster->topology_version = 1;
+   }
+}
+
+
+/*
+ * The most documents a write batch sent to @node may hold, or zero if it
+ * is only limited in size. @cluster may lower the limit @node reports.
+ */
+static BSON_INLINE int32_t
+_mongoc_cluster_max_write_batch_size (const mongoc_cluster_t      *cluster,
+                                      const mongoc_cluster_node_t *node)
+{
+   if (cluster->max_write_batch_size &&
+       (!node->max_write_batch_size ||
+        (node->max_write_batch_size > cluster->max_write_batch_size))) {
+      return cluster->max_write_batch_size;
+   }
+
+   return node->max_write_batch_size;
+}
+
+
 void                   _mongoc_cluster_destroy         (mongoc_cluster_t             *cluster);
+void                   _mongoc_cluster_set_apm_callbacks (mongoc_cluster_t           *cluster,
+                                                          const mongoc_apm_callbacks_t *callbacks,
+                                                          void                       *context);
+void                   _mongoc_cluster_set_slow_op_log (mongoc_cluster_t             *cluster,
+                                                        int64_t                       threshold_usec,
+                                                        mongoc_apm_slow_op_cb_t       callback,
+                                                        void                         *context);
+size_t                 _mongoc_cluster_get_slow_ops    (mongoc_cluster_t             *cluster,
+                                                        mongoc_apm_slow_op_t         *ops,
+                                                        size_t                        n_ops);
+size_t                 _mongoc_cluster_get_flights     (mongoc_cluster_t             *cluster,
+                                                        mongoc_apm_flight_record_t   *records,
+                                                        size_t                        n_records);
 void                   _mongoc_cluster_init            (mongoc_cluster_t             *cluster,
                                                         const mongoc_uri_t           *uri,
                                                         void                         *client);
@@ -133,6 +406,26 @@ bool                   _mongoc_cluster_try_recv        (mongoc_cluster_t
                                                         mongoc_buffer_t              *buffer,
                                                         uint32_t                      hint,
                                                         bson_error_t                 *error);
+bool                   _mongoc_cluster_try_recv_partial(mongoc_cluster_t             *cluster,
+                                                        mongoc_rpc_t                 *rpc,
+                                                        mongoc_buffer_t              *buffer,
+                                                        uint32_t                      hint,
+                                                        bson_error_t                 *error);
+bool                   _mongoc_cluster_try_recv_more   (mongoc_cluster_t             *cluster,
+                                                        mongoc_buffer_t              *buffer,
+                                                        uint32_t                      hint,
+                                                        size_t                        size,
+                                                        bson_error_t                 *error);
+bool                   _mongoc_cluster_try_recv_reply  (mongoc_cluster_t             *cluster,
+                                                        mongoc_rpc_t                 *rpc,
+                                                        mongoc_buffer_t              *buffer,
+                                                        uint32_t                      hint,
+                                                        uint32_t                      response_to,
+                                                        bson_error_t                 *error);
+bool                   _mongoc_cluster_kill_cursor_deferred (mongoc_cluster_t        *cluster,
+                                                             uint32_t                 hint,
+                                                             int64_t                  cursor_id);
+void                   _mongoc_cluster_flush_dead_cursors   (mongoc_cluster_t        *cluster);
 uint32_t               _mongoc_cluster_stamp           (const mongoc_cluster_t       *cluster,
                                                         uint32_t                      node);
 mongoc_cluster_node_t *_mongoc_cluster_get_primary     (mongoc_cluster_t             *cluster);
@@ -141,10 +434,45 @@ bool                   _mongoc_cluster_command_early   (mongoc_cluster_t
                                                         const bson_t                 *command,
                                                         bson_t                       *reply,
                                                         bson_error_t                 *error);
+bool                   _mongoc_cluster_can_hedge       (const mongoc_cluster_t       *cluster,
+                                                        const mongoc_rpc_t           *rpc,
+                                                        const mongoc_read_prefs_t    *read_prefs);
+uint32_t               _mongoc_cluster_query_hedged    (mongoc_cluster_t             *cluster,
+                                                        mongoc_rpc_t                 *rpc,
+                                                        const mongoc_read_prefs_t    *read_prefs,
+                                                        mongoc_rpc_t                 *reply,
+                                                        mongoc_buffer_t              *buffer,
+                                                        bson_error_t                 *error);
+int64_t                _mongoc_cluster_set_deadline    (mongoc_cluster_t             *cluster,
+                                                        uint32_t                      timeout_msec);
+void                   _mongoc_cluster_restore_deadline (mongoc_cluster_t            *cluster,
+                                                        int64_t                       saved);
 void                   _mongoc_cluster_disconnect_node (mongoc_cluster_t             *cluster,
                                                         mongoc_cluster_node_t        *node);
+void                   _mongoc_cluster_reset_after_fork (mongoc_cluster_t            *cluster);
 bool                   _mongoc_cluster_reconnect       (mongoc_cluster_t             *cluster,
                                                         bson_error_t                 *error);
+bool                   _mongoc_cluster_check_nodes     (mongoc_cluster_t             *cluster,
+                                                        bson_error_t                 *error);
+void                   _mongoc_cluster_swap_nodes      (mongoc_cluster_t             *cluster,
+                                                        mongoc_cluster_t             *other);
+void                   _mongoc_cluster_copy_nodes      (mongoc_cluster_t             *cluster,
+                                                        const mongoc_cluster_t       *other);
+mongoc_stream_t       *_mongoc_cluster_node_connect_stream (mongoc_cluster_t         *cluster,
+                                                            mongoc_cluster_node_t    *node,
+                                                            bson_error_t             *error);
+mongoc_stream_t       *_mongoc_cluster_node_checkout   (mongoc_cluster_t             *cluster,
+                                                        mongoc_cluster_node_t        *node,
+                                                        uint32_t                     *generation,
+                                                        bson_error_t                 *error);
+void                   _mongoc_cluster_node_checkin    (mongoc_cluster_t             *cluster,
+                                                        mongoc_cluster_node_t        *node,
+                                                        mongoc_stream_t              *stream,
+                                                        uint32_t                      generation,
+                                                        bool                          reusable);
+bool                   _mongoc_cluster_prepare_retry   (mongoc_cluster_t             *cluster,
+                                                        bool                          is_write,
+                                                        const bson_error_t           *error);
 uint32_t               _mongoc_cluster_preselect       (mongoc_cluster_t             *cluster,
                                                         mongoc_opcode_t               opcode,
                                                         const mongoc_write_concern_t *write_concern,
@@ -25,9 +25,12 @@
 #include <string.h>
 
 #include "mongoc-cluster-private.h"
+#include "mongoc-cluster-monitor-private.h"
 #include "mongoc-client-private.h"
+#include "mongoc-compression-private.h"
 #include "mongoc-counters-private.h"
 #include "mongoc-config.h"
+#include "mongoc-dns-cache-private.h"
 #include "mongoc-error.h"
 #include "mongoc-host-list-private.h"
 #include "mongoc-log.h"
@@ -39,7 +42,7 @@
 #endif
 #include "mongoc-b64-private.h"
 #include "mongoc-scram-private.h"
-#include "mongoc-socket.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-stream-socket.h"
 #include "mongoc-thread-private.h"
@@ -67,6 +70,84 @@
 #define CHECK_CLOSED_DURATION_MSEC 1000
 
 
+#ifndef SELECTION_RETRY_INTERVAL_USEC
+/*
+ * How long to wait between attempts to find a suitable node while
+ * serverSelectionTimeoutMS has not expired.
+ */
+#define SELECTION_RETRY_INTERVAL_USEC (1000L * 500L)
+#endif
+
+
+#ifndef MONGOS_TIMEOUT_AVOID_USEC
+/*
+ * A mongos that times out is passed over by node selection for this long,
+ * as long as some other mongos is available.
+ */
+#define MONGOS_TIMEOUT_AVOID_USEC (1000L * 1000L * 10L)
+#endif
+
+
+#ifndef BREAKER_FAILURE_THRESHOLD
+/*
+ * A node's breaker opens after this many failed operations in a row, or
+ * once the moving average of its failures reaches BREAKER_FAILURE_RATE.
+ * A timeout counts as two failures since it costs a whole
+ * socketTimeoutMS. See mongoc_cluster_breaker_t.
+ */
+#define BREAKER_FAILURE_THRESHOLD 3
+#define BREAKER_FAILURE_RATE 0.5
+#endif
+
+
+#ifndef BREAKER_BACKOFF_USEC
+/*
+ * How long an open breaker keeps a node out of node selection the first
+ * time. This doubles each time the probe that follows fails, up to
+ * BREAKER_BACKOFF_MAX_USEC.
+ */
+#define BREAKER_BACKOFF_USEC (1000L * 1000L)
+#define BREAKER_BACKOFF_MAX_USEC (1000L * 1000L * 32L)
+#endif
+
+
+#ifndef PING_INTERVAL_USEC
+/*
+ * Without a topology monitor, the ping times of the connected nodes are
+ * refreshed this often by the thread sending the next operation.
+ */
+#define PING_INTERVAL_USEC (1000L * 1000L * 10L)
+#endif
+
+
+#ifndef PRIMARY_PROBE_INTERVAL_USEC
+/*
+ * After a primary reports that it is no longer primary, the remaining
+ * members are asked for the new primary at most this often.
+ */
+#define PRIMARY_PROBE_INTERVAL_USEC (1000L * 100L)
+#endif
+
+
+#ifndef MAX_PENDING_REPLIES
+/*
+ * Replies read ahead of the one a pipelined caller is waiting for are
+ * held on the node. Bound them so an abandoned request can't grow the
+ * queue forever.
+ */
+#define MAX_PENDING_REPLIES 64
+#endif
+
+
+#ifndef MIN_HEDGE_DELAY_MSEC
+/*
+ * A hedged query is never sent to a second node sooner than this after
+ * the first, however fast the first node usually answers.
+ */
+#define MIN_HEDGE_DELAY_MSEC 5
+#endif
+
+
 #ifndef UNHEALTHY_RECONNECT_TIMEOUT_USEC
 /*
  * Try reconnect every 20 seconds if we are unhealthy.
@@ -87,6 +168,31 @@
    } while (0)
 
 
+/*
+ * An operation handed to _mongoc_cluster_sendv() while monitoring is on,
+ * noted before the RPC is swabbed. The strings point into the RPC.
+ */
+typedef struct
+{
+   const char *command_name;
+   const char *ns;
+   bool        expects_reply;
+} mongoc_cluster_apm_op_t;
+
+
+static bool _mongoc_cluster_node_connect_lazy  (mongoc_cluster_t      *cluster,
+                                                mongoc_cluster_node_t *node,
+                                                bson_error_t          *error);
+static bool _mongoc_cluster_reconnect_or_adopt (mongoc_cluster_t      *cluster,
+                                                bool                   block,
+                                                bson_error_t          *error);
+static bool _mongoc_cluster_retry_selection    (mongoc_cluster_t      *cluster,
+                                                int                   *retry_count,
+                                                int64_t               *expire_at,
+                                                bson_error_t          *error);
+static void _mongoc_cluster_clear_gle_cache    (mongoc_cluster_t      *cluster);
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -118,10 +224,10 @@ _mongoc_cluster_update_state (mongoc_cluster_t *cluster)
 
    for (i = 0; i < cluster->nodes_len; i++) {
       node = &cluster->nodes[i];
-      if (node->stamp && !node->stream) {
-         down_nodes++;
-      } else if (node->stream) {
+      if (node->stream || node->lazy) {
          up_nodes++;
+      } else if (node->stamp) {
+         down_nodes++;
       }
    }
 
@@ -139,6 +245,8 @@ _mongoc_cluster_update_state (mongoc_cluster_t *cluster)
 
    cluster->state = state;
 
+   _mongoc_cluster_topology_changed (cluster);
+
    EXIT;
 }
 
@@ -244,9 +352,11 @@ _mongoc_cluster_node_init (mongoc_cluster_node_t *node)
 
    node->index = 0;
    node->ping_avg_msec = -1;
-   memset(node->pings, 0xFF, sizeof node->pings);
-   node->pings_pos = 0;
+   node->rtt_msec = -1;
+   node->op_latency_msec = -1;
+   node->op_started = 0;
    node->stamp = 0;
+   node->staleness_msec = -1;
    bson_init(&node->tags);
    node->primary = 0;
    node->needs_auth = 0;
@@ -255,14 +365,89 @@ _mongoc_cluster_node_init (mongoc_cluster_node_t *node)
 }
 
 
+/*
+ * The tags of a node changed, so what they were matched against no longer
+ * holds.
+ */
+static BSON_INLINE void
+_mongoc_cluster_node_reset_tag_sets (mongoc_cluster_node_t *node)
+{
+   node->tag_sets_checked = 0;
+   node->tag_sets_matched = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_counters --
+ *
+ *       Look up the scoped counters of @node by its "host:port" the first
+ *       time they are needed.
+ *
+ * Returns:
+ *       The counters of @node, or NULL if there are no scoped counters
+ *       left for it.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_scoped_counters_t *
+_mongoc_cluster_node_counters (mongoc_cluster_node_t *node)
+{
+   if (!node->counters_checked) {
+      node->counters = _mongoc_scoped_counters_get (
+         MONGOC_SCOPED_COUNTERS_NODE, node->host.host_and_port);
+      node->counters_checked = true;
+   }
+
+   return node->counters;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_release_slot --
+ *
+ *       Give back the operation @node has in flight under the concurrency
+ *       limit of the pool, if any. See _mongoc_node_limit_release().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE void
+_mongoc_cluster_node_release_slot (mongoc_cluster_node_t *node,
+                                   int64_t                rtt_usec,
+                                   bool                   failed)
+{
+   mongoc_node_limit_t *slot = node->limit_slot;
+
+   if (slot) {
+      node->limit_slot = NULL;
+      _mongoc_node_limit_release (slot, rtt_usec, failed);
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
  * _mongoc_cluster_node_track_ping --
  *
  *       Add the ping time to the mongoc_cluster_node_t.
- *       Increment the position in the ring buffer and update the
- *       rolling average.
+ *       The round-trip time is an exponentially weighted moving average
+ *       so that a node that suddenly slows down is noticed quickly while
+ *       older samples still contribute.
  *
  * Returns:
  *       None.
@@ -277,32 +462,33 @@ static void
 _mongoc_cluster_node_track_ping (mongoc_cluster_node_t *node,
                                  int32_t           ping)
 {
-   int total = 0;
-   int count = 0;
-   int i;
-
    BSON_ASSERT(node);
 
-   node->pings[node->pings_pos] = ping;
-   node->pings_pos = (node->pings_pos + 1) % MONGOC_CLUSTER_PING_NUM_SAMPLES;
+   if (ping < 0) {
+      return;
+   }
+
+   mongoc_histogram_node_rtt_record ((int64_t)ping * 1000);
 
-   for (i = 0; i < MONGOC_CLUSTER_PING_NUM_SAMPLES; i++) {
-      if (node->pings[i] != -1) {
-         total += node->pings[i];
-         count++;
-      }
+   if (node->rtt_msec < 0) {
+      node->rtt_msec = ping;
+   } else {
+      node->rtt_msec = (MONGOC_CLUSTER_RTT_ALPHA * ping) +
+                       ((1.0 - MONGOC_CLUSTER_RTT_ALPHA) * node->rtt_msec);
    }
 
-   node->ping_avg_msec = count ? (int)((double)total / (double)count) : -1;
+   node->ping_avg_msec = (int32_t)(node->rtt_msec + 0.5);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_node_destroy --
+ * _mongoc_cluster_node_track_op --
  *
- *       Destroy allocated resources within @node.
+ *       Add the latency of a completed operation to the
+ *       mongoc_cluster_node_t. Like ping times, this is an exponentially
+ *       weighted moving average.
  *
  * Returns:
  *       None.
@@ -314,43 +500,59 @@ _mongoc_cluster_node_track_ping (mongoc_cluster_node_t *node,
  */
 
 static void
-_mongoc_cluster_node_destroy (mongoc_cluster_node_t *node)
+_mongoc_cluster_node_track_op (mongoc_cluster_node_t *node,
+                               int64_t                now)
 {
-   ENTRY;
+   double latency;
 
    BSON_ASSERT(node);
 
-   if (node->stream) {
-      mongoc_stream_close(node->stream);
-      mongoc_stream_destroy(node->stream);
-      node->stream = NULL;
+   if (!node->op_started) {
+      return;
    }
 
-   if (node->tags.len) {
-      bson_destroy (&node->tags);
-      memset (&node->tags, 0, sizeof node->tags);
+   latency = (double)(now - node->op_started) / 1000.0;
+
+   if (node->op_histogram) {
+      _mongoc_histogram_record (node->op_histogram, now - node->op_started);
+      node->op_histogram = NULL;
    }
 
-   bson_free (node->replSet);
-   node->replSet = NULL;
+   if (node->counters) {
+      _mongoc_scoped_counters_add_latency (node->counters,
+                                           now - node->op_started);
+   }
 
-   EXIT;
+   if (node->op_ns_counters) {
+      _mongoc_scoped_counters_add_latency (node->op_ns_counters,
+                                           now - node->op_started);
+      node->op_ns_counters = NULL;
+   }
+
+   _mongoc_cluster_node_release_slot (node, now - node->op_started, false);
+   node->op_started = 0;
+
+   if (node->op_latency_msec < 0) {
+      node->op_latency_msec = latency;
+   } else {
+      node->op_latency_msec =
+         (MONGOC_CLUSTER_RTT_ALPHA * latency) +
+         ((1.0 - MONGOC_CLUSTER_RTT_ALPHA) * node->op_latency_msec);
+   }
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_build_basic_auth_digest --
- *
- *       Computes the Basic Authentication digest using the credentials
- *       configured for @cluster and the @nonce provided.
+ * _mongoc_cluster_node_latency --
  *
- *       The result should be freed by the caller using bson_free() when
- *       they are finished with it.
+ *       Get the latency of @node used for node selection. This is the
+ *       ping round-trip time, or the operation latency if that is being
+ *       tracked and is higher.
  *
  * Returns:
- *       A newly allocated string containing the digest.
+ *       The latency in milliseconds or -1 if unknown.
  *
  * Side effects:
  *       None.
@@ -358,57 +560,37 @@ _mongoc_cluster_node_destroy (mongoc_cluster_node_t *node)
  *--------------------------------------------------------------------------
  */
 
-static char *
-_mongoc_cluster_build_basic_auth_digest (mongoc_cluster_t *cluster,
-                                         const char       *nonce)
+static int32_t
+_mongoc_cluster_node_latency (const mongoc_cluster_t      *cluster,
+                              const mongoc_cluster_node_t *node)
 {
-   const char *username;
-   const char *password;
-   char *password_digest;
-   char *password_md5;
-   char *digest_in;
-   char *ret;
-
-   ENTRY;
-
-   /*
-    * The following generates the digest to be used for basic authentication
-    * with a MongoDB server. More information on the format can be found
-    * at the following location:
-    *
-    * http://docs.mongodb.org/meta-driver/latest/legacy/
-    *   implement-authentication-in-driver/
-    */
-
-   BSON_ASSERT(cluster);
-   BSON_ASSERT(cluster->uri);
-
-   username = mongoc_uri_get_username(cluster->uri);
-   password = mongoc_uri_get_password(cluster->uri);
-   password_digest = bson_strdup_printf("%s:mongo:%s", username, password);
-   password_md5 = _mongoc_hex_md5(password_digest);
-   digest_in = bson_strdup_printf("%s%s%s", nonce, username, password_md5);
-   ret = _mongoc_hex_md5(digest_in);
-   bson_free(digest_in);
-   bson_free(password_md5);
-   bson_free(password_digest);
+   if (cluster->track_op_latency &&
+       (node->op_latency_msec >= 0) &&
+       (node->op_latency_msec > node->ping_avg_msec)) {
+      return (int32_t)(node->op_latency_msec + 0.5);
+   }
 
-   RETURN(ret);
+   return node->ping_avg_msec;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_disconnect_node --
+ * _mongoc_cluster_set_deadline --
  *
- *       Disconnects a cluster node and reinitializes it so it may be
- *       connected to again in the future.
+ *       Bound the total time of the operation that is about to start on
+ *       @cluster to @timeout_msec. Node selection, reconnection and every
+ *       stream read and write made for the operation share the budget; the
+ *       per-call socketTimeoutMS still applies if it is shorter.
  *
- *       The stream is closed and destroyed.
+ *       A deadline already in place is only ever shortened, so nested
+ *       operations never outlive the one that started them. A
+ *       @timeout_msec of 0 leaves the current deadline alone.
  *
  * Returns:
- *       None.
+ *       The previous deadline, to be given to
+ *       _mongoc_cluster_restore_deadline() when the operation completes.
  *
  * Side effects:
  *       None.
@@ -416,192 +598,287 @@ _mongoc_cluster_build_basic_auth_digest (mongoc_cluster_t *cluster,
  *--------------------------------------------------------------------------
  */
 
-void
-_mongoc_cluster_disconnect_node (mongoc_cluster_t      *cluster,
-                                 mongoc_cluster_node_t *node)
+int64_t
+_mongoc_cluster_set_deadline (mongoc_cluster_t *cluster,
+                              uint32_t          timeout_msec)
 {
-   ENTRY;
+   int64_t saved;
+   int64_t deadline;
 
-   bson_return_if_fail(node);
+   BSON_ASSERT (cluster);
 
-   if (node->stream) {
-      mongoc_stream_close(node->stream);
-      mongoc_stream_destroy(node->stream);
-      node->stream = NULL;
+   saved = cluster->deadline;
+
+   if (timeout_msec) {
+      deadline = bson_get_monotonic_time () + ((int64_t)timeout_msec * 1000L);
+      if (!cluster->deadline || (deadline < cluster->deadline)) {
+         cluster->deadline = deadline;
+      }
    }
 
-   node->needs_auth = cluster->requires_auth;
-   node->ping_avg_msec = -1;
-   memset(node->pings, 0xFF, sizeof node->pings);
-   node->pings_pos = 0;
-   node->stamp++;
-   node->primary = 0;
+   return saved;
+}
 
-   bson_destroy (&node->tags);
-   bson_init (&node->tags);
 
-   _mongoc_cluster_update_state (cluster);
+void
+_mongoc_cluster_restore_deadline (mongoc_cluster_t *cluster,
+                                  int64_t           saved)
+{
+   BSON_ASSERT (cluster);
 
-   EXIT;
+   cluster->deadline = saved;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_init --
+ * _mongoc_cluster_phase_timeout --
  *
- *       Initializes @cluster using the @uri and @client provided. The
- *       @uri is used to determine the "mode" of the cluster. Based on the
- *       uri we can determine if we are connected to a single host, a
- *       replicaSet, or a shardedCluster.
+ *       The timeout of a single read or write in the current phase: the
+ *       connect timeout while connecting, handshaking and authenticating,
+ *       otherwise the socket timeout.
  *
  * Returns:
- *       None.
+ *       The timeout in milliseconds.
  *
  * Side effects:
- *       @cluster is initialized.
+ *       None.
  *
  *--------------------------------------------------------------------------
  */
 
-void
-_mongoc_cluster_init (mongoc_cluster_t   *cluster,
-                      const mongoc_uri_t *uri,
-                      void               *client)
+static uint32_t
+_mongoc_cluster_phase_timeout (const mongoc_cluster_t *cluster)
 {
-   const mongoc_host_list_t *hosts;
-   const mongoc_host_list_t *host_iter;
-   uint32_t sockettimeoutms = MONGOC_DEFAULT_SOCKETTIMEOUTMS;
-   uint32_t i;
-   const bson_t *b;
-   bson_iter_t iter;
+   if (cluster->connecting) {
+      return BSON_MIN (cluster->connecttimeoutms, cluster->sockettimeoutms);
+   }
 
-   ENTRY;
+   return cluster->sockettimeoutms;
+}
 
-   bson_return_if_fail (cluster);
-   bson_return_if_fail (uri);
 
-   memset (cluster, 0, sizeof *cluster);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_io_timeout --
+ *
+ *       Get the timeout to use for the next stream read or write: the
+ *       socket timeout, or what is left of the operation deadline if that
+ *       is shorter. While connections are being set up, the connect
+ *       timeout is used instead of the socket timeout so that a host that
+ *       accepts connections but never answers is given up on quickly.
+ *
+ * Returns:
+ *       true and @timeout_msec is set; or false if the deadline has
+ *       passed and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   b = mongoc_uri_get_options(uri);
-   hosts = mongoc_uri_get_hosts(uri);
+static bool
+_mongoc_cluster_io_timeout (mongoc_cluster_t *cluster,
+                            int32_t          *timeout_msec,
+                            bson_error_t     *error)
+{
+   int64_t remaining;
 
-   if (bson_iter_init_find_case (&iter, b, "replicaSet")) {
-      cluster->mode = MONGOC_CLUSTER_REPLICA_SET;
-      cluster->replSet = bson_iter_dup_utf8 (&iter, NULL);
-      MONGOC_DEBUG ("Client initialized in replica set mode.");
-   } else if (hosts->next) {
-      cluster->mode = MONGOC_CLUSTER_SHARDED_CLUSTER;
-      MONGOC_DEBUG ("Client initialized in sharded cluster mode.");
-   } else {
-      cluster->mode = MONGOC_CLUSTER_DIRECT;
-      MONGOC_DEBUG ("Client initialized in direct mode.");
-   }
+   *timeout_msec = (int32_t)_mongoc_cluster_phase_timeout (cluster);
 
-   if (bson_iter_init_find_case(&iter, b, "sockettimeoutms")) {
-      if (!(sockettimeoutms = bson_iter_int32 (&iter))) {
-         sockettimeoutms = MONGOC_DEFAULT_SOCKETTIMEOUTMS;
-      }
+   if (!cluster->deadline) {
+      return true;
    }
 
-   cluster->uri = mongoc_uri_copy(uri);
-   cluster->client = client;
-   cluster->sec_latency_ms = 15;
-   cluster->max_msg_size = 1024 * 1024 * 48;
-   cluster->max_bson_size = 1024 * 1024 * 16;
-   cluster->requires_auth = (mongoc_uri_get_username (uri) ||
-                             mongoc_uri_get_auth_mechanism (uri));
-   cluster->sockettimeoutms = sockettimeoutms;
+   remaining = (cluster->deadline - bson_get_monotonic_time ()) / 1000L;
 
-   if (bson_iter_init_find_case(&iter, b, "secondaryacceptablelatencyms") &&
-       BSON_ITER_HOLDS_INT32(&iter)) {
-      cluster->sec_latency_ms = bson_iter_int32(&iter);
+   if (remaining <= 0) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Operation exceeded its deadline.");
+      return false;
    }
 
-   if (cluster->mode == MONGOC_CLUSTER_DIRECT) {
-      i = 1;
-   } else {
-      for (host_iter = hosts, i = 0; host_iter; host_iter = host_iter->next, i++) {}
+   if (remaining < *timeout_msec) {
+      *timeout_msec = (int32_t)remaining;
    }
 
-   cluster->nodes = bson_malloc(i * sizeof(*cluster->nodes));
-   cluster->nodes_len = i;
+   return true;
+}
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      _mongoc_cluster_node_init(&cluster->nodes[i]);
-      cluster->nodes[i].stamp = 0;
-      cluster->nodes[i].index = i;
-      cluster->nodes[i].ping_avg_msec = -1;
-      cluster->nodes[i].needs_auth = cluster->requires_auth;
-   }
 
-   _mongoc_array_init (&cluster->iov, sizeof (mongoc_iovec_t));
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_is_open --
+ *
+ *       Check whether the breaker of @node is open, in which case node
+ *       selection should pass it over.
+ *
+ * Returns:
+ *       true if @node should not be selected before @now.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   EXIT;
+static BSON_INLINE bool
+_mongoc_cluster_node_is_open (const mongoc_cluster_node_t *node,
+                              int64_t                      now)
+{
+   return node->breaker.open_until > now;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_destroy --
+ * _mongoc_cluster_node_is_saturated --
  *
- *       Clean up after @cluster and destroy all active connections.
- *       All resources for @cluster are released.
+ *       Check whether @node has as many operations in flight as the
+ *       concurrency limit of the pool allows, in which case node selection
+ *       should prefer another node. An operation on a node this client
+ *       already has one in flight to does not count against the limit
+ *       again.
+ *
+ * Returns:
+ *       true if an operation sent to @node now would be turned down.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE bool
+_mongoc_cluster_node_is_saturated (const mongoc_cluster_t      *cluster,
+                                   const mongoc_cluster_node_t *node)
+{
+   return cluster->limiter && !node->limit_slot &&
+          _mongoc_node_limiter_saturated (cluster->limiter,
+                                          node->host.host_and_port);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_record_success --
+ *
+ *       Called after an operation on @node completed. Closes the breaker
+ *       if this was the probe sent after it opened.
  *
  * Returns:
  *       None.
  *
  * Side effects:
- *       Everything.
+ *       None.
  *
  *--------------------------------------------------------------------------
  */
 
-void
-_mongoc_cluster_destroy (mongoc_cluster_t *cluster) /* INOUT */
+static void
+_mongoc_cluster_node_record_success (mongoc_cluster_node_t *node)
 {
-   uint32_t i;
+   mongoc_cluster_breaker_t *breaker = &node->breaker;
 
-   ENTRY;
+   breaker->consecutive_failures = 0;
+   breaker->failure_rate *= (1.0 - MONGOC_CLUSTER_RTT_ALPHA);
 
-   bson_return_if_fail (cluster);
+   if (breaker->half_open) {
+      MONGOC_INFO ("%s is answering again.", node->host.host_and_port);
+      breaker->half_open = false;
+      breaker->trips = 0;
+      breaker->open_until = 0;
+   }
+}
 
-   mongoc_uri_destroy (cluster->uri);
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (cluster->nodes[i].stream) {
-         _mongoc_cluster_node_destroy (&cluster->nodes [i]);
-      }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_record_failure --
+ *
+ *       Called after an operation on @node failed. Opens the breaker of
+ *       @node if it has been failing too often, or if this was the probe
+ *       sent after the breaker last opened.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_node_record_failure (mongoc_cluster_t      *cluster,
+                                     mongoc_cluster_node_t *node,
+                                     bool                   timed_out)
+{
+   mongoc_cluster_breaker_t *breaker = &node->breaker;
+   int64_t backoff;
+   int i;
+
+   if (cluster->mode == MONGOC_CLUSTER_DIRECT) {
+      return;
    }
 
-   bson_free (cluster->nodes);
+   breaker->failures++;
 
-   bson_free (cluster->replSet);
-   cluster->replSet = NULL;
+   if (timed_out) {
+      breaker->timeouts++;
+   }
 
-   _mongoc_cluster_clear_peers (cluster);
+   for (i = 0; i < (timed_out ? 2 : 1); i++) {
+      breaker->consecutive_failures++;
+      breaker->failure_rate = MONGOC_CLUSTER_RTT_ALPHA +
+                              ((1.0 - MONGOC_CLUSTER_RTT_ALPHA) *
+                               breaker->failure_rate);
+   }
 
-   _mongoc_array_destroy (&cluster->iov);
+   if (!breaker->half_open &&
+       (breaker->consecutive_failures < BREAKER_FAILURE_THRESHOLD) &&
+       (breaker->failure_rate < BREAKER_FAILURE_RATE)) {
+      return;
+   }
 
-   EXIT;
+   backoff = BREAKER_BACKOFF_USEC << BSON_MIN (breaker->trips, 5);
+   backoff = BSON_MIN (backoff, BREAKER_BACKOFF_MAX_USEC);
+
+   MONGOC_WARNING ("%s is failing, avoiding it for %d milliseconds.",
+                   node->host.host_and_port, (int)(backoff / 1000L));
+
+   breaker->trips++;
+   breaker->half_open = true;
+   breaker->consecutive_failures = 0;
+   breaker->open_until = bson_get_monotonic_time () + backoff;
+
+   mongoc_counter_cluster_breaker_trips_inc ();
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_select --
+ * _mongoc_cluster_node_io_failed --
  *
- *       Selects a cluster node that is suitable for handling the required
- *       set of rpc messages. The read_prefs are taken into account.
+ *       Called after a read from or write to @node failed, to feed its
+ *       breaker. If the read timed out and @node is a mongos,
+ *       also keep it out of node selection for MONGOS_TIMEOUT_AVOID_USEC
+ *       so requests go to the other mongos instead.
  *
- *       If any operation is a write, primary will be forced.
+ *       This must be called before anything that could clobber errno.
  *
  * Returns:
- *       A mongoc_cluster_node_t if successful; otherwise NULL and
- *       @error is set.
+ *       None.
  *
  * Side effects:
  *       None.
@@ -609,419 +886,291 @@ _mongoc_cluster_destroy (mongoc_cluster_t *cluster) /* INOUT */
  *--------------------------------------------------------------------------
  */
 
-static mongoc_cluster_node_t *
-_mongoc_cluster_select (mongoc_cluster_t             *cluster,
-                        mongoc_rpc_t                 *rpcs,
-                        size_t                        rpcs_len,
-                        uint32_t                      hint,
-                        const mongoc_write_concern_t *write_concern,
-                        const mongoc_read_prefs_t    *read_prefs,
-                        bson_error_t                 *error)
+static void
+_mongoc_cluster_node_io_failed (mongoc_cluster_t      *cluster,
+                                mongoc_cluster_node_t *node)
 {
-   mongoc_cluster_node_t **nodes;
-   mongoc_read_mode_t read_mode = MONGOC_READ_PRIMARY;
-   int *scores;
-   int max_score = 0;
-   uint32_t count;
-   uint32_t watermark;
-   int32_t nearest = -1;
-   bool need_primary;
-   bool need_secondary;
-   unsigned i;
-   mongoc_cluster_node_t *node = NULL;
+#ifdef _WIN32
+   bool timed_out = (errno == WSAETIMEDOUT);
+#else
+   bool timed_out = (errno == ETIMEDOUT);
+#endif
 
-   ENTRY;
+   if (timed_out && (cluster->mode == MONGOC_CLUSTER_SHARDED_CLUSTER)) {
+      MONGOC_WARNING ("%s timed out, avoiding it for %d seconds.",
+                      node->host.host_and_port,
+                      (int)(MONGOS_TIMEOUT_AVOID_USEC / (1000L * 1000L)));
+      node->avoid_until = bson_get_monotonic_time () +
+                          MONGOS_TIMEOUT_AVOID_USEC;
+   }
 
-   bson_return_val_if_fail(cluster, NULL);
-   bson_return_val_if_fail(rpcs, NULL);
-   bson_return_val_if_fail(rpcs_len, NULL);
-   bson_return_val_if_fail(hint <= cluster->nodes_len, NULL);
+   if (_mongoc_cluster_node_counters (node)) {
+      _mongoc_counter_add (node->counters->errors, 1);
+      if (timed_out) {
+         _mongoc_counter_add (node->counters->timeouts, 1);
+      }
+   }
 
-   nodes = bson_malloc(sizeof(*nodes) * cluster->nodes_len);
-   scores = bson_malloc(sizeof(*scores) * cluster->nodes_len);
+   _mongoc_cluster_node_record_failure (cluster, node, timed_out);
+}
 
-   /*
-    * We can take a few short-cut's if we are not talking to a replica set.
-    */
-   switch (cluster->mode) {
-   case MONGOC_CLUSTER_DIRECT: {
-      node = (cluster->nodes[0].stream ? &cluster->nodes[0] : NULL);
-      goto CLEANUP;
-   }
-   case MONGOC_CLUSTER_SHARDED_CLUSTER:
-      need_primary = false;
-      need_secondary = false;
-      GOTO (dispatch);
-   case MONGOC_CLUSTER_REPLICA_SET:
-   default:
-      break;
-   }
 
-   /*
-    * Determine if our read preference requires communicating with PRIMARY.
-    */
-   if (read_prefs)
-      read_mode = mongoc_read_prefs_get_mode(read_prefs);
-   need_primary = (read_mode == MONGOC_READ_PRIMARY);
-   need_secondary = (read_mode == MONGOC_READ_SECONDARY);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_close_idle --
+ *
+ *       Close the idle streams in the connection set of @node. Streams
+ *       that are checked out are closed when they are checked in, since
+ *       the generation of the set no longer matches theirs.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   /*
-    * Check to see if any RPCs require the primary. If so, we pin all
-    * of the RPCs to the primary.
-    */
-   for (i = 0; !need_primary && (i < rpcs_len); i++) {
-      switch (rpcs[i].header.opcode) {
-      case MONGOC_OPCODE_KILL_CURSORS:
-      case MONGOC_OPCODE_GET_MORE:
-      case MONGOC_OPCODE_MSG:
-      case MONGOC_OPCODE_REPLY:
-         break;
-      case MONGOC_OPCODE_QUERY:
-         if ((read_mode & MONGOC_READ_SECONDARY) != 0) {
-            rpcs[i].query.flags |= MONGOC_QUERY_SLAVE_OK;
-         } else if (!(rpcs[i].query.flags & MONGOC_QUERY_SLAVE_OK)) {
-            need_primary = true;
-         }
-         break;
-      case MONGOC_OPCODE_DELETE:
-      case MONGOC_OPCODE_INSERT:
-      case MONGOC_OPCODE_UPDATE:
-      default:
-         need_primary = true;
-         break;
-      }
-   }
+static void
+_mongoc_cluster_node_close_idle (mongoc_cluster_node_t *node)
+{
+   mongoc_cluster_conn_set_t *conns;
+   uint32_t i;
 
-dispatch:
+   BSON_ASSERT (node);
 
-   /*
-    * Build our list of nodes with established connections. Short circuit if
-    * we require a primary and we found one.
-    */
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (need_primary && cluster->nodes[i].primary) {
-         node = &cluster->nodes[i];
-         goto CLEANUP;
-      } else if (need_secondary && cluster->nodes[i].primary) {
-         nodes[i] = NULL;
-      } else {
-         nodes[i] = cluster->nodes[i].stream ? &cluster->nodes[i] : NULL;
-      }
+   if (!(conns = node->conns)) {
+      return;
    }
 
-   /*
-    * Check if we failed to locate a primary.
-    */
-   if (need_primary) {
-      bson_set_error(error,
-                     MONGOC_ERROR_CLIENT,
-                     MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                     "Requested PRIMARY node is not available.");
-      goto CLEANUP;
-   }
+   mongoc_mutex_lock (&conns->mutex);
 
-   /*
-    * Apply the hint if the client knows who they would like to continue
-    * communicating with.
-    */
-   if (hint) {
-      if (!nodes[hint - 1]) {
-         bson_set_error(error,
-                        MONGOC_ERROR_CLIENT,
-                        MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                        "Requested node (%u) is not available.",
-                        hint);
-      }
-      node = nodes[hint - 1];
-      goto CLEANUP;
+   for (i = 0; i < conns->idle_len; i++) {
+      mongoc_stream_close (conns->idle[i]);
+      mongoc_stream_destroy (conns->idle[i]);
+      conns->idle[i] = NULL;
    }
 
-   /*
-    * Now, we start removing connections that don't match the requirements of
-    * our requested event.
-    *
-    * - If read preferences are set, remove all non-matching.
-    * - If slaveOk exists and is false, then remove secondaries.
-    * - Find the nearest leftover node and remove those not within threshold.
-    * - Select a leftover node at random.
-    */
+   conns->idle_len = 0;
+   conns->generation++;
 
-   /*
-    * TODO: This whole section is ripe for optimization. It is very much
-    *       in the fast path of command dispatching.
-    */
+   mongoc_mutex_unlock (&conns->mutex);
+}
 
-   count = 0;
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (nodes[i]) {
-         if (read_prefs) {
-            int score = _mongoc_read_prefs_score(read_prefs, nodes[i]);
-            scores[i] = score;
-
-            if (score < 0) {
-               nodes[i] = NULL;
-               continue;
-            } else if (score > max_score) {
-                max_score = score;
-            }
+/*
+ * A reply that arrived on a node before the caller waiting for it asked,
+ * see _mongoc_cluster_try_recv_reply().
+ */
+typedef struct
+{
+   uint32_t  response_to;
+   size_t    len;
+   uint8_t  *data;
+} mongoc_cluster_pending_reply_t;
 
-         }
-         count++;
-      }
-   }
 
-   /*
-    * Filter nodes with score less than highest score.
-    */
-   if (max_score) {
-      for (i = 0; i < cluster->nodes_len; i++) {
-         if (nodes[i] && (scores[i] < max_score)) {
-             nodes[i] = NULL;
-             count--;
-         }
-      }
-   }
+static void
+_mongoc_cluster_pending_reply_destroy (void *data,
+                                       void *user_data)
+{
+   mongoc_cluster_pending_reply_t *pending = data;
 
-   /*
-    * Get the nearest node among those which have not been filtered out
-    */
-#define IS_NEARER_THAN(n, msec) \
-   ((msec < 0 && (n)->ping_avg_msec >= 0) || ((n)->ping_avg_msec < msec))
+   bson_free (pending->data);
+   bson_free (pending);
+}
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (nodes[i]) {
-         if (IS_NEARER_THAN(nodes[i], nearest)) {
-            nearest = nodes[i]->ping_avg_msec;
-         }
-      }
-   }
 
-#undef IS_NEARER_THAN
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_clear_pending --
+ *
+ *       Drop any pipelined replies held on @node. Called whenever the
+ *       connection they were read from goes away.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   /*
-    * Filter nodes with latency outside threshold of nearest.
-    */
-   if (nearest != -1) {
-      watermark = nearest + cluster->sec_latency_ms;
-      for (i = 0; i < cluster->nodes_len; i++) {
-         if (nodes[i]) {
-            if (nodes[i]->ping_avg_msec > (int32_t)watermark) {
-               nodes[i] = NULL;
-               count--;
-            }
-         }
-      }
-   }
+static void
+_mongoc_cluster_node_clear_pending (mongoc_cluster_node_t *node)
+{
+   BSON_ASSERT (node);
 
-   /*
-    * Mark the error as unable to locate a target node.
-    */
-   if (!count) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                      "Failed to locate a suitable MongoDB node.");
-      goto CLEANUP;
+   if (node->pending_replies) {
+      _mongoc_list_foreach (node->pending_replies,
+                            _mongoc_cluster_pending_reply_destroy, NULL);
+      _mongoc_list_destroy (node->pending_replies);
+      node->pending_replies = NULL;
    }
 
-   /*
-    * Choose a cluster node within threshold at random.
-    */
-   count = count ? rand() % count : count;
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (nodes[i]) {
-         if (!count) {
-            node = nodes[i];
-            goto CLEANUP;
-         }
-         count--;
-      }
-   }
+   node->pending_replies_len = 0;
+}
 
-CLEANUP:
 
-   bson_free(nodes);
-   bson_free(scores);
+/*
+ * A hedged query that lost the race, see _mongoc_cluster_query_hedged().
+ * Its stream stays checked out until the late reply has been read and
+ * any cursor it opened has been killed.
+ */
+typedef struct
+{
+   mongoc_stream_t *stream;
+   uint32_t         generation;
+   uint32_t         request_id;
+   int64_t          expire_at;
+} mongoc_cluster_hedge_t;
 
-   RETURN(node);
-}
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_clear_hedges --
+ *
+ *       Close the streams of hedged queries still outstanding on @node
+ *       without waiting for their replies. Must be called before the
+ *       connection set of @node is released.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-uint32_t
-_mongoc_cluster_preselect (mongoc_cluster_t             *cluster,       /* IN */
-                           mongoc_opcode_t               opcode,        /* IN */
-                           const mongoc_write_concern_t *write_concern, /* IN */
-                           const mongoc_read_prefs_t    *read_prefs,    /* IN */
-                           bson_error_t                 *error)         /* OUT */
+static void
+_mongoc_cluster_node_clear_hedges (mongoc_cluster_node_t *node)
 {
-   mongoc_cluster_node_t *node;
-   mongoc_rpc_t rpc = {{ 0 }};
-   int retry_count = 0;
-   bson_error_t scoped_error;
+   mongoc_cluster_hedge_t *hedge;
+   mongoc_list_t *iter;
 
-   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
 
-   rpc.header.opcode = opcode;
+   for (iter = node->hedges; iter; iter = iter->next) {
+      hedge = iter->data;
 
-   while (!(node = _mongoc_cluster_select (cluster, &rpc, 1, 0, write_concern,
-                                           read_prefs, &scoped_error))) {
-      if ((retry_count++ == MAX_RETRY_COUNT) ||
-          !_mongoc_cluster_reconnect (cluster, &scoped_error)) {
-         break;
+      mongoc_stream_close (hedge->stream);
+      mongoc_stream_destroy (hedge->stream);
+
+      if (node->conns) {
+         mongoc_mutex_lock (&node->conns->mutex);
+         node->conns->in_use--;
+         mongoc_mutex_unlock (&node->conns->mutex);
       }
-   }
 
-   if (!node && error) {
-      memcpy (error, &scoped_error, sizeof (scoped_error));
+      bson_free (hedge);
    }
 
-   return node ? (node->index + 1) : 0;
+   _mongoc_list_destroy (node->hedges);
+   node->hedges = NULL;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_run_command --
+ * _mongoc_cluster_node_release_conns --
  *
- *       Helper to run a command on a given mongoc_cluster_node_t.
+ *       Close the idle streams of @node and free its connection set.
+ *
+ *       Every stream checked out from the set must have been checked in
+ *       before calling this.
  *
  * Returns:
- *       true if successful; otherwise false and @error is set.
+ *       None.
  *
  * Side effects:
- *       @reply is set and should ALWAYS be released with bson_destroy().
+ *       node->conns is set to NULL.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_run_command (mongoc_cluster_t      *cluster,
-                             mongoc_cluster_node_t *node,
-                             const char            *db_name,
-                             const bson_t          *command,
-                             bson_t                *reply,
-                             bson_error_t          *error)
+static void
+_mongoc_cluster_node_release_conns (mongoc_cluster_node_t *node)
 {
-   mongoc_buffer_t buffer;
-   mongoc_array_t ar;
-   mongoc_rpc_t rpc;
-   int32_t msg_len;
-   bson_t reply_local;
-   char ns[MONGOC_NAMESPACE_MAX];
-
-   ENTRY;
-
-   BSON_ASSERT(cluster);
-   BSON_ASSERT(node);
-   BSON_ASSERT(node->stream);
-   BSON_ASSERT(db_name);
-   BSON_ASSERT(command);
-
-   bson_snprintf(ns, sizeof ns, "%s.$cmd", db_name);
-
-   rpc.query.msg_len = 0;
-   rpc.query.request_id = ++cluster->request_id;
-   rpc.query.response_to = 0;
-   rpc.query.opcode = MONGOC_OPCODE_QUERY;
-   rpc.query.flags = MONGOC_QUERY_SLAVE_OK;
-   rpc.query.collection = ns;
-   rpc.query.skip = 0;
-   rpc.query.n_return = -1;
-   rpc.query.query = bson_get_data(command);
-   rpc.query.fields = NULL;
-
-   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
-   _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
-
-   _mongoc_rpc_gather(&rpc, &ar);
-   _mongoc_rpc_swab_to_le(&rpc);
-
-   DUMP_IOVEC (((mongoc_iovec_t *)ar.data), ((mongoc_iovec_t *)ar.data), ar.len);
-   if (!mongoc_stream_writev(node->stream, ar.data, ar.len,
-                             cluster->sockettimeoutms)) {
-      GOTO(failure);
-   }
-
-   if (!_mongoc_buffer_append_from_stream(&buffer, node->stream, 4,
-                                          cluster->sockettimeoutms, error)) {
-      GOTO(failure);
-   }
-
-   BSON_ASSERT(buffer.len == 4);
+   BSON_ASSERT (node);
 
-   memcpy(&msg_len, buffer.data, 4);
-   msg_len = BSON_UINT32_FROM_LE(msg_len);
-   if ((msg_len < 16) || (msg_len > (1024 * 1024 * 16))) {
-      GOTO(invalid_reply);
+   if (node->conns) {
+      _mongoc_cluster_node_close_idle (node);
+      mongoc_mutex_destroy (&node->conns->mutex);
+      bson_free (node->conns->idle);
+      bson_free (node->conns);
+      node->conns = NULL;
    }
+}
 
-   if (!_mongoc_buffer_append_from_stream(&buffer, node->stream, msg_len - 4,
-                                          cluster->sockettimeoutms, error)) {
-      GOTO(failure);
-   }
 
-   if (!_mongoc_rpc_scatter(&rpc, buffer.data, buffer.len)) {
-      GOTO(invalid_reply);
-   }
-   DUMP_BYTES (&buffer, buffer.data + buffer.off, buffer.len);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_node_destroy --
+ *
+ *       Destroy allocated resources within @node.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   _mongoc_rpc_swab_from_le(&rpc);
+static void
+_mongoc_cluster_node_destroy (mongoc_cluster_node_t *node)
+{
+   ENTRY;
 
-   if (rpc.header.opcode != MONGOC_OPCODE_REPLY) {
-      GOTO(invalid_reply);
-   }
+   BSON_ASSERT(node);
 
-   if (reply) {
-      if (!_mongoc_rpc_reply_get_first(&rpc.reply, &reply_local)) {
-         bson_set_error (error,
-                         MONGOC_ERROR_BSON,
-                         MONGOC_ERROR_BSON_INVALID,
-                         "Failed to decode reply BSON document.");
-         GOTO(failure);
-      }
-      bson_copy_to(&reply_local, reply);
-      bson_destroy(&reply_local);
+   if (node->stream) {
+      mongoc_stream_close(node->stream);
+      mongoc_stream_destroy(node->stream);
+      node->stream = NULL;
    }
 
-   _mongoc_buffer_destroy(&buffer);
-   _mongoc_array_destroy(&ar);
-
-   RETURN(true);
-
-invalid_reply:
-   bson_set_error(error,
-                  MONGOC_ERROR_PROTOCOL,
-                  MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                  "Invalid reply from server.");
+   node->lazy = 0;
 
-failure:
-   _mongoc_buffer_destroy(&buffer);
-   _mongoc_array_destroy(&ar);
+   _mongoc_cluster_node_clear_hedges (node);
+   _mongoc_cluster_node_release_conns (node);
+   _mongoc_cluster_node_clear_pending (node);
+   _mongoc_cluster_node_release_slot (node, 0, false);
 
-   if (reply) {
-      bson_init(reply);
+   if (node->tags.len) {
+      bson_destroy (&node->tags);
+      memset (&node->tags, 0, sizeof node->tags);
    }
 
-   _mongoc_cluster_disconnect_node(cluster, node);
+   bson_free (node->replSet);
+   node->replSet = NULL;
 
-   RETURN(false);
+   EXIT;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_ismaster --
+ * mongoc_cluster_build_basic_auth_digest --
  *
- *       Executes an isMaster command on a given mongoc_cluster_node_t.
+ *       Computes the Basic Authentication digest using the credentials
+ *       configured for @cluster and the @nonce provided.
  *
- *       node->primary will be set to true if the node is discovered to
- *       be a primary node.
+ *       The result should be freed by the caller using bson_free() when
+ *       they are finished with it.
  *
  * Returns:
- *       true if successful; otehrwise false and @error is set.
+ *       A newly allocated string containing the digest.
  *
  * Side effects:
  *       None.
@@ -1029,902 +1178,1078 @@ failure:
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_ismaster (mongoc_cluster_t      *cluster,
-                          mongoc_cluster_node_t *node,
-                          bson_error_t          *error)
+static char *
+_mongoc_cluster_build_basic_auth_digest (mongoc_cluster_t *cluster,
+                                         const char       *nonce)
 {
-   int32_t v32;
-   bool ret = false;
-   bson_iter_t child;
-   bson_iter_t iter;
-   bson_t command;
-   bson_t reply;
+   const char *username;
+   const char *password;
+   char *password_digest;
+   char *password_md5;
+   char *digest_in;
+   char *ret;
 
    ENTRY;
 
+   /*
+    * The following generates the digest to be used for basic authentication
+    * with a MongoDB server. More information on the format can be found
+    * at the following location:
+    *
+    * http://docs.mongodb.org/meta-driver/latest/legacy/
+    *   implement-authentication-in-driver/
+    */
+
    BSON_ASSERT(cluster);
-   BSON_ASSERT(node);
-   BSON_ASSERT(node->stream);
+   BSON_ASSERT(cluster->uri);
 
-   bson_init(&command);
-   bson_append_int32(&command, "isMaster", 8, 1);
+   username = mongoc_uri_get_username(cluster->uri);
+   password = mongoc_uri_get_password(cluster->uri);
+   password_digest = bson_strdup_printf("%s:mongo:%s", username, password);
+   password_md5 = _mongoc_hex_md5(password_digest);
+   digest_in = bson_strdup_printf("%s%s%s", nonce, username, password_md5);
+   ret = _mongoc_hex_md5(digest_in);
+   bson_free(digest_in);
+   bson_free(password_md5);
+   bson_free(password_digest);
 
-   if (!_mongoc_cluster_run_command (cluster, node, "admin", &command, &reply,
-                                     error)) {
-      _mongoc_cluster_disconnect_node (cluster, node);
-      GOTO (failure);
-   }
+   RETURN(ret);
+}
 
-   node->primary = false;
 
-   bson_free (node->replSet);
-   node->replSet = NULL;
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_disconnect_node --
+ *
+ *       Disconnects a cluster node and reinitializes it so it may be
+ *       connected to again in the future.
+ *
+ *       The stream is closed and destroyed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (bson_iter_init_find_case (&iter, &reply, "isMaster") &&
-       BSON_ITER_HOLDS_BOOL (&iter) &&
-       bson_iter_bool (&iter)) {
-      node->primary = true;
-   }
+void
+_mongoc_cluster_disconnect_node (mongoc_cluster_t      *cluster,
+                                 mongoc_cluster_node_t *node)
+{
+   ENTRY;
 
-   if (bson_iter_init_find_case(&iter, &reply, "maxMessageSizeBytes")) {
-      v32 = bson_iter_int32(&iter);
-      if (!cluster->max_msg_size || (v32 < (int32_t)cluster->max_msg_size)) {
-         cluster->max_msg_size = v32;
-      }
-   }
+   bson_return_if_fail(node);
 
-   if (bson_iter_init_find_case(&iter, &reply, "maxBsonObjectSize")) {
-      v32 = bson_iter_int32(&iter);
-	  if (!cluster->max_bson_size || (v32 < (int32_t)cluster->max_bson_size)) {
-         cluster->max_bson_size = v32;
-      }
+   if (node->stream) {
+      mongoc_stream_close(node->stream);
+      mongoc_stream_destroy(node->stream);
+      node->stream = NULL;
    }
 
-   if (bson_iter_init_find_case (&iter, &reply, "maxWriteBatchSize")) {
-      v32 = bson_iter_int32 (&iter);
-      node->max_write_batch_size = v32;
-   }
+   _mongoc_cluster_node_clear_hedges (node);
+   _mongoc_cluster_node_close_idle (node);
+   _mongoc_cluster_node_clear_pending (node);
 
-   if (bson_iter_init_find_case(&iter, &reply, "maxWireVersion") &&
-       BSON_ITER_HOLDS_INT32(&iter)) {
-      node->max_wire_version = bson_iter_int32(&iter);
-   }
+   /* the reply to the operation in flight, if any, is lost with it */
+   _mongoc_cluster_node_release_slot (node, 0, true);
 
-   if (bson_iter_init_find_case(&iter, &reply, "minWireVersion") &&
-       BSON_ITER_HOLDS_INT32(&iter)) {
-      node->min_wire_version = bson_iter_int32(&iter);
-   }
+   node->needs_auth = cluster->requires_auth;
+   node->ping_avg_msec = -1;
+   node->rtt_msec = -1;
+   node->op_latency_msec = -1;
+   node->op_started = 0;
+   node->stamp++;
+   node->primary = 0;
+   node->lazy = 0;
+   node->compressed = 0;
 
-   if ((node->min_wire_version > MAX_WIRE_VERSION) ||
-       (node->max_wire_version < MIN_WIRE_VERSION)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_BAD_WIRE_VERSION,
-                      "Failed to negotiate wire version with "
-                      "cluster peer. %s is [%u,%u]. I support "
-                      "[%u,%u].",
-                      node->host.host_and_port,
-                      node->min_wire_version,
-                      node->max_wire_version,
-                      MIN_WIRE_VERSION,
-                      MAX_WIRE_VERSION);
-      GOTO (failure);
-   }
+   bson_destroy (&node->tags);
+   bson_init (&node->tags);
+   _mongoc_cluster_node_reset_tag_sets (node);
 
-   if (bson_iter_init_find (&iter, &reply, "msg") &&
-       BSON_ITER_HOLDS_UTF8 (&iter) &&
-       (0 == strcasecmp ("isdbgrid", bson_iter_utf8 (&iter, NULL)))) {
-      node->isdbgrid = true;
-      if (cluster->mode != MONGOC_CLUSTER_SHARDED_CLUSTER) {
-         MONGOC_INFO ("Unexpectedly connected to sharded cluster: %s",
-                      node->host.host_and_port);
-      }
-   } else {
-      node->isdbgrid = false;
-   }
+   _mongoc_cluster_update_state (cluster);
 
-   /*
-    * If we are in replicaSet mode, we need to track our potential peers for
-    * further connections.
-    */
-   if (cluster->mode == MONGOC_CLUSTER_REPLICA_SET) {
-      if (bson_iter_init_find (&iter, &reply, "hosts") &&
-          bson_iter_recurse (&iter, &child)) {
-         if (node->primary) {
-            _mongoc_cluster_clear_peers (cluster);
-         }
-         while (bson_iter_next (&child) && BSON_ITER_HOLDS_UTF8 (&child)) {
-            _mongoc_cluster_add_peer (cluster, bson_iter_utf8(&child, NULL));
-         }
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reset_after_fork --
+ *
+ *       Let go of the connections @cluster inherited from the parent
+ *       process without sending anything on them, see
+ *       _mongoc_stream_abandon(). The nodes, their breakers and counters
+ *       are kept, and the next operation connects again.
+ *
+ *       Cursors queued to be killed belong to the parent and are
+ *       forgotten. A private topology monitor is restarted, since its
+ *       thread did not survive the fork; a monitor shared with a pool is
+ *       reset by the pool.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Must be called in the child before any other thread uses
+ *       @cluster.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_reset_after_fork (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_hedge_t *hedge;
+   mongoc_cluster_node_t *node;
+   mongoc_list_t *iter;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+
+      if (node->stream) {
+         _mongoc_stream_abandon (node->stream);
+         node->stream = NULL;
       }
-      if (bson_iter_init_find(&iter, &reply, "setName") &&
-          BSON_ITER_HOLDS_UTF8(&iter)) {
-         node->replSet = bson_iter_dup_utf8(&iter, NULL);
+
+      for (iter = node->hedges; iter; iter = iter->next) {
+         hedge = iter->data;
+         _mongoc_stream_abandon (hedge->stream);
+         bson_free (hedge);
       }
-      if (bson_iter_init_find(&iter, &reply, "tags") &&
-          BSON_ITER_HOLDS_DOCUMENT(&iter)) {
-          bson_t tags;
-          uint32_t len;
-          const uint8_t *data;
 
-          bson_iter_document(&iter, &len, &data);
+      _mongoc_list_destroy (node->hedges);
+      node->hedges = NULL;
 
-          if (bson_init_static(&tags, data, len)) {
-              bson_copy_to(&tags, &(node->tags));
-          }
+      /* the pool forgets what was in flight in the parent, see
+       * _mongoc_node_limiter_reset_after_fork() */
+      node->limit_slot = NULL;
+
+      /*
+       * The lock may have been held by a thread that does not exist here,
+       * and streams checked out by such threads are never checked in.
+       */
+      if (node->conns) {
+         mongoc_mutex_init (&node->conns->mutex);
+
+         for (j = 0; j < node->conns->idle_len; j++) {
+            _mongoc_stream_abandon (node->conns->idle[j]);
+            node->conns->idle[j] = NULL;
+         }
+
+         node->conns->idle_len = 0;
+         node->conns->in_use = 0;
+         node->conns->generation++;
       }
+
+      _mongoc_cluster_disconnect_node (cluster, node);
    }
 
-   ret = true;
+   cluster->dead_cursors.len = 0;
 
-failure:
-   bson_destroy(&command);
-   bson_destroy(&reply);
+   if (cluster->monitor && !cluster->monitor->shared) {
+      _mongoc_cluster_monitor_reset_after_fork (cluster->monitor,
+                                                cluster->uri,
+                                                cluster->client);
+   }
 
-   RETURN(ret);
+   _mongoc_cluster_topology_changed (cluster);
+
+   EXIT;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_ping_node --
+ * _mongoc_cluster_init_compressor --
  *
- *       Ping a remote node and return the round-trip latency.
+ *       Pick the first compressor in the comma separated list
+ *       @compressors that this build supports. It is offered to every node
+ *       in "isMaster", and used with the nodes that accept it.
  *
  * Returns:
- *       A 32-bit integer counting the number of milliseconds to complete.
- *       -1 if there was a failure to communicate.
+ *       None.
  *
  * Side effects:
- *       @error is set of -1 is returned.
+ *       A warning is logged for each compressor that is not supported.
  *
  *--------------------------------------------------------------------------
  */
 
-static int32_t
-_mongoc_cluster_ping_node (mongoc_cluster_t      *cluster,
-                           mongoc_cluster_node_t *node,
-                           bson_error_t          *error)
+static void
+_mongoc_cluster_init_compressor (mongoc_cluster_t *cluster,
+                                 const char       *compressors)
 {
-   int64_t t_begin;
-   int64_t t_end;
-   int32_t ret;
-   bool r;
-   bson_t cmd;
-
-   ENTRY;
+   const char *end;
+   char *name;
 
-   BSON_ASSERT(cluster);
-   BSON_ASSERT(node);
-   BSON_ASSERT(node->stream);
+   while (*compressors) {
+      if (!(end = strchr (compressors, ','))) {
+         end = compressors + strlen (compressors);
+      }
 
-   bson_init(&cmd);
-   bson_append_int32(&cmd, "ping", 4, 1);
+      name = bson_strndup (compressors, end - compressors);
+      compressors = *end ? end + 1 : end;
 
-   t_begin = bson_get_monotonic_time ();
-   r = _mongoc_cluster_run_command (cluster, node, "admin", &cmd, NULL, error);
-   t_end = bson_get_monotonic_time ();
+      if (!*name) {
+         bson_free (name);
+         continue;
+      }
 
-   bson_destroy(&cmd);
+      cluster->compressor_id = _mongoc_compressor_name_to_id (name);
 
-   ret = r ? (int32_t) ((t_end - t_begin) / 1000L) : -1;
+      if (cluster->compressor_id != MONGOC_COMPRESSOR_NONE_ID) {
+         _mongoc_buffer_init (&cluster->compress_in, NULL, 0, NULL, NULL);
+         _mongoc_buffer_init (&cluster->compress_out, NULL, 0, NULL, NULL);
+         bson_free (name);
+         break;
+      }
 
-   RETURN(ret);
+      MONGOC_WARNING ("Unsupported compressor \"%s\"", name);
+      bson_free (name);
+   }
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_auth_node_cr --
- *
- *       Performs authentication of @node using the credentials provided
- *       when configuring the @cluster instance.
+ * _mongoc_cluster_init --
  *
- *       This is the Challenge-Response mode of authentication.
+ *       Initializes @cluster using the @uri and @client provided. The
+ *       @uri is used to determine the "mode" of the cluster. Based on the
+ *       uri we can determine if we are connected to a single host, a
+ *       replicaSet, or a shardedCluster.
  *
  * Returns:
- *       true if authentication was successful; otherwise false and
- *       @error is set.
+ *       None.
  *
  * Side effects:
- *       None.
+ *       @cluster is initialized.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_auth_node_cr (mongoc_cluster_t      *cluster,
-                              mongoc_cluster_node_t *node,
-                              bson_error_t          *error)
+void
+_mongoc_cluster_init (mongoc_cluster_t   *cluster,
+                      const mongoc_uri_t *uri,
+                      void               *client)
 {
+   const mongoc_host_list_t *hosts;
+   const mongoc_host_list_t *host_iter;
+   uint32_t sockettimeoutms = MONGOC_DEFAULT_SOCKETTIMEOUTMS;
+   uint32_t i;
+   const bson_t *b;
    bson_iter_t iter;
-   const char *auth_source;
-   bson_t command = { 0 };
-   bson_t reply = { 0 };
-   char *digest;
-   char *nonce;
 
    ENTRY;
 
-   BSON_ASSERT(cluster);
-   BSON_ASSERT(node);
+   bson_return_if_fail (cluster);
+   bson_return_if_fail (uri);
 
-   if (!(auth_source = mongoc_uri_get_auth_source(cluster->uri)) ||
-       (*auth_source == '\0')) {
-      auth_source = "admin";
-   }
+   memset (cluster, 0, sizeof *cluster);
 
-   /*
-    * To authenticate a node using basic authentication, we need to first
-    * get the nonce from the server. We use that to hash our password which
-    * is sent as a reply to the server. If everything went good we get a
-    * success notification back from the server.
-    */
+   b = mongoc_uri_get_options(uri);
+   hosts = mongoc_uri_get_hosts(uri);
 
-   /*
-    * Execute the getnonce command to fetch the nonce used for generating
-    * md5 digest of our password information.
-    */
-   bson_init (&command);
-   bson_append_int32 (&command, "getnonce", 8, 1);
-   if (!_mongoc_cluster_run_command (cluster, node, auth_source, &command,
-                                     &reply, error)) {
-      bson_destroy (&command);
-      RETURN (false);
-   }
-   bson_destroy (&command);
-   if (!bson_iter_init_find_case (&iter, &reply, "nonce")) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_GETNONCE,
-                      "Invalid reply from getnonce");
-      bson_destroy (&reply);
-      RETURN (false);
+   if (bson_iter_init_find_case (&iter, b, "replicaSet")) {
+      cluster->mode = MONGOC_CLUSTER_REPLICA_SET;
+      cluster->replSet = bson_iter_dup_utf8 (&iter, NULL);
+      MONGOC_DEBUG ("Client initialized in replica set mode.");
+   } else if (hosts->next) {
+      cluster->mode = MONGOC_CLUSTER_SHARDED_CLUSTER;
+      MONGOC_DEBUG ("Client initialized in sharded cluster mode.");
+   } else {
+      cluster->mode = MONGOC_CLUSTER_DIRECT;
+      MONGOC_DEBUG ("Client initialized in direct mode.");
    }
 
-   /*
-    * Build our command to perform the authentication.
-    */
-   nonce = bson_iter_dup_utf8(&iter, NULL);
-   digest = _mongoc_cluster_build_basic_auth_digest(cluster, nonce);
-   bson_init(&command);
-   bson_append_int32(&command, "authenticate", 12, 1);
-   bson_append_utf8(&command, "user", 4,
-                    mongoc_uri_get_username(cluster->uri), -1);
-   bson_append_utf8(&command, "nonce", 5, nonce, -1);
-   bson_append_utf8(&command, "key", 3, digest, -1);
-   bson_destroy(&reply);
-   bson_free(nonce);
-   bson_free(digest);
+   if (bson_iter_init_find_case(&iter, b, "sockettimeoutms")) {
+      if (!(sockettimeoutms = bson_iter_int32 (&iter))) {
+         sockettimeoutms = MONGOC_DEFAULT_SOCKETTIMEOUTMS;
+      }
+   }
 
-   /*
-    * Execute the authenticate command and check for {ok:1}
-    */
-   if (!_mongoc_cluster_run_command (cluster, node, auth_source, &command,
-                                     &reply, error)) {
-      bson_destroy (&command);
-      RETURN (false);
+   cluster->connecttimeoutms = MONGOC_DEFAULT_CONNECTTIMEOUTMS;
+
+   if (bson_iter_init_find_case (&iter, b, "connecttimeoutms") &&
+       BSON_ITER_HOLDS_INT32 (&iter) &&
+       bson_iter_int32 (&iter) > 0) {
+      cluster->connecttimeoutms = bson_iter_int32 (&iter);
    }
 
-   bson_destroy (&command);
+   if (bson_iter_init_find_case (&iter, b, "serverselectiontimeoutms") &&
+       BSON_ITER_HOLDS_INT32 (&iter) &&
+       bson_iter_int32 (&iter) > 0) {
+      cluster->serverselectiontimeoutms = bson_iter_int32 (&iter);
+   }
 
-   if (!bson_iter_init_find_case(&iter, &reply, "ok") ||
-       !bson_iter_as_bool(&iter)) {
-      bson_set_error(error,
-                     MONGOC_ERROR_CLIENT,
-                     MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                     "Failed to authenticate credentials.");
-      bson_destroy(&reply);
-      RETURN(false);
+   cluster->uri = mongoc_uri_copy(uri);
+   cluster->client = client;
+   cluster->sec_latency_ms = 15;
+   cluster->max_msg_size = 1024 * 1024 * 48;
+   cluster->max_bson_size = 1024 * 1024 * 16;
+   cluster->requires_auth = (mongoc_uri_get_username (uri) ||
+                             mongoc_uri_get_auth_mechanism (uri));
+   cluster->sockettimeoutms = sockettimeoutms;
+   cluster->topology_version = 1;
+
+   if (bson_iter_init_find_case(&iter, b, "heartbeatfrequencyms") &&
+       BSON_ITER_HOLDS_INT32(&iter) &&
+       bson_iter_int32(&iter) > 0) {
+      cluster->heartbeat_frequency_msec = bson_iter_int32(&iter);
    }
 
-   bson_destroy(&reply);
+   if (bson_iter_init_find_case(&iter, b, "localthresholdms") &&
+       BSON_ITER_HOLDS_INT32(&iter) &&
+       bson_iter_int32(&iter) >= 0) {
+      cluster->sec_latency_ms = bson_iter_int32(&iter);
+   } else if (bson_iter_init_find_case(&iter, b,
+                                       "secondaryacceptablelatencyms") &&
+              BSON_ITER_HOLDS_INT32(&iter)) {
+      cluster->sec_latency_ms = bson_iter_int32(&iter);
+   }
 
-   RETURN(true);
+   if (bson_iter_init_find_case(&iter, b, "trackoperationlatency") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->track_op_latency = bson_iter_bool(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "lazyconnect") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->lazy_connect = bson_iter_bool(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "standbyconnections") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->standby_connections = bson_iter_bool(&iter);
+   }
+
+   cluster->max_conns_per_node = 1;
+
+   if (bson_iter_init_find_case(&iter, b, "maxconnectionspernode") &&
+       BSON_ITER_HOLDS_INT32(&iter) &&
+       bson_iter_int32(&iter) > 1) {
+      cluster->max_conns_per_node = bson_iter_int32(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "hedgedreads") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->hedged_reads = bson_iter_bool(&iter);
+   }
+
+   cluster->retry_reads = true;
+   cluster->retry_writes = true;
+
+   if (bson_iter_init_find_case(&iter, b, "retryreads") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->retry_reads = bson_iter_bool(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "retrywrites") &&
+       BSON_ITER_HOLDS_BOOL(&iter)) {
+      cluster->retry_writes = bson_iter_bool(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "hedgedelayms") &&
+       BSON_ITER_HOLDS_INT32(&iter) &&
+       bson_iter_int32(&iter) > 0) {
+      cluster->hedge_delay_msec = bson_iter_int32(&iter);
+   }
+
+   cluster->compressor_id = MONGOC_COMPRESSOR_NONE_ID;
+   cluster->compression_level = -1;
+
+   if (bson_iter_init_find_case(&iter, b, "compressors") &&
+       BSON_ITER_HOLDS_UTF8(&iter)) {
+      _mongoc_cluster_init_compressor (cluster, bson_iter_utf8(&iter, NULL));
+   }
+
+   if (bson_iter_init_find_case(&iter, b, "zlibcompressionlevel") &&
+       BSON_ITER_HOLDS_INT32(&iter) &&
+       bson_iter_int32(&iter) >= -1 &&
+       bson_iter_int32(&iter) <= 9) {
+      cluster->compression_level = bson_iter_int32(&iter);
+   }
+
+   if (cluster->mode == MONGOC_CLUSTER_DIRECT) {
+      i = 1;
+   } else {
+      for (host_iter = hosts, i = 0; host_iter; host_iter = host_iter->next, i++) {}
+   }
+
+   cluster->nodes = bson_malloc(i * sizeof(*cluster->nodes));
+   cluster->nodes_len = i;
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      _mongoc_cluster_node_init(&cluster->nodes[i]);
+      cluster->nodes[i].stamp = 0;
+      cluster->nodes[i].index = i;
+      cluster->nodes[i].ping_avg_msec = -1;
+      cluster->nodes[i].needs_auth = cluster->requires_auth;
+   }
+
+   _mongoc_array_init (&cluster->iov, sizeof (mongoc_iovec_t));
+   cluster->iov_bytes_counted = cluster->iov.allocated;
+   mongoc_counter_memory_cluster_iov_add (cluster->iov_bytes_counted);
+   _mongoc_array_init (&cluster->gle_cache, sizeof (mongoc_cluster_gle_t *));
+   _mongoc_array_init (&cluster->dead_cursors,
+                       sizeof (mongoc_cluster_dead_cursor_t));
+   _mongoc_array_init (&cluster->kill_ids, sizeof (int64_t));
+   _mongoc_array_init (&cluster->apm_ops, sizeof (mongoc_cluster_apm_op_t));
+
+   EXIT;
 }
 
 
-#ifdef MONGOC_ENABLE_SASL
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_get_canonicalized_name --
- *
- *       Query the node to get the canonicalized name. This may happen if
- *       the node has been accessed via an alias.
- *
- *       The gssapi code will use this if canonicalizeHostname is true.
+ * _mongoc_cluster_destroy --
  *
- *       Some underlying layers of krb might do this for us, but they can
- *       be disabled in krb.conf.
+ *       Clean up after @cluster and destroy all active connections.
+ *       All resources for @cluster are released.
  *
  * Returns:
  *       None.
  *
  * Side effects:
- *       None.
+ *       Everything.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_get_canonicalized_name (mongoc_cluster_t      *cluster, /* IN */
-                                        mongoc_cluster_node_t *node,    /* IN */
-                                        char                  *name,    /* OUT */
-                                        size_t                 namelen, /* IN */
-                                        bson_error_t          *error)   /* OUT */
+void
+_mongoc_cluster_destroy (mongoc_cluster_t *cluster) /* INOUT */
 {
-   mongoc_stream_t *stream;
-   mongoc_stream_t *tmp;
-   mongoc_socket_t *sock = NULL;
-   char *canonicalized;
+   uint32_t i;
 
    ENTRY;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
-   BSON_ASSERT (name);
+   bson_return_if_fail (cluster);
 
-   /*
-    * Find the underlying socket used in the stream chain.
-    */
-   for (stream = node->stream; stream;) {
-      if ((tmp = mongoc_stream_get_base_stream (stream))) {
-         stream = tmp;
-         continue;
+   if (cluster->monitor) {
+      /* the cluster of a pooled client */
+      if (cluster->monitor->shared) {
+         _mongoc_cluster_monitor_client_removed (cluster->monitor);
       }
-      break;
+
+      _mongoc_cluster_monitor_unref (cluster->monitor);
+      cluster->monitor = NULL;
    }
 
-   BSON_ASSERT (stream);
+   mongoc_uri_destroy (cluster->uri);
 
-   if (stream->type == MONGOC_STREAM_SOCKET) {
-      sock = mongoc_stream_socket_get_socket ((mongoc_stream_socket_t *)stream);
-      if (sock) {
-         canonicalized = mongoc_socket_getnameinfo (sock);
-         if (canonicalized) {
-            bson_snprintf (name, namelen, "%s", canonicalized);
-            bson_free (canonicalized);
-            RETURN (true);
-         }
+   for (i = 0; i < cluster->nodes_len; i++) {
+      if (cluster->nodes[i].stream || cluster->nodes[i].conns ||
+          cluster->nodes[i].lazy) {
+         _mongoc_cluster_node_destroy (&cluster->nodes [i]);
       }
    }
 
-   RETURN (false);
+   bson_free (cluster->nodes);
+
+   bson_free (cluster->replSet);
+   cluster->replSet = NULL;
+
+   _mongoc_cluster_clear_peers (cluster);
+
+   for (i = 0; i < MONGOC_CLUSTER_SELECT_CACHE_SIZE; i++) {
+      if (cluster->select_cache[i].topology_version) {
+         bson_destroy (&cluster->select_cache[i].tags);
+      }
+      bson_free (cluster->select_cache[i].eligible);
+   }
+
+   bson_free (cluster->select_scores);
+
+   for (i = 0; i < cluster->tag_sets_len; i++) {
+      bson_destroy (cluster->tag_sets[i]);
+   }
+
+   mongoc_counter_memory_cluster_iov_add (-(int64_t)cluster->iov_bytes_counted);
+   _mongoc_array_destroy (&cluster->iov);
+   _mongoc_cluster_clear_gle_cache (cluster);
+   _mongoc_array_destroy (&cluster->gle_cache);
+   bson_free (cluster->gle_headers);
+   _mongoc_array_destroy (&cluster->dead_cursors);
+   _mongoc_array_destroy (&cluster->kill_ids);
+   _mongoc_array_destroy (&cluster->apm_ops);
+   bson_free (cluster->slow_ops);
+   _mongoc_buffer_destroy (&cluster->compress_in);
+   _mongoc_buffer_destroy (&cluster->compress_out);
+
+   EXIT;
 }
-#endif
 
 
-#ifdef MONGOC_ENABLE_SASL
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_auth_node_sasl --
+ * _mongoc_cluster_select_reserve --
  *
- *       Perform authentication for a cluster node using SASL. This is
- *       only supported for GSSAPI at the moment.
+ *       Make sure the per-cluster scratch storage used by server
+ *       selection can hold every node in @cluster. This only allocates
+ *       when the topology grows beyond anything seen before.
  *
  * Returns:
- *       true if successful; otherwise false and @error is set.
+ *       None.
  *
  * Side effects:
- *       error may be set.
+ *       None.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_auth_node_sasl (mongoc_cluster_t      *cluster,
-                                mongoc_cluster_node_t *node,
-                                bson_error_t          *error)
+static void
+_mongoc_cluster_select_reserve (mongoc_cluster_t *cluster)
 {
-   uint32_t buflen = 0;
-   mongoc_sasl_t sasl;
-   const bson_t *options;
-   bson_iter_t iter;
-   bool ret = false;
-   char real_name [BSON_HOST_NAME_MAX + 1];
-   const char *service_name;
-   const char *mechanism;
-   const char *tmpstr;
-   uint8_t buf[4096] = { 0 };
-   bson_t cmd;
-   bson_t reply;
-   int conv_id = 0;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
+   uint32_t i;
 
-   options = mongoc_uri_get_options (cluster->uri);
+   if (cluster->nodes_len <= cluster->select_capacity) {
+      return;
+   }
 
-   _mongoc_sasl_init (&sasl);
+   cluster->select_capacity = cluster->nodes_len;
+   cluster->select_scores =
+      bson_realloc (cluster->select_scores,
+                    sizeof (int) * cluster->select_capacity);
 
-   if ((mechanism = mongoc_uri_get_auth_mechanism (cluster->uri))) {
-      _mongoc_sasl_set_mechanism (&sasl, mechanism);
+   for (i = 0; i < MONGOC_CLUSTER_SELECT_CACHE_SIZE; i++) {
+      cluster->select_cache[i].eligible =
+         bson_realloc (cluster->select_cache[i].eligible,
+                       sizeof (uint32_t) * cluster->select_capacity);
    }
+}
 
-   if (bson_iter_init_find_case (&iter, options, "gssapiservicename") &&
-       BSON_ITER_HOLDS_UTF8 (&iter) &&
-       (service_name = bson_iter_utf8 (&iter, NULL))) {
-      _mongoc_sasl_set_service_name (&sasl, service_name);
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_update_staleness --
+ *
+ *       Estimate how far each secondary of @cluster has fallen behind,
+ *       from the lastWrite dates the nodes reported in isMaster.
+ *
+ *       When the primary is known, the staleness of a secondary is how
+ *       much further its last write lags behind the time we checked it
+ *       than the primary's does. Otherwise it is measured against the
+ *       secondary with the most recent write. Either way, a heartbeat is
+ *       added for the writes that may have happened since the check.
+ *
+ *       node->staleness_msec is -1 if the staleness of a node is unknown.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_update_staleness (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_node_t *primary = NULL;
+   mongoc_cluster_node_t *node;
+   int64_t max_last_write = 0;
+   uint32_t i;
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+
+      if (!node->last_write_date) {
+         continue;
+      }
+
+      if (node->primary) {
+         primary = node;
+      } else if (node->last_write_date > max_last_write) {
+         max_last_write = node->last_write_date;
+      }
    }
 
-   _mongoc_sasl_set_pass (&sasl, mongoc_uri_get_password (cluster->uri));
-   _mongoc_sasl_set_user (&sasl, mongoc_uri_get_username (cluster->uri));
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+      node->staleness_msec = -1;
 
-   /*
-    * If the URI requested canonicalizeHostname, we need to resolve the real
-    * hostname for the IP Address and pass that to the SASL layer. Some
-    * underlying GSSAPI layers will do this for us, but can be disabled in
-    * their config (krb.conf).
-    *
-    * This allows the consumer to specify canonicalizeHostname=true in the URI
-    * and have us do that for them.
-    *
-    * See CDRIVER-323 for more information.
-    */
-   if (bson_iter_init_find_case (&iter, options, "canonicalizeHostname") &&
-       BSON_ITER_HOLDS_BOOL (&iter) &&
-       bson_iter_bool (&iter)) {
-      if (_mongoc_cluster_get_canonicalized_name (cluster, node, real_name,
-                                                  sizeof real_name, error)) {
-         _mongoc_sasl_set_service_host (&sasl, real_name);
+      if (node->primary || !node->last_write_date) {
+         continue;
+      }
+
+      if (primary) {
+         node->staleness_msec =
+            (node->last_update_msec - node->last_write_date) -
+            (primary->last_update_msec - primary->last_write_date) +
+            cluster->heartbeat_frequency_msec;
       } else {
-         _mongoc_sasl_set_service_host (&sasl, node->host.host);
+         node->staleness_msec = max_last_write - node->last_write_date +
+                                cluster->heartbeat_frequency_msec;
       }
-   } else {
-      _mongoc_sasl_set_service_host (&sasl, node->host.host);
    }
+}
 
-   for (;;) {
-      if (!_mongoc_sasl_step (&sasl, buf, buflen, buf, sizeof buf, &buflen, error)) {
-         goto failure;
-      }
 
-      bson_init (&cmd);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_intern_tag_sets --
+ *
+ *       Look up each tag set of @read_tags in the tag sets of @cluster,
+ *       adding those seen for the first time, and store their positions
+ *       in @ids in order of preference.
+ *
+ * Returns:
+ *       The number of tag sets stored in @ids, or -1 if there are more
+ *       than MONGOC_CLUSTER_TAG_SETS_MAX of them, in which case the nodes
+ *       must be scored from their BSON tags instead.
+ *
+ * Side effects:
+ *       New tag sets are copied into @cluster.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-      if (sasl.step == 1) {
-         BSON_APPEND_INT32 (&cmd, "saslStart", 1);
-         BSON_APPEND_UTF8 (&cmd, "mechanism", mechanism ? mechanism : "GSSAPI");
-         bson_append_utf8 (&cmd, "payload", 7, (const char *)buf, buflen);
-         BSON_APPEND_INT32 (&cmd, "autoAuthorize", 1);
-      } else {
-         BSON_APPEND_INT32 (&cmd, "saslContinue", 1);
-         BSON_APPEND_INT32 (&cmd, "conversationId", conv_id);
-         bson_append_utf8 (&cmd, "payload", 7, (const char *)buf, buflen);
-      }
+static int
+_mongoc_cluster_intern_tag_sets (mongoc_cluster_t *cluster,
+                                 const bson_t     *read_tags,
+                                 uint32_t         *ids)
+{
+   const uint8_t *data;
+   bson_iter_t iter;
+   bson_t tag_set;
+   uint32_t len;
+   uint32_t i;
+   int n = 0;
 
-      MONGOC_INFO ("SASL: authenticating \"%s\" (step %d)",
-                   mongoc_uri_get_username (cluster->uri),
-                   sasl.step);
+   if (!bson_iter_init (&iter, read_tags)) {
+      return -1;
+   }
 
-      if (!_mongoc_cluster_run_command (cluster, node, "$external", &cmd, &reply, error)) {
-         bson_destroy (&cmd);
-         goto failure;
+   while (bson_iter_next (&iter)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+         continue;
       }
 
-      bson_destroy (&cmd);
+      bson_iter_document (&iter, &len, &data);
 
-      if (bson_iter_init_find (&iter, &reply, "done") &&
-          bson_iter_as_bool (&iter)) {
-         bson_destroy (&reply);
-         break;
+      if ((n == MONGOC_CLUSTER_TAG_SETS_MAX) ||
+          !bson_init_static (&tag_set, data, len)) {
+         return -1;
       }
 
-      if (!bson_iter_init_find (&iter, &reply, "ok") ||
-          !bson_iter_as_bool (&iter) ||
-          !bson_iter_init_find (&iter, &reply, "conversationId") ||
-          !BSON_ITER_HOLDS_INT32 (&iter) ||
-          !(conv_id = bson_iter_int32 (&iter)) ||
-          !bson_iter_init_find (&iter, &reply, "payload") ||
-          !BSON_ITER_HOLDS_UTF8 (&iter)) {
-         MONGOC_INFO ("SASL: authentication failed for \"%s\"",
-                      mongoc_uri_get_username (cluster->uri));
-         bson_destroy (&reply);
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "Received invalid SASL reply from MongoDB server.");
-         goto failure;
+      for (i = 0; i < cluster->tag_sets_len; i++) {
+         if (bson_equal (cluster->tag_sets[i], &tag_set)) {
+            break;
+         }
       }
 
-      tmpstr = bson_iter_utf8 (&iter, &buflen);
+      if (i == cluster->tag_sets_len) {
+         if (i == MONGOC_CLUSTER_TAG_SETS_MAX) {
+            return -1;
+         }
 
-      if (buflen > sizeof buf) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "SASL reply from MongoDB is too large.");
-         goto failure;
+         cluster->tag_sets[cluster->tag_sets_len++] = bson_copy (&tag_set);
       }
 
-      memcpy (buf, tmpstr, buflen);
-
-      bson_destroy (&reply);
+      ids[n++] = i;
    }
 
-   MONGOC_INFO ("SASL: \"%s\" authenticated",
-                mongoc_uri_get_username (cluster->uri));
-
-   ret = true;
-
-failure:
-   _mongoc_sasl_destroy (&sasl);
-
-   return ret;
+   return n;
 }
-#endif
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_auth_node_plain --
+ * _mongoc_cluster_node_match_tag_sets --
  *
- *       Perform SASL PLAIN authentication for @node. We do this manually
- *       instead of using the SASL module because its rather simplistic.
+ *       Match the tags of @node against every tag set of @cluster it has
+ *       not been checked against yet. This is done when the isMaster
+ *       reply gives @node new tags, so that selection only tests bits.
  *
  * Returns:
- *       true if successful; otherwise false and error is set.
+ *       None.
  *
  * Side effects:
- *       error may be set.
+ *       Updates @node->tag_sets_checked and @node->tag_sets_matched.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_auth_node_plain (mongoc_cluster_t      *cluster,
-                                 mongoc_cluster_node_t *node,
-                                 bson_error_t          *error)
+static void
+_mongoc_cluster_node_match_tag_sets (mongoc_cluster_t      *cluster,
+                                     mongoc_cluster_node_t *node)
 {
-   char buf[4096];
-   int buflen = 0;
-   bson_iter_t iter;
-   const char *username;
-   const char *password;
-   const char *errmsg = "Unknown authentication error.";
-   bson_t b = BSON_INITIALIZER;
-   bson_t reply;
-   size_t len;
-   char *str;
+   uint64_t bit;
+   uint32_t i;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
+   for (i = 0; i < cluster->tag_sets_len; i++) {
+      bit = ((uint64_t)1) << i;
 
-   username = mongoc_uri_get_username (cluster->uri);
-   if (!username) {
-      username = "";
-   }
+      if (!(node->tag_sets_checked & bit)) {
+         node->tag_sets_checked |= bit;
 
-   password = mongoc_uri_get_password (cluster->uri);
-   if (!password) {
-      password = "";
+         if (_mongoc_read_prefs_tag_set_matches (cluster->tag_sets[i],
+                                                 &node->tags)) {
+            node->tag_sets_matched |= bit;
+         }
+      }
    }
+}
 
-   str = bson_strdup_printf ("%c%s%c%s", '\0', username, '\0', password);
-   len = strlen (username) + strlen (password) + 2;
-   buflen = mongoc_b64_ntop ((const uint8_t *) str, len, buf, sizeof buf);
-   bson_free (str);
-
-   if (buflen == -1) {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "failed base64 encoding message");
-      return false;
-   }
 
-   BSON_APPEND_INT32 (&b, "saslStart", 1);
-   BSON_APPEND_UTF8 (&b, "mechanism", "PLAIN");
-   bson_append_utf8 (&b, "payload", 7, (const char *)buf, buflen);
-   BSON_APPEND_INT32 (&b, "autoAuthorize", 1);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_score_tag_sets --
+ *
+ *       Score the tags of @node like _score_tags() would, from the tag
+ *       sets @ids previously interned with _mongoc_cluster_intern_tag_sets().
+ *       @n_keys is the number of elements of the read preference tags.
+ *
+ * Returns:
+ *       @n_keys less the position of the first tag set @node satisfies,
+ *       or -1 if it satisfies none.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (!_mongoc_cluster_run_command (cluster, node, "$external", &b, &reply, error)) {
-      bson_destroy (&b);
-      return false;
-   }
+static int
+_mongoc_cluster_node_score_tag_sets (mongoc_cluster_t      *cluster,
+                                     mongoc_cluster_node_t *node,
+                                     const uint32_t        *ids,
+                                     int                    n_ids,
+                                     int                    n_keys)
+{
+   int i;
 
-   bson_destroy (&b);
+   _mongoc_cluster_node_match_tag_sets (cluster, node);
 
-   if (!bson_iter_init_find_case (&iter, &reply, "ok") ||
-       !bson_iter_as_bool (&iter)) {
-      if (bson_iter_init_find_case (&iter, &reply, "errmsg") &&
-          BSON_ITER_HOLDS_UTF8 (&iter)) {
-         errmsg = bson_iter_utf8 (&iter, NULL);
+   for (i = 0; i < n_ids; i++) {
+      if (node->tag_sets_matched & (((uint64_t)1) << ids[i])) {
+         return n_keys - i;
       }
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "%s", errmsg);
-      bson_destroy (&reply);
-      return false;
    }
 
-   bson_destroy (&reply);
-
-   return true;
+   return -1;
 }
 
 
-#ifdef MONGOC_ENABLE_SSL
-static bool
-_mongoc_cluster_auth_node_x509 (mongoc_cluster_t      *cluster,
-                                mongoc_cluster_node_t *node,
-                                bson_error_t          *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_select_eligible --
+ *
+ *       Find the nodes that match @read_prefs and have an established
+ *       connection, keeping only those with the best read preference
+ *       score. The result is cached per read mode and tag set until the
+ *       topology of @cluster changes.
+ *
+ * Returns:
+ *       A cache entry owned by @cluster.
+ *
+ * Side effects:
+ *       An older cache entry may be replaced.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static const mongoc_cluster_select_cache_t *
+_mongoc_cluster_select_eligible (mongoc_cluster_t          *cluster,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 bool                       need_secondary)
 {
-   const char *username = "";
-   const char *errmsg = "X509 authentication failure";
-   bson_iter_t iter;
-   bool ret = false;
-   bson_t cmd;
-   bson_t reply;
+   mongoc_cluster_select_cache_t *entry;
+   mongoc_cluster_node_t *node;
+   mongoc_read_mode_t read_mode;
+   uint32_t tag_set_ids [MONGOC_CLUSTER_TAG_SETS_MAX];
+   int64_t max_staleness_msec;
+   int n_tag_sets = -1;
+   int n_keys = 0;
+   int max_score = 0;
+   int score;
+   uint32_t i;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
+   ENTRY;
 
-   username = mongoc_uri_get_username(cluster->uri);
-   if (username) {
-      MONGOC_INFO ("X509: got username (%s) from URI", username);
-   } else {
-      if (!cluster->client->ssl_opts.pem_file) {
-         bson_set_error (error,
-               MONGOC_ERROR_CLIENT,
-               MONGOC_ERROR_CLIENT_AUTHENTICATE,
-               "cannot determine username "
-               "please either set it as part of the connection string or "
-               "call mongoc_client_set_ssl_opts() "
-               "with pem file for X-509 auth.");
-         return false;
+   read_mode = read_prefs ? mongoc_read_prefs_get_mode (read_prefs)
+                          : MONGOC_READ_PRIMARY;
+   max_staleness_msec =
+      read_prefs ? mongoc_read_prefs_get_max_staleness_ms (read_prefs) : 0;
+
+   for (i = 0; i < MONGOC_CLUSTER_SELECT_CACHE_SIZE; i++) {
+      entry = &cluster->select_cache[i];
+
+      if ((entry->topology_version == cluster->topology_version) &&
+          (entry->has_read_prefs == !!read_prefs) &&
+          (entry->need_secondary == need_secondary) &&
+          (!read_prefs ||
+           ((entry->read_mode == read_mode) &&
+            (entry->max_staleness_msec == max_staleness_msec) &&
+            bson_equal (&entry->tags, mongoc_read_prefs_get_tags (read_prefs))))) {
+         mongoc_counter_select_cache_hits_inc ();
+         RETURN (entry);
       }
+   }
 
-      if (cluster->client->pem_subject) {
-         username = cluster->client->pem_subject;
-         MONGOC_INFO ("X509: got username (%s) from certificate", username);
-      }
+   mongoc_counter_select_cache_misses_inc ();
+
+   _mongoc_cluster_select_reserve (cluster);
+
+   entry = &cluster->select_cache[cluster->select_cache_next];
+   cluster->select_cache_next =
+      (cluster->select_cache_next + 1) % MONGOC_CLUSTER_SELECT_CACHE_SIZE;
+
+   if (entry->topology_version) {
+      bson_destroy (&entry->tags);
    }
 
-   bson_init (&cmd);
-   BSON_APPEND_INT32 (&cmd, "authenticate", 1);
-   BSON_APPEND_UTF8 (&cmd, "mechanism", "MONGODB-X509");
-   BSON_APPEND_UTF8 (&cmd, "user", username);
+   entry->topology_version = cluster->topology_version;
+   entry->has_read_prefs = !!read_prefs;
+   entry->need_secondary = need_secondary;
+   entry->read_mode = read_mode;
+   entry->max_staleness_msec = max_staleness_msec;
+   entry->eligible_len = 0;
 
-   if (!_mongoc_cluster_run_command (cluster, node, "$external", &cmd, &reply,
-                                     error)) {
-      bson_destroy (&cmd);
-      return false;
+   if (max_staleness_msec) {
+      _mongoc_cluster_update_staleness (cluster);
    }
 
-   if (!bson_iter_init_find (&iter, &reply, "ok") ||
-       !bson_iter_as_bool (&iter)) {
-      if (bson_iter_init_find (&iter, &reply, "errmsg") &&
-          BSON_ITER_HOLDS_UTF8 (&iter)) {
-         errmsg = bson_iter_utf8 (&iter, NULL);
-      }
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "%s", errmsg);
-      goto failure;
+   if (read_prefs) {
+      bson_copy_to (mongoc_read_prefs_get_tags (read_prefs), &entry->tags);
+   } else {
+      bson_init (&entry->tags);
    }
 
-   ret = true;
-
-failure:
-
-   bson_destroy (&cmd);
-   bson_destroy (&reply);
-
-   return ret;
-}
-#endif
-
-
-#ifdef MONGOC_ENABLE_SSL
-static bool
-_mongoc_cluster_auth_node_scram (mongoc_cluster_t      *cluster,
-                                 mongoc_cluster_node_t *node,
-                                 bson_error_t          *error)
-{
-   uint32_t buflen = 0;
-   mongoc_scram_t scram;
-   bson_iter_t iter;
-   bool ret = false;
-   const char *tmpstr;
-   const char *auth_source;
-   uint8_t buf[4096] = { 0 };
-   bson_t cmd;
-   bson_t reply;
-   int conv_id = 0;
-   bson_subtype_t btype;
-
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
-
-   if (!(auth_source = mongoc_uri_get_auth_source(cluster->uri)) ||
-       (*auth_source == '\0')) {
-      auth_source = "admin";
+   if (read_prefs &&
+       (read_mode != MONGOC_READ_PRIMARY) &&
+       !bson_empty (mongoc_read_prefs_get_tags (read_prefs))) {
+      n_tag_sets = _mongoc_cluster_intern_tag_sets (
+         cluster, mongoc_read_prefs_get_tags (read_prefs), tag_set_ids);
+      n_keys = bson_count_keys (mongoc_read_prefs_get_tags (read_prefs));
    }
 
-   _mongoc_scram_init(&scram);
-
-   _mongoc_scram_set_pass (&scram, mongoc_uri_get_password (cluster->uri));
-   _mongoc_scram_set_user (&scram, mongoc_uri_get_username (cluster->uri));
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+      cluster->select_scores[i] = -1;
 
-   for (;;) {
-      if (!_mongoc_scram_step (&scram, buf, buflen, buf, sizeof buf, &buflen, error)) {
-         goto failure;
+      if ((!node->stream && !node->lazy) ||
+          (need_secondary && node->primary)) {
+         continue;
       }
 
-      bson_init (&cmd);
-
-      if (scram.step == 1) {
-         BSON_APPEND_INT32 (&cmd, "saslStart", 1);
-         BSON_APPEND_UTF8 (&cmd, "mechanism", "SCRAM-SHA-1");
-         bson_append_binary (&cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
-         BSON_APPEND_INT32 (&cmd, "autoAuthorize", 1);
+      if (!read_prefs) {
+         score = 0;
+      } else if (n_tag_sets >= 0) {
+         score = _mongoc_read_prefs_score_matched (
+            read_prefs, node,
+            _mongoc_cluster_node_score_tag_sets (cluster, node, tag_set_ids,
+                                                 n_tag_sets, n_keys));
       } else {
-         BSON_APPEND_INT32 (&cmd, "saslContinue", 1);
-         BSON_APPEND_INT32 (&cmd, "conversationId", conv_id);
-         bson_append_binary (&cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
+         score = _mongoc_read_prefs_score (read_prefs, node);
       }
+      cluster->select_scores[i] = score;
 
-      MONGOC_INFO ("SCRAM: authenticating \"%s\" (step %d)",
-                   mongoc_uri_get_username (cluster->uri),
-                   scram.step);
-
-      if (!_mongoc_cluster_run_command (cluster, node, auth_source, &cmd, &reply, error)) {
-         bson_destroy (&cmd);
-         goto failure;
-      }
-
-      bson_destroy (&cmd);
-
-      if (bson_iter_init_find (&iter, &reply, "done") &&
-          bson_iter_as_bool (&iter)) {
-         bson_destroy (&reply);
-         break;
-      }
-
-      if (!bson_iter_init_find (&iter, &reply, "ok") ||
-          !bson_iter_as_bool (&iter) ||
-          !bson_iter_init_find (&iter, &reply, "conversationId") ||
-          !BSON_ITER_HOLDS_INT32 (&iter) ||
-          !(conv_id = bson_iter_int32 (&iter)) ||
-          !bson_iter_init_find (&iter, &reply, "payload") ||
-          !BSON_ITER_HOLDS_BINARY(&iter)) {
-         const char *errmsg = "Received invalid SCRAM reply from MongoDB server.";
-
-         MONGOC_INFO ("SCRAM: authentication failed for \"%s\"",
-                      mongoc_uri_get_username (cluster->uri));
-
-         if (bson_iter_init_find (&iter, &reply, "errmsg") &&
-               BSON_ITER_HOLDS_UTF8 (&iter)) {
-            errmsg = bson_iter_utf8 (&iter, NULL);
-         }
-
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "%s", errmsg);
-         bson_destroy (&reply);
-         goto failure;
+      if (score > max_score) {
+         max_score = score;
       }
+   }
 
-      bson_iter_binary (&iter, &btype, &buflen, (const uint8_t**)&tmpstr);
-
-      if (buflen > sizeof buf) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                         "SCRAM reply from MongoDB is too large.");
-         goto failure;
+   /*
+    * Keep only the nodes with the highest score.
+    */
+   for (i = 0; i < cluster->nodes_len; i++) {
+      if ((cluster->select_scores[i] >= 0) &&
+          (cluster->select_scores[i] == max_score)) {
+         entry->eligible[entry->eligible_len++] = i;
       }
-
-      memcpy (buf, tmpstr, buflen);
-
-      bson_destroy (&reply);
    }
 
-   MONGOC_INFO ("SCRAM: \"%s\" authenticated",
-                mongoc_uri_get_username (cluster->uri));
-
-   ret = true;
-
-failure:
-   _mongoc_scram_destroy (&scram);
-
-   return ret;
+   RETURN (entry);
 }
-#endif
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_auth_node --
+ * _mongoc_cluster_select_mongos --
  *
- *       Authenticate a cluster node depending on the required mechanism.
+ *       Select one of the mongos of a sharded cluster. Only the mongos
+ *       whose latency is within localThresholdMS of the nearest one are
+ *       considered, and requests are handed to them in turn so the load
+ *       is spread evenly across that window.
+ *
+ *       A mongos that recently timed out, or whose breaker is open, is
+ *       skipped unless there is no other choice.
  *
  * Returns:
- *       true if authenticated. false on failure and @error is set.
+ *       A mongoc_cluster_node_t if successful; otherwise NULL and
+ *       @error is set.
  *
  * Side effects:
- *       @error is set on failure.
+ *       None.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_auth_node (mongoc_cluster_t      *cluster,
-                           mongoc_cluster_node_t *node,
-                           bson_error_t          *error)
+static mongoc_cluster_node_t *
+_mongoc_cluster_select_mongos (mongoc_cluster_t *cluster,
+                               bson_error_t     *error)
 {
-   bool ret = false;
-   const char *mechanism;
+   mongoc_cluster_node_t *node;
+   int32_t latency;
+   int32_t nearest;
+   int64_t now;
+   uint32_t count;
+   uint32_t i;
+   int pass;
+
+   ENTRY;
 
    BSON_ASSERT (cluster);
-   BSON_ASSERT (node);
 
-   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+   now = bson_get_monotonic_time ();
 
-   if (!mechanism) {
-      if (node->max_wire_version < 3) {
-         mechanism = "MONGODB-CR";
-      } else {
-         mechanism = "SCRAM-SHA-1";
+#define IS_CANDIDATE(n) \
+   (((n)->stream || (n)->lazy) && \
+    (pass || (((n)->avoid_until <= now) && \
+              !_mongoc_cluster_node_is_open ((n), now))))
+
+   for (pass = 0; pass < 2; pass++) {
+      nearest = -1;
+
+      for (i = 0; i < cluster->nodes_len; i++) {
+         node = &cluster->nodes[i];
+
+         if (IS_CANDIDATE (node)) {
+            latency = _mongoc_cluster_node_latency (cluster, node);
+            if ((latency >= 0) && ((nearest == -1) || (latency < nearest))) {
+               nearest = latency;
+            }
+         }
+      }
+
+#define IS_WITHIN_WINDOW(n) \
+   (IS_CANDIDATE (n) && \
+    ((nearest == -1) || \
+     (_mongoc_cluster_node_latency (cluster, (n)) <= \
+      (int32_t)(nearest + cluster->sec_latency_ms))))
+
+      for (i = 0, count = 0; i < cluster->nodes_len; i++) {
+         if (IS_WITHIN_WINDOW (&cluster->nodes[i])) {
+            count++;
+         }
+      }
+
+      if (!count) {
+         continue;
+      }
+
+      count = cluster->mongos_next++ % count;
+
+      for (i = 0; i < cluster->nodes_len; i++) {
+         node = &cluster->nodes[i];
+
+         if (IS_WITHIN_WINDOW (node)) {
+            if (!count) {
+               RETURN (node);
+            }
+            count--;
+         }
       }
    }
 
-   if (0 == strcasecmp (mechanism, "MONGODB-CR")) {
-      ret = _mongoc_cluster_auth_node_cr (cluster, node, error);
-#ifdef MONGOC_ENABLE_SSL
-   } else if (0 == strcasecmp (mechanism, "MONGODB-X509")) {
-      ret = _mongoc_cluster_auth_node_x509 (cluster, node, error);
-   } else if (0 == strcasecmp (mechanism, "SCRAM-SHA-1")) {
-      ret = _mongoc_cluster_auth_node_scram (cluster, node, error);
-#endif
-#ifdef MONGOC_ENABLE_SASL
-   } else if (0 == strcasecmp (mechanism, "GSSAPI")) {
-      ret = _mongoc_cluster_auth_node_sasl (cluster, node, error);
+#undef IS_WITHIN_WINDOW
+#undef IS_CANDIDATE
+
+   bson_set_error (error,
+                   MONGOC_ERROR_CLIENT,
+                   MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                   "Failed to locate a suitable mongos.");
+
+   RETURN (NULL);
+}
+
+
+/* the key that reads with @read_prefs stick to a node for, if any */
+static bool
+_mongoc_cluster_affinity_key (const mongoc_read_prefs_t *read_prefs,
+                              uint64_t                  *key)
+{
+   switch (mongoc_read_prefs_get_affinity (read_prefs, key)) {
+   case MONGOC_READ_AFFINITY_THREAD:
+#ifdef _WIN32
+      *key = (uint64_t)GetCurrentThreadId ();
+#else
+      *key = (uint64_t)(unsigned long)pthread_self ();
 #endif
-   } else if (0 == strcasecmp (mechanism, "PLAIN")) {
-      ret = _mongoc_cluster_auth_node_plain (cluster, node, error);
-   } else {
-      bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
-                      "The authentication mechanism \"%s\" is not supported.",
-                      mechanism);
+      return true;
+   case MONGOC_READ_AFFINITY_KEY:
+      return true;
+   case MONGOC_READ_AFFINITY_NONE:
+   default:
+      return false;
    }
+}
 
-   if (!ret) {
-      mongoc_counter_auth_failure_inc ();
-   } else {
-      mongoc_counter_auth_success_inc ();
+
+/*
+ * The weight of @node for affinity @key, from its address so that it is
+ * the same for every client of the deployment. Each key goes to the node
+ * it weighs most on, which spreads keys evenly over the nodes.
+ */
+static uint64_t
+_mongoc_cluster_affinity_weight (uint64_t                     key,
+                                 const mongoc_cluster_node_t *node)
+{
+   const char *p;
+   uint64_t h = 14695981039346656037ULL;
+
+   for (p = node->host.host_and_port; *p; p++) {
+      h = (h ^ (uint8_t)*p) * 1099511628211ULL;
    }
 
-   return ret;
+   h ^= key * 0x9e3779b97f4a7c15ULL;
+
+   /* the finalizer of splitmix64, so that close keys weigh apart */
+   h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+
+   return h ^ (h >> 31);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_reconnect_direct --
- *
- *       Reconnect to our only configured node.
+ * _mongoc_cluster_select_node --
  *
- *       "isMaster" is run after connecting to determine PRIMARY status.
+ *       Selects a cluster node that is suitable for handling the required
+ *       set of rpc messages. The read_prefs are taken into account.
  *
- *       If the node is valid, we will also greedily authenticate the
- *       configured user if available.
+ *       If any operation is a write, primary will be forced.
  *
  * Returns:
- *       true if successful; otherwise false and @error is set.
+ *       A mongoc_cluster_node_t if successful; otherwise NULL and
+ *       @error is set. The node may still have to be connected if it
+ *       was discovered in lazy mode.
  *
  * Side effects:
  *       None.
@@ -1932,610 +2257,6638 @@ _mongoc_cluster_auth_node (mongoc_cluster_t      *cluster,
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_reconnect_direct (mongoc_cluster_t *cluster,
-                                  bson_error_t     *error)
+static mongoc_cluster_node_t *
+_mongoc_cluster_select_node (mongoc_cluster_t             *cluster,
+                             mongoc_rpc_t                 *rpcs,
+                             size_t                        rpcs_len,
+                             uint32_t                      hint,
+                             const mongoc_write_concern_t *write_concern,
+                             const mongoc_read_prefs_t    *read_prefs,
+                             bson_error_t                 *error)
 {
-   const mongoc_host_list_t *hosts;
-   mongoc_cluster_node_t *node;
-   mongoc_stream_t *stream;
-   struct timeval timeout;
+   const mongoc_cluster_select_cache_t *entry;
+   mongoc_read_mode_t read_mode = MONGOC_READ_PRIMARY;
+   mongoc_cluster_node_t *candidate;
+   uint64_t affinity_key;
+   uint64_t weight;
+   uint64_t heaviest = 0;
+   int32_t latency;
+   uint32_t count;
+   uint32_t watermark;
+   int32_t nearest = -1;
+   bool need_primary;
+   bool need_secondary;
+   bool saturated = false;
+   bool unsaturated = false;
+   int64_t now;
+   unsigned i;
+   mongoc_cluster_node_t *node = NULL;
 
    ENTRY;
 
-   BSON_ASSERT(cluster);
+   bson_return_val_if_fail(cluster, NULL);
+   bson_return_val_if_fail(rpcs, NULL);
+   bson_return_val_if_fail(rpcs_len, NULL);
+   bson_return_val_if_fail(hint <= cluster->nodes_len, NULL);
 
-   if (!(hosts = mongoc_uri_get_hosts(cluster->uri))) {
-      bson_set_error(error,
-                     MONGOC_ERROR_CLIENT,
-                     MONGOC_ERROR_CLIENT_NOT_READY,
-                     "Invalid host list supplied.");
-      RETURN(false);
+   /*
+    * We can take a few short-cut's if we are not talking to a replica set.
+    */
+   switch (cluster->mode) {
+   case MONGOC_CLUSTER_DIRECT: {
+      node = (cluster->nodes[0].stream ? &cluster->nodes[0] : NULL);
+      RETURN (node);
    }
-
-   cluster->last_reconnect = bson_get_monotonic_time();
-
-   node = &cluster->nodes[0];
-
-   node->index = 0;
-   node->host = *hosts;
+   case MONGOC_CLUSTER_SHARDED_CLUSTER:
+      if (!hint) {
+         node = _mongoc_cluster_select_mongos (cluster, error);
+         RETURN (node);
+      }
+      need_primary = false;
+      need_secondary = false;
+      GOTO (dispatch);
+   case MONGOC_CLUSTER_REPLICA_SET:
+   default:
+      break;
+   }
+
+   /*
+    * Determine if our read preference requires communicating with PRIMARY.
+    */
+   if (read_prefs)
+      read_mode = mongoc_read_prefs_get_mode(read_prefs);
+   need_primary = (read_mode == MONGOC_READ_PRIMARY);
+   need_secondary = (read_mode == MONGOC_READ_SECONDARY);
+
+   /*
+    * Check to see if any RPCs require the primary. If so, we pin all
+    * of the RPCs to the primary.
+    */
+   for (i = 0; !need_primary && (i < rpcs_len); i++) {
+      switch (rpcs[i].header.opcode) {
+      case MONGOC_OPCODE_KILL_CURSORS:
+      case MONGOC_OPCODE_GET_MORE:
+      case MONGOC_OPCODE_MSG:
+      case MONGOC_OPCODE_REPLY:
+         break;
+      case MONGOC_OPCODE_QUERY:
+         if ((read_mode & MONGOC_READ_SECONDARY) != 0) {
+            rpcs[i].query.flags |= MONGOC_QUERY_SLAVE_OK;
+         } else if (!(rpcs[i].query.flags & MONGOC_QUERY_SLAVE_OK)) {
+            need_primary = true;
+         }
+         break;
+      case MONGOC_OPCODE_DELETE:
+      case MONGOC_OPCODE_INSERT:
+      case MONGOC_OPCODE_UPDATE:
+      default:
+         need_primary = true;
+         break;
+      }
+   }
+
+dispatch:
+
+   now = bson_get_monotonic_time ();
+
+   /*
+    * Short circuit if we require a primary and we found one. A primary
+    * whose breaker is open fails fast rather than making the caller wait
+    * for it to time out again.
+    */
+   if (need_primary) {
+      for (i = 0; i < cluster->nodes_len; i++) {
+         if (cluster->nodes[i].primary) {
+            if (_mongoc_cluster_node_is_open (&cluster->nodes[i], now)) {
+               bson_set_error (error,
+                               MONGOC_ERROR_CLIENT,
+                               MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                               "Requested PRIMARY node %s is failing and "
+                               "is temporarily avoided.",
+                               cluster->nodes[i].host.host_and_port);
+               RETURN (NULL);
+            }
+            RETURN (&cluster->nodes[i]);
+         }
+      }
+
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                     "Requested PRIMARY node is not available.");
+      RETURN (NULL);
+   }
+
+   /*
+    * Apply the hint if the client knows who they would like to continue
+    * communicating with.
+    */
+   if (hint) {
+      node = &cluster->nodes[hint - 1];
+      if ((!node->stream && !node->lazy) ||
+          (need_secondary && node->primary)) {
+         bson_set_error(error,
+                        MONGOC_ERROR_CLIENT,
+                        MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                        "Requested node (%u) is not available.",
+                        hint);
+         node = NULL;
+      }
+      RETURN (node);
+   }
+
+   /*
+    * Now, we start removing connections that don't match the requirements of
+    * our requested event.
+    *
+    * - If read preferences are set, remove all non-matching.
+    * - If slaveOk exists and is false, then remove secondaries.
+    * - Remove nodes whose breaker is open.
+    * - Remove nodes at their concurrency limit, unless all of them are.
+    * - Find the nearest leftover node and remove those not within threshold.
+    * - Select a leftover node at random.
+    *
+    * The first two steps only depend on the topology, the read mode and the
+    * tag set, so they are cached until the topology changes.
+    */
+   entry = _mongoc_cluster_select_eligible (cluster, read_prefs,
+                                            need_secondary);
+
+   /*
+    * Spill over to the nodes that are not saturated, if there are any.
+    */
+   if (cluster->limiter) {
+      for (i = 0; i < entry->eligible_len; i++) {
+         candidate = &cluster->nodes[entry->eligible[i]];
+         if ((candidate->stream || candidate->lazy) &&
+             !_mongoc_cluster_node_is_open (candidate, now)) {
+            if (_mongoc_cluster_node_is_saturated (cluster, candidate)) {
+               saturated = true;
+            } else {
+               unsaturated = true;
+            }
+         }
+      }
+
+      if (saturated && unsaturated) {
+         mongoc_counter_cluster_limiter_spills_inc ();
+      } else {
+         saturated = false;
+      }
+   }
+
+#define IS_AVAILABLE(n) \
+   (((n)->stream || (n)->lazy) && \
+    !_mongoc_cluster_node_is_open ((n), now) && \
+    !(saturated && _mongoc_cluster_node_is_saturated (cluster, (n))))
+
+   /*
+    * Get the nearest node among those which have not been filtered out
+    */
+#define IS_NEARER_THAN(l, msec) \
+   ((msec < 0 && (l) >= 0) || ((l) < msec))
+
+   for (i = 0; i < entry->eligible_len; i++) {
+      candidate = &cluster->nodes[entry->eligible[i]];
+      latency = _mongoc_cluster_node_latency (cluster, candidate);
+      if (IS_AVAILABLE (candidate) &&
+          IS_NEARER_THAN(latency, nearest)) {
+         nearest = latency;
+      }
+   }
+
+#undef IS_NEARER_THAN
+
+   /*
+    * Count the nodes with latency within threshold of nearest.
+    */
+   watermark = (nearest != -1) ? nearest + cluster->sec_latency_ms : 0;
+
+#define IS_WITHIN_WINDOW(n) \
+   (IS_AVAILABLE (n) && \
+    ((nearest == -1) || \
+     (_mongoc_cluster_node_latency (cluster, (n)) <= (int32_t)watermark)))
+
+   count = 0;
+
+   for (i = 0; i < entry->eligible_len; i++) {
+      if (IS_WITHIN_WINDOW (&cluster->nodes[entry->eligible[i]])) {
+         count++;
+      }
+   }
+
+   /*
+    * Mark the error as unable to locate a target node.
+    */
+   if (!count) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                      "Failed to locate a suitable MongoDB node.");
+      RETURN (NULL);
+   }
+
+   /*
+    * With an affinity, choose the node within threshold that weighs most
+    * for its key. The choice only changes for the keys of a node that
+    * leaves the window, or when one joins and outweighs it.
+    */
+   if (read_prefs &&
+       _mongoc_cluster_affinity_key (read_prefs, &affinity_key)) {
+      for (i = 0; i < entry->eligible_len; i++) {
+         candidate = &cluster->nodes[entry->eligible[i]];
+         if (IS_WITHIN_WINDOW (candidate)) {
+            weight = _mongoc_cluster_affinity_weight (affinity_key,
+                                                      candidate);
+            if (!node || weight > heaviest) {
+               node = candidate;
+               heaviest = weight;
+            }
+         }
+      }
+
+      RETURN (node);
+   }
+
+   /*
+    * Choose a cluster node within threshold at random.
+    */
+   count = rand() % count;
+   for (i = 0; i < entry->eligible_len; i++) {
+      candidate = &cluster->nodes[entry->eligible[i]];
+      if (IS_WITHIN_WINDOW (candidate)) {
+         if (!count) {
+            node = candidate;
+            break;
+         }
+         count--;
+      }
+   }
+
+#undef IS_WITHIN_WINDOW
+#undef IS_AVAILABLE
+
+   RETURN(node);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_select --
+ *
+ *       Select a node with _mongoc_cluster_select_node() and, if it was
+ *       discovered in lazy mode, connect and authenticate it now.
+ *
+ * Returns:
+ *       A connected mongoc_cluster_node_t if successful; otherwise NULL
+ *       and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_cluster_node_t *
+_mongoc_cluster_select (mongoc_cluster_t             *cluster,
+                        mongoc_rpc_t                 *rpcs,
+                        size_t                        rpcs_len,
+                        uint32_t                      hint,
+                        const mongoc_write_concern_t *write_concern,
+                        const mongoc_read_prefs_t    *read_prefs,
+                        bson_error_t                 *error)
+{
+   mongoc_cluster_node_t *node;
+
+   ENTRY;
+
+   node = _mongoc_cluster_select_node (cluster, rpcs, rpcs_len, hint,
+                                       write_concern, read_prefs, error);
+
+   if (node && node->lazy &&
+       !_mongoc_cluster_node_connect_lazy (cluster, node, error)) {
+      node = NULL;
+   }
+
+   RETURN (node);
+}
+
+
+uint32_t
+_mongoc_cluster_preselect (mongoc_cluster_t             *cluster,       /* IN */
+                           mongoc_opcode_t               opcode,        /* IN */
+                           const mongoc_write_concern_t *write_concern, /* IN */
+                           const mongoc_read_prefs_t    *read_prefs,    /* IN */
+                           bson_error_t                 *error)         /* OUT */
+{
+   mongoc_cluster_node_t *node;
+   mongoc_rpc_t rpc = {{ 0 }};
+   int retry_count = 0;
+   int64_t expire_at = 0;
+   bson_error_t scoped_error;
+
+   BSON_ASSERT (cluster);
+
+   rpc.header.opcode = opcode;
+
+   while (!(node = _mongoc_cluster_select (cluster, &rpc, 1, 0, write_concern,
+                                           read_prefs, &scoped_error))) {
+      if (!_mongoc_cluster_retry_selection (cluster, &retry_count, &expire_at,
+                                            &scoped_error)) {
+         break;
+      }
+   }
+
+   if (!node && error) {
+      memcpy (error, &scoped_error, sizeof (scoped_error));
+   }
+
+   return node ? (node->index + 1) : 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_send_commands --
+ *
+ *       Helper to send several commands to a given mongoc_cluster_node_t
+ *       in a single write without waiting for the replies. Each
+ *       commands[i] is run on the database db_names[i]. The replies
+ *       arrive in order and must be read with _mongoc_cluster_recv_reply().
+ *
+ * Returns:
+ *       true if successful; otherwise false, @error is set and the node
+ *       has been disconnected.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_send_commands (mongoc_cluster_t      *cluster,
+                               mongoc_cluster_node_t *node,
+                               const char           **db_names,
+                               const bson_t         **commands,
+                               size_t                 n_commands,
+                               bson_error_t          *error)
+{
+   mongoc_array_t ar;
+   mongoc_rpc_t *rpcs;
+   char (*ns)[MONGOC_NAMESPACE_MAX];
+   int32_t timeout_msec;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(node);
+   BSON_ASSERT(node->stream);
+   BSON_ASSERT(db_names);
+   BSON_ASSERT(commands);
+   BSON_ASSERT(n_commands);
+
+   rpcs = bson_malloc0 (n_commands * sizeof *rpcs);
+   ns = bson_malloc0 (n_commands * sizeof *ns);
+
+   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
+
+   for (i = 0; i < n_commands; i++) {
+      bson_snprintf(ns[i], sizeof ns[i], "%s.$cmd", db_names[i]);
+
+      rpcs[i].query.msg_len = 0;
+      rpcs[i].query.request_id = ++cluster->request_id;
+      rpcs[i].query.response_to = 0;
+      rpcs[i].query.opcode = MONGOC_OPCODE_QUERY;
+      rpcs[i].query.flags = MONGOC_QUERY_SLAVE_OK;
+      rpcs[i].query.collection = ns[i];
+      rpcs[i].query.skip = 0;
+      rpcs[i].query.n_return = -1;
+      rpcs[i].query.query = bson_get_data(commands[i]);
+      rpcs[i].query.fields = NULL;
+
+      _mongoc_rpc_gather(&rpcs[i], &ar);
+      _mongoc_rpc_swab_to_le(&rpcs[i]);
+   }
+
+   DUMP_IOVEC (((mongoc_iovec_t *)ar.data), ((mongoc_iovec_t *)ar.data), ar.len);
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      _mongoc_array_destroy(&ar);
+      bson_free (rpcs);
+      bson_free (ns);
+      RETURN(false);
+   }
+
+   if (!mongoc_stream_writev(node->stream, ar.data, ar.len, timeout_msec)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failed to send command to %s.",
+                      node->host.host_and_port);
+      _mongoc_array_destroy(&ar);
+      bson_free (rpcs);
+      bson_free (ns);
+      _mongoc_cluster_disconnect_node(cluster, node);
+      RETURN(false);
+   }
+
+   _mongoc_array_destroy(&ar);
+   bson_free (rpcs);
+   bson_free (ns);
+
+   RETURN(true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_send_command --
+ *
+ *       Helper to send a command to a given mongoc_cluster_node_t without
+ *       waiting for the reply. The reply must be read with
+ *       _mongoc_cluster_recv_reply().
+ *
+ * Returns:
+ *       true if successful; otherwise false, @error is set and the node
+ *       has been disconnected.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_send_command (mongoc_cluster_t      *cluster,
+                              mongoc_cluster_node_t *node,
+                              const char            *db_name,
+                              const bson_t          *command,
+                              bson_error_t          *error)
+{
+   return _mongoc_cluster_send_commands (cluster, node, &db_name, &command, 1,
+                                         error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_recv_reply --
+ *
+ *       Helper to read the reply to a command previously sent with
+ *       _mongoc_cluster_send_command().
+ *
+ * Returns:
+ *       true if successful; otherwise false, @error is set and the node
+ *       has been disconnected.
+ *
+ * Side effects:
+ *       @reply is set and should ALWAYS be released with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_recv_reply (mongoc_cluster_t      *cluster,
+                            mongoc_cluster_node_t *node,
+                            bson_t                *reply,
+                            bson_error_t          *error)
+{
+   mongoc_buffer_t buffer;
+   mongoc_rpc_t rpc;
+   int32_t msg_len;
+   int32_t timeout_msec;
+   bson_t reply_local;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(node);
+   BSON_ASSERT(node->stream);
+
+   _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
+
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error) ||
+       !_mongoc_buffer_append_from_stream(&buffer, node->stream, 4,
+                                          timeout_msec, error)) {
+      GOTO(failure);
+   }
+
+   BSON_ASSERT(buffer.len == 4);
+
+   memcpy(&msg_len, buffer.data, 4);
+   msg_len = BSON_UINT32_FROM_LE(msg_len);
+   if ((msg_len < 16) || (msg_len > (1024 * 1024 * 16))) {
+      GOTO(invalid_reply);
+   }
+
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error) ||
+       !_mongoc_buffer_append_from_stream(&buffer, node->stream, msg_len - 4,
+                                          timeout_msec, error)) {
+      GOTO(failure);
+   }
+
+   if (!_mongoc_rpc_scatter(&rpc, buffer.data, buffer.len)) {
+      GOTO(invalid_reply);
+   }
+   DUMP_BYTES (&buffer, buffer.data + buffer.off, buffer.len);
+
+   _mongoc_rpc_swab_from_le(&rpc);
+
+   if (rpc.header.opcode != MONGOC_OPCODE_REPLY) {
+      GOTO(invalid_reply);
+   }
+
+   if (reply) {
+      if (!_mongoc_rpc_reply_get_first(&rpc.reply, &reply_local)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Failed to decode reply BSON document.");
+         GOTO(failure);
+      }
+      bson_copy_to(&reply_local, reply);
+      bson_destroy(&reply_local);
+   }
+
+   _mongoc_buffer_destroy(&buffer);
+
+   RETURN(true);
+
+invalid_reply:
+   bson_set_error(error,
+                  MONGOC_ERROR_PROTOCOL,
+                  MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                  "Invalid reply from server.");
+
+failure:
+   _mongoc_buffer_destroy(&buffer);
+
+   if (reply) {
+      bson_init(reply);
+   }
+
+   _mongoc_cluster_disconnect_node(cluster, node);
+
+   RETURN(false);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_run_command --
+ *
+ *       Helper to run a command on a given mongoc_cluster_node_t.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is set and should ALWAYS be released with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_run_command (mongoc_cluster_t      *cluster,
+                             mongoc_cluster_node_t *node,
+                             const char            *db_name,
+                             const bson_t          *command,
+                             bson_t                *reply,
+                             bson_error_t          *error)
+{
+   bool ret;
+
+   ENTRY;
+
+   if (!_mongoc_cluster_send_command (cluster, node, db_name, command,
+                                      error)) {
+      if (reply) {
+         bson_init (reply);
+      }
+      RETURN (false);
+   }
+
+   ret = _mongoc_cluster_recv_reply (cluster, node, reply, error);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_append_compression --
+ *
+ *       Offer the compressor of @cluster, if any, in the "isMaster"
+ *       @command.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_append_compression (mongoc_cluster_t *cluster,
+                                    bson_t           *command)
+{
+   bson_t child;
+
+   if (cluster->compressor_id != MONGOC_COMPRESSOR_NONE_ID) {
+      bson_append_array_begin (command, "compression", 11, &child);
+      bson_append_utf8 (&child, "0", 1,
+                        _mongoc_compressor_id_to_name (cluster->compressor_id),
+                        -1);
+      bson_append_array_end (command, &child);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_process_ismaster --
+ *
+ *       Applies the @reply of an isMaster command to @node and @cluster.
+ *
+ *       node->primary will be set to true if the node is discovered to
+ *       be a primary node.
+ *
+ * Returns:
+ *       true if successful; otehrwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_process_ismaster (mongoc_cluster_t      *cluster,
+                                  mongoc_cluster_node_t *node,
+                                  const bson_t          *reply,
+                                  bson_error_t          *error)
+{
+   int32_t v32;
+   bool ret = false;
+   bson_iter_t child;
+   bson_iter_t iter;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(node);
+   BSON_ASSERT(reply);
+
+   node->primary = false;
+   node->electable = false;
+   node->compressed = false;
+   node->last_write_date = 0;
+   node->last_update_msec = bson_get_monotonic_time () / 1000;
+
+   bson_free (node->replSet);
+   node->replSet = NULL;
+
+   if (bson_iter_init_find_case (&iter, reply, "isMaster") &&
+       BSON_ITER_HOLDS_BOOL (&iter) &&
+       bson_iter_bool (&iter)) {
+      node->primary = true;
+   }
+
+   /*
+    * A data bearing member with a non-zero priority may become primary.
+    * Members with priority 0 report themselves as passive.
+    */
+   if (node->primary ||
+       (bson_iter_init_find (&iter, reply, "secondary") &&
+        BSON_ITER_HOLDS_BOOL (&iter) &&
+        bson_iter_bool (&iter))) {
+      node->electable = true;
+
+      if ((bson_iter_init_find (&iter, reply, "passive") &&
+           bson_iter_as_bool (&iter)) ||
+          (bson_iter_init_find (&iter, reply, "hidden") &&
+           bson_iter_as_bool (&iter)) ||
+          (bson_iter_init_find (&iter, reply, "arbiterOnly") &&
+           bson_iter_as_bool (&iter))) {
+         node->electable = false;
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, reply, "maxMessageSizeBytes")) {
+      v32 = bson_iter_int32(&iter);
+      if (!cluster->max_msg_size || (v32 < (int32_t)cluster->max_msg_size)) {
+         cluster->max_msg_size = v32;
+      }
+   }
+
+   if (bson_iter_init_find_case(&iter, reply, "maxBsonObjectSize")) {
+      v32 = bson_iter_int32(&iter);
+	  if (!cluster->max_bson_size || (v32 < (int32_t)cluster->max_bson_size)) {
+         cluster->max_bson_size = v32;
+      }
+   }
+
+   if (bson_iter_init_find_case (&iter, reply, "maxWriteBatchSize")) {
+      v32 = bson_iter_int32 (&iter);
+      node->max_write_batch_size = v32;
+   }
+
+   if (bson_iter_init_find_case(&iter, reply, "maxWireVersion") &&
+       BSON_ITER_HOLDS_INT32(&iter)) {
+      node->max_wire_version = bson_iter_int32(&iter);
+   }
+
+   if (bson_iter_init_find_case(&iter, reply, "minWireVersion") &&
+       BSON_ITER_HOLDS_INT32(&iter)) {
+      node->min_wire_version = bson_iter_int32(&iter);
+   }
+
+   if ((node->min_wire_version > MAX_WIRE_VERSION) ||
+       (node->max_wire_version < MIN_WIRE_VERSION)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_BAD_WIRE_VERSION,
+                      "Failed to negotiate wire version with "
+                      "cluster peer. %s is [%u,%u]. I support "
+                      "[%u,%u].",
+                      node->host.host_and_port,
+                      node->min_wire_version,
+                      node->max_wire_version,
+                      MIN_WIRE_VERSION,
+                      MAX_WIRE_VERSION);
+      GOTO (failure);
+   }
+
+   /*
+    * The node lists the compressors it accepts out of those we offered.
+    */
+   if ((cluster->compressor_id != MONGOC_COMPRESSOR_NONE_ID) &&
+       bson_iter_init_find (&iter, reply, "compression") &&
+       BSON_ITER_HOLDS_ARRAY (&iter) &&
+       bson_iter_recurse (&iter, &child)) {
+      while (bson_iter_next (&child)) {
+         if (BSON_ITER_HOLDS_UTF8 (&child) &&
+             (_mongoc_compressor_name_to_id (bson_iter_utf8 (&child, NULL)) ==
+              cluster->compressor_id)) {
+            node->compressed = true;
+            break;
+         }
+      }
+   }
+
+   if (bson_iter_init_find (&iter, reply, "msg") &&
+       BSON_ITER_HOLDS_UTF8 (&iter) &&
+       (0 == strcasecmp ("isdbgrid", bson_iter_utf8 (&iter, NULL)))) {
+      node->isdbgrid = true;
+      if (cluster->mode != MONGOC_CLUSTER_SHARDED_CLUSTER) {
+         MONGOC_INFO ("Unexpectedly connected to sharded cluster: %s",
+                      node->host.host_and_port);
+      }
+   } else {
+      node->isdbgrid = false;
+   }
+
+   /*
+    * If we are in replicaSet mode, we need to track our potential peers for
+    * further connections.
+    */
+   if (cluster->mode == MONGOC_CLUSTER_REPLICA_SET) {
+      if (bson_iter_init_find (&iter, reply, "hosts") &&
+          bson_iter_recurse (&iter, &child)) {
+         if (node->primary) {
+            _mongoc_cluster_clear_peers (cluster);
+         }
+         while (bson_iter_next (&child) && BSON_ITER_HOLDS_UTF8 (&child)) {
+            _mongoc_cluster_add_peer (cluster, bson_iter_utf8(&child, NULL));
+         }
+      }
+      if (bson_iter_init_find(&iter, reply, "setName") &&
+          BSON_ITER_HOLDS_UTF8(&iter)) {
+         node->replSet = bson_iter_dup_utf8(&iter, NULL);
+      }
+      if (bson_iter_init_find (&iter, reply, "lastWrite") &&
+          BSON_ITER_HOLDS_DOCUMENT (&iter) &&
+          bson_iter_recurse (&iter, &child) &&
+          bson_iter_find (&child, "lastWriteDate") &&
+          BSON_ITER_HOLDS_DATE_TIME (&child)) {
+         node->last_write_date = bson_iter_date_time (&child);
+      }
+      if (bson_iter_init_find(&iter, reply, "tags") &&
+          BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+          bson_t tags;
+          uint32_t len;
+          const uint8_t *data;
+
+          bson_iter_document(&iter, &len, &data);
+
+          if (bson_init_static(&tags, data, len)) {
+              bson_destroy(&node->tags);
+              bson_copy_to(&tags, &(node->tags));
+              _mongoc_cluster_node_reset_tag_sets(node);
+              _mongoc_cluster_node_match_tag_sets(cluster, node);
+          }
+      }
+   }
+
+   ret = true;
+
+failure:
+   _mongoc_cluster_topology_changed (cluster);
+
+   RETURN(ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_ismaster --
+ *
+ *       Executes an isMaster command on a given mongoc_cluster_node_t.
+ *
+ *       node->primary will be set to true if the node is discovered to
+ *       be a primary node.
+ *
+ * Returns:
+ *       true if successful; otehrwise false and @error is set.
+ *
+ * Side effects:
+ *       @rtt_msec, if not NULL, is set to the round-trip time of the
+ *       command, which doubles as a ping sample.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_ismaster (mongoc_cluster_t      *cluster,
+                          mongoc_cluster_node_t *node,
+                          int32_t               *rtt_msec,
+                          bson_error_t          *error)
+{
+   bool ret = false;
+   int64_t t_begin;
+   bson_t command;
+   bson_t reply;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(node);
+   BSON_ASSERT(node->stream);
+
+   bson_init(&command);
+   bson_append_int32(&command, "isMaster", 8, 1);
+   _mongoc_cluster_append_compression (cluster, &command);
+
+   t_begin = bson_get_monotonic_time ();
+
+   if (_mongoc_cluster_run_command (cluster, node, "admin", &command, &reply,
+                                    error)) {
+      ret = _mongoc_cluster_process_ismaster (cluster, node, &reply, error);
+      if (ret && rtt_msec) {
+         *rtt_msec = (int32_t)((bson_get_monotonic_time () - t_begin) / 1000L);
+      }
+   }
+
+   bson_destroy(&command);
+   bson_destroy(&reply);
+
+   RETURN(ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node_cr --
+ *
+ *       Performs authentication of @node using the credentials provided
+ *       when configuring the @cluster instance.
+ *
+ *       This is the Challenge-Response mode of authentication.
+ *
+ * Returns:
+ *       true if authentication was successful; otherwise false and
+ *       @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node_cr (mongoc_cluster_t      *cluster,
+                              mongoc_cluster_node_t *node,
+                              bson_error_t          *error)
+{
+   bson_iter_t iter;
+   const char *auth_source;
+   bson_t command = { 0 };
+   bson_t reply = { 0 };
+   char *digest;
+   char *nonce;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(node);
+
+   if (!(auth_source = mongoc_uri_get_auth_source(cluster->uri)) ||
+       (*auth_source == '\0')) {
+      auth_source = "admin";
+   }
+
+   /*
+    * To authenticate a node using basic authentication, we need to first
+    * get the nonce from the server. We use that to hash our password which
+    * is sent as a reply to the server. If everything went good we get a
+    * success notification back from the server.
+    */
+
+   /*
+    * Execute the getnonce command to fetch the nonce used for generating
+    * md5 digest of our password information.
+    */
+   bson_init (&command);
+   bson_append_int32 (&command, "getnonce", 8, 1);
+   if (!_mongoc_cluster_run_command (cluster, node, auth_source, &command,
+                                     &reply, error)) {
+      bson_destroy (&command);
+      RETURN (false);
+   }
+   bson_destroy (&command);
+   if (!bson_iter_init_find_case (&iter, &reply, "nonce")) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_GETNONCE,
+                      "Invalid reply from getnonce");
+      bson_destroy (&reply);
+      RETURN (false);
+   }
+
+   /*
+    * Build our command to perform the authentication.
+    */
+   nonce = bson_iter_dup_utf8(&iter, NULL);
+   digest = _mongoc_cluster_build_basic_auth_digest(cluster, nonce);
+   bson_init(&command);
+   bson_append_int32(&command, "authenticate", 12, 1);
+   bson_append_utf8(&command, "user", 4,
+                    mongoc_uri_get_username(cluster->uri), -1);
+   bson_append_utf8(&command, "nonce", 5, nonce, -1);
+   bson_append_utf8(&command, "key", 3, digest, -1);
+   bson_destroy(&reply);
+   bson_free(nonce);
+   bson_free(digest);
+
+   /*
+    * Execute the authenticate command and check for {ok:1}
+    */
+   if (!_mongoc_cluster_run_command (cluster, node, auth_source, &command,
+                                     &reply, error)) {
+      bson_destroy (&command);
+      RETURN (false);
+   }
+
+   bson_destroy (&command);
+
+   if (!bson_iter_init_find_case(&iter, &reply, "ok") ||
+       !bson_iter_as_bool(&iter)) {
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                     "Failed to authenticate credentials.");
+      bson_destroy(&reply);
+      RETURN(false);
+   }
+
+   bson_destroy(&reply);
+
+   RETURN(true);
+}
+
+
+#ifdef MONGOC_ENABLE_SASL
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_get_canonicalized_name --
+ *
+ *       Query the node to get the canonicalized name. This may happen if
+ *       the node has been accessed via an alias.
+ *
+ *       The gssapi code will use this if canonicalizeHostname is true.
+ *       The name is looked up in reverse through the process-wide DNS
+ *       cache, for as long as the "dnsCacheTTLMS" of the URI, so that
+ *       each new connection to a node does not wait for the resolver.
+ *
+ *       Some underlying layers of krb might do this for us, but they can
+ *       be disabled in krb.conf.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_get_canonicalized_name (mongoc_cluster_t      *cluster, /* IN */
+                                        mongoc_cluster_node_t *node,    /* IN */
+                                        char                  *name,    /* OUT */
+                                        size_t                 namelen, /* IN */
+                                        bson_error_t          *error)   /* OUT */
+{
+   mongoc_stream_t *stream;
+   mongoc_stream_t *tmp;
+   mongoc_socket_t *sock = NULL;
+   int64_t ttl_msec = MONGOC_DEFAULT_DNS_CACHE_TTL_MS;
+   const bson_t *options;
+   bson_iter_t iter;
+   char *canonicalized;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (name);
+
+   if ((options = mongoc_uri_get_options (cluster->uri)) &&
+       bson_iter_init_find_case (&iter, options, "dnscachettlms") &&
+       BSON_ITER_HOLDS_INT32 (&iter)) {
+      ttl_msec = bson_iter_int32 (&iter);
+   }
+
+   /*
+    * Find the underlying socket used in the stream chain.
+    */
+   for (stream = node->stream; stream;) {
+      if ((tmp = mongoc_stream_get_base_stream (stream))) {
+         stream = tmp;
+         continue;
+      }
+      break;
+   }
+
+   BSON_ASSERT (stream);
+
+   if (stream->type == MONGOC_STREAM_SOCKET) {
+      sock = mongoc_stream_socket_get_socket ((mongoc_stream_socket_t *)stream);
+      if (sock) {
+         canonicalized = _mongoc_socket_getnameinfo_cached (sock, ttl_msec);
+         if (canonicalized) {
+            bson_snprintf (name, namelen, "%s", canonicalized);
+            bson_free (canonicalized);
+            RETURN (true);
+         }
+      }
+   }
+
+   RETURN (false);
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_SASL
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node_sasl --
+ *
+ *       Perform authentication for a cluster node using SASL. This is
+ *       only supported for GSSAPI at the moment.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node_sasl (mongoc_cluster_t      *cluster,
+                                mongoc_cluster_node_t *node,
+                                bson_error_t          *error)
+{
+   uint32_t buflen = 0;
+   mongoc_sasl_t sasl;
+   const bson_t *options;
+   bson_iter_t iter;
+   bool ret = false;
+   char real_name [BSON_HOST_NAME_MAX + 1];
+   const char *service_name;
+   const char *mechanism;
+   const char *tmpstr;
+   uint8_t buf[4096] = { 0 };
+   bson_t cmd;
+   bson_t reply;
+   int conv_id = 0;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   options = mongoc_uri_get_options (cluster->uri);
+
+   _mongoc_sasl_init (&sasl);
+
+   if ((mechanism = mongoc_uri_get_auth_mechanism (cluster->uri))) {
+      _mongoc_sasl_set_mechanism (&sasl, mechanism);
+   }
+
+   if (bson_iter_init_find_case (&iter, options, "gssapiservicename") &&
+       BSON_ITER_HOLDS_UTF8 (&iter) &&
+       (service_name = bson_iter_utf8 (&iter, NULL))) {
+      _mongoc_sasl_set_service_name (&sasl, service_name);
+   }
+
+   _mongoc_sasl_set_pass (&sasl, mongoc_uri_get_password (cluster->uri));
+   _mongoc_sasl_set_user (&sasl, mongoc_uri_get_username (cluster->uri));
+
+   /*
+    * If the URI requested canonicalizeHostname, we need to resolve the real
+    * hostname for the IP Address and pass that to the SASL layer. Some
+    * underlying GSSAPI layers will do this for us, but can be disabled in
+    * their config (krb.conf).
+    *
+    * This allows the consumer to specify canonicalizeHostname=true in the URI
+    * and have us do that for them.
+    *
+    * See CDRIVER-323 for more information.
+    */
+   if (bson_iter_init_find_case (&iter, options, "canonicalizeHostname") &&
+       BSON_ITER_HOLDS_BOOL (&iter) &&
+       bson_iter_bool (&iter)) {
+      if (_mongoc_cluster_get_canonicalized_name (cluster, node, real_name,
+                                                  sizeof real_name, error)) {
+         _mongoc_sasl_set_service_host (&sasl, real_name);
+      } else {
+         _mongoc_sasl_set_service_host (&sasl, node->host.host);
+      }
+   } else {
+      _mongoc_sasl_set_service_host (&sasl, node->host.host);
+   }
+
+   for (;;) {
+      if (!_mongoc_sasl_step (&sasl, buf, buflen, buf, sizeof buf, &buflen, error)) {
+         goto failure;
+      }
+
+      bson_init (&cmd);
+
+      if (sasl.step == 1) {
+         BSON_APPEND_INT32 (&cmd, "saslStart", 1);
+         BSON_APPEND_UTF8 (&cmd, "mechanism", mechanism ? mechanism : "GSSAPI");
+         bson_append_utf8 (&cmd, "payload", 7, (const char *)buf, buflen);
+         BSON_APPEND_INT32 (&cmd, "autoAuthorize", 1);
+      } else {
+         BSON_APPEND_INT32 (&cmd, "saslContinue", 1);
+         BSON_APPEND_INT32 (&cmd, "conversationId", conv_id);
+         bson_append_utf8 (&cmd, "payload", 7, (const char *)buf, buflen);
+      }
+
+      MONGOC_INFO ("SASL: authenticating \"%s\" (step %d)",
+                   mongoc_uri_get_username (cluster->uri),
+                   sasl.step);
+
+      if (!_mongoc_cluster_run_command (cluster, node, "$external", &cmd, &reply, error)) {
+         bson_destroy (&cmd);
+         goto failure;
+      }
+
+      bson_destroy (&cmd);
+
+      if (bson_iter_init_find (&iter, &reply, "done") &&
+          bson_iter_as_bool (&iter)) {
+         bson_destroy (&reply);
+         break;
+      }
+
+      if (!bson_iter_init_find (&iter, &reply, "ok") ||
+          !bson_iter_as_bool (&iter) ||
+          !bson_iter_init_find (&iter, &reply, "conversationId") ||
+          !BSON_ITER_HOLDS_INT32 (&iter) ||
+          !(conv_id = bson_iter_int32 (&iter)) ||
+          !bson_iter_init_find (&iter, &reply, "payload") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         MONGOC_INFO ("SASL: authentication failed for \"%s\"",
+                      mongoc_uri_get_username (cluster->uri));
+         bson_destroy (&reply);
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "Received invalid SASL reply from MongoDB server.");
+         goto failure;
+      }
+
+      tmpstr = bson_iter_utf8 (&iter, &buflen);
+
+      if (buflen > sizeof buf) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "SASL reply from MongoDB is too large.");
+         goto failure;
+      }
+
+      memcpy (buf, tmpstr, buflen);
+
+      bson_destroy (&reply);
+   }
+
+   MONGOC_INFO ("SASL: \"%s\" authenticated",
+                mongoc_uri_get_username (cluster->uri));
+
+   ret = true;
+
+failure:
+   _mongoc_sasl_destroy (&sasl);
+
+   return ret;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node_plain --
+ *
+ *       Perform SASL PLAIN authentication for @node. We do this manually
+ *       instead of using the SASL module because its rather simplistic.
+ *
+ * Returns:
+ *       true if successful; otherwise false and error is set.
+ *
+ * Side effects:
+ *       error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node_plain (mongoc_cluster_t      *cluster,
+                                 mongoc_cluster_node_t *node,
+                                 bson_error_t          *error)
+{
+   char buf[4096];
+   int buflen = 0;
+   bson_iter_t iter;
+   const char *username;
+   const char *password;
+   const char *errmsg = "Unknown authentication error.";
+   bson_t b = BSON_INITIALIZER;
+   bson_t reply;
+   size_t len;
+   char *str;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   username = mongoc_uri_get_username (cluster->uri);
+   if (!username) {
+      username = "";
+   }
+
+   password = mongoc_uri_get_password (cluster->uri);
+   if (!password) {
+      password = "";
+   }
+
+   str = bson_strdup_printf ("%c%s%c%s", '\0', username, '\0', password);
+   len = strlen (username) + strlen (password) + 2;
+   buflen = mongoc_b64_ntop ((const uint8_t *) str, len, buf, sizeof buf);
+   bson_free (str);
+
+   if (buflen == -1) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "failed base64 encoding message");
+      return false;
+   }
+
+   BSON_APPEND_INT32 (&b, "saslStart", 1);
+   BSON_APPEND_UTF8 (&b, "mechanism", "PLAIN");
+   bson_append_utf8 (&b, "payload", 7, (const char *)buf, buflen);
+   BSON_APPEND_INT32 (&b, "autoAuthorize", 1);
+
+   if (!_mongoc_cluster_run_command (cluster, node, "$external", &b, &reply, error)) {
+      bson_destroy (&b);
+      return false;
+   }
+
+   bson_destroy (&b);
+
+   if (!bson_iter_init_find_case (&iter, &reply, "ok") ||
+       !bson_iter_as_bool (&iter)) {
+      if (bson_iter_init_find_case (&iter, &reply, "errmsg") &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         errmsg = bson_iter_utf8 (&iter, NULL);
+      }
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "%s", errmsg);
+      bson_destroy (&reply);
+      return false;
+   }
+
+   bson_destroy (&reply);
+
+   return true;
+}
+
+
+#ifdef MONGOC_ENABLE_SSL
+static bool
+_mongoc_cluster_auth_node_x509 (mongoc_cluster_t      *cluster,
+                                mongoc_cluster_node_t *node,
+                                bson_error_t          *error)
+{
+   const char *username = "";
+   const char *errmsg = "X509 authentication failure";
+   bson_iter_t iter;
+   bool ret = false;
+   bson_t cmd;
+   bson_t reply;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   username = mongoc_uri_get_username(cluster->uri);
+   if (username) {
+      MONGOC_INFO ("X509: got username (%s) from URI", username);
+   } else {
+      if (!cluster->client->ssl_opts.pem_file) {
+         bson_set_error (error,
+               MONGOC_ERROR_CLIENT,
+               MONGOC_ERROR_CLIENT_AUTHENTICATE,
+               "cannot determine username "
+               "please either set it as part of the connection string or "
+               "call mongoc_client_set_ssl_opts() "
+               "with pem file for X-509 auth.");
+         return false;
+      }
+
+      if (cluster->client->pem_subject) {
+         username = cluster->client->pem_subject;
+         MONGOC_INFO ("X509: got username (%s) from certificate", username);
+      }
+   }
+
+   bson_init (&cmd);
+   BSON_APPEND_INT32 (&cmd, "authenticate", 1);
+   BSON_APPEND_UTF8 (&cmd, "mechanism", "MONGODB-X509");
+   BSON_APPEND_UTF8 (&cmd, "user", username);
+
+   if (!_mongoc_cluster_run_command (cluster, node, "$external", &cmd, &reply,
+                                     error)) {
+      bson_destroy (&cmd);
+      return false;
+   }
+
+   if (!bson_iter_init_find (&iter, &reply, "ok") ||
+       !bson_iter_as_bool (&iter)) {
+      if (bson_iter_init_find (&iter, &reply, "errmsg") &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         errmsg = bson_iter_utf8 (&iter, NULL);
+      }
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "%s", errmsg);
+      goto failure;
+   }
+
+   ret = true;
+
+failure:
+
+   bson_destroy (&cmd);
+   bson_destroy (&reply);
+
+   return ret;
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_SSL
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_scram_start --
+ *
+ *       Run the first step of a SCRAM-SHA-1 conversation with @scram and
+ *       build the "saslStart" command carrying it into @cmd.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @cmd is initialized and should ALWAYS be released with
+ *       bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_scram_start (mongoc_cluster_t *cluster,
+                             mongoc_scram_t   *scram,
+                             bson_t           *cmd,
+                             bson_error_t     *error)
+{
+   uint8_t buf[4096] = { 0 };
+   uint32_t buflen = 0;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (scram);
+   BSON_ASSERT (cmd);
+
+   bson_init (cmd);
+
+   if (!_mongoc_scram_step (scram, buf, buflen, buf, sizeof buf, &buflen, error)) {
+      return false;
+   }
+
+   BSON_APPEND_INT32 (cmd, "saslStart", 1);
+   BSON_APPEND_UTF8 (cmd, "mechanism", "SCRAM-SHA-1");
+   bson_append_binary (cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
+   BSON_APPEND_INT32 (cmd, "autoAuthorize", 1);
+
+   MONGOC_INFO ("SCRAM: authenticating \"%s\" (step %d)",
+                mongoc_uri_get_username (cluster->uri),
+                scram->step);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_scram_continue --
+ *
+ *       Carry a SCRAM-SHA-1 conversation on from the server's @reply to
+ *       "saslStart" until the server reports it done.
+ *
+ * Returns:
+ *       true if authentication was successful; otherwise false and
+ *       @error is set.
+ *
+ * Side effects:
+ *       @reply is destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_scram_continue (mongoc_cluster_t      *cluster,
+                                mongoc_cluster_node_t *node,
+                                mongoc_scram_t        *scram,
+                                const char            *auth_source,
+                                bson_t                *reply,
+                                bson_error_t          *error)
+{
+   uint32_t buflen = 0;
+   bson_iter_t iter;
+   const char *tmpstr;
+   uint8_t buf[4096] = { 0 };
+   bson_t cmd;
+   int conv_id = 0;
+   bson_subtype_t btype;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (scram);
+   BSON_ASSERT (reply);
+
+   for (;;) {
+      if (bson_iter_init_find (&iter, reply, "done") &&
+          bson_iter_as_bool (&iter)) {
+         bson_destroy (reply);
+         break;
+      }
+
+      if (!bson_iter_init_find (&iter, reply, "ok") ||
+          !bson_iter_as_bool (&iter) ||
+          !bson_iter_init_find (&iter, reply, "conversationId") ||
+          !BSON_ITER_HOLDS_INT32 (&iter) ||
+          !(conv_id = bson_iter_int32 (&iter)) ||
+          !bson_iter_init_find (&iter, reply, "payload") ||
+          !BSON_ITER_HOLDS_BINARY(&iter)) {
+         const char *errmsg = "Received invalid SCRAM reply from MongoDB server.";
+
+         MONGOC_INFO ("SCRAM: authentication failed for \"%s\"",
+                      mongoc_uri_get_username (cluster->uri));
+
+         if (bson_iter_init_find (&iter, reply, "errmsg") &&
+               BSON_ITER_HOLDS_UTF8 (&iter)) {
+            errmsg = bson_iter_utf8 (&iter, NULL);
+         }
+
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "%s", errmsg);
+         bson_destroy (reply);
+         return false;
+      }
+
+      bson_iter_binary (&iter, &btype, &buflen, (const uint8_t**)&tmpstr);
+
+      if (buflen > sizeof buf) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                         "SCRAM reply from MongoDB is too large.");
+         bson_destroy (reply);
+         return false;
+      }
+
+      memcpy (buf, tmpstr, buflen);
+
+      bson_destroy (reply);
+
+      if (!_mongoc_scram_step (scram, buf, buflen, buf, sizeof buf, &buflen, error)) {
+         return false;
+      }
+
+      bson_init (&cmd);
+
+      BSON_APPEND_INT32 (&cmd, "saslContinue", 1);
+      BSON_APPEND_INT32 (&cmd, "conversationId", conv_id);
+      bson_append_binary (&cmd, "payload", 7, BSON_SUBTYPE_BINARY, buf, buflen);
+
+      MONGOC_INFO ("SCRAM: authenticating \"%s\" (step %d)",
+                   mongoc_uri_get_username (cluster->uri),
+                   scram->step);
+
+      if (!_mongoc_cluster_run_command (cluster, node, auth_source, &cmd, reply, error)) {
+         bson_destroy (&cmd);
+         bson_destroy (reply);
+         return false;
+      }
+
+      bson_destroy (&cmd);
+   }
+
+   MONGOC_INFO ("SCRAM: \"%s\" authenticated",
+                mongoc_uri_get_username (cluster->uri));
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_scram_init --
+ *
+ *       Prepare @scram with the credentials of @cluster and find the
+ *       database to authenticate against.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @scram should be released with _mongoc_scram_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_scram_init (mongoc_cluster_t  *cluster,
+                            mongoc_scram_t    *scram,
+                            const char       **auth_source)
+{
+   if (!(*auth_source = mongoc_uri_get_auth_source(cluster->uri)) ||
+       (**auth_source == '\0')) {
+      *auth_source = "admin";
+   }
+
+   _mongoc_scram_init(scram);
+
+   _mongoc_scram_set_pass (scram, mongoc_uri_get_password (cluster->uri));
+   _mongoc_scram_set_user (scram, mongoc_uri_get_username (cluster->uri));
+}
+
+
+static bool
+_mongoc_cluster_auth_node_scram (mongoc_cluster_t      *cluster,
+                                 mongoc_cluster_node_t *node,
+                                 bson_error_t          *error)
+{
+   mongoc_scram_t scram;
+   bool ret = false;
+   const char *auth_source;
+   bson_t cmd;
+   bson_t reply;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   _mongoc_cluster_scram_init (cluster, &scram, &auth_source);
+
+   if (_mongoc_cluster_scram_start (cluster, &scram, &cmd, error)) {
+      if (_mongoc_cluster_run_command (cluster, node, auth_source, &cmd,
+                                       &reply, error)) {
+         ret = _mongoc_cluster_scram_continue (cluster, node, &scram,
+                                               auth_source, &reply, error);
+      } else {
+         bson_destroy (&reply);
+      }
+   }
+
+   bson_destroy (&cmd);
+   _mongoc_scram_destroy (&scram);
+
+   return ret;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_auth_node --
+ *
+ *       Authenticate a cluster node depending on the required mechanism.
+ *
+ * Returns:
+ *       true if authenticated. false on failure and @error is set.
+ *
+ * Side effects:
+ *       @error is set on failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_auth_node (mongoc_cluster_t      *cluster,
+                           mongoc_cluster_node_t *node,
+                           bson_error_t          *error)
+{
+   bool ret = false;
+   const char *mechanism;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+
+   if (!mechanism) {
+      if (node->max_wire_version < 3) {
+         mechanism = "MONGODB-CR";
+      } else {
+         mechanism = "SCRAM-SHA-1";
+      }
+   }
+
+   if (0 == strcasecmp (mechanism, "MONGODB-CR")) {
+      ret = _mongoc_cluster_auth_node_cr (cluster, node, error);
+#ifdef MONGOC_ENABLE_SSL
+   } else if (0 == strcasecmp (mechanism, "MONGODB-X509")) {
+      ret = _mongoc_cluster_auth_node_x509 (cluster, node, error);
+   } else if (0 == strcasecmp (mechanism, "SCRAM-SHA-1")) {
+      ret = _mongoc_cluster_auth_node_scram (cluster, node, error);
+#endif
+#ifdef MONGOC_ENABLE_SASL
+   } else if (0 == strcasecmp (mechanism, "GSSAPI")) {
+      ret = _mongoc_cluster_auth_node_sasl (cluster, node, error);
+#endif
+   } else if (0 == strcasecmp (mechanism, "PLAIN")) {
+      ret = _mongoc_cluster_auth_node_plain (cluster, node, error);
+   } else {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_AUTHENTICATE,
+                      "The authentication mechanism \"%s\" is not supported.",
+                      mechanism);
+   }
+
+   if (!ret) {
+      mongoc_counter_auth_failure_inc ();
+   } else {
+      mongoc_counter_auth_success_inc ();
+   }
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_handshake --
+ *
+ *       Run "isMaster" on a freshly connected @node and authenticate it
+ *       if required, in as few round trips as possible.
+ *
+ *       When SCRAM-SHA-1 is the likely mechanism, "saslStart" is written
+ *       together with "isMaster" so the first step of the conversation
+ *       costs no extra round trip. If "isMaster" then shows that the node
+ *       only supports MONGODB-CR, the speculative reply is discarded and
+ *       the regular mechanism runs.
+ *
+ *       No separate "ping" is sent; the "isMaster" round trip is used as
+ *       the latency sample.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @rtt_msec is set to the round-trip time of "isMaster", or -1 if
+ *       "isMaster" failed. So if this returns false with @rtt_msec set,
+ *       it was authentication that failed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_handshake (mongoc_cluster_t      *cluster,
+                           mongoc_cluster_node_t *node,
+                           int32_t               *rtt_msec,
+                           bson_error_t          *error)
+{
+#ifdef MONGOC_ENABLE_SSL
+   const char *db_names[2];
+   const bson_t *commands[2];
+   const char *auth_source;
+   const char *mechanism;
+   mongoc_scram_t scram;
+   int64_t t_begin;
+   bson_t ismaster;
+   bson_t reply;
+   bson_t sasl;
+   bool ret = false;
+#endif
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (node->stream);
+   BSON_ASSERT (rtt_msec);
+
+   *rtt_msec = -1;
+
+#ifdef MONGOC_ENABLE_SSL
+   mechanism = mongoc_uri_get_auth_mechanism (cluster->uri);
+
+   if (node->needs_auth &&
+       (!mechanism || (0 == strcasecmp (mechanism, "SCRAM-SHA-1")))) {
+      _mongoc_cluster_scram_init (cluster, &scram, &auth_source);
+
+      bson_init (&ismaster);
+      bson_append_int32 (&ismaster, "isMaster", 8, 1);
+      _mongoc_cluster_append_compression (cluster, &ismaster);
+
+      if (!_mongoc_cluster_scram_start (cluster, &scram, &sasl, error)) {
+         GOTO (speculative_cleanup);
+      }
+
+      db_names[0] = "admin";
+      commands[0] = &ismaster;
+      db_names[1] = auth_source;
+      commands[1] = &sasl;
+
+      t_begin = bson_get_monotonic_time ();
+
+      if (!_mongoc_cluster_send_commands (cluster, node, db_names, commands,
+                                          2, error)) {
+         GOTO (speculative_cleanup);
+      }
+
+      if (!_mongoc_cluster_recv_reply (cluster, node, &reply, error)) {
+         bson_destroy (&reply);
+         GOTO (speculative_cleanup);
+      }
+
+      if (!_mongoc_cluster_process_ismaster (cluster, node, &reply, error)) {
+         bson_destroy (&reply);
+         GOTO (speculative_cleanup);
+      }
+
+      *rtt_msec = (int32_t)((bson_get_monotonic_time () - t_begin) / 1000L);
+
+      bson_destroy (&reply);
+
+      /*
+       * The saslStart reply has to be read to keep the stream in step,
+       * even if it turns out we won't use it.
+       */
+      if (!_mongoc_cluster_recv_reply (cluster, node, &reply, error)) {
+         bson_destroy (&reply);
+         GOTO (speculative_cleanup);
+      }
+
+      if (!mechanism && (node->max_wire_version < 3)) {
+         bson_destroy (&reply);
+         ret = _mongoc_cluster_auth_node (cluster, node, error);
+      } else {
+         ret = _mongoc_cluster_scram_continue (cluster, node, &scram,
+                                               auth_source, &reply, error);
+         if (!ret) {
+            mongoc_counter_auth_failure_inc ();
+         } else {
+            mongoc_counter_auth_success_inc ();
+         }
+      }
+
+      if (ret) {
+         node->needs_auth = false;
+      }
+
+speculative_cleanup:
+      bson_destroy (&sasl);
+      bson_destroy (&ismaster);
+      _mongoc_scram_destroy (&scram);
+
+      RETURN (ret);
+   }
+#endif
+
+   if (!_mongoc_cluster_ismaster (cluster, node, rtt_msec, error)) {
+      RETURN (false);
+   }
+
+   if (node->needs_auth) {
+      if (!_mongoc_cluster_auth_node (cluster, node, error)) {
+         RETURN (false);
+      }
+      node->needs_auth = false;
+   }
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_connect_lazy --
+ *
+ *       Open and authenticate the stream of a node that was discovered
+ *       with the "lazyConnect" URI option. The "isMaster" sent during the
+ *       handshake refreshes the state recorded at discovery time.
+ *
+ * Returns:
+ *       true if @node is now connected; otherwise false, @node is
+ *       disconnected and @error is set.
+ *
+ * Side effects:
+ *       The cluster state is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_node_connect_lazy (mongoc_cluster_t      *cluster,
+                                   mongoc_cluster_node_t *node,
+                                   bson_error_t          *error)
+{
+   mongoc_stream_t *stream;
+   struct timeval timeout;
+   int32_t rtt_msec;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (node->lazy);
+   BSON_ASSERT (!node->stream);
+
+   MONGOC_DEBUG ("Connecting lazily to %s", node->host.host_and_port);
+
+   stream = _mongoc_client_create_stream (cluster->client, &node->host,
+                                          error);
+   if (!stream) {
+      _mongoc_cluster_node_record_failure (cluster, node, false);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   node->stream = stream;
+   node->stamp++;
+   node->lazy = 0;
+
+   timeout.tv_sec = cluster->sockettimeoutms / 1000UL;
+   timeout.tv_usec = (cluster->sockettimeoutms % 1000UL) * 1000UL;
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_RCVTIMEO,
+                             &timeout, sizeof timeout);
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_SNDTIMEO,
+                             &timeout, sizeof timeout);
+
+   bson_destroy (&node->tags);
+   bson_init (&node->tags);
+   _mongoc_cluster_node_reset_tag_sets (node);
+
+   cluster->connecting++;
+   ret = _mongoc_cluster_handshake (cluster, node, &rtt_msec, error);
+   cluster->connecting--;
+
+   if (!ret) {
+      _mongoc_cluster_node_record_failure (cluster, node, false);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   _mongoc_cluster_node_track_ping (node, rtt_msec);
+
+   _mongoc_cluster_update_state (cluster);
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_reconnect_direct --
+ *
+ *       Reconnect to our only configured node.
+ *
+ *       "isMaster" is run after connecting to determine PRIMARY status.
+ *
+ *       If the node is valid, we will also greedily authenticate the
+ *       configured user if available.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_reconnect_direct (mongoc_cluster_t *cluster,
+                                  bson_error_t     *error)
+{
+   const mongoc_host_list_t *hosts;
+   mongoc_cluster_node_t *node;
+   mongoc_stream_t *stream;
+   struct timeval timeout;
+   int32_t rtt_msec = -1;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+
+   if (!(hosts = mongoc_uri_get_hosts(cluster->uri))) {
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NOT_READY,
+                     "Invalid host list supplied.");
+      RETURN(false);
+   }
+
+   cluster->last_reconnect = bson_get_monotonic_time();
+
+   node = &cluster->nodes[0];
+
+   node->index = 0;
+   node->host = *hosts;
    node->needs_auth = cluster->requires_auth;
    node->primary = false;
    node->ping_avg_msec = -1;
-   memset(node->pings, 0xFF, sizeof node->pings);
-   node->pings_pos = 0;
+   node->rtt_msec = -1;
+   node->op_latency_msec = -1;
+   node->op_started = 0;
    node->stream = NULL;
    node->stamp++;
    bson_init(&node->tags);
+   _mongoc_cluster_node_reset_tag_sets (node);
+
+   stream = _mongoc_client_create_stream (cluster->client, hosts, error);
+   if (!stream) {
+      RETURN (false);
+   }
+
+   node->stream = stream;
+   node->stamp++;
+
+   timeout.tv_sec = cluster->sockettimeoutms / 1000UL;
+   timeout.tv_usec = (cluster->sockettimeoutms % 1000UL) * 1000UL;
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_RCVTIMEO,
+                             &timeout, sizeof timeout);
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_SNDTIMEO,
+                             &timeout, sizeof timeout);
+
+   if (!_mongoc_cluster_handshake (cluster, node, &rtt_msec, error)) {
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   _mongoc_cluster_node_track_ping (node, rtt_msec);
+
+   _mongoc_cluster_update_state (cluster);
+
+   RETURN (true);
+}
+
+mongoc_host_list_t *
+prepend_host (const mongoc_host_list_t *host, mongoc_host_list_t *list)
+{
+   mongoc_host_list_t *cpy = bson_malloc (sizeof *host);
+
+   memcpy (cpy, host, sizeof *host);
+   cpy->next = list;
+
+   return cpy;
+}
+
+/*
+ * Case-sensitive search for host-and-port.
+ */
+bool
+has_host (const mongoc_host_list_t *hl,
+          const char               *host_and_port)
+{
+   printf ("has_host %s\n", host_and_port);
+
+   while (hl) {
+      if (!strcmp(hl->host_and_port, host_and_port)) {
+         printf ("\tyes\n");
+         return true;
+      }
+
+      hl = hl->next;
+   }
+
+   printf ("\tno\n");
+   return false;
+}
+
+
+void
+host_list_destroy (mongoc_host_list_t *hl)
+{
+   mongoc_host_list_t *tmp;
+
+   while (hl) {
+      tmp = hl->next;
+      bson_free (hl);
+      hl = tmp;
+   }
+}
+
+
+/*
+ * State for one connection attempt made by
+ * _mongoc_cluster_connect_parallel().
+ */
+typedef struct
+{
+   mongoc_client_t    *client;
+   mongoc_host_list_t  host;
+   mongoc_stream_t    *stream;
+   mongoc_thread_t     thread;
+   bson_error_t        error;
+} mongoc_cluster_connect_t;
+
+
+static void *
+_mongoc_cluster_connect_worker (void *data)
+{
+   mongoc_cluster_connect_t *conn = data;
+
+   conn->stream = _mongoc_client_create_stream (conn->client, &conn->host,
+                                                &conn->error);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_connect_parallel --
+ *
+ *       Create a stream for each host in @conns at the same time.
+ *
+ *       Streams are created by the client's stream initiator, which may
+ *       block on connect() and a TLS handshake, so each attempt runs on
+ *       its own short-lived thread.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The stream field of each element of @conns is set, or NULL and
+ *       the error field is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_connect_parallel (mongoc_cluster_t         *cluster,
+                                  mongoc_cluster_connect_t *conns,
+                                  size_t                    n_conns)
+{
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (conns || !n_conns);
+
+   for (i = 0; i < n_conns; i++) {
+      conns[i].client = cluster->client;
+   }
+
+   if (n_conns == 1) {
+      _mongoc_cluster_connect_worker (&conns[0]);
+      EXIT;
+   }
+
+   for (i = 0; i < n_conns; i++) {
+      mongoc_thread_create (&conns[i].thread, _mongoc_cluster_connect_worker,
+                            &conns[i]);
+   }
+
+   for (i = 0; i < n_conns; i++) {
+      mongoc_thread_join (conns[i].thread);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_run_command_parallel --
+ *
+ *       Run @command on each of @nodes at the same time. The command is
+ *       written to every node first and the replies are then read as
+ *       they arrive using a single poll() over the underlying sockets,
+ *       so the total time is bounded by the slowest node rather than
+ *       the sum of all round trips.
+ *
+ *       Nodes without a stream are skipped. Nodes whose stream is not
+ *       backed by a socket are read in turn.
+ *
+ *       @replies is optional. If provided, it must contain @n_nodes
+ *       elements which are all initialized upon return and must be
+ *       released with bson_destroy().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @rtt_msec[i] is set to the round-trip time of nodes[i] in
+ *       milliseconds, or -1 if the command failed, in which case the node
+ *       has been disconnected and @error is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_run_command_parallel (mongoc_cluster_t       *cluster,
+                                      mongoc_cluster_node_t **nodes,
+                                      size_t                  n_nodes,
+                                      const char             *db_name,
+                                      const bson_t           *command,
+                                      bson_t                 *replies,
+                                      int32_t                *rtt_msec,
+                                      bson_error_t           *error)
+{
+   mongoc_socket_poll_t *sds;
+   mongoc_socket_t *sock;
+   size_t *sds_nodes;
+   size_t n_sds;
+   size_t pending = 0;
+   int64_t *started;
+   int64_t expire_at;
+   int64_t now;
+   bool *waiting;
+   bool *answered;
+   bool ok;
+   size_t i;
+   size_t j;
+   ssize_t r;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (nodes || !n_nodes);
+   BSON_ASSERT (rtt_msec);
+
+   sds = bson_malloc0 (sizeof *sds * (n_nodes + 1));
+   sds_nodes = bson_malloc0 (sizeof *sds_nodes * (n_nodes + 1));
+   started = bson_malloc0 (sizeof *started * (n_nodes + 1));
+   waiting = bson_malloc0 (sizeof *waiting * (n_nodes + 1));
+   answered = bson_malloc0 (sizeof *answered * (n_nodes + 1));
+
+   for (i = 0; i < n_nodes; i++) {
+      rtt_msec[i] = -1;
+
+      if (!nodes[i]->stream) {
+         continue;
+      }
+
+      started[i] = bson_get_monotonic_time ();
+
+      if (_mongoc_cluster_send_command (cluster, nodes[i], db_name, command,
+                                        error)) {
+         waiting[i] = true;
+         pending++;
+      } else {
+         MONGOC_INFO ("%s: Failed to send command.",
+                      nodes[i]->host.host_and_port);
+      }
+   }
+
+   expire_at = bson_get_monotonic_time () +
+               ((int64_t)_mongoc_cluster_phase_timeout (cluster) * 1000L);
+
+   if (cluster->deadline && (cluster->deadline < expire_at)) {
+      expire_at = cluster->deadline;
+   }
+
+   while (pending) {
+      n_sds = 0;
+
+      for (i = 0; i < n_nodes; i++) {
+         if (!waiting[i]) {
+            continue;
+         }
+
+         if ((sock = _mongoc_stream_get_socket (nodes[i]->stream))) {
+            sds[n_sds].socket = sock;
+            sds[n_sds].events = POLLIN;
+            sds_nodes[n_sds] = i;
+            n_sds++;
+            continue;
+         }
+
+         /*
+          * Not a socket we can poll, just block until the reply arrives.
+          */
+         ok = _mongoc_cluster_recv_reply (cluster, nodes[i],
+                                          replies ? &replies[i] : NULL,
+                                          error);
+         if (ok) {
+            rtt_msec[i] = (int32_t)((bson_get_monotonic_time () -
+                                     started[i]) / 1000L);
+         }
+         answered[i] = true;
+         waiting[i] = false;
+         pending--;
+      }
+
+      if (!n_sds) {
+         continue;
+      }
+
+      now = bson_get_monotonic_time ();
+      if (now >= expire_at) {
+         break;
+      }
+
+      r = _mongoc_socket_poll (sds, n_sds,
+                               (int32_t)((expire_at - now) / 1000L));
+      if (r < 0 && errno == EINTR) {
+         continue;
+      } else if (r <= 0) {
+         break;
+      }
+
+      for (i = 0; i < n_sds; i++) {
+         if (!sds[i].revents) {
+            continue;
+         }
+
+         j = sds_nodes[i];
+         ok = _mongoc_cluster_recv_reply (cluster, nodes[j],
+                                          replies ? &replies[j] : NULL,
+                                          error);
+         if (ok) {
+            rtt_msec[j] = (int32_t)((bson_get_monotonic_time () -
+                                     started[j]) / 1000L);
+         }
+         answered[j] = true;
+         waiting[j] = false;
+         pending--;
+      }
+   }
+
+   for (i = 0; i < n_nodes; i++) {
+      if (waiting[i]) {
+         bson_set_error (error,
+                         MONGOC_ERROR_STREAM,
+                         MONGOC_ERROR_STREAM_SOCKET,
+                         "Timed out waiting for reply from %s.",
+                         nodes[i]->host.host_and_port);
+         _mongoc_cluster_disconnect_node (cluster, nodes[i]);
+      }
+
+      if (replies && !answered[i]) {
+         bson_init (&replies[i]);
+      }
+   }
+
+   bson_free (sds);
+   bson_free (sds_nodes);
+   bson_free (started);
+   bson_free (waiting);
+   bson_free (answered);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reconnect_replica_set --
+ *
+ *       Reconnect to replicaSet members that are unhealthy.
+ *
+ *       Each of them will be checked for matching replicaSet name
+ *       and capabilities via an "isMaster" command.
+ *
+ *       The nodes will also be greedily authenticated with the
+ *       configured user if available, unless the "lazyConnect" URI
+ *       option is set. In that case new connections are closed once
+ *       "isMaster" has been processed and are only opened again when
+ *       the node is selected, except that with "standbyConnections"
+ *       the members that may become primary stay connected.
+ *
+ * Returns:
+ *       true if there is an established stream that may be used,
+ *       otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @error is set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_reconnect_replica_set (mongoc_cluster_t *cluster,
+                                       bson_error_t     *error)
+{
+   const mongoc_host_list_t *hosts;
+   const mongoc_host_list_t *iter;
+   mongoc_host_list_t *failed_hosts = NULL;
+   mongoc_cluster_connect_t *conns = NULL;
+   mongoc_cluster_node_t **probes = NULL;
+   mongoc_cluster_node_t **lent = NULL;
+   mongoc_cluster_node_t *seeds = NULL;
+   mongoc_cluster_node_t *node;
+   mongoc_cluster_node_t *saved_nodes;
+   size_t saved_nodes_len;
+   mongoc_host_list_t host;
+   mongoc_list_t *list;
+   mongoc_list_t *liter;
+   bson_t *replies = NULL;
+   bool *connected = NULL;
+   int32_t *rtts = NULL;
+   uint32_t *conn_nodes = NULL;
+   const char *replSet;
+   bson_t command;
+   size_t n_seeds;
+   size_t n_conns;
+   size_t n;
+   size_t i;
+   size_t j;
+   bool rval = false;
+
+   ENTRY;
+
+   BSON_ASSERT(cluster);
+   BSON_ASSERT(cluster->mode == MONGOC_CLUSTER_REPLICA_SET);
+
+   saved_nodes = bson_malloc0(cluster->nodes_len * sizeof(*saved_nodes));
+   saved_nodes_len = cluster->nodes_len;
+
+   bson_init (&command);
+   bson_append_int32 (&command, "isMaster", 8, 1);
+   _mongoc_cluster_append_compression (cluster, &command);
+
+   MONGOC_DEBUG("Reconnecting to replica set.");
+
+   if (!(hosts = mongoc_uri_get_hosts(cluster->uri))) {
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NOT_READY,
+                     "Invalid host list supplied.");
+      goto CLEANUP;
+   }
+
+   replSet = mongoc_uri_get_replica_set(cluster->uri);
+   BSON_ASSERT(replSet);
+
+   /*
+    * Replica Set (Re)Connection Strategy
+    * ===================================
+    *
+    * Connections that are still open are kept. A seed we are already
+    * connected to is asked "isMaster" over the existing stream, and a
+    * member found again keeps its stream and its authentication.
+    *
+    * To perform the replica set connection, we connect to each of the
+    * other pre-configured replicaSet nodes in parallel. (There may in
+    * fact only be one).
+    *
+    * Using the result of an "isMaster" on each of these nodes, we can
+    * prime the cluster nodes we want to connect to.
+    *
+    * We then connect to all of these nodes in parallel and send each of
+    * them "isMaster" at the same time, so the whole process takes about
+    * as long as the slowest member rather than the sum of all of them.
+    * The "isMaster" round trip is also used as the ping sample.
+    *
+    * We return true if any of the connections were successful, however
+    * we must update the cluster health appropriately so that callers
+    * that need a PRIMARY node can force reconnection.
+    *
+    * TODO: At some point in the future, we will need to authenticate
+    *       before calling an "isMaster". But that is dependent on a
+    *       few server "features" first.
+    */
+
+   cluster->last_reconnect = bson_get_monotonic_time();
+
+   _mongoc_cluster_clear_peers (cluster);
+
+   /*
+    * Discover all the potential peers from our seeds.
+    */
+   for (iter = hosts, n_seeds = 0; iter; iter = iter->next, n_seeds++) {}
+
+   conns = bson_malloc0 (n_seeds * sizeof *conns);
+   conn_nodes = bson_malloc0 (n_seeds * sizeof *conn_nodes);
+   seeds = bson_malloc0 (n_seeds * sizeof *seeds);
+   probes = bson_malloc0 (n_seeds * sizeof *probes);
+   lent = bson_malloc0 (n_seeds * sizeof *lent);
+   connected = bson_malloc0 (n_seeds * sizeof *connected);
+   replies = bson_malloc0 (n_seeds * sizeof *replies);
+   rtts = bson_malloc0 (n_seeds * sizeof *rtts);
+
+   for (iter = hosts, i = 0, n_conns = 0; iter; iter = iter->next, i++) {
+      _mongoc_cluster_node_init (&seeds[i]);
+      seeds[i].host = *iter;
+      probes[i] = &seeds[i];
+
+      /*
+       * Borrow the stream of a member we are still connected to.
+       */
+      for (j = 0; j < cluster->nodes_len; j++) {
+         if (cluster->nodes[j].stream &&
+             !strcmp (cluster->nodes[j].host.host_and_port,
+                      iter->host_and_port)) {
+            lent[i] = &cluster->nodes[j];
+            seeds[i].stream = lent[i]->stream;
+            connected[i] = true;
+            break;
+         }
+      }
+
+      if (!lent[i]) {
+         conns[n_conns].host = *iter;
+         conn_nodes[n_conns] = (uint32_t)i;
+         n_conns++;
+      }
+   }
+
+   _mongoc_cluster_connect_parallel (cluster, conns, n_conns);
+
+   for (i = 0; i < n_conns; i++) {
+      node = &seeds[conn_nodes[i]];
+      node->stream = conns[i].stream;
+      connected[conn_nodes[i]] = !!conns[i].stream;
+
+      if (!conns[i].stream) {
+         MONGOC_WARNING("Failed connection to %s",
+                        conns[i].host.host_and_port);
+         if (error) {
+            memcpy (error, &conns[i].error, sizeof *error);
+         }
+         failed_hosts = prepend_host (&conns[i].host, failed_hosts);
+      }
+   }
+
+   _mongoc_cluster_run_command_parallel (cluster, probes, n_seeds, "admin",
+                                         &command, replies, rtts, error);
+
+   for (i = 0; i < n_seeds; i++) {
+      node = &seeds[i];
+
+      if (lent[i]) {
+         /*
+          * A failed "isMaster" closed the borrowed stream, otherwise it
+          * goes back to its member.
+          */
+         if (!node->stream) {
+            lent[i]->stream = NULL;
+         }
+         node->stream = NULL;
+      }
+
+      if (connected[i] && lent[i] && (rtts[i] == -1)) {
+         /*
+          * The connection we kept had gone away. That doesn't make the
+          * member unreachable, it is connected to again below.
+          */
+      } else if (connected[i]) {
+         if ((rtts[i] == -1) ||
+             !_mongoc_cluster_process_ismaster (cluster, node, &replies[i],
+                                                error)) {
+            failed_hosts = prepend_host (&node->host, failed_hosts);
+         } else if (!node->replSet || !!strcmp (node->replSet, replSet)) {
+            MONGOC_INFO ("%s: Got replicaSet \"%s\" expected \"%s\".",
+                         node->host.host_and_port,
+                         node->replSet ? node->replSet : "(null)",
+                         replSet);
+         }
+      }
+
+      bson_destroy (&replies[i]);
+      _mongoc_cluster_node_destroy (node);
+   }
+
+   bson_free (conns);
+   bson_free (conn_nodes);
+   bson_free (seeds);
+   bson_free (probes);
+   bson_free (lent);
+   bson_free (connected);
+   bson_free (replies);
+   bson_free (rtts);
+   conns = NULL;
+   conn_nodes = NULL;
+   probes = NULL;
+   lent = NULL;
+   connected = NULL;
+   replies = NULL;
+   rtts = NULL;
+
+   list = cluster->peers;
+   cluster->peers = NULL;
+
+   /*
+    * To avoid reconnecting to all of the peers, we will save the
+    * functional connections (and save their ping times) so that
+    * we don't waste time doing that again.
+    */
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      saved_nodes [i].host = cluster->nodes [i].host;
+      saved_nodes [i].breaker = cluster->nodes [i].breaker;
+      if (cluster->nodes [i].stream) {
+         saved_nodes [i].stream = cluster->nodes [i].stream;
+         saved_nodes [i].needs_auth = cluster->nodes [i].needs_auth;
+         cluster->nodes [i].stream = NULL;
+      }
+   }
+
+   for (liter = list, n = 0; liter; liter = liter->next, n++) {}
+   cluster->nodes = bson_realloc (cluster->nodes, sizeof (*cluster->nodes) * n);
+   if (n) {
+      memset (cluster->nodes, 0, sizeof (*cluster->nodes) * n);
+   }
+   cluster->nodes_len = (uint32_t)n;
+
+   conns = bson_malloc0 ((n + 1) * sizeof *conns);
+   conn_nodes = bson_malloc0 ((n + 1) * sizeof *conn_nodes);
+   probes = bson_malloc0 ((n + 1) * sizeof *probes);
+   replies = bson_malloc0 ((n + 1) * sizeof *replies);
+   rtts = bson_malloc0 ((n + 1) * sizeof *rtts);
+
+   for (liter = list, i = 0, n_conns = 0; liter; liter = liter->next) {
+      if (!_mongoc_host_list_from_string(&host, liter->data)) {
+         MONGOC_WARNING("Failed to parse host and port: \"%s\"",
+                        (char *)liter->data);
+         continue;
+      }
+
+      if (has_host (failed_hosts, host.host_and_port)) {
+         MONGOC_INFO ("Skipping reconnection to %s", host.host_and_port);
+         continue;
+      }
+
+      node = &cluster->nodes[i];
+
+      _mongoc_cluster_node_init(node);
+
+      node->host = host;
+      node->index = i;
+      node->needs_auth = cluster->requires_auth;
+
+      for (j = 0; j < saved_nodes_len; j++) {
+         if (0 == strcmp (saved_nodes [j].host.host_and_port,
+                          host.host_and_port)) {
+            node->stream = saved_nodes [j].stream;
+            node->breaker = saved_nodes [j].breaker;
+            if (node->stream) {
+               /* a kept stream is already authenticated */
+               node->needs_auth = saved_nodes [j].needs_auth;
+            }
+            saved_nodes [j].stream = NULL;
+         }
+      }
+
+      if (!node->stream) {
+         conns[n_conns].host = host;
+         conn_nodes[n_conns] = i;
+         n_conns++;
+      }
+
+      probes[i] = node;
+      i++;
+   }
+
+   n = i;
+   cluster->nodes_len = (uint32_t)n;
+
+   _mongoc_cluster_connect_parallel (cluster, conns, n_conns);
+
+   for (i = 0; i < n_conns; i++) {
+      node = &cluster->nodes[conn_nodes[i]];
+
+      if (!(node->stream = conns[i].stream)) {
+         MONGOC_WARNING("Failed connection to %s",
+                        conns[i].host.host_and_port);
+         if (error) {
+            memcpy (error, &conns[i].error, sizeof *error);
+         }
+      } else if (cluster->lazy_connect) {
+         node->lazy = 1;
+      }
+   }
+
+   _mongoc_cluster_run_command_parallel (cluster, probes, n, "admin",
+                                         &command, replies, rtts, error);
+
+   for (i = 0; i < n; i++) {
+      node = &cluster->nodes[i];
+
+      if (!node->stream) {
+         continue;
+      }
+
+      if ((rtts[i] == -1) ||
+          !_mongoc_cluster_process_ismaster (cluster, node, &replies[i],
+                                             error)) {
+         _mongoc_cluster_node_destroy (node);
+         continue;
+      }
+
+      if (!node->replSet || !!strcmp (node->replSet, replSet)) {
+         MONGOC_INFO ("%s: Got replicaSet \"%s\" expected \"%s\".",
+                      node->host.host_and_port,
+                      node->replSet ? node->replSet : "(null)",
+                      replSet);
+         _mongoc_cluster_node_destroy (node);
+         continue;
+      }
+
+      if (node->lazy && cluster->standby_connections && node->electable) {
+         /*
+          * Keep an authenticated connection to each member that could be
+          * elected, so a new primary is usable without a handshake.
+          */
+         node->lazy = 0;
+      }
+
+      if (node->lazy) {
+         mongoc_stream_close (node->stream);
+         mongoc_stream_destroy (node->stream);
+         node->stream = NULL;
+         continue;
+      }
+
+      if (node->needs_auth) {
+         if (!_mongoc_cluster_auth_node (cluster, node, error)) {
+            for (j = 0; j < n; j++) {
+               bson_destroy (&replies[j]);
+               _mongoc_cluster_node_destroy (&cluster->nodes[j]);
+            }
+            cluster->nodes_len = 0;
+            goto PEERS_CLEANUP;
+         }
+         node->needs_auth = false;
+      }
+   }
+
+   for (i = 0; i < n; i++) {
+      bson_destroy (&replies[i]);
+   }
+
+   /*
+    * Compact the working nodes to the front of the array. bson_t with
+    * heap storage can't be moved with memcpy() so the tags are copied.
+    *
+    * The "isMaster" round trip above is the latency sample, so no
+    * separate "ping" is needed.
+    */
+   for (i = 0, j = 0; i < n; i++) {
+      node = &cluster->nodes[i];
+
+      if ((!node->stream && !node->lazy) || (rtts[i] == -1)) {
+         _mongoc_cluster_node_destroy (node);
+         continue;
+      }
+
+      _mongoc_cluster_node_track_ping(node, rtts[i]);
+
+      if (i != j) {
+         memcpy (&cluster->nodes[j], node, sizeof *node);
+         bson_copy_to (&node->tags, &cluster->nodes[j].tags);
+         bson_destroy (&node->tags);
+         cluster->nodes[j].index = (uint32_t)j;
+      }
+
+      j++;
+   }
+
+   cluster->nodes_len = (uint32_t)j;
+
+   if (j == 0) {
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                     "No acceptable peer could be found.");
+      goto PEERS_CLEANUP;
+   }
+
+   _mongoc_cluster_update_state (cluster);
+
+   rval = true;
+
+PEERS_CLEANUP:
+
+   _mongoc_list_foreach(list, (void(*)(void*,void*))bson_free, NULL);
+   _mongoc_list_destroy(list);
+
+   /*
+    * Cleanup all potential saved connections that were not used.
+    */
+
+   for (j = 0; j < saved_nodes_len; j++) {
+      if (saved_nodes [j].stream) {
+         mongoc_stream_destroy (saved_nodes [j].stream);
+         saved_nodes [j].stream = NULL;
+      }
+   }
+
+CLEANUP:
+
+   bson_free(saved_nodes);
+   bson_free(conns);
+   bson_free(conn_nodes);
+   bson_free(probes);
+   bson_free(replies);
+   bson_free(rtts);
+   bson_destroy(&command);
+
+   host_list_destroy (failed_hosts);
+
+   RETURN(rval);
+}
+
+
+static bool
+_mongoc_cluster_reconnect_sharded_cluster (mongoc_cluster_t *cluster,
+                                           bson_error_t     *error)
+{
+   const mongoc_host_list_t *hosts;
+   const mongoc_host_list_t *iter;
+   mongoc_cluster_node_t *saved_nodes;
+   mongoc_stream_t *stream;
+   uint32_t saved_nodes_len;
+   uint32_t i;
+   uint32_t j;
+   int32_t ping;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   MONGOC_DEBUG ("Reconnecting to sharded cluster.");
+
+   /*
+    * Sharded Cluster (Re)Connection Strategy
+    * =======================================
+    *
+    * First we break all existing connections. This may and probably
+    * should change.
+    *
+    * Sharded cluster connection is pretty simple, in that we just need
+    * to connect to all of the nodes that we are configured to know
+    * about. The reconnect_direct case will also update things if it
+    * discovers that the node it connected to was a sharded cluster.
+    *
+    * We need to check for "msg" field of the "isMaster" command to
+    * ensure that we have connected to an "isdbgrid".
+    *
+    * If we can connect to all of the nodes, we are in a good state,
+    * otherwise we are in an unhealthy state. If no connections were
+    * established then we are in a failed state.
+    */
+
+   cluster->last_reconnect = bson_get_monotonic_time ();
+
+   hosts = mongoc_uri_get_hosts (cluster->uri);
+
+   /*
+    * Remember which mongos recently timed out, their nodes are about to
+    * be reinitialized.
+    */
+   saved_nodes_len = cluster->nodes_len;
+   saved_nodes = bson_malloc0 ((saved_nodes_len + 1) * sizeof *saved_nodes);
+
+   for (j = 0; j < saved_nodes_len; j++) {
+      saved_nodes[j].host = cluster->nodes[j].host;
+      saved_nodes[j].avoid_until = cluster->nodes[j].avoid_until;
+      saved_nodes[j].breaker = cluster->nodes[j].breaker;
+   }
+
+   /*
+    * Reconnect to each of our configured hosts.
+    */
+   for (iter = hosts, i = 0; iter; iter = iter->next) {
+      stream = _mongoc_client_create_stream (cluster->client, iter, error);
+
+      if (!stream) {
+         MONGOC_WARNING ("Failed connection to %s", iter->host_and_port);
+         continue;
+      }
+
+      _mongoc_cluster_node_init (&cluster->nodes[i]);
+
+      cluster->nodes[i].host = *iter;
+      cluster->nodes[i].index = i;
+      cluster->nodes[i].stream = stream;
+      cluster->nodes[i].needs_auth = cluster->requires_auth;
+
+      for (j = 0; j < saved_nodes_len; j++) {
+         if (!strcmp (saved_nodes[j].host.host_and_port,
+                      iter->host_and_port)) {
+            cluster->nodes[i].avoid_until = saved_nodes[j].avoid_until;
+            cluster->nodes[i].breaker = saved_nodes[j].breaker;
+            break;
+         }
+      }
+
+      if (!_mongoc_cluster_handshake (cluster, &cluster->nodes[i], &ping,
+                                      error)) {
+         _mongoc_cluster_node_destroy (&cluster->nodes[i]);
+
+         /* an authentication failure is fatal, a bad isMaster isn't */
+         if (ping != -1) {
+            GOTO (cleanup);
+         }
+         continue;
+      }
+
+      _mongoc_cluster_node_track_ping (&cluster->nodes[i], ping);
+
+      /*
+       * If this node is not a mongos, we should fail unless no
+       * replicaSet was specified. If that is the case, we will assume
+       * the caller meant they wanted a replicaSet and migrate to that
+       * reconnection strategy.
+       */
+      if ((i == 0) &&
+          !cluster->nodes [i].isdbgrid &&
+          !mongoc_uri_get_replica_set (cluster->uri) &&
+          cluster->nodes [i].replSet) {
+         MONGOC_WARNING ("Found replicaSet, expected sharded cluster. "
+                         "Reconnecting as replicaSet.");
+         cluster->mode = MONGOC_CLUSTER_REPLICA_SET;
+         cluster->replSet = bson_strdup (cluster->nodes [i].replSet);
+         ret = _mongoc_cluster_reconnect_replica_set (cluster, error);
+         GOTO (cleanup);
+      }
+
+      i++;
+   }
+
+   if (i == 0) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                      "No acceptable peer could be found.");
+      GOTO (cleanup);
+   }
+
+   _mongoc_cluster_update_state (cluster);
+
+   ret = true;
+
+cleanup:
+   bson_free (saved_nodes);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cluster_reconnect --
+ *
+ *       Reconnect to the cluster nodes.
+ *
+ *       This is called when no nodes were available to execute an
+ *       operation on.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_reconnect (mongoc_cluster_t *cluster,
+                           bson_error_t     *error)
+{
+   mongoc_cluster_node_t *node;
+   bool ret;
+   int i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (cluster, false);
+
+   /*
+    * Close any lingering connections. A replica set member that has no
+    * reply outstanding keeps its stream, the rediscovery asks it
+    * "isMaster" over that stream and carries it over if it is still a
+    * member, see _mongoc_cluster_reconnect_replica_set().
+    */
+   for (i = 0; i < cluster->nodes_len; i++) {
+       node = &cluster->nodes [i];
+       if (node->stream &&
+           ((cluster->mode != MONGOC_CLUSTER_REPLICA_SET) ||
+            node->op_started || node->pending_replies_len)) {
+           mongoc_stream_close (node->stream);
+           mongoc_stream_destroy (node->stream);
+           node->stream = NULL;
+       }
+       _mongoc_cluster_node_clear_hedges (&cluster->nodes [i]);
+       _mongoc_cluster_node_release_conns (&cluster->nodes [i]);
+       _mongoc_cluster_node_clear_pending (&cluster->nodes [i]);
+   }
+
+   _mongoc_cluster_update_state (cluster);
+
+   cluster->needs_primary_probe = false;
+   cluster->connecting++;
+
+   switch (cluster->mode) {
+   case MONGOC_CLUSTER_DIRECT:
+      ret = _mongoc_cluster_reconnect_direct (cluster, error);
+      break;
+   case MONGOC_CLUSTER_REPLICA_SET:
+      ret = _mongoc_cluster_reconnect_replica_set (cluster, error);
+      break;
+   case MONGOC_CLUSTER_SHARDED_CLUSTER:
+      ret = _mongoc_cluster_reconnect_sharded_cluster (cluster, error);
+      break;
+   default:
+      bson_set_error(error,
+                     MONGOC_ERROR_CLIENT,
+                     MONGOC_ERROR_CLIENT_NOT_READY,
+                     "Unsupported cluster mode: %02x",
+                     cluster->mode);
+      ret = false;
+      break;
+   }
+
+   cluster->connecting--;
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_check_nodes --
+ *
+ *       Refresh the isMaster state and ping time of every connected node
+ *       in @cluster without tearing down existing connections. Nodes that
+ *       fail to respond are disconnected. All of the nodes are asked at
+ *       once, see _mongoc_cluster_run_command_parallel().
+ *
+ *       This is used by the topology monitor to keep its standby cluster
+ *       current between full reconnections.
+ *
+ * Returns:
+ *       true if @cluster is still healthy, otherwise false and a full
+ *       reconnect should be performed.
+ *
+ * Side effects:
+ *       @error is set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_check_nodes (mongoc_cluster_t *cluster,
+                             bson_error_t     *error)
+{
+   mongoc_cluster_node_t **nodes;
+   mongoc_cluster_node_t *node;
+   mongoc_list_t *liter;
+   bool has_primary = false;
+   bson_t command;
+   bson_t *replies;
+   int32_t *rtts;
+   size_t n = 0;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   nodes = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *nodes);
+   replies = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *replies);
+   rtts = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *rtts);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+
+      if (!node->stream) {
+         continue;
+      }
+
+      bson_destroy (&node->tags);
+      bson_init (&node->tags);
+      _mongoc_cluster_node_reset_tag_sets (node);
+
+      nodes[n++] = node;
+   }
+
+   bson_init (&command);
+   bson_append_int32 (&command, "isMaster", 8, 1);
+   _mongoc_cluster_append_compression (cluster, &command);
+
+   _mongoc_cluster_run_command_parallel (cluster, nodes, n, "admin",
+                                         &command, replies, rtts, error);
+
+   for (i = 0; i < n; i++) {
+      node = nodes[i];
+
+      if ((rtts[i] == -1) ||
+          !_mongoc_cluster_process_ismaster (cluster, node, &replies[i],
+                                             error)) {
+         if (node->stream) {
+            _mongoc_cluster_disconnect_node (cluster, node);
+         }
+      } else {
+         _mongoc_cluster_node_track_ping (node, rtts[i]);
+
+         if (node->primary) {
+            has_primary = true;
+         }
+      }
+
+      bson_destroy (&replies[i]);
+   }
+
+   bson_destroy (&command);
+   bson_free (nodes);
+   bson_free (replies);
+   bson_free (rtts);
+
+   _mongoc_cluster_update_state (cluster);
+
+   if (cluster->state != MONGOC_CLUSTER_STATE_HEALTHY) {
+      RETURN (false);
+   }
+
+   if (cluster->mode == MONGOC_CLUSTER_REPLICA_SET) {
+      /*
+       * Rescan if the primary stepped down or a new member joined the set.
+       */
+      if (!has_primary) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
+                         "No primary found in replica set.");
+         RETURN (false);
+      }
+
+      for (liter = cluster->peers; liter; liter = liter->next) {
+         for (j = 0; j < cluster->nodes_len; j++) {
+            if (!strcasecmp (liter->data,
+                             cluster->nodes[j].host.host_and_port)) {
+               break;
+            }
+         }
+         if (j == cluster->nodes_len) {
+            RETURN (false);
+         }
+      }
+   }
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_ping_nodes --
+ *
+ *       Send "ping" to every connected node of @cluster at once and wait
+ *       for the replies with a single poll(), so refreshing the ping
+ *       times costs one round trip to the slowest node however many
+ *       nodes there are. Nodes that fail to respond are disconnected.
+ *
+ * Returns:
+ *       true if any node answered, otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_ping_nodes (mongoc_cluster_t *cluster,
+                            bson_error_t     *error)
+{
+   mongoc_cluster_node_t **nodes;
+   bson_t command;
+   int32_t *rtts;
+   size_t n = 0;
+   size_t i;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   nodes = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *nodes);
+   rtts = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *rtts);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      if (cluster->nodes[i].stream) {
+         nodes[n++] = &cluster->nodes[i];
+      }
+   }
+
+   bson_init (&command);
+   bson_append_int32 (&command, "ping", 4, 1);
+
+   _mongoc_cluster_run_command_parallel (cluster, nodes, n, "admin",
+                                         &command, NULL, rtts, error);
+
+   for (i = 0; i < n; i++) {
+      if (rtts[i] >= 0) {
+         _mongoc_cluster_node_track_ping (nodes[i], rtts[i]);
+         _mongoc_cluster_node_record_success (nodes[i]);
+         ret = true;
+      } else {
+         _mongoc_cluster_node_record_failure (cluster, nodes[i], false);
+      }
+   }
+
+   cluster->last_ping = bson_get_monotonic_time ();
+
+   _mongoc_cluster_update_state (cluster);
+
+   bson_destroy (&command);
+   bson_free (nodes);
+   bson_free (rtts);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_swap_nodes --
+ *
+ *       Exchange the discovered topology of @cluster and @other. This
+ *       includes the nodes and their connections, the peer list and the
+ *       limits negotiated with the servers. Configuration such as the uri
+ *       and the client are left in place.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_swap_nodes (mongoc_cluster_t *cluster,
+                            mongoc_cluster_t *other)
+{
+   mongoc_cluster_node_t *nodes;
+   mongoc_list_t *peers;
+   mongoc_cluster_state_t state;
+   mongoc_cluster_mode_t mode;
+   uint32_t nodes_len;
+   int64_t last_reconnect;
+   int32_t max_bson_size;
+   int32_t max_msg_size;
+   char *replSet;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (other);
+
+#define SWAP_FIELD(_v, _f) \
+   do { \
+      _v = cluster->_f; \
+      cluster->_f = other->_f; \
+      other->_f = _v; \
+   } while (0)
+
+   SWAP_FIELD (nodes, nodes);
+   SWAP_FIELD (nodes_len, nodes_len);
+   SWAP_FIELD (peers, peers);
+   SWAP_FIELD (state, state);
+   SWAP_FIELD (mode, mode);
+   SWAP_FIELD (last_reconnect, last_reconnect);
+   SWAP_FIELD (max_bson_size, max_bson_size);
+   SWAP_FIELD (max_msg_size, max_msg_size);
+   SWAP_FIELD (replSet, replSet);
+
+#undef SWAP_FIELD
+
+   _mongoc_cluster_topology_changed (cluster);
+   _mongoc_cluster_topology_changed (other);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_copy_nodes --
+ *
+ *       Replace the nodes of @cluster with a copy of the connected nodes
+ *       of @other. Everything learned about the nodes is copied except for
+ *       their streams. The copies are lazy nodes that are connected and
+ *       authenticated by @cluster itself when they are first selected.
+ *
+ *       This lets many clusters share the topology discovered by one
+ *       monitor while each keeps its own connections.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The existing streams of @cluster are closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_copy_nodes (mongoc_cluster_t       *cluster,
+                            const mongoc_cluster_t *other)
+{
+   const mongoc_cluster_node_t *src;
+   mongoc_cluster_node_t *saved_nodes;
+   mongoc_cluster_node_t *node;
+   uint32_t saved_nodes_len;
+   uint32_t i;
+   uint32_t j;
+   uint32_t k;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (other);
+
+   /*
+    * The monitor sends no operations, so the breakers of @cluster are the
+    * only ones worth keeping.
+    */
+   saved_nodes_len = cluster->nodes_len;
+   saved_nodes = bson_malloc0 ((saved_nodes_len + 1) * sizeof *saved_nodes);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      saved_nodes[i].host = cluster->nodes[i].host;
+      saved_nodes[i].breaker = cluster->nodes[i].breaker;
+      _mongoc_cluster_node_destroy (&cluster->nodes[i]);
+   }
+
+   cluster->nodes = bson_realloc (cluster->nodes,
+                                  sizeof *cluster->nodes *
+                                  BSON_MAX (other->nodes_len, 1));
+
+   for (i = 0, j = 0; i < other->nodes_len; i++) {
+      src = &other->nodes[i];
+
+      if (!src->stream) {
+         continue;
+      }
+
+      node = &cluster->nodes[j];
+
+      _mongoc_cluster_node_init (node);
+
+      node->index = j;
+      node->host = src->host;
+      node->primary = src->primary;
+      node->electable = src->electable;
+      node->isdbgrid = src->isdbgrid;
+      node->needs_auth = cluster->requires_auth;
+      node->lazy = 1;
+      node->ping_avg_msec = src->ping_avg_msec;
+      node->rtt_msec = src->rtt_msec;
+      node->min_wire_version = src->min_wire_version;
+      node->max_wire_version = src->max_wire_version;
+      node->max_write_batch_size = src->max_write_batch_size;
+      node->avoid_until = src->avoid_until;
+      node->last_write_date = src->last_write_date;
+      node->last_update_msec = src->last_update_msec;
+      node->replSet = src->replSet ? bson_strdup (src->replSet) : NULL;
+      bson_destroy (&node->tags);
+      bson_copy_to (&src->tags, &node->tags);
+      _mongoc_cluster_node_reset_tag_sets (node);
+
+      for (k = 0; k < saved_nodes_len; k++) {
+         if (!strcmp (saved_nodes[k].host.host_and_port,
+                      node->host.host_and_port)) {
+            node->breaker = saved_nodes[k].breaker;
+            break;
+         }
+      }
+
+      j++;
+   }
+
+   bson_free (saved_nodes);
+
+   cluster->nodes_len = j;
+   cluster->mode = other->mode;
+   cluster->max_bson_size = other->max_bson_size;
+   cluster->max_msg_size = other->max_msg_size;
+   cluster->last_reconnect = other->last_reconnect;
+   cluster->needs_primary_probe = false;
+
+   bson_free (cluster->replSet);
+   cluster->replSet = other->replSet ? bson_strdup (other->replSet) : NULL;
+
+   _mongoc_cluster_update_state (cluster);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_unhealthy_reconnect_due --
+ *
+ *       Check whether an unhealthy @cluster without a topology monitor
+ *       has waited long enough since its last reconnect to rescan. The
+ *       wait is UNHEALTHY_RECONNECT_TIMEOUT_USEC give or take a quarter,
+ *       derived from the time of the last reconnect and the address of
+ *       @cluster, so that clients which lost the same node at the same
+ *       moment spread their rescans out rather than all firing at once.
+ *
+ * Returns:
+ *       true if it is time to reconnect.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_unhealthy_reconnect_due (mongoc_cluster_t *cluster,
+                                         int64_t           now)
+{
+   int64_t jitter = UNHEALTHY_RECONNECT_TIMEOUT_USEC / 2;
+   uint32_t x;
+
+   x = (uint32_t)cluster->last_reconnect ^ (uint32_t)(uintptr_t)cluster;
+   x |= 1;
+
+   /* xorshift32 */
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+
+   return (cluster->last_reconnect + UNHEALTHY_RECONNECT_TIMEOUT_USEC +
+           (int64_t)(x % (uint32_t)(jitter + 1)) - (jitter / 2)) <= now;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reconnect_or_adopt --
+ *
+ *       Bring @cluster back to a usable state. If a topology monitor is
+ *       running for @cluster, the topology discovered by the monitor is
+ *       adopted instead of rescanning the cluster on the caller's thread.
+ *       Otherwise, this falls back to _mongoc_cluster_reconnect().
+ *
+ *       If @block is false and a monitor is running, this never waits for
+ *       the monitor and simply returns false if no better topology has
+ *       been published yet.
+ *
+ * Returns:
+ *       true if a new topology was installed, otherwise false and @error
+ *       is set.
+ *
+ * Side effects:
+ *       @error is set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_reconnect_or_adopt (mongoc_cluster_t *cluster,
+                                    bool              block,
+                                    bson_error_t     *error)
+{
+   int64_t timeout_msec = 0;
+   const bson_t *b;
+   bson_iter_t iter;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   if (!cluster->monitor) {
+      RETURN (_mongoc_cluster_reconnect (cluster, error));
+   }
+
+   if (block) {
+      timeout_msec = MONGOC_DEFAULT_CONNECTTIMEOUTMS;
+
+      b = mongoc_uri_get_options (cluster->uri);
+      if (bson_iter_init_find_case (&iter, b, "connecttimeoutms") &&
+          BSON_ITER_HOLDS_INT32 (&iter) &&
+          bson_iter_int32 (&iter) > 0) {
+         timeout_msec = bson_iter_int32 (&iter);
+      }
+   }
+
+   RETURN (_mongoc_cluster_monitor_adopt (cluster->monitor, cluster,
+                                          timeout_msec, error));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_retry_selection --
+ *
+ *       Called when no node could be selected, to bring @cluster back
+ *       before selecting again.
+ *
+ *       Without serverSelectionTimeoutMS, the cluster is reconnected up to
+ *       MAX_RETRY_COUNT times. With it, attempts go on until that long has
+ *       passed since the first one, SELECTION_RETRY_INTERVAL_USEC apart.
+ *       @expire_at must be zero before the first call for an operation.
+ *
+ * Returns:
+ *       true if selection should be tried again; otherwise false and
+ *       @error is set.
+ *
+ * Side effects:
+ *       @retry_count and @expire_at are updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_retry_selection (mongoc_cluster_t *cluster,
+                                 int              *retry_count,
+                                 int64_t          *expire_at,
+                                 bson_error_t     *error)
+{
+   int64_t now;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (retry_count);
+   BSON_ASSERT (expire_at);
+
+   if (!cluster->serverselectiontimeoutms) {
+      RETURN ((*retry_count)++ < MAX_RETRY_COUNT &&
+              _mongoc_cluster_reconnect_or_adopt (cluster, true, error));
+   }
+
+   now = bson_get_monotonic_time ();
+
+   if (!*expire_at) {
+      *expire_at = now + (cluster->serverselectiontimeoutms * 1000L);
+   } else if (now >= *expire_at) {
+      RETURN (false);
+   } else {
+      _mongoc_usleep (BSON_MIN (SELECTION_RETRY_INTERVAL_USEC,
+                                *expire_at - now));
+   }
+
+   (*retry_count)++;
+
+   /*
+    * A failed attempt still leaves the caller to select again, and to
+    * come back here until the time is up.
+    */
+   _mongoc_cluster_reconnect_or_adopt (cluster, true, error);
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_reply_is_not_master --
+ *
+ *       Check whether @rpc is a reply telling us that the node is not (or
+ *       no longer) a primary, such as "not master" after a stepdown or
+ *       "node is recovering" during a state change.
+ *
+ *       Only failed replies are examined: query failures, and command
+ *       or getlasterror replies with a false "ok". The documents of any
+ *       other reply are the user's, and may hold a "code" or an "errmsg"
+ *       of their own. Only the top level of the first document is read.
+ *
+ * Returns:
+ *       true if the reply carries a "not master" style error.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_reply_is_not_master (mongoc_rpc_t *rpc)
+{
+   bson_iter_t iter;
+   const char *key;
+   const char *msg;
+   bson_t b;
+
+   BSON_ASSERT (rpc);
+
+   if ((rpc->header.opcode != MONGOC_OPCODE_REPLY) ||
+       !_mongoc_rpc_reply_get_first (&rpc->reply, &b)) {
+      return false;
+   }
+
+   if (!(rpc->reply.flags & MONGOC_REPLY_QUERY_FAILURE) &&
+       (!bson_iter_init_find (&iter, &b, "ok") ||
+        bson_iter_as_bool (&iter))) {
+      return false;
+   }
+
+   if (!bson_iter_init (&iter, &b)) {
+      return false;
+   }
+
+   while (bson_iter_next (&iter)) {
+      key = bson_iter_key (&iter);
+
+      if (BSON_ITER_HOLDS_UTF8 (&iter) &&
+          (!strcmp (key, "$err") ||
+           !strcmp (key, "errmsg") ||
+           !strcmp (key, "err"))) {
+         msg = bson_iter_utf8 (&iter, NULL);
+         if (strstr (msg, "not master") ||
+             strstr (msg, "node is recovering")) {
+            return true;
+         }
+      } else if (!strcmp (key, "code") &&
+                 (BSON_ITER_HOLDS_INT32 (&iter) ||
+                  BSON_ITER_HOLDS_INT64 (&iter) ||
+                  BSON_ITER_HOLDS_DOUBLE (&iter))) {
+         switch (bson_iter_as_int64 (&iter)) {
+         case 91:    /* ShutdownInProgress */
+         case 189:   /* PrimarySteppedDown */
+         case 10107: /* NotMaster */
+         case 11600: /* InterruptedAtShutdown */
+         case 11602: /* InterruptedDueToReplStateChange */
+         case 13435: /* NotMasterNoSlaveOk */
+         case 13436: /* NotMasterOrSecondary */
+            return true;
+         default:
+            break;
+         }
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_mark_stale --
+ *
+ *       @node told us it is no longer primary. Forget that it was, without
+ *       touching its connection or any other node, and ask for the other
+ *       members to be probed for the new primary.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The cluster state is updated and the topology monitor, if any, is
+ *       woken up.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_node_mark_stale (mongoc_cluster_t      *cluster,
+                                 mongoc_cluster_node_t *node)
+{
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   if ((cluster->mode != MONGOC_CLUSTER_REPLICA_SET) || !node->primary) {
+      EXIT;
+   }
+
+   MONGOC_INFO ("%s is no longer primary.", node->host.host_and_port);
+
+   mongoc_counter_cluster_not_master_inc ();
+
+   node->primary = 0;
+   cluster->needs_primary_probe = true;
+   cluster->last_primary_probe = 0;
+
+   _mongoc_cluster_update_state (cluster);
+
+   if (cluster->monitor) {
+      _mongoc_cluster_monitor_wakeup (cluster->monitor);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_probe_primary --
+ *
+ *       Look for a new primary after _mongoc_cluster_node_mark_stale() by
+ *       sending "isMaster" to every connected member at once. This is
+ *       much cheaper than a full _mongoc_cluster_reconnect(), since no
+ *       connections are made and only roles and ping times are refreshed.
+ *
+ *       Probes are spaced by PRIMARY_PROBE_INTERVAL_USEC while an election
+ *       is in progress.
+ *
+ * Returns:
+ *       true if a primary is known afterwards.
+ *
+ * Side effects:
+ *       Nodes that fail to answer are disconnected.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_probe_primary (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_node_t **probes;
+   mongoc_cluster_node_t *node;
+   bson_error_t error;
+   bson_t *replies;
+   int32_t *rtts;
+   bson_t command;
+   int64_t now;
+   uint32_t i;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   now = bson_get_monotonic_time ();
+
+   if (cluster->last_primary_probe + PRIMARY_PROBE_INTERVAL_USEC > now) {
+      RETURN (false);
+   }
+
+   cluster->last_primary_probe = now;
+
+   probes = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *probes);
+   replies = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *replies);
+   rtts = bson_malloc0 ((cluster->nodes_len + 1) * sizeof *rtts);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      probes[i] = &cluster->nodes[i];
+   }
+
+   bson_init (&command);
+   bson_append_int32 (&command, "isMaster", 8, 1);
+   _mongoc_cluster_append_compression (cluster, &command);
+
+   _mongoc_cluster_run_command_parallel (cluster, probes, cluster->nodes_len,
+                                         "admin", &command, replies, rtts,
+                                         &error);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      node = &cluster->nodes[i];
+
+      if (node->stream && (rtts[i] != -1)) {
+         bson_destroy (&node->tags);
+         bson_init (&node->tags);
+         _mongoc_cluster_node_reset_tag_sets (node);
+
+         if (_mongoc_cluster_process_ismaster (cluster, node, &replies[i],
+                                               &error)) {
+            _mongoc_cluster_node_track_ping (node, rtts[i]);
+         } else {
+            _mongoc_cluster_disconnect_node (cluster, node);
+         }
+      }
+
+      bson_destroy (&replies[i]);
+   }
+
+   bson_destroy (&command);
+   bson_free (probes);
+   bson_free (replies);
+   bson_free (rtts);
+
+   _mongoc_cluster_update_state (cluster);
+
+   ret = !!_mongoc_cluster_get_primary (cluster);
+
+   if (ret) {
+      cluster->needs_primary_probe = false;
+   }
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_prepare_retry --
+ *
+ *       Decide whether an operation that failed with @error may be sent
+ *       once more, and if so, get the cluster ready for it. Only the loss
+ *       of a connection is retried: the node has already been
+ *       disconnected, and if it was the primary of a replica set the
+ *       members still connected are probed for the new one, see
+ *       _mongoc_cluster_probe_primary(), rather than rescanning the whole
+ *       cluster. With a topology monitor, the monitor is asked to do it.
+ *
+ *       The caller is responsible for the operation being safe to repeat
+ *       and for retrying at most once.
+ *
+ * Returns:
+ *       true if the operation should be retried. The caller must select
+ *       a node again, the one it used is gone.
+ *
+ * Side effects:
+ *       Nodes that fail to answer the probe are disconnected.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_prepare_retry (mongoc_cluster_t   *cluster,
+                               bool                is_write,
+                               const bson_error_t *error)
+{
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (error);
+
+   if (!(is_write ? cluster->retry_writes : cluster->retry_reads)) {
+      RETURN (false);
+   }
+
+   if (!((error->domain == MONGOC_ERROR_STREAM &&
+          error->code == MONGOC_ERROR_STREAM_SOCKET) ||
+         (error->domain == MONGOC_ERROR_CLIENT &&
+          error->code == MONGOC_ERROR_CLIENT_NOT_READY))) {
+      RETURN (false);
+   }
+
+   MONGOC_INFO ("Retrying %s after: %s",
+                is_write ? "write" : "read", error->message);
+
+   mongoc_counter_cluster_retries_inc ();
+
+   if (cluster->monitor) {
+      _mongoc_cluster_monitor_wakeup (cluster->monitor);
+   } else if ((cluster->mode == MONGOC_CLUSTER_REPLICA_SET) &&
+              !_mongoc_cluster_get_primary (cluster)) {
+      cluster->needs_primary_probe = true;
+      cluster->last_primary_probe = 0;
+      _mongoc_cluster_probe_primary (cluster);
+   }
+
+   RETURN (true);
+}
+
+
+bool
+_mongoc_cluster_command_early (mongoc_cluster_t *cluster,
+                               const char       *dbname,
+                               const bson_t     *command,
+                               bson_t           *reply,
+                               bson_error_t     *error)
+{
+   mongoc_cluster_node_t *node;
+   int i;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (cluster->state == MONGOC_CLUSTER_STATE_BORN);
+   BSON_ASSERT (dbname);
+   BSON_ASSERT (command);
+
+   if (!_mongoc_cluster_reconnect (cluster, error)) {
+      return false;
+   }
+
+   node = _mongoc_cluster_get_primary (cluster);
+
+   for (i = 0; !node && i < cluster->nodes_len; i++) {
+      if (cluster->nodes[i].stream) {
+         node = &cluster->nodes[i];
+      }
+   }
+
+   return _mongoc_cluster_run_command (cluster, node, dbname, command,
+                                       reply, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_ns_counters --
+ *
+ *       Look up the scoped counters of the namespace @rpc is sent to, if
+ *       namespaces are counted. The counters of the last namespace are
+ *       remembered, since consecutive operations of a client tend to go
+ *       to the same collection.
+ *
+ * Returns:
+ *       The counters, or NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_scoped_counters_t *
+_mongoc_cluster_ns_counters (mongoc_cluster_t   *cluster,
+                             const mongoc_rpc_t *rpc)
+{
+   const char *ns;
+
+   if (!_mongoc_scoped_counters_namespaces_enabled ()) {
+      return NULL;
+   }
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_QUERY:
+      ns = rpc->query.collection;
+      break;
+   case MONGOC_OPCODE_GET_MORE:
+      ns = rpc->get_more.collection;
+      break;
+   case MONGOC_OPCODE_INSERT:
+      ns = rpc->insert.collection;
+      break;
+   case MONGOC_OPCODE_UPDATE:
+      ns = rpc->update.collection;
+      break;
+   case MONGOC_OPCODE_DELETE:
+      ns = rpc->delete.collection;
+      break;
+   default:
+      return NULL;
+   }
+
+   if (strncmp (cluster->ns_counters_key, ns,
+                sizeof cluster->ns_counters_key - 1)) {
+      cluster->ns_counters = _mongoc_scoped_counters_get (
+         MONGOC_SCOPED_COUNTERS_NAMESPACE, ns);
+      bson_strncpy (cluster->ns_counters_key, ns,
+                    sizeof cluster->ns_counters_key);
+   }
+
+   return cluster->ns_counters;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_inc_egress_rpc --
+ *
+ *       Helper to increment the counter for a particular RPC based on
+ *       it's opcode, and the scoped counters of @node and of the
+ *       namespace of @rpc. @rpc must be gathered already, so that its
+ *       length is known.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE void
+_mongoc_cluster_inc_egress_rpc (mongoc_cluster_t      *cluster,
+                                mongoc_cluster_node_t *node,
+                                const mongoc_rpc_t    *rpc)
+{
+   mongoc_scoped_counters_t *counters;
+
+   mongoc_counter_op_egress_total_inc();
+
+   if ((counters = _mongoc_cluster_node_counters (node))) {
+      _mongoc_counter_add (counters->egress_ops, 1);
+      _mongoc_counter_add (counters->egress_bytes, rpc->header.msg_len);
+   }
+
+   if ((counters = _mongoc_cluster_ns_counters (cluster, rpc))) {
+      _mongoc_counter_add (counters->egress_ops, 1);
+      _mongoc_counter_add (counters->egress_bytes, rpc->header.msg_len);
+   }
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_DELETE:
+      mongoc_counter_op_egress_delete_inc();
+      break;
+   case MONGOC_OPCODE_UPDATE:
+      mongoc_counter_op_egress_update_inc();
+      break;
+   case MONGOC_OPCODE_INSERT:
+      mongoc_counter_op_egress_insert_inc();
+      break;
+   case MONGOC_OPCODE_KILL_CURSORS:
+      mongoc_counter_op_egress_killcursors_inc();
+      break;
+   case MONGOC_OPCODE_GET_MORE:
+      mongoc_counter_op_egress_getmore_inc();
+      break;
+   case MONGOC_OPCODE_REPLY:
+      mongoc_counter_op_egress_reply_inc();
+      break;
+   case MONGOC_OPCODE_MSG:
+      mongoc_counter_op_egress_msg_inc();
+      break;
+   case MONGOC_OPCODE_QUERY:
+      mongoc_counter_op_egress_query_inc();
+      break;
+   default:
+      BSON_ASSERT(false);
+      break;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_inc_ingress_rpc --
+ *
+ *       Helper to increment the counter for a particular RPC based on
+ *       it's opcode, and the scoped counters of @node.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static BSON_INLINE void
+_mongoc_cluster_inc_ingress_rpc (mongoc_cluster_node_t *node,
+                                 const mongoc_rpc_t    *rpc)
+{
+   mongoc_scoped_counters_t *counters;
+
+   mongoc_counter_op_ingress_total_inc ();
+
+   if ((counters = _mongoc_cluster_node_counters (node))) {
+      _mongoc_counter_add (counters->ingress_ops, 1);
+      _mongoc_counter_add (counters->ingress_bytes, rpc->header.msg_len);
+   }
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_DELETE:
+      mongoc_counter_op_ingress_delete_inc ();
+      break;
+   case MONGOC_OPCODE_UPDATE:
+      mongoc_counter_op_ingress_update_inc ();
+      break;
+   case MONGOC_OPCODE_INSERT:
+      mongoc_counter_op_ingress_insert_inc ();
+      break;
+   case MONGOC_OPCODE_KILL_CURSORS:
+      mongoc_counter_op_ingress_killcursors_inc ();
+      break;
+   case MONGOC_OPCODE_GET_MORE:
+      mongoc_counter_op_ingress_getmore_inc ();
+      break;
+   case MONGOC_OPCODE_REPLY:
+      mongoc_counter_op_ingress_reply_inc ();
+      break;
+   case MONGOC_OPCODE_MSG:
+      mongoc_counter_op_ingress_msg_inc ();
+      break;
+   case MONGOC_OPCODE_QUERY:
+      mongoc_counter_op_ingress_query_inc ();
+      break;
+   default:
+      BSON_ASSERT (false);
+      break;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_compress --
+ *
+ *       Replace the gathered messages in @iov with their compressed form,
+ *       for a node that accepted the compressor of @cluster. The result
+ *       is described by @compressed and is valid until the next call.
+ *
+ *       If the messages cannot be compressed, @iov is left alone and they
+ *       are sent as they are.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @iov and @iovcnt may be changed to point at @compressed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_compress (mongoc_cluster_t  *cluster,
+                          mongoc_iovec_t   **iov,
+                          size_t            *iovcnt,
+                          mongoc_iovec_t    *compressed)
+{
+   if (!_mongoc_compress_messages (cluster->compressor_id,
+                                   cluster->compression_level,
+                                   *iov, *iovcnt,
+                                   &cluster->compress_in,
+                                   &cluster->compress_out)) {
+      MONGOC_DEBUG ("Sending messages uncompressed.");
+      return;
+   }
+
+   compressed->iov_base = (void *)(cluster->compress_out.data +
+                                   cluster->compress_out.off);
+   compressed->iov_len = cluster->compress_out.len;
+
+   *iov = compressed;
+   *iovcnt = 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_kill_cursor_deferred --
+ *
+ *       Queues @cursor_id, opened on the node specified by @hint, to be
+ *       killed with the next request sent to that node. The ids of all
+ *       cursors abandoned there in the meantime go out in a single
+ *       OP_KILL_CURSORS.
+ *
+ * Returns:
+ *       true if the queue is full and should be flushed with
+ *       _mongoc_cluster_flush_dead_cursors().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_kill_cursor_deferred (mongoc_cluster_t *cluster,
+                                      uint32_t          hint,
+                                      int64_t           cursor_id)
+{
+   mongoc_cluster_dead_cursor_t dead;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (cursor_id);
+
+   if (!hint || hint > cluster->nodes_len) {
+      RETURN (false);
+   }
+
+   dead.cursor_id = cursor_id;
+   bson_strncpy (dead.host_and_port,
+                 cluster->nodes[hint - 1].host.host_and_port,
+                 sizeof dead.host_and_port);
+   _mongoc_array_append_val (&cluster->dead_cursors, dead);
+
+   RETURN (cluster->dead_cursors.len >= MONGOC_CLUSTER_DEAD_CURSORS_MAX);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_take_dead_cursors --
+ *
+ *       Removes the cursors queued for @node and prepares @rpc to kill
+ *       them. Cursors are tracked by host rather than by node, since the
+ *       nodes may be rebuilt by a reconnect while the cursors they had
+ *       open are still alive on the server.
+ *
+ * Returns:
+ *       true if @rpc was prepared, false if there is nothing to kill.
+ *
+ * Side effects:
+ *       @rpc refers to cluster->kill_ids until the next call.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_take_dead_cursors (mongoc_cluster_t      *cluster,
+                                   mongoc_cluster_node_t *node,
+                                   mongoc_rpc_t          *rpc)
+{
+   mongoc_cluster_dead_cursor_t *dead;
+   size_t kept = 0;
+   size_t i;
+
+   if (BSON_LIKELY (!cluster->dead_cursors.len)) {
+      return false;
+   }
+
+   _mongoc_array_clear (&cluster->kill_ids);
+
+   for (i = 0; i < cluster->dead_cursors.len; i++) {
+      dead = &_mongoc_array_index (&cluster->dead_cursors,
+                                   mongoc_cluster_dead_cursor_t, i);
+
+      if (!strcasecmp (dead->host_and_port, node->host.host_and_port)) {
+         _mongoc_array_append_val (&cluster->kill_ids, dead->cursor_id);
+      } else if (kept++ != i) {
+         _mongoc_array_index (&cluster->dead_cursors,
+                              mongoc_cluster_dead_cursor_t, kept - 1) = *dead;
+      }
+   }
+
+   cluster->dead_cursors.len = kept;
+
+   if (!cluster->kill_ids.len) {
+      return false;
+   }
+
+   rpc->kill_cursors.msg_len = 0;
+   rpc->kill_cursors.request_id = 0;
+   rpc->kill_cursors.response_to = 0;
+   rpc->kill_cursors.opcode = MONGOC_OPCODE_KILL_CURSORS;
+   rpc->kill_cursors.zero = 0;
+   rpc->kill_cursors.cursors = (int64_t *)cluster->kill_ids.data;
+   rpc->kill_cursors.n_cursors = (int32_t)cluster->kill_ids.len;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_flush_dead_cursors --
+ *
+ *       Sends the queued cursor ids to every connected node without waiting
+ *       for another request to carry them, one OP_KILL_CURSORS per node.
+ *
+ *       Like mongoc_client_kill_cursor(), this is best effort. Cursors
+ *       on nodes that are not connected are dropped; the server times
+ *       them out.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The queue is empty.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_flush_dead_cursors (mongoc_cluster_t *cluster)
+{
+   mongoc_rpc_t rpc = {{ 0 }};
+   uint32_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+
+   for (i = 0; i < cluster->nodes_len && cluster->dead_cursors.len; i++) {
+      if (cluster->nodes[i].stream &&
+          _mongoc_cluster_take_dead_cursors (cluster, &cluster->nodes[i],
+                                             &rpc)) {
+         _mongoc_cluster_try_sendv (cluster, &rpc, 1, i + 1, NULL, NULL,
+                                    NULL);
+      }
+   }
+
+   _mongoc_array_clear (&cluster->dead_cursors);
+
+   EXIT;
+}
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_clear_gle_cache --
+ *
+ *       Free the getlasterror messages serialized by
+ *       _mongoc_cluster_gather_gle().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_clear_gle_cache (mongoc_cluster_t *cluster)
+{
+   mongoc_cluster_gle_t *entry;
+   size_t i;
+
+   for (i = 0; i < cluster->gle_cache.len; i++) {
+      entry = _mongoc_array_index (&cluster->gle_cache,
+                                   mongoc_cluster_gle_t *, i);
+      bson_free (entry->data);
+      bson_free (entry);
+   }
+
+   _mongoc_array_clear (&cluster->gle_cache);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_prepare_gle --
+ *
+ *       Make room for the getlasterror headers of a send of @rpcs_len
+ *       messages. Called before gathering, since the iovecs point into
+ *       them and into the cached messages.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The cache is emptied if it has grown past
+ *       MONGOC_CLUSTER_GLE_CACHE_MAX entries.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_prepare_gle (mongoc_cluster_t *cluster,
+                             size_t            rpcs_len)
+{
+   if (cluster->gle_headers_len < rpcs_len) {
+      cluster->gle_headers = bson_realloc (cluster->gle_headers,
+                                           rpcs_len *
+                                           sizeof *cluster->gle_headers);
+      cluster->gle_headers_len = (uint32_t)rpcs_len;
+   }
+
+   if (cluster->gle_cache.len >= MONGOC_CLUSTER_GLE_CACHE_MAX) {
+      _mongoc_cluster_clear_gle_cache (cluster);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_gather_gle --
+ *
+ *       Append the getlasterror query that follows the write @rpc to the
+ *       iovecs of @cluster. The body of the query is serialized once per
+ *       write concern and database and reused, only @header is written
+ *       for each send.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A request id is taken from @cluster.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_gather_gle (mongoc_cluster_t             *cluster,
+                            const mongoc_rpc_t           *rpc,
+                            const mongoc_write_concern_t *write_concern,
+                            mongoc_cluster_gle_header_t  *header)
+{
+   mongoc_cluster_gle_t *entry = NULL;
+   mongoc_iovec_t iov;
+   const bson_t *b;
+   char cmdname[140];
+   uint32_t ns_len;
+   uint32_t len;
+   int32_t v32;
+   uint8_t *p;
+   size_t i;
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_INSERT:
+      DB_AND_CMD_FROM_COLLECTION(cmdname, rpc->insert.collection);
+      break;
+   case MONGOC_OPCODE_DELETE:
+      DB_AND_CMD_FROM_COLLECTION(cmdname, rpc->delete.collection);
+      break;
+   case MONGOC_OPCODE_UPDATE:
+      DB_AND_CMD_FROM_COLLECTION(cmdname, rpc->update.collection);
+      break;
+   default:
+      BSON_ASSERT(false);
+      DB_AND_CMD_FROM_COLLECTION(cmdname, "admin.$cmd");
+      break;
+   }
+
+   b = _mongoc_write_concern_get_gle ((mongoc_write_concern_t *)write_concern);
+   ns_len = (uint32_t)strlen (cmdname);
+
+   /* flags, namespace, skip, n_return, then the query */
+   len = 4 + ns_len + 1 + 4 + 4 + b->len;
+
+   for (i = 0; i < cluster->gle_cache.len; i++) {
+      entry = _mongoc_array_index (&cluster->gle_cache,
+                                   mongoc_cluster_gle_t *, i);
+
+      if ((entry->len == len) &&
+          (entry->ns_len == ns_len) &&
+          !memcmp (entry->data + 4, cmdname, ns_len) &&
+          !memcmp (entry->data + len - b->len, bson_get_data (b), b->len)) {
+         break;
+      }
+
+      entry = NULL;
+   }
+
+   if (!entry) {
+      entry = bson_malloc0 (sizeof *entry);
+      entry->data = p = bson_malloc (len);
+      entry->len = len;
+      entry->ns_len = ns_len;
+
+      v32 = BSON_UINT32_TO_LE (MONGOC_QUERY_NONE);
+      memcpy (p, &v32, 4);
+      p += 4;
+      memcpy (p, cmdname, ns_len + 1);
+      p += ns_len + 1;
+      v32 = 0;
+      memcpy (p, &v32, 4);
+      p += 4;
+      v32 = BSON_UINT32_TO_LE (1);
+      memcpy (p, &v32, 4);
+      p += 4;
+      memcpy (p, bson_get_data (b), b->len);
+
+      _mongoc_array_append_val (&cluster->gle_cache, entry);
+   }
+
+   header->msg_len = BSON_UINT32_TO_LE (16 + len);
+   header->request_id = BSON_UINT32_TO_LE (++cluster->request_id);
+   header->response_to = 0;
+   header->opcode = BSON_UINT32_TO_LE (MONGOC_OPCODE_QUERY);
+
+   iov.iov_base = (void *)header;
+   iov.iov_len = sizeof *header;
+   _mongoc_array_append_val (&cluster->iov, iov);
+
+   iov.iov_base = (void *)entry->data;
+   iov.iov_len = entry->len;
+   _mongoc_array_append_val (&cluster->iov, iov);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_rpc_histogram --
+ *
+ *       Pick the latency histogram for the round trip of @rpc, given
+ *       whether a getlasterror is sent along with it. Queries on a "$cmd"
+ *       collection are commands.
+ *
+ * Returns:
+ *       A histogram, or NULL if no reply is expected for @rpc.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_histogram_t *
+_mongoc_cluster_rpc_histogram (const mongoc_rpc_t *rpc,
+                               bool                need_gle)
+{
+   const char *dot;
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_QUERY:
+      dot = strchr (rpc->query.collection, '.');
+      if (dot && !strcmp (dot, ".$cmd")) {
+         return &__mongoc_histogram_op_rtt_command;
+      }
+      return &__mongoc_histogram_op_rtt_query;
+   case MONGOC_OPCODE_GET_MORE:
+      return &__mongoc_histogram_op_rtt_getmore;
+   case MONGOC_OPCODE_INSERT:
+   case MONGOC_OPCODE_UPDATE:
+   case MONGOC_OPCODE_DELETE:
+   default:
+      return need_gle ? &__mongoc_histogram_op_rtt_write : NULL;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_acquire_slot --
+ *
+ *       Take an operation in flight to @node under the concurrency limit
+ *       of the pool before @rpcs are sent to it, if a reply is expected
+ *       for them. Getmores are let through so that cursors the node has
+ *       already done the work for are not abandoned, and so is anything
+ *       sent while this client already has an operation in flight to
+ *       @node.
+ *
+ * Returns:
+ *       true if @rpcs may be sent. @acquired is set if a slot was taken
+ *       that must be given back should they not be sent after all.
+ *
+ *       false if @node is at its limit, and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_node_acquire_slot (mongoc_cluster_t             *cluster,
+                                   mongoc_cluster_node_t        *node,
+                                   const mongoc_rpc_t           *rpcs,
+                                   size_t                        rpcs_len,
+                                   const mongoc_write_concern_t *write_concern,
+                                   bool                         *acquired,
+                                   bson_error_t                 *error)
+{
+   size_t i;
+
+   *acquired = false;
+
+   if (!cluster->limiter || node->limit_slot) {
+      return true;
+   }
+
+   for (i = 0; i < rpcs_len; i++) {
+      if (rpcs[i].header.opcode == MONGOC_OPCODE_GET_MORE) {
+         return true;
+      }
+
+      if (_mongoc_cluster_rpc_histogram (
+             &rpcs[i], _mongoc_rpc_needs_gle (&rpcs[i], write_concern))) {
+         break;
+      }
+   }
+
+   if (i == rpcs_len) {
+      return true;
+   }
+
+   if (!(node->limit_slot = _mongoc_node_limiter_acquire (
+            cluster->limiter, node->host.host_and_port))) {
+      mongoc_counter_cluster_limiter_rejects_inc ();
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_OVERLOADED,
+                      "%s has too many operations in flight.",
+                      node->host.host_and_port);
+      return false;
+   }
+
+   *acquired = true;
+
+   return true;
+}
+
+
+/*
+ * Counts the growth of @cluster->iov since it was last counted in the
+ * "Cluster Iov Bytes" counter.
+ */
+static void
+_mongoc_cluster_count_iov (mongoc_cluster_t *cluster)
+{
+   if (cluster->iov.allocated != cluster->iov_bytes_counted) {
+      mongoc_counter_memory_cluster_iov_add (
+         (int64_t)cluster->iov.allocated -
+         (int64_t)cluster->iov_bytes_counted);
+      cluster->iov_bytes_counted = cluster->iov.allocated;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_do_sendv --
+ *
+ *       Deliver an RPC to the MongoDB server.
+ *
+ *       If @hint is non-zero, the connection matching that hint will be
+ *       used or the operation will fail. This is primarily used to force
+ *       sending an RPC on the same connection as a previous RPC. This
+ *       is often the case with OP_QUERY followed by OP_GETMORE.
+ *
+ *       @rpcs should be an array of mongoc_rpc_t that have not yet been
+ *       gathered or swab'ed. The state of @rpcs is undefined after calling
+ *       this function and should not be used afterwards.
+ *
+ *       @write_concern is optional. Providing it may cause this function
+ *       to block until an operation has completed on the remote MongoDB
+ *       server.
+ *
+ *       @read_prefs is optional and can be used to dictate which machines
+ *       may be used to perform a query upon.
+ *
+ *       This function will continue to try to deliver an RPC until
+ *       successful or the retry count has surprased.
+ *
+ * Returns:
+ *       Zero on failure. A non-zero value is the hint of the connection
+ *       that was used to communicate with a remote MongoDB server. This
+ *       value may be passed as @hint in future calls to use the same
+ *       connection.
+ *
+ *       If the result is zero, then @error will be set with information
+ *       about the failure.
+ *
+ * Side effects:
+ *       @rpcs may be mutated and should be considered invalid after calling
+ *       this function.
+ *
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_cluster_do_sendv (mongoc_cluster_t             *cluster,
+                          mongoc_rpc_t                 *rpcs,
+                          size_t                        rpcs_len,
+                          uint32_t                 hint,
+                          const mongoc_write_concern_t *write_concern,
+                          const mongoc_read_prefs_t    *read_prefs,
+                          bson_error_t                 *error)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_iovec_t compressed;
+   mongoc_iovec_t *iov;
+   mongoc_rpc_t kill = {{ 0 }};
+   int64_t now;
+   int32_t timeout_msec;
+   size_t iovcnt;
+   size_t i;
+   bool need_gle;
+   bool expect_reply = false;
+   mongoc_histogram_t *op_histogram = NULL;
+   mongoc_histogram_t *histogram;
+   mongoc_scoped_counters_t *op_ns_counters = NULL;
+   int retry_count = 0;
+   int64_t selection_expire_at = 0;
+   int64_t reconnect_started;
+   bool reconnected;
+   bool acquired;
+
+   ENTRY;
+
+   bson_return_val_if_fail(cluster, false);
+   bson_return_val_if_fail(rpcs, false);
+   bson_return_val_if_fail(rpcs_len, false);
+
+   now = bson_get_monotonic_time();
+
+   if (cluster->monitor || (cluster->heartbeat_frequency_msec > 0)) {
+      /*
+       * A topology monitor refreshes the cluster in the background. We only
+       * pick up what it has published and never rescan on this thread
+       * unless we have nothing at all to talk to. Clients of a pool are
+       * handed the monitor of the pool when they are created.
+       */
+      if (!cluster->monitor) {
+         cluster->monitor =
+            _mongoc_cluster_monitor_new (cluster->uri, cluster->client,
+                                         cluster->heartbeat_frequency_msec);
+      }
+
+      _mongoc_cluster_monitor_sync (cluster->monitor, cluster);
+
+      if (cluster->state == MONGOC_CLUSTER_STATE_UNHEALTHY) {
+         _mongoc_cluster_reconnect_or_adopt (cluster, false, NULL);
+      } else if ((cluster->state == MONGOC_CLUSTER_STATE_DEAD) ||
+                 (cluster->state == MONGOC_CLUSTER_STATE_BORN)) {
+         if (!_mongoc_cluster_reconnect_or_adopt (cluster, true, error)) {
+            RETURN (false);
+         }
+      }
+   } else if ((cluster->state == MONGOC_CLUSTER_STATE_DEAD) ||
+              ((cluster->state == MONGOC_CLUSTER_STATE_UNHEALTHY) &&
+               _mongoc_cluster_unhealthy_reconnect_due (cluster, now))) {
+      /*
+       * If we are in an unhealthy state, and enough time has elapsed since
+       * our last reconnection, go ahead and try to perform reconnection
+       * immediately.
+       */
+      if (!_mongoc_cluster_reconnect(cluster, error)) {
+         RETURN(false);
+      }
+   } else if (cluster->needs_primary_probe) {
+      /*
+       * The primary stepped down. Find the new one among the members we
+       * are already connected to rather than waiting for a full rescan.
+       */
+      _mongoc_cluster_probe_primary (cluster);
+   } else if ((cluster->mode != MONGOC_CLUSTER_DIRECT) &&
+              (BSON_MAX (cluster->last_ping, cluster->last_reconnect) +
+               PING_INTERVAL_USEC) <= now) {
+      /*
+       * Keep the ping times used for node selection current.
+       */
+      _mongoc_cluster_ping_nodes (cluster, NULL);
+   }
+
+   if (cluster->apm_enabled) {
+      cluster->op_reconnect_usec = bson_get_monotonic_time () - now;
+   }
+
+   for (;;) {
+      /*
+       * Try to find a node to deliver to. Since we are allowed to block in this
+       * version of sendv, we try to reconnect if we cannot select a node.
+       */
+      while (!(node = _mongoc_cluster_select (cluster, rpcs, rpcs_len, hint,
+                                              write_concern, read_prefs,
+                                              error))) {
+         reconnect_started = bson_get_monotonic_time ();
+         reconnected = (_mongoc_cluster_io_timeout (cluster, &timeout_msec,
+                                                    error) &&
+                        _mongoc_cluster_retry_selection (cluster,
+                                                         &retry_count,
+                                                         &selection_expire_at,
+                                                         error));
+         cluster->op_reconnect_usec +=
+            bson_get_monotonic_time () - reconnect_started;
+
+         if (!reconnected) {
+            RETURN (false);
+         }
+      }
+
+      BSON_ASSERT(node->stream);
+
+      if (node->last_read_msec + CHECK_CLOSED_DURATION_MSEC < now) {
+         if (mongoc_stream_check_closed (node->stream)) {
+            reconnect_started = bson_get_monotonic_time ();
+            _mongoc_cluster_disconnect_node (cluster, node);
+
+            /*
+             * Only this node's connection went away, so reopen it alone
+             * the way a lazily discovered node is connected. The rest of
+             * the cluster is rediscovered only if that fails.
+             */
+            node->lazy = 1;
+            if (_mongoc_cluster_node_connect_lazy (cluster, node, NULL)) {
+               node->last_read_msec = now;
+            } else {
+               _mongoc_cluster_reconnect_or_adopt (cluster, true, NULL);
+            }
+            cluster->op_reconnect_usec +=
+               bson_get_monotonic_time () - reconnect_started;
+         } else {
+            node->last_read_msec = now;
+            break;
+         }
+      } else {
+         break;
+      }
+   }
+
+   if (cluster->apm_enabled) {
+      cluster->op_selected = bson_get_monotonic_time ();
+   }
+
+   if (!_mongoc_cluster_node_acquire_slot (cluster, node, rpcs, rpcs_len,
+                                           write_concern, &acquired, error)) {
+      RETURN (0);
+   }
+
+   _mongoc_array_clear (&cluster->iov);
+   _mongoc_cluster_prepare_gle (cluster, rpcs_len);
+
+   /*
+    * Kill the cursors abandoned on this node on the way.
+    */
+   if (_mongoc_cluster_take_dead_cursors (cluster, node, &kill)) {
+      kill.header.request_id = ++cluster->request_id;
+      _mongoc_rpc_gather (&kill, &cluster->iov);
+      _mongoc_cluster_inc_egress_rpc (cluster, node, &kill);
+      _mongoc_rpc_swab_to_le (&kill);
+   }
+
+   /*
+    * TODO: We can probably remove the need for sendv and just do send since
+    * we support write concerns now.
+    */
+
+   for (i = 0; i < rpcs_len; i++) {
+      rpcs[i].header.request_id = ++cluster->request_id;
+      need_gle = _mongoc_rpc_needs_gle(&rpcs[i], write_concern);
+      if ((histogram = _mongoc_cluster_rpc_histogram (&rpcs[i], need_gle))) {
+         expect_reply = true;
+         op_histogram = histogram;
+         op_ns_counters = _mongoc_cluster_ns_counters (cluster, &rpcs[i]);
+      }
+      _mongoc_rpc_gather (&rpcs[i], &cluster->iov);
+      _mongoc_cluster_inc_egress_rpc (cluster, node, &rpcs[i]);
+
+	  if (rpcs[i].header.msg_len >(int32_t)cluster->max_msg_size) {
+         bson_set_error(error,
+                        MONGOC_ERROR_CLIENT,
+                        MONGOC_ERROR_CLIENT_TOO_BIG,
+                        "Attempted to send an RPC larger than the "
+                        "max allowed message size. Was %u, allowed %u.",
+                        rpcs[i].header.msg_len,
+                        cluster->max_msg_size);
+         if (acquired) {
+            _mongoc_cluster_node_release_slot (node, 0, false);
+         }
+         RETURN(0);
+      }
+
+      if (need_gle) {
+         _mongoc_cluster_gather_gle (cluster, &rpcs[i], write_concern,
+                                     &cluster->gle_headers[i]);
+      }
+
+      _mongoc_rpc_swab_to_le(&rpcs[i]);
+   }
+
+   _mongoc_cluster_count_iov (cluster);
+
+   iov = cluster->iov.data;
+   iovcnt = cluster->iov.len;
+   errno = 0;
+
+   if (node->compressed) {
+      _mongoc_cluster_compress (cluster, &iov, &iovcnt, &compressed);
+   }
+
+   BSON_ASSERT (cluster->iov.len);
+
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      if (acquired) {
+         _mongoc_cluster_node_release_slot (node, 0, false);
+      }
+      RETURN (0);
+   }
+
+   if (!mongoc_stream_writev (node->stream, iov, iovcnt, timeout_msec)) {
+      char buf[128];
+      char * errstr;
+      errstr = bson_strerror_r(errno, buf, sizeof buf);
+
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failure during socket delivery: %s",
+                      errstr);
+      _mongoc_cluster_node_io_failed (cluster, node);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (0);
+   }
+
+   if (expect_reply) {
+      node->op_started = bson_get_monotonic_time ();
+      node->op_histogram = op_histogram;
+      node->op_ns_counters = op_ns_counters;
+   }
+
+   if (cluster->apm_enabled) {
+      cluster->op_sent = bson_get_monotonic_time ();
+   }
+
+   RETURN (node->index + 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_do_try_sendv --
+ *
+ *       Deliver an RPC to a remote MongoDB instance.
+ *
+ *       This function is similar to _mongoc_cluster_sendv() except that it
+ *       will not try to reconnect until a connection has been made.
+ *
+ *       This is useful if you want to fire-and-forget ignoring network
+ *       errors. Kill Cursors would be a candidate for this.
+ *
+ * Returns:
+ *       0 on failure and @error is set.
+ *
+ *       Non-zero on success. The return value is a hint for the
+ *       connection that was used to communicate with the server.
+ *
+ * Side effects:
+ *       @rpcs will be invalid after calling this function.
+ *       @error may be set if 0 is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_cluster_do_try_sendv (mongoc_cluster_t             *cluster,
+                              mongoc_rpc_t                 *rpcs,
+                              size_t                        rpcs_len,
+                              uint32_t                 hint,
+                              const mongoc_write_concern_t *write_concern,
+                              const mongoc_read_prefs_t    *read_prefs,
+                              bson_error_t                 *error)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_iovec_t compressed;
+   mongoc_iovec_t *iov;
+   bool need_gle;
+   bool expect_reply = false;
+   mongoc_histogram_t *op_histogram = NULL;
+   mongoc_histogram_t *histogram;
+   mongoc_scoped_counters_t *op_ns_counters = NULL;
+   int32_t timeout_msec;
+   size_t iovcnt;
+   size_t i;
+   bool acquired;
+
+   ENTRY;
+
+   bson_return_val_if_fail(cluster, false);
+   bson_return_val_if_fail(rpcs, false);
+   bson_return_val_if_fail(rpcs_len, false);
+
+   if (!(node = _mongoc_cluster_select(cluster, rpcs, rpcs_len, hint,
+                                       write_concern, read_prefs, error))) {
+      RETURN (0);
+   }
+
+   BSON_ASSERT (node->stream);
+
+   if (cluster->apm_enabled) {
+      cluster->op_selected = bson_get_monotonic_time ();
+   }
+
+   if (!_mongoc_cluster_node_acquire_slot (cluster, node, rpcs, rpcs_len,
+                                           write_concern, &acquired, error)) {
+      RETURN (0);
+   }
+
+   _mongoc_array_clear (&cluster->iov);
+   _mongoc_cluster_prepare_gle (cluster, rpcs_len);
+
+   for (i = 0; i < rpcs_len; i++) {
+      rpcs[i].header.request_id = ++cluster->request_id;
+      need_gle = _mongoc_rpc_needs_gle (&rpcs[i], write_concern);
+      if ((histogram = _mongoc_cluster_rpc_histogram (&rpcs[i], need_gle))) {
+         expect_reply = true;
+         op_histogram = histogram;
+         op_ns_counters = _mongoc_cluster_ns_counters (cluster, &rpcs[i]);
+      }
+      _mongoc_rpc_gather (&rpcs[i], &cluster->iov);
+      _mongoc_cluster_inc_egress_rpc (cluster, node, &rpcs[i]);
+
+	  if (rpcs[i].header.msg_len >(int32_t)cluster->max_msg_size) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_TOO_BIG,
+                         "Attempted to send an RPC larger than the "
+                         "max allowed message size. Was %u, allowed %u.",
+                         rpcs[i].header.msg_len,
+                         cluster->max_msg_size);
+         if (acquired) {
+            _mongoc_cluster_node_release_slot (node, 0, false);
+         }
+         RETURN (0);
+      }
+
+      if (need_gle) {
+         _mongoc_cluster_gather_gle (cluster, &rpcs[i], write_concern,
+                                     &cluster->gle_headers[i]);
+      }
+
+      _mongoc_rpc_swab_to_le (&rpcs[i]);
+   }
+
+   _mongoc_cluster_count_iov (cluster);
+
+   iov = cluster->iov.data;
+   iovcnt = cluster->iov.len;
+   errno = 0;
+
+   if (node->compressed) {
+      _mongoc_cluster_compress (cluster, &iov, &iovcnt, &compressed);
+   }
+
+   DUMP_IOVEC (iov, iov, iovcnt);
+
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      if (acquired) {
+         _mongoc_cluster_node_release_slot (node, 0, false);
+      }
+      RETURN (0);
+   }
+
+   if (!mongoc_stream_writev (node->stream, iov, iovcnt, timeout_msec)) {
+      char buf[128];
+      char * errstr;
+      errstr = bson_strerror_r(errno, buf, sizeof buf);
+
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failure during socket delivery: %s",
+                      errstr);
+      _mongoc_cluster_node_io_failed (cluster, node);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (0);
+   }
+
+   if (expect_reply) {
+      node->op_started = bson_get_monotonic_time ();
+      node->op_histogram = op_histogram;
+      node->op_ns_counters = op_ns_counters;
+   }
+
+   if (cluster->apm_enabled) {
+      cluster->op_sent = bson_get_monotonic_time ();
+   }
+
+   RETURN(node->index + 1);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_recv_compressed --
+ *
+ *       Read the rest of a message whose length, @msg_len, has been read
+ *       into @buffer at @pos, from a node that accepted compression. If
+ *       it turns out to be OP_COMPRESSED, the compressed body is read
+ *       aside and expanded into @buffer, and @msg_len is updated to the
+ *       length of the original message.
+ *
+ * Returns:
+ *       true if successful; otherwise false, @error is set and @node has
+ *       been disconnected.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_recv_compressed (mongoc_cluster_t      *cluster,
+                                 mongoc_cluster_node_t *node,
+                                 mongoc_buffer_t       *buffer,
+                                 off_t                  pos,
+                                 int32_t               *msg_len,
+                                 int32_t                timeout_msec,
+                                 bson_error_t          *error)
+{
+   mongoc_buffer_t *body;
+   int32_t opcode;
+
+   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, 12,
+                                           timeout_msec, error)) {
+      GOTO (io_failure);
+   }
+
+   memcpy (&opcode, &buffer->data[buffer->off + pos + 12], 4);
+   opcode = BSON_UINT32_FROM_LE (opcode);
+
+   body = (opcode == MONGOC_OPCODE_COMPRESSED) ? &cluster->compress_in
+                                               : buffer;
+
+   if (body != buffer) {
+      _mongoc_buffer_clear (body, false);
+      _mongoc_buffer_shrink (body);
+   }
+
+   if ((*msg_len > 16) &&
+       !_mongoc_buffer_append_from_stream (body, node->stream, *msg_len - 16,
+                                           timeout_msec, error)) {
+      GOTO (io_failure);
+   }
+
+   if ((body != buffer) &&
+       !_mongoc_uncompress_message (buffer, pos, body->data + body->off,
+                                    body->len, cluster->max_msg_size,
+                                    msg_len)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Failed to decompress reply from server.");
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      return false;
+   }
+
+   return true;
+
+io_failure:
+   _mongoc_cluster_node_io_failed (cluster, node);
+   _mongoc_cluster_disconnect_node (cluster, node);
+   mongoc_counter_protocol_ingress_error_inc ();
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_do_try_recv --
+ *
+ *       Tries to receive the next event from the node in the cluster
+ *       specified by @hint. The contents are loaded into @buffer and then
+ *       scattered into the @rpc structure. @rpc is valid as long as
+ *       @buffer contains the contents read into it.
+ *
+ *       Callers that can optimize a reuse of @buffer should do so. It
+ *       can save many memory allocations.
+ *
+ * Returns:
+ *       0 on failure and @error is set.
+ *       non-zero on success where the value is the hint of the connection
+ *       that was used.
+ *
+ * Side effects:
+ *       @error if return value is zero.
+ *       @rpc is set if result is non-zero.
+ *       @buffer will be filled with the input data.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cluster_do_try_recv (mongoc_cluster_t *cluster,
+                             mongoc_rpc_t     *rpc,
+                             mongoc_buffer_t  *buffer,
+                             uint32_t          hint,
+                             bson_error_t     *error)
+{
+   mongoc_cluster_node_t *node;
+   int32_t timeout_msec;
+   int32_t msg_len;
+   off_t pos;
+
+   ENTRY;
+
+   bson_return_val_if_fail (cluster, false);
+   bson_return_val_if_fail (rpc, false);
+   bson_return_val_if_fail (buffer, false);
+   bson_return_val_if_fail (hint, false);
+   bson_return_val_if_fail (hint <= cluster->nodes_len, false);
+
+   /*
+    * Fetch the node to communicate over.
+    */
+   node = &cluster->nodes[hint-1];
+   if (!node->stream) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "Failed to receive message, lost connection to node.");
+      RETURN (false);
+   }
+
+   TRACE ("Waiting for reply from \"%s\"", node->host.host_and_port);
+
+   /*
+    * Buffer the message length to determine how much more to read.
+    */
+   pos = buffer->len;
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, 4,
+                                           timeout_msec, error)) {
+      _mongoc_cluster_node_io_failed (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   if (cluster->apm_enabled) {
+      cluster->op_first_byte = bson_get_monotonic_time ();
+   }
+
+   /*
+    * Read the msg length from the buffer.
+    */
+   memcpy (&msg_len, &buffer->data[buffer->off + pos], 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
+   if ((msg_len < 16) || (msg_len > cluster->max_msg_size)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Corrupt or malicious reply received.");
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   /*
+    * Read the rest of the message from the stream.
+    */
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
+
+   if (node->compressed) {
+      if (!_mongoc_cluster_recv_compressed (cluster, node, buffer, pos,
+                                            &msg_len, timeout_msec, error)) {
+         RETURN (false);
+      }
+   } else if (!_mongoc_buffer_append_from_stream (buffer, node->stream,
+                                                  msg_len - 4, timeout_msec,
+                                                  error)) {
+      _mongoc_cluster_node_io_failed (cluster, node);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   /*
+    * Scatter the buffer into the rpc structure.
+    */
+   if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos], msg_len)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Failed to decode reply from server.");
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
+
+   node->last_read_msec = bson_get_monotonic_time ();
+   _mongoc_cluster_node_track_op (node, node->last_read_msec);
+   _mongoc_cluster_node_record_success (node);
+
+   DUMP_BYTES (buffer, buffer->data + buffer->off, buffer->len);
+
+   _mongoc_rpc_swab_from_le (rpc);
+
+   _mongoc_cluster_inc_ingress_rpc (node, rpc);
+
+   if (node->primary && _mongoc_cluster_reply_is_not_master (rpc)) {
+      _mongoc_cluster_node_mark_stale (cluster, node);
+   }
+
+   RETURN(true);
+}
+
+
+/*
+ * Monitoring is on while there are callbacks to call or slow operations
+ * to log.
+ */
+static void
+_mongoc_cluster_apm_update (mongoc_cluster_t *cluster)
+{
+   cluster->apm_enabled = (cluster->apm.started ||
+                           cluster->apm.succeeded ||
+                           cluster->apm.failed ||
+                           cluster->slow_op_usec);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_set_apm_callbacks --
+ *
+ *       Set the command monitoring callbacks of @cluster, or turn
+ *       monitoring off if @callbacks is NULL or has no callback set.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_set_apm_callbacks (mongoc_cluster_t             *cluster,
+                                   const mongoc_apm_callbacks_t *callbacks,
+                                   void                         *context)
+{
+   BSON_ASSERT (cluster);
+
+   memset (&cluster->apm, 0, sizeof cluster->apm);
+   cluster->apm_context = context;
+
+   if (callbacks) {
+      memcpy (&cluster->apm, callbacks, sizeof cluster->apm);
+   }
+
+   _mongoc_cluster_apm_update (cluster);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_set_slow_op_log --
+ *
+ *       Report each operation of @cluster that takes @threshold_usec or
+ *       longer to @callback, or keep the last MONGOC_CLUSTER_SLOW_OPS_MAX
+ *       of them for _mongoc_cluster_get_slow_ops() if @callback is NULL.
+ *       A @threshold_usec of zero or less turns this off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The operations kept so far are discarded, unless nothing changed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cluster_set_slow_op_log (mongoc_cluster_t        *cluster,
+                                 int64_t                  threshold_usec,
+                                 mongoc_apm_slow_op_cb_t  callback,
+                                 void                    *context)
+{
+   BSON_ASSERT (cluster);
+
+   threshold_usec = BSON_MAX (threshold_usec, 0);
+
+   if ((cluster->slow_op_usec == threshold_usec) &&
+       (cluster->slow_op_cb == callback) &&
+       (cluster->slow_op_context == context)) {
+      return;
+   }
+
+   cluster->slow_op_usec = threshold_usec;
+   cluster->slow_op_cb = callback;
+   cluster->slow_op_context = context;
+   cluster->slow_ops_len = 0;
+   cluster->slow_ops_next = 0;
+
+   if (cluster->slow_op_usec && !callback && !cluster->slow_ops) {
+      cluster->slow_ops = bson_malloc0 (MONGOC_CLUSTER_SLOW_OPS_MAX *
+                                        sizeof *cluster->slow_ops);
+   }
+
+   _mongoc_cluster_apm_update (cluster);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_get_slow_ops --
+ *
+ *       Copy up to @n_ops of the slow operations kept by @cluster into
+ *       @ops, oldest first, and forget them.
+ *
+ * Returns:
+ *       The number of operations copied.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+_mongoc_cluster_get_slow_ops (mongoc_cluster_t     *cluster,
+                              mongoc_apm_slow_op_t *ops,
+                              size_t                n_ops)
+{
+   uint32_t first;
+   size_t i;
+
+   BSON_ASSERT (cluster);
+
+   n_ops = BSON_MIN (n_ops, cluster->slow_ops_len);
+   first = (cluster->slow_ops_next + MONGOC_CLUSTER_SLOW_OPS_MAX -
+            cluster->slow_ops_len) % MONGOC_CLUSTER_SLOW_OPS_MAX;
+
+   for (i = 0; i < n_ops; i++) {
+      memcpy (&ops [i],
+              &cluster->slow_ops [(first + i) % MONGOC_CLUSTER_SLOW_OPS_MAX],
+              sizeof *ops);
+   }
+
+   cluster->slow_ops_len -= (uint32_t)n_ops;
+
+   return n_ops;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_get_flights --
+ *
+ *       Copy up to @n_records of the last operations of @cluster from its
+ *       flight recorder into @records, oldest first. Unlike the slow
+ *       operations, they are kept, so that they can be read again when
+ *       another operation turns out slow or fails.
+ *
+ *       The host is that of the node the operation was sent to, if the
+ *       topology has not changed since.
+ *
+ * Returns:
+ *       The number of records copied.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+_mongoc_cluster_get_flights (mongoc_cluster_t           *cluster,
+                             mongoc_apm_flight_record_t *records,
+                             size_t                      n_records)
+{
+   mongoc_cluster_flight_t *flight;
+   mongoc_apm_flight_record_t *record;
+   uint32_t seq;
+   size_t i;
+
+   BSON_ASSERT (cluster);
+
+   n_records = BSON_MIN (n_records, BSON_MIN (cluster->flights_seq,
+                                              MONGOC_CLUSTER_FLIGHTS_MAX));
+   seq = cluster->flights_seq - (uint32_t)n_records;
+
+   for (i = 0; i < n_records; i++) {
+      seq++;
+      flight = &cluster->flights [seq & (MONGOC_CLUSTER_FLIGHTS_MAX - 1)];
+      record = &records [i];
+
+      memset (record, 0, sizeof *record);
+      record->opcode = flight->opcode;
+      bson_strncpy (record->ns, flight->ns, sizeof record->ns);
+      if (flight->hint && (flight->hint <= cluster->nodes_len)) {
+         bson_strncpy (record->host,
+                       cluster->nodes [flight->hint - 1].host.host_and_port,
+                       sizeof record->host);
+      }
+      record->request_id = flight->request_id;
+      record->started_usec = flight->started;
+      record->sent_usec = flight->sent;
+      record->replied_usec = flight->replied;
+      record->bytes_sent = flight->bytes_sent;
+      record->bytes_received = flight->bytes_received;
+      record->error_domain = flight->error_domain;
+      record->error_code = flight->error_code;
+   }
+
+   return n_records;
+}
+
+
+/*
+ * Log @op, if it took as long as the threshold of the slow operation log,
+ * to the callback or to the ring of the last slow operations.
+ */
+static void
+_mongoc_cluster_apm_slow_op (mongoc_cluster_t      *cluster,
+                             mongoc_cluster_node_t *node,
+                             mongoc_apm_slow_op_t  *op)
+{
+   if (!cluster->slow_op_usec || (op->duration_usec < cluster->slow_op_usec)) {
+      return;
+   }
+
+   if (node) {
+      bson_strncpy (op->host, node->host.host_and_port, sizeof op->host);
+   }
+
+   if (cluster->slow_op_cb) {
+      cluster->slow_op_cb (op, cluster->slow_op_context);
+   } else if (cluster->slow_ops) {
+      memcpy (&cluster->slow_ops [cluster->slow_ops_next], op, sizeof *op);
+      cluster->slow_ops_next =
+         (cluster->slow_ops_next + 1) % MONGOC_CLUSTER_SLOW_OPS_MAX;
+      if (cluster->slow_ops_len < MONGOC_CLUSTER_SLOW_OPS_MAX) {
+         cluster->slow_ops_len++;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_apm_note --
+ *
+ *       Note the name, namespace and whether a reply is expected for each
+ *       of @rpcs in cluster->apm_ops, before they are gathered and
+ *       swabbed. Commands are named after the first key of the command
+ *       document, which is read in place.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       cluster->apm_ops is overwritten.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_apm_note (mongoc_cluster_t             *cluster,
+                          mongoc_rpc_t                 *rpcs,
+                          size_t                        rpcs_len,
+                          const mongoc_write_concern_t *write_concern)
+{
+   mongoc_cluster_apm_op_t op;
+   const char *dot;
+   bson_iter_t iter;
+   int32_t len;
+   bson_t cmd;
+   size_t i;
+
+   _mongoc_array_clear (&cluster->apm_ops);
+
+   for (i = 0; i < rpcs_len; i++) {
+      op.ns = NULL;
+      op.expects_reply = false;
 
-   stream = _mongoc_client_create_stream (cluster->client, hosts, error);
-   if (!stream) {
-      RETURN (false);
+      switch (rpcs[i].header.opcode) {
+      case MONGOC_OPCODE_QUERY:
+         op.command_name = "query";
+         op.ns = rpcs[i].query.collection;
+         op.expects_reply = true;
+
+         dot = strchr (op.ns, '.');
+         if (dot && !strcmp (dot, ".$cmd")) {
+            memcpy (&len, rpcs[i].query.query, 4);
+            len = BSON_UINT32_FROM_LE (len);
+            if (bson_init_static (&cmd, rpcs[i].query.query, len) &&
+                bson_iter_init (&iter, &cmd) &&
+                bson_iter_next (&iter)) {
+               op.command_name = bson_iter_key (&iter);
+            }
+         }
+         break;
+      case MONGOC_OPCODE_GET_MORE:
+         op.command_name = "getMore";
+         op.ns = rpcs[i].get_more.collection;
+         op.expects_reply = true;
+         break;
+      case MONGOC_OPCODE_INSERT:
+         op.command_name = "insert";
+         op.ns = rpcs[i].insert.collection;
+         break;
+      case MONGOC_OPCODE_UPDATE:
+         op.command_name = "update";
+         op.ns = rpcs[i].update.collection;
+         break;
+      case MONGOC_OPCODE_DELETE:
+         op.command_name = "delete";
+         op.ns = rpcs[i].delete.collection;
+         break;
+      case MONGOC_OPCODE_KILL_CURSORS:
+         op.command_name = "killCursors";
+         break;
+      default:
+         op.command_name = "unknown";
+         break;
+      }
+
+      if (!op.expects_reply) {
+         op.expects_reply = _mongoc_rpc_needs_gle (&rpcs[i], write_concern);
+      }
+
+      _mongoc_array_append_val (&cluster->apm_ops, op);
    }
+}
 
-   node->stream = stream;
-   node->stamp++;
 
-   timeout.tv_sec = cluster->sockettimeoutms / 1000UL;
-   timeout.tv_usec = (cluster->sockettimeoutms % 1000UL) * 1000UL;
-   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_RCVTIMEO,
-                             &timeout, sizeof timeout);
-   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_SNDTIMEO,
-                             &timeout, sizeof timeout);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_apm_sent --
+ *
+ *       Emit the started event of each operation noted by
+ *       _mongoc_cluster_apm_note(), once @rpcs were sent to the node of
+ *       @hint, or failed to be if @hint is zero. Operations without a
+ *       reply succeed as soon as they are written, and the one that
+ *       expects a reply is left pending on its node.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Callbacks are called.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (!_mongoc_cluster_ismaster (cluster, node, error)) {
-      _mongoc_cluster_disconnect_node (cluster, node);
-      RETURN (false);
+static void
+_mongoc_cluster_apm_sent (mongoc_cluster_t   *cluster,
+                          const mongoc_rpc_t *rpcs,
+                          uint32_t            hint,
+                          int64_t             started,
+                          const bson_error_t *error)
+{
+   mongoc_apm_command_succeeded_t succeeded = { 0 };
+   mongoc_apm_command_started_t event = { 0 };
+   mongoc_apm_command_failed_t failed = { 0 };
+   mongoc_apm_slow_op_t slow = {{ 0 }};
+   mongoc_cluster_apm_op_t *op;
+   mongoc_cluster_node_t *node = NULL;
+   int64_t selected;
+   int64_t duration;
+   int64_t now;
+   size_t i;
+
+   if (hint && (hint <= cluster->nodes_len)) {
+      node = &cluster->nodes[hint - 1];
    }
 
-   if (node->needs_auth) {
-      if (!_mongoc_cluster_auth_node (cluster, node, error)) {
-         _mongoc_cluster_disconnect_node (cluster, node);
-         RETURN (false);
+   now = bson_get_monotonic_time ();
+   duration = now - started;
+
+   selected = cluster->op_selected ? cluster->op_selected : now;
+   slow.duration_usec = duration;
+   slow.reconnect_usec = cluster->op_reconnect_usec;
+   slow.selection_usec = BSON_MAX (selected - started - slow.reconnect_usec,
+                                   0);
+   slow.send_usec = (cluster->op_sent ? cluster->op_sent : now) - selected;
+
+   for (i = 0; i < cluster->apm_ops.len; i++) {
+      op = &_mongoc_array_index (&cluster->apm_ops,
+                                 mongoc_cluster_apm_op_t, i);
+
+      event.command_name = op->command_name;
+      event.ns = op->ns;
+      event.request_id = node ? (int32_t)BSON_UINT32_FROM_LE (
+         rpcs[i].header.request_id) : 0;
+      event.host = node ? &node->host : NULL;
+      event.context = cluster->apm_context;
+
+      if (cluster->apm.started) {
+         cluster->apm.started (&event);
+      }
+
+      bson_strncpy (slow.command_name, op->command_name,
+                    sizeof slow.command_name);
+      bson_strncpy (slow.ns, op->ns ? op->ns : "", sizeof slow.ns);
+      slow.request_id = event.request_id;
+      slow.bytes_sent = node ? (int32_t)BSON_UINT32_FROM_LE (
+         rpcs[i].header.msg_len) : 0;
+
+      if (!node) {
+         slow.failed = true;
+         _mongoc_cluster_apm_slow_op (cluster, NULL, &slow);
+
+         if (cluster->apm.failed) {
+            failed.command_name = event.command_name;
+            failed.ns = event.ns;
+            failed.request_id = event.request_id;
+            failed.host = event.host;
+            failed.duration_usec = duration;
+            failed.error = error;
+            failed.context = cluster->apm_context;
+            cluster->apm.failed (&failed);
+         }
+      } else if (!op->expects_reply) {
+         _mongoc_cluster_apm_slow_op (cluster, node, &slow);
+
+         if (cluster->apm.succeeded) {
+            succeeded.command_name = event.command_name;
+            succeeded.ns = event.ns;
+            succeeded.request_id = event.request_id;
+            succeeded.host = event.host;
+            succeeded.duration_usec = duration;
+            succeeded.reply_len = 0;
+            succeeded.context = cluster->apm_context;
+            cluster->apm.succeeded (&succeeded);
+         }
+      } else {
+         node->apm_pending = true;
+         node->apm_request_id = event.request_id;
+         node->apm_started = started;
+         bson_strncpy (node->apm_command_name, op->command_name,
+                       sizeof node->apm_command_name);
+         bson_strncpy (node->apm_ns, op->ns ? op->ns : "",
+                       sizeof node->apm_ns);
+         node->apm_selection_usec = slow.selection_usec;
+         node->apm_reconnect_usec = slow.reconnect_usec;
+         node->apm_send_usec = slow.send_usec;
+         node->apm_sent = cluster->op_sent ? cluster->op_sent : now;
+         node->apm_bytes_sent = slow.bytes_sent;
       }
-      node->needs_auth = false;
    }
+}
 
-   _mongoc_cluster_update_state (cluster);
 
-   RETURN (true);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_apm_replied --
+ *
+ *       Emit the succeeded or failed event of the operation pending on the
+ *       node of @hint, depending on whether @reply could be received.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Callbacks are called.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cluster_apm_replied (mongoc_cluster_t   *cluster,
+                             uint32_t            hint,
+                             const mongoc_rpc_t *reply,
+                             const bson_error_t *error)
+{
+   mongoc_apm_command_succeeded_t succeeded = { 0 };
+   mongoc_apm_command_failed_t failed = { 0 };
+   mongoc_apm_slow_op_t slow = {{ 0 }};
+   mongoc_cluster_node_t *node;
+   int64_t first_byte;
+   int64_t duration;
+   int64_t now;
+
+   if (!hint || (hint > cluster->nodes_len)) {
+      return;
+   }
+
+   node = &cluster->nodes[hint - 1];
+
+   if (!node->apm_pending) {
+      return;
+   }
+
+   node->apm_pending = false;
+   now = bson_get_monotonic_time ();
+   duration = now - node->apm_started;
+
+   if (cluster->slow_op_usec && (duration >= cluster->slow_op_usec)) {
+      first_byte = cluster->op_first_byte ? cluster->op_first_byte : now;
+      bson_strncpy (slow.command_name, node->apm_command_name,
+                    sizeof slow.command_name);
+      bson_strncpy (slow.ns, node->apm_ns, sizeof slow.ns);
+      slow.request_id = node->apm_request_id;
+      slow.failed = !reply;
+      slow.duration_usec = duration;
+      slow.selection_usec = node->apm_selection_usec;
+      slow.reconnect_usec = node->apm_reconnect_usec;
+      slow.send_usec = node->apm_send_usec;
+      slow.wait_usec = BSON_MAX (first_byte - node->apm_sent, 0);
+      slow.receive_usec = BSON_MAX (now - first_byte, 0);
+      slow.bytes_sent = node->apm_bytes_sent;
+      slow.bytes_received = reply ? reply->header.msg_len : 0;
+      _mongoc_cluster_apm_slow_op (cluster, node, &slow);
+   }
+
+   if (reply && cluster->apm.succeeded) {
+      succeeded.command_name = node->apm_command_name;
+      succeeded.ns = node->apm_ns;
+      succeeded.request_id = node->apm_request_id;
+      succeeded.host = &node->host;
+      succeeded.duration_usec = duration;
+      succeeded.reply_len = reply->header.msg_len;
+      succeeded.context = cluster->apm_context;
+      cluster->apm.succeeded (&succeeded);
+   } else if (!reply && cluster->apm.failed) {
+      failed.command_name = node->apm_command_name;
+      failed.ns = node->apm_ns;
+      failed.request_id = node->apm_request_id;
+      failed.host = &node->host;
+      failed.duration_usec = duration;
+      failed.error = error;
+      failed.context = cluster->apm_context;
+      cluster->apm.failed (&failed);
+   }
 }
 
-mongoc_host_list_t *
-prepend_host (const mongoc_host_list_t *host, mongoc_host_list_t *list)
+
+/*
+ * Start the next entry of the flight recorder for @rpcs, which is named
+ * after the first of them, the others being at most a getlasterror.
+ */
+static mongoc_cluster_flight_t *
+_mongoc_cluster_flight_begin (mongoc_cluster_t   *cluster,
+                              const mongoc_rpc_t *rpcs)
 {
-   mongoc_host_list_t *cpy = bson_malloc (sizeof *host);
+   mongoc_cluster_flight_t *flight;
+   const char *ns;
 
-   memcpy (cpy, host, sizeof *host);
-   cpy->next = list;
+   switch (rpcs->header.opcode) {
+   case MONGOC_OPCODE_QUERY:
+      ns = rpcs->query.collection;
+      break;
+   case MONGOC_OPCODE_GET_MORE:
+      ns = rpcs->get_more.collection;
+      break;
+   case MONGOC_OPCODE_INSERT:
+      ns = rpcs->insert.collection;
+      break;
+   case MONGOC_OPCODE_UPDATE:
+      ns = rpcs->update.collection;
+      break;
+   case MONGOC_OPCODE_DELETE:
+      ns = rpcs->delete.collection;
+      break;
+   default:
+      ns = "";
+      break;
+   }
 
-   return cpy;
+   /* zero means no entry, and the first entries are never the last */
+   if (!++cluster->flights_seq) {
+      cluster->flights_seq = MONGOC_CLUSTER_FLIGHTS_MAX;
+   }
+
+   flight = &cluster->flights [cluster->flights_seq &
+                               (MONGOC_CLUSTER_FLIGHTS_MAX - 1)];
+   flight->seq = cluster->flights_seq;
+   flight->opcode = rpcs->header.opcode;
+   flight->hint = 0;
+   flight->request_id = 0;
+   flight->started = bson_get_monotonic_time ();
+   flight->sent = 0;
+   flight->replied = 0;
+   flight->bytes_sent = 0;
+   flight->bytes_received = 0;
+   flight->error_domain = 0;
+   flight->error_code = 0;
+   bson_strncpy (flight->ns, ns, sizeof flight->ns);
+
+   return flight;
 }
 
+
 /*
- * Case-sensitive search for host-and-port.
+ * Note in @flight where @rpcs went, once they were sent to the node of
+ * @hint or failed to be if @hint is zero. The node remembers the entry so
+ * that _mongoc_cluster_flight_replied() can complete it.
  */
-bool
-has_host (const mongoc_host_list_t *hl,
-          const char               *host_and_port)
+static void
+_mongoc_cluster_flight_sent (mongoc_cluster_t        *cluster,
+                             mongoc_cluster_flight_t *flight,
+                             const mongoc_rpc_t      *rpcs,
+                             size_t                   rpcs_len,
+                             uint32_t                 hint,
+                             const bson_error_t      *error)
 {
-   printf ("has_host %s\n", host_and_port);
+   size_t i;
 
-   while (hl) {
-      if (!strcmp(hl->host_and_port, host_and_port)) {
-         printf ("\tyes\n");
-         return true;
-      }
+   if (!hint || (hint > cluster->nodes_len)) {
+      flight->error_domain = error->domain;
+      flight->error_code = error->code;
+      return;
+   }
 
-      hl = hl->next;
+   flight->hint = hint;
+   flight->request_id = (int32_t)BSON_UINT32_FROM_LE (
+      rpcs[rpcs_len - 1].header.request_id);
+   flight->sent = bson_get_monotonic_time ();
+
+   for (i = 0; i < rpcs_len; i++) {
+      flight->bytes_sent += (int32_t)BSON_UINT32_FROM_LE (
+         rpcs[i].header.msg_len);
    }
 
-   printf ("\tno\n");
-   return false;
+   cluster->nodes[hint - 1].flight_seq = flight->seq;
 }
 
 
-void
-host_list_destroy (mongoc_host_list_t *hl)
+/*
+ * Complete the entry of the operation last sent to the node of @hint with
+ * its reply, or with @error if @reply is NULL, unless the ring has moved
+ * past it.
+ */
+static void
+_mongoc_cluster_flight_replied (mongoc_cluster_t   *cluster,
+                                uint32_t            hint,
+                                const mongoc_rpc_t *reply,
+                                const bson_error_t *error)
 {
-   mongoc_host_list_t *tmp;
+   mongoc_cluster_flight_t *flight;
+   uint32_t seq;
 
-   while (hl) {
-      tmp = hl->next;
-      bson_free (hl);
-      hl = tmp;
+   if (!hint || (hint > cluster->nodes_len) ||
+       !(seq = cluster->nodes[hint - 1].flight_seq)) {
+      return;
+   }
+
+   flight = &cluster->flights [seq & (MONGOC_CLUSTER_FLIGHTS_MAX - 1)];
+
+   if (flight->seq != seq) {
+      return;
+   }
+
+   flight->replied = bson_get_monotonic_time ();
+
+   if (reply) {
+      flight->bytes_received = reply->header.msg_len;
+   } else {
+      flight->error_domain = error->domain;
+      flight->error_code = error->code;
    }
+
+   cluster->nodes[hint - 1].flight_seq = 0;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_reconnect_replica_set --
- *
- *       Reconnect to replicaSet members that are unhealthy.
- *
- *       Each of them will be checked for matching replicaSet name
- *       and capabilities via an "isMaster" command.
- *
- *       The nodes will also be greedily authenticated with the
- *       configured user if available.
- *
- * Returns:
- *       true if there is an established stream that may be used,
- *       otherwise false and @error is set.
+ * _mongoc_cluster_sendv --
+ * _mongoc_cluster_try_sendv --
+ * _mongoc_cluster_try_recv --
  *
- * Side effects:
- *       @error is set upon failure if non-NULL.
+ *       See _mongoc_cluster_do_sendv(), _mongoc_cluster_do_try_sendv()
+ *       and _mongoc_cluster_do_try_recv(). These also write the flight
+ *       recorder, emit the command monitoring events and log slow
+ *       operations, the last two costing a single branch when neither is
+ *       asked for.
  *
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_cluster_reconnect_replica_set (mongoc_cluster_t *cluster,
-                                       bson_error_t     *error)
+uint32_t
+_mongoc_cluster_sendv (mongoc_cluster_t             *cluster,
+                       mongoc_rpc_t                 *rpcs,
+                       size_t                        rpcs_len,
+                       uint32_t                      hint,
+                       const mongoc_write_concern_t *write_concern,
+                       const mongoc_read_prefs_t    *read_prefs,
+                       bson_error_t                 *error)
 {
-   const mongoc_host_list_t *hosts;
-   const mongoc_host_list_t *iter;
-   mongoc_host_list_t *failed_hosts = NULL;
-   mongoc_cluster_node_t node;
-   mongoc_cluster_node_t *saved_nodes;
-   size_t saved_nodes_len;
-   mongoc_host_list_t host;
-   mongoc_stream_t *stream;
-   mongoc_list_t *list;
-   mongoc_list_t *liter;
-   int32_t ping;
-   const char *replSet;
-   int i;
-   int j;
-   bool rval = false;
+   mongoc_cluster_flight_t *flight;
+   bson_error_t apm_error = { 0 };
+   int64_t started;
+
+   flight = _mongoc_cluster_flight_begin (cluster, rpcs);
+
+   if (BSON_LIKELY (!cluster->apm_enabled)) {
+      hint = _mongoc_cluster_do_sendv (cluster, rpcs, rpcs_len, hint,
+                                       write_concern, read_prefs,
+                                       error ? error : &apm_error);
+      _mongoc_cluster_flight_sent (cluster, flight, rpcs, rpcs_len, hint,
+                                   error ? error : &apm_error);
+      return hint;
+   }
 
-   ENTRY;
+   _mongoc_cluster_apm_note (cluster, rpcs, rpcs_len, write_concern);
+   cluster->op_reconnect_usec = 0;
+   cluster->op_selected = 0;
+   cluster->op_sent = 0;
+   started = flight->started;
+   hint = _mongoc_cluster_do_sendv (cluster, rpcs, rpcs_len, hint,
+                                    write_concern, read_prefs,
+                                    error ? error : &apm_error);
+   _mongoc_cluster_apm_sent (cluster, rpcs, hint, started,
+                             error ? error : &apm_error);
+   _mongoc_cluster_flight_sent (cluster, flight, rpcs, rpcs_len, hint,
+                                error ? error : &apm_error);
+
+   return hint;
+}
 
-   BSON_ASSERT(cluster);
-   BSON_ASSERT(cluster->mode == MONGOC_CLUSTER_REPLICA_SET);
 
-   saved_nodes = bson_malloc0(cluster->nodes_len * sizeof(*saved_nodes));
-   saved_nodes_len = cluster->nodes_len;
+uint32_t
+_mongoc_cluster_try_sendv (mongoc_cluster_t             *cluster,
+                           mongoc_rpc_t                 *rpcs,
+                           size_t                        rpcs_len,
+                           uint32_t                      hint,
+                           const mongoc_write_concern_t *write_concern,
+                           const mongoc_read_prefs_t    *read_prefs,
+                           bson_error_t                 *error)
+{
+   mongoc_cluster_flight_t *flight;
+   bson_error_t apm_error = { 0 };
+   int64_t started;
+
+   flight = _mongoc_cluster_flight_begin (cluster, rpcs);
+
+   if (BSON_LIKELY (!cluster->apm_enabled)) {
+      hint = _mongoc_cluster_do_try_sendv (cluster, rpcs, rpcs_len, hint,
+                                           write_concern, read_prefs,
+                                           error ? error : &apm_error);
+      _mongoc_cluster_flight_sent (cluster, flight, rpcs, rpcs_len, hint,
+                                   error ? error : &apm_error);
+      return hint;
+   }
 
-   MONGOC_DEBUG("Reconnecting to replica set.");
+   _mongoc_cluster_apm_note (cluster, rpcs, rpcs_len, write_concern);
+   cluster->op_reconnect_usec = 0;
+   cluster->op_selected = 0;
+   cluster->op_sent = 0;
+   started = flight->started;
+   hint = _mongoc_cluster_do_try_sendv (cluster, rpcs, rpcs_len, hint,
+                                        write_concern, read_prefs,
+                                        error ? error : &apm_error);
+   _mongoc_cluster_apm_sent (cluster, rpcs, hint, started,
+                             error ? error : &apm_error);
+   _mongoc_cluster_flight_sent (cluster, flight, rpcs, rpcs_len, hint,
+                                error ? error : &apm_error);
+
+   return hint;
+}
 
-   if (!(hosts = mongoc_uri_get_hosts(cluster->uri))) {
-      bson_set_error(error,
-                     MONGOC_ERROR_CLIENT,
-                     MONGOC_ERROR_CLIENT_NOT_READY,
-                     "Invalid host list supplied.");
-      goto CLEANUP;
+
+bool
+_mongoc_cluster_try_recv (mongoc_cluster_t *cluster,
+                          mongoc_rpc_t     *rpc,
+                          mongoc_buffer_t  *buffer,
+                          uint32_t          hint,
+                          bson_error_t     *error)
+{
+   bson_error_t apm_error = { 0 };
+   bool ret;
+
+   if (BSON_LIKELY (!cluster->apm_enabled)) {
+      ret = _mongoc_cluster_do_try_recv (cluster, rpc, buffer, hint,
+                                         error ? error : &apm_error);
+      _mongoc_cluster_flight_replied (cluster, hint, ret ? rpc : NULL,
+                                      error ? error : &apm_error);
+      return ret;
    }
 
-   replSet = mongoc_uri_get_replica_set(cluster->uri);
-   BSON_ASSERT(replSet);
+   cluster->op_first_byte = 0;
+   ret = _mongoc_cluster_do_try_recv (cluster, rpc, buffer, hint,
+                                      error ? error : &apm_error);
+   _mongoc_cluster_apm_replied (cluster, hint, ret ? rpc : NULL,
+                                error ? error : &apm_error);
+   _mongoc_cluster_flight_replied (cluster, hint, ret ? rpc : NULL,
+                                   error ? error : &apm_error);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_try_recv_reply --
+ *
+ *       Like _mongoc_cluster_try_recv(), but receives the reply to the
+ *       request numbered @response_to. This allows several requests to be
+ *       written to the same node with _mongoc_cluster_try_sendv() before
+ *       any of their replies are read.
+ *
+ *       Replies to other requests that arrive first are held on the node
+ *       until they are asked for. They are dropped if the node is
+ *       disconnected.
+ *
+ *       @response_to is the request_id of the sent rpc, converted from
+ *       little-endian.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @rpc is set if successful.
+ *       @buffer will be filled with the reply.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_try_recv_reply (mongoc_cluster_t *cluster,
+                                mongoc_rpc_t     *rpc,
+                                mongoc_buffer_t  *buffer,
+                                uint32_t          hint,
+                                uint32_t          response_to,
+                                bson_error_t     *error)
+{
+   mongoc_cluster_pending_reply_t *pending;
+   mongoc_cluster_node_t *node;
+   mongoc_list_t *iter;
+   off_t pos;
+
+   ENTRY;
 
-   /*
-    * Replica Set (Re)Connection Strategy
-    * ===================================
-    *
-    * First we break all existing connections. This may change.
-    *
-    * To perform the replica set connection, we connect to each of the
-    * pre-configured replicaSet nodes. (There may in fact only be one).
-    *
-    * TODO: We should perform this initial connection in parallel.
-    *
-    * Using the result of an "isMaster" on each of these nodes, we can
-    * prime the cluster nodes we want to connect to.
-    *
-    * We then connect to all of these nodes in parallel. Once we have
-    * all of the working nodes established, we can complete the process.
-    *
-    * We return true if any of the connections were successful, however
-    * we must update the cluster health appropriately so that callers
-    * that need a PRIMARY node can force reconnection.
-    *
-    * TODO: At some point in the future, we will need to authenticate
-    *       before calling an "isMaster". But that is dependent on a
-    *       few server "features" first.
-    */
+   bson_return_val_if_fail (cluster, false);
+   bson_return_val_if_fail (rpc, false);
+   bson_return_val_if_fail (buffer, false);
+   bson_return_val_if_fail (hint, false);
+   bson_return_val_if_fail (hint <= cluster->nodes_len, false);
 
-   cluster->last_reconnect = bson_get_monotonic_time();
+   node = &cluster->nodes[hint-1];
 
-   _mongoc_cluster_clear_peers (cluster);
+   for (iter = node->pending_replies; iter; iter = iter->next) {
+      pending = iter->data;
 
-   /*
-    * Discover all the potential peers from our seeds.
-    */
-   for (iter = hosts; iter; iter = iter->next) {
-      stream = _mongoc_client_create_stream(cluster->client, iter, error);
-      if (!stream) {
-         MONGOC_WARNING("Failed connection to %s", iter->host_and_port);
-         failed_hosts = prepend_host (iter, failed_hosts);
+      if (pending->response_to != response_to) {
          continue;
       }
 
-      _mongoc_cluster_node_init(&node);
-      node.host = *iter;
-      node.stream = stream;
+      node->pending_replies = _mongoc_list_remove (node->pending_replies,
+                                                   pending);
+      node->pending_replies_len--;
 
-      if (!_mongoc_cluster_ismaster (cluster, &node, error)) {
-         failed_hosts = prepend_host (iter, failed_hosts);
-         _mongoc_cluster_node_destroy (&node);
-         continue;
-      }
+      pos = buffer->len;
+      _mongoc_buffer_append (buffer, pending->data, pending->len);
+      _mongoc_cluster_pending_reply_destroy (pending, NULL);
 
-      if (!node.replSet || !!strcmp (node.replSet, replSet)) {
-         MONGOC_INFO ("%s: Got replicaSet \"%s\" expected \"%s\".",
-                      iter->host_and_port,
-                      node.replSet ? node.replSet : "(null)",
-                      replSet);
+      if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos],
+                                buffer->len - pos)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Failed to decode reply from server.");
+         mongoc_counter_protocol_ingress_error_inc ();
+         RETURN (false);
       }
 
-      if (node.primary) {
-         _mongoc_cluster_node_destroy (&node);
-         break;
-      }
+      _mongoc_rpc_swab_from_le (rpc);
 
-      _mongoc_cluster_node_destroy (&node);
+      RETURN (true);
    }
 
-   list = cluster->peers;
-   cluster->peers = NULL;
-
-   /*
-    * To avoid reconnecting to all of the peers, we will save the
-    * functional connections (and save their ping times) so that
-    * we don't waste time doing that again.
-    */
+   for (;;) {
+      pos = buffer->len;
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (cluster->nodes [i].stream) {
-         saved_nodes [i].host = cluster->nodes [i].host;
-         saved_nodes [i].stream = cluster->nodes [i].stream;
-         cluster->nodes [i].stream = NULL;
+      if (!_mongoc_cluster_try_recv (cluster, rpc, buffer, hint, error)) {
+         RETURN (false);
       }
-   }
-
-   for (liter = list, i = 0; liter; liter = liter->next, i++) {}
-   cluster->nodes = bson_realloc (cluster->nodes, sizeof (*cluster->nodes) * i);
-   cluster->nodes_len = i;
 
-   for (liter = list, i = 0; liter; liter = liter->next) {
-      if (!_mongoc_host_list_from_string(&host, liter->data)) {
-         MONGOC_WARNING("Failed to parse host and port: \"%s\"",
-                        (char *)liter->data);
-         continue;
+      if ((uint32_t)rpc->header.response_to == response_to) {
+         RETURN (true);
       }
 
-      if (has_host (failed_hosts, host.host_and_port)) {
-         MONGOC_INFO ("Skipping reconnection to %s", host.host_and_port);
-         continue;
+      if (node->pending_replies_len >= MAX_PENDING_REPLIES) {
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Too many unclaimed replies while waiting for "
+                         "the reply to request %u.",
+                         response_to);
+         _mongoc_cluster_disconnect_node (cluster, node);
+         RETURN (false);
       }
 
-      stream = NULL;
-
-      for (j = 0; j < saved_nodes_len; j++) {
-         if (0 == strcmp (saved_nodes [j].host.host_and_port,
-                          host.host_and_port)) {
-            stream = saved_nodes [j].stream;
-            saved_nodes [j].stream = NULL;
-         }
-      }
+      TRACE ("Holding reply to %u while waiting for %u",
+             rpc->header.response_to, response_to);
 
-      if (!stream) {
-         stream = _mongoc_client_create_stream (cluster->client, &host, error);
+      pending = bson_malloc0 (sizeof *pending);
+      pending->response_to = rpc->header.response_to;
+      pending->len = buffer->len - pos;
+      pending->data = bson_malloc (pending->len);
+      memcpy (pending->data, &buffer->data[buffer->off + pos], pending->len);
 
-         if (!stream) {
-            MONGOC_WARNING("Failed connection to %s", host.host_and_port);
-            continue;
-         }
-      }
+      node->pending_replies = _mongoc_list_append (node->pending_replies,
+                                                   pending);
+      node->pending_replies_len++;
 
-      _mongoc_cluster_node_init(&cluster->nodes[i]);
+      buffer->len = pos;
+   }
+}
 
-      cluster->nodes[i].host = host;
-      cluster->nodes[i].index = i;
-      cluster->nodes[i].stream = stream;
-      cluster->nodes[i].needs_auth = cluster->requires_auth;
 
-      if (!_mongoc_cluster_ismaster(cluster, &cluster->nodes[i], error)) {
-         _mongoc_cluster_node_destroy(&cluster->nodes[i]);
-         continue;
-      }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_try_recv_partial --
+ *
+ *       Like _mongoc_cluster_try_recv(), but only reads the header of an
+ *       OP_REPLY from the node specified by @hint and leaves its documents
+ *       on the stream. They are then read as needed with
+ *       _mongoc_cluster_try_recv_more(), so a large reply never has to be
+ *       buffered in full.
+ *
+ *       @rpc->reply.documents is NULL and @rpc->reply.documents_len is
+ *       the number of bytes left to read. If the node compresses its
+ *       replies there is no way to read them in pieces; the whole reply
+ *       is then read as by _mongoc_cluster_try_recv() and
+ *       @rpc->reply.documents is set.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @rpc is set if successful.
+ *       @buffer will be filled with the reply header.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-      if (!cluster->nodes[i].replSet ||
-          !!strcmp (cluster->nodes[i].replSet, replSet)) {
-         MONGOC_INFO ("%s: Got replicaSet \"%s\" expected \"%s\".",
-                      host.host_and_port,
-                      cluster->nodes[i].replSet ? cluster->nodes[i].replSet : "(null)",
-                      replSet);
-         _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-         continue;
-      }
+bool
+_mongoc_cluster_try_recv_partial (mongoc_cluster_t *cluster,
+                                  mongoc_rpc_t     *rpc,
+                                  mongoc_buffer_t  *buffer,
+                                  uint32_t          hint,
+                                  bson_error_t     *error)
+{
+   static const int32_t header_len = 36;
+   mongoc_cluster_node_t *node;
+   const uint8_t *data;
+   int32_t timeout_msec;
+   off_t pos;
 
-      if (cluster->nodes[i].needs_auth) {
-         if (!_mongoc_cluster_auth_node (cluster, &cluster->nodes[i], error)) {
-            _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-            goto CLEANUP;
-         }
-         cluster->nodes[i].needs_auth = false;
-      }
+   ENTRY;
 
-      if (-1 == (ping = _mongoc_cluster_ping_node (cluster,
-                                                   &cluster->nodes[i],
-                                                   error))) {
-         MONGOC_INFO("%s: Lost connection during ping.",
-                     host.host_and_port);
-         _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-         continue;
-      }
+   bson_return_val_if_fail (cluster, false);
+   bson_return_val_if_fail (rpc, false);
+   bson_return_val_if_fail (buffer, false);
+   bson_return_val_if_fail (hint, false);
+   bson_return_val_if_fail (hint <= cluster->nodes_len, false);
 
-      _mongoc_cluster_node_track_ping(&cluster->nodes[i], ping);
+   node = &cluster->nodes[hint-1];
 
-      i++;
+   if (node->stream && node->compressed) {
+      RETURN (_mongoc_cluster_try_recv (cluster, rpc, buffer, hint, error));
    }
 
-   cluster->nodes_len = i;
-
-   _mongoc_list_foreach(list, (void(*)(void*,void*))bson_free, NULL);
-   _mongoc_list_destroy(list);
+   if (!node->stream) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "Failed to receive message, lost connection to node.");
+      RETURN (false);
+   }
 
-   /*
-    * Cleanup all potential saved connections that were not used.
-    */
+   pos = buffer->len;
 
-   for (j = 0; j < saved_nodes_len; j++) {
-      if (saved_nodes [j].stream) {
-         mongoc_stream_destroy (saved_nodes [j].stream);
-         saved_nodes [j].stream = NULL;
-      }
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
    }
 
-   if (i == 0) {
-      bson_set_error(error,
-                     MONGOC_ERROR_CLIENT,
-                     MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                     "No acceptable peer could be found.");
-      goto CLEANUP;
+   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, header_len,
+                                           timeout_msec, error)) {
+      _mongoc_cluster_node_io_failed (cluster, node);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
    }
 
-   _mongoc_cluster_update_state (cluster);
+   data = &buffer->data[buffer->off + pos];
 
-   rval = true;
+   memcpy (&rpc->reply.msg_len, data, 4);
+   memcpy (&rpc->reply.request_id, data + 4, 4);
+   memcpy (&rpc->reply.response_to, data + 8, 4);
+   memcpy (&rpc->reply.opcode, data + 12, 4);
+   memcpy (&rpc->reply.flags, data + 16, 4);
+   memcpy (&rpc->reply.cursor_id, data + 20, 8);
+   memcpy (&rpc->reply.start_from, data + 28, 4);
+   memcpy (&rpc->reply.n_returned, data + 32, 4);
 
-CLEANUP:
+   _mongoc_rpc_swab_from_le (rpc);
 
-   bson_free(saved_nodes);
+   if ((rpc->reply.msg_len < header_len) ||
+       (rpc->reply.msg_len > cluster->max_msg_size) ||
+       (rpc->reply.opcode != MONGOC_OPCODE_REPLY)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Corrupt or malicious reply received.");
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
 
-   host_list_destroy (failed_hosts);
+   rpc->reply.documents = NULL;
+   rpc->reply.documents_len = rpc->reply.msg_len - header_len;
 
-   RETURN(rval);
+   node->last_read_msec = bson_get_monotonic_time ();
+   _mongoc_cluster_node_track_op (node, node->last_read_msec);
+   _mongoc_cluster_node_record_success (node);
+
+   _mongoc_cluster_inc_ingress_rpc (node, rpc);
+
+   RETURN (true);
 }
 
 
-static bool
-_mongoc_cluster_reconnect_sharded_cluster (mongoc_cluster_t *cluster,
-                                           bson_error_t     *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_try_recv_more --
+ *
+ *       Reads the next @size bytes of a reply whose header was read with
+ *       _mongoc_cluster_try_recv_partial() and appends them to @buffer.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       The node is disconnected on failure, since the rest of the reply
+ *       can no longer be skipped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cluster_try_recv_more (mongoc_cluster_t *cluster,
+                               mongoc_buffer_t  *buffer,
+                               uint32_t          hint,
+                               size_t            size,
+                               bson_error_t     *error)
 {
-   const mongoc_host_list_t *hosts;
-   const mongoc_host_list_t *iter;
-   mongoc_stream_t *stream;
-   uint32_t i;
-   int32_t ping;
+   mongoc_cluster_node_t *node;
+   int32_t timeout_msec;
 
    ENTRY;
 
-   BSON_ASSERT (cluster);
+   bson_return_val_if_fail (cluster, false);
+   bson_return_val_if_fail (buffer, false);
+   bson_return_val_if_fail (hint, false);
+   bson_return_val_if_fail (hint <= cluster->nodes_len, false);
 
-   MONGOC_DEBUG ("Reconnecting to sharded cluster.");
+   node = &cluster->nodes[hint-1];
+   if (!node->stream) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "Failed to receive message, lost connection to node.");
+      RETURN (false);
+   }
 
-   /*
-    * Sharded Cluster (Re)Connection Strategy
-    * =======================================
-    *
-    * First we break all existing connections. This may and probably
-    * should change.
-    *
-    * Sharded cluster connection is pretty simple, in that we just need
-    * to connect to all of the nodes that we are configured to know
-    * about. The reconnect_direct case will also update things if it
-    * discovers that the node it connected to was a sharded cluster.
-    *
-    * We need to check for "msg" field of the "isMaster" command to
-    * ensure that we have connected to an "isdbgrid".
-    *
-    * If we can connect to all of the nodes, we are in a good state,
-    * otherwise we are in an unhealthy state. If no connections were
-    * established then we are in a failed state.
-    */
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      _mongoc_cluster_disconnect_node (cluster, node);
+      RETURN (false);
+   }
 
-   cluster->last_reconnect = bson_get_monotonic_time ();
+   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, size,
+                                           timeout_msec, error)) {
+      _mongoc_cluster_node_io_failed (cluster, node);
+      _mongoc_cluster_disconnect_node (cluster, node);
+      mongoc_counter_protocol_ingress_error_inc ();
+      RETURN (false);
+   }
 
-   hosts = mongoc_uri_get_hosts (cluster->uri);
+   node->last_read_msec = bson_get_monotonic_time ();
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_stream_send --
+ *
+ *       Write a copy of @rpc to @stream, one of the extra connections to
+ *       @node, under a new request id. @rpc itself is left untouched so
+ *       that it can be sent again to another node.
+ *
+ * Returns:
+ *       The request id the copy was sent with, or 0 and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   /*
-    * Reconnect to each of our configured hosts.
-    */
-   for (iter = hosts, i = 0; iter; iter = iter->next) {
-      stream = _mongoc_client_create_stream (cluster->client, iter, error);
+static uint32_t
+_mongoc_cluster_stream_send (mongoc_cluster_t      *cluster,
+                             mongoc_cluster_node_t *node,
+                             mongoc_stream_t       *stream,
+                             const mongoc_rpc_t    *rpc,
+                             bson_error_t          *error)
+{
+   mongoc_array_t ar;
+   mongoc_rpc_t copy;
+   uint32_t request_id = 0;
+   int32_t timeout_msec;
 
-      if (!stream) {
-         MONGOC_WARNING ("Failed connection to %s", iter->host_and_port);
-         continue;
-      }
+   ENTRY;
 
-      _mongoc_cluster_node_init (&cluster->nodes[i]);
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (stream);
+   BSON_ASSERT (rpc);
 
-      cluster->nodes[i].host = *iter;
-      cluster->nodes[i].index = i;
-      cluster->nodes[i].stream = stream;
-      cluster->nodes[i].needs_auth = cluster->requires_auth;
+   memcpy (&copy, rpc, sizeof copy);
+   copy.header.msg_len = 0;
+   copy.header.request_id = ++cluster->request_id;
 
-      if (!_mongoc_cluster_ismaster (cluster, &cluster->nodes[i], error)) {
-         _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-         continue;
-      }
+   _mongoc_array_init_with_realloc (&ar, sizeof (mongoc_iovec_t),
+                                    cluster->client->realloc_func,
+                                    cluster->client->realloc_data);
 
-      if (cluster->nodes[i].needs_auth) {
-         if (!_mongoc_cluster_auth_node (cluster, &cluster->nodes[i], error)) {
-            _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-            RETURN (false);
-         }
-         cluster->nodes[i].needs_auth = false;
-      }
+   _mongoc_rpc_gather (&copy, &ar);
+   _mongoc_cluster_inc_egress_rpc (cluster, node, &copy);
 
-      if (-1 == (ping = _mongoc_cluster_ping_node (cluster,
-                                                   &cluster->nodes[i],
-                                                   error))) {
-         MONGOC_INFO ("%s: Lost connection during ping.",
-                      iter->host_and_port);
-         _mongoc_cluster_node_destroy (&cluster->nodes[i]);
-         continue;
-      }
+   if (copy.header.msg_len > (int32_t)cluster->max_msg_size) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_TOO_BIG,
+                      "Attempted to send an RPC larger than the "
+                      "max allowed message size. Was %u, allowed %u.",
+                      copy.header.msg_len,
+                      cluster->max_msg_size);
+      GOTO (cleanup);
+   }
 
-      _mongoc_cluster_node_track_ping (&cluster->nodes[i], ping);
+   request_id = copy.header.request_id;
+   _mongoc_rpc_swab_to_le (&copy);
 
-      /*
-       * If this node is not a mongos, we should fail unless no
-       * replicaSet was specified. If that is the case, we will assume
-       * the caller meant they wanted a replicaSet and migrate to that
-       * reconnection strategy.
-       */
-      if ((i == 0) &&
-          !cluster->nodes [i].isdbgrid &&
-          !mongoc_uri_get_replica_set (cluster->uri) &&
-          cluster->nodes [i].replSet) {
-         MONGOC_WARNING ("Found replicaSet, expected sharded cluster. "
-                         "Reconnecting as replicaSet.");
-         cluster->mode = MONGOC_CLUSTER_REPLICA_SET;
-         cluster->replSet = bson_strdup (cluster->nodes [i].replSet);
-         return _mongoc_cluster_reconnect_replica_set (cluster, error);
-      }
+   DUMP_IOVEC (((mongoc_iovec_t *)ar.data), ((mongoc_iovec_t *)ar.data), ar.len);
 
-      i++;
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      request_id = 0;
+      GOTO (cleanup);
    }
 
-   if (i == 0) {
+   if (!mongoc_stream_writev (stream, ar.data, ar.len, timeout_msec)) {
       bson_set_error (error,
-                      MONGOC_ERROR_CLIENT,
-                      MONGOC_ERROR_CLIENT_NO_ACCEPTABLE_PEER,
-                      "No acceptable peer could be found.");
-      RETURN (false);
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_SOCKET,
+                      "Failed to send query to %s.",
+                      node->host.host_and_port);
+      request_id = 0;
    }
 
-   _mongoc_cluster_update_state (cluster);
+cleanup:
+   _mongoc_array_destroy (&ar);
 
-   RETURN (true);
+   RETURN (request_id);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_cluster_reconnect --
+ * _mongoc_cluster_stream_recv --
  *
- *       Reconnect to the cluster nodes.
+ *       Read one reply from @stream, one of the extra connections to
+ *       @node, into @buffer and scatter it into @rpc.
  *
- *       This is called when no nodes were available to execute an
- *       operation on.
+ *       Unlike _mongoc_cluster_try_recv(), @node is not disconnected on
+ *       failure. The caller should close @stream instead.
  *
  * Returns:
  *       true if successful; otherwise false and @error is set.
  *
  * Side effects:
- *       None.
+ *       @rpc is valid as long as @buffer is not modified.
  *
  *--------------------------------------------------------------------------
  */
 
-bool
-_mongoc_cluster_reconnect (mongoc_cluster_t *cluster,
-                           bson_error_t     *error)
+static bool
+_mongoc_cluster_stream_recv (mongoc_cluster_t      *cluster,
+                             mongoc_cluster_node_t *node,
+                             mongoc_stream_t       *stream,
+                             mongoc_rpc_t          *rpc,
+                             mongoc_buffer_t       *buffer,
+                             bson_error_t          *error)
 {
-   bool ret;
-   int i;
+   int32_t timeout_msec;
+   int32_t msg_len;
+   off_t pos;
 
    ENTRY;
 
-   bson_return_val_if_fail (cluster, false);
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (stream);
+   BSON_ASSERT (rpc);
+   BSON_ASSERT (buffer);
 
-   /*
-    * Close any lingering connections.
-    *
-    * TODO: We could be better about reusing connections.
-    */
-   for (i = 0; i < cluster->nodes_len; i++) {
-       if (cluster->nodes [i].stream) {
-           mongoc_stream_close (cluster->nodes [i].stream);
-           mongoc_stream_destroy (cluster->nodes [i].stream);
-           cluster->nodes [i].stream = NULL;
-       }
+   pos = buffer->len;
+
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error) ||
+       !_mongoc_buffer_append_from_stream (buffer, stream, 4,
+                                           timeout_msec, error)) {
+      GOTO (failure);
    }
 
-   _mongoc_cluster_update_state (cluster);
+   memcpy (&msg_len, &buffer->data[buffer->off + pos], 4);
+   msg_len = BSON_UINT32_FROM_LE (msg_len);
 
-   switch (cluster->mode) {
-   case MONGOC_CLUSTER_DIRECT:
-      ret = _mongoc_cluster_reconnect_direct (cluster, error);
-      RETURN (ret);
-   case MONGOC_CLUSTER_REPLICA_SET:
-      ret = _mongoc_cluster_reconnect_replica_set (cluster, error);
-      RETURN (ret);
-   case MONGOC_CLUSTER_SHARDED_CLUSTER:
-      ret = _mongoc_cluster_reconnect_sharded_cluster (cluster, error);
-      RETURN (ret);
-   default:
-      break;
+   if ((msg_len < 16) || (msg_len > cluster->max_msg_size)) {
+      GOTO (invalid_reply);
    }
 
-   bson_set_error(error,
-                  MONGOC_ERROR_CLIENT,
-                  MONGOC_ERROR_CLIENT_NOT_READY,
-                  "Unsupported cluster mode: %02x",
-                  cluster->mode);
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error) ||
+       !_mongoc_buffer_append_from_stream (buffer, stream, msg_len - 4,
+                                           timeout_msec, error)) {
+      GOTO (failure);
+   }
+
+   if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos],
+                             msg_len)) {
+      GOTO (invalid_reply);
+   }
+
+   DUMP_BYTES (buffer, buffer->data + buffer->off, buffer->len);
+
+   _mongoc_rpc_swab_from_le (rpc);
+
+   _mongoc_cluster_inc_ingress_rpc (node, rpc);
+
+   RETURN (true);
+
+invalid_reply:
+   bson_set_error (error,
+                   MONGOC_ERROR_PROTOCOL,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "Corrupt or malicious reply received from %s.",
+                   node->host.host_and_port);
+
+failure:
+   mongoc_counter_protocol_ingress_error_inc ();
+   buffer->len = pos;
 
    RETURN (false);
 }
 
 
-bool
-_mongoc_cluster_command_early (mongoc_cluster_t *cluster,
-                               const char       *dbname,
-                               const bson_t     *command,
-                               bson_t           *reply,
-                               bson_error_t     *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_hedge_poll --
+ *
+ *       Wait up to @timeout_msec for a reply to start arriving on one of
+ *       the @n_streams streams. A stream that is not backed by a socket
+ *       can't be polled and is always reported as ready.
+ *
+ * Returns:
+ *       The index of a ready stream, or -1 if none became ready in time.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+_mongoc_cluster_hedge_poll (mongoc_stream_t **streams,
+                            size_t            n_streams,
+                            int32_t           timeout_msec)
 {
-   mongoc_cluster_node_t *node;
-   int i;
+   mongoc_socket_poll_t sds[2];
+   size_t i;
 
-   BSON_ASSERT (cluster);
-   BSON_ASSERT (cluster->state == MONGOC_CLUSTER_STATE_BORN);
-   BSON_ASSERT (dbname);
-   BSON_ASSERT (command);
+   BSON_ASSERT (streams);
+   BSON_ASSERT (n_streams && (n_streams <= 2));
 
-   if (!_mongoc_cluster_reconnect (cluster, error)) {
-      return false;
-   }
+   for (i = 0; i < n_streams; i++) {
+      if (!(sds[i].socket = _mongoc_stream_get_socket (streams[i]))) {
+         return (int)i;
+      }
 
-   node = _mongoc_cluster_get_primary (cluster);
+      sds[i].events = POLLIN;
+      sds[i].revents = 0;
+   }
 
-   for (i = 0; !node && i < cluster->nodes_len; i++) {
-      if (cluster->nodes[i].stream) {
-         node = &cluster->nodes[i];
+   if (_mongoc_socket_poll (sds, n_streams, timeout_msec) > 0) {
+      for (i = 0; i < n_streams; i++) {
+         if (sds[i].revents) {
+            return (int)i;
+         }
       }
    }
 
-   return _mongoc_cluster_run_command (cluster, node, dbname, command,
-                                       reply, error);
+   return -1;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_inc_egress_rpc --
+ * _mongoc_cluster_hedge_delay --
  *
- *       Helper to increment the counter for a particular RPC based on
- *       it's opcode.
+ *       How long to wait for @node to start answering before a hedged
+ *       query is also sent to a second node. Unless hedgeDelayMS is set,
+ *       this is twice the latency of @node used for node selection, which
+ *       stands in for a high percentile of its response time.
+ *
+ * Returns:
+ *       The delay in milliseconds.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int32_t
+_mongoc_cluster_hedge_delay (const mongoc_cluster_t      *cluster,
+                             const mongoc_cluster_node_t *node)
+{
+   int32_t latency;
+
+   if (cluster->hedge_delay_msec > 0) {
+      return cluster->hedge_delay_msec;
+   }
+
+   latency = _mongoc_cluster_node_latency (cluster, node);
+
+   return BSON_MAX (latency * 2, MIN_HEDGE_DELAY_MSEC);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_node_reap_hedges --
+ *
+ *       Finish the hedged queries that lost the race on @node. Late
+ *       replies that have arrived are read, the server cursor they opened
+ *       is killed and their stream is returned to the node. Streams whose
+ *       reply has not arrived within socketTimeoutMS are closed.
+ *
+ *       This never waits for a reply.
  *
  * Returns:
  *       None.
@@ -2546,53 +8899,149 @@ _mongoc_cluster_command_early (mongoc_cluster_t *cluster,
  *--------------------------------------------------------------------------
  */
 
-static BSON_INLINE void
-_mongoc_cluster_inc_egress_rpc (const mongoc_rpc_t *rpc)
+static void
+_mongoc_cluster_node_reap_hedges (mongoc_cluster_t      *cluster,
+                                  mongoc_cluster_node_t *node)
 {
-   mongoc_counter_op_egress_total_inc();
+   mongoc_cluster_hedge_t *hedge;
+   mongoc_buffer_t buffer;
+   mongoc_list_t *iter;
+   mongoc_list_t *next;
+   mongoc_rpc_t kill = {{ 0 }};
+   mongoc_rpc_t rpc;
+   bson_error_t error;
+   int64_t cursor_id;
+   int64_t now;
+   bool reusable;
 
-   switch (rpc->header.opcode) {
-   case MONGOC_OPCODE_DELETE:
-      mongoc_counter_op_egress_delete_inc();
-      break;
-   case MONGOC_OPCODE_UPDATE:
-      mongoc_counter_op_egress_update_inc();
-      break;
-   case MONGOC_OPCODE_INSERT:
-      mongoc_counter_op_egress_insert_inc();
-      break;
-   case MONGOC_OPCODE_KILL_CURSORS:
-      mongoc_counter_op_egress_killcursors_inc();
-      break;
-   case MONGOC_OPCODE_GET_MORE:
-      mongoc_counter_op_egress_getmore_inc();
-      break;
-   case MONGOC_OPCODE_REPLY:
-      mongoc_counter_op_egress_reply_inc();
-      break;
-   case MONGOC_OPCODE_MSG:
-      mongoc_counter_op_egress_msg_inc();
-      break;
-   case MONGOC_OPCODE_QUERY:
-      mongoc_counter_op_egress_query_inc();
-      break;
-   default:
-      BSON_ASSERT(false);
-      break;
+   ENTRY;
+
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+
+   now = bson_get_monotonic_time ();
+
+   for (iter = node->hedges; iter; iter = next) {
+      next = iter->next;
+      hedge = iter->data;
+
+      if (_mongoc_cluster_hedge_poll (&hedge->stream, 1, 0) < 0) {
+         if (now < hedge->expire_at) {
+            continue;
+         }
+
+         reusable = false;
+      } else {
+         _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
+
+         reusable = (_mongoc_cluster_stream_recv (cluster, node,
+                                                  hedge->stream, &rpc,
+                                                  &buffer, &error) &&
+                     ((uint32_t)rpc.header.response_to == hedge->request_id));
+
+         if (reusable &&
+             (rpc.header.opcode == MONGOC_OPCODE_REPLY) &&
+             (cursor_id = rpc.reply.cursor_id)) {
+            kill.kill_cursors.opcode = MONGOC_OPCODE_KILL_CURSORS;
+            kill.kill_cursors.zero = 0;
+            kill.kill_cursors.cursors = &cursor_id;
+            kill.kill_cursors.n_cursors = 1;
+
+            reusable = !!_mongoc_cluster_stream_send (cluster, node,
+                                                      hedge->stream, &kill,
+                                                      &error);
+         }
+
+         _mongoc_buffer_destroy (&buffer);
+      }
+
+      node->hedges = _mongoc_list_remove (node->hedges, hedge);
+      _mongoc_cluster_node_checkin (cluster, node, hedge->stream,
+                                    hedge->generation, reusable);
+      bson_free (hedge);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cluster_select_hedge --
+ *
+ *       Select the node a hedged query is sent to when @first is slow to
+ *       answer. This is the nearest node other than @first among those
+ *       that match @read_prefs equally well.
+ *
+ * Returns:
+ *       A connected mongoc_cluster_node_t, or NULL if there is none.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_cluster_node_t *
+_mongoc_cluster_select_hedge (mongoc_cluster_t            *cluster,
+                              const mongoc_read_prefs_t   *read_prefs,
+                              const mongoc_cluster_node_t *first)
+{
+   const mongoc_cluster_select_cache_t *entry;
+   mongoc_cluster_node_t *candidate;
+   mongoc_cluster_node_t *node = NULL;
+   bson_error_t error;
+   int32_t nearest = -1;
+   int32_t latency;
+   int64_t now;
+   uint32_t i;
+
+   ENTRY;
+
+   now = bson_get_monotonic_time ();
+   entry = _mongoc_cluster_select_eligible (cluster, read_prefs, false);
+
+   for (i = 0; i < entry->eligible_len; i++) {
+      candidate = &cluster->nodes[entry->eligible[i]];
+
+      if ((candidate == first) ||
+          (!candidate->stream && !candidate->lazy) ||
+          _mongoc_cluster_node_is_open (candidate, now)) {
+         continue;
+      }
+
+      latency = _mongoc_cluster_node_latency (cluster, candidate);
+
+      if (!node || ((latency >= 0) && ((nearest < 0) || (latency < nearest)))) {
+         node = candidate;
+         nearest = latency;
+      }
+   }
+
+   if (node && node->lazy &&
+       !_mongoc_cluster_node_connect_lazy (cluster, node, &error)) {
+      MONGOC_DEBUG ("Not hedging query: %s", error.message);
+      node = NULL;
    }
+
+   RETURN (node);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_inc_ingress_rpc --
+ * _mongoc_cluster_can_hedge --
  *
- *       Helper to increment the counter for a particular RPC based on
- *       it's opcode.
+ *       Check whether the query @rpc may be hedged with
+ *       _mongoc_cluster_query_hedged(). This requires hedgedReads and more
+ *       than one connection per node, a replica set, and a read mode of
+ *       secondaryPreferred or nearest. Tailable and exhaust queries are
+ *       never hedged since their cursor is tied to one connection.
  *
  * Returns:
- *       None.
+ *       true if @rpc may be hedged.
  *
  * Side effects:
  *       None.
@@ -2600,547 +9049,563 @@ _mongoc_cluster_inc_egress_rpc (const mongoc_rpc_t *rpc)
  *--------------------------------------------------------------------------
  */
 
-static BSON_INLINE void
-_mongoc_cluster_inc_ingress_rpc (const mongoc_rpc_t *rpc)
+bool
+_mongoc_cluster_can_hedge (const mongoc_cluster_t    *cluster,
+                           const mongoc_rpc_t        *rpc,
+                           const mongoc_read_prefs_t *read_prefs)
 {
-   mongoc_counter_op_ingress_total_inc ();
+   mongoc_read_mode_t read_mode;
 
-   switch (rpc->header.opcode) {
-   case MONGOC_OPCODE_DELETE:
-      mongoc_counter_op_ingress_delete_inc ();
-      break;
-   case MONGOC_OPCODE_UPDATE:
-      mongoc_counter_op_ingress_update_inc ();
-      break;
-   case MONGOC_OPCODE_INSERT:
-      mongoc_counter_op_ingress_insert_inc ();
-      break;
-   case MONGOC_OPCODE_KILL_CURSORS:
-      mongoc_counter_op_ingress_killcursors_inc ();
-      break;
-   case MONGOC_OPCODE_GET_MORE:
-      mongoc_counter_op_ingress_getmore_inc ();
-      break;
-   case MONGOC_OPCODE_REPLY:
-      mongoc_counter_op_ingress_reply_inc ();
-      break;
-   case MONGOC_OPCODE_MSG:
-      mongoc_counter_op_ingress_msg_inc ();
-      break;
-   case MONGOC_OPCODE_QUERY:
-      mongoc_counter_op_ingress_query_inc ();
-      break;
-   default:
-      BSON_ASSERT (false);
-      break;
+   bson_return_val_if_fail (cluster, false);
+   bson_return_val_if_fail (rpc, false);
+
+   if (!cluster->hedged_reads ||
+       (cluster->max_conns_per_node < 2) ||
+       (cluster->mode != MONGOC_CLUSTER_REPLICA_SET) ||
+       !(cluster->state & MONGOC_CLUSTER_STATE_HEALTHY) ||
+       !read_prefs) {
+      return false;
+   }
+
+   read_mode = mongoc_read_prefs_get_mode (read_prefs);
+
+   if ((read_mode != MONGOC_READ_SECONDARY_PREFERRED) &&
+       (read_mode != MONGOC_READ_NEAREST)) {
+      return false;
    }
+
+   return ((rpc->header.opcode == MONGOC_OPCODE_QUERY) &&
+           !(rpc->query.flags & (MONGOC_QUERY_TAILABLE_CURSOR |
+                                 MONGOC_QUERY_EXHAUST)));
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_sendv --
- *
- *       Deliver an RPC to the MongoDB server.
- *
- *       If @hint is non-zero, the connection matching that hint will be
- *       used or the operation will fail. This is primarily used to force
- *       sending an RPC on the same connection as a previous RPC. This
- *       is often the case with OP_QUERY followed by OP_GETMORE.
- *
- *       @rpcs should be an array of mongoc_rpc_t that have not yet been
- *       gathered or swab'ed. The state of @rpcs is undefined after calling
- *       this function and should not be used afterwards.
+ * _mongoc_cluster_query_hedged --
  *
- *       @write_concern is optional. Providing it may cause this function
- *       to block until an operation has completed on the remote MongoDB
- *       server.
+ *       Send the query @rpc to a node selected for @read_prefs and wait
+ *       for its reply. If the node has not started answering within the
+ *       hedge delay, the same query is also sent to a second eligible
+ *       node and whichever reply arrives first is used.
  *
- *       @read_prefs is optional and can be used to dictate which machines
- *       may be used to perform a query upon.
+ *       Both queries go out on extra connections checked out from the
+ *       nodes, so neither node->stream is left with a reply nobody reads.
+ *       The losing query's stream is parked on its node until the late
+ *       reply arrives; the cursor it opened is then killed, see
+ *       _mongoc_cluster_node_reap_hedges().
  *
- *       This function will continue to try to deliver an RPC until
- *       successful or the retry count has surprased.
+ *       The caller must check _mongoc_cluster_can_hedge() first.
  *
  * Returns:
- *       Zero on failure. A non-zero value is the hint of the connection
- *       that was used to communicate with a remote MongoDB server. This
- *       value may be passed as @hint in future calls to use the same
- *       connection.
- *
- *       If the result is zero, then @error will be set with information
- *       about the failure.
+ *       The hint of the node that answered, or 0 and @error is set.
  *
  * Side effects:
- *       @rpcs may be mutated and should be considered invalid after calling
- *       this function.
- *
- *       @error may be set.
+ *       @reply is valid as long as @buffer is not modified.
  *
  *--------------------------------------------------------------------------
  */
 
 uint32_t
-_mongoc_cluster_sendv (mongoc_cluster_t             *cluster,
-                       mongoc_rpc_t                 *rpcs,
-                       size_t                        rpcs_len,
-                       uint32_t                 hint,
-                       const mongoc_write_concern_t *write_concern,
-                       const mongoc_read_prefs_t    *read_prefs,
-                       bson_error_t                 *error)
+_mongoc_cluster_query_hedged (mongoc_cluster_t          *cluster,
+                              mongoc_rpc_t              *rpc,
+                              const mongoc_read_prefs_t *read_prefs,
+                              mongoc_rpc_t              *reply,
+                              mongoc_buffer_t           *buffer,
+                              bson_error_t              *error)
 {
+   mongoc_cluster_node_t *nodes[2] = { NULL };
+   mongoc_stream_t *streams[2] = { NULL };
+   mongoc_cluster_hedge_t *hedge;
    mongoc_cluster_node_t *node;
-   mongoc_iovec_t *iov;
-   const bson_t *b;
-   mongoc_rpc_t gle;
+   bson_error_t local_error;
+   uint32_t generations[2] = { 0 };
+   uint32_t request_ids[2] = { 0 };
+   int64_t started[2] = { 0 };
+   uint32_t request_id;
+   uint32_t hint;
+   int32_t timeout_msec;
+   int64_t expire_at;
    int64_t now;
-   size_t iovcnt;
+   size_t n = 0;
    size_t i;
-   bool need_gle;
-   char cmdname[140];
-   int retry_count = 0;
+   int winner;
 
    ENTRY;
 
-   bson_return_val_if_fail(cluster, false);
-   bson_return_val_if_fail(rpcs, false);
-   bson_return_val_if_fail(rpcs_len, false);
+   bson_return_val_if_fail (cluster, 0);
+   bson_return_val_if_fail (rpc, 0);
+   bson_return_val_if_fail (reply, 0);
+   bson_return_val_if_fail (buffer, 0);
 
-   /*
-    * If we are in an unhealthy state, and enough time has elapsed since
-    * our last reconnection, go ahead and try to perform reconnection
-    * immediately.
-    */
-   now = bson_get_monotonic_time();
-   if ((cluster->state == MONGOC_CLUSTER_STATE_DEAD) ||
-       ((cluster->state == MONGOC_CLUSTER_STATE_UNHEALTHY) &&
-        (cluster->last_reconnect + UNHEALTHY_RECONNECT_TIMEOUT_USEC) <= now)) {
-      if (!_mongoc_cluster_reconnect(cluster, error)) {
-         RETURN(false);
-      }
+   if (cluster->monitor) {
+      _mongoc_cluster_monitor_sync (cluster->monitor, cluster);
    }
 
-   for (;;) {
+   for (i = 0; i < cluster->nodes_len; i++) {
+      _mongoc_cluster_node_reap_hedges (cluster, &cluster->nodes[i]);
+   }
+
+   if (!(node = _mongoc_cluster_select (cluster, rpc, 1, 0, NULL, read_prefs,
+                                        error))) {
+      RETURN (0);
+   }
+
+   nodes[0] = node;
+
+   if (!(streams[0] = _mongoc_cluster_node_checkout (cluster, node,
+                                                     &generations[0],
+                                                     &local_error))) {
       /*
-       * Try to find a node to deliver to. Since we are allowed to block in this
-       * version of sendv, we try to reconnect if we cannot select a node.
+       * Every connection to the node is busy. Don't hedge, just send the
+       * query on node->stream like any other.
        */
-      while (!(node = _mongoc_cluster_select (cluster, rpcs, rpcs_len, hint,
-                                              write_concern, read_prefs,
-                                              error))) {
-         if ((retry_count++ == MAX_RETRY_COUNT) ||
-             !_mongoc_cluster_reconnect (cluster, error)) {
-            RETURN (false);
-         }
+      TRACE ("Not hedging query: %s", local_error.message);
+
+      hint = node->index + 1;
+
+      if (!_mongoc_cluster_try_sendv (cluster, rpc, 1, hint, NULL,
+                                      read_prefs, error)) {
+         RETURN (0);
       }
 
-      BSON_ASSERT(node->stream);
+      request_id = BSON_UINT32_FROM_LE (rpc->header.request_id);
 
-      if (node->last_read_msec + CHECK_CLOSED_DURATION_MSEC < now) {
-         if (mongoc_stream_check_closed (node->stream)) {
-            _mongoc_cluster_disconnect_node (cluster, node);
-            _mongoc_cluster_reconnect (cluster, NULL);
-         } else {
-            node->last_read_msec = now;
-            break;
-         }
+      if (!_mongoc_cluster_try_recv_reply (cluster, reply, buffer, hint,
+                                           request_id, error)) {
+         RETURN (0);
+      }
+
+      RETURN (hint);
+   }
+
+   n = 1;
+   started[0] = bson_get_monotonic_time ();
+
+   if (!(request_ids[0] = _mongoc_cluster_stream_send (cluster, nodes[0],
+                                                       streams[0], rpc,
+                                                       error))) {
+      GOTO (failure);
+   }
+
+   winner = _mongoc_cluster_hedge_poll (streams, 1,
+                                        _mongoc_cluster_hedge_delay (cluster,
+                                                                     node));
+
+   if ((winner < 0) &&
+       (nodes[1] = _mongoc_cluster_select_hedge (cluster, read_prefs, node)) &&
+       (streams[1] = _mongoc_cluster_node_checkout (cluster, nodes[1],
+                                                    &generations[1],
+                                                    &local_error))) {
+      started[1] = bson_get_monotonic_time ();
+
+      if ((request_ids[1] = _mongoc_cluster_stream_send (cluster, nodes[1],
+                                                         streams[1], rpc,
+                                                         &local_error))) {
+         TRACE ("Hedging query to \"%s\" with \"%s\"",
+                nodes[0]->host.host_and_port, nodes[1]->host.host_and_port);
+         mongoc_counter_hedged_reads_inc ();
+         n = 2;
       } else {
-         break;
+         _mongoc_cluster_node_checkin (cluster, nodes[1], streams[1],
+                                       generations[1], false);
       }
    }
 
-   _mongoc_array_clear (&cluster->iov);
+   if (!_mongoc_cluster_io_timeout (cluster, &timeout_msec, error)) {
+      GOTO (failure);
+   }
 
-   /*
-    * TODO: We can probably remove the need for sendv and just do send since
-    * we support write concerns now. Also, we clobber our getlasterror on
-    * each subsequent mutation. It's okay, since it comes out correct anyway,
-    * just useless work (and technically the request_id changes).
-    */
+   expire_at = bson_get_monotonic_time () + (timeout_msec * 1000L);
 
-   for (i = 0; i < rpcs_len; i++) {
-      _mongoc_cluster_inc_egress_rpc (&rpcs[i]);
-      rpcs[i].header.request_id = ++cluster->request_id;
-      need_gle = _mongoc_rpc_needs_gle(&rpcs[i], write_concern);
-      _mongoc_rpc_gather (&rpcs[i], &cluster->iov);
+   for (;;) {
+      while (winner < 0) {
+         now = bson_get_monotonic_time ();
+
+         if (now >= expire_at) {
+            bson_set_error (error,
+                            MONGOC_ERROR_STREAM,
+                            MONGOC_ERROR_STREAM_SOCKET,
+                            "Timed out waiting for a reply from %s.",
+                            nodes[0]->host.host_and_port);
+            GOTO (failure);
+         }
 
-	  if (rpcs[i].header.msg_len >(int32_t)cluster->max_msg_size) {
-         bson_set_error(error,
-                        MONGOC_ERROR_CLIENT,
-                        MONGOC_ERROR_CLIENT_TOO_BIG,
-                        "Attempted to send an RPC larger than the "
-                        "max allowed message size. Was %u, allowed %u.",
-                        rpcs[i].header.msg_len,
-                        cluster->max_msg_size);
-         RETURN(0);
+         winner = _mongoc_cluster_hedge_poll (streams, n,
+                                              (int32_t)((expire_at - now) /
+                                                        1000L));
       }
 
-      if (need_gle) {
-         gle.query.msg_len = 0;
-         gle.query.request_id = ++cluster->request_id;
-         gle.query.response_to = 0;
-         gle.query.opcode = MONGOC_OPCODE_QUERY;
-         gle.query.flags = MONGOC_QUERY_NONE;
-         switch (rpcs[i].header.opcode) {
-         case MONGOC_OPCODE_INSERT:
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].insert.collection);
-            break;
-         case MONGOC_OPCODE_DELETE:
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].delete.collection);
-            break;
-         case MONGOC_OPCODE_UPDATE:
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].update.collection);
-            break;
-         default:
-            BSON_ASSERT(false);
-            DB_AND_CMD_FROM_COLLECTION(cmdname, "admin.$cmd");
+      if (_mongoc_cluster_stream_recv (cluster, nodes[winner],
+                                       streams[winner], reply, buffer,
+                                       error)) {
+         if ((uint32_t)reply->header.response_to == request_ids[winner]) {
             break;
          }
-         gle.query.collection = cmdname;
-         gle.query.skip = 0;
-         gle.query.n_return = 1;
-         b = _mongoc_write_concern_get_gle((void*)write_concern);
-         gle.query.query = bson_get_data(b);
-         gle.query.fields = NULL;
-         _mongoc_rpc_gather(&gle, &cluster->iov);
-         _mongoc_rpc_swab_to_le(&gle);
+
+         bson_set_error (error,
+                         MONGOC_ERROR_PROTOCOL,
+                         MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                         "Invalid response_to. Expected %d, got %d.",
+                         request_ids[winner], reply->header.response_to);
       }
 
-      _mongoc_rpc_swab_to_le(&rpcs[i]);
+      /*
+       * This query failed. If the other one is still in flight, keep
+       * waiting for it.
+       */
+      _mongoc_cluster_node_record_failure (cluster, nodes[winner], false);
+      _mongoc_cluster_node_checkin (cluster, nodes[winner], streams[winner],
+                                    generations[winner], false);
+
+      if (--n) {
+         nodes[0] = nodes[!winner];
+         streams[0] = streams[!winner];
+         generations[0] = generations[!winner];
+         request_ids[0] = request_ids[!winner];
+         started[0] = started[!winner];
+         winner = -1;
+         continue;
+      }
+
+      RETURN (0);
    }
 
-   iov = cluster->iov.data;
-   iovcnt = cluster->iov.len;
-   errno = 0;
+   node = nodes[winner];
+   node->last_read_msec = bson_get_monotonic_time ();
 
-   BSON_ASSERT (cluster->iov.len);
+   if (cluster->track_op_latency && !node->op_started) {
+      node->op_started = started[winner];
+      _mongoc_cluster_node_track_op (node, node->last_read_msec);
+   }
 
-   if (!mongoc_stream_writev (node->stream, iov, iovcnt,
-                              cluster->sockettimeoutms)) {
-      char buf[128];
-      char * errstr;
-      errstr = bson_strerror_r(errno, buf, sizeof buf);
+   _mongoc_cluster_node_record_success (node);
 
-      bson_set_error (error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_SOCKET,
-                      "Failure during socket delivery: %s",
-                      errstr);
-      _mongoc_cluster_disconnect_node (cluster, node);
-      RETURN (0);
+   _mongoc_cluster_node_checkin (cluster, node, streams[winner],
+                                 generations[winner], true);
+
+   if (n == 2) {
+      if (winner) {
+         mongoc_counter_hedged_reads_won_inc ();
+      }
+
+      hedge = bson_malloc0 (sizeof *hedge);
+      hedge->stream = streams[!winner];
+      hedge->generation = generations[!winner];
+      hedge->request_id = request_ids[!winner];
+      hedge->expire_at = (bson_get_monotonic_time () +
+                          (cluster->sockettimeoutms * 1000L));
+
+      nodes[!winner]->hedges = _mongoc_list_append (nodes[!winner]->hedges,
+                                                    hedge);
+   }
+
+   RETURN (node->index + 1);
+
+failure:
+   for (i = 0; i < n; i++) {
+      _mongoc_cluster_node_checkin (cluster, nodes[i], streams[i],
+                                    generations[i], false);
+   }
+
+   RETURN (0);
+}
+
+
+/**
+ * _mongoc_cluster_stamp:
+ * @cluster: A mongoc_cluster_t.
+ * @node: The node identifier.
+ *
+ * Returns the stamp of the node provided. The stamp is a monotonic counter
+ * that tracks changes to a node within the cluster. As changes to the node
+ * instance are made, the value is incremented. This helps cursors and other
+ * connection sensitive portions fail gracefully (or reset) upon loss of
+ * connection.
+ *
+ * Returns: A 32-bit stamp indiciating the node version.
+ */
+uint32_t
+_mongoc_cluster_stamp (const mongoc_cluster_t *cluster,
+                       uint32_t           node)
+{
+   bson_return_val_if_fail(cluster, 0);
+   bson_return_val_if_fail(node > 0, 0);
+   bson_return_val_if_fail(node <= cluster->nodes_len, 0);
+
+   return cluster->nodes[node].stamp;
+}
+
+
+/**
+ * _mongoc_cluster_get_primary:
+ * @cluster: A #mongoc_cluster_t.
+ *
+ * Fetches the node we currently believe is PRIMARY.
+ *
+ * Returns: A #mongoc_cluster_node_t or %NULL.
+ */
+mongoc_cluster_node_t *
+_mongoc_cluster_get_primary (mongoc_cluster_t *cluster)
+{
+   uint32_t i;
+
+   BSON_ASSERT (cluster);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      if (cluster->nodes[i].primary) {
+         return &cluster->nodes[i];
+      }
    }
 
-   RETURN (node->index + 1);
+   return NULL;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_try_sendv --
- *
- *       Deliver an RPC to a remote MongoDB instance.
+ * _mongoc_cluster_node_connect_stream --
  *
- *       This function is similar to _mongoc_cluster_sendv() except that it
- *       will not try to reconnect until a connection has been made.
+ *       Open a new connection to @node in addition to node->stream and
+ *       authenticate it if the cluster requires it. The caller owns the
+ *       result, which is not tracked by @node in any way.
  *
- *       This is useful if you want to fire-and-forget ignoring network
- *       errors. Kill Cursors would be a candidate for this.
+ *       @node must be connected, since the wire version learned from
+ *       node->stream decides the default authentication mechanism.
  *
  * Returns:
- *       0 on failure and @error is set.
- *
- *       Non-zero on success. The return value is a hint for the
- *       connection that was used to communicate with the server.
+ *       A new mongoc_stream_t, or NULL and @error is set.
  *
  * Side effects:
- *       @rpcs will be invalid after calling this function.
- *       @error may be set if 0 is returned.
+ *       None.
  *
  *--------------------------------------------------------------------------
  */
 
-uint32_t
-_mongoc_cluster_try_sendv (mongoc_cluster_t             *cluster,
-                           mongoc_rpc_t                 *rpcs,
-                           size_t                        rpcs_len,
-                           uint32_t                 hint,
-                           const mongoc_write_concern_t *write_concern,
-                           const mongoc_read_prefs_t    *read_prefs,
-                           bson_error_t                 *error)
+mongoc_stream_t *
+_mongoc_cluster_node_connect_stream (mongoc_cluster_t      *cluster,
+                                     mongoc_cluster_node_t *node,
+                                     bson_error_t          *error)
 {
-   mongoc_cluster_node_t *node;
-   mongoc_iovec_t *iov;
-   const bson_t *b;
-   mongoc_rpc_t gle;
-   bool need_gle;
-   size_t iovcnt;
-   size_t i;
-   char cmdname[140];
+   mongoc_cluster_node_t tmp;
+   mongoc_stream_t *stream;
+   struct timeval timeout;
 
    ENTRY;
 
-   bson_return_val_if_fail(cluster, false);
-   bson_return_val_if_fail(rpcs, false);
-   bson_return_val_if_fail(rpcs_len, false);
-
-   if (!(node = _mongoc_cluster_select(cluster, rpcs, rpcs_len, hint,
-                                       write_concern, read_prefs, error))) {
-      RETURN (0);
-   }
-
-   BSON_ASSERT (node->stream);
-
-   _mongoc_array_clear (&cluster->iov);
-
-   for (i = 0; i < rpcs_len; i++) {
-      _mongoc_cluster_inc_egress_rpc (&rpcs[i]);
-      rpcs[i].header.request_id = ++cluster->request_id;
-      need_gle = _mongoc_rpc_needs_gle (&rpcs[i], write_concern);
-      _mongoc_rpc_gather (&rpcs[i], &cluster->iov);
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
 
-	  if (rpcs[i].header.msg_len >(int32_t)cluster->max_msg_size) {
-         bson_set_error (error,
-                         MONGOC_ERROR_CLIENT,
-                         MONGOC_ERROR_CLIENT_TOO_BIG,
-                         "Attempted to send an RPC larger than the "
-                         "max allowed message size. Was %u, allowed %u.",
-                         rpcs[i].header.msg_len,
-                         cluster->max_msg_size);
-         RETURN (0);
-      }
+   stream = _mongoc_client_create_stream (cluster->client, &node->host,
+                                          error);
 
-      if (need_gle) {
-         gle.query.msg_len = 0;
-         gle.query.request_id = ++cluster->request_id;
-         gle.query.response_to = 0;
-         gle.query.opcode = MONGOC_OPCODE_QUERY;
-         gle.query.flags = MONGOC_QUERY_NONE;
-
-         switch (rpcs[i].header.opcode) {
-         case MONGOC_OPCODE_INSERT:
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].insert.collection);
-            break;
-         case MONGOC_OPCODE_DELETE:
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].delete.collection);
-            break;
-         case MONGOC_OPCODE_UPDATE:
-            gle.query.collection = rpcs[i].update.collection;
-            DB_AND_CMD_FROM_COLLECTION(cmdname, rpcs[i].update.collection);
-            break;
-         default:
-            BSON_ASSERT(false);
-            DB_AND_CMD_FROM_COLLECTION(cmdname, "admin.$cmd");
-            break;
-         }
+   if (!stream) {
+      RETURN (NULL);
+   }
 
-         gle.query.collection = cmdname;
-         gle.query.skip = 0;
-         gle.query.n_return = 1;
+   timeout.tv_sec = cluster->sockettimeoutms / 1000UL;
+   timeout.tv_usec = (cluster->sockettimeoutms % 1000UL) * 1000UL;
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_RCVTIMEO,
+                             &timeout, sizeof timeout);
+   mongoc_stream_setsockopt (stream, SOL_SOCKET, SO_SNDTIMEO,
+                             &timeout, sizeof timeout);
 
-         b = _mongoc_write_concern_get_gle ((void *)write_concern);
+   if (cluster->requires_auth) {
+      /*
+       * The auth helpers talk to node->stream, so authenticate through
+       * a scratch node that shares nothing with @node but its address
+       * and wire version.
+       */
+      _mongoc_cluster_node_init (&tmp);
+      tmp.host = node->host;
+      tmp.stream = stream;
+      tmp.min_wire_version = node->min_wire_version;
+      tmp.max_wire_version = node->max_wire_version;
 
-         gle.query.query = bson_get_data (b);
-         gle.query.fields = NULL;
+      cluster->connecting++;
 
-         _mongoc_rpc_gather (&gle, &cluster->iov);
-         _mongoc_rpc_swab_to_le (&gle);
+      if (_mongoc_cluster_auth_node (cluster, &tmp, error)) {
+         stream = tmp.stream;
+         tmp.stream = NULL;
+      } else {
+         stream = NULL;
       }
 
-      _mongoc_rpc_swab_to_le (&rpcs[i]);
-   }
-
-   iov = cluster->iov.data;
-   iovcnt = cluster->iov.len;
-   errno = 0;
-
-   DUMP_IOVEC (iov, iov, iovcnt);
-
-   if (!mongoc_stream_writev (node->stream, iov, iovcnt,
-                              cluster->sockettimeoutms)) {
-      char buf[128];
-      char * errstr;
-      errstr = bson_strerror_r(errno, buf, sizeof buf);
+      cluster->connecting--;
 
-      bson_set_error (error,
-                      MONGOC_ERROR_STREAM,
-                      MONGOC_ERROR_STREAM_SOCKET,
-                      "Failure during socket delivery: %s",
-                      errstr);
-      _mongoc_cluster_disconnect_node (cluster, node);
-      RETURN (0);
+      _mongoc_cluster_node_destroy (&tmp);
    }
 
-   RETURN(node->index + 1);
+   RETURN (stream);
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_cluster_try_recv --
+ * _mongoc_cluster_node_checkout --
  *
- *       Tries to receive the next event from the node in the cluster
- *       specified by @hint. The contents are loaded into @buffer and then
- *       scattered into the @rpc structure. @rpc is valid as long as
- *       @buffer contains the contents read into it.
+ *       Borrow one of the extra connections to @node so that a request
+ *       can be in flight on it while node->stream is busy. An idle stream
+ *       is reused when available, otherwise a new one is connected and
+ *       authenticated, up to maxConnectionsPerNode streams per node
+ *       including node->stream.
  *
- *       Callers that can optimize a reuse of @buffer should do so. It
- *       can save many memory allocations.
+ *       @node must be connected, since the wire version learned from
+ *       node->stream is used to authenticate new streams.
  *
  * Returns:
- *       0 on failure and @error is set.
- *       non-zero on success where the value is the hint of the connection
- *       that was used.
+ *       A mongoc_stream_t that must be returned with
+ *       _mongoc_cluster_node_checkin(), or NULL and @error is set.
  *
  * Side effects:
- *       @error if return value is zero.
- *       @rpc is set if result is non-zero.
- *       @buffer will be filled with the input data.
+ *       @generation is set and must be passed to
+ *       _mongoc_cluster_node_checkin().
  *
  *--------------------------------------------------------------------------
  */
 
-bool
-_mongoc_cluster_try_recv (mongoc_cluster_t *cluster,
-                          mongoc_rpc_t     *rpc,
-                          mongoc_buffer_t  *buffer,
-                          uint32_t          hint,
-                          bson_error_t     *error)
+mongoc_stream_t *
+_mongoc_cluster_node_checkout (mongoc_cluster_t      *cluster,
+                               mongoc_cluster_node_t *node,
+                               uint32_t              *generation,
+                               bson_error_t          *error)
 {
-   mongoc_cluster_node_t *node;
-   int32_t msg_len;
-   off_t pos;
+   mongoc_cluster_conn_set_t *conns;
+   mongoc_stream_t *stream = NULL;
+   uint32_t gen;
 
    ENTRY;
 
-   bson_return_val_if_fail (cluster, false);
-   bson_return_val_if_fail (rpc, false);
-   bson_return_val_if_fail (buffer, false);
-   bson_return_val_if_fail (hint, false);
-   bson_return_val_if_fail (hint <= cluster->nodes_len, false);
+   BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (generation);
 
-   /*
-    * Fetch the node to communicate over.
-    */
-   node = &cluster->nodes[hint-1];
-   if (!node->stream) {
+   if (cluster->max_conns_per_node < 2) {
       bson_set_error (error,
                       MONGOC_ERROR_CLIENT,
                       MONGOC_ERROR_CLIENT_NOT_READY,
-                      "Failed to receive message, lost connection to node.");
-      RETURN (false);
-   }
-
-   TRACE ("Waiting for reply from \"%s\"", node->host.host_and_port);
-
-   /*
-    * Buffer the message length to determine how much more to read.
-    */
-   pos = buffer->len;
-   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, 4,
-                                           cluster->sockettimeoutms, error)) {
-      mongoc_counter_protocol_ingress_error_inc ();
-      _mongoc_cluster_disconnect_node (cluster, node);
-      RETURN (false);
+                      "Multiple connections per node require "
+                      "maxConnectionsPerNode greater than 1.");
+      RETURN (NULL);
    }
 
-   /*
-    * Read the msg length from the buffer.
-    */
-   memcpy (&msg_len, &buffer->data[buffer->off + pos], 4);
-   msg_len = BSON_UINT32_FROM_LE (msg_len);
-   if ((msg_len < 16) || (msg_len > cluster->max_msg_size)) {
+   if (!node->stream) {
       bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Corrupt or malicious reply received.");
-      _mongoc_cluster_disconnect_node (cluster, node);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "%s is not connected.",
+                      node->host.host_and_port);
+      RETURN (NULL);
    }
 
-   /*
-    * Read the rest of the message from the stream.
-    */
-   if (!_mongoc_buffer_append_from_stream (buffer, node->stream, msg_len - 4,
-                                           cluster->sockettimeoutms, error)) {
-      _mongoc_cluster_disconnect_node (cluster, node);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
+   if (!node->conns) {
+      node->conns = bson_malloc0 (sizeof *node->conns);
+      node->conns->idle = bson_malloc0 ((cluster->max_conns_per_node - 1) *
+                                        sizeof *node->conns->idle);
+      mongoc_mutex_init (&node->conns->mutex);
    }
 
-   /*
-    * Scatter the buffer into the rpc structure.
-    */
-   if (!_mongoc_rpc_scatter (rpc, &buffer->data[buffer->off + pos], msg_len)) {
+   conns = node->conns;
+
+   mongoc_mutex_lock (&conns->mutex);
+
+   if (conns->idle_len) {
+      stream = conns->idle[--conns->idle_len];
+      conns->idle[conns->idle_len] = NULL;
+   } else if ((conns->in_use + 1) >= cluster->max_conns_per_node) {
+      mongoc_mutex_unlock (&conns->mutex);
       bson_set_error (error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Failed to decode reply from server.");
-      _mongoc_cluster_disconnect_node (cluster, node);
-      mongoc_counter_protocol_ingress_error_inc ();
-      RETURN (false);
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_NOT_READY,
+                      "All %u connections to %s are in use.",
+                      cluster->max_conns_per_node,
+                      node->host.host_and_port);
+      RETURN (NULL);
    }
 
-   node->last_read_msec = bson_get_monotonic_time ();
+   conns->in_use++;
+   gen = conns->generation;
 
-   DUMP_BYTES (buffer, buffer->data + buffer->off, buffer->len);
+   mongoc_mutex_unlock (&conns->mutex);
 
-   _mongoc_rpc_swab_from_le (rpc);
+   if (!stream) {
+      stream = _mongoc_cluster_node_connect_stream (cluster, node, error);
+
+      if (!stream) {
+         mongoc_mutex_lock (&conns->mutex);
+         conns->in_use--;
+         mongoc_mutex_unlock (&conns->mutex);
+         RETURN (NULL);
+      }
+   }
 
-   _mongoc_cluster_inc_ingress_rpc (rpc);
+   *generation = gen;
 
-   RETURN(true);
+   RETURN (stream);
 }
 
 
-/**
- * _mongoc_cluster_stamp:
- * @cluster: A mongoc_cluster_t.
- * @node: The node identifier.
+/*
+ *--------------------------------------------------------------------------
  *
- * Returns the stamp of the node provided. The stamp is a monotonic counter
- * that tracks changes to a node within the cluster. As changes to the node
- * instance are made, the value is incremented. This helps cursors and other
- * connection sensitive portions fail gracefully (or reset) upon loss of
- * connection.
+ * _mongoc_cluster_node_checkin --
  *
- * Returns: A 32-bit stamp indiciating the node version.
- */
-uint32_t
-_mongoc_cluster_stamp (const mongoc_cluster_t *cluster,
-                       uint32_t           node)
-{
-   bson_return_val_if_fail(cluster, 0);
-   bson_return_val_if_fail(node > 0, 0);
-   bson_return_val_if_fail(node <= cluster->nodes_len, 0);
-
-   return cluster->nodes[node].stamp;
-}
-
-
-/**
- * _mongoc_cluster_get_primary:
- * @cluster: A #mongoc_cluster_t.
+ *       Return a stream borrowed with _mongoc_cluster_node_checkout().
  *
- * Fetches the node we currently believe is PRIMARY.
+ *       The stream is kept on the free list of @node unless @reusable is
+ *       false, for example after a network error, or @node has been
+ *       disconnected since the stream was checked out. In those cases it
+ *       is closed.
  *
- * Returns: A #mongoc_cluster_node_t or %NULL.
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @stream may be destroyed.
+ *
+ *--------------------------------------------------------------------------
  */
-mongoc_cluster_node_t *
-_mongoc_cluster_get_primary (mongoc_cluster_t *cluster)
+
+void
+_mongoc_cluster_node_checkin (mongoc_cluster_t      *cluster,
+                              mongoc_cluster_node_t *node,
+                              mongoc_stream_t       *stream,
+                              uint32_t               generation,
+                              bool                   reusable)
 {
-   uint32_t i;
+   mongoc_cluster_conn_set_t *conns;
+
+   ENTRY;
 
    BSON_ASSERT (cluster);
+   BSON_ASSERT (node);
+   BSON_ASSERT (node->conns);
+   BSON_ASSERT (stream);
 
-   for (i = 0; i < cluster->nodes_len; i++) {
-      if (cluster->nodes[i].primary) {
-         return &cluster->nodes[i];
-      }
+   conns = node->conns;
+
+   mongoc_mutex_lock (&conns->mutex);
+
+   BSON_ASSERT (conns->in_use);
+
+   conns->in_use--;
+
+   if (reusable &&
+       (generation == conns->generation) &&
+       (conns->idle_len < (cluster->max_conns_per_node - 1))) {
+      conns->idle[conns->idle_len++] = stream;
+      stream = NULL;
    }
 
-   return NULL;
+   mongoc_mutex_unlock (&conns->mutex);
+
+   if (stream) {
+      mongoc_stream_close (stream);
+      mongoc_stream_destroy (stream);
+   }
+
+   EXIT;
 }
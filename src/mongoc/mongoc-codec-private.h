@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CODEC_PRIVATE_H
+#define MONGOC_CODEC_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-codec.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * A field of a compiled codec. @header is the element header it is
+ * encoded with, its BSON type, name and NUL, and @width the length of a
+ * value of fixed size, or 0 for strings.
+ */
+typedef struct
+{
+   mongoc_codec_field_t  field;
+   uint8_t              *header;
+   uint32_t              header_len;
+   uint32_t              width;
+} mongoc_codec_plan_t;
+
+
+struct _mongoc_codec_t
+{
+   mongoc_codec_plan_t *plan;
+   uint32_t             n_fields;
+   size_t               struct_size;
+   /* the length of an encoded struct without the strings it holds */
+   uint32_t             fixed_len;
+};
+
+
+size_t _mongoc_codec_encoded_len (const mongoc_codec_t *codec,
+                                  const void           *st);
+size_t _mongoc_codec_encode      (const mongoc_codec_t *codec,
+                                  const void           *st,
+                                  uint8_t              *out);
+bool   _mongoc_codec_decode      (const mongoc_codec_t *codec,
+                                  const uint8_t        *data,
+                                  uint32_t              len,
+                                  void                 *st,
+                                  bson_error_t         *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_CODEC_PRIVATE_H */
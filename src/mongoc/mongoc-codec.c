@@ -0,0 +1,674 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-codec.h"
+#include "mongoc-codec-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "codec"
+
+
+/*
+ * The BSON type a field is encoded as, the size its member must have in
+ * the struct, and the length of its encoded value, 0 for strings.
+ */
+static bool
+_mongoc_codec_type_info (mongoc_codec_type_t  type,
+                         bson_type_t         *bson_type,
+                         size_t              *size,
+                         uint32_t            *width)
+{
+   switch (type) {
+   case MONGOC_CODEC_BOOL:
+      *bson_type = BSON_TYPE_BOOL;
+      *size = sizeof (bool);
+      *width = 1;
+      return true;
+   case MONGOC_CODEC_INT32:
+      *bson_type = BSON_TYPE_INT32;
+      *size = sizeof (int32_t);
+      *width = 4;
+      return true;
+   case MONGOC_CODEC_INT64:
+      *bson_type = BSON_TYPE_INT64;
+      *size = sizeof (int64_t);
+      *width = 8;
+      return true;
+   case MONGOC_CODEC_DOUBLE:
+      *bson_type = BSON_TYPE_DOUBLE;
+      *size = sizeof (double);
+      *width = 8;
+      return true;
+   case MONGOC_CODEC_DATE_TIME:
+      *bson_type = BSON_TYPE_DATE_TIME;
+      *size = sizeof (int64_t);
+      *width = 8;
+      return true;
+   case MONGOC_CODEC_OID:
+      *bson_type = BSON_TYPE_OID;
+      *size = sizeof (bson_oid_t);
+      *width = 12;
+      return true;
+   case MONGOC_CODEC_UTF8:
+      /* any size, a char array */
+      *bson_type = BSON_TYPE_UTF8;
+      *size = 0;
+      *width = 0;
+      return true;
+   case MONGOC_CODEC_UTF8_REF:
+      *bson_type = BSON_TYPE_UTF8;
+      *size = sizeof (const char *);
+      *width = 0;
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_codec_new --
+ *
+ *       Compile the @n_fields descriptions of the members of a struct at
+ *       @fields into a codec, which encodes such structs as documents and
+ *       decodes documents into them. @struct_size is the size of the
+ *       struct, the distance between two structs of an array.
+ *
+ *       The element headers of the fields are laid out once, so that
+ *       encoding a struct only copies them and the values.
+ *
+ * Returns:
+ *       A newly allocated mongoc_codec_t, or NULL if a field is invalid,
+ *       in which case @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_codec_t *
+mongoc_codec_new (const mongoc_codec_field_t *fields,      /* IN */
+                  uint32_t                    n_fields,    /* IN */
+                  size_t                      struct_size, /* IN */
+                  bson_error_t               *error)       /* OUT */
+{
+   const mongoc_codec_field_t *field;
+   mongoc_codec_plan_t *plan;
+   mongoc_codec_t *codec;
+   bson_type_t bson_type;
+   size_t name_len;
+   size_t size;
+   uint32_t width;
+   uint32_t i;
+   uint32_t j;
+
+   ENTRY;
+
+   BSON_ASSERT (fields || !n_fields);
+
+   for (i = 0; i < n_fields; i++) {
+      field = &fields [i];
+
+      if (!field->name || !field->name [0] || field->name [0] == '$' ||
+          strchr (field->name, '.')) {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Field %u has an invalid name.", i);
+         RETURN (NULL);
+      }
+
+      for (j = 0; j < i; j++) {
+         if (!strcmp (fields [j].name, field->name)) {
+            bson_set_error (error,
+                            MONGOC_ERROR_BSON,
+                            MONGOC_ERROR_BSON_INVALID,
+                            "Field \"%s\" is given twice.", field->name);
+            RETURN (NULL);
+         }
+      }
+
+      if (!_mongoc_codec_type_info (field->type, &bson_type, &size, &width) ||
+          (size ? (field->size != size) : (field->size == 0)) ||
+          (field->offset > struct_size) ||
+          (field->size > struct_size - field->offset)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "Field \"%s\" has an invalid type, size or offset.",
+                         field->name);
+         RETURN (NULL);
+      }
+   }
+
+   codec = bson_malloc0 (sizeof *codec);
+   codec->plan = bson_malloc0 (BSON_MAX (n_fields, 1) * sizeof *codec->plan);
+   codec->n_fields = n_fields;
+   codec->struct_size = struct_size;
+   /* the length of the document and its trailing NUL */
+   codec->fixed_len = 5;
+
+   for (i = 0; i < n_fields; i++) {
+      plan = &codec->plan [i];
+      plan->field = fields [i];
+
+      _mongoc_codec_type_info (fields [i].type, &bson_type, &size, &width);
+      name_len = strlen (fields [i].name);
+
+      plan->header_len = (uint32_t)(name_len + 2);
+      plan->header = bson_malloc (plan->header_len);
+      plan->header [0] = (uint8_t)bson_type;
+      memcpy (plan->header + 1, fields [i].name, name_len + 1);
+      plan->field.name = (const char *)plan->header + 1;
+      plan->width = width;
+
+      codec->fixed_len += plan->header_len + width;
+
+      if (bson_type == BSON_TYPE_UTF8) {
+         /* length and trailing NUL of the string */
+         codec->fixed_len += 5;
+      }
+   }
+
+   RETURN (codec);
+}
+
+
+void
+mongoc_codec_destroy (mongoc_codec_t *codec)
+{
+   uint32_t i;
+
+   if (codec) {
+      for (i = 0; i < codec->n_fields; i++) {
+         bson_free (codec->plan [i].header);
+      }
+
+      bson_free (codec->plan);
+      bson_free (codec);
+   }
+}
+
+
+/*
+ * The string a field of type UTF8 or UTF8_REF of @st points to, and its
+ * length. A char array with no NUL is taken whole. NULL if a UTF8_REF is
+ * NULL, which is encoded as a BSON null.
+ */
+static const char *
+_mongoc_codec_str (const mongoc_codec_plan_t *plan,
+                   const uint8_t             *st,
+                   size_t                    *len)
+{
+   const char *str;
+   const char *end;
+
+   if (plan->field.type == MONGOC_CODEC_UTF8_REF) {
+      memcpy (&str, st + plan->field.offset, sizeof str);
+
+      if (str) {
+         *len = strlen (str);
+      }
+
+      return str;
+   }
+
+   str = (const char *)st + plan->field.offset;
+   end = memchr (str, '\0', plan->field.size);
+   *len = end ? (size_t)(end - str) : plan->field.size;
+
+   return str;
+}
+
+
+size_t
+_mongoc_codec_encoded_len (const mongoc_codec_t *codec,
+                           const void           *st)
+{
+   const mongoc_codec_plan_t *plan;
+   size_t len = codec->fixed_len;
+   size_t str_len;
+   uint32_t i;
+
+   for (i = 0; i < codec->n_fields; i++) {
+      plan = &codec->plan [i];
+
+      if (plan->header [0] != BSON_TYPE_UTF8) {
+         continue;
+      }
+
+      if (_mongoc_codec_str (plan, st, &str_len)) {
+         len += str_len;
+      } else {
+         len -= 5;
+      }
+   }
+
+   return len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_codec_encode --
+ *
+ *       Encode @st as a document into @out, which must have room for
+ *       _mongoc_codec_encoded_len() bytes.
+ *
+ * Returns:
+ *       The length of the document.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+size_t
+_mongoc_codec_encode (const mongoc_codec_t *codec,
+                      const void           *st,
+                      uint8_t              *out)
+{
+   const mongoc_codec_plan_t *plan;
+   const uint8_t *src;
+   const char *str;
+   uint8_t *p = out + 4;
+   size_t str_len;
+   uint32_t u32;
+   uint64_t u64;
+   uint32_t i;
+
+   for (i = 0; i < codec->n_fields; i++) {
+      plan = &codec->plan [i];
+      src = (const uint8_t *)st + plan->field.offset;
+
+      memcpy (p, plan->header, plan->header_len);
+      p += plan->header_len;
+
+      switch (plan->field.type) {
+      case MONGOC_CODEC_BOOL:
+         *p++ = *(const bool *)src ? 1 : 0;
+         break;
+      case MONGOC_CODEC_INT32:
+         memcpy (&u32, src, 4);
+         u32 = BSON_UINT32_TO_LE (u32);
+         memcpy (p, &u32, 4);
+         p += 4;
+         break;
+      case MONGOC_CODEC_INT64:
+      case MONGOC_CODEC_DOUBLE:
+      case MONGOC_CODEC_DATE_TIME:
+         memcpy (&u64, src, 8);
+         u64 = BSON_UINT64_TO_LE (u64);
+         memcpy (p, &u64, 8);
+         p += 8;
+         break;
+      case MONGOC_CODEC_OID:
+         memcpy (p, src, 12);
+         p += 12;
+         break;
+      case MONGOC_CODEC_UTF8:
+      case MONGOC_CODEC_UTF8_REF:
+         if (!(str = _mongoc_codec_str (plan, st, &str_len))) {
+            p [-(int)plan->header_len] = BSON_TYPE_NULL;
+            break;
+         }
+
+         u32 = BSON_UINT32_TO_LE ((uint32_t)str_len + 1);
+         memcpy (p, &u32, 4);
+         memcpy (p + 4, str, str_len);
+         p [4 + str_len] = '\0';
+         p += 4 + str_len + 1;
+         break;
+      default:
+         BSON_ASSERT (false);
+         break;
+      }
+   }
+
+   *p++ = '\0';
+
+   u32 = BSON_UINT32_TO_LE ((uint32_t)(p - out));
+   memcpy (out, &u32, 4);
+
+   return (size_t)(p - out);
+}
+
+
+/* find the field named @key, trying @hint first */
+static const mongoc_codec_plan_t *
+_mongoc_codec_find (const mongoc_codec_t *codec,
+                    const char           *key,
+                    uint32_t             *hint)
+{
+   uint32_t i;
+
+   if (*hint < codec->n_fields &&
+       !strcmp (codec->plan [*hint].field.name, key)) {
+      return &codec->plan [(*hint)++];
+   }
+
+   for (i = 0; i < codec->n_fields; i++) {
+      if (!strcmp (codec->plan [i].field.name, key)) {
+         *hint = i + 1;
+         return &codec->plan [i];
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_codec_decode --
+ *
+ *       Decode the document of @len bytes at @data into @st.
+ *
+ *       Fields are zeroed first, so that one the document lacks, or holds
+ *       a null for, is zero or NULL. Other keys of the document are
+ *       ignored. An int32 is widened for an int64 or double field and an
+ *       int64 for a double field. A UTF8_REF field points into @data.
+ *
+ *       Documents usually come back with their fields in the order they
+ *       were inserted, so the field after the last one found is tried
+ *       first.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set if a value
+ *       has a type its field does not take, or a string does not fit its
+ *       char array.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_codec_decode (const mongoc_codec_t *codec,
+                      const uint8_t        *data,
+                      uint32_t              len,
+                      void                 *st,
+                      bson_error_t         *error)
+{
+   const mongoc_codec_plan_t *plan;
+   bson_iter_t iter;
+   bson_type_t type;
+   const char *str;
+   uint32_t str_len;
+   uint32_t hint = 0;
+   uint32_t i;
+   uint8_t *dst;
+   int32_t i32;
+   int64_t i64;
+   double d;
+   bool b;
+   bson_t doc;
+
+   for (i = 0; i < codec->n_fields; i++) {
+      plan = &codec->plan [i];
+      memset ((uint8_t *)st + plan->field.offset, 0, plan->field.size);
+
+      if (plan->field.type == MONGOC_CODEC_UTF8_REF) {
+         str = NULL;
+         memcpy ((uint8_t *)st + plan->field.offset, &str, sizeof str);
+      }
+   }
+
+   if (!bson_init_static (&doc, data, len) || !bson_iter_init (&iter, &doc)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "The document is corrupt.");
+      return false;
+   }
+
+   while (bson_iter_next (&iter)) {
+      if (!(plan = _mongoc_codec_find (codec, bson_iter_key (&iter), &hint))) {
+         continue;
+      }
+
+      dst = (uint8_t *)st + plan->field.offset;
+      type = bson_iter_type (&iter);
+
+      if (type == BSON_TYPE_NULL) {
+         continue;
+      }
+
+      switch (plan->field.type) {
+      case MONGOC_CODEC_BOOL:
+         if (type != BSON_TYPE_BOOL) {
+            goto mismatch;
+         }
+
+         b = bson_iter_bool (&iter);
+         memcpy (dst, &b, sizeof b);
+         break;
+      case MONGOC_CODEC_INT32:
+         if (type != BSON_TYPE_INT32) {
+            goto mismatch;
+         }
+
+         i32 = bson_iter_int32 (&iter);
+         memcpy (dst, &i32, sizeof i32);
+         break;
+      case MONGOC_CODEC_INT64:
+         if (type == BSON_TYPE_INT64) {
+            i64 = bson_iter_int64 (&iter);
+         } else if (type == BSON_TYPE_INT32) {
+            i64 = bson_iter_int32 (&iter);
+         } else {
+            goto mismatch;
+         }
+
+         memcpy (dst, &i64, sizeof i64);
+         break;
+      case MONGOC_CODEC_DOUBLE:
+         if (type == BSON_TYPE_DOUBLE) {
+            d = bson_iter_double (&iter);
+         } else if (type == BSON_TYPE_INT32) {
+            d = bson_iter_int32 (&iter);
+         } else if (type == BSON_TYPE_INT64) {
+            d = (double)bson_iter_int64 (&iter);
+         } else {
+            goto mismatch;
+         }
+
+         memcpy (dst, &d, sizeof d);
+         break;
+      case MONGOC_CODEC_DATE_TIME:
+         if (type != BSON_TYPE_DATE_TIME) {
+            goto mismatch;
+         }
+
+         i64 = bson_iter_date_time (&iter);
+         memcpy (dst, &i64, sizeof i64);
+         break;
+      case MONGOC_CODEC_OID:
+         if (type != BSON_TYPE_OID) {
+            goto mismatch;
+         }
+
+         memcpy (dst, bson_iter_oid (&iter), sizeof (bson_oid_t));
+         break;
+      case MONGOC_CODEC_UTF8:
+         if (type != BSON_TYPE_UTF8) {
+            goto mismatch;
+         }
+
+         str = bson_iter_utf8 (&iter, &str_len);
+
+         if (str_len >= plan->field.size) {
+            bson_set_error (error,
+                            MONGOC_ERROR_BSON,
+                            MONGOC_ERROR_BSON_INVALID,
+                            "The string of field \"%s\" does not fit in "
+                            "%u bytes.",
+                            plan->field.name, (unsigned)plan->field.size);
+            return false;
+         }
+
+         memcpy (dst, str, str_len + 1);
+         break;
+      case MONGOC_CODEC_UTF8_REF:
+         if (type != BSON_TYPE_UTF8) {
+            goto mismatch;
+         }
+
+         str = bson_iter_utf8 (&iter, NULL);
+         memcpy (dst, &str, sizeof str);
+         break;
+      default:
+         BSON_ASSERT (false);
+         break;
+      }
+   }
+
+   return true;
+
+mismatch:
+   bson_set_error (error,
+                   MONGOC_ERROR_BSON,
+                   MONGOC_ERROR_BSON_INVALID,
+                   "Field \"%s\" holds a value of unexpected BSON type 0x%02x.",
+                   plan->field.name, (unsigned)type);
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_insert_struct --
+ *
+ *       Insert the @n_structs structs of the array at @structs, encoded
+ *       with @codec, as mongoc_collection_insert_raw() does. The
+ *       documents are encoded back to back into one buffer, which the
+ *       write command sends as it is; no bson_t is built.
+ *
+ *       Structs whose codec has no "_id" field get a generated ObjectId.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       As mongoc_collection_insert_raw().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_insert_struct (mongoc_collection_t          *collection,    /* IN */
+                                 mongoc_insert_flags_t         flags,         /* IN */
+                                 const mongoc_codec_t         *codec,         /* IN */
+                                 const void                   *structs,       /* IN */
+                                 uint32_t                      n_structs,     /* IN */
+                                 const mongoc_write_concern_t *write_concern, /* IN */
+                                 bson_error_t                 *error)         /* OUT */
+{
+   const uint8_t *st;
+   uint8_t *buf;
+   size_t buflen = 0;
+   size_t pos;
+   uint32_t i;
+   bool ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (codec, false);
+   bson_return_val_if_fail (structs || !n_structs, false);
+
+   for (i = 0, st = structs; i < n_structs; i++, st += codec->struct_size) {
+      buflen += _mongoc_codec_encoded_len (codec, st);
+   }
+
+   buf = bson_malloc (BSON_MAX (buflen, 1));
+
+   for (i = 0, pos = 0, st = structs; i < n_structs;
+        i++, st += codec->struct_size) {
+      pos += _mongoc_codec_encode (codec, st, buf + pos);
+   }
+
+   ret = mongoc_collection_insert_raw (collection, flags, buf, buflen,
+                                       write_concern, error);
+
+   bson_free (buf);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_next_struct --
+ *
+ *       Decode the next document of @cursor into @st with @codec, straight
+ *       from the bytes of the server's reply.
+ *
+ *       Strings of UTF8_REF fields point into the reply and are valid
+ *       until the next call to mongoc_cursor_next() or
+ *       mongoc_cursor_next_struct(), or mongoc_cursor_destroy().
+ *
+ * Returns:
+ *       true if a document was decoded; otherwise false, in which case
+ *       mongoc_cursor_error() should be checked.
+ *
+ * Side effects:
+ *       The cursor fails if the document does not match @codec.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_next_struct (mongoc_cursor_t      *cursor, /* IN */
+                           const mongoc_codec_t *codec,  /* IN */
+                           void                 *st)     /* OUT */
+{
+   const bson_t *doc;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (codec);
+   BSON_ASSERT (st);
+
+   if (!mongoc_cursor_next (cursor, &doc)) {
+      RETURN (false);
+   }
+
+   if (!_mongoc_codec_decode (codec, bson_get_data (doc), doc->len, st,
+                              &cursor->error)) {
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
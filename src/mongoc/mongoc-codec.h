@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CODEC_H
+#define MONGOC_CODEC_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+#include <stddef.h>
+
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+#include "mongoc-flags.h"
+#include "mongoc-write-concern.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef enum
+{
+   MONGOC_CODEC_BOOL,
+   MONGOC_CODEC_INT32,
+   MONGOC_CODEC_INT64,
+   MONGOC_CODEC_DOUBLE,
+   MONGOC_CODEC_DATE_TIME,
+   MONGOC_CODEC_OID,
+   MONGOC_CODEC_UTF8,
+   MONGOC_CODEC_UTF8_REF,
+} mongoc_codec_type_t;
+
+
+typedef struct
+{
+   const char          *name;
+   mongoc_codec_type_t  type;
+   size_t               offset;
+   size_t               size;
+} mongoc_codec_field_t;
+
+
+#define MONGOC_CODEC_FIELD_NAMED(_struct, _member, _name, _type) \
+   { (_name), (_type), offsetof (_struct, _member), \
+     sizeof (((_struct *)0)->_member) }
+#define MONGOC_CODEC_FIELD(_struct, _member, _type) \
+   MONGOC_CODEC_FIELD_NAMED (_struct, _member, #_member, _type)
+
+
+typedef struct _mongoc_codec_t mongoc_codec_t;
+
+
+mongoc_codec_t *mongoc_codec_new                (const mongoc_codec_field_t   *fields,
+                                                 uint32_t                      n_fields,
+                                                 size_t                        struct_size,
+                                                 bson_error_t                 *error);
+void            mongoc_codec_destroy            (mongoc_codec_t               *codec);
+bool            mongoc_collection_insert_struct (mongoc_collection_t          *collection,
+                                                 mongoc_insert_flags_t         flags,
+                                                 const mongoc_codec_t         *codec,
+                                                 const void                   *structs,
+                                                 uint32_t                      n_structs,
+                                                 const mongoc_write_concern_t *write_concern,
+                                                 bson_error_t                 *error);
+bool            mongoc_cursor_next_struct       (mongoc_cursor_t              *cursor,
+                                                 const mongoc_codec_t         *codec,
+                                                 void                         *st);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_CODEC_H */
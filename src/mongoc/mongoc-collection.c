@@ -18,21 +18,27 @@
 #include <bcon.h>
 #include <stdio.h>
 
+#include "mongoc-array-private.h"
 #include "mongoc-bulk-operation.h"
 #include "mongoc-bulk-operation-private.h"
+#include "mongoc-bulk-writer-private.h"
 #include "mongoc-client-private.h"
 #include "mongoc-collection.h"
 #include "mongoc-collection-private.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-cursor-cursorid-private.h"
 #include "mongoc-cursor-array-private.h"
+#include "mongoc-cursor-scatter-private.h"
 #include "mongoc-error.h"
 #include "mongoc-index.h"
 #include "mongoc-log.h"
 #include "mongoc-opcode.h"
+#include "mongoc-oplog-watcher-private.h"
+#include "mongoc-read-prefs-private.h"
 #include "mongoc-trace.h"
 #include "mongoc-write-command-private.h"
 #include "mongoc-write-concern-private.h"
+#include "mongoc-write-future-private.h"
 
 
 #undef MONGOC_LOG_DOMAIN
@@ -113,10 +119,10 @@ _mongoc_collection_new (mongoc_client_t              *client,
    col = bson_malloc0(sizeof *col);
    col->client = client;
    col->write_concern = write_concern ?
-      mongoc_write_concern_copy(write_concern) :
+      _mongoc_write_concern_share(write_concern) :
       mongoc_write_concern_new();
    col->read_prefs = read_prefs ?
-      mongoc_read_prefs_copy(read_prefs) :
+      _mongoc_read_prefs_share(read_prefs) :
       mongoc_read_prefs_new(MONGOC_READ_PRIMARY);
 
    bson_snprintf (col->ns, sizeof col->ns, "%s.%s", db, collection);
@@ -134,6 +140,77 @@ _mongoc_collection_new (mongoc_client_t              *client,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_collection_write_command_execute --
+ *
+ *       Execute @command against @collection within the operation timeout
+ *       of @collection. If @target, the document inserted or the selector
+ *       if @is_query, lets mongoc_client_set_direct_shard_routing() find
+ *       the shard it goes to, the command is sent there and not through
+ *       mongos.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @result is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_collection_write_command_execute (
+      mongoc_collection_t          *collection,
+      mongoc_write_command_t       *command,
+      const bson_t                 *target,
+      bool                          is_query,
+      const mongoc_write_concern_t *write_concern,
+      mongoc_write_result_t        *result)
+{
+   mongoc_client_t *client = NULL;
+   mongoc_write_error_t *write_error;
+   int64_t deadline;
+   bool stale;
+   size_t i;
+
+   if (target && collection->client->shard_router) {
+      client = _mongoc_shard_router_target (collection->client->shard_router,
+                                            collection->ns, target,
+                                            is_query);
+   }
+
+   if (!client) {
+      client = collection->client;
+   }
+
+   deadline = _mongoc_cluster_set_deadline (&client->cluster,
+                                            collection->operation_timeout_msec);
+
+   _mongoc_write_command_execute (command, client, 0,
+                                  collection->db, collection->collection,
+                                  write_concern, 0, result);
+
+   _mongoc_cluster_restore_deadline (&client->cluster, deadline);
+
+   if (client->routed_by) {
+      stale = result->failed &&
+              _mongoc_shard_router_is_stale ((int32_t)result->error.code);
+
+      for (i = 0; !stale && i < result->writeErrors.len; i++) {
+         write_error = &_mongoc_array_index (&result->writeErrors,
+                                             mongoc_write_error_t, i);
+         stale = _mongoc_shard_router_is_stale (write_error->code);
+      }
+
+      if (stale) {
+         _mongoc_shard_router_invalidate (client->routed_by, collection->ns);
+      }
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -178,6 +255,15 @@ mongoc_collection_destroy (mongoc_collection_t *collection) /* IN */
 }
 
 
+static BSON_INLINE bool
+_mongoc_iter_holds_number (const bson_iter_t *iter)
+{
+   return (BSON_ITER_HOLDS_INT32 (iter) ||
+           BSON_ITER_HOLDS_INT64 (iter) ||
+           BSON_ITER_HOLDS_DOUBLE (iter));
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -206,6 +292,12 @@ mongoc_collection_destroy (mongoc_collection_t *collection) /* IN */
  *       @flags: bitwise or of mongoc_query_flags_t or 0.
  *       @pipeline: A bson_t containing the pipeline request. @pipeline
  *                  will be sent as an array type in the request.
+ *       @options: Optional options for the command. "initialBatchSize"
+ *                 sets the size of the first batch only, "prefetch" and
+ *                 "adaptiveBatchSize" are applied to the cursor with
+ *                 mongoc_cursor_set_prefetch() and
+ *                 mongoc_cursor_set_adaptive_batch_size(). Anything else,
+ *                 such as "allowDiskUse", is sent with the command.
  *       @read_prefs: Optional read preferences for the command.
  *
  * Returns:
@@ -230,14 +322,21 @@ mongoc_collection_aggregate (mongoc_collection_t       *collection, /* IN */
    bson_t command;
    bson_t child;
    int32_t batch_size = 0;
+   int32_t initial_batch_size = -1;
+   uint32_t adaptive_max_bytes = 0;
    bool did_batch_size = false;
    bool try_cursor = true;
+   bool prefetch = false;
+   int64_t deadline;
 
    bson_return_val_if_fail (collection, NULL);
    bson_return_val_if_fail (pipeline, NULL);
 
    bson_init (&command);
 
+   deadline = _mongoc_cluster_set_deadline (&collection->client->cluster,
+                                            collection->operation_timeout_msec);
+
 TOP:
    BSON_APPEND_UTF8 (&command, "aggregate", collection->collection);
 
@@ -259,18 +358,21 @@ TOP:
       if (options && bson_iter_init (&iter, options)) {
          while (bson_iter_next (&iter)) {
             if (BSON_ITER_IS_KEY (&iter, "batchSize") &&
-                (BSON_ITER_HOLDS_INT32 (&iter) ||
-                 BSON_ITER_HOLDS_INT64 (&iter) ||
-                 BSON_ITER_HOLDS_DOUBLE (&iter))) {
+                _mongoc_iter_holds_number (&iter)) {
                did_batch_size = true;
                batch_size = (int32_t)bson_iter_as_int64 (&iter);
-               BSON_APPEND_INT32 (&child, "batchSize", batch_size);
+            } else if (BSON_ITER_IS_KEY (&iter, "initialBatchSize") &&
+                       _mongoc_iter_holds_number (&iter)) {
+               initial_batch_size = (int32_t)bson_iter_as_int64 (&iter);
             }
          }
       }
 
-      if (!did_batch_size) {
-         BSON_APPEND_INT32 (&child, "batchSize", 100);
+      if (initial_batch_size >= 0) {
+         BSON_APPEND_INT32 (&child, "batchSize", initial_batch_size);
+      } else {
+         BSON_APPEND_INT32 (&child, "batchSize",
+                            did_batch_size ? batch_size : 100);
       }
 
       bson_append_document_end (&command, &child);
@@ -278,7 +380,17 @@ TOP:
 
    if (options && bson_iter_init (&iter, options)) {
       while (bson_iter_next (&iter)) {
-         if (! (BSON_ITER_IS_KEY (&iter, "batchSize") || BSON_ITER_IS_KEY (&iter, "cursor"))) {
+         if (BSON_ITER_IS_KEY (&iter, "prefetch")) {
+            prefetch = bson_iter_as_bool (&iter);
+         } else if (BSON_ITER_IS_KEY (&iter, "adaptiveBatchSize") &&
+                    _mongoc_iter_holds_number (&iter)) {
+            adaptive_max_bytes = (uint32_t)bson_iter_as_int64 (&iter);
+         } else if (BSON_ITER_IS_KEY (&iter, "allowDiskUse")) {
+            BSON_APPEND_BOOL (&command, "allowDiskUse",
+                              bson_iter_as_bool (&iter));
+         } else if (! (BSON_ITER_IS_KEY (&iter, "batchSize") ||
+                       BSON_ITER_IS_KEY (&iter, "initialBatchSize") ||
+                       BSON_ITER_IS_KEY (&iter, "cursor"))) {
             bson_append_iter (&command, bson_iter_key (&iter), -1, &iter);
          }
       }
@@ -300,6 +412,9 @@ TOP:
          try_cursor = false;
          goto TOP;
       }
+
+      mongoc_cursor_set_prefetch (cursor, prefetch);
+      mongoc_cursor_set_adaptive_batch_size (cursor, adaptive_max_bytes);
    } else {
       /* for older versions we get an array that we can create a synthetic
        * cursor on top of */
@@ -309,10 +424,108 @@ TOP:
 
    bson_destroy(&command);
 
+   _mongoc_cluster_restore_deadline (&collection->client->cluster, deadline);
+
    return cursor;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_collection_find_cached --
+ *
+ *       Have @cursor, which is not started yet, return the cached
+ *       results of its query if the client's query cache has them, or
+ *       cache the results it receives.
+ *
+ * Returns:
+ *       true if @cursor iterates cached documents.
+ *
+ * Side effects:
+ *       @cursor may iterate the cached documents instead of querying.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_collection_find_cached (mongoc_collection_t *collection,
+                                mongoc_cursor_t     *cursor)
+{
+   mongoc_client_t *client = collection->client;
+   const bson_t *docs;
+   bson_t *key;
+
+   if (client->cache_watcher) {
+      _mongoc_oplog_watcher_poll (client->cache_watcher,
+                                  &client->cache_watcher_seq,
+                                  &client->query_cache);
+   }
+
+   key = _mongoc_query_cache_key (cursor->flags, cursor->skip, cursor->limit,
+                                  &cursor->query,
+                                  cursor->has_fields ? &cursor->fields : NULL,
+                                  cursor->read_prefs);
+
+   docs = _mongoc_query_cache_lookup (&client->query_cache, collection->ns,
+                                      key);
+
+   if (docs) {
+      _mongoc_cursor_array_init (cursor, NULL);
+      _mongoc_cursor_array_set_bson (cursor, docs);
+      bson_destroy (key);
+      return true;
+   }
+
+   cursor->cache_key = key;
+
+   return false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_collection_find_coalesced --
+ *
+ *       Have @cursor, which is not started yet, share the results of an
+ *       identical query another client of the pool has in flight, or let
+ *       others share its own once it is sent.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May wait for the reply to the other query, and @cursor then
+ *       iterates its documents instead of querying.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_collection_find_coalesced (mongoc_collection_t *collection,
+                                   mongoc_cursor_t     *cursor)
+{
+   bson_t *key;
+   bson_t docs;
+
+   key = _mongoc_query_cache_key (cursor->flags, cursor->skip, cursor->limit,
+                                  &cursor->query,
+                                  cursor->has_fields ? &cursor->fields : NULL,
+                                  cursor->read_prefs);
+
+   if (_mongoc_query_flights_join (collection->client->query_flights,
+                                   collection->ns, key, &docs)) {
+      _mongoc_cursor_array_init (cursor, NULL);
+      _mongoc_cursor_array_set_bson (cursor, &docs);
+      bson_destroy (&docs);
+      bson_destroy (key);
+   } else {
+      cursor->flight_key = key;
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -366,6 +579,9 @@ mongoc_collection_find (mongoc_collection_t       *collection, /* IN */
                         const bson_t              *fields,     /* IN */
                         const mongoc_read_prefs_t *read_prefs) /* IN */
 {
+   mongoc_client_t *shard = NULL;
+   mongoc_cursor_t *cursor;
+
    bson_return_val_if_fail(collection, NULL);
    bson_return_val_if_fail(query, NULL);
 
@@ -375,8 +591,281 @@ mongoc_collection_find (mongoc_collection_t       *collection, /* IN */
       read_prefs = collection->read_prefs;
    }
 
-   return _mongoc_cursor_new(collection->client, collection->ns, flags, skip,
-                             limit, batch_size, false, query, fields, read_prefs);
+   if (collection->client->shard_router &&
+       !(flags & (MONGOC_QUERY_TAILABLE_CURSOR | MONGOC_QUERY_EXHAUST))) {
+      shard = _mongoc_shard_router_target (collection->client->shard_router,
+                                           collection->ns, query, true);
+   }
+
+   if (shard) {
+      cursor = _mongoc_cursor_new (shard, collection->ns, flags, skip, limit,
+                                   batch_size, false, query, fields,
+                                   read_prefs);
+      if (cursor) {
+         cursor->operation_timeout_msec = collection->operation_timeout_msec;
+      }
+
+      return cursor;
+   }
+
+   cursor = _mongoc_cursor_new(collection->client, collection->ns, flags, skip,
+                               limit, batch_size, false, query, fields,
+                               read_prefs);
+   if (cursor) {
+      cursor->operation_timeout_msec = collection->operation_timeout_msec;
+
+      if (collection->client->shard_router &&
+          collection->client->scatter_gather &&
+          !(flags & (MONGOC_QUERY_TAILABLE_CURSOR | MONGOC_QUERY_EXHAUST)) &&
+          _mongoc_cursor_scatter_init (cursor,
+                                       collection->client->shard_router)) {
+         return cursor;
+      }
+
+      if (!(flags & (MONGOC_QUERY_TAILABLE_CURSOR | MONGOC_QUERY_EXHAUST)) &&
+          !(collection->client->query_cache.max_entries &&
+            _mongoc_collection_find_cached (collection, cursor)) &&
+          collection->client->query_flights) {
+         _mongoc_collection_find_coalesced (collection, cursor);
+      }
+   }
+
+   return cursor;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_find_many --
+ *
+ *       Starts one cursor for each of @queries, as mongoc_collection_find()
+ *       would, but writes all of their OP_QUERYs to the same node back to
+ *       back before reading any reply. Independent lookups then take
+ *       about one round trip instead of one each.
+ *
+ *       @cursors must have room for @n_queries cursors, which are always
+ *       created and must be freed with mongoc_cursor_destroy(). A query
+ *       the server fails is reported by its own cursor.
+ *
+ *       Exhaust cursors can't be started this way.
+ *
+ * Returns:
+ *       true if every reply was received; otherwise false, @error is set,
+ *       and the cursors without a reply fail with the same error.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_find_many (mongoc_collection_t       *collection, /* IN */
+                             mongoc_query_flags_t       flags,      /* IN */
+                             uint32_t                   skip,       /* IN */
+                             uint32_t                   limit,      /* IN */
+                             uint32_t                   batch_size, /* IN */
+                             const bson_t             **queries,    /* IN */
+                             uint32_t                   n_queries,  /* IN */
+                             const bson_t              *fields,     /* IN */
+                             const mongoc_read_prefs_t *read_prefs, /* IN */
+                             mongoc_cursor_t          **cursors,    /* OUT */
+                             bson_error_t              *error)      /* OUT */
+{
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (queries, false);
+   bson_return_val_if_fail (n_queries, false);
+   bson_return_val_if_fail (cursors, false);
+
+   for (i = 0; i < n_queries; i++) {
+      cursors[i] = mongoc_collection_find (collection, flags, skip, limit,
+                                           batch_size, queries[i], fields,
+                                           read_prefs);
+   }
+
+   if ((flags & MONGOC_QUERY_EXHAUST)) {
+      for (i = 0; i < n_queries; i++) {
+         bson_set_error (&cursors[i]->error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "Exhaust cursors can't be started together.");
+         cursors[i]->failed = true;
+         cursors[i]->done = true;
+      }
+
+      if (error) {
+         memcpy (error, &cursors[0]->error, sizeof *error);
+      }
+
+      RETURN (false);
+   }
+
+   RETURN (_mongoc_cursor_query_many (cursors, n_queries, error));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_find_one --
+ *
+ *       Finds the first document matching @query. This is the same as
+ *       mongoc_collection_find() with a limit of 1, but the OP_QUERY is
+ *       built on the stack and sent directly, without the setup and
+ *       teardown of a mongoc_cursor_t. It asks for a single document, so
+ *       the server closes its cursor and there is nothing to kill.
+ *
+ *       @query is sent as is unless @read_prefs have to be added to it.
+ *
+ * Returns:
+ *       true if the query succeeded, in which case @doc is initialized
+ *       with the document found, or empty if none matched. Otherwise
+ *       false and @error is set.
+ *
+ * Side effects:
+ *       @doc is always initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_find_one (mongoc_collection_t       *collection, /* IN */
+                            const bson_t              *query,      /* IN */
+                            const bson_t              *fields,     /* IN */
+                            const mongoc_read_prefs_t *read_prefs, /* IN */
+                            bson_t                    *doc,        /* OUT */
+                            bson_error_t              *error)      /* OUT */
+{
+   mongoc_client_t *client;
+   mongoc_buffer_t buffer;
+   mongoc_rpc_t rpc;
+   bson_iter_t iter;
+   const char *msg = "Unknown query failure";
+   uint32_t code = MONGOC_ERROR_QUERY_FAILURE;
+   uint32_t request_id;
+   uint32_t hint;
+   int64_t deadline;
+   bson_t wrapped;
+   bson_t b;
+   bool has_wrapped = false;
+   bool ret = false;
+
+   ENTRY;
+
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (query, false);
+   bson_return_val_if_fail (doc, false);
+
+   bson_init (doc);
+   bson_clear (&collection->gle);
+
+   client = collection->client;
+
+   if (!read_prefs) {
+      read_prefs = collection->read_prefs;
+   }
+
+   rpc.query.msg_len = 0;
+   rpc.query.request_id = 0;
+   rpc.query.response_to = 0;
+   rpc.query.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_NONE;
+   rpc.query.collection = collection->ns;
+   rpc.query.skip = 0;
+   rpc.query.n_return = -1;
+   rpc.query.query = bson_get_data (query);
+   rpc.query.fields = fields ? bson_get_data (fields) : NULL;
+
+   if (read_prefs &&
+       (mongoc_read_prefs_get_mode (read_prefs) != MONGOC_READ_PRIMARY)) {
+      rpc.query.flags |= MONGOC_QUERY_SLAVE_OK;
+
+      bson_init (&wrapped);
+      has_wrapped = true;
+
+      if (bson_has_field (query, "$query")) {
+         bson_concat (&wrapped, query);
+      } else {
+         bson_append_document (&wrapped, "$query", 6, query);
+      }
+
+      _mongoc_cursor_append_read_prefs (&wrapped, read_prefs);
+      rpc.query.query = bson_get_data (&wrapped);
+   }
+
+   if (!_mongoc_client_warm_up (client, error)) {
+      if (has_wrapped) {
+         bson_destroy (&wrapped);
+      }
+      RETURN (false);
+   }
+
+   deadline = _mongoc_cluster_set_deadline (&client->cluster,
+                                            collection->operation_timeout_msec);
+   _mongoc_client_recv_buffer_take (client, &buffer);
+
+   if (!(hint = _mongoc_client_sendv (client, &rpc, 1, 0, NULL, read_prefs,
+                                      error))) {
+      GOTO (cleanup);
+   }
+
+   request_id = BSON_UINT32_FROM_LE (rpc.header.request_id);
+
+   if (!_mongoc_client_recv (client, &rpc, &buffer, hint, error)) {
+      GOTO (cleanup);
+   }
+
+   if ((rpc.header.opcode != MONGOC_OPCODE_REPLY) ||
+       ((uint32_t)rpc.header.response_to != request_id)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid reply to the query.");
+      GOTO (cleanup);
+   }
+
+   if (rpc.reply.cursor_id) {
+      _mongoc_client_kill_cursor_deferred (client, hint, rpc.reply.cursor_id);
+   }
+
+   if ((rpc.reply.flags & MONGOC_REPLY_QUERY_FAILURE)) {
+      if (_mongoc_rpc_reply_get_first (&rpc.reply, &b)) {
+         if (bson_iter_init_find (&iter, &b, "code") &&
+             BSON_ITER_HOLDS_INT32 (&iter)) {
+            code = bson_iter_int32 (&iter);
+         }
+
+         if (bson_iter_init_find (&iter, &b, "$err") &&
+             BSON_ITER_HOLDS_UTF8 (&iter)) {
+            msg = bson_iter_utf8 (&iter, NULL);
+         }
+      }
+
+      bson_set_error (error, MONGOC_ERROR_QUERY, code, "%s", msg);
+      GOTO (cleanup);
+   }
+
+   if (rpc.reply.n_returned && _mongoc_rpc_reply_get_first (&rpc.reply, &b)) {
+      bson_concat (doc, &b);
+      bson_destroy (&b);
+   }
+
+   ret = true;
+
+cleanup:
+   _mongoc_client_recv_buffer_release (client, &buffer);
+   _mongoc_cluster_restore_deadline (&client->cluster, deadline);
+
+   if (has_wrapped) {
+      bson_destroy (&wrapped);
+   }
+
+   RETURN (ret);
 }
 
 
@@ -420,6 +909,7 @@ mongoc_collection_command (mongoc_collection_t       *collection,
                            const mongoc_read_prefs_t *read_prefs)
 {
    char ns[MONGOC_NAMESPACE_MAX];
+   mongoc_cursor_t *cursor;
 
    BSON_ASSERT (collection);
    BSON_ASSERT (query);
@@ -437,8 +927,13 @@ mongoc_collection_command (mongoc_collection_t       *collection,
                      collection->db, collection->collection);
    }
 
-   return mongoc_client_command (collection->client, ns, flags,
-                                 skip, limit, batch_size, query, fields, read_prefs);
+   cursor = mongoc_client_command (collection->client, ns, flags, skip, limit,
+                                   batch_size, query, fields, read_prefs);
+   if (cursor) {
+      cursor->operation_timeout_msec = collection->operation_timeout_msec;
+   }
+
+   return cursor;
 }
 
 bool
@@ -448,13 +943,23 @@ mongoc_collection_command_simple (mongoc_collection_t       *collection,
                                   bson_t                    *reply,
                                   bson_error_t              *error)
 {
+   int64_t deadline;
+   bool ret;
+
    BSON_ASSERT (collection);
    BSON_ASSERT (command);
 
    bson_clear (&collection->gle);
 
-   return mongoc_client_command_simple (collection->client, collection->db,
-                                        command, read_prefs, reply, error);
+   deadline = _mongoc_cluster_set_deadline (&collection->client->cluster,
+                                            collection->operation_timeout_msec);
+
+   ret = mongoc_client_command_simple (collection->client, collection->db,
+                                       command, read_prefs, reply, error);
+
+   _mongoc_cluster_restore_deadline (&collection->client->cluster, deadline);
+
+   return ret;
 }
 
 /*
@@ -551,6 +1056,65 @@ mongoc_collection_count_with_opts (mongoc_collection_t       *collection,  /* IN
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_estimated_count --
+ *
+ *       Get the number of documents in @collection from its metadata,
+ *       by running "count" without a query. The server answers from the
+ *       size it keeps for the collection instead of scanning, so the
+ *       result may be off after an unclean shutdown or, with a sharded
+ *       cluster, while chunks migrate.
+ *
+ *       The count is reused for the time set with
+ *       mongoc_client_set_estimated_count_ttl(), if any.
+ *
+ * Returns:
+ *       -1 on failure; otherwise the number of documents.
+ *
+ * Side effects:
+ *       @error is set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int64_t
+mongoc_collection_estimated_count (mongoc_collection_t       *collection,  /* IN */
+                                   const mongoc_read_prefs_t *read_prefs,  /* IN */
+                                   bson_error_t              *error)       /* OUT */
+{
+   int64_t ret = -1;
+   bson_iter_t iter;
+   bson_t reply;
+   bson_t cmd;
+
+   bson_return_val_if_fail (collection, -1);
+
+   if (_mongoc_client_get_estimated_count (collection->client,
+                                           collection->ns, &ret)) {
+      return ret;
+   }
+
+   bson_init (&cmd);
+   bson_append_utf8 (&cmd, "count", 5, collection->collection,
+                     collection->collectionlen);
+
+   if (mongoc_collection_command_simple (collection, &cmd, read_prefs,
+                                         &reply, error) &&
+       bson_iter_init_find (&iter, &reply, "n")) {
+      ret = bson_iter_as_int64 (&iter);
+      _mongoc_client_set_estimated_count (collection->client,
+                                          collection->ns, ret);
+   }
+
+   bson_destroy (&reply);
+   bson_destroy (&cmd);
+
+   return ret;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -582,6 +1146,9 @@ mongoc_collection_drop (mongoc_collection_t *collection, /* IN */
    ret = mongoc_collection_command_simple(collection, &cmd, NULL, NULL, error);
    bson_destroy(&cmd);
 
+   _mongoc_client_invalidate_metadata (collection->client, collection->db,
+                                       collection->collection);
+
    return ret;
 }
 
@@ -620,6 +1187,9 @@ mongoc_collection_drop_index (mongoc_collection_t *collection, /* IN */
    ret = mongoc_collection_command_simple(collection, &cmd, NULL, NULL, error);
    bson_destroy(&cmd);
 
+   _mongoc_client_invalidate_metadata (collection->client, collection->db,
+                                       collection->collection);
+
    return ret;
 }
 
@@ -775,30 +1345,39 @@ _mongoc_collection_create_index_legacy (mongoc_collection_t      *collection,
 }
 
 
-bool
-mongoc_collection_create_index (mongoc_collection_t      *collection,
-                                const bson_t             *keys,
-                                const mongoc_index_opt_t *opt,
-                                bson_error_t             *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_collection_append_index --
+ *
+ *       Appends the createIndexes specification of the index on @keys
+ *       with @opt to the array @ar, as element @key.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_collection_append_index (bson_t                   *ar,
+                                 const char               *key,
+                                 const bson_t             *keys,
+                                 const mongoc_index_opt_t *opt)
 {
    const mongoc_index_opt_t *def_opt;
    const mongoc_index_opt_geo_t *def_geo;
-   bson_error_t local_error;
-   const char *name;
-   bson_t cmd = BSON_INITIALIZER;
-   bson_t ar;
-   bson_t doc;
-   bson_t reply;
-   bson_t storage_doc;
-   bson_t wt_doc;
    const mongoc_index_opt_geo_t *geo_opt;
    const mongoc_index_opt_storage_t *storage_opt;
    const mongoc_index_opt_wt_t *wt_opt;
+   const char *name;
    char *alloc_name = NULL;
-   bool ret = false;
-
-   bson_return_val_if_fail (collection, false);
-   bson_return_val_if_fail (keys, false);
+   bson_t doc;
+   bson_t storage_doc;
+   bson_t wt_doc;
 
    def_opt = mongoc_index_opt_get_default ();
    opt = opt ? opt : def_opt;
@@ -812,12 +1391,7 @@ mongoc_collection_create_index (mongoc_collection_t      *collection,
       name = alloc_name;
    }
 
-   /*
-    * Build our createIndexes command to send to the server.
-    */
-   BSON_APPEND_UTF8 (&cmd, "createIndexes", collection->collection);
-   bson_append_array_begin (&cmd, "indexes", 7, &ar);
-   bson_append_document_begin (&ar, "0", 1, &doc);
+   bson_append_document_begin (ar, key, -1, &doc);
    BSON_APPEND_DOCUMENT (&doc, "key", keys);
    BSON_APPEND_UTF8 (&doc, "name", name);
    if (opt->background) {
@@ -883,7 +1457,80 @@ mongoc_collection_create_index (mongoc_collection_t      *collection,
       }
    }
 
-   bson_append_document_end (&ar, &doc);
+   bson_append_document_end (ar, &doc);
+
+   bson_free (alloc_name);
+}
+
+
+bool
+mongoc_collection_create_index (mongoc_collection_t      *collection,
+                                const bson_t             *keys,
+                                const mongoc_index_opt_t *opt,
+                                bson_error_t             *error)
+{
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (keys, false);
+
+   return mongoc_collection_create_indexes (collection, &keys, &opt, 1, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_create_indexes --
+ *
+ *       Request the MongoDB server create the @n_indexes indexes on
+ *       @keys, each with the options at the same position in @opts, in a
+ *       single createIndexes command. The server can then build them in
+ *       one pass over the collection.
+ *
+ *       @opts may be NULL, as may each of its elements, to use the
+ *       default options.
+ *
+ *       Servers without createIndexes get one insert into
+ *       system.indexes per index.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @error is setup upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_create_indexes (mongoc_collection_t       *collection,
+                                  const bson_t             **keys,
+                                  const mongoc_index_opt_t **opts,
+                                  uint32_t                   n_indexes,
+                                  bson_error_t              *error)
+{
+   bson_error_t local_error;
+   const char *key;
+   char str[16];
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t ar;
+   bson_t reply;
+   uint32_t i;
+   bool ret = false;
+
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (keys, false);
+   bson_return_val_if_fail (n_indexes, false);
+
+   /*
+    * Build our createIndexes command to send to the server.
+    */
+   BSON_APPEND_UTF8 (&cmd, "createIndexes", collection->collection);
+   bson_append_array_begin (&cmd, "indexes", 7, &ar);
+   for (i = 0; i < n_indexes; i++) {
+      bson_uint32_to_string (i, &key, str, sizeof str);
+      _mongoc_collection_append_index (&ar, key, keys[i],
+                                       opts ? opts[i] : NULL);
+   }
    bson_append_array_end (&cmd, &ar);
 
    ret = mongoc_collection_command_simple (collection, &cmd, NULL, &reply,
@@ -895,16 +1542,21 @@ mongoc_collection_create_index (mongoc_collection_t      *collection,
     */
    if (!ret) {
       if (local_error.code == MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND) {
-         ret = _mongoc_collection_create_index_legacy (collection, keys, opt,
-                                                       error);
+         for (i = 0, ret = true; ret && i < n_indexes; i++) {
+            ret = _mongoc_collection_create_index_legacy (
+               collection, keys[i], opts ? opts[i] : NULL, error);
+         }
       } else if (error) {
          memcpy (error, &local_error, sizeof *error);
       }
    }
 
+   /* this creates the collection too if it did not exist */
+   _mongoc_client_invalidate_metadata (collection->client, collection->db,
+                                       collection->collection);
+
    bson_destroy (&cmd);
    bson_destroy (&reply);
-   bson_free (alloc_name);
 
    return ret;
 }
@@ -960,56 +1612,198 @@ mongoc_collection_find_indexes (mongoc_collection_t *collection,
    bson_t cmd = BSON_INITIALIZER;
    bson_t child;
 
-   BSON_ASSERT (collection);
+   BSON_ASSERT (collection);
+
+   if ((cursor = _mongoc_client_get_metadata (collection->client,
+                                              MONGOC_CLIENT_METADATA_INDEXES,
+                                              collection->ns, NULL))) {
+      return cursor;
+   }
+
+   bson_append_utf8 (&cmd, "listIndexes", -1, collection->collection,
+                     collection->collectionlen);
+
+   BSON_APPEND_DOCUMENT_BEGIN (&cmd, "cursor", &child);
+   bson_append_document_end (&cmd, &child);
+
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
+
+   cursor = mongoc_collection_command (collection, MONGOC_QUERY_SLAVE_OK, 0, 0, 0,
+                                       &cmd, NULL, read_prefs);
+
+   _mongoc_cursor_cursorid_init(cursor);
+   cursor->limit = 0;
+
+   if (_mongoc_cursor_cursorid_prime(cursor)) {
+       /* intentionally empty */
+   } else {
+      if (mongoc_cursor_error (cursor, error)) {
+         if (error->code == MONGOC_ERROR_COLLECTION_DOES_NOT_EXIST) {
+             bson_t empty_arr = BSON_INITIALIZER;
+             /* collection does not exist. in accordance with the spec we return
+             * an empty array. Also we need to clear out the error. */
+             error->code = 0;
+             error->domain = 0;
+             _mongoc_cursor_array_set_bson (cursor, &empty_arr);
+         } else if (error->code == MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND) {
+            /* talking to an old server. */
+            /* clear out error. */
+            error->code = 0;
+            error->domain = 0;
+            mongoc_cursor_destroy (cursor);
+            cursor = _mongoc_collection_find_indexes_legacy (collection, error);
+         }
+      } else {
+         /* TODO: remove this branch for general release.  Only relevant for RC */
+         mongoc_cursor_destroy (cursor);
+         cursor = mongoc_collection_command (collection, MONGOC_QUERY_SLAVE_OK, 0, 0, 0,
+                                             &cmd, NULL, read_prefs);
+
+         _mongoc_cursor_array_init(cursor, "indexes");
+         cursor->limit = 0;
+      }
+   }
+
+   bson_destroy (&cmd);
+   mongoc_read_prefs_destroy (read_prefs);
+
+   return _mongoc_client_set_metadata (collection->client,
+                                       MONGOC_CLIENT_METADATA_INDEXES,
+                                       collection->ns, NULL, cursor);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_parallel_scan --
+ *
+ *       Runs the parallelCollectionScan command, asking the server for up
+ *       to @num_cursors cursors that together return every document of
+ *       @collection.
+ *
+ *       The cursors are independent of each other and all read from the
+ *       server the command was run on. They belong to the collection's
+ *       client; use mongoc_cursor_set_client() to iterate them from other
+ *       threads.
+ *
+ * Returns:
+ *       A NULL terminated array of cursors that should be freed with
+ *       mongoc_cursor_destroy() and bson_free(), or NULL on failure and
+ *       @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_cursor_t **
+mongoc_collection_parallel_scan (mongoc_collection_t       *collection,
+                                 uint32_t                   num_cursors,
+                                 const mongoc_read_prefs_t *read_prefs,
+                                 bson_error_t              *error)
+{
+   mongoc_cursor_t *cmd_cursor;
+   mongoc_cursor_t *cursor;
+   mongoc_array_t cursors;
+   const bson_t *reply;
+   const uint8_t *data;
+   uint32_t data_len;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t cursor_doc;
+   bson_t query = BSON_INITIALIZER;
+   bson_t cmd = BSON_INITIALIZER;
+   size_t i;
+   bool ok = false;
+
+   bson_return_val_if_fail (collection, NULL);
+   bson_return_val_if_fail (num_cursors, NULL);
+
+   if (!read_prefs) {
+      read_prefs = collection->read_prefs;
+   }
+
+   bson_append_utf8 (&cmd, "parallelCollectionScan", -1,
+                     collection->collection, collection->collectionlen);
+   BSON_APPEND_INT32 (&cmd, "numCursors", num_cursors);
+
+   _mongoc_array_init (&cursors, sizeof (mongoc_cursor_t *));
+
+   cmd_cursor = mongoc_collection_command (collection, MONGOC_QUERY_NONE, 0,
+                                           0, 0, &cmd, NULL, read_prefs);
 
-   bson_append_utf8 (&cmd, "listIndexes", -1, collection->collection,
-                     collection->collectionlen);
+   if (!mongoc_cursor_next (cmd_cursor, &reply)) {
+      if (!mongoc_cursor_error (cmd_cursor, error)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "parallelCollectionScan returned no reply.");
+      }
+      GOTO (cleanup);
+   }
 
-   BSON_APPEND_DOCUMENT_BEGIN (&cmd, "cursor", &child);
-   bson_append_document_end (&cmd, &child);
+   if (!bson_iter_init_find (&iter, reply, "cursors") ||
+       !BSON_ITER_HOLDS_ARRAY (&iter) ||
+       !bson_iter_recurse (&iter, &child)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "parallelCollectionScan returned no cursors.");
+      GOTO (cleanup);
+   }
 
-   read_prefs = mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
+   while (bson_iter_next (&child)) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&child)) {
+         continue;
+      }
 
-   cursor = mongoc_collection_command (collection, MONGOC_QUERY_SLAVE_OK, 0, 0, 0,
-                                       &cmd, NULL, read_prefs);
+      bson_iter_document (&child, &data_len, &data);
 
-   _mongoc_cursor_cursorid_init(cursor);
-   cursor->limit = 0;
+      if (!bson_init_static (&cursor_doc, data, data_len)) {
+         continue;
+      }
 
-   if (_mongoc_cursor_cursorid_prime(cursor)) {
-       /* intentionally empty */
-   } else {
-      if (mongoc_cursor_error (cursor, error)) {
-         if (error->code == MONGOC_ERROR_COLLECTION_DOES_NOT_EXIST) {
-             bson_t empty_arr = BSON_INITIALIZER;
-             /* collection does not exist. in accordance with the spec we return
-             * an empty array. Also we need to clear out the error. */
-             error->code = 0;
-             error->domain = 0;
-             _mongoc_cursor_array_set_bson (cursor, &empty_arr);
-         } else if (error->code == MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND) {
-            /* talking to an old server. */
-            /* clear out error. */
-            error->code = 0;
-            error->domain = 0;
-            mongoc_cursor_destroy (cursor);
-            cursor = _mongoc_collection_find_indexes_legacy (collection, error);
-         }
-      } else {
-         /* TODO: remove this branch for general release.  Only relevant for RC */
-         mongoc_cursor_destroy (cursor);
-         cursor = mongoc_collection_command (collection, MONGOC_QUERY_SLAVE_OK, 0, 0, 0,
-                                             &cmd, NULL, read_prefs);
+      cursor = _mongoc_cursor_new (collection->client, collection->ns,
+                                   MONGOC_QUERY_NONE, 0, 0, 0, false, &query,
+                                   NULL, read_prefs);
+      cursor->operation_timeout_msec = collection->operation_timeout_msec;
+      _mongoc_cursor_cursorid_init (cursor);
 
-         _mongoc_cursor_array_init(cursor, "indexes");
-         cursor->limit = 0;
+      _mongoc_array_append_val (&cursors, cursor);
+
+      if (!_mongoc_cursor_cursorid_set_cursor (cursor, cmd_cursor->hint,
+                                               &cursor_doc)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CURSOR,
+                         MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                         "parallelCollectionScan returned an invalid cursor.");
+         GOTO (cleanup);
       }
    }
 
+   ok = true;
+
+cleanup:
+   mongoc_cursor_destroy (cmd_cursor);
+   bson_destroy (&query);
    bson_destroy (&cmd);
-   mongoc_read_prefs_destroy (read_prefs);
 
-   return cursor;
+   if (!ok) {
+      for (i = 0; i < cursors.len; i++) {
+         mongoc_cursor_destroy (_mongoc_array_index (&cursors,
+                                                     mongoc_cursor_t *, i));
+      }
+      _mongoc_array_destroy (&cursors);
+      return NULL;
+   }
+
+   /* NULL terminate, also handles the case of no cursors. */
+   cursor = NULL;
+   _mongoc_array_append_val (&cursors, cursor);
+
+   return (mongoc_cursor_t **)cursors.data;
 }
 
 /*
@@ -1061,7 +1855,7 @@ mongoc_collection_insert_bulk (mongoc_collection_t           *collection,
       write_concern = collection->write_concern;
    }
 
-   if (!(flags & MONGOC_INSERT_NO_VALIDATE)) {
+   if (!(flags & MONGOC_INSERT_NO_VALIDATE) && !collection->skip_validation) {
       int i;
 
       for (i = 0; i < n_documents; i++) {
@@ -1088,12 +1882,13 @@ mongoc_collection_insert_bulk (mongoc_collection_t           *collection,
    _mongoc_write_result_init (&result);
 
    ordered = !(flags & MONGOC_INSERT_CONTINUE_ON_ERROR);
-   _mongoc_write_command_init_insert (&command, documents, n_documents,
-                                      ordered, true);
+   _mongoc_write_command_init_insert_borrowed (&command, documents,
+                                               n_documents, ordered, true,
+                                               collection->client->oid_gen);
 
-   _mongoc_write_command_execute (&command, collection->client, 0,
-                                  collection->db, collection->collection,
-                                  write_concern, 0, &result);
+   _mongoc_collection_write_command_execute (collection, &command,
+                                             NULL, false, write_concern,
+                                             &result);
 
    collection->gle = bson_new ();
    ret = _mongoc_write_result_complete (&result, collection->gle, error);
@@ -1105,6 +1900,108 @@ mongoc_collection_insert_bulk (mongoc_collection_t           *collection,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_insert_raw --
+ *
+ *       Insert documents given as concatenated BSON, such as the contents
+ *       of a bsondump file, without wrapping each in a bson_t.
+ *
+ * Parameters:
+ *       @collection: A mongoc_collection_t.
+ *       @flags: flags for the insert or 0.
+ *       @buf: The concatenated documents.
+ *       @buflen: The length of @buf in bytes.
+ *       @write_concern: A write concern or NULL.
+ *       @error: a location for an error or NULL.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ *       If the write concern does not dictate checking the result of the
+ *       insert, then true may be returned even though the document was
+ *       not actually inserted on the MongoDB server or cluster.
+ *
+ * Side effects:
+ *       @collection->gle is setup, depending on write_concern->w value.
+ *       @error may be set upon failure if non-NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_collection_insert_raw (mongoc_collection_t          *collection,
+                              mongoc_insert_flags_t         flags,
+                              const uint8_t                *buf,
+                              size_t                        buflen,
+                              const mongoc_write_concern_t *write_concern,
+                              bson_error_t                 *error)
+{
+   mongoc_write_command_t command;
+   mongoc_write_result_t result;
+   bson_t b;
+   bool ordered;
+   bool ret;
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (buf || !buflen, false);
+
+   if (!write_concern) {
+      write_concern = collection->write_concern;
+   }
+
+   ordered = !(flags & MONGOC_INSERT_CONTINUE_ON_ERROR);
+
+   if (!_mongoc_write_command_init_insert_raw (&command, buf, buflen,
+                                               ordered, true,
+                                               collection->client->oid_gen,
+                                               error)) {
+      RETURN (false);
+   }
+
+   if (!(flags & MONGOC_INSERT_NO_VALIDATE) && !collection->skip_validation) {
+      for (i = 0; i < command.n_documents; i++) {
+         if (!bson_init_static (&b, command.borrowed [i].data,
+                                command.borrowed [i].len) ||
+             !bson_validate (&b,
+                             (BSON_VALIDATE_UTF8 |
+                              BSON_VALIDATE_UTF8_ALLOW_NULL |
+                              BSON_VALIDATE_DOLLAR_KEYS |
+                              BSON_VALIDATE_DOT_KEYS),
+                             NULL)) {
+            bson_set_error (error,
+                            MONGOC_ERROR_BSON,
+                            MONGOC_ERROR_BSON_INVALID,
+                            "A document was corrupt or contained "
+                            "invalid characters . or $");
+            _mongoc_write_command_destroy (&command);
+            RETURN (false);
+         }
+      }
+   }
+
+   bson_clear (&collection->gle);
+
+   _mongoc_write_result_init (&result);
+
+   _mongoc_collection_write_command_execute (collection, &command,
+                                             NULL, false, write_concern,
+                                             &result);
+
+   collection->gle = bson_new ();
+   ret = _mongoc_write_result_complete (&result, collection->gle, error);
+
+   _mongoc_write_result_destroy (&result);
+   _mongoc_write_command_destroy (&command);
+
+   RETURN (ret);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1155,7 +2052,7 @@ mongoc_collection_insert (mongoc_collection_t          *collection,
       write_concern = collection->write_concern;
    }
 
-   if (!(flags & MONGOC_INSERT_NO_VALIDATE)) {
+   if (!(flags & MONGOC_INSERT_NO_VALIDATE) && !collection->skip_validation) {
       if (!bson_validate (document,
                           (BSON_VALIDATE_UTF8 |
                            BSON_VALIDATE_UTF8_ALLOW_NULL |
@@ -1173,12 +2070,23 @@ mongoc_collection_insert (mongoc_collection_t          *collection,
       flags &= ~MONGOC_INSERT_NO_VALIDATE;
    }
 
+   if (collection->client->coalesce_max_bytes &&
+       !_mongoc_write_concern_needs_gle (write_concern)) {
+      collection->gle = bson_new ();
+      RETURN (_mongoc_client_coalesce_insert (collection->client,
+                                              collection->db,
+                                              collection->collection,
+                                              document, error));
+   }
+
    _mongoc_write_result_init (&result);
-   _mongoc_write_command_init_insert (&command, &document, 1, true, false);
+   _mongoc_write_command_init_insert_borrowed (&command, &document, 1, true,
+                                               false,
+                                               collection->client->oid_gen);
 
-   _mongoc_write_command_execute (&command, collection->client, 0,
-                                  collection->db, collection->collection,
-                                  write_concern, 0, &result);
+   _mongoc_collection_write_command_execute (collection, &command,
+                                             document, false, write_concern,
+                                             &result);
 
    collection->gle = bson_new ();
    ret = _mongoc_write_result_complete (&result, collection->gle, error);
@@ -1190,6 +2098,70 @@ mongoc_collection_insert (mongoc_collection_t          *collection,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_insert_async --
+ *
+ *       Like mongoc_collection_insert(), but an acknowledged insert is
+ *       sent without waiting for the reply. Any number of them may be in
+ *       flight on a client; each is acknowledged in
+ *       mongoc_write_future_wait(), and all of them before anything else
+ *       is sent on the client.
+ *
+ *       Servers without write commands, and unacknowledged write concerns,
+ *       get the insert performed right away.
+ *
+ * Returns:
+ *       A newly allocated mongoc_write_future_t that should be freed with
+ *       mongoc_write_future_destroy(), or NULL if @document is invalid and
+ *       @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_write_future_t *
+mongoc_collection_insert_async (mongoc_collection_t          *collection,
+                                mongoc_insert_flags_t         flags,
+                                const bson_t                 *document,
+                                const mongoc_write_concern_t *write_concern,
+                                bson_error_t                 *error)
+{
+   ENTRY;
+
+   bson_return_val_if_fail (collection, NULL);
+   bson_return_val_if_fail (document, NULL);
+
+   if (!write_concern) {
+      write_concern = collection->write_concern;
+   }
+
+   if (!(flags & MONGOC_INSERT_NO_VALIDATE) && !collection->skip_validation) {
+      if (!bson_validate (document,
+                          (BSON_VALIDATE_UTF8 |
+                           BSON_VALIDATE_UTF8_ALLOW_NULL |
+                           BSON_VALIDATE_DOLLAR_KEYS |
+                           BSON_VALIDATE_DOT_KEYS),
+                          NULL)) {
+         bson_set_error (error,
+                         MONGOC_ERROR_BSON,
+                         MONGOC_ERROR_BSON_INVALID,
+                         "A document was corrupt or contained "
+                         "invalid characters . or $");
+         RETURN (NULL);
+      }
+   }
+
+   RETURN (_mongoc_write_future_new_insert (collection->client,
+                                            collection->db,
+                                            collection->collection,
+                                            document, write_concern));
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1242,6 +2214,7 @@ mongoc_collection_update (mongoc_collection_t          *collection,
    }
 
    if (!((uint32_t)flags & MONGOC_UPDATE_NO_VALIDATE) &&
+       !collection->skip_validation &&
        bson_iter_init (&iter, update) &&
        bson_iter_next (&iter) &&
        (bson_iter_key (&iter) [0] != '$') &&
@@ -1269,9 +2242,9 @@ mongoc_collection_update (mongoc_collection_t          *collection,
                                       !!(flags & MONGOC_UPDATE_MULTI_UPDATE),
                                       true);
 
-   _mongoc_write_command_execute (&command, collection->client, 0,
-                                  collection->db, collection->collection,
-                                  write_concern, 0, &result);
+   _mongoc_collection_write_command_execute (collection, &command,
+                                             selector, true, write_concern,
+                                             &result);
 
    collection->gle = bson_new ();
    ret = _mongoc_write_result_complete (&result, collection->gle, error);
@@ -1397,9 +2370,9 @@ mongoc_collection_remove (mongoc_collection_t          *collection,
    _mongoc_write_result_init (&result);
    _mongoc_write_command_init_delete (&command, selector, multi, true);
 
-   _mongoc_write_command_execute (&command, collection->client, 0,
-                                  collection->db, collection->collection,
-                                  write_concern, 0, &result);
+   _mongoc_collection_write_command_execute (collection, &command,
+                                             selector, true, write_concern,
+                                             &result);
 
    collection->gle = bson_new ();
    ret = _mongoc_write_result_complete (&result, collection->gle, error);
@@ -1475,7 +2448,7 @@ mongoc_collection_set_read_prefs (mongoc_collection_t       *collection,
    }
 
    if (read_prefs) {
-      collection->read_prefs = mongoc_read_prefs_copy(read_prefs);
+      collection->read_prefs = _mongoc_read_prefs_share(read_prefs);
    }
 }
 
@@ -1533,11 +2506,93 @@ mongoc_collection_set_write_concern (mongoc_collection_t          *collection,
    }
 
    if (write_concern) {
-      collection->write_concern = mongoc_write_concern_copy(write_concern);
+      collection->write_concern = _mongoc_write_concern_share(write_concern);
    }
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_set_operation_timeout --
+ *
+ *       Bound the total time of each operation on @collection, including
+ *       node selection, reconnection and every read and write on the
+ *       network, to @timeout_msec. Cursors created from @collection apply
+ *       the same bound to each call to mongoc_cursor_next().
+ *
+ *       A @timeout_msec of 0, the default, only applies socketTimeoutMS
+ *       to each read and write.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_collection_set_operation_timeout (mongoc_collection_t *collection,
+                                         uint32_t             timeout_msec)
+{
+   bson_return_if_fail (collection);
+
+   collection->operation_timeout_msec = timeout_msec;
+}
+
+
+uint32_t
+mongoc_collection_get_operation_timeout (const mongoc_collection_t *collection)
+{
+   bson_return_val_if_fail (collection, 0);
+
+   return collection->operation_timeout_msec;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_set_validate_documents --
+ *
+ *       Turn off, or back on, the checks that documents written through
+ *       @collection are valid UTF-8 BSON without "." or "$" in their keys.
+ *       This is for callers that produce BSON known to be valid and do not
+ *       want to pay for the check on every write. It applies as if
+ *       MONGOC_INSERT_NO_VALIDATE or MONGOC_UPDATE_NO_VALIDATE was passed
+ *       to every insert and update, and to the replacements of bulk
+ *       operations and bulk writers created afterwards.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_collection_set_validate_documents (mongoc_collection_t *collection,
+                                          bool                 validate)
+{
+   bson_return_if_fail (collection);
+
+   collection->skip_validation = !validate;
+}
+
+
+bool
+mongoc_collection_get_validate_documents (const mongoc_collection_t *collection)
+{
+   bson_return_val_if_fail (collection, true);
+
+   return !collection->skip_validation;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1717,6 +2772,12 @@ mongoc_collection_rename (mongoc_collection_t *collection,
    ret = mongoc_client_command_simple (collection->client, "admin",
                                        &cmd, NULL, NULL, error);
 
+   _mongoc_client_invalidate_metadata (collection->client, collection->db,
+                                       collection->collection);
+   _mongoc_client_invalidate_metadata (collection->client,
+                                       new_db ? new_db : collection->db,
+                                       new_name);
+
    if (ret) {
       if (new_db) {
          bson_snprintf (collection->db, sizeof collection->db, "%s", new_db);
@@ -1801,6 +2862,8 @@ mongoc_collection_create_bulk_operation (
       bool                          ordered,
       const mongoc_write_concern_t *write_concern)
 {
+   mongoc_bulk_operation_t *bulk;
+
    bson_return_val_if_fail (collection, NULL);
 
    if (!write_concern) {
@@ -1811,12 +2874,60 @@ mongoc_collection_create_bulk_operation (
     * TODO: where should we discover if we can do new or old style bulk ops?
     */
 
-   return _mongoc_bulk_operation_new (collection->client,
+   bulk = _mongoc_bulk_operation_new (collection->client,
                                       collection->db,
                                       collection->collection,
                                       0,
                                       ordered,
                                       write_concern);
+   bulk->operation_timeout_msec = collection->operation_timeout_msec;
+   bulk->skip_validation = collection->skip_validation;
+
+   return bulk;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_collection_create_bulk_writer --
+ *
+ *       Create a mongoc_bulk_writer_t that sends operations to @collection
+ *       in batches as they are pushed, rather than all at once.
+ *
+ * Returns:
+ *       A newly allocated mongoc_bulk_writer_t that should be freed with
+ *       mongoc_bulk_writer_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_bulk_writer_t *
+mongoc_collection_create_bulk_writer (
+      mongoc_collection_t          *collection,
+      bool                          ordered,
+      const mongoc_write_concern_t *write_concern)
+{
+   mongoc_bulk_writer_t *writer;
+
+   bson_return_val_if_fail (collection, NULL);
+
+   if (!write_concern) {
+      write_concern = collection->write_concern;
+   }
+
+   writer = _mongoc_bulk_writer_new (collection->client,
+                                     collection->db,
+                                     collection->collection,
+                                     ordered,
+                                     write_concern);
+   writer->operation_timeout_msec = collection->operation_timeout_msec;
+   writer->skip_validation = collection->skip_validation;
+
+   return writer;
 }
 
 
@@ -24,11 +24,13 @@
 #include <bson.h>
 
 #include "mongoc-bulk-operation.h"
+#include "mongoc-bulk-writer.h"
 #include "mongoc-flags.h"
 #include "mongoc-cursor.h"
 #include "mongoc-index.h"
 #include "mongoc-read-prefs.h"
 #include "mongoc-write-concern.h"
+#include "mongoc-write-future.h"
 
 
 BSON_BEGIN_DECLS
@@ -71,6 +73,9 @@ int64_t                       mongoc_collection_count_with_opts      (mongoc_col
                                                                       const bson_t                  *opts,
                                                                       const mongoc_read_prefs_t     *read_prefs,
                                                                       bson_error_t                  *error);
+int64_t                       mongoc_collection_estimated_count      (mongoc_collection_t           *collection,
+                                                                      const mongoc_read_prefs_t     *read_prefs,
+                                                                      bson_error_t                  *error);
 bool                          mongoc_collection_drop                 (mongoc_collection_t           *collection,
                                                                       bson_error_t                  *error);
 bool                          mongoc_collection_drop_index           (mongoc_collection_t           *collection,
@@ -80,12 +85,21 @@ bool                          mongoc_collection_create_index         (mongoc_col
                                                                       const bson_t                  *keys,
                                                                       const mongoc_index_opt_t      *opt,
                                                                       bson_error_t                  *error);
+bool                          mongoc_collection_create_indexes       (mongoc_collection_t           *collection,
+                                                                      const bson_t                 **keys,
+                                                                      const mongoc_index_opt_t     **opts,
+                                                                      uint32_t                       n_indexes,
+                                                                      bson_error_t                  *error);
 bool                          mongoc_collection_ensure_index         (mongoc_collection_t           *collection,
                                                                       const bson_t                  *keys,
                                                                       const mongoc_index_opt_t      *opt,
                                                                       bson_error_t                  *error) BSON_GNUC_DEPRECATED_FOR (mongoc_collection_create_index);
 mongoc_cursor_t              *mongoc_collection_find_indexes         (mongoc_collection_t           *collection,
                                                                       bson_error_t                  *error);
+mongoc_cursor_t             **mongoc_collection_parallel_scan        (mongoc_collection_t           *collection,
+                                                                      uint32_t                       num_cursors,
+                                                                      const mongoc_read_prefs_t     *read_prefs,
+                                                                      bson_error_t                  *error);
 mongoc_cursor_t              *mongoc_collection_find                 (mongoc_collection_t           *collection,
                                                                       mongoc_query_flags_t           flags,
                                                                       uint32_t                       skip,
@@ -94,17 +108,45 @@ mongoc_cursor_t              *mongoc_collection_find                 (mongoc_col
                                                                       const bson_t                  *query,
                                                                       const bson_t                  *fields,
                                                                       const mongoc_read_prefs_t     *read_prefs) BSON_GNUC_WARN_UNUSED_RESULT;
+bool                          mongoc_collection_find_many            (mongoc_collection_t           *collection,
+                                                                      mongoc_query_flags_t           flags,
+                                                                      uint32_t                       skip,
+                                                                      uint32_t                       limit,
+                                                                      uint32_t                       batch_size,
+                                                                      const bson_t                 **queries,
+                                                                      uint32_t                       n_queries,
+                                                                      const bson_t                  *fields,
+                                                                      const mongoc_read_prefs_t     *read_prefs,
+                                                                      mongoc_cursor_t              **cursors,
+                                                                      bson_error_t                  *error);
+bool                          mongoc_collection_find_one             (mongoc_collection_t           *collection,
+                                                                      const bson_t                  *query,
+                                                                      const bson_t                  *fields,
+                                                                      const mongoc_read_prefs_t     *read_prefs,
+                                                                      bson_t                        *doc,
+                                                                      bson_error_t                  *error);
 bool                          mongoc_collection_insert               (mongoc_collection_t           *collection,
                                                                       mongoc_insert_flags_t          flags,
                                                                       const bson_t                  *document,
                                                                       const mongoc_write_concern_t  *write_concern,
                                                                       bson_error_t                  *error);
+mongoc_write_future_t        *mongoc_collection_insert_async         (mongoc_collection_t           *collection,
+                                                                      mongoc_insert_flags_t          flags,
+                                                                      const bson_t                  *document,
+                                                                      const mongoc_write_concern_t  *write_concern,
+                                                                      bson_error_t                  *error);
 bool                          mongoc_collection_insert_bulk          (mongoc_collection_t           *collection,
                                                                       mongoc_insert_flags_t          flags,
                                                                       const bson_t                 **documents,
                                                                       uint32_t                       n_documents,
                                                                       const mongoc_write_concern_t  *write_concern,
                                                                       bson_error_t                  *error) BSON_GNUC_DEPRECATED_FOR (mongoc_collection_create_bulk_operation);
+bool                          mongoc_collection_insert_raw           (mongoc_collection_t           *collection,
+                                                                      mongoc_insert_flags_t          flags,
+                                                                      const uint8_t                 *buf,
+                                                                      size_t                         buflen,
+                                                                      const mongoc_write_concern_t  *write_concern,
+                                                                      bson_error_t                  *error);
 bool                          mongoc_collection_update               (mongoc_collection_t           *collection,
                                                                       mongoc_update_flags_t          flags,
                                                                       const bson_t                  *selector,
@@ -147,12 +189,21 @@ bool                          mongoc_collection_stats                (mongoc_col
 mongoc_bulk_operation_t      *mongoc_collection_create_bulk_operation(mongoc_collection_t           *collection,
                                                                       bool                           ordered,
                                                                       const mongoc_write_concern_t  *write_concern) BSON_GNUC_WARN_UNUSED_RESULT;
+mongoc_bulk_writer_t         *mongoc_collection_create_bulk_writer   (mongoc_collection_t           *collection,
+                                                                      bool                           ordered,
+                                                                      const mongoc_write_concern_t  *write_concern) BSON_GNUC_WARN_UNUSED_RESULT;
 const mongoc_read_prefs_t    *mongoc_collection_get_read_prefs       (const mongoc_collection_t     *collection);
 void                          mongoc_collection_set_read_prefs       (mongoc_collection_t           *collection,
                                                                       const mongoc_read_prefs_t     *read_prefs);
 const mongoc_write_concern_t *mongoc_collection_get_write_concern    (const mongoc_collection_t     *collection);
 void                          mongoc_collection_set_write_concern    (mongoc_collection_t           *collection,
                                                                       const mongoc_write_concern_t  *write_concern);
+void                          mongoc_collection_set_operation_timeout(mongoc_collection_t           *collection,
+                                                                      uint32_t                       timeout_msec);
+uint32_t                      mongoc_collection_get_operation_timeout(const mongoc_collection_t     *collection);
+void                          mongoc_collection_set_validate_documents (mongoc_collection_t         *collection,
+                                                                        bool                         validate);
+bool                          mongoc_collection_get_validate_documents (const mongoc_collection_t   *collection);
 const char                   *mongoc_collection_get_name             (mongoc_collection_t           *collection);
 const bson_t                 *mongoc_collection_get_last_error       (const mongoc_collection_t     *collection);
 char                         *mongoc_collection_keys_to_index_string (const bson_t                  *keys);
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_COLUMNS_PRIVATE_H
+#define MONGOC_COLUMNS_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-columns.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * A column of a record batch: the value at @path in each document, where
+ * @path is a dotted path like "a.b". @key_len is the length of its first
+ * key and @rest what follows that key and its dot, or NULL if the path is
+ * a single key.
+ */
+typedef struct
+{
+   char                 *path;
+   size_t                key_len;
+   const char           *rest;
+   mongoc_column_type_t  type;
+} mongoc_column_t;
+
+
+struct _mongoc_columns_t
+{
+   /* of mongoc_column_t */
+   mongoc_array_t columns;
+};
+
+
+bool _mongoc_columns_decode (const mongoc_columns_t *columns,
+                             const uint8_t          *data,
+                             uint32_t                data_len,
+                             uint32_t                n_docs,
+                             struct ArrowArray      *batch,
+                             bson_error_t           *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_COLUMNS_PRIVATE_H */
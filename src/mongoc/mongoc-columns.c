@@ -0,0 +1,699 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-columns.h"
+#include "mongoc-columns-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-error.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "columns"
+
+
+/*
+ * A record batch is a struct array with a child array per column. The
+ * parent owns the children, and its release callback releases them.
+ */
+typedef struct
+{
+   struct ArrowArray  *arrays;
+   struct ArrowArray **children;
+   const void         *buffers [1];
+} mongoc_columns_batch_t;
+
+
+typedef struct
+{
+   struct ArrowSchema  *schemas;
+   struct ArrowSchema **children;
+} mongoc_columns_schema_t;
+
+
+/*
+ * The buffers of a column while a batch is decoded: the validity bitmap,
+ * the values, one bit per row for booleans and fixed width otherwise,
+ * and for strings the offsets of each row in @values.
+ */
+typedef struct
+{
+   uint8_t *validity;
+   uint8_t *values;
+   int32_t *offsets;
+   size_t   values_len;
+   size_t   values_alloc;
+   int64_t  n_valid;
+} mongoc_column_buffers_t;
+
+
+static const char *
+_mongoc_column_format (mongoc_column_type_t type)
+{
+   switch (type) {
+   case MONGOC_COLUMN_BOOL:
+      return "b";
+   case MONGOC_COLUMN_INT32:
+      return "i";
+   case MONGOC_COLUMN_INT64:
+      return "l";
+   case MONGOC_COLUMN_DOUBLE:
+      return "g";
+   case MONGOC_COLUMN_UTF8:
+      return "u";
+   case MONGOC_COLUMN_DATE_TIME:
+      /* BSON dates are milliseconds since the epoch, in UTC */
+      return "tsm:UTC";
+   case MONGOC_COLUMN_OID:
+      return "w:12";
+   default:
+      BSON_ASSERT (false);
+      return NULL;
+   }
+}
+
+
+/* the width of a value, 0 for the bits of a boolean column */
+static size_t
+_mongoc_column_width (mongoc_column_type_t type)
+{
+   switch (type) {
+   case MONGOC_COLUMN_BOOL:
+      return 0;
+   case MONGOC_COLUMN_INT32:
+      return 4;
+   case MONGOC_COLUMN_OID:
+      return 12;
+   case MONGOC_COLUMN_UTF8:
+      return 1;
+   case MONGOC_COLUMN_INT64:
+   case MONGOC_COLUMN_DOUBLE:
+   case MONGOC_COLUMN_DATE_TIME:
+   default:
+      return 8;
+   }
+}
+
+
+mongoc_columns_t *
+mongoc_columns_new (void)
+{
+   mongoc_columns_t *columns;
+
+   columns = bson_malloc0 (sizeof *columns);
+   _mongoc_array_init (&columns->columns, sizeof (mongoc_column_t));
+
+   return columns;
+}
+
+
+void
+mongoc_columns_destroy (mongoc_columns_t *columns)
+{
+   size_t i;
+
+   if (columns) {
+      for (i = 0; i < columns->columns.len; i++) {
+         bson_free (_mongoc_array_index (&columns->columns,
+                                         mongoc_column_t, i).path);
+      }
+
+      _mongoc_array_destroy (&columns->columns);
+      bson_free (columns);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_columns_add --
+ *
+ *       Add a column of @type holding the value at @path, a key or a
+ *       dotted path such as "a.b", of each document. The column is named
+ *       after @path.
+ *
+ * Returns:
+ *       true if the column was added, false if @path is empty, has an
+ *       empty key or is already a column.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_columns_add (mongoc_columns_t     *columns, /* IN */
+                    const char           *path,    /* IN */
+                    mongoc_column_type_t  type)    /* IN */
+{
+   mongoc_column_t column;
+   const char *dot;
+   size_t len;
+   size_t i;
+
+   BSON_ASSERT (columns);
+   BSON_ASSERT (path);
+
+   len = strlen (path);
+
+   if (!len || path [0] == '.' || path [len - 1] == '.' || strstr (path, "..")) {
+      return false;
+   }
+
+   if (type < MONGOC_COLUMN_BOOL || type > MONGOC_COLUMN_OID) {
+      return false;
+   }
+
+   for (i = 0; i < columns->columns.len; i++) {
+      if (!strcmp (_mongoc_array_index (&columns->columns,
+                                        mongoc_column_t, i).path, path)) {
+         return false;
+      }
+   }
+
+   column.path = bson_strdup (path);
+   column.type = type;
+
+   if ((dot = strchr (column.path, '.'))) {
+      column.key_len = (size_t)(dot - column.path);
+      column.rest = dot + 1;
+   } else {
+      column.key_len = len;
+      column.rest = NULL;
+   }
+
+   _mongoc_array_append_val (&columns->columns, column);
+
+   return true;
+}
+
+
+/*
+ * Children have release callbacks of their own, so that a consumer may
+ * move one out of its parent. The parent releases those that were not.
+ */
+static void
+_mongoc_columns_child_schema_release (struct ArrowSchema *schema)
+{
+   bson_free ((char *)schema->name);
+   schema->release = NULL;
+}
+
+
+static void
+_mongoc_columns_schema_release (struct ArrowSchema *schema)
+{
+   mongoc_columns_schema_t *priv = schema->private_data;
+   int64_t i;
+
+   for (i = 0; i < schema->n_children; i++) {
+      if (priv->schemas [i].release) {
+         priv->schemas [i].release (&priv->schemas [i]);
+      }
+   }
+
+   bson_free (priv->schemas);
+   bson_free (priv->children);
+   bson_free (priv);
+
+   schema->release = NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_columns_get_schema --
+ *
+ *       Describe the record batches of @columns in @schema, a struct of
+ *       a nullable field per column.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @schema is initialized and must be released by calling its
+ *       release callback.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_columns_get_schema (const mongoc_columns_t *columns, /* IN */
+                           struct ArrowSchema     *schema)  /* OUT */
+{
+   mongoc_columns_schema_t *priv;
+   const mongoc_column_t *column;
+   size_t n;
+   size_t i;
+
+   BSON_ASSERT (columns);
+   BSON_ASSERT (schema);
+
+   n = columns->columns.len;
+
+   priv = bson_malloc0 (sizeof *priv);
+   priv->schemas = bson_malloc0 (BSON_MAX (n, 1) * sizeof *priv->schemas);
+   priv->children = bson_malloc0 (BSON_MAX (n, 1) * sizeof *priv->children);
+
+   for (i = 0; i < n; i++) {
+      column = &_mongoc_array_index (&columns->columns, mongoc_column_t, i);
+
+      priv->schemas [i].format = _mongoc_column_format (column->type);
+      priv->schemas [i].name = bson_strdup (column->path);
+      priv->schemas [i].flags = ARROW_FLAG_NULLABLE;
+      priv->schemas [i].release = _mongoc_columns_child_schema_release;
+      priv->children [i] = &priv->schemas [i];
+   }
+
+   memset (schema, 0, sizeof *schema);
+   schema->format = "+s";
+   schema->name = "";
+   schema->n_children = (int64_t)n;
+   schema->children = priv->children;
+   schema->release = _mongoc_columns_schema_release;
+   schema->private_data = priv;
+}
+
+
+static void
+_mongoc_columns_child_release (struct ArrowArray *array)
+{
+   int64_t i;
+
+   for (i = 0; i < array->n_buffers; i++) {
+      bson_free ((void *)array->buffers [i]);
+   }
+
+   bson_free (array->buffers);
+   array->release = NULL;
+}
+
+
+static void
+_mongoc_columns_batch_release (struct ArrowArray *batch)
+{
+   mongoc_columns_batch_t *priv = batch->private_data;
+   int64_t i;
+
+   for (i = 0; i < batch->n_children; i++) {
+      if (priv->arrays [i].release) {
+         priv->arrays [i].release (&priv->arrays [i]);
+      }
+   }
+
+   bson_free (priv->arrays);
+   bson_free (priv->children);
+   bson_free (priv);
+
+   batch->release = NULL;
+}
+
+
+static void
+_mongoc_column_reserve (mongoc_column_buffers_t *buf,
+                        size_t                   len)
+{
+   if (buf->values_len + len > buf->values_alloc) {
+      buf->values_alloc = BSON_MAX (buf->values_alloc * 2,
+                                    buf->values_len + len);
+      buf->values = bson_realloc (buf->values, buf->values_alloc);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_column_set --
+ *
+ *       Store the value at @iter as row @row of @buf. An int32 is widened
+ *       for an int64 or double column, and an int64 for a double column;
+ *       a value of any other type leaves the row null.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_column_set (const mongoc_column_t   *column,
+                    mongoc_column_buffers_t *buf,
+                    uint32_t                 row,
+                    const bson_iter_t       *iter)
+{
+   bson_type_t type = bson_iter_type (iter);
+   const bson_oid_t *oid;
+   const char *str;
+   uint32_t len;
+   int32_t i32;
+   int64_t i64;
+   double d;
+
+   switch (column->type) {
+   case MONGOC_COLUMN_BOOL:
+      if (type != BSON_TYPE_BOOL) {
+         return;
+      }
+
+      if (bson_iter_bool (iter)) {
+         buf->values [row >> 3] |= (uint8_t)(1 << (row & 7));
+      }
+      break;
+   case MONGOC_COLUMN_INT32:
+      if (type != BSON_TYPE_INT32) {
+         return;
+      }
+
+      i32 = bson_iter_int32 (iter);
+      memcpy (buf->values + (size_t)row * 4, &i32, 4);
+      break;
+   case MONGOC_COLUMN_INT64:
+   case MONGOC_COLUMN_DATE_TIME:
+      if (column->type == MONGOC_COLUMN_DATE_TIME) {
+         if (type != BSON_TYPE_DATE_TIME) {
+            return;
+         }
+
+         i64 = bson_iter_date_time (iter);
+      } else if (type == BSON_TYPE_INT64) {
+         i64 = bson_iter_int64 (iter);
+      } else if (type == BSON_TYPE_INT32) {
+         i64 = bson_iter_int32 (iter);
+      } else {
+         return;
+      }
+
+      memcpy (buf->values + (size_t)row * 8, &i64, 8);
+      break;
+   case MONGOC_COLUMN_DOUBLE:
+      if (type == BSON_TYPE_DOUBLE) {
+         d = bson_iter_double (iter);
+      } else if (type == BSON_TYPE_INT32) {
+         d = bson_iter_int32 (iter);
+      } else if (type == BSON_TYPE_INT64) {
+         d = (double)bson_iter_int64 (iter);
+      } else {
+         return;
+      }
+
+      memcpy (buf->values + (size_t)row * 8, &d, 8);
+      break;
+   case MONGOC_COLUMN_UTF8:
+      if (type != BSON_TYPE_UTF8) {
+         return;
+      }
+
+      str = bson_iter_utf8 (iter, &len);
+      _mongoc_column_reserve (buf, len);
+      memcpy (buf->values + buf->values_len, str, len);
+      buf->values_len += len;
+      break;
+   case MONGOC_COLUMN_OID:
+      if (type != BSON_TYPE_OID) {
+         return;
+      }
+
+      oid = bson_iter_oid (iter);
+      memcpy (buf->values + (size_t)row * 12, oid->bytes, 12);
+      break;
+   default:
+      BSON_ASSERT (false);
+      return;
+   }
+
+   buf->validity [row >> 3] |= (uint8_t)(1 << (row & 7));
+   buf->n_valid++;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_columns_decode --
+ *
+ *       Decode the @n_docs documents laid out back to back in the
+ *       @data_len bytes at @data into a record batch of @columns.
+ *
+ *       Each document is walked once: its top-level keys are matched
+ *       against the first key of every column, and only the columns with
+ *       a dotted path descend into the matching subdocument. The first
+ *       value found for a column wins. A missing value, or one of a type
+ *       the column does not take, is null.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       On success @batch is initialized and must be released by calling
+ *       its release callback.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_columns_decode (const mongoc_columns_t *columns,  /* IN */
+                        const uint8_t          *data,     /* IN */
+                        uint32_t                data_len, /* IN */
+                        uint32_t                n_docs,   /* IN */
+                        struct ArrowArray      *batch,    /* OUT */
+                        bson_error_t           *error)    /* OUT */
+{
+   mongoc_column_buffers_t *bufs;
+   const mongoc_column_t *column;
+   mongoc_columns_batch_t *priv;
+   struct ArrowArray *child;
+   bson_iter_t iter;
+   bson_iter_t sub;
+   bson_iter_t desc;
+   const char *key;
+   size_t bitmap_len = ((size_t)n_docs + 7) / 8;
+   size_t n;
+   size_t n_seen;
+   uint8_t *seen;
+   uint32_t off = 0;
+   uint32_t len;
+   uint32_t row;
+   size_t i;
+   bson_t doc;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (columns);
+   BSON_ASSERT (batch);
+
+   n = columns->columns.len;
+   bufs = bson_malloc0 (BSON_MAX (n, 1) * sizeof *bufs);
+   seen = bson_malloc (BSON_MAX (n, 1));
+
+   for (i = 0; i < n; i++) {
+      column = &_mongoc_array_index (&columns->columns, mongoc_column_t, i);
+
+      bufs [i].validity = bson_malloc0 (BSON_MAX (bitmap_len, 1));
+
+      if (column->type == MONGOC_COLUMN_UTF8) {
+         bufs [i].offsets = bson_malloc0 (((size_t)n_docs + 1) * 4);
+         bufs [i].values_alloc = 1;
+      } else if (column->type == MONGOC_COLUMN_BOOL) {
+         bufs [i].values_alloc = BSON_MAX (bitmap_len, 1);
+      } else {
+         bufs [i].values_alloc =
+            BSON_MAX ((size_t)n_docs * _mongoc_column_width (column->type), 1);
+      }
+
+      bufs [i].values = bson_malloc0 (bufs [i].values_alloc);
+   }
+
+   for (row = 0; row < n_docs; row++, off += len) {
+      if ((data_len - off) < 5) {
+         GOTO (corrupt);
+      }
+
+      memcpy (&len, data + off, 4);
+      len = BSON_UINT32_FROM_LE (len);
+
+      if (len < 5 || len > (data_len - off) ||
+          !bson_init_static (&doc, data + off, len) ||
+          !bson_iter_init (&iter, &doc)) {
+         GOTO (corrupt);
+      }
+
+      memset (seen, 0, BSON_MAX (n, 1));
+      n_seen = 0;
+
+      while (n_seen < n && bson_iter_next (&iter)) {
+         key = bson_iter_key (&iter);
+
+         for (i = 0; i < n; i++) {
+            column = &_mongoc_array_index (&columns->columns,
+                                           mongoc_column_t, i);
+
+            if (seen [i] ||
+                strncmp (key, column->path, column->key_len) ||
+                key [column->key_len]) {
+               continue;
+            }
+
+            seen [i] = 1;
+            n_seen++;
+
+            if (!column->rest) {
+               _mongoc_column_set (column, &bufs [i], row, &iter);
+            } else if ((BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+                        BSON_ITER_HOLDS_ARRAY (&iter)) &&
+                       bson_iter_recurse (&iter, &sub) &&
+                       bson_iter_find_descendant (&sub, column->rest,
+                                                  &desc)) {
+               _mongoc_column_set (column, &bufs [i], row, &desc);
+            }
+         }
+      }
+
+      for (i = 0; i < n; i++) {
+         if (bufs [i].offsets) {
+            if (bufs [i].values_len > INT32_MAX) {
+               bson_set_error (error,
+                               MONGOC_ERROR_CURSOR,
+                               MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                               "The strings of column \"%s\" exceed 2GB.",
+                               _mongoc_array_index (&columns->columns,
+                                                    mongoc_column_t, i).path);
+               GOTO (cleanup);
+            }
+
+            bufs [i].offsets [row + 1] = (int32_t)bufs [i].values_len;
+         }
+      }
+   }
+
+   priv = bson_malloc0 (sizeof *priv);
+   priv->arrays = bson_malloc0 (BSON_MAX (n, 1) * sizeof *priv->arrays);
+   priv->children = bson_malloc0 (BSON_MAX (n, 1) * sizeof *priv->children);
+
+   for (i = 0; i < n; i++) {
+      child = &priv->arrays [i];
+      child->length = n_docs;
+      child->null_count = n_docs - bufs [i].n_valid;
+      child->buffers = bson_malloc0 (3 * sizeof (void *));
+      child->buffers [0] = bufs [i].validity;
+
+      if (bufs [i].offsets) {
+         child->n_buffers = 3;
+         child->buffers [1] = bufs [i].offsets;
+         child->buffers [2] = bufs [i].values;
+      } else {
+         child->n_buffers = 2;
+         child->buffers [1] = bufs [i].values;
+      }
+
+      child->release = _mongoc_columns_child_release;
+      priv->children [i] = child;
+
+      bufs [i].validity = NULL;
+      bufs [i].offsets = NULL;
+      bufs [i].values = NULL;
+   }
+
+   memset (batch, 0, sizeof *batch);
+   batch->length = n_docs;
+   batch->n_buffers = 1;
+   batch->buffers = priv->buffers;
+   batch->n_children = (int64_t)n;
+   batch->children = priv->children;
+   batch->release = _mongoc_columns_batch_release;
+   batch->private_data = priv;
+
+   ret = true;
+   GOTO (cleanup);
+
+corrupt:
+   bson_set_error (error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "Document %u of the batch is corrupt.", row);
+
+cleanup:
+   for (i = 0; i < n; i++) {
+      bson_free (bufs [i].validity);
+      bson_free (bufs [i].offsets);
+      bson_free (bufs [i].values);
+   }
+
+   bson_free (bufs);
+   bson_free (seen);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_next_columns --
+ *
+ *       Fetch the next batch of @cursor, as mongoc_cursor_next_batch()
+ *       does, and decode it straight from the server's reply into a
+ *       record batch of @columns.
+ *
+ * Returns:
+ *       true if a batch was decoded; otherwise false, in which case
+ *       mongoc_cursor_error() should be checked.
+ *
+ * Side effects:
+ *       On success @batch is initialized and must be released by calling
+ *       its release callback. It does not refer to the cursor and may be
+ *       kept after it is destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_next_columns (mongoc_cursor_t        *cursor,  /* IN */
+                            const mongoc_columns_t *columns, /* IN */
+                            struct ArrowArray      *batch)   /* OUT */
+{
+   const uint8_t *data;
+   uint32_t data_len;
+   uint32_t n_docs;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (columns);
+   BSON_ASSERT (batch);
+
+   if (!mongoc_cursor_next_batch (cursor, &data, &data_len, &n_docs, NULL)) {
+      RETURN (false);
+   }
+
+   if (!_mongoc_columns_decode (columns, data, data_len, n_docs, batch,
+                                &cursor->error)) {
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
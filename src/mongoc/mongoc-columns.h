@@ -0,0 +1,104 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_COLUMNS_H
+#define MONGOC_COLUMNS_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-cursor.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The structures of the Apache Arrow C data interface, as given by its
+ * specification. They are shared by every library that implements it, so
+ * they are only defined if nothing else did.
+ */
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema
+{
+   const char          *format;
+   const char          *name;
+   const char          *metadata;
+   int64_t              flags;
+   int64_t              n_children;
+   struct ArrowSchema **children;
+   struct ArrowSchema  *dictionary;
+   void               (*release) (struct ArrowSchema *);
+   void                *private_data;
+};
+
+struct ArrowArray
+{
+   int64_t              length;
+   int64_t              null_count;
+   int64_t              offset;
+   int64_t              n_buffers;
+   int64_t              n_children;
+   const void         **buffers;
+   struct ArrowArray  **children;
+   struct ArrowArray   *dictionary;
+   void               (*release) (struct ArrowArray *);
+   void                *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+
+typedef enum
+{
+   MONGOC_COLUMN_BOOL,
+   MONGOC_COLUMN_INT32,
+   MONGOC_COLUMN_INT64,
+   MONGOC_COLUMN_DOUBLE,
+   MONGOC_COLUMN_UTF8,
+   MONGOC_COLUMN_DATE_TIME,
+   MONGOC_COLUMN_OID,
+} mongoc_column_type_t;
+
+
+typedef struct _mongoc_columns_t mongoc_columns_t;
+
+
+mongoc_columns_t *mongoc_columns_new         (void);
+void              mongoc_columns_destroy     (mongoc_columns_t         *columns);
+bool              mongoc_columns_add         (mongoc_columns_t         *columns,
+                                              const char               *path,
+                                              mongoc_column_type_t      type);
+void              mongoc_columns_get_schema  (const mongoc_columns_t   *columns,
+                                              struct ArrowSchema       *schema);
+bool              mongoc_cursor_next_columns (mongoc_cursor_t          *cursor,
+                                              const mongoc_columns_t   *columns,
+                                              struct ArrowArray        *batch);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_COLUMNS_H */
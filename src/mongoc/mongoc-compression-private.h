@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_COMPRESSION_PRIVATE_H
+#define MONGOC_COMPRESSION_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-buffer-private.h"
+#include "mongoc-iovec.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#define MONGOC_COMPRESSOR_NONE_ID   -1
+#define MONGOC_COMPRESSOR_NOOP_ID    0
+#define MONGOC_COMPRESSOR_SNAPPY_ID  1
+#define MONGOC_COMPRESSOR_ZLIB_ID    2
+
+
+/*
+ * An OP_COMPRESSED message is the standard message header followed by
+ * the original opcode, the uncompressed size of everything after the
+ * original header, and the id of the compressor.
+ */
+#define MONGOC_COMPRESSED_HEADER_LEN 25
+
+
+int32_t     _mongoc_compressor_name_to_id (const char           *name);
+const char *_mongoc_compressor_id_to_name (int32_t               compressor_id);
+bool        _mongoc_compress_messages     (int32_t               compressor_id,
+                                           int32_t               level,
+                                           const mongoc_iovec_t *iov,
+                                           size_t                iovcnt,
+                                           mongoc_buffer_t      *scratch,
+                                           mongoc_buffer_t      *out);
+bool        _mongoc_uncompress_message    (mongoc_buffer_t      *buffer,
+                                           off_t                 pos,
+                                           const uint8_t        *data,
+                                           size_t                data_len,
+                                           int32_t               max_msg_size,
+                                           int32_t              *msg_len);
+bool        _mongoc_compress              (int32_t               compressor_id,
+                                           int32_t               level,
+                                           const uint8_t        *data,
+                                           size_t                len,
+                                           mongoc_buffer_t      *out);
+bool        _mongoc_uncompress            (int32_t               compressor_id,
+                                           const uint8_t        *data,
+                                           size_t                len,
+                                           uint8_t              *out,
+                                           size_t               *out_len);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_COMPRESSION_PRIVATE_H */
@@ -0,0 +1,570 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-compression-private.h"
+#include "mongoc-config.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-log.h"
+#include "mongoc-opcode.h"
+#include "mongoc-trace.h"
+
+#ifdef MONGOC_ENABLE_ZLIB
+# include <zlib.h>
+#endif
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "compression"
+
+
+#ifdef _WIN32
+# define strcasecmp _stricmp
+#endif
+
+
+/*
+ * Commands that must never be compressed, since they either negotiate
+ * compression or carry credentials.
+ */
+static const char *gUncompressibleCommands[] = {
+   "authenticate",
+   "copydb",
+   "copydbgetnonce",
+   "copydbsaslstart",
+   "createuser",
+   "getnonce",
+   "ismaster",
+   "saslcontinue",
+   "saslstart",
+   "updateuser",
+   NULL
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_compressor_name_to_id --
+ *
+ *       Look up the wire protocol id of the compressor called @name.
+ *
+ * Returns:
+ *       The compressor id, or MONGOC_COMPRESSOR_NONE_ID if @name is not
+ *       a compressor supported by this build.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int32_t
+_mongoc_compressor_name_to_id (const char *name)
+{
+   bson_return_val_if_fail (name, MONGOC_COMPRESSOR_NONE_ID);
+
+#ifdef MONGOC_ENABLE_ZLIB
+   if (!strcasecmp (name, "zlib")) {
+      return MONGOC_COMPRESSOR_ZLIB_ID;
+   }
+#endif
+
+   return MONGOC_COMPRESSOR_NONE_ID;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_compressor_id_to_name --
+ *
+ *       Look up the name of the compressor @compressor_id, as sent in
+ *       the "compression" field of "isMaster".
+ *
+ * Returns:
+ *       A static string, or NULL if @compressor_id is unknown.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const char *
+_mongoc_compressor_id_to_name (int32_t compressor_id)
+{
+   switch (compressor_id) {
+   case MONGOC_COMPRESSOR_NOOP_ID:
+      return "noop";
+   case MONGOC_COMPRESSOR_SNAPPY_ID:
+      return "snappy";
+   case MONGOC_COMPRESSOR_ZLIB_ID:
+      return "zlib";
+   default:
+      return NULL;
+   }
+}
+
+
+#ifdef MONGOC_ENABLE_ZLIB
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_message_is_compressible --
+ *
+ *       Check whether the little-endian message @msg may be sent as
+ *       OP_COMPRESSED. Everything can be, except for the commands in
+ *       gUncompressibleCommands, which are looked for in OP_QUERY
+ *       messages on a "$cmd" namespace, unwrapping "$query" if needed.
+ *
+ * Returns:
+ *       true if @msg may be compressed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_message_is_compressible (const uint8_t *msg,
+                                 size_t         msg_len)
+{
+   const uint8_t *ns;
+   const uint8_t *end;
+   const char *name;
+   bson_iter_t iter;
+   bson_iter_t child;
+   int32_t opcode;
+   int32_t doc_len;
+   size_t ns_len;
+   bson_t doc;
+   int i;
+
+   memcpy (&opcode, msg + 12, 4);
+   opcode = BSON_UINT32_FROM_LE (opcode);
+
+   if (opcode != MONGOC_OPCODE_QUERY) {
+      return true;
+   }
+
+   /* The namespace follows the header and the query flags. */
+   if (msg_len <= 20) {
+      return false;
+   }
+
+   ns = msg + 20;
+   if (!(end = memchr (ns, '\0', msg_len - 20))) {
+      return false;
+   }
+
+   ns_len = end - ns;
+   if ((ns_len < 5) || memcmp (end - 5, ".$cmd", 5)) {
+      return true;
+   }
+
+   /* Skip the terminator, numberToSkip and numberToReturn. */
+   end += 9;
+   if ((end + 4) > (msg + msg_len)) {
+      return false;
+   }
+
+   memcpy (&doc_len, end, 4);
+   doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+   if ((doc_len < 5) || ((end + doc_len) > (msg + msg_len)) ||
+       !bson_init_static (&doc, end, doc_len) ||
+       !bson_iter_init (&iter, &doc) ||
+       !bson_iter_next (&iter)) {
+      return false;
+   }
+
+   name = bson_iter_key (&iter);
+
+   if (!strcmp (name, "$query")) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+          !bson_iter_recurse (&iter, &child) ||
+          !bson_iter_next (&child)) {
+         return false;
+      }
+      name = bson_iter_key (&child);
+   }
+
+   for (i = 0; gUncompressibleCommands[i]; i++) {
+      if (!strcasecmp (name, gUncompressibleCommands[i])) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_compress_message --
+ *
+ *       Append @msg to @out as an OP_COMPRESSED message, unless that
+ *       would not make it any smaller.
+ *
+ * Returns:
+ *       true if @msg was compressed, otherwise false and nothing was
+ *       appended.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_compress_message (int32_t          compressor_id,
+                          int32_t          level,
+                          const uint8_t   *msg,
+                          size_t           msg_len,
+                          mongoc_buffer_t *out)
+{
+   uLongf compressed_len;
+   uint8_t *dst;
+   int32_t v32;
+
+   BSON_ASSERT (compressor_id == MONGOC_COMPRESSOR_ZLIB_ID);
+
+   compressed_len = compressBound (msg_len - 16);
+
+   _mongoc_buffer_reserve (out, MONGOC_COMPRESSED_HEADER_LEN + compressed_len);
+   dst = out->data + out->off + out->len;
+
+   if ((Z_OK != compress2 (dst + MONGOC_COMPRESSED_HEADER_LEN,
+                           &compressed_len, msg + 16, msg_len - 16, level)) ||
+       ((MONGOC_COMPRESSED_HEADER_LEN + compressed_len) >= msg_len)) {
+      return false;
+   }
+
+   v32 = BSON_UINT32_TO_LE (MONGOC_COMPRESSED_HEADER_LEN + compressed_len);
+   memcpy (dst, &v32, 4);
+   memcpy (dst + 4, msg + 4, 8); /* requestID, responseTo */
+   v32 = BSON_UINT32_TO_LE (MONGOC_OPCODE_COMPRESSED);
+   memcpy (dst + 12, &v32, 4);
+   memcpy (dst + 16, msg + 12, 4); /* originalOpcode */
+   v32 = BSON_UINT32_TO_LE (msg_len - 16);
+   memcpy (dst + 20, &v32, 4);
+   dst[24] = (uint8_t)compressor_id;
+
+   out->len += MONGOC_COMPRESSED_HEADER_LEN + compressed_len;
+
+   mongoc_counter_protocol_egress_saved_add (
+      msg_len - (MONGOC_COMPRESSED_HEADER_LEN + compressed_len));
+
+   return true;
+}
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_compress_messages --
+ *
+ *       Compress the little-endian messages gathered into @iov with
+ *       @compressor_id at @level. Messages that cannot be compressed, or
+ *       would not get any smaller, are passed through unchanged.
+ *
+ *       @scratch is used to flatten @iov. Both it and @out are reused
+ *       between calls so that they only allocate when they must grow.
+ *
+ * Returns:
+ *       true and the messages to send are in @out, otherwise false if
+ *       @iov does not hold whole messages or @compressor_id is not
+ *       supported.
+ *
+ * Side effects:
+ *       @scratch and @out are cleared first.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_compress_messages (int32_t               compressor_id,
+                           int32_t               level,
+                           const mongoc_iovec_t *iov,
+                           size_t                iovcnt,
+                           mongoc_buffer_t      *scratch,
+                           mongoc_buffer_t      *out)
+{
+#ifdef MONGOC_ENABLE_ZLIB
+   const uint8_t *msg;
+   int32_t msg_len;
+   size_t off = 0;
+   size_t i;
+#endif
+
+   ENTRY;
+
+   bson_return_val_if_fail (iov, false);
+   bson_return_val_if_fail (scratch, false);
+   bson_return_val_if_fail (out, false);
+
+#ifndef MONGOC_ENABLE_ZLIB
+   RETURN (false);
+#else
+   if (compressor_id != MONGOC_COMPRESSOR_ZLIB_ID) {
+      RETURN (false);
+   }
+
+   _mongoc_buffer_clear (scratch, false);
+   _mongoc_buffer_clear (out, false);
+   _mongoc_buffer_shrink (scratch);
+   _mongoc_buffer_shrink (out);
+
+   for (i = 0; i < iovcnt; i++) {
+      _mongoc_buffer_append (scratch, iov[i].iov_base, iov[i].iov_len);
+   }
+
+   while (off < scratch->len) {
+      msg = scratch->data + scratch->off + off;
+
+      if ((scratch->len - off) < 16) {
+         RETURN (false);
+      }
+
+      memcpy (&msg_len, msg, 4);
+      msg_len = BSON_UINT32_FROM_LE (msg_len);
+
+      if ((msg_len < 16) || ((size_t)msg_len > (scratch->len - off))) {
+         RETURN (false);
+      }
+
+      if (!_mongoc_message_is_compressible (msg, msg_len) ||
+          !_mongoc_compress_message (compressor_id, level, msg, msg_len,
+                                     out)) {
+         _mongoc_buffer_append (out, msg, msg_len);
+      }
+
+      off += msg_len;
+   }
+
+   RETURN (true);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_uncompress_message --
+ *
+ *       Expand an OP_COMPRESSED message in place. @buffer holds its
+ *       16-byte header at @pos and nothing after it, and @data holds the
+ *       @data_len bytes that followed the header on the wire.
+ *
+ *       The original message is appended to @buffer and its header is
+ *       rewritten, so that @buffer looks as if the message had been sent
+ *       uncompressed.
+ *
+ * Returns:
+ *       true and @msg_len is set to the length of the original message,
+ *       otherwise false if the message is corrupt, too large, or uses a
+ *       compressor that is not supported.
+ *
+ * Side effects:
+ *       @buffer may be grown.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_uncompress_message (mongoc_buffer_t *buffer,
+                            off_t            pos,
+                            const uint8_t   *data,
+                            size_t           data_len,
+                            int32_t          max_msg_size,
+                            int32_t         *msg_len)
+{
+#ifdef MONGOC_ENABLE_ZLIB
+   uLongf uncompressed_len;
+   uint8_t *header;
+   int32_t original_opcode;
+   int32_t size;
+   int32_t v32;
+#endif
+
+   ENTRY;
+
+   bson_return_val_if_fail (buffer, false);
+   bson_return_val_if_fail (data, false);
+   bson_return_val_if_fail (msg_len, false);
+
+#ifndef MONGOC_ENABLE_ZLIB
+   RETURN (false);
+#else
+   if ((data_len < (MONGOC_COMPRESSED_HEADER_LEN - 16)) ||
+       (data[8] != MONGOC_COMPRESSOR_ZLIB_ID)) {
+      RETURN (false);
+   }
+
+   memcpy (&original_opcode, data, 4);
+   memcpy (&size, data + 4, 4);
+   size = BSON_UINT32_FROM_LE (size);
+
+   if ((size < 0) || (size > (max_msg_size - 16))) {
+      RETURN (false);
+   }
+
+   _mongoc_buffer_reserve (buffer, size);
+
+   uncompressed_len = size;
+
+   if ((Z_OK != uncompress (buffer->data + buffer->off + buffer->len,
+                            &uncompressed_len,
+                            data + (MONGOC_COMPRESSED_HEADER_LEN - 16),
+                            data_len - (MONGOC_COMPRESSED_HEADER_LEN - 16))) ||
+       (uncompressed_len != (uLongf)size)) {
+      RETURN (false);
+   }
+
+   buffer->len += size;
+
+   header = buffer->data + buffer->off + pos;
+   v32 = BSON_UINT32_TO_LE (16 + size);
+   memcpy (header, &v32, 4);
+   memcpy (header + 12, &original_opcode, 4);
+
+   *msg_len = 16 + size;
+
+   mongoc_counter_protocol_ingress_saved_add (size - (int32_t)data_len);
+
+   RETURN (true);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_compress --
+ *
+ *       Compress the @len bytes at @data with @compressor_id at @level,
+ *       outside of any message, as GridFS chunks are.
+ *
+ * Returns:
+ *       true and the compressed bytes are in @out, otherwise false if
+ *       @compressor_id is not supported or compression failed.
+ *
+ * Side effects:
+ *       @out is cleared first.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_compress (int32_t          compressor_id,
+                  int32_t          level,
+                  const uint8_t   *data,
+                  size_t           len,
+                  mongoc_buffer_t *out)
+{
+#ifdef MONGOC_ENABLE_ZLIB
+   uLongf compressed_len;
+#endif
+
+   ENTRY;
+
+   bson_return_val_if_fail (data || !len, false);
+   bson_return_val_if_fail (out, false);
+
+#ifndef MONGOC_ENABLE_ZLIB
+   RETURN (false);
+#else
+   if (compressor_id != MONGOC_COMPRESSOR_ZLIB_ID) {
+      RETURN (false);
+   }
+
+   _mongoc_buffer_clear (out, false);
+
+   compressed_len = compressBound (len);
+   _mongoc_buffer_reserve (out, compressed_len);
+
+   if (Z_OK != compress2 (out->data + out->off, &compressed_len,
+                          data, len, level)) {
+      RETURN (false);
+   }
+
+   out->len = compressed_len;
+
+   RETURN (true);
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_uncompress --
+ *
+ *       Expand the @len bytes at @data, compressed by _mongoc_compress()
+ *       with @compressor_id, into the *@out_len bytes at @out.
+ *
+ * Returns:
+ *       true and *@out_len is set to the uncompressed length, otherwise
+ *       false if the data is corrupt, does not fit @out, or uses a
+ *       compressor that is not supported.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_uncompress (int32_t        compressor_id,
+                    const uint8_t *data,
+                    size_t         len,
+                    uint8_t       *out,
+                    size_t        *out_len)
+{
+#ifdef MONGOC_ENABLE_ZLIB
+   uLongf uncompressed_len;
+#endif
+
+   ENTRY;
+
+   bson_return_val_if_fail (data || !len, false);
+   bson_return_val_if_fail (out, false);
+   bson_return_val_if_fail (out_len, false);
+
+#ifndef MONGOC_ENABLE_ZLIB
+   RETURN (false);
+#else
+   if (compressor_id != MONGOC_COMPRESSOR_ZLIB_ID) {
+      RETURN (false);
+   }
+
+   uncompressed_len = *out_len;
+
+   if (Z_OK != uncompress (out, &uncompressed_len, data, len)) {
+      RETURN (false);
+   }
+
+   *out_len = uncompressed_len;
+
+   RETURN (true);
+#endif
+}
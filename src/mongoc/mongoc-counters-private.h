@@ -84,6 +84,30 @@ _mongoc_get_cpu_count (void)
    bson_atomic_int64_add(&(v), (count))
 
 
+/*
+ * The slot of the calling thread when the CPU it runs on can't be had
+ * cheaply: threads are given slots in turn on first use, so that they
+ * don't all share the slot of CPU 0.
+ */
+unsigned _mongoc_counters_thread_slot (void);
+
+
+/*
+ * With glibc 2.35 or newer every thread is registered for restartable
+ * sequences, and the kernel keeps the CPU the thread runs on in its rseq
+ * area, which is a plain load away instead of a call to sched_getcpu().
+ */
+#if defined(__linux__) && defined(HAVE_SYS_RSEQ_H) && defined(__GNUC__)
+# if defined(__has_builtin)
+#  if __has_builtin(__builtin_thread_pointer)
+#   define MONGOC_HAVE_RSEQ_CPU_ID 1
+#  endif
+# elif !defined(__clang__) && (__GNUC__ >= 11)
+#  define MONGOC_HAVE_RSEQ_CPU_ID 1
+# endif
+#endif
+
+
 #if defined(ENABLE_RDTSCP)
  static BSON_INLINE unsigned
  _mongoc_sched_getcpu (void)
@@ -92,10 +116,34 @@ _mongoc_get_cpu_count (void)
     __asm__ volatile ("rdtscp\n" : "=a" (rax), "=d" (rdx), "=c" (aux) : : );
     return aux;
  }
+#elif defined(MONGOC_HAVE_RSEQ_CPU_ID)
+# include <sys/rseq.h>
+ static BSON_INLINE unsigned
+ _mongoc_sched_getcpu (void)
+ {
+    const struct rseq *area;
+    int32_t cpu_id;
+
+    if (__rseq_size) {
+       area = (const struct rseq *)((char *)__builtin_thread_pointer () +
+                                    __rseq_offset);
+       cpu_id = (int32_t)*(const volatile uint32_t *)&area->cpu_id;
+
+       if (cpu_id >= 0) {
+          return (unsigned)cpu_id;
+       }
+    }
+
+#  ifdef HAVE_SCHED_GETCPU
+    return sched_getcpu ();
+#  else
+    return _mongoc_counters_thread_slot ();
+#  endif
+ }
 #elif defined(HAVE_SCHED_GETCPU)
 # define _mongoc_sched_getcpu sched_getcpu
 #else
-# define _mongoc_sched_getcpu() (0)
+# define _mongoc_sched_getcpu _mongoc_counters_thread_slot
 #endif
 
 
@@ -164,6 +212,164 @@ mongoc_counter_##ident##_reset (void) \
 #undef COUNTER
 
 
+/*
+ * Histograms count samples, latencies in microseconds, in log-linear
+ * buckets: values below MONGOC_HISTOGRAM_SUB_BUCKETS have a bucket each,
+ * and every power of two above is split in MONGOC_HISTOGRAM_SUB_BUCKETS
+ * buckets of equal width. The last bucket takes all larger values. Like
+ * counters, each CPU has buckets of its own.
+ */
+#ifndef MONGOC_HISTOGRAM_N_BUCKETS
+# define MONGOC_HISTOGRAM_N_BUCKETS 88
+#endif
+#define MONGOC_HISTOGRAM_SUB_BUCKETS_BITS 2
+#define MONGOC_HISTOGRAM_SUB_BUCKETS (1 << MONGOC_HISTOGRAM_SUB_BUCKETS_BITS)
+
+
+BSON_STATIC_ASSERT ((MONGOC_HISTOGRAM_N_BUCKETS % SLOTS_PER_CACHELINE) == 0);
+
+
+typedef struct
+{
+   int64_t buckets [MONGOC_HISTOGRAM_N_BUCKETS];
+} mongoc_histogram_slots_t;
+
+
+typedef struct
+{
+   mongoc_histogram_slots_t *cpus;
+} mongoc_histogram_t;
+
+
+#define HISTOGRAM(ident, Category, Name, Description) \
+   extern mongoc_histogram_t __mongoc_histogram_##ident;
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+enum
+{
+#define HISTOGRAM(ident, Category, Name, Description) \
+   HISTOGRAM_##ident,
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+   LAST_HISTOGRAM
+};
+
+
+static BSON_INLINE uint32_t
+_mongoc_histogram_bucket (int64_t value)
+{
+   uint64_t v = (value > 0) ? (uint64_t)value : 0;
+   uint32_t msb = MONGOC_HISTOGRAM_SUB_BUCKETS_BITS;
+   uint32_t i;
+
+   if (v < MONGOC_HISTOGRAM_SUB_BUCKETS) {
+      return (uint32_t)v;
+   }
+
+   while ((v >> msb) > 1) {
+      msb++;
+   }
+
+   i = ((msb - MONGOC_HISTOGRAM_SUB_BUCKETS_BITS + 1) *
+        MONGOC_HISTOGRAM_SUB_BUCKETS) +
+       (uint32_t)((v >> (msb - MONGOC_HISTOGRAM_SUB_BUCKETS_BITS)) &
+                  (MONGOC_HISTOGRAM_SUB_BUCKETS - 1));
+
+   return BSON_MIN (i, MONGOC_HISTOGRAM_N_BUCKETS - 1);
+}
+
+
+static BSON_INLINE void
+_mongoc_histogram_record (mongoc_histogram_t *histogram,
+                          int64_t             value)
+{
+   _mongoc_counter_add (
+      histogram->cpus[_mongoc_sched_getcpu()].buckets[
+         _mongoc_histogram_bucket (value)], 1);
+}
+
+
+#define HISTOGRAM(ident, Category, Name, Description) \
+static BSON_INLINE void \
+mongoc_histogram_##ident##_record (int64_t value) \
+{ \
+   _mongoc_histogram_record (&__mongoc_histogram_##ident, value); \
+}
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+/*
+ * Scoped counters are created at runtime for one node, keyed by its
+ * "host:port", or for one namespace, and live after the histograms in
+ * the counters segment. There are at most MONGOC_SCOPED_COUNTERS_MAX of
+ * them in a process, and once they are used up new nodes and namespaces
+ * are only counted globally. They are shared by all CPUs.
+ *
+ * in_flight and concurrency_limit are not counters but the current state
+ * of the concurrency limit of a node, see mongoc_node_limit_t. They stay
+ * zero unless maxConcurrentOpsPerNode is set.
+ */
+#ifndef MONGOC_SCOPED_COUNTERS_MAX
+# define MONGOC_SCOPED_COUNTERS_MAX 64
+#endif
+#define MONGOC_SCOPED_COUNTERS_N_BUCKETS 24
+
+
+typedef enum
+{
+   MONGOC_SCOPED_COUNTERS_NODE      = 1,
+   MONGOC_SCOPED_COUNTERS_NAMESPACE = 2,
+} mongoc_scoped_counters_kind_t;
+
+
+typedef struct
+{
+   uint32_t kind;
+   uint32_t padding0;
+   char     key [120];
+   int64_t  egress_ops;
+   int64_t  ingress_ops;
+   int64_t  egress_bytes;
+   int64_t  ingress_bytes;
+   int64_t  errors;
+   int64_t  timeouts;
+   int64_t  in_flight;
+   int64_t  concurrency_limit;
+   int64_t  latency_usec [MONGOC_SCOPED_COUNTERS_N_BUCKETS];
+} mongoc_scoped_counters_t;
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_scoped_counters_t) == 384);
+
+
+mongoc_scoped_counters_t *_mongoc_scoped_counters_get (mongoc_scoped_counters_kind_t  kind,
+                                                       const char                    *key);
+bool                      _mongoc_scoped_counters_namespaces_enabled (void);
+
+
+/*
+ * Count a round trip of @usec microseconds. Bucket i holds the round
+ * trips that took a number of microseconds with i significant bits.
+ */
+static BSON_INLINE void
+_mongoc_scoped_counters_add_latency (mongoc_scoped_counters_t *counters,
+                                     int64_t                   usec)
+{
+   uint64_t v = (usec > 0) ? (uint64_t)usec : 0;
+   int i = 0;
+
+   while (v && (i < MONGOC_SCOPED_COUNTERS_N_BUCKETS - 1)) {
+      v >>= 1;
+      i++;
+   }
+
+   _mongoc_counter_add (counters->latency_usec [i], 1);
+}
+
+
 BSON_END_DECLS
 
 
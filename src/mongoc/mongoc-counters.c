@@ -31,8 +31,10 @@
 # include <windows.h>
 #endif
 
+#include "mongoc-counters.h"
 #include "mongoc-counters-private.h"
 #include "mongoc-log.h"
+#include "mongoc-thread-private.h"
 
 
 #pragma pack(1)
@@ -58,7 +60,15 @@ typedef struct
    uint32_t n_counters;
    uint32_t infos_offset;
    uint32_t values_offset;
-   uint8_t  padding[44];
+   uint32_t n_histograms;
+   uint32_t histogram_infos_offset;
+   uint32_t histogram_values_offset;
+   uint32_t histogram_n_buckets;
+   uint32_t histogram_sub_buckets;
+   uint32_t n_scoped;
+   uint32_t scoped_offset;
+   uint32_t scoped_max;
+   uint8_t  padding[12];
 } mongoc_counters_t;
 #pragma pack()
 
@@ -66,6 +76,9 @@ typedef struct
 BSON_STATIC_ASSERT(sizeof(mongoc_counters_t) == 64);
 
 static void *gCounterFallback = NULL;
+static mongoc_counters_t *gCounters = NULL;
+static mongoc_mutex_t gScopedMutex;
+static bool gScopedNamespaces = false;
 
 
 #define COUNTER(ident, Category, Name, Description) \
@@ -74,6 +87,64 @@ static void *gCounterFallback = NULL;
 #undef COUNTER
 
 
+#define HISTOGRAM(ident, Category, Name, Description) \
+   mongoc_histogram_t __mongoc_histogram_##ident;
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
+
+/* the counters in the order of their COUNTER_ number */
+static const struct
+{
+   mongoc_counter_t *counter;
+   const char       *category;
+   const char       *name;
+   const char       *description;
+} gCounterDescs [] = {
+#define COUNTER(ident, Category, Name, Description) \
+   { &__mongoc_counter_##ident, Category, Name, Description },
+#include "mongoc-counters.defs"
+#undef COUNTER
+};
+
+
+#if defined(_MSC_VER)
+# define MONGOC_COUNTERS_TLS __declspec(thread)
+#elif defined(__GNUC__)
+# define MONGOC_COUNTERS_TLS __thread
+#endif
+
+
+/**
+ * _mongoc_counters_thread_slot:
+ *
+ * Gives each thread a slot of its own on first use, round robin over
+ * the slots of the CPUs, for platforms that can't tell which CPU a
+ * thread runs on.
+ *
+ * Returns: The slot of the calling thread.
+ */
+unsigned
+_mongoc_counters_thread_slot (void)
+{
+#ifdef MONGOC_COUNTERS_TLS
+   static MONGOC_COUNTERS_TLS unsigned slot;
+   static volatile int32_t next;
+   unsigned n_cpu;
+
+   /* slot is the slot of the thread plus one, zero until it has one */
+   if (!slot) {
+      n_cpu = gCounters ? gCounters->n_cpu : 1;
+      slot = ((unsigned)bson_atomic_int_add (&next, 1) % n_cpu) + 1;
+   }
+
+   return slot - 1;
+#else
+   return 0;
+#endif
+}
+
+
 /**
  * mongoc_counters_use_shm:
  *
@@ -110,7 +181,10 @@ mongoc_counters_calc_size (void)
    n_groups = (LAST_COUNTER / SLOTS_PER_CACHELINE) + 1;
    size = (sizeof(mongoc_counters_t) +
            (LAST_COUNTER * sizeof(mongoc_counter_info_t)) +
-           (n_cpu * n_groups * sizeof(mongoc_counter_slots_t)));
+           (n_cpu * n_groups * sizeof(mongoc_counter_slots_t)) +
+           (LAST_HISTOGRAM * sizeof(mongoc_counter_info_t)) +
+           (n_cpu * LAST_HISTOGRAM * sizeof(mongoc_histogram_slots_t)) +
+           (MONGOC_SCOPED_COUNTERS_MAX * sizeof(mongoc_scoped_counters_t)));
 
 #ifdef BSON_OS_UNIX
    return BSON_MAX(getpagesize(), size);
@@ -268,6 +342,57 @@ mongoc_counters_register (mongoc_counters_t *counters,
 }
 
 
+/**
+ * mongoc_histograms_register:
+ * @counters: A mongoc_counter_t.
+ * @num: The histogram number.
+ * @category: The histogram category.
+ * @name: The histogram name.
+ * @description The histogram description.
+ *
+ * Registers a new histogram in the memory segment for counters, after the
+ * counters. Histogram infos have the same layout as counter infos, with
+ * the slot unused since the buckets of a CPU fill whole cachelines.
+ *
+ * Returns: The offset to the buckets of the histogram.
+ */
+static size_t
+mongoc_histograms_register (mongoc_counters_t *counters,
+                            uint32_t           num,
+                            const char        *category,
+                            const char        *name,
+                            const char        *description)
+{
+   mongoc_counter_info_t *infos;
+   char *segment;
+   int n_cpu;
+
+   BSON_ASSERT(counters);
+   BSON_ASSERT(category);
+   BSON_ASSERT(name);
+   BSON_ASSERT(description);
+
+   n_cpu = _mongoc_get_cpu_count();
+   segment = (char *)counters;
+
+   infos = (mongoc_counter_info_t *)(segment + counters->histogram_infos_offset);
+   infos = &infos[counters->n_histograms];
+   infos->slot = 0;
+   infos->offset = (counters->histogram_values_offset +
+                    (num * n_cpu * sizeof(mongoc_histogram_slots_t)));
+
+   bson_strncpy (infos->category, category, sizeof infos->category);
+   bson_strncpy (infos->name, name, sizeof infos->name);
+   bson_strncpy (infos->description, description, sizeof infos->description);
+
+   bson_memory_barrier ();
+
+   counters->n_histograms++;
+
+   return infos->offset;
+}
+
+
 /**
  * mongoc_counters_init:
  *
@@ -280,6 +405,7 @@ _mongoc_counters_init (void)
    mongoc_counter_info_t *info;
    mongoc_counters_t *counters;
    size_t infos_size;
+   size_t n_groups;
    size_t off;
    size_t size;
    char *segment;
@@ -296,12 +422,41 @@ _mongoc_counters_init (void)
 
    BSON_ASSERT ((counters->values_offset % 64) == 0);
 
+   n_groups = (LAST_COUNTER / SLOTS_PER_CACHELINE) + 1;
+   counters->n_histograms = 0;
+   counters->histogram_n_buckets = MONGOC_HISTOGRAM_N_BUCKETS;
+   counters->histogram_sub_buckets = MONGOC_HISTOGRAM_SUB_BUCKETS;
+   counters->histogram_infos_offset = (uint32_t)(
+      counters->values_offset +
+      (counters->n_cpu * n_groups * sizeof(mongoc_counter_slots_t)));
+   counters->histogram_values_offset = (uint32_t)(
+      counters->histogram_infos_offset +
+      (LAST_HISTOGRAM * sizeof *info));
+
+   BSON_ASSERT ((counters->histogram_values_offset % 64) == 0);
+
+   counters->n_scoped = 0;
+   counters->scoped_max = MONGOC_SCOPED_COUNTERS_MAX;
+   counters->scoped_offset = (uint32_t)(
+      counters->histogram_values_offset +
+      (counters->n_cpu * LAST_HISTOGRAM * sizeof(mongoc_histogram_slots_t)));
+
+   mongoc_mutex_init (&gScopedMutex);
+   gScopedNamespaces = !!getenv ("MONGOC_NAMESPACE_COUNTERS");
+   gCounters = counters;
+
 #define COUNTER(ident, Category, Name, Desc) \
    off = mongoc_counters_register(counters, COUNTER_##ident, Category, Name, Desc); \
    __mongoc_counter_##ident.cpus = (void *)(segment + off);
 #include "mongoc-counters.defs"
 #undef COUNTER
 
+#define HISTOGRAM(ident, Category, Name, Desc) \
+   off = mongoc_histograms_register(counters, HISTOGRAM_##ident, Category, Name, Desc); \
+   __mongoc_histogram_##ident.cpus = (void *)(segment + off);
+#include "mongoc-histograms.defs"
+#undef HISTOGRAM
+
    /*
     * NOTE:
     *
@@ -312,3 +467,169 @@ _mongoc_counters_init (void)
    bson_memory_barrier ();
    counters->size = (uint32_t)size;
 }
+
+
+/**
+ * _mongoc_scoped_counters_get:
+ * @kind: The kind of scope @key names.
+ * @key: The "host:port" of a node or a namespace.
+ *
+ * Finds the scoped counters for @key, creating them on first use. Lookups
+ * of existing counters take no lock, since entries are only published
+ * once they are initialized and never removed.
+ *
+ * Returns: The counters for @key, or NULL if all are in use.
+ */
+mongoc_scoped_counters_t *
+_mongoc_scoped_counters_get (mongoc_scoped_counters_kind_t  kind,
+                             const char                    *key)
+{
+   mongoc_scoped_counters_t *scoped;
+   mongoc_scoped_counters_t *ret = NULL;
+   uint32_t n;
+   uint32_t i;
+
+   BSON_ASSERT (key);
+
+   if (!gCounters) {
+      return NULL;
+   }
+
+   scoped = (mongoc_scoped_counters_t *)((char *)gCounters +
+                                         gCounters->scoped_offset);
+
+   n = gCounters->n_scoped;
+   bson_memory_barrier ();
+
+   for (i = 0; i < n; i++) {
+      if ((scoped[i].kind == (uint32_t)kind) &&
+          !strncmp (scoped[i].key, key, sizeof scoped[i].key - 1)) {
+         return &scoped[i];
+      }
+   }
+
+   mongoc_mutex_lock (&gScopedMutex);
+
+   /* another thread may have added it meanwhile */
+   for (; i < gCounters->n_scoped; i++) {
+      if ((scoped[i].kind == (uint32_t)kind) &&
+          !strncmp (scoped[i].key, key, sizeof scoped[i].key - 1)) {
+         ret = &scoped[i];
+         break;
+      }
+   }
+
+   if (!ret && (gCounters->n_scoped < gCounters->scoped_max)) {
+      ret = &scoped[gCounters->n_scoped];
+      ret->kind = (uint32_t)kind;
+      bson_strncpy (ret->key, key, sizeof ret->key);
+
+      bson_memory_barrier ();
+
+      gCounters->n_scoped++;
+   }
+
+   mongoc_mutex_unlock (&gScopedMutex);
+
+   return ret;
+}
+
+
+/**
+ * _mongoc_scoped_counters_namespaces_enabled:
+ *
+ * Namespaces are only counted when MONGOC_NAMESPACE_COUNTERS is set in
+ * the environment, since an application may use more namespaces than
+ * there are scoped counters, and each operation then looks its own up.
+ *
+ * Returns: true if operations should be counted by namespace.
+ */
+bool
+_mongoc_scoped_counters_namespaces_enabled (void)
+{
+   return gScopedNamespaces;
+}
+
+
+/**
+ * mongoc_counters_iter_init:
+ * @iter: A mongoc_counters_iter_t.
+ *
+ * Initializes @iter to walk the counters with mongoc_counters_iter_next().
+ */
+void
+mongoc_counters_iter_init (mongoc_counters_iter_t *iter)
+{
+   BSON_ASSERT (iter);
+
+   memset (iter, 0, sizeof *iter);
+}
+
+
+/**
+ * mongoc_counters_iter_next:
+ * @iter: A mongoc_counters_iter_t.
+ *
+ * Advances @iter to the next counter, and sets its index, category, name
+ * and description. The strings are static.
+ *
+ * Returns: true if @iter is on a counter, false once all were seen.
+ */
+bool
+mongoc_counters_iter_next (mongoc_counters_iter_t *iter)
+{
+   BSON_ASSERT (iter);
+
+   if (iter->next >= LAST_COUNTER) {
+      return false;
+   }
+
+   iter->index = iter->next++;
+   iter->category = gCounterDescs [iter->index].category;
+   iter->name = gCounterDescs [iter->index].name;
+   iter->description = gCounterDescs [iter->index].description;
+
+   return true;
+}
+
+
+/**
+ * mongoc_counters_snapshot:
+ * @values: An array of @n_values, or NULL.
+ * @n_values: The number of elements of @values.
+ *
+ * Sums the per-CPU slots of each counter into @values, in the order of
+ * mongoc_counters_iter_next(), whether or not the counters are exported
+ * over shared memory. No lock is taken: each slot is read as it is, so a
+ * snapshot taken while operations are running need not be consistent
+ * across counters.
+ *
+ * Returns: The number of counters, of which the first @n_values are
+ *          written to @values.
+ */
+uint32_t
+mongoc_counters_snapshot (int64_t  *values,
+                          uint32_t  n_values)
+{
+   mongoc_counter_slots_t *cpus;
+   uint32_t n_cpu;
+   uint32_t i;
+   uint32_t j;
+
+   BSON_ASSERT (values || !n_values);
+
+   n_cpu = gCounters ? gCounters->n_cpu : 0;
+
+   bson_memory_barrier ();
+
+   for (i = 0; (i < n_values) && (i < LAST_COUNTER); i++) {
+      values [i] = 0;
+      cpus = gCounterDescs [i].counter->cpus;
+
+      for (j = 0; cpus && (j < n_cpu); j++) {
+         values [i] += cpus [j].slots [i % SLOTS_PER_CACHELINE];
+      }
+   }
+
+   return LAST_COUNTER;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_COUNTERS_H
+#define MONGOC_COUNTERS_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * Walks the counters of the driver in the order of the values written by
+ * mongoc_counters_snapshot(): after each successful call to
+ * mongoc_counters_iter_next(), @index is the position of the counter
+ * described by @category, @name and @description.
+ */
+typedef struct
+{
+   uint32_t    index;
+   const char *category;
+   const char *name;
+   const char *description;
+   uint32_t    next;
+   void       *padding [4];
+} mongoc_counters_iter_t;
+
+
+void     mongoc_counters_iter_init (mongoc_counters_iter_t *iter);
+bool     mongoc_counters_iter_next (mongoc_counters_iter_t *iter);
+uint32_t mongoc_counters_snapshot  (int64_t                *values,
+                                    uint32_t                n_values);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_COUNTERS_H */
@@ -37,6 +37,7 @@ typedef struct
    bool         has_synthetic_bson;
    bson_iter_t         iter;
    bson_t              bson;
+   bson_t              current;
    uint32_t       document_len;
    const uint8_t *document;
    const char    *field_name;
@@ -126,9 +127,9 @@ _mongoc_cursor_array_next (mongoc_cursor_t *cursor,
 
    if (ret) {
       bson_iter_document (&arr->iter, &arr->document_len, &arr->document);
-      bson_init_static (&arr->bson, arr->document, arr->document_len);
+      bson_init_static (&arr->current, arr->document, arr->document_len);
 
-      *bson = &arr->bson;
+      *bson = &arr->current;
    }
 
    RETURN (ret);
@@ -148,6 +149,10 @@ _mongoc_cursor_array_clone (const mongoc_cursor_t *cursor)
    clone_ = _mongoc_cursor_clone (cursor);
    _mongoc_cursor_array_init (clone_, arr->field_name);
 
+   if (arr->has_synthetic_bson) {
+      _mongoc_cursor_array_set_bson (clone_, &arr->bson);
+   }
+
    RETURN (clone_);
 }
 
@@ -29,8 +29,11 @@
 BSON_BEGIN_DECLS
 
 
-bool _mongoc_cursor_cursorid_prime (mongoc_cursor_t *cursor);
-void _mongoc_cursor_cursorid_init (mongoc_cursor_t *cursor);
+bool _mongoc_cursor_cursorid_prime      (mongoc_cursor_t *cursor);
+bool _mongoc_cursor_cursorid_set_cursor (mongoc_cursor_t *cursor,
+                                         uint32_t         hint,
+                                         const bson_t    *bson);
+void _mongoc_cursor_cursorid_init       (mongoc_cursor_t *cursor);
 
 
 BSON_END_DECLS
@@ -36,6 +36,7 @@ typedef struct
    bool        in_first_batch;
    bson_iter_t first_batch_iter;
    bson_t      first_batch_inline;
+   bson_t     *reply;
 } mongoc_cursor_cursorid_t;
 
 
@@ -55,23 +56,65 @@ _mongoc_cursor_cursorid_new (void)
 static void
 _mongoc_cursor_cursorid_destroy (mongoc_cursor_t *cursor)
 {
+   mongoc_cursor_cursorid_t *cid;
+
    ENTRY;
 
-   bson_free (cursor->iface_data);
+   cid = cursor->iface_data;
+
+   if (cid->reply) {
+      bson_destroy (cid->reply);
+   }
+
+   bson_free (cid);
    _mongoc_cursor_destroy (cursor);
 
    EXIT;
 }
 
 
+static bool
+_mongoc_cursor_cursorid_read_cursor (mongoc_cursor_t *cursor,
+                                     const bson_t    *bson)
+{
+   mongoc_cursor_cursorid_t *cid;
+   bson_iter_t iter, child;
+   const char *ns;
+
+   cid = cursor->iface_data;
+
+   if (!bson_iter_init_find (&iter, bson, "cursor") ||
+       !BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+       !bson_iter_recurse (&iter, &child)) {
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      if (BSON_ITER_IS_KEY (&child, "id")) {
+         cursor->rpc.reply.cursor_id = bson_iter_as_int64 (&child);
+      } else if (BSON_ITER_IS_KEY (&child, "ns")) {
+         ns = bson_iter_utf8 (&child, &cursor->nslen);
+         bson_strncpy (cursor->ns, ns, sizeof cursor->ns);
+      } else if (BSON_ITER_IS_KEY (&child, "firstBatch")) {
+         if (BSON_ITER_HOLDS_ARRAY (&child) &&
+             bson_iter_recurse (&child, &cid->first_batch_iter)) {
+            cid->in_first_batch = true;
+         }
+      }
+   }
+
+   cursor->is_command = false;
+
+   return true;
+}
+
+
 bool
 _mongoc_cursor_cursorid_prime (mongoc_cursor_t *cursor)
 {
    bool ret = true;
    mongoc_cursor_cursorid_t *cid;
    const bson_t *bson;
-   bson_iter_t iter, child;
-   const char *ns;
 
    ENTRY;
 
@@ -82,27 +125,8 @@ _mongoc_cursor_cursorid_prime (mongoc_cursor_t *cursor)
 
       cid->has_cursor = true;
 
-      if (ret &&
-          bson_iter_init_find (&iter, bson, "cursor") &&
-          BSON_ITER_HOLDS_DOCUMENT (&iter) &&
-          bson_iter_recurse (&iter, &child)) {
-         while (bson_iter_next (&child)) {
-            if (BSON_ITER_IS_KEY (&child, "id")) {
-               cursor->rpc.reply.cursor_id = bson_iter_as_int64 (&child);
-            } else if (BSON_ITER_IS_KEY (&child, "ns")) {
-               ns = bson_iter_utf8 (&child, &cursor->nslen);
-               bson_strncpy (cursor->ns, ns, sizeof cursor->ns);
-            } else if (BSON_ITER_IS_KEY (&child, "firstBatch")) {
-               if (BSON_ITER_HOLDS_ARRAY (&child) &&
-                   bson_iter_recurse (&child, &cid->first_batch_iter)) {
-                  cid->in_first_batch = true;
-               }
-            }
-         }
-
-         cursor->is_command = false;
-      } else {
-         ret = false;
+      if (ret) {
+         ret = _mongoc_cursor_cursorid_read_cursor (cursor, bson);
       }
    }
 
@@ -110,6 +134,50 @@ _mongoc_cursor_cursorid_prime (mongoc_cursor_t *cursor)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_cursorid_set_cursor --
+ *
+ *       Primes @cursor from a cursor document that was returned by a
+ *       command run on the node @hint, such as one of the cursors of
+ *       parallelCollectionScan, instead of running the command itself.
+ *
+ * Returns:
+ *       true if @bson holds a valid cursor document.
+ *
+ * Side effects:
+ *       @bson is copied, the first batch is returned from the copy.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_cursorid_set_cursor (mongoc_cursor_t *cursor,
+                                    uint32_t         hint,
+                                    const bson_t    *bson)
+{
+   mongoc_cursor_cursorid_t *cid;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (bson);
+
+   cid = cursor->iface_data;
+
+   BSON_ASSERT (!cid->has_cursor);
+
+   cid->has_cursor = true;
+   cid->reply = bson_copy (bson);
+
+   cursor->hint = hint;
+   cursor->sent = true;
+
+   RETURN (_mongoc_cursor_cursorid_read_cursor (cursor, cid->reply));
+}
+
+
 static bool
 _mongoc_cursor_cursorid_next (mongoc_cursor_t *cursor,
                               const bson_t   **bson)
@@ -130,6 +198,12 @@ _mongoc_cursor_cursorid_next (mongoc_cursor_t *cursor,
    }
 
    if (cid->in_first_batch) {
+      /*
+       * The first batch came with the command reply, so the OP_GET_MORE
+       * for the second can be in flight while it is read.
+       */
+      _mongoc_cursor_prefetch (cursor);
+
       while (bson_iter_next (&cid->first_batch_iter)) {
          if (BSON_ITER_HOLDS_DOCUMENT (&cid->first_batch_iter)) {
             bson_iter_document (&cid->first_batch_iter, &data_len, &data);
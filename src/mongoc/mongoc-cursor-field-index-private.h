@@ -0,0 +1,64 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_CURSOR_FIELD_INDEX_PRIVATE_H
+#define MONGOC_CURSOR_FIELD_INDEX_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * An index of the top-level fields of a cursor's current document. It is
+ * built with a single pass over the document the first time a field is
+ * looked up, and answers further lookups with a hash of the key.
+ *
+ * The keys are kept from one document to the next. When the next
+ * document has the same keys in the same order, as the documents of a
+ * collection mostly do, only the positions of its fields are refreshed.
+ */
+typedef struct
+{
+   bool          valid;
+   uint32_t      generation;
+   uint32_t      n_fields;
+   uint32_t      n_alloc;
+   char        **keys;
+   bson_iter_t  *iters;
+   uint32_t     *table;
+   uint32_t      table_size;
+} mongoc_cursor_field_index_t;
+
+
+mongoc_cursor_field_index_t *_mongoc_cursor_field_index_new     (void);
+void                         _mongoc_cursor_field_index_destroy (mongoc_cursor_field_index_t *index);
+bool                         _mongoc_cursor_field_index_find    (mongoc_cursor_field_index_t *index,
+                                                                 const bson_t                *doc,
+                                                                 uint32_t                     generation,
+                                                                 const char                  *key,
+                                                                 bson_iter_t                 *iter);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_CURSOR_FIELD_INDEX_PRIVATE_H */
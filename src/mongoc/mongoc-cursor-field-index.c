@@ -0,0 +1,216 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-cursor-field-index-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "cursor-field-index"
+
+
+#define MONGOC_CURSOR_FIELD_INDEX_MIN_TABLE 16
+
+
+mongoc_cursor_field_index_t *
+_mongoc_cursor_field_index_new (void)
+{
+   return bson_malloc0 (sizeof (mongoc_cursor_field_index_t));
+}
+
+
+void
+_mongoc_cursor_field_index_destroy (mongoc_cursor_field_index_t *index)
+{
+   uint32_t i;
+
+   if (index) {
+      for (i = 0; i < index->n_fields; i++) {
+         bson_free (index->keys[i]);
+      }
+
+      bson_free (index->keys);
+      bson_free (index->iters);
+      bson_free (index->table);
+      bson_free (index);
+   }
+}
+
+
+static BSON_INLINE uint32_t
+_mongoc_cursor_field_index_hash (const char *key)
+{
+   uint32_t hash = 2166136261u;
+
+   /* FNV-1a */
+   while (*key) {
+      hash ^= (uint8_t)*key++;
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+/*
+ * Rebuilds the hash table, once the keys have changed. The table is kept
+ * at most half full, and maps to the first field of any duplicate key as
+ * bson_iter_find() would.
+ */
+static void
+_mongoc_cursor_field_index_rehash (mongoc_cursor_field_index_t *index)
+{
+   uint32_t mask;
+   uint32_t slot;
+   uint32_t size = MONGOC_CURSOR_FIELD_INDEX_MIN_TABLE;
+   uint32_t i;
+
+   while (size < index->n_fields * 2) {
+      size *= 2;
+   }
+
+   if (size != index->table_size) {
+      bson_free (index->table);
+      index->table = bson_malloc (size * sizeof *index->table);
+      index->table_size = size;
+   }
+
+   memset (index->table, 0, size * sizeof *index->table);
+   mask = size - 1;
+
+   for (i = 0; i < index->n_fields; i++) {
+      slot = _mongoc_cursor_field_index_hash (index->keys[i]) & mask;
+
+      while (index->table[slot] &&
+             strcmp (index->keys[index->table[slot] - 1], index->keys[i])) {
+         slot = (slot + 1) & mask;
+      }
+
+      if (!index->table[slot]) {
+         index->table[slot] = i + 1;
+      }
+   }
+}
+
+
+static void
+_mongoc_cursor_field_index_build (mongoc_cursor_field_index_t *index,
+                                  const bson_t                *doc)
+{
+   bson_iter_t iter;
+   const char *key;
+   bool changed = false;
+   uint32_t i = 0;
+   uint32_t j;
+
+   if (bson_iter_init (&iter, doc)) {
+      while (bson_iter_next (&iter)) {
+         key = bson_iter_key (&iter);
+
+         if ((i >= index->n_fields) || strcmp (index->keys[i], key)) {
+            /* a different shape from here on, forget the old keys */
+            for (j = i; j < index->n_fields; j++) {
+               bson_free (index->keys[j]);
+            }
+            index->n_fields = i;
+            changed = true;
+
+            if (i == index->n_alloc) {
+               index->n_alloc = BSON_MAX (16, index->n_alloc * 2);
+               index->keys = bson_realloc (
+                  index->keys, index->n_alloc * sizeof *index->keys);
+               index->iters = bson_realloc (
+                  index->iters, index->n_alloc * sizeof *index->iters);
+            }
+
+            index->keys[i] = bson_strdup (key);
+            index->n_fields++;
+         }
+
+         memcpy (&index->iters[i], &iter, sizeof iter);
+         i++;
+      }
+   }
+
+   if (i < index->n_fields) {
+      for (j = i; j < index->n_fields; j++) {
+         bson_free (index->keys[j]);
+      }
+      index->n_fields = i;
+      changed = true;
+   }
+
+   if (changed || !index->table) {
+      _mongoc_cursor_field_index_rehash (index);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_field_index_find --
+ *
+ *       Finds the top-level field @key of @doc, indexing @doc first if
+ *       the index is not of the same @generation.
+ *
+ * Returns:
+ *       true and @iter is positioned on the field if it was found.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_field_index_find (mongoc_cursor_field_index_t *index,
+                                 const bson_t                *doc,
+                                 uint32_t                     generation,
+                                 const char                  *key,
+                                 bson_iter_t                 *iter)
+{
+   uint32_t mask;
+   uint32_t slot;
+
+   BSON_ASSERT (index);
+   BSON_ASSERT (doc);
+   BSON_ASSERT (key);
+   BSON_ASSERT (iter);
+
+   if (!index->valid || (index->generation != generation)) {
+      _mongoc_cursor_field_index_build (index, doc);
+      index->generation = generation;
+      index->valid = true;
+   }
+
+   mask = index->table_size - 1;
+   slot = _mongoc_cursor_field_index_hash (key) & mask;
+
+   while (index->table[slot]) {
+      if (!strcmp (index->keys[index->table[slot] - 1], key)) {
+         memcpy (iter, &index->iters[index->table[slot] - 1], sizeof *iter);
+         return true;
+      }
+
+      slot = (slot + 1) & mask;
+   }
+
+   return false;
+}
@@ -25,15 +25,42 @@
 
 #include "mongoc-client.h"
 #include "mongoc-buffer-private.h"
+#include "mongoc-cursor-field-index-private.h"
 #include "mongoc-rpc-private.h"
 
 
 BSON_BEGIN_DECLS
 
 
+/*
+ * Adaptive batch sizes are capped to what a single OP_REPLY can carry.
+ */
+#define MONGOC_CURSOR_ADAPTIVE_MAX_BYTES (16 * 1024 * 1024)
+
+
+/*
+ * Cursors whose query or fields grew past this are not kept for reuse
+ * by the client, so a rare large query doesn't pin its storage.
+ */
+#define MONGOC_CURSOR_REUSE_MAX_BSON (16 * 1024)
+
+
 typedef struct _mongoc_cursor_interface_t mongoc_cursor_interface_t;
 
 
+/*
+ * Reads the documents of a batch in place. The cursor keeps one and
+ * resets it over each batch, reader points to it while there is one.
+ */
+typedef struct
+{
+   const uint8_t *data;
+   size_t         len;
+   size_t         off;
+   bson_t         doc;
+} mongoc_cursor_reader_t;
+
+
 struct _mongoc_cursor_interface_t
 {
    mongoc_cursor_t *(*clone)    (const mongoc_cursor_t  *cursor);
@@ -63,6 +90,10 @@ struct _mongoc_cursor_t
    unsigned                   in_exhaust   : 1;
    unsigned                   redir_primary: 1;
    unsigned                   has_fields   : 1;
+   unsigned                   prefetch     : 1;
+   unsigned                   prefetch_sent: 1;
+   unsigned                   prefetch_recv: 1;
+   unsigned                   single_batch : 1;
 
    bson_t                     query;
    bson_t                     fields;
@@ -74,17 +105,63 @@ struct _mongoc_cursor_t
    uint32_t                   limit;
    uint32_t                   count;
    uint32_t                   batch_size;
+   uint32_t                   batch_read;
+   uint32_t                   adaptive_max_bytes;
+   uint32_t                   adaptive_n_return;
+   int64_t                    batch_recv_time;
+   uint32_t                   operation_timeout_msec;
+
+   /*
+    * Replies with more than incremental_threshold bytes of documents are
+    * read one document at a time. incremental_remaining is what is left
+    * of such a reply on the connection.
+    */
+   uint32_t                   incremental_threshold;
+   uint32_t                   incremental_remaining;
+   bson_t                     incremental_doc;
 
    char                       ns [140];
    uint32_t                   nslen;
 
+   /*
+    * The key the results are cached under in the client's query cache,
+    * if the first reply holds all of them.
+    */
+   bson_t                    *cache_key;
+
+   /*
+    * The key identical queries of other clients of the pool wait on while
+    * this one is in flight, see mongoc_client_pool_set_query_coalescing().
+    */
+   bson_t                    *flight_key;
+   struct _mongoc_query_flight_t *flight;
+
    bson_error_t               error;
 
    mongoc_rpc_t               rpc;
    mongoc_buffer_t            buffer;
-   bson_reader_t             *reader;
+   mongoc_cursor_reader_t    *reader;
+   mongoc_cursor_reader_t     reader_storage;
 
    const bson_t              *current;
+   mongoc_cursor_field_index_t *field_index;
+
+   uint32_t                  *batch_offsets;
+   uint32_t                   batch_offsets_alloc;
+
+   /*
+    * A OP_GET_MORE sent ahead of time, and the buffer its reply is read
+    * into while the documents of the current batch are still in use.
+    * @prefetch_reserved is what was taken from the memory budget for it.
+    */
+   uint32_t                   prefetch_request_id;
+   mongoc_rpc_t               prefetch_rpc;
+   mongoc_buffer_t            prefetch_buffer;
+   size_t                     prefetch_reserved;
+
+   /* links in the live cursors of the client */
+   struct _mongoc_cursor_t   *live_prev;
+   struct _mongoc_cursor_t   *live_next;
 
    mongoc_cursor_interface_t  iface;
    void                      *iface_data;
@@ -110,6 +187,17 @@ bool             _mongoc_cursor_error     (mongoc_cursor_t            *cursor,
                                            bson_error_t               *error);
 void             _mongoc_cursor_get_host  (mongoc_cursor_t            *cursor,
                                            mongoc_host_list_t         *host);
+void             _mongoc_cursor_prefetch  (mongoc_cursor_t            *cursor);
+bool             _mongoc_cursor_prefetch_recv (mongoc_cursor_t        *cursor);
+bool             _mongoc_cursor_query_many (mongoc_cursor_t          **cursors,
+                                            uint32_t                   n_cursors,
+                                            bson_error_t              *error);
+void             _mongoc_cursor_query_parallel (mongoc_cursor_t      **cursors,
+                                                uint32_t               n_cursors);
+void             _mongoc_cursor_dispose   (mongoc_cursor_t            *cursor);
+void             _mongoc_cursor_abandon   (mongoc_cursor_t            *cursor);
+void             _mongoc_cursor_append_read_prefs (bson_t                    *query,
+                                                   const mongoc_read_prefs_t *read_prefs);
 
 
 BSON_END_DECLS
@@ -0,0 +1,506 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-cursor.h"
+#include "mongoc-cursor-scatter-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "cursor-scatter"
+
+
+/*
+ * The cursor of the query on one shard. In a merge @head is its next
+ * document, or NULL once @done.
+ */
+typedef struct
+{
+   mongoc_cursor_t       *cursor;
+   uint32_t               shard;
+   const bson_t          *head;
+   bool                   done;
+} mongoc_cursor_scatter_part_t;
+
+
+/*
+ * A query run on every shard that owns a chunk of the collection. The
+ * results are a union, taking a document from each shard in turn, or if
+ * the query has an $orderby a merge of the sorted results of the shards.
+ * The skip is applied here, so it is not sent to the shards.
+ */
+typedef struct
+{
+   mongoc_shard_router_t *router;
+   mongoc_array_t         parts;
+   bson_t                *sort;       /* or NULL for a union */
+   uint32_t               next_part;  /* the next one of a union to read */
+   uint32_t               skipped;
+   bool                   started;
+   mongoc_cursor_scatter_part_t *last; /* the current document is from it */
+} mongoc_cursor_scatter_t;
+
+
+static void
+_mongoc_cursor_scatter_free (mongoc_cursor_scatter_t *scatter)
+{
+   mongoc_cursor_scatter_part_t *part;
+   size_t i;
+
+   for (i = 0; i < scatter->parts.len; i++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t, i);
+      mongoc_cursor_destroy (part->cursor);
+   }
+
+   if (scatter->sort) {
+      bson_destroy (scatter->sort);
+   }
+
+   _mongoc_array_destroy (&scatter->parts);
+   bson_free (scatter);
+}
+
+
+static void
+_mongoc_cursor_scatter_destroy (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   _mongoc_cursor_scatter_free (cursor->iface_data);
+   _mongoc_cursor_destroy (cursor);
+
+   EXIT;
+}
+
+
+/*
+ * The next document of @part that its shard owns, or NULL when the part
+ * is done. @cursor fails with the error of the part if it failed.
+ */
+static const bson_t *
+_mongoc_cursor_scatter_read (mongoc_cursor_t              *cursor,
+                             mongoc_cursor_scatter_part_t *part)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+   const bson_t *doc;
+
+   while (mongoc_cursor_next (part->cursor, &doc)) {
+      if (_mongoc_shard_router_owns (scatter->router, cursor->ns,
+                                     part->shard, doc)) {
+         return doc;
+      }
+   }
+
+   part->done = true;
+
+   if (mongoc_cursor_error (part->cursor, &cursor->error)) {
+      cursor->failed = true;
+   }
+
+   return NULL;
+}
+
+
+/*
+ * Send the query to every shard before reading any reply, and in a merge
+ * read the first document of each.
+ */
+static void
+_mongoc_cursor_scatter_start (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+   mongoc_cursor_scatter_part_t *part;
+   mongoc_cursor_t **cursors;
+   size_t i;
+
+   ENTRY;
+
+   scatter->started = true;
+   cursor->sent = true;
+
+   cursors = bson_malloc (scatter->parts.len * sizeof *cursors);
+
+   for (i = 0; i < scatter->parts.len; i++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t, i);
+      cursors[i] = part->cursor;
+   }
+
+   _mongoc_cursor_query_parallel (cursors, (uint32_t)scatter->parts.len);
+   bson_free (cursors);
+
+   if (!scatter->sort) {
+      EXIT;
+   }
+
+   for (i = 0; i < scatter->parts.len && !cursor->failed; i++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t, i);
+      part->head = _mongoc_cursor_scatter_read (cursor, part);
+   }
+
+   EXIT;
+}
+
+
+static const bson_t *
+_mongoc_cursor_scatter_next_union (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+   mongoc_cursor_scatter_part_t *part;
+   const bson_t *doc;
+   size_t tries;
+
+   for (tries = 0; tries < scatter->parts.len; tries++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t,
+                                   scatter->next_part);
+      scatter->next_part = (uint32_t)((scatter->next_part + 1) %
+                                      scatter->parts.len);
+
+      if (part->done) {
+         continue;
+      }
+
+      if ((doc = _mongoc_cursor_scatter_read (cursor, part))) {
+         scatter->last = part;
+         return doc;
+      }
+
+      if (cursor->failed) {
+         break;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ * The least head of the parts, which is only replaced by the next
+ * document of its part on the following call, since until then it is
+ * the current document of the cursor. With as many parts as shards a
+ * scan of the heads is as quick as a heap.
+ */
+static const bson_t *
+_mongoc_cursor_scatter_next_merge (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+   mongoc_cursor_scatter_part_t *part;
+   mongoc_cursor_scatter_part_t *least = NULL;
+   size_t i;
+
+   if (scatter->last) {
+      scatter->last->head = _mongoc_cursor_scatter_read (cursor,
+                                                         scatter->last);
+      scatter->last = NULL;
+
+      if (cursor->failed) {
+         return NULL;
+      }
+   }
+
+   for (i = 0; i < scatter->parts.len; i++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t, i);
+
+      if (part->head &&
+          (!least ||
+           _mongoc_shard_router_compare_sort (scatter->sort, part->head,
+                                              least->head) < 0)) {
+         least = part;
+      }
+   }
+
+   if (!least) {
+      return NULL;
+   }
+
+   scatter->last = least;
+
+   return least->head;
+}
+
+
+static bool
+_mongoc_cursor_scatter_next (mongoc_cursor_t *cursor,
+                             const bson_t   **bson)
+{
+   mongoc_cursor_scatter_t *scatter;
+   const bson_t *doc;
+
+   ENTRY;
+
+   scatter = cursor->iface_data;
+   *bson = NULL;
+
+   if (cursor->done || (cursor->limit && cursor->count >= cursor->limit)) {
+      cursor->done = true;
+      RETURN (false);
+   }
+
+   if (!scatter->started) {
+      _mongoc_cursor_scatter_start (cursor);
+   }
+
+   for (;;) {
+      if (cursor->failed) {
+         RETURN (false);
+      }
+
+      if (scatter->sort) {
+         doc = _mongoc_cursor_scatter_next_merge (cursor);
+      } else {
+         doc = _mongoc_cursor_scatter_next_union (cursor);
+      }
+
+      if (!doc) {
+         cursor->done = true;
+         RETURN (false);
+      }
+
+      if (scatter->skipped < cursor->skip) {
+         scatter->skipped++;
+         continue;
+      }
+
+      *bson = doc;
+      RETURN (true);
+   }
+}
+
+
+static bool
+_mongoc_cursor_scatter_more (mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+   mongoc_cursor_scatter_part_t *part;
+   size_t i;
+
+   if (cursor->failed || cursor->done) {
+      return false;
+   }
+
+   if (!scatter->started) {
+      return true;
+   }
+
+   for (i = 0; i < scatter->parts.len; i++) {
+      part = &_mongoc_array_index (&scatter->parts,
+                                   mongoc_cursor_scatter_part_t, i);
+
+      if (!part->done) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+static void
+_mongoc_cursor_scatter_get_host (mongoc_cursor_t    *cursor,
+                                 mongoc_host_list_t *host)
+{
+   mongoc_cursor_scatter_t *scatter = cursor->iface_data;
+
+   if (scatter->last) {
+      mongoc_cursor_get_host (scatter->last->cursor, host);
+   } else {
+      _mongoc_cursor_get_host (cursor, host);
+   }
+}
+
+
+static mongoc_cursor_t *
+_mongoc_cursor_scatter_clone (const mongoc_cursor_t *cursor)
+{
+   mongoc_cursor_scatter_t *scatter;
+   mongoc_cursor_t *clone_;
+
+   ENTRY;
+
+   scatter = cursor->iface_data;
+
+   /* if the collection can't be scattered any more it goes to mongos */
+   clone_ = _mongoc_cursor_clone (cursor);
+   _mongoc_cursor_scatter_init (clone_, scatter->router);
+
+   RETURN (clone_);
+}
+
+
+static mongoc_cursor_interface_t gMongocCursorScatter = {
+   _mongoc_cursor_scatter_clone,
+   _mongoc_cursor_scatter_destroy,
+   _mongoc_cursor_scatter_more,
+   _mongoc_cursor_scatter_next,
+   NULL,
+   _mongoc_cursor_scatter_get_host,
+};
+
+
+/*
+ * The $orderby of @query, if it only has fields sorted up or down and so
+ * the sorted results of the shards can be merged here.
+ */
+static bool
+_mongoc_cursor_scatter_get_sort (const bson_t *query,
+                                 bson_t      **sort)
+{
+   const uint8_t *data;
+   bson_iter_t iter;
+   bson_iter_t child;
+   uint32_t len;
+
+   *sort = NULL;
+
+   if (!bson_iter_init_find (&iter, query, "$orderby")) {
+      return true;
+   }
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+       !bson_iter_recurse (&iter, &child)) {
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      /* $natural and { "$meta": "textScore" } can't be merged */
+      if (!BSON_ITER_HOLDS_NUMBER (&child) ||
+          !bson_iter_as_int64 (&child) ||
+          !strcmp (bson_iter_key (&child), "$natural")) {
+         return false;
+      }
+   }
+
+   bson_iter_document (&iter, &len, &data);
+   *sort = bson_new_from_data (data, len);
+
+   return !!*sort;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_scatter_init --
+ *
+ *       Make @cursor, a find that has not been started, run its query on
+ *       each shard that owns a chunk of its collection over the clients
+ *       of @router, instead of on mongos.
+ *
+ *       The query is sent to every shard before any reply is read, and
+ *       the cursors of the shards prefetch their next batches, so the
+ *       shards work at the same time. Documents a shard returns from a
+ *       chunk it doesn't own, left behind by a migration, are dropped.
+ *
+ *       A limit only bounds the batch size of each shard, further
+ *       batches are fetched from a shard whose documents were dropped.
+ *
+ * Returns:
+ *       true if @cursor now scatters its query; false if it is left as it
+ *       was, because its collection is not routed, a shard can't be
+ *       reached, or its query is an $explain or has an $orderby that
+ *       can't be merged.
+ *
+ * Side effects:
+ *       The chunk map of the collection may be read and clients created.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_scatter_init (mongoc_cursor_t       *cursor,
+                             mongoc_shard_router_t *router)
+{
+   mongoc_cursor_scatter_part_t part;
+   mongoc_cursor_scatter_t *scatter;
+   mongoc_shard_t *shard;
+   mongoc_array_t owners;
+   uint32_t batch_size;
+   uint32_t want;
+   bson_t query;
+   size_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (router);
+
+   if (cursor->sent || cursor->failed || cursor->is_command ||
+       bson_has_field (&cursor->query, "$explain")) {
+      RETURN (false);
+   }
+
+   scatter = bson_malloc0 (sizeof *scatter);
+   scatter->router = router;
+   _mongoc_array_init (&scatter->parts, sizeof part);
+
+   if (!_mongoc_cursor_scatter_get_sort (&cursor->query, &scatter->sort)) {
+      _mongoc_cursor_scatter_free (scatter);
+      RETURN (false);
+   }
+
+   _mongoc_array_init (&owners, sizeof (uint32_t));
+
+   if (!_mongoc_shard_router_owners (router, cursor->ns, &owners)) {
+      _mongoc_array_destroy (&owners);
+      _mongoc_cursor_scatter_free (scatter);
+      RETURN (false);
+   }
+
+   /* each shard must return as many as skip and limit take from them all */
+   batch_size = cursor->batch_size;
+
+   if (cursor->limit && cursor->skip <= UINT32_MAX - cursor->limit) {
+      want = cursor->skip + cursor->limit;
+      batch_size = batch_size ? BSON_MIN (batch_size, want) : want;
+   }
+
+   /* the shards are replica sets, they apply the read preferences */
+   bson_init (&query);
+   bson_copy_to_excluding_noinit (&cursor->query, &query, "$readPreference",
+                                  NULL);
+
+   for (i = 0; i < owners.len; i++) {
+      memset (&part, 0, sizeof part);
+      part.shard = _mongoc_array_index (&owners, uint32_t, i);
+      shard = &_mongoc_array_index (&router->shards, mongoc_shard_t,
+                                    part.shard);
+      part.cursor = _mongoc_cursor_new (
+         shard->client, cursor->ns, cursor->flags, 0, 0, batch_size, false,
+         &query, cursor->has_fields ? &cursor->fields : NULL,
+         cursor->read_prefs);
+      part.cursor->prefetch = true;
+      part.cursor->operation_timeout_msec = cursor->operation_timeout_msec;
+      _mongoc_array_append_val (&scatter->parts, part);
+   }
+
+   bson_destroy (&query);
+   _mongoc_array_destroy (&owners);
+
+   cursor->iface_data = scatter;
+   memcpy (&cursor->iface, &gMongocCursorScatter,
+           sizeof (mongoc_cursor_interface_t));
+
+   RETURN (true);
+}
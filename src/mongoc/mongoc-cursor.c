@@ -21,7 +21,9 @@
 #include "mongoc-counters-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-memory-budget-private.h"
 #include "mongoc-opcode.h"
+#include "mongoc-read-prefs-private.h"
 #include "mongoc-trace.h"
 
 
@@ -78,23 +80,227 @@ _mongoc_cursor_get_read_mode_string (mongoc_read_mode_t mode)
 static int32_t
 _mongoc_n_return (mongoc_cursor_t * cursor)
 {
-   /* by default, use the batch size */
-   int32_t r = cursor->batch_size;
+   /* by default, use the batch size, or the adapted one */
+   int32_t r = cursor->adaptive_n_return ? cursor->adaptive_n_return
+                                         : cursor->batch_size;
+   uint32_t remaining;
 
    if (cursor->is_command) {
       /* commands always have n_return of 1 */
-      r = 1;
-   } else if (cursor->limit) {
-      /* calculate remaining */
-      uint32_t remaining = cursor->limit - cursor->count;
+      return 1;
+   }
+
+   if (cursor->limit) {
+      /*
+       * Never ask for more than the limit leaves, not even when the batch
+       * size is left to the server, which doesn't know the limit.
+       */
+      remaining = cursor->limit - cursor->count;
+      r = r ? BSON_MIN (r, (int32_t)remaining) : (int32_t)remaining;
+   }
 
-      /* use min of batch or remaining */
-      r = BSON_MIN(r, (int32_t)remaining);
+   /* a negative n_return has the server close the cursor after one batch */
+   if (cursor->single_batch && r > 0) {
+      r = -r;
    }
 
    return r;
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_alloc --
+ *
+ *       Allocates a zeroed cursor with an empty query and fields,
+ *       reusing a cursor released to @client if there is one. The storage
+ *       of its query, fields and batch offsets is kept, so building the
+ *       next query is a copy into memory already the right size.
+ *
+ * Returns:
+ *       A mongoc_cursor_t to be freed with _mongoc_cursor_free().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_cursor_t *
+_mongoc_cursor_alloc (mongoc_client_t *client)
+{
+   mongoc_cursor_t *cursor;
+   uint32_t *batch_offsets;
+   uint32_t batch_offsets_alloc;
+   bson_t query;
+   bson_t fields;
+
+   if (!client->free_cursors_len) {
+      cursor = bson_malloc0 (sizeof *cursor);
+      mongoc_counter_memory_cursors_add (sizeof *cursor);
+      bson_init (&cursor->query);
+      bson_init (&cursor->fields);
+      return cursor;
+   }
+
+   cursor = client->free_cursors[--client->free_cursors_len];
+
+   /*
+    * The bson_t are put back where they were, so that heap allocated
+    * ones still point at their own buffer.
+    */
+   memcpy (&query, &cursor->query, sizeof query);
+   memcpy (&fields, &cursor->fields, sizeof fields);
+   batch_offsets = cursor->batch_offsets;
+   batch_offsets_alloc = cursor->batch_offsets_alloc;
+
+   memset (cursor, 0, sizeof *cursor);
+
+   memcpy (&cursor->query, &query, sizeof query);
+   memcpy (&cursor->fields, &fields, sizeof fields);
+   cursor->batch_offsets = batch_offsets;
+   cursor->batch_offsets_alloc = batch_offsets_alloc;
+
+   bson_reinit (&cursor->query);
+   bson_reinit (&cursor->fields);
+
+   return cursor;
+}
+
+
+static void
+_mongoc_cursor_free (mongoc_cursor_t *cursor)
+{
+   mongoc_client_t *client = cursor->client;
+
+   if ((client->free_cursors_len < MONGOC_CLIENT_FREE_CURSORS_MAX) &&
+       (cursor->query.len <= MONGOC_CURSOR_REUSE_MAX_BSON) &&
+       (cursor->fields.len <= MONGOC_CURSOR_REUSE_MAX_BSON)) {
+      client->free_cursors[client->free_cursors_len++] = cursor;
+   } else {
+      _mongoc_cursor_dispose (cursor);
+   }
+}
+
+
+/*
+ * Link @cursor into the live cursors of its client, or out of them, so
+ * that _mongoc_client_abandon_cursors() can find it.
+ */
+static void
+_mongoc_cursor_track (mongoc_cursor_t *cursor)
+{
+   mongoc_client_t *client = cursor->client;
+
+   cursor->live_prev = NULL;
+   cursor->live_next = client->live_cursors;
+
+   if (client->live_cursors) {
+      client->live_cursors->live_prev = cursor;
+   }
+
+   client->live_cursors = cursor;
+}
+
+
+static void
+_mongoc_cursor_untrack (mongoc_cursor_t *cursor)
+{
+   if (cursor->live_prev) {
+      cursor->live_prev->live_next = cursor->live_next;
+   } else if (cursor->client->live_cursors == cursor) {
+      cursor->client->live_cursors = cursor->live_next;
+   }
+
+   if (cursor->live_next) {
+      cursor->live_next->live_prev = cursor->live_prev;
+   }
+
+   cursor->live_prev = NULL;
+   cursor->live_next = NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_dispose --
+ *
+ *       Frees a cursor released by mongoc_cursor_destroy() for good. Used
+ *       by the client to empty its list of cursors for reuse.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_dispose (mongoc_cursor_t *cursor)
+{
+   mongoc_counter_memory_cursors_add (
+      -(int64_t)(sizeof *cursor +
+                 cursor->batch_offsets_alloc * sizeof (uint32_t)));
+   bson_destroy (&cursor->query);
+   bson_destroy (&cursor->fields);
+   bson_free (cursor->batch_offsets);
+   bson_free (cursor);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_append_read_prefs --
+ *
+ *       Appends "$readPreference" to the wrapped @query if @read_prefs
+ *       can't be expressed with the slaveOk bit alone.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_append_read_prefs (bson_t                    *query,
+                                  const mongoc_read_prefs_t *read_prefs)
+{
+   mongoc_read_mode_t mode;
+   const bson_t *tags;
+   int64_t max_staleness_msec;
+   const char *mode_str;
+   bson_t child;
+
+   mode = mongoc_read_prefs_get_mode (read_prefs);
+   tags = mongoc_read_prefs_get_tags (read_prefs);
+   max_staleness_msec = mongoc_read_prefs_get_max_staleness_ms (read_prefs);
+
+   if ((mode != MONGOC_READ_PRIMARY) &&
+       ((mode != MONGOC_READ_SECONDARY_PREFERRED) || tags ||
+        max_staleness_msec)) {
+      bson_append_document_begin (query, "$readPreference", 15, &child);
+      mode_str = _mongoc_cursor_get_read_mode_string (mode);
+      bson_append_utf8 (&child, "mode", 4, mode_str, -1);
+      if (tags) {
+         bson_append_array (&child, "tags", 4, tags);
+      }
+      if (max_staleness_msec) {
+         /* mongos takes whole seconds, round up */
+         bson_append_int64 (&child, "maxStalenessSeconds", 19,
+                            (max_staleness_msec + 999) / 1000);
+      }
+      bson_append_document_end (query, &child);
+   }
+}
+
+
 mongoc_cursor_t *
 _mongoc_cursor_new (mongoc_client_t           *client,
                     const char                *db_and_collection,
@@ -110,11 +316,8 @@ _mongoc_cursor_new (mongoc_client_t           *client,
    mongoc_read_prefs_t *local_read_prefs = NULL;
    mongoc_read_mode_t mode;
    mongoc_cursor_t *cursor;
-   const bson_t *tags;
    bson_iter_t iter;
    const char *key;
-   const char *mode_str;
-   bson_t child;
    bool found = false;
    int i;
 
@@ -128,7 +331,7 @@ _mongoc_cursor_new (mongoc_client_t           *client,
       read_prefs = client->read_prefs;
    }
 
-   cursor = bson_malloc0 (sizeof *cursor);
+   cursor = _mongoc_cursor_alloc (client);
 
    /*
     * DRIVERS-63:
@@ -177,6 +380,7 @@ _mongoc_cursor_new (mongoc_client_t           *client,
     */
 
    cursor->client = client;
+   _mongoc_cursor_track (cursor);
    bson_strncpy (cursor->ns, db_and_collection, sizeof cursor->ns);
    cursor->nslen = (uint32_t)strlen(cursor->ns);
    cursor->flags = flags;
@@ -188,8 +392,6 @@ _mongoc_cursor_new (mongoc_client_t           *client,
 
 #define MARK_FAILED(c) \
    do { \
-      bson_init (&(c)->query); \
-      bson_init (&(c)->fields); \
       (c)->failed = true; \
       (c)->done = true; \
       (c)->end_of_event = true; \
@@ -271,41 +473,27 @@ _mongoc_cursor_new (mongoc_client_t           *client,
    }
 
    if (!cursor->is_command && !bson_has_field (query, "$query")) {
-      bson_init (&cursor->query);
       bson_append_document (&cursor->query, "$query", 6, query);
    } else {
-      bson_copy_to (query, &cursor->query);
+      bson_concat (&cursor->query, query);
    }
 
    if (read_prefs) {
-      cursor->read_prefs = mongoc_read_prefs_copy (read_prefs);
+      cursor->read_prefs = _mongoc_read_prefs_share (read_prefs);
 
       mode = mongoc_read_prefs_get_mode (read_prefs);
-      tags = mongoc_read_prefs_get_tags (read_prefs);
 
       if (mode != MONGOC_READ_PRIMARY) {
          flags |= MONGOC_QUERY_SLAVE_OK;
-
-         if ((mode != MONGOC_READ_SECONDARY_PREFERRED) || tags) {
-            bson_append_document_begin (&cursor->query, "$readPreference",
-                                        15, &child);
-            mode_str = _mongoc_cursor_get_read_mode_string (mode);
-            bson_append_utf8 (&child, "mode", 4, mode_str, -1);
-            if (tags) {
-               bson_append_array (&child, "tags", 4, tags);
-            }
-            bson_append_document_end (&cursor->query, &child);
-         }
+         _mongoc_cursor_append_read_prefs (&cursor->query, read_prefs);
       }
    }
 
    if (fields) {
-      bson_copy_to(fields, &cursor->fields);
-   } else {
-      bson_init(&cursor->fields);
+      bson_concat (&cursor->fields, fields);
    }
 
-   _mongoc_buffer_init(&cursor->buffer, NULL, 0, NULL, NULL);
+   _mongoc_client_recv_buffer_take (client, &cursor->buffer);
 
 finish:
    mongoc_counter_cursors_active_inc();
@@ -334,36 +522,137 @@ mongoc_cursor_destroy (mongoc_cursor_t *cursor)
    EXIT;
 }
 
-void
-_mongoc_cursor_destroy (mongoc_cursor_t *cursor)
+
+/*
+ * Drops the connection a reply is still being read from, since the rest
+ * of it can't be skipped, and frees the client for other operations.
+ */
+static void
+_mongoc_cursor_incremental_abort (mongoc_cursor_t *cursor)
 {
-   ENTRY;
+   if (cursor->incremental_remaining) {
+      _mongoc_cluster_disconnect_node (
+         &cursor->client->cluster,
+         &cursor->client->cluster.nodes[cursor->hint - 1]);
+      cursor->incremental_remaining = 0;
+      cursor->client->in_exhaust = false;
+   }
+}
 
-   bson_return_if_fail(cursor);
+
+/*
+ * Let go of what @cursor holds on the server: queue its server cursor to
+ * be killed, or drop the connection of an exhaust or partly read reply.
+ */
+static void
+_mongoc_cursor_release (mongoc_cursor_t *cursor)
+{
+   int64_t cursor_id;
 
    if (cursor->in_exhaust) {
       cursor->client->in_exhaust = false;
+      cursor->in_exhaust = false;
 
       if (!cursor->done) {
          _mongoc_cluster_disconnect_node (
             &cursor->client->cluster,
             &cursor->client->cluster.nodes[cursor->hint - 1]);
       }
-   } else if (cursor->rpc.reply.cursor_id) {
-      mongoc_client_kill_cursor(cursor->client, cursor->rpc.reply.cursor_id);
+   } else {
+      _mongoc_cursor_incremental_abort (cursor);
+
+      cursor_id = cursor->rpc.reply.cursor_id;
+
+      if (cursor->prefetch_sent && _mongoc_cursor_prefetch_recv (cursor)) {
+         cursor_id = cursor->prefetch_rpc.reply.cursor_id;
+      }
+
+      if (cursor_id) {
+         _mongoc_client_kill_cursor_deferred (cursor->client, cursor->hint,
+                                              cursor_id);
+      }
    }
 
-   if (cursor->reader) {
-      bson_reader_destroy(cursor->reader);
-      cursor->reader = NULL;
+   cursor->rpc.reply.cursor_id = 0;
+   cursor->prefetch_rpc.reply.cursor_id = 0;
+   cursor->prefetch_sent = false;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_abandon --
+ *
+ *       Release what @cursor holds on the server, when its client goes
+ *       back to the pool before the cursor is destroyed. The cursor
+ *       fails from then on, unless it has no server cursor left, in
+ *       which case the documents it already received can still be read.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The server cursor is queued to be killed along with those of
+ *       destroyed cursors.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_abandon (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+
+   if (cursor->done ||
+       !(cursor->in_exhaust || cursor->incremental_remaining ||
+         cursor->prefetch_sent || cursor->rpc.reply.cursor_id)) {
+      EXIT;
    }
 
-   bson_destroy(&cursor->query);
-   bson_destroy(&cursor->fields);
-   _mongoc_buffer_destroy(&cursor->buffer);
+   _mongoc_cursor_release (cursor);
+
+   bson_set_error (&cursor->error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                   "The client of the cursor was returned to the pool.");
+   cursor->done = true;
+   cursor->failed = true;
+
+   EXIT;
+}
+
+
+void
+_mongoc_cursor_destroy (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   bson_return_if_fail(cursor);
+
+   _mongoc_cursor_release (cursor);
+   _mongoc_cursor_untrack (cursor);
+
+   _mongoc_client_recv_buffer_release (cursor->client, &cursor->buffer);
+   if (cursor->prefetch_buffer.data) {
+      _mongoc_client_recv_buffer_release (cursor->client,
+                                          &cursor->prefetch_buffer);
+   }
+   _mongoc_memory_budget_release (cursor->prefetch_reserved);
    mongoc_read_prefs_destroy(cursor->read_prefs);
+   _mongoc_cursor_field_index_destroy (cursor->field_index);
+
+   if (cursor->cache_key) {
+      bson_destroy (cursor->cache_key);
+   }
+
+   if (cursor->flight_key) {
+      bson_destroy (cursor->flight_key);
+   }
 
-   bson_free(cursor);
+   _mongoc_cursor_free (cursor);
 
    mongoc_counter_cursors_active_dec();
    mongoc_counter_cursors_disposed_inc();
@@ -433,6 +722,14 @@ _mongoc_cursor_unwrap_failure (mongoc_cursor_t *cursor)
                         MONGOC_ERROR_QUERY_FAILURE,
                         "Unknown query failure.");
       }
+
+      /* a shard refused a routed find, read the chunk map again */
+      if (cursor->client->routed_by &&
+          ((cursor->rpc.reply.flags & MONGOC_REPLY_SHARD_CONFIG_STALE) ||
+           _mongoc_shard_router_is_stale ((int32_t)cursor->error.code))) {
+         _mongoc_shard_router_invalidate (cursor->client->routed_by,
+                                          cursor->ns);
+      }
       RETURN(true);
    } else if (cursor->is_command) {
       if (_mongoc_rpc_reply_get_first (&cursor->rpc.reply, &b)) {
@@ -466,173 +763,382 @@ _mongoc_cursor_unwrap_failure (mongoc_cursor_t *cursor)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_adapt_batch_size --
+ *
+ *       Picks the number of documents to request in the next OP_GET_MORE
+ *       after a reply has been received, if the cursor has an adaptive
+ *       batch size.
+ *
+ *       The batch size doubles while the cursor spent less time consuming
+ *       the previous batch than waiting for this one, and is capped so
+ *       that a batch of documents of the observed average size stays
+ *       within the cursor's byte limit.
+ *
+ *       @wait_start is when the cursor started waiting for the reply.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Updates the batch size used by _mongoc_n_return().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cursor_adapt_batch_size (mongoc_cursor_t *cursor,
+                                 int64_t          wait_start)
+{
+   int64_t now;
+   uint32_t n_returned;
+   uint32_t avg_size;
+   uint32_t max_n;
+   uint32_t n;
+
+   BSON_ASSERT (cursor);
+
+   now = bson_get_monotonic_time ();
+   n_returned = (uint32_t)cursor->rpc.reply.n_returned;
+
+   /*
+    * The reply to a command is not a batch. A command cursor adapts its
+    * batches once it is past the first.
+    */
+   if (cursor->adaptive_max_bytes && n_returned && !cursor->is_command) {
+      avg_size = BSON_MAX (1, cursor->rpc.reply.documents_len / n_returned);
+      max_n = BSON_MAX (1, cursor->adaptive_max_bytes / avg_size);
+
+      n = cursor->adaptive_n_return;
+      if (!n) {
+         n = cursor->batch_size ? cursor->batch_size : n_returned;
+      }
+
+      if (!cursor->batch_recv_time ||
+          (wait_start - cursor->batch_recv_time) < (now - wait_start)) {
+         n = (n > max_n / 2) ? max_n : n * 2;
+      }
+
+      cursor->adaptive_n_return = BSON_MIN (n, max_n);
+   }
+
+   cursor->batch_recv_time = now;
+}
+
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_recv --
+ *
+ *       Receives the reply to the cursor's OP_QUERY or OP_GET_MORE into
+ *       the cursor's buffer.
+ *
+ *       If the reply carries more than the cursor's incremental threshold
+ *       of documents, only its header is read and the documents are left
+ *       on the connection for _mongoc_cursor_read_incremental(). Command
+ *       replies, query failures and the replies of exhaust cursors are
+ *       always read in full.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ * Side effects:
+ *       While documents are left on the connection, the client refuses
+ *       other operations as it does for a cursor in exhaust.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 static bool
-_mongoc_cursor_query (mongoc_cursor_t *cursor)
+_mongoc_cursor_recv (mongoc_cursor_t *cursor)
 {
-   mongoc_rpc_t rpc;
-   uint32_t hint;
-   uint32_t request_id;
+   mongoc_cluster_t *cluster = &cursor->client->cluster;
+   uint32_t remaining;
 
    ENTRY;
 
-   bson_return_val_if_fail (cursor, false);
+   _mongoc_buffer_clear (&cursor->buffer, false);
+   _mongoc_buffer_shrink (&cursor->buffer);
 
-   if (!_mongoc_client_warm_up (cursor->client, &cursor->error)) {
-      cursor->failed = true;
+   if (!cursor->incremental_threshold ||
+       cursor->is_command ||
+       (cursor->flags & MONGOC_QUERY_EXHAUST)) {
+      RETURN (_mongoc_client_recv (cursor->client, &cursor->rpc,
+                                   &cursor->buffer, cursor->hint,
+                                   &cursor->error));
+   }
+
+   if (!_mongoc_cluster_try_recv_partial (cluster, &cursor->rpc,
+                                          &cursor->buffer, cursor->hint,
+                                          &cursor->error)) {
       RETURN (false);
    }
 
-   rpc.query.msg_len = 0;
-   rpc.query.request_id = 0;
-   rpc.query.response_to = 0;
-   rpc.query.opcode = MONGOC_OPCODE_QUERY;
-   rpc.query.flags = cursor->flags;
-   rpc.query.collection = cursor->ns;
-   rpc.query.skip = cursor->skip;
-   if ((cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR)) {
-      rpc.query.n_return = 0;
-   } else {
-      rpc.query.n_return = _mongoc_n_return(cursor);
+   /*
+    * The reply was read in full if the node compresses its replies.
+    */
+   if (cursor->rpc.reply.documents) {
+      RETURN (true);
    }
-   rpc.query.query = bson_get_data(&cursor->query);
 
-   if (cursor->has_fields) {
-      rpc.query.fields = bson_get_data (&cursor->fields);
-   } else {
-      rpc.query.fields = NULL;
+   remaining = cursor->rpc.reply.documents_len;
+
+   if (remaining > cursor->incremental_threshold &&
+       cursor->rpc.header.opcode == MONGOC_OPCODE_REPLY &&
+       !(cursor->rpc.reply.flags & MONGOC_REPLY_QUERY_FAILURE)) {
+      cursor->incremental_remaining = remaining;
+      cursor->client->in_exhaust = true;
+      RETURN (true);
    }
 
-   if (!(hint = _mongoc_client_sendv (cursor->client, &rpc, 1,
-                                      cursor->hint, NULL,
-                                      cursor->read_prefs,
-                                      &cursor->error))) {
-      GOTO (failure);
+   if (remaining &&
+       !_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                       cursor->hint, remaining,
+                                       &cursor->error)) {
+      RETURN (false);
    }
 
-   cursor->hint = hint;
-   request_id = BSON_UINT32_FROM_LE(rpc.header.request_id);
+   cursor->rpc.reply.documents = cursor->buffer.data +
+                                 cursor->buffer.off +
+                                 cursor->buffer.len - remaining;
 
-   _mongoc_buffer_clear(&cursor->buffer, false);
+   RETURN (true);
+}
 
-   if (!_mongoc_client_recv(cursor->client,
-                            &cursor->rpc,
-                            &cursor->buffer,
-                            hint,
-                            &cursor->error)) {
-      GOTO (failure);
-   }
 
-   if (cursor->rpc.header.opcode != MONGOC_OPCODE_REPLY) {
-      bson_set_error (&cursor->error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Invalid opcode. Expected %d, got %d.",
-                      MONGOC_OPCODE_REPLY, cursor->rpc.header.opcode);
-      GOTO (failure);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_read_incremental --
+ *
+ *       Reads the next document of a reply that _mongoc_cursor_recv() left
+ *       on the connection. The cursor's buffer only ever holds this one
+ *       document, which is valid until the next call.
+ *
+ *       @eof is set once the last document of the reply has been read.
+ *
+ * Returns:
+ *       The document, or NULL on failure and the cursor is failed.
+ *
+ * Side effects:
+ *       The client is free for other operations once the reply has been
+ *       read, or the connection has been dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static const bson_t *
+_mongoc_cursor_read_incremental (mongoc_cursor_t *cursor,
+                                 bool            *eof)
+{
+   mongoc_cluster_t *cluster = &cursor->client->cluster;
+   int32_t doc_len;
+
+   ENTRY;
+
+   if (cursor->incremental_remaining < 5) {
+      GOTO (corrupt);
    }
 
-   if (cursor->rpc.header.response_to != request_id) {
-      bson_set_error (&cursor->error,
-                      MONGOC_ERROR_PROTOCOL,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "Invalid response_to. Expected %d, got %d.",
-                      request_id, cursor->rpc.header.response_to);
+   _mongoc_buffer_clear (&cursor->buffer, false);
+
+   if (!_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                       cursor->hint, 4, &cursor->error)) {
       GOTO (failure);
    }
 
-   if (_mongoc_cursor_unwrap_failure(cursor)) {
+   memcpy (&doc_len, cursor->buffer.data + cursor->buffer.off, 4);
+   doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+   if (doc_len < 5 || (uint32_t)doc_len > cursor->incremental_remaining) {
+      GOTO (corrupt);
+   }
+
+   if (!_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                       cursor->hint, doc_len - 4,
+                                       &cursor->error)) {
       GOTO (failure);
    }
 
-   if (cursor->reader) {
-      bson_reader_destroy(cursor->reader);
+   if (!bson_init_static (&cursor->incremental_doc,
+                          cursor->buffer.data + cursor->buffer.off,
+                          doc_len)) {
+      GOTO (corrupt);
    }
 
-   cursor->reader = bson_reader_new_from_data(cursor->rpc.reply.documents,
-                                              cursor->rpc.reply.documents_len);
+   cursor->incremental_remaining -= doc_len;
 
-   if ((cursor->flags & MONGOC_QUERY_EXHAUST)) {
-      cursor->in_exhaust = true;
-      cursor->client->in_exhaust = true;
+   if (!cursor->incremental_remaining) {
+      cursor->client->in_exhaust = false;
+      *eof = true;
    }
 
-   cursor->done = false;
-   cursor->end_of_event = false;
-   cursor->sent = true;
-
-   RETURN (true);
+   RETURN (&cursor->incremental_doc);
 
 failure:
+   /*
+    * The node was disconnected by the failed read.
+    */
+   cursor->incremental_remaining = 0;
+   cursor->client->in_exhaust = false;
    cursor->failed = true;
    cursor->done = true;
 
-   RETURN (false);
+   RETURN (NULL);
+
+corrupt:
+   bson_set_error (&cursor->error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "The reply was corrupt.");
+   _mongoc_cursor_incremental_abort (cursor);
+   cursor->failed = true;
+   cursor->done = true;
+
+   RETURN (NULL);
 }
 
 
-static bool
-_mongoc_cursor_get_more (mongoc_cursor_t *cursor)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_reader_reset --
+ *
+ *       Point the reader of @cursor at the @len bytes of documents at
+ *       @data, in place of bson_reader_new_from_data(), so that reading
+ *       batch after batch allocates nothing.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       cursor->reader is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_cursor_reader_reset (mongoc_cursor_t *cursor,
+                             const uint8_t   *data,
+                             size_t           len)
 {
-   uint64_t cursor_id;
-   uint32_t request_id;
-   mongoc_rpc_t rpc;
+   cursor->reader_storage.data = data;
+   cursor->reader_storage.len = len;
+   cursor->reader_storage.off = 0;
+   cursor->reader = &cursor->reader_storage;
+}
 
-   ENTRY;
 
-   BSON_ASSERT (cursor);
+/*
+ * Reads the next document of @reader, as bson_reader_read() does: *@eof
+ * is true once the documents are read to their exact end.
+ */
+static const bson_t *
+_mongoc_cursor_reader_read (mongoc_cursor_reader_t *reader,
+                            bool                   *eof)
+{
+   uint32_t len;
 
-   if (!cursor->in_exhaust) {
-      if (!_mongoc_client_warm_up (cursor->client, &cursor->error)) {
-         cursor->failed = true;
-         RETURN (false);
-      }
+   *eof = false;
 
-      if (!(cursor_id = cursor->rpc.reply.cursor_id)) {
-         bson_set_error(&cursor->error,
-                        MONGOC_ERROR_CURSOR,
-                        MONGOC_ERROR_CURSOR_INVALID_CURSOR,
-                        "No valid cursor was provided.");
-         GOTO (failure);
-      }
+   if (reader->off + 4 < reader->len) {
+      memcpy (&len, reader->data + reader->off, 4);
+      len = BSON_UINT32_FROM_LE (len);
 
-      rpc.get_more.msg_len = 0;
-      rpc.get_more.request_id = 0;
-      rpc.get_more.response_to = 0;
-      rpc.get_more.opcode = MONGOC_OPCODE_GET_MORE;
-      rpc.get_more.zero = 0;
-      rpc.get_more.collection = cursor->ns;
-      if ((cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR)) {
-         rpc.get_more.n_return = 0;
-      } else {
-         rpc.get_more.n_return = _mongoc_n_return(cursor);
+      if ((len < 5) || (len > reader->len - reader->off) ||
+          !bson_init_static (&reader->doc, reader->data + reader->off, len)) {
+         return NULL;
       }
-      rpc.get_more.cursor_id = cursor_id;
 
-      /*
-       * TODO: Stamp protections for disconnections.
-       */
+      reader->off += len;
 
-      if (!_mongoc_client_sendv(cursor->client, &rpc, 1, cursor->hint,
-                                NULL, cursor->read_prefs, &cursor->error)) {
-         cursor->done = true;
-         cursor->failed = true;
-         RETURN (false);
-      }
+      return &reader->doc;
+   }
 
-      request_id = BSON_UINT32_FROM_LE(rpc.header.request_id);
-   } else {
-      request_id = BSON_UINT32_FROM_LE(cursor->rpc.header.request_id);
+   *eof = (reader->off == reader->len);
+
+   return NULL;
+}
+
+
+/*
+ * Reads the next document of the current batch, wherever it is.
+ */
+static const bson_t *
+_mongoc_cursor_read (mongoc_cursor_t *cursor,
+                     bool            *eof)
+{
+   if (cursor->incremental_remaining) {
+      return _mongoc_cursor_read_incremental (cursor, eof);
    }
 
-   _mongoc_buffer_clear(&cursor->buffer, false);
+   if (cursor->reader) {
+      return _mongoc_cursor_reader_read (cursor->reader, eof);
+   }
 
-   if (!_mongoc_client_recv(cursor->client,
-                            &cursor->rpc,
-                            &cursor->buffer,
-                            cursor->hint,
-                            &cursor->error)) {
-      GOTO (failure);
+   *eof = true;
+
+   return NULL;
+}
+
+
+/*
+ * Fills @rpc with the cursor's OP_QUERY.
+ */
+static void
+_mongoc_cursor_prepare_query (mongoc_cursor_t *cursor,
+                              mongoc_rpc_t    *rpc)
+{
+   rpc->query.msg_len = 0;
+   rpc->query.request_id = 0;
+   rpc->query.response_to = 0;
+   rpc->query.opcode = MONGOC_OPCODE_QUERY;
+   rpc->query.flags = cursor->flags;
+   rpc->query.collection = cursor->ns;
+   rpc->query.skip = cursor->skip;
+   if ((cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR)) {
+      rpc->query.n_return = 0;
+   } else {
+      rpc->query.n_return = _mongoc_n_return(cursor);
+   }
+   rpc->query.query = bson_get_data(&cursor->query);
+
+   if (cursor->has_fields) {
+      rpc->query.fields = bson_get_data (&cursor->fields);
+   } else {
+      rpc->query.fields = NULL;
    }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_query_reply --
+ *
+ *       Checks the reply to the cursor's OP_QUERY numbered @request_id,
+ *       which has been received into cursor->rpc, and sets up the cursor
+ *       to iterate its documents.
+ *
+ * Returns:
+ *       true if successful; otherwise false and cursor->error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cursor_query_reply (mongoc_cursor_t *cursor,
+                            uint32_t         request_id,
+                            int64_t          wait_start)
+{
+   ENTRY;
 
    if (cursor->rpc.header.opcode != MONGOC_OPCODE_REPLY) {
       bson_set_error (&cursor->error,
@@ -640,7 +1146,7 @@ _mongoc_cursor_get_more (mongoc_cursor_t *cursor)
                       MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
                       "Invalid opcode. Expected %d, got %d.",
                       MONGOC_OPCODE_REPLY, cursor->rpc.header.opcode);
-      GOTO (failure);
+      RETURN (false);
    }
 
    if (cursor->rpc.header.response_to != request_id) {
@@ -649,150 +1155,1097 @@ _mongoc_cursor_get_more (mongoc_cursor_t *cursor)
                       MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
                       "Invalid response_to. Expected %d, got %d.",
                       request_id, cursor->rpc.header.response_to);
-      GOTO (failure);
+      RETURN (false);
    }
 
    if (_mongoc_cursor_unwrap_failure(cursor)) {
-      GOTO (failure);
+      RETURN (false);
    }
 
-   if (cursor->reader) {
-      bson_reader_destroy(cursor->reader);
-   }
+   cursor->reader = NULL;
 
-   cursor->reader = bson_reader_new_from_data(cursor->rpc.reply.documents,
-                                              cursor->rpc.reply.documents_len);
+   if (!cursor->incremental_remaining) {
+      _mongoc_cursor_reader_reset (cursor, cursor->rpc.reply.documents,
+                                   cursor->rpc.reply.documents_len);
 
-   cursor->end_of_event = false;
+      if (cursor->cache_key && !cursor->rpc.reply.cursor_id) {
+         _mongoc_query_cache_add (&cursor->client->query_cache, cursor->ns,
+                                  cursor->cache_key,
+                                  cursor->rpc.reply.documents,
+                                  cursor->rpc.reply.documents_len);
+         cursor->cache_key = NULL;
+      }
+   }
+   cursor->batch_read = 0;
 
-   RETURN(true);
+   _mongoc_cursor_adapt_batch_size (cursor, wait_start);
 
-failure:
-   cursor->done = true;
-   cursor->failed = true;
+   if ((cursor->flags & MONGOC_QUERY_EXHAUST)) {
+      cursor->in_exhaust = true;
+      cursor->client->in_exhaust = true;
+   }
 
-   RETURN(false);
+   cursor->done = false;
+   cursor->end_of_event = false;
+   cursor->sent = true;
+
+   RETURN (true);
 }
 
 
-bool
-mongoc_cursor_error (mongoc_cursor_t *cursor,
-                     bson_error_t    *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_is_retryable --
+ *
+ *       Check whether the OP_QUERY of @cursor may be sent again after its
+ *       connection was lost. Queries only read, but commands are retried
+ *       only if they are known to be read-only, and exhaust cursors never
+ *       are, since their replies keep coming on the connection.
+ *
+ * Returns:
+ *       true if the query is safe to repeat.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_cursor_is_retryable (const mongoc_cursor_t *cursor)
 {
-   bool ret;
+   static const char *read_commands[] = {
+      "buildinfo", "buildInfo", "collStats", "collstats", "count",
+      "dbStats", "dbstats", "distinct", "geoNear", "geoSearch", "isMaster",
+      "ismaster", "listCollections", "listDatabases", "listIndexes",
+      "ping", "serverStatus", NULL
+   };
+   bson_iter_t iter;
+   bson_iter_t child;
+   const char *name;
+   int i;
 
-   ENTRY;
+   if ((cursor->flags & MONGOC_QUERY_EXHAUST) ||
+       cursor->incremental_remaining) {
+      return false;
+   }
 
-   BSON_ASSERT(cursor);
+   if (!cursor->is_command) {
+      return true;
+   }
 
-   if (cursor->iface.error) {
-      ret = cursor->iface.error(cursor, error);
+   if (!bson_iter_init (&iter, &cursor->query) || !bson_iter_next (&iter)) {
+      return false;
+   }
+
+   /* commands sent to mongos with read preferences are wrapped */
+   if (!strcmp (bson_iter_key (&iter), "$query")) {
+      if (!BSON_ITER_HOLDS_DOCUMENT (&iter) ||
+          !bson_iter_recurse (&iter, &child) ||
+          !bson_iter_next (&child)) {
+         return false;
+      }
+      name = bson_iter_key (&child);
    } else {
-      ret = _mongoc_cursor_error(cursor, error);
+      name = bson_iter_key (&iter);
    }
 
-   if (ret && error) {
-      /*
-       * Rewrite the error code if we are talking to an older mongod
-       * and the command was not found. It used to simply return an
-       * error code of 17 and we can synthesize 59.
-       *
-       * Additionally, old versions of mongos may send 13390 indicating
-       * unrecognized command.
-       */
-      if (cursor->is_command &&
-          ((error->code == MONGOC_ERROR_PROTOCOL_ERROR) ||
-           (error->code == 13390))) {
-         error->code = MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND;
+   for (i = 0; read_commands[i]; i++) {
+      if (!strcmp (name, read_commands[i])) {
+         return true;
       }
    }
 
-   RETURN(ret);
+   return false;
 }
 
 
-bool
-_mongoc_cursor_error (mongoc_cursor_t *cursor,
-                      bson_error_t    *error)
+static bool
+_mongoc_cursor_query (mongoc_cursor_t *cursor)
 {
+   mongoc_rpc_t rpc;
+   uint32_t hint;
+   uint32_t request_id;
+   int64_t wait_start;
+   bool pinned;
+   bool retried = false;
+
    ENTRY;
 
-   bson_return_val_if_fail(cursor, false);
+   bson_return_val_if_fail (cursor, false);
 
-   if (BSON_UNLIKELY(cursor->failed)) {
-      bson_set_error(error,
-                     cursor->error.domain,
-                     cursor->error.code,
-                     "%s",
-                     cursor->error.message);
-      RETURN(true);
+   wait_start = bson_get_monotonic_time ();
+
+   if (!_mongoc_client_warm_up (cursor->client, &cursor->error)) {
+      cursor->failed = true;
+      RETURN (false);
    }
 
-   RETURN(false);
-}
+   _mongoc_cursor_prepare_query (cursor, &rpc);
 
+   if (cursor->client->prefetch_cursor) {
+      _mongoc_cursor_prefetch_recv (cursor->client->prefetch_cursor);
+   }
 
-bool
-mongoc_cursor_next (mongoc_cursor_t  *cursor,
-                    const bson_t    **bson)
-{
-   bool ret;
+   if (cursor->flight_key && cursor->client->query_flights) {
+      cursor->flight = _mongoc_query_flights_take_off (
+         cursor->client->query_flights, cursor->ns, cursor->flight_key);
+   }
 
-   ENTRY;
+   if (!cursor->hint && !cursor->client->in_exhaust &&
+       _mongoc_cluster_can_hedge (&cursor->client->cluster, &rpc,
+                                  cursor->read_prefs)) {
+      _mongoc_buffer_clear(&cursor->buffer, false);
+      _mongoc_buffer_shrink(&cursor->buffer);
+
+      if (!(hint = _mongoc_cluster_query_hedged (&cursor->client->cluster,
+                                                 &rpc,
+                                                 cursor->read_prefs,
+                                                 &cursor->rpc,
+                                                 &cursor->buffer,
+                                                 &cursor->error))) {
+         GOTO (failure);
+      }
 
-   BSON_ASSERT(cursor);
-   BSON_ASSERT(bson);
+      cursor->hint = hint;
+      request_id = cursor->rpc.header.response_to;
+   } else {
+      pinned = !!cursor->hint;
+
+      for (;;) {
+         if ((hint = _mongoc_client_sendv (cursor->client, &rpc, 1,
+                                           cursor->hint, NULL,
+                                           cursor->read_prefs,
+                                           &cursor->error))) {
+            cursor->hint = hint;
+            request_id = BSON_UINT32_FROM_LE(rpc.header.request_id);
+
+            if (_mongoc_cursor_recv (cursor)) {
+               break;
+            }
+         }
 
-   TRACE ("cursor_id(%"PRId64")", cursor->rpc.reply.cursor_id);
+         if (retried || pinned || !_mongoc_cursor_is_retryable (cursor) ||
+             !_mongoc_cluster_prepare_retry (&cursor->client->cluster, false,
+                                             &cursor->error)) {
+            GOTO (failure);
+         }
 
-   if (bson) {
-      *bson = NULL;
+         /* the rpc was swabbed on its way out */
+         retried = true;
+         cursor->hint = 0;
+         _mongoc_cursor_prepare_query (cursor, &rpc);
+      }
    }
 
-   if (cursor->failed) {
-      return false;
+   if (!_mongoc_cursor_query_reply (cursor, request_id, wait_start)) {
+      GOTO (failure);
    }
 
-   if (cursor->iface.next) {
-      ret = cursor->iface.next(cursor, bson);
-   } else {
-      ret = _mongoc_cursor_next(cursor, bson);
+   if (cursor->flight) {
+      /* shared only if the first reply holds all the results */
+      if (!cursor->rpc.reply.cursor_id && !cursor->incremental_remaining) {
+         _mongoc_query_flights_land (cursor->client->query_flights,
+                                     cursor->flight,
+                                     cursor->rpc.reply.documents,
+                                     cursor->rpc.reply.documents_len);
+      } else {
+         _mongoc_query_flights_land (cursor->client->query_flights,
+                                     cursor->flight, NULL, 0);
+      }
+      cursor->flight = NULL;
    }
 
+   RETURN (true);
+
+failure:
+   if (cursor->flight) {
+      _mongoc_query_flights_land (cursor->client->query_flights,
+                                  cursor->flight, NULL, 0);
+      cursor->flight = NULL;
+   }
+
+   _mongoc_cursor_incremental_abort (cursor);
+   cursor->failed = true;
+   cursor->done = true;
+
+   RETURN (false);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_query_many --
+ *
+ *       Sends the OP_QUERY of each of @cursors in a single write to one
+ *       node, then reads the replies in order, so that starting
+ *       @n_cursors cursors costs about one round trip. The cursors must
+ *       belong to the same client and not have been started. The node is
+ *       picked with the read preferences of the first cursor, or with
+ *       those of the first command that had to be rerouted to the
+ *       primary, since every query goes to the same node.
+ *
+ *       Replies are always read in full, since each must be off the
+ *       connection before the next one can be read.
+ *
+ * Returns:
+ *       true if every reply was received; otherwise false and @error is
+ *       set. A query that the server fails only fails its own cursor.
+ *
+ * Side effects:
+ *       The cursors whose reply was not received fail with @error.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_query_many (mongoc_cursor_t **cursors,
+                           uint32_t          n_cursors,
+                           bson_error_t     *error)
+{
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const mongoc_read_prefs_t *read_prefs;
+   mongoc_rpc_t *rpcs;
+   bson_error_t local_error;
+   uint32_t request_id;
+   int64_t wait_start;
+   uint32_t hint;
+   uint32_t i;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (cursors);
+   BSON_ASSERT (n_cursors);
+
+   client = cursors[0]->client;
+   read_prefs = cursors[0]->read_prefs;
+   wait_start = bson_get_monotonic_time ();
+   rpcs = bson_malloc (n_cursors * sizeof *rpcs);
+
+   for (i = 0; i < n_cursors; i++) {
+      BSON_ASSERT (cursors[i]->client == client);
+      BSON_ASSERT (!cursors[i]->sent);
+      _mongoc_cursor_prepare_query (cursors[i], &rpcs[i]);
+
+      if (cursors[i]->redir_primary && read_prefs == cursors[0]->read_prefs) {
+         read_prefs = cursors[i]->read_prefs;
+      }
+   }
+
+   i = 0;
+
+   if (!_mongoc_client_warm_up (client, &local_error) ||
+       !(hint = _mongoc_client_sendv (client, rpcs, n_cursors, 0, NULL,
+                                      read_prefs, &local_error))) {
+      GOTO (failure);
+   }
+
+   for (; i < n_cursors; i++) {
+      cursor = cursors[i];
+      cursor->hint = hint;
+      request_id = BSON_UINT32_FROM_LE (rpcs[i].header.request_id);
+
+      _mongoc_buffer_clear (&cursor->buffer, false);
+      _mongoc_buffer_shrink (&cursor->buffer);
+
+      if (!_mongoc_client_recv (client, &cursor->rpc, &cursor->buffer, hint,
+                                &local_error)) {
+         GOTO (failure);
+      }
+
+      if (!_mongoc_cursor_query_reply (cursor, request_id, wait_start)) {
+         cursor->failed = true;
+         cursor->done = true;
+      }
+   }
+
+   ret = true;
+
+   GOTO (done);
+
+failure:
+   for (; i < n_cursors; i++) {
+      memcpy (&cursors[i]->error, &local_error, sizeof local_error);
+      cursors[i]->failed = true;
+      cursors[i]->done = true;
+   }
+
+   if (error) {
+      memcpy (error, &local_error, sizeof *error);
+   }
+
+done:
+   bson_free (rpcs);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_query_parallel --
+ *
+ *       Sends the OP_QUERY of each of @cursors, which must each belong to
+ *       a different client and not have been started, before reading any
+ *       reply. The servers then run the queries at the same time and
+ *       starting @n_cursors cursors takes about as long as the slowest.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A cursor whose query could not be sent is left as it was, to be
+ *       started the usual way, with a retry, when it is first read. A
+ *       cursor whose reply could not be read fails.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_query_parallel (mongoc_cursor_t **cursors,
+                               uint32_t          n_cursors)
+{
+   mongoc_cursor_t *cursor;
+   mongoc_rpc_t rpc;
+   uint32_t *request_ids;
+   bool *sent;
+   int64_t wait_start;
+   uint32_t hint;
+   uint32_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (cursors);
+
+   request_ids = bson_malloc0 (n_cursors * sizeof *request_ids);
+   sent = bson_malloc0 (n_cursors * sizeof *sent);
+   wait_start = bson_get_monotonic_time ();
+
+   for (i = 0; i < n_cursors; i++) {
+      cursor = cursors[i];
+      BSON_ASSERT (!cursor->sent);
+
+      if (cursor->failed ||
+          cursor->client->in_exhaust ||
+          !_mongoc_client_warm_up (cursor->client, &cursor->error)) {
+         continue;
+      }
+
+      if (cursor->client->prefetch_cursor) {
+         _mongoc_cursor_prefetch_recv (cursor->client->prefetch_cursor);
+      }
+
+      _mongoc_cursor_prepare_query (cursor, &rpc);
+
+      if ((hint = _mongoc_client_sendv (cursor->client, &rpc, 1,
+                                        cursor->hint, NULL,
+                                        cursor->read_prefs,
+                                        &cursor->error))) {
+         cursor->hint = hint;
+         request_ids[i] = BSON_UINT32_FROM_LE (rpc.header.request_id);
+         sent[i] = true;
+      }
+   }
+
+   for (i = 0; i < n_cursors; i++) {
+      cursor = cursors[i];
+
+      if (!sent[i]) {
+         continue;
+      }
+
+      if (!_mongoc_cursor_recv (cursor) ||
+          !_mongoc_cursor_query_reply (cursor, request_ids[i], wait_start)) {
+         _mongoc_cursor_incremental_abort (cursor);
+         cursor->failed = true;
+         cursor->done = true;
+         cursor->sent = true;
+      }
+   }
+
+   bson_free (request_ids);
+   bson_free (sent);
+
+   EXIT;
+}
+
+
+static bool
+_mongoc_cursor_send_get_more (mongoc_cursor_t *cursor,
+                              uint32_t        *request_id)
+{
+   uint64_t cursor_id;
+   mongoc_rpc_t rpc;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (request_id);
+
+   if (!_mongoc_client_warm_up (cursor->client, &cursor->error)) {
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   if (!(cursor_id = cursor->rpc.reply.cursor_id)) {
+      bson_set_error(&cursor->error,
+                     MONGOC_ERROR_CURSOR,
+                     MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                     "No valid cursor was provided.");
+      cursor->done = true;
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   rpc.get_more.msg_len = 0;
+   rpc.get_more.request_id = 0;
+   rpc.get_more.response_to = 0;
+   rpc.get_more.opcode = MONGOC_OPCODE_GET_MORE;
+   rpc.get_more.zero = 0;
+   rpc.get_more.collection = cursor->ns;
+   if ((cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR)) {
+      rpc.get_more.n_return = 0;
+   } else {
+      rpc.get_more.n_return = _mongoc_n_return(cursor);
+   }
+   rpc.get_more.cursor_id = cursor_id;
+
+   /*
+    * TODO: Stamp protections for disconnections.
+    */
+
+   if (!_mongoc_client_sendv(cursor->client, &rpc, 1, cursor->hint,
+                             NULL, cursor->read_prefs, &cursor->error)) {
+      cursor->done = true;
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   *request_id = BSON_UINT32_FROM_LE(rpc.header.request_id);
+
+   RETURN (true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_prefetch --
+ *
+ *       Sends the OP_GET_MORE for the next batch once half of the current
+ *       batch has been read, so that the reply is on its way while the
+ *       rest of the batch is consumed.
+ *
+ *       Cursors with a limit or an incremental threshold, tailable,
+ *       exhaust and command cursors are not prefetched. Cursors created from a command reply, such as
+ *       those of aggregate, are once they have read the cursor document.
+ *
+ *       A batch the size of the current one is reserved from the memory
+ *       budget first. If the budget is spent the next batch is simply
+ *       fetched when it is needed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @cursor becomes the client's prefetch cursor.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_cursor_prefetch (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+
+   if (!cursor->prefetch ||
+       cursor->prefetch_sent ||
+       cursor->is_command ||
+       cursor->in_exhaust ||
+       cursor->incremental_threshold ||
+       cursor->limit ||
+       (cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR) ||
+       !cursor->rpc.reply.cursor_id ||
+       (cursor->batch_read * 2) < (uint32_t)cursor->rpc.reply.n_returned) {
+      EXIT;
+   }
+
+   if (!_mongoc_memory_budget_reserve (cursor->rpc.reply.documents_len)) {
+      EXIT;
+   }
+
+   cursor->prefetch_reserved = cursor->rpc.reply.documents_len;
+
+   if (!cursor->prefetch_buffer.data) {
+      _mongoc_client_recv_buffer_take (cursor->client,
+                                       &cursor->prefetch_buffer);
+   }
+
+   if (_mongoc_cursor_send_get_more (cursor, &cursor->prefetch_request_id)) {
+      cursor->prefetch_sent = true;
+      cursor->prefetch_recv = false;
+      cursor->client->prefetch_cursor = cursor;
+   } else {
+      _mongoc_memory_budget_release (cursor->prefetch_reserved);
+      cursor->prefetch_reserved = 0;
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_cursor_prefetch_recv --
+ *
+ *       Reads the reply to a prefetched OP_GET_MORE into the cursor's
+ *       second buffer, leaving the documents of the current batch intact.
+ *
+ *       This is called when the cursor needs the next batch, and by the
+ *       client before it sends anything else.
+ *
+ * Returns:
+ *       true if the reply was read, or had already been read.
+ *       false on failure and @cursor is marked as failed.
+ *
+ * Side effects:
+ *       The client no longer has a prefetch cursor.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_cursor_prefetch_recv (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (cursor->prefetch_sent);
+
+   if (cursor->client->prefetch_cursor == cursor) {
+      cursor->client->prefetch_cursor = NULL;
+   }
+
+   if (cursor->prefetch_recv) {
+      RETURN (!cursor->failed);
+   }
+
+   cursor->prefetch_recv = true;
+
+   _mongoc_buffer_clear (&cursor->prefetch_buffer, false);
+   _mongoc_buffer_shrink (&cursor->prefetch_buffer);
+
+   if (!_mongoc_client_recv (cursor->client,
+                             &cursor->prefetch_rpc,
+                             &cursor->prefetch_buffer,
+                             cursor->hint,
+                             &cursor->error)) {
+      cursor->done = true;
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   RETURN (true);
+}
+
+
+static bool
+_mongoc_cursor_get_more (mongoc_cursor_t *cursor)
+{
+   mongoc_buffer_t buffer;
+   uint32_t request_id;
+   int64_t wait_start;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+
+   wait_start = bson_get_monotonic_time ();
+
+   if (cursor->prefetch_sent) {
+      if (!_mongoc_cursor_prefetch_recv (cursor)) {
+         RETURN (false);
+      }
+
+      /*
+       * The current batch is exhausted, so its buffer becomes the one the
+       * next prefetch is read into.
+       */
+      memcpy (&buffer, &cursor->buffer, sizeof buffer);
+      memcpy (&cursor->buffer, &cursor->prefetch_buffer, sizeof buffer);
+      memcpy (&cursor->prefetch_buffer, &buffer, sizeof buffer);
+      memcpy (&cursor->rpc, &cursor->prefetch_rpc, sizeof cursor->rpc);
+
+      request_id = cursor->prefetch_request_id;
+      cursor->prefetch_sent = false;
+
+      _mongoc_memory_budget_release (cursor->prefetch_reserved);
+      cursor->prefetch_reserved = 0;
+   } else {
+      if (!cursor->in_exhaust) {
+         if (!_mongoc_cursor_send_get_more (cursor, &request_id)) {
+            RETURN (false);
+         }
+      } else {
+         request_id = BSON_UINT32_FROM_LE(cursor->rpc.header.request_id);
+      }
+
+      if (!_mongoc_cursor_recv (cursor)) {
+         GOTO (failure);
+      }
+   }
+
+   if (cursor->rpc.header.opcode != MONGOC_OPCODE_REPLY) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid opcode. Expected %d, got %d.",
+                      MONGOC_OPCODE_REPLY, cursor->rpc.header.opcode);
+      GOTO (failure);
+   }
+
+   if (cursor->rpc.header.response_to != request_id) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid response_to. Expected %d, got %d.",
+                      request_id, cursor->rpc.header.response_to);
+      GOTO (failure);
+   }
+
+   if (_mongoc_cursor_unwrap_failure(cursor)) {
+      GOTO (failure);
+   }
+
+   cursor->reader = NULL;
+
+   if (!cursor->incremental_remaining) {
+      _mongoc_cursor_reader_reset (cursor, cursor->rpc.reply.documents,
+                                   cursor->rpc.reply.documents_len);
+
+      if (cursor->cache_key && !cursor->rpc.reply.cursor_id) {
+         _mongoc_query_cache_add (&cursor->client->query_cache, cursor->ns,
+                                  cursor->cache_key,
+                                  cursor->rpc.reply.documents,
+                                  cursor->rpc.reply.documents_len);
+         cursor->cache_key = NULL;
+      }
+   }
+   cursor->batch_read = 0;
+
+   _mongoc_cursor_adapt_batch_size (cursor, wait_start);
+
+   cursor->end_of_event = false;
+
+   RETURN(true);
+
+failure:
+   _mongoc_cursor_incremental_abort (cursor);
+   cursor->done = true;
+   cursor->failed = true;
+
+   RETURN(false);
+}
+
+
+bool
+mongoc_cursor_error (mongoc_cursor_t *cursor,
+                     bson_error_t    *error)
+{
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT(cursor);
+
+   if (cursor->iface.error) {
+      ret = cursor->iface.error(cursor, error);
+   } else {
+      ret = _mongoc_cursor_error(cursor, error);
+   }
+
+   if (ret && error) {
+      /*
+       * Rewrite the error code if we are talking to an older mongod
+       * and the command was not found. It used to simply return an
+       * error code of 17 and we can synthesize 59.
+       *
+       * Additionally, old versions of mongos may send 13390 indicating
+       * unrecognized command.
+       */
+      if (cursor->is_command &&
+          ((error->code == MONGOC_ERROR_PROTOCOL_ERROR) ||
+           (error->code == 13390))) {
+         error->code = MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND;
+      }
+   }
+
+   RETURN(ret);
+}
+
+
+bool
+_mongoc_cursor_error (mongoc_cursor_t *cursor,
+                      bson_error_t    *error)
+{
+   ENTRY;
+
+   bson_return_val_if_fail(cursor, false);
+
+   if (BSON_UNLIKELY(cursor->failed)) {
+      bson_set_error(error,
+                     cursor->error.domain,
+                     cursor->error.code,
+                     "%s",
+                     cursor->error.message);
+      RETURN(true);
+   }
+
+   RETURN(false);
+}
+
+
+bool
+mongoc_cursor_next (mongoc_cursor_t  *cursor,
+                    const bson_t    **bson)
+{
+   int64_t deadline;
+   bool ret;
+
+   ENTRY;
+
+   BSON_ASSERT(cursor);
+   BSON_ASSERT(bson);
+
+   TRACE ("cursor_id(%"PRId64")", cursor->rpc.reply.cursor_id);
+
+   if (bson) {
+      *bson = NULL;
+   }
+
+   if (cursor->failed) {
+      return false;
+   }
+
+   deadline = _mongoc_cluster_set_deadline (&cursor->client->cluster,
+                                            cursor->operation_timeout_msec);
+
+   if (cursor->iface.next) {
+      ret = cursor->iface.next(cursor, bson);
+   } else {
+      ret = _mongoc_cursor_next(cursor, bson);
+   }
+
+   _mongoc_cluster_restore_deadline (&cursor->client->cluster, deadline);
+
    cursor->current = *bson;
 
-   cursor->count++;
+   cursor->count++;
+
+   RETURN(ret);
+}
+
+
+bool
+_mongoc_cursor_next (mongoc_cursor_t  *cursor,
+                     const bson_t    **bson)
+{
+   const bson_t *b;
+   bool eof;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+
+   if (bson) {
+      *bson = NULL;
+   }
+
+   if (cursor->done || cursor->failed) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Cannot advance a completed or failed cursor.");
+      RETURN (false);
+   }
+
+   /*
+    * We cannot proceed if another cursor is receiving results in exhaust mode
+    * or is in the middle of a reply.
+    */
+   if (cursor->client->in_exhaust && !cursor->in_exhaust &&
+       !cursor->incremental_remaining) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "Another cursor derived from this client is in exhaust.");
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   /*
+    * If we reached our limit, make sure we mark this as done and do not try to
+    * make further progress.
+    */
+   if (cursor->limit && cursor->count >= cursor->limit) {
+      cursor->done = true;
+      RETURN (false);
+   }
+
+   /*
+    * Try to read the next document from the reader if it exists, we might
+    * get NULL back and EOF, in which case we need to submit a getmore.
+    */
+   if (cursor->reader || cursor->incremental_remaining) {
+      eof = false;
+      b = _mongoc_cursor_read (cursor, &eof);
+      cursor->end_of_event = eof;
+      if (b) {
+         cursor->batch_read++;
+         _mongoc_cursor_prefetch (cursor);
+         GOTO (complete);
+      } else if (cursor->failed) {
+         RETURN (false);
+      }
+   }
+
+   /*
+    * Check to see if we need to send a GET_MORE for more results.
+    */
+   if (!cursor->sent) {
+      if (!_mongoc_cursor_query (cursor)) {
+         RETURN (false);
+      }
+   } else if (BSON_UNLIKELY (cursor->end_of_event) && cursor->rpc.reply.cursor_id) {
+      if (!_mongoc_cursor_get_more (cursor)) {
+         RETURN (false);
+      }
+   }
+
+   eof = false;
+   b = _mongoc_cursor_read (cursor, &eof);
+   cursor->end_of_event = eof;
+
+   if (b) {
+      cursor->batch_read++;
+      _mongoc_cursor_prefetch (cursor);
+   } else if (cursor->failed) {
+      RETURN (false);
+   }
+
+complete:
+   cursor->done = (cursor->end_of_event &&
+                   ((cursor->in_exhaust && !cursor->rpc.reply.cursor_id) ||
+                    (!b && !(cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR))));
 
-   RETURN(ret);
+   /*
+    * Do a supplimental check to see if we had a corrupted reply in the
+    * document stream.
+    */
+   if (!b && !eof) {
+      cursor->failed = true;
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "The reply was corrupt.");
+      RETURN (false);
+   }
+
+   if (bson) {
+      *bson = b;
+   }
+
+   RETURN (!!b);
+}
+
+
+static bool
+_mongoc_cursor_next_batch (mongoc_cursor_t  *cursor,
+                           const uint8_t   **data,
+                           uint32_t         *data_len,
+                           uint32_t         *n_docs,
+                           bool              want_offsets)
+{
+   const uint8_t *documents;
+   uint32_t documents_len;
+   uint32_t pos = 0;
+   uint32_t off;
+   uint32_t alloc;
+   int32_t doc_len;
+
+   ENTRY;
+
+   /*
+    * Hand out whatever mongoc_cursor_next() has not read of the current
+    * batch, or fetch the next one.
+    */
+   if (cursor->reader) {
+      pos = (uint32_t)cursor->reader->off;
+   }
+
+   if (!cursor->reader || pos >= (uint32_t)cursor->rpc.reply.documents_len) {
+      if (!cursor->sent) {
+         if (!_mongoc_cursor_query (cursor)) {
+            RETURN (false);
+         }
+      } else if (cursor->rpc.reply.cursor_id) {
+         if (!_mongoc_cursor_get_more (cursor)) {
+            RETURN (false);
+         }
+      } else {
+         cursor->done = true;
+         RETURN (false);
+      }
+
+      pos = 0;
+   }
+
+   documents = cursor->rpc.reply.documents + pos;
+   documents_len = cursor->rpc.reply.documents_len - pos;
+
+   for (off = 0; off < documents_len; off += doc_len) {
+      if ((documents_len - off) < 5) {
+         GOTO (corrupt);
+      }
+
+      memcpy (&doc_len, documents + off, sizeof doc_len);
+      doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+      if (doc_len < 5 || (uint32_t)doc_len > (documents_len - off)) {
+         GOTO (corrupt);
+      }
+
+      if (want_offsets) {
+         if (*n_docs == cursor->batch_offsets_alloc) {
+            alloc = BSON_MAX (16, cursor->batch_offsets_alloc * 2);
+            mongoc_counter_memory_cursors_add (
+               (int64_t)(alloc - cursor->batch_offsets_alloc) *
+               sizeof (uint32_t));
+            cursor->batch_offsets_alloc = alloc;
+            cursor->batch_offsets = bson_realloc (
+               cursor->batch_offsets,
+               cursor->batch_offsets_alloc * sizeof (uint32_t));
+         }
+         cursor->batch_offsets[*n_docs] = off;
+      }
+
+      (*n_docs)++;
+   }
+
+   /*
+    * The whole batch is handed out, leave mongoc_cursor_next() with an
+    * exhausted reader.
+    */
+   _mongoc_cursor_reader_reset (cursor, documents + documents_len, 0);
+   cursor->end_of_event = true;
+   cursor->batch_read += *n_docs;
+   cursor->count += *n_docs;
+   cursor->current = NULL;
+
+   *data = documents;
+   *data_len = documents_len;
+
+   /* the batch is ours to keep until the next call, request the next one */
+   _mongoc_cursor_prefetch (cursor);
+
+   RETURN (*n_docs > 0);
+
+corrupt:
+   cursor->failed = true;
+   bson_set_error (&cursor->error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "The reply was corrupt.");
+   RETURN (false);
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_next_batch --
+ *
+ *       Fetches the documents of the next batch at once, as the raw
+ *       document section of the server's reply, instead of one document
+ *       at a time.
+ *
+ *       If @offsets is not NULL, it is set to an array of @n_docs offsets
+ *       of the documents within @data.
+ *
+ *       The data is valid until the next call to mongoc_cursor_next(),
+ *       mongoc_cursor_next_batch() or mongoc_cursor_destroy().
+ *
+ * Returns:
+ *       true if a batch of documents was returned; otherwise false, in
+ *       which case mongoc_cursor_error() should be checked.
+ *
+ * Side effects:
+ *       Documents of the current batch not yet read by
+ *       mongoc_cursor_next() are returned as a batch of their own.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 bool
-_mongoc_cursor_next (mongoc_cursor_t  *cursor,
-                     const bson_t    **bson)
+mongoc_cursor_next_batch (mongoc_cursor_t  *cursor,
+                          const uint8_t   **data,
+                          uint32_t         *data_len,
+                          uint32_t         *n_docs,
+                          const uint32_t  **offsets)
 {
-   const bson_t *b;
-   bool eof;
+   int64_t deadline;
+   bool ret;
 
    ENTRY;
 
    BSON_ASSERT (cursor);
+   BSON_ASSERT (data);
+   BSON_ASSERT (data_len);
+   BSON_ASSERT (n_docs);
 
-   if (bson) {
-      *bson = NULL;
+   *data = NULL;
+   *data_len = 0;
+   *n_docs = 0;
+
+   if (offsets) {
+      *offsets = NULL;
    }
 
-   if (cursor->done || cursor->failed) {
+   if (cursor->failed || cursor->done) {
+      RETURN (false);
+   }
+
+   /*
+    * Batches of cursors with their own iteration, such as the first batch
+    * of a command cursor, do not come from an OP_REPLY document section.
+    */
+   if (cursor->iface.next) {
       bson_set_error (&cursor->error,
                       MONGOC_ERROR_CURSOR,
                       MONGOC_ERROR_CURSOR_INVALID_CURSOR,
-                      "Cannot advance a completed or failed cursor.");
+                      "Batch iteration is not supported by this cursor.");
+      cursor->failed = true;
+      RETURN (false);
+   }
+
+   if (cursor->incremental_threshold) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Batch iteration is not supported with an "
+                      "incremental threshold.");
+      cursor->failed = true;
       RETURN (false);
    }
 
-   /*
-    * We cannot proceed if another cursor is receiving results in exhaust mode.
-    */
    if (cursor->client->in_exhaust && !cursor->in_exhaust) {
       bson_set_error (&cursor->error,
                       MONGOC_ERROR_CLIENT,
@@ -802,68 +2255,328 @@ _mongoc_cursor_next (mongoc_cursor_t  *cursor,
       RETURN (false);
    }
 
-   /*
-    * If we reached our limit, make sure we mark this as done and do not try to
-    * make further progress.
-    */
    if (cursor->limit && cursor->count >= cursor->limit) {
       cursor->done = true;
       RETURN (false);
    }
 
-   /*
-    * Try to read the next document from the reader if it exists, we might
-    * get NULL back and EOF, in which case we need to submit a getmore.
-    */
-   if (cursor->reader) {
-      eof = false;
-      b = bson_reader_read (cursor->reader, &eof);
-      cursor->end_of_event = eof;
-      if (b) {
-         GOTO (complete);
-      }
+   deadline = _mongoc_cluster_set_deadline (&cursor->client->cluster,
+                                            cursor->operation_timeout_msec);
+
+   ret = _mongoc_cursor_next_batch (cursor, data, data_len, n_docs,
+                                    !!offsets);
+
+   _mongoc_cluster_restore_deadline (&cursor->client->cluster, deadline);
+
+   if (ret && offsets) {
+      *offsets = cursor->batch_offsets;
+   }
+
+   RETURN (ret);
+}
+
+
+/*
+ * Stops an exhaust stream that is between, or in the middle of, replies
+ * the server is still sending. The rest can't be skipped, so the
+ * connection is dropped and the client is free for other operations.
+ */
+static void
+_mongoc_cursor_stream_abort (mongoc_cursor_t *cursor)
+{
+   ENTRY;
+
+   if (cursor->rpc.reply.cursor_id ||
+       (!cursor->rpc.reply.documents && !cursor->end_of_event)) {
+      _mongoc_cluster_disconnect_node (
+         &cursor->client->cluster,
+         &cursor->client->cluster.nodes[cursor->hint - 1]);
+   }
+
+   cursor->reader = NULL;
+
+   cursor->in_exhaust = false;
+   cursor->client->in_exhaust = false;
+   cursor->rpc.reply.cursor_id = 0;
+   cursor->end_of_event = true;
+   cursor->done = true;
+
+   EXIT;
+}
+
+
+/*
+ * Hands the documents left in the cursor's reader to @cb.
+ */
+static bool
+_mongoc_cursor_stream_reader (mongoc_cursor_t           *cursor,
+                              mongoc_cursor_stream_cb_t  cb,
+                              void                      *data,
+                              bool                      *stopped)
+{
+   const bson_t *b;
+   bool eof = false;
+
+   ENTRY;
+
+   while ((b = _mongoc_cursor_reader_read (cursor->reader, &eof))) {
+      cursor->count++;
+
+      if (!cb (b, data)) {
+         *stopped = true;
+         RETURN (true);
+      }
+   }
+
+   if (!eof) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "The reply was corrupt.");
+      RETURN (false);
+   }
+
+   cursor->end_of_event = true;
+
+   RETURN (true);
+}
+
+
+/*
+ * Receives the next reply of an exhaust cursor and hands its documents to
+ * @cb as they are read off the connection. Only one document is buffered
+ * at a time, so the server can't send faster than @cb consumes.
+ */
+static bool
+_mongoc_cursor_stream_reply (mongoc_cursor_t           *cursor,
+                             mongoc_cursor_stream_cb_t  cb,
+                             void                      *data,
+                             bool                      *stopped)
+{
+   mongoc_cluster_t *cluster = &cursor->client->cluster;
+   uint32_t request_id;
+   uint32_t remaining;
+   int32_t doc_len;
+   bson_t b;
+
+   ENTRY;
+
+   request_id = BSON_UINT32_FROM_LE (cursor->rpc.header.request_id);
+
+   cursor->reader = NULL;
+
+   _mongoc_buffer_clear (&cursor->buffer, false);
+
+   if (!_mongoc_cluster_try_recv_partial (cluster, &cursor->rpc,
+                                          &cursor->buffer, cursor->hint,
+                                          &cursor->error)) {
+      RETURN (false);
+   }
+
+   cursor->end_of_event = false;
+
+   if (cursor->rpc.header.response_to != request_id) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid response_to. Expected %d, got %d.",
+                      request_id, cursor->rpc.header.response_to);
+      RETURN (false);
+   }
+
+   /*
+    * The reply was read in full if the node compresses its replies, and
+    * must be if it carries an error document.
+    */
+   if (!cursor->rpc.reply.documents &&
+       (cursor->rpc.reply.flags & MONGOC_REPLY_QUERY_FAILURE)) {
+      remaining = cursor->rpc.reply.documents_len;
+
+      if (!_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                          cursor->hint, remaining,
+                                          &cursor->error)) {
+         RETURN (false);
+      }
+
+      cursor->rpc.reply.documents = cursor->buffer.data +
+                                    cursor->buffer.off +
+                                    cursor->buffer.len - remaining;
+      cursor->end_of_event = true;
+   }
+
+   if (_mongoc_cursor_unwrap_failure (cursor)) {
+      RETURN (false);
+   }
+
+   if (cursor->rpc.reply.documents) {
+      _mongoc_cursor_reader_reset (cursor, cursor->rpc.reply.documents,
+                                   cursor->rpc.reply.documents_len);
+      RETURN (_mongoc_cursor_stream_reader (cursor, cb, data, stopped));
+   }
+
+   remaining = cursor->rpc.reply.documents_len;
+
+   while (remaining) {
+      if (remaining < 5) {
+         GOTO (corrupt);
+      }
+
+      _mongoc_buffer_clear (&cursor->buffer, false);
+
+      if (!_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                          cursor->hint, 4, &cursor->error)) {
+         RETURN (false);
+      }
+
+      memcpy (&doc_len, cursor->buffer.data + cursor->buffer.off, 4);
+      doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+      if (doc_len < 5 || (uint32_t)doc_len > remaining) {
+         GOTO (corrupt);
+      }
+
+      if (!_mongoc_cluster_try_recv_more (cluster, &cursor->buffer,
+                                          cursor->hint, doc_len - 4,
+                                          &cursor->error)) {
+         RETURN (false);
+      }
+
+      if (!bson_init_static (&b, cursor->buffer.data + cursor->buffer.off,
+                             doc_len)) {
+         GOTO (corrupt);
+      }
+
+      remaining -= doc_len;
+      cursor->end_of_event = !remaining;
+      cursor->count++;
+
+      if (!cb (&b, data)) {
+         *stopped = true;
+         RETURN (true);
+      }
+   }
+
+   RETURN (true);
+
+corrupt:
+   bson_set_error (&cursor->error,
+                   MONGOC_ERROR_CURSOR,
+                   MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                   "The reply was corrupt.");
+   RETURN (false);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_stream --
+ *
+ *       Iterates the cursor to the end, calling @cb with each document.
+ *       Iteration stops early if @cb returns false.
+ *
+ *       For a cursor created with MONGOC_QUERY_EXHAUST, the server sends
+ *       every batch after the first without waiting for an OP_GET_MORE.
+ *       These batches are parsed while they arrive, and only the
+ *       document being handed to @cb is buffered. A full collection scan
+ *       is then a single long read, and a slow @cb holds back the server
+ *       through the connection instead of having replies pile up in
+ *       memory. Other cursors are iterated with mongoc_cursor_next().
+ *
+ *       The document passed to @cb is only valid during the call.
+ *
+ * Returns:
+ *       true if the cursor was iterated to the end or @cb stopped it;
+ *       otherwise false, in which case mongoc_cursor_error() should be
+ *       checked.
+ *
+ * Side effects:
+ *       An exhaust cursor is done once this returns. If @cb stopped it
+ *       while the server was still sending, the connection to the server
+ *       is closed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_stream (mongoc_cursor_t           *cursor,
+                      mongoc_cursor_stream_cb_t  cb,
+                      void                      *data)
+{
+   const bson_t *doc;
+   bool stopped = false;
+   int64_t deadline;
+   bool ret = true;
+
+   ENTRY;
+
+   BSON_ASSERT (cursor);
+   BSON_ASSERT (cb);
+
+   if (cursor->iface.next || !(cursor->flags & MONGOC_QUERY_EXHAUST)) {
+      while (mongoc_cursor_next (cursor, &doc)) {
+         if (!cb (doc, data)) {
+            RETURN (true);
+         }
+      }
+
+      RETURN (!mongoc_cursor_error (cursor, NULL));
+   }
+
+   if (cursor->done || cursor->failed) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CURSOR,
+                      MONGOC_ERROR_CURSOR_INVALID_CURSOR,
+                      "Cannot advance a completed or failed cursor.");
+      RETURN (false);
+   }
+
+   if (cursor->client->in_exhaust && !cursor->in_exhaust) {
+      bson_set_error (&cursor->error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "Another cursor derived from this client is in exhaust.");
+      cursor->failed = true;
+      RETURN (false);
    }
 
    /*
-    * Check to see if we need to send a GET_MORE for more results.
+    * The reply to the query, and whatever mongoc_cursor_next() has not
+    * read of a batch, are already buffered.
     */
    if (!cursor->sent) {
-      if (!_mongoc_cursor_query (cursor)) {
-         RETURN (false);
-      }
-   } else if (BSON_UNLIKELY (cursor->end_of_event) && cursor->rpc.reply.cursor_id) {
-      if (!_mongoc_cursor_get_more (cursor)) {
+      deadline = _mongoc_cluster_set_deadline (&cursor->client->cluster,
+                                               cursor->operation_timeout_msec);
+      ret = _mongoc_cursor_query (cursor);
+      _mongoc_cluster_restore_deadline (&cursor->client->cluster, deadline);
+
+      if (!ret) {
          RETURN (false);
       }
    }
 
-   eof = false;
-   b = bson_reader_read (cursor->reader, &eof);
-   cursor->end_of_event = eof;
+   cursor->current = NULL;
 
-complete:
-   cursor->done = (cursor->end_of_event &&
-                   ((cursor->in_exhaust && !cursor->rpc.reply.cursor_id) ||
-                    (!b && !(cursor->flags & MONGOC_QUERY_TAILABLE_CURSOR))));
+   if (cursor->reader && !cursor->end_of_event) {
+      ret = _mongoc_cursor_stream_reader (cursor, cb, data, &stopped);
+   }
 
-   /*
-    * Do a supplimental check to see if we had a corrupted reply in the
-    * document stream.
-    */
-   if (!b && !eof) {
-      cursor->failed = true;
-      bson_set_error (&cursor->error,
-                      MONGOC_ERROR_CURSOR,
-                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
-                      "The reply was corrupt.");
-      RETURN (false);
+   while (ret && !stopped && cursor->rpc.reply.cursor_id) {
+      deadline = _mongoc_cluster_set_deadline (&cursor->client->cluster,
+                                               cursor->operation_timeout_msec);
+      ret = _mongoc_cursor_stream_reply (cursor, cb, data, &stopped);
+      _mongoc_cluster_restore_deadline (&cursor->client->cluster, deadline);
    }
 
-   if (bson) {
-      *bson = b;
+   _mongoc_cursor_stream_abort (cursor);
+   _mongoc_buffer_clear (&cursor->buffer, false);
+   _mongoc_buffer_shrink (&cursor->buffer);
+
+   if (!ret) {
+      cursor->failed = true;
    }
 
-   RETURN (!!b);
+   RETURN (ret);
 }
 
 
@@ -964,27 +2677,37 @@ _mongoc_cursor_clone (const mongoc_cursor_t *cursor)
 
    BSON_ASSERT (cursor);
 
-   _clone = bson_malloc0 (sizeof *_clone);
+   _clone = _mongoc_cursor_alloc (cursor->client);
 
    _clone->client = cursor->client;
+   _mongoc_cursor_track (_clone);
    _clone->is_command = cursor->is_command;
    _clone->flags = cursor->flags;
    _clone->skip = cursor->skip;
    _clone->batch_size = cursor->batch_size;
+   _clone->prefetch = cursor->prefetch;
+   _clone->single_batch = cursor->single_batch;
+   _clone->adaptive_max_bytes = cursor->adaptive_max_bytes;
+   _clone->operation_timeout_msec = cursor->operation_timeout_msec;
+   _clone->incremental_threshold = cursor->incremental_threshold;
    _clone->limit = cursor->limit;
    _clone->nslen = cursor->nslen;
    _clone->has_fields = cursor->has_fields;
 
+   if (cursor->field_index) {
+      _clone->field_index = _mongoc_cursor_field_index_new ();
+   }
+
    if (cursor->read_prefs) {
-      _clone->read_prefs = mongoc_read_prefs_copy (cursor->read_prefs);
+      _clone->read_prefs = _mongoc_read_prefs_share (cursor->read_prefs);
    }
 
-   bson_copy_to (&cursor->query, &_clone->query);
-   bson_copy_to (&cursor->fields, &_clone->fields);
+   bson_concat (&_clone->query, &cursor->query);
+   bson_concat (&_clone->fields, &cursor->fields);
 
    bson_strncpy (_clone->ns, cursor->ns, sizeof _clone->ns);
 
-   _mongoc_buffer_init (&_clone->buffer, NULL, 0, NULL, NULL);
+   _mongoc_client_recv_buffer_take (_clone->client, &_clone->buffer);
 
    mongoc_counter_cursors_active_inc ();
 
@@ -1032,6 +2755,94 @@ mongoc_cursor_current (const mongoc_cursor_t *cursor) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_set_operation_timeout --
+ *
+ *       Bound the total time of each call to mongoc_cursor_next() on
+ *       @cursor, including the initial query, any getmore, reconnection
+ *       and every network read and write, to @timeout_msec. 0 disables
+ *       the bound.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cursor_set_operation_timeout (mongoc_cursor_t *cursor,
+                                     uint32_t         timeout_msec)
+{
+   bson_return_if_fail (cursor);
+
+   cursor->operation_timeout_msec = timeout_msec;
+}
+
+
+uint32_t
+mongoc_cursor_get_operation_timeout (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, 0);
+
+   return cursor->operation_timeout_msec;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_set_incremental_threshold --
+ *
+ *       Makes mongoc_cursor_next() return the documents of any reply
+ *       carrying more than @threshold bytes of them as soon as each one
+ *       has arrived, instead of after the whole reply has been received.
+ *       Only one document of such a reply is buffered at a time, so a
+ *       batch of many megabytes needs no more memory than its largest
+ *       document.
+ *
+ *       Until the last document of the reply has been read, the client
+ *       can't be used for anything else, and destroying the cursor
+ *       closes the connection to the server.
+ *
+ *       The cursor is not prefetched and can't be iterated with
+ *       mongoc_cursor_next_batch(). Command cursors, exhaust cursors and
+ *       replies from a server that compresses them are not affected.
+ *
+ *       A @threshold of 0, the default, turns this off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cursor_set_incremental_threshold (mongoc_cursor_t *cursor,
+                                         uint32_t         threshold)
+{
+   bson_return_if_fail (cursor);
+
+   cursor->incremental_threshold = threshold;
+}
+
+
+uint32_t
+mongoc_cursor_get_incremental_threshold (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, 0);
+
+   return cursor->incremental_threshold;
+}
+
+
 void
 mongoc_cursor_set_batch_size (mongoc_cursor_t *cursor,
                               uint32_t         batch_size)
@@ -1048,6 +2859,245 @@ mongoc_cursor_get_batch_size (const mongoc_cursor_t *cursor)
    return cursor->batch_size;
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_set_single_batch --
+ *
+ *       Have the server return a single batch of at most the limit, or
+ *       the batch size if it is smaller, and close the cursor right away.
+ *       Queries that only want their first few documents, such as a
+ *       find_one(), save the killCursors that would follow otherwise.
+ *       Without a limit or a batch size, this has no effect.
+ *
+ *       Must be set before the first call to mongoc_cursor_next().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_cursor_set_single_batch (mongoc_cursor_t *cursor,
+                                bool             single_batch)
+{
+   bson_return_if_fail (cursor);
+
+   cursor->single_batch = !!single_batch;
+}
+
+bool
+mongoc_cursor_get_single_batch (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, false);
+
+   return cursor->single_batch;
+}
+
+void
+mongoc_cursor_set_prefetch (mongoc_cursor_t *cursor,
+                            bool             prefetch)
+{
+   bson_return_if_fail (cursor);
+
+   cursor->prefetch = !!prefetch;
+}
+
+bool
+mongoc_cursor_get_prefetch (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, false);
+
+   return cursor->prefetch;
+}
+
+void
+mongoc_cursor_set_field_index (mongoc_cursor_t *cursor,
+                               bool             field_index)
+{
+   bson_return_if_fail (cursor);
+
+   if (field_index && !cursor->field_index) {
+      cursor->field_index = _mongoc_cursor_field_index_new ();
+   } else if (!field_index && cursor->field_index) {
+      _mongoc_cursor_field_index_destroy (cursor->field_index);
+      cursor->field_index = NULL;
+   }
+}
+
+bool
+mongoc_cursor_get_field_index (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, false);
+
+   return !!cursor->field_index;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_get_field --
+ *
+ *       Finds the top-level field @key of the current document, like
+ *       bson_iter_init_find() on mongoc_cursor_current().
+ *
+ *       If the cursor has a field index, the current document is indexed
+ *       on the first lookup and the lookups after that don't scan it.
+ *
+ * Returns:
+ *       true and @iter is positioned on the field if it was found.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_get_field (mongoc_cursor_t *cursor,
+                         const char      *key,
+                         bson_iter_t     *iter)
+{
+   bson_return_val_if_fail (cursor, false);
+   bson_return_val_if_fail (key, false);
+   bson_return_val_if_fail (iter, false);
+
+   if (!cursor->current) {
+      return false;
+   }
+
+   /*
+    * mongoc_cursor_next() counts every document it returns, which tells
+    * the index when the current document has changed.
+    */
+   if (cursor->field_index) {
+      return _mongoc_cursor_field_index_find (cursor->field_index,
+                                              cursor->current,
+                                              cursor->count, key, iter);
+   }
+
+   return bson_iter_init_find (iter, cursor->current, key);
+}
+
+void
+mongoc_cursor_set_adaptive_batch_size (mongoc_cursor_t *cursor,
+                                       uint32_t         max_bytes)
+{
+   bson_return_if_fail (cursor);
+
+   cursor->adaptive_max_bytes = BSON_MIN (max_bytes,
+                                          MONGOC_CURSOR_ADAPTIVE_MAX_BYTES);
+
+   if (!max_bytes) {
+      cursor->adaptive_n_return = 0;
+   }
+}
+
+uint32_t
+mongoc_cursor_get_adaptive_batch_size (const mongoc_cursor_t *cursor)
+{
+   bson_return_val_if_fail (cursor, 0);
+
+   return cursor->adaptive_max_bytes;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_cursor_set_client --
+ *
+ *       Moves @cursor to @client, which must be connected to the same
+ *       deployment, so that it can be iterated from the thread that owns
+ *       @client. A cursor that has already been started keeps reading
+ *       from the same server.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @client may connect to the cursor's server.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_cursor_set_client (mongoc_cursor_t *cursor,
+                          mongoc_client_t *client,
+                          bson_error_t    *error)
+{
+   const char *host_and_port;
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (cursor, false);
+   bson_return_val_if_fail (client, false);
+
+   if (client == cursor->client) {
+      RETURN (true);
+   }
+
+   if (cursor->in_exhaust) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "Cannot move a cursor that is in exhaust.");
+      RETURN (false);
+   }
+
+   if (cursor->incremental_remaining) {
+      bson_set_error (error,
+                      MONGOC_ERROR_CLIENT,
+                      MONGOC_ERROR_CLIENT_IN_EXHAUST,
+                      "Cannot move a cursor in the middle of a reply.");
+      RETURN (false);
+   }
+
+   if (cursor->prefetch_sent && !_mongoc_cursor_prefetch_recv (cursor)) {
+      _mongoc_cursor_error (cursor, error);
+      RETURN (false);
+   }
+
+   if (cursor->hint) {
+      if (!_mongoc_client_warm_up (client, error)) {
+         RETURN (false);
+      }
+
+      host_and_port =
+         cursor->client->cluster.nodes[cursor->hint - 1].host.host_and_port;
+
+      for (i = 0; i < client->cluster.nodes_len; i++) {
+         if (0 == strcasecmp (client->cluster.nodes[i].host.host_and_port,
+                              host_and_port)) {
+            break;
+         }
+      }
+
+      if (i == client->cluster.nodes_len) {
+         bson_set_error (error,
+                         MONGOC_ERROR_CLIENT,
+                         MONGOC_ERROR_CLIENT_NOT_READY,
+                         "The client is not connected to %s.",
+                         host_and_port);
+         RETURN (false);
+      }
+
+      cursor->hint = i + 1;
+   }
+
+   _mongoc_cursor_untrack (cursor);
+   cursor->client = client;
+   _mongoc_cursor_track (cursor);
+
+   RETURN (true);
+}
+
 uint32_t
 mongoc_cursor_get_hint (const mongoc_cursor_t *cursor)
 {
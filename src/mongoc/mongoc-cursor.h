@@ -31,12 +31,27 @@ BSON_BEGIN_DECLS
 
 typedef struct _mongoc_cursor_t mongoc_cursor_t;
 
+/* forward decl, see mongoc-client.h */
+struct _mongoc_client_t;
+
+
+typedef bool (*mongoc_cursor_stream_cb_t) (const bson_t *doc,
+                                           void         *data);
+
 
 mongoc_cursor_t *mongoc_cursor_clone    (const mongoc_cursor_t  *cursor) BSON_GNUC_WARN_UNUSED_RESULT;
 void             mongoc_cursor_destroy  (mongoc_cursor_t        *cursor);
 bool             mongoc_cursor_more     (mongoc_cursor_t        *cursor);
 bool             mongoc_cursor_next     (mongoc_cursor_t        *cursor,
                                          const bson_t          **bson);
+bool             mongoc_cursor_next_batch (mongoc_cursor_t      *cursor,
+                                           const uint8_t       **data,
+                                           uint32_t             *data_len,
+                                           uint32_t             *n_docs,
+                                           const uint32_t      **offsets);
+bool             mongoc_cursor_stream   (mongoc_cursor_t           *cursor,
+                                         mongoc_cursor_stream_cb_t  cb,
+                                         void                      *data);
 bool             mongoc_cursor_error    (mongoc_cursor_t        *cursor,
                                          bson_error_t           *error);
 void             mongoc_cursor_get_host (mongoc_cursor_t        *cursor,
@@ -46,6 +61,30 @@ const bson_t    *mongoc_cursor_current  (const mongoc_cursor_t  *cursor);
 void             mongoc_cursor_set_batch_size (mongoc_cursor_t  *cursor,
                                                uint32_t          batch_size);
 uint32_t         mongoc_cursor_get_batch_size (const mongoc_cursor_t *cursor);
+void             mongoc_cursor_set_prefetch   (mongoc_cursor_t  *cursor,
+                                               bool              prefetch);
+bool             mongoc_cursor_get_prefetch   (const mongoc_cursor_t *cursor);
+void             mongoc_cursor_set_single_batch (mongoc_cursor_t *cursor,
+                                                 bool             single_batch);
+bool             mongoc_cursor_get_single_batch (const mongoc_cursor_t *cursor);
+void             mongoc_cursor_set_field_index (mongoc_cursor_t *cursor,
+                                                bool             field_index);
+bool             mongoc_cursor_get_field_index (const mongoc_cursor_t *cursor);
+bool             mongoc_cursor_get_field      (mongoc_cursor_t  *cursor,
+                                               const char       *key,
+                                               bson_iter_t      *iter);
+void             mongoc_cursor_set_adaptive_batch_size (mongoc_cursor_t       *cursor,
+                                                        uint32_t               max_bytes);
+uint32_t         mongoc_cursor_get_adaptive_batch_size (const mongoc_cursor_t *cursor);
+bool             mongoc_cursor_set_client     (mongoc_cursor_t         *cursor,
+                                               struct _mongoc_client_t *client,
+                                               bson_error_t            *error);
+void             mongoc_cursor_set_operation_timeout (mongoc_cursor_t       *cursor,
+                                                      uint32_t               timeout_msec);
+uint32_t         mongoc_cursor_get_operation_timeout (const mongoc_cursor_t *cursor);
+void             mongoc_cursor_set_incremental_threshold (mongoc_cursor_t       *cursor,
+                                                          uint32_t               threshold);
+uint32_t         mongoc_cursor_get_incremental_threshold (const mongoc_cursor_t *cursor);
 uint32_t         mongoc_cursor_get_hint (const mongoc_cursor_t  *cursor);
 int64_t          mongoc_cursor_get_id   (const mongoc_cursor_t  *cursor);
 
@@ -27,8 +27,10 @@
 #include "mongoc-database-private.h"
 #include "mongoc-error.h"
 #include "mongoc-log.h"
+#include "mongoc-read-prefs-private.h"
 #include "mongoc-trace.h"
 #include "mongoc-util-private.h"
+#include "mongoc-write-concern-private.h"
 
 
 #undef MONGOC_LOG_DOMAIN
@@ -71,10 +73,10 @@ _mongoc_database_new (mongoc_client_t              *client,
    db = bson_malloc0(sizeof *db);
    db->client = client;
    db->write_concern = write_concern ?
-      mongoc_write_concern_copy(write_concern) :
+      _mongoc_write_concern_share(write_concern) :
       mongoc_write_concern_new();
    db->read_prefs = read_prefs ?
-      mongoc_read_prefs_copy(read_prefs) :
+      _mongoc_read_prefs_share(read_prefs) :
       mongoc_read_prefs_new(MONGOC_READ_PRIMARY);
 
    bson_strncpy (db->name, name, sizeof db->name);
@@ -195,6 +197,9 @@ mongoc_database_drop (mongoc_database_t *database,
    ret = mongoc_database_command_simple(database, &cmd, NULL, NULL, error);
    bson_destroy(&cmd);
 
+   _mongoc_client_invalidate_metadata (database->client, database->name,
+                                       NULL);
+
    return ret;
 }
 
@@ -509,7 +514,7 @@ mongoc_database_set_read_prefs (mongoc_database_t         *database,
    }
 
    if (read_prefs) {
-      database->read_prefs = mongoc_read_prefs_copy(read_prefs);
+      database->read_prefs = _mongoc_read_prefs_share(read_prefs);
    }
 }
 
@@ -567,7 +572,7 @@ mongoc_database_set_write_concern (mongoc_database_t            *database,
    }
 
    if (write_concern) {
-      database->write_concern = mongoc_write_concern_copy(write_concern);
+      database->write_concern = _mongoc_write_concern_share(write_concern);
    }
 }
 
@@ -767,6 +772,12 @@ mongoc_database_find_collections (mongoc_database_t *database,
 
    BSON_ASSERT (database);
 
+   if ((cursor = _mongoc_client_get_metadata (
+           database->client, MONGOC_CLIENT_METADATA_COLLECTIONS,
+           database->name, filter))) {
+      return cursor;
+   }
+
    BSON_APPEND_INT32 (&cmd, "listCollections", 1);
 
    if (filter) {
@@ -814,7 +825,9 @@ mongoc_database_find_collections (mongoc_database_t *database,
    bson_destroy (&cmd);
    mongoc_read_prefs_destroy (read_prefs);
 
-   return cursor;
+   return _mongoc_client_set_metadata (database->client,
+                                       MONGOC_CLIENT_METADATA_COLLECTIONS,
+                                       database->name, filter, cursor);
 }
 
 char **
@@ -1012,6 +1025,9 @@ mongoc_database_create_collection (mongoc_database_t *database,
       }
    }
 
+   _mongoc_client_invalidate_metadata (database->client, database->name,
+                                       name);
+
    if (mongoc_database_command_simple (database, &cmd, NULL, NULL, error)) {
       collection = _mongoc_collection_new (database->client,
                                            database->name,
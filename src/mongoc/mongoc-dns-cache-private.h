@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_DNS_CACHE_PRIVATE_H
+#define MONGOC_DNS_CACHE_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-socket.h"
+
+
+BSON_BEGIN_DECLS
+
+
+#ifndef MONGOC_DEFAULT_DNS_CACHE_TTL_MS
+# define MONGOC_DEFAULT_DNS_CACHE_TTL_MS (30 * 1000L)
+#endif
+
+
+#ifndef MONGOC_DEFAULT_DNS_NEGATIVE_CACHE_TTL_MS
+# define MONGOC_DEFAULT_DNS_NEGATIVE_CACHE_TTL_MS (1000L)
+#endif
+
+
+void _mongoc_dns_cache_init        (void);
+void _mongoc_dns_cache_cleanup     (void);
+int  _mongoc_dns_cache_getaddrinfo (const char             *host,
+                                    const char             *port,
+                                    const struct addrinfo  *hints,
+                                    int64_t                 ttl_msec,
+                                    int64_t                 negative_ttl_msec,
+                                    struct addrinfo       **result);
+void _mongoc_dns_cache_freeaddrinfo (struct addrinfo       *result);
+bool _mongoc_dns_cache_getnameinfo (const struct sockaddr  *addr,
+                                    socklen_t               addrlen,
+                                    int64_t                 ttl_msec,
+                                    char                   *host,
+                                    size_t                  hostlen);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_DNS_CACHE_PRIVATE_H */
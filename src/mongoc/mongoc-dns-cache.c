@@ -0,0 +1,461 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-counters-private.h"
+#include "mongoc-dns-cache-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "dns"
+
+
+#ifdef _WIN32
+# define strcasecmp _stricmp
+#endif
+
+
+#ifndef MONGOC_DNS_CACHE_MAX_ENTRIES
+# define MONGOC_DNS_CACHE_MAX_ENTRIES 256
+#endif
+
+
+#ifndef MONGOC_DNS_CACHE_MAX_NAMES
+# define MONGOC_DNS_CACHE_MAX_NAMES 64
+#endif
+
+
+/*
+ * A resolved (or failed) lookup. While @resolving is set, the thread that
+ * set it is calling getaddrinfo() without the lock held and other threads
+ * looking up the same name wait for its answer instead of asking the
+ * resolver again.
+ */
+typedef struct
+{
+   char            *host;
+   char             port[8];
+   int              family;
+   int              socktype;
+   int              status;
+   int64_t          resolved_at;
+   struct addrinfo *result;
+   bool             resolving;
+} mongoc_dns_cache_entry_t;
+
+
+/* the name a numeric address resolved to in reverse */
+typedef struct
+{
+   char             addr[64];
+   char            *name;
+   int64_t          resolved_at;
+} mongoc_dns_cache_name_t;
+
+
+static mongoc_mutex_t           gDNSCacheMutex;
+static mongoc_cond_t            gDNSCacheCond;
+static mongoc_dns_cache_entry_t gDNSCache[MONGOC_DNS_CACHE_MAX_ENTRIES];
+static mongoc_dns_cache_name_t  gDNSNames[MONGOC_DNS_CACHE_MAX_NAMES];
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_cache_copy --
+ *
+ *       Make a deep copy of the address list @ai. Canonical names are not
+ *       copied since the driver never requests them.
+ *
+ * Returns:
+ *       A list that should be freed with _mongoc_dns_cache_freeaddrinfo(),
+ *       or NULL if @ai is NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static struct addrinfo *
+_mongoc_dns_cache_copy (const struct addrinfo *ai)
+{
+   struct addrinfo *head = NULL;
+   struct addrinfo **tail = &head;
+   struct addrinfo *copy;
+
+   for (; ai; ai = ai->ai_next) {
+      copy = bson_malloc0 (sizeof *copy + ai->ai_addrlen);
+      memcpy (copy, ai, sizeof *copy);
+      copy->ai_addr = (struct sockaddr *)(copy + 1);
+      memcpy (copy->ai_addr, ai->ai_addr, ai->ai_addrlen);
+      copy->ai_canonname = NULL;
+      copy->ai_next = NULL;
+
+      *tail = copy;
+      tail = &copy->ai_next;
+   }
+
+   return head;
+}
+
+
+void
+_mongoc_dns_cache_freeaddrinfo (struct addrinfo *result)
+{
+   struct addrinfo *next;
+
+   while (result) {
+      next = result->ai_next;
+      bson_free (result);
+      result = next;
+   }
+}
+
+
+static void
+_mongoc_dns_cache_entry_clear (mongoc_dns_cache_entry_t *entry)
+{
+   bson_free (entry->host);
+   _mongoc_dns_cache_freeaddrinfo (entry->result);
+   memset (entry, 0, sizeof *entry);
+}
+
+
+void
+_mongoc_dns_cache_init (void)
+{
+   mongoc_mutex_init (&gDNSCacheMutex);
+   mongoc_cond_init (&gDNSCacheCond);
+}
+
+
+void
+_mongoc_dns_cache_cleanup (void)
+{
+   int i;
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+   for (i = 0; i < MONGOC_DNS_CACHE_MAX_ENTRIES; i++) {
+      if (!gDNSCache[i].resolving) {
+         _mongoc_dns_cache_entry_clear (&gDNSCache[i]);
+      }
+   }
+   for (i = 0; i < MONGOC_DNS_CACHE_MAX_NAMES; i++) {
+      bson_free (gDNSNames[i].name);
+      memset (&gDNSNames[i], 0, sizeof gDNSNames[i]);
+   }
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_cache_find --
+ *
+ *       Find the entry for a lookup, or claim a slot for it. When the
+ *       cache is full, the oldest entry that is not being resolved is
+ *       evicted.
+ *
+ *       Requires gDNSCacheMutex to be held.
+ *
+ * Returns:
+ *       An entry, which has no host if it was just claimed, or NULL if
+ *       every slot is being resolved.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_dns_cache_entry_t *
+_mongoc_dns_cache_find (const char            *host,
+                        const char            *port,
+                        const struct addrinfo *hints)
+{
+   mongoc_dns_cache_entry_t *entry;
+   mongoc_dns_cache_entry_t *oldest = NULL;
+   mongoc_dns_cache_entry_t *empty = NULL;
+   int i;
+
+   for (i = 0; i < MONGOC_DNS_CACHE_MAX_ENTRIES; i++) {
+      entry = &gDNSCache[i];
+
+      if (!entry->host) {
+         if (!empty) {
+            empty = entry;
+         }
+         continue;
+      }
+
+      if ((entry->family == hints->ai_family) &&
+          (entry->socktype == hints->ai_socktype) &&
+          !strcmp (entry->port, port) &&
+          !strcasecmp (entry->host, host)) {
+         return entry;
+      }
+
+      if (!entry->resolving &&
+          (!oldest || (entry->resolved_at < oldest->resolved_at))) {
+         oldest = entry;
+      }
+   }
+
+   if (empty) {
+      return empty;
+   }
+
+   if (oldest) {
+      _mongoc_dns_cache_entry_clear (oldest);
+   }
+
+   return oldest;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_cache_getaddrinfo --
+ *
+ *       Resolve @host and @port like getaddrinfo(), sharing the answer
+ *       with every client in the process.
+ *
+ *       A successful answer is reused for @ttl_msec milliseconds and a
+ *       failure for @negative_ttl_msec milliseconds. A TTL of 0 disables
+ *       caching of that kind of answer. Concurrent lookups of the same
+ *       name wait for a single call to getaddrinfo().
+ *
+ * Returns:
+ *       0 if successful and @result is set; otherwise a getaddrinfo()
+ *       error code.
+ *
+ * Side effects:
+ *       @result should be freed with _mongoc_dns_cache_freeaddrinfo().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_dns_cache_getaddrinfo (const char             *host,
+                               const char             *port,
+                               const struct addrinfo  *hints,
+                               int64_t                 ttl_msec,
+                               int64_t                 negative_ttl_msec,
+                               struct addrinfo       **result)
+{
+   mongoc_dns_cache_entry_t *entry = NULL;
+   struct addrinfo *resolved = NULL;
+   struct addrinfo *copy;
+   int64_t ttl;
+   int64_t now;
+   int status;
+
+   ENTRY;
+
+   BSON_ASSERT (host);
+   BSON_ASSERT (port);
+   BSON_ASSERT (hints);
+   BSON_ASSERT (result);
+
+   *result = NULL;
+
+   if ((ttl_msec > 0) || (negative_ttl_msec > 0)) {
+      mongoc_mutex_lock (&gDNSCacheMutex);
+
+      for (;;) {
+         entry = _mongoc_dns_cache_find (host, port, hints);
+
+         if (!entry || !entry->resolving) {
+            break;
+         }
+
+         mongoc_cond_wait (&gDNSCacheCond, &gDNSCacheMutex);
+      }
+
+      if (entry && entry->host) {
+         ttl = entry->status ? negative_ttl_msec : ttl_msec;
+         now = bson_get_monotonic_time ();
+
+         if ((now - entry->resolved_at) < (ttl * 1000L)) {
+            if (entry->status) {
+               mongoc_counter_dns_cache_negative_hits_inc ();
+            } else {
+               mongoc_counter_dns_cache_hits_inc ();
+            }
+
+            *result = _mongoc_dns_cache_copy (entry->result);
+            status = entry->status;
+            mongoc_mutex_unlock (&gDNSCacheMutex);
+
+            RETURN (status);
+         }
+
+         _mongoc_dns_cache_freeaddrinfo (entry->result);
+         entry->result = NULL;
+      } else if (entry) {
+         entry->host = bson_strdup (host);
+         bson_strncpy (entry->port, port, sizeof entry->port);
+         entry->family = hints->ai_family;
+         entry->socktype = hints->ai_socktype;
+      }
+
+      if (entry) {
+         entry->resolving = true;
+      }
+
+      mongoc_counter_dns_cache_misses_inc ();
+
+      mongoc_mutex_unlock (&gDNSCacheMutex);
+   }
+
+   status = getaddrinfo (host, port, hints, &resolved);
+
+   if (status == 0) {
+      mongoc_counter_dns_success_inc ();
+      copy = _mongoc_dns_cache_copy (resolved);
+      freeaddrinfo (resolved);
+   } else {
+      mongoc_counter_dns_failure_inc ();
+      copy = NULL;
+   }
+
+   if (entry) {
+      mongoc_mutex_lock (&gDNSCacheMutex);
+      entry->status = status;
+      entry->result = _mongoc_dns_cache_copy (copy);
+      entry->resolved_at = bson_get_monotonic_time ();
+      entry->resolving = false;
+      mongoc_cond_broadcast (&gDNSCacheCond);
+      mongoc_mutex_unlock (&gDNSCacheMutex);
+   }
+
+   *result = copy;
+
+   RETURN (status);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_dns_cache_getnameinfo --
+ *
+ *       Resolve the address @addr back to a host name like getnameinfo(),
+ *       sharing the answer with every client in the process for
+ *       @ttl_msec milliseconds. GSSAPI authentication with
+ *       canonicalizeHostname does this for every connection, and the
+ *       name of a server seldom changes.
+ *
+ *       Failures are not cached. A TTL of 0 disables caching.
+ *
+ * Returns:
+ *       true if successful and @host is set; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_dns_cache_getnameinfo (const struct sockaddr *addr,
+                               socklen_t              addrlen,
+                               int64_t                ttl_msec,
+                               char                  *host,
+                               size_t                 hostlen)
+{
+   mongoc_dns_cache_name_t *entry;
+   mongoc_dns_cache_name_t *oldest = NULL;
+   char numeric[64];
+   int64_t now;
+   bool found = false;
+   int i;
+
+   ENTRY;
+
+   BSON_ASSERT (addr);
+   BSON_ASSERT (host);
+
+   if ((ttl_msec <= 0) ||
+       (0 != getnameinfo (addr, addrlen, numeric, sizeof numeric, NULL, 0,
+                          NI_NUMERICHOST))) {
+      RETURN (0 == getnameinfo (addr, addrlen, host, (socklen_t)hostlen,
+                                NULL, 0, 0));
+   }
+
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   for (i = 0; i < MONGOC_DNS_CACHE_MAX_NAMES; i++) {
+      entry = &gDNSNames[i];
+
+      if (entry->name &&
+          !strcmp (entry->addr, numeric) &&
+          ((now - entry->resolved_at) < (ttl_msec * 1000L))) {
+         bson_snprintf (host, hostlen, "%s", entry->name);
+         found = true;
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+
+   if (found) {
+      mongoc_counter_dns_cache_hits_inc ();
+      RETURN (true);
+   }
+
+   mongoc_counter_dns_cache_misses_inc ();
+
+   if (0 != getnameinfo (addr, addrlen, host, (socklen_t)hostlen, NULL, 0, 0)) {
+      mongoc_counter_dns_failure_inc ();
+      RETURN (false);
+   }
+
+   mongoc_counter_dns_success_inc ();
+
+   mongoc_mutex_lock (&gDNSCacheMutex);
+
+   for (i = 0; i < MONGOC_DNS_CACHE_MAX_NAMES; i++) {
+      entry = &gDNSNames[i];
+
+      if (!entry->name || !strcmp (entry->addr, numeric)) {
+         oldest = entry;
+         break;
+      }
+
+      if (!oldest || (entry->resolved_at < oldest->resolved_at)) {
+         oldest = entry;
+      }
+   }
+
+   bson_free (oldest->name);
+   bson_strncpy (oldest->addr, numeric, sizeof oldest->addr);
+   oldest->name = bson_strdup (host);
+   oldest->resolved_at = bson_get_monotonic_time ();
+
+   mongoc_mutex_unlock (&gDNSCacheMutex);
+
+   RETURN (true);
+}
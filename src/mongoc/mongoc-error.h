@@ -89,6 +89,14 @@ typedef enum
    MONGOC_ERROR_SCRAM_NOT_DONE,
    MONGOC_ERROR_SCRAM_PROTOCOL_ERROR,
 
+   MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+
+   MONGOC_ERROR_CLIENT_POOL_EXHAUSTED,
+   MONGOC_ERROR_CLIENT_OVERLOADED,
+
+   MONGOC_ERROR_GRIDFS_COMPRESSION,
+   MONGOC_ERROR_GRIDFS_PARTIAL_FILE,
+
    MONGOC_ERROR_QUERY_COMMAND_NOT_FOUND = 59,
    MONGOC_ERROR_QUERY_NOT_TAILABLE = 13051,
 
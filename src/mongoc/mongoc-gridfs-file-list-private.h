@@ -31,17 +31,21 @@
 BSON_BEGIN_DECLS
 
 
+/* files listed with a projection are partial */
 struct _mongoc_gridfs_file_list_t
 {
    mongoc_gridfs_t *gridfs;
    mongoc_cursor_t *cursor;
    bson_error_t     error;
+   bool             partial;
 };
 
 
 mongoc_gridfs_file_list_t *_mongoc_gridfs_file_list_new (mongoc_gridfs_t *gridfs,
                                                          const bson_t    *query,
-                                                         uint32_t         limit);
+                                                         const bson_t    *fields,
+                                                         uint32_t         limit,
+                                                         uint32_t         batch_size);
 
 
 BSON_END_DECLS
@@ -35,13 +35,15 @@
 mongoc_gridfs_file_list_t *
 _mongoc_gridfs_file_list_new (mongoc_gridfs_t *gridfs,
                               const bson_t    *query,
-                              uint32_t    limit)
+                              const bson_t    *fields,
+                              uint32_t         limit,
+                              uint32_t         batch_size)
 {
    mongoc_gridfs_file_list_t *list;
    mongoc_cursor_t *cursor;
 
-   cursor = mongoc_collection_find (gridfs->files, MONGOC_QUERY_NONE, 0, limit, 0,
-                                    query, NULL, NULL);
+   cursor = mongoc_collection_find (gridfs->files, MONGOC_QUERY_NONE, 0, limit,
+                                    batch_size, query, fields, NULL);
 
    BSON_ASSERT (cursor);
 
@@ -49,6 +51,7 @@ _mongoc_gridfs_file_list_new (mongoc_gridfs_t *gridfs,
 
    list->cursor = cursor;
    list->gridfs = gridfs;
+   list->partial = (fields && !bson_empty (fields));
 
    return list;
 }
@@ -57,12 +60,17 @@ _mongoc_gridfs_file_list_new (mongoc_gridfs_t *gridfs,
 mongoc_gridfs_file_t *
 mongoc_gridfs_file_list_next (mongoc_gridfs_file_list_t *list)
 {
+   mongoc_gridfs_file_t *file;
    const bson_t *bson;
 
    BSON_ASSERT (list);
 
    if (mongoc_cursor_next (list->cursor, &bson)) {
-      return _mongoc_gridfs_file_new_from_bson (list->gridfs, bson);
+      file = _mongoc_gridfs_file_new_from_bson (list->gridfs, bson);
+      if (file) {
+         file->partial = list->partial;
+      }
+      return file;
    } else {
       return NULL;
    }
@@ -18,6 +18,7 @@
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "gridfs_file_page"
 
+#include "mongoc-counters-private.h"
 #include "mongoc-gridfs-file-page.h"
 #include "mongoc-gridfs-file-page-private.h"
 
@@ -81,7 +82,7 @@ _mongoc_gridfs_file_page_read (mongoc_gridfs_file_page_t *page,
 
    bytes_read = BSON_MIN (len, page->len - page->offset);
 
-   src = page->read_buf ? page->read_buf : page->buf;
+   src = page->buf ? page->buf : page->read_buf;
 
    memcpy (dst, src + page->offset, bytes_read);
 
@@ -116,6 +117,7 @@ _mongoc_gridfs_file_page_write (mongoc_gridfs_file_page_t *page,
 
    if (!page->buf) {
       page->buf = bson_malloc (page->chunk_size);
+      mongoc_counter_memory_gridfs_pages_add (page->chunk_size);
       memcpy (page->buf, page->read_buf, BSON_MIN (page->chunk_size, page->len));
    }
 
@@ -177,7 +179,10 @@ _mongoc_gridfs_file_page_destroy (mongoc_gridfs_file_page_t *page)
 {
    ENTRY;
 
-   if (page->buf) { bson_free (page->buf); }
+   if (page->buf) {
+      mongoc_counter_memory_gridfs_pages_add (-(int64_t)page->chunk_size);
+      bson_free (page->buf);
+   }
 
    bson_free (page);
 
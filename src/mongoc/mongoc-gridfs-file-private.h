@@ -27,11 +27,34 @@
 #include "mongoc-gridfs-file.h"
 #include "mongoc-gridfs-file-page.h"
 #include "mongoc-cursor.h"
+#include "mongoc-bulk-writer.h"
 
 
 BSON_BEGIN_DECLS
 
 
+/*
+ * The default chunk size is now 255kb. This used to be 256k but has been
+ * reduced to allow for them to fit within power of two sizes in mongod.
+ *
+ * See CDRIVER-322.
+ */
+#define MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE ((1 << 18) - 1024)
+
+/* the most chunks an auto chunk size splits larger files in, short of
+ * the largest chunk size */
+#define MONGOC_GRIDFS_AUTO_CHUNKS 64
+
+
+typedef struct
+{
+   uint32_t  n;
+   uint32_t  len;
+   uint8_t  *data;
+   uint64_t  last_used;
+} mongoc_gridfs_file_cached_chunk_t;
+
+
 struct _mongoc_gridfs_file_t
 {
    mongoc_gridfs_t           *gridfs;
@@ -42,11 +65,41 @@ struct _mongoc_gridfs_file_t
    bool                       failed;
    mongoc_cursor_t           *cursor;
    uint32_t                   cursor_range[2];
+   uint32_t                   read_ahead;
+   bool                       has_read_range;
+   uint32_t                   read_range[2];
    bool                       is_dirty;
 
+   /* made from a files document fetched with a projection */
+   bool                       partial;
+
+   /* the cache_size chunks read or written most recently */
+   mongoc_gridfs_file_cached_chunk_t *cache;
+   uint32_t                   cache_size;
+   uint32_t                   cache_len;
+   uint64_t                   cache_clock;
+
+   /* chunks from n_maybe_stored on are not on the server yet */
+   uint32_t                   n_maybe_stored;
+   bool                       bulk_upload;
+   mongoc_bulk_writer_t      *bulk_writer;
+
+   /* md5 of the first digest_pos bytes, while they were written in order */
+   bson_md5_t                 digest;
+   uint64_t                   digest_pos;
+   bool                       digest_valid;
+   bool                       digest_saved;
+
    bson_value_t               files_id;
    int64_t                    length;
    int32_t                    chunk_size;
+   bool                       chunk_size_auto;
+
+   /* chunks are stored compressed unless compressor_id is
+    * MONGOC_COMPRESSOR_NONE_ID, and read back into uncompressed */
+   int32_t                    compressor_id;
+   const char                *bson_compression;
+   uint8_t                   *uncompressed;
    int64_t                    upload_date;
 
    char                      *md5;
@@ -66,6 +119,8 @@ mongoc_gridfs_file_t *_mongoc_gridfs_file_new_from_bson (mongoc_gridfs_t
                                                          const bson_t             *data);
 mongoc_gridfs_file_t *_mongoc_gridfs_file_new           (mongoc_gridfs_t          *gridfs,
                                                          mongoc_gridfs_file_opt_t *opt);
+bool                  _mongoc_gridfs_file_resume        (mongoc_gridfs_file_t     *file,
+                                                         bson_error_t             *error);
 
 
 BSON_END_DECLS
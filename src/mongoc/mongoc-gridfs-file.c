@@ -22,9 +22,12 @@
 #include <time.h>
 #include <errno.h>
 
+#include "mongoc-client-private.h"
 #include "mongoc-cursor.h"
 #include "mongoc-cursor-private.h"
 #include "mongoc-collection.h"
+#include "mongoc-compression-private.h"
+#include "mongoc-error.h"
 #include "mongoc-gridfs.h"
 #include "mongoc-gridfs-private.h"
 #include "mongoc-gridfs-file.h"
@@ -40,6 +43,22 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file);
 static bool
 _mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file);
 
+static bool
+_mongoc_gridfs_file_finish_upload (mongoc_gridfs_file_t *file);
+
+static mongoc_gridfs_file_cached_chunk_t *
+_mongoc_gridfs_file_cache_get (mongoc_gridfs_file_t *file,
+                               uint32_t              n);
+
+static mongoc_gridfs_file_cached_chunk_t *
+_mongoc_gridfs_file_cache_put (mongoc_gridfs_file_t *file,
+                               uint32_t              n,
+                               const uint8_t        *data,
+                               uint32_t              len);
+
+static void
+_mongoc_gridfs_file_cache_clear (mongoc_gridfs_file_t *file);
+
 
 /*****************************************************************
 * Magic accessor generation
@@ -89,13 +108,164 @@ _mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file);
       file->is_dirty = 1; \
    }
 
-MONGOC_GRIDFS_FILE_STR_ACCESSOR (md5)
 MONGOC_GRIDFS_FILE_STR_ACCESSOR (filename)
 MONGOC_GRIDFS_FILE_STR_ACCESSOR (content_type)
 MONGOC_GRIDFS_FILE_BSON_ACCESSOR (aliases)
 MONGOC_GRIDFS_FILE_BSON_ACCESSOR (metadata)
 
 
+const char *
+mongoc_gridfs_file_get_md5 (mongoc_gridfs_file_t *file)
+{
+   return file->md5 ? file->md5 : file->bson_md5;
+}
+
+
+/* a digest set by the caller replaces the one computed while writing */
+void
+mongoc_gridfs_file_set_md5 (mongoc_gridfs_file_t *file,
+                            const char           *str)
+{
+   if (file->md5) {
+      bson_free (file->md5);
+   }
+
+   file->md5 = bson_strdup (str);
+   file->digest_valid = false;
+   file->digest_saved = false;
+   file->is_dirty = 1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_digest --
+ *
+ *       Add the @len bytes at @data, just written at @pos, to the running
+ *       md5 of @file. The digest carries on while the file is written in
+ *       order from its start, and is given up as soon as a write skips
+ *       ahead or rewrites bytes already hashed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Giving up drops the md5 stored by an earlier save, if any.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_gridfs_file_digest (mongoc_gridfs_file_t *file,
+                            uint64_t              pos,
+                            const uint8_t        *data,
+                            uint32_t              len)
+{
+   if (!file->digest_valid || !len) {
+      return;
+   }
+
+   if (pos != file->digest_pos) {
+      file->digest_valid = false;
+
+      /* the md5 saved before no longer describes the file */
+      if (file->digest_saved) {
+         bson_free (file->md5);
+         file->md5 = NULL;
+      }
+
+      return;
+   }
+
+   bson_md5_append (&file->digest, data, len);
+   file->digest_pos += len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_finish_digest --
+ *
+ *       Store the md5 computed while writing @file, if it covers the
+ *       whole file.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The md5 of @file is replaced. The running digest is left as is so
+ *       that later appends carry on from it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_gridfs_file_finish_digest (mongoc_gridfs_file_t *file)
+{
+   bson_md5_t md5;
+   uint8_t digest[16];
+   char digest_str[33];
+   int i;
+
+   if (!file->digest_valid || file->digest_pos != (uint64_t)file->length) {
+      return;
+   }
+
+   md5 = file->digest;
+   bson_md5_finish (&md5, digest);
+
+   for (i = 0; i < sizeof digest; i++) {
+      bson_snprintf (&digest_str[i * 2], 3, "%02x", digest[i]);
+   }
+   digest_str[sizeof digest_str - 1] = '\0';
+
+   if (file->md5) {
+      bson_free (file->md5);
+   }
+
+   file->md5 = bson_strdup (digest_str);
+   file->digest_saved = true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_check_partial --
+ *
+ *       Refuse to read, write or save @file if it was made from a files
+ *       document fetched with a projection, since the fields its chunks
+ *       or its files document depend on may be missing.
+ *
+ * Returns:
+ *       true if @file is complete, otherwise false and @file is failed.
+ *
+ * Side effects:
+ *       @file->error is set upon failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_gridfs_file_check_partial (mongoc_gridfs_file_t *file)
+{
+   if (!file->partial) {
+      return true;
+   }
+
+   bson_set_error (&file->error,
+                   MONGOC_ERROR_GRIDFS,
+                   MONGOC_ERROR_GRIDFS_PARTIAL_FILE,
+                   "File was listed with a projection. "
+                   "Find it again to read, write or save it.");
+   file->failed = true;
+
+   return false;
+}
+
+
 /** save a gridfs file */
 bool
 mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
@@ -114,10 +284,20 @@ mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
       return 1;
    }
 
+   if (!_mongoc_gridfs_file_check_partial (file)) {
+      RETURN (false);
+   }
+
    if (file->page && _mongoc_gridfs_file_page_is_dirty (file->page)) {
       _mongoc_gridfs_file_flush_page (file);
    }
 
+   if (!_mongoc_gridfs_file_finish_upload (file)) {
+      RETURN (false);
+   }
+
+   _mongoc_gridfs_file_finish_digest (file);
+
    md5 = mongoc_gridfs_file_get_md5 (file);
    filename = mongoc_gridfs_file_get_filename (file);
    content_type = mongoc_gridfs_file_get_content_type (file);
@@ -133,6 +313,12 @@ mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
    bson_append_int32 (&child, "chunkSize", -1, file->chunk_size);
    bson_append_date_time (&child, "uploadDate", -1, file->upload_date);
 
+   if (file->compressor_id != MONGOC_COMPRESSOR_NONE_ID) {
+      bson_append_utf8 (&child, "compression", -1,
+                        _mongoc_compressor_id_to_name (file->compressor_id),
+                        -1);
+   }
+
    if (md5) {
       bson_append_utf8 (&child, "md5", -1, md5, -1);
    }
@@ -155,6 +341,12 @@ mongoc_gridfs_file_save (mongoc_gridfs_file_t *file)
 
    bson_append_document_end (update, &child);
 
+   if (!md5 && file->digest_saved) {
+      bson_append_document_begin (update, "$unset", -1, &child);
+      bson_append_utf8 (&child, "md5", -1, "", 0);
+      bson_append_document_end (update, &child);
+   }
+
    r = mongoc_collection_update (file->gridfs->files, MONGOC_UPDATE_UPSERT,
                                  selector, update, NULL, &file->error);
 
@@ -197,6 +389,7 @@ _mongoc_gridfs_file_new_from_bson (mongoc_gridfs_t *gridfs,
    file = bson_malloc0 (sizeof *file);
 
    file->gridfs = gridfs;
+   file->compressor_id = MONGOC_COMPRESSOR_NONE_ID;
    bson_copy_to (data, &file->bson);
 
    bson_iter_init (&iter, &file->bson);
@@ -234,6 +427,14 @@ _mongoc_gridfs_file_new_from_bson (mongoc_gridfs_t *gridfs,
             GOTO (failure);
          }
          file->bson_md5 = bson_iter_utf8 (&iter, NULL);
+      } else if (0 == strcmp (key, "compression")) {
+         if (!BSON_ITER_HOLDS_UTF8 (&iter)) {
+            GOTO (failure);
+         }
+         /* an unsupported compressor fails reading the chunks */
+         file->bson_compression = bson_iter_utf8 (&iter, NULL);
+         file->compressor_id =
+            _mongoc_compressor_name_to_id (file->bson_compression);
       } else if (0 == strcmp (key, "filename")) {
          if (!BSON_ITER_HOLDS_UTF8 (&iter)) {
             GOTO (failure);
@@ -262,6 +463,9 @@ _mongoc_gridfs_file_new_from_bson (mongoc_gridfs_t *gridfs,
    /* TODO: is there are a minimal object we should be verifying that we
     * actually have here? */
 
+   /* any chunk may be on the server already */
+   file->n_maybe_stored = UINT32_MAX;
+
    RETURN (file);
 
 failure:
@@ -271,6 +475,96 @@ failure:
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_auto_chunk_size --
+ *
+ *       Pick the chunk size of a file of @length bytes. A file up to the
+ *       default chunk size is stored in a single chunk of its own size,
+ *       and larger files in up to MONGOC_GRIDFS_AUTO_CHUNKS chunks, each
+ *       a power of two less 1kb so that they fit the allocations of
+ *       mongod, no smaller than the default and short enough of
+ *       max_bson_size that a chunk document can always be sent.
+ *
+ * Returns:
+ *       The chunk size.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int32_t
+_mongoc_gridfs_file_auto_chunk_size (mongoc_gridfs_file_t *file,
+                                     uint64_t              length)
+{
+   int64_t max_chunk_size;
+   int64_t chunk_size;
+   uint64_t target;
+
+   if (!length) {
+      return MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE;
+   }
+
+   if (length <= MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE) {
+      return (int32_t)length;
+   }
+
+   max_chunk_size = file->gridfs->client->cluster.max_bson_size / 4 - 1024;
+   max_chunk_size = BSON_MAX (max_chunk_size, MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE);
+
+   target = length / MONGOC_GRIDFS_AUTO_CHUNKS;
+
+   for (chunk_size = MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE + 1024;
+        chunk_size - 1024 < (int64_t)BSON_MIN (target, (uint64_t)INT32_MAX) &&
+        chunk_size * 2 - 1024 <= max_chunk_size;
+        chunk_size *= 2) {
+   }
+
+   return (int32_t)(chunk_size - 1024);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_set_length_hint --
+ *
+ *       Tell @file that about @length bytes are going to be written to
+ *       it. If it was created with a chunk_size of
+ *       MONGOC_GRIDFS_CHUNK_SIZE_AUTO and nothing was written yet, this
+ *       picks its chunk size: small files are stored in a single chunk
+ *       and large ones in fewer, bigger chunks than the default.
+ *
+ *       The hint is not a limit, @file may end up shorter or longer.
+ *       mongoc_gridfs_create_file_from_stream() gives the length of
+ *       regular files itself.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The chunk size of @file may change.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_file_set_length_hint (mongoc_gridfs_file_t *file,   /* IN */
+                                    uint64_t              length) /* IN */
+{
+   bson_return_if_fail (file);
+
+   if (!file->chunk_size_auto || file->page || file->length || file->pos) {
+      return;
+   }
+
+   file->chunk_size = _mongoc_gridfs_file_auto_chunk_size (file, length);
+}
+
+
 /**
  * _mongoc_gridfs_file_new:
  *
@@ -295,17 +589,15 @@ _mongoc_gridfs_file_new (mongoc_gridfs_t          *gridfs,
 
    file->gridfs = gridfs;
    file->is_dirty = 1;
+   file->compressor_id = gridfs->compressor_id;
 
-   if (opt->chunk_size) {
+   if (opt->chunk_size && opt->chunk_size != MONGOC_GRIDFS_CHUNK_SIZE_AUTO) {
       file->chunk_size = opt->chunk_size;
    } else {
-      /*
-       * The default chunk size is now 255kb. This used to be 256k but has been
-       * reduced to allow for them to fit within power of two sizes in mongod.
-       *
-       * See CDRIVER-322.
-       */
-      file->chunk_size = (1 << 18) - 1024;
+      /* until the length is known, an auto chunk size is the default too */
+      file->chunk_size = MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE;
+      file->chunk_size_auto =
+         (opt->chunk_size == MONGOC_GRIDFS_CHUNK_SIZE_AUTO);
    }
 
    file->files_id.value_type = BSON_TYPE_OID;
@@ -315,6 +607,10 @@ _mongoc_gridfs_file_new (mongoc_gridfs_t          *gridfs,
 
    if (opt->md5) {
       file->md5 = bson_strdup (opt->md5);
+   } else {
+      /* a new file starts out empty, so its md5 can follow the writes */
+      bson_md5_init (&file->digest);
+      file->digest_valid = true;
    }
 
    if (opt->filename) {
@@ -355,6 +651,14 @@ mongoc_gridfs_file_destroy (mongoc_gridfs_file_t *file)
       mongoc_cursor_destroy (file->cursor);
    }
 
+   if (file->bulk_writer) {
+      mongoc_bulk_writer_destroy (file->bulk_writer);
+   }
+
+   _mongoc_gridfs_file_cache_clear (file);
+   bson_free (file->cache);
+   bson_free (file->uncompressed);
+
    if (file->files_id.value_type) {
       bson_value_destroy (&file->files_id);
    }
@@ -415,6 +719,10 @@ mongoc_gridfs_file_readv (mongoc_gridfs_file_t *file,
 
    /* TODO: we should probably do something about timeout_msec here */
 
+   if (!_mongoc_gridfs_file_check_partial (file)) {
+      RETURN (-1);
+   }
+
    if (!file->page) {
       _mongoc_gridfs_file_refresh_page (file);
    }
@@ -452,6 +760,102 @@ mongoc_gridfs_file_readv (mongoc_gridfs_file_t *file,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_read_view --
+ *
+ *       Read up to @max_bytes from @file without copying them. @data is
+ *       pointed at the bytes at the current position, which never extend
+ *       past the end of the chunk they are in, and the position moves past
+ *       them.
+ *
+ *       The bytes stay valid until the next call on @file.
+ *
+ * Returns:
+ *       The number of bytes at @data, 0 at the end of the file, or -1 on
+ *       failure, see mongoc_gridfs_file_error().
+ *
+ * Side effects:
+ *       A written page that has been read to its end is flushed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ssize_t
+mongoc_gridfs_file_read_view (mongoc_gridfs_file_t  *file,      /* IN */
+                              const uint8_t        **data,      /* OUT */
+                              size_t                 max_bytes) /* IN */
+{
+   uint32_t offset;
+   uint32_t len;
+   bool r;
+
+   ENTRY;
+
+   bson_return_val_if_fail (file, -1);
+   bson_return_val_if_fail (data, -1);
+
+   *data = NULL;
+
+   if (!_mongoc_gridfs_file_check_partial (file)) {
+      RETURN (-1);
+   }
+
+   if ((int64_t)file->pos >= file->length || !max_bytes) {
+      RETURN (0);
+   }
+
+   /* a page read to its end is left behind by the position */
+   if (file->page &&
+       _mongoc_gridfs_file_page_tell (file->page) ==
+       _mongoc_gridfs_file_page_get_len (file->page)) {
+      if (_mongoc_gridfs_file_page_is_dirty (file->page)) {
+         file->pos--;
+         r = _mongoc_gridfs_file_flush_page (file);
+         file->pos++;
+
+         if (!r) {
+            RETURN (-1);
+         }
+      } else {
+         _mongoc_gridfs_file_page_destroy (file->page);
+         file->page = NULL;
+      }
+   }
+
+   if (!file->page) {
+      _mongoc_gridfs_file_refresh_page (file);
+
+      if (!file->page) {
+         if (!file->failed) {
+            bson_set_error (&file->error,
+                            MONGOC_ERROR_GRIDFS,
+                            MONGOC_ERROR_GRIDFS_CHUNK_MISSING,
+                            "Missing chunk %u.",
+                            (unsigned)(file->pos / file->chunk_size));
+            file->failed = true;
+         }
+
+         RETURN (-1);
+      }
+   }
+
+   offset = _mongoc_gridfs_file_page_tell (file->page);
+   len = _mongoc_gridfs_file_page_get_len (file->page) - offset;
+
+   if (max_bytes < len) {
+      len = (uint32_t)max_bytes;
+   }
+
+   *data = _mongoc_gridfs_file_page_get_data (file->page) + offset;
+   _mongoc_gridfs_file_page_seek (file->page, offset + len);
+   file->pos += len;
+
+   RETURN ((ssize_t)len);
+}
+
+
 /** writev against a gridfs file */
 ssize_t
 mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
@@ -473,6 +877,10 @@ mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
 
    /* TODO: we should probably do something about timeout_msec here */
 
+   if (!_mongoc_gridfs_file_check_partial (file)) {
+      RETURN (-1);
+   }
+
    for (i = 0; i < iovcnt; i++) {
       iov_pos = 0;
 
@@ -486,6 +894,10 @@ mongoc_gridfs_file_writev (mongoc_gridfs_file_t *file,
                                             (uint32_t)(iov[i].iov_len - iov_pos));
          BSON_ASSERT (r >= 0);
 
+         _mongoc_gridfs_file_digest (file, file->pos,
+                                     (uint8_t *)iov[i].iov_base + iov_pos,
+                                     (uint32_t)r);
+
          iov_pos += r;
          file->pos += r;
          bytes_written += r;
@@ -520,30 +932,74 @@ static bool
 _mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file)
 {
    bson_t *selector, *update;
+   mongoc_buffer_t compressed;
    bool r;
    const uint8_t *buf;
    uint32_t len;
+   uint32_t n;
 
    ENTRY;
    BSON_ASSERT (file);
    BSON_ASSERT (file->page);
 
+   n = (uint32_t)(file->pos / file->chunk_size);
+
    buf = _mongoc_gridfs_file_page_get_data (file->page);
    len = _mongoc_gridfs_file_page_get_len (file->page);
 
+   _mongoc_buffer_init (&compressed, NULL, 0, NULL, NULL);
+
+   if ((file->compressor_id != MONGOC_COMPRESSOR_NONE_ID) &&
+       !_mongoc_compress (file->compressor_id, -1, buf, len, &compressed)) {
+      bson_set_error (&file->error,
+                      MONGOC_ERROR_GRIDFS,
+                      MONGOC_ERROR_GRIDFS_COMPRESSION,
+                      "Failed to compress chunk %u.", n);
+      file->failed = true;
+      _mongoc_buffer_destroy (&compressed);
+      RETURN (false);
+   }
+
    selector = bson_new ();
 
    bson_append_value (selector, "files_id", -1, &file->files_id);
-   bson_append_int32 (selector, "n", -1, (int32_t)(file->pos / file->chunk_size));
+   bson_append_int32 (selector, "n", -1, (int32_t)n);
 
    update = bson_sized_new (file->chunk_size + 100);
 
    bson_append_value (update, "files_id", -1, &file->files_id);
-   bson_append_int32 (update, "n", -1, (int32_t)(file->pos / file->chunk_size));
-   bson_append_binary (update, "data", -1, BSON_SUBTYPE_BINARY, buf, len);
+   bson_append_int32 (update, "n", -1, (int32_t)n);
 
-   r = mongoc_collection_update (file->gridfs->chunks, MONGOC_UPDATE_UPSERT,
-                                 selector, update, NULL, &file->error);
+   if (file->compressor_id != MONGOC_COMPRESSOR_NONE_ID) {
+      bson_append_binary (update, "data", -1, BSON_SUBTYPE_BINARY,
+                          compressed.data + compressed.off,
+                          (uint32_t)compressed.len);
+   } else {
+      bson_append_binary (update, "data", -1, BSON_SUBTYPE_BINARY, buf, len);
+   }
+
+   _mongoc_buffer_destroy (&compressed);
+
+   if (file->bulk_upload) {
+      if (!file->bulk_writer) {
+         file->bulk_writer = mongoc_collection_create_bulk_writer (
+            file->gridfs->chunks, true, NULL);
+         mongoc_bulk_writer_set_pipelined (file->bulk_writer, true);
+      }
+
+      /* a chunk that cannot be on the server yet is inserted, which lets
+       * a new file go out as a few large insert commands */
+      if (n >= file->n_maybe_stored) {
+         r = mongoc_bulk_writer_insert (file->bulk_writer, update,
+                                        &file->error);
+      } else {
+         r = mongoc_bulk_writer_replace_one (file->bulk_writer, selector,
+                                             update, true, &file->error);
+      }
+   } else {
+      r = mongoc_collection_update (file->gridfs->chunks, MONGOC_UPDATE_UPSERT,
+                                    selector, update, NULL, &file->error);
+   }
 
    file->failed = !r;
 
@@ -551,9 +1007,179 @@ _mongoc_gridfs_file_flush_page (mongoc_gridfs_file_t *file)
    bson_destroy (update);
 
    if (r) {
+      /* the chunk just written is as good as read back */
+      if (file->cache_size) {
+         _mongoc_gridfs_file_cache_put (file, n, buf, len);
+      }
+
       _mongoc_gridfs_file_page_destroy (file->page);
       file->page = NULL;
-      r = mongoc_gridfs_file_save (file);
+      file->n_maybe_stored = BSON_MAX (file->n_maybe_stored, n + 1);
+
+      /* a bulk upload saves the file once, in mongoc_gridfs_file_save() */
+      if (!file->bulk_upload) {
+         r = mongoc_gridfs_file_save (file);
+      }
+   }
+
+   RETURN (r);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_cache_get --
+ *
+ *       Look up chunk @n in the chunk cache of @file.
+ *
+ * Returns:
+ *       The cached chunk, or NULL.
+ *
+ * Side effects:
+ *       The chunk becomes the most recently used.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_gridfs_file_cached_chunk_t *
+_mongoc_gridfs_file_cache_get (mongoc_gridfs_file_t *file,
+                               uint32_t              n)
+{
+   uint32_t i;
+
+   for (i = 0; i < file->cache_len; i++) {
+      if (file->cache[i].n == n) {
+         file->cache[i].last_used = ++file->cache_clock;
+         return &file->cache[i];
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_cache_put --
+ *
+ *       Store a copy of the @len bytes of chunk @n at @data in the chunk
+ *       cache of @file, which must have a non-zero cache size.
+ *
+ * Returns:
+ *       The cached chunk.
+ *
+ * Side effects:
+ *       A previous copy of chunk @n, or else the least recently used
+ *       chunk once the cache is full, is freed. The current page must
+ *       not be reading from it.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_gridfs_file_cached_chunk_t *
+_mongoc_gridfs_file_cache_put (mongoc_gridfs_file_t *file,
+                               uint32_t              n,
+                               const uint8_t        *data,
+                               uint32_t              len)
+{
+   mongoc_gridfs_file_cached_chunk_t *cached = NULL;
+   uint32_t i;
+
+   BSON_ASSERT (file->cache_size);
+
+   for (i = 0; i < file->cache_len; i++) {
+      if (file->cache[i].n == n) {
+         cached = &file->cache[i];
+         break;
+      }
+   }
+
+   if (!cached) {
+      if (file->cache_len < file->cache_size) {
+         cached = &file->cache[file->cache_len++];
+         cached->data = NULL;
+      } else {
+         cached = &file->cache[0];
+
+         for (i = 1; i < file->cache_len; i++) {
+            if (file->cache[i].last_used < cached->last_used) {
+               cached = &file->cache[i];
+            }
+         }
+      }
+   }
+
+   /* the page being flushed may hand us the cached copy itself */
+   if (cached->data != data) {
+      bson_free (cached->data);
+      cached->data = bson_malloc (BSON_MAX (len, 1));
+      memcpy (cached->data, data, len);
+   }
+
+   cached->n = n;
+   cached->len = len;
+   cached->last_used = ++file->cache_clock;
+
+   return cached;
+}
+
+
+static void
+_mongoc_gridfs_file_cache_clear (mongoc_gridfs_file_t *file)
+{
+   uint32_t i;
+
+   for (i = 0; i < file->cache_len; i++) {
+      bson_free (file->cache[i].data);
+   }
+
+   file->cache_len = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_finish_upload --
+ *
+ *       Wait for the chunks a bulk upload has written so far to be
+ *       acknowledged.
+ *
+ * Returns:
+ *       true if there were none or all were written; otherwise false and
+ *       the error of @file is set.
+ *
+ * Side effects:
+ *       The chunks cursor of @file, which may predate the chunks just
+ *       written, is destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_gridfs_file_finish_upload (mongoc_gridfs_file_t *file)
+{
+   bool r;
+
+   ENTRY;
+
+   if (!file->bulk_writer) {
+      RETURN (true);
+   }
+
+   r = mongoc_bulk_writer_finish (file->bulk_writer, NULL, &file->error);
+   mongoc_bulk_writer_destroy (file->bulk_writer);
+   file->bulk_writer = NULL;
+
+   if (!r) {
+      file->failed = true;
+   }
+
+   if (file->cursor) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
    }
 
    RETURN (r);
@@ -573,9 +1199,12 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
    const char *key;
    bson_iter_t iter;
 
+   mongoc_gridfs_file_cached_chunk_t *cached;
    uint32_t n;
    const uint8_t *data;
    uint32_t len;
+   size_t uncompressed_len;
+   bool ranged;
 
    ENTRY;
 
@@ -594,16 +1223,27 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
    if ((int64_t)file->pos >= file->length && !(file->pos % file->chunk_size)) {
       data = (uint8_t *)"";
       len = 0;
+   } else if ((cached = _mongoc_gridfs_file_cache_get (file, n))) {
+      data = cached->data;
+      len = cached->len;
    } else {
       /* if we have a cursor, but the cursor doesn't have the chunk we're going
        * to need, destroy it (we'll grab a new one immediately there after) */
       if (file->cursor &&
-          !(file->cursor_range[0] >= n && file->cursor_range[1] <= n)) {
+          !(file->cursor_range[0] <= n && n <= file->cursor_range[1])) {
          mongoc_cursor_destroy (file->cursor);
          file->cursor = NULL;
       }
 
       if (!file->cursor) {
+         /* the chunks of a bulk upload must be on the server to be read */
+         _mongoc_gridfs_file_finish_upload (file);
+
+         /* a read within the read range fetches the rest of the range and
+          * nothing past it */
+         ranged = (file->has_read_range &&
+                   file->read_range[0] <= n && n <= file->read_range[1]);
+
          query = bson_new ();
 
          bson_append_document_begin(query, "$query", -1, &child);
@@ -611,6 +1251,9 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
 
             bson_append_document_begin (&child, "n", -1, &child2);
                bson_append_int32 (&child2, "$gte", -1, (int32_t)(file->pos / file->chunk_size));
+               if (ranged) {
+                  bson_append_int32 (&child2, "$lte", -1, (int32_t)file->read_range[1]);
+               }
             bson_append_document_end (&child, &child2);
          bson_append_document_end(query, &child);
 
@@ -631,6 +1274,22 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
          file->cursor_range[0] = n;
          file->cursor_range[1] = (uint32_t)(file->length / file->chunk_size);
 
+         if (ranged) {
+            file->cursor_range[1] = file->read_range[1];
+         }
+
+         /* fetch the read-ahead window of chunks per round trip, and the
+          * next window while this one is being read */
+         if (file->read_ahead &&
+             (!ranged || file->read_ahead <= file->read_range[1] - n)) {
+            mongoc_cursor_set_batch_size (file->cursor, file->read_ahead);
+            mongoc_cursor_set_prefetch (file->cursor, true);
+         } else if (ranged) {
+            /* the whole rest of the range in one reply */
+            mongoc_cursor_set_batch_size (file->cursor,
+                                          file->read_range[1] - n + 1);
+         }
+
          bson_destroy (query);
          bson_destroy (fields);
 
@@ -677,6 +1336,36 @@ _mongoc_gridfs_file_refresh_page (mongoc_gridfs_file_t *file)
       if (!(n == file->pos / file->chunk_size)) {
          return 0;
       }
+
+      if (file->bson_compression ||
+          (file->compressor_id != MONGOC_COMPRESSOR_NONE_ID)) {
+         if (!file->uncompressed) {
+            file->uncompressed = bson_malloc (BSON_MAX (file->chunk_size, 1));
+         }
+
+         uncompressed_len = (size_t)file->chunk_size;
+
+         if (!_mongoc_uncompress (file->compressor_id, data, len,
+                                  file->uncompressed, &uncompressed_len)) {
+            bson_set_error (&file->error,
+                            MONGOC_ERROR_GRIDFS,
+                            MONGOC_ERROR_GRIDFS_COMPRESSION,
+                            "Failed to uncompress chunk %u with \"%s\".", n,
+                            file->bson_compression ? file->bson_compression :
+                            _mongoc_compressor_id_to_name (file->compressor_id));
+            file->failed = true;
+            RETURN (0);
+         }
+
+         data = file->uncompressed;
+         len = (uint32_t)uncompressed_len;
+      }
+
+      /* the page reads from the cached copy, which outlives the cursor */
+      if (file->cache_size) {
+         cached = _mongoc_gridfs_file_cache_put (file, n, data, len);
+         data = cached->data;
+      }
    }
 
    file->page = _mongoc_gridfs_file_page_new (data, len, file->chunk_size);
@@ -793,6 +1482,133 @@ mongoc_gridfs_file_get_upload_date (mongoc_gridfs_file_t *file)
    return file->upload_date;
 }
 
+const bson_value_t *
+mongoc_gridfs_file_get_id (mongoc_gridfs_file_t *file)
+{
+   bson_return_val_if_fail (file, NULL);
+
+   return &file->files_id;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_file_resume --
+ *
+ *       Prepare @file to carry on an upload that stopped part way. The
+ *       chunks stored for it are counted from chunk 0 up to the first
+ *       missing one, any chunks past that are removed, and the length and
+ *       position of @file are set to the end of the stored contents.
+ *
+ *       Only chunk numbers are fetched, so this costs one round trip per
+ *       batch of chunk numbers rather than a read of the file. The chunk
+ *       size of @file must be the one the upload used.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       The md5 of @file is no longer computed while writing.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_gridfs_file_resume (mongoc_gridfs_file_t *file,  /* IN */
+                            bson_error_t         *error) /* OUT */
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *chunk;
+   bson_iter_t iter;
+   bson_t *query, *fields, child, child2;
+   bson_t sel = BSON_INITIALIZER;
+   uint32_t n = 0;
+   int64_t length;
+   bool ret = false;
+
+   ENTRY;
+
+   BSON_ASSERT (file);
+
+   query = bson_new ();
+
+   bson_append_document_begin (query, "$query", -1, &child);
+      bson_append_value (&child, "files_id", -1, &file->files_id);
+   bson_append_document_end (query, &child);
+
+   bson_append_document_begin (query, "$orderby", -1, &child);
+      bson_append_int32 (&child, "n", -1, 1);
+   bson_append_document_end (query, &child);
+
+   fields = bson_new ();
+   bson_append_int32 (fields, "n", -1, 1);
+   bson_append_int32 (fields, "_id", -1, 0);
+
+   cursor = mongoc_collection_find (file->gridfs->chunks, MONGOC_QUERY_NONE,
+                                    0, 0, 0, query, fields, NULL);
+
+   while (mongoc_cursor_next (cursor, &chunk)) {
+      if (!bson_iter_init_find (&iter, chunk, "n") ||
+          bson_iter_as_int64 (&iter) != n) {
+         break;
+      }
+
+      n++;
+   }
+
+   if (mongoc_cursor_error (cursor, error)) {
+      GOTO (cleanup);
+   }
+
+   /* a short last chunk ends the file where the files document says */
+   length = (int64_t)n * file->chunk_size;
+
+   if (n && file->length < length &&
+       file->length > length - file->chunk_size) {
+      length = file->length;
+   }
+
+   /* chunks past a missing one are written again */
+   BSON_APPEND_VALUE (&sel, "files_id", &file->files_id);
+   bson_append_document_begin (&sel, "n", -1, &child2);
+   bson_append_int32 (&child2, "$gte", -1, (int32_t)n);
+   bson_append_document_end (&sel, &child2);
+
+   if (!mongoc_collection_remove (file->gridfs->chunks, MONGOC_REMOVE_NONE,
+                                  &sel, NULL, error)) {
+      GOTO (cleanup);
+   }
+
+   if (file->page) {
+      _mongoc_gridfs_file_page_destroy (file->page);
+      file->page = NULL;
+   }
+
+   if (file->cursor) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
+   }
+
+   _mongoc_gridfs_file_cache_clear (file);
+
+   file->length = length;
+   file->pos = (uint64_t)length;
+   file->n_maybe_stored = n;
+   file->digest_valid = false;
+   file->is_dirty = 1;
+
+   ret = true;
+
+cleanup:
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (query);
+   bson_destroy (fields);
+   bson_destroy (&sel);
+
+   RETURN (ret);
+}
+
 bool
 mongoc_gridfs_file_remove (mongoc_gridfs_file_t *file,
                            bson_error_t         *error)
@@ -802,6 +1618,9 @@ mongoc_gridfs_file_remove (mongoc_gridfs_file_t *file,
 
    bson_return_val_if_fail (file, false);
 
+   /* chunks of a bulk upload not sent yet would outlive the file */
+   _mongoc_gridfs_file_finish_upload (file);
+
    BSON_APPEND_VALUE (&sel, "_id", &file->files_id);
 
    if (!mongoc_collection_remove (file->gridfs->files,
@@ -830,3 +1649,181 @@ cleanup:
 
    return ret;
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_set_read_ahead --
+ *
+ *       Set the number of chunks that reading @file requests from the
+ *       server at a time. The chunks past the read position are
+ *       requested while the current ones are being read, so sequential
+ *       reads of a large file are not held up by a round trip per batch.
+ *       0, the default, leaves the batch size to the server without
+ *       reading ahead.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The chunks cursor of @file is recreated on the next read.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_file_set_read_ahead (mongoc_gridfs_file_t *file,     /* IN */
+                                   uint32_t              n_chunks) /* IN */
+{
+   bson_return_if_fail (file);
+
+   if (file->cursor) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
+   }
+
+   file->read_ahead = n_chunks;
+}
+
+
+uint32_t
+mongoc_gridfs_file_get_read_ahead (mongoc_gridfs_file_t *file)
+{
+   bson_return_val_if_fail (file, 0);
+
+   return file->read_ahead;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_set_read_range --
+ *
+ *       Announce that the @length bytes from @offset on are about to be
+ *       read. Reading within them then fetches the chunks left in the
+ *       range with a single query bounded to the range, in one batch
+ *       unless a smaller read-ahead window is set. A @length of 0 drops
+ *       the range.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The chunks cursor of @file is recreated on the next read.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_file_set_read_range (mongoc_gridfs_file_t *file,   /* IN */
+                                   uint64_t              offset, /* IN */
+                                   uint64_t              length) /* IN */
+{
+   bson_return_if_fail (file);
+
+   file->has_read_range = (length > 0);
+
+   if (length) {
+      file->read_range[0] = (uint32_t)(offset / file->chunk_size);
+      file->read_range[1] = (uint32_t)((offset + length - 1) /
+                                       file->chunk_size);
+   }
+
+   if (file->cursor) {
+      mongoc_cursor_destroy (file->cursor);
+      file->cursor = NULL;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_set_bulk_upload --
+ *
+ *       Enable or disable bulk uploads for @file. Chunks written to a
+ *       bulk upload are sent in batches of many chunks per write command,
+ *       with one batch in flight while the next is filled, and the files
+ *       document is only updated by mongoc_gridfs_file_save(), which must
+ *       be called to complete the upload.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Disabling bulk uploads waits for the chunks already written, the
+ *       outcome is reported by mongoc_gridfs_file_error().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_file_set_bulk_upload (mongoc_gridfs_file_t *file,        /* IN */
+                                    bool                  bulk_upload) /* IN */
+{
+   bson_return_if_fail (file);
+
+   if (!bulk_upload) {
+      _mongoc_gridfs_file_finish_upload (file);
+   }
+
+   file->bulk_upload = bulk_upload;
+}
+
+
+bool
+mongoc_gridfs_file_get_bulk_upload (mongoc_gridfs_file_t *file)
+{
+   bson_return_val_if_fail (file, false);
+
+   return file->bulk_upload;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_file_set_cache_size --
+ *
+ *       Keep up to @n_chunks of the chunks most recently read or written
+ *       in memory, so that seeking back to them does not query the server
+ *       again. 0, the default, keeps only the current chunk.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Chunks cached so far are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_gridfs_file_set_cache_size (mongoc_gridfs_file_t *file,     /* IN */
+                                   uint32_t              n_chunks) /* IN */
+{
+   bson_return_if_fail (file);
+
+   /* a clean page may be reading from the cache, a dirty one has its own
+    * copy of the chunk */
+   if (file->page && !_mongoc_gridfs_file_page_is_dirty (file->page)) {
+      _mongoc_gridfs_file_page_destroy (file->page);
+      file->page = NULL;
+   }
+
+   _mongoc_gridfs_file_cache_clear (file);
+
+   file->cache = bson_realloc (file->cache, n_chunks * sizeof *file->cache);
+   file->cache_size = n_chunks;
+}
+
+
+uint32_t
+mongoc_gridfs_file_get_cache_size (mongoc_gridfs_file_t *file)
+{
+   bson_return_val_if_fail (file, 0);
+
+   return file->cache_size;
+}
@@ -44,6 +44,14 @@ BSON_BEGIN_DECLS
                                      const bson_t * bson);
 
 
+/*
+ * A chunk_size of MONGOC_GRIDFS_CHUNK_SIZE_AUTO has the chunk size picked
+ * from the length of the file once it is known, see
+ * mongoc_gridfs_file_set_length_hint().
+ */
+#define MONGOC_GRIDFS_CHUNK_SIZE_AUTO UINT32_MAX
+
+
 typedef struct _mongoc_gridfs_file_t     mongoc_gridfs_file_t;
 typedef struct _mongoc_gridfs_file_opt_t mongoc_gridfs_file_opt_t;
 
@@ -69,6 +77,8 @@ MONGOC_GRIDFS_FILE_BSON_HEADER (metadata)
 int64_t  mongoc_gridfs_file_get_length      (mongoc_gridfs_file_t *file);
 int32_t  mongoc_gridfs_file_get_chunk_size  (mongoc_gridfs_file_t *file);
 int64_t  mongoc_gridfs_file_get_upload_date (mongoc_gridfs_file_t *file);
+const bson_value_t *
+         mongoc_gridfs_file_get_id          (mongoc_gridfs_file_t *file);
 ssize_t  mongoc_gridfs_file_writev          (mongoc_gridfs_file_t *file,
                                              mongoc_iovec_t       *iov,
                                              size_t                iovcnt,
@@ -78,6 +88,9 @@ ssize_t  mongoc_gridfs_file_readv           (mongoc_gridfs_file_t *file,
                                              size_t                iovcnt,
                                              size_t                min_bytes,
                                              uint32_t              timeout_msec);
+ssize_t  mongoc_gridfs_file_read_view       (mongoc_gridfs_file_t *file,
+                                             const uint8_t       **data,
+                                             size_t                max_bytes);
 int      mongoc_gridfs_file_seek            (mongoc_gridfs_file_t *file,
                                              int64_t               delta,
                                              int                   whence);
@@ -88,6 +101,20 @@ bool     mongoc_gridfs_file_error           (mongoc_gridfs_file_t *file,
                                              bson_error_t         *error);
 bool     mongoc_gridfs_file_remove          (mongoc_gridfs_file_t *file,
                                              bson_error_t         *error);
+void     mongoc_gridfs_file_set_read_ahead  (mongoc_gridfs_file_t *file,
+                                             uint32_t              n_chunks);
+uint32_t mongoc_gridfs_file_get_read_ahead  (mongoc_gridfs_file_t *file);
+void     mongoc_gridfs_file_set_read_range  (mongoc_gridfs_file_t *file,
+                                             uint64_t              offset,
+                                             uint64_t              length);
+void     mongoc_gridfs_file_set_bulk_upload (mongoc_gridfs_file_t *file,
+                                             bool                  bulk_upload);
+bool     mongoc_gridfs_file_get_bulk_upload (mongoc_gridfs_file_t *file);
+void     mongoc_gridfs_file_set_cache_size  (mongoc_gridfs_file_t *file,
+                                             uint32_t              n_chunks);
+uint32_t mongoc_gridfs_file_get_cache_size  (mongoc_gridfs_file_t *file);
+void     mongoc_gridfs_file_set_length_hint (mongoc_gridfs_file_t *file,
+                                             uint64_t              length);
 
 
 BSON_END_DECLS
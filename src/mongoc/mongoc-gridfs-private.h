@@ -36,6 +36,7 @@ struct _mongoc_gridfs_t
    mongoc_client_t     *client;
    mongoc_collection_t *files;
    mongoc_collection_t *chunks;
+   int32_t              compressor_id;
 };
 
 
@@ -22,19 +22,25 @@
 #include "mongoc-client-private.h"
 #include "mongoc-collection.h"
 #include "mongoc-collection-private.h"
+#include "mongoc-compression-private.h"
 #include "mongoc-error.h"
 #include "mongoc-index.h"
 #include "mongoc-gridfs.h"
 #include "mongoc-gridfs-private.h"
 #include "mongoc-gridfs-file.h"
 #include "mongoc-gridfs-file-private.h"
+#include "mongoc-stream-file-private.h"
 #include "mongoc-gridfs-file-list.h"
 #include "mongoc-gridfs-file-list-private.h"
 #include "mongoc-client.h"
 #include "mongoc-trace.h"
+#include "mongoc-util-private.h"
 
 #define MONGOC_GRIDFS_STREAM_CHUNK 4096
 
+/* the files removed per delete by mongoc_gridfs_remove_many() */
+#define MONGOC_GRIDFS_REMOVE_BATCH 1000
+
 
 /**
  * _mongoc_gridfs_ensure_index:
@@ -116,6 +122,7 @@ _mongoc_gridfs_new (mongoc_client_t *client,
    gridfs = bson_malloc0 (sizeof *gridfs);
 
    gridfs->client = client;
+   gridfs->compressor_id = MONGOC_COMPRESSOR_NONE_ID;
 
    bson_snprintf (buf, sizeof(buf), "%s.chunks", prefix);
    gridfs->chunks = _mongoc_collection_new (client, db, buf, NULL, NULL);
@@ -174,7 +181,38 @@ mongoc_gridfs_file_list_t *
 mongoc_gridfs_find (mongoc_gridfs_t *gridfs,
                     const bson_t    *query)
 {
-   return _mongoc_gridfs_file_list_new (gridfs, query, 0);
+   return _mongoc_gridfs_file_list_new (gridfs, query, NULL, 0, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_find_with_fields --
+ *
+ *       Like mongoc_gridfs_find(), but only the @fields of each files
+ *       document are returned, @batch_size documents per round trip.
+ *
+ *       With @fields, the files returned by the list are partial: their
+ *       getters work for the fields that were fetched, but they can't be
+ *       read, written or saved.
+ *
+ * Returns:
+ *       A newly allocated mongoc_gridfs_file_list_t.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_gridfs_file_list_t *
+mongoc_gridfs_find_with_fields (mongoc_gridfs_t *gridfs,
+                                const bson_t    *query,
+                                const bson_t    *fields,
+                                uint32_t         batch_size)
+{
+   return _mongoc_gridfs_file_list_new (gridfs, query, fields, 0, batch_size);
 }
 
 
@@ -189,7 +227,7 @@ mongoc_gridfs_find_one (mongoc_gridfs_t *gridfs,
 
    ENTRY;
 
-   list = _mongoc_gridfs_file_list_new (gridfs, query, 1);
+   list = _mongoc_gridfs_file_list_new (gridfs, query, NULL, 1, 0);
 
    file = mongoc_gridfs_file_list_next (list);
    mongoc_gridfs_file_list_error(list, error);
@@ -236,6 +274,9 @@ mongoc_gridfs_create_file_from_stream (mongoc_gridfs_t          *gridfs,
    uint8_t buf[MONGOC_GRIDFS_STREAM_CHUNK];
    mongoc_iovec_t iov;
    int timeout;
+   const uint8_t *data;
+   size_t len;
+   size_t offset;
 
    ENTRY;
 
@@ -248,6 +289,21 @@ mongoc_gridfs_create_file_from_stream (mongoc_gridfs_t          *gridfs,
    file = _mongoc_gridfs_file_new (gridfs, opt);
    timeout = gridfs->client->cluster.sockettimeoutms;
 
+   /* a regular file is mapped and sliced into chunks, rather than read
+    * into buf first */
+   if (_mongoc_stream_file_map (stream, &data, &len)) {
+      mongoc_gridfs_file_set_length_hint (file, len);
+
+      for (offset = 0; offset < len; offset += iov.iov_len) {
+         iov.iov_base = (void *)(data + offset);
+         iov.iov_len = BSON_MIN (len - offset, (size_t)file->chunk_size);
+         mongoc_gridfs_file_writev (file, &iov, 1, timeout);
+      }
+
+      _mongoc_stream_file_unmap (stream);
+      GOTO (done);
+   }
+
    for (;; ) {
       r = mongoc_stream_read (stream, iov.iov_base, MONGOC_GRIDFS_STREAM_CHUNK,
                               0, timeout);
@@ -263,6 +319,7 @@ mongoc_gridfs_create_file_from_stream (mongoc_gridfs_t          *gridfs,
       }
    }
 
+done:
    mongoc_stream_destroy (stream);
 
    mongoc_gridfs_file_seek (file, 0, SEEK_SET);
@@ -287,6 +344,74 @@ mongoc_gridfs_create_file (mongoc_gridfs_t          *gridfs,
    RETURN (file);
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_resume_file --
+ *
+ *       Open the file @files_id to carry on an upload that stopped part
+ *       way, for instance because the connection dropped. The file keeps
+ *       the contents stored for it up to the first missing chunk, and is
+ *       positioned at their end, which mongoc_gridfs_file_tell() returns:
+ *       writing the source from that offset on and saving the file
+ *       completes the upload.
+ *
+ *       If the files document was never saved, as with bulk uploads, a
+ *       new file is created from @opt with @files_id. @opt must then give
+ *       the chunk size the upload used.
+ *
+ * Returns:
+ *       A newly allocated mongoc_gridfs_file_t that should be freed with
+ *       mongoc_gridfs_file_destroy(), or NULL and @error is set.
+ *
+ * Side effects:
+ *       Stored chunks past the first missing one are removed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_gridfs_file_t *
+mongoc_gridfs_resume_file (mongoc_gridfs_t          *gridfs,   /* IN */
+                           const bson_value_t       *files_id, /* IN */
+                           mongoc_gridfs_file_opt_t *opt,      /* IN */
+                           bson_error_t             *error)    /* OUT */
+{
+   mongoc_gridfs_file_t *file;
+   bson_t query = BSON_INITIALIZER;
+   bson_error_t find_error = { 0 };
+
+   ENTRY;
+
+   bson_return_val_if_fail (gridfs, NULL);
+   bson_return_val_if_fail (files_id, NULL);
+
+   BSON_APPEND_VALUE (&query, "_id", files_id);
+   file = mongoc_gridfs_find_one (gridfs, &query, &find_error);
+   bson_destroy (&query);
+
+   if (!file) {
+      if (find_error.domain) {
+         if (error) {
+            memcpy (error, &find_error, sizeof *error);
+         }
+
+         RETURN (NULL);
+      }
+
+      file = _mongoc_gridfs_file_new (gridfs, opt);
+      bson_value_destroy (&file->files_id);
+      bson_value_copy (files_id, &file->files_id);
+   }
+
+   if (!_mongoc_gridfs_file_resume (file, error)) {
+      mongoc_gridfs_file_destroy (file);
+      RETURN (NULL);
+   }
+
+   RETURN (file);
+}
+
+
 /** accessor functions for collections */
 mongoc_collection_t *
 mongoc_gridfs_get_files (mongoc_gridfs_t *gridfs)
@@ -305,70 +430,85 @@ mongoc_gridfs_get_chunks (mongoc_gridfs_t *gridfs)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_set_compressor --
+ *
+ *       Compress the chunks of the files created from now on through
+ *       @gridfs with @compressor, such as "zlib", or stop compressing
+ *       them if @compressor is NULL. The compressor is recorded in the
+ *       files document as "compression", and files are read back with
+ *       the compressor they were written with whatever @gridfs is set
+ *       to.
+ *
+ * Returns:
+ *       true, or false if @compressor is not supported by this build.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 bool
-mongoc_gridfs_remove_by_filename (mongoc_gridfs_t *gridfs,
-                                  const char      *filename,
-                                  bson_error_t    *error)
+mongoc_gridfs_set_compressor (mongoc_gridfs_t *gridfs,     /* IN */
+                              const char      *compressor) /* IN */
 {
-   mongoc_bulk_operation_t *bulk_files = NULL;
-   mongoc_bulk_operation_t *bulk_chunks = NULL;
-   mongoc_cursor_t *cursor = NULL;
-   bson_error_t files_error;
-   bson_error_t chunks_error;
-   const bson_t *doc;
-   const char *key;
-   char keybuf[16];
-   int count = 0;
-   bool chunks_ret;
-   bool files_ret;
-   bool ret = false;
-   bson_iter_t iter;
-   bson_t *files_q = NULL;
-   bson_t *chunks_q = NULL;
-   bson_t q = BSON_INITIALIZER;
-   bson_t fields = BSON_INITIALIZER;
-   bson_t ar = BSON_INITIALIZER;
+   int32_t compressor_id = MONGOC_COMPRESSOR_NONE_ID;
 
    bson_return_val_if_fail (gridfs, false);
 
-   if (!filename) {
-      bson_set_error (error,
-                      MONGOC_ERROR_GRIDFS,
-                      MONGOC_ERROR_GRIDFS_INVALID_FILENAME,
-                      "A non-NULL filename must be specified.");
-      return false;
-   }
+   if (compressor) {
+      compressor_id = _mongoc_compressor_name_to_id (compressor);
 
-   /*
-    * Find all files matching this filename. Hopefully just one, but not
-    * strictly required!
-    */
+      if (compressor_id == MONGOC_COMPRESSOR_NONE_ID) {
+         return false;
+      }
+   }
 
-   BSON_APPEND_UTF8 (&q, "filename", filename);
-   BSON_APPEND_INT32 (&fields, "_id", 1);
+   gridfs->compressor_id = compressor_id;
 
-   cursor = mongoc_collection_find (gridfs->files, MONGOC_QUERY_NONE, 0, 0, 0,
-                                    &q, &fields, NULL);
-   BSON_ASSERT (cursor);
+   return true;
+}
 
-   while (mongoc_cursor_next (cursor, &doc)) {
-      if (bson_iter_init_find (&iter, doc, "_id")) {
-         const bson_value_t *value = bson_iter_value (&iter);
 
-         bson_uint32_to_string (count, &key, keybuf, sizeof keybuf);
-         BSON_APPEND_VALUE (&ar, key, value);
-      }
-   }
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_gridfs_remove_batch --
+ *
+ *       Remove the files documents with the ids in the array @ids, then
+ *       their chunks, with one delete of each through the bulk API.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-   if (mongoc_cursor_error (cursor, error)) {
-      goto failure;
-   }
+static bool
+_mongoc_gridfs_remove_batch (mongoc_gridfs_t *gridfs,
+                             const bson_t    *ids,
+                             bson_error_t    *error)
+{
+   mongoc_bulk_operation_t *bulk_files;
+   mongoc_bulk_operation_t *bulk_chunks;
+   bson_error_t files_error;
+   bson_error_t chunks_error;
+   bool chunks_ret;
+   bool files_ret;
+   bson_t *files_q;
+   bson_t *chunks_q;
 
    bulk_files = mongoc_collection_create_bulk_operation (gridfs->files, false, NULL);
    bulk_chunks = mongoc_collection_create_bulk_operation (gridfs->chunks, false, NULL);
 
-   files_q = BCON_NEW ("_id", "{", "$in", BCON_ARRAY (&ar), "}");
-   chunks_q = BCON_NEW ("files_id", "{", "$in", BCON_ARRAY (&ar), "}");
+   files_q = BCON_NEW ("_id", "{", "$in", BCON_ARRAY (ids), "}");
+   chunks_q = BCON_NEW ("files_id", "{", "$in", BCON_ARRAY (ids), "}");
 
    mongoc_bulk_operation_remove (bulk_files, files_q);
    mongoc_bulk_operation_remove (bulk_chunks, chunks_q);
@@ -384,27 +524,138 @@ mongoc_gridfs_remove_by_filename (mongoc_gridfs_t *gridfs,
       }
    }
 
-   ret = (files_ret && chunks_ret);
+   mongoc_bulk_operation_destroy (bulk_files);
+   mongoc_bulk_operation_destroy (bulk_chunks);
+   bson_destroy (files_q);
+   bson_destroy (chunks_q);
 
-failure:
-   if (cursor) {
-      mongoc_cursor_destroy (cursor);
+   return (files_ret && chunks_ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_gridfs_remove_many --
+ *
+ *       Remove all files matching @selector and their chunks. The ids of
+ *       the files are read from a cursor and the files are removed
+ *       @batch_size at a time, with a delete of files documents and a
+ *       delete of chunks per batch. @pause_msec is slept between batches
+ *       to spread the load of large removals.
+ *
+ * Returns:
+ *       true if successful, including when no files match; otherwise
+ *       false and @error is set. The batches before a failure stay
+ *       removed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_gridfs_remove_many (mongoc_gridfs_t *gridfs,
+                           const bson_t    *selector,
+                           uint32_t         batch_size,
+                           uint32_t         pause_msec,
+                           bson_error_t    *error)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   const char *key;
+   char keybuf[16];
+   uint32_t count = 0;
+   bool ret = false;
+   bson_iter_t iter;
+   bson_t fields = BSON_INITIALIZER;
+   bson_t ar = BSON_INITIALIZER;
+
+   ENTRY;
+
+   bson_return_val_if_fail (gridfs, false);
+   bson_return_val_if_fail (selector, false);
+
+   if (!batch_size) {
+      batch_size = MONGOC_GRIDFS_REMOVE_BATCH;
    }
-   if (bulk_files) {
-      mongoc_bulk_operation_destroy (bulk_files);
+
+   BSON_APPEND_INT32 (&fields, "_id", 1);
+
+   cursor = mongoc_collection_find (gridfs->files, MONGOC_QUERY_NONE, 0, 0,
+                                    batch_size, selector, &fields, NULL);
+   BSON_ASSERT (cursor);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      if (!bson_iter_init_find (&iter, doc, "_id")) {
+         continue;
+      }
+
+      bson_uint32_to_string (count++, &key, keybuf, sizeof keybuf);
+      BSON_APPEND_VALUE (&ar, key, bson_iter_value (&iter));
+
+      if (count == batch_size) {
+         if (!_mongoc_gridfs_remove_batch (gridfs, &ar, error)) {
+            GOTO (failure);
+         }
+
+         bson_reinit (&ar);
+         count = 0;
+
+         if (pause_msec) {
+            _mongoc_usleep ((int64_t)pause_msec * 1000);
+         }
+      }
    }
-   if (bulk_chunks) {
-      mongoc_bulk_operation_destroy (bulk_chunks);
+
+   if (mongoc_cursor_error (cursor, error)) {
+      GOTO (failure);
    }
-   bson_destroy (&q);
+
+   if (count && !_mongoc_gridfs_remove_batch (gridfs, &ar, error)) {
+      GOTO (failure);
+   }
+
+   ret = true;
+
+failure:
+   mongoc_cursor_destroy (cursor);
    bson_destroy (&fields);
    bson_destroy (&ar);
-   if (files_q) {
-      bson_destroy (files_q);
-   }
-   if (chunks_q) {
-      bson_destroy (chunks_q);
+
+   RETURN (ret);
+}
+
+
+bool
+mongoc_gridfs_remove_by_filename (mongoc_gridfs_t *gridfs,
+                                  const char      *filename,
+                                  bson_error_t    *error)
+{
+   bson_t q = BSON_INITIALIZER;
+   bool ret;
+
+   bson_return_val_if_fail (gridfs, false);
+
+   if (!filename) {
+      bson_set_error (error,
+                      MONGOC_ERROR_GRIDFS,
+                      MONGOC_ERROR_GRIDFS_INVALID_FILENAME,
+                      "A non-NULL filename must be specified.");
+      return false;
    }
 
+   /*
+    * Find all files matching this filename. Hopefully just one, but not
+    * strictly required!
+    */
+
+   BSON_APPEND_UTF8 (&q, "filename", filename);
+
+   ret = mongoc_gridfs_remove_many (gridfs, &q, 0, 0, error);
+
+   bson_destroy (&q);
+
    return ret;
 }
@@ -40,8 +40,16 @@ mongoc_gridfs_file_t      *mongoc_gridfs_create_file_from_stream (mongoc_gridfs_
                                                                   mongoc_gridfs_file_opt_t *opt);
 mongoc_gridfs_file_t      *mongoc_gridfs_create_file             (mongoc_gridfs_t          *gridfs,
                                                                   mongoc_gridfs_file_opt_t *opt);
+mongoc_gridfs_file_t      *mongoc_gridfs_resume_file             (mongoc_gridfs_t          *gridfs,
+                                                                  const bson_value_t       *files_id,
+                                                                  mongoc_gridfs_file_opt_t *opt,
+                                                                  bson_error_t             *error);
 mongoc_gridfs_file_list_t *mongoc_gridfs_find                    (mongoc_gridfs_t          *gridfs,
                                                                   const bson_t             *query);
+mongoc_gridfs_file_list_t *mongoc_gridfs_find_with_fields        (mongoc_gridfs_t          *gridfs,
+                                                                  const bson_t             *query,
+                                                                  const bson_t             *fields,
+                                                                  uint32_t                  batch_size);
 mongoc_gridfs_file_t      *mongoc_gridfs_find_one                (mongoc_gridfs_t          *gridfs,
                                                                   const bson_t             *query,
                                                                   bson_error_t             *error);
@@ -56,6 +64,13 @@ mongoc_collection_t       *mongoc_gridfs_get_chunks              (mongoc_gridfs_
 bool                       mongoc_gridfs_remove_by_filename      (mongoc_gridfs_t          *gridfs,
                                                                   const char               *filename,
                                                                   bson_error_t             *error);
+bool                       mongoc_gridfs_remove_many             (mongoc_gridfs_t          *gridfs,
+                                                                  const bson_t             *selector,
+                                                                  uint32_t                  batch_size,
+                                                                  uint32_t                  pause_msec,
+                                                                  bson_error_t             *error);
+bool                       mongoc_gridfs_set_compressor          (mongoc_gridfs_t          *gridfs,
+                                                                  const char               *compressor);
 
 
 BSON_END_DECLS
@@ -17,24 +17,33 @@
 
 #include <bson.h>
 
+#include "mongoc-buffer-private.h"
 #include "mongoc-config.h"
 #include "mongoc-counters-private.h"
+#include "mongoc-dns-cache-private.h"
 #include "mongoc-init.h"
+#include "mongoc-log-private.h"
+#ifdef MONGOC_ENABLE_SASL
+# include "mongoc-sasl-private.h"
+#endif
 #ifdef MONGOC_ENABLE_SSL
 # include "mongoc-scram-private.h"
 # include "mongoc-ssl.h"
 # include "mongoc-ssl-private.h"
 #endif
 #include "mongoc-thread-private.h"
+#include "mongoc-trace-ring-private.h"
 
 static MONGOC_ONCE_FUN( _mongoc_do_init)
 {
+   /* OpenSSL and the SASL library are initialized on first use */
 #ifdef MONGOC_ENABLE_SSL
-   _mongoc_ssl_init();
    _mongoc_scram_startup();
 #endif
 
    _mongoc_counters_init();
+   _mongoc_dns_cache_init();
+   _mongoc_buffer_pool_init();
 
 #ifdef _WIN32
    {
@@ -66,10 +75,21 @@ mongoc_init (void)
 
 static MONGOC_ONCE_FUN( _mongoc_do_cleanup)
 {
+   _mongoc_trace_cleanup();
+   _mongoc_dns_cache_cleanup();
+   _mongoc_buffer_pool_cleanup();
+
+#ifdef MONGOC_ENABLE_SASL
+   _mongoc_sasl_cleanup();
+#endif
+
 #ifdef MONGOC_ENABLE_SSL
+   _mongoc_scram_cleanup();
    _mongoc_ssl_cleanup();
 #endif
 
+   _mongoc_log_cleanup();
+
 #ifdef _WIN32
    WSACleanup ();
 #endif
@@ -22,20 +22,88 @@
 #else
 # include <unistd.h>
 #endif
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sched.h>
+#endif
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 
 #include "mongoc-log.h"
+#include "mongoc-log-private.h"
 #include "mongoc-thread-private.h"
 
 
+/*
+ * How long the thread of the async mode sleeps at most. Producers only
+ * signal it when it is asleep, without a lock, so a wakeup may be missed.
+ */
+#define LOG_ASYNC_WAIT_MSEC 100
+
+#define LOG_ASYNC_DEFAULT_QUEUE_LEN 1024
+
+
+/*
+ * A slot of the async queue. It is free for ticket @t once seq == t, and
+ * holds the message of ticket @t once seq == t + 1.
+ */
+typedef struct
+{
+   volatile int64_t    seq;
+   mongoc_log_level_t  log_level;
+   char                log_domain [32];
+   char               *message;
+} mongoc_log_slot_t;
+
+
+/*
+ * The async mode. Producers take a ticket from @tail with an atomic add,
+ * wait for its slot to be free, which it is unless the queue lapped, and
+ * publish the message through the slot's sequence. The thread is the sole
+ * consumer and owns every field below @head.
+ */
+typedef struct
+{
+   volatile int32_t         enabled;
+   volatile int32_t         inflight;
+   volatile int32_t         sleeping;
+   volatile int32_t         dropped;
+   mongoc_log_slot_t       *slots;
+   uint32_t                 mask;
+   volatile int64_t         tail;
+   volatile int64_t         head;
+   bool                     running;
+   bool                     shutdown;
+   mongoc_mutex_t           mutex;
+   mongoc_cond_t            cond;
+   mongoc_thread_t          thread;
+   mongoc_log_async_opts_t  opts;
+
+   mongoc_log_level_t       last_level;
+   char                     last_domain [32];
+   char                    *last_message;
+   uint32_t                 last_repeats;
+   int64_t                  last_reported;
+   int64_t                  window_started;
+   uint32_t                 window_count;
+   uint32_t                 suppressed;
+} mongoc_log_async_t;
+
+
 static mongoc_mutex_t       gLogMutex;
+static mongoc_mutex_t       gLogAsyncMutex;
 static mongoc_log_func_t  gLogFunc = mongoc_log_default_handler;
 static void              *gLogData;
+static mongoc_log_async_t gLogAsync;
 
 static MONGOC_ONCE_FUN( _mongoc_ensure_mutex_once)
 {
    mongoc_mutex_init(&gLogMutex);
+   mongoc_mutex_init(&gLogAsyncMutex);
+   mongoc_mutex_init(&gLogAsync.mutex);
+   mongoc_cond_init(&gLogAsync.cond);
 
    MONGOC_ONCE_RETURN;
 }
@@ -54,6 +122,388 @@ mongoc_log_set_handler (mongoc_log_func_t  log_func,
 }
 
 
+static void
+_mongoc_log_yield (void)
+{
+#ifdef _WIN32
+   SwitchToThread ();
+#else
+   sched_yield ();
+#endif
+}
+
+
+static void
+_mongoc_log_call (mongoc_log_level_t  log_level,
+                  const char         *log_domain,
+                  const char         *message)
+{
+   mongoc_mutex_lock(&gLogMutex);
+   gLogFunc(log_level, log_domain, message, gLogData);
+   mongoc_mutex_unlock(&gLogMutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_log_async_push --
+ *
+ *       Queue @message for the thread of the async mode, or drop it if
+ *       the queue is full. Takes no lock.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes ownership of @message.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_log_async_push (mongoc_log_level_t  log_level,
+                        const char         *log_domain,
+                        char               *message)
+{
+   mongoc_log_slot_t *slot;
+   int64_t ticket;
+
+   if ((gLogAsync.tail - gLogAsync.head) > (int64_t)gLogAsync.mask) {
+      bson_atomic_int_add (&gLogAsync.dropped, 1);
+      bson_free (message);
+      return;
+   }
+
+   ticket = bson_atomic_int64_add (&gLogAsync.tail, 1) - 1;
+   slot = &gLogAsync.slots [ticket & gLogAsync.mask];
+
+   while (slot->seq != ticket) {
+      _mongoc_log_yield ();
+   }
+
+   slot->log_level = log_level;
+   bson_strncpy (slot->log_domain, log_domain ? log_domain : "",
+                 sizeof slot->log_domain);
+   slot->message = message;
+   bson_memory_barrier ();
+   slot->seq = ticket + 1;
+
+   if (gLogAsync.sleeping) {
+      mongoc_cond_signal (&gLogAsync.cond);
+   }
+}
+
+
+static mongoc_log_slot_t *
+_mongoc_log_async_peek (void)
+{
+   mongoc_log_slot_t *slot;
+
+   slot = &gLogAsync.slots [gLogAsync.head & gLogAsync.mask];
+
+   if (slot->seq != gLogAsync.head + 1) {
+      return NULL;
+   }
+
+   bson_memory_barrier ();
+
+   return slot;
+}
+
+
+static void
+_mongoc_log_async_pop (mongoc_log_slot_t *slot)
+{
+   slot->message = NULL;
+   bson_memory_barrier ();
+   slot->seq = gLogAsync.head + gLogAsync.mask + 1;
+   gLogAsync.head++;
+}
+
+
+/*
+ * Deliver the count of repeats of the last message, once @dedup_msec
+ * passed since it was last reported, or now if @force.
+ */
+static void
+_mongoc_log_async_report_repeats (int64_t now,
+                                  bool    force)
+{
+   char *message;
+
+   if (gLogAsync.last_repeats &&
+       (force ||
+        ((now - gLogAsync.last_reported) >=
+         (int64_t)gLogAsync.opts.dedup_msec * 1000))) {
+      message = bson_strdup_printf ("last message repeated %u times",
+                                    gLogAsync.last_repeats);
+      _mongoc_log_call (gLogAsync.last_level, gLogAsync.last_domain,
+                        message);
+      bson_free (message);
+      gLogAsync.last_repeats = 0;
+      gLogAsync.last_reported = now;
+   }
+}
+
+
+/*
+ * Deliver the count of messages beyond the rate limit, at the end of their
+ * one second window or now if @force, and of those dropped from a full
+ * queue.
+ */
+static void
+_mongoc_log_async_report_counts (int64_t now,
+                                 bool    force)
+{
+   char *message;
+   int32_t dropped;
+
+   if (gLogAsync.suppressed &&
+       (force || ((now - gLogAsync.window_started) >= 1000000))) {
+      message = bson_strdup_printf ("%u log messages suppressed by the "
+                                    "rate limit", gLogAsync.suppressed);
+      _mongoc_log_call (MONGOC_LOG_LEVEL_WARNING, "log", message);
+      bson_free (message);
+      gLogAsync.suppressed = 0;
+   }
+
+   if ((dropped = bson_atomic_int_add (&gLogAsync.dropped, 0))) {
+      bson_atomic_int_add (&gLogAsync.dropped, -dropped);
+      message = bson_strdup_printf ("%d log messages dropped from a full "
+                                    "queue", dropped);
+      _mongoc_log_call (MONGOC_LOG_LEVEL_WARNING, "log", message);
+      bson_free (message);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_log_async_deliver --
+ *
+ *       Call the log handler with @message, unless it repeats the last
+ *       message or exceeds the rate limit, in which case it is counted.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Takes ownership of @message.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_log_async_deliver (mongoc_log_level_t  log_level,
+                           const char         *log_domain,
+                           char               *message)
+{
+   int64_t now;
+
+   now = bson_get_monotonic_time ();
+
+   if (gLogAsync.opts.dedup_msec &&
+       gLogAsync.last_message &&
+       (gLogAsync.last_level == log_level) &&
+       !strcmp (gLogAsync.last_domain, log_domain) &&
+       !strcmp (gLogAsync.last_message, message)) {
+      gLogAsync.last_repeats++;
+      bson_free (message);
+      return;
+   }
+
+   _mongoc_log_async_report_repeats (now, true);
+
+   if (gLogAsync.opts.max_per_sec) {
+      if ((now - gLogAsync.window_started) >= 1000000) {
+         _mongoc_log_async_report_counts (now, false);
+         gLogAsync.window_started = now;
+         gLogAsync.window_count = 0;
+      }
+
+      if (gLogAsync.window_count >= gLogAsync.opts.max_per_sec) {
+         gLogAsync.suppressed++;
+         bson_free (message);
+         return;
+      }
+
+      gLogAsync.window_count++;
+   }
+
+   _mongoc_log_call (log_level, log_domain, message);
+
+   bson_free (gLogAsync.last_message);
+   gLogAsync.last_message = message;
+   gLogAsync.last_level = log_level;
+   bson_strncpy (gLogAsync.last_domain, log_domain,
+                 sizeof gLogAsync.last_domain);
+   gLogAsync.last_reported = now;
+}
+
+
+static void
+_mongoc_log_async_drain (void)
+{
+   mongoc_log_slot_t *slot;
+   mongoc_log_level_t log_level;
+   char log_domain [32];
+   char *message;
+
+   while ((slot = _mongoc_log_async_peek ())) {
+      log_level = slot->log_level;
+      memcpy (log_domain, slot->log_domain, sizeof log_domain);
+      message = slot->message;
+      _mongoc_log_async_pop (slot);
+
+      _mongoc_log_async_deliver (log_level, log_domain, message);
+   }
+}
+
+
+static void *
+_mongoc_log_async_run (void *data)
+{
+   int64_t now;
+
+   for (;;) {
+      _mongoc_log_async_drain ();
+      now = bson_get_monotonic_time ();
+      _mongoc_log_async_report_repeats (now, false);
+      _mongoc_log_async_report_counts (now, false);
+
+      mongoc_mutex_lock (&gLogAsync.mutex);
+
+      if (gLogAsync.shutdown) {
+         mongoc_mutex_unlock (&gLogAsync.mutex);
+         break;
+      }
+
+      gLogAsync.sleeping = 1;
+      bson_memory_barrier ();
+
+      if (!_mongoc_log_async_peek ()) {
+         mongoc_cond_timedwait (&gLogAsync.cond, &gLogAsync.mutex,
+                                LOG_ASYNC_WAIT_MSEC);
+      }
+
+      gLogAsync.sleeping = 0;
+
+      mongoc_mutex_unlock (&gLogAsync.mutex);
+   }
+
+   _mongoc_log_async_drain ();
+   now = bson_get_monotonic_time ();
+   _mongoc_log_async_report_repeats (now, true);
+   _mongoc_log_async_report_counts (now, true);
+
+   return NULL;
+}
+
+
+/*
+ * Stop the async mode, once no thread is still queueing, and deliver what
+ * is left in the queue. Requires gLogAsyncMutex.
+ */
+static void
+_mongoc_log_async_stop (void)
+{
+   if (!gLogAsync.running) {
+      return;
+   }
+
+   gLogAsync.enabled = 0;
+   bson_memory_barrier ();
+
+   while (bson_atomic_int_add (&gLogAsync.inflight, 0)) {
+      _mongoc_log_yield ();
+   }
+
+   mongoc_mutex_lock (&gLogAsync.mutex);
+   gLogAsync.shutdown = true;
+   mongoc_cond_signal (&gLogAsync.cond);
+   mongoc_mutex_unlock (&gLogAsync.mutex);
+
+   mongoc_thread_join (gLogAsync.thread);
+
+   bson_free (gLogAsync.slots);
+   bson_free (gLogAsync.last_message);
+   gLogAsync.slots = NULL;
+   gLogAsync.last_message = NULL;
+   gLogAsync.running = false;
+}
+
+
+void
+mongoc_log_set_async (const mongoc_log_async_opts_t *opts)
+{
+   static mongoc_once_t once = MONGOC_ONCE_INIT;
+   uint32_t len = 2;
+   uint32_t n;
+   uint32_t i;
+
+   mongoc_once(&once, &_mongoc_ensure_mutex_once);
+
+   mongoc_mutex_lock (&gLogAsyncMutex);
+
+   _mongoc_log_async_stop ();
+
+   if (opts) {
+      n = opts->queue_len ? opts->queue_len : LOG_ASYNC_DEFAULT_QUEUE_LEN;
+      while ((len < n) && (len < (1U << 30))) {
+         len <<= 1;
+      }
+
+      memcpy (&gLogAsync.opts, opts, sizeof gLogAsync.opts);
+      gLogAsync.slots = bson_malloc0 (len * sizeof *gLogAsync.slots);
+      for (i = 0; i < len; i++) {
+         gLogAsync.slots [i].seq = i;
+      }
+      gLogAsync.mask = len - 1;
+      gLogAsync.tail = 0;
+      gLogAsync.head = 0;
+      gLogAsync.last_repeats = 0;
+      gLogAsync.window_started = 0;
+      gLogAsync.window_count = 0;
+      gLogAsync.suppressed = 0;
+      gLogAsync.shutdown = false;
+      gLogAsync.running = true;
+
+      mongoc_thread_create (&gLogAsync.thread, _mongoc_log_async_run, NULL);
+
+      bson_memory_barrier ();
+      gLogAsync.enabled = 1;
+   }
+
+   mongoc_mutex_unlock (&gLogAsyncMutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_log_cleanup --
+ *
+ *       Called from mongoc_cleanup(). Deliver the queued messages and stop
+ *       the async mode.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_log_cleanup (void)
+{
+   mongoc_log_set_async (NULL);
+}
+
+
 void
 mongoc_log (mongoc_log_level_t  log_level,
             const char         *log_domain,
@@ -72,9 +522,20 @@ mongoc_log (mongoc_log_level_t  log_level,
    message = bson_strdupv_printf(format, args);
    va_end(args);
 
-   mongoc_mutex_lock(&gLogMutex);
-   gLogFunc(log_level, log_domain, message, gLogData);
-   mongoc_mutex_unlock(&gLogMutex);
+   if (gLogAsync.enabled) {
+      bson_atomic_int_add (&gLogAsync.inflight, 1);
+      if (gLogAsync.enabled) {
+         _mongoc_log_async_push (log_level, log_domain, message);
+         message = NULL;
+      }
+      bson_atomic_int_add (&gLogAsync.inflight, -1);
+
+      if (!message) {
+         return;
+      }
+   }
+
+   _mongoc_log_call(log_level, log_domain, message);
 
    bson_free(message);
 }
@@ -69,6 +69,28 @@ typedef void (*mongoc_log_func_t) (mongoc_log_level_t  log_level,
                                    void               *user_data);
 
 
+/**
+ * mongoc_log_async_opts_t:
+ * @queue_len: The number of messages the queue holds, rounded up to a
+ *   power of two, or 0 for 1024. Messages logged while it is full are
+ *   dropped and counted.
+ * @max_per_sec: The number of messages delivered per second at most, or 0
+ *   for no limit. Messages beyond it are counted, not delivered.
+ * @dedup_msec: If not 0, a message identical to the one before it is
+ *   counted instead of delivered, and the count is delivered at most
+ *   every @dedup_msec milliseconds as "last message repeated N times".
+ *
+ * Options of mongoc_log_set_async().
+ */
+typedef struct
+{
+   uint32_t  queue_len;
+   uint32_t  max_per_sec;
+   uint32_t  dedup_msec;
+   void     *padding [8];
+} mongoc_log_async_opts_t;
+
+
 /**
  * mongoc_log_set_handler:
  * @log_func: A function to handle log messages.
@@ -80,6 +102,19 @@ void mongoc_log_set_handler (mongoc_log_func_t  log_func,
                              void              *user_data);
 
 
+/**
+ * mongoc_log_set_async:
+ * @opts: A mongoc_log_async_opts_t, or NULL.
+ *
+ * Have mongoc_log() queue messages instead of calling the log handler,
+ * and deliver them from a background thread, so that threads logging at
+ * a high rate do not wait on each other or on the handler. Passing NULL
+ * delivers the queued messages, stops the thread and returns to calling
+ * the handler from mongoc_log().
+ */
+void mongoc_log_set_async (const mongoc_log_async_opts_t *opts);
+
+
 /**
  * mongoc_log:
  * @log_level: The log level.
@@ -117,6 +152,22 @@ const char *
 mongoc_log_level_str (mongoc_log_level_t log_level);
 
 
+/**
+ * mongoc_log_trace_dump:
+ * @path: The file to write.
+ * @error: A location for a bson_error_t, or NULL.
+ *
+ * Writes the trace records kept by a library built with --enable-tracing
+ * to @path, for the mongoc-trace tool to decode. Threads may keep tracing
+ * meanwhile.
+ *
+ * Returns: true if successful; otherwise false and @error is set.
+ */
+bool
+mongoc_log_trace_dump (const char   *path,
+                       bson_error_t *error);
+
+
 BSON_END_DECLS
 
 
@@ -23,6 +23,17 @@
 
 #include <bson.h>
 
+#include "mongoc-config.h"
+
+
+/*
+ * $regex uses PCRE when the driver is built with it, or the POSIX regular
+ * expressions of the C library elsewhere but on Windows.
+ */
+#if defined(MONGOC_ENABLE_PCRE) || !defined(_WIN32)
+# define MONGOC_MATCHER_HAVE_REGEX 1
+#endif
+
 
 BSON_BEGIN_DECLS
 
@@ -34,6 +45,9 @@ typedef struct _mongoc_matcher_op_compare_t mongoc_matcher_op_compare_t;
 typedef struct _mongoc_matcher_op_exists_t  mongoc_matcher_op_exists_t;
 typedef struct _mongoc_matcher_op_type_t    mongoc_matcher_op_type_t;
 typedef struct _mongoc_matcher_op_not_t     mongoc_matcher_op_not_t;
+typedef struct _mongoc_matcher_op_regex_t   mongoc_matcher_op_regex_t;
+typedef struct _mongoc_matcher_op_elem_match_t mongoc_matcher_op_elem_match_t;
+typedef struct _mongoc_matcher_in_set_t     mongoc_matcher_in_set_t;
 
 
 typedef enum
@@ -52,6 +66,8 @@ typedef enum
    MONGOC_MATCHER_OPCODE_NOR,
    MONGOC_MATCHER_OPCODE_EXISTS,
    MONGOC_MATCHER_OPCODE_TYPE,
+   MONGOC_MATCHER_OPCODE_REGEX,
+   MONGOC_MATCHER_OPCODE_ELEM_MATCH,
 } mongoc_matcher_opcode_t;
 
 
@@ -74,6 +90,8 @@ struct _mongoc_matcher_op_compare_t
    mongoc_matcher_op_base_t base;
    char *path;
    bson_iter_t iter;
+   /* the values of a large $in or $nin array, hashed */
+   mongoc_matcher_in_set_t *set;
 };
 
 
@@ -101,6 +119,36 @@ struct _mongoc_matcher_op_not_t
 };
 
 
+struct _mongoc_matcher_op_regex_t
+{
+   mongoc_matcher_op_base_t base;
+   char *path;
+   char *pattern;
+   char *options;
+   /* a literal that every matching string starts with, or contains */
+   char *literal;
+   uint32_t literal_len;
+   bool anchored;
+   /* the literal is the whole pattern, the regex need not be run */
+   bool exact;
+   /* pcre * or regex_t *, compiled once when the op is created */
+   void *compiled;
+   /* pcre_extra *, holding the JIT code if PCRE has it */
+   void *extra;
+};
+
+
+struct _mongoc_matcher_op_elem_match_t
+{
+   mongoc_matcher_op_base_t base;
+   char *path;
+   /* matched against each element of the array at path */
+   mongoc_matcher_op_t *query;
+   /* query is {$gt: 1, ...} for the element itself, not for its fields */
+   bool operators;
+};
+
+
 union _mongoc_matcher_op_t
 {
    mongoc_matcher_op_base_t base;
@@ -109,6 +157,8 @@ union _mongoc_matcher_op_t
    mongoc_matcher_op_exists_t exists;
    mongoc_matcher_op_type_t type;
    mongoc_matcher_op_not_t not;
+   mongoc_matcher_op_regex_t regex;
+   mongoc_matcher_op_elem_match_t elem_match;
 };
 
 
@@ -124,8 +174,22 @@ mongoc_matcher_op_t *_mongoc_matcher_op_type_new    (const char              *pa
                                                      bson_type_t              type);
 mongoc_matcher_op_t *_mongoc_matcher_op_not_new     (const char              *path,
                                                      mongoc_matcher_op_t     *child);
+mongoc_matcher_op_t *_mongoc_matcher_op_regex_new   (const char              *path,
+                                                     const char              *pattern,
+                                                     const char              *options,
+                                                     bson_error_t            *error);
+mongoc_matcher_op_t *_mongoc_matcher_op_elem_match_new (const char           *path,
+                                                        mongoc_matcher_op_t  *query,
+                                                        bool                  operators);
+const char          *_mongoc_matcher_op_path        (const mongoc_matcher_op_t *op);
 bool                 _mongoc_matcher_op_match       (mongoc_matcher_op_t     *op,
                                                      const bson_t            *bson);
+bool                 _mongoc_matcher_op_compare_iter (mongoc_matcher_op_compare_t *compare,
+                                                      bson_iter_t                 *iter);
+bool                 _mongoc_matcher_op_regex_iter   (mongoc_matcher_op_regex_t   *regex,
+                                                      bson_iter_t                 *iter);
+bool                 _mongoc_matcher_op_iter         (mongoc_matcher_op_t         *op,
+                                                      bson_iter_t                 *iter);
 void                 _mongoc_matcher_op_destroy     (mongoc_matcher_op_t     *op);
 void                 _mongoc_matcher_op_to_bson     (mongoc_matcher_op_t     *op,
                                                      bson_t                  *bson);
@@ -15,9 +15,39 @@
  */
 
 
+#include <string.h>
+
+#include "mongoc-error.h"
 #include "mongoc-log.h"
 #include "mongoc-matcher-op-private.h"
 
+#if defined(MONGOC_ENABLE_PCRE)
+# include <pcre.h>
+#elif defined(MONGOC_MATCHER_HAVE_REGEX)
+# include <regex.h>
+#endif
+
+
+/*
+ * $in and $nin arrays with at least this many values are hashed when the
+ * op is created, instead of being compared one by one for each document.
+ */
+#define MONGOC_MATCHER_IN_SET_MIN 16
+
+
+struct _mongoc_matcher_in_set_t
+{
+   uint32_t     mask;
+   /* index + 1 into values, 0 for an empty slot */
+   uint32_t    *table;
+   bson_iter_t *values;
+   uint32_t     n_values;
+};
+
+
+static bool _mongoc_matcher_iter_eq_match (bson_iter_t *compare_iter,
+                                           bson_iter_t *iter);
+
 
 /*
  *--------------------------------------------------------------------------
@@ -88,6 +118,232 @@ _mongoc_matcher_op_type_new (const char  *path, /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_regex_literal --
+ *
+ *       Find the run of literal characters at the start of @regex's
+ *       pattern. Every string the pattern matches contains that run, or
+ *       starts with it if the pattern is anchored, so it can be checked
+ *       with memcmp() before the regex is run at all.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @regex literal, literal_len, anchored and exact are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_regex_literal (mongoc_matcher_op_regex_t *regex) /* IN */
+{
+   const char *pattern = regex->pattern;
+   size_t len = 0;
+   char end;
+
+   /*
+    * Every option but "s" changes how literal characters or ^ match, and
+    * with an alternation the literal is only one of the choices.
+    */
+   if (regex->options [strspn (regex->options, "s")] == '\0' &&
+       !strchr (pattern, '|')) {
+      if (*pattern == '^') {
+         regex->anchored = true;
+         pattern++;
+      }
+
+      len = strcspn (pattern, "\\^$.|?*+()[]{}");
+      end = pattern [len];
+
+      if (end == '\0') {
+         regex->exact = true;
+      } else if (len && (end == '?' || end == '*' || end == '{')) {
+         /* the quantifier applies to the last literal character only */
+         len--;
+      }
+   }
+
+   regex->literal = bson_strndup (pattern, len);
+   regex->literal_len = (uint32_t)len;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_regex_compile --
+ *
+ *       Compile the pattern of @regex with its options, once, so that
+ *       matching a document only has to run it.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @regex compiled and extra are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_regex_compile (mongoc_matcher_op_regex_t *regex, /* IN */
+                               bson_error_t              *error) /* OUT */
+{
+#if defined(MONGOC_ENABLE_PCRE)
+   const char *errstr = NULL;
+   const char *opt;
+   int flags = PCRE_UTF8;
+   int erroffset = 0;
+
+   for (opt = regex->options; *opt; opt++) {
+      switch (*opt) {
+      case 'i':
+         flags |= PCRE_CASELESS;
+         break;
+      case 'm':
+         flags |= PCRE_MULTILINE;
+         break;
+      case 's':
+         flags |= PCRE_DOTALL;
+         break;
+      case 'x':
+         flags |= PCRE_EXTENDED;
+         break;
+      default:
+         bson_set_error (error,
+                         MONGOC_ERROR_MATCHER,
+                         MONGOC_ERROR_MATCHER_INVALID,
+                         "Invalid $options \"%s\"",
+                         regex->options);
+         return false;
+      }
+   }
+
+   regex->compiled = pcre_compile (regex->pattern, flags, &errstr,
+                                   &erroffset, NULL);
+
+   if (!regex->compiled) {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "Invalid $regex \"%s\" at offset %d: %s",
+                      regex->pattern, erroffset, errstr);
+      return false;
+   }
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+   regex->extra = pcre_study (regex->compiled, PCRE_STUDY_JIT_COMPILE,
+                              &errstr);
+#else
+   regex->extra = pcre_study (regex->compiled, 0, &errstr);
+#endif
+
+   return true;
+#elif defined(MONGOC_MATCHER_HAVE_REGEX)
+   const char *opt;
+   char errstr [128];
+   int flags = REG_EXTENDED | REG_NOSUB;
+   int ret;
+
+   /*
+    * POSIX has no counterpart for "x", and "." already matches a newline
+    * unless "m" is given.
+    */
+   for (opt = regex->options; *opt; opt++) {
+      switch (*opt) {
+      case 'i':
+         flags |= REG_ICASE;
+         break;
+      case 'm':
+         flags |= REG_NEWLINE;
+         break;
+      case 's':
+         break;
+      default:
+         bson_set_error (error,
+                         MONGOC_ERROR_MATCHER,
+                         MONGOC_ERROR_MATCHER_INVALID,
+                         "Invalid $options \"%s\"",
+                         regex->options);
+         return false;
+      }
+   }
+
+   regex->compiled = bson_malloc0 (sizeof (regex_t));
+
+   if ((ret = regcomp (regex->compiled, regex->pattern, flags))) {
+      regerror (ret, regex->compiled, errstr, sizeof errstr);
+      bson_free (regex->compiled);
+      regex->compiled = NULL;
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "Invalid $regex \"%s\": %s",
+                      regex->pattern, errstr);
+      return false;
+   }
+
+   return true;
+#else
+   bson_set_error (error,
+                   MONGOC_ERROR_MATCHER,
+                   MONGOC_ERROR_MATCHER_INVALID,
+                   "$regex is not supported by this build of the driver.");
+   return false;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_regex_new --
+ *
+ *       Create a new op for checking {$regex: pattern, $options: string}.
+ *       The pattern is compiled here, and reused for every document.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t that should be freed with
+ *       _mongoc_matcher_op_destroy(), or NULL if the pattern or options
+ *       are invalid or this build has no regex support.
+ *
+ * Side effects:
+ *       @error is set upon failure.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_matcher_op_t *
+_mongoc_matcher_op_regex_new (const char   *path,    /* IN */
+                              const char   *pattern, /* IN */
+                              const char   *options, /* IN */
+                              bson_error_t *error)   /* OUT */
+{
+   mongoc_matcher_op_t *op;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (pattern);
+
+   op = bson_malloc0 (sizeof *op);
+   op->regex.base.opcode = MONGOC_MATCHER_OPCODE_REGEX;
+   op->regex.path = bson_strdup (path);
+   op->regex.pattern = bson_strdup (pattern);
+   op->regex.options = bson_strdup (options ? options : "");
+
+   if (!_mongoc_matcher_regex_compile (&op->regex, error)) {
+      _mongoc_matcher_op_destroy (op);
+      return NULL;
+   }
+
+   _mongoc_matcher_regex_literal (&op->regex);
+
+   return op;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -129,6 +385,222 @@ _mongoc_matcher_op_logical_new (mongoc_matcher_opcode_t  opcode, /* IN */
 }
 
 
+static BSON_INLINE uint32_t
+_mongoc_matcher_hash (uint32_t       hash,
+                      const uint8_t *data,
+                      size_t         len)
+{
+   size_t i;
+
+   /* FNV-1a */
+   for (i = 0; i < len; i++) {
+      hash ^= data [i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_in_set_hash --
+ *
+ *       Hash the value observed by @iter so that values which
+ *       _mongoc_matcher_iter_eq_match() may find equal hash the same:
+ *       numbers and booleans by their value as a double, null and
+ *       undefined alike, strings and documents by their bytes.
+ *
+ * Returns:
+ *       true and @hash is set, or false if the value cannot equal
+ *       anything in a set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_in_set_hash (const bson_iter_t *iter, /* IN */
+                             uint32_t          *hash) /* OUT */
+{
+   const uint8_t *data;
+   uint32_t len;
+   double d;
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOUBLE:
+      d = bson_iter_double (iter);
+      break;
+   case BSON_TYPE_INT32:
+      d = bson_iter_int32 (iter);
+      break;
+   case BSON_TYPE_INT64:
+      d = (double)bson_iter_int64 (iter);
+      break;
+   case BSON_TYPE_BOOL:
+      d = bson_iter_bool (iter);
+      break;
+   case BSON_TYPE_UTF8:
+      data = (const uint8_t *)bson_iter_utf8 (iter, &len);
+      *hash = _mongoc_matcher_hash (2166136261u ^ BSON_TYPE_UTF8, data, len);
+      return true;
+   case BSON_TYPE_DOCUMENT:
+      bson_iter_document (iter, &len, &data);
+      *hash = _mongoc_matcher_hash (2166136261u ^ BSON_TYPE_DOCUMENT,
+                                    data, len);
+      return true;
+   case BSON_TYPE_NULL:
+   case BSON_TYPE_UNDEFINED:
+      *hash = 2166136261u ^ BSON_TYPE_NULL;
+      return true;
+   default:
+      return false;
+   }
+
+   if (d != d) {
+      /* NaN is not equal to anything */
+      return false;
+   }
+
+   if (d == 0) {
+      /* -0.0 == 0.0 */
+      d = 0;
+   }
+
+   *hash = _mongoc_matcher_hash (2166136261u ^ BSON_TYPE_DOUBLE,
+                                 (const uint8_t *)&d, sizeof d);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_in_set_new --
+ *
+ *       Hash the values of the $in or $nin array observed by @iter.
+ *
+ *       Values that never compare equal, such as booleans on the query
+ *       side, are left out. Arrays are compared element by element, so a
+ *       query array holding one is not hashed.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_in_set_t, or NULL if the array
+ *       is small or cannot be hashed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_matcher_in_set_t *
+_mongoc_matcher_in_set_new (const bson_iter_t *iter) /* IN */
+{
+   mongoc_matcher_in_set_t *set;
+   bson_iter_t child;
+   uint32_t n_values = 0;
+   uint32_t size;
+   uint32_t hash;
+   uint32_t slot;
+   uint32_t i;
+
+   if (!BSON_ITER_HOLDS_ARRAY (iter) || !bson_iter_recurse (iter, &child)) {
+      return NULL;
+   }
+
+   while (bson_iter_next (&child)) {
+      if (BSON_ITER_HOLDS_ARRAY (&child)) {
+         return NULL;
+      }
+      n_values++;
+   }
+
+   if (n_values < MONGOC_MATCHER_IN_SET_MIN) {
+      return NULL;
+   }
+
+   /* keep the table at most half full */
+   for (size = 32; size < n_values * 2; size <<= 1) { }
+
+   set = bson_malloc0 (sizeof *set);
+   set->mask = size - 1;
+   set->table = bson_malloc0 (size * sizeof *set->table);
+   set->values = bson_malloc (n_values * sizeof *set->values);
+
+   bson_iter_recurse (iter, &child);
+
+   while (bson_iter_next (&child)) {
+      switch (bson_iter_type (&child)) {
+      case BSON_TYPE_DOUBLE:
+      case BSON_TYPE_INT32:
+      case BSON_TYPE_INT64:
+      case BSON_TYPE_UTF8:
+      case BSON_TYPE_DOCUMENT:
+      case BSON_TYPE_NULL:
+         break;
+      default:
+         continue;
+      }
+
+      if (!_mongoc_matcher_in_set_hash (&child, &hash)) {
+         continue;
+      }
+
+      i = set->n_values++;
+      memcpy (&set->values [i], &child, sizeof child);
+
+      for (slot = hash & set->mask;
+           set->table [slot];
+           slot = (slot + 1) & set->mask) { }
+
+      set->table [slot] = i + 1;
+   }
+
+   return set;
+}
+
+
+static bool
+_mongoc_matcher_in_set_contains (const mongoc_matcher_in_set_t *set,  /* IN */
+                                 bson_iter_t                   *iter) /* IN */
+{
+   uint32_t hash;
+   uint32_t slot;
+
+   if (!_mongoc_matcher_in_set_hash (iter, &hash)) {
+      return false;
+   }
+
+   /* values may share a hash without being equal, so check every one */
+   for (slot = hash & set->mask;
+        set->table [slot];
+        slot = (slot + 1) & set->mask) {
+      if (_mongoc_matcher_iter_eq_match (&set->values [set->table [slot] - 1],
+                                         iter)) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+static void
+_mongoc_matcher_in_set_destroy (mongoc_matcher_in_set_t *set) /* IN */
+{
+   if (set) {
+      bson_free (set->table);
+      bson_free (set->values);
+      bson_free (set);
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -172,6 +644,11 @@ _mongoc_matcher_op_compare_new (mongoc_matcher_opcode_t  opcode, /* IN */
    op->compare.path = bson_strdup (path);
    memcpy (&op->compare.iter, iter, sizeof *iter);
 
+   if (opcode == MONGOC_MATCHER_OPCODE_IN ||
+       opcode == MONGOC_MATCHER_OPCODE_NIN) {
+      op->compare.set = _mongoc_matcher_in_set_new (iter);
+   }
+
    return op;
 }
 
@@ -211,6 +688,90 @@ _mongoc_matcher_op_not_new (const char          *path,  /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_elem_match_new --
+ *
+ *       Create a new op for checking {$elemMatch: query}. If @operators
+ *       is true, @query is a list of operators such as {$gt: 1, $lt: 5}
+ *       and is checked against each element itself, otherwise it is a
+ *       query that each element is a document for.
+ *
+ *       @query is owned by the new op.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t that should be freed with
+ *       _mongoc_matcher_op_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_matcher_op_t *
+_mongoc_matcher_op_elem_match_new (const char          *path,      /* IN */
+                                   mongoc_matcher_op_t *query,     /* IN */
+                                   bool                 operators) /* IN */
+{
+   mongoc_matcher_op_t *op;
+
+   BSON_ASSERT (path);
+   BSON_ASSERT (query);
+
+   op = bson_malloc0 (sizeof *op);
+   op->elem_match.base.opcode = MONGOC_MATCHER_OPCODE_ELEM_MATCH;
+   op->elem_match.path = bson_strdup (path);
+   op->elem_match.query = query;
+   op->elem_match.operators = operators;
+
+   return op;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_path --
+ *
+ *       Get the dotted path of the field that @op tests.
+ *
+ * Returns:
+ *       The path, or NULL for $and, $or and $nor.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const char *
+_mongoc_matcher_op_path (const mongoc_matcher_op_t *op) /* IN */
+{
+   BSON_ASSERT (op);
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      return NULL;
+   case MONGOC_MATCHER_OPCODE_NOT:
+      return op->not.path;
+   case MONGOC_MATCHER_OPCODE_EXISTS:
+      return op->exists.path;
+   case MONGOC_MATCHER_OPCODE_TYPE:
+      return op->type.path;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      return op->regex.path;
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      return op->elem_match.path;
+   default:
+      return op->compare.path;
+   }
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -240,6 +801,7 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
    case MONGOC_MATCHER_OPCODE_LTE:
    case MONGOC_MATCHER_OPCODE_NE:
    case MONGOC_MATCHER_OPCODE_NIN:
+      _mongoc_matcher_in_set_destroy (op->compare.set);
       bson_free (op->compare.path);
       break;
    case MONGOC_MATCHER_OPCODE_OR:
@@ -257,8 +819,31 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
    case MONGOC_MATCHER_OPCODE_EXISTS:
       bson_free (op->exists.path);
       break;
-   case MONGOC_MATCHER_OPCODE_TYPE:
-      bson_free (op->type.path);
+   case MONGOC_MATCHER_OPCODE_TYPE:
+      bson_free (op->type.path);
+      break;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+#if defined(MONGOC_ENABLE_PCRE)
+      if (op->regex.extra) {
+         pcre_free_study (op->regex.extra);
+      }
+      if (op->regex.compiled) {
+         pcre_free (op->regex.compiled);
+      }
+#elif defined(MONGOC_MATCHER_HAVE_REGEX)
+      if (op->regex.compiled) {
+         regfree (op->regex.compiled);
+         bson_free (op->regex.compiled);
+      }
+#endif
+      bson_free (op->regex.path);
+      bson_free (op->regex.pattern);
+      bson_free (op->regex.options);
+      bson_free (op->regex.literal);
+      break;
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      _mongoc_matcher_op_destroy (op->elem_match.query);
+      bson_free (op->elem_match.path);
       break;
    default:
       break;
@@ -271,17 +856,12 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_exists_match --
+ * _mongoc_matcher_regex_contains --
  *
- *       Checks to see if @bson matches @exists requirements. The
- *       {$exists: bool} query can be either true or fase so we must
- *       handle false as "not exists".
+ *       Checks if @needle occurs in the first @len bytes of @str.
  *
  * Returns:
- *       true if the field exists and the spec expected it.
- *       true if the field does not exist and the spec expected it to not
- *       exist.
- *       Otherwise, false.
+ *       true if it does; otherwise false.
  *
  * Side effects:
  *       None.
@@ -290,33 +870,49 @@ _mongoc_matcher_op_destroy (mongoc_matcher_op_t *op) /* IN */
  */
 
 static bool
-_mongoc_matcher_op_exists_match (mongoc_matcher_op_exists_t *exists, /* IN */
-                                 const bson_t               *bson)   /* IN */
+_mongoc_matcher_regex_contains (const char *str,        /* IN */
+                                uint32_t    len,        /* IN */
+                                const char *needle,     /* IN */
+                                uint32_t    needle_len) /* IN */
 {
-   bson_iter_t iter;
-   bson_iter_t desc;
-   bool found;
+   const char *end;
+   const char *p;
 
-   BSON_ASSERT (exists);
-   BSON_ASSERT (bson);
+   if (!needle_len) {
+      return true;
+   }
+
+   if (len < needle_len) {
+      return false;
+   }
 
-   found = (bson_iter_init (&iter, bson) &&
-            bson_iter_find_descendant (&iter, exists->path, &desc));
+   end = str + (len - needle_len) + 1;
+
+   for (p = str; p < end; p++) {
+      if (!(p = memchr (p, needle [0], (size_t)(end - p)))) {
+         return false;
+      }
+      if (!memcmp (p, needle, needle_len)) {
+         return true;
+      }
+   }
 
-   return (found == exists->exists);
+   return false;
 }
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_type_match --
+ * _mongoc_matcher_op_regex_iter --
  *
- *       Checks if @bson matches the {$type: ...} op.
+ *       Checks if the string observed by @iter matches the pattern of
+ *       @regex. The literal part of the pattern is checked first, which
+ *       for most patterns rejects a string without running the regex.
  *
  * Returns:
- *       true if the requested field was found and the type matched
- *       the requested type.
+ *       true if @iter observes a string matching the pattern; otherwise
+ *       false.
  *
  * Side effects:
  *       None.
@@ -324,22 +920,44 @@ _mongoc_matcher_op_exists_match (mongoc_matcher_op_exists_t *exists, /* IN */
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_matcher_op_type_match (mongoc_matcher_op_type_t *type, /* IN */
-                               const bson_t             *bson) /* IN */
+bool
+_mongoc_matcher_op_regex_iter (mongoc_matcher_op_regex_t *regex, /* IN */
+                               bson_iter_t               *iter)  /* IN */
 {
-   bson_iter_t iter;
-   bson_iter_t desc;
+   const char *str;
+   uint32_t len;
 
-   BSON_ASSERT (type);
-   BSON_ASSERT (bson);
+   BSON_ASSERT (regex);
+   BSON_ASSERT (iter);
+
+   if (!BSON_ITER_HOLDS_UTF8 (iter)) {
+      return false;
+   }
+
+   str = bson_iter_utf8 (iter, &len);
+
+   if (regex->anchored) {
+      if (len < regex->literal_len ||
+          memcmp (str, regex->literal, regex->literal_len)) {
+         return false;
+      }
+   } else if (!_mongoc_matcher_regex_contains (str, len, regex->literal,
+                                               regex->literal_len)) {
+      return false;
+   }
 
-   if (bson_iter_init (&iter, bson) &&
-       bson_iter_find_descendant (&iter, type->path, &desc)) {
-      return (bson_iter_type (&iter) == type->type);
+   if (regex->exact) {
+      return true;
    }
 
+#if defined(MONGOC_ENABLE_PCRE)
+   return (pcre_exec (regex->compiled, regex->extra, str, (int)len,
+                      0, 0, NULL, 0) >= 0);
+#elif defined(MONGOC_MATCHER_HAVE_REGEX)
+   return !regexec (regex->compiled, str, 0, NULL, 0);
+#else
    return false;
+#endif
 }
 
 
@@ -718,8 +1336,13 @@ _mongoc_matcher_op_in_match (mongoc_matcher_op_compare_t *compare, /* IN */
 {
    mongoc_matcher_op_compare_t op;
 
+   if (compare->set) {
+      return _mongoc_matcher_in_set_contains (compare->set, iter);
+   }
+
    op.base.opcode = MONGOC_MATCHER_OPCODE_EQ;
    op.path = compare->path;
+   op.set = NULL;
 
    if (!BSON_ITER_HOLDS_ARRAY (&compare->iter) ||
        !bson_iter_recurse (&compare->iter, &op.iter)) {
@@ -934,10 +1557,10 @@ _mongoc_matcher_op_nin_match (mongoc_matcher_op_compare_t *compare, /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_op_compare_match --
+ * _mongoc_matcher_op_compare_iter --
  *
  *       Dispatch function for mongoc_matcher_op_compare_t operations
- *       to perform a match.
+ *       to compare the field observed by @iter.
  *
  * Returns:
  *       Opcode dependent.
@@ -948,51 +1571,378 @@ _mongoc_matcher_op_nin_match (mongoc_matcher_op_compare_t *compare, /* IN */
  *--------------------------------------------------------------------------
  */
 
-static bool
-_mongoc_matcher_op_compare_match (mongoc_matcher_op_compare_t *compare, /* IN */
-                                  const bson_t                *bson)    /* IN */
+bool
+_mongoc_matcher_op_compare_iter (mongoc_matcher_op_compare_t *compare, /* IN */
+                                 bson_iter_t                 *iter)    /* IN */
 {
-   bson_iter_t tmp;
-   bson_iter_t iter;
-
    BSON_ASSERT (compare);
-   BSON_ASSERT (bson);
-
-   if (strchr (compare->path, '.')) {
-      if (!bson_iter_init (&tmp, bson) ||
-          !bson_iter_find_descendant (&tmp, compare->path, &iter)) {
-         return false;
-      }
-   } else if (!bson_iter_init_find (&iter, bson, compare->path)) {
-      return false;
-   }
+   BSON_ASSERT (iter);
 
    switch ((int)compare->base.opcode) {
    case MONGOC_MATCHER_OPCODE_EQ:
-      return _mongoc_matcher_op_eq_match (compare, &iter);
+      return _mongoc_matcher_op_eq_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_GT:
-      return _mongoc_matcher_op_gt_match (compare, &iter);
+      return _mongoc_matcher_op_gt_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_GTE:
-      return _mongoc_matcher_op_gte_match (compare, &iter);
+      return _mongoc_matcher_op_gte_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_IN:
-      return _mongoc_matcher_op_in_match (compare, &iter);
+      return _mongoc_matcher_op_in_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_LT:
-      return _mongoc_matcher_op_lt_match (compare, &iter);
+      return _mongoc_matcher_op_lt_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_LTE:
-      return _mongoc_matcher_op_lte_match (compare, &iter);
+      return _mongoc_matcher_op_lte_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_NE:
-      return _mongoc_matcher_op_ne_match (compare, &iter);
+      return _mongoc_matcher_op_ne_match (compare, iter);
    case MONGOC_MATCHER_OPCODE_NIN:
-      return _mongoc_matcher_op_nin_match (compare, &iter);
+      return _mongoc_matcher_op_nin_match (compare, iter);
+   default:
+      BSON_ASSERT (false);
+      break;
+   }
+
+   return false;
+}
+
+
+/*
+ * The state of a walk over the values that the path of a leaf op reaches
+ * in a document.
+ */
+typedef struct
+{
+   mongoc_matcher_op_t *op;
+   bool                 negated;
+   bool                 reached;
+   bool                 result;
+} mongoc_matcher_walk_t;
+
+
+static BSON_INLINE bool
+_mongoc_matcher_op_negated (const mongoc_matcher_op_t *op) /* IN */
+{
+   return (op->base.opcode == MONGOC_MATCHER_OPCODE_NE ||
+           op->base.opcode == MONGOC_MATCHER_OPCODE_NIN);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_value_match --
+ *
+ *       Check the operators of an {$elemMatch: {$gt: 1, ...}} against
+ *       the single value observed by @iter, ignoring their paths.
+ *
+ * Returns:
+ *       true if the value matches; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_op_value_match (mongoc_matcher_op_t *op,   /* IN */
+                                bson_iter_t         *iter) /* IN */
+{
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+      return (_mongoc_matcher_op_value_match (op->logical.left, iter) ||
+              _mongoc_matcher_op_value_match (op->logical.right, iter));
+   case MONGOC_MATCHER_OPCODE_AND:
+      return (_mongoc_matcher_op_value_match (op->logical.left, iter) &&
+              _mongoc_matcher_op_value_match (op->logical.right, iter));
+   case MONGOC_MATCHER_OPCODE_NOR:
+      return !(_mongoc_matcher_op_value_match (op->logical.left, iter) ||
+               _mongoc_matcher_op_value_match (op->logical.right, iter));
+   case MONGOC_MATCHER_OPCODE_NOT:
+      return !_mongoc_matcher_op_value_match (op->not.child, iter);
    default:
+      return _mongoc_matcher_op_iter (op, iter);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_elem_match_iter --
+ *
+ *       Checks if the field observed by @iter is an array with at least
+ *       one element matching the query of @elem_match. The elements are
+ *       iterated in place, a document element is only wrapped in a
+ *       static bson_t and never copied.
+ *
+ * Returns:
+ *       true if an element matches; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_op_elem_match_iter (mongoc_matcher_op_elem_match_t *elem_match, /* IN */
+                                    bson_iter_t                    *iter)       /* IN */
+{
+   const uint8_t *data;
+   bson_iter_t child;
+   uint32_t len;
+   bson_t doc;
+
+   if (!BSON_ITER_HOLDS_ARRAY (iter) || !bson_iter_recurse (iter, &child)) {
+      return false;
+   }
+
+   while (bson_iter_next (&child)) {
+      if (elem_match->operators) {
+         if (_mongoc_matcher_op_value_match (elem_match->query, &child)) {
+            return true;
+         }
+      } else if (BSON_ITER_HOLDS_DOCUMENT (&child)) {
+         bson_iter_document (&child, &len, &data);
+
+         if (bson_init_static (&doc, data, len) &&
+             _mongoc_matcher_op_match (elem_match->query, &doc)) {
+            return true;
+         }
+      }
+   }
+
+   return false;
+}
+
+
+static BSON_INLINE bool
+_mongoc_matcher_op_test (mongoc_matcher_op_t *op,   /* IN */
+                         bson_iter_t         *iter) /* IN */
+{
+   if (op->base.opcode == MONGOC_MATCHER_OPCODE_REGEX) {
+      return _mongoc_matcher_op_regex_iter (&op->regex, iter);
+   }
+
+   return _mongoc_matcher_op_compare_iter (&op->compare, iter);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_iter --
+ *
+ *       Checks the leaf @op against the field observed by @iter, which
+ *       was found at the path of @op.
+ *
+ *       If the field is an array, a comparison or $regex matches if the
+ *       array itself or any of its elements does. $ne and $nin match
+ *       only if the array and every element differ.
+ *
+ * Returns:
+ *       true if the field matches; otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_matcher_op_iter (mongoc_matcher_op_t *op,   /* IN */
+                         bson_iter_t         *iter) /* IN */
+{
+   bson_iter_t child;
+   bool negated;
+
+   BSON_ASSERT (op);
+   BSON_ASSERT (iter);
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_EXISTS:
+      return op->exists.exists;
+   case MONGOC_MATCHER_OPCODE_TYPE:
+      return (bson_iter_type (iter) == op->type.type);
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      return _mongoc_matcher_op_elem_match_iter (&op->elem_match, iter);
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+   case MONGOC_MATCHER_OPCODE_NOT:
       BSON_ASSERT (false);
+      return false;
+   default:
       break;
    }
 
+   negated = _mongoc_matcher_op_negated (op);
+
+   if (_mongoc_matcher_op_test (op, iter) != negated) {
+      return !negated;
+   }
+
+   if (BSON_ITER_HOLDS_ARRAY (iter) && bson_iter_recurse (iter, &child)) {
+      while (bson_iter_next (&child)) {
+         if (_mongoc_matcher_op_test (op, &child) != negated) {
+            return !negated;
+         }
+      }
+   }
+
+   return negated;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_visit --
+ *
+ *       Check a value that the path of @walk's op reached.
+ *
+ * Returns:
+ *       true if the value decides the match and the walk can stop.
+ *
+ * Side effects:
+ *       @walk is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_op_visit (mongoc_matcher_walk_t *walk, /* IN */
+                          bson_iter_t           *iter) /* IN */
+{
+   walk->reached = true;
+
+   if (walk->op->base.opcode == MONGOC_MATCHER_OPCODE_EXISTS) {
+      return true;
+   }
+
+   walk->result = _mongoc_matcher_op_iter (walk->op, iter);
+
+   /* one passing value decides a match, one failing $ne a mismatch */
+   return (walk->result != walk->negated);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_walk --
+ *
+ *       Visit every value that @path reaches from the document observed
+ *       by @iter. Where the path goes through an array, the rest of it
+ *       is looked up as an index into the array, "a.0.b", and in each
+ *       document element of the array, "a.b". Arrays are iterated in
+ *       place, nothing is allocated.
+ *
+ *       As with bson_iter_find_descendant(), only the first element of
+ *       a document with a key is followed.
+ *
+ * Returns:
+ *       true if the walk was stopped by _mongoc_matcher_op_visit().
+ *
+ * Side effects:
+ *       @walk is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_op_walk (mongoc_matcher_walk_t *walk, /* IN */
+                         bson_iter_t           *iter, /* IN */
+                         const char            *path) /* IN */
+{
+   bson_iter_t child;
+   bson_iter_t elem;
+   const char *key;
+   const char *dot;
+   size_t len;
+
+   dot = strchr (path, '.');
+   len = dot ? (size_t)(dot - path) : strlen (path);
+
+   while (bson_iter_next (iter)) {
+      key = bson_iter_key (iter);
+
+      if (strncmp (key, path, len) || key [len] != '\0') {
+         continue;
+      }
+
+      if (!dot) {
+         return _mongoc_matcher_op_visit (walk, iter);
+      }
+
+      if (BSON_ITER_HOLDS_DOCUMENT (iter) &&
+          bson_iter_recurse (iter, &child)) {
+         return _mongoc_matcher_op_walk (walk, &child, dot + 1);
+      }
+
+      if (BSON_ITER_HOLDS_ARRAY (iter) &&
+          bson_iter_recurse (iter, &child)) {
+         if (_mongoc_matcher_op_walk (walk, &child, dot + 1)) {
+            return true;
+         }
+
+         bson_iter_recurse (iter, &child);
+
+         while (bson_iter_next (&child)) {
+            if (BSON_ITER_HOLDS_DOCUMENT (&child) &&
+                bson_iter_recurse (&child, &elem) &&
+                _mongoc_matcher_op_walk (walk, &elem, dot + 1)) {
+               return true;
+            }
+         }
+      }
+
+      return false;
+   }
+
    return false;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_op_path_match --
+ *
+ *       Checks the leaf @op against the fields of @bson at its path.
+ *
+ * Returns:
+ *       true if any field reached matches, or for $ne and $nin if every
+ *       field reached does. For $exists, whether any field is reached.
+ *       Otherwise false, also if no field is reached.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_op_path_match (mongoc_matcher_op_t *op,   /* IN */
+                               const bson_t        *bson) /* IN */
+{
+   mongoc_matcher_walk_t walk = { 0 };
+   bson_iter_t iter;
+
+   walk.op = op;
+   walk.negated = _mongoc_matcher_op_negated (op);
+
+   if (bson_iter_init (&iter, bson)) {
+      _mongoc_matcher_op_walk (&walk, &iter, _mongoc_matcher_op_path (op));
+   }
+
+   if (op->base.opcode == MONGOC_MATCHER_OPCODE_EXISTS) {
+      return (walk.reached == op->exists.exists);
+   }
+
+   return walk.result;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -1068,17 +2018,17 @@ _mongoc_matcher_op_match (mongoc_matcher_op_t *op,   /* IN */
    case MONGOC_MATCHER_OPCODE_LTE:
    case MONGOC_MATCHER_OPCODE_NE:
    case MONGOC_MATCHER_OPCODE_NIN:
-      return _mongoc_matcher_op_compare_match (&op->compare, bson);
+   case MONGOC_MATCHER_OPCODE_EXISTS:
+   case MONGOC_MATCHER_OPCODE_TYPE:
+   case MONGOC_MATCHER_OPCODE_REGEX:
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      return _mongoc_matcher_op_path_match (op, bson);
    case MONGOC_MATCHER_OPCODE_OR:
    case MONGOC_MATCHER_OPCODE_AND:
    case MONGOC_MATCHER_OPCODE_NOR:
       return _mongoc_matcher_op_logical_match (&op->logical, bson);
    case MONGOC_MATCHER_OPCODE_NOT:
       return _mongoc_matcher_op_not_match (&op->not, bson);
-   case MONGOC_MATCHER_OPCODE_EXISTS:
-      return _mongoc_matcher_op_exists_match (&op->exists, bson);
-   case MONGOC_MATCHER_OPCODE_TYPE:
-      return _mongoc_matcher_op_type_match (&op->type, bson);
    default:
       break;
    }
@@ -1195,6 +2145,17 @@ _mongoc_matcher_op_to_bson (mongoc_matcher_op_t *op,   /* IN */
    case MONGOC_MATCHER_OPCODE_TYPE:
       BSON_APPEND_INT32 (bson, "$type", (int)op->type.type);
       break;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      bson_append_regex (bson, op->regex.path, -1, op->regex.pattern,
+                         op->regex.options);
+      break;
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      bson_append_document_begin (bson, op->elem_match.path, -1, &child);
+      bson_append_document_begin (&child, "$elemMatch", -1, &child2);
+      _mongoc_matcher_op_to_bson (op->elem_match.query, &child2);
+      bson_append_document_end (&child, &child2);
+      bson_append_document_end (bson, &child);
+      break;
    default:
       BSON_ASSERT (false);
       break;
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_MATCHER_PROGRAM_PRIVATE_H
+#define MONGOC_MATCHER_PROGRAM_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-matcher-op-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/* jump targets that end the program */
+#define MONGOC_MATCHER_PROGRAM_TRUE  UINT32_MAX
+#define MONGOC_MATCHER_PROGRAM_FALSE (UINT32_MAX - 1)
+
+
+/* marks the end of a list of nodes */
+#define MONGOC_MATCHER_NODE_NONE UINT32_MAX
+
+
+/*
+ * One component of the dotted paths of a query. The paths are merged
+ * into a tree, so "a.b" and "a.c" share the node for "a", and every
+ * field a query refers to is found in a single pass over the document.
+ * The key points into the path of an op and is not NUL terminated.
+ */
+typedef struct
+{
+   const char *key;
+   uint32_t    len;
+   uint32_t    first_child;
+   uint32_t    next_sibling;
+   uint32_t    n_children;
+} mongoc_matcher_node_t;
+
+
+/*
+ * A test of one field. Logical operators are not instructions of their
+ * own, they are compiled into the jump targets of the tests below them.
+ */
+typedef struct
+{
+   mongoc_matcher_opcode_t  opcode;
+   uint32_t                 on_true;
+   uint32_t                 on_false;
+   uint32_t                 node;
+   uint32_t                 stat;
+   mongoc_matcher_op_t     *op;
+} mongoc_matcher_insn_t;
+
+
+/*
+ * What is known of the test of one leaf of the optree, indexed by the
+ * position of the leaf in the query so that it survives reordering.
+ */
+typedef struct
+{
+   uint32_t n_evals;
+   uint32_t n_true;
+   uint32_t cost;
+} mongoc_matcher_stat_t;
+
+
+typedef struct
+{
+   mongoc_array_t       insns;
+   mongoc_array_t       nodes;
+   uint32_t             first_child;
+   uint32_t             n_children;
+   mongoc_matcher_op_t *optree;
+   mongoc_array_t       stats;
+   bool                 adaptive;
+   uint32_t             n_matches;
+} mongoc_matcher_program_t;
+
+
+void _mongoc_matcher_program_init    (mongoc_matcher_program_t       *program,
+                                      mongoc_matcher_op_t            *optree);
+bool _mongoc_matcher_program_match   (const mongoc_matcher_program_t *program,
+                                      const bson_t                   *bson);
+bool _mongoc_matcher_program_match_project
+                                     (const mongoc_matcher_program_t *program,
+                                      const bson_t                   *bson,
+                                      const bson_t                   *projection,
+                                      bson_t                         *out);
+void _mongoc_matcher_program_destroy (mongoc_matcher_program_t       *program);
+void _mongoc_matcher_program_set_adaptive
+                                     (mongoc_matcher_program_t       *program,
+                                      bool                            adaptive);
+void _mongoc_matcher_program_adapt   (mongoc_matcher_program_t       *program);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_MATCHER_PROGRAM_PRIVATE_H */
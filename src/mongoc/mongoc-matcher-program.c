@@ -0,0 +1,1047 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-matcher-program-private.h"
+
+
+/*
+ * The optree of a matcher is compiled into a flat array of field tests,
+ * in the order the tree would have evaluated them. Each test names the
+ * test to run next if it passed and if it failed, or one of the
+ * MONGOC_MATCHER_PROGRAM_TRUE and _FALSE targets that end the match. That
+ * is how $and, $or, $nor and $not short-circuit without any instruction
+ * of their own, so matching a document is a single loop over the array.
+ *
+ * The fields the tests refer to are merged into a tree of path components
+ * and all of them are found in one pass over the document before the
+ * first test runs, rather than each test searching the document again.
+ */
+
+
+/* nodes whose fields are kept on the stack while matching */
+#define MONGOC_MATCHER_PROGRAM_STACK_NODES 16
+
+/* matches between recompiles of an adaptive program */
+#define MONGOC_MATCHER_PROGRAM_ADAPT_INTERVAL 1024
+
+/* what the fill of a document found for a node */
+#define MONGOC_MATCHER_SLOT_FOUND 1
+#define MONGOC_MATCHER_SLOT_ARRAY 2
+
+
+/* a child of a $and, $or or $nor, with the estimates it is ordered by */
+typedef struct
+{
+   mongoc_matcher_op_t *op;
+   uint32_t             stat;
+   double               p;
+   double               cost;
+   double               key;
+} mongoc_matcher_clause_t;
+
+
+static uint32_t
+_mongoc_matcher_program_count (mongoc_matcher_op_t *op) /* IN */
+{
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      return (_mongoc_matcher_program_count (op->logical.left) +
+              _mongoc_matcher_program_count (op->logical.right));
+   case MONGOC_MATCHER_OPCODE_NOT:
+      return _mongoc_matcher_program_count (op->not.child);
+   default:
+      return 1;
+   }
+}
+
+
+static uint32_t
+_mongoc_matcher_program_add_node (mongoc_matcher_program_t *program, /* IN */
+                                  uint32_t                  parent,  /* IN */
+                                  const char               *key,     /* IN */
+                                  uint32_t                  len)     /* IN */
+{
+   mongoc_matcher_node_t *nodes;
+   mongoc_matcher_node_t node;
+   uint32_t idx;
+
+   nodes = (mongoc_matcher_node_t *)program->nodes.data;
+   idx = (parent == MONGOC_MATCHER_NODE_NONE) ? program->first_child
+                                              : nodes [parent].first_child;
+
+   for (; idx != MONGOC_MATCHER_NODE_NONE; idx = nodes [idx].next_sibling) {
+      if (nodes [idx].len == len && !memcmp (nodes [idx].key, key, len)) {
+         return idx;
+      }
+   }
+
+   idx = (uint32_t)program->nodes.len;
+
+   node.key = key;
+   node.len = len;
+   node.first_child = MONGOC_MATCHER_NODE_NONE;
+   node.n_children = 0;
+
+   if (parent == MONGOC_MATCHER_NODE_NONE) {
+      node.next_sibling = program->first_child;
+      program->first_child = idx;
+      program->n_children++;
+      _mongoc_array_append_val (&program->nodes, node);
+   } else {
+      node.next_sibling = nodes [parent].first_child;
+      _mongoc_array_append_val (&program->nodes, node);
+      nodes = (mongoc_matcher_node_t *)program->nodes.data;
+      nodes [parent].first_child = idx;
+      nodes [parent].n_children++;
+   }
+
+   return idx;
+}
+
+
+static void
+_mongoc_matcher_program_append_test (mongoc_matcher_program_t *program,  /* IN */
+                                     mongoc_matcher_op_t      *op,       /* IN */
+                                     uint32_t                  stat,     /* IN */
+                                     uint32_t                  on_true,  /* IN */
+                                     uint32_t                  on_false) /* IN */
+{
+   mongoc_matcher_insn_t insn;
+   const char *path;
+   const char *dot;
+   uint32_t node = MONGOC_MATCHER_NODE_NONE;
+   uint32_t len;
+
+   path = _mongoc_matcher_op_path (op);
+
+   BSON_ASSERT (path);
+
+   /* split "a.b.c" like bson_iter_find_descendant() would */
+   for (;;) {
+      dot = strchr (path, '.');
+      len = (uint32_t)(dot ? (size_t)(dot - path) : strlen (path));
+      node = _mongoc_matcher_program_add_node (program, node, path, len);
+
+      if (!dot) {
+         break;
+      }
+
+      path = dot + 1;
+   }
+
+   insn.opcode = op->base.opcode;
+   insn.on_true = on_true;
+   insn.on_false = on_false;
+   insn.node = node;
+   insn.stat = stat;
+   insn.op = op;
+
+   _mongoc_array_append_val (&program->insns, insn);
+}
+
+
+/*
+ * The cost of a test relative to the others, not counting the lookup of
+ * its field which is shared by all of them.
+ */
+static uint32_t
+_mongoc_matcher_program_cost (mongoc_matcher_op_t *op) /* IN */
+{
+   bson_iter_t child;
+   uint32_t cost = 1;
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_EXISTS:
+   case MONGOC_MATCHER_OPCODE_TYPE:
+      return 1;
+   case MONGOC_MATCHER_OPCODE_IN:
+   case MONGOC_MATCHER_OPCODE_NIN:
+      if (op->compare.set) {
+         return 4;
+      }
+      if (bson_iter_recurse (&op->compare.iter, &child)) {
+         while (bson_iter_next (&child)) {
+            cost += 2;
+         }
+      }
+      return cost;
+   case MONGOC_MATCHER_OPCODE_REGEX:
+      return op->regex.exact ? 3 : 8;
+   case MONGOC_MATCHER_OPCODE_ELEM_MATCH:
+      return 8;
+   default:
+      break;
+   }
+
+   switch (bson_iter_type (&op->compare.iter)) {
+   case BSON_TYPE_UTF8:
+      return 3;
+   case BSON_TYPE_DOCUMENT:
+   case BSON_TYPE_ARRAY:
+      return 4;
+   default:
+      return 2;
+   }
+}
+
+
+/* record the cost of each leaf, in query order */
+static void
+_mongoc_matcher_program_init_stats (mongoc_matcher_program_t *program, /* IN */
+                                    mongoc_matcher_op_t      *op)      /* IN */
+{
+   mongoc_matcher_stat_t stat = { 0 };
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      _mongoc_matcher_program_init_stats (program, op->logical.left);
+      _mongoc_matcher_program_init_stats (program, op->logical.right);
+      break;
+   case MONGOC_MATCHER_OPCODE_NOT:
+      _mongoc_matcher_program_init_stats (program, op->not.child);
+      break;
+   default:
+      stat.cost = _mongoc_matcher_program_cost (op);
+      _mongoc_array_append_val (&program->stats, stat);
+      break;
+   }
+}
+
+
+static void
+_mongoc_matcher_program_estimate (mongoc_matcher_program_t *program, /* IN */
+                                  mongoc_matcher_op_t      *op,      /* IN */
+                                  uint32_t                  stat,    /* IN */
+                                  double                   *p,       /* OUT */
+                                  double                   *cost);   /* OUT */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_clauses --
+ *
+ *       Gather the children of the logical @op into @clauses, taking the
+ *       children of nested $and into one $and and of nested $or into one
+ *       $or. @stat is the index of the first leaf of @op.
+ *
+ *       When the program is adaptive the clauses are sorted to reach an
+ *       answer as cheaply as possible: those of a $and most likely to be
+ *       false for their cost first, those of a $or or $nor most likely to
+ *       be true for their cost first. Otherwise they stay in query order.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @p and @cost are set to the estimates for @op with that order.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_program_clauses (mongoc_matcher_program_t *program, /* IN */
+                                 mongoc_matcher_op_t      *op,      /* IN */
+                                 uint32_t                  stat,    /* IN */
+                                 mongoc_array_t           *clauses, /* OUT */
+                                 double                   *p,       /* OUT */
+                                 double                   *cost)    /* OUT */
+{
+   mongoc_matcher_clause_t clause;
+   mongoc_matcher_clause_t *c;
+   mongoc_matcher_op_t *stack [2];
+   double reach = 1.0;
+   size_t i;
+   size_t j;
+
+   /* walk the chain of same-opcode ops, left to right */
+   stack [0] = op->logical.left;
+   stack [1] = op->logical.right;
+
+   for (i = 0; i < 2; i++) {
+      clause.op = stack [i];
+
+      if (op->base.opcode != MONGOC_MATCHER_OPCODE_NOR &&
+          clause.op->base.opcode == op->base.opcode) {
+         _mongoc_matcher_program_clauses (program, clause.op, stat, clauses,
+                                          p, cost);
+         stat += _mongoc_matcher_program_count (clause.op);
+         continue;
+      }
+
+      clause.stat = stat;
+      _mongoc_matcher_program_estimate (program, clause.op, stat,
+                                        &clause.p, &clause.cost);
+
+      if (op->base.opcode == MONGOC_MATCHER_OPCODE_AND) {
+         clause.key = clause.cost / BSON_MAX (1.0 - clause.p, 1e-9);
+      } else {
+         clause.key = clause.cost / BSON_MAX (clause.p, 1e-9);
+      }
+
+      _mongoc_array_append_val (clauses, clause);
+      stat += _mongoc_matcher_program_count (clause.op);
+   }
+
+   c = (mongoc_matcher_clause_t *)clauses->data;
+
+   if (program->adaptive) {
+      /* insertion sort, few clauses and we want it stable */
+      for (i = 1; i < clauses->len; i++) {
+         clause = c [i];
+         for (j = i; j > 0 && c [j - 1].key > clause.key; j--) {
+            c [j] = c [j - 1];
+         }
+         c [j] = clause;
+      }
+   }
+
+   /* reach is the chance that evaluation gets as far as clause i */
+   *cost = 0;
+
+   for (i = 0; i < clauses->len; i++) {
+      *cost += reach * c [i].cost;
+      reach *= (op->base.opcode == MONGOC_MATCHER_OPCODE_AND) ? c [i].p
+                                                              : 1.0 - c [i].p;
+   }
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_AND:
+      *p = reach;
+      break;
+   case MONGOC_MATCHER_OPCODE_OR:
+      *p = 1.0 - reach;
+      break;
+   default:
+      *p = reach;
+      break;
+   }
+}
+
+
+static void
+_mongoc_matcher_program_estimate (mongoc_matcher_program_t *program, /* IN */
+                                  mongoc_matcher_op_t      *op,      /* IN */
+                                  uint32_t                  stat,    /* IN */
+                                  double                   *p,       /* OUT */
+                                  double                   *cost)    /* OUT */
+{
+   const mongoc_matcher_stat_t *s;
+   mongoc_array_t clauses;
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      _mongoc_array_init (&clauses, sizeof (mongoc_matcher_clause_t));
+      _mongoc_matcher_program_clauses (program, op, stat, &clauses, p, cost);
+      _mongoc_array_destroy (&clauses);
+      break;
+   case MONGOC_MATCHER_OPCODE_NOT:
+      _mongoc_matcher_program_estimate (program, op->not.child, stat,
+                                        p, cost);
+      *p = 1.0 - *p;
+      break;
+   default:
+      s = &_mongoc_array_index (&program->stats, mongoc_matcher_stat_t, stat);
+      *p = (s->n_true + 1.0) / (s->n_evals + 2.0);
+      *cost = s->cost;
+      break;
+   }
+}
+
+
+static void
+_mongoc_matcher_program_compile (mongoc_matcher_program_t *program,  /* IN */
+                                 mongoc_matcher_op_t      *op,       /* IN */
+                                 uint32_t                  stat,     /* IN */
+                                 uint32_t                  on_true,  /* IN */
+                                 uint32_t                  on_false) /* IN */
+{
+   const mongoc_matcher_clause_t *c;
+   mongoc_array_t clauses;
+   uint32_t next;
+   uint32_t tmp;
+   double p;
+   double cost;
+   size_t i;
+
+   BSON_ASSERT (op);
+
+   switch (op->base.opcode) {
+   case MONGOC_MATCHER_OPCODE_OR:
+   case MONGOC_MATCHER_OPCODE_AND:
+   case MONGOC_MATCHER_OPCODE_NOR:
+      _mongoc_array_init (&clauses, sizeof (mongoc_matcher_clause_t));
+      _mongoc_matcher_program_clauses (program, op, stat, &clauses,
+                                       &p, &cost);
+      c = (const mongoc_matcher_clause_t *)clauses.data;
+
+      if (op->base.opcode == MONGOC_MATCHER_OPCODE_NOR) {
+         /* $nor is a $or with its answers swapped */
+         tmp = on_true;
+         on_true = on_false;
+         on_false = tmp;
+      }
+
+      for (i = 0; i < clauses.len; i++) {
+         next = (uint32_t)program->insns.len +
+                _mongoc_matcher_program_count (c [i].op);
+
+         if (op->base.opcode == MONGOC_MATCHER_OPCODE_AND) {
+            _mongoc_matcher_program_compile (
+               program, c [i].op, c [i].stat,
+               (i + 1 < clauses.len) ? next : on_true, on_false);
+         } else {
+            _mongoc_matcher_program_compile (
+               program, c [i].op, c [i].stat,
+               on_true, (i + 1 < clauses.len) ? next : on_false);
+         }
+      }
+
+      _mongoc_array_destroy (&clauses);
+      break;
+   case MONGOC_MATCHER_OPCODE_NOT:
+      _mongoc_matcher_program_compile (program, op->not.child, stat,
+                                       on_false, on_true);
+      break;
+   default:
+      _mongoc_matcher_program_append_test (program, op, stat,
+                                           on_true, on_false);
+      break;
+   }
+}
+
+
+static void
+_mongoc_matcher_program_recompile (mongoc_matcher_program_t *program) /* IN */
+{
+   _mongoc_array_clear (&program->insns);
+   _mongoc_matcher_program_compile (program, program->optree, 0,
+                                    MONGOC_MATCHER_PROGRAM_TRUE,
+                                    MONGOC_MATCHER_PROGRAM_FALSE);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_init --
+ *
+ *       Compile @optree into @program. The program refers to the ops and
+ *       paths of @optree, which must outlive it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @program is initialized.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_matcher_program_init (mongoc_matcher_program_t *program, /* OUT */
+                              mongoc_matcher_op_t      *optree)  /* IN */
+{
+   BSON_ASSERT (program);
+   BSON_ASSERT (optree);
+
+   _mongoc_array_init (&program->insns, sizeof (mongoc_matcher_insn_t));
+   _mongoc_array_init (&program->nodes, sizeof (mongoc_matcher_node_t));
+   _mongoc_array_init (&program->stats, sizeof (mongoc_matcher_stat_t));
+   program->first_child = MONGOC_MATCHER_NODE_NONE;
+   program->n_children = 0;
+   program->optree = optree;
+   program->adaptive = false;
+   program->n_matches = 0;
+
+   _mongoc_matcher_program_init_stats (program, optree);
+   _mongoc_matcher_program_recompile (program);
+}
+
+
+/* mark the nodes from @first_child down as being below an array */
+static void
+_mongoc_matcher_program_mark (const mongoc_matcher_node_t *nodes,       /* IN */
+                              uint32_t                     first_child, /* IN */
+                              uint8_t                     *found)       /* OUT */
+{
+   uint32_t idx;
+
+   for (idx = first_child;
+        idx != MONGOC_MATCHER_NODE_NONE;
+        idx = nodes [idx].next_sibling) {
+      found [idx] |= MONGOC_MATCHER_SLOT_ARRAY;
+      _mongoc_matcher_program_mark (nodes, nodes [idx].first_child, found);
+   }
+}
+
+
+static bool
+_mongoc_matcher_program_fill_one (const mongoc_matcher_node_t *nodes,       /* IN */
+                                  uint32_t                     first_child, /* IN */
+                                  const bson_iter_t           *iter,        /* IN */
+                                  bson_iter_t                 *slots,       /* OUT */
+                                  uint8_t                     *found);      /* OUT */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_fill --
+ *
+ *       Scan the elements of @iter for the @n_children nodes starting at
+ *       @first_child, descending into documents and arrays for their own
+ *       children. The first element with the key of a node is the one
+ *       bson_iter_find_descendant() would find, so that is the one kept,
+ *       and the scan ends once every node of this level is seen.
+ *
+ *       The nodes below an array are marked, the values their paths reach
+ *       may be in any element and are left to _mongoc_matcher_op_match().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @slots and @found are set for the nodes found.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_matcher_program_fill (const mongoc_matcher_node_t *nodes,       /* IN */
+                              uint32_t                     first_child, /* IN */
+                              uint32_t                     n_children,  /* IN */
+                              bson_iter_t                 *iter,        /* IN */
+                              bson_iter_t                 *slots,       /* OUT */
+                              uint8_t                     *found)       /* OUT */
+{
+   while (n_children && bson_iter_next (iter)) {
+      if (_mongoc_matcher_program_fill_one (nodes, first_child, iter,
+                                            slots, found)) {
+         n_children--;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_fill_one --
+ *
+ *       Look for the node of the element at @iter among the siblings
+ *       starting at @first_child, and if it is one not seen yet, keep
+ *       @iter in its slot and fill its children from the element's own.
+ *
+ * Returns:
+ *       true if a node was found for the element.
+ *
+ * Side effects:
+ *       @slots and @found are set for the nodes found.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_matcher_program_fill_one (const mongoc_matcher_node_t *nodes,       /* IN */
+                                  uint32_t                     first_child, /* IN */
+                                  const bson_iter_t           *iter,        /* IN */
+                                  bson_iter_t                 *slots,       /* OUT */
+                                  uint8_t                     *found)       /* OUT */
+{
+   const mongoc_matcher_node_t *node;
+   bson_iter_t child;
+   const char *key;
+   uint32_t idx;
+
+   key = bson_iter_key (iter);
+
+   for (idx = first_child;
+        idx != MONGOC_MATCHER_NODE_NONE;
+        idx = nodes [idx].next_sibling) {
+      node = &nodes [idx];
+
+      if (found [idx] ||
+          strncmp (key, node->key, node->len) ||
+          key [node->len] != '\0') {
+         continue;
+      }
+
+      found [idx] = MONGOC_MATCHER_SLOT_FOUND;
+      memcpy (&slots [idx], iter, sizeof *iter);
+
+      if (node->n_children &&
+          (BSON_ITER_HOLDS_DOCUMENT (iter) ||
+           BSON_ITER_HOLDS_ARRAY (iter)) &&
+          bson_iter_recurse (iter, &child)) {
+         _mongoc_matcher_program_fill (nodes, node->first_child,
+                                       node->n_children, &child,
+                                       slots, found);
+
+         if (BSON_ITER_HOLDS_ARRAY (iter)) {
+            _mongoc_matcher_program_mark (nodes, node->first_child, found);
+         }
+      }
+
+      return true;
+   }
+
+   return false;
+}
+
+
+/* run the tests of @program on the fields found by a fill */
+static bool
+_mongoc_matcher_program_run (const mongoc_matcher_program_t *program, /* IN */
+                             const bson_t                   *bson,    /* IN */
+                             const bson_iter_t              *slots,   /* IN */
+                             const uint8_t                  *found)   /* IN */
+{
+   const mongoc_matcher_insn_t *insns;
+   const mongoc_matcher_insn_t *insn;
+   mongoc_matcher_stat_t *stat;
+   bson_iter_t iter;
+   uint32_t pc = 0;
+   bool r;
+
+   insns = (const mongoc_matcher_insn_t *)program->insns.data;
+
+   while (pc < MONGOC_MATCHER_PROGRAM_FALSE) {
+      insn = &insns [pc];
+
+      if (found [insn->node] & MONGOC_MATCHER_SLOT_ARRAY) {
+         /* the path goes through an array, search each of its elements */
+         r = _mongoc_matcher_op_match (insn->op, bson);
+      } else if (found [insn->node]) {
+         memcpy (&iter, &slots [insn->node], sizeof iter);
+         r = _mongoc_matcher_op_iter (insn->op, &iter);
+      } else {
+         r = (insn->opcode == MONGOC_MATCHER_OPCODE_EXISTS &&
+              !insn->op->exists.exists);
+      }
+
+      if (program->adaptive) {
+         stat = &((mongoc_matcher_stat_t *)program->stats.data) [insn->stat];
+         stat->n_evals++;
+         stat->n_true += r;
+      }
+
+      pc = r ? insn->on_true : insn->on_false;
+   }
+
+   return (pc == MONGOC_MATCHER_PROGRAM_TRUE);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_match --
+ *
+ *       Run @program against @bson.
+ *
+ * Returns:
+ *       true if @bson matched, otherwise false.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_matcher_program_match (const mongoc_matcher_program_t *program, /* IN */
+                               const bson_t                   *bson)    /* IN */
+{
+   bson_iter_t stack_slots [MONGOC_MATCHER_PROGRAM_STACK_NODES];
+   uint8_t stack_found [MONGOC_MATCHER_PROGRAM_STACK_NODES];
+   bson_iter_t *slots = stack_slots;
+   uint8_t *found = stack_found;
+   bson_iter_t iter;
+   size_t n_nodes;
+   bool r;
+
+   BSON_ASSERT (program);
+   BSON_ASSERT (bson);
+
+   n_nodes = program->nodes.len;
+
+   if (n_nodes > MONGOC_MATCHER_PROGRAM_STACK_NODES) {
+      slots = bson_malloc (n_nodes * sizeof *slots);
+      found = bson_malloc (n_nodes);
+   }
+
+   memset (found, 0, n_nodes);
+
+   if (bson_iter_init (&iter, bson)) {
+      _mongoc_matcher_program_fill (
+         (const mongoc_matcher_node_t *)program->nodes.data,
+         program->first_child, program->n_children, &iter, slots, found);
+   }
+
+   r = _mongoc_matcher_program_run (program, bson, slots, found);
+
+   if (slots != stack_slots) {
+      bson_free (slots);
+      bson_free (found);
+   }
+
+   return r;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_project_covers --
+ *
+ *       Check whether the field @key, below the dotted path @prefix of
+ *       @prefix_len bytes (empty or ending with a '.'), is selected by
+ *       the inclusion projection @projection.
+ *
+ * Returns:
+ *       MONGOC_MATCHER_PROJECT_WHOLE if the field itself is selected,
+ *       MONGOC_MATCHER_PROJECT_PARTIAL if only paths below it are, in
+ *       which case @sub_prefix is set to a projected path whose first
+ *       @prefix_len + strlen (@key) + 1 bytes are the prefix of those.
+ *       Otherwise MONGOC_MATCHER_PROJECT_NONE.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+#define MONGOC_MATCHER_PROJECT_NONE    0
+#define MONGOC_MATCHER_PROJECT_PARTIAL 1
+#define MONGOC_MATCHER_PROJECT_WHOLE   2
+
+static int
+_mongoc_matcher_project_covers (const bson_t  *projection, /* IN */
+                                const char    *prefix,     /* IN */
+                                size_t         prefix_len, /* IN */
+                                const char    *key,        /* IN */
+                                const char   **sub_prefix) /* OUT */
+{
+   bson_iter_t iter;
+   const char *path;
+   size_t key_len;
+   int r = MONGOC_MATCHER_PROJECT_NONE;
+
+   key_len = strlen (key);
+
+   if (!bson_iter_init (&iter, projection)) {
+      return r;
+   }
+
+   while (bson_iter_next (&iter)) {
+      path = bson_iter_key (&iter);
+
+      if (strncmp (path, prefix, prefix_len) ||
+          strncmp (path + prefix_len, key, key_len) ||
+          !bson_iter_as_bool (&iter)) {
+         continue;
+      }
+
+      if (path [prefix_len + key_len] == '\0') {
+         return MONGOC_MATCHER_PROJECT_WHOLE;
+      } else if (path [prefix_len + key_len] == '.') {
+         *sub_prefix = path;
+         r = MONGOC_MATCHER_PROJECT_PARTIAL;
+      }
+   }
+
+   return r;
+}
+
+
+/*
+ * Append the field at @iter to @out as selected by @projection, where
+ * @covers and @sub_prefix are what _mongoc_matcher_project_covers() said
+ * of it. Partly selected documents are copied with only the selected
+ * fields, and dropped if they are of any other type.
+ */
+static void
+_mongoc_matcher_project_append (const bson_t      *projection, /* IN */
+                                const bson_iter_t *iter,       /* IN */
+                                int                covers,     /* IN */
+                                const char        *sub_prefix, /* IN */
+                                size_t             prefix_len, /* IN */
+                                bson_t            *out)        /* OUT */
+{
+   const char *child_prefix = NULL;
+   bson_iter_t child;
+   const char *key;
+   bson_t doc;
+   int child_covers;
+
+   key = bson_iter_key (iter);
+
+   if (covers == MONGOC_MATCHER_PROJECT_WHOLE) {
+      bson_append_iter (out, key, -1, iter);
+      return;
+   }
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (iter) || !bson_iter_recurse (iter, &child)) {
+      return;
+   }
+
+   prefix_len += strlen (key) + 1;
+
+   bson_append_document_begin (out, key, -1, &doc);
+
+   while (bson_iter_next (&child)) {
+      child_covers = _mongoc_matcher_project_covers (projection, sub_prefix,
+                                                     prefix_len,
+                                                     bson_iter_key (&child),
+                                                     &child_prefix);
+
+      if (child_covers != MONGOC_MATCHER_PROJECT_NONE) {
+         _mongoc_matcher_project_append (projection, &child, child_covers,
+                                         child_prefix, prefix_len, &doc);
+      }
+   }
+
+   bson_append_document_end (out, &doc);
+}
+
+
+/* a top-level field that the projection selects, kept until the match */
+typedef struct
+{
+   bson_iter_t  iter;
+   int          covers;
+   const char  *sub_prefix;
+} mongoc_matcher_projected_t;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_match_project --
+ *
+ *       Run @program against @bson like _mongoc_matcher_program_match(),
+ *       and if it matched append the fields of @bson selected by the
+ *       inclusion projection @projection to @out.
+ *
+ *       The top-level fields to project are gathered in the same pass
+ *       over @bson that fills the slots of the tests, and only those
+ *       fields are visited again to copy them out once the document has
+ *       matched.
+ *
+ * Returns:
+ *       true if @bson matched, otherwise false.
+ *
+ * Side effects:
+ *       @out is appended to if @bson matched.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_matcher_program_match_project (const mongoc_matcher_program_t *program,    /* IN */
+                                       const bson_t                   *bson,       /* IN */
+                                       const bson_t                   *projection, /* IN */
+                                       bson_t                         *out)        /* OUT */
+{
+   mongoc_matcher_projected_t stack_projected [MONGOC_MATCHER_PROGRAM_STACK_NODES];
+   bson_iter_t stack_slots [MONGOC_MATCHER_PROGRAM_STACK_NODES];
+   uint8_t stack_found [MONGOC_MATCHER_PROGRAM_STACK_NODES];
+   mongoc_matcher_projected_t *projected = stack_projected;
+   const mongoc_matcher_node_t *nodes;
+   const char *sub_prefix = NULL;
+   bson_iter_t *slots = stack_slots;
+   uint8_t *found = stack_found;
+   size_t n_allocated = MONGOC_MATCHER_PROGRAM_STACK_NODES;
+   size_t n_projected = 0;
+   bson_iter_t iter;
+   size_t n_nodes;
+   size_t i;
+   bool keep_id = true;
+   int covers;
+   bool r;
+
+   BSON_ASSERT (program);
+   BSON_ASSERT (bson);
+   BSON_ASSERT (projection);
+   BSON_ASSERT (out);
+
+   nodes = (const mongoc_matcher_node_t *)program->nodes.data;
+   n_nodes = program->nodes.len;
+
+   if (n_nodes > MONGOC_MATCHER_PROGRAM_STACK_NODES) {
+      slots = bson_malloc (n_nodes * sizeof *slots);
+      found = bson_malloc (n_nodes);
+   }
+
+   memset (found, 0, n_nodes);
+
+   /* "_id" is returned unless the projection excludes it */
+   if (bson_iter_init_find (&iter, projection, "_id")) {
+      keep_id = bson_iter_as_bool (&iter);
+   }
+
+   if (bson_iter_init (&iter, bson)) {
+      while (bson_iter_next (&iter)) {
+         _mongoc_matcher_program_fill_one (nodes, program->first_child,
+                                           &iter, slots, found);
+
+         covers = _mongoc_matcher_project_covers (projection, "", 0,
+                                                  bson_iter_key (&iter),
+                                                  &sub_prefix);
+
+         if (keep_id && !strcmp (bson_iter_key (&iter), "_id")) {
+            covers = MONGOC_MATCHER_PROJECT_WHOLE;
+         }
+
+         if (covers == MONGOC_MATCHER_PROJECT_NONE) {
+            continue;
+         }
+
+         if (n_projected == n_allocated) {
+            n_allocated *= 2;
+
+            if (projected == stack_projected) {
+               projected = bson_malloc (n_allocated * sizeof *projected);
+               memcpy (projected, stack_projected, sizeof stack_projected);
+            } else {
+               projected = bson_realloc (projected,
+                                         n_allocated * sizeof *projected);
+            }
+         }
+
+         memcpy (&projected [n_projected].iter, &iter, sizeof iter);
+         projected [n_projected].covers = covers;
+         projected [n_projected].sub_prefix = sub_prefix;
+         n_projected++;
+      }
+   }
+
+   r = _mongoc_matcher_program_run (program, bson, slots, found);
+
+   if (r) {
+      for (i = 0; i < n_projected; i++) {
+         _mongoc_matcher_project_append (projection, &projected [i].iter,
+                                         projected [i].covers,
+                                         projected [i].sub_prefix, 0, out);
+      }
+   }
+
+   if (slots != stack_slots) {
+      bson_free (slots);
+      bson_free (found);
+   }
+
+   if (projected != stack_projected) {
+      bson_free (projected);
+   }
+
+   return r;
+}
+
+
+void
+_mongoc_matcher_program_destroy (mongoc_matcher_program_t *program) /* IN */
+{
+   BSON_ASSERT (program);
+
+   _mongoc_array_destroy (&program->insns);
+   _mongoc_array_destroy (&program->nodes);
+   _mongoc_array_destroy (&program->stats);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_set_adaptive --
+ *
+ *       Enable or disable the reordering of clauses by their cost and by
+ *       how often their tests have passed. An adaptive program counts
+ *       the outcome of every test it runs, so it must not be matched
+ *       from several threads at once.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @program is recompiled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_matcher_program_set_adaptive (mongoc_matcher_program_t *program,  /* IN */
+                                      bool                      adaptive) /* IN */
+{
+   BSON_ASSERT (program);
+
+   program->adaptive = adaptive;
+   program->n_matches = 0;
+   _mongoc_matcher_program_recompile (program);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_program_adapt --
+ *
+ *       Called after each document matched by an adaptive program. Every
+ *       MONGOC_MATCHER_PROGRAM_ADAPT_INTERVAL documents the clauses are
+ *       reordered by what has been seen so far, and the counts are
+ *       halved so that later documents weigh more than early ones.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @program may be recompiled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_matcher_program_adapt (mongoc_matcher_program_t *program) /* IN */
+{
+   mongoc_matcher_stat_t *stat;
+   size_t i;
+
+   BSON_ASSERT (program);
+
+   if (!program->adaptive ||
+       ++program->n_matches < MONGOC_MATCHER_PROGRAM_ADAPT_INTERVAL) {
+      return;
+   }
+
+   program->n_matches = 0;
+   _mongoc_matcher_program_recompile (program);
+
+   for (i = 0; i < program->stats.len; i++) {
+      stat = &_mongoc_array_index (&program->stats, mongoc_matcher_stat_t, i);
+      stat->n_evals /= 2;
+      stat->n_true /= 2;
+   }
+}
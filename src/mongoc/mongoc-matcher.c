@@ -16,6 +16,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "mongoc-error.h"
 #include "mongoc-matcher.h"
@@ -28,14 +29,95 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t  opcode,
                                bson_iter_t             *iter,
                                bool                     is_root,
                                bson_error_t            *error);
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_compare (bson_iter_t             *iter,
+                               const char              *path,
+                               bson_error_t            *error);
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_elem_match (bson_iter_t          *iter,
+                                  const char           *path,
+                                  bson_error_t         *error);
 
 
 /*
  *--------------------------------------------------------------------------
  *
- * _mongoc_matcher_parse_compare --
+ * _mongoc_matcher_parse_regex --
  *
- *       Parse a compare spec such as $gt or $in.
+ *       Parse a document such as {$regex: "^a", $options: "i"}, observed
+ *       by @iter, in either order of the two keys. $regex may also be a
+ *       BSON regex, whose own options are used unless $options is given.
+ *       Any other operators in the document are left to the caller.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t if successful; otherwise
+ *       NULL and @error is set.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_regex (bson_iter_t  *iter,  /* IN */
+                             const char   *path,  /* IN */
+                             bson_error_t *error) /* OUT */
+{
+   const char *pattern = NULL;
+   const char *options = NULL;
+   const char *key;
+   bson_iter_t child;
+
+   if (!bson_iter_recurse (iter, &child)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "Invalid $regex document.");
+      return NULL;
+   }
+
+   while (bson_iter_next (&child)) {
+      key = bson_iter_key (&child);
+
+      if (strcmp (key, "$regex") == 0 && BSON_ITER_HOLDS_UTF8 (&child)) {
+         pattern = bson_iter_utf8 (&child, NULL);
+      } else if (strcmp (key, "$regex") == 0 &&
+                 BSON_ITER_HOLDS_REGEX (&child)) {
+         pattern = bson_iter_regex (&child, options ? NULL : &options);
+      } else if (strcmp (key, "$options") == 0 &&
+                 BSON_ITER_HOLDS_UTF8 (&child)) {
+         options = bson_iter_utf8 (&child, NULL);
+      } else if (strcmp (key, "$regex") == 0 ||
+                 strcmp (key, "$options") == 0) {
+         bson_set_error (error,
+                         MONGOC_ERROR_MATCHER,
+                         MONGOC_ERROR_MATCHER_INVALID,
+                         "Invalid value for operator \"%s\"",
+                         key);
+         return NULL;
+      }
+   }
+
+   if (!pattern) {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "$options requires $regex.");
+      return NULL;
+   }
+
+   return _mongoc_matcher_op_regex_new (path, pattern, options, error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_parse_operator --
+ *
+ *       Parse the operator observed by @child, such as $gt or $in, in
+ *       the document observed by @iter.
  *
  *       See the following link for more information.
  *
@@ -51,13 +133,173 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t  opcode,
  *--------------------------------------------------------------------------
  */
 
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_operator (bson_iter_t  *iter,  /* IN */
+                                bson_iter_t  *child, /* IN */
+                                const char   *path,  /* IN */
+                                bson_error_t *error) /* OUT */
+{
+   const char * key;
+   mongoc_matcher_op_t * op = NULL, * op_child;
+
+   key = bson_iter_key (child);
+
+   if (strcmp(key, "$not") == 0) {
+      if (!(op_child = _mongoc_matcher_parse_compare (child, path, error))) {
+         return NULL;
+      }
+      op = _mongoc_matcher_op_not_new (path, op_child);
+   } else if (strcmp(key, "$gt") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_GT, path,
+                                           child);
+   } else if (strcmp(key, "$gte") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_GTE, path,
+                                           child);
+   } else if (strcmp(key, "$in") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_IN, path,
+                                           child);
+   } else if (strcmp(key, "$lt") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_LT, path,
+                                           child);
+   } else if (strcmp(key, "$lte") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_LTE, path,
+                                           child);
+   } else if (strcmp(key, "$ne") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_NE, path,
+                                           child);
+   } else if (strcmp(key, "$nin") == 0) {
+      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_NIN, path,
+                                           child);
+   } else if (strcmp(key, "$exists") == 0) {
+      op = _mongoc_matcher_op_exists_new (path, bson_iter_bool (child));
+   } else if (strcmp(key, "$type") == 0) {
+      op = _mongoc_matcher_op_type_new (path, bson_iter_type (child));
+   } else if (strcmp(key, "$regex") == 0 ||
+              strcmp(key, "$options") == 0) {
+      return _mongoc_matcher_parse_regex (iter, path, error);
+   } else if (strcmp(key, "$elemMatch") == 0) {
+      return _mongoc_matcher_parse_elem_match (child, path, error);
+   } else {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "Invalid operator \"%s\"",
+                      key);
+      return NULL;
+   }
+
+   BSON_ASSERT (op);
+
+   return op;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_parse_elem_match --
+ *
+ *       Parse the value of {$elemMatch: ...} observed by @iter. It is
+ *       either a list of operators, {$gt: 1, $lt: 5}, that one element
+ *       must satisfy together, or a query that one document element must
+ *       match.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t if successful; otherwise
+ *       NULL and @error is set.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static mongoc_matcher_op_t *
+_mongoc_matcher_parse_elem_match (bson_iter_t  *iter,  /* IN */
+                                  const char   *path,  /* IN */
+                                  bson_error_t *error) /* OUT */
+{
+   mongoc_matcher_op_t *query = NULL;
+   mongoc_matcher_op_t *op;
+   bson_iter_t child;
+   const char *key;
+   bool regex = false;
+
+   if (!BSON_ITER_HOLDS_DOCUMENT (iter) ||
+       !bson_iter_recurse (iter, &child) ||
+       !bson_iter_next (&child)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_MATCHER,
+                      MONGOC_ERROR_MATCHER_INVALID,
+                      "$elemMatch requires a document of operations.");
+      return NULL;
+   }
+
+   key = bson_iter_key (&child);
+
+   if (key [0] != '$' ||
+       strcmp (key, "$and") == 0 ||
+       strcmp (key, "$or") == 0 ||
+       strcmp (key, "$nor") == 0) {
+      bson_iter_recurse (iter, &child);
+      if (!(query = _mongoc_matcher_parse_logical (MONGOC_MATCHER_OPCODE_AND,
+                                                   &child, true, error))) {
+         return NULL;
+      }
+      return _mongoc_matcher_op_elem_match_new (path, query, false);
+   }
+
+   /* {$gt: 1, $lt: 5} is the $and of its operators, paths are unused */
+   do {
+      key = bson_iter_key (&child);
+
+      if (strcmp (key, "$regex") == 0 || strcmp (key, "$options") == 0) {
+         if (regex) {
+            continue;
+         }
+         regex = true;
+      }
+
+      if (!(op = _mongoc_matcher_parse_operator (iter, &child, "", error))) {
+         if (query) {
+            _mongoc_matcher_op_destroy (query);
+         }
+         return NULL;
+      }
+
+      query = query ? _mongoc_matcher_op_logical_new (MONGOC_MATCHER_OPCODE_AND,
+                                                      query, op)
+                    : op;
+   } while (bson_iter_next (&child));
+
+   return _mongoc_matcher_op_elem_match_new (path, query, true);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_matcher_parse_compare --
+ *
+ *       Parse a compare spec such as {"a": 1} or {"a": {$gt: 1}}.
+ *
+ * Returns:
+ *       A newly allocated mongoc_matcher_op_t if successful; otherwise
+ *       NULL and @error is set.
+ *
+ * Side effects:
+ *       @error may be set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 static mongoc_matcher_op_t *
 _mongoc_matcher_parse_compare (bson_iter_t  *iter,  /* IN */
                                const char   *path,  /* IN */
                                bson_error_t *error) /* OUT */
 {
-   const char * key;
-   mongoc_matcher_op_t * op = NULL, * op_child;
+   const char * options;
+   const char * pattern;
    bson_iter_t child;
 
    BSON_ASSERT (iter);
@@ -73,57 +315,15 @@ _mongoc_matcher_parse_compare (bson_iter_t  *iter,  /* IN */
          return NULL;
       }
 
-      key = bson_iter_key (&child);
-
-      if (key[0] != '$') {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_EQ, path,
-                                              iter);
-      } else if (strcmp(key, "$not") == 0) {
-         if (!(op_child = _mongoc_matcher_parse_compare (&child, path,
-                                                         error))) {
-            return NULL;
-         }
-         op = _mongoc_matcher_op_not_new (path, op_child);
-      } else if (strcmp(key, "$gt") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_GT, path,
-                                              &child);
-      } else if (strcmp(key, "$gte") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_GTE, path,
-                                              &child);
-      } else if (strcmp(key, "$in") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_IN, path,
-                                              &child);
-      } else if (strcmp(key, "$lt") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_LT, path,
-                                              &child);
-      } else if (strcmp(key, "$lte") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_LTE, path,
-                                              &child);
-      } else if (strcmp(key, "$ne") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_NE, path,
-                                              &child);
-      } else if (strcmp(key, "$nin") == 0) {
-         op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_NIN, path,
-                                              &child);
-      } else if (strcmp(key, "$exists") == 0) {
-         op = _mongoc_matcher_op_exists_new (path, bson_iter_bool (&child));
-      } else if (strcmp(key, "$type") == 0) {
-         op = _mongoc_matcher_op_type_new (path, bson_iter_type (&child));
-      } else {
-         bson_set_error (error,
-                         MONGOC_ERROR_MATCHER,
-                         MONGOC_ERROR_MATCHER_INVALID,
-                         "Invalid operator \"%s\"",
-                         key);
-         return NULL;
+      if (bson_iter_key (&child) [0] == '$') {
+         return _mongoc_matcher_parse_operator (iter, &child, path, error);
       }
-   } else {
-      op = _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_EQ, path, iter);
+   } else if (bson_iter_type (iter) == BSON_TYPE_REGEX) {
+      pattern = bson_iter_regex (iter, &options);
+      return _mongoc_matcher_op_regex_new (path, pattern, options, error);
    }
 
-   BSON_ASSERT (op);
-
-   return op;
+   return _mongoc_matcher_op_compare_new (MONGOC_MATCHER_OPCODE_EQ, path, iter);
 }
 
 
@@ -302,8 +502,9 @@ _mongoc_matcher_parse_logical (mongoc_matcher_opcode_t  opcode,  /* IN */
  *       Create a new mongoc_matcher_t using the query specification
  *       provided in @query.
  *
- *       This will build an operation tree that can be applied to arbitrary
- *       bson documents using mongoc_matcher_match().
+ *       This will build an operation tree and compile it into a program
+ *       that can be applied to arbitrary bson documents using
+ *       mongoc_matcher_match().
  *
  * Returns:
  *       A newly allocated mongoc_matcher_t if successful; otherwise NULL
@@ -341,6 +542,7 @@ mongoc_matcher_new (const bson_t *query, /* IN */
    }
 
    matcher->optree = op;
+   _mongoc_matcher_program_init (&matcher->program, op);
 
    return matcher;
 
@@ -372,11 +574,176 @@ bool
 mongoc_matcher_match (const mongoc_matcher_t *matcher,  /* IN */
                       const bson_t           *document) /* IN */
 {
+   bool r;
+
    BSON_ASSERT (matcher);
    BSON_ASSERT (matcher->optree);
    BSON_ASSERT (document);
 
-   return _mongoc_matcher_op_match (matcher->optree, document);
+   r = _mongoc_matcher_program_match (&matcher->program, document);
+
+   if (matcher->program.adaptive) {
+      _mongoc_matcher_program_adapt ((mongoc_matcher_program_t *)
+                                     &matcher->program);
+   }
+
+   return r;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_matcher_match_project --
+ *
+ *       Checks to see if @document matches the query specified when
+ *       creating @matcher, and if it does, appends the fields of
+ *       @document selected by @projection to @out.
+ *
+ *       @projection is an inclusion projection like {"a": 1, "b.c": 1}.
+ *       "_id" is included unless @projection has {"_id": 0}, paths with
+ *       a false value are otherwise ignored. The fields are found in the
+ *       same pass over @document as those the query tests.
+ *
+ * Returns:
+ *       TRUE if @document matched the query, otherwise FALSE.
+ *
+ * Side effects:
+ *       @out is appended to if @document matched.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_matcher_match_project (const mongoc_matcher_t *matcher,    /* IN */
+                              const bson_t           *document,   /* IN */
+                              const bson_t           *projection, /* IN */
+                              bson_t                 *out)        /* OUT */
+{
+   bool r;
+
+   BSON_ASSERT (matcher);
+   BSON_ASSERT (matcher->optree);
+   BSON_ASSERT (document);
+   BSON_ASSERT (projection);
+   BSON_ASSERT (out);
+
+   r = _mongoc_matcher_program_match_project (&matcher->program, document,
+                                              projection, out);
+
+   if (matcher->program.adaptive) {
+      _mongoc_matcher_program_adapt ((mongoc_matcher_program_t *)
+                                     &matcher->program);
+   }
+
+   return r;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_matcher_match_batch --
+ *
+ *       Checks each of the documents laid end to end in the @len bytes at
+ *       @docs, such as the documents of an OP_REPLY or a bsondump file,
+ *       against the query specified when creating @matcher.
+ *
+ *       Bit (i % 8) of @result_bitmap [i / 8] is set if document i
+ *       matched and cleared otherwise. @result_bitmap must hold a bit for
+ *       every document, (len / 5 + 7) / 8 bytes is always enough.
+ *
+ * Returns:
+ *       The number of documents checked, or -1 if @docs does not hold a
+ *       whole number of documents. The bits of those before the corrupt
+ *       one are set as above.
+ *
+ * Side effects:
+ *       @result_bitmap is written to.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ssize_t
+mongoc_matcher_match_batch (const mongoc_matcher_t *matcher,       /* IN */
+                            const uint8_t          *docs,          /* IN */
+                            size_t                  len,           /* IN */
+                            uint8_t                *result_bitmap) /* OUT */
+{
+   const mongoc_matcher_program_t *program;
+   uint32_t doc_len;
+   ssize_t n = 0;
+   size_t pos = 0;
+   bson_t b;
+
+   BSON_ASSERT (matcher);
+   BSON_ASSERT (docs || !len);
+   BSON_ASSERT (result_bitmap || !len);
+
+   program = &matcher->program;
+
+   while (pos < len) {
+      if ((len - pos) < 5) {
+         return -1;
+      }
+
+      memcpy (&doc_len, docs + pos, 4);
+      doc_len = BSON_UINT32_FROM_LE (doc_len);
+
+      if (doc_len > (len - pos) ||
+          !bson_init_static (&b, docs + pos, doc_len)) {
+         return -1;
+      }
+
+      if (!(n & 7)) {
+         result_bitmap [n >> 3] = 0;
+      }
+
+      if (_mongoc_matcher_program_match (program, &b)) {
+         result_bitmap [n >> 3] |= (uint8_t)(1 << (n & 7));
+      }
+
+      if (program->adaptive) {
+         _mongoc_matcher_program_adapt ((mongoc_matcher_program_t *)program);
+      }
+
+      pos += doc_len;
+      n++;
+   }
+
+   return n;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_matcher_set_adaptive --
+ *
+ *       Let @matcher reorder the clauses of $and, $or and $nor by the
+ *       cost of their tests and how often they have passed, so that it
+ *       reaches an answer with as few tests as it can. The result of
+ *       matching a document does not change.
+ *
+ *       An adaptive matcher updates its statistics while matching, so it
+ *       must not be used from several threads at once.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_matcher_set_adaptive (mongoc_matcher_t *matcher,  /* IN */
+                             bool              adaptive) /* IN */
+{
+   BSON_ASSERT (matcher);
+
+   _mongoc_matcher_program_set_adaptive (&matcher->program, adaptive);
 }
 
 
@@ -401,6 +768,7 @@ mongoc_matcher_destroy (mongoc_matcher_t *matcher) /* IN */
 {
    BSON_ASSERT (matcher);
 
+   _mongoc_matcher_program_destroy (&matcher->program);
    _mongoc_matcher_op_destroy (matcher->optree);
    bson_destroy (&matcher->query);
    bson_free (matcher);
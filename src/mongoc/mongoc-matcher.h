@@ -34,6 +34,19 @@ mongoc_matcher_t *mongoc_matcher_new     (const bson_t           *query,
                                           bson_error_t           *error);
 bool              mongoc_matcher_match   (const mongoc_matcher_t *matcher,
                                           const bson_t           *document);
+bool              mongoc_matcher_match_project
+                                         (const mongoc_matcher_t *matcher,
+                                          const bson_t           *document,
+                                          const bson_t           *projection,
+                                          bson_t                 *out);
+ssize_t           mongoc_matcher_match_batch
+                                         (const mongoc_matcher_t *matcher,
+                                          const uint8_t          *docs,
+                                          size_t                  len,
+                                          uint8_t                *result_bitmap);
+void              mongoc_matcher_set_adaptive
+                                         (mongoc_matcher_t       *matcher,
+                                          bool                    adaptive);
 void              mongoc_matcher_destroy (mongoc_matcher_t       *matcher);
 
 
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MONGOC_MEMORY_BUDGET_PRIVATE_H
+#define MONGOC_MEMORY_BUDGET_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-memory-budget.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The memory budget is shared by everything in the process that buffers
+ * ahead of the application: prefetched cursor batches, which include the
+ * read-ahead of GridFS files, and the batches pipelined bulk writers leave
+ * in flight. They reserve what they are about to buffer and do without
+ * buffering ahead when the reservation is refused.
+ */
+bool _mongoc_memory_budget_reserve (size_t len);
+void _mongoc_memory_budget_release (size_t len);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_MEMORY_BUDGET_PRIVATE_H */
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#include "mongoc-counters-private.h"
+#include "mongoc-memory-budget-private.h"
+
+
+/*
+ * The most bytes that may be buffered ahead at once, or zero for no limit,
+ * and the bytes reserved so far.
+ */
+static volatile int64_t gMaxBytes;
+static volatile int64_t gReservedBytes;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_memory_budget_set --
+ *
+ *       Limit the memory all clients and pools of the process may use to
+ *       buffer data ahead of the application to @max_bytes. Zero, the
+ *       default, removes the limit.
+ *
+ *       Lowering the budget below what is already reserved does not take
+ *       anything back, but nothing more is reserved until enough has been
+ *       released.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_memory_budget_set (int64_t max_bytes)
+{
+   bson_return_if_fail (max_bytes >= 0);
+
+   gMaxBytes = max_bytes;
+   bson_memory_barrier ();
+}
+
+
+int64_t
+mongoc_memory_budget_get (void)
+{
+   return gMaxBytes;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_memory_budget_reserve --
+ *
+ *       Reserve @len bytes of the memory budget before buffering them
+ *       ahead of the application.
+ *
+ * Returns:
+ *       true if the bytes were reserved and must be given back with
+ *       _mongoc_memory_budget_release(); false if that would exceed the
+ *       budget and the caller should carry on without buffering ahead.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_memory_budget_reserve (size_t len)
+{
+   int64_t max_bytes = gMaxBytes;
+   int64_t reserved;
+
+   if (!len) {
+      return true;
+   }
+
+   reserved = bson_atomic_int64_add (&gReservedBytes, (int64_t)len);
+
+   if (max_bytes && (reserved > max_bytes)) {
+      bson_atomic_int64_add (&gReservedBytes, -(int64_t)len);
+      mongoc_counter_memory_budget_refused_inc ();
+      return false;
+   }
+
+   mongoc_counter_memory_budget_add ((int64_t)len);
+
+   return true;
+}
+
+
+void
+_mongoc_memory_budget_release (size_t len)
+{
+   if (len) {
+      bson_atomic_int64_add (&gReservedBytes, -(int64_t)len);
+      mongoc_counter_memory_budget_add (-(int64_t)len);
+   }
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_NODE_LIMITER_PRIVATE_H
+#define MONGOC_NODE_LIMITER_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-counters-private.h"
+#include "mongoc-host-list.h"
+#include "mongoc-thread-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_node_limiter_t mongoc_node_limiter_t;
+typedef struct _mongoc_node_limit_t   mongoc_node_limit_t;
+
+
+/*
+ * How many operations the clients of a pool may have waiting for a reply
+ * from one node. @limit grows by about one per round trip while the node
+ * is kept busy and answers about as fast as it ever did, and shrinks by a
+ * fraction when its round trips take much longer than @min_rtt_usec or
+ * fail, so a node that is overloaded is given less work instead of more.
+ *
+ * Limits are created the first time a node is used and kept until the
+ * pool is destroyed.
+ */
+struct _mongoc_node_limit_t
+{
+   mongoc_node_limit_t      *next;
+   mongoc_node_limiter_t    *limiter;
+   char                      host_and_port [BSON_HOST_NAME_MAX + 7];
+   uint32_t                  in_flight;
+   double                    limit;
+   int64_t                   min_rtt_usec;
+   int64_t                   window_min_usec;
+   uint32_t                  window_samples;
+   int64_t                   last_decrease;
+   mongoc_scoped_counters_t *counters;
+};
+
+
+struct _mongoc_node_limiter_t
+{
+   mongoc_mutex_t            mutex;
+   uint32_t                  max;
+   mongoc_node_limit_t      *head;
+};
+
+
+void                 _mongoc_node_limiter_init            (mongoc_node_limiter_t *limiter,
+                                                           uint32_t               max);
+void                 _mongoc_node_limiter_destroy         (mongoc_node_limiter_t *limiter);
+void                 _mongoc_node_limiter_reset_after_fork (mongoc_node_limiter_t *limiter);
+mongoc_node_limit_t *_mongoc_node_limiter_acquire         (mongoc_node_limiter_t *limiter,
+                                                           const char            *host_and_port);
+bool                 _mongoc_node_limiter_saturated       (mongoc_node_limiter_t *limiter,
+                                                           const char            *host_and_port);
+void                 _mongoc_node_limit_release           (mongoc_node_limit_t   *limit,
+                                                           int64_t                rtt_usec,
+                                                           bool                   failed);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_NODE_LIMITER_PRIVATE_H */
@@ -0,0 +1,301 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-node-limiter-private.h"
+
+
+#ifndef NODE_LIMITER_INITIAL
+/*
+ * The limit of a node before anything is known about it, unless
+ * maxConcurrentOpsPerNode is lower.
+ */
+#define NODE_LIMITER_INITIAL 16
+#endif
+
+
+#ifndef NODE_LIMITER_TOLERANCE
+/*
+ * A round trip that takes more than this many times the fastest one seen
+ * lately means the node is queueing our requests. The limit is then
+ * multiplied by NODE_LIMITER_BACKOFF, at most once per round trip.
+ */
+#define NODE_LIMITER_TOLERANCE 2.0
+#define NODE_LIMITER_BACKOFF 0.9
+#endif
+
+
+#ifndef NODE_LIMITER_WINDOW
+/*
+ * The fastest round trip is forgotten after this many samples, so that a
+ * node which has become slower for good is measured against its new
+ * speed rather than being throttled forever.
+ */
+#define NODE_LIMITER_WINDOW 1000
+#endif
+
+
+void
+_mongoc_node_limiter_init (mongoc_node_limiter_t *limiter,
+                           uint32_t               max)
+{
+   memset (limiter, 0, sizeof *limiter);
+   mongoc_mutex_init (&limiter->mutex);
+   limiter->max = max;
+}
+
+
+void
+_mongoc_node_limiter_destroy (mongoc_node_limiter_t *limiter)
+{
+   mongoc_node_limit_t *limit;
+
+   while ((limit = limiter->head)) {
+      limiter->head = limit->next;
+      bson_free (limit);
+   }
+
+   mongoc_mutex_destroy (&limiter->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_node_limiter_reset_after_fork --
+ *
+ *       The operations in flight belong to the parent process, so none
+ *       are in flight in the child, and the lock may have been held by a
+ *       thread that does not exist here. The limits learned are kept.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_node_limiter_reset_after_fork (mongoc_node_limiter_t *limiter)
+{
+   mongoc_node_limit_t *limit;
+
+   mongoc_mutex_init (&limiter->mutex);
+
+   for (limit = limiter->head; limit; limit = limit->next) {
+      limit->in_flight = 0;
+
+      if (limit->counters) {
+         limit->counters->in_flight = 0;
+      }
+   }
+}
+
+
+static mongoc_node_limit_t *
+_mongoc_node_limiter_find (mongoc_node_limiter_t *limiter,
+                           const char            *host_and_port,
+                           bool                   create)
+{
+   mongoc_node_limit_t *limit;
+
+   for (limit = limiter->head; limit; limit = limit->next) {
+      if (!strcmp (limit->host_and_port, host_and_port)) {
+         return limit;
+      }
+   }
+
+   if (!create) {
+      return NULL;
+   }
+
+   limit = bson_malloc0 (sizeof *limit);
+   limit->limiter = limiter;
+   bson_strncpy (limit->host_and_port, host_and_port,
+                 sizeof limit->host_and_port);
+   limit->limit = BSON_MIN (limiter->max, NODE_LIMITER_INITIAL);
+   limit->counters = _mongoc_scoped_counters_get (MONGOC_SCOPED_COUNTERS_NODE,
+                                                  host_and_port);
+   limit->next = limiter->head;
+   limiter->head = limit;
+
+   return limit;
+}
+
+
+static void
+_mongoc_node_limit_publish (mongoc_node_limit_t *limit)
+{
+   if (limit->counters) {
+      limit->counters->in_flight = limit->in_flight;
+      limit->counters->concurrency_limit = (int64_t)limit->limit;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_node_limiter_acquire --
+ *
+ *       Take one of the operations that may be in flight to the node at
+ *       @host_and_port, for a request that expects a reply.
+ *
+ * Returns:
+ *       The limit of the node, to be passed to _mongoc_node_limit_release()
+ *       once the reply is in or the connection is lost. NULL if as many
+ *       operations as the node is allowed are already in flight.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_node_limit_t *
+_mongoc_node_limiter_acquire (mongoc_node_limiter_t *limiter,
+                              const char            *host_and_port)
+{
+   mongoc_node_limit_t *limit;
+
+   BSON_ASSERT (limiter);
+   BSON_ASSERT (host_and_port);
+
+   mongoc_mutex_lock (&limiter->mutex);
+
+   limit = _mongoc_node_limiter_find (limiter, host_and_port, true);
+
+   if (limit->in_flight >= (uint32_t)limit->limit) {
+      limit = NULL;
+   } else {
+      limit->in_flight++;
+      _mongoc_node_limit_publish (limit);
+   }
+
+   mongoc_mutex_unlock (&limiter->mutex);
+
+   return limit;
+}
+
+
+/*
+ * Whether an operation sent to @host_and_port now would be turned down.
+ */
+bool
+_mongoc_node_limiter_saturated (mongoc_node_limiter_t *limiter,
+                                const char            *host_and_port)
+{
+   mongoc_node_limit_t *limit;
+   bool ret;
+
+   mongoc_mutex_lock (&limiter->mutex);
+   limit = _mongoc_node_limiter_find (limiter, host_and_port, false);
+   ret = limit && (limit->in_flight >= (uint32_t)limit->limit);
+   mongoc_mutex_unlock (&limiter->mutex);
+
+   return ret;
+}
+
+
+static void
+_mongoc_node_limit_decrease (mongoc_node_limit_t *limit,
+                             int64_t              now)
+{
+   /* the replies to requests sent before the last decrease say nothing new */
+   if (limit->last_decrease &&
+       (now - limit->last_decrease) < BSON_MAX (limit->min_rtt_usec, 1000)) {
+      return;
+   }
+
+   limit->last_decrease = now;
+   limit->limit = BSON_MAX (1.0, limit->limit * NODE_LIMITER_BACKOFF);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_node_limit_release --
+ *
+ *       Give back the operation taken with _mongoc_node_limiter_acquire()
+ *       and adjust the limit of the node. @rtt_usec is how long the reply
+ *       took, or 0 if the operation ended before one came in. @failed
+ *       means the connection was lost or timed out with the operation in
+ *       flight.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_node_limit_release (mongoc_node_limit_t *limit,
+                            int64_t              rtt_usec,
+                            bool                 failed)
+{
+   mongoc_node_limiter_t *limiter;
+   bool saturated;
+   int64_t now;
+
+   BSON_ASSERT (limit);
+
+   limiter = limit->limiter;
+   now = bson_get_monotonic_time ();
+
+   mongoc_mutex_lock (&limiter->mutex);
+
+   saturated = (limit->in_flight >= (uint32_t)limit->limit);
+
+   if (limit->in_flight) {
+      limit->in_flight--;
+   }
+
+   if (failed) {
+      _mongoc_node_limit_decrease (limit, now);
+   } else if (rtt_usec > 0) {
+      if (!limit->window_samples || (rtt_usec < limit->window_min_usec)) {
+         limit->window_min_usec = rtt_usec;
+      }
+
+      if (!limit->min_rtt_usec || (rtt_usec < limit->min_rtt_usec)) {
+         limit->min_rtt_usec = rtt_usec;
+      }
+
+      if (++limit->window_samples == NODE_LIMITER_WINDOW) {
+         limit->min_rtt_usec = limit->window_min_usec;
+         limit->window_samples = 0;
+      }
+
+      if (rtt_usec > NODE_LIMITER_TOLERANCE * limit->min_rtt_usec) {
+         _mongoc_node_limit_decrease (limit, now);
+      } else if (saturated) {
+         limit->limit = BSON_MIN ((double)limiter->max,
+                                  limit->limit + 1.0 / limit->limit);
+      }
+   }
+
+   _mongoc_node_limit_publish (limit);
+
+   mongoc_mutex_unlock (&limiter->mutex);
+}
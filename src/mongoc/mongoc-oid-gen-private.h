@@ -0,0 +1,60 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_OID_GEN_PRIVATE_H
+#define MONGOC_OID_GEN_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The number of sequence values a generator takes from the process-wide
+ * counter at a time.
+ */
+#define MONGOC_OID_GEN_BLOCK_SIZE 1024
+
+
+/*
+ * Generates ObjectIds for one thread at a time without touching shared
+ * state, except once every MONGOC_OID_GEN_BLOCK_SIZE ids to reserve the
+ * next block of sequence values from a process-wide atomic counter. The
+ * ids are laid out as bson_oid_init() lays them out, and never repeat
+ * across the generators of a process.
+ */
+typedef struct
+{
+   uint8_t  machine_pid [5];
+   uint32_t seq;
+   uint32_t seq_end;
+} mongoc_oid_gen_t;
+
+
+void _mongoc_oid_gen_init (mongoc_oid_gen_t *gen);
+void _mongoc_oid_gen_next (mongoc_oid_gen_t *gen,
+                           bson_oid_t       *oid);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_OID_GEN_PRIVATE_H */
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+#include <time.h>
+
+#include "mongoc-oid-gen-private.h"
+
+
+static volatile int32_t gOidGenSeq;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oid_gen_init --
+ *
+ *       Initialize @gen. The machine and process bytes of its ids are
+ *       taken from an id of the default bson_context_t, so a generator
+ *       must not be used across fork().
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_oid_gen_init (mongoc_oid_gen_t *gen)
+{
+   bson_oid_t oid;
+
+   BSON_ASSERT (gen);
+
+   bson_oid_init (&oid, NULL);
+   memcpy (gen->machine_pid, &oid.bytes [4], sizeof gen->machine_pid);
+   gen->seq = 0;
+   gen->seq_end = 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oid_gen_next --
+ *
+ *       Generate the next ObjectId of @gen into @oid. If @gen is NULL the
+ *       default bson_context_t is used.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       A new block of sequence values is reserved when @gen runs out.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_oid_gen_next (mongoc_oid_gen_t *gen,
+                      bson_oid_t       *oid)
+{
+   uint32_t t;
+
+   BSON_ASSERT (oid);
+
+   if (!gen) {
+      bson_oid_init (oid, NULL);
+      return;
+   }
+
+   if (gen->seq == gen->seq_end) {
+      gen->seq_end = (uint32_t)bson_atomic_int_add (&gOidGenSeq,
+                                                    MONGOC_OID_GEN_BLOCK_SIZE);
+      gen->seq = gen->seq_end - MONGOC_OID_GEN_BLOCK_SIZE;
+   }
+
+   t = BSON_UINT32_TO_BE ((uint32_t)time (NULL));
+   memcpy (&oid->bytes [0], &t, 4);
+   memcpy (&oid->bytes [4], gen->machine_pid, sizeof gen->machine_pid);
+   oid->bytes [9] = (uint8_t)(gen->seq >> 16);
+   oid->bytes [10] = (uint8_t)(gen->seq >> 8);
+   oid->bytes [11] = (uint8_t)gen->seq;
+
+   gen->seq++;
+}
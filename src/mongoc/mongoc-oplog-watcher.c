@@ -0,0 +1,367 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <bcon.h>
+#include <string.h>
+
+#include "mongoc-client.h"
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+#include "mongoc-log.h"
+#include "mongoc-oplog-watcher.h"
+#include "mongoc-oplog-watcher-private.h"
+#include "mongoc-tailer.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "oplog-watcher"
+
+
+/*
+ * The namespaces of the last MONGOC_OPLOG_WATCHER_EVENTS writes are kept
+ * for the caches to catch up with. A cache that falls further behind
+ * than that drops everything.
+ */
+#define MONGOC_OPLOG_WATCHER_EVENTS 1024
+
+
+struct _mongoc_oplog_watcher_t
+{
+   mongoc_tailer_t *tailer;
+
+   /*
+    * Event seq is at events [seq % MONGOC_OPLOG_WATCHER_EVENTS]. A
+    * namespace without a collection, for commands, stands for the whole
+    * database.
+    */
+   mongoc_mutex_t   mutex;
+   uint64_t         seq;
+   char           (*events) [140];
+   bool             failed;
+};
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oplog_watcher_last_ts --
+ *
+ *       Fetch the timestamp of the newest entry of the oplog, so that
+ *       tailing starts after it.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *       @has_ts is set if the oplog has an entry, and then @timestamp
+ *       and @increment are its "ts".
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_oplog_watcher_last_ts (mongoc_client_pool_t *pool,
+                               bool                 *has_ts,
+                               uint32_t             *timestamp,
+                               uint32_t             *increment,
+                               bson_error_t         *error)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t *query;
+   bson_t *fields;
+   bool ret;
+
+   client = mongoc_client_pool_pop (pool);
+   collection = mongoc_client_get_collection (client, "local", "oplog.rs");
+
+   query = BCON_NEW ("$query", "{", "}",
+                     "$orderby", "{", "$natural", BCON_INT32 (-1), "}");
+   fields = BCON_NEW ("ts", BCON_INT32 (1));
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    query, fields, NULL);
+
+   *has_ts = false;
+
+   if (mongoc_cursor_next (cursor, &doc) &&
+       bson_iter_init_find (&iter, doc, "ts") &&
+       BSON_ITER_HOLDS_TIMESTAMP (&iter)) {
+      bson_iter_timestamp (&iter, timestamp, increment);
+      *has_ts = true;
+   }
+
+   ret = !mongoc_cursor_error (cursor, error);
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (fields);
+   bson_destroy (query);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+
+   return ret;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_oplog_watcher_new --
+ *
+ *       Starts tailing local.oplog.rs from a client popped from @pool,
+ *       to learn which namespaces are written. Clients given the watcher
+ *       with mongoc_client_set_query_cache_watcher() drop the results
+ *       they cached for those namespaces.
+ *
+ *       Tailing starts after the newest entry of the oplog, which is
+ *       read from the primary, so writes are seen as soon as the
+ *       primary logs them.
+ *
+ * Returns:
+ *       A newly allocated mongoc_oplog_watcher_t that should be freed
+ *       with mongoc_oplog_watcher_destroy() after every client using it
+ *       stopped, or NULL and @error is set if the oplog can't be read.
+ *
+ * Side effects:
+ *       A thread is spawned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_oplog_watcher_t *
+mongoc_oplog_watcher_new (mongoc_client_pool_t *pool,
+                          bson_error_t         *error)
+{
+   mongoc_oplog_watcher_t *watcher;
+   uint32_t timestamp = 0;
+   uint32_t increment = 0;
+   bson_t *query;
+   bool has_ts;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, NULL);
+
+   if (!_mongoc_oplog_watcher_last_ts (pool, &has_ts, &timestamp, &increment,
+                                       error)) {
+      RETURN (NULL);
+   }
+
+   if (has_ts) {
+      query = BCON_NEW ("ts", "{",
+                        "$gt", BCON_TIMESTAMP (timestamp, increment),
+                        "}");
+   } else {
+      query = bson_new ();
+   }
+
+   watcher = bson_malloc0 (sizeof *watcher);
+   watcher->events = bson_malloc0 (MONGOC_OPLOG_WATCHER_EVENTS *
+                                   sizeof *watcher->events);
+   mongoc_mutex_init (&watcher->mutex);
+
+   watcher->tailer = mongoc_tailer_new (pool, "local", "oplog.rs", query, "ts",
+                                        MONGOC_QUERY_OPLOG_REPLAY, 0);
+
+   bson_destroy (query);
+
+   RETURN (watcher);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oplog_watcher_record --
+ *
+ *       Record the namespace an oplog entry wrote to. Must be called
+ *       with the mutex held.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_oplog_watcher_record (mongoc_oplog_watcher_t *watcher,
+                              const bson_t           *entry)
+{
+   bson_iter_t iter;
+   const char *op = NULL;
+   const char *ns = NULL;
+   char *event;
+   char *dot;
+
+   if (bson_iter_init (&iter, entry)) {
+      while (bson_iter_next (&iter)) {
+         if (BSON_ITER_HOLDS_UTF8 (&iter)) {
+            if (!strcmp (bson_iter_key (&iter), "op")) {
+               op = bson_iter_utf8 (&iter, NULL);
+            } else if (!strcmp (bson_iter_key (&iter), "ns")) {
+               ns = bson_iter_utf8 (&iter, NULL);
+            }
+         }
+      }
+   }
+
+   /* "n" entries are no-ops, noted for replication only */
+   if (!op || !ns || !strcmp (op, "n")) {
+      return;
+   }
+
+   event = watcher->events [watcher->seq % MONGOC_OPLOG_WATCHER_EVENTS];
+   bson_strncpy (event, ns, sizeof *watcher->events);
+
+   /*
+    * Commands such as drop or renameCollection are logged on "db.$cmd",
+    * their target is in the command itself; drop the whole database.
+    */
+   if (!strcmp (op, "c") && (dot = strchr (event, '.'))) {
+      *dot = '\0';
+   }
+
+   watcher->seq++;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oplog_watcher_seq --
+ *
+ *       The number of writes seen so far, for a cache that starts using
+ *       @watcher to call _mongoc_oplog_watcher_poll() with.
+ *
+ * Returns:
+ *       The current event.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint64_t
+_mongoc_oplog_watcher_seq (mongoc_oplog_watcher_t *watcher)
+{
+   uint64_t seq;
+
+   mongoc_mutex_lock (&watcher->mutex);
+   seq = watcher->seq;
+   mongoc_mutex_unlock (&watcher->mutex);
+
+   return seq;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_oplog_watcher_poll --
+ *
+ *       Take in the oplog entries received since the last poll, then
+ *       drop from @cache the results for every namespace written since
+ *       event @seq. Everything is dropped if @cache fell too far behind
+ *       or tailing failed, since writes may have been missed.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @seq is advanced to the current event.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_oplog_watcher_poll (mongoc_oplog_watcher_t *watcher,
+                            uint64_t               *seq,
+                            mongoc_query_cache_t   *cache)
+{
+   const bson_t *entry;
+   bson_error_t error;
+   char ns [140];
+   char *dot;
+
+   mongoc_mutex_lock (&watcher->mutex);
+
+   while ((entry = mongoc_tailer_next (watcher->tailer, 0))) {
+      _mongoc_oplog_watcher_record (watcher, entry);
+   }
+
+   if (!watcher->failed && mongoc_tailer_error (watcher->tailer, &error)) {
+      MONGOC_WARNING ("Tailing the oplog failed, query caches are "
+                      "disabled: %s", error.message);
+      watcher->failed = true;
+   }
+
+   if (watcher->failed ||
+       watcher->seq - *seq > MONGOC_OPLOG_WATCHER_EVENTS) {
+      _mongoc_query_cache_invalidate (cache, NULL, NULL);
+      *seq = watcher->seq;
+   }
+
+   for (; *seq < watcher->seq; (*seq)++) {
+      bson_strncpy (ns, watcher->events [*seq % MONGOC_OPLOG_WATCHER_EVENTS],
+                    sizeof ns);
+
+      if ((dot = strchr (ns, '.'))) {
+         *dot = '\0';
+         _mongoc_query_cache_invalidate (cache, ns, dot + 1);
+      } else {
+         _mongoc_query_cache_invalidate (cache, ns, NULL);
+      }
+   }
+
+   mongoc_mutex_unlock (&watcher->mutex);
+}
+
+
+bool
+mongoc_oplog_watcher_error (mongoc_oplog_watcher_t *watcher,
+                            bson_error_t           *error)
+{
+   bson_return_val_if_fail (watcher, false);
+
+   return mongoc_tailer_error (watcher->tailer, error);
+}
+
+
+void
+mongoc_oplog_watcher_destroy (mongoc_oplog_watcher_t *watcher)
+{
+   ENTRY;
+
+   bson_return_if_fail (watcher);
+
+   mongoc_tailer_destroy (watcher->tailer);
+   mongoc_mutex_destroy (&watcher->mutex);
+   bson_free (watcher->events);
+   bson_free (watcher);
+
+   EXIT;
+}
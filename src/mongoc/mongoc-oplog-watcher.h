@@ -0,0 +1,47 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_OPLOG_WATCHER_H
+#define MONGOC_OPLOG_WATCHER_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-client-pool.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_oplog_watcher_t mongoc_oplog_watcher_t;
+
+
+mongoc_oplog_watcher_t *mongoc_oplog_watcher_new              (mongoc_client_pool_t   *pool,
+                                                               bson_error_t           *error);
+bool                    mongoc_oplog_watcher_error            (mongoc_oplog_watcher_t *watcher,
+                                                               bson_error_t           *error);
+void                    mongoc_oplog_watcher_destroy          (mongoc_oplog_watcher_t *watcher);
+void                    mongoc_client_set_query_cache_watcher (mongoc_client_t        *client,
+                                                               mongoc_oplog_watcher_t *watcher);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_OPLOG_WATCHER_H */
@@ -0,0 +1,771 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-array-private.h"
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-parallel-find.h"
+#include "mongoc-queue-private.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "parallel-find"
+
+
+/*
+ * The query is split into more ranges than there are workers so that a
+ * worker that finishes early usually finds queued work, and only steals
+ * from a busy worker once the queue runs dry. Ranges with fewer documents
+ * left than MONGOC_PARALLEL_FIND_MIN_STEAL are not worth splitting.
+ */
+#define MONGOC_PARALLEL_FIND_RANGES_PER_WORKER 4
+#define MONGOC_PARALLEL_FIND_MIN_STEAL         1024
+
+
+typedef struct
+{
+   bool         has_lower;
+   bool         lower_inclusive;
+   bson_value_t lower;
+   bool         has_upper;
+   bson_value_t upper;
+   int64_t      estimate;
+} mongoc_parallel_find_range_t;
+
+
+typedef struct _mongoc_parallel_find_t mongoc_parallel_find_t;
+
+
+typedef struct
+{
+   mongoc_parallel_find_t *find;
+   mongoc_thread_t         thread;
+   bool                    busy;
+   bool                    steal;
+   int64_t                 remaining;
+} mongoc_parallel_find_worker_t;
+
+
+struct _mongoc_parallel_find_t
+{
+   mongoc_client_pool_t          *pool;
+   const char                    *db;
+   const char                    *collection;
+   const bson_t                  *query;
+   const bson_t                  *fields;
+   mongoc_parallel_find_cb_t      cb;
+   void                          *data;
+
+   mongoc_mutex_t                 mutex;
+   mongoc_cond_t                  cond;
+   mongoc_queue_t                 ranges;
+   uint32_t                       active;
+   bool                           stop;
+   bool                           failed;
+   bson_error_t                   error;
+
+   mongoc_parallel_find_worker_t *workers;
+   uint32_t                       n_workers;
+};
+
+
+static mongoc_parallel_find_range_t *
+_mongoc_parallel_find_range_new (const bson_value_t *lower,
+                                 bool                lower_inclusive,
+                                 const bson_value_t *upper,
+                                 int64_t             estimate)
+{
+   mongoc_parallel_find_range_t *range;
+
+   range = bson_malloc0 (sizeof *range);
+
+   if (lower) {
+      range->has_lower = true;
+      range->lower_inclusive = lower_inclusive;
+      bson_value_copy (lower, &range->lower);
+   }
+
+   if (upper) {
+      range->has_upper = true;
+      bson_value_copy (upper, &range->upper);
+   }
+
+   range->estimate = estimate;
+
+   return range;
+}
+
+
+static void
+_mongoc_parallel_find_range_destroy (mongoc_parallel_find_range_t *range)
+{
+   if (range->has_lower) {
+      bson_value_destroy (&range->lower);
+   }
+
+   if (range->has_upper) {
+      bson_value_destroy (&range->upper);
+   }
+
+   bson_free (range);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_parallel_find_range_filter --
+ *
+ *       Appends the query restricted to the _id range of @range to
+ *       @filter.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_parallel_find_range_filter (mongoc_parallel_find_t             *find,
+                                    const mongoc_parallel_find_range_t *range,
+                                    bson_t                             *filter)
+{
+   bson_t and;
+   bson_t child;
+   bson_t id;
+
+   bson_append_array_begin (filter, "$and", 4, &and);
+   BSON_APPEND_DOCUMENT (&and, "0", find->query);
+
+   if (range->has_lower || range->has_upper) {
+      bson_append_document_begin (&and, "1", 1, &child);
+      bson_append_document_begin (&child, "_id", 3, &id);
+      if (range->has_lower) {
+         BSON_APPEND_VALUE (&id, range->lower_inclusive ? "$gte" : "$gt",
+                            &range->lower);
+      }
+      if (range->has_upper) {
+         BSON_APPEND_VALUE (&id, "$lt", &range->upper);
+      }
+      bson_append_document_end (&child, &id);
+      bson_append_document_end (&and, &child);
+   }
+
+   bson_append_array_end (filter, &and);
+}
+
+
+static void
+_mongoc_parallel_find_sorted (const bson_t *filter,
+                              bson_t       *query)
+{
+   bson_t child;
+
+   BSON_APPEND_DOCUMENT (query, "$query", filter);
+   BSON_APPEND_DOCUMENT_BEGIN (query, "$orderby", &child);
+   BSON_APPEND_INT32 (&child, "_id", 1);
+   bson_append_document_end (query, &child);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_parallel_find_split_point --
+ *
+ *       Fetches the _id of the document @skip documents into @filter in
+ *       _id order.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set. @found is
+ *       false if there are no more than @skip documents.
+ *
+ * Side effects:
+ *       @value is initialized if @found is true.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_parallel_find_split_point (mongoc_collection_t *collection,
+                                   const bson_t        *filter,
+                                   int64_t              skip,
+                                   bson_value_t        *value,
+                                   bool                *found,
+                                   bson_error_t        *error)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t fields = BSON_INITIALIZER;
+   bson_t query = BSON_INITIALIZER;
+   bool ret;
+
+   *found = false;
+
+   _mongoc_parallel_find_sorted (filter, &query);
+   BSON_APPEND_INT32 (&fields, "_id", 1);
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE,
+                                    (uint32_t)BSON_MIN (skip, UINT32_MAX), 1,
+                                    0, &query, &fields, NULL);
+
+   if (mongoc_cursor_next (cursor, &doc) &&
+       bson_iter_init_find (&iter, doc, "_id")) {
+      bson_value_copy (bson_iter_value (&iter), value);
+      *found = true;
+   }
+
+   ret = !mongoc_cursor_error (cursor, error);
+
+   if (!ret && *found) {
+      bson_value_destroy (value);
+      *found = false;
+   }
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&fields);
+   bson_destroy (&query);
+
+   return ret;
+}
+
+
+static void
+_mongoc_parallel_find_fail (mongoc_parallel_find_t *find,
+                            const bson_error_t     *error)
+{
+   mongoc_mutex_lock (&find->mutex);
+   if (!find->failed) {
+      find->failed = true;
+      memcpy (&find->error, error, sizeof find->error);
+   }
+   find->stop = true;
+   mongoc_cond_broadcast (&find->cond);
+   mongoc_mutex_unlock (&find->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_parallel_find_make_ranges --
+ *
+ *       Splits the _id space into about @n_ranges ranges and queues them.
+ *
+ *       The split points come from the splitVector command when the
+ *       server allows it. Otherwise, such as through mongos or without
+ *       the privilege, they are sampled from the documents matching the
+ *       query in _id order.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_parallel_find_make_ranges (mongoc_parallel_find_t *find,
+                                   mongoc_client_t        *client,
+                                   uint32_t                n_ranges,
+                                   bson_error_t           *error)
+{
+   mongoc_parallel_find_range_t *range;
+   mongoc_collection_t *collection;
+   mongoc_array_t splits;
+   const bson_value_t *lower = NULL;
+   bson_value_t *value;
+   bson_value_t split;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_iter_t id;
+   bson_t empty = BSON_INITIALIZER;
+   bson_t reply;
+   bson_t key;
+   bson_t cmd;
+   int64_t count;
+   int64_t total;
+   bool found;
+   bool ret = false;
+   size_t i;
+   char ns [140];
+
+   ENTRY;
+
+   collection = mongoc_client_get_collection (client, find->db,
+                                              find->collection);
+
+   _mongoc_array_init (&splits, sizeof (bson_value_t));
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE,
+                                    find->query, 0, 0, NULL, error);
+   if (count < 0) {
+      GOTO (cleanup);
+   }
+
+   if (n_ranges > 1 && count >= n_ranges) {
+      total = mongoc_collection_count (collection, MONGOC_QUERY_NONE, &empty,
+                                       0, 0, NULL, NULL);
+
+      bson_snprintf (ns, sizeof ns, "%s.%s", find->db, find->collection);
+
+      bson_init (&cmd);
+      BSON_APPEND_UTF8 (&cmd, "splitVector", ns);
+      BSON_APPEND_DOCUMENT_BEGIN (&cmd, "keyPattern", &key);
+      BSON_APPEND_INT32 (&key, "_id", 1);
+      bson_append_document_end (&cmd, &key);
+      BSON_APPEND_INT64 (&cmd, "maxChunkObjects",
+                         BSON_MAX (1, total / n_ranges));
+
+      if (total > 0) {
+         if (mongoc_client_command_simple (client, find->db, &cmd, NULL,
+                                           &reply, NULL) &&
+             bson_iter_init_find (&iter, &reply, "splitKeys") &&
+             BSON_ITER_HOLDS_ARRAY (&iter) &&
+             bson_iter_recurse (&iter, &child)) {
+            while (bson_iter_next (&child)) {
+               if (BSON_ITER_HOLDS_DOCUMENT (&child) &&
+                   bson_iter_recurse (&child, &id) &&
+                   bson_iter_find (&id, "_id")) {
+                  bson_value_copy (bson_iter_value (&id), &split);
+                  _mongoc_array_append_val (&splits, split);
+               }
+            }
+         }
+
+         bson_destroy (&reply);
+      }
+
+      bson_destroy (&cmd);
+
+      if (!splits.len) {
+         for (i = 1; i < n_ranges; i++) {
+            if (!_mongoc_parallel_find_split_point (collection, find->query,
+                                                    (count * i) / n_ranges,
+                                                    &split, &found, error)) {
+               GOTO (cleanup);
+            }
+
+            if (!found) {
+               break;
+            }
+
+            _mongoc_array_append_val (&splits, split);
+         }
+      }
+   }
+
+   for (i = 0; i < splits.len; i++) {
+      value = &_mongoc_array_index (&splits, bson_value_t, i);
+      range = _mongoc_parallel_find_range_new (lower, true, value,
+                                               count / (splits.len + 1));
+      _mongoc_queue_push_tail (&find->ranges, range);
+      lower = value;
+   }
+
+   range = _mongoc_parallel_find_range_new (lower, true, NULL,
+                                            count / (splits.len + 1));
+   _mongoc_queue_push_tail (&find->ranges, range);
+
+   ret = true;
+
+cleanup:
+   for (i = 0; i < splits.len; i++) {
+      bson_value_destroy (&_mongoc_array_index (&splits, bson_value_t, i));
+   }
+
+   _mongoc_array_destroy (&splits);
+   mongoc_collection_destroy (collection);
+   bson_destroy (&empty);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_parallel_find_split --
+ *
+ *       Gives away the upper half of what is left of @range, which is
+ *       everything after the document with the _id @last. Called by the
+ *       worker iterating @range after an idle worker asked for work.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set. @split is
+ *       true if @range was narrowed.
+ *
+ * Side effects:
+ *       Queues the upper half for an idle worker.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_parallel_find_split (mongoc_parallel_find_worker_t *worker,
+                             mongoc_collection_t           *collection,
+                             mongoc_parallel_find_range_t  *range,
+                             const bson_value_t            *last,
+                             bool                          *split,
+                             bson_error_t                  *error)
+{
+   mongoc_parallel_find_t *find = worker->find;
+   mongoc_parallel_find_range_t *rest;
+   mongoc_parallel_find_range_t *stolen = NULL;
+   bson_value_t mid;
+   bson_t filter = BSON_INITIALIZER;
+   int64_t count;
+   bool found = false;
+   bool ret = false;
+
+   ENTRY;
+
+   *split = false;
+
+   rest = _mongoc_parallel_find_range_new (last, false,
+                                           range->has_upper ? &range->upper
+                                                            : NULL,
+                                           0);
+   _mongoc_parallel_find_range_filter (find, rest, &filter);
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, &filter,
+                                    0, 0, NULL, error);
+   if (count < 0) {
+      GOTO (cleanup);
+   }
+
+   if (count >= 2 &&
+       !_mongoc_parallel_find_split_point (collection, &filter, count / 2,
+                                           &mid, &found, error)) {
+      GOTO (cleanup);
+   }
+
+   if (found) {
+      stolen = _mongoc_parallel_find_range_new (&mid, true,
+                                                rest->has_upper ? &rest->upper
+                                                                : NULL,
+                                                count - (count / 2));
+
+      if (range->has_lower) {
+         bson_value_destroy (&range->lower);
+      }
+      bson_value_copy (last, &range->lower);
+      range->has_lower = true;
+      range->lower_inclusive = false;
+
+      if (range->has_upper) {
+         bson_value_destroy (&range->upper);
+      }
+      memcpy (&range->upper, &mid, sizeof mid);
+      range->has_upper = true;
+
+      *split = true;
+   }
+
+   mongoc_mutex_lock (&find->mutex);
+   worker->remaining = found ? count / 2 : count;
+   if (stolen) {
+      _mongoc_queue_push_tail (&find->ranges, stolen);
+   }
+   mongoc_cond_broadcast (&find->cond);
+   mongoc_mutex_unlock (&find->mutex);
+
+   ret = true;
+
+cleanup:
+   _mongoc_parallel_find_range_destroy (rest);
+   bson_destroy (&filter);
+
+   RETURN (ret);
+}
+
+
+static bool
+_mongoc_parallel_find_process (mongoc_parallel_find_worker_t *worker,
+                               mongoc_collection_t           *collection,
+                               mongoc_parallel_find_range_t  *range,
+                               bson_error_t                  *error)
+{
+   mongoc_parallel_find_t *find = worker->find;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t filter;
+   bson_t query;
+   bool restart;
+   bool steal;
+   bool split;
+   bool stop;
+   bool ret;
+
+   ENTRY;
+
+   do {
+      restart = false;
+
+      bson_init (&filter);
+      bson_init (&query);
+      _mongoc_parallel_find_range_filter (find, range, &filter);
+      _mongoc_parallel_find_sorted (&filter, &query);
+
+      cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                       &query, find->fields, NULL);
+
+      while (mongoc_cursor_next (cursor, &doc)) {
+         stop = !find->cb (doc, find->data);
+
+         mongoc_mutex_lock (&find->mutex);
+         if (stop) {
+            find->stop = true;
+            mongoc_cond_broadcast (&find->cond);
+         }
+         stop = find->stop;
+         steal = worker->steal;
+         worker->steal = false;
+         worker->remaining--;
+         mongoc_mutex_unlock (&find->mutex);
+
+         if (stop) {
+            break;
+         }
+
+         /*
+          * An idle worker asked for work. Hand it the upper half of what is
+          * left and continue with the lower half from the next document.
+          */
+         if (steal && bson_iter_init_find (&iter, doc, "_id")) {
+            if (!_mongoc_parallel_find_split (worker, collection, range,
+                                              bson_iter_value (&iter),
+                                              &split, error)) {
+               mongoc_cursor_destroy (cursor);
+               bson_destroy (&filter);
+               bson_destroy (&query);
+               RETURN (false);
+            }
+
+            if (split) {
+               restart = true;
+               break;
+            }
+         }
+      }
+
+      ret = !mongoc_cursor_error (cursor, error);
+
+      mongoc_cursor_destroy (cursor);
+      bson_destroy (&filter);
+      bson_destroy (&query);
+   } while (ret && restart);
+
+   RETURN (ret);
+}
+
+
+static void *
+_mongoc_parallel_find_worker_run (void *data)
+{
+   mongoc_parallel_find_worker_t *worker = data;
+   mongoc_parallel_find_worker_t *victim;
+   mongoc_parallel_find_range_t *range;
+   mongoc_parallel_find_t *find = worker->find;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   uint32_t i;
+   bool ok;
+
+   client = mongoc_client_pool_pop (find->pool);
+   collection = mongoc_client_get_collection (client, find->db,
+                                              find->collection);
+
+   mongoc_mutex_lock (&find->mutex);
+
+   while (!find->stop) {
+      if ((range = _mongoc_queue_pop_head (&find->ranges))) {
+         worker->busy = true;
+         worker->steal = false;
+         worker->remaining = range->estimate;
+         find->active++;
+         mongoc_mutex_unlock (&find->mutex);
+
+         ok = _mongoc_parallel_find_process (worker, collection, range,
+                                             &error);
+         _mongoc_parallel_find_range_destroy (range);
+
+         if (!ok) {
+            _mongoc_parallel_find_fail (find, &error);
+         }
+
+         mongoc_mutex_lock (&find->mutex);
+         worker->busy = false;
+         worker->steal = false;
+         find->active--;
+         mongoc_cond_broadcast (&find->cond);
+         continue;
+      }
+
+      if (!find->active) {
+         break;
+      }
+
+      /*
+       * Nothing queued, ask the worker with the most documents left to
+       * split its range.
+       */
+      victim = NULL;
+
+      for (i = 0; i < find->n_workers; i++) {
+         if (find->workers[i].busy &&
+             !find->workers[i].steal &&
+             find->workers[i].remaining >= MONGOC_PARALLEL_FIND_MIN_STEAL &&
+             (!victim || find->workers[i].remaining > victim->remaining)) {
+            victim = &find->workers[i];
+         }
+      }
+
+      if (victim) {
+         victim->steal = true;
+      }
+
+      mongoc_cond_wait (&find->cond, &find->mutex);
+   }
+
+   mongoc_mutex_unlock (&find->mutex);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (find->pool, client);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_client_pool_parallel_find --
+ *
+ *       Runs @query against @db.@collection from @n_workers threads, each
+ *       with a client popped from @pool, calling @cb for every matching
+ *       document.
+ *
+ *       The _id space is split into ranges that are queued for the
+ *       workers. A worker that runs out of queued ranges asks the busiest
+ *       worker to split its range and takes the upper half.
+ *
+ *       @cb is called concurrently from the worker threads. Returning
+ *       false from it stops the find.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_client_pool_parallel_find (mongoc_client_pool_t      *pool,
+                                  const char                *db,
+                                  const char                *collection,
+                                  const bson_t              *query,
+                                  const bson_t              *fields,
+                                  uint32_t                   n_workers,
+                                  mongoc_parallel_find_cb_t  cb,
+                                  void                      *data,
+                                  bson_error_t              *error)
+{
+   mongoc_parallel_find_range_t *range;
+   mongoc_parallel_find_t find;
+   mongoc_client_t *client;
+   bson_t empty = BSON_INITIALIZER;
+   uint32_t i;
+   bool ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, false);
+   bson_return_val_if_fail (db, false);
+   bson_return_val_if_fail (collection, false);
+   bson_return_val_if_fail (n_workers, false);
+   bson_return_val_if_fail (cb, false);
+
+   memset (&find, 0, sizeof find);
+
+   find.pool = pool;
+   find.db = db;
+   find.collection = collection;
+   find.query = query ? query : &empty;
+   find.fields = fields;
+   find.cb = cb;
+   find.data = data;
+   find.n_workers = n_workers;
+
+   mongoc_mutex_init (&find.mutex);
+   mongoc_cond_init (&find.cond);
+   _mongoc_queue_init (&find.ranges);
+
+   client = mongoc_client_pool_pop (pool);
+   ret = _mongoc_parallel_find_make_ranges (
+      &find, client, n_workers * MONGOC_PARALLEL_FIND_RANGES_PER_WORKER,
+      error);
+   mongoc_client_pool_push (pool, client);
+
+   if (ret) {
+      find.workers = bson_malloc0 (n_workers * sizeof *find.workers);
+
+      for (i = 0; i < n_workers; i++) {
+         find.workers[i].find = &find;
+         mongoc_thread_create (&find.workers[i].thread,
+                               _mongoc_parallel_find_worker_run,
+                               &find.workers[i]);
+      }
+
+      for (i = 0; i < n_workers; i++) {
+         mongoc_thread_join (find.workers[i].thread);
+      }
+
+      if (find.failed) {
+         if (error) {
+            memcpy (error, &find.error, sizeof *error);
+         }
+         ret = false;
+      }
+
+      bson_free (find.workers);
+   }
+
+   while ((range = _mongoc_queue_pop_head (&find.ranges))) {
+      _mongoc_parallel_find_range_destroy (range);
+   }
+
+   mongoc_cond_destroy (&find.cond);
+   mongoc_mutex_destroy (&find.mutex);
+   bson_destroy (&empty);
+
+   RETURN (ret);
+}
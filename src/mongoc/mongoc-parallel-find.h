@@ -0,0 +1,50 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_PARALLEL_FIND_H
+#define MONGOC_PARALLEL_FIND_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-client-pool.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef bool (*mongoc_parallel_find_cb_t) (const bson_t *doc,
+                                           void         *data);
+
+
+bool mongoc_client_pool_parallel_find (mongoc_client_pool_t      *pool,
+                                       const char                *db,
+                                       const char                *collection,
+                                       const bson_t              *query,
+                                       const bson_t              *fields,
+                                       uint32_t                   n_workers,
+                                       mongoc_parallel_find_cb_t  cb,
+                                       void                      *data,
+                                       bson_error_t              *error);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_PARALLEL_FIND_H */
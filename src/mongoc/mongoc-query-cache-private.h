@@ -0,0 +1,135 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_QUERY_CACHE_PRIVATE_H
+#define MONGOC_QUERY_CACHE_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-flags.h"
+#include "mongoc-read-prefs.h"
+#include "mongoc-thread-private.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_query_cache_entry_t mongoc_query_cache_entry_t;
+
+
+/*
+ * The results of a find that fit in its first reply, as an array
+ * document for mongoc-cursor-array.c. Entries are kept most recently
+ * used first.
+ */
+struct _mongoc_query_cache_entry_t
+{
+   mongoc_query_cache_entry_t *prev;
+   mongoc_query_cache_entry_t *next;
+   char                        ns [140];
+   uint32_t                    hash;
+   bson_t                     *key;
+   bson_t                      docs;
+   int64_t                     expire_at;
+};
+
+
+typedef struct
+{
+   mongoc_query_cache_entry_t *head;
+   mongoc_query_cache_entry_t *tail;
+   uint32_t                    n_entries;
+   uint32_t                    max_entries;
+   int64_t                     ttl_usec;
+} mongoc_query_cache_t;
+
+
+/*
+ * A query on the wire that identical queries started meanwhile, on other
+ * clients of a pool, wait for instead of sending their own. Flights are
+ * kept until they land and the last waiter has copied the results.
+ */
+typedef struct _mongoc_query_flight_t mongoc_query_flight_t;
+
+
+struct _mongoc_query_flight_t
+{
+   mongoc_query_flight_t *prev;
+   mongoc_query_flight_t *next;
+   char                   ns [140];
+   uint32_t               hash;
+   bson_t                *key;
+   mongoc_cond_t          cond;
+   uint32_t               refs;
+   bool                   landed;
+   bool                   shared;
+   bson_t                 docs;
+};
+
+
+typedef struct
+{
+   mongoc_mutex_t         mutex;
+   mongoc_query_flight_t *head;
+} mongoc_query_flights_t;
+
+
+void          _mongoc_query_cache_init       (mongoc_query_cache_t      *cache);
+void          _mongoc_query_cache_destroy    (mongoc_query_cache_t      *cache);
+void          _mongoc_query_cache_configure  (mongoc_query_cache_t      *cache,
+                                              uint32_t                   max_entries,
+                                              int64_t                    ttl_msec);
+bson_t       *_mongoc_query_cache_key        (mongoc_query_flags_t       flags,
+                                              uint32_t                   skip,
+                                              uint32_t                   limit,
+                                              const bson_t              *query,
+                                              const bson_t              *fields,
+                                              const mongoc_read_prefs_t *read_prefs);
+const bson_t *_mongoc_query_cache_lookup     (mongoc_query_cache_t      *cache,
+                                              const char                *ns,
+                                              const bson_t              *key);
+void          _mongoc_query_cache_add        (mongoc_query_cache_t      *cache,
+                                              const char                *ns,
+                                              bson_t                    *key,
+                                              const uint8_t             *documents,
+                                              uint32_t                   documents_len);
+void          _mongoc_query_cache_invalidate (mongoc_query_cache_t      *cache,
+                                              const char                *db,
+                                              const char                *collection);
+
+void                   _mongoc_query_flights_init     (mongoc_query_flights_t *flights);
+void                   _mongoc_query_flights_destroy  (mongoc_query_flights_t *flights);
+bool                   _mongoc_query_flights_join     (mongoc_query_flights_t *flights,
+                                                       const char             *ns,
+                                                       const bson_t           *key,
+                                                       bson_t                 *docs);
+mongoc_query_flight_t *_mongoc_query_flights_take_off (mongoc_query_flights_t *flights,
+                                                       const char             *ns,
+                                                       const bson_t           *key);
+void                   _mongoc_query_flights_land     (mongoc_query_flights_t *flights,
+                                                       mongoc_query_flight_t  *flight,
+                                                       const uint8_t          *documents,
+                                                       uint32_t                documents_len);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_QUERY_CACHE_PRIVATE_H */
@@ -0,0 +1,621 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <string.h>
+
+#include "mongoc-query-cache-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "query-cache"
+
+
+static uint32_t
+_mongoc_query_cache_hash (const bson_t *key)
+{
+   const uint8_t *data;
+   uint32_t hash = 2166136261u;
+   uint32_t i;
+
+   data = bson_get_data (key);
+
+   for (i = 0; i < key->len; i++) {
+      hash = (hash ^ data [i]) * 16777619u;
+   }
+
+   return hash;
+}
+
+
+/*
+ * Append the documents of an OP_REPLY to @docs as an array document, as
+ * mongoc-cursor-array.c iterates them. Returns false if they are corrupt.
+ */
+static bool
+_mongoc_query_cache_build_docs (const uint8_t *documents,
+                                uint32_t       documents_len,
+                                bson_t        *docs)
+{
+   bson_reader_t *reader;
+   const bson_t *doc;
+   const char *idx;
+   char str[16];
+   uint32_t i = 0;
+   bool eof = false;
+
+   reader = bson_reader_new_from_data (documents, documents_len);
+
+   while ((doc = bson_reader_read (reader, &eof))) {
+      bson_uint32_to_string (i++, &idx, str, sizeof str);
+      bson_append_document (docs, idx, -1, doc);
+   }
+
+   bson_reader_destroy (reader);
+
+   return eof;
+}
+
+
+static void
+_mongoc_query_cache_unlink (mongoc_query_cache_t       *cache,
+                            mongoc_query_cache_entry_t *entry)
+{
+   if (entry->prev) {
+      entry->prev->next = entry->next;
+   } else {
+      cache->head = entry->next;
+   }
+
+   if (entry->next) {
+      entry->next->prev = entry->prev;
+   } else {
+      cache->tail = entry->prev;
+   }
+
+   entry->prev = NULL;
+   entry->next = NULL;
+}
+
+
+static void
+_mongoc_query_cache_push_head (mongoc_query_cache_t       *cache,
+                               mongoc_query_cache_entry_t *entry)
+{
+   entry->prev = NULL;
+   entry->next = cache->head;
+
+   if (cache->head) {
+      cache->head->prev = entry;
+   } else {
+      cache->tail = entry;
+   }
+
+   cache->head = entry;
+}
+
+
+static void
+_mongoc_query_cache_remove (mongoc_query_cache_t       *cache,
+                            mongoc_query_cache_entry_t *entry)
+{
+   _mongoc_query_cache_unlink (cache, entry);
+   cache->n_entries--;
+
+   bson_destroy (entry->key);
+   bson_destroy (&entry->docs);
+   bson_free (entry);
+}
+
+
+void
+_mongoc_query_cache_init (mongoc_query_cache_t *cache)
+{
+   memset (cache, 0, sizeof *cache);
+}
+
+
+void
+_mongoc_query_cache_destroy (mongoc_query_cache_t *cache)
+{
+   while (cache->head) {
+      _mongoc_query_cache_remove (cache, cache->head);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_cache_configure --
+ *
+ *       Keep up to @max_entries results in @cache, each for @ttl_msec
+ *       or until evicted if @ttl_msec is 0. A @max_entries of 0 turns
+ *       the cache off.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The least recently used entries over @max_entries are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_query_cache_configure (mongoc_query_cache_t *cache,
+                               uint32_t              max_entries,
+                               int64_t               ttl_msec)
+{
+   cache->max_entries = max_entries;
+   cache->ttl_usec = ttl_msec > 0 ? ttl_msec * 1000 : 0;
+
+   while (cache->n_entries > cache->max_entries) {
+      _mongoc_query_cache_remove (cache, cache->tail);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_cache_key --
+ *
+ *       Build the key of a find with these arguments. The batch size is
+ *       left out since it does not change the results.
+ *
+ * Returns:
+ *       A newly allocated bson_t to free with bson_destroy(), or give to
+ *       _mongoc_query_cache_add().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bson_t *
+_mongoc_query_cache_key (mongoc_query_flags_t       flags,
+                         uint32_t                   skip,
+                         uint32_t                   limit,
+                         const bson_t              *query,
+                         const bson_t              *fields,
+                         const mongoc_read_prefs_t *read_prefs)
+{
+   const bson_t *tags;
+   bson_t *key;
+
+   key = bson_new ();
+
+   bson_append_int32 (key, "flags", 5, (int32_t)flags);
+   bson_append_int32 (key, "skip", 4, (int32_t)skip);
+   bson_append_int32 (key, "limit", 5, (int32_t)limit);
+   bson_append_document (key, "query", 5, query);
+
+   if (fields) {
+      bson_append_document (key, "fields", 6, fields);
+   }
+
+   if (read_prefs) {
+      bson_append_int32 (key, "mode", 4,
+                         (int32_t)mongoc_read_prefs_get_mode (read_prefs));
+      bson_append_int64 (key, "maxStalenessMS", 14,
+                         mongoc_read_prefs_get_max_staleness_ms (read_prefs));
+
+      if ((tags = mongoc_read_prefs_get_tags (read_prefs))) {
+         bson_append_array (key, "tags", 4, tags);
+      }
+   }
+
+   return key;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_cache_lookup --
+ *
+ *       Find the results of the query @key on @ns.
+ *
+ * Returns:
+ *       An array document of the results, valid until @cache is next
+ *       changed, or NULL if they are not cached or have expired.
+ *
+ * Side effects:
+ *       A hit becomes the most recently used entry. An expired entry is
+ *       dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_t *
+_mongoc_query_cache_lookup (mongoc_query_cache_t *cache,
+                            const char           *ns,
+                            const bson_t         *key)
+{
+   mongoc_query_cache_entry_t *entry;
+   uint32_t hash;
+
+   ENTRY;
+
+   if (!cache->n_entries) {
+      RETURN (NULL);
+   }
+
+   hash = _mongoc_query_cache_hash (key);
+
+   for (entry = cache->head; entry; entry = entry->next) {
+      if (entry->hash == hash &&
+          entry->key->len == key->len &&
+          !memcmp (bson_get_data (entry->key), bson_get_data (key), key->len) &&
+          !strcmp (entry->ns, ns)) {
+         break;
+      }
+   }
+
+   if (!entry) {
+      RETURN (NULL);
+   }
+
+   if (entry->expire_at && entry->expire_at <= bson_get_monotonic_time ()) {
+      _mongoc_query_cache_remove (cache, entry);
+      RETURN (NULL);
+   }
+
+   _mongoc_query_cache_unlink (cache, entry);
+   _mongoc_query_cache_push_head (cache, entry);
+
+   RETURN (&entry->docs);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_cache_add --
+ *
+ *       Cache @documents, the whole result of the query @key on @ns, as
+ *       received in an OP_REPLY.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @cache takes ownership of @key. A previous entry for @key and
+ *       the least recently used entry over the limit are dropped.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_query_cache_add (mongoc_query_cache_t *cache,
+                         const char           *ns,
+                         bson_t               *key,
+                         const uint8_t        *documents,
+                         uint32_t              documents_len)
+{
+   mongoc_query_cache_entry_t *entry;
+
+   ENTRY;
+
+   if (!cache->max_entries) {
+      bson_destroy (key);
+      EXIT;
+   }
+
+   entry = bson_malloc0 (sizeof *entry);
+   bson_strncpy (entry->ns, ns, sizeof entry->ns);
+   entry->hash = _mongoc_query_cache_hash (key);
+   entry->key = key;
+   bson_init (&entry->docs);
+
+   if (!_mongoc_query_cache_build_docs (documents, documents_len,
+                                        &entry->docs)) {
+      /* a corrupt reply, the cursor fails on it too */
+      bson_destroy (entry->key);
+      bson_destroy (&entry->docs);
+      bson_free (entry);
+      EXIT;
+   }
+
+   if (cache->ttl_usec) {
+      entry->expire_at = bson_get_monotonic_time () + cache->ttl_usec;
+   }
+
+   if (_mongoc_query_cache_lookup (cache, ns, key)) {
+      _mongoc_query_cache_remove (cache, cache->head);
+   }
+
+   _mongoc_query_cache_push_head (cache, entry);
+   cache->n_entries++;
+
+   if (cache->n_entries > cache->max_entries) {
+      _mongoc_query_cache_remove (cache, cache->tail);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_cache_invalidate --
+ *
+ *       Drop the cached results of queries on @collection in @db, of
+ *       every collection in @db if @collection is NULL, or of everything
+ *       if @db is NULL too.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_query_cache_invalidate (mongoc_query_cache_t *cache,
+                                const char           *db,
+                                const char           *collection)
+{
+   mongoc_query_cache_entry_t *entry;
+   mongoc_query_cache_entry_t *next;
+   size_t db_len = 0;
+
+   if (!cache->n_entries) {
+      return;
+   }
+
+   if (db) {
+      db_len = strlen (db);
+   }
+
+   for (entry = cache->head; entry; entry = next) {
+      next = entry->next;
+
+      if (!db ||
+          (!strncmp (entry->ns, db, db_len) &&
+           entry->ns [db_len] == '.' &&
+           (!collection || !strcmp (entry->ns + db_len + 1, collection)))) {
+         _mongoc_query_cache_remove (cache, entry);
+      }
+   }
+}
+
+
+void
+_mongoc_query_flights_init (mongoc_query_flights_t *flights)
+{
+   memset (flights, 0, sizeof *flights);
+   mongoc_mutex_init (&flights->mutex);
+}
+
+
+void
+_mongoc_query_flights_destroy (mongoc_query_flights_t *flights)
+{
+   /* every flight has landed once the clients using @flights are gone */
+   BSON_ASSERT (!flights->head);
+
+   mongoc_mutex_destroy (&flights->mutex);
+}
+
+
+static void
+_mongoc_query_flight_release (mongoc_query_flight_t *flight)
+{
+   if (--flight->refs) {
+      return;
+   }
+
+   mongoc_cond_destroy (&flight->cond);
+   bson_destroy (flight->key);
+   bson_destroy (&flight->docs);
+   bson_free (flight);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_flights_join --
+ *
+ *       Wait for the query @key on @ns if another cursor has it on the
+ *       wire, and take its results.
+ *
+ *       Only queries already sent can be joined, by a thread that is not
+ *       the one waiting for their reply.
+ *
+ * Returns:
+ *       true if @docs is initialized with an array document of the
+ *       results, to be freed with bson_destroy(). false if no such query
+ *       is in flight or its results could not be shared, in which case
+ *       the caller should send its own.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_query_flights_join (mongoc_query_flights_t *flights,
+                            const char             *ns,
+                            const bson_t           *key,
+                            bson_t                 *docs)
+{
+   mongoc_query_flight_t *flight;
+   uint32_t hash;
+   bool ret = false;
+
+   ENTRY;
+
+   hash = _mongoc_query_cache_hash (key);
+
+   mongoc_mutex_lock (&flights->mutex);
+
+   for (flight = flights->head; flight; flight = flight->next) {
+      if (flight->hash == hash &&
+          flight->key->len == key->len &&
+          !memcmp (bson_get_data (flight->key), bson_get_data (key),
+                   key->len) &&
+          !strcmp (flight->ns, ns)) {
+         break;
+      }
+   }
+
+   if (flight) {
+      flight->refs++;
+
+      while (!flight->landed) {
+         mongoc_cond_wait (&flight->cond, &flights->mutex);
+      }
+
+      if (flight->shared) {
+         bson_copy_to (&flight->docs, docs);
+         ret = true;
+      }
+
+      _mongoc_query_flight_release (flight);
+   }
+
+   mongoc_mutex_unlock (&flights->mutex);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_flights_take_off --
+ *
+ *       Announce that the query @key on @ns is being sent, so that
+ *       identical ones started meanwhile wait for its results.
+ *
+ * Returns:
+ *       A flight to pass to _mongoc_query_flights_land() once the reply
+ *       is in, or NULL if an identical query is in flight already.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_query_flight_t *
+_mongoc_query_flights_take_off (mongoc_query_flights_t *flights,
+                                const char             *ns,
+                                const bson_t           *key)
+{
+   mongoc_query_flight_t *flight;
+   uint32_t hash;
+
+   ENTRY;
+
+   hash = _mongoc_query_cache_hash (key);
+
+   mongoc_mutex_lock (&flights->mutex);
+
+   for (flight = flights->head; flight; flight = flight->next) {
+      if (flight->hash == hash &&
+          flight->key->len == key->len &&
+          !memcmp (bson_get_data (flight->key), bson_get_data (key),
+                   key->len) &&
+          !strcmp (flight->ns, ns)) {
+         mongoc_mutex_unlock (&flights->mutex);
+         RETURN (NULL);
+      }
+   }
+
+   flight = bson_malloc0 (sizeof *flight);
+   bson_strncpy (flight->ns, ns, sizeof flight->ns);
+   flight->hash = hash;
+   flight->key = bson_copy (key);
+   bson_init (&flight->docs);
+   mongoc_cond_init (&flight->cond);
+   flight->refs = 1;
+
+   flight->next = flights->head;
+   if (flights->head) {
+      flights->head->prev = flight;
+   }
+   flights->head = flight;
+
+   mongoc_mutex_unlock (&flights->mutex);
+
+   RETURN (flight);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_query_flights_land --
+ *
+ *       Hand @documents, the whole result of the query of @flight as
+ *       received in an OP_REPLY, to the cursors waiting for it. NULL
+ *       @documents have the waiters send their own query.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @flight is released.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_query_flights_land (mongoc_query_flights_t *flights,
+                            mongoc_query_flight_t  *flight,
+                            const uint8_t          *documents,
+                            uint32_t                documents_len)
+{
+   ENTRY;
+
+   mongoc_mutex_lock (&flights->mutex);
+
+   if (flight->prev) {
+      flight->prev->next = flight->next;
+   } else {
+      flights->head = flight->next;
+   }
+
+   if (flight->next) {
+      flight->next->prev = flight->prev;
+   }
+
+   /* only done if someone is waiting, they copy it under the lock */
+   if (documents && flight->refs > 1) {
+      flight->shared = _mongoc_query_cache_build_docs (documents,
+                                                       documents_len,
+                                                       &flight->docs);
+   }
+
+   flight->landed = true;
+   mongoc_cond_broadcast (&flight->cond);
+
+   _mongoc_query_flight_release (flight);
+
+   mongoc_mutex_unlock (&flights->mutex);
+
+   EXIT;
+}
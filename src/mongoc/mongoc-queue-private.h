@@ -29,7 +29,7 @@
 BSON_BEGIN_DECLS
 
 
-#define MONGOC_QUEUE_INITIALIZER {NULL,NULL}
+#define MONGOC_QUEUE_INITIALIZER {NULL,NULL,0}
 
 
 typedef struct _mongoc_queue_t      mongoc_queue_t;
@@ -40,6 +40,7 @@ struct _mongoc_queue_t
 {
    mongoc_queue_item_t *head;
    mongoc_queue_item_t *tail;
+   uint32_t             length;
 };
 
 
@@ -58,6 +59,19 @@ void      _mongoc_queue_push_tail  (mongoc_queue_t       *queue,
                                     void                 *data);
 uint32_t  _mongoc_queue_get_length (const mongoc_queue_t *queue);
 
+/*
+ * Intrusive variants: @item is embedded in the structure @data points to,
+ * so nothing is allocated or freed by the queue. A queue must hold either
+ * only intrusive items or only items pushed by the functions above.
+ */
+void      _mongoc_queue_push_head_item (mongoc_queue_t      *queue,
+                                        mongoc_queue_item_t *item,
+                                        void                *data);
+void      _mongoc_queue_push_tail_item (mongoc_queue_t      *queue,
+                                        mongoc_queue_item_t *item,
+                                        void                *data);
+void     *_mongoc_queue_pop_head_item  (mongoc_queue_t      *queue);
+
 
 BSON_END_DECLS
 
@@ -30,19 +30,19 @@ _mongoc_queue_init (mongoc_queue_t *queue)
 
 
 void
-_mongoc_queue_push_head (mongoc_queue_t *queue,
-                         void           *data)
+_mongoc_queue_push_head_item (mongoc_queue_t      *queue,
+                              mongoc_queue_item_t *item,
+                              void                *data)
 {
-   mongoc_queue_item_t *item;
-
    bson_return_if_fail(queue);
+   bson_return_if_fail(item);
    bson_return_if_fail(data);
 
-   item = bson_malloc0(sizeof *item);
    item->next = queue->head;
    item->data = data;
 
    queue->head = item;
+   queue->length++;
 
    if (!queue->tail) {
       queue->tail = item;
@@ -51,15 +51,15 @@ _mongoc_queue_push_head (mongoc_queue_t *queue,
 
 
 void
-_mongoc_queue_push_tail (mongoc_queue_t *queue,
-                         void           *data)
+_mongoc_queue_push_tail_item (mongoc_queue_t      *queue,
+                              mongoc_queue_item_t *item,
+                              void                *data)
 {
-   mongoc_queue_item_t *item;
-
    bson_return_if_fail(queue);
+   bson_return_if_fail(item);
    bson_return_if_fail(data);
 
-   item = bson_malloc0(sizeof *item);
+   item->next = NULL;
    item->data = data;
 
    if (queue->tail) {
@@ -69,11 +69,12 @@ _mongoc_queue_push_tail (mongoc_queue_t *queue,
    }
 
    queue->tail = item;
+   queue->length++;
 }
 
 
 void *
-_mongoc_queue_pop_head (mongoc_queue_t *queue)
+_mongoc_queue_pop_head_item (mongoc_queue_t *queue)
 {
    mongoc_queue_item_t *item;
    void *data = NULL;
@@ -85,25 +86,58 @@ _mongoc_queue_pop_head (mongoc_queue_t *queue)
          queue->tail = NULL;
       }
       queue->head = item->next;
+      queue->length--;
+      item->next = NULL;
       data = item->data;
-      bson_free(item);
    }
 
    return data;
 }
 
 
-uint32_t
-_mongoc_queue_get_length (const mongoc_queue_t *queue)
+void
+_mongoc_queue_push_head (mongoc_queue_t *queue,
+                         void           *data)
+{
+   bson_return_if_fail(queue);
+   bson_return_if_fail(data);
+
+   _mongoc_queue_push_head_item (queue, bson_malloc0 (sizeof (mongoc_queue_item_t)), data);
+}
+
+
+void
+_mongoc_queue_push_tail (mongoc_queue_t *queue,
+                         void           *data)
+{
+   bson_return_if_fail(queue);
+   bson_return_if_fail(data);
+
+   _mongoc_queue_push_tail_item (queue, bson_malloc0 (sizeof (mongoc_queue_item_t)), data);
+}
+
+
+void *
+_mongoc_queue_pop_head (mongoc_queue_t *queue)
 {
    mongoc_queue_item_t *item;
-   uint32_t count = 0;
+   void *data = NULL;
 
-   bson_return_val_if_fail(queue, 0);
+   bson_return_val_if_fail(queue, NULL);
 
-   for (item = queue->head; item; item = item->next) {
-      count++;
+   if ((item = queue->head)) {
+      data = _mongoc_queue_pop_head_item (queue);
+      bson_free(item);
    }
 
-   return count;
+   return data;
+}
+
+
+uint32_t
+_mongoc_queue_get_length (const mongoc_queue_t *queue)
+{
+   bson_return_val_if_fail(queue, 0);
+
+   return queue->length;
 }
@@ -34,11 +34,25 @@ struct _mongoc_read_prefs_t
 {
    mongoc_read_mode_t mode;
    bson_t             tags;
+   int64_t            max_staleness_msec;
+   mongoc_read_affinity_t affinity;
+   uint64_t           affinity_key;
+   volatile int32_t   ref_count;
+   bool               frozen;
 };
 
 
-int _mongoc_read_prefs_score (const mongoc_read_prefs_t   *read_prefs,
-                              const mongoc_cluster_node_t *node);
+int                  _mongoc_read_prefs_score  (const mongoc_read_prefs_t   *read_prefs,
+                                                const mongoc_cluster_node_t *node);
+int                  _mongoc_read_prefs_score_matched
+                                               (const mongoc_read_prefs_t   *read_prefs,
+                                                const mongoc_cluster_node_t *node,
+                                                int                          tag_score);
+bool                 _mongoc_read_prefs_tag_set_matches
+                                               (const bson_t                *tag_set,
+                                                const bson_t                *node_tags);
+void                 _mongoc_read_prefs_freeze (mongoc_read_prefs_t         *read_prefs);
+mongoc_read_prefs_t *_mongoc_read_prefs_share  (const mongoc_read_prefs_t   *read_prefs);
 
 
 BSON_END_DECLS
@@ -17,10 +17,22 @@
 
 #include <limits.h>
 
+#include "mongoc-log.h"
 #include "mongoc-read-prefs.h"
 #include "mongoc-read-prefs-private.h"
 
 
+static BSON_INLINE bool
+_mongoc_read_prefs_warn_frozen (mongoc_read_prefs_t *read_prefs)
+{
+   if (read_prefs->frozen) {
+      MONGOC_WARNING("Cannot modify a frozen read-preference.");
+   }
+
+   return read_prefs->frozen;
+}
+
+
 mongoc_read_prefs_t *
 mongoc_read_prefs_new (mongoc_read_mode_t mode)
 {
@@ -28,6 +40,7 @@ mongoc_read_prefs_new (mongoc_read_mode_t mode)
 
    read_prefs = bson_malloc0(sizeof *read_prefs);
    read_prefs->mode = mode;
+   read_prefs->ref_count = 1;
    bson_init(&read_prefs->tags);
 
    return read_prefs;
@@ -49,7 +62,9 @@ mongoc_read_prefs_set_mode (mongoc_read_prefs_t *read_prefs,
    bson_return_if_fail(read_prefs);
    bson_return_if_fail(mode <= MONGOC_READ_NEAREST);
 
-   read_prefs->mode = mode;
+   if (!_mongoc_read_prefs_warn_frozen(read_prefs)) {
+      read_prefs->mode = mode;
+   }
 }
 
 
@@ -67,6 +82,10 @@ mongoc_read_prefs_set_tags (mongoc_read_prefs_t *read_prefs,
 {
    bson_return_if_fail(read_prefs);
 
+   if (_mongoc_read_prefs_warn_frozen(read_prefs)) {
+      return;
+   }
+
    bson_destroy(&read_prefs->tags);
 
    if (tags) {
@@ -87,6 +106,10 @@ mongoc_read_prefs_add_tag (mongoc_read_prefs_t *read_prefs,
 
    BSON_ASSERT (read_prefs);
 
+   if (_mongoc_read_prefs_warn_frozen (read_prefs)) {
+      return;
+   }
+
    key = bson_count_keys (&read_prefs->tags);
    bson_snprintf (str, sizeof str, "%d", key);
 
@@ -98,16 +121,84 @@ mongoc_read_prefs_add_tag (mongoc_read_prefs_t *read_prefs,
 }
 
 
+int64_t
+mongoc_read_prefs_get_max_staleness_ms (const mongoc_read_prefs_t *read_prefs)
+{
+   bson_return_val_if_fail(read_prefs, 0);
+   return read_prefs->max_staleness_msec;
+}
+
+
+void
+mongoc_read_prefs_set_max_staleness_ms (mongoc_read_prefs_t *read_prefs,
+                                        int64_t              max_staleness_msec)
+{
+   bson_return_if_fail(read_prefs);
+   bson_return_if_fail(max_staleness_msec >= 0);
+
+   if (!_mongoc_read_prefs_warn_frozen(read_prefs)) {
+      read_prefs->max_staleness_msec = max_staleness_msec;
+   }
+}
+
+
+mongoc_read_affinity_t
+mongoc_read_prefs_get_affinity (const mongoc_read_prefs_t *read_prefs,
+                                uint64_t                  *key)
+{
+   bson_return_val_if_fail(read_prefs, MONGOC_READ_AFFINITY_NONE);
+
+   if (key) {
+      *key = read_prefs->affinity_key;
+   }
+
+   return read_prefs->affinity;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_read_prefs_set_affinity --
+ *
+ *       Have reads that may go to any of several nodes in the latency
+ *       window keep going to the same one, for the calling thread with
+ *       MONGOC_READ_AFFINITY_THREAD, or for @key with
+ *       MONGOC_READ_AFFINITY_KEY, as long as it stays in the window.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_read_prefs_set_affinity (mongoc_read_prefs_t    *read_prefs,
+                                mongoc_read_affinity_t  affinity,
+                                uint64_t                key)
+{
+   bson_return_if_fail(read_prefs);
+
+   if (!_mongoc_read_prefs_warn_frozen(read_prefs)) {
+      read_prefs->affinity = affinity;
+      read_prefs->affinity_key = key;
+   }
+}
+
+
 bool
 mongoc_read_prefs_is_valid (const mongoc_read_prefs_t *read_prefs)
 {
    bson_return_val_if_fail(read_prefs, false);
 
    /*
-    * Tags are not supported with PRIMARY mode.
+    * Tags and maxStalenessMS are not supported with PRIMARY mode.
     */
    if (read_prefs->mode == MONGOC_READ_PRIMARY) {
-      if (!bson_empty(&read_prefs->tags)) {
+      if (!bson_empty(&read_prefs->tags) || read_prefs->max_staleness_msec) {
          return false;
       }
    }
@@ -138,25 +229,75 @@ _contains_tag (const bson_t *b,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_read_prefs_tag_set_matches --
+ *
+ *       Check whether a node with @node_tags satisfies the single tag set
+ *       @tag_set, that is, whether it has every tag of the set.
+ *
+ * Returns:
+ *       true if the node satisfies @tag_set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_read_prefs_tag_set_matches (const bson_t *tag_set,
+                                    const bson_t *node_tags)
+{
+   bson_iter_t iter;
+   const char *key;
+   const char *str;
+   uint32_t len;
+
+   bson_return_val_if_fail(tag_set, false);
+   bson_return_val_if_fail(node_tags, false);
+
+   if (!bson_iter_init(&iter, tag_set)) {
+      return false;
+   }
+
+   /* Iterate over the key/value pairs (tags) in the set */
+   while (bson_iter_next(&iter) && BSON_ITER_HOLDS_UTF8(&iter)) {
+      key = bson_iter_key(&iter);
+      str = bson_iter_utf8(&iter, &len);
+
+      /* If any of the tags do not match, this node cannot satisfy this tag set. */
+      if (!_contains_tag(node_tags, key, str, len)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
 static int
 _score_tags (const bson_t *read_tags,
              const bson_t *node_tags)
 {
    uint32_t len;
    bson_iter_t iter;
-   bson_iter_t sub_iter;
-   const char *key;
-   const char *str;
+   const uint8_t *data;
+   bson_t tag_set;
    int count;
-   bool node_matches_set;
 
    bson_return_val_if_fail(read_tags, -1);
    bson_return_val_if_fail(node_tags, -1);
 
+   /* If no read tags were provided, all nodes are equal */
+   if (bson_empty(read_tags)) {
+      return 1;
+   }
+
    count = bson_count_keys(read_tags);
 
-   /* Execute this block if read tags were provided, else bail and return 0 (all nodes equal) */
-   if (!bson_empty(read_tags) && bson_iter_init(&iter, read_tags)) {
+   if (bson_iter_init(&iter, read_tags)) {
 
       /*
        * Iterate over array of read tag sets provided (each element is a tag set)
@@ -164,23 +305,12 @@ _score_tags (const bson_t *read_tags,
        * first set that matches the node or -1 if no set matched the node.
        */
       while (count && bson_iter_next(&iter)) {
-         if (BSON_ITER_HOLDS_DOCUMENT(&iter) && bson_iter_recurse(&iter, &sub_iter)) {
-            node_matches_set = true;
-
-            /* Iterate over the key/value pairs (tags) in the current set */
-            while (bson_iter_next(&sub_iter) && BSON_ITER_HOLDS_UTF8(&sub_iter)) {
-               key = bson_iter_key(&sub_iter);
-               str = bson_iter_utf8(&sub_iter, &len);
-
-               /* If any of the tags do not match, this node cannot satisfy this tag set. */
-               if (!_contains_tag(node_tags, key, str, len)) {
-                   node_matches_set = false;
-                   break;
-               }
-            }
+         if (BSON_ITER_HOLDS_DOCUMENT(&iter)) {
+            bson_iter_document(&iter, &len, &data);
 
             /* This set matched, return the count as the score */
-            if (node_matches_set) {
+            if (bson_init_static(&tag_set, data, len) &&
+                _mongoc_read_prefs_tag_set_matches(&tag_set, node_tags)) {
                 return count;
             }
 
@@ -188,147 +318,180 @@ _score_tags (const bson_t *read_tags,
             count--;
          }
       }
-      return -1;
    }
 
-   return 0;
+   return -1;
 }
 
 
-static int
-_mongoc_read_prefs_score_primary (const mongoc_read_prefs_t   *read_prefs,
-                                  const mongoc_cluster_node_t *node)
-{
-   bson_return_val_if_fail(read_prefs, -1);
-   bson_return_val_if_fail(node, -1);
-   return node->primary ? INT_MAX : 0;
-}
-
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_read_prefs_score_matched --
+ *
+ *       Score @node for @read_prefs given @tag_score, the score of the
+ *       node's tags against the tag sets of @read_prefs: 1 if there are no
+ *       tag sets, otherwise the count returned for the first matching set
+ *       or -1 if none matched. It is only used for the modes that read
+ *       from secondaries.
+ *
+ *       This lets the cluster score tags from the tag sets it matched
+ *       against each node ahead of time, rather than walking the BSON.
+ *
+ * Returns:
+ *       The score of @node, or -1 if it must not be selected.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
 
-static int
-_mongoc_read_prefs_score_primary_preferred (const mongoc_read_prefs_t   *read_prefs,
-                                            const mongoc_cluster_node_t *node)
+int
+_mongoc_read_prefs_score_matched (const mongoc_read_prefs_t   *read_prefs,
+                                  const mongoc_cluster_node_t *node,
+                                  int                          tag_score)
 {
-   const bson_t *node_tags;
-   const bson_t *read_tags;
-
    bson_return_val_if_fail(read_prefs, -1);
    bson_return_val_if_fail(node, -1);
 
-   if (node->primary) {
-      return INT_MAX;
+   /*
+    * Secondaries that have fallen too far behind the primary cannot be
+    * used at all. A node whose staleness is unknown, because it is too old
+    * to report lastWrite in isMaster, is given the benefit of the doubt.
+    */
+   if (read_prefs->max_staleness_msec &&
+       !node->primary &&
+       (node->staleness_msec > read_prefs->max_staleness_msec)) {
+      return -1;
    }
 
-   node_tags = &node->tags;
-   read_tags = &read_prefs->tags;
-
-   return bson_empty(read_tags) ? 1 : _score_tags(read_tags, node_tags);
-}
-
-
-static int
-_mongoc_read_prefs_score_secondary (const mongoc_read_prefs_t   *read_prefs,
-                                    const mongoc_cluster_node_t *node)
-{
-   const bson_t *node_tags;
-   const bson_t *read_tags;
-
-   bson_return_val_if_fail(read_prefs, -1);
-   bson_return_val_if_fail(node, -1);
-
-   if (node->primary) {
+   switch (read_prefs->mode) {
+   case MONGOC_READ_PRIMARY:
+      return node->primary ? INT_MAX : 0;
+   case MONGOC_READ_PRIMARY_PREFERRED:
+      return node->primary ? INT_MAX : tag_score;
+   case MONGOC_READ_SECONDARY:
+      return node->primary ? -1 : tag_score;
+   case MONGOC_READ_SECONDARY_PREFERRED:
+      return node->primary ? 0 : tag_score;
+   case MONGOC_READ_NEAREST:
+      return tag_score;
+   default:
+      BSON_ASSERT(false);
       return -1;
    }
-
-   node_tags = &node->tags;
-   read_tags = &read_prefs->tags;
-
-   return bson_empty(read_tags) ? 1 : _score_tags(read_tags, node_tags);
 }
 
 
-static int
-_mongoc_read_prefs_score_secondary_preferred (const mongoc_read_prefs_t   *read_prefs,
-                                              const mongoc_cluster_node_t *node)
+int
+_mongoc_read_prefs_score (const mongoc_read_prefs_t   *read_prefs,
+                          const mongoc_cluster_node_t *node)
 {
-   const bson_t *node_tags;
-   const bson_t *read_tags;
+   int tag_score = 0;
 
    bson_return_val_if_fail(read_prefs, -1);
    bson_return_val_if_fail(node, -1);
 
-   if (node->primary) {
-      return 0;
+   if (read_prefs->mode != MONGOC_READ_PRIMARY) {
+      tag_score = _score_tags(&read_prefs->tags, &node->tags);
    }
 
-   node_tags = &node->tags;
-   read_tags = &read_prefs->tags;
-
-   return bson_empty(read_tags) ? 1 : _score_tags(read_tags, node_tags);
+   return _mongoc_read_prefs_score_matched(read_prefs, node, tag_score);
 }
 
 
-static int
-_mongoc_read_prefs_score_nearest (const mongoc_read_prefs_t   *read_prefs,
-                                  const mongoc_cluster_node_t *node)
+void
+mongoc_read_prefs_destroy (mongoc_read_prefs_t *read_prefs)
 {
-   const bson_t *read_tags;
-   const bson_t *node_tags;
-
-   bson_return_val_if_fail(read_prefs, -1);
-   bson_return_val_if_fail(node, -1);
-
-   node_tags = &node->tags;
-   read_tags = &read_prefs->tags;
-
-   return bson_empty(read_tags) ? 1 : _score_tags(read_tags, node_tags);
+   if (read_prefs && !bson_atomic_int_add(&read_prefs->ref_count, -1)) {
+      bson_destroy(&read_prefs->tags);
+      bson_free(read_prefs);
+   }
 }
 
 
-int
-_mongoc_read_prefs_score (const mongoc_read_prefs_t   *read_prefs,
-                          const mongoc_cluster_node_t *node)
+mongoc_read_prefs_t *
+mongoc_read_prefs_copy (const mongoc_read_prefs_t *read_prefs)
 {
-   bson_return_val_if_fail(read_prefs, -1);
-   bson_return_val_if_fail(node, -1);
+   mongoc_read_prefs_t *ret = NULL;
 
-   switch (read_prefs->mode) {
-   case MONGOC_READ_PRIMARY:
-      return _mongoc_read_prefs_score_primary(read_prefs, node);
-   case MONGOC_READ_PRIMARY_PREFERRED:
-      return _mongoc_read_prefs_score_primary_preferred(read_prefs, node);
-   case MONGOC_READ_SECONDARY:
-      return _mongoc_read_prefs_score_secondary(read_prefs, node);
-   case MONGOC_READ_SECONDARY_PREFERRED:
-      return _mongoc_read_prefs_score_secondary_preferred(read_prefs, node);
-   case MONGOC_READ_NEAREST:
-      return _mongoc_read_prefs_score_nearest(read_prefs, node);
-   default:
-      BSON_ASSERT(false);
-      return -1;
+   if (read_prefs) {
+      ret = mongoc_read_prefs_new(read_prefs->mode);
+      bson_copy_to(&read_prefs->tags, &ret->tags);
+      ret->max_staleness_msec = read_prefs->max_staleness_msec;
+      ret->affinity = read_prefs->affinity;
+      ret->affinity_key = read_prefs->affinity_key;
    }
+
+   return ret;
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_read_prefs_freeze --
+ *
+ *       Mark @read_prefs as immutable so that it may be shared with
+ *       _mongoc_read_prefs_share(). Setters called afterwards log a
+ *       warning and leave @read_prefs unchanged.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 void
-mongoc_read_prefs_destroy (mongoc_read_prefs_t *read_prefs)
+_mongoc_read_prefs_freeze (mongoc_read_prefs_t *read_prefs)
 {
    if (read_prefs) {
-      bson_destroy(&read_prefs->tags);
-      bson_free(read_prefs);
+      read_prefs->frozen = true;
    }
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_read_prefs_share --
+ *
+ *       Get a reference to a read preference equal to @read_prefs for a
+ *       collection, database or cursor to hold on to. A frozen
+ *       @read_prefs is shared by taking a reference, any other is copied
+ *       once and the copy is frozen.
+ *
+ * Returns:
+ *       A frozen mongoc_read_prefs_t that should be released with
+ *       mongoc_read_prefs_destroy(), or NULL if @read_prefs is NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 mongoc_read_prefs_t *
-mongoc_read_prefs_copy (const mongoc_read_prefs_t *read_prefs)
+_mongoc_read_prefs_share (const mongoc_read_prefs_t *read_prefs)
 {
-   mongoc_read_prefs_t *ret = NULL;
+   mongoc_read_prefs_t *ret;
 
-   if (read_prefs) {
-      ret = mongoc_read_prefs_new(read_prefs->mode);
-      bson_copy_to(&read_prefs->tags, &ret->tags);
+   if (!read_prefs) {
+      return NULL;
    }
 
+   if (read_prefs->frozen) {
+      ret = (mongoc_read_prefs_t *)read_prefs;
+      bson_atomic_int_add (&ret->ref_count, 1);
+      return ret;
+   }
+
+   ret = mongoc_read_prefs_copy (read_prefs);
+   ret->frozen = true;
+
    return ret;
 }
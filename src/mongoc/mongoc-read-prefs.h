@@ -40,6 +40,14 @@ typedef enum
 } mongoc_read_mode_t;
 
 
+typedef enum
+{
+   MONGOC_READ_AFFINITY_NONE,
+   MONGOC_READ_AFFINITY_THREAD,
+   MONGOC_READ_AFFINITY_KEY,
+} mongoc_read_affinity_t;
+
+
 mongoc_read_prefs_t *mongoc_read_prefs_new      (mongoc_read_mode_t         read_mode);
 mongoc_read_prefs_t *mongoc_read_prefs_copy     (const mongoc_read_prefs_t *read_prefs);
 void                 mongoc_read_prefs_destroy  (mongoc_read_prefs_t       *read_prefs);
@@ -51,6 +59,14 @@ void                 mongoc_read_prefs_set_tags (mongoc_read_prefs_t       *read
                                                  const bson_t              *tags);
 void                 mongoc_read_prefs_add_tag  (mongoc_read_prefs_t       *read_prefs,
                                                  const bson_t              *tag);
+int64_t              mongoc_read_prefs_get_max_staleness_ms (const mongoc_read_prefs_t *read_prefs);
+void                 mongoc_read_prefs_set_max_staleness_ms (mongoc_read_prefs_t       *read_prefs,
+                                                             int64_t                    max_staleness_msec);
+mongoc_read_affinity_t mongoc_read_prefs_get_affinity (const mongoc_read_prefs_t *read_prefs,
+                                                       uint64_t                  *key);
+void                 mongoc_read_prefs_set_affinity (mongoc_read_prefs_t       *read_prefs,
+                                                     mongoc_read_affinity_t     affinity,
+                                                     uint64_t                   key);
 bool                 mongoc_read_prefs_is_valid (const mongoc_read_prefs_t *read_prefs);
 
 
@@ -32,6 +32,14 @@
 BSON_BEGIN_DECLS
 
 
+/*
+ * Requests with an inline buffer are gathered into it as far as they fit,
+ * so that a small one is written from a single iovec. Only documents that
+ * do not fit get iovecs of their own.
+ */
+#define MONGOC_RPC_INLINE_BUFFER_SIZE 512
+
+
 #define RPC(_name, _code)                typedef struct { _code } mongoc_rpc_##_name##_t;
 #define ENUM_FIELD(_name)                uint32_t _name;
 #define INT32_FIELD(_name)               int32_t _name;
@@ -40,9 +48,11 @@ BSON_BEGIN_DECLS
 #define CSTRING_FIELD(_name)             const char *_name;
 #define BSON_FIELD(_name)                const uint8_t *_name;
 #define BSON_ARRAY_FIELD(_name)          const uint8_t *_name; int32_t _name##_len;
+#define BSON_IOVEC_FIELD(_name)          const uint8_t *_name; const mongoc_iovec_t *_name##_iov; int32_t n_##_name##_iov;
 #define IOVEC_ARRAY_FIELD(_name)         const mongoc_iovec_t *_name; int32_t n_##_name; mongoc_iovec_t _name##_recv;
 #define RAW_BUFFER_FIELD(_name)          const uint8_t *_name; int32_t _name##_len;
 #define BSON_OPTIONAL(_check, _code)     _code
+#define INLINE_BUFFER_FIELD(_name)       uint8_t _name [MONGOC_RPC_INLINE_BUFFER_SIZE];
 
 
 #include "op-delete.def"
@@ -83,14 +93,16 @@ BSON_STATIC_ASSERT (offsetof (mongoc_rpc_header_t, opcode) ==
 #undef CSTRING_FIELD
 #undef BSON_FIELD
 #undef BSON_ARRAY_FIELD
+#undef BSON_IOVEC_FIELD
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
+#undef INLINE_BUFFER_FIELD
 
 
 void _mongoc_rpc_gather          (mongoc_rpc_t                 *rpc,
                                   mongoc_array_t               *array);
-bool _mongoc_rpc_needs_gle       (mongoc_rpc_t                 *rpc,
+bool _mongoc_rpc_needs_gle       (const mongoc_rpc_t           *rpc,
                                   const mongoc_write_concern_t *write_concern);
 void _mongoc_rpc_swab_to_le      (mongoc_rpc_t                 *rpc);
 void _mongoc_rpc_swab_from_le    (mongoc_rpc_t                 *rpc);
@@ -22,6 +22,10 @@
 #include "mongoc-rpc-private.h"
 
 
+/* the inline buffer is not sent as such, no pass has to handle it */
+#define INLINE_BUFFER_FIELD(_name)
+
+
 #define RPC(_name, _code) \
    static void \
    _mongoc_rpc_gather_##_name (mongoc_rpc_##_name##_t *rpc, \
@@ -64,6 +68,20 @@
       rpc->msg_len += (int32_t)iov.iov_len; \
       _mongoc_array_append_val(array, iov); \
    } while (0);
+/* a document that is either contiguous at @_name or, if that is NULL,
+ * split across the @_name##_iov chain */
+#define BSON_IOVEC_FIELD(_name) \
+   if (rpc->_name) { \
+      BSON_FIELD(_name) \
+   } else { \
+      ssize_t _i; \
+      BSON_ASSERT(rpc->n_##_name##_iov); \
+      for (_i = 0; _i < rpc->n_##_name##_iov; _i++) { \
+         BSON_ASSERT(rpc->_name##_iov[_i].iov_len); \
+         rpc->msg_len += (int32_t)rpc->_name##_iov[_i].iov_len; \
+         _mongoc_array_append_val(array, rpc->_name##_iov[_i]); \
+      } \
+   }
 #define BSON_OPTIONAL(_check, _code) \
    if (rpc->_check) { _code }
 #define BSON_ARRAY_FIELD(_name) \
@@ -105,11 +123,8 @@
 
 
 #include "op-delete.def"
-#include "op-get-more.def"
 #include "op-insert.def"
-#include "op-kill-cursors.def"
 #include "op-msg.def"
-#include "op-query.def"
 #include "op-reply.def"
 #include "op-update.def"
 
@@ -122,11 +137,153 @@
 #undef CSTRING_FIELD
 #undef BSON_FIELD
 #undef BSON_ARRAY_FIELD
+#undef BSON_IOVEC_FIELD
 #undef IOVEC_ARRAY_FIELD
 #undef RAW_BUFFER_FIELD
 #undef BSON_OPTIONAL
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_rpc_inline_append --
+ *
+ *       Append the @len bytes at @data to a request being gathered into
+ *       @inline_buf, of which *@off bytes are used and those from *@run
+ *       on are not in @array yet. Bytes that do not fit are given an
+ *       iovec of their own after the pending ones, without being copied.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @inline_buf, *@off, *@run and @array are updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_rpc_inline_append (uint8_t        *inline_buf,
+                           size_t         *off,
+                           size_t         *run,
+                           mongoc_array_t *array,
+                           const void     *data,
+                           size_t          len)
+{
+   mongoc_iovec_t iov;
+
+   BSON_ASSERT (len);
+
+   if (*off + len <= MONGOC_RPC_INLINE_BUFFER_SIZE) {
+      memcpy (inline_buf + *off, data, len);
+      *off += len;
+      return;
+   }
+
+   if (*off > *run) {
+      iov.iov_base = (void *)(inline_buf + *run);
+      iov.iov_len = *off - *run;
+      _mongoc_array_append_val (array, iov);
+      *run = *off;
+   }
+
+   iov.iov_base = (void *)data;
+   iov.iov_len = len;
+   _mongoc_array_append_val (array, iov);
+}
+
+
+/*
+ * The requests with an inline buffer are gathered into it in little
+ * endian, so swabbing them afterwards changes nothing that is sent. The
+ * message length comes first and is filled in once it is known.
+ */
+#define RPC(_name, _code) \
+   static void \
+   _mongoc_rpc_gather_##_name (mongoc_rpc_##_name##_t *rpc, \
+                               mongoc_array_t *array) \
+   { \
+      mongoc_iovec_t iov; \
+      size_t off = 0; \
+      size_t run = 0; \
+      int32_t v32; \
+      int64_t v64; \
+      BSON_ASSERT(rpc); \
+      BSON_ASSERT(array); \
+      rpc->msg_len = 0; \
+      _code \
+      v32 = BSON_UINT32_TO_LE(rpc->msg_len); \
+      memcpy(rpc->inline_buf, &v32, 4); \
+      if (off > run) { \
+         iov.iov_base = (void *)(rpc->inline_buf + run); \
+         iov.iov_len = off - run; \
+         _mongoc_array_append_val(array, iov); \
+      } \
+      (void)v64; \
+   }
+#define INLINE_APPEND(_data, _len) \
+   rpc->msg_len += (int32_t)(_len); \
+   _mongoc_rpc_inline_append(rpc->inline_buf, &off, &run, array, \
+                             (_data), (_len));
+#define INT32_FIELD(_name) \
+   v32 = BSON_UINT32_TO_LE(rpc->_name); \
+   INLINE_APPEND(&v32, 4)
+#define ENUM_FIELD INT32_FIELD
+#define INT64_FIELD(_name) \
+   v64 = BSON_UINT64_TO_LE(rpc->_name); \
+   INLINE_APPEND(&v64, 8)
+#define CSTRING_FIELD(_name) \
+   BSON_ASSERT(rpc->_name); \
+   INLINE_APPEND(rpc->_name, strlen(rpc->_name) + 1)
+#define BSON_FIELD(_name) \
+   do { \
+      int32_t __l; \
+      memcpy(&__l, rpc->_name, 4); \
+      __l = BSON_UINT32_FROM_LE(__l); \
+      INLINE_APPEND(rpc->_name, __l) \
+   } while (0);
+#define BSON_IOVEC_FIELD(_name) \
+   if (rpc->_name) { \
+      BSON_FIELD(_name) \
+   } else { \
+      ssize_t _i; \
+      BSON_ASSERT(rpc->n_##_name##_iov); \
+      for (_i = 0; _i < rpc->n_##_name##_iov; _i++) { \
+         INLINE_APPEND(rpc->_name##_iov[_i].iov_base, \
+                       rpc->_name##_iov[_i].iov_len) \
+      } \
+   }
+#define BSON_OPTIONAL(_check, _code) \
+   if (rpc->_check) { _code }
+#define INT64_ARRAY_FIELD(_len, _name) \
+   do { \
+      ssize_t _i; \
+      v32 = BSON_UINT32_TO_LE(rpc->_len); \
+      INLINE_APPEND(&v32, 4) \
+      for (_i = 0; _i < rpc->_len; _i++) { \
+         v64 = BSON_UINT64_TO_LE(rpc->_name[_i]); \
+         INLINE_APPEND(&v64, 8) \
+      } \
+   } while (0);
+
+
+#include "op-get-more.def"
+#include "op-kill-cursors.def"
+#include "op-query.def"
+
+
+#undef RPC
+#undef INLINE_APPEND
+#undef ENUM_FIELD
+#undef INT32_FIELD
+#undef INT64_FIELD
+#undef INT64_ARRAY_FIELD
+#undef CSTRING_FIELD
+#undef BSON_FIELD
+#undef BSON_IOVEC_FIELD
+#undef BSON_OPTIONAL
+
+
 #if BSON_BYTE_ORDER == BSON_BIG_ENDIAN
 
 #define RPC(_name, _code) \
@@ -143,6 +300,7 @@
    rpc->_name = BSON_UINT64_FROM_LE(rpc->_name);
 #define CSTRING_FIELD(_name)
 #define BSON_FIELD(_name)
+#define BSON_IOVEC_FIELD(_name)
 #define BSON_ARRAY_FIELD(_name)
 #define IOVEC_ARRAY_FIELD(_name)
 #define BSON_OPTIONAL(_check, _code) \
@@ -205,6 +363,7 @@
 #undef CSTRING_FIELD
 #undef BSON_FIELD
 #undef BSON_ARRAY_FIELD
+#undef BSON_IOVEC_FIELD
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
@@ -240,6 +399,22 @@
       bson_free(s); \
       bson_destroy(&b); \
    } while (0);
+#define BSON_IOVEC_FIELD(_name) \
+   if (rpc->_name) { \
+      BSON_FIELD(_name) \
+   } else { \
+      ssize_t _i; \
+      size_t _j; \
+      printf("  "#_name" :"); \
+      for (_i = 0; _i < rpc->n_##_name##_iov; _i++) { \
+         for (_j = 0; _j < rpc->_name##_iov[_i].iov_len; _j++) { \
+            uint8_t u; \
+            u = ((char *)rpc->_name##_iov[_i].iov_base)[_j]; \
+            printf(" %02x", u); \
+         } \
+      } \
+      printf("\n"); \
+   }
 #define BSON_ARRAY_FIELD(_name) \
    do { \
       bson_reader_t *__r; \
@@ -308,6 +483,7 @@
 #undef CSTRING_FIELD
 #undef BSON_FIELD
 #undef BSON_ARRAY_FIELD
+#undef BSON_IOVEC_FIELD
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
@@ -389,6 +565,10 @@
       buf += __l; \
       buflen -= __l; \
    } while (0);
+#define BSON_IOVEC_FIELD(_name) \
+   rpc->_name##_iov = NULL; \
+   rpc->n_##_name##_iov = 0; \
+   BSON_FIELD(_name)
 #define BSON_ARRAY_FIELD(_name) \
    rpc->_name = (uint8_t *)buf; \
    rpc->_name##_len = (int32_t)buflen; \
@@ -431,6 +611,7 @@
 #undef CSTRING_FIELD
 #undef BSON_FIELD
 #undef BSON_ARRAY_FIELD
+#undef BSON_IOVEC_FIELD
 #undef IOVEC_ARRAY_FIELD
 #undef BSON_OPTIONAL
 #undef RAW_BUFFER_FIELD
@@ -689,7 +870,7 @@ _mongoc_rpc_reply_get_first (mongoc_rpc_reply_t *reply,
  */
 
 bool
-_mongoc_rpc_needs_gle (mongoc_rpc_t                 *rpc,
+_mongoc_rpc_needs_gle (const mongoc_rpc_t           *rpc,
                        const mongoc_write_concern_t *write_concern)
 {
    bson_return_val_if_fail(rpc, false);
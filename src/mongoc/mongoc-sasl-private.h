@@ -47,6 +47,7 @@ struct _mongoc_sasl_t
 };
 
 
+void _mongoc_sasl_cleanup          (void);
 void _mongoc_sasl_init             (mongoc_sasl_t      *sasl);
 void _mongoc_sasl_set_pass         (mongoc_sasl_t      *sasl,
                                     const char         *pass);
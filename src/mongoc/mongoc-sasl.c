@@ -22,6 +22,7 @@
 
 #include "mongoc-error.h"
 #include "mongoc-sasl-private.h"
+#include "mongoc-thread-private.h"
 
 
 #ifndef SASL_CALLBACK_FN
@@ -126,9 +127,44 @@ _mongoc_sasl_set_service_name (mongoc_sasl_t *sasl,
 }
 
 
+/*
+ * The SASL library, and the GSSAPI plugin and Kerberos libraries it
+ * loads, are initialized once for the process and kept until
+ * mongoc_cleanup(), instead of for every authentication. Callbacks are
+ * only given to each connection with sasl_client_new().
+ */
+static bool gSaslInitialized;
+
+
+static MONGOC_ONCE_FUN (_mongoc_sasl_do_init)
+{
+   sasl_client_init (NULL);
+   gSaslInitialized = true;
+
+   MONGOC_ONCE_RETURN;
+}
+
+
+void
+_mongoc_sasl_cleanup (void)
+{
+   if (!gSaslInitialized) {
+      return;
+   }
+
+#if (SASL_VERSION_MAJOR >= 2) && \
+    (SASL_VERSION_MINOR >= 1) && \
+    (SASL_VERSION_STEP >= 24) && \
+    (!defined(__APPLE__))
+   sasl_client_done ();
+#endif
+}
+
+
 void
 _mongoc_sasl_init (mongoc_sasl_t *sasl)
 {
+   static mongoc_once_t once = MONGOC_ONCE_INIT;
    sasl_callback_t callbacks [] = {
       { SASL_CB_AUTHNAME, SASL_CALLBACK_FN (_mongoc_sasl_get_user), sasl },
       { SASL_CB_USER, SASL_CALLBACK_FN (_mongoc_sasl_get_user), sasl },
@@ -152,7 +188,7 @@ _mongoc_sasl_init (mongoc_sasl_t *sasl)
    sasl->service_host = NULL;
    sasl->interact = NULL;
 
-   sasl_client_init (sasl->callbacks);
+   mongoc_once (&once, _mongoc_sasl_do_init);
 }
 
 
@@ -170,13 +206,6 @@ _mongoc_sasl_destroy (mongoc_sasl_t *sasl)
    free (sasl->mechanism);
    free (sasl->service_name);
    free (sasl->service_host);
-
-#if (SASL_VERSION_MAJOR >= 2) && \
-    (SASL_VERSION_MINOR >= 1) && \
-    (SASL_VERSION_STEP >= 24) && \
-    (!defined(__APPLE__))
-   sasl_client_done ();
-#endif
 }
 
 
@@ -38,6 +38,8 @@ typedef struct _mongoc_scram_t
    char        *user;
    char        *pass;
    uint8_t      salted_password[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t      client_key[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t      server_key[MONGOC_SCRAM_HASH_SIZE];
    char         encoded_nonce[48];
    int32_t      encoded_nonce_len;
    uint8_t     *auth_message;
@@ -48,6 +50,9 @@ typedef struct _mongoc_scram_t
 void
 _mongoc_scram_startup();
 
+void
+_mongoc_scram_cleanup();
+
 void
 _mongoc_scram_init (mongoc_scram_t *scram);
 
@@ -19,9 +19,12 @@
 
 #include <string.h>
 
+#include "mongoc-counters-private.h"
 #include "mongoc-error.h"
 #include "mongoc-scram-private.h"
 #include "mongoc-rand-private.h"
+#include "mongoc-ssl-private.h"
+#include "mongoc-thread-private.h"
 #include "mongoc-util-private.h"
 
 #include "mongoc-b64-private.h"
@@ -38,11 +41,52 @@
 #define MONGOC_SCRAM_B64_HASH_SIZE \
    MONGOC_SCRAM_B64_ENCODED_SIZE (MONGOC_SCRAM_HASH_SIZE)
 
+#define MONGOC_SCRAM_SALT_SIZE 16
+
+#ifndef MONGOC_SCRAM_CACHE_SIZE
+# define MONGOC_SCRAM_CACHE_SIZE 64
+#endif
+
+
+/*
+ * Keys derived from a password are the same for every node that stores
+ * the same salt and iteration count, so they are shared by all clients in
+ * the process. Entries are keyed by a digest of the MONGODB-CR password
+ * hash, which covers both the user name and the password, so a changed
+ * password never matches a stale entry.
+ */
+typedef struct
+{
+   bool     valid;
+   uint64_t last_used;
+   uint8_t  credentials[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t  salt[MONGOC_SCRAM_SALT_SIZE];
+   uint32_t iterations;
+   uint8_t  salted_password[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t  client_key[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t  server_key[MONGOC_SCRAM_HASH_SIZE];
+} mongoc_scram_cache_entry_t;
+
+
+static mongoc_mutex_t             gScramCacheMutex;
+static mongoc_scram_cache_entry_t gScramCache[MONGOC_SCRAM_CACHE_SIZE];
+static uint64_t                   gScramCacheClock;
+
 
 void
 _mongoc_scram_startup()
 {
    mongoc_b64_initialize_rmap();
+   mongoc_mutex_init (&gScramCacheMutex);
+}
+
+
+void
+_mongoc_scram_cleanup()
+{
+   mongoc_mutex_lock (&gScramCacheMutex);
+   memset (gScramCache, 0, sizeof gScramCache);
+   mongoc_mutex_unlock (&gScramCacheMutex);
 }
 
 
@@ -76,6 +120,8 @@ _mongoc_scram_init (mongoc_scram_t *scram)
 {
    BSON_ASSERT (scram);
 
+   _mongoc_ssl_init ();
+
    memset (scram, 0, sizeof *scram);
 }
 
@@ -330,14 +376,123 @@ cleanup:
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_scram_derive_keys --
+ *
+ *       Compute SaltedPassword, ClientKey and ServerKey for @scram, or
+ *       fetch them from the process-wide cache if the same credentials
+ *       were already stretched with this salt and iteration count.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       The keys in @scram are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_scram_derive_keys (mongoc_scram_t *scram,
+                           const char     *hashed_password,
+                           const uint8_t  *salt,
+                           uint32_t        iterations)
+{
+   mongoc_scram_cache_entry_t *entry;
+   mongoc_scram_cache_entry_t *victim = NULL;
+   uint8_t credentials[MONGOC_SCRAM_HASH_SIZE];
+   uint32_t hash_len = 0;
+   int i;
+
+   _mongoc_scram_sha1 ((const unsigned char *)hashed_password,
+                       strlen (hashed_password), credentials);
+
+   mongoc_mutex_lock (&gScramCacheMutex);
+
+   for (i = 0; i < MONGOC_SCRAM_CACHE_SIZE; i++) {
+      entry = &gScramCache[i];
+
+      if (entry->valid &&
+          (entry->iterations == iterations) &&
+          !memcmp (entry->salt, salt, MONGOC_SCRAM_SALT_SIZE) &&
+          !memcmp (entry->credentials, credentials, sizeof credentials)) {
+         entry->last_used = ++gScramCacheClock;
+         memcpy (scram->salted_password, entry->salted_password,
+                 MONGOC_SCRAM_HASH_SIZE);
+         memcpy (scram->client_key, entry->client_key,
+                 MONGOC_SCRAM_HASH_SIZE);
+         memcpy (scram->server_key, entry->server_key,
+                 MONGOC_SCRAM_HASH_SIZE);
+         mongoc_mutex_unlock (&gScramCacheMutex);
+         mongoc_counter_auth_scram_cache_hits_inc ();
+         return;
+      }
+   }
+
+   mongoc_mutex_unlock (&gScramCacheMutex);
+
+   mongoc_counter_auth_scram_cache_misses_inc ();
+
+   _mongoc_scram_salt_password (scram, hashed_password,
+                                (uint32_t) strlen (hashed_password),
+                                salt, MONGOC_SCRAM_SALT_SIZE, iterations);
+
+   /* ClientKey := HMAC(saltedPassword, "Client Key") */
+   HMAC (EVP_sha1 (),
+         scram->salted_password,
+         MONGOC_SCRAM_HASH_SIZE,
+         (uint8_t *)MONGOC_SCRAM_CLIENT_KEY,
+         strlen (MONGOC_SCRAM_CLIENT_KEY),
+         scram->client_key,
+         &hash_len);
+
+   /* ServerKey := HMAC(SaltedPassword, "Server Key") */
+   HMAC (EVP_sha1 (),
+         scram->salted_password,
+         MONGOC_SCRAM_HASH_SIZE,
+         (uint8_t *)MONGOC_SCRAM_SERVER_KEY,
+         strlen (MONGOC_SCRAM_SERVER_KEY),
+         scram->server_key,
+         &hash_len);
+
+   mongoc_mutex_lock (&gScramCacheMutex);
+
+   for (i = 0; i < MONGOC_SCRAM_CACHE_SIZE; i++) {
+      entry = &gScramCache[i];
+
+      if (!entry->valid) {
+         victim = entry;
+         break;
+      }
+
+      if (!victim || (entry->last_used < victim->last_used)) {
+         victim = entry;
+      }
+   }
+
+   victim->valid = true;
+   victim->last_used = ++gScramCacheClock;
+   victim->iterations = iterations;
+   memcpy (victim->credentials, credentials, sizeof credentials);
+   memcpy (victim->salt, salt, MONGOC_SCRAM_SALT_SIZE);
+   memcpy (victim->salted_password, scram->salted_password,
+           MONGOC_SCRAM_HASH_SIZE);
+   memcpy (victim->client_key, scram->client_key, MONGOC_SCRAM_HASH_SIZE);
+   memcpy (victim->server_key, scram->server_key, MONGOC_SCRAM_HASH_SIZE);
+
+   mongoc_mutex_unlock (&gScramCacheMutex);
+}
+
+
 static bool
 _mongoc_scram_generate_client_proof (mongoc_scram_t *scram,
                                      uint8_t        *outbuf,
                                      uint32_t        outbufmax,
                                      uint32_t       *outbuflen)
 {
-   /* ClientKey := HMAC(saltedPassword, "Client Key") */
-   uint8_t client_key[MONGOC_SCRAM_HASH_SIZE];
+   uint8_t *client_key = scram->client_key;
    uint8_t stored_key[MONGOC_SCRAM_HASH_SIZE];
    uint8_t client_signature[MONGOC_SCRAM_HASH_SIZE];
    unsigned char client_proof[MONGOC_SCRAM_HASH_SIZE];
@@ -345,14 +500,6 @@ _mongoc_scram_generate_client_proof (mongoc_scram_t *scram,
    int i;
    int r = 0;
 
-   HMAC (EVP_sha1 (),
-         scram->salted_password,
-         MONGOC_SCRAM_HASH_SIZE,
-         (uint8_t *)MONGOC_SCRAM_CLIENT_KEY,
-         strlen (MONGOC_SCRAM_CLIENT_KEY),
-         client_key,
-         &hash_len);
-
    /* StoredKey := H(client_key) */
    _mongoc_scram_sha1 (client_key, MONGOC_SCRAM_HASH_SIZE, stored_key);
 
@@ -571,7 +718,7 @@ _mongoc_scram_step2 (mongoc_scram_t *scram,
       goto FAIL;
    }
 
-   if (16 != decoded_salt_len) {
+   if (MONGOC_SCRAM_SALT_SIZE != decoded_salt_len) {
       bson_set_error (error,
                       MONGOC_ERROR_SCRAM,
                       MONGOC_ERROR_SCRAM_PROTOCOL_ERROR,
@@ -592,9 +739,8 @@ _mongoc_scram_step2 (mongoc_scram_t *scram,
       goto FAIL;
    }
 
-   _mongoc_scram_salt_password (scram, hashed_password, (uint32_t) strlen (
-                                   hashed_password), decoded_salt, decoded_salt_len,
-                                iterations);
+   _mongoc_scram_derive_keys (scram, hashed_password, decoded_salt,
+                              iterations);
 
    _mongoc_scram_generate_client_proof (scram, outbuf, outbufmax, outbuflen);
 
@@ -637,24 +783,14 @@ _mongoc_scram_verify_server_signature (mongoc_scram_t *scram,
                                        uint8_t        *verification,
                                        uint32_t        len)
 {
-   /* ServerKey := HMAC(SaltedPassword, "Server Key") */
    uint32_t hash_len;
-   uint8_t server_key[MONGOC_SCRAM_HASH_SIZE];
    char encoded_server_signature[MONGOC_SCRAM_B64_HASH_SIZE];
    int32_t encoded_server_signature_len;
    uint8_t server_signature[MONGOC_SCRAM_HASH_SIZE];
 
-   HMAC (EVP_sha1 (),
-         scram->salted_password,
-         MONGOC_SCRAM_HASH_SIZE,
-         (uint8_t *)MONGOC_SCRAM_SERVER_KEY,
-         strlen (MONGOC_SCRAM_SERVER_KEY),
-         server_key,
-         &hash_len);
-
    /* ServerSignature := HMAC(ServerKey, AuthMessage) */
    HMAC (EVP_sha1 (),
-         server_key,
+         scram->server_key,
          MONGOC_SCRAM_HASH_SIZE,
          scram->auth_message,
          scram->auth_messagelen,
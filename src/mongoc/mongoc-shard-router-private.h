@@ -0,0 +1,113 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_SHARD_ROUTER_PRIVATE_H
+#define MONGOC_SHARD_ROUTER_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-client.h"
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * A shard from config.shards, like "rs0/a:27018,b:27018", and the client
+ * connected to it directly, created when the first operation is routed
+ * there.
+ */
+typedef struct
+{
+   char            *name;
+   char            *host;
+   mongoc_client_t *client;
+   bool             failed;
+} mongoc_shard_t;
+
+
+/* a chunk from config.chunks, owned by shards [shard] */
+typedef struct
+{
+   bson_t          *min;
+   bson_t          *max;
+   uint32_t         shard;
+} mongoc_shard_chunk_t;
+
+
+/*
+ * The chunks of a collection, sorted by min. @key is its shard key
+ * pattern, or NULL if the collection is not sharded or its key can't be
+ * targeted, in which case everything goes through mongos.
+ */
+typedef struct
+{
+   char             ns [140];
+   bson_t          *key;
+   mongoc_array_t   chunks;
+   int64_t          expire_at;
+} mongoc_shard_map_t;
+
+
+typedef struct _mongoc_shard_router_t
+{
+   mongoc_client_t *client;
+   int64_t          ttl_usec;
+   mongoc_array_t   shards;
+   mongoc_array_t   maps;
+   int64_t          shards_expire_at;
+} mongoc_shard_router_t;
+
+
+mongoc_shard_router_t *_mongoc_shard_router_new         (mongoc_client_t             *client,
+                                                         int64_t                      ttl_msec);
+void                   _mongoc_shard_router_destroy     (mongoc_shard_router_t       *router);
+mongoc_client_t       *_mongoc_shard_router_target      (mongoc_shard_router_t       *router,
+                                                         const char                  *ns,
+                                                         const bson_t                *doc,
+                                                         bool                         is_query);
+void                   _mongoc_shard_router_invalidate  (mongoc_shard_router_t       *router,
+                                                         const char                  *ns);
+bool                   _mongoc_shard_router_owners      (mongoc_shard_router_t       *router,
+                                                         const char                  *ns,
+                                                         mongoc_array_t              *owners);
+bool                   _mongoc_shard_router_owns        (mongoc_shard_router_t       *router,
+                                                         const char                  *ns,
+                                                         uint32_t                     shard,
+                                                         const bson_t                *doc);
+bool                   _mongoc_shard_router_is_stale    (int32_t                      code);
+bool                   _mongoc_shard_router_extract_key (const bson_t                *pattern,
+                                                         const bson_t                *doc,
+                                                         bool                         is_query,
+                                                         bson_t                      *key);
+int                    _mongoc_shard_router_compare     (const bson_t                *key,
+                                                         const bson_t                *bound);
+int                    _mongoc_shard_router_compare_sort (const bson_t               *sort,
+                                                          const bson_t               *a,
+                                                          const bson_t               *b);
+char                  *_mongoc_shard_router_uri_string  (const char                  *uri_string,
+                                                         const char                  *host);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_SHARD_ROUTER_PRIVATE_H */
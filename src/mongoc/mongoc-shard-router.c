@@ -0,0 +1,1119 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <bcon.h>
+#include <string.h>
+
+#include "mongoc-client-private.h"
+#include "mongoc-cursor-private.h"
+#include "mongoc-log.h"
+#include "mongoc-shard-router-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "shard-router"
+
+
+/*
+ * Server error codes meaning the shard's idea of the chunk map differs
+ * from ours: StaleConfig, StaleShardVersion, and the one mongod 2.x
+ * returns when it does not own the chunk any more.
+ */
+#define MONGOC_SHARD_ERROR_STALE_CONFIG        13388
+#define MONGOC_SHARD_ERROR_STALE_SHARD_VERSION 63
+#define MONGOC_SHARD_ERROR_NOT_IN_CHUNK        9517
+
+
+mongoc_shard_router_t *
+_mongoc_shard_router_new (mongoc_client_t *client,
+                          int64_t          ttl_msec)
+{
+   mongoc_shard_router_t *router;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (ttl_msec > 0);
+
+   router = bson_malloc0 (sizeof *router);
+   router->client = client;
+   router->ttl_usec = ttl_msec * 1000;
+   _mongoc_array_init (&router->shards, sizeof (mongoc_shard_t));
+   _mongoc_array_init (&router->maps, sizeof (mongoc_shard_map_t));
+
+   return router;
+}
+
+
+static void
+_mongoc_shard_map_clear (mongoc_shard_map_t *map)
+{
+   mongoc_shard_chunk_t *chunk;
+   size_t i;
+
+   for (i = 0; i < map->chunks.len; i++) {
+      chunk = &_mongoc_array_index (&map->chunks, mongoc_shard_chunk_t, i);
+      bson_destroy (chunk->min);
+      bson_destroy (chunk->max);
+   }
+
+   _mongoc_array_clear (&map->chunks);
+
+   if (map->key) {
+      bson_destroy (map->key);
+      map->key = NULL;
+   }
+}
+
+
+void
+_mongoc_shard_router_destroy (mongoc_shard_router_t *router)
+{
+   mongoc_shard_map_t *map;
+   mongoc_shard_t *shard;
+   size_t i;
+
+   if (!router) {
+      return;
+   }
+
+   for (i = 0; i < router->maps.len; i++) {
+      map = &_mongoc_array_index (&router->maps, mongoc_shard_map_t, i);
+      _mongoc_shard_map_clear (map);
+      _mongoc_array_destroy (&map->chunks);
+   }
+
+   for (i = 0; i < router->shards.len; i++) {
+      shard = &_mongoc_array_index (&router->shards, mongoc_shard_t, i);
+      bson_free (shard->name);
+      bson_free (shard->host);
+
+      if (shard->client) {
+         mongoc_client_destroy (shard->client);
+      }
+   }
+
+   _mongoc_array_destroy (&router->maps);
+   _mongoc_array_destroy (&router->shards);
+   bson_free (router);
+}
+
+
+/*
+ * The position of a type in the order in which the server compares values
+ * of different types, numbers and strings each being one.
+ */
+static int
+_mongoc_shard_router_rank (bson_type_t type)
+{
+   switch (type) {
+   case BSON_TYPE_MINKEY:
+      return 0;
+   case BSON_TYPE_UNDEFINED:
+   case BSON_TYPE_NULL:
+      return 1;
+   case BSON_TYPE_DOUBLE:
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+      return 2;
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+      return 3;
+   case BSON_TYPE_DOCUMENT:
+      return 4;
+   case BSON_TYPE_ARRAY:
+      return 5;
+   case BSON_TYPE_BINARY:
+      return 6;
+   case BSON_TYPE_OID:
+      return 7;
+   case BSON_TYPE_BOOL:
+      return 8;
+   case BSON_TYPE_DATE_TIME:
+      return 9;
+   case BSON_TYPE_TIMESTAMP:
+      return 10;
+   case BSON_TYPE_REGEX:
+      return 11;
+   case BSON_TYPE_MAXKEY:
+      return 13;
+   default:
+      return 12;
+   }
+}
+
+
+static const char *
+_mongoc_shard_router_string (const bson_iter_t *iter,
+                             uint32_t          *len)
+{
+   if (BSON_ITER_HOLDS_SYMBOL (iter)) {
+      return bson_iter_symbol (iter, len);
+   }
+
+   return bson_iter_utf8 (iter, len);
+}
+
+
+static double
+_mongoc_shard_router_double (const bson_iter_t *iter)
+{
+   if (BSON_ITER_HOLDS_DOUBLE (iter)) {
+      return bson_iter_double (iter);
+   }
+
+   return (double)bson_iter_as_int64 (iter);
+}
+
+
+/*
+ * Compare a shard key value @a with the value @b of a chunk bound. @a is
+ * of a type _mongoc_shard_router_targetable() accepts, so values of the
+ * same rank as it can be compared exactly.
+ */
+static int
+_mongoc_shard_router_compare_values (const bson_iter_t *a,
+                                     const bson_iter_t *b)
+{
+   const char *sa;
+   const char *sb;
+   uint32_t la;
+   uint32_t lb;
+   uint32_t ta, ia;
+   uint32_t tb, ib;
+   int64_t xa;
+   int64_t xb;
+   double da;
+   double db;
+   int ra;
+   int rb;
+   int r;
+
+   ra = _mongoc_shard_router_rank (bson_iter_type (a));
+   rb = _mongoc_shard_router_rank (bson_iter_type (b));
+
+   if (ra != rb) {
+      return ra < rb ? -1 : 1;
+   }
+
+   switch (bson_iter_type (a)) {
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_DOUBLE:
+      if (!BSON_ITER_HOLDS_DOUBLE (a) && !BSON_ITER_HOLDS_DOUBLE (b)) {
+         xa = bson_iter_as_int64 (a);
+         xb = bson_iter_as_int64 (b);
+         return xa < xb ? -1 : (xa > xb);
+      }
+
+      da = _mongoc_shard_router_double (a);
+      db = _mongoc_shard_router_double (b);
+
+      if (db != db) {
+         /* NaN sorts before all other numbers */
+         return 1;
+      }
+
+      return da < db ? -1 : (da > db);
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_SYMBOL:
+      sa = _mongoc_shard_router_string (a, &la);
+      sb = _mongoc_shard_router_string (b, &lb);
+      r = memcmp (sa, sb, BSON_MIN (la, lb));
+
+      if (r) {
+         return r < 0 ? -1 : 1;
+      }
+
+      return la < lb ? -1 : (la > lb);
+   case BSON_TYPE_OID:
+      r = bson_oid_compare (bson_iter_oid (a), bson_iter_oid (b));
+      return r < 0 ? -1 : (r > 0);
+   case BSON_TYPE_BOOL:
+      return (int)bson_iter_bool (a) - (int)bson_iter_bool (b);
+   case BSON_TYPE_DATE_TIME:
+      xa = bson_iter_date_time (a);
+      xb = bson_iter_date_time (b);
+      return xa < xb ? -1 : (xa > xb);
+   case BSON_TYPE_TIMESTAMP:
+      bson_iter_timestamp (a, &ta, &ia);
+      bson_iter_timestamp (b, &tb, &ib);
+
+      if (ta != tb) {
+         return ta < tb ? -1 : 1;
+      }
+
+      return ia < ib ? -1 : (ia > ib);
+   default:
+      return 0;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_compare --
+ *
+ *       Compare the shard key @key, as built by
+ *       _mongoc_shard_router_extract_key(), with the min or max @bound of
+ *       a chunk, field by field in the order the server does.
+ *
+ * Returns:
+ *       Less than, equal to or greater than zero.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_shard_router_compare (const bson_t *key,
+                              const bson_t *bound)
+{
+   bson_iter_t a;
+   bson_iter_t b;
+   bool more_a;
+   bool more_b;
+   int r;
+
+   BSON_ASSERT (key);
+   BSON_ASSERT (bound);
+
+   if (!bson_iter_init (&a, key) || !bson_iter_init (&b, bound)) {
+      return 0;
+   }
+
+   for (;;) {
+      more_a = bson_iter_next (&a);
+      more_b = bson_iter_next (&b);
+
+      if (!more_a || !more_b) {
+         return (int)more_a - (int)more_b;
+      }
+
+      if ((r = _mongoc_shard_router_compare_values (&a, &b))) {
+         return r;
+      }
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_compare_sort --
+ *
+ *       Compare documents @a and @b by the @sort specification of a
+ *       query, like { "a": 1, "b.c": -1 }, to merge the sorted results
+ *       of several shards. A missing field sorts as null. Documents,
+ *       arrays and other values of types chunk bounds can't hold compare
+ *       as equal to values of the same type.
+ *
+ * Returns:
+ *       Less than, equal to or greater than zero.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_shard_router_compare_sort (const bson_t *sort,
+                                   const bson_t *a,
+                                   const bson_t *b)
+{
+   bson_iter_t siter;
+   bson_iter_t iter;
+   bson_iter_t va;
+   bson_iter_t vb;
+   const char *field;
+   bool has_a;
+   bool has_b;
+   int ra;
+   int rb;
+   int r;
+
+   BSON_ASSERT (sort);
+   BSON_ASSERT (a);
+   BSON_ASSERT (b);
+
+   if (!bson_iter_init (&siter, sort)) {
+      return 0;
+   }
+
+   while (bson_iter_next (&siter)) {
+      field = bson_iter_key (&siter);
+      has_a = (bson_iter_init (&iter, a) &&
+               bson_iter_find_descendant (&iter, field, &va));
+      has_b = (bson_iter_init (&iter, b) &&
+               bson_iter_find_descendant (&iter, field, &vb));
+
+      if (has_a && has_b) {
+         r = _mongoc_shard_router_compare_values (&va, &vb);
+      } else {
+         ra = has_a ? _mongoc_shard_router_rank (bson_iter_type (&va)) : 1;
+         rb = has_b ? _mongoc_shard_router_rank (bson_iter_type (&vb)) : 1;
+         r = ra < rb ? -1 : (ra > rb);
+      }
+
+      if (r) {
+         return bson_iter_as_int64 (&siter) < 0 ? -r : r;
+      }
+   }
+
+   return 0;
+}
+
+
+static bool
+_mongoc_shard_router_targetable (const bson_iter_t *iter)
+{
+   double d;
+
+   switch (bson_iter_type (iter)) {
+   case BSON_TYPE_DOUBLE:
+      d = bson_iter_double (iter);
+      return d == d;
+   case BSON_TYPE_INT32:
+   case BSON_TYPE_INT64:
+   case BSON_TYPE_UTF8:
+   case BSON_TYPE_OID:
+   case BSON_TYPE_BOOL:
+   case BSON_TYPE_DATE_TIME:
+   case BSON_TYPE_TIMESTAMP:
+      return true;
+   default:
+      return false;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_extract_key --
+ *
+ *       Build in @key, which must be initialized, the value of the shard
+ *       key @pattern in @doc: a document to insert, or if @is_query a
+ *       query or selector, possibly wrapped in "$query". A query only
+ *       yields a key if it has an equality on every field of the pattern
+ *       with a value of a type this can compare; operators, arrays,
+ *       subdocuments, regular expressions and nulls can match documents
+ *       in more than one chunk.
+ *
+ * Returns:
+ *       true if the key was built, otherwise false.
+ *
+ * Side effects:
+ *       @key is appended to, also when false is returned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_shard_router_extract_key (const bson_t *pattern,
+                                  const bson_t *doc,
+                                  bool          is_query,
+                                  bson_t       *key)
+{
+   bson_iter_t piter;
+   bson_iter_t iter;
+   bson_iter_t child;
+   const uint8_t *data;
+   uint32_t len;
+   bson_t query;
+   const char *field;
+
+   BSON_ASSERT (pattern);
+   BSON_ASSERT (doc);
+   BSON_ASSERT (key);
+
+   if (is_query &&
+       bson_iter_init_find (&iter, doc, "$query") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+
+      if (!bson_init_static (&query, data, len)) {
+         return false;
+      }
+
+      doc = &query;
+   }
+
+   if (!bson_iter_init (&piter, pattern)) {
+      return false;
+   }
+
+   while (bson_iter_next (&piter)) {
+      field = bson_iter_key (&piter);
+
+      if (bson_iter_init_find (&iter, doc, field)) {
+         child = iter;
+      } else if (!(bson_iter_init (&iter, doc) &&
+                   bson_iter_find_descendant (&iter, field, &child))) {
+         return false;
+      }
+
+      if (!_mongoc_shard_router_targetable (&child) ||
+          !bson_append_iter (key, field, -1, &child)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_uri_string --
+ *
+ *       Build the URI of a shard from the @uri_string of the mongos
+ *       client and a @host from config.shards, "rs/a:1,b:2" for a
+ *       replica set or "a:1" for a single server. Credentials, database
+ *       and options are those of @uri_string.
+ *
+ * Returns:
+ *       A newly allocated string that should be freed with bson_free().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+char *
+_mongoc_shard_router_uri_string (const char *uri_string,
+                                 const char *host)
+{
+   bson_string_t *str;
+   const char *hosts;
+   const char *tail;
+   const char *creds = NULL;
+   const char *list;
+   const char *p;
+
+   BSON_ASSERT (uri_string);
+   BSON_ASSERT (host);
+
+   hosts = strstr (uri_string, "://");
+   hosts = hosts ? hosts + 3 : uri_string;
+
+   if (!(tail = strchr (hosts, '/'))) {
+      tail = hosts + strlen (hosts);
+   }
+
+   for (p = hosts; p < tail; p++) {
+      if (*p == '@') {
+         creds = p + 1;
+      }
+   }
+
+   list = strchr (host, '/');
+
+   str = bson_string_new ("mongodb://");
+
+   if (creds) {
+      bson_string_append_printf (str, "%.*s", (int)(creds - hosts), hosts);
+   }
+
+   bson_string_append (str, list ? list + 1 : host);
+   bson_string_append (str, *tail ? tail : "/");
+
+   if (list) {
+      if (!strchr (tail, '?')) {
+         bson_string_append_c (str, '?');
+      } else if (str->str [str->len - 1] != '?' &&
+                 str->str [str->len - 1] != '&') {
+         bson_string_append_c (str, '&');
+      }
+
+      bson_string_append_printf (str, "replicaSet=%.*s",
+                                 (int)(list - host), host);
+   }
+
+   return bson_string_free (str, false);
+}
+
+
+bool
+_mongoc_shard_router_is_stale (int32_t code)
+{
+   return (code == MONGOC_SHARD_ERROR_STALE_CONFIG ||
+           code == MONGOC_SHARD_ERROR_STALE_SHARD_VERSION ||
+           code == MONGOC_SHARD_ERROR_NOT_IN_CHUNK);
+}
+
+
+/*
+ * Query a collection of the config database through mongos. This uses
+ * _mongoc_cursor_new() rather than mongoc_collection_find() so that the
+ * query cache never answers with an outdated chunk map.
+ */
+static mongoc_cursor_t *
+_mongoc_shard_router_query_config (mongoc_shard_router_t *router,
+                                   const char            *ns,
+                                   const bson_t          *query)
+{
+   return _mongoc_cursor_new (router->client, ns, MONGOC_QUERY_NONE, 0, 0, 0,
+                              false, query, NULL, NULL);
+}
+
+
+static bool
+_mongoc_shard_router_load_shards (mongoc_shard_router_t *router)
+{
+   mongoc_cursor_t *cursor;
+   mongoc_shard_t *shard;
+   mongoc_shard_t tmp;
+   const bson_t *doc;
+   bson_iter_t iter;
+   const char *name;
+   const char *host;
+   bson_t query = BSON_INITIALIZER;
+   size_t i;
+   bool ret;
+
+   ENTRY;
+
+   cursor = _mongoc_shard_router_query_config (router, "config.shards",
+                                               &query);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      if (!bson_iter_init_find (&iter, doc, "_id") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         continue;
+      }
+
+      name = bson_iter_utf8 (&iter, NULL);
+
+      if (!bson_iter_init_find (&iter, doc, "host") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter)) {
+         continue;
+      }
+
+      host = bson_iter_utf8 (&iter, NULL);
+
+      for (i = 0; i < router->shards.len; i++) {
+         shard = &_mongoc_array_index (&router->shards, mongoc_shard_t, i);
+
+         if (!strcmp (shard->name, name)) {
+            break;
+         }
+      }
+
+      if (i == router->shards.len) {
+         memset (&tmp, 0, sizeof tmp);
+         tmp.name = bson_strdup (name);
+         tmp.host = bson_strdup (host);
+         _mongoc_array_append_val (&router->shards, tmp);
+      } else if (strcmp (shard->host, host)) {
+         /* the shard moved, connect again on the next operation */
+         bson_free (shard->host);
+         shard->host = bson_strdup (host);
+         shard->failed = false;
+
+         if (shard->client) {
+            mongoc_client_destroy (shard->client);
+            shard->client = NULL;
+         }
+      }
+   }
+
+   ret = !mongoc_cursor_error (cursor, NULL);
+   mongoc_cursor_destroy (cursor);
+
+   if (ret) {
+      router->shards_expire_at = bson_get_monotonic_time () + router->ttl_usec;
+   }
+
+   RETURN (ret);
+}
+
+
+static bool
+_mongoc_shard_router_find_shard (mongoc_shard_router_t *router,
+                                 const char            *name,
+                                 uint32_t              *index)
+{
+   mongoc_shard_t *shard;
+   size_t i;
+
+   for (i = 0; i < router->shards.len; i++) {
+      shard = &_mongoc_array_index (&router->shards, mongoc_shard_t, i);
+
+      if (!strcmp (shard->name, name)) {
+         *index = (uint32_t)i;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+
+/*
+ * Read the shard key and the chunks of @map->ns from the config
+ * database. The map is left without a key, so nothing is routed, if the
+ * collection is not sharded, is sharded on a hashed key, or the config
+ * servers can't be read.
+ */
+static void
+_mongoc_shard_router_load_map (mongoc_shard_router_t *router,
+                               mongoc_shard_map_t    *map)
+{
+   mongoc_shard_chunk_t chunk;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   const uint8_t *data;
+   bson_iter_t iter;
+   bson_iter_t min;
+   bson_iter_t max;
+   uint32_t len;
+   bson_t pattern;
+   bson_t *query;
+   bool ok = true;
+
+   ENTRY;
+
+   _mongoc_shard_map_clear (map);
+   map->expire_at = bson_get_monotonic_time () + router->ttl_usec;
+
+   query = BCON_NEW ("_id", BCON_UTF8 (map->ns));
+   cursor = _mongoc_shard_router_query_config (router, "config.collections",
+                                               query);
+   bson_destroy (query);
+
+   if (mongoc_cursor_next (cursor, &doc) &&
+       !(bson_iter_init_find (&iter, doc, "dropped") &&
+         bson_iter_as_bool (&iter)) &&
+       bson_iter_init_find (&iter, doc, "key") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &len, &data);
+
+      if (bson_init_static (&pattern, data, len) &&
+          bson_iter_init (&iter, &pattern)) {
+         map->key = bson_copy (&pattern);
+
+         while (bson_iter_next (&iter)) {
+            /* { "k": "hashed" } chunks are ranges of hashes */
+            if (!BSON_ITER_HOLDS_NUMBER (&iter)) {
+               bson_destroy (map->key);
+               map->key = NULL;
+               break;
+            }
+         }
+      }
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   if (!map->key) {
+      EXIT;
+   }
+
+   if (router->shards_expire_at <= bson_get_monotonic_time () &&
+       !_mongoc_shard_router_load_shards (router)) {
+      _mongoc_shard_map_clear (map);
+      EXIT;
+   }
+
+   query = BCON_NEW ("$query", "{", "ns", BCON_UTF8 (map->ns), "}",
+                     "$orderby", "{", "min", BCON_INT32 (1), "}");
+   cursor = _mongoc_shard_router_query_config (router, "config.chunks",
+                                               query);
+   bson_destroy (query);
+
+   while (ok && mongoc_cursor_next (cursor, &doc)) {
+      if (!bson_iter_init_find (&min, doc, "min") ||
+          !BSON_ITER_HOLDS_DOCUMENT (&min) ||
+          !bson_iter_init_find (&max, doc, "max") ||
+          !BSON_ITER_HOLDS_DOCUMENT (&max) ||
+          !bson_iter_init_find (&iter, doc, "shard") ||
+          !BSON_ITER_HOLDS_UTF8 (&iter) ||
+          !_mongoc_shard_router_find_shard (router,
+                                            bson_iter_utf8 (&iter, NULL),
+                                            &chunk.shard)) {
+         ok = false;
+         break;
+      }
+
+      bson_iter_document (&min, &len, &data);
+      chunk.min = bson_new_from_data (data, len);
+      bson_iter_document (&max, &len, &data);
+      chunk.max = bson_new_from_data (data, len);
+
+      if (!chunk.min || !chunk.max) {
+         if (chunk.min) {
+            bson_destroy (chunk.min);
+         }
+         if (chunk.max) {
+            bson_destroy (chunk.max);
+         }
+         ok = false;
+         break;
+      }
+
+      _mongoc_array_append_val (&map->chunks, chunk);
+   }
+
+   if (!ok || mongoc_cursor_error (cursor, NULL)) {
+      MONGOC_DEBUG ("Not routing \"%s\", its chunks could not be read.",
+                    map->ns);
+      _mongoc_shard_map_clear (map);
+      /* a shard we don't know of yet, read config.shards next time */
+      router->shards_expire_at = 0;
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   EXIT;
+}
+
+
+static mongoc_shard_map_t *
+_mongoc_shard_router_get_map (mongoc_shard_router_t *router,
+                              const char            *ns)
+{
+   mongoc_shard_map_t *map;
+   mongoc_shard_map_t tmp;
+   size_t i;
+
+   for (i = 0; i < router->maps.len; i++) {
+      map = &_mongoc_array_index (&router->maps, mongoc_shard_map_t, i);
+
+      if (!strcmp (map->ns, ns)) {
+         return map;
+      }
+   }
+
+   memset (&tmp, 0, sizeof tmp);
+   bson_strncpy (tmp.ns, ns, sizeof tmp.ns);
+   _mongoc_array_init (&tmp.chunks, sizeof (mongoc_shard_chunk_t));
+   _mongoc_array_append_val (&router->maps, tmp);
+
+   return &_mongoc_array_index (&router->maps, mongoc_shard_map_t,
+                                router->maps.len - 1);
+}
+
+
+/*
+ * The chunk of @map that holds @key: the last one whose min is not
+ * greater than @key, if @key is below its max.
+ */
+static mongoc_shard_chunk_t *
+_mongoc_shard_map_find_chunk (mongoc_shard_map_t *map,
+                              const bson_t       *key)
+{
+   mongoc_shard_chunk_t *chunk;
+   size_t lo = 0;
+   size_t hi = map->chunks.len;
+   size_t mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      chunk = &_mongoc_array_index (&map->chunks, mongoc_shard_chunk_t, mid);
+
+      if (_mongoc_shard_router_compare (key, chunk->min) < 0) {
+         hi = mid;
+      } else {
+         lo = mid + 1;
+      }
+   }
+
+   if (!lo) {
+      return NULL;
+   }
+
+   chunk = &_mongoc_array_index (&map->chunks, mongoc_shard_chunk_t, lo - 1);
+
+   if (_mongoc_shard_router_compare (key, chunk->max) >= 0) {
+      return NULL;
+   }
+
+   return chunk;
+}
+
+
+/*
+ * The chunk map of @ns, read again if it is unknown or has expired, or
+ * NULL if @ns is not routed: the cluster is not sharded, the namespace is
+ * a system one, or the collection has no ranged shard key.
+ */
+static mongoc_shard_map_t *
+_mongoc_shard_router_routable_map (mongoc_shard_router_t *router,
+                                   const char            *ns)
+{
+   mongoc_shard_map_t *map;
+
+   if (router->client->cluster.mode != MONGOC_CLUSTER_SHARDED_CLUSTER ||
+       !strncmp (ns, "config.", 7) ||
+       !strncmp (ns, "admin.", 6) ||
+       strstr (ns, ".$cmd") ||
+       strlen (ns) >= sizeof map->ns) {
+      return NULL;
+   }
+
+   map = _mongoc_shard_router_get_map (router, ns);
+
+   if (map->expire_at <= bson_get_monotonic_time ()) {
+      _mongoc_shard_router_load_map (router, map);
+   }
+
+   if (!map->key || !map->chunks.len) {
+      return NULL;
+   }
+
+   return map;
+}
+
+
+/*
+ * The client connected to @shard, created the first time it is needed.
+ * NULL if it could not be created, which is not tried again until the
+ * shard moves.
+ */
+static mongoc_client_t *
+_mongoc_shard_router_connect (mongoc_shard_router_t *router,
+                              mongoc_shard_t        *shard)
+{
+   char *uri_string;
+
+   if (!shard->client && !shard->failed) {
+      uri_string = _mongoc_shard_router_uri_string (
+         mongoc_uri_get_string (router->client->uri), shard->host);
+      shard->client = _mongoc_client_new_for_shard (router->client,
+                                                    uri_string);
+
+      if (shard->client) {
+         shard->client->routed_by = router;
+      } else {
+         MONGOC_WARNING ("Failed to create a client for shard \"%s\".",
+                         shard->name);
+         shard->failed = true;
+      }
+
+      bson_free (uri_string);
+   }
+
+   return shard->client;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_target --
+ *
+ *       Find the shard that owns the documents of @ns that @doc, a
+ *       document to insert or if @is_query a query or selector, can
+ *       match, reading the chunk map of @ns if it is unknown or has
+ *       expired.
+ *
+ * Returns:
+ *       A client connected to the shard, owned by @router, or NULL if the
+ *       operation must go through mongos.
+ *
+ * Side effects:
+ *       The config database may be queried and a client created.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_client_t *
+_mongoc_shard_router_target (mongoc_shard_router_t *router,
+                             const char            *ns,
+                             const bson_t          *doc,
+                             bool                   is_query)
+{
+   mongoc_shard_chunk_t *chunk;
+   mongoc_shard_map_t *map;
+   mongoc_shard_t *shard;
+   bson_t key;
+
+   ENTRY;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (ns);
+   BSON_ASSERT (doc);
+
+   if (!(map = _mongoc_shard_router_routable_map (router, ns))) {
+      RETURN (NULL);
+   }
+
+   bson_init (&key);
+
+   if (!_mongoc_shard_router_extract_key (map->key, doc, is_query, &key) ||
+       !(chunk = _mongoc_shard_map_find_chunk (map, &key))) {
+      bson_destroy (&key);
+      RETURN (NULL);
+   }
+
+   bson_destroy (&key);
+
+   shard = &_mongoc_array_index (&router->shards, mongoc_shard_t,
+                                 chunk->shard);
+
+   RETURN (_mongoc_shard_router_connect (router, shard));
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_owners --
+ *
+ *       Append to @owners, an array of uint32_t, the index in
+ *       router->shards of each shard that owns a chunk of @ns, connecting
+ *       to those the router has no client for yet.
+ *
+ * Returns:
+ *       true if every owner has a client; false if @ns is not routed or
+ *       a shard can't be reached, in which case queries on @ns must go
+ *       through mongos.
+ *
+ * Side effects:
+ *       The config database may be queried and clients created.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_shard_router_owners (mongoc_shard_router_t *router,
+                             const char            *ns,
+                             mongoc_array_t        *owners)
+{
+   mongoc_shard_chunk_t *chunk;
+   mongoc_shard_map_t *map;
+   mongoc_shard_t *shard;
+   uint8_t *owned;
+   uint32_t i;
+   bool ret = true;
+
+   ENTRY;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (ns);
+   BSON_ASSERT (owners);
+
+   if (!(map = _mongoc_shard_router_routable_map (router, ns))) {
+      RETURN (false);
+   }
+
+   owned = bson_malloc0 (router->shards.len);
+
+   for (i = 0; i < map->chunks.len; i++) {
+      chunk = &_mongoc_array_index (&map->chunks, mongoc_shard_chunk_t, i);
+      owned [chunk->shard] = 1;
+   }
+
+   for (i = 0; ret && i < router->shards.len; i++) {
+      if (owned [i]) {
+         shard = &_mongoc_array_index (&router->shards, mongoc_shard_t, i);
+         ret = !!_mongoc_shard_router_connect (router, shard);
+         _mongoc_array_append_val (owners, i);
+      }
+   }
+
+   bson_free (owned);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_shard_router_owns --
+ *
+ *       Check whether @doc, read from the shard router->shards [@shard],
+ *       is in a chunk of @ns that shard owns. Documents left behind on
+ *       a shard by a chunk migration are still returned by queries sent
+ *       to it directly, mongos is what filters them out otherwise.
+ *
+ * Returns:
+ *       false if @doc is in a chunk owned by another shard; true if it
+ *       is not, or if that can't be told, such as when the shard key was
+ *       projected away or the chunk map of @ns is being read again.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_shard_router_owns (mongoc_shard_router_t *router,
+                           const char            *ns,
+                           uint32_t               shard,
+                           const bson_t          *doc)
+{
+   mongoc_shard_chunk_t *chunk;
+   mongoc_shard_map_t *map;
+   bson_t key;
+   bool ret = true;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (ns);
+   BSON_ASSERT (doc);
+
+   map = _mongoc_shard_router_get_map (router, ns);
+
+   if (!map->key) {
+      return true;
+   }
+
+   bson_init (&key);
+
+   if (_mongoc_shard_router_extract_key (map->key, doc, false, &key) &&
+       (chunk = _mongoc_shard_map_find_chunk (map, &key))) {
+      ret = (chunk->shard == shard);
+   }
+
+   bson_destroy (&key);
+
+   return ret;
+}
+
+
+/*
+ * Forget the chunk map of @ns after a shard reported it out of date, it
+ * is read again by the next operation on @ns.
+ */
+void
+_mongoc_shard_router_invalidate (mongoc_shard_router_t *router,
+                                 const char            *ns)
+{
+   mongoc_shard_map_t *map;
+   size_t i;
+
+   BSON_ASSERT (router);
+   BSON_ASSERT (ns);
+
+   for (i = 0; i < router->maps.len; i++) {
+      map = &_mongoc_array_index (&router->maps, mongoc_shard_map_t, i);
+
+      if (!strcmp (map->ns, ns)) {
+         MONGOC_DEBUG ("Chunk map of \"%s\" is stale.", ns);
+         map->expire_at = 0;
+         router->shards_expire_at = 0;
+      }
+   }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_SOCKET_PRIVATE_H
+#define MONGOC_SOCKET_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-socket.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct
+{
+   mongoc_socket_t *socket;
+   int              events;
+   int              revents;
+} mongoc_socket_poll_t;
+
+
+ssize_t _mongoc_socket_poll           (mongoc_socket_poll_t  *sds,
+                                       size_t                 nsds,
+                                       int32_t                timeout_msec);
+int     _mongoc_socket_connect_begin  (mongoc_socket_t       *sock,
+                                       const struct sockaddr *addr,
+                                       socklen_t              addrlen);
+int     _mongoc_socket_connect_finish (mongoc_socket_t       *sock);
+void    _mongoc_socket_abandon        (mongoc_socket_t       *sock);
+char   *_mongoc_socket_getnameinfo_cached (mongoc_socket_t   *sock,
+                                           int64_t            ttl_msec);
+#ifdef _WIN32
+SOCKET  _mongoc_socket_get_fd         (mongoc_socket_t       *sock);
+#else
+int     _mongoc_socket_get_fd         (mongoc_socket_t       *sock);
+#endif
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_SOCKET_PRIVATE_H */
@@ -19,15 +19,31 @@
 #include <string.h>
 
 #include "mongoc-counters-private.h"
+#include "mongoc-dns-cache-private.h"
 #include "mongoc-errno-private.h"
 #include "mongoc-host-list.h"
-#include "mongoc-socket.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-trace.h"
 
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+# include <linux/errqueue.h>
+# define MONGOC_HAVE_ZEROCOPY 1
+#endif
+
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "socket"
 
 
+/*
+ * Sends of at least this many bytes use MSG_ZEROCOPY on sockets that have
+ * SO_ZEROCOPY enabled. Below it, pinning the pages and reaping the
+ * completion costs more than the copy does.
+ */
+#ifndef MONGOC_SOCKET_ZEROCOPY_MIN_BYTES
+# define MONGOC_SOCKET_ZEROCOPY_MIN_BYTES (128 * 1024)
+#endif
+
+
 struct _mongoc_socket_t
 {
 #ifdef _WIN32
@@ -37,6 +53,10 @@ struct _mongoc_socket_t
 #endif
    int errno_;
    int domain;
+   bool awaiting_reply;
+   bool zerocopy;
+   uint32_t zerocopy_sent;
+   uint32_t zerocopy_done;
 };
 
 
@@ -440,6 +460,136 @@ mongoc_socket_close (mongoc_socket_t *sock) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_abandon --
+ *
+ *       Close the descriptor of @sock without shutting the connection
+ *       down. A parent process that shares the descriptor across fork()
+ *       keeps using the connection as if nothing happened.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @sock can no longer be used for I/O.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_socket_abandon (mongoc_socket_t *sock) /* IN */
+{
+   ENTRY;
+
+   BSON_ASSERT (sock);
+
+#ifdef _WIN32
+   if (sock->sd != INVALID_SOCKET) {
+      closesocket (sock->sd);
+      sock->sd = INVALID_SOCKET;
+   }
+#else
+   if (sock->sd != -1) {
+      close (sock->sd);
+      sock->sd = -1;
+   }
+#endif
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_connect_begin --
+ *
+ *       Start connecting @sock to @addr without waiting for the
+ *       connection to be established.
+ *
+ * Returns:
+ *       0 if connected, 1 if the connection is in progress and
+ *       _mongoc_socket_connect_finish() should be called once @sock
+ *       polls writable, otherwise -1 and errno is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_socket_connect_begin (mongoc_socket_t       *sock,    /* IN */
+                              const struct sockaddr *addr,    /* IN */
+                              socklen_t              addrlen) /* IN */
+{
+   int ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (sock, -1);
+   bson_return_val_if_fail (addr, -1);
+   bson_return_val_if_fail (addrlen, -1);
+
+   ret = connect (sock->sd, addr, addrlen);
+
+   _mongoc_socket_capture_errno (sock);
+
+#ifdef _WIN32
+   if (ret == SOCKET_ERROR) {
+#else
+   if (ret == -1) {
+#endif
+      RETURN (_mongoc_socket_errno_is_again (sock) ? 1 : -1);
+   }
+
+   RETURN (0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_connect_finish --
+ *
+ *       Check the outcome of a connection started with
+ *       _mongoc_socket_connect_begin() once @sock has polled writable.
+ *
+ * Returns:
+ *       0 if connected, otherwise -1 and errno is set.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+int
+_mongoc_socket_connect_finish (mongoc_socket_t *sock) /* IN */
+{
+   int ret;
+   int optval = -1;
+   socklen_t optlen = sizeof optval;
+
+   ENTRY;
+
+   bson_return_val_if_fail (sock, -1);
+
+   ret = getsockopt (sock->sd, SOL_SOCKET, SO_ERROR,
+                     (char *)&optval, &optlen);
+
+   if ((ret == 0) && (optval == 0)) {
+      RETURN (0);
+   }
+
+   errno = sock->errno_ = optval;
+
+   RETURN (-1);
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -463,11 +613,7 @@ mongoc_socket_connect (mongoc_socket_t       *sock,      /* IN */
                        socklen_t              addrlen,   /* IN */
                        int64_t                expire_at) /* IN */
 {
-   bool try_again = false;
-   bool failed = false;
    int ret;
-   int optval;
-   socklen_t optlen = sizeof optval;
 
    ENTRY;
 
@@ -475,36 +621,16 @@ mongoc_socket_connect (mongoc_socket_t       *sock,      /* IN */
    bson_return_val_if_fail (addr, false);
    bson_return_val_if_fail (addrlen, false);
 
-   ret = connect (sock->sd, addr, addrlen);
-
-   _mongoc_socket_capture_errno (sock);
-
-#ifdef _WIN32
-   if (ret == SOCKET_ERROR) {
-#else
-   if (ret == -1) {
-#endif
-      failed = true;
-      try_again = _mongoc_socket_errno_is_again (sock);
-   }
+   ret = _mongoc_socket_connect_begin (sock, addr, addrlen);
 
-   if (failed && try_again) {
+   if (ret == 1) {
       if (_mongoc_socket_wait (sock->sd, POLLOUT, expire_at)) {
-         optval = -1;
-         ret = getsockopt (sock->sd, SOL_SOCKET, SO_ERROR,
-                           (char *)&optval, &optlen);
-         if ((ret == 0) && (optval == 0)) {
-            RETURN (0);
-         } else {
-            errno = sock->errno_ = optval;
-         }
+         RETURN (_mongoc_socket_connect_finish (sock));
       }
       RETURN (-1);
-   } else if (failed) {
-      RETURN (-1);
-   } else {
-      RETURN (0);
    }
+
+   RETURN (ret);
 }
 
 
@@ -683,6 +809,17 @@ mongoc_socket_recv (mongoc_socket_t *sock,      /* IN */
    bson_return_val_if_fail (buf, -1);
    bson_return_val_if_fail (buflen, -1);
 
+   /*
+    * Right after a request has been sent, the reply is almost never in
+    * the socket buffer yet. Wait for it before calling recv() instead of
+    * spending a syscall on a recv() that fails with EAGAIN.
+    */
+   if (sock->awaiting_reply && expire_at) {
+      _mongoc_socket_wait (sock->sd, POLLIN, expire_at);
+   }
+
+   sock->awaiting_reply = false;
+
 again:
    sock->errno_ = 0;
 #ifdef _WIN32
@@ -746,6 +883,13 @@ mongoc_socket_setsockopt (mongoc_socket_t *sock,    /* IN */
 
    _mongoc_socket_capture_errno (sock);
 
+#ifdef MONGOC_HAVE_ZEROCOPY
+   if ((ret == 0) && (level == SOL_SOCKET) && (optname == SO_ZEROCOPY) &&
+       (optlen == sizeof (int))) {
+      sock->zerocopy = (0 != *(const int *)optval);
+   }
+#endif
+
    RETURN (ret);
 }
 
@@ -868,9 +1012,10 @@ _mongoc_socket_try_sendv_slow (mongoc_socket_t *sock,   /* IN */
  */
 
 static ssize_t
-_mongoc_socket_try_sendv (mongoc_socket_t *sock,   /* IN */
-                          mongoc_iovec_t  *iov,    /* IN */
-                          size_t           iovcnt) /* IN */
+_mongoc_socket_try_sendv (mongoc_socket_t *sock,     /* IN */
+                          mongoc_iovec_t  *iov,      /* IN */
+                          size_t           iovcnt,   /* IN */
+                          bool             zerocopy) /* IN */
 {
 #ifdef _WIN32
    DWORD dwNumberofBytesSent = 0;
@@ -895,6 +1040,22 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock,   /* IN */
    memset (&msg, 0, sizeof msg);
    msg.msg_iov = iov;
    msg.msg_iovlen = (int) iovcnt;
+# ifdef MONGOC_HAVE_ZEROCOPY
+   if (zerocopy) {
+      ret = sendmsg (sock->sd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+      if (ret >= 0) {
+         sock->zerocopy_sent++;
+         mongoc_counter_streams_egress_zerocopy_add (ret);
+         RETURN (ret);
+      }
+
+      /* ENOBUFS means we are over the optmem limit, just copy. */
+      if (errno != ENOBUFS) {
+         _mongoc_socket_capture_errno (sock);
+         RETURN (ret);
+      }
+   }
+# endif
    ret = sendmsg (sock->sd, &msg,
 # ifdef MSG_NOSIGNAL
                   MSG_NOSIGNAL);
@@ -922,6 +1083,80 @@ _mongoc_socket_try_sendv (mongoc_socket_t *sock,   /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_zerocopy_wait --
+ *
+ *       Reap the completion notifications of the MSG_ZEROCOPY sends made
+ *       on @sock from its error queue, until the kernel no longer
+ *       references any buffer that was passed to one of them.
+ *
+ * Returns:
+ *       true if all sends completed, false on failure or if @expire_at
+ *       passed first.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_socket_zerocopy_wait (mongoc_socket_t *sock,      /* IN */
+                              int64_t          expire_at) /* IN */
+{
+#ifdef MONGOC_HAVE_ZEROCOPY
+   struct sock_extended_err *serr;
+   struct cmsghdr *cm;
+   struct msghdr msg;
+   char control [128];
+   ssize_t ret;
+
+   ENTRY;
+
+   while ((int32_t)(sock->zerocopy_sent - sock->zerocopy_done) > 0) {
+      memset (&msg, 0, sizeof msg);
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof control;
+
+      ret = recvmsg (sock->sd, &msg, MSG_ERRQUEUE);
+
+      if (ret == -1) {
+         _mongoc_socket_capture_errno (sock);
+
+         /* the error queue is reported as POLLERR */
+         if (!_mongoc_socket_errno_is_again (sock) ||
+             !_mongoc_socket_wait (sock->sd, POLLERR, expire_at)) {
+            RETURN (false);
+         }
+
+         continue;
+      }
+
+      for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm)) {
+         if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+               (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+            continue;
+         }
+
+         serr = (struct sock_extended_err *)CMSG_DATA (cm);
+
+         if ((serr->ee_errno == 0) &&
+             (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY)) {
+            /* sends numbered ee_info through ee_data have completed */
+            sock->zerocopy_done = serr->ee_data + 1;
+         }
+      }
+   }
+
+   RETURN (true);
+#else
+   return true;
+#endif
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -954,6 +1189,9 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
    ssize_t ret = 0;
    ssize_t sent;
    size_t cur = 0;
+   size_t total = 0;
+   bool zerocopy = false;
+   size_t i;
 
    ENTRY;
 
@@ -961,8 +1199,16 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
    bson_return_val_if_fail (iov, -1);
    bson_return_val_if_fail (iovcnt, -1);
 
+   if (sock->zerocopy) {
+      for (i = 0; i < iovcnt; i++) {
+         total += iov [i].iov_len;
+      }
+      zerocopy = (expire_at && (total >= MONGOC_SOCKET_ZEROCOPY_MIN_BYTES));
+   }
+
    for (;;) {
-      sent = _mongoc_socket_try_sendv (sock, &iov [cur], iovcnt - cur);
+      sent = _mongoc_socket_try_sendv (sock, &iov [cur], iovcnt - cur,
+                                       zerocopy);
 
       /*
        * If we failed with anything other than EAGAIN or EWOULDBLOCK,
@@ -971,7 +1217,8 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
        */
       if (sent == -1) {
          if (!_mongoc_socket_errno_is_again (sock)) {
-            RETURN (ret ? ret : -1);
+            ret = ret ? ret : -1;
+            GOTO (done);
          }
       }
 
@@ -994,6 +1241,7 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
           * sending data over the socket.
           */
          if (cur == iovcnt) {
+            sock->awaiting_reply = true;
             break;
          }
 
@@ -1012,7 +1260,8 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
 #else
          errno = ETIMEDOUT;
 #endif
-         RETURN (ret ? ret : -1);
+         ret = ret ? ret : -1;
+         GOTO (done);
       }
 
       /*
@@ -1026,10 +1275,20 @@ mongoc_socket_sendv (mongoc_socket_t  *sock,      /* IN */
             errno = ETIMEDOUT;
 #endif
          }
-         RETURN (ret  ? ret : -1);
+         ret = ret ? ret : -1;
+         GOTO (done);
       }
    }
 
+done:
+   /*
+    * The caller may free or reuse @iov as soon as we return, so wait for
+    * the kernel to release the pages of any zero-copy send.
+    */
+   if (zerocopy && !_mongoc_socket_zerocopy_wait (sock, expire_at)) {
+      ret = -1;
+   }
+
    RETURN (ret);
 }
 
@@ -1056,7 +1315,34 @@ mongoc_socket_getsockname (mongoc_socket_t *sock,    /* IN */
 char *
 mongoc_socket_getnameinfo (mongoc_socket_t *sock) /* IN */
 {
-   struct sockaddr addr;
+   return _mongoc_socket_getnameinfo_cached (sock, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_getnameinfo_cached --
+ *
+ *       Like mongoc_socket_getnameinfo(), but the name of the peer is
+ *       looked up through the process-wide DNS cache and reused for
+ *       @ttl_msec milliseconds.
+ *
+ * Returns:
+ *       A newly allocated string that should be freed with bson_free(),
+ *       or NULL on failure.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+char *
+_mongoc_socket_getnameinfo_cached (mongoc_socket_t *sock,     /* IN */
+                                   int64_t          ttl_msec) /* IN */
+{
+   struct sockaddr_storage addr;
    socklen_t len = sizeof addr;
    char *ret;
    char host [BSON_HOST_NAME_MAX + 1];
@@ -1065,8 +1351,9 @@ mongoc_socket_getnameinfo (mongoc_socket_t *sock) /* IN */
 
    bson_return_val_if_fail (sock, NULL);
 
-   if ((0 == getpeername (sock->sd, &addr, &len)) &&
-       (0 == getnameinfo (&addr, len, host, sizeof host, NULL, 0, 0))) {
+   if ((0 == getpeername (sock->sd, (struct sockaddr *)&addr, &len)) &&
+       _mongoc_dns_cache_getnameinfo ((struct sockaddr *)&addr, len,
+                                      ttl_msec, host, sizeof host)) {
       ret = bson_strdup (host);
       RETURN (ret);
    }
@@ -1099,6 +1386,110 @@ mongoc_socket_check_closed (mongoc_socket_t *sock) /* IN */
    return closed;
 }
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_poll --
+ *
+ *       Wait for any of the sockets in @sds to become ready for the
+ *       events requested in each element's @events field. The matching
+ *       events are stored in @revents.
+ *
+ *       @timeout_msec is the number of milliseconds to wait. Zero does
+ *       not block at all and -1 blocks forever.
+ *
+ * Returns:
+ *       The number of sockets with events, 0 on timeout, or -1 on failure.
+ *
+ * Side effects:
+ *       The @revents field of each element of @sds is set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+ssize_t
+_mongoc_socket_poll (mongoc_socket_poll_t *sds,          /* INOUT */
+                     size_t                nsds,         /* IN */
+                     int32_t               timeout_msec) /* IN */
+{
+#ifdef _WIN32
+   WSAPOLLFD *pfds;
+#else
+   struct pollfd *pfds;
+#endif
+   int ret;
+   size_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (sds, -1);
+
+   if (!nsds) {
+      RETURN (0);
+   }
+
+   pfds = bson_malloc (sizeof (*pfds) * nsds);
+
+   for (i = 0; i < nsds; i++) {
+      pfds[i].fd = sds[i].socket->sd;
+#ifdef _WIN32
+      pfds[i].events = sds[i].events;
+#else
+      pfds[i].events = sds[i].events | POLLERR | POLLHUP;
+#endif
+      pfds[i].revents = 0;
+   }
+
+#ifdef _WIN32
+   ret = WSAPoll (pfds, (ULONG)nsds, timeout_msec);
+   if (ret == SOCKET_ERROR) {
+      MONGOC_WARNING ("WSAGetLastError(): %d", WSAGetLastError ());
+      ret = -1;
+   }
+#else
+   ret = poll (pfds, nsds, timeout_msec);
+#endif
+
+   for (i = 0; i < nsds; i++) {
+      sds[i].revents = (ret > 0) ? pfds[i].revents : 0;
+   }
+
+   bson_free (pfds);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_socket_get_fd --
+ *
+ *       Fetch the underlying descriptor of @sock, so that it can be
+ *       registered with an external event loop.
+ *
+ * Returns:
+ *       The socket descriptor.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+#ifdef _WIN32
+SOCKET
+#else
+int
+#endif
+_mongoc_socket_get_fd (mongoc_socket_t *sock) /* IN */
+{
+   BSON_ASSERT (sock);
+
+   return sock->sd;
+}
+
 /*
  *
  *--------------------------------------------------------------------------
@@ -35,10 +35,20 @@ BSON_BEGIN_DECLS
 bool     _mongoc_ssl_check_cert      (SSL              *ssl,
                                       const char       *host,
                                       bool              weak_cert_validation);
+bool     _mongoc_ssl_check_cert_cached (SSL            *ssl,
+                                        const char     *host,
+                                        const char     *opt_key,
+                                        bool            weak_cert_validation);
 SSL_CTX *_mongoc_ssl_ctx_new         (mongoc_ssl_opt_t *opt);
+SSL_CTX *_mongoc_ssl_ctx_ref         (SSL_CTX          *ctx);
 char    *_mongoc_ssl_extract_subject (const char       *filename);
 void     _mongoc_ssl_init            (void);
 void     _mongoc_ssl_cleanup         (void);
+bool     _mongoc_ssl_session_cache_apply  (const char  *key,
+                                           SSL         *ssl);
+void     _mongoc_ssl_session_cache_put    (const char  *key,
+                                           SSL_SESSION *session);
+void     _mongoc_ssl_session_cache_remove (const char  *key);
 
 
 BSON_END_DECLS
@@ -25,8 +25,10 @@
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
 #include <openssl/crypto.h>
+#include <openssl/evp.h>
 
 #include <string.h>
+#include <time.h>
 
 #include "mongoc-init.h"
 #include "mongoc-socket.h"
@@ -59,6 +61,60 @@ mongoc_ssl_opt_t gMongocSslOptDefault = {
 
 static mongoc_mutex_t * gMongocSslThreadLocks;
 
+
+#ifndef MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES
+# define MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES 256
+#endif
+
+
+/*
+ * Client sessions, including session tickets, shared by every TLS stream
+ * in the process. A reconnect to the same server with the same
+ * certificate options resumes the session with an abbreviated handshake
+ * instead of doing the full key exchange again.
+ */
+typedef struct
+{
+   char        *key;
+   SSL_SESSION *session;
+   int64_t      stored_at;
+} mongoc_ssl_session_cache_entry_t;
+
+
+static mongoc_mutex_t                   gMongocSslSessionCacheMutex;
+static mongoc_ssl_session_cache_entry_t gMongocSslSessionCache[MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES];
+
+
+#ifndef MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES
+# define MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES 256
+#endif
+
+
+#ifndef MONGOC_SSL_VERIFY_CACHE_TTL_SEC
+/*
+ * How long a host name check is trusted at most, so that a new CRL or
+ * trust store is honored by connections made after it is in place.
+ */
+# define MONGOC_SSL_VERIFY_CACHE_TTL_SEC 600
+#endif
+
+
+/*
+ * Certificates whose host name was already checked, keyed by host,
+ * certificate options and the SHA-256 fingerprint of the certificate.
+ * Each entry expires at the notAfter of the certificate or after
+ * MONGOC_SSL_VERIFY_CACHE_TTL_SEC, whichever comes first.
+ */
+typedef struct
+{
+   char    *key;
+   int64_t  expire_at;
+} mongoc_ssl_verify_cache_entry_t;
+
+
+static mongoc_mutex_t                  gMongocSslVerifyCacheMutex;
+static mongoc_ssl_verify_cache_entry_t gMongocSslVerifyCache[MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES];
+
 static void _mongoc_ssl_thread_startup(void);
 static void _mongoc_ssl_thread_cleanup(void);
 
@@ -68,16 +124,21 @@ mongoc_ssl_opt_get_default (void)
    return &gMongocSslOptDefault;
 }
 
-/**
- * _mongoc_ssl_init:
- *
- * initialization function for SSL
- *
- * This needs to get called early on and is not threadsafe.  Called by
- * mongoc_init.
- */
-void
-_mongoc_ssl_init (void)
+static void
+_mongoc_ssl_session_cache_entry_clear (mongoc_ssl_session_cache_entry_t *entry)
+{
+   bson_free (entry->key);
+   if (entry->session) {
+      SSL_SESSION_free (entry->session);
+   }
+   memset (entry, 0, sizeof *entry);
+}
+
+
+static bool gMongocSslInitialized;
+
+
+static MONGOC_ONCE_FUN (_mongoc_ssl_do_init)
 {
    SSL_CTX *ctx;
 
@@ -86,6 +147,8 @@ _mongoc_ssl_init (void)
    ERR_load_BIO_strings ();
    OpenSSL_add_all_algorithms ();
    _mongoc_ssl_thread_startup ();
+   mongoc_mutex_init (&gMongocSslSessionCacheMutex);
+   mongoc_mutex_init (&gMongocSslVerifyCacheMutex);
 
    /*
     * Ensure we also load the ciphers now from the primary thread
@@ -98,14 +161,173 @@ _mongoc_ssl_init (void)
    }
 
    SSL_CTX_free (ctx);
+
+   gMongocSslInitialized = true;
+
+   MONGOC_ONCE_RETURN;
+}
+
+
+/**
+ * _mongoc_ssl_init:
+ *
+ * initialization function for SSL
+ *
+ * Loading the OpenSSL error strings and algorithms is most of the cost
+ * of starting a process that links the driver, so it is done once on
+ * first use, by the first SSL context or SCRAM authentication, rather
+ * than by mongoc_init. Applications that also use OpenSSL from other
+ * threads should initialize it themselves before the driver does.
+ */
+void
+_mongoc_ssl_init (void)
+{
+   static mongoc_once_t once = MONGOC_ONCE_INIT;
+   mongoc_once (&once, _mongoc_ssl_do_init);
 }
 
 void
 _mongoc_ssl_cleanup (void)
 {
+   int i;
+
+   if (!gMongocSslInitialized) {
+      return;
+   }
+
+   mongoc_mutex_lock (&gMongocSslSessionCacheMutex);
+   for (i = 0; i < MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES; i++) {
+      _mongoc_ssl_session_cache_entry_clear (&gMongocSslSessionCache[i]);
+   }
+   mongoc_mutex_unlock (&gMongocSslSessionCacheMutex);
+
+   mongoc_mutex_lock (&gMongocSslVerifyCacheMutex);
+   for (i = 0; i < MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES; i++) {
+      bson_free (gMongocSslVerifyCache[i].key);
+      gMongocSslVerifyCache[i].key = NULL;
+   }
+   mongoc_mutex_unlock (&gMongocSslVerifyCacheMutex);
+
    _mongoc_ssl_thread_cleanup ();
 }
 
+
+static mongoc_ssl_session_cache_entry_t *
+_mongoc_ssl_session_cache_find (const char *key)
+{
+   int i;
+
+   for (i = 0; i < MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES; i++) {
+      if (gMongocSslSessionCache[i].key &&
+          !strcmp (gMongocSslSessionCache[i].key, key)) {
+         return &gMongocSslSessionCache[i];
+      }
+   }
+
+   return NULL;
+}
+
+
+/**
+ * _mongoc_ssl_session_cache_apply:
+ *
+ * Make @ssl try to resume the session cached for @key, unless there is
+ * none or it has expired.
+ *
+ * Returns: true if a cached session was set on @ssl.
+ */
+bool
+_mongoc_ssl_session_cache_apply (const char *key,
+                                 SSL        *ssl)
+{
+   mongoc_ssl_session_cache_entry_t *entry;
+   SSL_SESSION *session;
+   bool ret = false;
+
+   BSON_ASSERT (key);
+   BSON_ASSERT (ssl);
+
+   mongoc_mutex_lock (&gMongocSslSessionCacheMutex);
+
+   if ((entry = _mongoc_ssl_session_cache_find (key))) {
+      session = entry->session;
+
+      if ((time (NULL) - SSL_SESSION_get_time (session)) >=
+          SSL_SESSION_get_timeout (session)) {
+         _mongoc_ssl_session_cache_entry_clear (entry);
+      } else {
+         /* SSL_set_session() takes its own reference */
+         ret = (1 == SSL_set_session (ssl, session));
+      }
+   }
+
+   mongoc_mutex_unlock (&gMongocSslSessionCacheMutex);
+
+   return ret;
+}
+
+
+/**
+ * _mongoc_ssl_session_cache_put:
+ *
+ * Cache @session for @key, replacing the previous session for @key or,
+ * if the cache is full, the oldest one. The cache takes over the
+ * caller's reference to @session.
+ */
+void
+_mongoc_ssl_session_cache_put (const char  *key,
+                               SSL_SESSION *session)
+{
+   mongoc_ssl_session_cache_entry_t *entry;
+   int i;
+
+   BSON_ASSERT (key);
+   BSON_ASSERT (session);
+
+   mongoc_mutex_lock (&gMongocSslSessionCacheMutex);
+
+   if (!(entry = _mongoc_ssl_session_cache_find (key))) {
+      entry = &gMongocSslSessionCache[0];
+      for (i = 0; i < MONGOC_SSL_SESSION_CACHE_MAX_ENTRIES; i++) {
+         if (!gMongocSslSessionCache[i].key) {
+            entry = &gMongocSslSessionCache[i];
+            break;
+         }
+         if (gMongocSslSessionCache[i].stored_at < entry->stored_at) {
+            entry = &gMongocSslSessionCache[i];
+         }
+      }
+   }
+
+   _mongoc_ssl_session_cache_entry_clear (entry);
+   entry->key = bson_strdup (key);
+   entry->session = session;
+   entry->stored_at = bson_get_monotonic_time ();
+
+   mongoc_mutex_unlock (&gMongocSslSessionCacheMutex);
+}
+
+
+/**
+ * _mongoc_ssl_session_cache_remove:
+ *
+ * Forget the session cached for @key, such as after a handshake that
+ * tried to resume it failed.
+ */
+void
+_mongoc_ssl_session_cache_remove (const char *key)
+{
+   mongoc_ssl_session_cache_entry_t *entry;
+
+   BSON_ASSERT (key);
+
+   mongoc_mutex_lock (&gMongocSslSessionCacheMutex);
+   if ((entry = _mongoc_ssl_session_cache_find (key))) {
+      _mongoc_ssl_session_cache_entry_clear (entry);
+   }
+   mongoc_mutex_unlock (&gMongocSslSessionCacheMutex);
+}
+
 static int
 _mongoc_ssl_password_cb (char *buf,
                          int   num,
@@ -321,6 +543,154 @@ _mongoc_ssl_check_cert (SSL        *ssl,
 }
 
 
+/**
+ * _mongoc_ssl_verify_cache_lookup:
+ *
+ * Look for @key in the verification cache, dropping it if it expired.
+ *
+ * Returns: true if @key is cached and still valid.
+ */
+static bool
+_mongoc_ssl_verify_cache_lookup (const char *key)
+{
+   mongoc_ssl_verify_cache_entry_t *entry;
+   int64_t now = bson_get_monotonic_time ();
+   bool ret = false;
+   int i;
+
+   mongoc_mutex_lock (&gMongocSslVerifyCacheMutex);
+
+   for (i = 0; i < MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES; i++) {
+      entry = &gMongocSslVerifyCache[i];
+
+      if (entry->key && !strcmp (entry->key, key)) {
+         if (now < entry->expire_at) {
+            ret = true;
+         } else {
+            bson_free (entry->key);
+            entry->key = NULL;
+         }
+         break;
+      }
+   }
+
+   mongoc_mutex_unlock (&gMongocSslVerifyCacheMutex);
+
+   return ret;
+}
+
+
+/**
+ * _mongoc_ssl_verify_cache_put:
+ *
+ * Remember @key until @expire_at, replacing the entry that expires
+ * first if the cache is full.
+ */
+static void
+_mongoc_ssl_verify_cache_put (const char *key,
+                              int64_t     expire_at)
+{
+   mongoc_ssl_verify_cache_entry_t *entry;
+   int i;
+
+   mongoc_mutex_lock (&gMongocSslVerifyCacheMutex);
+
+   entry = &gMongocSslVerifyCache[0];
+
+   for (i = 0; i < MONGOC_SSL_VERIFY_CACHE_MAX_ENTRIES; i++) {
+      if (!gMongocSslVerifyCache[i].key) {
+         entry = &gMongocSslVerifyCache[i];
+         break;
+      }
+      if (gMongocSslVerifyCache[i].expire_at < entry->expire_at) {
+         entry = &gMongocSslVerifyCache[i];
+      }
+   }
+
+   bson_free (entry->key);
+   entry->key = bson_strdup (key);
+   entry->expire_at = expire_at;
+
+   mongoc_mutex_unlock (&gMongocSslVerifyCacheMutex);
+}
+
+
+/**
+ * _mongoc_ssl_check_cert_cached:
+ *
+ * Like _mongoc_ssl_check_cert(), but a certificate already found to
+ * match @host is not parsed again. @opt_key tells apart the trust
+ * settings the certificate was checked with.
+ *
+ * The chain itself is verified by OpenSSL during each full handshake,
+ * and its result is still checked here on every connection.
+ *
+ * Returns: true if the certificate is valid for @host.
+ */
+bool
+_mongoc_ssl_check_cert_cached (SSL        *ssl,
+                               const char *host,
+                               const char *opt_key,
+                               bool        weak_cert_validation)
+{
+   unsigned char md[EVP_MAX_MD_SIZE];
+   unsigned int md_len = 0;
+   char hex[2 * EVP_MAX_MD_SIZE + 1];
+   int64_t ttl_sec = MONGOC_SSL_VERIFY_CACHE_TTL_SEC;
+   X509 *peer;
+   char *key;
+   int days;
+   int secs;
+   unsigned int i;
+   bool ret;
+
+   BSON_ASSERT (ssl);
+   BSON_ASSERT (host);
+   BSON_ASSERT (opt_key);
+
+   if (weak_cert_validation) {
+      return true;
+   }
+
+   if (SSL_get_verify_result (ssl) != X509_V_OK ||
+       !(peer = SSL_get_peer_certificate (ssl))) {
+      return false;
+   }
+
+   if (!X509_digest (peer, EVP_sha256 (), md, &md_len)) {
+      X509_free (peer);
+      return _mongoc_ssl_check_cert (ssl, host, false);
+   }
+
+   for (i = 0; i < md_len; i++) {
+      bson_snprintf (&hex[2 * i], 3, "%02x", md[i]);
+   }
+   hex[2 * md_len] = '\0';
+
+   key = bson_strdup_printf ("%s|%s|%s", host, opt_key, hex);
+
+   if (!(ret = _mongoc_ssl_verify_cache_lookup (key)) &&
+       (ret = _mongoc_ssl_check_cert (ssl, host, false))) {
+      /* don't trust the certificate past its expiry */
+      if (ASN1_TIME_diff (&days, &secs, NULL, X509_get_notAfter (peer))) {
+         ttl_sec = BSON_MIN (ttl_sec, (int64_t)days * 86400 + secs);
+      } else {
+         ttl_sec = 0;
+      }
+
+      if (ttl_sec > 0) {
+         _mongoc_ssl_verify_cache_put (key, bson_get_monotonic_time () +
+                                       ttl_sec * 1000000);
+      }
+   }
+
+   bson_free (key);
+   X509_free (peer);
+
+   return ret;
+}
+
+
 static bool
 _mongoc_ssl_setup_ca (SSL_CTX    *ctx,
                       const char *cert,
@@ -399,6 +769,7 @@ _mongoc_ssl_ctx_new (mongoc_ssl_opt_t *opt)
     * Ensure we are initialized. This is safe to call multiple times.
     */
    mongoc_init ();
+   _mongoc_ssl_init ();
 
    ctx = SSL_CTX_new (SSLv23_method ());
 
@@ -418,9 +789,11 @@ _mongoc_ssl_ctx_new (mongoc_ssl_opt_t *opt)
     * Note: this is for blocking sockets only. */
    SSL_CTX_set_mode (ctx, SSL_MODE_AUTO_RETRY);
 
-   /* TODO: does this cargo cult actually matter?
-    * Disable session caching (see SERVER-10261) */
-   SSL_CTX_set_session_cache_mode (ctx, SSL_SESS_CACHE_OFF);
+   /* Disable the server side cache (see SERVER-10261). Client sessions
+    * are handed to mongoc_stream_tls, which keeps them in the process
+    * wide session cache instead of in this context. */
+   SSL_CTX_set_session_cache_mode (ctx, (SSL_SESS_CACHE_CLIENT |
+                                         SSL_SESS_CACHE_NO_INTERNAL_STORE));
 
    /* Load in verification certs, private keys and revocation lists */
    if ((!opt->pem_file ||
@@ -438,6 +811,29 @@ _mongoc_ssl_ctx_new (mongoc_ssl_opt_t *opt)
 }
 
 
+/**
+ * _mongoc_ssl_ctx_ref:
+ *
+ * Take a reference on @ctx, dropped again with SSL_CTX_free(), so that
+ * a context can be shared by the streams of a client or pool.
+ *
+ * Returns: @ctx.
+ */
+SSL_CTX *
+_mongoc_ssl_ctx_ref (SSL_CTX *ctx)
+{
+   BSON_ASSERT (ctx);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+   SSL_CTX_up_ref (ctx);
+#else
+   CRYPTO_add (&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+#endif
+
+   return ctx;
+}
+
+
 char *
 _mongoc_ssl_extract_subject (const char *filename)
 {
@@ -452,6 +848,8 @@ _mongoc_ssl_extract_subject (const char *filename)
       return NULL;
    }
 
+   _mongoc_ssl_init ();
+
    certbio = BIO_new (BIO_s_file ());
    strbio = BIO_new (BIO_s_mem ());;
 
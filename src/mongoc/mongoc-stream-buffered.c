@@ -29,14 +29,91 @@
 #define MONGOC_LOG_DOMAIN "stream"
 
 
+/*
+ * Writes are passed through unless a write buffer was set. Then writes
+ * that fit are held in wbuf and sent together with the write that does
+ * not fit any more, the next read, or a flush, with the timeout of the
+ * last write.
+ */
 typedef struct
 {
    mongoc_stream_t  stream;
    mongoc_stream_t *base_stream;
    mongoc_buffer_t  buffer;
+   uint8_t         *wbuf;
+   size_t           wbuf_size;
+   size_t           wbuf_len;
+   int32_t          wbuf_timeout_msec;
 } mongoc_stream_buffered_t;
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_buffered_send --
+ *
+ *       Write the buffered writes of @buffered, followed by @iovcnt
+ *       elements of @iov, to the base stream in a single writev.
+ *
+ * Returns:
+ *       true if all of them were written, otherwise false and the
+ *       buffered writes are lost.
+ *
+ * Side effects:
+ *       The write buffer is emptied.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_stream_buffered_send (mongoc_stream_buffered_t *buffered,
+                              mongoc_iovec_t           *iov,
+                              size_t                    iovcnt,
+                              int32_t                   timeout_msec)
+{
+   mongoc_iovec_t stack_iov[8];
+   mongoc_iovec_t *all = stack_iov;
+   size_t expected = buffered->wbuf_len;
+   size_t n = 0;
+   ssize_t r;
+   size_t i;
+
+   if (!expected && !iovcnt) {
+      return true;
+   }
+
+   if (iovcnt + 1 > sizeof stack_iov / sizeof stack_iov[0]) {
+      all = bson_malloc (sizeof *all * (iovcnt + 1));
+   }
+
+   if (buffered->wbuf_len) {
+      all[n].iov_base = (void *)buffered->wbuf;
+      all[n].iov_len = buffered->wbuf_len;
+      n++;
+   }
+
+   for (i = 0; i < iovcnt; i++) {
+      all[n++] = iov[i];
+      expected += iov[i].iov_len;
+   }
+
+   buffered->wbuf_len = 0;
+
+   r = mongoc_stream_writev (buffered->base_stream, all, n, timeout_msec);
+
+   if (all != stack_iov) {
+      bson_free (all);
+   }
+
+   if (r != (ssize_t)expected) {
+      MONGOC_WARNING ("Failure to write %u bytes.", (unsigned)expected);
+      return false;
+   }
+
+   return true;
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
@@ -61,10 +138,14 @@ mongoc_stream_buffered_destroy (mongoc_stream_t *stream) /* IN */
 
    bson_return_if_fail(stream);
 
+   _mongoc_stream_buffered_send (buffered, NULL, 0,
+                                 buffered->wbuf_timeout_msec);
+
    mongoc_stream_destroy(buffered->base_stream);
    buffered->base_stream = NULL;
 
    _mongoc_buffer_destroy (&buffered->buffer);
+   bson_free (buffered->wbuf);
 
    bson_free(stream);
 
@@ -78,8 +159,8 @@ mongoc_stream_buffered_destroy (mongoc_stream_t *stream) /* IN */
  *
  * mongoc_stream_buffered_close --
  *
- *       Close the underlying stream. The buffered content is still
- *       valid.
+ *       Send the buffered writes and close the underlying stream. The
+ *       buffered content is still valid.
  *
  * Returns:
  *       The return value of mongoc_stream_close() on the underlying
@@ -96,6 +177,8 @@ mongoc_stream_buffered_close (mongoc_stream_t *stream) /* IN */
 {
    mongoc_stream_buffered_t *buffered = (mongoc_stream_buffered_t *)stream;
    bson_return_val_if_fail(stream, -1);
+   _mongoc_stream_buffered_send (buffered, NULL, 0,
+                                 buffered->wbuf_timeout_msec);
    return mongoc_stream_close(buffered->base_stream);
 }
 
@@ -105,10 +188,11 @@ mongoc_stream_buffered_close (mongoc_stream_t *stream) /* IN */
  *
  * mongoc_stream_buffered_flush --
  *
- *       Flushes the underlying stream.
+ *       Sends the buffered writes, then flushes the underlying stream.
  *
  * Returns:
- *       The result of flush on the base stream.
+ *       -1 if the buffered writes failed, otherwise the result of flush
+ *       on the base stream.
  *
  * Side effects:
  *       None.
@@ -121,6 +205,12 @@ mongoc_stream_buffered_flush (mongoc_stream_t *stream) /* IN */
 {
    mongoc_stream_buffered_t *buffered = (mongoc_stream_buffered_t *)stream;
    bson_return_val_if_fail(buffered, -1);
+
+   if (!_mongoc_stream_buffered_send (buffered, NULL, 0,
+                                      buffered->wbuf_timeout_msec)) {
+      return -1;
+   }
+
    return mongoc_stream_flush(buffered->base_stream);
 }
 
@@ -130,14 +220,19 @@ mongoc_stream_buffered_flush (mongoc_stream_t *stream) /* IN */
  *
  * mongoc_stream_buffered_writev --
  *
- *       Write an iovec to the underlying stream. This write is not
- *       buffered, it passes through to the base stream directly.
+ *       Write an iovec to the underlying stream. Without a write
+ *       buffer, this write passes through to the base stream directly.
+ *
+ *       With one, @iov is copied into the write buffer if it fits.
+ *       Otherwise it is sent in one writev with the writes buffered so
+ *       far, so a large write is not copied.
  *
  *       timeout_msec should be the number of milliseconds to wait before
  *       considering the writev as failed.
  *
  * Returns:
- *       The number of bytes written or -1 on failure.
+ *       The number of bytes written or buffered, or -1 on failure. A
+ *       buffered write that fails is reported by the call that sends it.
  *
  * Side effects:
  *       None.
@@ -152,16 +247,43 @@ mongoc_stream_buffered_writev (mongoc_stream_t *stream,       /* IN */
                                int32_t          timeout_msec) /* IN */
 {
    mongoc_stream_buffered_t *buffered = (mongoc_stream_buffered_t *)stream;
+   size_t total = 0;
    ssize_t ret;
+   size_t i;
 
    ENTRY;
 
    bson_return_val_if_fail(buffered, -1);
 
-   ret = mongoc_stream_writev(buffered->base_stream, iov, iovcnt,
-                              timeout_msec);
+   if (!buffered->wbuf_size) {
+      ret = mongoc_stream_writev(buffered->base_stream, iov, iovcnt,
+                                 timeout_msec);
+
+      RETURN (ret);
+   }
 
-   RETURN (ret);
+   for (i = 0; i < iovcnt; i++) {
+      total += iov[i].iov_len;
+   }
+
+   buffered->wbuf_timeout_msec = timeout_msec;
+
+   if (buffered->wbuf_len + total > buffered->wbuf_size) {
+      if (!_mongoc_stream_buffered_send (buffered, iov, iovcnt,
+                                         timeout_msec)) {
+         RETURN (-1);
+      }
+
+      RETURN ((ssize_t)total);
+   }
+
+   for (i = 0; i < iovcnt; i++) {
+      memcpy (buffered->wbuf + buffered->wbuf_len, iov[i].iov_base,
+              iov[i].iov_len);
+      buffered->wbuf_len += iov[i].iov_len;
+   }
+
+   RETURN ((ssize_t)total);
 }
 
 
@@ -177,6 +299,14 @@ mongoc_stream_buffered_writev (mongoc_stream_t *stream,       /* IN */
  *       requested number of bytes, but try to also fill the stream to
  *       the size of the underlying buffer.
  *
+ *       Reads that are larger than the buffer, such as the body of a
+ *       large OP_REPLY, are only served from the buffer for the bytes it
+ *       already holds. The rest is read straight into @iov instead of
+ *       growing the buffer and copying out of it.
+ *
+ *       Buffered writes are sent first, since what is read is likely the
+ *       reply to them.
+ *
  * Note:
  *       This isn't actually a huge savings since we never have more than
  *       one reply waiting for us, but perhaps someday that will be
@@ -200,37 +330,68 @@ mongoc_stream_buffered_readv (mongoc_stream_t *stream,       /* IN */
                               int32_t          timeout_msec) /* IN */
 {
    mongoc_stream_buffered_t *buffered = (mongoc_stream_buffered_t *)stream;
+   mongoc_buffer_t *buffer;
    bson_error_t error = { 0 };
    size_t total_bytes = 0;
+   uint8_t *ptr;
+   size_t len;
+   size_t n;
+   ssize_t r;
    size_t i;
 
    ENTRY;
 
    bson_return_val_if_fail(buffered, -1);
 
-   for (i = 0; i < iovcnt; i++) {
-      total_bytes += iov[i].iov_len;
-   }
-
-   if (-1 == _mongoc_buffer_fill (&buffered->buffer,
-                                  buffered->base_stream,
-                                  total_bytes,
-                                  timeout_msec,
-                                  &error)) {
-      MONGOC_WARNING ("Failure to buffer %u bytes: %s",
-                      (unsigned)total_bytes,
-                      error.message);
+   if (buffered->wbuf_len &&
+       !_mongoc_stream_buffered_send (buffered, NULL, 0,
+                                      buffered->wbuf_timeout_msec)) {
       RETURN (-1);
    }
 
-   BSON_ASSERT(buffered->buffer.len >= total_bytes);
+   buffer = &buffered->buffer;
 
    for (i = 0; i < iovcnt; i++) {
-      memcpy(iov[i].iov_base,
-             buffered->buffer.data + buffered->buffer.off,
-             iov[i].iov_len);
-      buffered->buffer.off += iov[i].iov_len;
-      buffered->buffer.len -= iov[i].iov_len;
+      ptr = iov[i].iov_base;
+      len = iov[i].iov_len;
+
+      n = BSON_MIN (len, buffer->len);
+
+      if (n) {
+         memcpy (ptr, buffer->data + buffer->off, n);
+         buffer->off += n;
+         buffer->len -= n;
+         ptr += n;
+         len -= n;
+      }
+
+      if (len >= buffer->datalen) {
+         r = mongoc_stream_read (buffered->base_stream, ptr, len, len,
+                                 timeout_msec);
+         if (r != (ssize_t)len) {
+            MONGOC_WARNING ("Failure to read %u bytes.", (unsigned)len);
+            RETURN (-1);
+         }
+      } else if (len) {
+         if (-1 == _mongoc_buffer_fill (buffer,
+                                        buffered->base_stream,
+                                        len,
+                                        timeout_msec,
+                                        &error)) {
+            MONGOC_WARNING ("Failure to buffer %u bytes: %s",
+                            (unsigned)len,
+                            error.message);
+            RETURN (-1);
+         }
+
+         BSON_ASSERT(buffer->len >= len);
+
+         memcpy (ptr, buffer->data + buffer->off, len);
+         buffer->off += len;
+         buffer->len -= len;
+      }
+
+      total_bytes += iov[i].iov_len;
    }
 
    RETURN (total_bytes);
@@ -302,3 +463,53 @@ mongoc_stream_buffered_new (mongoc_stream_t *base_stream, /* IN */
 
    return (mongoc_stream_t *)stream;
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_buffered_set_write_buffer --
+ *
+ *       Have the buffered stream @stream hold writes of up to
+ *       @buffer_size bytes together before writing them to its base
+ *       stream, so that many small writes take a few write() or send()
+ *       syscalls, and over TLS a few records. Writes that do not fit go
+ *       out at once with those buffered before them. Buffered writes are
+ *       also sent by the next read, mongoc_stream_flush(), or closing or
+ *       destroying @stream.
+ *
+ *       A @buffer_size of 0, the default, passes writes through.
+ *
+ * Returns:
+ *       true, or false if @stream is not a buffered stream or the writes
+ *       buffered so far could not be sent.
+ *
+ * Side effects:
+ *       Buffered writes are sent first.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_stream_buffered_set_write_buffer (mongoc_stream_t *stream,      /* IN */
+                                         size_t           buffer_size) /* IN */
+{
+   mongoc_stream_buffered_t *buffered = (mongoc_stream_buffered_t *)stream;
+
+   bson_return_val_if_fail (stream, false);
+
+   if (stream->type != MONGOC_STREAM_BUFFERED) {
+      return false;
+   }
+
+   if (!_mongoc_stream_buffered_send (buffered, NULL, 0,
+                                      buffered->wbuf_timeout_msec)) {
+      return false;
+   }
+
+   bson_free (buffered->wbuf);
+   buffered->wbuf = buffer_size ? bson_malloc (buffer_size) : NULL;
+   buffered->wbuf_size = buffer_size;
+
+   return true;
+}
@@ -29,8 +29,10 @@
 BSON_BEGIN_DECLS
 
 
-mongoc_stream_t *mongoc_stream_buffered_new (mongoc_stream_t *base_stream,
-                                             size_t           buffer_size);
+mongoc_stream_t *mongoc_stream_buffered_new              (mongoc_stream_t *base_stream,
+                                                          size_t           buffer_size);
+bool             mongoc_stream_buffered_set_write_buffer (mongoc_stream_t *stream,
+                                                          size_t           buffer_size);
 
 
 BSON_END_DECLS
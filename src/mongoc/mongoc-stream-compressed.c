@@ -0,0 +1,479 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-config.h"
+
+#ifdef MONGOC_ENABLE_ZLIB
+# include <zlib.h>
+#endif
+
+#include "mongoc-compression-private.h"
+#include "mongoc-counters-private.h"
+#include "mongoc-log.h"
+#include "mongoc-stream-compressed.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "stream"
+
+
+#ifdef MONGOC_ENABLE_ZLIB
+
+
+#define MONGOC_STREAM_COMPRESSED_BUFFER_SIZE (16 * 1024)
+
+
+/*
+ * Data written to the stream is deflated into @out, which is written to
+ * the base stream each time it fills up. Data read from the stream is
+ * inflated straight into the caller's iovecs from @in, which holds the
+ * compressed bytes read from the base stream.
+ *
+ * Each direction is set up the first time it is used, so a stream that
+ * is only ever written to does not pay for an inflater.
+ */
+typedef struct
+{
+   mongoc_stream_t  stream;
+   mongoc_stream_t *base_stream;
+   z_stream         deflater;
+   z_stream         inflater;
+   bool             deflating;
+   bool             deflate_finished;
+   bool             inflating;
+   bool             inflate_finished;
+   int32_t          timeout_msec;
+   uint8_t          out [MONGOC_STREAM_COMPRESSED_BUFFER_SIZE];
+   uint8_t          in [MONGOC_STREAM_COMPRESSED_BUFFER_SIZE];
+} mongoc_stream_compressed_t;
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_compressed_deflate --
+ *
+ *       Run the deflater over its pending input with @flush, writing
+ *       every output block it produces to the base stream.
+ *
+ * Returns:
+ *       true if successful; otherwise false.
+ *
+ * Side effects:
+ *       The deflater's input is consumed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_stream_compressed_deflate (mongoc_stream_compressed_t *compressed,
+                                   int                         flush,
+                                   int32_t                     timeout_msec)
+{
+   z_stream *zs = &compressed->deflater;
+   ssize_t n;
+   int ret;
+
+   do {
+      zs->next_out = compressed->out;
+      zs->avail_out = sizeof compressed->out;
+
+      ret = deflate (zs, flush);
+      if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+         MONGOC_WARNING ("Failed to deflate stream: %s",
+                         zs->msg ? zs->msg : "unknown error");
+         return false;
+      }
+
+      n = sizeof compressed->out - zs->avail_out;
+
+      if (n && (mongoc_stream_write (compressed->base_stream,
+                                     compressed->out, n,
+                                     timeout_msec) != n)) {
+         return false;
+      }
+   } while (zs->avail_out == 0);
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_compressed_finish --
+ *
+ *       Terminate the deflate stream so that a reader sees a complete
+ *       stream. No more data may be written afterwards.
+ *
+ * Returns:
+ *       true if successful or nothing was ever written; otherwise false.
+ *
+ * Side effects:
+ *       The trailing compressed bytes are written to the base stream.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_stream_compressed_finish (mongoc_stream_compressed_t *compressed)
+{
+   if (!compressed->deflating || compressed->deflate_finished) {
+      return true;
+   }
+
+   compressed->deflate_finished = true;
+
+   compressed->deflater.next_in = NULL;
+   compressed->deflater.avail_in = 0;
+
+   return _mongoc_stream_compressed_deflate (compressed, Z_FINISH,
+                                             compressed->timeout_msec);
+}
+
+
+static void
+_mongoc_stream_compressed_destroy (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+
+   bson_return_if_fail (stream);
+
+   _mongoc_stream_compressed_finish (compressed);
+
+   if (compressed->deflating) {
+      deflateEnd (&compressed->deflater);
+   }
+
+   if (compressed->inflating) {
+      inflateEnd (&compressed->inflater);
+   }
+
+   mongoc_stream_destroy (compressed->base_stream);
+   compressed->base_stream = NULL;
+
+   bson_free (stream);
+
+   mongoc_counter_streams_active_dec ();
+   mongoc_counter_streams_disposed_inc ();
+}
+
+
+static int
+_mongoc_stream_compressed_close (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+   bool finished;
+   int ret;
+
+   bson_return_val_if_fail (stream, -1);
+
+   finished = _mongoc_stream_compressed_finish (compressed);
+   ret = mongoc_stream_close (compressed->base_stream);
+
+   return finished ? ret : -1;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_compressed_flush --
+ *
+ *       Push everything written so far through the deflater so that a
+ *       reader can inflate it, then flush the base stream. Flushing
+ *       often hurts the compression ratio.
+ *
+ * Returns:
+ *       0 on success, -1 on failure.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+_mongoc_stream_compressed_flush (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+
+   bson_return_val_if_fail (stream, -1);
+
+   if (compressed->deflating && !compressed->deflate_finished) {
+      compressed->deflater.next_in = NULL;
+      compressed->deflater.avail_in = 0;
+
+      if (!_mongoc_stream_compressed_deflate (compressed, Z_SYNC_FLUSH,
+                                              compressed->timeout_msec)) {
+         return -1;
+      }
+   }
+
+   return mongoc_stream_flush (compressed->base_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_compressed_writev --
+ *
+ *       Deflate the contents of @iov directly from the caller's buffers.
+ *       Compressed bytes reach the base stream as deflate produces them,
+ *       which for small writes may not be until the next flush or close.
+ *
+ * Returns:
+ *       The number of uncompressed bytes consumed, or -1 on failure.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_mongoc_stream_compressed_writev (mongoc_stream_t *stream,       /* IN */
+                                  mongoc_iovec_t  *iov,          /* IN */
+                                  size_t           iovcnt,       /* IN */
+                                  int32_t          timeout_msec) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+   ssize_t total_bytes = 0;
+   size_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (stream, -1);
+
+   if (compressed->deflate_finished) {
+      MONGOC_WARNING ("Cannot write to a finished compressed stream.");
+      RETURN (-1);
+   }
+
+   if (!compressed->deflating) {
+      if (Z_OK != deflateInit (&compressed->deflater,
+                               Z_DEFAULT_COMPRESSION)) {
+         MONGOC_WARNING ("Failed to initialize deflate stream.");
+         RETURN (-1);
+      }
+      compressed->deflating = true;
+   }
+
+   compressed->timeout_msec = timeout_msec;
+
+   for (i = 0; i < iovcnt; i++) {
+      compressed->deflater.next_in = iov [i].iov_base;
+      compressed->deflater.avail_in = (uInt)iov [i].iov_len;
+
+      if (!_mongoc_stream_compressed_deflate (compressed, Z_NO_FLUSH,
+                                              timeout_msec)) {
+         RETURN (total_bytes ? total_bytes : -1);
+      }
+
+      total_bytes += iov [i].iov_len;
+   }
+
+   RETURN (total_bytes);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_compressed_readv --
+ *
+ *       Inflate into @iov straight from the compressed bytes read off the
+ *       base stream. The base stream is only read again while fewer than
+ *       @min_bytes (at least one) have been produced.
+ *
+ * Returns:
+ *       The number of bytes inflated, 0 at the end of the compressed
+ *       stream, or -1 on failure.
+ *
+ * Side effects:
+ *       iov[*]->iov_base buffers are filled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_mongoc_stream_compressed_readv (mongoc_stream_t *stream,       /* IN */
+                                 mongoc_iovec_t  *iov,          /* INOUT */
+                                 size_t           iovcnt,       /* IN */
+                                 size_t           min_bytes,    /* IN */
+                                 int32_t          timeout_msec) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+   z_stream *zs = &compressed->inflater;
+   uLong total_out;
+   size_t total_bytes = 0;
+   ssize_t r;
+   size_t i;
+   int ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (stream, -1);
+
+   if (!compressed->inflating) {
+      if (Z_OK != inflateInit (zs)) {
+         MONGOC_WARNING ("Failed to initialize inflate stream.");
+         RETURN (-1);
+      }
+      compressed->inflating = true;
+   }
+
+   if (compressed->inflate_finished) {
+      RETURN (0);
+   }
+
+   total_out = zs->total_out;
+
+   for (i = 0; i < iovcnt; i++) {
+      zs->next_out = iov [i].iov_base;
+      zs->avail_out = (uInt)iov [i].iov_len;
+
+      while (zs->avail_out) {
+         ret = inflate (zs, Z_NO_FLUSH);
+
+         if (ret == Z_STREAM_END) {
+            compressed->inflate_finished = true;
+            GOTO (done);
+         } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            MONGOC_WARNING ("Failed to inflate stream: %s",
+                            zs->msg ? zs->msg : "unknown error");
+            RETURN (-1);
+         }
+
+         if (!zs->avail_out) {
+            break;
+         }
+
+         /* out of input, only block for more if the caller needs it. */
+         total_bytes = zs->total_out - total_out;
+
+         if (total_bytes && total_bytes >= min_bytes) {
+            GOTO (done);
+         }
+
+         r = mongoc_stream_read (compressed->base_stream,
+                                 compressed->in,
+                                 sizeof compressed->in,
+                                 1, timeout_msec);
+
+         if (r < 0) {
+            RETURN (total_bytes ? (ssize_t)total_bytes : -1);
+         } else if (r == 0) {
+            MONGOC_WARNING ("Compressed stream was truncated.");
+            GOTO (done);
+         }
+
+         zs->next_in = compressed->in;
+         zs->avail_in = (uInt)r;
+      }
+   }
+
+done:
+   total_bytes = zs->total_out - total_out;
+
+   RETURN ((ssize_t)total_bytes);
+}
+
+
+static mongoc_stream_t *
+_mongoc_stream_compressed_get_base_stream (mongoc_stream_t *stream) /* IN */
+{
+   return ((mongoc_stream_compressed_t *)stream)->base_stream;
+}
+
+
+static bool
+_mongoc_stream_compressed_check_closed (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_compressed_t *compressed = (mongoc_stream_compressed_t *)stream;
+   bson_return_val_if_fail (stream, -1);
+   return mongoc_stream_check_closed (compressed->base_stream);
+}
+
+
+#endif /* MONGOC_ENABLE_ZLIB */
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_compressed_new --
+ *
+ *       Creates a new mongoc_stream_compressed_t.
+ *
+ *       Bytes written to the stream are compressed with @codec before
+ *       they reach @base_stream, and bytes read from it are uncompressed.
+ *       @codec uses the same names as the "compressors" URI option;
+ *       currently only "zlib" is supported.
+ *
+ *       @base_stream is considered owned by the resulting stream after
+ *       calling this function.
+ *
+ * Returns:
+ *       A newly allocated mongoc_stream_t, or NULL if @codec is not
+ *       supported by this build.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+mongoc_stream_compressed_new (mongoc_stream_t *base_stream, /* IN */
+                              const char      *codec)       /* IN */
+{
+#ifdef MONGOC_ENABLE_ZLIB
+   mongoc_stream_compressed_t *stream;
+#endif
+
+   bson_return_val_if_fail (base_stream, NULL);
+   bson_return_val_if_fail (codec, NULL);
+
+#ifdef MONGOC_ENABLE_ZLIB
+   if (_mongoc_compressor_name_to_id (codec) == MONGOC_COMPRESSOR_ZLIB_ID) {
+      stream = bson_malloc0 (sizeof *stream);
+      stream->stream.type = MONGOC_STREAM_COMPRESSED;
+      stream->stream.destroy = _mongoc_stream_compressed_destroy;
+      stream->stream.close = _mongoc_stream_compressed_close;
+      stream->stream.flush = _mongoc_stream_compressed_flush;
+      stream->stream.writev = _mongoc_stream_compressed_writev;
+      stream->stream.readv = _mongoc_stream_compressed_readv;
+      stream->stream.get_base_stream = _mongoc_stream_compressed_get_base_stream;
+      stream->stream.check_closed = _mongoc_stream_compressed_check_closed;
+
+      stream->base_stream = base_stream;
+      stream->timeout_msec = -1;
+
+      mongoc_counter_streams_active_inc ();
+
+      return (mongoc_stream_t *)stream;
+   }
+#endif
+
+   MONGOC_WARNING ("Unsupported stream compressor \"%s\".", codec);
+
+   return NULL;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_STREAM_FILE_PRIVATE_H
+#define MONGOC_STREAM_FILE_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include "mongoc-stream.h"
+
+
+BSON_BEGIN_DECLS
+
+
+bool _mongoc_stream_file_map   (mongoc_stream_t  *stream,
+                                const uint8_t   **data,
+                                size_t           *len);
+void _mongoc_stream_file_unmap (mongoc_stream_t  *stream);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_STREAM_FILE_PRIVATE_H */
@@ -18,10 +18,15 @@
 #ifdef _WIN32
 # include <io.h>
 # include <share.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
 #endif
 
 #include "mongoc-stream-private.h"
 #include "mongoc-stream-file.h"
+#include "mongoc-stream-file-private.h"
 #include "mongoc-trace.h"
 
 
@@ -35,6 +40,8 @@ struct _mongoc_stream_file_t
 {
    mongoc_stream_t vtable;
    int             fd;
+   void           *map;
+   size_t          map_len;
 };
 
 
@@ -71,6 +78,8 @@ _mongoc_stream_file_destroy (mongoc_stream_t *stream)
 
    bson_return_if_fail (file);
 
+   _mongoc_stream_file_unmap (stream);
+
    if (file->fd) {
       _mongoc_stream_file_close (stream);
    }
@@ -220,6 +229,114 @@ mongoc_stream_file_new_for_path (const char *path,  /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_file_map --
+ *
+ *       Map the rest of the regular file behind @stream, from its current
+ *       position on, so that it can be consumed without read() copying
+ *       it. The kernel is told the mapping will be read in order.
+ *
+ * Returns:
+ *       true and the mapped bytes in @data and @len, which stay valid
+ *       until _mongoc_stream_file_unmap() or the stream is destroyed.
+ *       false if @stream is not a file stream or cannot be mapped, in
+ *       which case it should be read as usual.
+ *
+ * Side effects:
+ *       The position of the stream moves to the end of the file.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_stream_file_map (mongoc_stream_t  *stream, /* IN */
+                         const uint8_t   **data,   /* OUT */
+                         size_t           *len)    /* OUT */
+{
+#ifdef _WIN32
+   return false;
+#else
+   mongoc_stream_file_t *file = (mongoc_stream_file_t *)stream;
+   struct stat st;
+   off_t offset;
+   off_t aligned;
+   void *map;
+
+   ENTRY;
+
+   bson_return_val_if_fail (stream, false);
+   bson_return_val_if_fail (data, false);
+   bson_return_val_if_fail (len, false);
+
+   if (stream->type != MONGOC_STREAM_FILE || file->fd == -1 || file->map) {
+      RETURN (false);
+   }
+
+   /* pipes and the like are only readable in order */
+   if (fstat (file->fd, &st) != 0 || !S_ISREG (st.st_mode)) {
+      RETURN (false);
+   }
+
+   offset = lseek (file->fd, 0, SEEK_CUR);
+
+   if (offset < 0 || offset > st.st_size ||
+       (uint64_t)(st.st_size - offset) > SIZE_MAX) {
+      RETURN (false);
+   }
+
+   if (offset == st.st_size) {
+      *data = (const uint8_t *)"";
+      *len = 0;
+      RETURN (true);
+   }
+
+   /* mappings start on a page boundary */
+   aligned = offset - (offset % sysconf (_SC_PAGESIZE));
+
+   map = mmap (NULL, (size_t)(st.st_size - aligned), PROT_READ, MAP_PRIVATE,
+               file->fd, aligned);
+
+   if (map == MAP_FAILED) {
+      RETURN (false);
+   }
+
+   posix_madvise (map, (size_t)(st.st_size - aligned), POSIX_MADV_SEQUENTIAL);
+
+   if (lseek (file->fd, 0, SEEK_END) < 0) {
+      munmap (map, (size_t)(st.st_size - aligned));
+      RETURN (false);
+   }
+
+   file->map = map;
+   file->map_len = (size_t)(st.st_size - aligned);
+
+   *data = (const uint8_t *)map + (offset - aligned);
+   *len = (size_t)(st.st_size - offset);
+
+   RETURN (true);
+#endif
+}
+
+
+void
+_mongoc_stream_file_unmap (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_file_t *file = (mongoc_stream_file_t *)stream;
+
+   bson_return_if_fail (stream);
+
+#ifndef _WIN32
+   if (stream->type == MONGOC_STREAM_FILE && file->map) {
+      munmap (file->map, file->map_len);
+      file->map = NULL;
+      file->map_len = 0;
+   }
+#endif
+}
+
+
 int
 mongoc_stream_file_get_fd (mongoc_stream_file_t *stream)
 {
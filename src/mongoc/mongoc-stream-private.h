@@ -22,17 +22,24 @@
 #endif
 
 #include "mongoc-iovec.h"
+#include "mongoc-socket.h"
 #include "mongoc-stream.h"
 
 
 BSON_BEGIN_DECLS
 
 
-#define MONGOC_STREAM_SOCKET   1
-#define MONGOC_STREAM_FILE     2
-#define MONGOC_STREAM_BUFFERED 3
-#define MONGOC_STREAM_GRIDFS   4
-#define MONGOC_STREAM_TLS      5
+#define MONGOC_STREAM_SOCKET     1
+#define MONGOC_STREAM_FILE       2
+#define MONGOC_STREAM_BUFFERED   3
+#define MONGOC_STREAM_GRIDFS     4
+#define MONGOC_STREAM_TLS        5
+#define MONGOC_STREAM_COMPRESSED 6
+#define MONGOC_STREAM_SIMULATED  7
+
+
+mongoc_socket_t *_mongoc_stream_get_socket (mongoc_stream_t *stream);
+void             _mongoc_stream_abandon    (mongoc_stream_t *stream);
 
 
 BSON_END_DECLS
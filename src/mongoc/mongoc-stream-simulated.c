@@ -0,0 +1,396 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#ifndef _WIN32
+# include <time.h>
+#endif
+
+#include "mongoc-counters-private.h"
+#include "mongoc-log.h"
+#include "mongoc-stream-private.h"
+#include "mongoc-stream-simulated.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "stream"
+
+
+/*
+ * The network is modeled as a link of a given round trip time and
+ * bandwidth. The reply to what was written cannot be read before the
+ * round trip has elapsed since the write, plus a random jitter, so a
+ * batch of requests written at once pays one round trip and time spent
+ * elsewhere between the write and the read hides it. Every byte costs
+ * its transmission time in either direction, and every read or write may
+ * stall, the way a lost packet waits for its retransmission.
+ *
+ * Jitter and stalls come from a generator seeded by the options, so a
+ * given sequence of reads and writes is delayed the same way each run.
+ */
+typedef struct
+{
+   mongoc_stream_t                 stream;
+   mongoc_stream_t                *base_stream;
+   mongoc_stream_simulated_opts_t  opts;
+   uint32_t                        rand;
+   int64_t                         ready_at;
+} mongoc_stream_simulated_t;
+
+
+static uint32_t
+_mongoc_stream_simulated_rand (mongoc_stream_simulated_t *simulated)
+{
+   uint32_t x = simulated->rand;
+
+   /* xorshift32 */
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+
+   return simulated->rand = x;
+}
+
+
+static int64_t
+_mongoc_stream_simulated_stall (mongoc_stream_simulated_t *simulated)
+{
+   if (simulated->opts.stalls_per_million &&
+       ((_mongoc_stream_simulated_rand (simulated) % 1000000) <
+        simulated->opts.stalls_per_million)) {
+      return simulated->opts.stall_usec;
+   }
+
+   return 0;
+}
+
+
+static int64_t
+_mongoc_stream_simulated_transmit (mongoc_stream_simulated_t *simulated,
+                                   size_t                     len)
+{
+   if (simulated->opts.bytes_per_sec <= 0) {
+      return 0;
+   }
+
+   return (int64_t)((double)len * 1000000.0 /
+                    (double)simulated->opts.bytes_per_sec);
+}
+
+
+static void
+_mongoc_stream_simulated_sleep (int64_t usec)
+{
+#ifdef _WIN32
+   Sleep ((DWORD)((usec + 999) / 1000));
+#else
+   struct timespec ts;
+
+   ts.tv_sec = (time_t)(usec / 1000000);
+   ts.tv_nsec = (long)((usec % 1000000) * 1000);
+
+   while ((-1 == nanosleep (&ts, &ts)) && (errno == EINTR)) {
+   }
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_simulated_delay --
+ *
+ *       Wait @usec before going on with a read or write that was given
+ *       @timeout_msec, as the base stream would have if the network were
+ *       that slow.
+ *
+ * Returns:
+ *       The timeout left for the base stream, or -2 if the delay is
+ *       longer than @timeout_msec. In that case the whole timeout was
+ *       waited and errno is set to ETIMEDOUT.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int32_t
+_mongoc_stream_simulated_delay (int64_t usec,
+                                int32_t timeout_msec)
+{
+   if (usec <= 0) {
+      return timeout_msec;
+   }
+
+   if ((timeout_msec >= 0) && (usec > (int64_t)timeout_msec * 1000)) {
+      _mongoc_stream_simulated_sleep ((int64_t)timeout_msec * 1000);
+#ifdef _WIN32
+      errno = WSAETIMEDOUT;
+#else
+      errno = ETIMEDOUT;
+#endif
+      return -2;
+   }
+
+   _mongoc_stream_simulated_sleep (usec);
+
+   if (timeout_msec > 0) {
+      timeout_msec = BSON_MAX (1, timeout_msec - (int32_t)(usec / 1000));
+   }
+
+   return timeout_msec;
+}
+
+
+static void
+_mongoc_stream_simulated_destroy (mongoc_stream_t *stream)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+
+   bson_return_if_fail (stream);
+
+   mongoc_stream_destroy (simulated->base_stream);
+   simulated->base_stream = NULL;
+
+   bson_free (stream);
+
+   mongoc_counter_streams_active_dec ();
+   mongoc_counter_streams_disposed_inc ();
+}
+
+
+static int
+_mongoc_stream_simulated_close (mongoc_stream_t *stream)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   bson_return_val_if_fail (stream, -1);
+   return mongoc_stream_close (simulated->base_stream);
+}
+
+
+static int
+_mongoc_stream_simulated_flush (mongoc_stream_t *stream)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   bson_return_val_if_fail (stream, -1);
+   return mongoc_stream_flush (simulated->base_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_simulated_writev --
+ *
+ *       Write @iov to the base stream once the bytes would have been
+ *       sent, and note when the reply could first be read.
+ *
+ * Returns:
+ *       The number of bytes written or -1 on failure.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_mongoc_stream_simulated_writev (mongoc_stream_t *stream,
+                                 mongoc_iovec_t  *iov,
+                                 size_t           iovcnt,
+                                 int32_t          timeout_msec)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   int64_t usec;
+   int64_t rtt;
+   size_t len = 0;
+   ssize_t ret;
+   size_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (simulated, -1);
+
+   for (i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+   }
+
+   usec = _mongoc_stream_simulated_transmit (simulated, len) +
+          _mongoc_stream_simulated_stall (simulated);
+
+   if (-2 == (timeout_msec = _mongoc_stream_simulated_delay (usec,
+                                                             timeout_msec))) {
+      RETURN (-1);
+   }
+
+   ret = mongoc_stream_writev (simulated->base_stream, iov, iovcnt,
+                               timeout_msec);
+
+   if (ret > 0) {
+      rtt = simulated->opts.latency_usec;
+
+      if (simulated->opts.jitter_usec > 0) {
+         rtt += _mongoc_stream_simulated_rand (simulated) %
+                (uint32_t)BSON_MIN (simulated->opts.jitter_usec + 1,
+                                    (int64_t)UINT32_MAX);
+      }
+
+      simulated->ready_at = BSON_MAX (simulated->ready_at,
+                                      bson_get_monotonic_time () + rtt);
+   }
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_simulated_readv --
+ *
+ *       Wait for the round trip of the last write to be over, and read
+ *       from the base stream. The bytes read are then held for the time
+ *       they would have taken to come in.
+ *
+ * Returns:
+ *       The number of bytes read or -1 on failure.
+ *
+ * Side effects:
+ *       iov[*]->iov_base buffers are filled.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static ssize_t
+_mongoc_stream_simulated_readv (mongoc_stream_t *stream,
+                                mongoc_iovec_t  *iov,
+                                size_t           iovcnt,
+                                size_t           min_bytes,
+                                int32_t          timeout_msec)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   int64_t usec;
+   ssize_t ret;
+
+   ENTRY;
+
+   bson_return_val_if_fail (simulated, -1);
+
+   usec = (simulated->ready_at - bson_get_monotonic_time ()) +
+          _mongoc_stream_simulated_stall (simulated);
+
+   if (-2 == (timeout_msec = _mongoc_stream_simulated_delay (usec,
+                                                             timeout_msec))) {
+      RETURN (-1);
+   }
+
+   ret = mongoc_stream_readv (simulated->base_stream, iov, iovcnt, min_bytes,
+                              timeout_msec);
+
+   if (ret > 0) {
+      _mongoc_stream_simulated_sleep (
+         _mongoc_stream_simulated_transmit (simulated, (size_t)ret));
+   }
+
+   RETURN (ret);
+}
+
+
+static int
+_mongoc_stream_simulated_setsockopt (mongoc_stream_t *stream,
+                                     int              level,
+                                     int              optname,
+                                     void            *optval,
+                                     socklen_t        optlen)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   bson_return_val_if_fail (stream, -1);
+   return mongoc_stream_setsockopt (simulated->base_stream, level, optname,
+                                    optval, optlen);
+}
+
+
+static mongoc_stream_t *
+_mongoc_stream_simulated_get_base_stream (mongoc_stream_t *stream)
+{
+   return ((mongoc_stream_simulated_t *)stream)->base_stream;
+}
+
+
+static bool
+_mongoc_stream_simulated_check_closed (mongoc_stream_t *stream)
+{
+   mongoc_stream_simulated_t *simulated = (mongoc_stream_simulated_t *)stream;
+   bson_return_val_if_fail (stream, true);
+   return mongoc_stream_check_closed (simulated->base_stream);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_simulated_new --
+ *
+ *       Creates a new mongoc_stream_simulated_t, which delays the reads
+ *       and writes of @base_stream as a network with the round trip
+ *       time, bandwidth, jitter and stalls of @opts would. It is meant
+ *       to be returned by the stream initiator of a client, for testing
+ *       the driver against remote clusters with local servers.
+ *
+ *       @base_stream is considered owned by the resulting stream after
+ *       calling this function.
+ *
+ * Returns:
+ *       A newly allocated mongoc_stream_t.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+mongoc_stream_simulated_new (mongoc_stream_t                      *base_stream, /* IN */
+                             const mongoc_stream_simulated_opts_t *opts)        /* IN */
+{
+   mongoc_stream_simulated_t *stream;
+
+   bson_return_val_if_fail (base_stream, NULL);
+   bson_return_val_if_fail (opts, NULL);
+
+   stream = bson_malloc0 (sizeof *stream);
+   stream->stream.type = MONGOC_STREAM_SIMULATED;
+   stream->stream.destroy = _mongoc_stream_simulated_destroy;
+   stream->stream.close = _mongoc_stream_simulated_close;
+   stream->stream.flush = _mongoc_stream_simulated_flush;
+   stream->stream.writev = _mongoc_stream_simulated_writev;
+   stream->stream.readv = _mongoc_stream_simulated_readv;
+   stream->stream.setsockopt = _mongoc_stream_simulated_setsockopt;
+   stream->stream.get_base_stream = _mongoc_stream_simulated_get_base_stream;
+   stream->stream.check_closed = _mongoc_stream_simulated_check_closed;
+
+   stream->base_stream = base_stream;
+   memcpy (&stream->opts, opts, sizeof stream->opts);
+   stream->rand = opts->seed ? opts->seed : 1;
+
+   mongoc_counter_streams_active_inc ();
+
+   return (mongoc_stream_t *)stream;
+}
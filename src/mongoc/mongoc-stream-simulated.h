@@ -0,0 +1,51 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_STREAM_SIMULATED_H
+#define MONGOC_STREAM_SIMULATED_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-stream.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct
+{
+   int64_t   latency_usec;
+   int64_t   jitter_usec;
+   int64_t   bytes_per_sec;
+   int64_t   stall_usec;
+   uint32_t  stalls_per_million;
+   uint32_t  seed;
+   void     *padding [8];
+} mongoc_stream_simulated_opts_t;
+
+
+mongoc_stream_t *mongoc_stream_simulated_new (mongoc_stream_t                      *base_stream,
+                                              const mongoc_stream_simulated_opts_t *opts);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_STREAM_SIMULATED_H */
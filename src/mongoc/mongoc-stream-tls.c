@@ -33,6 +33,7 @@
 #include "mongoc-counters-private.h"
 #include "mongoc-errno-private.h"
 #include "mongoc-stream-tls.h"
+#include "mongoc-stream-tls-private.h"
 #include "mongoc-stream-private.h"
 #include "mongoc-ssl-private.h"
 #include "mongoc-trace.h"
@@ -42,7 +43,8 @@
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "stream-tls"
 
-#define MONGOC_STREAM_TLS_BUFFER_SIZE 4096
+/* The maximum plaintext payload of a single TLS record */
+#define MONGOC_STREAM_TLS_RECORD_SIZE 16384
 
 
 /**
@@ -63,6 +65,8 @@ typedef struct
    SSL_CTX         *ctx;
    int32_t          timeout_msec;
    bool             weak_cert_validation;
+   char            *opt_key;
+   char            *session_key;
 } mongoc_stream_tls_t;
 
 
@@ -385,6 +389,9 @@ _mongoc_stream_tls_destroy (mongoc_stream_t *stream)
    SSL_CTX_free (tls->ctx);
    tls->ctx = NULL;
 
+   bson_free (tls->opt_key);
+   bson_free (tls->session_key);
+
    bson_free (stream);
 
    mongoc_counter_streams_active_dec();
@@ -522,30 +529,31 @@ _mongoc_stream_tls_writev (mongoc_stream_t *stream,
                            int32_t          timeout_msec)
 {
    mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *)stream;
-   char buf[MONGOC_STREAM_TLS_BUFFER_SIZE];
+   char buf[MONGOC_STREAM_TLS_RECORD_SIZE];
 
    ssize_t ret = 0;
    ssize_t child_ret;
    size_t i;
    size_t iov_pos = 0;
 
-   /* There's a bit of a dance to coalesce vectorized writes into
-    * MONGOC_STREAM_TLS_BUFFER_SIZE'd writes to avoid lots of small tls
-    * packets.
+   /* Coalesce vectorized writes into full MONGOC_STREAM_TLS_RECORD_SIZE'd
+    * writes so that each SSL_write() produces full TLS records rather than
+    * one undersized record per iovec.
     *
-    * The basic idea is that we want to combine writes in the buffer if they're
-    * smaller than the buffer, flushing as it gets full.  For larger writes, or
-    * the last write in the iovec array, we want to ignore the buffer and just
-    * write immediately.  We take care of doing buffer writes by re-invoking
-    * ourself with a single iovec_t, pointing at our stack buffer.
+    * Bytes are only copied into the staging buffer when they would otherwise
+    * end up in a partial record: the head of an iovec that tops off bytes
+    * already staged, or a tail shorter than a record with more iovecs still
+    * to come. Whole records, and everything in the last iovec once the
+    * staging buffer is empty, are written straight out of the caller's
+    * memory.
     */
-   char *buf_head = buf;
    char *buf_tail = buf;
-   char *buf_end = buf + MONGOC_STREAM_TLS_BUFFER_SIZE;
+   char *buf_end = buf + MONGOC_STREAM_TLS_RECORD_SIZE;
+   size_t remaining;
    size_t bytes;
 
    char *to_write = NULL;
-   size_t to_write_len;
+   size_t to_write_len = 0;
 
    BSON_ASSERT (tls);
    BSON_ASSERT (iov);
@@ -557,47 +565,49 @@ _mongoc_stream_tls_writev (mongoc_stream_t *stream,
       iov_pos = 0;
 
       while (iov_pos < iov[i].iov_len) {
-         if (buf_head != buf_tail ||
-             ((i + 1 < iovcnt) &&
-              ((buf_end - buf_tail) > (iov[i].iov_len - iov_pos)))) {
-            /* If we have either of:
-             *   - buffered bytes already
-             *   - another iovec to send after this one and we don't have more
-             *     bytes to send than the size of the buffer.
-             *
-             * copy into the buffer */
-
-            bytes = BSON_MIN (iov[i].iov_len - iov_pos, buf_end - buf_tail);
+         remaining = iov[i].iov_len - iov_pos;
+
+         if (buf_tail != buf) {
+            /* Top off the partially filled record */
+
+            bytes = BSON_MIN (remaining, (size_t)(buf_end - buf_tail));
 
             memcpy (buf_tail, (char *) iov[i].iov_base + iov_pos, bytes);
             buf_tail += bytes;
             iov_pos += bytes;
 
             if (buf_tail == buf_end) {
-               /* If we're full, request send */
+               to_write = buf;
+               to_write_len = buf_tail - buf;
 
-               to_write = buf_head;
-               to_write_len = buf_tail - buf_head;
-
-               buf_tail = buf_head = buf;
+               buf_tail = buf;
             }
-         } else {
-            /* Didn't buffer, so just write it through */
+         } else if (i + 1 == iovcnt) {
+            /* Last iovec and nothing staged, write it through */
 
             to_write = (char *)iov[i].iov_base + iov_pos;
-            to_write_len = iov[i].iov_len - iov_pos;
+            to_write_len = remaining;
 
             iov_pos += to_write_len;
+         } else if (remaining >= MONGOC_STREAM_TLS_RECORD_SIZE) {
+            /* Write the whole records in place, stage the tail */
+
+            to_write = (char *)iov[i].iov_base + iov_pos;
+            to_write_len = remaining - (remaining % MONGOC_STREAM_TLS_RECORD_SIZE);
+
+            iov_pos += to_write_len;
+         } else {
+            /* Short tail with more iovecs to come, stage it */
+
+            memcpy (buf_tail, (char *) iov[i].iov_base + iov_pos, remaining);
+            buf_tail += remaining;
+            iov_pos += remaining;
          }
 
          if (to_write) {
-            /* We get here if we buffered some bytes and filled the buffer, or
-             * if we didn't buffer and have to send out of the iovec */
-
             child_ret = _mongoc_stream_tls_write (tls, to_write, to_write_len);
 
             if (child_ret < 0) {
-               /* Buffer write failed, just return the error */
                return child_ret;
             }
 
@@ -614,10 +624,10 @@ _mongoc_stream_tls_writev (mongoc_stream_t *stream,
       }
    }
 
-   if (buf_head != buf_tail) {
+   if (buf_tail != buf) {
       /* If we have any bytes buffered, send */
 
-      child_ret = _mongoc_stream_tls_write (tls, buf_head, buf_tail - buf_head);
+      child_ret = _mongoc_stream_tls_write (tls, buf, buf_tail - buf);
 
       if (child_ret < 0) {
          return child_ret;
@@ -782,15 +792,29 @@ mongoc_stream_tls_do_handshake (mongoc_stream_t *stream,
                                 int32_t          timeout_msec)
 {
    mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *)stream;
+   SSL *ssl;
 
    BSON_ASSERT (tls);
 
    tls->timeout_msec = timeout_msec;
 
    if (BIO_do_handshake (tls->bio) == 1) {
+      BIO_get_ssl (tls->bio, &ssl);
+
+      if (SSL_session_reused (ssl)) {
+         mongoc_counter_ssl_handshakes_resumed_inc ();
+      } else {
+         mongoc_counter_ssl_handshakes_full_inc ();
+      }
+
       return true;
    }
 
+   /* don't try to resume that session again */
+   if (tls->session_key) {
+      _mongoc_ssl_session_cache_remove (tls->session_key);
+   }
+
    if (!errno) {
 #ifdef _WIN32
       errno = WSAETIMEDOUT;
@@ -803,6 +827,110 @@ mongoc_stream_tls_do_handshake (mongoc_stream_t *stream,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_new_session_cb --
+ *
+ *       Called by OpenSSL when the server hands out a session or a
+ *       session ticket, which is kept in the session cache for the next
+ *       connection to the same server.
+ *
+ * Returns:
+ *       1 if the session cache took the reference to @session.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static int
+_mongoc_stream_tls_new_session_cb (SSL         *ssl,
+                                   SSL_SESSION *session)
+{
+   mongoc_stream_tls_t *tls = SSL_get_app_data (ssl);
+
+   if (tls && tls->session_key) {
+      _mongoc_ssl_session_cache_put (tls->session_key, session);
+      return 1;
+   }
+
+   return 0;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_set_session_key --
+ *
+ *       Enable session resumption for the connection to @host_and_port.
+ *       If a session from an earlier connection to it with the same TLS
+ *       options is cached, the handshake will try to resume it, and new
+ *       sessions the server issues are cached for the next connection.
+ *
+ *       This must be called before the handshake.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_set_session_key (mongoc_stream_t *stream,
+                                    const char      *host_and_port)
+{
+   mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *)stream;
+   SSL *ssl;
+
+   BSON_ASSERT (tls);
+   BSON_ASSERT (host_and_port);
+
+   bson_free (tls->session_key);
+   tls->session_key = bson_strdup_printf ("%s|%s", host_and_port,
+                                          tls->opt_key);
+
+   BIO_get_ssl (tls->bio, &ssl);
+   _mongoc_ssl_session_cache_apply (tls->session_key, ssl);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_abandon --
+ *
+ *       Make destroying @stream skip the close_notify alert. The TLS
+ *       state of a connection inherited across fork() still belongs to
+ *       the parent, and any record we sent would corrupt it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_tls_abandon (mongoc_stream_t *stream)
+{
+   mongoc_stream_tls_t *tls = (mongoc_stream_tls_t *)stream;
+   SSL *ssl;
+
+   BSON_ASSERT (tls);
+
+   BIO_get_ssl (tls->bio, &ssl);
+   SSL_set_quiet_shutdown (ssl, 1);
+}
+
+
 /**
  * mongoc_stream_tls_check_cert:
  *
@@ -820,7 +948,8 @@ mongoc_stream_tls_check_cert (mongoc_stream_t *stream,
 
    BIO_get_ssl (tls->bio, &ssl);
 
-   return _mongoc_ssl_check_cert (ssl, host, tls->weak_cert_validation);
+   return _mongoc_ssl_check_cert_cached (ssl, host, tls->opt_key,
+                                         tls->weak_cert_validation);
 }
 
 
@@ -843,19 +972,50 @@ _mongoc_stream_tls_check_closed (mongoc_stream_t *stream) /* IN */
 /*
  *--------------------------------------------------------------------------
  *
- * mongoc_stream_tls_new --
+ * _mongoc_stream_tls_ctx_new --
  *
- *       Creates a new mongoc_stream_tls_t to communicate with a remote
- *       server using a TLS stream.
+ *       Create an SSL_CTX for client streams from @opt, loading the
+ *       certificates and revocation list it names. The context can be
+ *       shared by any number of streams, see
+ *       _mongoc_stream_tls_new_with_ctx(), so that they are loaded and
+ *       parsed only once.
  *
- *       @base_stream should be a stream that will become owned by the
- *       resulting tls stream. It will be used for raw I/O.
+ * Returns:
+ *       A new SSL_CTX that should be freed with SSL_CTX_free(), or NULL
+ *       if the files named by @opt could not be loaded.
  *
- *       @trust_store_dir should be a path to the SSL cert db to use for
- *       verifying trust of the remote server.
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+SSL_CTX *
+_mongoc_stream_tls_ctx_new (mongoc_ssl_opt_t *opt)
+{
+   SSL_CTX *ssl_ctx;
+
+   BSON_ASSERT (opt);
+
+   if ((ssl_ctx = _mongoc_ssl_ctx_new (opt))) {
+      SSL_CTX_sess_set_new_cb (ssl_ctx, _mongoc_stream_tls_new_session_cb);
+   }
+
+   return ssl_ctx;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_tls_new_with_ctx --
+ *
+ *       Like mongoc_stream_tls_new() but with @ssl_ctx, which must have
+ *       been created from @opt, instead of a context of its own. The
+ *       stream takes a reference on @ssl_ctx.
  *
  * Returns:
- *       NULL on failure, otherwise a mongoc_stream_t.
+ *       A mongoc_stream_t.
  *
  * Side effects:
  *       None.
@@ -864,24 +1024,20 @@ _mongoc_stream_tls_check_closed (mongoc_stream_t *stream) /* IN */
  */
 
 mongoc_stream_t *
-mongoc_stream_tls_new (mongoc_stream_t  *base_stream,
-                       mongoc_ssl_opt_t *opt,
-                       int               client)
+_mongoc_stream_tls_new_with_ctx (mongoc_stream_t  *base_stream,
+                                 mongoc_ssl_opt_t *opt,
+                                 SSL_CTX          *ssl_ctx,
+                                 int               client)
 {
    mongoc_stream_tls_t *tls;
-   SSL_CTX *ssl_ctx = NULL;
+   SSL *ssl;
 
    BIO *bio_ssl = NULL;
    BIO *bio_mongoc_shim = NULL;
 
    BSON_ASSERT(base_stream);
    BSON_ASSERT(opt);
-
-   ssl_ctx = _mongoc_ssl_ctx_new (opt);
-
-   if (!ssl_ctx) {
-      return NULL;
-   }
+   BSON_ASSERT(ssl_ctx);
 
    bio_ssl = BIO_new_ssl (ssl_ctx, client);
    bio_mongoc_shim = BIO_new (&gMongocStreamTlsRawMethods);
@@ -889,6 +1045,17 @@ mongoc_stream_tls_new (mongoc_stream_t  *base_stream,
    BIO_push (bio_ssl, bio_mongoc_shim);
 
    tls = bson_malloc0 (sizeof *tls);
+
+   BIO_get_ssl (bio_ssl, &ssl);
+   SSL_set_app_data (ssl, tls);
+
+   /* sessions are only resumed with the same certificate options */
+   tls->opt_key = bson_strdup_printf ("%s|%s|%s|%s|%d",
+                                      opt->pem_file ? opt->pem_file : "",
+                                      opt->ca_file ? opt->ca_file : "",
+                                      opt->ca_dir ? opt->ca_dir : "",
+                                      opt->crl_file ? opt->crl_file : "",
+                                      (int)opt->weak_cert_validation);
    tls->base_stream = base_stream;
    tls->parent.type = MONGOC_STREAM_TLS;
    tls->parent.destroy = _mongoc_stream_tls_destroy;
@@ -901,7 +1068,7 @@ mongoc_stream_tls_new (mongoc_stream_t  *base_stream,
    tls->parent.check_closed = _mongoc_stream_tls_check_closed;
    tls->weak_cert_validation = opt->weak_cert_validation;
    tls->bio = bio_ssl;
-   tls->ctx = ssl_ctx;
+   tls->ctx = _mongoc_ssl_ctx_ref (ssl_ctx);
    tls->timeout_msec = -1;
    bio_mongoc_shim->ptr = tls;
 
@@ -910,4 +1077,53 @@ mongoc_stream_tls_new (mongoc_stream_t  *base_stream,
    return (mongoc_stream_t *)tls;
 }
 
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_stream_tls_new --
+ *
+ *       Creates a new mongoc_stream_tls_t to communicate with a remote
+ *       server using a TLS stream.
+ *
+ *       @base_stream should be a stream that will become owned by the
+ *       resulting tls stream. It will be used for raw I/O.
+ *
+ *       @trust_store_dir should be a path to the SSL cert db to use for
+ *       verifying trust of the remote server.
+ *
+ * Returns:
+ *       NULL on failure, otherwise a mongoc_stream_t.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_stream_t *
+mongoc_stream_tls_new (mongoc_stream_t  *base_stream,
+                       mongoc_ssl_opt_t *opt,
+                       int               client)
+{
+   mongoc_stream_t *stream;
+   SSL_CTX *ssl_ctx = NULL;
+
+   BSON_ASSERT(base_stream);
+   BSON_ASSERT(opt);
+
+   ssl_ctx = client ? _mongoc_stream_tls_ctx_new (opt)
+                    : _mongoc_ssl_ctx_new (opt);
+
+   if (!ssl_ctx) {
+      return NULL;
+   }
+
+   stream = _mongoc_stream_tls_new_with_ctx (base_stream, opt, ssl_ctx,
+                                             client);
+   SSL_CTX_free (ssl_ctx);
+
+   return stream;
+}
+
 #endif
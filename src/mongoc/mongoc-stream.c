@@ -17,6 +17,7 @@
 
 #include <bson.h>
 
+#include "mongoc-config.h"
 #include "mongoc-array-private.h"
 #include "mongoc-buffer-private.h"
 #include "mongoc-error.h"
@@ -24,10 +25,16 @@
 #include "mongoc-log.h"
 #include "mongoc-opcode.h"
 #include "mongoc-rpc-private.h"
+#include "mongoc-socket-private.h"
 #include "mongoc-stream.h"
 #include "mongoc-stream-private.h"
+#include "mongoc-stream-socket.h"
 #include "mongoc-trace.h"
 
+#ifdef MONGOC_ENABLE_SSL
+#include "mongoc-stream-tls-private.h"
+#endif
+
 
 #undef MONGOC_LOG_DOMAIN
 #define MONGOC_LOG_DOMAIN "stream"
@@ -275,6 +282,92 @@ mongoc_stream_get_base_stream (mongoc_stream_t *stream) /* IN */
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_get_socket --
+ *
+ *       Walk the chain of base streams below @stream looking for a
+ *       socket stream.
+ *
+ * Returns:
+ *       The mongoc_socket_t of the underlying socket stream, or NULL if
+ *       @stream is not backed by a socket.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_socket_t *
+_mongoc_stream_get_socket (mongoc_stream_t *stream) /* IN */
+{
+   while (stream) {
+      if (stream->type == MONGOC_STREAM_SOCKET) {
+         return mongoc_stream_socket_get_socket (
+            (mongoc_stream_socket_t *)stream);
+      }
+
+      stream = mongoc_stream_get_base_stream (stream);
+   }
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_stream_abandon --
+ *
+ *       Destroy @stream without sending anything on it: the socket below
+ *       is closed without a shutdown and a TLS layer sends no
+ *       close_notify. This is how a child process lets go of the
+ *       connections it inherited, which the parent may still be using.
+ *
+ *       Stream types unknown to the driver are destroyed as usual.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @stream is destroyed.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_stream_abandon (mongoc_stream_t *stream) /* IN */
+{
+   mongoc_stream_t *iter;
+
+   ENTRY;
+
+   BSON_ASSERT (stream);
+
+   for (iter = stream; iter; iter = mongoc_stream_get_base_stream (iter)) {
+#ifdef MONGOC_ENABLE_SSL
+      if (iter->type == MONGOC_STREAM_TLS) {
+         _mongoc_stream_tls_abandon (iter);
+      }
+#endif
+
+      if (iter->type == MONGOC_STREAM_SOCKET) {
+         _mongoc_socket_abandon (mongoc_stream_socket_get_socket (
+            (mongoc_stream_socket_t *)iter));
+      }
+   }
+
+   /*
+    * Anything a layer flushes on destroy now fails on the closed socket.
+    */
+   mongoc_stream_destroy (stream);
+
+   EXIT;
+}
+
+
 bool
 mongoc_stream_check_closed (mongoc_stream_t *stream)
 {
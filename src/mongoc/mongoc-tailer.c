@@ -0,0 +1,550 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-collection.h"
+#include "mongoc-cursor.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-tailer.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "tailer"
+
+
+/*
+ * When the cursor dies, or the server has no cursor to keep open, as for
+ * an empty capped collection, the query is sent again after a delay that
+ * doubles from MONGOC_TAILER_RETRY_MIN_MSEC up to
+ * MONGOC_TAILER_RETRY_MAX_MSEC until documents arrive again.
+ */
+#define MONGOC_TAILER_RETRY_MIN_MSEC    10
+#define MONGOC_TAILER_RETRY_MAX_MSEC    1000
+#define MONGOC_TAILER_RING_SIZE_DEFAULT 1024
+
+
+struct _mongoc_tailer_t
+{
+   mongoc_client_pool_t *pool;
+   char                 *db;
+   char                 *collection;
+   bson_t                query;
+   char                 *resume_field;
+   mongoc_query_flags_t  flags;
+
+   /*
+    * The value of the resume field in the last document received. Only
+    * used by the tailing thread.
+    */
+   bool                  has_resume;
+   bson_value_t          resume;
+
+   /*
+    * Documents waiting for mongoc_tailer_next(), starting at head. While
+    * the consumer holds the one at head, it is still counted in len so the
+    * tailing thread doesn't overwrite it.
+    */
+   mongoc_mutex_t        mutex;
+   mongoc_cond_t         readable;
+   mongoc_cond_t         writable;
+   bson_t               *ring;
+   uint32_t              ring_size;
+   uint32_t              head;
+   uint32_t              len;
+   bool                  has_current;
+   bool                  stop;
+   bool                  failed;
+   bson_error_t          error;
+
+   mongoc_thread_t       thread;
+};
+
+
+static bool
+_mongoc_tailer_stopped (mongoc_tailer_t *tailer)
+{
+   bool stop;
+
+   mongoc_mutex_lock (&tailer->mutex);
+   stop = tailer->stop;
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   return stop;
+}
+
+
+/*
+ * Sleeps for @msec, or until the tailer is destroyed.
+ */
+static bool
+_mongoc_tailer_sleep (mongoc_tailer_t *tailer,
+                      int64_t          msec)
+{
+   bool stop;
+
+   mongoc_mutex_lock (&tailer->mutex);
+   if (!tailer->stop) {
+      mongoc_cond_timedwait (&tailer->writable, &tailer->mutex, msec);
+   }
+   stop = tailer->stop;
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   return !stop;
+}
+
+
+static void
+_mongoc_tailer_fail (mongoc_tailer_t    *tailer,
+                     const bson_error_t *error)
+{
+   mongoc_mutex_lock (&tailer->mutex);
+   memcpy (&tailer->error, error, sizeof tailer->error);
+   tailer->failed = true;
+   mongoc_cond_broadcast (&tailer->readable);
+   mongoc_mutex_unlock (&tailer->mutex);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_tailer_push --
+ *
+ *       Copies @doc into the ring and wakes up the consumer, waiting for
+ *       a free slot if the ring is full.
+ *
+ * Returns:
+ *       false if the tailer is being destroyed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_tailer_push (mongoc_tailer_t *tailer,
+                     const bson_t    *doc)
+{
+   bson_t *slot;
+
+   mongoc_mutex_lock (&tailer->mutex);
+
+   while (tailer->len == tailer->ring_size && !tailer->stop) {
+      mongoc_cond_wait (&tailer->writable, &tailer->mutex);
+   }
+
+   if (tailer->stop) {
+      mongoc_mutex_unlock (&tailer->mutex);
+      return false;
+   }
+
+   slot = &tailer->ring [(tailer->head + tailer->len) % tailer->ring_size];
+   bson_reinit (slot);
+   bson_concat (slot, doc);
+   tailer->len++;
+
+   mongoc_cond_signal (&tailer->readable);
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   return true;
+}
+
+
+static void
+_mongoc_tailer_save_resume (mongoc_tailer_t *tailer,
+                            const bson_t    *doc)
+{
+   bson_iter_t iter;
+
+   if (tailer->resume_field &&
+       bson_iter_init_find (&iter, doc, tailer->resume_field)) {
+      if (tailer->has_resume) {
+         bson_value_destroy (&tailer->resume);
+      }
+      bson_value_copy (bson_iter_value (&iter), &tailer->resume);
+      tailer->has_resume = true;
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_tailer_build_query --
+ *
+ *       Appends the query to send to @query: the tailer's query, restricted
+ *       to documents after the last one received if there was one.
+ *
+ *       The condition is added at the top level unless the query already
+ *       has one on the resume field, since oplogReplay only looks there.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_tailer_build_query (mongoc_tailer_t *tailer,
+                            bson_t          *query)
+{
+   bson_iter_t iter;
+   bson_t child;
+   bson_t and;
+   bson_t gt;
+
+   if (!tailer->has_resume) {
+      bson_concat (query, &tailer->query);
+      return;
+   }
+
+   if (bson_iter_init_find (&iter, &tailer->query, tailer->resume_field)) {
+      bson_append_array_begin (query, "$and", 4, &and);
+      BSON_APPEND_DOCUMENT (&and, "0", &tailer->query);
+      bson_append_document_begin (&and, "1", 1, &child);
+      bson_append_document_begin (&child, tailer->resume_field, -1, &gt);
+      BSON_APPEND_VALUE (&gt, "$gt", &tailer->resume);
+      bson_append_document_end (&child, &gt);
+      bson_append_document_end (&and, &child);
+      bson_append_array_end (query, &and);
+   } else {
+      bson_concat (query, &tailer->query);
+      bson_append_document_begin (query, tailer->resume_field, -1, &gt);
+      BSON_APPEND_VALUE (&gt, "$gt", &tailer->resume);
+      bson_append_document_end (query, &gt);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_tailer_run --
+ *
+ *       Thread entry point of the tailer. Keeps a tailable, awaitData
+ *       cursor open and copies every document it returns into the ring.
+ *
+ *       An empty batch leaves the cursor alive, and the next
+ *       mongoc_cursor_next() sends another OP_GET_MORE that the server
+ *       holds until new documents arrive. When the cursor dies or fails,
+ *       it is created again for the documents after the last one
+ *       received. Only a query the server can't tail stops the tailer.
+ *
+ * Returns:
+ *       NULL.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void *
+_mongoc_tailer_run (void *data)
+{
+   mongoc_tailer_t *tailer = data;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   int64_t retry_msec = MONGOC_TAILER_RETRY_MIN_MSEC;
+   bson_t query;
+   bool stop = false;
+
+   client = mongoc_client_pool_pop (tailer->pool);
+   collection = mongoc_client_get_collection (client, tailer->db,
+                                              tailer->collection);
+
+   while (!stop) {
+      bson_init (&query);
+      _mongoc_tailer_build_query (tailer, &query);
+      cursor = mongoc_collection_find (collection,
+                                       (tailer->flags |
+                                        MONGOC_QUERY_TAILABLE_CURSOR |
+                                        MONGOC_QUERY_AWAIT_DATA),
+                                       0, 0, 0, &query, NULL, NULL);
+      bson_destroy (&query);
+
+      while (!stop && mongoc_cursor_is_alive (cursor)) {
+         if (mongoc_cursor_next (cursor, &doc)) {
+            _mongoc_tailer_save_resume (tailer, doc);
+            stop = !_mongoc_tailer_push (tailer, doc);
+            retry_msec = MONGOC_TAILER_RETRY_MIN_MSEC;
+         } else if (mongoc_cursor_error (cursor, &error)) {
+            break;
+         } else {
+            stop = _mongoc_tailer_stopped (tailer);
+         }
+      }
+
+      if (!stop && mongoc_cursor_error (cursor, &error)) {
+         if (error.domain == MONGOC_ERROR_QUERY &&
+             error.code == MONGOC_ERROR_QUERY_NOT_TAILABLE) {
+            _mongoc_tailer_fail (tailer, &error);
+            stop = true;
+         } else {
+            MONGOC_WARNING ("Tailing %s.%s failed, resuming: %s",
+                            tailer->db, tailer->collection, error.message);
+         }
+      }
+
+      mongoc_cursor_destroy (cursor);
+
+      if (!stop) {
+         stop = !_mongoc_tailer_sleep (tailer, retry_msec);
+         retry_msec = BSON_MIN (retry_msec * 2, MONGOC_TAILER_RETRY_MAX_MSEC);
+      }
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (tailer->pool, client);
+
+   return NULL;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_tailer_new --
+ *
+ *       Starts tailing the documents of the capped collection
+ *       @db.@collection that match @query, from a thread with a client
+ *       popped from @pool.
+ *
+ *       Documents are copied into a ring of @ring_size slots as soon as
+ *       they arrive, from where mongoc_tailer_next() hands them out. If
+ *       the ring is full, tailing pauses until the consumer catches up.
+ *       A @ring_size of 0 picks a default.
+ *
+ *       When the cursor is lost, tailing resumes with the documents whose
+ *       @resume_field is greater than in the last document received, such
+ *       as "ts" for the oplog or "_id" for a capped collection with
+ *       ObjectIds. Without a @resume_field, @query is sent again as is.
+ *
+ *       @flags are added to MONGOC_QUERY_TAILABLE_CURSOR and
+ *       MONGOC_QUERY_AWAIT_DATA, for instance MONGOC_QUERY_OPLOG_REPLAY.
+ *
+ * Returns:
+ *       A newly allocated mongoc_tailer_t that should be freed with
+ *       mongoc_tailer_destroy().
+ *
+ * Side effects:
+ *       A thread is spawned.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_tailer_t *
+mongoc_tailer_new (mongoc_client_pool_t *pool,
+                   const char           *db,
+                   const char           *collection,
+                   const bson_t         *query,
+                   const char           *resume_field,
+                   mongoc_query_flags_t  flags,
+                   uint32_t              ring_size)
+{
+   mongoc_tailer_t *tailer;
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_val_if_fail (pool, NULL);
+   bson_return_val_if_fail (db, NULL);
+   bson_return_val_if_fail (collection, NULL);
+
+   tailer = bson_malloc0 (sizeof *tailer);
+   tailer->pool = pool;
+   tailer->db = bson_strdup (db);
+   tailer->collection = bson_strdup (collection);
+   tailer->flags = flags;
+
+   bson_init (&tailer->query);
+   if (query) {
+      bson_concat (&tailer->query, query);
+   }
+
+   if (resume_field) {
+      tailer->resume_field = bson_strdup (resume_field);
+   }
+
+   tailer->ring_size = ring_size ? ring_size : MONGOC_TAILER_RING_SIZE_DEFAULT;
+   tailer->ring = bson_malloc (tailer->ring_size * sizeof *tailer->ring);
+   for (i = 0; i < tailer->ring_size; i++) {
+      bson_init (&tailer->ring [i]);
+   }
+
+   mongoc_mutex_init (&tailer->mutex);
+   mongoc_cond_init (&tailer->readable);
+   mongoc_cond_init (&tailer->writable);
+
+   mongoc_thread_create (&tailer->thread, _mongoc_tailer_run, tailer);
+
+   RETURN (tailer);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_tailer_next --
+ *
+ *       Waits up to @timeout_msec for the next document, or forever if
+ *       @timeout_msec is negative. The calling thread sleeps until a
+ *       document is received.
+ *
+ *       The document is valid until the next call or until the tailer is
+ *       destroyed.
+ *
+ * Returns:
+ *       The next document, or NULL if none arrived in time or the tailer
+ *       failed, in which case mongoc_tailer_error() should be checked.
+ *
+ * Side effects:
+ *       The previous document is released.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+const bson_t *
+mongoc_tailer_next (mongoc_tailer_t *tailer,
+                    int64_t          timeout_msec)
+{
+   const bson_t *doc = NULL;
+   int64_t deadline;
+   int64_t now;
+
+   bson_return_val_if_fail (tailer, NULL);
+
+   mongoc_mutex_lock (&tailer->mutex);
+
+   if (tailer->has_current) {
+      tailer->head = (tailer->head + 1) % tailer->ring_size;
+      tailer->len--;
+      tailer->has_current = false;
+      mongoc_cond_signal (&tailer->writable);
+   }
+
+   deadline = bson_get_monotonic_time () + (timeout_msec * 1000);
+
+   while (!tailer->len && !tailer->failed) {
+      if (timeout_msec < 0) {
+         mongoc_cond_wait (&tailer->readable, &tailer->mutex);
+         continue;
+      }
+
+      now = bson_get_monotonic_time ();
+      if (now >= deadline) {
+         break;
+      }
+
+      mongoc_cond_timedwait (&tailer->readable, &tailer->mutex,
+                             (deadline - now + 999) / 1000);
+   }
+
+   if (tailer->len) {
+      doc = &tailer->ring [tailer->head];
+      tailer->has_current = true;
+   }
+
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   return doc;
+}
+
+
+bool
+mongoc_tailer_error (mongoc_tailer_t *tailer,
+                     bson_error_t    *error)
+{
+   bool failed;
+
+   bson_return_val_if_fail (tailer, false);
+
+   mongoc_mutex_lock (&tailer->mutex);
+   failed = tailer->failed;
+   if (failed && error) {
+      memcpy (error, &tailer->error, sizeof *error);
+   }
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   return failed;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_tailer_destroy --
+ *
+ *       Stops the tailing thread and frees @tailer, along with the
+ *       documents it has received but not handed out.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Blocks until an OP_GET_MORE in progress returns, which the server
+ *       holds for at most its awaitData timeout.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_tailer_destroy (mongoc_tailer_t *tailer)
+{
+   uint32_t i;
+
+   ENTRY;
+
+   bson_return_if_fail (tailer);
+
+   mongoc_mutex_lock (&tailer->mutex);
+   tailer->stop = true;
+   mongoc_cond_broadcast (&tailer->writable);
+   mongoc_mutex_unlock (&tailer->mutex);
+
+   mongoc_thread_join (tailer->thread);
+
+   for (i = 0; i < tailer->ring_size; i++) {
+      bson_destroy (&tailer->ring [i]);
+   }
+   bson_free (tailer->ring);
+
+   if (tailer->has_resume) {
+      bson_value_destroy (&tailer->resume);
+   }
+
+   mongoc_cond_destroy (&tailer->writable);
+   mongoc_cond_destroy (&tailer->readable);
+   mongoc_mutex_destroy (&tailer->mutex);
+
+   bson_destroy (&tailer->query);
+   bson_free (tailer->resume_field);
+   bson_free (tailer->collection);
+   bson_free (tailer->db);
+   bson_free (tailer);
+
+   EXIT;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_TAILER_H
+#define MONGOC_TAILER_H
+
+#if !defined (MONGOC_INSIDE) && !defined (MONGOC_COMPILATION)
+# error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+#include "mongoc-client-pool.h"
+#include "mongoc-flags.h"
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_tailer_t mongoc_tailer_t;
+
+
+mongoc_tailer_t *mongoc_tailer_new     (mongoc_client_pool_t  *pool,
+                                        const char            *db,
+                                        const char            *collection,
+                                        const bson_t          *query,
+                                        const char            *resume_field,
+                                        mongoc_query_flags_t   flags,
+                                        uint32_t               ring_size);
+const bson_t    *mongoc_tailer_next    (mongoc_tailer_t       *tailer,
+                                        int64_t                timeout_msec);
+bool             mongoc_tailer_error   (mongoc_tailer_t       *tailer,
+                                        bson_error_t          *error);
+void             mongoc_tailer_destroy (mongoc_tailer_t       *tailer);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_TAILER_H */
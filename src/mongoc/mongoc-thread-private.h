@@ -33,7 +33,9 @@
 # define mongoc_cond_init(_n)           pthread_cond_init((_n), NULL)
 # define mongoc_cond_wait               pthread_cond_wait
 # define mongoc_cond_signal             pthread_cond_signal
+# define mongoc_cond_broadcast          pthread_cond_broadcast
 # define mongoc_cond_destroy            pthread_cond_destroy
+# define mongoc_cond_timedwait          _mongoc_cond_timedwait
 # define mongoc_mutex_t                 pthread_mutex_t
 # define mongoc_mutex_init(_n)          pthread_mutex_init((_n), NULL)
 # define mongoc_mutex_lock              pthread_mutex_lock
@@ -44,6 +46,11 @@
 # define mongoc_thread_join(_n)         pthread_join((_n), NULL)
 # define mongoc_once_t                  pthread_once_t
 # define mongoc_once                    pthread_once
+# define mongoc_thread_key_t            pthread_key_t
+# define mongoc_thread_key_create(_k)   pthread_key_create((_k), NULL)
+# define mongoc_thread_key_delete       pthread_key_delete
+# define mongoc_thread_key_get          pthread_getspecific
+# define mongoc_thread_key_set          pthread_setspecific
 # define MONGOC_ONCE_FUN(n)             void n(void)
 # define MONGOC_ONCE_RETURN             return
 # ifdef _PTHREAD_ONCE_INIT_NEEDS_BRACES
@@ -51,6 +58,24 @@
 # else
 #  define MONGOC_ONCE_INIT              PTHREAD_ONCE_INIT
 # endif
+static BSON_INLINE int
+_mongoc_cond_timedwait (pthread_cond_t  *cond,
+                        pthread_mutex_t *mutex,
+                        int64_t          timeout_msec)
+{
+   struct timespec to;
+   struct timeval tv;
+   int64_t msec;
+
+   bson_gettimeofday (&tv);
+
+   msec = ((int64_t)tv.tv_sec * 1000) + (tv.tv_usec / 1000) + timeout_msec;
+
+   to.tv_sec = (time_t)(msec / 1000);
+   to.tv_nsec = (long)((msec % 1000) * 1000000);
+
+   return pthread_cond_timedwait (cond, mutex, &to);
+}
 #else
 # define mongoc_thread_t                HANDLE
 static BSON_INLINE int
@@ -70,12 +95,25 @@ mongoc_thread_create (mongoc_thread_t *thread,
 # define mongoc_cond_t                  CONDITION_VARIABLE
 # define mongoc_cond_init               InitializeConditionVariable
 # define mongoc_cond_wait(_c, _m)       SleepConditionVariableCS((_c), (_m), INFINITE)
+# define mongoc_cond_timedwait(_c, _m, _t) \
+   SleepConditionVariableCS((_c), (_m), (DWORD)(_t))
 # define mongoc_cond_signal             WakeConditionVariable
+# define mongoc_cond_broadcast          WakeAllConditionVariable
 static BSON_INLINE int
 mongoc_cond_destroy (mongoc_cond_t *_ignored)
 {
    return 0;
 }
+# define mongoc_thread_key_t            DWORD
+static BSON_INLINE int
+mongoc_thread_key_create (mongoc_thread_key_t *key)
+{
+   *key = TlsAlloc ();
+   return (*key == TLS_OUT_OF_INDEXES) ? -1 : 0;
+}
+# define mongoc_thread_key_delete       TlsFree
+# define mongoc_thread_key_get          TlsGetValue
+# define mongoc_thread_key_set          TlsSetValue
 # define mongoc_once_t                  INIT_ONCE
 # define MONGOC_ONCE_INIT               INIT_ONCE_STATIC_INIT
 # define mongoc_once(o, c)              InitOnceExecuteOnce(o, c, NULL, NULL)
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_TRACE_RING_PRIVATE_H
+#define MONGOC_TRACE_RING_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+/*
+ * The file written by mongoc_log_trace_dump(), in host byte order:
+ *
+ *   mongoc_trace_header_t
+ *   n_sites times: uint32_t kind, uint32_t line, then the domain, function
+ *                  and text of the site as NUL-terminated strings. Site ids
+ *                  count from 1 in this order.
+ *   n_rings times: mongoc_trace_ring_info_t, then n_records records
+ *                  mongoc_trace_record_t, oldest first.
+ *
+ * src/tools/mongoc-trace.c decodes it, and keeps its own copy of these.
+ */
+#define MONGOC_TRACE_MAGIC   "MONGOCTR"
+#define MONGOC_TRACE_VERSION 1
+
+
+#pragma pack(1)
+typedef struct
+{
+   char     magic [8];
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t ring_size;
+   uint32_t n_sites;
+   uint32_t n_rings;
+   uint32_t n_dropped;
+   int64_t  timestamp;
+} mongoc_trace_header_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_header_t) == 40);
+
+
+#pragma pack(1)
+typedef struct
+{
+   uint32_t thread;
+   uint32_t n_records;
+   uint64_t n_written;
+} mongoc_trace_ring_info_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_ring_info_t) == 16);
+
+
+#pragma pack(1)
+typedef struct
+{
+   int64_t  timestamp;
+   uint32_t site;
+   uint32_t payload;
+} mongoc_trace_record_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_record_t) == 16);
+
+
+void _mongoc_trace_cleanup (void);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_TRACE_RING_PRIVATE_H */
@@ -0,0 +1,463 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-array-private.h"
+#include "mongoc-error.h"
+#include "mongoc-log.h"
+#include "mongoc-thread-private.h"
+#include "mongoc-trace.h"
+#include "mongoc-trace-ring-private.h"
+
+
+#undef MONGOC_LOG_DOMAIN
+#define MONGOC_LOG_DOMAIN "trace"
+
+
+#if defined(MONGOC_TRACE) && !defined(MONGOC_TRACE_LOG)
+
+
+/*
+ * Number of records in the ring of each thread, a power of two. Once a
+ * ring is full, each record overwrites the oldest one.
+ */
+#ifndef MONGOC_TRACE_RING_SIZE
+# define MONGOC_TRACE_RING_SIZE 4096
+#endif
+
+
+/*
+ * Maximum number of threads that get a ring. Records of the threads that
+ * come after are dropped and counted.
+ */
+#ifndef MONGOC_TRACE_RING_MAX
+# define MONGOC_TRACE_RING_MAX 256
+#endif
+
+
+BSON_STATIC_ASSERT (!(MONGOC_TRACE_RING_SIZE & (MONGOC_TRACE_RING_SIZE - 1)));
+
+
+typedef struct
+{
+   mongoc_trace_kind_t  kind;
+   uint32_t             line;
+   const char          *domain;
+   const char          *function;
+   const char          *text;
+} mongoc_trace_site_t;
+
+
+typedef struct
+{
+   uint32_t                       thread;
+   volatile uint64_t              head;
+   volatile mongoc_trace_record_t records [MONGOC_TRACE_RING_SIZE];
+} mongoc_trace_ring_t;
+
+
+static mongoc_mutex_t       gTraceMutex;
+static mongoc_thread_key_t  gTraceKey;
+static volatile bool        gTraceReady;
+static mongoc_array_t       gTraceSites;
+static mongoc_trace_ring_t *gTraceRings [MONGOC_TRACE_RING_MAX];
+static uint32_t             gTraceRingsLen;
+static volatile int32_t     gTraceDropped;
+
+
+static MONGOC_ONCE_FUN (_mongoc_trace_init_once)
+{
+   mongoc_mutex_init (&gTraceMutex);
+   mongoc_thread_key_create (&gTraceKey);
+   _mongoc_array_init (&gTraceSites, sizeof (mongoc_trace_site_t));
+   gTraceReady = true;
+
+   MONGOC_ONCE_RETURN;
+}
+
+
+static void
+_mongoc_trace_init (void)
+{
+   static mongoc_once_t once = MONGOC_ONCE_INIT;
+
+   mongoc_once (&once, _mongoc_trace_init_once);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_trace_site --
+ *
+ *       Register a trace point. The strings must be literals, since only
+ *       their address is kept. Registering the same point twice, as two
+ *       threads racing for its first record do, returns the same id.
+ *
+ * Returns:
+ *       The id of the site, never zero.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_trace_site (mongoc_trace_kind_t  kind,
+                    const char          *domain,
+                    const char          *function,
+                    uint32_t             line,
+                    const char          *text)
+{
+   mongoc_trace_site_t site;
+   mongoc_trace_site_t *s;
+   uint32_t id = 0;
+   size_t i;
+
+   _mongoc_trace_init ();
+
+   mongoc_mutex_lock (&gTraceMutex);
+
+   for (i = 0; i < gTraceSites.len; i++) {
+      s = &_mongoc_array_index (&gTraceSites, mongoc_trace_site_t, i);
+      if ((s->function == function) && (s->line == line) &&
+          (s->kind == kind) && (s->text == text)) {
+         id = (uint32_t)i + 1;
+         break;
+      }
+   }
+
+   if (!id) {
+      site.kind = kind;
+      site.line = line;
+      site.domain = domain;
+      site.function = function;
+      site.text = text;
+      _mongoc_array_append_val (&gTraceSites, site);
+      id = (uint32_t)gTraceSites.len;
+   }
+
+   mongoc_mutex_unlock (&gTraceMutex);
+
+   return id;
+}
+
+
+static mongoc_trace_ring_t *
+_mongoc_trace_ring_new (void)
+{
+   mongoc_trace_ring_t *ring = NULL;
+
+   mongoc_mutex_lock (&gTraceMutex);
+
+   if (gTraceRingsLen < MONGOC_TRACE_RING_MAX) {
+      ring = bson_malloc0 (sizeof *ring);
+      ring->thread = gTraceRingsLen;
+      gTraceRings [gTraceRingsLen++] = ring;
+      mongoc_thread_key_set (gTraceKey, ring);
+   }
+
+   mongoc_mutex_unlock (&gTraceMutex);
+
+   return ring;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_trace_record --
+ *
+ *       Write a record for @site into the ring of the calling thread. This
+ *       takes no lock and formats nothing: each thread owns its ring, and
+ *       only the first record of a thread allocates it.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       May overwrite the oldest record of the ring.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_trace_record (uint32_t site,
+                      uint32_t payload)
+{
+   volatile mongoc_trace_record_t *record;
+   mongoc_trace_ring_t *ring;
+
+   if (BSON_UNLIKELY (!gTraceReady)) {
+      _mongoc_trace_init ();
+   }
+
+   ring = mongoc_thread_key_get (gTraceKey);
+
+   if (BSON_UNLIKELY (!ring)) {
+      if (!(ring = _mongoc_trace_ring_new ())) {
+         bson_atomic_int_add (&gTraceDropped, 1);
+         return;
+      }
+   }
+
+   record = &ring->records [ring->head & (MONGOC_TRACE_RING_SIZE - 1)];
+   record->timestamp = bson_get_monotonic_time ();
+   record->site = site;
+   record->payload = payload;
+   ring->head++;
+}
+
+
+static bool
+_mongoc_trace_write (FILE       *file,
+                     const void *data,
+                     size_t      len)
+{
+   return fwrite (data, 1, len, file) == len;
+}
+
+
+static bool
+_mongoc_trace_write_str (FILE       *file,
+                         const char *str)
+{
+   if (!str) {
+      str = "";
+   }
+
+   return _mongoc_trace_write (file, str, strlen (str) + 1);
+}
+
+
+/*
+ * Write the records of @ring, oldest first. Its thread keeps writing
+ * meanwhile, so the records it overwrote while they were copied are left
+ * out, along with the one it may be writing.
+ */
+static bool
+_mongoc_trace_write_ring (FILE                  *file,
+                          mongoc_trace_ring_t   *ring,
+                          mongoc_trace_record_t *copy)
+{
+   mongoc_trace_ring_info_t info;
+   uint64_t before;
+   uint64_t after;
+   uint64_t first;
+   uint64_t i;
+
+   before = ring->head;
+   bson_memory_barrier ();
+   for (i = 0; i < MONGOC_TRACE_RING_SIZE; i++) {
+      copy [i] = *(mongoc_trace_record_t *)&ring->records [i];
+   }
+   bson_memory_barrier ();
+   after = ring->head;
+
+   first = (before > MONGOC_TRACE_RING_SIZE) ?
+            before - MONGOC_TRACE_RING_SIZE : 0;
+   if (after + 1 > first + MONGOC_TRACE_RING_SIZE) {
+      first = after + 1 - MONGOC_TRACE_RING_SIZE;
+   }
+   if (first > before) {
+      first = before;
+   }
+
+   memset (&info, 0, sizeof info);
+   info.thread = ring->thread;
+   info.n_records = (uint32_t)(before - first);
+   info.n_written = before;
+
+   if (!_mongoc_trace_write (file, &info, sizeof info)) {
+      return false;
+   }
+
+   for (i = first; i < before; i++) {
+      if (!_mongoc_trace_write (file,
+                                &copy [i & (MONGOC_TRACE_RING_SIZE - 1)],
+                                sizeof *copy)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+static bool
+_mongoc_trace_dump (FILE *file)
+{
+   mongoc_trace_record_t *copy;
+   mongoc_trace_header_t header;
+   mongoc_trace_site_t *s;
+   uint32_t site [2];
+   bool ret = false;
+   uint32_t i;
+
+   _mongoc_trace_init ();
+
+   copy = bson_malloc (MONGOC_TRACE_RING_SIZE * sizeof *copy);
+
+   mongoc_mutex_lock (&gTraceMutex);
+
+   memset (&header, 0, sizeof header);
+   memcpy (header.magic, MONGOC_TRACE_MAGIC, sizeof header.magic);
+   header.version = MONGOC_TRACE_VERSION;
+   header.record_size = sizeof (mongoc_trace_record_t);
+   header.ring_size = MONGOC_TRACE_RING_SIZE;
+   header.n_sites = (uint32_t)gTraceSites.len;
+   header.n_rings = gTraceRingsLen;
+   header.n_dropped = (uint32_t)bson_atomic_int_add (&gTraceDropped, 0);
+   header.timestamp = bson_get_monotonic_time ();
+
+   if (!_mongoc_trace_write (file, &header, sizeof header)) {
+      goto failure;
+   }
+
+   for (i = 0; i < gTraceSites.len; i++) {
+      s = &_mongoc_array_index (&gTraceSites, mongoc_trace_site_t, i);
+      site [0] = s->kind;
+      site [1] = s->line;
+      if (!_mongoc_trace_write (file, site, sizeof site) ||
+          !_mongoc_trace_write_str (file, s->domain) ||
+          !_mongoc_trace_write_str (file, s->function) ||
+          !_mongoc_trace_write_str (file, s->text)) {
+         goto failure;
+      }
+   }
+
+   for (i = 0; i < gTraceRingsLen; i++) {
+      if (!_mongoc_trace_write_ring (file, gTraceRings [i], copy)) {
+         goto failure;
+      }
+   }
+
+   ret = true;
+
+failure:
+   mongoc_mutex_unlock (&gTraceMutex);
+   bson_free (copy);
+
+   return ret;
+}
+
+
+#endif
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_log_trace_dump --
+ *
+ *       Write the trace records of every thread to @path, in the binary
+ *       format of mongoc-trace-ring-private.h, for "mongoc-trace" to decode.
+ *
+ * Returns:
+ *       true if successful; otherwise false and @error is set, also when
+ *       the library was not built with the ring buffer tracer.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_log_trace_dump (const char   *path,
+                       bson_error_t *error)
+{
+#if defined(MONGOC_TRACE) && !defined(MONGOC_TRACE_LOG)
+   char buf [128];
+   FILE *file;
+   bool ret;
+
+   bson_return_val_if_fail (path, false);
+
+   if (!(file = fopen (path, "wb"))) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_INVALID_STATE,
+                      "Failed to open \"%s\": %s", path,
+                      bson_strerror_r (errno, buf, sizeof buf));
+      return false;
+   }
+
+   ret = _mongoc_trace_dump (file);
+
+   if (fclose (file) != 0) {
+      ret = false;
+   }
+
+   if (!ret) {
+      bson_set_error (error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_INVALID_STATE,
+                      "Failed to write \"%s\": %s", path,
+                      bson_strerror_r (errno, buf, sizeof buf));
+   }
+
+   return ret;
+#else
+   bson_return_val_if_fail (path, false);
+
+   bson_set_error (error,
+                   MONGOC_ERROR_STREAM,
+                   MONGOC_ERROR_STREAM_INVALID_STATE,
+                   "libmongoc was built without the ring buffer tracer, "
+                   "configure with --enable-tracing.");
+
+   return false;
+#endif
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_trace_cleanup --
+ *
+ *       Called from mongoc_cleanup(). Dump the trace records to the file
+ *       named by the MONGOC_TRACE_FILE environment variable, if set.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_trace_cleanup (void)
+{
+#if defined(MONGOC_TRACE) && !defined(MONGOC_TRACE_LOG)
+   bson_error_t error;
+   const char *path;
+
+   if ((path = getenv ("MONGOC_TRACE_FILE")) && *path &&
+       !mongoc_log_trace_dump (path, &error)) {
+      MONGOC_WARNING ("%s", error.message);
+   }
+#endif
+}
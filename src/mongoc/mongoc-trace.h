@@ -28,7 +28,59 @@
 BSON_BEGIN_DECLS
 
 
-#ifdef MONGOC_TRACE
+#if defined(MONGOC_TRACE) && !defined(MONGOC_TRACE_LOG)
+/*
+ * By default MONGOC_TRACE builds write each trace point as a fixed-size
+ * binary record into a ring buffer of the calling thread, see
+ * mongoc-trace.c. A trace point registers its call site the first time it
+ * is reached, so a record only holds the site id, a timestamp and a small
+ * payload. Define MONGOC_TRACE_LOG as well for the formatted log messages.
+ */
+typedef enum
+{
+   MONGOC_TRACE_KIND_ENTRY = 1,
+   MONGOC_TRACE_KIND_EXIT,
+   MONGOC_TRACE_KIND_GOTO,
+   MONGOC_TRACE_KIND_TRACE,
+   MONGOC_TRACE_KIND_DUMP,
+} mongoc_trace_kind_t;
+
+
+uint32_t _mongoc_trace_site   (mongoc_trace_kind_t  kind,
+                               const char          *domain,
+                               const char          *function,
+                               uint32_t             line,
+                               const char          *text);
+void     _mongoc_trace_record (uint32_t             site,
+                               uint32_t             payload);
+
+
+#define _MONGOC_TRACE_POINT(_kind, _text, _payload) \
+   do { \
+      static uint32_t _site; \
+      if (BSON_UNLIKELY (!_site)) { \
+         _site = _mongoc_trace_site ((_kind), MONGOC_LOG_DOMAIN, \
+                                     __FUNCTION__, __LINE__, (_text)); \
+      } \
+      _mongoc_trace_record (_site, (uint32_t)(_payload)); \
+   } while (0)
+#define TRACE(msg, ...) _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_TRACE, msg, 0)
+#define ENTRY       _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_ENTRY, NULL, 0)
+#define EXIT        do { _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_EXIT, NULL, 0); return; } while (0)
+#define RETURN(ret) do { _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_EXIT, NULL, 0); return ret; } while (0)
+#define GOTO(label) do { _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_GOTO, #label, 0); goto label; } while (0)
+#define DUMP_BYTES(_n, _b, _l) \
+   _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_DUMP, #_n, (_l))
+#define DUMP_IOVEC(_n, _iov, _iovcnt) \
+   do { \
+      unsigned _i; \
+      size_t _l = 0; \
+      for (_i = 0; _i < (unsigned)(_iovcnt); _i++) { \
+         _l += (_iov)[_i].iov_len; \
+      } \
+      _MONGOC_TRACE_POINT (MONGOC_TRACE_KIND_DUMP, #_n, _l); \
+   } while (0)
+#elif defined(MONGOC_TRACE)
 #define TRACE(msg, ...) \
                     do { mongoc_log(MONGOC_LOG_LEVEL_TRACE, MONGOC_LOG_DOMAIN, "TRACE: %s():%d " msg, __FUNCTION__, __LINE__, __VA_ARGS__); } while (0)
 #define ENTRY       do { mongoc_log(MONGOC_LOG_LEVEL_TRACE, MONGOC_LOG_DOMAIN, "ENTRY: %s():%d", __FUNCTION__, __LINE__); } while (0)
@@ -34,8 +34,13 @@
 #endif
 
 
+/*
+ * A URI is never modified once parsed, so copies share it and only
+ * count references, see mongoc_uri_copy().
+ */
 struct _mongoc_uri_t
 {
+   volatile int32_t        ref_count;
    char                   *str;
    mongoc_host_list_t     *hosts;
    char                   *username;
@@ -490,14 +495,31 @@ mongoc_uri_parse_option (mongoc_uri_t *uri,
    value = bson_strdup(end_key + 1);
    mongoc_uri_do_unescape(&value);
 
-   if (!strcasecmp(key, "connecttimeoutms") ||
+   if (!strcasecmp(key, "busypollus") ||
+       !strcasecmp(key, "connecttimeoutms") ||
+       !strcasecmp(key, "dnscachettlms") ||
+       !strcasecmp(key, "dnsnegativecachettlms") ||
+       !strcasecmp(key, "heartbeatfrequencyms") ||
+       !strcasecmp(key, "hedgedelayms") ||
+       !strcasecmp(key, "keepalivecount") ||
+       !strcasecmp(key, "keepaliveidlems") ||
+       !strcasecmp(key, "keepaliveintervalms") ||
+       !strcasecmp(key, "localthresholdms") ||
+       !strcasecmp(key, "maxstalenessms") ||
+       !strcasecmp(key, "secondaryacceptablelatencyms") ||
+       !strcasecmp(key, "serverselectiontimeoutms") ||
+       !strcasecmp(key, "socketreceivebuffersize") ||
+       !strcasecmp(key, "socketsendbuffersize") ||
        !strcasecmp(key, "sockettimeoutms") ||
        !strcasecmp(key, "maxpoolsize") ||
+       !strcasecmp(key, "maxconnectionspernode") ||
+       !strcasecmp(key, "maxconcurrentopspernode") ||
        !strcasecmp(key, "minpoolsize") ||
        !strcasecmp(key, "maxidletimems") ||
        !strcasecmp(key, "waitqueuemultiple") ||
        !strcasecmp(key, "waitqueuetimeoutms") ||
-       !strcasecmp(key, "wtimeoutms")) {
+       !strcasecmp(key, "wtimeoutms") ||
+       !strcasecmp(key, "zlibcompressionlevel")) {
       v_int = (int) strtol (value, NULL, 10);
       bson_append_int32(&uri->options, key, -1, v_int);
    } else if (!strcasecmp(key, "w")) {
@@ -510,10 +532,20 @@ mongoc_uri_parse_option (mongoc_uri_t *uri,
          BSON_APPEND_UTF8 (&uri->options, "W", value);
       }
    } else if (!strcasecmp(key, "canonicalizeHostname") ||
+              !strcasecmp(key, "hedgedReads") ||
               !strcasecmp(key, "journal") ||
+              !strcasecmp(key, "keepAlive") ||
+              !strcasecmp(key, "lazyConnect") ||
+              !strcasecmp(key, "preferUnixSocket") ||
+              !strcasecmp(key, "retryReads") ||
+              !strcasecmp(key, "retryWrites") ||
               !strcasecmp(key, "safe") ||
               !strcasecmp(key, "slaveok") ||
-              !strcasecmp(key, "ssl")) {
+              !strcasecmp(key, "ssl") ||
+              !strcasecmp(key, "standbyConnections") ||
+              !strcasecmp(key, "tcpFastOpen") ||
+              !strcasecmp(key, "trackoperationlatency") ||
+              !strcasecmp(key, "zeroCopySend")) {
       bson_append_bool (&uri->options, key, -1,
                         (0 == strcasecmp (value, "true")) ||
                         (0 == strcasecmp (value, "t")) ||
@@ -767,6 +799,9 @@ _mongoc_uri_build_write_concern (mongoc_uri_t *uri) /* IN */
       }
    }
 
+   /* frozen so that every client of this URI shares it instead of a copy */
+   _mongoc_write_concern_freeze (write_concern);
+
    uri->write_concern = write_concern;
 }
 
@@ -777,6 +812,7 @@ mongoc_uri_new (const char *uri_string)
    mongoc_uri_t *uri;
 
    uri = bson_malloc0(sizeof *uri);
+   uri->ref_count = 1;
    bson_init(&uri->options);
    bson_init(&uri->credentials);
    bson_init(&uri->read_prefs);
@@ -873,7 +909,7 @@ mongoc_uri_destroy (mongoc_uri_t *uri)
 {
    mongoc_host_list_t *tmp;
 
-   if (uri) {
+   if (uri && !bson_atomic_int_add (&uri->ref_count, -1)) {
       while (uri->hosts) {
          tmp = uri->hosts;
          uri->hosts = tmp->next;
@@ -897,10 +933,34 @@ mongoc_uri_destroy (mongoc_uri_t *uri)
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_uri_copy --
+ *
+ *       Copy @uri. Since a parsed URI is immutable, the copy is @uri
+ *       itself with one more reference, which is cheap however many
+ *       hosts and options it has. Clients and pools copy their URI.
+ *
+ * Returns:
+ *       A mongoc_uri_t that should be freed with mongoc_uri_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 mongoc_uri_t *
 mongoc_uri_copy (const mongoc_uri_t *uri)
 {
-   return mongoc_uri_new(uri->str);
+   mongoc_uri_t *copy = (mongoc_uri_t *)uri;
+
+   bson_return_val_if_fail(uri, NULL);
+
+   bson_atomic_int_add (&copy->ref_count, 1);
+
+   return copy;
 }
 
 
@@ -15,7 +15,11 @@
  */
 
 
+#include <errno.h>
 #include <string.h>
+#ifndef _WIN32
+# include <time.h>
+#endif
 
 #include "mongoc-util-private.h"
 
@@ -39,3 +43,20 @@ _mongoc_hex_md5 (const char *input)
 
    return bson_strdup(digest_str);
 }
+
+
+void
+_mongoc_usleep (int64_t usec)
+{
+#ifdef _WIN32
+   Sleep ((DWORD)((usec + 999) / 1000));
+#else
+   struct timespec ts;
+
+   ts.tv_sec = (time_t)(usec / 1000000);
+   ts.tv_nsec = (long)((usec % 1000000) * 1000);
+
+   while ((-1 == nanosleep (&ts, &ts)) && (errno == EINTR)) {
+   }
+#endif
+}
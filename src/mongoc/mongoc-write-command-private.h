@@ -23,7 +23,9 @@
 
 #include <bson.h>
 
+#include "mongoc-array-private.h"
 #include "mongoc-client.h"
+#include "mongoc-oid-gen-private.h"
 #include "mongoc-write-concern.h"
 
 
@@ -35,12 +37,40 @@ BSON_BEGIN_DECLS
 #define MONGOC_WRITE_COMMAND_UPDATE 2
 
 
+/*
+ * The length header and generated "_id" element that are sent in front of
+ * a borrowed insert document which has no "_id" of its own.
+ */
+#define MONGOC_WRITE_COMMAND_ID_PREFIX_LEN 21
+
+
+typedef struct
+{
+   const uint8_t *data;
+   uint32_t       len;
+   bool           needs_id;
+   uint8_t        id_prefix [MONGOC_WRITE_COMMAND_ID_PREFIX_LEN];
+} mongoc_write_command_borrowed_t;
+
+
 typedef struct
 {
    int      type;
    uint32_t hint;
    bson_t  *documents;
    uint32_t n_documents;
+   /* the exact length of the command's array of documents if they are all
+    * sent in one batch, see _mongoc_write_command_element_len() */
+   uint32_t batch_len;
+   /* insert documents referenced in place instead of copied to @documents,
+    * see _mongoc_write_command_init_insert_borrowed() */
+   mongoc_write_command_borrowed_t *borrowed;
+   /* generates the _id of appended insert documents, NULL for the
+    * default bson_context_t */
+   mongoc_oid_gen_t *oid_gen;
+   /* insert documents that came with an "_id" of their own, an insert
+    * is only retried if all of its ids were generated by the driver */
+   uint32_t n_user_ids;
    union {
       struct {
          uint8_t   ordered : 1;
@@ -57,6 +87,25 @@ typedef struct
 } mongoc_write_command_t;
 
 
+/* an element of "upserted", like {"index": int, "_id": value} */
+typedef struct
+{
+   uint32_t     index;
+   bson_value_t _id;
+} mongoc_write_upsert_t;
+
+
+/* an element of "writeErrors", like {"index": int, "code": int,
+ * "errmsg": str}; any other fields the server sent are kept in info */
+typedef struct
+{
+   uint32_t     index;
+   int32_t      code;
+   char        *errmsg;
+   bson_t      *info;
+} mongoc_write_error_t;
+
+
 typedef struct
 {
    /* true after a legacy update prevents us from calculating nModified */
@@ -66,23 +115,42 @@ typedef struct
    uint32_t     nModified;
    uint32_t     nRemoved;
    uint32_t     nUpserted;
-   /* like [{"index": int, "_id": value}, ...] */
-   bson_t       writeErrors;
-   /* like [{"index": int, "code": int, "errmsg": str}, ...] */
-   bson_t       upserted;
+   /* of mongoc_write_error_t, turned into BSON by
+    * _mongoc_write_result_complete() */
+   mongoc_array_t writeErrors;
+   /* of mongoc_write_upsert_t, likewise */
+   mongoc_array_t upserted;
    bson_t       writeConcernError;
    bool         failed;
    bson_error_t error;
-   uint32_t     upsert_append_count;
 } mongoc_write_result_t;
 
 
+uint32_t _mongoc_write_command_element_len
+                                       (int                            type,
+                                        uint32_t                       index,
+                                        uint32_t                       len);
 void _mongoc_write_command_destroy     (mongoc_write_command_t        *command);
 void _mongoc_write_command_init_insert (mongoc_write_command_t        *command,
                                         const bson_t * const          *documents,
                                         uint32_t                       n_documents,
                                         bool                           ordered,
                                         bool                           allow_bulk_op_insert);
+void _mongoc_write_command_init_insert_borrowed
+                                       (mongoc_write_command_t        *command,
+                                        const bson_t * const          *documents,
+                                        uint32_t                       n_documents,
+                                        bool                           ordered,
+                                        bool                           allow_bulk_op_insert,
+                                        mongoc_oid_gen_t              *oid_gen);
+bool _mongoc_write_command_init_insert_raw
+                                       (mongoc_write_command_t        *command,
+                                        const uint8_t                 *buf,
+                                        size_t                         buflen,
+                                        bool                           ordered,
+                                        bool                           allow_bulk_op_insert,
+                                        mongoc_oid_gen_t              *oid_gen,
+                                        bson_error_t                  *error);
 void _mongoc_write_command_init_delete (mongoc_write_command_t        *command,
                                         const bson_t                  *selectors,
                                         bool                           multi,
@@ -93,6 +161,11 @@ void _mongoc_write_command_init_update (mongoc_write_command_t        *command,
                                         bool                           upsert,
                                         bool                           multi,
                                         bool                           ordered);
+void _mongoc_write_command_init_upsert (mongoc_write_command_t        *command,
+                                        const char                    *key_path,
+                                        const bson_iter_t             *value,
+                                        const bson_t                  *document,
+                                        bool                           ordered);
 void _mongoc_write_command_insert_append (mongoc_write_command_t      *command,
                                           const bson_t * const        *documents,
                                           uint32_t                     n_documents);
@@ -103,6 +176,11 @@ void _mongoc_write_command_update_append (mongoc_write_command_t      *command,
                                           bool                         upsert,
                                           bool                         multi);
 
+void _mongoc_write_command_upsert_append (mongoc_write_command_t      *command,
+                                          const char                  *key_path,
+                                          const bson_iter_t           *value,
+                                          const bson_t                *document);
+
 void _mongoc_write_command_delete_append (mongoc_write_command_t *command,
                                           const bson_t           *selector);
 
@@ -113,6 +191,28 @@ void _mongoc_write_command_execute     (mongoc_write_command_t        *command,
                                         const char                    *collection,
                                         const mongoc_write_concern_t  *write_concern,
                                         uint32_t                       offset,                                        mongoc_write_result_t         *result);
+void _mongoc_write_command_execute_concurrent
+                                       (mongoc_write_command_t        *command,
+                                        mongoc_client_t               *client,
+                                        uint32_t                       hint,
+                                        const char                    *database,
+                                        const char                    *collection,
+                                        const mongoc_write_concern_t  *write_concern,
+                                        uint32_t                       offset,
+                                        mongoc_write_result_t         *result);
+bool _mongoc_write_command_send        (mongoc_write_command_t        *command,
+                                        mongoc_client_t               *client,
+                                        uint32_t                       hint,
+                                        const char                    *database,
+                                        const char                    *collection,
+                                        const mongoc_write_concern_t  *write_concern,
+                                        uint32_t                      *request_id,
+                                        mongoc_write_result_t         *result);
+void _mongoc_write_command_recv        (mongoc_write_command_t        *command,
+                                        mongoc_client_t               *client,
+                                        uint32_t                       request_id,
+                                        uint32_t                       offset,
+                                        mongoc_write_result_t         *result);
 void _mongoc_write_result_init         (mongoc_write_result_t         *result);
 void _mongoc_write_result_merge        (mongoc_write_result_t         *result,
                                         mongoc_write_command_t        *command,
@@ -16,6 +16,7 @@
 
 
 #include "mongoc-client-private.h"
+#include "mongoc-counters-private.h"
 #include "mongoc-error.h"
 #include "mongoc-trace.h"
 #include "mongoc-write-command-private.h"
@@ -29,6 +30,8 @@
  */
 
 #define MAX_INSERT_BATCH 1000
+#define MAX_IN_FLIGHT 4
+#define MAX_LEGACY_IN_FLIGHT 64
 #define SUPPORTS_WRITE_COMMANDS(n) \
    (((n)->min_wire_version <= 2) && ((n)->max_wire_version >= 2))
 #define WRITE_CONCERN_DOC(wc) \
@@ -50,11 +53,72 @@ typedef void (*mongoc_write_op_t) (mongoc_write_command_t       *command,
 
 static bson_t gEmptyWriteConcern = BSON_INITIALIZER;
 
-static int32_t
-_mongoc_write_result_merge_arrays (uint32_t               offset,
-                                   mongoc_write_result_t *result,
-                                   bson_t                *dest,
+static void
+_mongoc_write_result_merge_errors (mongoc_write_result_t *result,
+                                   uint32_t               offset,
                                    bson_iter_t           *iter);
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_element_len --
+ *
+ *       The number of bytes that a document @len bytes long takes in the
+ *       array of a write command of @type when it is element @index: its
+ *       type byte, the decimal digits of @index and their NUL, and the
+ *       document itself, wrapped as {"q": doc, "limit": int32} for a
+ *       delete.
+ *
+ * Returns:
+ *       The length of the element.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+uint32_t
+_mongoc_write_command_element_len (int      type,  /* IN */
+                                   uint32_t index, /* IN */
+                                   uint32_t len)   /* IN */
+{
+   uint32_t key_len = 1;
+
+   while (index >= 10) {
+      index /= 10;
+      key_len++;
+   }
+
+   if (type == MONGOC_WRITE_COMMAND_DELETE) {
+      /* length, "q" element header, "limit" element and trailing NUL */
+      len += 4 + 3 + 11 + 1;
+   }
+
+   return 1 + key_len + 1 + len;
+}
+
+
+/*
+ * Returns the number of bytes held by the documents of @command, as
+ * counted by the "Write Command Bytes" counter.
+ */
+static int64_t
+_mongoc_write_command_bytes_held (const mongoc_write_command_t *command)
+{
+   int64_t held = 0;
+
+   if (command->documents) {
+      held += command->documents->len;
+   }
+
+   if (command->borrowed) {
+      held += command->n_documents * sizeof *command->borrowed;
+   }
+
+   return held;
+}
+
+
 void
 _mongoc_write_command_insert_append (mongoc_write_command_t *command,
                                      const bson_t * const   *documents,
@@ -66,6 +130,7 @@ _mongoc_write_command_insert_append (mongoc_write_command_t *command,
    uint32_t i;
    bson_t tmp;
    char keydata [16];
+   int64_t held;
 
    ENTRY;
 
@@ -73,12 +138,15 @@ _mongoc_write_command_insert_append (mongoc_write_command_t *command,
    BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
    BSON_ASSERT (!n_documents || documents);
 
+   held = _mongoc_write_command_bytes_held (command);
+
    for (i = 0; i < n_documents; i++) {
       BSON_ASSERT (documents [i]);
       BSON_ASSERT (documents [i]->len >= 5);
 
       key = NULL;
-      bson_uint32_to_string (i, &key, keydata, sizeof keydata);
+      bson_uint32_to_string (command->n_documents + i, &key, keydata,
+                             sizeof keydata);
       BSON_ASSERT (key);
 
       /*
@@ -87,18 +155,26 @@ _mongoc_write_command_insert_append (mongoc_write_command_t *command,
        */
       if (!bson_iter_init_find (&iter, documents [i], "_id")) {
          bson_init (&tmp);
-         bson_oid_init (&oid, NULL);
+         _mongoc_oid_gen_next (command->oid_gen, &oid);
          BSON_APPEND_OID (&tmp, "_id", &oid);
          bson_concat (&tmp, documents [i]);
          BSON_APPEND_DOCUMENT (command->documents, key, &tmp);
+         command->batch_len += _mongoc_write_command_element_len (
+            command->type, command->n_documents + i, tmp.len);
          bson_destroy (&tmp);
       } else {
          BSON_APPEND_DOCUMENT (command->documents, key, documents [i]);
+         command->batch_len += _mongoc_write_command_element_len (
+            command->type, command->n_documents + i, documents [i]->len);
+         command->n_user_ids++;
       }
    }
 
    command->n_documents += n_documents;
 
+   mongoc_counter_memory_write_commands_add (
+      _mongoc_write_command_bytes_held (command) - held);
+
    EXIT;
 }
 
@@ -112,6 +188,7 @@ _mongoc_write_command_update_append (mongoc_write_command_t *command,
    const char *key;
    char keydata [16];
    bson_t doc;
+   int64_t held;
 
    ENTRY;
 
@@ -119,6 +196,8 @@ _mongoc_write_command_update_append (mongoc_write_command_t *command,
    BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_UPDATE);
    BSON_ASSERT (selector && update);
 
+   held = _mongoc_write_command_bytes_held (command);
+
    bson_init (&doc);
    BSON_APPEND_DOCUMENT (&doc, "q", selector);
    BSON_APPEND_DOCUMENT (&doc, "u", update);
@@ -129,31 +208,109 @@ _mongoc_write_command_update_append (mongoc_write_command_t *command,
    bson_uint32_to_string (command->n_documents, &key, keydata, sizeof keydata);
    BSON_ASSERT (key);
    BSON_APPEND_DOCUMENT (command->documents, key, &doc);
+   command->batch_len += _mongoc_write_command_element_len (
+      command->type, command->n_documents, doc.len);
    command->n_documents++;
 
+   mongoc_counter_memory_write_commands_add (
+      _mongoc_write_command_bytes_held (command) - held);
+
    bson_destroy (&doc);
 
    EXIT;
 }
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_upsert_append --
+ *
+ *       Append the update statement
+ *       {q: {@key_path: @value}, u: @document, upsert: true, multi: false}
+ *       to @command. The statement is written straight into the documents
+ *       of @command, without building the selector or the statement in a
+ *       bson_t of its own first.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_upsert_append (mongoc_write_command_t *command,
+                                     const char             *key_path,
+                                     const bson_iter_t      *value,
+                                     const bson_t           *document)
+{
+   const char *key;
+   char keydata [16];
+   bson_t statement;
+   bson_t selector;
+   int64_t held;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_UPDATE);
+   BSON_ASSERT (key_path);
+   BSON_ASSERT (value);
+   BSON_ASSERT (document);
+
+   held = _mongoc_write_command_bytes_held (command);
+
+   key = NULL;
+   bson_uint32_to_string (command->n_documents, &key, keydata, sizeof keydata);
+   BSON_ASSERT (key);
+
+   bson_append_document_begin (command->documents, key, -1, &statement);
+   bson_append_document_begin (&statement, "q", 1, &selector);
+   bson_append_iter (&selector, key_path, -1, value);
+   bson_append_document_end (&statement, &selector);
+   bson_append_document (&statement, "u", 1, document);
+   bson_append_bool (&statement, "upsert", 6, true);
+   bson_append_bool (&statement, "multi", 5, false);
+   bson_append_document_end (command->documents, &statement);
+
+   command->batch_len += _mongoc_write_command_element_len (
+      command->type, command->n_documents, statement.len);
+   command->n_documents++;
+
+   mongoc_counter_memory_write_commands_add (
+      _mongoc_write_command_bytes_held (command) - held);
+
+   EXIT;
+}
+
 void
 _mongoc_write_command_delete_append (mongoc_write_command_t *command,
                                      const bson_t           *selector)
 {
    const char *key;
    char keydata [16];
+   int64_t held;
 
    BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_DELETE);
    BSON_ASSERT (selector);
 
    BSON_ASSERT (selector->len >= 5);
 
+   held = _mongoc_write_command_bytes_held (command);
+
    key = NULL;
    bson_uint32_to_string (command->n_documents, &key, keydata, sizeof keydata);
    BSON_ASSERT (key);
    BSON_APPEND_DOCUMENT (command->documents, key, selector);
+   command->batch_len += _mongoc_write_command_element_len (
+      command->type, command->n_documents, selector->len);
    command->n_documents++;
 
+   mongoc_counter_memory_write_commands_add (
+      _mongoc_write_command_bytes_held (command) - held);
+
    EXIT;
 }
 
@@ -172,9 +329,15 @@ _mongoc_write_command_init_insert (mongoc_write_command_t *command,
    command->type = MONGOC_WRITE_COMMAND_INSERT;
    command->documents = bson_new ();
    command->n_documents = 0;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = NULL;
+   command->n_user_ids = 0;
    command->u.insert.ordered = (uint8_t)ordered;
    command->u.insert.allow_bulk_op_insert = (uint8_t)allow_bulk_op_insert;
 
+   mongoc_counter_memory_write_commands_add (command->documents->len);
+
    if (n_documents) {
       _mongoc_write_command_insert_append (command, documents, n_documents);
    }
@@ -183,6 +346,246 @@ _mongoc_write_command_init_insert (mongoc_write_command_t *command,
 }
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_borrow --
+ *
+ *       Refer to the document at @data, @len bytes long, from @borrowed,
+ *       and make the "_id" prefix it is sent with if it lacks an "_id".
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       An ObjectId may be taken from @oid_gen.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_write_command_borrow (mongoc_write_command_borrowed_t *borrowed, /* OUT */
+                              const uint8_t                   *data,     /* IN */
+                              uint32_t                         len,      /* IN */
+                              mongoc_oid_gen_t                *oid_gen)  /* IN */
+{
+   bson_iter_t iter;
+   bson_oid_t oid;
+   bson_t b;
+   uint32_t le;
+
+   BSON_ASSERT (len >= 5);
+
+   borrowed->data = data;
+   borrowed->len = len;
+   borrowed->needs_id = !(bson_init_static (&b, data, len) &&
+                          bson_iter_init_find (&iter, &b, "_id"));
+
+   if (borrowed->needs_id) {
+      /*
+       * The new document is the prefix followed by the elements of the
+       * original, that is, everything after its own length header.
+       */
+      le = BSON_UINT32_TO_LE (len + MONGOC_WRITE_COMMAND_ID_PREFIX_LEN - 4);
+      _mongoc_oid_gen_next (oid_gen, &oid);
+
+      memcpy (&borrowed->id_prefix [0], &le, 4);
+      borrowed->id_prefix [4] = BSON_TYPE_OID;
+      memcpy (&borrowed->id_prefix [5], "_id", 4);
+      memcpy (&borrowed->id_prefix [9], oid.bytes, 12);
+   }
+}
+
+
+/* count borrowed document @i, with its "_id" prefix, in batch_len */
+static void
+_mongoc_write_command_add_borrowed_len (mongoc_write_command_t *command,
+                                        uint32_t                i)
+{
+   const mongoc_write_command_borrowed_t *borrowed = &command->borrowed [i];
+   uint32_t len = borrowed->len;
+
+   if (borrowed->needs_id) {
+      len += MONGOC_WRITE_COMMAND_ID_PREFIX_LEN - 4;
+   }
+
+   command->batch_len += _mongoc_write_command_element_len (command->type,
+                                                            i, len);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_init_insert_borrowed --
+ *
+ *       Like _mongoc_write_command_init_insert(), but @documents are not
+ *       copied: the command refers to the caller's buffers and they are
+ *       written straight to the socket. Only a length header and "_id"
+ *       are kept for each document that lacks an "_id". Those are made
+ *       with @oid_gen, or the default bson_context_t if it is NULL.
+ *
+ *       The caller must keep @documents alive and unmodified until the
+ *       command is destroyed, and no more documents may be appended.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_init_insert_borrowed (mongoc_write_command_t *command,              /* IN */
+                                            const bson_t *const    *documents,            /* IN */
+                                            uint32_t                n_documents,          /* IN */
+                                            bool                    ordered,              /* IN */
+                                            bool                    allow_bulk_op_insert, /* IN */
+                                            mongoc_oid_gen_t       *oid_gen)              /* IN */
+{
+   uint32_t i;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (!n_documents || documents);
+
+   command->type = MONGOC_WRITE_COMMAND_INSERT;
+   command->documents = NULL;
+   command->n_documents = n_documents;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = oid_gen;
+   command->n_user_ids = 0;
+   command->u.insert.ordered = (uint8_t)ordered;
+   command->u.insert.allow_bulk_op_insert = (uint8_t)allow_bulk_op_insert;
+
+   if (n_documents) {
+      command->borrowed = bson_malloc (n_documents * sizeof *command->borrowed);
+      mongoc_counter_memory_write_commands_add (
+         _mongoc_write_command_bytes_held (command));
+   }
+
+   for (i = 0; i < n_documents; i++) {
+      BSON_ASSERT (documents [i]);
+
+      _mongoc_write_command_borrow (&command->borrowed [i],
+                                    bson_get_data (documents [i]),
+                                    documents [i]->len,
+                                    oid_gen);
+
+      _mongoc_write_command_add_borrowed_len (command, i);
+
+      if (!command->borrowed [i].needs_id) {
+         command->n_user_ids++;
+      }
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_init_insert_raw --
+ *
+ *       Like _mongoc_write_command_init_insert_borrowed(), but the
+ *       documents are given as @buflen bytes of concatenated BSON at @buf,
+ *       such as the contents of a bsondump file. The buffer is split on
+ *       the length header of each document; the documents themselves are
+ *       not validated here.
+ *
+ *       The caller must keep @buf alive and unmodified until the command
+ *       is destroyed.
+ *
+ * Returns:
+ *       true if successful. false if @buf does not hold a whole number of
+ *       documents, in which case @error is set and the command must not
+ *       be used nor destroyed.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_write_command_init_insert_raw (mongoc_write_command_t *command,              /* IN */
+                                       const uint8_t          *buf,                  /* IN */
+                                       size_t                  buflen,               /* IN */
+                                       bool                    ordered,              /* IN */
+                                       bool                    allow_bulk_op_insert, /* IN */
+                                       mongoc_oid_gen_t       *oid_gen,              /* IN */
+                                       bson_error_t           *error)                /* OUT */
+{
+   uint32_t n_documents = 0;
+   uint32_t len;
+   size_t pos;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (!buflen || buf);
+
+   for (pos = 0; pos < buflen; pos += len) {
+      if ((buflen - pos) < 5) {
+         GOTO (truncated);
+      }
+
+      memcpy (&len, buf + pos, 4);
+      len = BSON_UINT32_FROM_LE (len);
+
+      if (len < 5 || len > (buflen - pos) || buf [pos + len - 1] != '\0') {
+         GOTO (truncated);
+      }
+
+      n_documents++;
+   }
+
+   command->type = MONGOC_WRITE_COMMAND_INSERT;
+   command->documents = NULL;
+   command->n_documents = n_documents;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = oid_gen;
+   command->n_user_ids = 0;
+   command->u.insert.ordered = (uint8_t)ordered;
+   command->u.insert.allow_bulk_op_insert = (uint8_t)allow_bulk_op_insert;
+
+   if (n_documents) {
+      command->borrowed = bson_malloc (n_documents * sizeof *command->borrowed);
+      mongoc_counter_memory_write_commands_add (
+         _mongoc_write_command_bytes_held (command));
+   }
+
+   for (pos = 0, n_documents = 0; pos < buflen; pos += len) {
+      memcpy (&len, buf + pos, 4);
+      len = BSON_UINT32_FROM_LE (len);
+
+      _mongoc_write_command_borrow (&command->borrowed [n_documents],
+                                    buf + pos, len, oid_gen);
+      _mongoc_write_command_add_borrowed_len (command, n_documents);
+
+      if (!command->borrowed [n_documents++].needs_id) {
+         command->n_user_ids++;
+      }
+   }
+
+   RETURN (true);
+
+truncated:
+   bson_set_error (error,
+                   MONGOC_ERROR_BSON,
+                   MONGOC_ERROR_BSON_INVALID,
+                   "Document %u of the buffer is truncated or corrupt.",
+                   n_documents);
+   RETURN (false);
+}
+
+
 void
 _mongoc_write_command_init_delete (mongoc_write_command_t *command,  /* IN */
                                    const bson_t           *selector, /* IN */
@@ -197,15 +600,49 @@ _mongoc_write_command_init_delete (mongoc_write_command_t *command,  /* IN */
    command->type = MONGOC_WRITE_COMMAND_DELETE;
    command->documents = bson_new ();
    command->n_documents = 0;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = NULL;
+   command->n_user_ids = 0;
    command->u.delete.multi = (uint8_t)multi;
    command->u.delete.ordered = (uint8_t)ordered;
 
+   mongoc_counter_memory_write_commands_add (command->documents->len);
+
    _mongoc_write_command_delete_append (command, selector);
 
    EXIT;
 }
 
 
+void
+_mongoc_write_command_init_upsert (mongoc_write_command_t *command,  /* IN */
+                                   const char             *key_path, /* IN */
+                                   const bson_iter_t      *value,    /* IN */
+                                   const bson_t           *document, /* IN */
+                                   bool                    ordered)  /* IN */
+{
+   ENTRY;
+
+   BSON_ASSERT (command);
+
+   command->type = MONGOC_WRITE_COMMAND_UPDATE;
+   command->documents = bson_new ();
+   command->n_documents = 0;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = NULL;
+   command->n_user_ids = 0;
+   command->u.update.ordered = (uint8_t) ordered;
+
+   mongoc_counter_memory_write_commands_add (command->documents->len);
+
+   _mongoc_write_command_upsert_append (command, key_path, value, document);
+
+   EXIT;
+}
+
+
 void
 _mongoc_write_command_init_update (mongoc_write_command_t *command,  /* IN */
                                    const bson_t           *selector, /* IN */
@@ -223,69 +660,251 @@ _mongoc_write_command_init_update (mongoc_write_command_t *command,  /* IN */
    command->type = MONGOC_WRITE_COMMAND_UPDATE;
    command->documents = bson_new ();
    command->n_documents = 0;
+   command->batch_len = 5;
+   command->borrowed = NULL;
+   command->oid_gen = NULL;
+   command->n_user_ids = 0;
    command->u.update.ordered = (uint8_t) ordered;
 
+   mongoc_counter_memory_write_commands_add (command->documents->len);
+
    _mongoc_write_command_update_append (command, selector, update, upsert, multi);
 
    EXIT;
 }
 
 
-static void
-_mongoc_write_command_delete_legacy (mongoc_write_command_t       *command,
-                                     mongoc_client_t              *client,
-                                     uint32_t                      hint,
-                                     const char                   *database,
-                                     const char                   *collection,
-                                     const mongoc_write_concern_t *write_concern,
-                                     uint32_t                      offset,
-                                     mongoc_write_result_t        *result,
-                                     bson_error_t                 *error)
+/*
+ * A legacy write op whose getLastError reply has not been read yet. An
+ * unordered command sends up to MAX_LEGACY_IN_FLIGHT ops, each followed
+ * by its getLastError, before it reads the replies, which come back in
+ * the same order. The limit keeps the unread replies small enough that
+ * the server never blocks writing them while we are still sending.
+ */
+typedef struct
 {
+   uint32_t       offset;
+   /* the number of documents in an insert batch */
+   uint32_t       n_documents;
+   /* the update statement the op was built from */
    const uint8_t *data;
-   mongoc_rpc_t rpc;
-   bson_iter_t iter;
-   uint32_t len;
-   bson_t *gle = NULL;
-   char ns [MONGOC_NAMESPACE_MAX + 1];
-   bool r;
-
-   ENTRY;
+   uint32_t       len;
+} mongoc_write_command_gle_t;
 
-   BSON_ASSERT (command);
-   BSON_ASSERT (client);
-   BSON_ASSERT (database);
-   BSON_ASSERT (hint);
-   BSON_ASSERT (collection);
 
-   r = bson_iter_init (&iter, command->documents);
+static void
+_mongoc_write_command_fix_upsert (const uint8_t *data,
+                                  uint32_t       len,
+                                  bson_t        *gle)
+{
+   bson_iter_t iter;
+   bson_iter_t subiter;
+   bson_t spec;
+   bson_t doc;
+   const uint8_t *doc_data;
+   uint32_t doc_len;
+   int32_t affected = 0;
 
-   if (!r) {
-      BSON_ASSERT (false);
-      EXIT;
+   if (bson_iter_init_find (&iter, gle, "n") &&
+       BSON_ITER_HOLDS_INT32 (&iter)) {
+      affected = bson_iter_int32 (&iter);
    }
 
-   if (!command->n_documents || !bson_iter_next (&iter)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_COLLECTION,
-                      MONGOC_ERROR_COLLECTION_DELETE_FAILED,
-                      "Cannot do an empty delete.");
-      result->failed = true;
-      EXIT;
+   /*
+    * CDRIVER-372:
+    *
+    * Versions of MongoDB before 2.6 don't return the _id for an
+    * upsert if _id is not an ObjectId.
+    */
+   if (!affected ||
+       bson_iter_init_find (&iter, gle, "upserted") ||
+       !bson_iter_init_find (&iter, gle, "updatedExisting") ||
+       !BSON_ITER_HOLDS_BOOL (&iter) ||
+       bson_iter_bool (&iter) ||
+       !bson_init_static (&spec, data, len) ||
+       !bson_iter_init_find (&iter, &spec, "upsert")) {
+      return;
    }
 
-   bson_snprintf (ns, sizeof ns, "%s.%s", database, collection);
-
-   do {
-      BSON_ASSERT (BSON_ITER_HOLDS_DOCUMENT (&iter));
+   if (bson_iter_init_find (&iter, &spec, "u") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &doc_len, &doc_data);
+      bson_init_static (&doc, doc_data, doc_len);
+      if (bson_iter_init_find (&subiter, &doc, "_id")) {
+         bson_append_iter (gle, "upserted", 8, &subiter);
+         return;
+      }
+   }
 
-      bson_iter_document (&iter, &len, &data);
+   if (bson_iter_init_find (&iter, &spec, "q") &&
+       BSON_ITER_HOLDS_DOCUMENT (&iter)) {
+      bson_iter_document (&iter, &doc_len, &doc_data);
+      bson_init_static (&doc, doc_data, doc_len);
+      if (bson_iter_init_find (&subiter, &doc, "_id")) {
+         bson_append_iter (gle, "upserted", 8, &subiter);
+      }
+   }
+}
 
-      BSON_ASSERT (data);
-      BSON_ASSERT (len >= 5);
 
-      rpc.delete.msg_len = 0;
-      rpc.delete.request_id = 0;
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_recv_gles --
+ *
+ *       Read the getLastError replies to the @n_pending legacy ops in
+ *       @pending, in the order they were sent, and merge them into
+ *       @result.
+ *
+ * Returns:
+ *       true if every reply was read; otherwise false and @error is set.
+ *       The replies after a failed read are lost with the connection.
+ *
+ * Side effects:
+ *       @result is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_write_command_recv_gles (mongoc_write_command_t     *command,
+                                 mongoc_client_t            *client,
+                                 uint32_t                    hint,
+                                 mongoc_write_command_gle_t *pending,
+                                 uint32_t                    n_pending,
+                                 mongoc_write_result_t      *result,
+                                 bson_error_t               *error)
+{
+   bson_iter_t iter;
+   bson_t *gle;
+   uint32_t i;
+
+   for (i = 0; i < n_pending; i++) {
+      if (!_mongoc_client_recv_gle (client, hint, &gle, error)) {
+         result->failed = true;
+         bson_destroy (gle);
+         return false;
+      }
+
+      if (command->type == MONGOC_WRITE_COMMAND_INSERT) {
+         /*
+          * Overwrite the "n" field since it will be zero. Otherwise, our
+          * merge_legacy code will not know how many we tried in this batch.
+          */
+         if (bson_iter_init_find (&iter, gle, "n") &&
+             BSON_ITER_HOLDS_INT32 (&iter) &&
+             !bson_iter_int32 (&iter)) {
+            bson_iter_overwrite_int32 (&iter, pending [i].n_documents);
+         }
+      } else if (command->type == MONGOC_WRITE_COMMAND_UPDATE) {
+         _mongoc_write_command_fix_upsert (pending [i].data, pending [i].len,
+                                           gle);
+      }
+
+      _mongoc_write_result_merge_legacy (result, command, gle,
+                                         pending [i].offset);
+      bson_destroy (gle);
+   }
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_send_legacy --
+ *
+ *       Send the legacy write op @rpc to the node @hint, behind the
+ *       @n_pending ops whose getLastError replies are still unread.
+ *
+ *       While replies are pending the op is pipelined with
+ *       _mongoc_client_try_sendv(), so that no ping or primary probe is
+ *       written to the stream and reads one of those replies as its own.
+ *
+ * Returns:
+ *       0 upon failure and @error is set. Otherwise the node used.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_write_command_send_legacy (mongoc_client_t              *client,
+                                   mongoc_rpc_t                 *rpc,
+                                   uint32_t                      hint,
+                                   const mongoc_write_concern_t *write_concern,
+                                   uint32_t                      n_pending,
+                                   bson_error_t                 *error)
+{
+   if (n_pending) {
+      return _mongoc_client_try_sendv (client, rpc, 1, hint, write_concern,
+                                       NULL, error);
+   }
+
+   return _mongoc_client_sendv (client, rpc, 1, hint, write_concern, NULL,
+                                error);
+}
+
+
+static void
+_mongoc_write_command_delete_legacy (mongoc_write_command_t       *command,
+                                     mongoc_client_t              *client,
+                                     uint32_t                      hint,
+                                     const char                   *database,
+                                     const char                   *collection,
+                                     const mongoc_write_concern_t *write_concern,
+                                     uint32_t                      offset,
+                                     mongoc_write_result_t        *result,
+                                     bson_error_t                 *error)
+{
+   mongoc_write_command_gle_t pending [MAX_LEGACY_IN_FLIGHT];
+   uint32_t n_pending = 0;
+   uint32_t max_pending;
+   const uint8_t *data;
+   mongoc_rpc_t rpc;
+   bson_iter_t iter;
+   uint32_t len;
+   char ns [MONGOC_NAMESPACE_MAX + 1];
+   bool r;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (hint);
+   BSON_ASSERT (collection);
+
+   r = bson_iter_init (&iter, command->documents);
+
+   if (!r) {
+      BSON_ASSERT (false);
+      EXIT;
+   }
+
+   if (!command->n_documents || !bson_iter_next (&iter)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COLLECTION,
+                      MONGOC_ERROR_COLLECTION_DELETE_FAILED,
+                      "Cannot do an empty delete.");
+      result->failed = true;
+      EXIT;
+   }
+
+   bson_snprintf (ns, sizeof ns, "%s.%s", database, collection);
+
+   max_pending = command->u.delete.ordered ? 1 : MAX_LEGACY_IN_FLIGHT;
+
+   do {
+      BSON_ASSERT (BSON_ITER_HOLDS_DOCUMENT (&iter));
+
+      bson_iter_document (&iter, &len, &data);
+
+      BSON_ASSERT (data);
+      BSON_ASSERT (len >= 5);
+
+      rpc.delete.msg_len = 0;
+      rpc.delete.request_id = 0;
       rpc.delete.response_to = 0;
       rpc.delete.opcode = MONGOC_OPCODE_DELETE;
       rpc.delete.zero = 0;
@@ -294,8 +913,9 @@ _mongoc_write_command_delete_legacy (mongoc_write_command_t       *command,
                          : MONGOC_DELETE_SINGLE_REMOVE;
       rpc.delete.selector = data;
 
-      hint = _mongoc_client_sendv (client, &rpc, 1, hint, write_concern,
-                                   NULL, error);
+      hint = _mongoc_write_command_send_legacy (client, &rpc, hint,
+                                                write_concern, n_pending,
+                                                error);
 
       if (!hint) {
          result->failed = true;
@@ -303,22 +923,132 @@ _mongoc_write_command_delete_legacy (mongoc_write_command_t       *command,
       }
 
       if (_mongoc_write_concern_needs_gle (write_concern)) {
-         if (!_mongoc_client_recv_gle (client, hint, &gle, error)) {
-            result->failed = true;
-            bson_destroy (gle);
-            EXIT;
+         pending [n_pending].offset = offset++;
+         n_pending++;
+
+         if (n_pending == max_pending) {
+            if (!_mongoc_write_command_recv_gles (command, client, hint,
+                                                  pending, n_pending,
+                                                  result, error)) {
+               EXIT;
+            }
+            n_pending = 0;
          }
-
-         _mongoc_write_result_merge_legacy (result, command, gle, offset);
-         offset++;
-         bson_destroy (gle);
       }
    } while (bson_iter_next (&iter));
 
+   _mongoc_write_command_recv_gles (command, client, hint, pending, n_pending,
+                                    result, error);
+
    EXIT;
 }
 
 
+/*
+ * Walks the documents of an insert command, whether they were copied into
+ * command->documents or borrowed from the caller.
+ */
+typedef struct
+{
+   const mongoc_write_command_t *command;
+   bson_iter_t                   iter;
+   uint32_t                      pos;
+   bool                          done;
+} mongoc_write_command_docs_t;
+
+
+static void
+_mongoc_write_command_docs_init (mongoc_write_command_docs_t  *docs,
+                                 const mongoc_write_command_t *command)
+{
+   docs->command = command;
+   docs->pos = 0;
+
+   if (command->borrowed) {
+      docs->done = !command->n_documents;
+   } else {
+      docs->done = !bson_iter_init (&docs->iter, command->documents) ||
+                   !bson_iter_next (&docs->iter);
+   }
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_docs_peek --
+ *
+ *       Point @iov at the bytes of the current document, without copying
+ *       them. A borrowed document missing an "_id" takes two entries.
+ *
+ * Returns:
+ *       The length of the document on the wire.
+ *
+ * Side effects:
+ *       @n_iov is set to the number of entries of @iov used, 1 or 2.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_write_command_docs_peek (mongoc_write_command_docs_t *docs,
+                                 mongoc_iovec_t              *iov,
+                                 size_t                      *n_iov)
+{
+   const mongoc_write_command_borrowed_t *borrowed;
+   const uint8_t *data;
+   uint32_t len;
+
+   BSON_ASSERT (!docs->done);
+
+   if (!docs->command->borrowed) {
+      BSON_ASSERT (BSON_ITER_HOLDS_DOCUMENT (&docs->iter));
+      bson_iter_document (&docs->iter, &len, &data);
+      BSON_ASSERT (data);
+
+      iov [0].iov_base = (void *)data;
+      iov [0].iov_len = len;
+      *n_iov = 1;
+
+      return len;
+   }
+
+   borrowed = &docs->command->borrowed [docs->pos];
+   data = borrowed->data;
+   len = borrowed->len;
+
+   if (!borrowed->needs_id) {
+      iov [0].iov_base = (void *)data;
+      iov [0].iov_len = len;
+      *n_iov = 1;
+
+      return len;
+   }
+
+   iov [0].iov_base = (void *)borrowed->id_prefix;
+   iov [0].iov_len = MONGOC_WRITE_COMMAND_ID_PREFIX_LEN;
+   iov [1].iov_base = (void *)(data + 4);
+   iov [1].iov_len = len - 4;
+   *n_iov = 2;
+
+   return len + MONGOC_WRITE_COMMAND_ID_PREFIX_LEN - 4;
+}
+
+
+static bool
+_mongoc_write_command_docs_next (mongoc_write_command_docs_t *docs)
+{
+   if (docs->command->borrowed) {
+      docs->pos++;
+      docs->done = (docs->pos >= docs->command->n_documents);
+   } else {
+      docs->done = !bson_iter_next (&docs->iter);
+   }
+
+   return !docs->done;
+}
+
+
 static void
 too_large_error (bson_error_t *error,
                  int32_t       index,
@@ -345,16 +1075,18 @@ _mongoc_write_command_insert_legacy (mongoc_write_command_t       *command,
                                      mongoc_write_result_t        *result,
                                      bson_error_t                 *error)
 {
+   mongoc_write_command_gle_t pending [MAX_LEGACY_IN_FLIGHT];
+   uint32_t n_pending = 0;
+   uint32_t max_pending;
+   mongoc_write_command_docs_t docs;
    mongoc_iovec_t *iov;
-   const uint8_t *data;
    mongoc_rpc_t rpc;
-   bson_iter_t iter;
    uint32_t len;
-   bson_t *gle = NULL;
+   size_t n_iov;
+   size_t n_pieces;
    uint32_t size = 0;
    bool has_more = false;
    char ns [MONGOC_NAMESPACE_MAX + 1];
-   bool r;
    uint32_t i;
    mongoc_cluster_node_t *node;
    int max_insert_batch;
@@ -369,21 +1101,21 @@ _mongoc_write_command_insert_legacy (mongoc_write_command_t       *command,
    BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
 
    node = &client->cluster.nodes [hint - 1];
-   max_insert_batch =
-      node->max_write_batch_size ? node->max_write_batch_size : MAX_INSERT_BATCH;
+   max_insert_batch = _mongoc_cluster_max_write_batch_size (&client->cluster,
+                                                            node);
+   if (!max_insert_batch) {
+      max_insert_batch = MAX_INSERT_BATCH;
+   }
 
    if (command->u.insert.ordered || !command->u.insert.allow_bulk_op_insert) {
       max_insert_batch = 1;
    }
 
-   r = bson_iter_init (&iter, command->documents);
+   max_pending = command->u.insert.ordered ? 1 : MAX_LEGACY_IN_FLIGHT;
 
-   if (!r) {
-      BSON_ASSERT (false);
-      EXIT;
-   }
+   _mongoc_write_command_docs_init (&docs, command);
 
-   if (!command->n_documents || !bson_iter_next (&iter)) {
+   if (!command->n_documents || docs.done) {
       bson_set_error (error,
                       MONGOC_ERROR_COLLECTION,
                       MONGOC_ERROR_COLLECTION_INSERT_FAILED,
@@ -394,11 +1126,13 @@ _mongoc_write_command_insert_legacy (mongoc_write_command_t       *command,
 
    bson_snprintf (ns, sizeof ns, "%s.%s", database, collection);
 
-   iov = bson_malloc ((sizeof *iov) * command->n_documents);
+   /* room for two entries per document, see _mongoc_write_command_docs_peek */
+   iov = bson_malloc ((sizeof *iov) * command->n_documents * 2);
 
 again:
    has_more = false;
    i = 0;
+   n_iov = 0;
    size = (uint32_t)(sizeof (mongoc_rpc_header_t) +
                      4 +
                      strlen (database) +
@@ -407,12 +1141,10 @@ again:
                      1);
 
    do {
-      BSON_ASSERT (BSON_ITER_HOLDS_DOCUMENT (&iter));
       BSON_ASSERT (i < command->n_documents);
 
-      bson_iter_document (&iter, &len, &data);
+      len = _mongoc_write_command_docs_peek (&docs, &iov [n_iov], &n_pieces);
 
-      BSON_ASSERT (data);
       BSON_ASSERT (len >= 5);
 
       /*
@@ -437,12 +1169,10 @@ again:
          break;
       }
 
-      iov [i].iov_base = (void *)data;
-      iov [i].iov_len = len;
-
+      n_iov += n_pieces;
       size += len;
       i++;
-   } while (bson_iter_next (&iter));
+   } while (_mongoc_write_command_docs_next (&docs));
 
    rpc.insert.msg_len = 0;
    rpc.insert.request_id = 0;
@@ -453,44 +1183,28 @@ again:
       : MONGOC_INSERT_CONTINUE_ON_ERROR);
    rpc.insert.collection = ns;
    rpc.insert.documents = iov;
-   rpc.insert.n_documents = i;
+   rpc.insert.n_documents = (int32_t)n_iov;
 
-   hint = _mongoc_client_sendv (client, &rpc, 1, hint, write_concern,
-                                NULL, error);
+   hint = _mongoc_write_command_send_legacy (client, &rpc, hint,
+                                             write_concern, n_pending, error);
 
    if (!hint) {
+      /* the replies to ops still pending were lost with the connection */
       result->failed = true;
-      GOTO (cleanup);
-   }
-
-   if (_mongoc_write_concern_needs_gle (write_concern)) {
-      bson_iter_t citer;
-
-      if (!_mongoc_client_recv_gle (client, hint, &gle, error)) {
-         result->failed = true;
-         GOTO (cleanup);
-      }
+      n_pending = 0;
+   } else if (_mongoc_write_concern_needs_gle (write_concern)) {
+      pending [n_pending].offset = offset;
+      pending [n_pending].n_documents = i;
+      n_pending++;
+      offset += i;
 
-      /*
-       * Overwrite the "n" field since it will be zero. Otherwise, our
-       * merge_legacy code will not know how many we tried in this batch.
-       */
-      if (bson_iter_init_find (&citer, gle, "n") &&
-          BSON_ITER_HOLDS_INT32 (&citer) &&
-          !bson_iter_int32 (&citer)) {
-         bson_iter_overwrite_int32 (&citer, i);
+      if ((n_pending == max_pending) || !has_more) {
+         _mongoc_write_command_recv_gles (command, client, hint, pending,
+                                          n_pending, result, error);
+         n_pending = 0;
       }
    }
 
-cleanup:
-
-   if (gle) {
-      _mongoc_write_result_merge_legacy (result, command, gle, offset);
-      offset += i;
-      bson_destroy (gle);
-      gle = NULL;
-   }
-
    if (has_more) {
       GOTO (again);
    }
@@ -508,12 +1222,14 @@ _mongoc_write_command_will_overflow (uint32_t len_so_far,
                                      int32_t  max_bson_size,
                                      int32_t  max_write_batch_size)
 {
+   int32_t max_cmd_size;
+
    BSON_ASSERT (max_bson_size);
 
-   /* max BSON object size + 16k - 2 bytes for ending NUL bytes.
+   /* max BSON object size + 16k, @len_so_far counts the ending NUL bytes.
     * server guarantees there is enough room: SERVER-10643
     */
-   int32_t max_cmd_size = max_bson_size + 16382;
+   max_cmd_size = max_bson_size + 16384;
 
    if (len_so_far + document_len > max_cmd_size) {
       return true;
@@ -537,18 +1253,17 @@ _mongoc_write_command_update_legacy (mongoc_write_command_t       *command,
                                      mongoc_write_result_t        *result,
                                      bson_error_t                 *error)
 {
+   mongoc_write_command_gle_t pending [MAX_LEGACY_IN_FLIGHT];
+   uint32_t n_pending = 0;
+   uint32_t max_pending;
    mongoc_rpc_t rpc;
    bson_iter_t iter, subiter, subsubiter;
    bson_t doc;
-   bool has_update, has_selector, is_upsert;
-   bson_t update, selector;
-   bson_t *gle = NULL;
    const uint8_t *data = NULL;
    uint32_t len = 0;
    size_t err_offset;
    bool val = false;
    char ns [MONGOC_NAMESPACE_MAX + 1];
-   int32_t affected = 0;
 
    ENTRY;
 
@@ -595,6 +1310,8 @@ _mongoc_write_command_update_legacy (mongoc_write_command_t       *command,
 
    bson_snprintf (ns, sizeof ns, "%s.%s", database, collection);
 
+   max_pending = command->u.update.ordered ? 1 : MAX_LEGACY_IN_FLIGHT;
+
    bson_iter_init (&iter, command->documents);
    while (bson_iter_next (&iter)) {
       rpc.update.msg_len = 0;
@@ -605,22 +1322,14 @@ _mongoc_write_command_update_legacy (mongoc_write_command_t       *command,
       rpc.update.collection = ns;
       rpc.update.flags = 0;
 
-      has_update = false;
-      has_selector = false;
-      is_upsert = false;
-
       bson_iter_recurse (&iter, &subiter);
       while (bson_iter_next (&subiter)) {
          if (strcmp (bson_iter_key (&subiter), "u") == 0) {
             bson_iter_document (&subiter, &len, &data);
             rpc.update.update = data;
-            bson_init_static (&update, data, len);
-            has_update = true;
          } else if (strcmp (bson_iter_key (&subiter), "q") == 0) {
             bson_iter_document (&subiter, &len, &data);
             rpc.update.selector = data;
-            bson_init_static (&selector, data, len);
-            has_selector = true;
          } else if (strcmp (bson_iter_key (&subiter), "multi") == 0) {
             val = bson_iter_bool (&subiter);
             rpc.update.flags = rpc.update.flags |
@@ -629,12 +1338,12 @@ _mongoc_write_command_update_legacy (mongoc_write_command_t       *command,
             val = bson_iter_bool (&subiter);
             rpc.update.flags = rpc.update.flags |
                                (val ? MONGOC_UPDATE_UPSERT : 0);
-            is_upsert = true;
          }
       }
 
-      hint = _mongoc_client_sendv (client, &rpc, 1, hint, write_concern,
-                                   NULL, error);
+      hint = _mongoc_write_command_send_legacy (client, &rpc, hint,
+                                                write_concern, n_pending,
+                                                error);
 
       if (!hint) {
          result->failed = true;
@@ -642,44 +1351,25 @@ _mongoc_write_command_update_legacy (mongoc_write_command_t       *command,
       }
 
       if (_mongoc_write_concern_needs_gle (write_concern)) {
-         if (!_mongoc_client_recv_gle (client, hint, &gle, error)) {
-            result->failed = true;
-            bson_destroy (gle);
-
-            EXIT;
-         }
-
-         if (bson_iter_init_find (&subiter, gle, "n") &&
-             BSON_ITER_HOLDS_INT32 (&subiter)) {
-            affected = bson_iter_int32 (&subiter);
-         }
-
-         /*
-          * CDRIVER-372:
-          *
-          * Versions of MongoDB before 2.6 don't return the _id for an
-          * upsert if _id is not an ObjectId.
-          */
-         if (is_upsert &&
-             affected &&
-             !bson_iter_init_find (&subiter, gle, "upserted") &&
-             bson_iter_init_find (&subiter, gle, "updatedExisting") &&
-             BSON_ITER_HOLDS_BOOL (&subiter) &&
-             !bson_iter_bool (&subiter)) {
-            if (has_update && bson_iter_init_find (&subiter, &update, "_id")) {
-               bson_append_iter (gle, "upserted", 8, &subiter);
-            } else if (has_selector &&
-                       bson_iter_init_find (&subiter, &selector, "_id")) {
-               bson_append_iter (gle, "upserted", 8, &subiter);
+         bson_iter_document (&iter, &pending [n_pending].len,
+                             &pending [n_pending].data);
+         pending [n_pending].offset = offset++;
+         n_pending++;
+
+         if (n_pending == max_pending) {
+            if (!_mongoc_write_command_recv_gles (command, client, hint,
+                                                  pending, n_pending,
+                                                  result, error)) {
+               EXIT;
             }
+            n_pending = 0;
          }
-
-         _mongoc_write_result_merge_legacy (result, command, gle, offset);
-         offset++;
-         bson_destroy (gle);
       }
    }
 
+   _mongoc_write_command_recv_gles (command, client, hint, pending, n_pending,
+                                    result, error);
+
    EXIT;
 }
 
@@ -711,6 +1401,7 @@ _mongoc_write_command_delete (mongoc_write_command_t       *command,
    mongoc_cluster_node_t *node;
    int32_t max_delete_batch;
    uint32_t key_len;
+   uint32_t prefix_len;
 
    ENTRY;
 
@@ -722,7 +1413,8 @@ _mongoc_write_command_delete (mongoc_write_command_t       *command,
    BSON_ASSERT (collection);
 
    node = &client->cluster.nodes [hint - 1];
-   max_delete_batch = node->max_write_batch_size;
+   max_delete_batch = _mongoc_cluster_max_write_batch_size (&client->cluster,
+                                                            node);
 
    /*
     * If we have an unacknowledged write and the server supports the legacy
@@ -757,6 +1449,8 @@ again:
    BSON_APPEND_DOCUMENT (&cmd, "writeConcern",
                          WRITE_CONCERN_DOC (write_concern));
    BSON_APPEND_BOOL (&cmd, "ordered", command->u.delete.ordered);
+   /* the fields so far, the array's type byte and its key */
+   prefix_len = cmd.len + 2 + 7;
    bson_append_array_begin (&cmd, "deletes", 7, &ar);
 
    do {
@@ -767,11 +1461,12 @@ again:
       bson_iter_document (&iter, &len, &data);
       key_len = (uint32_t)bson_uint32_to_string (i, &key, str, sizeof str);
 
-      if (_mongoc_write_command_will_overflow (ar.len,
-                                               key_len + len + 2,
-                                               i,
-                                               client->cluster.max_bson_size,
-                                               max_delete_batch)) {
+      if (_mongoc_write_command_will_overflow (
+             prefix_len + ar.len,
+             _mongoc_write_command_element_len (command->type, i, len),
+             i,
+             client->cluster.max_bson_size,
+             max_delete_batch)) {
          has_more = true;
          break;
       }
@@ -819,44 +1514,356 @@ again:
 }
 
 
-static void
-_mongoc_write_command_insert (mongoc_write_command_t       *command,
-                              mongoc_client_t              *client,
-                              uint32_t                      hint,
-                              const char                   *database,
-                              const char                   *collection,
-                              const mongoc_write_concern_t *write_concern,
-                              uint32_t                      offset,
-                              mongoc_write_result_t        *result,
-                              bson_error_t                 *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_send_query --
+ *
+ *       Send the command in @iov to the "$cmd" collection of @database on
+ *       the node @hint, without waiting for the reply.
+ *
+ *       If @pipelined, replies to other commands are still unread and the
+ *       command is sent with _mongoc_client_try_sendv(), so that no ping
+ *       or primary probe is written behind them to read one as its own.
+ *
+ * Returns:
+ *       The node the command was sent to, or 0 and @error is set.
+ *
+ * Side effects:
+ *       @request_id is set to the id to expect the reply under.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static uint32_t
+_mongoc_write_command_send_query (mongoc_client_t      *client,
+                                  uint32_t              hint,
+                                  const char           *database,
+                                  const mongoc_iovec_t *iov,
+                                  size_t                n_iov,
+                                  bool                  pipelined,
+                                  uint32_t             *request_id,
+                                  bson_error_t         *error)
 {
-   const uint8_t *data;
+   char ns [MONGOC_NAMESPACE_MAX + 1];
+   mongoc_rpc_t rpc;
+
+   bson_snprintf (ns, sizeof ns, "%s.$cmd", database);
+
+   rpc.query.msg_len = 0;
+   rpc.query.request_id = 0;
+   rpc.query.response_to = 0;
+   rpc.query.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_NONE;
+   rpc.query.collection = ns;
+   rpc.query.skip = 0;
+   rpc.query.n_return = -1;
+   rpc.query.query = NULL;
+   rpc.query.query_iov = iov;
+   rpc.query.n_query_iov = (int32_t)n_iov;
+   rpc.query.fields = NULL;
+
+   if (pipelined) {
+      hint = _mongoc_client_try_sendv (client, &rpc, 1, hint, NULL, NULL,
+                                       error);
+   } else {
+      hint = _mongoc_client_sendv (client, &rpc, 1, hint, NULL, NULL, error);
+   }
+
+   *request_id = BSON_UINT32_FROM_LE (rpc.header.request_id);
+
+   return hint;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_recv_reply --
+ *
+ *       Read the reply to the command sent as @request_id to the node
+ *       @hint, with the same semantics as mongoc_client_command_simple().
+ *       Replies to other requests still in flight are held by the cluster
+ *       until they are asked for.
+ *
+ * Returns:
+ *       true if the command succeeded; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_write_command_recv_reply (mongoc_client_t *client,
+                                  uint32_t         hint,
+                                  uint32_t         request_id,
+                                  bson_t          *reply,
+                                  bson_error_t    *error)
+{
+   mongoc_buffer_t buffer;
+   mongoc_rpc_t rpc;
    bson_iter_t iter;
-   const char *key;
-   uint32_t len = 0;
-   bson_t tmp;
-   bson_t ar;
-   bson_t cmd;
-   bson_t reply;
-   char str [16];
-   bool has_more;
+   const char *msg = "Unknown command failure";
+   uint32_t code = MONGOC_ERROR_QUERY_FAILURE;
+   bson_t b;
    bool ret = false;
-   uint32_t i;
-   mongoc_cluster_node_t *node;
-   int32_t max_insert_batch;
-   uint32_t key_len;
 
    ENTRY;
 
-   BSON_ASSERT (command);
-   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
-   BSON_ASSERT (client);
-   BSON_ASSERT (database);
-   BSON_ASSERT (hint);
-   BSON_ASSERT (collection);
+   bson_init (reply);
+
+   _mongoc_client_recv_buffer_take (client, &buffer);
+
+   if (!_mongoc_cluster_try_recv_reply (&client->cluster, &rpc, &buffer, hint,
+                                        request_id, error)) {
+      GOTO (cleanup);
+   }
+
+   if (rpc.header.opcode != MONGOC_OPCODE_REPLY) {
+      bson_set_error (error,
+                      MONGOC_ERROR_PROTOCOL,
+                      MONGOC_ERROR_PROTOCOL_INVALID_REPLY,
+                      "Invalid reply to the command.");
+      GOTO (cleanup);
+   }
+
+   if (!_mongoc_rpc_reply_get_first (&rpc.reply, &b)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_BSON,
+                      MONGOC_ERROR_BSON_INVALID,
+                      "Failed to decode document from the server.");
+      GOTO (cleanup);
+   }
+
+   if (!(rpc.reply.flags & MONGOC_REPLY_QUERY_FAILURE) &&
+       bson_iter_init_find (&iter, &b, "ok") &&
+       bson_iter_as_bool (&iter)) {
+      bson_concat (reply, &b);
+      ret = true;
+   } else {
+      if (bson_iter_init_find (&iter, &b, "code") &&
+          BSON_ITER_HOLDS_INT32 (&iter)) {
+         code = bson_iter_int32 (&iter);
+      }
+
+      if ((bson_iter_init_find (&iter, &b, "errmsg") ||
+           bson_iter_init_find (&iter, &b, "$err")) &&
+          BSON_ITER_HOLDS_UTF8 (&iter)) {
+         msg = bson_iter_utf8 (&iter, NULL);
+      }
+
+      bson_set_error (error, MONGOC_ERROR_QUERY, code, "%s", msg);
+   }
+
+   bson_destroy (&b);
+
+cleanup:
+   _mongoc_client_recv_buffer_release (client, &buffer);
+
+   RETURN (ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_run_iov --
+ *
+ *       Run the command whose bytes are spread across @iov on the node
+ *       @hint. This is mongoc_client_command_simple() for a command that
+ *       was never assembled into a single bson_t.
+ *
+ * Returns:
+ *       true if the command succeeded; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is always initialized and must be freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_write_command_run_iov (mongoc_client_t      *client,
+                               uint32_t              hint,
+                               const char           *database,
+                               const mongoc_iovec_t *iov,
+                               size_t                n_iov,
+                               bson_t               *reply,
+                               bson_error_t         *error)
+{
+   uint32_t request_id;
+
+   if (!(hint = _mongoc_write_command_send_query (client, hint, database,
+                                                  iov, n_iov, false,
+                                                  &request_id, error))) {
+      bson_init (reply);
+      return false;
+   }
+
+   return _mongoc_write_command_recv_reply (client, hint, request_id, reply,
+                                            error);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_forgive_retry --
+ *
+ *       Fix up @reply to an insert that was sent a second time after its
+ *       connection was lost. Every document had an "_id" generated by
+ *       the driver, so a duplicate key error on the "_id" index means the
+ *       first attempt inserted the document. Such errors are removed and
+ *       the documents counted as inserted.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @reply is rewritten if it held such errors.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_write_command_forgive_retry (bson_t *reply)
+{
+   bson_iter_t iter;
+   bson_iter_t ar;
+   bson_iter_t citer;
+   bson_t fixed;
+   bson_t errors;
+   const char *key;
+   const char *errmsg;
+   char str [16];
+   int32_t code;
+   int32_t n = 0;
+   uint32_t n_errors = 0;
+   uint32_t n_forgiven = 0;
+
+   if (!bson_iter_init_find (&iter, reply, "writeErrors") ||
+       !BSON_ITER_HOLDS_ARRAY (&iter)) {
+      return;
+   }
+
+   bson_init (&fixed);
+   bson_init (&errors);
+
+   bson_iter_init (&iter, reply);
+
+   while (bson_iter_next (&iter)) {
+      if (!strcmp (bson_iter_key (&iter), "n")) {
+         if (BSON_ITER_HOLDS_INT32 (&iter)) {
+            n = bson_iter_int32 (&iter);
+         }
+         continue;
+      }
+
+      if (strcmp (bson_iter_key (&iter), "writeErrors")) {
+         bson_append_iter (&fixed, NULL, 0, &iter);
+         continue;
+      }
+
+      if (!BSON_ITER_HOLDS_ARRAY (&iter) || !bson_iter_recurse (&iter, &ar)) {
+         continue;
+      }
+
+      while (bson_iter_next (&ar)) {
+         code = 0;
+         errmsg = "";
+
+         if (BSON_ITER_HOLDS_DOCUMENT (&ar) &&
+             bson_iter_recurse (&ar, &citer) &&
+             bson_iter_find (&citer, "code") &&
+             BSON_ITER_HOLDS_INT32 (&citer)) {
+            code = bson_iter_int32 (&citer);
+         }
+
+         if (BSON_ITER_HOLDS_DOCUMENT (&ar) &&
+             bson_iter_recurse (&ar, &citer) &&
+             bson_iter_find (&citer, "errmsg") &&
+             BSON_ITER_HOLDS_UTF8 (&citer)) {
+            errmsg = bson_iter_utf8 (&citer, NULL);
+         }
+
+         if ((code == 11000 || code == 11001 || code == 12582) &&
+             strstr (errmsg, "_id_")) {
+            n_forgiven++;
+            continue;
+         }
+
+         bson_uint32_to_string (n_errors++, &key, str, sizeof str);
+         bson_append_iter (&errors, key, -1, &ar);
+      }
+   }
+
+   BSON_APPEND_INT32 (&fixed, "n", n + (int32_t)n_forgiven);
+
+   if (n_errors) {
+      BSON_APPEND_ARRAY (&fixed, "writeErrors", &errors);
+   }
+
+   bson_destroy (reply);
+   bson_init (reply);
+   bson_concat (reply, &fixed);
+
+   bson_destroy (&errors);
+   bson_destroy (&fixed);
+}
+
+
+/* the type byte, the longest uint32 index and its NUL */
+#define ELEMENT_HEADER_MAX 12
+
+
+static void
+_mongoc_write_command_insert (mongoc_write_command_t       *command,
+                              mongoc_client_t              *client,
+                              uint32_t                      hint,
+                              const char                   *database,
+                              const char                   *collection,
+                              const mongoc_write_concern_t *write_concern,
+                              uint32_t                      offset,
+                              mongoc_write_result_t        *result,
+                              bson_error_t                 *error)
+{
+   mongoc_write_command_docs_t docs;
+   mongoc_iovec_t *iov;
+   uint8_t *elements;
+   uint8_t *element;
+   uint8_t *head;
+   uint8_t tail [2] = { 0 };
+   const char *key;
+   uint32_t len = 0;
+   uint32_t head_len;
+   uint32_t docs_len;
+   uint32_t le;
+   size_t n_iov;
+   size_t n_pieces;
+   bson_t cmd;
+   bson_t reply;
+   char str [16];
+   bool has_more;
+   bool ret = false;
+   uint32_t i;
+   mongoc_cluster_node_t *node;
+   int32_t max_insert_batch;
+   uint32_t key_len;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->type == MONGOC_WRITE_COMMAND_INSERT);
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (hint);
+   BSON_ASSERT (collection);
 
    node = &client->cluster.nodes [hint - 1];
-   max_insert_batch = node->max_write_batch_size;
+   max_insert_batch = _mongoc_cluster_max_write_batch_size (&client->cluster,
+                                                            node);
 
    /*
     * If we have an unacknowledged write and the server supports the legacy
@@ -871,9 +1878,9 @@ _mongoc_write_command_insert (mongoc_write_command_t       *command,
       EXIT;
    }
 
-   if (!command->n_documents ||
-       !bson_iter_init (&iter, command->documents) ||
-       !bson_iter_next (&iter)) {
+   _mongoc_write_command_docs_init (&docs, command);
+
+   if (!command->n_documents || docs.done) {
       bson_set_error (error,
                       MONGOC_ERROR_COLLECTION,
                       MONGOC_ERROR_COLLECTION_INSERT_FAILED,
@@ -882,26 +1889,216 @@ _mongoc_write_command_insert (mongoc_write_command_t       *command,
       EXIT;
    }
 
+   /*
+    * The command is never assembled in memory. It goes out as a chain of
+    * iovecs: the leading fields and the header of the "documents" array,
+    * then an element header and the document itself for each document,
+    * referenced in place, and finally the two closing NUL bytes.
+    */
+   iov = bson_malloc ((sizeof *iov) * (command->n_documents * 3 + 2));
+   elements = bson_malloc (command->n_documents * ELEMENT_HEADER_MAX);
+
 again:
    bson_init (&cmd);
    has_more = false;
    i = 0;
+   n_iov = 1;
+   docs_len = 0;
 
    BSON_APPEND_UTF8 (&cmd, "insert", collection);
    BSON_APPEND_DOCUMENT (&cmd, "writeConcern",
                          WRITE_CONCERN_DOC (write_concern));
    BSON_APPEND_BOOL (&cmd, "ordered", command->u.insert.ordered);
 
-   if (!_mongoc_write_command_will_overflow (0,
-                                             command->documents->len,
-                                             command->n_documents,
+   /*
+    * Room for the length, the fields of @cmd without its own length and
+    * trailing NUL, the "documents" key and the length of the array.
+    */
+   head_len = cmd.len + 14;
+   head = bson_malloc (head_len);
+   memcpy (head + 4, bson_get_data (&cmd) + 4, cmd.len - 5);
+   head [cmd.len - 1] = BSON_TYPE_ARRAY;
+   memcpy (head + cmd.len, "documents", 10);
+
+   do {
+      element = elements + (i * ELEMENT_HEADER_MAX);
+      key_len = (uint32_t)bson_uint32_to_string (i, &key, str, sizeof str);
+      len = _mongoc_write_command_docs_peek (&docs, &iov [n_iov + 1],
+                                             &n_pieces);
+
+      if (_mongoc_write_command_will_overflow (
+             head_len + docs_len + 2,
+             _mongoc_write_command_element_len (command->type, i, len),
+             i,
+             client->cluster.max_bson_size,
+             max_insert_batch)) {
+         has_more = true;
+         break;
+      }
+
+      element [0] = BSON_TYPE_DOCUMENT;
+      memcpy (element + 1, key, key_len + 1);
+
+      iov [n_iov].iov_base = (void *)element;
+      iov [n_iov].iov_len = key_len + 2;
+      n_iov += 1 + n_pieces;
+      docs_len += key_len + len + 2;
+
+      i++;
+   } while (_mongoc_write_command_docs_next (&docs));
+
+   if (!i) {
+      too_large_error (error, i, len, client->cluster.max_bson_size);
+      result->failed = true;
+      ret = false;
+   } else {
+      le = BSON_UINT32_TO_LE (head_len + docs_len + 2);
+      memcpy (head, &le, 4);
+      le = BSON_UINT32_TO_LE (docs_len + 5);
+      memcpy (head + cmd.len + 10, &le, 4);
+
+      iov [0].iov_base = (void *)head;
+      iov [0].iov_len = head_len;
+      iov [n_iov].iov_base = (void *)tail;
+      iov [n_iov].iov_len = sizeof tail;
+      n_iov++;
+
+      /* sets domain to QUERY? */
+      ret = _mongoc_write_command_run_iov (client, hint, database, iov, n_iov,
+                                           &reply, error);
+
+      /*
+       * The batch is sent again as it is, with the same ids, so that the
+       * documents the first attempt did insert are refused as duplicates.
+       */
+      if (!ret && !command->n_user_ids &&
+          (!command->u.insert.ordered || i == 1) &&
+          _mongoc_cluster_prepare_retry (&client->cluster, true, error)) {
+         bson_destroy (&reply);
+
+         hint = _mongoc_client_preselect (client, MONGOC_OPCODE_INSERT,
+                                          write_concern, NULL, error);
+
+         if (!hint) {
+            bson_init (&reply);
+         } else {
+            command->hint = hint;
+            ret = _mongoc_write_command_run_iov (client, hint, database, iov,
+                                                 n_iov, &reply, error);
+            if (ret) {
+               _mongoc_write_command_forgive_retry (&reply);
+            }
+         }
+      }
+
+      if (!ret) {
+         result->failed = true;
+      }
+
+      _mongoc_write_result_merge (result, command, &reply, offset);
+      offset += i;
+      bson_destroy (&reply);
+   }
+
+   bson_free (head);
+   bson_destroy (&cmd);
+
+   if (has_more && (ret || !command->u.insert.ordered)) {
+      GOTO (again);
+   }
+
+   bson_free (elements);
+   bson_free (iov);
+
+   EXIT;
+}
+
+
+static void
+_mongoc_write_command_update (mongoc_write_command_t       *command,
+                              mongoc_client_t              *client,
+                              uint32_t                      hint,
+                              const char                   *database,
+                              const char                   *collection,
+                              const mongoc_write_concern_t *write_concern,
+                              uint32_t                      offset,
+                              mongoc_write_result_t        *result,
+                              bson_error_t                 *error)
+{
+   const uint8_t *data;
+   bson_iter_t iter;
+   const char *key;
+   uint32_t len = 0;
+   bson_t tmp;
+   bson_t ar;
+   bson_t cmd;
+   bson_t reply;
+   char str [16];
+   bool ret = false;
+   mongoc_cluster_node_t *node;
+   int32_t max_update_batch;
+   bool has_more;
+   uint32_t i;
+   uint32_t prefix_len;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (hint);
+   BSON_ASSERT (collection);
+
+   node = &client->cluster.nodes [hint - 1];
+   max_update_batch = _mongoc_cluster_max_write_batch_size (&client->cluster,
+                                                            node);
+
+   /*
+    * If we have an unacknowledged write and the server supports the legacy
+    * opcodes, then submit the legacy opcode so we don't need to wait for
+    * a response from the server.
+    */
+   if ((client->cluster.nodes [hint - 1].min_wire_version == 0) &&
+       !_mongoc_write_concern_needs_gle (write_concern)) {
+      _mongoc_write_command_update_legacy (command, client, hint, database,
+                                           collection, write_concern, offset,
+                                           result, error);
+      EXIT;
+   }
+
+   if ((command->n_documents == 0) ||
+       !bson_iter_init (&iter, command->documents) ||
+       !bson_iter_next (&iter)) {
+      bson_set_error (error,
+                      MONGOC_ERROR_COLLECTION,
+                      MONGOC_ERROR_COLLECTION_UPDATE_FAILED,
+                      "Cannot do an empty update.");
+      result->failed = true;
+      EXIT;
+   }
+
+again:
+   bson_init (&cmd);
+   has_more = false;
+   i = 0;
+
+   BSON_APPEND_UTF8 (&cmd, "update", collection);
+   BSON_APPEND_DOCUMENT (&cmd, "writeConcern",
+                         WRITE_CONCERN_DOC (write_concern));
+   BSON_APPEND_BOOL (&cmd, "ordered", command->u.insert.ordered);
+   /* the fields so far, the array's type byte and its key */
+   prefix_len = cmd.len + 2 + 7;
+
+   if (!_mongoc_write_command_will_overflow (prefix_len,
+                                             command->batch_len,
+                                             command->n_documents - 1,
                                              client->cluster.max_bson_size,
-                                             max_insert_batch)) {
-      BSON_APPEND_ARRAY (&cmd, "documents", command->documents);
+                                             max_update_batch)) {
+      /* there is enough space to send the whole query at once... */
+      BSON_APPEND_ARRAY (&cmd, "updates", command->documents);
       i = command->n_documents;
    } else {
-      bson_append_array_begin (&cmd, "documents", (int)strlen ("documents"),
-                               &ar);
+      bson_append_array_begin (&cmd, "updates", (int)strlen ("updates"), &ar);
 
       do {
          if (!BSON_ITER_HOLDS_DOCUMENT (&iter)) {
@@ -909,13 +2106,14 @@ again:
          }
 
          bson_iter_document (&iter, &len, &data);
-         key_len = (uint32_t)bson_uint32_to_string (i, &key, str, sizeof str);
-
-         if (_mongoc_write_command_will_overflow (ar.len,
-                                                  key_len + len + 2,
-                                                  i,
-                                                  client->cluster.max_bson_size,
-                                                  max_insert_batch)) {
+         bson_uint32_to_string (i, &key, str, sizeof str);
+
+         if (_mongoc_write_command_will_overflow (
+                prefix_len + ar.len,
+                _mongoc_write_command_element_len (command->type, i, len),
+                i,
+                client->cluster.max_bson_size,
+                max_update_batch)) {
             has_more = true;
             break;
          }
@@ -927,7 +2125,6 @@ again:
          BSON_APPEND_DOCUMENT (&ar, key, &tmp);
 
          bson_destroy (&tmp);
-
          i++;
       } while (bson_iter_next (&iter));
 
@@ -939,7 +2136,6 @@ again:
       result->failed = true;
       ret = false;
    } else {
-      /* sets domain to QUERY? */
       ret = mongoc_client_command_simple (client, database, &cmd, NULL,
                                           &reply, error);
 
@@ -947,222 +2143,576 @@ again:
          result->failed = true;
       }
 
-      _mongoc_write_result_merge (result, command, &reply, offset);
-      offset += i;
-      bson_destroy (&reply);
+      _mongoc_write_result_merge (result, command, &reply, offset);
+      offset += i;
+      bson_destroy (&reply);
+   }
+
+   bson_destroy (&cmd);
+
+   if (has_more && (ret || !command->u.insert.ordered)) {
+      GOTO (again);
+   }
+
+   EXIT;
+}
+
+
+static mongoc_write_op_t gWriteOps [2][3] = {
+   { _mongoc_write_command_delete_legacy,
+     _mongoc_write_command_insert_legacy,
+     _mongoc_write_command_update_legacy },
+   { _mongoc_write_command_delete,
+     _mongoc_write_command_insert,
+     _mongoc_write_command_update },
+};
+
+
+void
+_mongoc_write_command_execute (mongoc_write_command_t       *command,       /* IN */
+                               mongoc_client_t              *client,        /* IN */
+                               uint32_t                      hint,          /* IN */
+                               const char                   *database,      /* IN */
+                               const char                   *collection,    /* IN */
+                               const mongoc_write_concern_t *write_concern, /* IN */
+                               uint32_t                      offset,        /* IN */
+                               mongoc_write_result_t        *result)        /* OUT */
+{
+   mongoc_cluster_node_t *node;
+   int mode = 0;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (collection);
+   BSON_ASSERT (result);
+
+   if (!write_concern) {
+      write_concern = client->write_concern;
+   }
+
+   if (!_mongoc_write_concern_is_valid(write_concern)) {
+      bson_set_error (&result->error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "The write concern is invalid.");
+      result->failed = true;
+      EXIT;
+   }
+
+   if (!hint) {
+      hint = _mongoc_client_preselect (client, MONGOC_OPCODE_INSERT,
+                                       write_concern, NULL, &result->error);
+      if (!hint) {
+         result->failed = true;
+         EXIT;
+      }
+   }
+
+   command->hint = hint;
+
+   node = &client->cluster.nodes [hint - 1];
+   mode = SUPPORTS_WRITE_COMMANDS (node);
+
+   _mongoc_query_cache_invalidate (&client->query_cache, database,
+                                   collection);
+
+   gWriteOps [mode][command->type] (command, client, hint, database,
+                                    collection, write_concern, offset,
+                                    result, &result->error);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_prepare --
+ *
+ *       Resolve the write concern of @command and the node to send it to,
+ *       as _mongoc_write_command_execute() does.
+ *
+ * Returns:
+ *       true if successful; otherwise false and the failure is recorded
+ *       in @result.
+ *
+ * Side effects:
+ *       @hint, @write_concern and @command->hint are set.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_write_command_prepare (mongoc_write_command_t        *command,       /* IN */
+                               mongoc_client_t               *client,        /* IN */
+                               uint32_t                      *hint,          /* INOUT */
+                               const mongoc_write_concern_t **write_concern, /* INOUT */
+                               mongoc_write_result_t         *result)        /* OUT */
+{
+   if (!*write_concern) {
+      *write_concern = client->write_concern;
+   }
+
+   if (!_mongoc_write_concern_is_valid (*write_concern)) {
+      bson_set_error (&result->error,
+                      MONGOC_ERROR_COMMAND,
+                      MONGOC_ERROR_COMMAND_INVALID_ARG,
+                      "The write concern is invalid.");
+      result->failed = true;
+      return false;
+   }
+
+   if (!*hint) {
+      *hint = _mongoc_client_preselect (client, MONGOC_OPCODE_INSERT,
+                                        *write_concern, NULL, &result->error);
+      if (!*hint) {
+         result->failed = true;
+         return false;
+      }
+   }
+
+   command->hint = *hint;
+
+   return true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_build_batch --
+ *
+ *       Build in @cmd a write command holding as many of the documents of
+ *       @command as the server accepts at once, starting at @iter.
+ *
+ * Returns:
+ *       true if documents remain after this batch.
+ *
+ * Side effects:
+ *       @cmd is initialized, @n_documents is set to the number of
+ *       documents it holds and @iter is advanced past them.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static bool
+_mongoc_write_command_build_batch (mongoc_write_command_t       *command,
+                                   bson_iter_t                  *iter,
+                                   int32_t                       max_bson_size,
+                                   int32_t                       max_batch,
+                                   const char                   *collection,
+                                   const mongoc_write_concern_t *write_concern,
+                                   bson_t                       *cmd,
+                                   uint32_t                     *n_documents)
+{
+   static const char *names [][2] = {
+      { "delete", "deletes" },
+      { "insert", "documents" },
+      { "update", "updates" },
+   };
+   const uint8_t *data;
+   const char *key;
+   uint32_t key_len;
+   uint32_t prefix_len;
+   uint32_t len;
+   uint32_t i = 0;
+   bson_t ar;
+   bson_t child;
+   bson_t tmp;
+   char str [16];
+   bool more = true;
+
+   bson_init (cmd);
+   BSON_APPEND_UTF8 (cmd, names [command->type][0], collection);
+   BSON_APPEND_DOCUMENT (cmd, "writeConcern",
+                         WRITE_CONCERN_DOC (write_concern));
+   BSON_APPEND_BOOL (cmd, "ordered", command->u.insert.ordered);
+   /* the fields so far, the array's type byte and its key */
+   prefix_len = cmd->len + 2 + (uint32_t)strlen (names [command->type][1]);
+   bson_append_array_begin (cmd, names [command->type][1], -1, &ar);
+
+   do {
+      BSON_ASSERT (BSON_ITER_HOLDS_DOCUMENT (iter));
+
+      bson_iter_document (iter, &len, &data);
+      key_len = (uint32_t)bson_uint32_to_string (i, &key, str, sizeof str);
+
+      if (_mongoc_write_command_will_overflow (
+             prefix_len + ar.len,
+             _mongoc_write_command_element_len (command->type, i, len),
+             i,
+             max_bson_size,
+             max_batch)) {
+         break;
+      }
+
+      bson_init_static (&tmp, data, len);
+
+      if (command->type == MONGOC_WRITE_COMMAND_DELETE) {
+         bson_append_document_begin (&ar, key, key_len, &child);
+         BSON_APPEND_DOCUMENT (&child, "q", &tmp);
+         BSON_APPEND_INT32 (&child, "limit",
+                            command->u.delete.multi ? 0 : 1);
+         bson_append_document_end (&ar, &child);
+      } else {
+         BSON_APPEND_DOCUMENT (&ar, key, &tmp);
+      }
+
+      i++;
+   } while ((more = bson_iter_next (iter)));
+
+   bson_append_array_end (cmd, &ar);
+
+   *n_documents = i;
+
+   return more;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_send --
+ *
+ *       Send @command as a single write command without waiting for the
+ *       reply, so that the caller can get on with its next batch. The
+ *       reply must be read with _mongoc_write_command_recv() before
+ *       anything else is read from the node.
+ *
+ *       Only commands built with the append functions can be sent this
+ *       way.
+ *
+ * Returns:
+ *       false if the node chosen does not support write commands or
+ *       @command does not fit in one write command, in which case nothing
+ *       was sent and the caller should use _mongoc_write_command_execute().
+ *
+ *       Otherwise true. @request_id is 0 if the command could not be sent
+ *       and the failure is recorded in @result.
+ *
+ * Side effects:
+ *       @command->hint is set to the node the command was sent to.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+_mongoc_write_command_send (mongoc_write_command_t       *command,       /* IN */
+                            mongoc_client_t              *client,        /* IN */
+                            uint32_t                      hint,          /* IN */
+                            const char                   *database,      /* IN */
+                            const char                   *collection,    /* IN */
+                            const mongoc_write_concern_t *write_concern, /* IN */
+                            uint32_t                     *request_id,    /* OUT */
+                            mongoc_write_result_t        *result)        /* OUT */
+{
+   mongoc_cluster_node_t *node;
+   mongoc_iovec_t iov;
+   bson_iter_t iter;
+   uint32_t n_documents;
+   bson_t cmd;
+   bool more;
+
+   ENTRY;
+
+   BSON_ASSERT (command);
+   BSON_ASSERT (command->documents);
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (collection);
+   BSON_ASSERT (request_id);
+   BSON_ASSERT (result);
+
+   *request_id = 0;
+
+   if (!_mongoc_write_command_prepare (command, client, &hint, &write_concern,
+                                       result)) {
+      RETURN (true);
+   }
+
+   node = &client->cluster.nodes [hint - 1];
+
+   if (!SUPPORTS_WRITE_COMMANDS (node) ||
+       !bson_iter_init (&iter, command->documents) ||
+       !bson_iter_next (&iter)) {
+      RETURN (false);
+   }
+
+   more = _mongoc_write_command_build_batch (command, &iter,
+                                             client->cluster.max_bson_size,
+                                             _mongoc_cluster_max_write_batch_size (
+                                                &client->cluster, node),
+                                             collection, write_concern,
+                                             &cmd, &n_documents);
+
+   if (more || (n_documents != command->n_documents)) {
+      bson_destroy (&cmd);
+      RETURN (false);
+   }
+
+   iov.iov_base = (void *)bson_get_data (&cmd);
+   iov.iov_len = cmd.len;
+
+   if (!_mongoc_write_command_send_query (client, hint, database, &iov, 1,
+                                          false, request_id,
+                                          &result->error)) {
+      result->failed = true;
+      *request_id = 0;
    }
 
    bson_destroy (&cmd);
 
-   if (has_more && (ret || !command->u.insert.ordered)) {
-      GOTO (again);
+   RETURN (true);
+}
+
+
+/*
+ * A batch of an unordered command that has been sent, but whose reply has
+ * not been read yet.
+ */
+typedef struct
+{
+   uint32_t hint;
+   uint32_t request_id;
+   uint32_t offset;
+} mongoc_write_command_in_flight_t;
+
+
+static void
+_mongoc_write_command_recv_batch (mongoc_write_command_t           *command,
+                                  mongoc_client_t                  *client,
+                                  mongoc_write_command_in_flight_t *batch,
+                                  mongoc_write_result_t            *result)
+{
+   bson_t reply;
+
+   if (!_mongoc_write_command_recv_reply (client, batch->hint,
+                                          batch->request_id, &reply,
+                                          &result->error)) {
+      result->failed = true;
    }
 
-   EXIT;
+   _mongoc_write_result_merge (result, command, &reply, batch->offset);
+   bson_destroy (&reply);
 }
 
 
-static void
-_mongoc_write_command_update (mongoc_write_command_t       *command,
-                              mongoc_client_t              *client,
-                              uint32_t                      hint,
-                              const char                   *database,
-                              const char                   *collection,
-                              const mongoc_write_concern_t *write_concern,
-                              uint32_t                      offset,
-                              mongoc_write_result_t        *result,
-                              bson_error_t                 *error)
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_execute_concurrent --
+ *
+ *       Like _mongoc_write_command_execute(), for a command whose batches
+ *       may be applied in any order. Up to MAX_IN_FLIGHT batches are
+ *       pipelined on a connection before the first reply is read. When
+ *       the node chosen is a mongos, the batches are also spread over
+ *       every other mongos we are connected to.
+ *
+ *       Replies are merged in the order the batches were sent, each at
+ *       its own offset, so the indexes in @result are the same as if the
+ *       batches had been sent one at a time.
+ *
+ *       Falls back to _mongoc_write_command_execute() for ordered commands
+ *       and for servers without write commands.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @result is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_command_execute_concurrent (mongoc_write_command_t       *command,       /* IN */
+                                          mongoc_client_t              *client,        /* IN */
+                                          uint32_t                      hint,          /* IN */
+                                          const char                   *database,      /* IN */
+                                          const char                   *collection,    /* IN */
+                                          const mongoc_write_concern_t *write_concern, /* IN */
+                                          uint32_t                      offset,        /* IN */
+                                          mongoc_write_result_t        *result)        /* OUT */
 {
+   mongoc_write_command_in_flight_t *in_flight;
+   mongoc_cluster_node_t *node;
    const uint8_t *data;
+   mongoc_iovec_t iov;
    bson_iter_t iter;
-   const char *key;
-   uint32_t len = 0;
-   bson_t tmp;
-   bson_t ar;
+   uint32_t *hints;
+   uint32_t len;
+   uint32_t n_hints = 0;
+   uint32_t n_documents;
+   uint32_t target;
+   uint32_t request_id;
+   size_t window;
+   size_t head = 0;
+   size_t n_in_flight = 0;
+   size_t n_batches = 0;
    bson_t cmd;
-   bson_t reply;
-   char str [16];
-   bool ret = false;
-   mongoc_cluster_node_t *node;
-   int32_t max_update_batch;
-   bool has_more;
+   bool more;
    uint32_t i;
-   uint32_t key_len;
 
    ENTRY;
 
    BSON_ASSERT (command);
    BSON_ASSERT (client);
    BSON_ASSERT (database);
-   BSON_ASSERT (hint);
    BSON_ASSERT (collection);
+   BSON_ASSERT (result);
 
-   node = &client->cluster.nodes [hint - 1];
-   max_update_batch = node->max_write_batch_size;
+   if (command->u.insert.ordered || !command->documents) {
+      _mongoc_write_command_execute (command, client, hint, database,
+                                     collection, write_concern, offset,
+                                     result);
+      EXIT;
+   }
 
-   /*
-    * If we have an unacknowledged write and the server supports the legacy
-    * opcodes, then submit the legacy opcode so we don't need to wait for
-    * a response from the server.
-    */
-   if ((client->cluster.nodes [hint - 1].min_wire_version == 0) &&
-       !_mongoc_write_concern_needs_gle (write_concern)) {
-      _mongoc_write_command_update_legacy (command, client, hint, database,
-                                           collection, write_concern, offset,
-                                           result, error);
+   if (!_mongoc_write_command_prepare (command, client, &hint, &write_concern,
+                                       result)) {
       EXIT;
    }
 
-   if ((command->n_documents == 0) ||
+   _mongoc_query_cache_invalidate (&client->query_cache, database,
+                                   collection);
+
+   node = &client->cluster.nodes [hint - 1];
+
+   if (!SUPPORTS_WRITE_COMMANDS (node) ||
        !bson_iter_init (&iter, command->documents) ||
        !bson_iter_next (&iter)) {
-      bson_set_error (error,
-                      MONGOC_ERROR_COLLECTION,
-                      MONGOC_ERROR_COLLECTION_UPDATE_FAILED,
-                      "Cannot do an empty update.");
-      result->failed = true;
+      _mongoc_write_command_execute (command, client, hint, database,
+                                     collection, write_concern, offset,
+                                     result);
       EXIT;
    }
 
-again:
-   bson_init (&cmd);
-   has_more = false;
-   i = 0;
-
-   BSON_APPEND_UTF8 (&cmd, "update", collection);
-   BSON_APPEND_DOCUMENT (&cmd, "writeConcern",
-                         WRITE_CONCERN_DOC (write_concern));
-   BSON_APPEND_BOOL (&cmd, "ordered", command->u.insert.ordered);
+   hints = bson_malloc (client->cluster.nodes_len * sizeof *hints);
+   hints [n_hints++] = hint;
 
-   if (!_mongoc_write_command_will_overflow (command->documents->len,
-                                             0,
-                                             command->n_documents,
-                                             client->cluster.max_bson_size,
-                                             max_update_batch)) {
-      /* there is enough space to send the whole query at once... */
-      BSON_APPEND_ARRAY (&cmd, "updates", command->documents);
-      i = command->n_documents;
-   } else {
-      bson_append_array_begin (&cmd, "updates", (int)strlen ("updates"), &ar);
+   if (node->isdbgrid) {
+      for (i = 0; i < client->cluster.nodes_len; i++) {
+         node = &client->cluster.nodes [i];
 
-      do {
-         if (!BSON_ITER_HOLDS_DOCUMENT (&iter)) {
-            BSON_ASSERT (false);
+         if (((i + 1) != hint) && node->isdbgrid && node->stream &&
+             SUPPORTS_WRITE_COMMANDS (node)) {
+            hints [n_hints++] = i + 1;
          }
+      }
+   }
 
-         bson_iter_document (&iter, &len, &data);
-         key_len = (uint32_t)bson_uint32_to_string (i, &key, str, sizeof str);
-
-         if (_mongoc_write_command_will_overflow (ar.len,
-                                                  key_len + len + 2,
-                                                  i,
-                                                  client->cluster.max_bson_size,
-                                                  max_update_batch)) {
-            has_more = true;
-            break;
-         }
+   window = n_hints * MAX_IN_FLIGHT;
+   in_flight = bson_malloc (window * sizeof *in_flight);
 
-         if (!bson_init_static (&tmp, data, len)) {
-            BSON_ASSERT (false);
-         }
+   do {
+      if (n_in_flight == window) {
+         _mongoc_write_command_recv_batch (command, client, &in_flight [head],
+                                           result);
+         head = (head + 1) % window;
+         n_in_flight--;
+      }
 
-         BSON_APPEND_DOCUMENT (&ar, key, &tmp);
+      target = hints [n_batches % n_hints];
+      node = &client->cluster.nodes [target - 1];
 
-         bson_destroy (&tmp);
-         i++;
-      } while (bson_iter_next (&iter));
+      more = _mongoc_write_command_build_batch (command, &iter,
+                                                client->cluster.max_bson_size,
+                                                _mongoc_cluster_max_write_batch_size (
+                                                   &client->cluster, node),
+                                                collection, write_concern,
+                                                &cmd, &n_documents);
 
-      bson_append_array_end (&cmd, &ar);
-   }
+      if (!n_documents) {
+         bson_iter_document (&iter, &len, &data);
+         too_large_error (&result->error, offset, len,
+                          client->cluster.max_bson_size);
+         result->failed = true;
+         bson_destroy (&cmd);
+         break;
+      }
 
-   if (!i) {
-      too_large_error (error, i, len, client->cluster.max_bson_size);
-      result->failed = true;
-      ret = false;
-   } else {
-      ret = mongoc_client_command_simple (client, database, &cmd, NULL,
-                                          &reply, error);
+      iov.iov_base = (void *)bson_get_data (&cmd);
+      iov.iov_len = cmd.len;
 
-      if (!ret) {
+      if (!_mongoc_write_command_send_query (client, target, database, &iov,
+                                             1, n_in_flight > 0, &request_id,
+                                             &result->error)) {
          result->failed = true;
+         bson_destroy (&cmd);
+         break;
       }
 
-      _mongoc_write_result_merge (result, command, &reply, offset);
-      offset += i;
-      bson_destroy (&reply);
-   }
+      bson_destroy (&cmd);
 
-   bson_destroy (&cmd);
+      in_flight [(head + n_in_flight) % window].hint = target;
+      in_flight [(head + n_in_flight) % window].request_id = request_id;
+      in_flight [(head + n_in_flight) % window].offset = offset;
+      n_in_flight++;
+      n_batches++;
 
-   if (has_more && (ret || !command->u.insert.ordered)) {
-      GOTO (again);
+      offset += n_documents;
+   } while (more);
+
+   while (n_in_flight) {
+      _mongoc_write_command_recv_batch (command, client, &in_flight [head],
+                                        result);
+      head = (head + 1) % window;
+      n_in_flight--;
    }
 
+   bson_free (in_flight);
+   bson_free (hints);
+
    EXIT;
 }
 
 
-static mongoc_write_op_t gWriteOps [2][3] = {
-   { _mongoc_write_command_delete_legacy,
-     _mongoc_write_command_insert_legacy,
-     _mongoc_write_command_update_legacy },
-   { _mongoc_write_command_delete,
-     _mongoc_write_command_insert,
-     _mongoc_write_command_update },
-};
-
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_command_recv --
+ *
+ *       Read the reply to @command, sent earlier with
+ *       _mongoc_write_command_send() as @request_id, and merge it into
+ *       @result. @offset is the index of the first document of @command
+ *       within the whole write.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @result is updated.
+ *
+ *--------------------------------------------------------------------------
+ */
 
 void
-_mongoc_write_command_execute (mongoc_write_command_t       *command,       /* IN */
-                               mongoc_client_t              *client,        /* IN */
-                               uint32_t                      hint,          /* IN */
-                               const char                   *database,      /* IN */
-                               const char                   *collection,    /* IN */
-                               const mongoc_write_concern_t *write_concern, /* IN */
-                               uint32_t                      offset,        /* IN */
-                               mongoc_write_result_t        *result)        /* OUT */
+_mongoc_write_command_recv (mongoc_write_command_t *command,    /* IN */
+                            mongoc_client_t        *client,     /* IN */
+                            uint32_t                request_id, /* IN */
+                            uint32_t                offset,     /* IN */
+                            mongoc_write_result_t  *result)     /* OUT */
 {
-   mongoc_cluster_node_t *node;
-   int mode = 0;
+   bson_t reply;
 
    ENTRY;
 
    BSON_ASSERT (command);
+   BSON_ASSERT (command->hint);
    BSON_ASSERT (client);
-   BSON_ASSERT (database);
-   BSON_ASSERT (collection);
+   BSON_ASSERT (request_id);
    BSON_ASSERT (result);
 
-   if (!write_concern) {
-      write_concern = client->write_concern;
-   }
-
-   if (!_mongoc_write_concern_is_valid(write_concern)) {
-      bson_set_error (&result->error,
-                      MONGOC_ERROR_COMMAND,
-                      MONGOC_ERROR_COMMAND_INVALID_ARG,
-                      "The write concern is invalid.");
+   if (!_mongoc_write_command_recv_reply (client, command->hint, request_id,
+                                          &reply, &result->error)) {
       result->failed = true;
-      EXIT;
-   }
-
-   if (!hint) {
-      hint = _mongoc_client_preselect (client, MONGOC_OPCODE_INSERT,
-                                       write_concern, NULL, &result->error);
-      if (!hint) {
-         result->failed = true;
-         EXIT;
-      }
    }
 
-   command->hint = hint;
-
-   node = &client->cluster.nodes [hint - 1];
-   mode = SUPPORTS_WRITE_COMMANDS (node);
-
-   gWriteOps [mode][command->type] (command, client, hint, database,
-                                    collection, write_concern, offset,
-                                    result, &result->error);
+   _mongoc_write_result_merge (result, command, &reply, offset);
+   bson_destroy (&reply);
 
    EXIT;
 }
@@ -1174,7 +2724,13 @@ _mongoc_write_command_destroy (mongoc_write_command_t *command)
    ENTRY;
 
    if (command) {
-      bson_destroy (command->documents);
+      mongoc_counter_memory_write_commands_add (
+         -_mongoc_write_command_bytes_held (command));
+
+      if (command->documents) {
+         bson_destroy (command->documents);
+      }
+      bson_free (command->borrowed);
    }
 
    EXIT;
@@ -1190,9 +2746,9 @@ _mongoc_write_result_init (mongoc_write_result_t *result) /* IN */
 
    memset (result, 0, sizeof *result);
 
-   bson_init (&result->upserted);
+   _mongoc_array_init (&result->upserted, sizeof (mongoc_write_upsert_t));
    bson_init (&result->writeConcernError);
-   bson_init (&result->writeErrors);
+   _mongoc_array_init (&result->writeErrors, sizeof (mongoc_write_error_t));
 
    EXIT;
 }
@@ -1201,13 +2757,32 @@ _mongoc_write_result_init (mongoc_write_result_t *result) /* IN */
 void
 _mongoc_write_result_destroy (mongoc_write_result_t *result)
 {
+   mongoc_write_upsert_t *upsert;
+   mongoc_write_error_t *write_error;
+   size_t i;
+
    ENTRY;
 
    BSON_ASSERT (result);
 
-   bson_destroy (&result->upserted);
+   for (i = 0; i < result->upserted.len; i++) {
+      upsert = &_mongoc_array_index (&result->upserted,
+                                     mongoc_write_upsert_t, i);
+      bson_value_destroy (&upsert->_id);
+   }
+
+   for (i = 0; i < result->writeErrors.len; i++) {
+      write_error = &_mongoc_array_index (&result->writeErrors,
+                                          mongoc_write_error_t, i);
+      bson_free (write_error->errmsg);
+      if (write_error->info) {
+         bson_destroy (write_error->info);
+      }
+   }
+
+   _mongoc_array_destroy (&result->upserted);
    bson_destroy (&result->writeConcernError);
-   bson_destroy (&result->writeErrors);
+   _mongoc_array_destroy (&result->writeErrors);
 
    EXIT;
 }
@@ -1218,23 +2793,35 @@ _mongoc_write_result_append_upsert (mongoc_write_result_t *result,
                                     int32_t                idx,
                                     const bson_value_t    *value)
 {
-   bson_t child;
-   const char *keyptr = NULL;
-   char key[12];
-   int len;
+   mongoc_write_upsert_t upsert;
 
    BSON_ASSERT (result);
    BSON_ASSERT (value);
 
-   len = (int)bson_uint32_to_string (result->upsert_append_count, &keyptr, key,
-                                     sizeof key);
+   upsert.index = idx;
+   bson_value_copy (value, &upsert._id);
+
+   _mongoc_array_append_val (&result->upserted, upsert);
+}
+
+
+static void
+_mongoc_write_result_append_error (mongoc_write_result_t *result,
+                                   uint32_t               idx,
+                                   int32_t                code,
+                                   const char            *errmsg,
+                                   bson_t                *info)
+{
+   mongoc_write_error_t write_error;
+
+   BSON_ASSERT (result);
 
-   bson_append_document_begin (&result->upserted, keyptr, len, &child);
-   BSON_APPEND_INT32 (&child, "index", idx);
-   BSON_APPEND_VALUE (&child, "_id", value);
-   bson_append_document_end (&result->upserted, &child);
+   write_error.index = idx;
+   write_error.code = code;
+   write_error.errmsg = errmsg ? bson_strdup (errmsg) : NULL;
+   write_error.info = info;
 
-   result->upsert_append_count++;
+   _mongoc_array_append_val (&result->writeErrors, write_error);
 }
 
 
@@ -1245,7 +2832,6 @@ _mongoc_write_result_merge_legacy (mongoc_write_result_t  *result,  /* IN */
                                    uint32_t                offset)
 {
    const bson_value_t *value;
-   bson_t holder, write_errors, child;
    bson_iter_t iter;
    bson_iter_t ar;
    bson_iter_t citer;
@@ -1281,21 +2867,7 @@ _mongoc_write_result_merge_legacy (mongoc_write_result_t  *result,  /* IN */
                       "%s", err);
       result->failed = true;
 
-      bson_init(&holder);
-      bson_append_array_begin(&holder, "0", 1, &write_errors);
-      bson_append_document_begin(&write_errors, "0", 1, &child);
-      bson_append_int32(&child, "index", 5, 0);
-      bson_append_int32(&child, "code", 4, code);
-      bson_append_utf8(&child, "errmsg", 6, err, -1);
-      bson_append_document_end(&write_errors, &child);
-      bson_append_array_end(&holder, &write_errors);
-      bson_iter_init(&iter, &holder);
-      bson_iter_next(&iter);
-
-      _mongoc_write_result_merge_arrays (offset, result, &result->writeErrors,
-                                         &iter);
-
-      bson_destroy(&holder);
+      _mongoc_write_result_append_error (result, offset, code, err, NULL);
    }
 
    switch (command->type) {
@@ -1348,55 +2920,58 @@ _mongoc_write_result_merge_legacy (mongoc_write_result_t  *result,  /* IN */
 }
 
 
-static int32_t
-_mongoc_write_result_merge_arrays (uint32_t               offset,
-                                   mongoc_write_result_t *result, /* IN */
-                                   bson_t                *dest,   /* IN */
+static void
+_mongoc_write_result_merge_errors (mongoc_write_result_t *result, /* IN */
+                                   uint32_t               offset,
                                    bson_iter_t           *iter)   /* IN */
 {
-   const bson_value_t *value;
+   const char *errmsg;
    bson_iter_t ar;
    bson_iter_t citer;
-   int32_t idx;
-   int32_t count = 0;
-   int32_t aridx;
-   bson_t child;
-   const char *keyptr = NULL;
-   char key[12];
-   int len;
+   uint32_t idx;
+   int32_t code;
+   bson_t *info;
 
    ENTRY;
 
    BSON_ASSERT (result);
-   BSON_ASSERT (dest);
    BSON_ASSERT (iter);
    BSON_ASSERT (BSON_ITER_HOLDS_ARRAY (iter));
 
-   aridx = bson_count_keys (dest);
-
    if (bson_iter_recurse (iter, &ar)) {
       while (bson_iter_next (&ar)) {
          if (BSON_ITER_HOLDS_DOCUMENT (&ar) &&
              bson_iter_recurse (&ar, &citer)) {
-            len = (int)bson_uint32_to_string (aridx++, &keyptr, key,
-                                              sizeof key);
-            bson_append_document_begin (dest, keyptr, len, &child);
+            idx = offset;
+            code = 0;
+            errmsg = NULL;
+            info = NULL;
+
             while (bson_iter_next (&citer)) {
                if (BSON_ITER_IS_KEY (&citer, "index")) {
                   idx = bson_iter_int32 (&citer) + offset;
-                  BSON_APPEND_INT32 (&child, "index", idx);
+               } else if (BSON_ITER_IS_KEY (&citer, "code") &&
+                          BSON_ITER_HOLDS_INT32 (&citer)) {
+                  code = bson_iter_int32 (&citer);
+               } else if (BSON_ITER_IS_KEY (&citer, "errmsg") &&
+                          BSON_ITER_HOLDS_UTF8 (&citer)) {
+                  errmsg = bson_iter_utf8 (&citer, NULL);
                } else {
-                  value = bson_iter_value (&citer);
-                  BSON_APPEND_VALUE (&child, bson_iter_key (&citer), value);
+                  if (!info) {
+                     info = bson_new ();
+                  }
+                  BSON_APPEND_VALUE (info, bson_iter_key (&citer),
+                                     bson_iter_value (&citer));
                }
             }
-            bson_append_document_end (dest, &child);
-            count++;
+
+            _mongoc_write_result_append_error (result, idx, code, errmsg,
+                                               info);
          }
       }
    }
 
-   RETURN (count);
+   EXIT;
 }
 
 
@@ -1496,8 +3071,7 @@ _mongoc_write_result_merge (mongoc_write_result_t  *result,  /* IN */
 
    if (bson_iter_init_find (&iter, reply, "writeErrors") &&
        BSON_ITER_HOLDS_ARRAY (&iter)) {
-      _mongoc_write_result_merge_arrays (offset, result, &result->writeErrors,
-                                         &iter);
+      _mongoc_write_result_merge_errors (result, offset, &iter);
    }
 
    if (bson_iter_init_find (&iter, reply, "writeConcernError") &&
@@ -1516,15 +3090,78 @@ _mongoc_write_result_merge (mongoc_write_result_t  *result,  /* IN */
 }
 
 
+static void
+_mongoc_write_result_append_arrays (mongoc_write_result_t *result,
+                                    bson_t                *bson)
+{
+   mongoc_write_upsert_t *upsert;
+   mongoc_write_error_t *write_error;
+   const char *key;
+   char str [16];
+   size_t i;
+   bson_t ar;
+   bson_t child;
+
+   if (result->upserted.len) {
+      bson_append_array_begin (bson, "upserted", 8, &ar);
+      for (i = 0; i < result->upserted.len; i++) {
+         upsert = &_mongoc_array_index (&result->upserted,
+                                        mongoc_write_upsert_t, i);
+         bson_uint32_to_string ((uint32_t)i, &key, str, sizeof str);
+         bson_append_document_begin (&ar, key, -1, &child);
+         BSON_APPEND_INT32 (&child, "index", upsert->index);
+         BSON_APPEND_VALUE (&child, "_id", &upsert->_id);
+         bson_append_document_end (&ar, &child);
+      }
+      bson_append_array_end (bson, &ar);
+   }
+
+   bson_append_array_begin (bson, "writeErrors", 11, &ar);
+   for (i = 0; i < result->writeErrors.len; i++) {
+      write_error = &_mongoc_array_index (&result->writeErrors,
+                                          mongoc_write_error_t, i);
+      bson_uint32_to_string ((uint32_t)i, &key, str, sizeof str);
+      bson_append_document_begin (&ar, key, -1, &child);
+      BSON_APPEND_INT32 (&child, "index", write_error->index);
+      if (write_error->code) {
+         BSON_APPEND_INT32 (&child, "code", write_error->code);
+      }
+      if (write_error->errmsg) {
+         BSON_APPEND_UTF8 (&child, "errmsg", write_error->errmsg);
+      }
+      if (write_error->info) {
+         bson_concat (&child, write_error->info);
+      }
+      bson_append_document_end (&ar, &child);
+   }
+   bson_append_array_end (bson, &ar);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_result_complete --
+ *
+ *       Build the reply to a bulk write from @result. The merged
+ *       "upserted" and "writeErrors" are only turned into BSON here, so
+ *       merging each batch costs no more than the size of its reply.
+ *
+ * Returns:
+ *       true if there were no errors; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @bson is appended to if not NULL.
+ *
+ *--------------------------------------------------------------------------
+ */
+
 bool
 _mongoc_write_result_complete (mongoc_write_result_t *result,
                                bson_t                *bson,
                                bson_error_t          *error)
 {
-   bson_iter_t iter;
-   bson_iter_t citer;
-   const char *err = NULL;
-   uint32_t code = 0;
+   mongoc_write_error_t *write_error;
    bool ret;
 
    ENTRY;
@@ -1533,7 +3170,7 @@ _mongoc_write_result_complete (mongoc_write_result_t *result,
 
    ret = (!result->failed &&
           bson_empty0 (&result->writeConcernError) &&
-          bson_empty0 (&result->writeErrors));
+          !result->writeErrors.len);
 
    if (bson) {
       BSON_APPEND_INT32 (bson, "nInserted", result->nInserted);
@@ -1543,10 +3180,7 @@ _mongoc_write_result_complete (mongoc_write_result_t *result,
       }
       BSON_APPEND_INT32 (bson, "nRemoved", result->nRemoved);
       BSON_APPEND_INT32 (bson, "nUpserted", result->nUpserted);
-      if (!bson_empty0 (&result->upserted)) {
-         BSON_APPEND_ARRAY (bson, "upserted", &result->upserted);
-      }
-      BSON_APPEND_ARRAY (bson, "writeErrors", &result->writeErrors);
+      _mongoc_write_result_append_arrays (result, bson);
       if (!bson_empty0 (&result->writeConcernError)) {
          BSON_APPEND_DOCUMENT (bson, "writeConcernError",
                             &result->writeConcernError);
@@ -1557,21 +3191,12 @@ _mongoc_write_result_complete (mongoc_write_result_t *result,
       memcpy (error, &result->error, sizeof *error);
    }
 
-   if (!ret &&
-       !bson_empty0 (&result->writeErrors) &&
-       bson_iter_init (&iter, &result->writeErrors) &&
-       bson_iter_next (&iter) &&
-       BSON_ITER_HOLDS_DOCUMENT (&iter) &&
-       bson_iter_recurse (&iter, &citer)) {
-      while (bson_iter_next (&citer)) {
-         if (BSON_ITER_IS_KEY (&citer, "errmsg")) {
-            err = bson_iter_utf8 (&citer, NULL);
-         } else if (BSON_ITER_IS_KEY (&citer, "code")) {
-            code = bson_iter_int32 (&citer);
-         }
-      }
-      if (err && code) {
-         bson_set_error (error, MONGOC_ERROR_COMMAND, code, "%s", err);
+   if (!ret && result->writeErrors.len) {
+      write_error = &_mongoc_array_index (&result->writeErrors,
+                                          mongoc_write_error_t, 0);
+      if (write_error->errmsg && write_error->code) {
+         bson_set_error (error, MONGOC_ERROR_COMMAND, write_error->code,
+                         "%s", write_error->errmsg);
       }
    }
 
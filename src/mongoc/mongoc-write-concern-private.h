@@ -41,6 +41,7 @@ struct _mongoc_write_concern_t
    bool      frozen;
    bson_t    compiled;
    bson_t    compiled_gle;
+   volatile int32_t ref_count;
 };
 
 
@@ -48,6 +49,9 @@ const bson_t *_mongoc_write_concern_get_gle   (mongoc_write_concern_t       *wri
 const bson_t *_mongoc_write_concern_get_bson  (mongoc_write_concern_t       *write_concern);
 bool          _mongoc_write_concern_needs_gle (const mongoc_write_concern_t *write_concern);
 bool          _mongoc_write_concern_is_valid  (const mongoc_write_concern_t *write_concern);
+void          _mongoc_write_concern_freeze    (mongoc_write_concern_t       *write_concern);
+mongoc_write_concern_t *
+              _mongoc_write_concern_share     (const mongoc_write_concern_t *write_concern);
 
 BSON_END_DECLS
 
@@ -30,9 +30,6 @@ _mongoc_write_concern_warn_frozen (mongoc_write_concern_t *write_concern)
    return write_concern->frozen;
 }
 
-static void
-_mongoc_write_concern_freeze (mongoc_write_concern_t *write_concern);
-
 
 /**
  * mongoc_write_concern_new:
@@ -51,6 +48,7 @@ mongoc_write_concern_new (void)
    write_concern->w = MONGOC_WRITE_CONCERN_W_DEFAULT;
    write_concern->fsync_ = MONGOC_WRITE_CONCERN_FSYNC_DEFAULT;
    write_concern->journal = MONGOC_WRITE_CONCERN_JOURNAL_DEFAULT;
+   write_concern->ref_count = 1;
 
    return write_concern;
 }
@@ -84,7 +82,8 @@ mongoc_write_concern_copy (const mongoc_write_concern_t *write_concern)
 void
 mongoc_write_concern_destroy (mongoc_write_concern_t *write_concern)
 {
-   if (write_concern) {
+   if (write_concern &&
+       !bson_atomic_int_add (&write_concern->ref_count, -1)) {
       if (write_concern->compiled.len) {
          bson_destroy (&write_concern->compiled);
          bson_destroy (&write_concern->compiled_gle);
@@ -325,7 +324,7 @@ _mongoc_write_concern_get_gle (mongoc_write_concern_t *write_concern) {
  *
  * You may not modify the write concern further after calling this function.
  */
-static void
+void
 _mongoc_write_concern_freeze (mongoc_write_concern_t *write_concern)
 {
    bson_t *compiled;
@@ -333,6 +332,10 @@ _mongoc_write_concern_freeze (mongoc_write_concern_t *write_concern)
 
    bson_return_if_fail(write_concern);
 
+   if (write_concern->frozen) {
+      return;
+   }
+
    compiled = &write_concern->compiled;
    compiled_gle = &write_concern->compiled_gle;
 
@@ -369,6 +372,42 @@ _mongoc_write_concern_freeze (mongoc_write_concern_t *write_concern)
 }
 
 
+/**
+ * _mongoc_write_concern_share:
+ * @write_concern: (in): A mongoc_write_concern_t.
+ *
+ * This is an internal function.
+ *
+ * Get a reference to a write concern equal to @write_concern for a
+ * collection, database or bulk operation to hold on to. A frozen
+ * @write_concern is shared by taking a reference, any other is copied once
+ * and the copy is frozen.
+ *
+ * Returns: A frozen mongoc_write_concern_t that should be released with
+ *    mongoc_write_concern_destroy(), or NULL if @write_concern is NULL.
+ */
+mongoc_write_concern_t *
+_mongoc_write_concern_share (const mongoc_write_concern_t *write_concern)
+{
+   mongoc_write_concern_t *ret;
+
+   if (!write_concern) {
+      return NULL;
+   }
+
+   if (write_concern->frozen) {
+      ret = (mongoc_write_concern_t *)write_concern;
+      bson_atomic_int_add (&ret->ref_count, 1);
+      return ret;
+   }
+
+   ret = mongoc_write_concern_copy (write_concern);
+   _mongoc_write_concern_freeze (ret);
+
+   return ret;
+}
+
+
 /**
  * mongoc_write_concern_needs_gle:
  * @concern: (in): A mongoc_write_concern_t.
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MONGOC_WRITE_FUTURE_PRIVATE_H
+#define MONGOC_WRITE_FUTURE_PRIVATE_H
+
+#if !defined (MONGOC_I_AM_A_DRIVER) && !defined (MONGOC_COMPILATION)
+#error "Only <mongoc.h> can be included directly."
+#endif
+
+#include "mongoc-client.h"
+#include "mongoc-write-command-private.h"
+#include "mongoc-write-future.h"
+
+
+BSON_BEGIN_DECLS
+
+
+struct _mongoc_write_future_t
+{
+   /* NULL once the acknowledgement has been read */
+   mongoc_client_t        *client;
+   /* its documents are borrowed, and only read while it is sent */
+   mongoc_write_command_t  command;
+   uint32_t                request_id;
+   uint32_t                stamp;
+   mongoc_write_result_t   result;
+   bool                    done;
+   bool                    ret;
+   bson_t                  reply;
+   bson_error_t            error;
+};
+
+
+mongoc_write_future_t *_mongoc_write_future_new_insert  (mongoc_client_t              *client,
+                                                         const char                   *database,
+                                                         const char                   *collection,
+                                                         const bson_t                 *document,
+                                                         const mongoc_write_concern_t *write_concern);
+void                   _mongoc_write_future_collect_all (mongoc_client_t              *client);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_WRITE_FUTURE_PRIVATE_H */
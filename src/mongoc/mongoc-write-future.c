@@ -0,0 +1,298 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "mongoc-client-private.h"
+#include "mongoc-error.h"
+#include "mongoc-list-private.h"
+#include "mongoc-trace.h"
+#include "mongoc-write-concern-private.h"
+#include "mongoc-write-future.h"
+#include "mongoc-write-future-private.h"
+
+
+/*
+ * A write future is an acknowledged write that was sent without waiting
+ * for its reply. The client keeps the futures in flight in the order they
+ * were sent, all to the same node, and each one's acknowledgement is read
+ * when it is waited on, or before anything else is sent on the client.
+ *
+ * Another write future joins those in flight without reading their
+ * acknowledgements first, and while any are in flight the client sends
+ * without pinging or reconnecting, since either would read from the
+ * connection the acknowledgements are coming on.
+ */
+
+
+static void
+_mongoc_write_future_finish (mongoc_write_future_t *future) /* IN */
+{
+   future->ret = _mongoc_write_result_complete (&future->result,
+                                                &future->reply,
+                                                &future->error);
+   future->client = NULL;
+   future->done = true;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_future_recv --
+ *
+ *       Read the acknowledgement of @future, which must still be in
+ *       flight. Acknowledgements of futures sent before it are held by
+ *       the cluster until they are waited on.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       @future is done and removed from its client.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static void
+_mongoc_write_future_recv (mongoc_write_future_t *future) /* IN */
+{
+   mongoc_client_t *client = future->client;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+
+   client->write_futures = _mongoc_list_remove (client->write_futures,
+                                                future);
+
+   if (_mongoc_cluster_stamp (&client->cluster, future->command.hint) !=
+       future->stamp) {
+      bson_set_error (&future->result.error,
+                      MONGOC_ERROR_STREAM,
+                      MONGOC_ERROR_STREAM_NOT_ESTABLISHED,
+                      "The connection was lost before the write "
+                      "was acknowledged.");
+      future->result.failed = true;
+   } else {
+      _mongoc_write_command_recv (&future->command, client,
+                                  future->request_id, 0, &future->result);
+   }
+
+   _mongoc_write_future_finish (future);
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_future_new_insert --
+ *
+ *       Send an insert of @document into @collection of @database.
+ *
+ *       If the write is acknowledged and the node supports write
+ *       commands, it is left in flight. Otherwise it is performed on the
+ *       spot and the future returned is already done.
+ *
+ * Returns:
+ *       A newly allocated mongoc_write_future_t that should be freed with
+ *       mongoc_write_future_destroy().
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+mongoc_write_future_t *
+_mongoc_write_future_new_insert (mongoc_client_t              *client,        /* IN */
+                                 const char                   *database,      /* IN */
+                                 const char                   *collection,    /* IN */
+                                 const bson_t                 *document,      /* IN */
+                                 const mongoc_write_concern_t *write_concern) /* IN */
+{
+   mongoc_write_future_t *future;
+   mongoc_list_t *iter;
+   uint32_t hint = 0;
+   bool sent = false;
+
+   ENTRY;
+
+   BSON_ASSERT (client);
+   BSON_ASSERT (database);
+   BSON_ASSERT (collection);
+   BSON_ASSERT (document);
+
+   future = bson_malloc0 (sizeof *future);
+   future->client = client;
+   bson_init (&future->reply);
+   _mongoc_write_result_init (&future->result);
+   _mongoc_write_command_init_insert_borrowed (&future->command, &document,
+                                               1, true, false,
+                                               client->oid_gen);
+
+   if (!write_concern) {
+      write_concern = client->write_concern;
+   }
+
+   /* join the futures in flight on their node */
+   for (iter = client->write_futures; iter; iter = iter->next) {
+      hint = ((mongoc_write_future_t *)iter->data)->command.hint;
+   }
+
+   _mongoc_query_cache_invalidate (&client->query_cache, database,
+                                   collection);
+
+   if (_mongoc_write_concern_needs_gle (write_concern)) {
+      client->in_write_future = true;
+      sent = _mongoc_write_command_send (&future->command, client, hint,
+                                         database, collection, write_concern,
+                                         &future->request_id,
+                                         &future->result);
+      client->in_write_future = false;
+   }
+
+   if (!sent) {
+      _mongoc_write_command_execute (&future->command, client, hint,
+                                     database, collection, write_concern, 0,
+                                     &future->result);
+      _mongoc_write_future_finish (future);
+   } else if (!future->request_id) {
+      _mongoc_write_future_finish (future);
+   } else {
+      future->stamp = _mongoc_cluster_stamp (&client->cluster,
+                                             future->command.hint);
+      client->write_futures = _mongoc_list_append (client->write_futures,
+                                                   future);
+   }
+
+   RETURN (future);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * _mongoc_write_future_collect_all --
+ *
+ *       Read the acknowledgements of all the write futures @client has in
+ *       flight.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       Each future is done, with its result kept for when it is waited
+ *       on.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+_mongoc_write_future_collect_all (mongoc_client_t *client) /* IN */
+{
+   ENTRY;
+
+   BSON_ASSERT (client);
+
+   while (client->write_futures) {
+      _mongoc_write_future_recv (client->write_futures->data);
+   }
+
+   EXIT;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_write_future_wait --
+ *
+ *       Wait for the acknowledgement of the write @future was returned
+ *       for. This may be called more than once.
+ *
+ * Returns:
+ *       true if the write succeeded; otherwise false and @error is set.
+ *
+ * Side effects:
+ *       @reply is initialized with the same fields as the reply of
+ *       mongoc_bulk_operation_execute() if it is not NULL. It must be
+ *       freed with bson_destroy().
+ *
+ *--------------------------------------------------------------------------
+ */
+
+bool
+mongoc_write_future_wait (mongoc_write_future_t *future, /* IN */
+                          bson_t                *reply,  /* OUT */
+                          bson_error_t          *error)  /* OUT */
+{
+   ENTRY;
+
+   bson_return_val_if_fail (future, false);
+
+   if (!future->done) {
+      _mongoc_write_future_recv (future);
+   }
+
+   if (reply) {
+      bson_copy_to (&future->reply, reply);
+   }
+
+   if (!future->ret && error) {
+      memcpy (error, &future->error, sizeof *error);
+   }
+
+   RETURN (future->ret);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mongoc_write_future_destroy --
+ *
+ *       Free @future. If its acknowledgement has not been read yet it is
+ *       read now, so that the connection stays in step.
+ *
+ * Returns:
+ *       None.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mongoc_write_future_destroy (mongoc_write_future_t *future) /* IN */
+{
+   ENTRY;
+
+   if (future) {
+      if (!future->done) {
+         _mongoc_write_future_recv (future);
+      }
+
+      _mongoc_write_command_destroy (&future->command);
+      _mongoc_write_result_destroy (&future->result);
+      bson_destroy (&future->reply);
+      bson_free (future);
+   }
+
+   EXIT;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef MONGOC_WRITE_FUTURE_H
+#define MONGOC_WRITE_FUTURE_H
+
+
+#include <bson.h>
+
+
+BSON_BEGIN_DECLS
+
+
+typedef struct _mongoc_write_future_t mongoc_write_future_t;
+
+
+bool mongoc_write_future_wait    (mongoc_write_future_t *future,
+                                  bson_t                *reply,
+                                  bson_error_t          *error);
+void mongoc_write_future_destroy (mongoc_write_future_t *future);
+
+
+BSON_END_DECLS
+
+
+#endif /* MONGOC_WRITE_FUTURE_H */
@@ -22,11 +22,17 @@
 #include <bson.h>
 
 #define MONGOC_INSIDE
+#include "mongoc-apm.h"
+#include "mongoc-async.h"
 #include "mongoc-bulk-operation.h"
+#include "mongoc-bulk-writer.h"
 #include "mongoc-client.h"
 #include "mongoc-client-pool.h"
+#include "mongoc-codec.h"
 #include "mongoc-collection.h"
+#include "mongoc-columns.h"
 #include "mongoc-config.h"
+#include "mongoc-counters.h"
 #include "mongoc-cursor.h"
 #include "mongoc-database.h"
 #include "mongoc-index.h"
@@ -39,16 +45,23 @@
 #include "mongoc-host-list.h"
 #include "mongoc-init.h"
 #include "mongoc-matcher.h"
+#include "mongoc-memory-budget.h"
 #include "mongoc-opcode.h"
 #include "mongoc-log.h"
+#include "mongoc-oplog-watcher.h"
+#include "mongoc-parallel-find.h"
 #include "mongoc-socket.h"
 #include "mongoc-stream.h"
 #include "mongoc-stream-buffered.h"
+#include "mongoc-stream-compressed.h"
 #include "mongoc-stream-file.h"
 #include "mongoc-stream-gridfs.h"
+#include "mongoc-stream-simulated.h"
 #include "mongoc-stream-socket.h"
+#include "mongoc-tailer.h"
 #include "mongoc-uri.h"
 #include "mongoc-write-concern.h"
+#include "mongoc-write-future.h"
 #include "mongoc-version.h"
 #ifdef MONGOC_ENABLE_SSL
 #include "mongoc-rand.h"
@@ -21,11 +21,17 @@
 #ifdef BSON_OS_UNIX
 
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -52,7 +58,15 @@ typedef struct
    uint32_t n_counters;
    uint32_t infos_offset;
    uint32_t values_offset;
-   uint8_t  padding[44];
+   uint32_t n_histograms;
+   uint32_t histogram_infos_offset;
+   uint32_t histogram_values_offset;
+   uint32_t histogram_n_buckets;
+   uint32_t histogram_sub_buckets;
+   uint32_t n_scoped;
+   uint32_t scoped_offset;
+   uint32_t scoped_max;
+   uint8_t  padding[12];
 } mongoc_counters_t;
 #pragma pack()
 
@@ -69,10 +83,27 @@ typedef struct
 BSON_STATIC_ASSERT(sizeof(mongoc_counter_slots_t) == 64);
 
 
+#define MONGOC_SCOPED_COUNTERS_N_BUCKETS 24
+
+
 typedef struct
 {
-   mongoc_counter_slots_t *cpus;
-} mongoc_counter_t;
+   uint32_t kind;
+   uint32_t padding0;
+   char     key[120];
+   int64_t  egress_ops;
+   int64_t  ingress_ops;
+   int64_t  egress_bytes;
+   int64_t  ingress_bytes;
+   int64_t  errors;
+   int64_t  timeouts;
+   int64_t  in_flight;
+   int64_t  concurrency_limit;
+   int64_t  latency_usec[MONGOC_SCOPED_COUNTERS_N_BUCKETS];
+} mongoc_scoped_counters_t;
+
+
+BSON_STATIC_ASSERT(sizeof(mongoc_scoped_counters_t) == 384);
 
 
 static mongoc_counters_t *
@@ -149,48 +180,969 @@ mongoc_counters_get_infos (mongoc_counters_t *counters,
 }
 
 
+#define MONGOC_STAT_N_QUANTILES 4
+
+
+static const double gQuantiles[MONGOC_STAT_N_QUANTILES] = {
+   0.5, 0.9, 0.99, 0.999
+};
+static const char *gQuantileNames[MONGOC_STAT_N_QUANTILES] = {
+   "p50", "p90", "p99", "p99.9"
+};
+
+
+typedef enum
+{
+   MONGOC_STAT_TEXT,
+   MONGOC_STAT_JSON,
+   MONGOC_STAT_PROMETHEUS,
+} mongoc_stat_format_t;
+
+
+/*
+ * The counters of a process at one point in time: the value of each
+ * counter, the buckets of each histogram summed over all CPUs, and a copy
+ * of the scoped counters.
+ */
+typedef struct
+{
+   int64_t                   time;
+   int64_t                  *values;
+   int64_t                  *buckets;
+   mongoc_scoped_counters_t *scoped;
+   uint32_t                  n_scoped;
+} mongoc_stat_sample_t;
+
+
+/*
+ * A watched process. The last two samples are kept to derive rates from.
+ */
+typedef struct
+{
+   unsigned               pid;
+   bool                   exited;
+   mongoc_counters_t     *counters;
+   mongoc_counter_info_t *infos;
+   uint32_t               n_infos;
+   mongoc_counter_info_t *histogram_infos;
+   uint32_t               n_histogram_infos;
+   mongoc_stat_sample_t   samples[2];
+   uint64_t               n_samples;
+} mongoc_stat_process_t;
+
+
+static const void *
+mongoc_counters_at (mongoc_counters_t *counters,
+                    uint32_t           offset)
+{
+   return ((const char *)counters) + offset;
+}
+
+
 static int64_t
 mongoc_counters_get_value (mongoc_counters_t     *counters,
-                           mongoc_counter_info_t *info,
-                           mongoc_counter_t      *counter)
+                           mongoc_counter_info_t *info)
 {
+   const mongoc_counter_slots_t *cpus;
    int64_t value = 0;
    unsigned i;
 
+   BSON_ASSERT ((info->offset & 0x7) == 0);
+
+   cpus = mongoc_counters_at (counters, info->offset);
+
    for (i = 0; i < counters->n_cpu; i++) {
-      value += counter->cpus[i].slots[info->slot];
+      value += cpus[i].slots[info->slot];
    }
 
    return value;
 }
 
 
+static mongoc_counter_info_t *
+mongoc_counters_get_histogram_infos (mongoc_counters_t *counters,
+                                     uint32_t          *n_infos)
+{
+   char *base = (char *)counters;
+
+   BSON_ASSERT(counters);
+   BSON_ASSERT(n_infos);
+
+   *n_infos = counters->n_histograms;
+
+   return (mongoc_counter_info_t *)(base + counters->histogram_infos_offset);
+}
+
+
 static void
-mongoc_counters_print_info (mongoc_counters_t     *counters,
-                            mongoc_counter_info_t *info,
-                            FILE                  *file)
+mongoc_counters_get_buckets (mongoc_counters_t     *counters,
+                             mongoc_counter_info_t *info,
+                             int64_t               *buckets)
 {
-   mongoc_counter_t ctr;
-   int64_t value;
+   const int64_t *cpu;
+   unsigned n_buckets;
+   unsigned i;
+   unsigned j;
 
-   BSON_ASSERT (info);
-   BSON_ASSERT (file);
    BSON_ASSERT ((info->offset & 0x7) == 0);
 
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wcast-align"
-#endif
-   ctr.cpus = (mongoc_counter_slots_t *)(((char *)counters)+ info->offset);
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
+   n_buckets = counters->histogram_n_buckets;
+   memset (buckets, 0, n_buckets * sizeof *buckets);
+
+   cpu = mongoc_counters_at (counters, info->offset);
+
+   for (i = 0; i < counters->n_cpu; i++, cpu += n_buckets) {
+      for (j = 0; j < n_buckets; j++) {
+         buckets[j] += cpu[j];
+      }
+   }
+}
+
+
+/*
+ * The smallest value counted in @bucket, see _mongoc_histogram_bucket()
+ * in mongoc-counters-private.h.
+ */
+static int64_t
+mongoc_histogram_bucket_min (mongoc_counters_t *counters,
+                             uint32_t           bucket)
+{
+   uint32_t sub = counters->histogram_sub_buckets;
+   uint32_t sub_bits = 0;
+   uint32_t msb;
+
+   if (bucket < sub) {
+      return bucket;
+   }
+
+   while ((1U << sub_bits) < sub) {
+      sub_bits++;
+   }
+
+   msb = (bucket / sub) + sub_bits - 1;
+
+   return (int64_t)(sub + (bucket % sub)) << (msb - sub_bits);
+}
+
+
+/*
+ * Compute the gQuantiles of @buckets, less the samples in @prev unless it
+ * is NULL, into @percentiles, and return the number of samples. A bucket
+ * of a histogram stands for its smallest value; latency bucket i of the
+ * scoped counters counts round trips of up to 2^i - 1 microseconds, so
+ * those percentiles are upper bounds.
+ */
+static int64_t
+mongoc_stat_percentiles (mongoc_counters_t *counters,
+                         const int64_t     *buckets,
+                         const int64_t     *prev,
+                         unsigned           n_buckets,
+                         bool               scoped,
+                         int64_t            percentiles[MONGOC_STAT_N_QUANTILES])
+{
+   int64_t total = 0;
+   int64_t seen = 0;
+   unsigned q = 0;
+   unsigned i;
+
+   memset (percentiles, 0, MONGOC_STAT_N_QUANTILES * sizeof *percentiles);
+
+   for (i = 0; i < n_buckets; i++) {
+      total += buckets[i] - (prev ? prev[i] : 0);
+   }
+
+   for (i = 0; total > 0 && i < n_buckets && q < MONGOC_STAT_N_QUANTILES;
+        i++) {
+      seen += buckets[i] - (prev ? prev[i] : 0);
+      while (q < MONGOC_STAT_N_QUANTILES &&
+             seen >= (int64_t)(gQuantiles[q] * total + 0.5)) {
+         percentiles[q++] = scoped ? ((int64_t)1 << i) - 1 :
+                                     mongoc_histogram_bucket_min (counters, i);
+      }
+   }
+
+   return total;
+}
+
+
+static bool
+mongoc_stat_process_init (mongoc_stat_process_t *process,
+                          unsigned               pid)
+{
+   mongoc_counters_t *counters;
+   size_t n_buckets;
+   unsigned i;
+
+   memset (process, 0, sizeof *process);
+
+   process->pid = pid;
+
+   if (!(counters = mongoc_counters_new_from_pid (pid))) {
+      return false;
+   }
+
+   process->counters = counters;
+   process->infos = mongoc_counters_get_infos (counters, &process->n_infos);
+   process->histogram_infos =
+      mongoc_counters_get_histogram_infos (counters,
+                                           &process->n_histogram_infos);
+
+   n_buckets = (size_t)process->n_histogram_infos *
+               counters->histogram_n_buckets;
+
+   for (i = 0; i < 2; i++) {
+      process->samples[i].values = calloc (process->n_infos + 1,
+                                           sizeof (int64_t));
+      process->samples[i].buckets = calloc (n_buckets + 1, sizeof (int64_t));
+      process->samples[i].scoped = calloc (counters->scoped_max + 1,
+                                           sizeof (mongoc_scoped_counters_t));
+   }
+
+   return true;
+}
+
+
+static void
+mongoc_stat_process_destroy (mongoc_stat_process_t *process)
+{
+   unsigned i;
+
+   for (i = 0; i < 2; i++) {
+      free (process->samples[i].values);
+      free (process->samples[i].buckets);
+      free (process->samples[i].scoped);
+   }
+
+   if (process->counters) {
+      mongoc_counters_destroy (process->counters);
+   }
+}
+
+
+static void
+mongoc_stat_process_sample (mongoc_stat_process_t *process)
+{
+   mongoc_counters_t *counters = process->counters;
+   const mongoc_scoped_counters_t *scoped;
+   mongoc_stat_sample_t *sample;
+   uint32_t i;
+
+   sample = &process->samples[process->n_samples++ & 1];
+   sample->time = bson_get_monotonic_time ();
+
+   for (i = 0; i < process->n_infos; i++) {
+      sample->values[i] = mongoc_counters_get_value (counters,
+                                                     &process->infos[i]);
+   }
+
+   for (i = 0; i < process->n_histogram_infos; i++) {
+      mongoc_counters_get_buckets (counters, &process->histogram_infos[i],
+                                   sample->buckets +
+                                   i * counters->histogram_n_buckets);
+   }
+
+   /*
+    * Scoped counters are only appended, and counted in n_scoped once their
+    * key is set.
+    */
+   sample->n_scoped = BSON_MIN (counters->n_scoped, counters->scoped_max);
+   bson_memory_barrier ();
+
+   scoped = mongoc_counters_at (counters, counters->scoped_offset);
+   memcpy (sample->scoped, scoped, sample->n_scoped * sizeof *scoped);
+
+   for (i = 0; i < sample->n_scoped; i++) {
+      sample->scoped[i].key[sizeof sample->scoped[i].key - 1] = '\0';
+   }
+}
+
+
+static const mongoc_stat_sample_t *
+mongoc_stat_process_current (const mongoc_stat_process_t *process)
+{
+   return &process->samples[(process->n_samples - 1) & 1];
+}
+
+
+/*
+ * The sample before the current one, or NULL after the first sample.
+ */
+static const mongoc_stat_sample_t *
+mongoc_stat_process_previous (const mongoc_stat_process_t *process)
+{
+   if (process->n_samples < 2) {
+      return NULL;
+   }
+
+   return &process->samples[process->n_samples & 1];
+}
+
+
+static const mongoc_scoped_counters_t *
+mongoc_stat_sample_scoped (const mongoc_stat_sample_t *sample,
+                           uint32_t                    i)
+{
+   static const mongoc_scoped_counters_t zero;
+
+   return (sample && i < sample->n_scoped) ? &sample->scoped[i] : &zero;
+}
+
+
+static double
+mongoc_stat_rate (int64_t                     value,
+                  int64_t                     prev_value,
+                  const mongoc_stat_sample_t *cur,
+                  const mongoc_stat_sample_t *prev)
+{
+   int64_t usec = cur->time - prev->time;
+
+   return (usec > 0) ? (value - prev_value) * 1000000.0 / usec : 0.0;
+}
+
+
+/*
+ * Print the counters of @process. After the first sample, counters are
+ * printed with their rate, and histograms and scoped counters for the
+ * last interval only.
+ */
+static void
+mongoc_stat_print_text (const mongoc_stat_process_t *process,
+                        bool                         print_pid,
+                        FILE                        *file)
+{
+   const mongoc_scoped_counters_t *prev_scoped;
+   const mongoc_scoped_counters_t *scoped;
+   const mongoc_stat_sample_t *prev;
+   const mongoc_stat_sample_t *cur;
+   const mongoc_counter_info_t *info;
+   int64_t percentiles[MONGOC_STAT_N_QUANTILES];
+   unsigned n_buckets;
+   int64_t total;
+   uint32_t i;
+
+   cur = mongoc_stat_process_current (process);
+   prev = mongoc_stat_process_previous (process);
+   n_buckets = process->counters->histogram_n_buckets;
+
+   if (print_pid) {
+      fprintf (file, "%24s : %u\n", "Process", process->pid);
+   }
+
+   for (i = 0; i < process->n_infos; i++) {
+      info = &process->infos[i];
+
+      if (prev) {
+         fprintf (file, "%24s : %-24s : %16lld : %12.1f/s\n",
+                  info->category, info->name, (long long)cur->values[i],
+                  mongoc_stat_rate (cur->values[i], prev->values[i], cur,
+                                    prev));
+      } else {
+         fprintf (file, "%24s : %-24s : %-50s : %lld\n",
+                  info->category, info->name, info->description,
+                  (long long)cur->values[i]);
+      }
+   }
+
+   for (i = 0; i < process->n_histogram_infos; i++) {
+      info = &process->histogram_infos[i];
+      total = mongoc_stat_percentiles (process->counters,
+                                       cur->buckets + i * n_buckets,
+                                       prev ? prev->buckets + i * n_buckets :
+                                              NULL,
+                                       n_buckets, false, percentiles);
+
+      if (prev) {
+         fprintf (file, "%24s : %-24s : %12.1f/s p50=%lld p90=%lld "
+                  "p99=%lld p99.9=%lld\n",
+                  info->category, info->name,
+                  mongoc_stat_rate (total, 0, cur, prev),
+                  (long long)percentiles[0], (long long)percentiles[1],
+                  (long long)percentiles[2], (long long)percentiles[3]);
+      } else {
+         fprintf (file, "%24s : %-24s : %-50s : n=%lld p50=%lld p90=%lld "
+                  "p99=%lld p99.9=%lld\n",
+                  info->category, info->name, info->description,
+                  (long long)total, (long long)percentiles[0],
+                  (long long)percentiles[1], (long long)percentiles[2],
+                  (long long)percentiles[3]);
+      }
+   }
 
-   value = mongoc_counters_get_value(counters, info, &ctr);
+   for (i = 0; i < cur->n_scoped; i++) {
+      scoped = &cur->scoped[i];
+      prev_scoped = mongoc_stat_sample_scoped (prev, i);
+      mongoc_stat_percentiles (process->counters, scoped->latency_usec,
+                               prev ? prev_scoped->latency_usec : NULL,
+                               MONGOC_SCOPED_COUNTERS_N_BUCKETS, true,
+                               percentiles);
+
+      if (prev) {
+         fprintf (file, "%24s : %-48s : ops/s=%.1f/%.1f bytes/s=%.1f/%.1f "
+                  "errors/s=%.1f timeouts/s=%.1f p50<=%lld p99<=%lld",
+                  (scoped->kind == 1) ? "Node" : "Namespace", scoped->key,
+                  mongoc_stat_rate (scoped->egress_ops,
+                                    prev_scoped->egress_ops, cur, prev),
+                  mongoc_stat_rate (scoped->ingress_ops,
+                                    prev_scoped->ingress_ops, cur, prev),
+                  mongoc_stat_rate (scoped->egress_bytes,
+                                    prev_scoped->egress_bytes, cur, prev),
+                  mongoc_stat_rate (scoped->ingress_bytes,
+                                    prev_scoped->ingress_bytes, cur, prev),
+                  mongoc_stat_rate (scoped->errors,
+                                    prev_scoped->errors, cur, prev),
+                  mongoc_stat_rate (scoped->timeouts,
+                                    prev_scoped->timeouts, cur, prev),
+                  (long long)percentiles[0], (long long)percentiles[2]);
+      } else {
+         fprintf (file, "%24s : %-48s : ops=%lld/%lld bytes=%lld/%lld "
+                  "errors=%lld timeouts=%lld p50<=%lld p99<=%lld",
+                  (scoped->kind == 1) ? "Node" : "Namespace", scoped->key,
+                  (long long)scoped->egress_ops,
+                  (long long)scoped->ingress_ops,
+                  (long long)scoped->egress_bytes,
+                  (long long)scoped->ingress_bytes,
+                  (long long)scoped->errors, (long long)scoped->timeouts,
+                  (long long)percentiles[0], (long long)percentiles[2]);
+      }
+
+      if (scoped->concurrency_limit) {
+         fprintf (file, " in_flight=%lld/%lld",
+                  (long long)scoped->in_flight,
+                  (long long)scoped->concurrency_limit);
+      }
+
+      fprintf (file, "\n");
+   }
+}
+
+
+static void
+mongoc_stat_append_percentiles (bson_t        *doc,
+                                int64_t        total,
+                                const int64_t *percentiles)
+{
+   unsigned q;
+
+   BSON_APPEND_INT64 (doc, "n", total);
+
+   for (q = 0; q < MONGOC_STAT_N_QUANTILES; q++) {
+      BSON_APPEND_INT64 (doc, gQuantileNames[q], percentiles[q]);
+   }
+}
+
+
+/*
+ * Print the counters of @process as one line of JSON. Values are totals;
+ * after the first sample, each also has its rate over the interval and
+ * histograms have their percentiles over the interval in "interval".
+ */
+static void
+mongoc_stat_print_json (const mongoc_stat_process_t *process,
+                        FILE                        *file)
+{
+   static const struct {
+      const char *name;
+      size_t      offset;
+   } fields[] = {
+      { "egress_ops", offsetof (mongoc_scoped_counters_t, egress_ops) },
+      { "ingress_ops", offsetof (mongoc_scoped_counters_t, ingress_ops) },
+      { "egress_bytes", offsetof (mongoc_scoped_counters_t, egress_bytes) },
+      { "ingress_bytes", offsetof (mongoc_scoped_counters_t, ingress_bytes) },
+      { "errors", offsetof (mongoc_scoped_counters_t, errors) },
+      { "timeouts", offsetof (mongoc_scoped_counters_t, timeouts) },
+   };
+   const mongoc_scoped_counters_t *prev_scoped;
+   const mongoc_scoped_counters_t *scoped;
+   const mongoc_stat_sample_t *prev;
+   const mongoc_stat_sample_t *cur;
+   const mongoc_counter_info_t *info;
+   int64_t percentiles[MONGOC_STAT_N_QUANTILES];
+   struct timeval tv;
+   unsigned n_buckets;
+   const char *key;
+   int64_t total;
+   int64_t value;
+   int64_t prev_value;
+   char keybuf[16];
+   char name[32];
+   bson_t interval;
+   bson_t array;
+   bson_t child;
+   bson_t doc;
+   uint32_t i;
+   unsigned j;
+   char *str;
+
+   cur = mongoc_stat_process_current (process);
+   prev = mongoc_stat_process_previous (process);
+   n_buckets = process->counters->histogram_n_buckets;
+
+   bson_gettimeofday (&tv);
+
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "pid", (int32_t)process->pid);
+   BSON_APPEND_INT64 (&doc, "time",
+                      (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000);
+   if (prev) {
+      BSON_APPEND_DOUBLE (&doc, "interval",
+                          (cur->time - prev->time) / 1000000.0);
+   }
+
+   BSON_APPEND_ARRAY_BEGIN (&doc, "counters", &array);
+   for (i = 0; i < process->n_infos; i++) {
+      info = &process->infos[i];
+      bson_uint32_to_string (i, &key, keybuf, sizeof keybuf);
+      bson_append_document_begin (&array, key, -1, &child);
+      BSON_APPEND_UTF8 (&child, "category", info->category);
+      BSON_APPEND_UTF8 (&child, "name", info->name);
+      BSON_APPEND_INT64 (&child, "value", cur->values[i]);
+      if (prev) {
+         BSON_APPEND_DOUBLE (&child, "rate",
+                             mongoc_stat_rate (cur->values[i],
+                                               prev->values[i], cur, prev));
+      }
+      bson_append_document_end (&array, &child);
+   }
+   bson_append_array_end (&doc, &array);
+
+   BSON_APPEND_ARRAY_BEGIN (&doc, "histograms", &array);
+   for (i = 0; i < process->n_histogram_infos; i++) {
+      info = &process->histogram_infos[i];
+      bson_uint32_to_string (i, &key, keybuf, sizeof keybuf);
+      bson_append_document_begin (&array, key, -1, &child);
+      BSON_APPEND_UTF8 (&child, "category", info->category);
+      BSON_APPEND_UTF8 (&child, "name", info->name);
+      total = mongoc_stat_percentiles (process->counters,
+                                       cur->buckets + i * n_buckets, NULL,
+                                       n_buckets, false, percentiles);
+      mongoc_stat_append_percentiles (&child, total, percentiles);
+      if (prev) {
+         total = mongoc_stat_percentiles (process->counters,
+                                          cur->buckets + i * n_buckets,
+                                          prev->buckets + i * n_buckets,
+                                          n_buckets, false, percentiles);
+         BSON_APPEND_DOCUMENT_BEGIN (&child, "interval", &interval);
+         mongoc_stat_append_percentiles (&interval, total, percentiles);
+         BSON_APPEND_DOUBLE (&interval, "rate",
+                             mongoc_stat_rate (total, 0, cur, prev));
+         bson_append_document_end (&child, &interval);
+      }
+      bson_append_document_end (&array, &child);
+   }
+   bson_append_array_end (&doc, &array);
+
+   BSON_APPEND_ARRAY_BEGIN (&doc, "scoped", &array);
+   for (i = 0; i < cur->n_scoped; i++) {
+      scoped = &cur->scoped[i];
+      prev_scoped = mongoc_stat_sample_scoped (prev, i);
+      bson_uint32_to_string (i, &key, keybuf, sizeof keybuf);
+      bson_append_document_begin (&array, key, -1, &child);
+      BSON_APPEND_UTF8 (&child, "kind",
+                        (scoped->kind == 1) ? "node" : "namespace");
+      BSON_APPEND_UTF8 (&child, "key", scoped->key);
+      for (j = 0; j < sizeof fields / sizeof fields[0]; j++) {
+         memcpy (&value, (const char *)scoped + fields[j].offset,
+                 sizeof value);
+         BSON_APPEND_INT64 (&child, fields[j].name, value);
+         if (prev) {
+            memcpy (&prev_value, (const char *)prev_scoped + fields[j].offset,
+                    sizeof prev_value);
+            bson_snprintf (name, sizeof name, "%s_rate", fields[j].name);
+            BSON_APPEND_DOUBLE (&child, name,
+                                mongoc_stat_rate (value, prev_value, cur,
+                                                  prev));
+         }
+      }
+      mongoc_stat_percentiles (process->counters, scoped->latency_usec,
+                               prev ? prev_scoped->latency_usec : NULL,
+                               MONGOC_SCOPED_COUNTERS_N_BUCKETS, true,
+                               percentiles);
+      BSON_APPEND_INT64 (&child, "p50_max", percentiles[0]);
+      BSON_APPEND_INT64 (&child, "p99_max", percentiles[2]);
+      if (scoped->concurrency_limit) {
+         BSON_APPEND_INT64 (&child, "in_flight", scoped->in_flight);
+         BSON_APPEND_INT64 (&child, "concurrency_limit",
+                            scoped->concurrency_limit);
+      }
+      bson_append_document_end (&array, &child);
+   }
+   bson_append_array_end (&doc, &array);
+
+   str = bson_as_json (&doc, NULL);
+   fprintf (file, "%s\n", str);
+   bson_free (str);
+   bson_destroy (&doc);
+}
+
+
+/*
+ * Build a Prometheus metric name such as "mongoc_operations_egress_total"
+ * from a counter's category and name.
+ */
+static void
+mongoc_stat_metric_name (const mongoc_counter_info_t *info,
+                         char                        *buf,
+                         size_t                       len)
+{
+   const char *parts[2];
+   const char *c;
+   size_t pos;
+   unsigned i;
+
+   parts[0] = info->category;
+   parts[1] = info->name;
+
+   pos = bson_snprintf (buf, len, "mongoc");
+
+   for (i = 0; i < 2; i++) {
+      if (pos + 1 < len && buf[pos - 1] != '_') {
+         buf[pos++] = '_';
+      }
+      for (c = parts[i]; *c && pos + 1 < len; c++) {
+         if ((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9')) {
+            buf[pos++] = *c;
+         } else if (*c >= 'A' && *c <= 'Z') {
+            buf[pos++] = *c - 'A' + 'a';
+         } else if (buf[pos - 1] != '_') {
+            buf[pos++] = '_';
+         }
+      }
+   }
+
+   while (pos > 0 && buf[pos - 1] == '_') {
+      pos--;
+   }
+
+   buf[pos] = '\0';
+}
+
+
+static void
+mongoc_stat_print_label (const char *value,
+                         FILE       *file)
+{
+   for (; *value; value++) {
+      if (*value == '\n') {
+         fputs ("\\n", file);
+         continue;
+      }
+      if (*value == '\\' || *value == '"') {
+         fputc ('\\', file);
+      }
+      fputc (*value, file);
+   }
+}
+
+
+/*
+ * The index of the counter named like @info in @infos, or -1. @hint is
+ * tried first, since processes running the same driver share a layout.
+ */
+static int32_t
+mongoc_stat_find_info (const mongoc_counter_info_t *infos,
+                       uint32_t                     n_infos,
+                       const mongoc_counter_info_t *info,
+                       uint32_t                     hint)
+{
+   uint32_t i;
+
+   if (hint < n_infos &&
+       !strcmp (infos[hint].category, info->category) &&
+       !strcmp (infos[hint].name, info->name)) {
+      return hint;
+   }
+
+   for (i = 0; i < n_infos; i++) {
+      if (!strcmp (infos[i].category, info->category) &&
+          !strcmp (infos[i].name, info->name)) {
+         return i;
+      }
+   }
 
-   fprintf(file, "%24s : %-24s : %-50s : %lld\n",
-           info->category, info->name, info->description,
-           (long long)value);
+   return -1;
+}
+
+
+/*
+ * Print the counters of all @processes in the Prometheus text format. The
+ * samples of a metric must be grouped together, so each metric is printed
+ * for all processes before the next one, the first process that has it
+ * deciding where.
+ */
+static void
+mongoc_stat_print_prometheus (const mongoc_stat_process_t *processes,
+                              unsigned                     n_processes,
+                              FILE                        *file)
+{
+   static const struct {
+      const char *name;
+      const char *help;
+      size_t      offset;
+   } fields[] = {
+      { "egress_ops", "Operations sent.",
+        offsetof (mongoc_scoped_counters_t, egress_ops) },
+      { "ingress_ops", "Replies received.",
+        offsetof (mongoc_scoped_counters_t, ingress_ops) },
+      { "egress_bytes", "Bytes sent.",
+        offsetof (mongoc_scoped_counters_t, egress_bytes) },
+      { "ingress_bytes", "Bytes received.",
+        offsetof (mongoc_scoped_counters_t, ingress_bytes) },
+      { "errors", "I/O errors.",
+        offsetof (mongoc_scoped_counters_t, errors) },
+      { "timeouts", "Timeouts.",
+        offsetof (mongoc_scoped_counters_t, timeouts) },
+   };
+   const mongoc_scoped_counters_t *scoped;
+   const mongoc_stat_process_t *process;
+   const mongoc_stat_process_t *other;
+   const mongoc_stat_sample_t *cur;
+   const mongoc_counter_info_t *info;
+   int64_t percentiles[MONGOC_STAT_N_QUANTILES];
+   unsigned n_buckets;
+   int64_t total;
+   int64_t value;
+   char name[128];
+   bool printed;
+   int32_t found;
+   unsigned p;
+   unsigned o;
+   unsigned q;
+   uint32_t i;
+   uint32_t j;
+
+   for (p = 0; p < n_processes; p++) {
+      process = &processes[p];
+      if (process->exited) {
+         continue;
+      }
+
+      for (i = 0; i < process->n_infos; i++) {
+         info = &process->infos[i];
+
+         for (o = 0, printed = false; o < p && !printed; o++) {
+            printed = !processes[o].exited &&
+                      mongoc_stat_find_info (processes[o].infos,
+                                             processes[o].n_infos,
+                                             info, i) >= 0;
+         }
+         if (printed) {
+            continue;
+         }
+
+         mongoc_stat_metric_name (info, name, sizeof name);
+         fprintf (file, "# HELP %s %s\n# TYPE %s untyped\n",
+                  name, info->description, name);
+
+         for (o = p; o < n_processes; o++) {
+            other = &processes[o];
+            if (other->exited ||
+                (found = mongoc_stat_find_info (other->infos, other->n_infos,
+                                                info, i)) < 0) {
+               continue;
+            }
+            cur = mongoc_stat_process_current (other);
+            fprintf (file, "%s{pid=\"%u\"} %lld\n",
+                     name, other->pid, (long long)cur->values[found]);
+         }
+      }
+
+      for (i = 0; i < process->n_histogram_infos; i++) {
+         info = &process->histogram_infos[i];
+
+         for (o = 0, printed = false; o < p && !printed; o++) {
+            printed = !processes[o].exited &&
+                      mongoc_stat_find_info (processes[o].histogram_infos,
+                                             processes[o].n_histogram_infos,
+                                             info, i) >= 0;
+         }
+         if (printed) {
+            continue;
+         }
+
+         mongoc_stat_metric_name (info, name, sizeof name);
+         fprintf (file, "# HELP %s %s\n# TYPE %s summary\n",
+                  name, info->description, name);
+
+         for (o = p; o < n_processes; o++) {
+            other = &processes[o];
+            if (other->exited ||
+                (found = mongoc_stat_find_info (other->histogram_infos,
+                                                other->n_histogram_infos,
+                                                info, i)) < 0) {
+               continue;
+            }
+            cur = mongoc_stat_process_current (other);
+            n_buckets = other->counters->histogram_n_buckets;
+            total = mongoc_stat_percentiles (other->counters,
+                                             cur->buckets + found * n_buckets,
+                                             NULL, n_buckets, false,
+                                             percentiles);
+            for (q = 0; q < MONGOC_STAT_N_QUANTILES; q++) {
+               fprintf (file, "%s{pid=\"%u\",quantile=\"%g\"} %lld\n",
+                        name, other->pid, gQuantiles[q],
+                        (long long)percentiles[q]);
+            }
+            fprintf (file, "%s_count{pid=\"%u\"} %lld\n",
+                     name, other->pid, (long long)total);
+         }
+      }
+   }
+
+   for (i = 0; i < sizeof fields / sizeof fields[0]; i++) {
+      fprintf (file, "# HELP mongoc_scoped_%s_total %s\n"
+               "# TYPE mongoc_scoped_%s_total counter\n",
+               fields[i].name, fields[i].help, fields[i].name);
+
+      for (p = 0; p < n_processes; p++) {
+         process = &processes[p];
+         if (process->exited) {
+            continue;
+         }
+         cur = mongoc_stat_process_current (process);
+         for (j = 0; j < cur->n_scoped; j++) {
+            scoped = &cur->scoped[j];
+            memcpy (&value, (const char *)scoped + fields[i].offset,
+                    sizeof value);
+            fprintf (file, "mongoc_scoped_%s_total{pid=\"%u\",kind=\"%s\","
+                     "key=\"", fields[i].name, process->pid,
+                     (scoped->kind == 1) ? "node" : "namespace");
+            mongoc_stat_print_label (scoped->key, file);
+            fprintf (file, "\"} %lld\n", (long long)value);
+         }
+      }
+   }
+
+   fprintf (file, "# HELP mongoc_scoped_latency_usec Upper bound of the "
+            "round-trip latency.\n# TYPE mongoc_scoped_latency_usec "
+            "summary\n");
+
+   for (p = 0; p < n_processes; p++) {
+      process = &processes[p];
+      if (process->exited) {
+         continue;
+      }
+      cur = mongoc_stat_process_current (process);
+      for (j = 0; j < cur->n_scoped; j++) {
+         scoped = &cur->scoped[j];
+         total = mongoc_stat_percentiles (process->counters,
+                                          scoped->latency_usec, NULL,
+                                          MONGOC_SCOPED_COUNTERS_N_BUCKETS,
+                                          true, percentiles);
+         for (q = 0; q <= MONGOC_STAT_N_QUANTILES; q++) {
+            if (q == MONGOC_STAT_N_QUANTILES) {
+               fprintf (file, "mongoc_scoped_latency_usec_count{");
+            } else {
+               fprintf (file, "mongoc_scoped_latency_usec{quantile=\"%g\",",
+                        gQuantiles[q]);
+            }
+            fprintf (file, "pid=\"%u\",kind=\"%s\",key=\"", process->pid,
+                     (scoped->kind == 1) ? "node" : "namespace");
+            mongoc_stat_print_label (scoped->key, file);
+            fprintf (file, "\"} %lld\n",
+                     (long long)((q == MONGOC_STAT_N_QUANTILES) ?
+                                 total : percentiles[q]));
+         }
+      }
+   }
+}
+
+
+/*
+ * Print the last sample of each process still running, to stdout or
+ * else replacing the file at @path with rename() so that a scraper never
+ * reads it half written.
+ */
+static bool
+mongoc_stat_print (const mongoc_stat_process_t *processes,
+                   unsigned                     n_processes,
+                   mongoc_stat_format_t         format,
+                   const char                  *path,
+                   bool                         clear)
+{
+   char tmp_path[PATH_MAX];
+   FILE *file = stdout;
+   unsigned n_running = 0;
+   unsigned i;
+
+   for (i = 0; i < n_processes; i++) {
+      n_running += !processes[i].exited;
+   }
+
+   if (path) {
+      if (bson_snprintf (tmp_path, sizeof tmp_path, "%s.tmp", path) >=
+          (int)sizeof tmp_path) {
+         fprintf (stderr, "Output path is too long.\n");
+         return false;
+      }
+      if (!(file = fopen (tmp_path, "w"))) {
+         perror ("Failed to open output file");
+         return false;
+      }
+   } else if (clear) {
+      fputs ("\033[H\033[2J", file);
+   }
+
+   if (format == MONGOC_STAT_PROMETHEUS) {
+      mongoc_stat_print_prometheus (processes, n_processes, file);
+   } else {
+      for (i = 0; i < n_processes; i++) {
+         if (processes[i].exited) {
+            continue;
+         }
+         if (format == MONGOC_STAT_JSON) {
+            mongoc_stat_print_json (&processes[i], file);
+         } else {
+            mongoc_stat_print_text (&processes[i], n_running > 1, file);
+         }
+      }
+   }
+
+   if (path) {
+      if (0 != fclose (file) || 0 != rename (tmp_path, path)) {
+         perror ("Failed to write output file");
+         return false;
+      }
+   } else {
+      fflush (file);
+   }
+
+   return true;
+}
+
+
+static void
+mongoc_stat_sleep_until (int64_t deadline)
+{
+   struct timespec ts;
+   int64_t usec;
+
+   usec = deadline - bson_get_monotonic_time ();
+
+   if (usec > 0) {
+      ts.tv_sec = usec / 1000000;
+      ts.tv_nsec = (usec % 1000000) * 1000;
+      nanosleep (&ts, NULL);
+   }
+}
+
+
+static void
+usage (const char *prog,
+       FILE       *file)
+{
+   fprintf (file,
+            "usage: %s [-i SECONDS [-n COUNT]] [-f text|json|prometheus] "
+            "[-o FILE] PID...\n"
+            "\n"
+            "  -i SECONDS  Sample every SECONDS and print rates over each "
+            "interval.\n"
+            "  -n COUNT    Stop after COUNT samples.\n"
+            "  -f FORMAT   Print text (the default), a line of JSON per "
+            "process,\n"
+            "              or the Prometheus text format.\n"
+            "  -o FILE     Replace FILE with each sample instead of "
+            "printing it.\n",
+            prog);
 }
 
 
@@ -198,31 +1150,141 @@ int
 main (int   argc,
       char *argv[])
 {
-   mongoc_counter_info_t *infos;
-   mongoc_counters_t *counters;
-   uint32_t n_counters = 0;
+   mongoc_stat_format_t format = MONGOC_STAT_TEXT;
+   mongoc_stat_process_t *processes;
+   const char *output = NULL;
+   unsigned n_processes;
+   unsigned n_running;
+   int64_t interval = 0;
+   int64_t deadline;
+   int64_t count = 0;
+   int64_t n;
+   double secs;
+   bool clear;
+   int ret = EXIT_FAILURE;
+   char *end;
    unsigned i;
-   int pid;
+   long pid;
+   int opt;
 
-   if (argc != 2) {
-      fprintf(stderr, "usage: %s PID\n", argv[0]);
-      return 1;
+   while (-1 != (opt = getopt (argc, argv, "f:hi:n:o:"))) {
+      switch (opt) {
+      case 'f':
+         if (!strcmp (optarg, "text")) {
+            format = MONGOC_STAT_TEXT;
+         } else if (!strcmp (optarg, "json")) {
+            format = MONGOC_STAT_JSON;
+         } else if (!strcmp (optarg, "prometheus")) {
+            format = MONGOC_STAT_PROMETHEUS;
+         } else {
+            usage (argv[0], stderr);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'h':
+         usage (argv[0], stdout);
+         return EXIT_SUCCESS;
+      case 'i':
+         secs = strtod (optarg, &end);
+         if (*end || !(secs > 0)) {
+            usage (argv[0], stderr);
+            return EXIT_FAILURE;
+         }
+         interval = BSON_MAX ((int64_t)(secs * 1000000), 1);
+         break;
+      case 'n':
+         count = strtoll (optarg, &end, 10);
+         if (*end || count <= 0) {
+            usage (argv[0], stderr);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'o':
+         output = optarg;
+         break;
+      default:
+         usage (argv[0], stderr);
+         return EXIT_FAILURE;
+      }
    }
 
-   pid = strtol(argv[1], NULL, 10);
-   if (!(counters = mongoc_counters_new_from_pid (pid))) {
-      fprintf (stderr, "Failed to load shared memory for pid %u.\n", pid);
+   if (optind == argc) {
+      usage (argv[0], stderr);
       return EXIT_FAILURE;
    }
 
-   infos = mongoc_counters_get_infos (counters, &n_counters);
-   for (i = 0; i < n_counters; i++) {
-      mongoc_counters_print_info (counters, &infos[i], stdout);
+   /* Without an interval, print a single snapshot. */
+   if (!interval) {
+      count = 1;
+   }
+
+   n_processes = argc - optind;
+   processes = calloc (n_processes, sizeof *processes);
+
+   for (i = 0; i < n_processes; i++) {
+      pid = strtol (argv[optind + i], &end, 10);
+      if (*end || pid <= 0 ||
+          !mongoc_stat_process_init (&processes[i], (unsigned)pid)) {
+         fprintf (stderr, "Failed to load shared memory for pid %s.\n",
+                  argv[optind + i]);
+         goto cleanup;
+      }
+   }
+
+   clear = interval && !output && format == MONGOC_STAT_TEXT &&
+           isatty (STDOUT_FILENO);
+   deadline = bson_get_monotonic_time ();
+
+   for (n = 0; !count || n < count; n++) {
+      if (n) {
+         deadline += interval;
+         mongoc_stat_sleep_until (deadline);
+
+         /* Don't try to catch up after being stopped or falling behind. */
+         if (bson_get_monotonic_time () - deadline > interval) {
+            deadline = bson_get_monotonic_time ();
+         }
+      }
+
+      n_running = 0;
+
+      for (i = 0; i < n_processes; i++) {
+         if (processes[i].exited) {
+            continue;
+         }
+
+         /* The segment outlives the process, its counters stop moving. */
+         if (n && -1 == kill ((pid_t)processes[i].pid, 0) &&
+             errno == ESRCH) {
+            fprintf (stderr, "Process %u exited.\n", processes[i].pid);
+            processes[i].exited = true;
+            continue;
+         }
+
+         mongoc_stat_process_sample (&processes[i]);
+         n_running++;
+      }
+
+      if (!n_running) {
+         break;
+      }
+
+      if (!mongoc_stat_print (processes, n_processes, format, output,
+                              clear)) {
+         goto cleanup;
+      }
+   }
+
+   ret = EXIT_SUCCESS;
+
+cleanup:
+   for (i = 0; i < n_processes; i++) {
+      mongoc_stat_process_destroy (&processes[i]);
    }
 
-   mongoc_counters_destroy (counters);
+   free (processes);
 
-   return EXIT_SUCCESS;
+   return ret;
 }
 
 #else
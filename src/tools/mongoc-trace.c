@@ -0,0 +1,313 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <bson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Decodes the file written by mongoc_log_trace_dump(), see
+ * src/mongoc/mongoc-trace-ring-private.h for its layout.
+ */
+
+
+#define MONGOC_TRACE_MAGIC   "MONGOCTR"
+#define MONGOC_TRACE_VERSION 1
+
+
+#pragma pack(1)
+typedef struct
+{
+   char     magic [8];
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t ring_size;
+   uint32_t n_sites;
+   uint32_t n_rings;
+   uint32_t n_dropped;
+   int64_t  timestamp;
+} mongoc_trace_header_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_header_t) == 40);
+
+
+#pragma pack(1)
+typedef struct
+{
+   uint32_t thread;
+   uint32_t n_records;
+   uint64_t n_written;
+} mongoc_trace_ring_info_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_ring_info_t) == 16);
+
+
+#pragma pack(1)
+typedef struct
+{
+   int64_t  timestamp;
+   uint32_t site;
+   uint32_t payload;
+} mongoc_trace_record_t;
+#pragma pack()
+
+
+BSON_STATIC_ASSERT (sizeof (mongoc_trace_record_t) == 16);
+
+
+typedef struct
+{
+   uint32_t    kind;
+   uint32_t    line;
+   const char *domain;
+   const char *function;
+   const char *text;
+} mongoc_trace_site_t;
+
+
+enum
+{
+   KIND_ENTRY = 1,
+   KIND_EXIT,
+   KIND_GOTO,
+   KIND_TRACE,
+   KIND_DUMP,
+};
+
+
+static const char *gKinds [] = {
+   "?", "ENTRY", " EXIT", " GOTO", "TRACE", " DUMP",
+};
+
+
+typedef struct
+{
+   const char *data;
+   size_t      len;
+   size_t      pos;
+} reader_t;
+
+
+static const void *
+reader_take (reader_t *reader,
+             size_t    len)
+{
+   const void *ret;
+
+   if (reader->len - reader->pos < len) {
+      return NULL;
+   }
+
+   ret = reader->data + reader->pos;
+   reader->pos += len;
+
+   return ret;
+}
+
+
+static const char *
+reader_take_str (reader_t *reader)
+{
+   const char *str = reader->data + reader->pos;
+   const char *end;
+
+   end = memchr (str, '\0', reader->len - reader->pos);
+   if (!end) {
+      return NULL;
+   }
+
+   reader->pos += (end - str) + 1;
+
+   return str;
+}
+
+
+static char *
+read_file (const char *path,
+           size_t     *len)
+{
+   char *data = NULL;
+   size_t allocated = 0;
+   size_t n;
+   FILE *file;
+
+   if (!(file = fopen (path, "rb"))) {
+      return NULL;
+   }
+
+   *len = 0;
+
+   do {
+      if (*len == allocated) {
+         allocated = allocated ? allocated * 2 : 65536;
+         data = realloc (data, allocated);
+      }
+      n = fread (data + *len, 1, allocated - *len, file);
+      *len += n;
+   } while (n);
+
+   fclose (file);
+
+   return data;
+}
+
+
+static void
+print_record (const mongoc_trace_site_t   *sites,
+              uint32_t                     n_sites,
+              const mongoc_trace_record_t *record,
+              int64_t                      start,
+              int                         *depth,
+              FILE                        *file)
+{
+   const mongoc_trace_site_t *site;
+   const char *kind;
+
+   if (!record->site || record->site > n_sites) {
+      fprintf (file, "%12lld  <unknown site %u>\n",
+               (long long)(record->timestamp - start), record->site);
+      return;
+   }
+
+   site = &sites [record->site - 1];
+   kind = (site->kind < sizeof gKinds / sizeof gKinds [0]) ?
+          gKinds [site->kind] : gKinds [0];
+
+   if ((site->kind == KIND_EXIT) && (*depth > 0)) {
+      (*depth)--;
+   }
+
+   fprintf (file, "%12lld  %-10s %s %*s%s():%u",
+            (long long)(record->timestamp - start), site->domain, kind,
+            *depth * 2, "", site->function, site->line);
+
+   if (*site->text) {
+      fprintf (file, " %s", site->text);
+   }
+
+   if (site->kind == KIND_DUMP) {
+      fprintf (file, " [%u]", record->payload);
+   }
+
+   fprintf (file, "\n");
+
+   if (site->kind == KIND_ENTRY) {
+      (*depth)++;
+   }
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   const mongoc_trace_ring_info_t *info;
+   const mongoc_trace_header_t *header;
+   const mongoc_trace_record_t *record;
+   mongoc_trace_site_t *sites;
+   const uint32_t *pair;
+   reader_t reader;
+   int64_t start;
+   size_t len;
+   char *data;
+   uint32_t i;
+   uint32_t j;
+   int depth;
+
+   if (argc != 2) {
+      fprintf (stderr, "usage: %s FILE\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (!(data = read_file (argv[1], &len))) {
+      fprintf (stderr, "Failed to read \"%s\".\n", argv[1]);
+      return EXIT_FAILURE;
+   }
+
+   reader.data = data;
+   reader.len = len;
+   reader.pos = 0;
+
+   header = reader_take (&reader, sizeof *header);
+
+   if (!header ||
+       memcmp (header->magic, MONGOC_TRACE_MAGIC, sizeof header->magic) ||
+       header->version != MONGOC_TRACE_VERSION ||
+       header->record_size != sizeof (mongoc_trace_record_t)) {
+      fprintf (stderr, "\"%s\" is not a trace file of this version and "
+               "byte order.\n", argv[1]);
+      free (data);
+      return EXIT_FAILURE;
+   }
+
+   sites = calloc (header->n_sites + 1, sizeof *sites);
+
+   for (i = 0; i < header->n_sites; i++) {
+      if (!(pair = reader_take (&reader, 2 * sizeof (uint32_t))) ||
+          !(sites [i].domain = reader_take_str (&reader)) ||
+          !(sites [i].function = reader_take_str (&reader)) ||
+          !(sites [i].text = reader_take_str (&reader))) {
+         fprintf (stderr, "Truncated trace file.\n");
+         goto failure;
+      }
+      sites [i].kind = pair [0];
+      sites [i].line = pair [1];
+   }
+
+   printf ("%u sites, %u threads, %u records dropped, %u records per "
+           "thread\n", header->n_sites, header->n_rings, header->n_dropped,
+           header->ring_size);
+
+   for (i = 0; i < header->n_rings; i++) {
+      if (!(info = reader_take (&reader, sizeof *info)) ||
+          !(record = reader_take (&reader,
+                                  info->n_records * sizeof *record))) {
+         fprintf (stderr, "Truncated trace file.\n");
+         goto failure;
+      }
+
+      printf ("\nthread %u: %u of %llu records, in usec relative to the "
+              "dump\n",
+              info->thread, info->n_records,
+              (unsigned long long)info->n_written);
+
+      start = header->timestamp;
+      depth = 0;
+
+      for (j = 0; j < info->n_records; j++) {
+         print_record (sites, header->n_sites, &record [j], start, &depth,
+                       stdout);
+      }
+   }
+
+   free (sites);
+   free (data);
+
+   return EXIT_SUCCESS;
+
+failure:
+   free (sites);
+   free (data);
+
+   return EXIT_FAILURE;
+}
@@ -50,11 +50,17 @@
 #define TEST_NOFORK    (1 << 1)
 #define TEST_HELPONLY  (1 << 2)
 #define TEST_NOTHREADS (1 << 3)
+#define TEST_BENCH     (1 << 4)
 
 
 #define NANOSEC_PER_SEC 1000000000UL
 
 
+/* A benchmark's iterations are scaled until one call runs this long. */
+#define BENCH_MIN_NSEC  (100 * 1000 * 1000ULL)
+#define BENCH_MAX_REPS  100
+
+
 #if !defined(_WIN32)
 #  include <pthread.h>
 #  define Mutex                   pthread_mutex_t
@@ -224,6 +230,8 @@ TestSuite_Init (TestSuite *suite,
          suite->flags |= TEST_NOFORK;
       } else if (0 == strcmp ("-p", argv [i])) {
          suite->flags |= TEST_NOTHREADS;
+      } else if (0 == strcmp ("-b", argv [i])) {
+         suite->flags |= TEST_BENCH;
       } else if (0 == strcmp ("-F", argv [i])) {
          if (argc - 1 == i) {
             fprintf (stderr, "-F requires a filename argument.\n");
@@ -417,6 +425,7 @@ static void
 TestSuite_PrintHelp (TestSuite *suite, /* IN */
                      FILE *stream)     /* IN */
 {
+   Bench *bench;
    Test *iter;
 
    fprintf (stream,
@@ -424,8 +433,10 @@ TestSuite_PrintHelp (TestSuite *suite, /* IN */
 "\n"
 "Options:\n"
 "    -h, --help   Show this help menu.\n"
+"    -b           Run the benchmarks instead of the tests.\n"
 "    -f           Do not fork() before running tests.\n"
-"    -l NAME      Run test by name, e.g. \"/Client/command\" or \"/Client/*\".\n"
+"    -l NAME      Run test or benchmark by name, e.g. \"/Client/command\" or\n"
+"                 \"/Client/*\".\n"
 "    -p           Do not run tests in parallel.\n"
 "    -v           Be verbose with logs.\n"
 "\n"
@@ -436,6 +447,12 @@ TestSuite_PrintHelp (TestSuite *suite, /* IN */
       fprintf (stream, "    %s%s\n", suite->name, iter->name);
    }
 
+   fprintf (stream, "\nBenchmarks:\n");
+
+   for (bench = suite->benches; bench; bench = bench->next) {
+      fprintf (stream, "    %s%s\n", suite->name, bench->name);
+   }
+
    fprintf (stream, "\n");
 }
 
@@ -478,13 +495,14 @@ TestSuite_PrintJsonHeader (TestSuite *suite, /* IN */
             "    \"parallel\": \"%s\",\n"
             "    \"fork\": \"%s\"\n"
             "  },\n"
-            "  \"tests\": [\n",
+            "  \"%s\": [\n",
             major_version, minor_version, build,
             si.dwProcessorType,
             si.dwPageSize,
             0,
             (suite->flags & TEST_NOTHREADS) ? "false" : "true",
-            (suite->flags & TEST_NOFORK) ? "false" : "true");
+            (suite->flags & TEST_NOFORK) ? "false" : "true",
+            (suite->flags & TEST_BENCH) ? "benchmarks" : "tests");
 #else
    struct utsname u;
    uint64_t pagesize;
@@ -518,14 +536,15 @@ TestSuite_PrintJsonHeader (TestSuite *suite, /* IN */
             "    \"parallel\": \"%s\",\n"
             "    \"fork\": \"%s\"\n"
             "  },\n"
-            "  \"tests\": [\n",
+            "  \"%s\": [\n",
             u.sysname,
             u.release,
             u.machine,
             pagesize,
             npages,
             (suite->flags & TEST_NOTHREADS) ? "false" : "true",
-            (suite->flags & TEST_NOFORK) ? "false" : "true");
+            (suite->flags & TEST_NOFORK) ? "false" : "true",
+            (suite->flags & TEST_BENCH) ? "benchmarks" : "tests");
 #endif
 
    fflush (stream);
@@ -681,6 +700,221 @@ TestSuite_RunNamed (TestSuite *suite,     /* IN */
 }
 
 
+void
+TestSuite_AddBench (TestSuite  *suite,  /* IN */
+                    const char *name,   /* IN */
+                    BenchFunc   func,   /* IN */
+                    int         reps,   /* IN */
+                    int         warmup) /* IN */
+{
+   Bench *bench;
+   Bench *iter;
+
+   bench = calloc (1, sizeof *bench);
+   bench->name = strdup (name);
+   bench->func = func;
+   bench->reps = (reps < 1) ? 1 : (reps > BENCH_MAX_REPS) ? BENCH_MAX_REPS : reps;
+   bench->warmup = (warmup < 0) ? 0 : warmup;
+
+   if (!suite->benches) {
+      suite->benches = bench;
+      return;
+   }
+
+   for (iter = suite->benches; iter->next; iter = iter->next) { }
+
+   iter->next = bench;
+}
+
+
+static uint64_t
+Bench_Now (void)
+{
+   struct timespec ts;
+
+   _Clock_GetMonotonic (&ts);
+
+   return (uint64_t)ts.tv_sec * NANOSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+
+void
+Bench_StartTimer (Bench *bench) /* IN */
+{
+   if (!bench->timing) {
+      bench->started_ns = Bench_Now ();
+      bench->timing = true;
+   }
+}
+
+
+void
+Bench_StopTimer (Bench *bench) /* IN */
+{
+   if (bench->timing) {
+      bench->elapsed_ns += Bench_Now () - bench->started_ns;
+      bench->timing = false;
+   }
+}
+
+
+/*
+ * Discard the time measured so far, e.g. after setting up a benchmark.
+ */
+void
+Bench_ResetTimer (Bench *bench) /* IN */
+{
+   bench->elapsed_ns = 0;
+
+   if (bench->timing) {
+      bench->started_ns = Bench_Now ();
+   }
+}
+
+
+static uint64_t
+TestSuite_RunBenchOnce (Bench    *bench,      /* IN */
+                        uint64_t  iterations) /* IN */
+{
+   bench->iterations = iterations;
+   bench->elapsed_ns = 0;
+   bench->timing = false;
+
+   Bench_StartTimer (bench);
+   bench->func (bench);
+   Bench_StopTimer (bench);
+
+   return bench->elapsed_ns;
+}
+
+
+static int
+TestSuite_CompareDouble (const void *a,
+                         const void *b)
+{
+   double da = *(const double *)a;
+   double db = *(const double *)b;
+
+   return (da > db) - (da < db);
+}
+
+
+/*
+ * Scale the iterations until a call takes BENCH_MIN_NSEC, run the warm-up
+ * calls and then the timed ones, and report the fastest and the median
+ * time per iteration in nanoseconds.
+ */
+static void
+TestSuite_RunBench (TestSuite *suite, /* IN */
+                    Bench     *bench, /* IN */
+                    bool       last)  /* IN */
+{
+   double ns_per_op[BENCH_MAX_REPS];
+   uint64_t iterations = 1;
+   uint64_t elapsed;
+   char name[128];
+   char buf[512];
+   int i;
+
+   for (;;) {
+      elapsed = TestSuite_RunBenchOnce (bench, iterations);
+
+      if (elapsed >= BENCH_MIN_NSEC || iterations >= 1000000000ULL) {
+         break;
+      }
+
+      if (elapsed > 0) {
+         iterations = BSON_MIN (iterations * 100,
+                                BSON_MAX (iterations + 1,
+                                          (uint64_t)((double)iterations *
+                                                     BENCH_MIN_NSEC * 1.2 /
+                                                     elapsed)));
+      } else {
+         iterations *= 100;
+      }
+   }
+
+   for (i = 0; i < bench->warmup; i++) {
+      TestSuite_RunBenchOnce (bench, iterations);
+   }
+
+   for (i = 0; i < bench->reps; i++) {
+      ns_per_op[i] = (double)TestSuite_RunBenchOnce (bench, iterations) /
+                     iterations;
+   }
+
+   qsort (ns_per_op, bench->reps, sizeof ns_per_op[0],
+          TestSuite_CompareDouble);
+
+   snprintf (name, sizeof name, "%s%s", suite->name, bench->name);
+   name [sizeof name - 1] = '\0';
+
+   snprintf (buf, sizeof buf,
+             "    { \"name\": \"%s\", "
+                   "\"iterations\": %llu, "
+                   "\"reps\": %d, "
+                   "\"warmup\": %d, "
+                   "\"min_ns\": %.2f, "
+                   "\"median_ns\": %.2f }%s\n",
+             name,
+             (unsigned long long)iterations,
+             bench->reps,
+             bench->warmup,
+             ns_per_op[0],
+             ns_per_op[bench->reps / 2],
+             last ? "" : ",");
+   buf [sizeof buf - 1] = '\0';
+   fprintf (stdout, "%s", buf);
+   fflush (stdout);
+   if (suite->outfile) {
+      fprintf (suite->outfile, "%s", buf);
+      fflush (suite->outfile);
+   }
+}
+
+
+/*
+ * Benchmarks run one at a time in this process, never in parallel with
+ * each other or in a child, so their timings are comparable.
+ */
+static void
+TestSuite_RunBenches (TestSuite  *suite,    /* IN */
+                      const char *benchname) /* IN */
+{
+   Bench *selected [256];
+   Bench *bench;
+   char name[128];
+   size_t n = 0;
+   size_t i;
+   size_t len;
+
+   for (bench = suite->benches; bench && n < 256; bench = bench->next) {
+      snprintf (name, sizeof name, "%s%s", suite->name, bench->name);
+      name [sizeof name - 1] = '\0';
+
+      if (benchname) {
+         len = strlen (benchname);
+         if ((len && benchname[len - 1] == '*') ?
+             !!strncmp (name, benchname, len - 1) :
+             !!strcmp (name, benchname)) {
+            continue;
+         }
+      }
+
+      selected [n++] = bench;
+   }
+
+   for (i = 0; i < n; i++) {
+      TestSuite_RunBench (suite, selected [i], i == n - 1);
+   }
+
+   TestSuite_PrintJsonFooter (stdout);
+   if (suite->outfile) {
+      TestSuite_PrintJsonFooter (suite->outfile);
+   }
+}
+
+
 int
 TestSuite_Run (TestSuite *suite) /* IN */
 {
@@ -694,7 +928,9 @@ TestSuite_Run (TestSuite *suite) /* IN */
       TestSuite_PrintJsonHeader (suite, suite->outfile);
    }
 
-   if (suite->tests) {
+   if ((suite->flags & TEST_BENCH)) {
+      TestSuite_RunBenches (suite, suite->testname);
+   } else if (suite->tests) {
       if (suite->testname) {
          TestSuite_RunNamed (suite, suite->testname);
       } else if ((suite->flags & TEST_NOTHREADS)) {
@@ -716,6 +952,8 @@ TestSuite_Run (TestSuite *suite) /* IN */
 void
 TestSuite_Destroy (TestSuite *suite)
 {
+   Bench *bench;
+   Bench *next;
    Test *test;
    Test *tmp;
 
@@ -725,6 +963,12 @@ TestSuite_Destroy (TestSuite *suite)
       free (test);
    }
 
+   for (bench = suite->benches; bench; bench = next) {
+      next = bench->next;
+      free (bench->name);
+      free (bench);
+   }
+
    if (suite->outfile) {
       fclose (suite->outfile);
    }
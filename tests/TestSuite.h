@@ -19,6 +19,7 @@
 #define TEST_SUITE_H
 
 
+#include <bson.h>
 #include <stdio.h>
 
 
@@ -61,6 +62,8 @@ extern "C" {
 typedef void (*TestFunc) (void);
 typedef struct _Test Test;
 typedef struct _TestSuite TestSuite;
+typedef struct _Bench Bench;
+typedef void (*BenchFunc) (Bench *bench);
 
 
 struct _Test
@@ -74,12 +77,32 @@ struct _Test
 };
 
 
+/*
+ * A benchmark runs its operation bench->iterations times per call. The
+ * timer runs for the whole call unless the function resets or stops it
+ * around its setup.
+ */
+struct _Bench
+{
+   Bench *next;
+   char *name;
+   BenchFunc func;
+   int reps;
+   int warmup;
+   uint64_t iterations;
+   uint64_t started_ns;
+   uint64_t elapsed_ns;
+   bool timing;
+};
+
+
 struct _TestSuite
 {
    char *prgname;
    char *name;
    char *testname;
    Test *tests;
+   Bench *benches;
    FILE *outfile;
    int flags;
 };
@@ -96,9 +119,18 @@ void TestSuite_AddFull (TestSuite *suite,
                         const char *name,
                         TestFunc func,
                         int (*check) (void));
+void TestSuite_AddBench (TestSuite *suite,
+                         const char *name,
+                         BenchFunc func,
+                         int reps,
+                         int warmup);
 int  TestSuite_Run     (TestSuite *suite);
 void TestSuite_Destroy (TestSuite *suite);
 
+void Bench_StartTimer  (Bench *bench);
+void Bench_StopTimer   (Bench *bench);
+void Bench_ResetTimer  (Bench *bench);
+
 #ifdef __cplusplus
 }
 #endif
@@ -63,10 +63,9 @@ void ha_mkdir(const char * name)
    }
 }
 
-mongoc_client_t *
-ha_replica_set_create_client (ha_replica_set_t *replica_set)
+static char *
+ha_replica_set_get_uri (ha_replica_set_t *replica_set)
 {
-   mongoc_client_t *client;
    bson_string_t *str;
    ha_node_t *iter;
    char *portstr;
@@ -88,7 +87,18 @@ ha_replica_set_create_client (ha_replica_set_t *replica_set)
    bson_string_append(str, "/?replicaSet=");
    bson_string_append(str, replica_set->name);
 
-   client = mongoc_client_new(str->str);
+   return bson_string_free(str, false);
+}
+
+
+mongoc_client_t *
+ha_replica_set_create_client (ha_replica_set_t *replica_set)
+{
+   mongoc_client_t *client;
+   char *uristr;
+
+   uristr = ha_replica_set_get_uri(replica_set);
+   client = mongoc_client_new(uristr);
 
 #ifdef MONGOC_ENABLE_SSL
    if (replica_set->ssl_opt) {
@@ -96,12 +106,40 @@ ha_replica_set_create_client (ha_replica_set_t *replica_set)
    }
 #endif
 
-   bson_string_free(str, true);
+   bson_free(uristr);
 
    return client;
 }
 
 
+mongoc_client_pool_t *
+ha_replica_set_create_client_pool (ha_replica_set_t *replica_set,
+                                   uint32_t          max_pool_size)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_uri_t *uri;
+   char *uristr;
+   char *base;
+
+   base = ha_replica_set_get_uri(replica_set);
+   uristr = bson_strdup_printf("%s&maxPoolSize=%u", base, max_pool_size);
+   uri = mongoc_uri_new(uristr);
+   pool = mongoc_client_pool_new(uri);
+
+#ifdef MONGOC_ENABLE_SSL
+   if (replica_set->ssl_opt) {
+      mongoc_client_pool_set_ssl_opts(pool, replica_set->ssl_opt);
+   }
+#endif
+
+   mongoc_uri_destroy(uri);
+   bson_free(uristr);
+   bson_free(base);
+
+   return pool;
+}
+
+
 static ha_node_t *
 ha_node_new (const char       *name,
              const char       *repl_set,
@@ -757,6 +795,56 @@ again:
 }
 
 
+/*
+ * Returns the node that replSetGetStatus reports as PRIMARY, or NULL if
+ * there is none right now.
+ */
+ha_node_t *
+ha_replica_set_get_primary (ha_replica_set_t *replica_set)
+{
+   bson_iter_t iter;
+   bson_iter_t ar;
+   bson_iter_t member;
+   const char *stateStr;
+   const char *name;
+   const char *port;
+   ha_node_t *node = NULL;
+   bson_t status;
+
+   if (!ha_replica_set_get_status(replica_set, &status)) {
+      return NULL;
+   }
+
+   if (bson_iter_init_find(&iter, &status, "members") &&
+       BSON_ITER_HOLDS_ARRAY(&iter) &&
+       bson_iter_recurse(&iter, &ar)) {
+      while (!node && bson_iter_next(&ar)) {
+         if (!BSON_ITER_HOLDS_DOCUMENT(&ar) ||
+             !bson_iter_recurse(&ar, &member) ||
+             !bson_iter_find(&member, "stateStr") ||
+             !(stateStr = bson_iter_utf8(&member, NULL)) ||
+             !!strcmp(stateStr, "PRIMARY") ||
+             !bson_iter_recurse(&ar, &member) ||
+             !bson_iter_find(&member, "name") ||
+             !(name = bson_iter_utf8(&member, NULL)) ||
+             !(port = strrchr(name, ':'))) {
+            continue;
+         }
+
+         for (node = replica_set->nodes; node; node = node->next) {
+            if (node->port == atoi(port + 1)) {
+               break;
+            }
+         }
+      }
+   }
+
+   bson_destroy(&status);
+
+   return node;
+}
+
+
 ha_sharded_cluster_t *
 ha_sharded_cluster_new (const char *name)
 {
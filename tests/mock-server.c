@@ -46,15 +46,46 @@ struct _mock_server_t
    mongoc_socket_t       *sock;
 
    int                    last_response_id;
+   int                    n_connections;
 
    bool                   isMaster;
    int                    minWireVersion;
    int                    maxWireVersion;
    int                    maxBsonObjectSize;
    int                    maxMessageSizeBytes;
+
+   char                  *setName;
+   char                  *hosts;
+
+   bool                   silent;
+
+   uint8_t               *canned_docs;
+   size_t                 canned_docs_len;
+   int32_t                canned_batch_size;
+   int32_t                canned_n_batches;
+   uint8_t               *canned_command;
+   size_t                 canned_command_len;
 };
 
 
+#define MOCK_SERVER_CURSOR_ID 1234
+
+
+#pragma pack(1)
+typedef struct
+{
+   int32_t msg_len;
+   int32_t request_id;
+   int32_t response_to;
+   int32_t opcode;
+   int32_t flags;
+   int64_t cursor_id;
+   int32_t start_from;
+   int32_t n_returned;
+} mock_reply_header_t;
+#pragma pack()
+
+
 void
 mock_server_reply_simple (mock_server_t        *server,
                           mongoc_stream_t      *client,
@@ -81,7 +112,7 @@ mock_server_reply_simple (mock_server_t        *server,
    r.reply.request_id = ++server->last_response_id;
    r.reply.response_to = request->header.request_id;
    r.reply.opcode = MONGOC_OPCODE_REPLY;
-   r.reply.flags = 0;
+   r.reply.flags = flags;
    r.reply.cursor_id = 0;
    r.reply.start_from = 0;
    r.reply.n_returned = 1;
@@ -122,6 +153,34 @@ handle_ping (mock_server_t   *server,
 }
 
 
+static void
+append_replset (mock_server_t *server,
+                bson_t        *reply_doc)
+{
+   const char *host;
+   const char *end;
+   const char *key;
+   char str [16];
+   bson_t ar;
+   uint32_t i = 0;
+
+   bson_append_bool (reply_doc, "secondary", -1, !server->isMaster);
+   bson_append_utf8 (reply_doc, "setName", -1, server->setName, -1);
+   bson_append_array_begin (reply_doc, "hosts", -1, &ar);
+
+   for (host = server->hosts; *host; host = *end ? end + 1 : end) {
+      if (!(end = strchr (host, ','))) {
+         end = host + strlen (host);
+      }
+
+      bson_uint32_to_string (i++, &key, str, sizeof str);
+      bson_append_utf8 (&ar, key, -1, host, (int)(end - host));
+   }
+
+   bson_append_array_end (reply_doc, &ar);
+}
+
+
 static bool
 handle_ismaster (mock_server_t   *server,
                  mongoc_stream_t *client,
@@ -136,6 +195,7 @@ handle_ismaster (mock_server_t   *server,
    BSON_ASSERT (rpc);
    BSON_ASSERT (doc);
 
+   mongoc_mutex_lock (&server->mutex);
    bson_append_bool (&reply_doc, "ismaster", -1, server->isMaster);
    bson_append_int32 (&reply_doc, "maxBsonObjectSize", -1,
                       server->maxBsonObjectSize);
@@ -148,6 +208,11 @@ handle_ismaster (mock_server_t   *server,
    bson_append_double (&reply_doc, "ok", -1, 1.0);
    bson_append_time_t (&reply_doc, "localtime", -1, now);
 
+   if (server->setName) {
+      append_replset (server, &reply_doc);
+   }
+   mongoc_mutex_unlock (&server->mutex);
+
    mock_server_reply_simple (server, client, rpc, MONGOC_REPLY_NONE, &reply_doc);
 
    bson_destroy (&reply_doc);
@@ -197,6 +262,111 @@ handle_command (mock_server_t   *server,
 }
 
 
+/*
+ * Write an OP_REPLY of @n_docs pre-encoded documents without building an
+ * rpc, so that a canned reply costs the server no allocation.
+ */
+static void
+mock_server_reply_canned (mock_server_t      *server,
+                          mongoc_stream_t    *client,
+                          const mongoc_rpc_t *request,
+                          const uint8_t      *docs,
+                          size_t              docs_len,
+                          int32_t             n_docs,
+                          int64_t             cursor_id,
+                          int32_t             start_from)
+{
+   mock_reply_header_t header;
+   mongoc_iovec_t iov[2];
+   ssize_t n_written;
+
+   header.msg_len = BSON_UINT32_TO_LE ((uint32_t)(sizeof header + docs_len));
+   header.request_id =
+      BSON_UINT32_TO_LE (bson_atomic_int_add (&server->last_response_id, 1));
+   header.response_to = BSON_UINT32_TO_LE (request->header.request_id);
+   header.opcode = BSON_UINT32_TO_LE (MONGOC_OPCODE_REPLY);
+   header.flags = 0;
+   header.cursor_id = BSON_UINT64_TO_LE (cursor_id);
+   header.start_from = BSON_UINT32_TO_LE (start_from);
+   header.n_returned = BSON_UINT32_TO_LE (n_docs);
+
+   iov[0].iov_base = (void *)&header;
+   iov[0].iov_len = sizeof header;
+   iov[1].iov_base = (void *)docs;
+   iov[1].iov_len = docs_len;
+
+   n_written = mongoc_stream_writev (client, iov, 2, -1);
+
+   assert (n_written == (ssize_t)(sizeof header + docs_len));
+}
+
+
+static bool
+is_ismaster (const mongoc_rpc_t *rpc)
+{
+   bson_iter_t iter;
+   int32_t len;
+   bson_t doc;
+
+   memcpy (&len, rpc->query.query, 4);
+   len = BSON_UINT32_FROM_LE (len);
+
+   return (bson_init_static (&doc, rpc->query.query, len) &&
+           bson_iter_init (&iter, &doc) &&
+           bson_iter_next (&iter) &&
+           !strcasecmp (bson_iter_key (&iter), "ismaster"));
+}
+
+
+/*
+ * Answer @rpc from the replies set up by mock_server_set_canned_reply().
+ * @batch counts the batches sent on this connection's cursor. Returns
+ * false for the requests left to the regular handlers.
+ */
+static bool
+handle_canned (mock_server_t   *server,
+               mongoc_stream_t *client,
+               mongoc_rpc_t    *rpc,
+               int32_t         *batch)
+{
+   const char *dot;
+
+   switch (rpc->header.opcode) {
+   case MONGOC_OPCODE_QUERY:
+      dot = strchr (rpc->query.collection, '.');
+      if (dot && !strcmp (dot, ".$cmd")) {
+         if (is_ismaster (rpc)) {
+            return false;
+         }
+         mock_server_reply_canned (server, client, rpc,
+                                   server->canned_command,
+                                   server->canned_command_len, 1, 0, 0);
+         return true;
+      }
+      *batch = 0;
+      /* fall through */
+   case MONGOC_OPCODE_GET_MORE:
+      (*batch)++;
+      mock_server_reply_canned (server, client, rpc,
+                                server->canned_docs,
+                                server->canned_docs_len,
+                                server->canned_batch_size,
+                                (*batch < server->canned_n_batches) ?
+                                MOCK_SERVER_CURSOR_ID : 0,
+                                (*batch - 1) * server->canned_batch_size);
+      return true;
+   case MONGOC_OPCODE_INSERT:
+   case MONGOC_OPCODE_UPDATE:
+   case MONGOC_OPCODE_DELETE:
+   case MONGOC_OPCODE_KILL_CURSORS:
+      /* Unacknowledged, or followed by a getlasterror command. */
+      return true;
+   default:
+      return false;
+   }
+}
+
+
 static void *
 mock_server_worker (void *data)
 {
@@ -206,6 +376,7 @@ mock_server_worker (void *data)
    mongoc_rpc_t rpc;
    bson_error_t error;
    int32_t msg_len;
+   int32_t batch = 0;
    void **closure = data;
 
    ENTRY;
@@ -249,13 +420,18 @@ again:
 
    _mongoc_rpc_swab_from_le(&rpc);
 
-   if (!handle_command(server, stream, &rpc)) {
+   if (!server->silent &&
+       !(server->canned_docs &&
+         handle_canned (server, stream, &rpc, &batch)) &&
+       !handle_command (server, stream, &rpc)) {
       server->handler(server, stream, &rpc, server->handler_data);
    }
 
-   memmove (buffer.data, buffer.data + buffer.off + msg_len,
-            buffer.len - msg_len);
-   buffer.off = 0;
+   /*
+    * Step past the request rather than moving the rest of the buffer down,
+    * the next fill compacts it only when it runs out of room.
+    */
+   buffer.off += msg_len;
    buffer.len -= msg_len;
 
    GOTO (again);
@@ -263,6 +439,7 @@ again:
 failure:
    mongoc_stream_close (stream);
    mongoc_stream_destroy (stream);
+   bson_atomic_int_add (&server->n_connections, -1);
    bson_free(closure);
    _mongoc_buffer_destroy (&buffer);
 
@@ -354,7 +531,7 @@ mock_server_run (mock_server_t *server)
       return -1;
    }
 
-   if (-1 == mongoc_socket_listen (ssock, 10)) {
+   if (-1 == mongoc_socket_listen (ssock, 128)) {
       perror("Failed to put socket into listen mode");
       return 3;
    }
@@ -373,6 +550,7 @@ mock_server_run (mock_server_t *server)
       }
 
       stream = mongoc_stream_socket_new (csock);
+      bson_atomic_int_add (&server->n_connections, 1);
       closure = bson_malloc0 (sizeof(void*) * 2);
       closure[0] = server;
       closure[1] = stream;
@@ -430,6 +608,10 @@ mock_server_destroy (mock_server_t *server)
    if (server) {
       mongoc_cond_destroy (&server->cond);
       mongoc_mutex_destroy (&server->mutex);
+      bson_free (server->canned_docs);
+      bson_free (server->canned_command);
+      bson_free (server->setName);
+      bson_free (server->hosts);
       bson_free(server);
    }
 }
@@ -445,3 +627,130 @@ mock_server_set_wire_version (mock_server_t *server,
    server->minWireVersion = min_wire_version;
    server->maxWireVersion = max_wire_version;
 }
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mock_server_set_replset --
+ *
+ *       Answer "isMaster" as a member of the replica set @set_name, the
+ *       primary if @primary and otherwise a secondary. @hosts lists the
+ *       members as "host:port" strings separated by commas.
+ *
+ *       This may be called again while @server runs to change its role
+ *       or the members it reports, as a reconfiguration would.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mock_server_set_replset (mock_server_t *server,
+                         const char    *set_name,
+                         bool           primary,
+                         const char    *hosts)
+{
+   BSON_ASSERT (server);
+   BSON_ASSERT (set_name);
+   BSON_ASSERT (hosts);
+
+   mongoc_mutex_lock (&server->mutex);
+   bson_free (server->setName);
+   bson_free (server->hosts);
+   server->setName = bson_strdup (set_name);
+   server->hosts = bson_strdup (hosts);
+   server->isMaster = primary;
+   mongoc_mutex_unlock (&server->mutex);
+}
+
+
+/*
+ * A silent server accepts connections and reads requests but answers
+ * none of them, not even "isMaster", as a member that hangs would.
+ */
+void
+mock_server_set_silent (mock_server_t *server,
+                        bool           silent)
+{
+   BSON_ASSERT (server);
+
+   server->silent = silent;
+}
+
+
+/*
+ * The number of client connections @server has open.
+ */
+int
+mock_server_get_n_connections (mock_server_t *server)
+{
+   BSON_ASSERT (server);
+
+   return bson_atomic_int_add (&server->n_connections, 0);
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * mock_server_set_canned_reply --
+ *
+ *       Answer every query with @batch_size documents of about @doc_size
+ *       bytes, and the getmores on its cursor with the same batch until
+ *       @n_batches have been sent. Commands other than ismaster get
+ *       {ok: 1, n: 0} and writes get no reply.
+ *
+ *       The replies are encoded once here, so the server spends as little
+ *       as possible per request and allocates nothing. Call this before
+ *       running @server.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+void
+mock_server_set_canned_reply (mock_server_t *server,
+                              uint32_t       doc_size,
+                              uint32_t       batch_size,
+                              uint32_t       n_batches)
+{
+   bson_string_t *pad;
+   bson_t command = BSON_INITIALIZER;
+   bson_t doc;
+   uint32_t i;
+
+   BSON_ASSERT (server);
+   BSON_ASSERT (!server->sock);
+   BSON_ASSERT (batch_size);
+   BSON_ASSERT (n_batches);
+
+   /* The document header, an int32 _id and a string "x" take 22 bytes. */
+   pad = bson_string_new (NULL);
+   for (i = 22; i < doc_size; i++) {
+      bson_string_append_c (pad, 'x');
+   }
+
+   bson_init (&doc);
+   bson_append_int32 (&doc, "_id", 3, 0);
+   bson_append_utf8 (&doc, "x", 1, pad->str, (int)pad->len);
+
+   bson_free (server->canned_docs);
+   server->canned_docs_len = (size_t)doc.len * batch_size;
+   server->canned_docs = bson_malloc (server->canned_docs_len);
+   for (i = 0; i < batch_size; i++) {
+      memcpy (server->canned_docs + (size_t)i * doc.len, bson_get_data (&doc),
+              doc.len);
+   }
+   server->canned_batch_size = (int32_t)batch_size;
+   server->canned_n_batches = (int32_t)n_batches;
+
+   bson_append_double (&command, "ok", 2, 1.0);
+   bson_append_int32 (&command, "n", 1, 0);
+   bson_free (server->canned_command);
+   server->canned_command_len = command.len;
+   server->canned_command = bson_malloc (command.len);
+   memcpy (server->canned_command, bson_get_data (&command), command.len);
+
+   bson_destroy (&command);
+   bson_destroy (&doc);
+   bson_string_free (pad, true);
+}
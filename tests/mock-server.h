@@ -45,6 +45,17 @@ mock_server_t *mock_server_new              (const char            *address,
 void           mock_server_set_wire_version (mock_server_t         *server,
                                              int32_t           min_wire_version,
                                              int32_t           max_wire_version);
+void           mock_server_set_replset      (mock_server_t         *server,
+                                             const char            *set_name,
+                                             bool                   primary,
+                                             const char            *hosts);
+void           mock_server_set_silent       (mock_server_t         *server,
+                                             bool                   silent);
+int            mock_server_get_n_connections (mock_server_t        *server);
+void           mock_server_set_canned_reply (mock_server_t         *server,
+                                             uint32_t               doc_size,
+                                             uint32_t               batch_size,
+                                             uint32_t               n_batches);
 void           mock_server_reply_simple     (mock_server_t        *server,
                                              mongoc_stream_t      *client,
                                              const mongoc_rpc_t   *request,
@@ -0,0 +1,1015 @@
+/*
+ * Copyright 2015 MongoDB, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Microbenchmarks of the driver internals on the hot paths of every
+ * operation. None of them talks to a server: streams are served from
+ * memory and the cluster is given fake connected nodes.
+ *
+ * The "mock/" benchmarks run whole operations against a mock server on
+ * loopback that answers with canned replies, so they measure the driver's
+ * own cost of a round trip. The mock server allocates nothing per reply,
+ * its allocations do not show in the figures.
+ *
+ * Each benchmark is run with a growing number of iterations until one run
+ * takes at least the minimum time, then repeated at that count. The median
+ * and best time per iteration are printed, with the number of memory
+ * allocations made through libbson per iteration.
+ */
+
+
+#include <bson.h>
+#include <mongoc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mongoc-b64-private.h"
+#include "mongoc-buffer-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-private.h"
+#include "mongoc-rpc-private.h"
+#include "mongoc-write-command-private.h"
+
+#include "mock-server.h"
+
+
+#define BENCH_MAX_REPS 100
+
+
+typedef struct
+{
+   uint64_t n;
+   int64_t  started;
+   int64_t  elapsed_usec;
+   uint64_t allocs_started;
+   uint64_t allocs;
+   uint64_t alloc_bytes_started;
+   uint64_t alloc_bytes;
+} bench_t;
+
+
+typedef void (*bench_func_t) (bench_t    *bench,
+                              const void *data);
+
+
+typedef struct
+{
+   const char   *name;
+   bench_func_t  func;
+   const void   *data;
+} bench_entry_t;
+
+
+static uint64_t gAllocs;
+static uint64_t gAllocBytes;
+
+
+static void *
+bench_malloc (size_t num_bytes)
+{
+   gAllocs++;
+   gAllocBytes += num_bytes;
+   return malloc (num_bytes);
+}
+
+
+static void *
+bench_calloc (size_t n_members,
+              size_t num_bytes)
+{
+   gAllocs++;
+   gAllocBytes += n_members * num_bytes;
+   return calloc (n_members, num_bytes);
+}
+
+
+static void *
+bench_realloc (void   *mem,
+               size_t  num_bytes)
+{
+   gAllocs++;
+   gAllocBytes += num_bytes;
+   return realloc (mem, num_bytes);
+}
+
+
+static void
+bench_free (void *mem)
+{
+   free (mem);
+}
+
+
+/*
+ * Call once the benchmark is set up, right before its loop of bench->n
+ * iterations, and bench_stop() right after it.
+ */
+static void
+bench_start (bench_t *bench)
+{
+   bench->allocs_started = gAllocs;
+   bench->alloc_bytes_started = gAllocBytes;
+   bench->started = bson_get_monotonic_time ();
+}
+
+
+static void
+bench_stop (bench_t *bench)
+{
+   bench->elapsed_usec = bson_get_monotonic_time () - bench->started;
+   bench->allocs = gAllocs - bench->allocs_started;
+   bench->alloc_bytes = gAllocBytes - bench->alloc_bytes_started;
+}
+
+
+static void
+bench_fail (const char *what)
+{
+   fprintf (stderr, "Benchmark failed: %s\n", what);
+   abort ();
+}
+
+
+static uint8_t *
+bench_read_fixture (const char *filename,
+                    size_t     *len)
+{
+   char path[256];
+   uint8_t *buf;
+   size_t n;
+   FILE *file;
+
+   bson_snprintf (path, sizeof path, BINARY_DIR"/%s", filename);
+
+   if (!(file = fopen (path, "rb"))) {
+      fprintf (stderr, "Failed to open: %s\n", path);
+      abort ();
+   }
+
+   buf = bson_malloc (65536);
+   n = fread (buf, 1, 65536, file);
+   fclose (file);
+
+   if (!n) {
+      bench_fail (path);
+   }
+
+   *len = n;
+
+   return buf;
+}
+
+
+/*
+ * A stream that never runs dry, serving a pattern from memory like a
+ * socket with data waiting: each read returns up to a segment of 4096
+ * bytes, or more if the caller needs more.
+ */
+typedef struct
+{
+   mongoc_stream_t  vtable;
+   uint8_t          data[4096];
+   size_t           pos;
+} bench_stream_t;
+
+
+static void
+bench_stream_destroy (mongoc_stream_t *stream)
+{
+   bson_free (stream);
+}
+
+
+static int
+bench_stream_close (mongoc_stream_t *stream)
+{
+   return 0;
+}
+
+
+static ssize_t
+bench_stream_readv (mongoc_stream_t *stream,
+                    mongoc_iovec_t  *iov,
+                    size_t           iovcnt,
+                    size_t           min_bytes,
+                    int32_t          timeout_msec)
+{
+   bench_stream_t *bstream = (bench_stream_t *)stream;
+   size_t limit = BSON_MAX (min_bytes, sizeof bstream->data);
+   size_t ret = 0;
+   size_t off;
+   size_t n;
+   size_t i;
+
+   for (i = 0; i < iovcnt && ret < limit; i++) {
+      for (off = 0; off < iov[i].iov_len && ret < limit; off += n) {
+         n = BSON_MIN (iov[i].iov_len - off,
+                       sizeof bstream->data - bstream->pos);
+         n = BSON_MIN (n, limit - ret);
+         memcpy ((uint8_t *)iov[i].iov_base + off,
+                 bstream->data + bstream->pos, n);
+         bstream->pos = (bstream->pos + n) % sizeof bstream->data;
+         ret += n;
+      }
+   }
+
+   return ret;
+}
+
+
+static bool
+bench_stream_check_closed (mongoc_stream_t *stream)
+{
+   return false;
+}
+
+
+static mongoc_stream_t *
+bench_stream_new (void)
+{
+   bench_stream_t *stream;
+   size_t i;
+
+   stream = bson_malloc0 (sizeof *stream);
+   stream->vtable.destroy = bench_stream_destroy;
+   stream->vtable.close = bench_stream_close;
+   stream->vtable.readv = bench_stream_readv;
+   stream->vtable.check_closed = bench_stream_check_closed;
+
+   for (i = 0; i < sizeof stream->data; i++) {
+      stream->data[i] = (uint8_t)i;
+   }
+
+   return (mongoc_stream_t *)stream;
+}
+
+
+static void
+bench_rpc_scatter (bench_t    *bench,
+                   const void *data)
+{
+   mongoc_rpc_t rpc;
+   uint8_t *buf;
+   size_t len;
+   uint64_t i;
+
+   buf = bench_read_fixture (data, &len);
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (!_mongoc_rpc_scatter (&rpc, buf, len)) {
+         bench_fail ("_mongoc_rpc_scatter");
+      }
+      _mongoc_rpc_swab_from_le (&rpc);
+   }
+   bench_stop (bench);
+
+   bson_free (buf);
+}
+
+
+static void
+bench_rpc_gather (bench_t    *bench,
+                  const void *data)
+{
+   mongoc_array_t ar;
+   mongoc_rpc_t rpc;
+   uint8_t *buf;
+   size_t len;
+   uint64_t i;
+
+   buf = bench_read_fixture (data, &len);
+
+   if (!_mongoc_rpc_scatter (&rpc, buf, len)) {
+      bench_fail ("_mongoc_rpc_scatter");
+   }
+   _mongoc_rpc_swab_from_le (&rpc);
+
+   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      _mongoc_array_clear (&ar);
+      _mongoc_rpc_gather (&rpc, &ar);
+   }
+   bench_stop (bench);
+
+   _mongoc_array_destroy (&ar);
+   bson_free (buf);
+}
+
+
+static void
+bench_buffer_fill (bench_t    *bench,
+                   const void *data)
+{
+   size_t min_bytes = *(const size_t *)data;
+   mongoc_stream_t *stream;
+   mongoc_buffer_t buffer;
+   bson_error_t error;
+   uint64_t i;
+
+   stream = bench_stream_new ();
+   _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (_mongoc_buffer_fill (&buffer, stream, min_bytes, 0, &error) < 0) {
+         bench_fail (error.message);
+      }
+      _mongoc_buffer_clear (&buffer, false);
+   }
+   bench_stop (bench);
+
+   _mongoc_buffer_destroy (&buffer);
+   mongoc_stream_destroy (stream);
+}
+
+
+/*
+ * Read messages of @data bytes from a buffered stream the way replies
+ * are read, a header and then the body.
+ */
+static void
+bench_stream_buffered_readv (bench_t    *bench,
+                             const void *data)
+{
+   size_t len = *(const size_t *)data;
+   mongoc_stream_t *buffered;
+   mongoc_iovec_t iov[2];
+   uint8_t *buf;
+   uint64_t i;
+
+   buffered = mongoc_stream_buffered_new (bench_stream_new (), 16384);
+   buf = bson_malloc (len);
+
+   iov[0].iov_base = buf;
+   iov[0].iov_len = 16;
+   iov[1].iov_base = buf + 16;
+   iov[1].iov_len = len - 16;
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (mongoc_stream_readv (buffered, iov, 2, len, 0) != (ssize_t)len) {
+         bench_fail ("mongoc_stream_readv");
+      }
+   }
+   bench_stop (bench);
+
+   bson_free (buf);
+   mongoc_stream_destroy (buffered);
+}
+
+
+/*
+ * Select a node of a three member replica set whose nodes all look
+ * connected, with the read mode named @data.
+ */
+static void
+bench_cluster_select (bench_t    *bench,
+                      const void *data)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_cluster_t *cluster;
+   mongoc_stream_t *stream;
+   mongoc_client_t *client;
+   bson_error_t error;
+   uint64_t i;
+   uint32_t j;
+
+   client = mongoc_client_new ("mongodb://a:27017,b:27017,c:27017/"
+                               "?replicaSet=rs");
+   cluster = &client->cluster;
+   stream = bench_stream_new ();
+
+   if (!strcmp (data, "primary")) {
+      read_prefs = mongoc_read_prefs_new (MONGOC_READ_PRIMARY);
+   } else if (!strcmp (data, "secondaryPreferred")) {
+      read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY_PREFERRED);
+   } else {
+      read_prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+   }
+
+   for (j = 0; j < cluster->nodes_len; j++) {
+      cluster->nodes[j].stream = stream;
+      cluster->nodes[j].ping_avg_msec = 1 + j;
+   }
+   cluster->nodes[0].primary = true;
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (!_mongoc_cluster_preselect (cluster, MONGOC_OPCODE_QUERY, NULL,
+                                      read_prefs, &error)) {
+         bench_fail (error.message);
+      }
+   }
+   bench_stop (bench);
+
+   for (j = 0; j < cluster->nodes_len; j++) {
+      cluster->nodes[j].stream = NULL;
+   }
+
+   mongoc_stream_destroy (stream);
+   mongoc_read_prefs_destroy (read_prefs);
+   mongoc_client_destroy (client);
+}
+
+
+typedef struct
+{
+   const char *query;
+   const char *document;
+} bench_matcher_case_t;
+
+
+static const bench_matcher_case_t gMatcherEq = {
+   "{\"a\": 1}",
+   "{\"_id\": 1, \"a\": 1, \"b\": \"b\", \"c\": [1, 2, 3]}",
+};
+
+
+static const bench_matcher_case_t gMatcherCompound = {
+   "{\"a\": {\"$gt\": 5, \"$lt\": 10}, \"b.c\": \"x\", "
+   "\"$or\": [{\"d\": 1}, {\"e\": {\"$in\": [1, 2, 3]}}]}",
+   "{\"_id\": 1, \"name\": \"document\", \"a\": 7, "
+   "\"b\": {\"a\": 1, \"b\": 2, \"c\": \"x\"}, \"d\": 2, \"e\": 3, "
+   "\"f\": [1, 2, 3, 4, 5], \"g\": {\"h\": {\"i\": true}}}",
+};
+
+
+static bson_t *
+bench_bson_from_json (const char *json)
+{
+   bson_error_t error;
+   bson_t *bson;
+
+   if (!(bson = bson_new_from_json ((const uint8_t *)json, -1, &error))) {
+      bench_fail (error.message);
+   }
+
+   return bson;
+}
+
+
+static void
+bench_matcher_match (bench_t    *bench,
+                     const void *data)
+{
+   const bench_matcher_case_t *c = data;
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *document;
+   bson_t *query;
+   uint64_t i;
+
+   query = bench_bson_from_json (c->query);
+   document = bench_bson_from_json (c->document);
+
+   if (!(matcher = mongoc_matcher_new (query, &error))) {
+      bench_fail (error.message);
+   }
+
+   if (!mongoc_matcher_match (matcher, document)) {
+      bench_fail ("mongoc_matcher_match");
+   }
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (!mongoc_matcher_match (matcher, document)) {
+         bench_fail ("mongoc_matcher_match");
+      }
+   }
+   bench_stop (bench);
+
+   mongoc_matcher_destroy (matcher);
+   bson_destroy (document);
+   bson_destroy (query);
+}
+
+
+static void
+bench_uri_new (bench_t    *bench,
+               const void *data)
+{
+   mongoc_uri_t *uri;
+   uint64_t i;
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (!(uri = mongoc_uri_new (data))) {
+         bench_fail (data);
+      }
+      mongoc_uri_destroy (uri);
+   }
+   bench_stop (bench);
+}
+
+
+/*
+ * Encode @data bytes to base64, as SCRAM does with its proofs.
+ */
+static void
+bench_b64_ntop (bench_t    *bench,
+                const void *data)
+{
+   size_t len = *(const size_t *)data;
+   uint8_t *src;
+   char *target;
+   size_t target_len;
+   uint64_t i;
+
+   target_len = ((len + 2) / 3) * 4 + 1;
+   src = bson_malloc (len);
+   target = bson_malloc (target_len);
+
+   for (i = 0; i < len; i++) {
+      src[i] = (uint8_t)(i * 7);
+   }
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (mongoc_b64_ntop (src, len, target, target_len) < 0) {
+         bench_fail ("b64_ntop");
+      }
+   }
+   bench_stop (bench);
+
+   bson_free (target);
+   bson_free (src);
+}
+
+
+#ifdef MONGOC_ENABLE_SSL
+static void
+bench_b64_pton (bench_t    *bench,
+                const void *data)
+{
+   size_t len = *(const size_t *)data;
+   uint8_t *src;
+   char *encoded;
+   size_t encoded_len;
+   uint64_t i;
+
+   encoded_len = ((len + 2) / 3) * 4 + 1;
+   src = bson_malloc (len + 1);
+   encoded = bson_malloc (encoded_len);
+
+   for (i = 0; i < len; i++) {
+      src[i] = (uint8_t)(i * 7);
+   }
+
+   mongoc_b64_ntop (src, len, encoded, encoded_len);
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (mongoc_b64_pton (encoded, src, len + 1) != (int)len) {
+         bench_fail ("b64_pton");
+      }
+   }
+   bench_stop (bench);
+
+   bson_free (encoded);
+   bson_free (src);
+}
+#endif
+
+
+#define BENCH_N_DOCUMENTS 100
+
+
+/*
+ * Build an insert, update or delete command of BENCH_N_DOCUMENTS
+ * documents, as a bulk operation does.
+ */
+static void
+bench_write_command (bench_t    *bench,
+                     const void *data)
+{
+   bson_t *documents[BENCH_N_DOCUMENTS];
+   mongoc_write_command_t command;
+   bson_t *update;
+   uint64_t i;
+   uint32_t j;
+
+   for (j = 0; j < BENCH_N_DOCUMENTS; j++) {
+      documents[j] = BCON_NEW ("a", BCON_INT32 ((int32_t)j),
+                               "b", BCON_UTF8 ("a string of some length"),
+                               "c", "{", "d", BCON_DOUBLE (1.5), "}");
+   }
+
+   update = BCON_NEW ("$set", "{", "b", BCON_UTF8 ("another string"), "}");
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      if (!strcmp (data, "insert")) {
+         _mongoc_write_command_init_insert (&command,
+                                            (const bson_t * const *)documents,
+                                            BENCH_N_DOCUMENTS, true, true);
+      } else if (!strcmp (data, "update")) {
+         _mongoc_write_command_init_update (&command, documents[0], update,
+                                            false, false, true);
+         for (j = 1; j < BENCH_N_DOCUMENTS; j++) {
+            _mongoc_write_command_update_append (&command, documents[j],
+                                                 update, false, false);
+         }
+      } else {
+         _mongoc_write_command_init_delete (&command, documents[0], false,
+                                            true);
+         for (j = 1; j < BENCH_N_DOCUMENTS; j++) {
+            _mongoc_write_command_delete_append (&command, documents[j]);
+         }
+      }
+      _mongoc_write_command_destroy (&command);
+   }
+   bench_stop (bench);
+
+   for (j = 0; j < BENCH_N_DOCUMENTS; j++) {
+      bson_destroy (documents[j]);
+   }
+
+   bson_destroy (update);
+}
+
+
+typedef struct
+{
+   const char *op;
+   uint32_t    doc_size;
+   uint32_t    batch_size;
+   uint32_t    n_batches;
+   int32_t     max_wire_version;
+} bench_mock_case_t;
+
+
+#define BENCH_MAX_MOCK_SERVERS 16
+
+
+static const bench_mock_case_t *gMockCases[BENCH_MAX_MOCK_SERVERS];
+static uint16_t gMockPorts[BENCH_MAX_MOCK_SERVERS];
+static int gNMockServers;
+
+
+/*
+ * Start a mock server for @mock_case the first time it is run and return
+ * its port. The servers are left running, mock_server_quit() cannot stop
+ * them yet.
+ */
+static uint16_t
+bench_mock_server_port (const bench_mock_case_t *mock_case)
+{
+   static uint16_t base_port;
+   mock_server_t *server;
+   int i;
+
+   for (i = 0; i < gNMockServers; i++) {
+      if (gMockCases[i] == mock_case) {
+         return gMockPorts[i];
+      }
+   }
+
+   if (gNMockServers == BENCH_MAX_MOCK_SERVERS) {
+      bench_fail ("too many mock servers");
+   }
+
+   if (!base_port) {
+      base_port = (uint16_t)(20000 + (bson_get_monotonic_time () % 10000));
+   }
+
+   server = mock_server_new ("127.0.0.1", base_port + gNMockServers, NULL,
+                             NULL);
+   mock_server_set_wire_version (server, 0, mock_case->max_wire_version);
+   mock_server_set_canned_reply (server, mock_case->doc_size,
+                                 mock_case->batch_size, mock_case->n_batches);
+   mock_server_run_in_thread (server);
+
+   gMockCases[gNMockServers] = mock_case;
+   gMockPorts[gNMockServers] = base_port + gNMockServers;
+
+   return gMockPorts[gNMockServers++];
+}
+
+
+static void
+bench_mock_op (const bench_mock_case_t *mock_case,
+               mongoc_client_t         *client,
+               mongoc_collection_t     *collection,
+               const bson_t            *doc)
+{
+   mongoc_cursor_t *cursor;
+   bson_error_t error;
+   const bson_t *reply_doc;
+   bson_t reply;
+   uint32_t n = 0;
+
+   if (!strcmp (mock_case->op, "command")) {
+      if (!mongoc_client_command_simple (client, "admin", doc, NULL, &reply,
+                                         &error)) {
+         bench_fail (error.message);
+      }
+      bson_destroy (&reply);
+   } else if (!strcmp (mock_case->op, "insert")) {
+      if (!mongoc_collection_insert (collection, MONGOC_INSERT_NONE, doc,
+                                     NULL, &error)) {
+         bench_fail (error.message);
+      }
+   } else {
+      cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                       doc, NULL, NULL);
+      while (mongoc_cursor_next (cursor, &reply_doc)) {
+         n++;
+      }
+      if (mongoc_cursor_error (cursor, &error)) {
+         bench_fail (error.message);
+      }
+      if (n != mock_case->batch_size * mock_case->n_batches) {
+         bench_fail ("unexpected number of documents");
+      }
+      mongoc_cursor_destroy (cursor);
+   }
+}
+
+
+/*
+ * Run a find to exhaustion, an insert or a ping against a mock server
+ * with canned replies. The connection is made before the timed loop.
+ */
+static void
+bench_mock (bench_t    *bench,
+            const void *data)
+{
+   const bench_mock_case_t *mock_case = data;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_t *doc;
+   uint64_t i;
+   char *uri;
+
+   uri = bson_strdup_printf ("mongodb://127.0.0.1:%hu/",
+                             bench_mock_server_port (mock_case));
+   client = mongoc_client_new (uri);
+   collection = mongoc_client_get_collection (client, "bench", "bench");
+
+   if (!strcmp (mock_case->op, "command")) {
+      doc = BCON_NEW ("ping", BCON_INT32 (1));
+   } else if (!strcmp (mock_case->op, "insert")) {
+      doc = BCON_NEW ("a", BCON_INT32 (1),
+                      "b", BCON_UTF8 ("a string of some length"));
+   } else {
+      doc = bson_new ();
+   }
+
+   bench_mock_op (mock_case, client, collection, doc);
+
+   bench_start (bench);
+   for (i = 0; i < bench->n; i++) {
+      bench_mock_op (mock_case, client, collection, doc);
+   }
+   bench_stop (bench);
+
+   bson_destroy (doc);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   bson_free (uri);
+}
+
+
+static const bench_mock_case_t gMockCommand = { "command", 0, 1, 1, 3 };
+static const bench_mock_case_t gMockFindSmall = { "find", 100, 1, 1, 3 };
+static const bench_mock_case_t gMockFindLarge = { "find", 1024, 100, 1, 3 };
+static const bench_mock_case_t gMockGetMore = { "find", 100, 100, 10, 3 };
+static const bench_mock_case_t gMockInsert = { "insert", 0, 1, 1, 3 };
+static const bench_mock_case_t gMockInsertLegacy = { "insert", 0, 1, 1, 0 };
+
+
+static const size_t gSize16 = 16;
+static const size_t gSize4096 = 4096;
+static const size_t gSize65536 = 65536;
+
+
+#define RPC_BENCH(file) \
+   { "rpc_scatter/" file, bench_rpc_scatter, file ".dat" }, \
+   { "rpc_gather/" file, bench_rpc_gather, file ".dat" }
+
+
+static const bench_entry_t gBenchmarks[] = {
+   RPC_BENCH ("delete1"),
+   RPC_BENCH ("get_more1"),
+   RPC_BENCH ("insert1"),
+   RPC_BENCH ("kill_cursors1"),
+   RPC_BENCH ("msg1"),
+   RPC_BENCH ("query1"),
+   RPC_BENCH ("query2"),
+   RPC_BENCH ("reply1"),
+   RPC_BENCH ("reply2"),
+   RPC_BENCH ("update1"),
+   { "b64_ntop/16", bench_b64_ntop, &gSize16 },
+   { "b64_ntop/4096", bench_b64_ntop, &gSize4096 },
+#ifdef MONGOC_ENABLE_SSL
+   { "b64_pton/16", bench_b64_pton, &gSize16 },
+   { "b64_pton/4096", bench_b64_pton, &gSize4096 },
+#endif
+   { "buffer_fill/16", bench_buffer_fill, &gSize16 },
+   { "buffer_fill/4096", bench_buffer_fill, &gSize4096 },
+   { "buffered_readv/4096", bench_stream_buffered_readv, &gSize4096 },
+   { "buffered_readv/65536", bench_stream_buffered_readv, &gSize65536 },
+   { "cluster_select/primary", bench_cluster_select, "primary" },
+   { "cluster_select/secondaryPreferred", bench_cluster_select,
+     "secondaryPreferred" },
+   { "cluster_select/nearest", bench_cluster_select, "nearest" },
+   { "matcher_match/eq", bench_matcher_match, &gMatcherEq },
+   { "matcher_match/compound", bench_matcher_match, &gMatcherCompound },
+   { "uri_new/simple", bench_uri_new, "mongodb://localhost/" },
+   { "uri_new/replica_set", bench_uri_new,
+     "mongodb://user:pass@a:27017,b:27017,c:27017/db?replicaSet=rs&w=majority"
+     "&readPreference=secondaryPreferred&readPreferenceTags=dc:ny"
+     "&connectTimeoutMS=1000&socketTimeoutMS=5000" },
+   { "write_command/insert", bench_write_command, "insert" },
+   { "write_command/update", bench_write_command, "update" },
+   { "write_command/delete", bench_write_command, "delete" },
+   { "mock/command/ping", bench_mock, &gMockCommand },
+   { "mock/find/1x100B", bench_mock, &gMockFindSmall },
+   { "mock/find/100x1KB", bench_mock, &gMockFindLarge },
+   { "mock/getmore/10x100x100B", bench_mock, &gMockGetMore },
+   { "mock/insert/command", bench_mock, &gMockInsert },
+   { "mock/insert/legacy", bench_mock, &gMockInsertLegacy },
+};
+
+
+static int
+bench_compare_double (const void *a,
+                      const void *b)
+{
+   double da = *(const double *)a;
+   double db = *(const double *)b;
+
+   return (da > db) - (da < db);
+}
+
+
+static void
+bench_run (const bench_entry_t *entry,
+           int64_t              min_usec,
+           int                  reps)
+{
+   double ns_per_op[BENCH_MAX_REPS];
+   bench_t bench;
+   uint64_t n = 1;
+   double allocs = 0;
+   double alloc_bytes = 0;
+   int i;
+
+   /*
+    * Grow the iteration count until a run takes min_usec, aiming a bit
+    * past it from the last run. This doubles as the warm-up.
+    */
+   for (;;) {
+      memset (&bench, 0, sizeof bench);
+      bench.n = n;
+      entry->func (&bench, entry->data);
+
+      if (bench.elapsed_usec >= min_usec || n >= 1000000000) {
+         break;
+      }
+
+      if (bench.elapsed_usec > 0) {
+         n = BSON_MIN (n * 100,
+                       BSON_MAX (n + 1, (uint64_t)((double)n * min_usec * 1.2 /
+                                                  bench.elapsed_usec)));
+      } else {
+         n *= 100;
+      }
+   }
+
+   for (i = 0; i < reps; i++) {
+      memset (&bench, 0, sizeof bench);
+      bench.n = n;
+      entry->func (&bench, entry->data);
+      ns_per_op[i] = bench.elapsed_usec * 1000.0 / n;
+      allocs = (double)bench.allocs / n;
+      alloc_bytes = (double)bench.alloc_bytes / n;
+   }
+
+   qsort (ns_per_op, reps, sizeof ns_per_op[0], bench_compare_double);
+
+   printf ("%-36s %12llu %12.1f %12.1f %10.2f %12.1f\n",
+           entry->name, (unsigned long long)n, ns_per_op[reps / 2],
+           ns_per_op[0], allocs, alloc_bytes);
+   fflush (stdout);
+}
+
+
+static void
+bench_log_handler (mongoc_log_level_t  log_level,
+                   const char         *log_domain,
+                   const char         *message,
+                   void               *user_data)
+{
+}
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [-l] [-t MSEC] [-r REPS] [PATTERN...]\n"
+            "\n"
+            "  -l       List the benchmarks.\n"
+            "  -t MSEC  Run each measurement for at least MSEC (200).\n"
+            "  -r REPS  Repeat each measurement REPS times (5).\n"
+            "\n"
+            "Only the benchmarks whose name contains one of the PATTERNs "
+            "are run.\n",
+            prog);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   static const bson_mem_vtable_t vtable = {
+      bench_malloc,
+      bench_calloc,
+      bench_realloc,
+      bench_free,
+   };
+   int64_t min_usec = 200 * 1000;
+   bool list = false;
+   bool selected;
+   int reps = 5;
+   size_t i;
+   int first;
+   int j;
+
+   /* Count allocations from the very first one. */
+   bson_mem_set_vtable (&vtable);
+
+   for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+      if (!strcmp (argv[first], "-l")) {
+         list = true;
+      } else if (!strcmp (argv[first], "-t") && first + 1 < argc) {
+         min_usec = atoi (argv[++first]) * (int64_t)1000;
+      } else if (!strcmp (argv[first], "-r") && first + 1 < argc) {
+         reps = atoi (argv[++first]);
+      } else {
+         usage (argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (min_usec <= 0 || reps <= 0 || reps > BENCH_MAX_REPS) {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   /* Keep the driver's debug output out of the results. */
+   mongoc_log_set_handler (bench_log_handler, NULL);
+
+   /* Node selection picks among equal nodes at random. */
+   srand (0);
+
+   if (!list) {
+      printf ("%-36s %12s %12s %12s %10s %12s\n",
+              "benchmark", "iterations", "ns/op", "best ns/op", "allocs/op",
+              "bytes/op");
+   }
+
+   for (i = 0; i < sizeof gBenchmarks / sizeof gBenchmarks[0]; i++) {
+      selected = (first == argc);
+
+      for (j = first; j < argc && !selected; j++) {
+         selected = !!strstr (gBenchmarks[i].name, argv[j]);
+      }
+
+      if (!selected) {
+         continue;
+      }
+
+      if (list) {
+         printf ("%s\n", gBenchmarks[i].name);
+      } else {
+         bench_run (&gBenchmarks[i], min_usec, reps);
+      }
+   }
+
+   mongoc_cleanup ();
+
+   return EXIT_SUCCESS;
+}
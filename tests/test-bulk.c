@@ -689,6 +689,61 @@ test_upsert_unordered (void)
 }
 
 
+static void
+test_upsert_many_by_key (void)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   const bson_t *docs [4];
+   bson_error_t error;
+   bson_t reply;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   collection = get_test_collection (client, "test_upsert_many_by_key");
+   assert (collection);
+
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE,
+                                 tmp_bson ("{'k': {'id': 1}, 'v': 'old'}"),
+                                 NULL, &error);
+   assert (r);
+
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   assert (bulk);
+
+   /* the third document has no key and is skipped */
+   docs [0] = tmp_bson ("{'k': {'id': 1}, 'v': 'new'}");
+   docs [1] = tmp_bson ("{'k': {'id': 2}, 'v': 'new'}");
+   docs [2] = tmp_bson ("{'v': 'no key'}");
+   docs [3] = tmp_bson ("{'k': {'id': 3}, 'v': 'new'}");
+
+   suppress_one_message ();
+   mongoc_bulk_operation_upsert_many_by_key (bulk, "k.id", docs, 4);
+
+   r = mongoc_bulk_operation_execute (bulk, &reply, &error);
+   assert (r);
+
+   ASSERT_MATCH (&reply, "{'nInserted': 0,"
+                         " 'nRemoved':  0,"
+                         " 'nMatched':  1,"
+                         " 'nUpserted': 2,"
+                         " 'writeErrors': []}");
+
+   ASSERT_COUNT (3, collection);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_upserted_index (bool ordered)
 {
@@ -1988,6 +2043,233 @@ test_bulk_edge_over_1000 (void)
    mongoc_client_destroy(client);
 }
 
+static void
+test_bulk_unordered_concurrent (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   bson_iter_t iter, error_iter, index;
+   bson_t doc, reply;
+   bson_error_t error;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   collection = get_test_collection (client, "unordered_concurrent");
+   assert (collection);
+
+   /* enough batches to wrap the window of batches in flight */
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+
+   for (i = 0; i < 5500; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", (i % 1100 == 1099) ? i - 1 : i);
+      mongoc_bulk_operation_insert (bulk, &doc);
+      bson_destroy (&doc);
+   }
+
+   r = mongoc_bulk_operation_execute (bulk, &reply, &error);
+   assert (!r);
+
+   assert (bson_iter_init_find (&iter, &reply, "nInserted"));
+   assert (bson_iter_int32 (&iter) == 5495);
+
+   assert (bson_iter_init_find (&iter, &reply, "writeErrors"));
+   assert (bson_iter_recurse (&iter, &error_iter));
+
+   for (i = 1099; i < 5500; i += 1100) {
+      assert (bson_iter_next (&error_iter));
+      assert (bson_iter_recurse (&error_iter, &index));
+      assert (bson_iter_find (&index, "index"));
+      assert (bson_iter_int32 (&index) == i);
+   }
+
+   assert (!bson_iter_next (&error_iter));
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+static void
+test_bulk_max_memory (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_operation_t *bulk;
+   bson_iter_t iter, error_iter, index;
+   bson_t doc, reply;
+   bson_error_t error;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   collection = get_test_collection (client, "bulk_max_memory");
+   assert (collection);
+
+   /* unordered bulks execute early, indexes stay relative to the bulk */
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+   mongoc_bulk_operation_set_max_memory (bulk, 1024);
+
+   for (i = 0; i < 1000; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", (i == 999) ? 0 : i);
+      mongoc_bulk_operation_insert (bulk, &doc);
+      bson_destroy (&doc);
+      assert (mongoc_bulk_operation_get_memory_usage (bulk) <= 1024);
+   }
+
+   r = mongoc_bulk_operation_execute (bulk, &reply, &error);
+   assert (!r);
+
+   assert (bson_iter_init_find (&iter, &reply, "nInserted"));
+   assert (bson_iter_int32 (&iter) == 999);
+
+   assert (bson_iter_init_find (&iter, &reply, "writeErrors"));
+   assert (bson_iter_recurse (&iter, &error_iter));
+   assert (bson_iter_next (&error_iter));
+   assert (bson_iter_recurse (&error_iter, &index));
+   assert (bson_iter_find (&index, "index"));
+   assert (bson_iter_int32 (&index) == 999);
+   assert (!bson_iter_next (&error_iter));
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   /* ordered bulks fail without sending anything */
+   bulk = mongoc_collection_create_bulk_operation (collection, true, NULL);
+   mongoc_bulk_operation_set_max_memory (bulk, 1024);
+
+   for (i = 0; i < 1000; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", i);
+      mongoc_bulk_operation_insert (bulk, &doc);
+      bson_destroy (&doc);
+   }
+
+   assert (mongoc_bulk_operation_get_memory_usage (bulk) <= 1024);
+
+   r = mongoc_bulk_operation_execute (bulk, &reply, &error);
+   assert (!r);
+   assert (error.domain == MONGOC_ERROR_COMMAND);
+   assert (error.code == MONGOC_ERROR_COMMAND_INVALID_ARG);
+
+   bson_init (&doc);
+   assert (!mongoc_collection_count (collection, MONGOC_QUERY_NONE, &doc,
+                                     0, 0, NULL, &error));
+   bson_destroy (&doc);
+
+   bson_destroy (&reply);
+   mongoc_bulk_operation_destroy (bulk);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+static void
+test_bulk_writer (bool pipelined)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_bulk_writer_t *writer;
+   bson_iter_t iter, error_iter, index;
+   bson_t doc, result;
+   bson_error_t error;
+   int64_t count;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   collection = get_test_collection (client, "test_bulk_writer");
+   assert (collection);
+
+   writer = mongoc_collection_create_bulk_writer (collection, false, NULL);
+   mongoc_bulk_writer_set_pipelined (writer, pipelined);
+   assert (mongoc_bulk_writer_get_pipelined (writer) == pipelined);
+
+   for (i = 0; i < 2510; i += 3) {
+      bson_init (&doc);
+      bson_append_int32 (&doc, "_id", -1, i);
+      r = mongoc_bulk_writer_insert (writer, &doc, &error);
+      assert (r);
+      bson_destroy (&doc);
+   }
+
+   r = mongoc_bulk_writer_flush (writer, &error);
+   assert (r);
+   r = mongoc_bulk_writer_finish (writer, NULL, &error);
+   assert (r);
+
+   /* spans several batches, the duplicates must keep their index */
+   for (i = 0; i < 2510; i++) {
+      bson_init (&doc);
+      bson_append_int32 (&doc, "_id", -1, i);
+      r = mongoc_bulk_writer_insert (writer, &doc, &error);
+      assert (r);
+      bson_destroy (&doc);
+   }
+
+   r = mongoc_bulk_writer_finish (writer, &result, &error);
+   assert (!r);
+
+   assert (bson_iter_init_find (&iter, &result, "nInserted"));
+   assert (bson_iter_int32 (&iter) == 2510 - 837);
+
+   assert (bson_iter_init_find (&iter, &result, "writeErrors"));
+   assert (bson_iter_recurse (&iter, &error_iter));
+
+   for (i = 0; i < 2510; i += 3) {
+      assert (bson_iter_next (&error_iter));
+      assert (bson_iter_recurse (&error_iter, &index));
+      assert (bson_iter_find (&index, "index"));
+      assert (bson_iter_int32 (&index) == i);
+   }
+
+   bson_destroy (&result);
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL,
+                                    0, 0, NULL, &error);
+   assert (count == 2510);
+
+   mongoc_bulk_writer_destroy (writer);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_bulk_writer_pipelined (void)
+{
+   test_bulk_writer (true);
+}
+
+
+static void
+test_bulk_writer_unpipelined (void)
+{
+   test_bulk_writer (false);
+}
+
+
 static void
 test_bulk_edge_case_372 (bool ordered)
 {
@@ -2213,4 +2495,14 @@ test_bulk_install (TestSuite *suite)
                   test_bulk_new);
    TestSuite_Add (suite, "/BulkOperation/over_1000",
                   test_bulk_edge_over_1000);
+   TestSuite_Add (suite, "/BulkOperation/unordered_concurrent",
+                  test_bulk_unordered_concurrent);
+   TestSuite_Add (suite, "/BulkOperation/max_memory",
+                  test_bulk_max_memory);
+   TestSuite_Add (suite, "/BulkOperation/upsert_many_by_key",
+                  test_upsert_many_by_key);
+   TestSuite_Add (suite, "/BulkWriter/pipelined",
+                  test_bulk_writer_pipelined);
+   TestSuite_Add (suite, "/BulkWriter/unpipelined",
+                  test_bulk_writer_unpipelined);
 }
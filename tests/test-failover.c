@@ -0,0 +1,526 @@
+#include <mongoc.h>
+#include <mongoc-thread-private.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ha-test.h"
+
+
+/*
+ * Failover benchmark: worker threads run a steady mix of reads and writes
+ * through a client pool against a replica set started with ha-test, the
+ * primary is killed, and we measure how long it takes until writes
+ * succeed again.
+ *
+ * The time to recovery is from the moment the primary is dead until the
+ * first successful write that was started after that. Operations are
+ * counted in three phases: "before" the kill, "failover" for those that
+ * overlap the outage, and "after" for those started once writes work
+ * again. A line per interval shows the errors and latency spikes along
+ * the way.
+ */
+
+
+/*
+ * Latencies are kept in microseconds in log-linear buckets, as test-load
+ * does: 2^FAILOVER_SUB_BITS buckets per power of two.
+ */
+#define FAILOVER_SUB_BITS  4
+#define FAILOVER_N_BUCKETS ((64 - FAILOVER_SUB_BITS + 1) << FAILOVER_SUB_BITS)
+#define FAILOVER_N_ERRORS  8
+
+
+typedef enum
+{
+   PHASE_BEFORE,
+   PHASE_FAILOVER,
+   PHASE_AFTER,
+   N_PHASES
+} failover_phase_t;
+
+
+static const char *gPhaseNames [N_PHASES] = { "before", "failover", "after" };
+
+
+typedef struct
+{
+   uint64_t count;
+   uint64_t errors;
+   int64_t  max_usec;
+   uint64_t buckets [FAILOVER_N_BUCKETS];
+} failover_histogram_t;
+
+
+typedef struct
+{
+   char     message [sizeof ((bson_error_t *)0)->message];
+   uint64_t count;
+} failover_error_t;
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   unsigned              n_threads;
+   unsigned              read_percent;
+   volatile int32_t      stop;
+
+   /* The fields below are guarded by mutex. */
+   mongoc_mutex_t        mutex;
+   int64_t               killed;
+   int64_t               recovered;
+   int64_t               first_error;
+   int64_t               last_error;
+   failover_histogram_t  phases [N_PHASES];
+   failover_histogram_t  interval;
+   failover_error_t      errors [FAILOVER_N_ERRORS];
+   uint64_t              n_other_errors;
+} failover_t;
+
+
+typedef struct
+{
+   failover_t      *failover;
+   mongoc_thread_t  thread;
+   unsigned         id;
+} failover_worker_t;
+
+
+static unsigned
+failover_bucket (int64_t usec)
+{
+   uint64_t v = (usec > 0) ? (uint64_t)usec : 0;
+   unsigned msb = 0;
+
+   if (v < (1 << FAILOVER_SUB_BITS)) {
+      return (unsigned)v;
+   }
+
+   while ((v >> msb) > 1) {
+      msb++;
+   }
+
+   return ((msb - FAILOVER_SUB_BITS + 1) << FAILOVER_SUB_BITS) +
+          (unsigned)((v >> (msb - FAILOVER_SUB_BITS)) -
+                     (1 << FAILOVER_SUB_BITS));
+}
+
+
+static int64_t
+failover_bucket_min (unsigned bucket)
+{
+   unsigned shift;
+
+   if (bucket < (1 << FAILOVER_SUB_BITS)) {
+      return bucket;
+   }
+
+   shift = (bucket >> FAILOVER_SUB_BITS) - 1;
+
+   return (int64_t)((1 << FAILOVER_SUB_BITS) +
+                    (bucket & ((1 << FAILOVER_SUB_BITS) - 1))) << shift;
+}
+
+
+static void
+failover_histogram_record (failover_histogram_t *histogram,
+                           int64_t               usec,
+                           bool                  failed)
+{
+   histogram->count++;
+   histogram->errors += failed;
+   histogram->buckets [failover_bucket (usec)]++;
+
+   if (usec > histogram->max_usec) {
+      histogram->max_usec = usec;
+   }
+}
+
+
+static int64_t
+failover_histogram_percentile (const failover_histogram_t *histogram,
+                               double                      quantile)
+{
+   uint64_t target;
+   uint64_t seen = 0;
+   unsigned i;
+
+   if (!histogram->count) {
+      return 0;
+   }
+
+   target = (uint64_t)(quantile * histogram->count + 0.5);
+   target = BSON_MAX (target, 1);
+
+   for (i = 0; i < FAILOVER_N_BUCKETS; i++) {
+      seen += histogram->buckets [i];
+      if (seen >= target) {
+         return BSON_MIN (failover_bucket_min (i), histogram->max_usec);
+      }
+   }
+
+   return histogram->max_usec;
+}
+
+
+static void
+failover_sleep_usec (int64_t usec)
+{
+   struct timespec ts;
+
+   ts.tv_sec = (time_t)(usec / 1000000);
+   ts.tv_nsec = (long)((usec % 1000000) * 1000);
+   nanosleep (&ts, NULL);
+}
+
+
+/*
+ * Count @error under its message, keeping the first FAILOVER_N_ERRORS
+ * distinct messages. Call with the mutex held.
+ */
+static void
+failover_count_error (failover_t         *failover,
+                      const bson_error_t *error)
+{
+   unsigned i;
+
+   for (i = 0; i < FAILOVER_N_ERRORS; i++) {
+      if (!failover->errors [i].count) {
+         bson_strncpy (failover->errors [i].message, error->message,
+                       sizeof failover->errors [i].message);
+      }
+      if (!strcmp (failover->errors [i].message, error->message)) {
+         failover->errors [i].count++;
+         return;
+      }
+   }
+
+   failover->n_other_errors++;
+}
+
+
+static void
+failover_record (failover_t         *failover,
+                 bool                is_write,
+                 int64_t             started,
+                 int64_t             finished,
+                 const bson_error_t *error)
+{
+   failover_phase_t phase;
+
+   mongoc_mutex_lock (&failover->mutex);
+
+   if (!failover->killed || finished < failover->killed) {
+      phase = PHASE_BEFORE;
+   } else if (failover->recovered && started >= failover->recovered) {
+      phase = PHASE_AFTER;
+   } else {
+      phase = PHASE_FAILOVER;
+   }
+
+   if (is_write && !error && failover->killed && !failover->recovered &&
+       started >= failover->killed) {
+      failover->recovered = finished;
+   }
+
+   if (error) {
+      if (!failover->first_error) {
+         failover->first_error = finished;
+      }
+      failover->last_error = finished;
+      failover_count_error (failover, error);
+   }
+
+   failover_histogram_record (&failover->phases [phase], finished - started,
+                              !!error);
+   failover_histogram_record (&failover->interval, finished - started,
+                              !!error);
+
+   mongoc_mutex_unlock (&failover->mutex);
+}
+
+
+static void *
+failover_worker_run (void *data)
+{
+   failover_worker_t *worker = data;
+   failover_t *failover = worker->failover;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   const bson_t *doc;
+   bson_error_t error;
+   uint64_t n = 0;
+   int64_t started;
+   bool is_write;
+   bool ok;
+   bson_t query;
+   bson_t insert;
+
+   while (!bson_atomic_int_add (&failover->stop, 0)) {
+      is_write = (n % 100) >= failover->read_percent;
+      started = bson_get_monotonic_time ();
+
+      client = mongoc_client_pool_pop (failover->pool);
+      collection = mongoc_client_get_collection (client, "test", "failover");
+
+      if (is_write) {
+         bson_init (&insert);
+         BSON_APPEND_INT32 (&insert, "worker", (int32_t)worker->id);
+         BSON_APPEND_INT64 (&insert, "n", (int64_t)n);
+         ok = mongoc_collection_insert (collection, MONGOC_INSERT_NONE,
+                                        &insert, NULL, &error);
+         bson_destroy (&insert);
+      } else {
+         bson_init (&query);
+         BSON_APPEND_INT32 (&query, "worker", (int32_t)worker->id);
+         cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0,
+                                          1, 0, &query, NULL, NULL);
+         while (mongoc_cursor_next (cursor, &doc)) {
+         }
+         ok = !mongoc_cursor_error (cursor, &error);
+         mongoc_cursor_destroy (cursor);
+         bson_destroy (&query);
+      }
+
+      mongoc_collection_destroy (collection);
+      mongoc_client_pool_push (failover->pool, client);
+
+      failover_record (failover, is_write, started,
+                       bson_get_monotonic_time (), ok ? NULL : &error);
+
+      /* Do not spin on a node that refuses connections. */
+      if (!ok) {
+         failover_sleep_usec (10000);
+      }
+
+      n++;
+   }
+
+   return NULL;
+}
+
+
+static void
+failover_print_row (const char                 *name,
+                    const failover_histogram_t *histogram)
+{
+   printf ("%-10s %10llu %8llu %9lld %9lld %9lld\n",
+           name,
+           (unsigned long long)histogram->count,
+           (unsigned long long)histogram->errors,
+           (long long)failover_histogram_percentile (histogram, 0.5),
+           (long long)failover_histogram_percentile (histogram, 0.99),
+           (long long)histogram->max_usec);
+}
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [OPTIONS]\n"
+            "\n"
+            "  -t THREADS   Worker threads (4).\n"
+            "  -r PERCENT   Share of reads, the rest are writes (50).\n"
+            "  -w SECONDS   Steady load before killing the primary (5).\n"
+            "  -a SECONDS   Load kept up after recovery (5).\n"
+            "  -T SECONDS   Give up on recovery after SECONDS (120).\n"
+            "  -i SECONDS   Print progress every SECONDS (0.5).\n"
+            "\n"
+            "Latencies are printed in microseconds.\n",
+            prog);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   failover_histogram_t interval;
+   failover_worker_t *workers;
+   ha_replica_set_t *replica_set;
+   ha_node_t *primary;
+   failover_t failover;
+   double warmup = 5;
+   double after = 5;
+   double timeout = 120;
+   double report = 0.5;
+   int64_t started;
+   int64_t deadline;
+   int64_t killed;
+   int64_t recovered;
+   int64_t now;
+   unsigned i;
+   int arg;
+
+   memset (&failover, 0, sizeof failover);
+   failover.n_threads = 4;
+   failover.read_percent = 50;
+
+   for (arg = 1; arg < argc; arg += 2) {
+      if (argv [arg][0] != '-' || arg + 1 >= argc ||
+          argv [arg][1] == '\0' || argv [arg][2]) {
+         usage (argv [0]);
+         return EXIT_FAILURE;
+      }
+
+      switch (argv [arg][1]) {
+      case 't':
+         failover.n_threads = (unsigned)BSON_MAX (atoi (argv [arg + 1]), 1);
+         break;
+      case 'r':
+         failover.read_percent =
+            (unsigned)BSON_MIN (BSON_MAX (atoi (argv [arg + 1]), 0), 100);
+         break;
+      case 'w':
+         warmup = atof (argv [arg + 1]);
+         break;
+      case 'a':
+         after = atof (argv [arg + 1]);
+         break;
+      case 'T':
+         timeout = atof (argv [arg + 1]);
+         break;
+      case 'i':
+         report = atof (argv [arg + 1]);
+         break;
+      default:
+         usage (argv [0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (report <= 0 || timeout <= 0) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   replica_set = ha_replica_set_new ("failover1");
+   ha_replica_set_add_replica (replica_set, "replica1");
+   ha_replica_set_add_replica (replica_set, "replica2");
+   ha_replica_set_add_replica (replica_set, "replica3");
+
+   ha_replica_set_start (replica_set);
+   ha_replica_set_wait_for_healthy (replica_set);
+
+   mongoc_mutex_init (&failover.mutex);
+   failover.pool = ha_replica_set_create_client_pool (replica_set,
+                                                      failover.n_threads);
+
+   workers = bson_malloc0 (failover.n_threads * sizeof *workers);
+   started = bson_get_monotonic_time ();
+
+   for (i = 0; i < failover.n_threads; i++) {
+      workers [i].failover = &failover;
+      workers [i].id = i;
+      mongoc_thread_create (&workers [i].thread, failover_worker_run,
+                            &workers [i]);
+   }
+
+   printf ("%8s %10s %8s %9s %9s\n", "time", "ops", "errors", "p99", "max");
+
+   deadline = started + (int64_t)(warmup * 1000000);
+   killed = 0;
+   recovered = 0;
+
+   for (;;) {
+      failover_sleep_usec ((int64_t)(report * 1000000));
+      now = bson_get_monotonic_time ();
+
+      mongoc_mutex_lock (&failover.mutex);
+      interval = failover.interval;
+      memset (&failover.interval, 0, sizeof failover.interval);
+      if (!recovered && failover.recovered) {
+         recovered = failover.recovered;
+         deadline = now + (int64_t)(after * 1000000);
+      }
+      mongoc_mutex_unlock (&failover.mutex);
+
+      printf ("%7.1fs %10llu %8llu %9lld %9lld%s\n",
+              (now - started) / 1000000.0,
+              (unsigned long long)interval.count,
+              (unsigned long long)interval.errors,
+              (long long)failover_histogram_percentile (&interval, 0.99),
+              (long long)interval.max_usec,
+              (killed && !recovered) ? "  *" : "");
+      fflush (stdout);
+
+      if (now < deadline) {
+         continue;
+      }
+
+      if (killed) {
+         break;
+      }
+
+      if (!(primary = ha_replica_set_get_primary (replica_set))) {
+         fprintf (stderr, "No primary to kill.\n");
+         abort ();
+      }
+
+      printf ("killing primary %s on port %hu\n", primary->name,
+              primary->port);
+
+      ha_node_kill (primary);
+      killed = bson_get_monotonic_time ();
+
+      mongoc_mutex_lock (&failover.mutex);
+      failover.killed = killed;
+      mongoc_mutex_unlock (&failover.mutex);
+
+      deadline = killed + (int64_t)(timeout * 1000000);
+   }
+
+   bson_atomic_int_add (&failover.stop, 1);
+
+   for (i = 0; i < failover.n_threads; i++) {
+      mongoc_thread_join (workers [i].thread);
+   }
+
+   printf ("\n%u threads, %u%% reads\n\n", failover.n_threads,
+           failover.read_percent);
+   printf ("%-10s %10s %8s %9s %9s %9s\n",
+           "phase", "count", "errors", "p50", "p99", "max");
+
+   for (i = 0; i < N_PHASES; i++) {
+      failover_print_row (gPhaseNames [i], &failover.phases [i]);
+   }
+
+   if (failover.first_error) {
+      printf ("\nerrors from %.3fs to %.3fs after the kill:\n",
+              (failover.first_error - killed) / 1000000.0,
+              (failover.last_error - killed) / 1000000.0);
+      for (i = 0; i < FAILOVER_N_ERRORS && failover.errors [i].count; i++) {
+         printf ("%10llu  %s\n", (unsigned long long)failover.errors [i].count,
+                 failover.errors [i].message);
+      }
+      if (failover.n_other_errors) {
+         printf ("%10llu  other errors\n",
+                 (unsigned long long)failover.n_other_errors);
+      }
+   }
+
+   if (recovered) {
+      printf ("\ntime to recovery: %.3f seconds\n",
+              (recovered - killed) / 1000000.0);
+   } else {
+      printf ("\nwrites did not recover within %.0f seconds\n", timeout);
+   }
+
+   mongoc_client_pool_destroy (failover.pool);
+   mongoc_mutex_destroy (&failover.mutex);
+   bson_free (workers);
+
+   ha_replica_set_shutdown (replica_set);
+   ha_replica_set_destroy (replica_set);
+
+   mongoc_cleanup ();
+
+   return recovered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
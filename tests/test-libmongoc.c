@@ -26,20 +26,27 @@
 
 
 extern void test_array_install             (TestSuite *suite);
+extern void test_bson_index_install        (TestSuite *suite);
 extern void test_buffer_install            (TestSuite *suite);
 extern void test_bulk_install              (TestSuite *suite);
 extern void test_client_install            (TestSuite *suite);
 extern void test_client_pool_install       (TestSuite *suite);
+extern void test_codec_install             (TestSuite *suite);
 extern void test_collection_install        (TestSuite *suite);
+extern void test_columns_install           (TestSuite *suite);
+extern void test_counters_install          (TestSuite *suite);
 extern void test_cursor_install            (TestSuite *suite);
 extern void test_database_install          (TestSuite *suite);
 extern void test_gridfs_install            (TestSuite *suite);
 extern void test_gridfs_file_page_install  (TestSuite *suite);
 extern void test_list_install              (TestSuite *suite);
 extern void test_matcher_install           (TestSuite *suite);
+extern void test_memory_budget_install     (TestSuite *suite);
+extern void test_oid_gen_install           (TestSuite *suite);
 extern void test_queue_install             (TestSuite *suite);
 extern void test_read_prefs_install        (TestSuite *suite);
 extern void test_rpc_install               (TestSuite *suite);
+extern void test_shard_router_install      (TestSuite *suite);
 extern void test_socket_install            (TestSuite *suite);
 extern void test_stream_install            (TestSuite *suite);
 extern void test_uri_install               (TestSuite *suite);
@@ -491,21 +498,28 @@ main (int   argc,
    TestSuite_Init (&suite, "", argc, argv);
 
    test_array_install (&suite);
+   test_bson_index_install (&suite);
    test_buffer_install (&suite);
    test_client_install (&suite);
    test_client_pool_install (&suite);
+   test_codec_install (&suite);
    test_write_command_install (&suite);
    test_bulk_install (&suite);
    test_collection_install (&suite);
+   test_columns_install (&suite);
+   test_counters_install (&suite);
    test_cursor_install (&suite);
    test_database_install (&suite);
    test_gridfs_install (&suite);
    test_gridfs_file_page_install (&suite);
    test_list_install (&suite);
    test_matcher_install (&suite);
+   test_memory_budget_install (&suite);
+   test_oid_gen_install (&suite);
    test_queue_install (&suite);
    test_read_prefs_install (&suite);
    test_rpc_install (&suite);
+   test_shard_router_install (&suite);
    test_socket_install (&suite);
    test_stream_install (&suite);
    test_uri_install (&suite);
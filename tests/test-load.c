@@ -1,96 +1,559 @@
 #include <mongoc.h>
 #include <mongoc-client-private.h>
+#include <mongoc-thread-private.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+
+/*
+ * A load generator: worker threads share a client pool and run a mix of
+ * reads (find one document by _id), writes (upsert one document by _id)
+ * and commands (ping) against a collection, as fast as they can or, in
+ * rate mode, at a fixed total rate.
+ *
+ * In rate mode each operation has a scheduled start and its latency is
+ * measured from there, so that time spent queued behind a slow operation
+ * counts against the driver instead of being hidden by it.
+ */
+
+
+/*
+ * Latencies are kept in microseconds in log-linear buckets: 2^LOAD_SUB_BITS
+ * buckets per power of two, so within about 6% of the real value.
+ */
+#define LOAD_SUB_BITS  4
+#define LOAD_N_BUCKETS ((64 - LOAD_SUB_BITS + 1) << LOAD_SUB_BITS)
+
+
+typedef enum
+{
+   LOAD_READ,
+   LOAD_WRITE,
+   LOAD_COMMAND,
+   LOAD_N_OPS
+} load_op_t;
+
+
+static const char *gOpNames [LOAD_N_OPS] = { "read", "write", "command" };
+
+
+typedef struct
+{
+   uint64_t count;
+   uint64_t errors;
+   int64_t  max_usec;
+   uint64_t buckets [LOAD_N_BUCKETS];
+} load_histogram_t;
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   const char           *db;
+   const char           *collection;
+   unsigned              n_threads;
+   unsigned              mix [LOAD_N_OPS];
+   unsigned              mix_total;
+   uint32_t              doc_size;
+   uint32_t              n_keys;
+   double                rate;
+   int64_t               max_ops;
+   int64_t               started;
+   volatile int64_t      ops;
+   volatile int32_t      stop;
+   char                 *payload;
+} load_t;
+
+
+typedef struct
+{
+   load_t           *load;
+   mongoc_thread_t   thread;
+   mongoc_mutex_t    mutex;
+   uint64_t          seed;
+   load_histogram_t  interval [LOAD_N_OPS];
+} load_worker_t;
+
+
+static unsigned
+load_bucket (int64_t usec)
+{
+   uint64_t v = (usec > 0) ? (uint64_t)usec : 0;
+   unsigned msb = 0;
+
+   if (v < (1 << LOAD_SUB_BITS)) {
+      return (unsigned)v;
+   }
+
+   while ((v >> msb) > 1) {
+      msb++;
+   }
+
+   return ((msb - LOAD_SUB_BITS + 1) << LOAD_SUB_BITS) +
+          (unsigned)((v >> (msb - LOAD_SUB_BITS)) - (1 << LOAD_SUB_BITS));
+}
+
+
+/*
+ * The smallest latency counted in @bucket.
+ */
+static int64_t
+load_bucket_min (unsigned bucket)
+{
+   unsigned shift;
+
+   if (bucket < (1 << LOAD_SUB_BITS)) {
+      return bucket;
+   }
+
+   shift = (bucket >> LOAD_SUB_BITS) - 1;
+
+   return (int64_t)((1 << LOAD_SUB_BITS) +
+                    (bucket & ((1 << LOAD_SUB_BITS) - 1))) << shift;
+}
 
 
 static void
-print_doc (const bson_t *b)
+load_histogram_record (load_histogram_t *histogram,
+                       int64_t           usec,
+                       bool              failed)
 {
-   char *str;
+   histogram->count++;
+   histogram->errors += failed;
+   histogram->buckets [load_bucket (usec)]++;
 
-   str = bson_as_json(b, NULL);
-   MONGOC_DEBUG("%s", str);
-   bson_free(str);
+   if (usec > histogram->max_usec) {
+      histogram->max_usec = usec;
+   }
 }
 
 
 static void
-ping (mongoc_database_t *db,
-      const bson_t      *cmd)
+load_histogram_merge (load_histogram_t       *dst,
+                      const load_histogram_t *src)
 {
-   mongoc_cursor_t *cursor;
-   const bson_t *b;
-   bson_error_t error;
+   unsigned i;
 
-   cursor = mongoc_database_command(db, MONGOC_QUERY_NONE, 0, 1, 0, cmd, NULL, NULL);
-   while (mongoc_cursor_next(cursor, &b)) {
-      BSON_ASSERT(b);
-      print_doc(b);
+   dst->count += src->count;
+   dst->errors += src->errors;
+   dst->max_usec = BSON_MAX (dst->max_usec, src->max_usec);
+
+   for (i = 0; i < LOAD_N_BUCKETS; i++) {
+      dst->buckets [i] += src->buckets [i];
    }
-   if (mongoc_cursor_error(cursor, &error)) {
-      MONGOC_WARNING("Cursor error: %s", error.message);
+}
+
+
+static int64_t
+load_histogram_percentile (const load_histogram_t *histogram,
+                           double                  quantile)
+{
+   uint64_t target;
+   uint64_t seen = 0;
+   unsigned i;
+
+   if (!histogram->count) {
+      return 0;
+   }
+
+   target = (uint64_t)(quantile * histogram->count + 0.5);
+   target = BSON_MAX (target, 1);
+
+   for (i = 0; i < LOAD_N_BUCKETS; i++) {
+      seen += histogram->buckets [i];
+      if (seen >= target) {
+         return BSON_MIN (load_bucket_min (i), histogram->max_usec);
+      }
    }
-   mongoc_cursor_destroy(cursor);
+
+   return histogram->max_usec;
+}
+
+
+static uint32_t
+load_random (load_worker_t *worker)
+{
+   /* xorshift64*, seeded per worker. */
+   worker->seed ^= worker->seed >> 12;
+   worker->seed ^= worker->seed << 25;
+   worker->seed ^= worker->seed >> 27;
+
+   return (uint32_t)((worker->seed * 2685821657736338717ULL) >> 32);
 }
 
 
 static void
-fetch (mongoc_collection_t *col,
-       const bson_t        *spec)
+load_sleep_usec (int64_t usec)
+{
+#ifdef _WIN32
+   Sleep ((DWORD)(usec / 1000));
+#else
+   struct timespec ts;
+
+   ts.tv_sec = (time_t)(usec / 1000000);
+   ts.tv_nsec = (long)((usec % 1000000) * 1000);
+   nanosleep (&ts, NULL);
+#endif
+}
+
+
+static bool
+load_read (mongoc_collection_t *collection,
+           uint32_t             key)
 {
    mongoc_cursor_t *cursor;
-   const bson_t *b;
+   const bson_t *doc;
    bson_error_t error;
+   bool ret = true;
+   bson_t query;
+
+   bson_init (&query);
+   BSON_APPEND_INT32 (&query, "_id", (int32_t)key);
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &query, NULL, NULL);
 
-   cursor = mongoc_collection_find(col, MONGOC_QUERY_NONE, 0, 0, 0, spec, NULL, NULL);
-   while (mongoc_cursor_next(cursor, &b)) {
-      BSON_ASSERT(b);
-      print_doc(b);
+   while (mongoc_cursor_next (cursor, &doc)) {
    }
-   if (mongoc_cursor_error(cursor, &error)) {
-      MONGOC_WARNING("Cursor error: %s", error.message);
+
+   if (mongoc_cursor_error (cursor, &error)) {
+      MONGOC_WARNING ("Read failed: %s", error.message);
+      ret = false;
    }
-   mongoc_cursor_destroy(cursor);
+
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&query);
+
+   return ret;
 }
 
 
-static void
-test_load (mongoc_client_t *client,
-           unsigned         iterations)
+static bool
+load_write (load_t              *load,
+            mongoc_collection_t *collection,
+            uint32_t             key,
+            uint32_t             n)
+{
+   bson_error_t error;
+   bson_t selector;
+   bson_t update;
+   bson_t child;
+   bool ret;
+
+   bson_init (&selector);
+   BSON_APPEND_INT32 (&selector, "_id", (int32_t)key);
+
+   bson_init (&update);
+   BSON_APPEND_DOCUMENT_BEGIN (&update, "$set", &child);
+   BSON_APPEND_UTF8 (&child, "payload", load->payload);
+   BSON_APPEND_INT32 (&child, "n", (int32_t)n);
+   bson_append_document_end (&update, &child);
+
+   ret = mongoc_collection_update (collection, MONGOC_UPDATE_UPSERT,
+                                   &selector, &update, NULL, &error);
+   if (!ret) {
+      MONGOC_WARNING ("Write failed: %s", error.message);
+   }
+
+   bson_destroy (&update);
+   bson_destroy (&selector);
+
+   return ret;
+}
+
+
+static bool
+load_command (mongoc_client_t *client)
 {
-   mongoc_collection_t *col;
-   mongoc_database_t *db;
    bson_error_t error;
+   bson_t command;
+   bson_t reply;
+   bool ret;
+
+   bson_init (&command);
+   BSON_APPEND_INT32 (&command, "ping", 1);
+
+   ret = mongoc_client_command_simple (client, "admin", &command, NULL,
+                                       &reply, &error);
+   if (!ret) {
+      MONGOC_WARNING ("Command failed: %s", error.message);
+   }
+
+   bson_destroy (&reply);
+   bson_destroy (&command);
+
+   return ret;
+}
+
+
+static void *
+load_worker_run (void *data)
+{
+   load_worker_t *worker = data;
+   load_t *load = worker->load;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   int64_t interval_usec = 0;
+   int64_t scheduled = 0;
+   int64_t started;
+   int64_t now;
+   uint64_t n = 0;
+   uint32_t pick;
+   load_op_t op;
+   bool ok;
+
+   if (load->rate > 0) {
+      interval_usec = (int64_t)(1000000.0 * load->n_threads / load->rate);
+      interval_usec = BSON_MAX (interval_usec, 1);
+      /* Stagger the workers across the first interval. */
+      scheduled = load->started + (load_random (worker) % interval_usec);
+   }
+
+   while (!bson_atomic_int_add (&load->stop, 0)) {
+      if (load->max_ops &&
+          bson_atomic_int64_add (&load->ops, 1) > load->max_ops) {
+         break;
+      }
+
+      if (interval_usec) {
+         now = bson_get_monotonic_time ();
+         if (scheduled > now) {
+            load_sleep_usec (scheduled - now);
+         }
+         started = scheduled;
+         scheduled += interval_usec;
+      } else {
+         started = bson_get_monotonic_time ();
+      }
+
+      pick = load_random (worker) % load->mix_total;
+      for (op = LOAD_READ; pick >= load->mix [op]; op++) {
+         pick -= load->mix [op];
+      }
+
+      client = mongoc_client_pool_pop (load->pool);
+
+      if (op == LOAD_COMMAND) {
+         ok = load_command (client);
+      } else {
+         collection = mongoc_client_get_collection (client, load->db,
+                                                    load->collection);
+         if (op == LOAD_READ) {
+            ok = load_read (collection,
+                            load_random (worker) % load->n_keys);
+         } else {
+            ok = load_write (load, collection,
+                             load_random (worker) % load->n_keys,
+                             (uint32_t)n);
+         }
+         mongoc_collection_destroy (collection);
+      }
+
+      mongoc_client_pool_push (load->pool, client);
+
+      now = bson_get_monotonic_time ();
+
+      mongoc_mutex_lock (&worker->mutex);
+      load_histogram_record (&worker->interval [op], now - started, !ok);
+      mongoc_mutex_unlock (&worker->mutex);
+
+      n++;
+   }
+
+   return NULL;
+}
+
+
+/*
+ * Move what the workers recorded since the last call into @sums.
+ */
+static void
+load_collect (load_worker_t    *workers,
+              unsigned          n_workers,
+              load_histogram_t *sums)
+{
    unsigned i;
-   bson_t b;
-   bson_t q;
+   unsigned op;
+
+   memset (sums, 0, LOAD_N_OPS * sizeof *sums);
+
+   for (i = 0; i < n_workers; i++) {
+      mongoc_mutex_lock (&workers [i].mutex);
+      for (op = 0; op < LOAD_N_OPS; op++) {
+         load_histogram_merge (&sums [op], &workers [i].interval [op]);
+      }
+      memset (workers [i].interval, 0, sizeof workers [i].interval);
+      mongoc_mutex_unlock (&workers [i].mutex);
+   }
+}
+
+
+static void
+load_print_row (const char             *name,
+                const load_histogram_t *histogram,
+                double                  secs)
+{
+   printf ("%-8s %10llu %10.1f %8llu %9lld %9lld %9lld %9lld\n",
+           name,
+           (unsigned long long)histogram->count,
+           secs > 0 ? histogram->count / secs : 0.0,
+           (unsigned long long)histogram->errors,
+           (long long)load_histogram_percentile (histogram, 0.5),
+           (long long)load_histogram_percentile (histogram, 0.99),
+           (long long)load_histogram_percentile (histogram, 0.999),
+           (long long)histogram->max_usec);
+}
+
+
+static bool
+load_prepare (load_t *load)
+{
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t reply;
+   bson_t doc;
+   bool ret = true;
+   uint32_t i;
+
+   client = mongoc_client_pool_pop (load->pool);
+   collection = mongoc_client_get_collection (client, load->db,
+                                              load->collection);
+
+   if (!mongoc_collection_drop (collection, &error) &&
+       !strstr (error.message, "ns not found")) {
+      MONGOC_WARNING ("Failed to drop collection: %s", error.message);
+   }
 
-   bson_init(&b);
-   bson_append_int32(&b, "ping", 4, 1);
+   /* Only reads need the documents to be there from the start. */
+   for (i = 0; load->mix [LOAD_READ] && ret && i < load->n_keys; i++) {
+      if (!(i % 1000)) {
+         bulk = mongoc_collection_create_bulk_operation (collection, false,
+                                                         NULL);
+      }
+
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", (int32_t)i);
+      BSON_APPEND_UTF8 (&doc, "payload", load->payload);
+      BSON_APPEND_INT32 (&doc, "n", 0);
+      mongoc_bulk_operation_insert (bulk, &doc);
+      bson_destroy (&doc);
 
-   bson_init(&q);
+      if ((i % 1000) == 999 || i == load->n_keys - 1) {
+         if (!mongoc_bulk_operation_execute (bulk, &reply, &error)) {
+            fprintf (stderr, "Failed to load documents: %s\n",
+                     error.message);
+            ret = false;
+         }
+         bson_destroy (&reply);
+         mongoc_bulk_operation_destroy (bulk);
+      }
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (load->pool, client);
+
+   return ret;
+}
+
+
+static void
+load_finish (load_t *load)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
 
-   db = mongoc_client_get_database(client, "admin");
-   col = mongoc_client_get_collection(client, "test", "test");
+   client = mongoc_client_pool_pop (load->pool);
+   collection = mongoc_client_get_collection (client, load->db,
+                                              load->collection);
 
-   for (i = 0; i < iterations; i++) {
-      ping(db, &b);
-      fetch(col, &q);
+   if (!mongoc_collection_drop (collection, &error)) {
+      MONGOC_WARNING ("Failed to drop collection: %s", error.message);
    }
 
-   if (!mongoc_collection_drop(col, &error)) {
-      MONGOC_WARNING("Failed to drop collection: %s", error.message);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (load->pool, client);
+}
+
+
+/*
+ * Append maxPoolSize to @uri, which may or may not have a path and
+ * options yet.
+ */
+static char *
+load_uri_with_pool_size (const char *uri,
+                         unsigned    pool_size)
+{
+   const char *hosts = strstr (uri, "://");
+   const char *sep;
+
+   hosts = hosts ? hosts + 3 : uri;
+
+   if (strchr (uri, '?')) {
+      sep = "&";
+   } else if (strchr (hosts, '/')) {
+      sep = "?";
+   } else {
+      sep = "/?";
    }
 
-   mongoc_database_destroy(db);
-   db = mongoc_client_get_database(client, "test");
+   return bson_strdup_printf ("%s%smaxPoolSize=%u", uri, sep, pool_size);
+}
+
+
+static bool
+load_parse_mix (load_t     *load,
+                const char *str)
+{
+   char *end;
+   unsigned op;
+
+   load->mix_total = 0;
 
-   if (!mongoc_database_drop(db, &error)) {
-      MONGOC_WARNING("Failed to drop database: %s", error.message);
+   for (op = 0; op < LOAD_N_OPS; op++) {
+      load->mix [op] = (unsigned)strtoul (str, &end, 10);
+      load->mix_total += load->mix [op];
+      if (end == str || (op < LOAD_N_OPS - 1 && *end != ',') ||
+          (op == LOAD_N_OPS - 1 && *end)) {
+         return false;
+      }
+      str = end + 1;
    }
 
-   mongoc_database_destroy(db);
-   mongoc_collection_destroy(col);
-   bson_destroy(&b);
+   return load->mix_total > 0;
+}
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [OPTIONS] [URI]\n"
+            "\n"
+            "  -t THREADS   Worker threads (1).\n"
+            "  -p SIZE      Maximum size of the client pool (THREADS).\n"
+            "  -m R,W,C     Weights of reads, writes and commands (80,15,5).\n"
+            "  -s BYTES     Size of the payload of each document (100).\n"
+            "  -k KEYS      Number of distinct documents (10000).\n"
+            "  -r RATE      Run open loop at RATE operations per second in\n"
+            "               total, instead of as fast as possible.\n"
+            "  -d SECONDS   Run for SECONDS (10).\n"
+            "  -n OPS       Stop after OPS operations.\n"
+            "  -i SECONDS   Print progress every SECONDS (1), 0 for none.\n"
+            "  -c DB.COLL   Collection to use (test.load). It is dropped\n"
+            "               before and after the run.\n"
+            "\n"
+            "Latencies are printed in microseconds.\n",
+            prog);
 }
 
 
@@ -98,34 +561,218 @@ int
 main (int   argc,
       char *argv[])
 {
-   mongoc_client_pool_t *pool;
-   mongoc_client_t *client;
+   load_histogram_t interval [LOAD_N_OPS];
+   load_histogram_t totals [LOAD_N_OPS];
+   load_histogram_t sum;
+   load_worker_t *workers;
    mongoc_uri_t *uri;
-   unsigned count = 10000000;
+   load_t load;
+   const char *uri_str = "mongodb://127.0.0.1:27017/?sockettimeoutms=500";
+   const char *ns = "test.load";
+   char *pooled_uri;
+   char *db;
+   char *dot;
+   unsigned pool_size = 0;
+   double duration = 10;
+   double report = 1;
+   double secs;
+   int64_t last_report;
+   int64_t deadline;
+   int64_t now;
+   unsigned op;
+   unsigned i;
+   int arg;
 
-   mongoc_init();
+   memset (&load, 0, sizeof load);
+   memset (totals, 0, sizeof totals);
+   load.n_threads = 1;
+   load.doc_size = 100;
+   load.n_keys = 10000;
+   load_parse_mix (&load, "80,15,5");
 
-   if (argc > 1) {
-      if (!(uri = mongoc_uri_new(argv[1]))) {
-         fprintf(stderr, "Failed to parse uri: %s\n", argv[1]);
-         return 1;
+   for (arg = 1; arg < argc && argv [arg][0] == '-'; arg += 2) {
+      if (arg + 1 >= argc || argv [arg][1] == '\0' || argv [arg][2]) {
+         usage (argv [0]);
+         return EXIT_FAILURE;
       }
-   } else {
-      uri = mongoc_uri_new("mongodb://127.0.0.1:27017/?sockettimeoutms=500");
+
+      switch (argv [arg][1]) {
+      case 't':
+         load.n_threads = (unsigned)BSON_MAX (atoi (argv [arg + 1]), 1);
+         break;
+      case 'p':
+         pool_size = (unsigned)BSON_MAX (atoi (argv [arg + 1]), 1);
+         break;
+      case 'm':
+         if (!load_parse_mix (&load, argv [arg + 1])) {
+            usage (argv [0]);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 's':
+         load.doc_size = (uint32_t)BSON_MAX (atoi (argv [arg + 1]), 0);
+         break;
+      case 'k':
+         load.n_keys = (uint32_t)BSON_MAX (atoi (argv [arg + 1]), 1);
+         break;
+      case 'r':
+         load.rate = atof (argv [arg + 1]);
+         break;
+      case 'd':
+         duration = atof (argv [arg + 1]);
+         break;
+      case 'n':
+         load.max_ops = BSON_MAX (atoi (argv [arg + 1]), 0);
+         break;
+      case 'i':
+         report = atof (argv [arg + 1]);
+         break;
+      case 'c':
+         ns = argv [arg + 1];
+         break;
+      default:
+         usage (argv [0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (arg < argc) {
+      uri_str = argv [arg++];
+   }
+
+   if (arg < argc || !(dot = strchr (ns, '.')) || dot == ns || !dot [1] ||
+       duration <= 0) {
+      usage (argv [0]);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   pooled_uri = load_uri_with_pool_size (uri_str,
+                                         pool_size ? pool_size :
+                                                     load.n_threads);
+
+   if (!(uri = mongoc_uri_new (pooled_uri))) {
+      fprintf (stderr, "Failed to parse uri: %s\n", uri_str);
+      bson_free (pooled_uri);
+      return EXIT_FAILURE;
+   }
+
+   db = bson_strndup (ns, dot - ns);
+   load.db = db;
+   load.collection = dot + 1;
+   load.pool = mongoc_client_pool_new (uri);
+   load.payload = bson_malloc (load.doc_size + 1);
+   memset (load.payload, 'x', load.doc_size);
+   load.payload [load.doc_size] = '\0';
+
+   if (!load_prepare (&load)) {
+      return EXIT_FAILURE;
+   }
+
+   workers = bson_malloc0 (load.n_threads * sizeof *workers);
+   load.started = bson_get_monotonic_time ();
+
+   for (i = 0; i < load.n_threads; i++) {
+      workers [i].load = &load;
+      workers [i].seed = (uint64_t)load.started * 2654435761U + i + 1;
+      mongoc_mutex_init (&workers [i].mutex);
+      mongoc_thread_create (&workers [i].thread, load_worker_run,
+                            &workers [i]);
+   }
+
+   if (report > 0) {
+      printf ("%8s %10s %8s %9s %9s %9s %9s\n",
+              "time", "ops/s", "errors", "p50", "p99", "p99.9", "max");
+   }
+
+   deadline = load.started + (int64_t)(duration * 1000000);
+   last_report = load.started;
+
+   for (;;) {
+      now = bson_get_monotonic_time ();
+
+      if (now >= deadline ||
+          (load.max_ops &&
+           bson_atomic_int64_add (&load.ops, 0) >= load.max_ops)) {
+         break;
+      }
+
+      load_sleep_usec (BSON_MIN (deadline - now,
+                                 report > 0 ? (int64_t)(report * 1000000) :
+                                              100000));
+
+      if (report <= 0) {
+         continue;
+      }
+
+      now = bson_get_monotonic_time ();
+      load_collect (workers, load.n_threads, interval);
+      memset (&sum, 0, sizeof sum);
+
+      for (op = 0; op < LOAD_N_OPS; op++) {
+         load_histogram_merge (&sum, &interval [op]);
+         load_histogram_merge (&totals [op], &interval [op]);
+      }
+
+      secs = (now - last_report) / 1000000.0;
+      last_report = now;
+
+      printf ("%7.1fs %10.1f %8llu %9lld %9lld %9lld %9lld\n",
+              (now - load.started) / 1000000.0,
+              secs > 0 ? sum.count / secs : 0.0,
+              (unsigned long long)sum.errors,
+              (long long)load_histogram_percentile (&sum, 0.5),
+              (long long)load_histogram_percentile (&sum, 0.99),
+              (long long)load_histogram_percentile (&sum, 0.999),
+              (long long)sum.max_usec);
+      fflush (stdout);
    }
 
-   if (argc > 2) {
-      count = BSON_MAX(atoi(argv[2]), 1);
+   bson_atomic_int_add (&load.stop, 1);
+
+   for (i = 0; i < load.n_threads; i++) {
+      mongoc_thread_join (workers [i].thread);
    }
 
-   pool = mongoc_client_pool_new(uri);
-   client = mongoc_client_pool_pop(pool);
-   test_load(client, count);
-   mongoc_client_pool_push(pool, client);
-   mongoc_uri_destroy(uri);
-   mongoc_client_pool_destroy(pool);
+   now = bson_get_monotonic_time ();
+   secs = (now - load.started) / 1000000.0;
+
+   load_collect (workers, load.n_threads, interval);
+   memset (&sum, 0, sizeof sum);
+
+   printf ("\n%u threads, %s, %.1f seconds\n\n", load.n_threads,
+           load.rate > 0 ? "open loop" : "closed loop", secs);
+   if (load.rate > 0) {
+      printf ("target %.1f ops/s\n\n", load.rate);
+   }
+   printf ("%-8s %10s %10s %8s %9s %9s %9s %9s\n",
+           "op", "count", "ops/s", "errors", "p50", "p99", "p99.9", "max");
+
+   for (op = 0; op < LOAD_N_OPS; op++) {
+      load_histogram_merge (&totals [op], &interval [op]);
+      load_histogram_merge (&sum, &totals [op]);
+      if (load.mix [op]) {
+         load_print_row (gOpNames [op], &totals [op], secs);
+      }
+   }
+
+   load_print_row ("total", &sum, secs);
+
+   for (i = 0; i < load.n_threads; i++) {
+      mongoc_mutex_destroy (&workers [i].mutex);
+   }
+
+   load_finish (&load);
+
+   bson_free (workers);
+   bson_free (load.payload);
+   bson_free (db);
+   bson_free (pooled_uri);
+   mongoc_client_pool_destroy (load.pool);
+   mongoc_uri_destroy (uri);
 
-   mongoc_cleanup();
+   mongoc_cleanup ();
 
-   return 0;
+   return sum.errors ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,144 @@
+#include <bcon.h>
+#include <mongoc.h>
+#include <mongoc-bson-index-private.h>
+
+#include "TestSuite.h"
+
+
+static void
+test_bson_index_docs (void)
+{
+   mongoc_bson_index_t index;
+   bson_writer_t *writer;
+   bson_error_t error;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   size_t len;
+   bson_t *b;
+   bson_t doc;
+   bson_iter_t iter;
+   int i;
+
+   writer = bson_writer_new (&buf, &buflen, 0, bson_realloc_ctx, NULL);
+
+   for (i = 0; i < 100; i++) {
+      bson_writer_begin (writer, &b);
+      BSON_APPEND_INT32 (b, "i", i);
+      bson_writer_end (writer);
+   }
+
+   len = bson_writer_get_length (writer);
+
+   _mongoc_bson_index_init (&index);
+
+   assert (_mongoc_bson_index_docs (&index, buf, len,
+                                    MONGOC_BSON_INDEX_CHECK_NUL, &error));
+   assert (_mongoc_bson_index_count (&index) == 100);
+   assert (index.len == len);
+
+   for (i = 0; i < 100; i++) {
+      assert (_mongoc_bson_index_get (&index, i, &doc));
+      assert (bson_iter_init_find (&iter, &doc, "i"));
+      assert (bson_iter_int32 (&iter) == i);
+   }
+
+   assert (!_mongoc_bson_index_get (&index, 100, &doc));
+
+   /* a document cut short, allowed or not */
+   assert (!_mongoc_bson_index_docs (&index, buf, len - 3,
+                                     MONGOC_BSON_INDEX_NONE, &error));
+   assert (error.domain == MONGOC_ERROR_BSON);
+   assert (_mongoc_bson_index_count (&index) == 99);
+
+   assert (_mongoc_bson_index_docs (&index, buf, len - 3,
+                                    MONGOC_BSON_INDEX_ALLOW_PARTIAL, &error));
+   assert (_mongoc_bson_index_count (&index) == 99);
+   assert (index.len == len - len / 100);
+
+   /* a missing NUL, and a bogus length */
+   buf [len - 1] = 1;
+   assert (_mongoc_bson_index_docs (&index, buf, len,
+                                    MONGOC_BSON_INDEX_NONE, &error));
+   assert (!_mongoc_bson_index_docs (&index, buf, len,
+                                     MONGOC_BSON_INDEX_CHECK_NUL, &error));
+   buf [len - 1] = 0;
+
+   buf [0] = 4;
+   assert (!_mongoc_bson_index_docs (&index, buf, len,
+                                     MONGOC_BSON_INDEX_NONE, &error));
+   assert (_mongoc_bson_index_count (&index) == 0);
+
+   assert (_mongoc_bson_index_docs (&index, NULL, 0,
+                                    MONGOC_BSON_INDEX_NONE, &error));
+   assert (_mongoc_bson_index_count (&index) == 0);
+
+   _mongoc_bson_index_destroy (&index);
+   bson_writer_destroy (writer);
+   bson_free (buf);
+}
+
+
+static void
+test_bson_index_partition (void)
+{
+   mongoc_bson_index_t index;
+   bson_writer_t *writer;
+   bson_error_t error;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   size_t first;
+   size_t last;
+   size_t next;
+   bson_t *b;
+   uint32_t n_parts;
+   uint32_t part;
+   int i;
+
+   writer = bson_writer_new (&buf, &buflen, 0, bson_realloc_ctx, NULL);
+
+   /* one large document among small ones */
+   for (i = 0; i < 10; i++) {
+      bson_writer_begin (writer, &b);
+      BSON_APPEND_UTF8 (b, "s", i == 3 ?
+                        "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx"
+                        "xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx" :
+                        "x");
+      bson_writer_end (writer);
+   }
+
+   _mongoc_bson_index_init (&index);
+   assert (_mongoc_bson_index_docs (&index, buf,
+                                    bson_writer_get_length (writer),
+                                    MONGOC_BSON_INDEX_NONE, &error));
+
+   /* the parts cover every document once, in order */
+   for (n_parts = 1; n_parts <= 12; n_parts++) {
+      next = 0;
+
+      for (part = 0; part < n_parts; part++) {
+         _mongoc_bson_index_partition (&index, n_parts, part, &first, &last);
+         assert (first == next);
+         assert (last >= first);
+         next = last;
+      }
+
+      assert (next == 10);
+   }
+
+   /* split by bytes, the large document gets a part to itself */
+   _mongoc_bson_index_partition (&index, 2, 0, &first, &last);
+   assert (first == 0);
+   assert (last == 4);
+
+   _mongoc_bson_index_destroy (&index);
+   bson_writer_destroy (writer);
+   bson_free (buf);
+}
+
+
+void
+test_bson_index_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/BsonIndex/docs", test_bson_index_docs);
+   TestSuite_Add (suite, "/BsonIndex/partition", test_bson_index_partition);
+}
@@ -34,8 +34,79 @@ test_mongoc_buffer_basic (void)
 }
 
 
+static void
+test_mongoc_buffer_fill_in_place (void)
+{
+   mongoc_stream_t *stream;
+   mongoc_buffer_t buf;
+   bson_error_t error = { 0 };
+   uint8_t head[100];
+   ssize_t r;
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   ASSERT(stream);
+
+   memset (head, 'a', sizeof head);
+
+   _mongoc_buffer_init(&buf, NULL, 1024, NULL, NULL);
+   _mongoc_buffer_append(&buf, head, sizeof head);
+
+   /* consume half of what is buffered. */
+   buf.off += 50;
+   buf.len -= 50;
+
+   /* there is room after the unread data, so it is not moved. */
+   r = _mongoc_buffer_fill(&buf, stream, 60, 0, &error);
+   ASSERT_CMPINT((int)r, ==, 974);
+   ASSERT(buf.off == 50);
+   ASSERT(buf.data[50] == 'a' && buf.data[99] == 'a');
+
+   /* an empty buffer starts over at the front. */
+   buf.off += buf.len;
+   buf.len = 0;
+   r = _mongoc_buffer_fill(&buf, stream, 16, 0, &error);
+   ASSERT_CMPINT((int)r, ==, 1024);
+   ASSERT(buf.off == 0);
+
+   _mongoc_buffer_destroy(&buf);
+
+   mongoc_stream_destroy(stream);
+}
+
+
+static void
+test_mongoc_buffer_shrink (void)
+{
+   mongoc_buffer_t buf;
+   uint8_t data[16] = { 0 };
+
+   _mongoc_buffer_init(&buf, NULL, 0, NULL, NULL);
+
+   _mongoc_buffer_reserve(&buf, 2 * 1024 * 1024);
+   ASSERT(buf.datalen == 2 * 1024 * 1024);
+
+   /* a buffer that still holds data is left alone. */
+   _mongoc_buffer_append(&buf, data, sizeof data);
+   _mongoc_buffer_shrink(&buf);
+   ASSERT(buf.datalen == 2 * 1024 * 1024);
+
+   _mongoc_buffer_clear(&buf, false);
+   _mongoc_buffer_shrink(&buf);
+   ASSERT(buf.datalen < 2 * 1024 * 1024);
+   ASSERT(buf.off == 0 && buf.len == 0);
+
+   /* growing again may reuse the pooled memory. */
+   _mongoc_buffer_reserve(&buf, 2 * 1024 * 1024);
+   ASSERT(buf.datalen == 2 * 1024 * 1024);
+
+   _mongoc_buffer_destroy(&buf);
+}
+
+
 void
 test_buffer_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Buffer/Basic", test_mongoc_buffer_basic);
+   TestSuite_Add (suite, "/Buffer/fill_in_place", test_mongoc_buffer_fill_in_place);
+   TestSuite_Add (suite, "/Buffer/shrink", test_mongoc_buffer_shrink);
 }
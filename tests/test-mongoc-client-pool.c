@@ -1,9 +1,19 @@
 #include <mongoc.h>
 #include "mongoc-client-pool-private.h"
+#include "mongoc-client-private.h"
+#include "mongoc-cluster-monitor-private.h"
+#include "mongoc-cursor-private.h"
 #include "mongoc-array-private.h"
+#include "mongoc-thread-private.h"
 
+#ifndef _WIN32
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
 
+#include "mock-server.h"
 #include "TestSuite.h"
+#include "test-libmongoc.h"
 
 
 static void
@@ -74,10 +84,1419 @@ test_mongoc_client_pool_min_size_dispose (void)
    mongoc_client_pool_destroy (pool);
 }
 
+
+static void
+test_mongoc_client_pool_warm (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   char *uri_str;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=4&minpoolsize=3");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   assert (mongoc_client_pool_warm (pool, &error));
+   assert (mongoc_client_pool_get_size (pool) == 3);
+
+   /* already warm */
+   assert (mongoc_client_pool_warm (pool, &error));
+   assert (mongoc_client_pool_get_size (pool) == 3);
+
+   client = mongoc_client_pool_pop (pool);
+   assert (client);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_max_idle_time (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   char *uri_str;
+   uint32_t i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=1&minpoolsize=1&maxidletimems=1");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   assert (mongoc_client_pool_warm (pool, &error));
+
+   client = mongoc_client_pool_pop (pool);
+   assert (client);
+   mongoc_client_pool_push (pool, client);
+
+   usleep (5000);
+
+   /* idle for too long, the streams are closed but the client is kept */
+   client = mongoc_client_pool_pop (pool);
+   assert (client);
+   for (i = 0; i < client->cluster.nodes_len; i++) {
+      assert (!client->cluster.nodes [i].stream);
+   }
+   assert (mongoc_client_pool_get_size (pool) == 1);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_stats (void)
+{
+   mongoc_client_pool_stats_t stats;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client1;
+   mongoc_client_t *client2;
+   mongoc_uri_t *uri;
+   uint64_t n = 0;
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=2");
+   pool = mongoc_client_pool_new (uri);
+
+   client1 = mongoc_client_pool_pop (pool);
+   client2 = mongoc_client_pool_pop (pool);
+   assert (client1 && client2);
+   assert (!mongoc_client_pool_try_pop (pool));
+
+   mongoc_client_pool_get_stats (pool, &stats);
+   assert (stats.size == 2);
+   assert (stats.idle == 0);
+   assert (stats.checked_out == 2);
+   assert (stats.waiting == 0);
+   assert (stats.n_checkouts == 2);
+   assert (stats.n_exhausted == 1);
+
+   for (i = 0; i < MONGOC_CLIENT_POOL_STATS_N_BUCKETS; i++) {
+      n += stats.checkout_usec [i];
+   }
+   assert (n == stats.n_checkouts);
+
+   mongoc_client_pool_push (pool, client1);
+
+   mongoc_client_pool_get_stats (pool, &stats);
+   assert (stats.idle == 1);
+   assert (stats.checked_out == 1);
+
+   mongoc_client_pool_push (pool, client2);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_shared_topology (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client1;
+   mongoc_client_t *client2;
+   mongoc_uri_t *uri;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=2");
+   pool = mongoc_client_pool_new (uri);
+   client1 = mongoc_client_pool_pop (pool);
+   client2 = mongoc_client_pool_pop (pool);
+   assert (client1);
+   assert (client2);
+   assert (client1->cluster.monitor);
+   assert (client1->cluster.monitor == client2->cluster.monitor);
+   mongoc_client_pool_push (pool, client1);
+   mongoc_client_pool_push (pool, client2);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void *
+pop_push_worker (void *data)
+{
+   mongoc_client_pool_t *pool = data;
+   mongoc_client_t *client;
+   int i;
+
+   for (i = 0; i < 1000; i++) {
+      client = mongoc_client_pool_pop (pool);
+      assert (client);
+      mongoc_client_pool_push (pool, client);
+   }
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_threads (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_thread_t threads[16];
+   mongoc_uri_t *uri;
+   int i;
+
+   /* more threads than clients, so some wait for a push */
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=4&minpoolsize=4");
+   pool = mongoc_client_pool_new (uri);
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_create (&threads[i], pop_push_worker, pool);
+   }
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   assert (mongoc_client_pool_get_size (pool) <= 4);
+
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t      *client;
+} pop_worker_t;
+
+
+static void *
+pop_worker (void *data)
+{
+   pop_worker_t *worker = data;
+
+   worker->client = mongoc_client_pool_pop (worker->pool);
+
+   return NULL;
+}
+
+
+static mongoc_client_t *
+pop_from_thread (mongoc_client_pool_t *pool)
+{
+   mongoc_thread_t thread;
+   pop_worker_t worker = { pool, NULL };
+
+   mongoc_thread_create (&thread, pop_worker, &worker);
+   mongoc_thread_join (thread);
+
+   return worker.client;
+}
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   mongoc_mutex_t        mutex;
+   mongoc_array_t        clients;
+   int                   n_failures;
+} run_worker_t;
+
+
+static bool
+run_ping (mongoc_client_t *client,
+          void            *data,
+          bson_error_t    *error)
+{
+   run_worker_t *worker = data;
+   bson_t ping = BSON_INITIALIZER;
+   bool r;
+   size_t i;
+
+   BSON_APPEND_INT32 (&ping, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &ping, NULL, NULL, error);
+   bson_destroy (&ping);
+
+   mongoc_mutex_lock (&worker->mutex);
+   for (i = 0; i < worker->clients.len; i++) {
+      if (_mongoc_array_index (&worker->clients, mongoc_client_t *, i) == client) {
+         break;
+      }
+   }
+   if (i == worker->clients.len) {
+      _mongoc_array_append_val (&worker->clients, client);
+   }
+   mongoc_mutex_unlock (&worker->mutex);
+
+   return r;
+}
+
+
+static void *
+run_worker (void *data)
+{
+   run_worker_t *worker = data;
+   bson_error_t error;
+   int i;
+
+   for (i = 0; i < 100; i++) {
+      if (!mongoc_client_pool_run (worker->pool, -1, run_ping, worker,
+                                   &error)) {
+         mongoc_mutex_lock (&worker->mutex);
+         worker->n_failures++;
+         mongoc_mutex_unlock (&worker->mutex);
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_run (void)
+{
+   mongoc_thread_t threads[16];
+   run_worker_t worker;
+   mongoc_uri_t *uri;
+   char *uri_str;
+   int i;
+
+   /* sixteen threads share the pool, but only ever use two clients */
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=2");
+   uri = mongoc_uri_new (uri_str);
+   worker.pool = mongoc_client_pool_new (uri);
+   worker.n_failures = 0;
+   mongoc_mutex_init (&worker.mutex);
+   _mongoc_array_init (&worker.clients, sizeof (mongoc_client_t *));
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_create (&threads[i], run_worker, &worker);
+   }
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   assert (!worker.n_failures);
+   assert (worker.clients.len <= 2);
+   assert (mongoc_client_pool_get_size (worker.pool) <= 2);
+
+   _mongoc_array_destroy (&worker.clients);
+   mongoc_mutex_destroy (&worker.mutex);
+   mongoc_client_pool_destroy (worker.pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
+}
+
+
+typedef struct
+{
+   mongoc_client_pool_t *pool;
+   mongoc_mutex_t        mutex;
+   int                   next_id;
+   int                   n_failures;
+   int                   n_duplicates;
+} insert_worker_t;
+
+
+static void *
+insert_worker (void *data)
+{
+   insert_worker_t *worker = data;
+   bson_error_t error;
+   bson_t doc;
+   int id;
+   int i;
+
+   for (i = 0; i < 50; i++) {
+      mongoc_mutex_lock (&worker->mutex);
+      id = worker->next_id++;
+      mongoc_mutex_unlock (&worker->mutex);
+
+      /* every tenth document repeats the _id of the one before */
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", (id % 10) ? id : id - 1);
+
+      if (!mongoc_client_pool_insert (worker->pool, "test",
+                                      "test_client_pool_insert",
+                                      MONGOC_INSERT_NONE, &doc, NULL,
+                                      &error)) {
+         mongoc_mutex_lock (&worker->mutex);
+         if (error.domain == MONGOC_ERROR_COMMAND && error.code == 11000) {
+            worker->n_duplicates++;
+         } else {
+            worker->n_failures++;
+         }
+         mongoc_mutex_unlock (&worker->mutex);
+      }
+
+      bson_destroy (&doc);
+   }
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_insert (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_thread_t threads[16];
+   insert_worker_t worker;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   char *uri_str;
+   int i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=2");
+   uri = mongoc_uri_new (uri_str);
+   worker.pool = mongoc_client_pool_new (uri);
+   worker.next_id = 1;
+   worker.n_failures = 0;
+   worker.n_duplicates = 0;
+   mongoc_mutex_init (&worker.mutex);
+
+   client = mongoc_client_pool_pop (worker.pool);
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_client_pool_insert");
+   mongoc_collection_drop (collection, &error);
+   mongoc_client_pool_push (worker.pool, client);
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_create (&threads[i], insert_worker, &worker);
+   }
+
+   for (i = 0; i < 16; i++) {
+      mongoc_thread_join (threads[i]);
+   }
+
+   /* only the repeated _ids fail, each for its own submitter */
+   assert (!worker.n_failures);
+   assert (worker.n_duplicates == 16 * 50 / 10);
+
+   client = mongoc_client_pool_pop (worker.pool);
+   assert (16 * 50 * 9 / 10 == mongoc_collection_count (collection,
+                                                        MONGOC_QUERY_NONE,
+                                                        NULL, 0, 0, NULL,
+                                                        &error));
+   assert (mongoc_collection_drop (collection, &error));
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (worker.pool, client);
+
+   mongoc_mutex_destroy (&worker.mutex);
+   mongoc_client_pool_destroy (worker.pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
+}
+
+typedef struct
+{
+   mongoc_client_t *client;
+   bson_t           doc;
+   bool             found;
+} coalesce_worker_t;
+
+
+static void *
+coalesce_worker (void *data)
+{
+   coalesce_worker_t *worker = data;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t query = BSON_INITIALIZER;
+
+   collection = mongoc_client_get_collection (worker->client, "test",
+                                              "test_query_coalescing");
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    &query, NULL, NULL);
+
+   if (mongoc_cursor_next (cursor, &doc)) {
+      bson_copy_to (doc, &worker->doc);
+      worker->found = true;
+   }
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+   bson_destroy (&query);
+
+   return NULL;
+}
+
+
+static void
+test_mongoc_client_pool_query_coalescing (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_query_flight_t *flight;
+   coalesce_worker_t worker = { 0 };
+   mongoc_client_pool_t *pool;
+   mongoc_cursor_t *cursor;
+   mongoc_thread_t thread;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_t query = BSON_INITIALIZER;
+   bson_iter_t iter;
+   bson_t *reply;
+   uint32_t refs;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/");
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_query_coalescing (pool, true);
+
+   client = mongoc_client_pool_pop (pool);
+   worker.client = mongoc_client_pool_pop (pool);
+   assert (client->query_flights);
+   assert (client->query_flights == worker.client->query_flights);
+
+   /* put the query of this client on the wire, as far as the pool knows */
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_query_coalescing");
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    &query, NULL, NULL);
+   assert (cursor->flight_key);
+   flight = _mongoc_query_flights_take_off (client->query_flights,
+                                            cursor->ns, cursor->flight_key);
+   assert (flight);
+   assert (!_mongoc_query_flights_take_off (client->query_flights,
+                                            cursor->ns, cursor->flight_key));
+
+   mongoc_thread_create (&thread, coalesce_worker, &worker);
+
+   do {
+      mongoc_mutex_lock (&client->query_flights->mutex);
+      refs = flight->refs;
+      mongoc_mutex_unlock (&client->query_flights->mutex);
+   } while (refs < 2);
+
+   /* the other client gets this reply without a server to ask */
+   reply = BCON_NEW ("hello", "world");
+   _mongoc_query_flights_land (client->query_flights, flight,
+                               bson_get_data (reply), reply->len);
+   mongoc_thread_join (thread);
+
+   assert (worker.found);
+   assert (bson_iter_init_find (&iter, &worker.doc, "hello"));
+   assert (!strcmp (bson_iter_utf8 (&iter, NULL), "world"));
+   assert (!client->query_flights->head);
+
+   bson_destroy (&worker.doc);
+   bson_destroy (reply);
+   bson_destroy (&query);
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, worker.client);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_client_pool_lanes (void)
+{
+   mongoc_client_pool_lane_opts_t opts = { 0 };
+   mongoc_client_pool_stats_t stats;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_client_t *bulk;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxPoolSize=1");
+   pool = mongoc_client_pool_new (uri);
+
+   opts.max_size = 1;
+   opts.socket_timeout_msec = 1234;
+   opts.max_write_batch_size = 10;
+   mongoc_client_pool_set_lane (pool, MONGOC_CLIENT_POOL_LANE_BULK, &opts);
+
+   /* the lane has clients of its own, beyond maxPoolSize */
+   client = mongoc_client_pool_pop (pool);
+   bulk = mongoc_client_pool_pop_lane (pool, MONGOC_CLIENT_POOL_LANE_BULK, 0,
+                                       &error);
+   assert (client);
+   assert (bulk);
+   assert (bulk != client);
+   assert (bulk->cluster.sockettimeoutms == 1234);
+   assert (bulk->cluster.max_write_batch_size == 10);
+   assert (client->cluster.max_write_batch_size == 0);
+
+   assert (!mongoc_client_pool_pop_lane (pool, MONGOC_CLIENT_POOL_LANE_BULK,
+                                         0, &error));
+   assert (error.domain == MONGOC_ERROR_CLIENT);
+   assert (error.code == MONGOC_ERROR_CLIENT_POOL_EXHAUSTED);
+
+   /* a lane nothing is reserved for shares the exhausted pool */
+   assert (!mongoc_client_pool_pop_lane (pool,
+                                         MONGOC_CLIENT_POOL_LANE_INTERACTIVE,
+                                         0, &error));
+
+   mongoc_client_pool_get_lane_stats (pool, MONGOC_CLIENT_POOL_LANE_BULK,
+                                      &stats);
+   assert (stats.size == 1);
+   assert (stats.checked_out == 1);
+   assert (stats.n_checkouts == 1);
+   assert (stats.n_exhausted == 1);
+
+   mongoc_client_pool_get_stats (pool, &stats);
+   assert (stats.size == 1);
+
+   /* pushed back to its lane, not to the pool */
+   mongoc_client_pool_push (pool, bulk);
+   mongoc_client_pool_get_lane_stats (pool, MONGOC_CLIENT_POOL_LANE_BULK,
+                                      &stats);
+   assert (stats.idle == 1);
+   assert (mongoc_client_pool_pop_lane (pool, MONGOC_CLIENT_POOL_LANE_BULK, 0,
+                                        &error) == bulk);
+
+   /* released, the lane lets go of its clients as they come back */
+   mongoc_client_pool_set_lane (pool, MONGOC_CLIENT_POOL_LANE_BULK, NULL);
+   mongoc_client_pool_push (pool, bulk);
+   mongoc_client_pool_get_lane_stats (pool, MONGOC_CLIENT_POOL_LANE_BULK,
+                                      &stats);
+   assert (stats.size == 0);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+
+static void
+test_mongoc_client_pool_node_limiter (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_node_limit_t *limits[4];
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   double limit;
+   int i;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/?maxConcurrentOpsPerNode=4");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   assert (client->cluster.limiter);
+   assert (client->cluster.limiter->max == 4);
+
+   /* the limit starts at maxConcurrentOpsPerNode below the initial one */
+   for (i = 0; i < 4; i++) {
+      limits[i] = _mongoc_node_limiter_acquire (client->cluster.limiter,
+                                                "a:27017");
+      assert (limits[i]);
+      assert (limits[i] == limits[0]);
+   }
+
+   assert (!_mongoc_node_limiter_acquire (client->cluster.limiter,
+                                          "a:27017"));
+   assert (_mongoc_node_limiter_saturated (client->cluster.limiter,
+                                           "a:27017"));
+   assert (!_mongoc_node_limiter_saturated (client->cluster.limiter,
+                                            "b:27017"));
+
+   /* it never grows past the maximum */
+   _mongoc_node_limit_release (limits[0], 1000, false);
+   assert (limits[0]->limit == 4.0);
+   assert (limits[0]->in_flight == 3);
+
+   /* slow replies and lost ones shrink it, but not below one */
+   _mongoc_node_limit_release (limits[1], 10000, false);
+   limit = limits[0]->limit;
+   assert (limit < 4.0);
+   _mongoc_node_limit_release (limits[2], 0, true);
+   _mongoc_node_limit_release (limits[3], 0, true);
+   assert (limits[0]->limit <= limit);
+   assert (limits[0]->limit >= 1.0);
+   assert (limits[0]->in_flight == 0);
+   assert (_mongoc_node_limiter_acquire (client->cluster.limiter,
+                                         "a:27017") == limits[0]);
+   _mongoc_node_limit_release (limits[0], 0, false);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+
+   /* off unless asked for */
+   uri = mongoc_uri_new ("mongodb://127.0.0.1/");
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+   assert (!client->cluster.limiter);
+   mongoc_client_pool_push (pool, client);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+
+#ifndef _WIN32
+static bool
+ping_pool (mongoc_client_pool_t *pool)
+{
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t cmd = BSON_INITIALIZER;
+   bool r;
+
+   client = mongoc_client_pool_pop (pool);
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   mongoc_client_pool_push (pool, client);
+   bson_destroy (&cmd);
+
+   return r;
+}
+
+
+static void
+test_mongoc_client_pool_reset_after_fork (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_uri_t *uri;
+   char *uri_str;
+   pid_t pid;
+   int status;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=1");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   assert (ping_pool (pool));
+
+   pid = fork ();
+   assert (pid != -1);
+
+   if (pid == 0) {
+      mongoc_client_pool_reset_after_fork (pool);
+      status = ping_pool (pool) ? 0 : 1;
+      mongoc_client_pool_destroy (pool);
+      _exit (status);
+   }
+
+   assert (waitpid (pid, &status, 0) == pid);
+   assert (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+
+   /* the child must not have touched the connection of the parent */
+   assert (ping_pool (pool));
+
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   bson_free (uri_str);
+}
+#endif
+
+
+#ifdef MONGOC_ENABLE_SSL
+static void
+test_mongoc_client_pool_ssl_ctx (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_ssl_opt_t opts = { 0 };
+   mongoc_client_t *a;
+   mongoc_client_t *b;
+   mongoc_uri_t *uri;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=2");
+   pool = mongoc_client_pool_new (uri);
+
+   opts.ca_file = "tests/trust_dir/verify/mongo_root.pem";
+   mongoc_client_pool_set_ssl_opts (pool, &opts);
+
+   /* the CA file is loaded once for the pool, not for each client */
+   a = mongoc_client_pool_pop (pool);
+   b = mongoc_client_pool_pop (pool);
+   assert (a->ssl_ctx);
+   assert (a->ssl_ctx == b->ssl_ctx);
+
+   mongoc_client_pool_push (pool, a);
+   mongoc_client_pool_push (pool, b);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+}
+#endif
+
+
+static void
+test_mongoc_client_pool_wait_queue (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_thread_t thread;
+   pop_worker_t worker;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   int64_t start;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=1&waitqueuemultiple=1");
+   pool = mongoc_client_pool_new (uri);
+
+   client = mongoc_client_pool_pop (pool);
+   assert (client);
+
+   start = bson_get_monotonic_time ();
+   assert (!mongoc_client_pool_pop_timeout (pool, 10, &error));
+   assert (bson_get_monotonic_time () - start >= 10000);
+   assert (error.domain == MONGOC_ERROR_CLIENT);
+   assert (error.code == MONGOC_ERROR_CLIENT_POOL_EXHAUSTED);
+
+   /* one thread waits, which is all waitQueueMultiple allows */
+   worker.pool = pool;
+   worker.client = NULL;
+   mongoc_thread_create (&thread, pop_worker, &worker);
+   usleep (50000);
+
+   start = bson_get_monotonic_time ();
+   assert (!mongoc_client_pool_pop_timeout (pool, 1000, &error));
+   assert (bson_get_monotonic_time () - start < 1000000);
+   assert (error.code == MONGOC_ERROR_CLIENT_POOL_EXHAUSTED);
+
+   mongoc_client_pool_push (pool, client);
+   mongoc_thread_join (thread);
+   assert (worker.client == client);
+   mongoc_client_pool_push (pool, client);
+
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_thread_affinity (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client1;
+   mongoc_client_t *client2;
+   mongoc_uri_t *uri;
+
+   uri = mongoc_uri_new ("mongodb://127.0.0.1?maxpoolsize=2&minpoolsize=2");
+   pool = mongoc_client_pool_new (uri);
+   mongoc_client_pool_set_thread_affinity (pool, true);
+
+   client1 = mongoc_client_pool_pop (pool);
+   client2 = mongoc_client_pool_pop (pool);
+   assert (client1 && client2);
+
+   /* the client pushed last comes back first */
+   mongoc_client_pool_push (pool, client2);
+   mongoc_client_pool_push (pool, client1);
+   assert (mongoc_client_pool_pop (pool) == client1);
+
+   /* the client it replaced was shared and is still handed out */
+   assert (mongoc_client_pool_pop (pool) == client2);
+   assert (!mongoc_client_pool_try_pop (pool));
+
+   /* a kept client goes to another thread once none is idle */
+   mongoc_client_pool_push (pool, client2);
+   assert (pop_from_thread (pool) == client2);
+
+   mongoc_client_pool_push (pool, client1);
+   mongoc_client_pool_push (pool, client2);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static bool
+parallel_find_cb (const bson_t *doc,
+                  void         *data)
+{
+   bson_atomic_int_add ((int32_t *)data, 1);
+
+   return true;
+}
+
+
+static void
+test_mongoc_client_pool_abandoned_cursors (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_cursor_t *open;
+   mongoc_cursor_t *drained;
+   mongoc_cursor_t *unsent;
+   mongoc_uri_t *uri;
+   const bson_t *doc;
+   bson_error_t error;
+   char *uri_str;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   bool r;
+   int i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=1");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   client = mongoc_client_pool_pop (pool);
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_abandoned_cursors");
+   mongoc_collection_drop (collection, NULL);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      assert (r);
+      bson_destroy (b);
+   }
+
+   open = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 2,
+                                  &q, NULL, NULL);
+   assert (mongoc_cursor_next (open, &doc));
+   assert (mongoc_cursor_get_id (open));
+
+   drained = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                     &q, NULL, NULL);
+   assert (mongoc_cursor_next (drained, &doc));
+   assert (!mongoc_cursor_get_id (drained));
+
+   unsent = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    &q, NULL, NULL);
+
+   /* the open server cursor is killed as the client goes back */
+   mongoc_client_pool_push (pool, client);
+   assert (!client->cluster.dead_cursors.len);
+   assert (!mongoc_cursor_get_id (open));
+   assert (!mongoc_cursor_next (open, &doc));
+   assert (mongoc_cursor_error (open, &error));
+   assert (error.domain == MONGOC_ERROR_CURSOR);
+
+   /* cursors without one are left alone */
+   assert (mongoc_cursor_next (drained, &doc));
+   assert (!mongoc_cursor_error (drained, &error));
+
+   assert (mongoc_client_pool_pop (pool) == client);
+   assert (mongoc_cursor_next (unsent, &doc));
+
+   mongoc_cursor_destroy (open);
+   mongoc_cursor_destroy (drained);
+   mongoc_cursor_destroy (unsent);
+   assert (!client->cluster.dead_cursors.len);
+   assert (!client->live_cursors);
+
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_parallel_find (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   int32_t n = 0;
+   char *uri_str;
+   bson_t *b;
+   bool r;
+   int i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=4");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   client = mongoc_client_pool_pop (pool);
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_parallel_find");
+   mongoc_collection_drop (collection, NULL);
+
+   for (i = 0; i < 1000; i++) {
+      b = BCON_NEW ("_id", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      assert (r);
+      bson_destroy (b);
+   }
+
+   mongoc_client_pool_push (pool, client);
+
+   r = mongoc_client_pool_parallel_find (pool, "test", "test_parallel_find",
+                                         NULL, NULL, 4, parallel_find_cb, &n,
+                                         &error);
+   assert (r);
+   assert (n == 1000);
+
+   client = mongoc_client_pool_pop (pool);
+   mongoc_collection_destroy (collection);
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_parallel_find");
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_tailer (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_pool_t *pool;
+   mongoc_database_t *database;
+   mongoc_client_t *client;
+   mongoc_tailer_t *tailer;
+   mongoc_uri_t *uri;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   char *uri_str;
+   bson_t *opts;
+   bson_t *b;
+   bool r;
+   int i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=2");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   client = mongoc_client_pool_pop (pool);
+   database = mongoc_client_get_database (client, "test");
+   collection = mongoc_client_get_collection (client, "test", "test_tailer");
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+
+   opts = BCON_NEW ("capped", BCON_BOOL (true), "size", BCON_INT32 (100000));
+   collection = mongoc_database_create_collection (database, "test_tailer",
+                                                   opts, &error);
+   assert (collection);
+   bson_destroy (opts);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("_id", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      assert (r);
+      bson_destroy (b);
+   }
+
+   tailer = mongoc_tailer_new (pool, "test", "test_tailer", NULL, "_id",
+                               MONGOC_QUERY_NONE, 4);
+
+   for (i = 0; i < 10; i++) {
+      doc = mongoc_tailer_next (tailer, 10000);
+      assert (doc);
+      assert (bson_iter_init_find (&iter, doc, "_id"));
+      assert (bson_iter_int32 (&iter) == i);
+   }
+
+   /* these arrive through the awaitData getmore in progress */
+   for (i = 10; i < 20; i++) {
+      b = BCON_NEW ("_id", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      assert (r);
+      bson_destroy (b);
+   }
+
+   for (i = 10; i < 20; i++) {
+      doc = mongoc_tailer_next (tailer, 10000);
+      assert (doc);
+      assert (bson_iter_init_find (&iter, doc, "_id"));
+      assert (bson_iter_int32 (&iter) == i);
+   }
+
+   assert (!mongoc_tailer_next (tailer, 0));
+   assert (!mongoc_tailer_error (tailer, &error));
+   mongoc_tailer_destroy (tailer);
+
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+   mongoc_database_destroy (database);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+static int32_t
+find_x (mongoc_collection_t *collection)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   bson_t query = BSON_INITIALIZER;
+   int32_t x = 0;
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    &query, NULL, NULL);
+   if (mongoc_cursor_next (cursor, &doc)) {
+      assert (bson_iter_init_find (&iter, doc, "x"));
+      x = bson_iter_int32 (&iter);
+   }
+   assert (!mongoc_cursor_error (cursor, NULL));
+   mongoc_cursor_destroy (cursor);
+
+   return x;
+}
+
+
+static void
+test_mongoc_client_pool_oplog_watcher (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_collection_t *writer_collection;
+   mongoc_oplog_watcher_t *watcher;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mongoc_client_t *writer;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   bson_t reply;
+   bson_t *cmd;
+   bson_t *b;
+   char *uri_str;
+   bool is_replset;
+   bool r;
+   int i;
+
+   uri_str = test_framework_get_uri_str ("mongodb://127.0.0.1?maxpoolsize=3");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   client = mongoc_client_pool_pop (pool);
+   writer = mongoc_client_pool_pop (pool);
+
+   /* only replica set members have an oplog */
+   cmd = BCON_NEW ("isMaster", BCON_INT32 (1));
+   r = mongoc_client_command_simple (client, "admin", cmd, NULL, &reply,
+                                     &error);
+   assert (r);
+   is_replset = bson_has_field (&reply, "setName");
+   bson_destroy (&reply);
+   bson_destroy (cmd);
+
+   if (!is_replset) {
+      goto cleanup;
+   }
+
+   collection = mongoc_client_get_collection (client, "test",
+                                              "test_oplog_watcher");
+   writer_collection = mongoc_client_get_collection (writer, "test",
+                                                     "test_oplog_watcher");
+   mongoc_collection_drop (writer_collection, NULL);
+
+   b = BCON_NEW ("_id", BCON_INT32 (1), "x", BCON_INT32 (1));
+   r = mongoc_collection_insert (writer_collection, MONGOC_INSERT_NONE, b,
+                                 NULL, &error);
+   assert (r);
+   bson_destroy (b);
+
+   watcher = mongoc_oplog_watcher_new (pool, &error);
+   assert (watcher);
+
+   mongoc_client_set_query_cache (client, 16, 0);
+   mongoc_client_set_query_cache_watcher (client, watcher);
+
+   assert (find_x (collection) == 1);
+
+   b = BCON_NEW ("$set", "{", "x", BCON_INT32 (2), "}");
+   cmd = BCON_NEW ("_id", BCON_INT32 (1));
+   r = mongoc_collection_update (writer_collection, MONGOC_UPDATE_NONE, cmd,
+                                 b, NULL, &error);
+   assert (r);
+   bson_destroy (cmd);
+   bson_destroy (b);
+
+   /* the write made by another client shows up through the oplog */
+   for (i = 0; i < 1000 && find_x (collection) != 2; i++) {
+      usleep (10 * 1000);
+   }
+   assert (find_x (collection) == 2);
+   assert (!mongoc_oplog_watcher_error (watcher, &error));
+
+   mongoc_client_set_query_cache_watcher (client, NULL);
+   mongoc_oplog_watcher_destroy (watcher);
+
+   mongoc_collection_drop (writer_collection, NULL);
+   mongoc_collection_destroy (writer_collection);
+   mongoc_collection_destroy (collection);
+
+cleanup:
+   mongoc_client_pool_push (pool, writer);
+   mongoc_client_pool_push (pool, client);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+typedef struct
+{
+   volatile int32_t discovered;
+   volatile int32_t primaries;
+   volatile int32_t created;
+   volatile int32_t destroyed;
+} topology_events_t;
+
+
+static void
+node_discovered (const mongoc_apm_node_discovered_t *event)
+{
+   topology_events_t *events = event->context;
+
+   assert (event->host);
+   assert (event->host->host_and_port[0]);
+   bson_atomic_int_add (&events->discovered, 1);
+}
+
+
+static void
+primary_changed (const mongoc_apm_primary_changed_t *event)
+{
+   topology_events_t *events = event->context;
+
+   assert (event->old_primary || event->new_primary);
+   bson_atomic_int_add (&events->primaries, 1);
+}
+
+
+static void
+pool_client_created (const mongoc_apm_pool_client_event_t *event)
+{
+   topology_events_t *events = event->context;
+
+   bson_atomic_int_add (&events->created, 1);
+}
+
+
+static void
+pool_client_destroyed (const mongoc_apm_pool_client_event_t *event)
+{
+   topology_events_t *events = event->context;
+
+   bson_atomic_int_add (&events->destroyed, 1);
+}
+
+
+static void
+test_mongoc_client_pool_topology_callbacks (void)
+{
+   mongoc_apm_topology_callbacks_t callbacks = { 0 };
+   topology_events_t events = { 0 };
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client1;
+   mongoc_client_t *client2;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   bson_t *cmd;
+   char *uri_str;
+   bool r;
+   int i;
+
+   uri_str = test_framework_get_uri_str (
+      "mongodb://127.0.0.1?maxpoolsize=2&minpoolsize=1");
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+
+   callbacks.node_discovered = node_discovered;
+   callbacks.primary_changed = primary_changed;
+   callbacks.pool_client_created = pool_client_created;
+   callbacks.pool_client_destroyed = pool_client_destroyed;
+   mongoc_client_pool_set_topology_callbacks (pool, &callbacks, &events);
+
+   client1 = mongoc_client_pool_pop (pool);
+   client2 = mongoc_client_pool_pop (pool);
+
+   cmd = BCON_NEW ("ping", BCON_INT32 (1));
+   r = mongoc_client_command_simple (client1, "admin", cmd, NULL, NULL,
+                                     &error);
+   assert (r);
+   bson_destroy (cmd);
+
+   /* above the minimum size, the idle client is destroyed by the push */
+   mongoc_client_pool_push (pool, client1);
+   mongoc_client_pool_push (pool, client2);
+
+   /* the monitor thread delivers the events after the fact */
+   for (i = 0; i < 1000; i++) {
+      if (bson_atomic_int_add (&events.discovered, 0) &&
+          bson_atomic_int_add (&events.created, 0) == 2 &&
+          bson_atomic_int_add (&events.destroyed, 0) == 1) {
+         break;
+      }
+      usleep (10 * 1000);
+   }
+
+   assert (bson_atomic_int_add (&events.discovered, 0) >= 1);
+   ASSERT_CMPINT (bson_atomic_int_add (&events.created, 0), ==, 2);
+   ASSERT_CMPINT (bson_atomic_int_add (&events.destroyed, 0), ==, 1);
+
+   mongoc_client_pool_set_topology_callbacks (pool, NULL, NULL);
+
+   bson_free (uri_str);
+   mongoc_uri_destroy (uri);
+   mongoc_client_pool_destroy (pool);
+}
+
+
+static void
+test_mongoc_client_pool_monitor_streams (void)
+{
+   mongoc_cluster_monitor_t *monitor;
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client1;
+   mongoc_client_t *client2;
+   mongoc_stream_t *standby_stream;
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   uint32_t standby_len;
+   uint16_t port;
+   char *uri_str;
+   bson_t cmd = BSON_INITIALIZER;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uri_str = bson_strdup_printf ("mongodb://127.0.0.1:%hu/?maxpoolsize=2"
+                                 "&heartbeatFrequencyMS=60000", port);
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+   client1 = mongoc_client_pool_pop (pool);
+   client2 = mongoc_client_pool_pop (pool);
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client1, "admin", &cmd, NULL, NULL,
+                                     &error);
+   assert (r);
+   r = mongoc_client_command_simple (client2, "admin", &cmd, NULL, NULL,
+                                     &error);
+   assert (r);
+
+   monitor = client1->cluster.monitor;
+   assert (monitor);
+   assert (monitor->shared);
+   assert (client2->cluster.monitor == monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   assert (monitor->standby);
+   standby_len = monitor->standby->nodes_len;
+   standby_stream = monitor->standby->nodes [0].stream;
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   /* the monitor keeps its nodes, each client connects on its own */
+   ASSERT_CMPINT (standby_len, ==, 1);
+   assert (standby_stream);
+   ASSERT_CMPINT (client1->cluster.nodes_len, ==, 1);
+   ASSERT_CMPINT (client2->cluster.nodes_len, ==, 1);
+   assert (client1->cluster.nodes [0].stream);
+   assert (client2->cluster.nodes [0].stream);
+   assert (client1->cluster.nodes [0].stream != standby_stream);
+   assert (client2->cluster.nodes [0].stream != standby_stream);
+   assert (client1->cluster.nodes [0].stream !=
+           client2->cluster.nodes [0].stream);
+
+   mongoc_client_pool_push (pool, client1);
+   mongoc_client_pool_push (pool, client2);
+   mongoc_client_pool_destroy (pool);
+   mongoc_uri_destroy (uri);
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_free (uri_str);
+}
+
+
+static void
+test_mongoc_client_pool_monitor_destroy (void)
+{
+   mongoc_client_pool_t *pool;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   mongoc_uri_t *uri;
+   bson_error_t error;
+   int64_t started;
+   uint16_t port;
+   char *uri_str;
+   bson_t cmd = BSON_INITIALIZER;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uri_str = bson_strdup_printf ("mongodb://127.0.0.1:%hu/?maxpoolsize=2"
+                                 "&heartbeatFrequencyMS=60000", port);
+   uri = mongoc_uri_new (uri_str);
+   pool = mongoc_client_pool_new (uri);
+   client = mongoc_client_pool_pop (pool);
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   assert (r);
+   assert (client->cluster.monitor);
+
+   /* the pool and its client each hold a reference on the monitor */
+   mongoc_mutex_lock (&client->cluster.monitor->mutex);
+   ASSERT_CMPINT (client->cluster.monitor->ref_count, ==, 2);
+   mongoc_mutex_unlock (&client->cluster.monitor->mutex);
+
+   mongoc_client_pool_push (pool, client);
+
+   /* let the monitor go back to sleep for the heartbeat interval */
+   usleep (50 * 1000);
+
+   /* the thread is woken and joined, not waited out */
+   started = bson_get_monotonic_time ();
+   mongoc_client_pool_destroy (pool);
+   assert ((bson_get_monotonic_time () - started) < 1000 * 1000);
+
+   mongoc_uri_destroy (uri);
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_free (uri_str);
+}
+
+
 void
 test_client_pool_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/ClientPool/basic", test_mongoc_client_pool_basic);
    TestSuite_Add (suite, "/ClientPool/try_pop", test_mongoc_client_pool_try_pop);
    TestSuite_Add (suite, "/ClientPool/min_size_dispose", test_mongoc_client_pool_min_size_dispose);
+   TestSuite_Add (suite, "/ClientPool/warm", test_mongoc_client_pool_warm);
+   TestSuite_Add (suite, "/ClientPool/max_idle_time", test_mongoc_client_pool_max_idle_time);
+   TestSuite_Add (suite, "/ClientPool/stats", test_mongoc_client_pool_stats);
+   TestSuite_Add (suite, "/ClientPool/shared_topology", test_mongoc_client_pool_shared_topology);
+   TestSuite_Add (suite, "/ClientPool/threads", test_mongoc_client_pool_threads);
+   TestSuite_Add (suite, "/ClientPool/wait_queue", test_mongoc_client_pool_wait_queue);
+   TestSuite_Add (suite, "/ClientPool/run", test_mongoc_client_pool_run);
+   TestSuite_Add (suite, "/ClientPool/insert", test_mongoc_client_pool_insert);
+   TestSuite_Add (suite, "/ClientPool/query_coalescing", test_mongoc_client_pool_query_coalescing);
+   TestSuite_Add (suite, "/ClientPool/node_limiter", test_mongoc_client_pool_node_limiter);
+   TestSuite_Add (suite, "/ClientPool/lanes", test_mongoc_client_pool_lanes);
+#ifdef MONGOC_ENABLE_SSL
+   TestSuite_Add (suite, "/ClientPool/ssl_ctx", test_mongoc_client_pool_ssl_ctx);
+#endif
+#ifndef _WIN32
+   TestSuite_Add (suite, "/ClientPool/reset_after_fork", test_mongoc_client_pool_reset_after_fork);
+#endif
+   TestSuite_Add (suite, "/ClientPool/thread_affinity", test_mongoc_client_pool_thread_affinity);
+   TestSuite_Add (suite, "/ClientPool/abandoned_cursors", test_mongoc_client_pool_abandoned_cursors);
+   TestSuite_Add (suite, "/ClientPool/parallel_find", test_mongoc_client_pool_parallel_find);
+   TestSuite_Add (suite, "/ClientPool/tailer", test_mongoc_client_pool_tailer);
+   TestSuite_Add (suite, "/ClientPool/oplog_watcher", test_mongoc_client_pool_oplog_watcher);
+   TestSuite_Add (suite, "/ClientPool/topology_callbacks", test_mongoc_client_pool_topology_callbacks);
+   TestSuite_Add (suite, "/ClientPool/monitor_streams", test_mongoc_client_pool_monitor_streams);
+   TestSuite_Add (suite, "/ClientPool/monitor_destroy", test_mongoc_client_pool_monitor_destroy);
 }
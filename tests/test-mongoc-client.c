@@ -4,6 +4,7 @@
 #include "mongoc-cursor-private.h"
 #include "mock-server.h"
 #include "mongoc-client-private.h"
+#include "mongoc-cluster-monitor-private.h"
 #include "mongoc-tests.h"
 #include "TestSuite.h"
 
@@ -674,6 +675,1777 @@ test_mongoc_client_ipv6 (void)
 }
 
 
+static void
+test_node_connections (void)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_client_t *client;
+   mongoc_stream_t *streams[3];
+   uint32_t generations[3];
+   bson_error_t error;
+   char *host;
+   char *uri;
+   bson_t reply;
+   bool r;
+
+   host = test_framework_get_host ();
+   uri = bson_strdup_printf ("mongodb://%s/?maxConnectionsPerNode=3", host);
+   client = test_framework_client_new (uri);
+   bson_free (host);
+   bson_free (uri);
+
+   r = mongoc_client_get_server_status (client, NULL, &reply, &error);
+   assert (r);
+   bson_destroy (&reply);
+
+   node = &client->cluster.nodes[0];
+   assert (node->stream);
+
+   /* node->stream counts against the limit, so only two extras */
+   streams[0] = _mongoc_cluster_node_checkout (&client->cluster, node,
+                                               &generations[0], &error);
+   assert (streams[0]);
+   assert (streams[0] != node->stream);
+   streams[1] = _mongoc_cluster_node_checkout (&client->cluster, node,
+                                               &generations[1], &error);
+   assert (streams[1]);
+   assert (streams[1] != streams[0]);
+   streams[2] = _mongoc_cluster_node_checkout (&client->cluster, node,
+                                               &generations[2], &error);
+   assert (!streams[2]);
+   assert (error.domain == MONGOC_ERROR_CLIENT);
+
+   /* an idle stream is handed out again */
+   _mongoc_cluster_node_checkin (&client->cluster, node, streams[1],
+                                 generations[1], true);
+   streams[2] = _mongoc_cluster_node_checkout (&client->cluster, node,
+                                               &generations[2], &error);
+   assert (streams[2] == streams[1]);
+
+   /* streams checked out before a disconnect are not reused */
+   _mongoc_cluster_disconnect_node (&client->cluster, node);
+   _mongoc_cluster_node_checkin (&client->cluster, node, streams[0],
+                                 generations[0], true);
+   _mongoc_cluster_node_checkin (&client->cluster, node, streams[2],
+                                 generations[2], true);
+   assert (node->conns->idle_len == 0);
+   assert (node->conns->in_use == 0);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_pipelined_replies (void)
+{
+   mongoc_client_t *client;
+   mongoc_buffer_t buffer;
+   mongoc_rpc_t rpcs[3];
+   mongoc_rpc_t reply;
+   uint32_t request_ids[3];
+   uint32_t hint = 0;
+   bson_error_t error;
+   bson_t cmd;
+   bson_t status;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+
+   r = mongoc_client_get_server_status (client, NULL, &status, &error);
+   assert (r);
+   bson_destroy (&status);
+
+   bson_init (&cmd);
+   bson_append_int32 (&cmd, "ping", 4, 1);
+
+   /* write all three requests before reading any reply */
+   for (i = 0; i < 3; i++) {
+      rpcs[i].query.msg_len = 0;
+      rpcs[i].query.request_id = 0;
+      rpcs[i].query.response_to = 0;
+      rpcs[i].query.opcode = MONGOC_OPCODE_QUERY;
+      rpcs[i].query.flags = MONGOC_QUERY_SLAVE_OK;
+      rpcs[i].query.collection = "admin.$cmd";
+      rpcs[i].query.skip = 0;
+      rpcs[i].query.n_return = -1;
+      rpcs[i].query.query = bson_get_data (&cmd);
+      rpcs[i].query.fields = NULL;
+
+      hint = _mongoc_cluster_try_sendv (&client->cluster, &rpcs[i], 1, hint,
+                                        NULL, NULL, &error);
+      assert (hint);
+      request_ids[i] = BSON_UINT32_FROM_LE (rpcs[i].header.request_id);
+   }
+
+   /* claim the replies out of order */
+   _mongoc_buffer_init (&buffer, NULL, 0, NULL, NULL);
+
+   for (i = 2; i >= 0; i--) {
+      _mongoc_buffer_clear (&buffer, false);
+      r = _mongoc_cluster_try_recv_reply (&client->cluster, &reply, &buffer,
+                                          hint, request_ids[i], &error);
+      assert (r);
+      assert (reply.header.opcode == MONGOC_OPCODE_REPLY);
+      assert ((uint32_t)reply.header.response_to == request_ids[i]);
+   }
+
+   assert (!client->cluster.nodes[hint - 1].pending_replies);
+
+   _mongoc_buffer_destroy (&buffer);
+   bson_destroy (&cmd);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+async_ping_cb (mongoc_async_t     *async,
+               bool                success,
+               const bson_t       *reply,
+               const bson_error_t *error,
+               void               *data)
+{
+   int *n_replies = data;
+
+   assert (success);
+   assert (reply);
+   (*n_replies)++;
+}
+
+
+static void
+test_async_command (void)
+{
+   mongoc_client_t *client;
+   mongoc_async_t *async;
+   mongoc_async_pollfd_t fds[1];
+   bson_error_t error;
+   bson_t cmd;
+   int n_replies = 0;
+   bool r;
+   int i;
+
+   if (test_framework_get_ssl ()) {
+      return;
+   }
+
+   client = test_framework_client_new (NULL);
+   async = mongoc_async_new ();
+
+   assert (mongoc_async_get_timeout (async) == -1);
+   assert (mongoc_async_perform (async, 0) == 0);
+
+   bson_init (&cmd);
+   bson_append_int32 (&cmd, "ping", 4, 1);
+
+   for (i = 0; i < 3; i++) {
+      r = mongoc_client_async_command (client, async, "admin", &cmd, NULL,
+                                       async_ping_cb, &n_replies, &error);
+      assert (r);
+   }
+
+   /* all three commands are pipelined over one connection */
+   assert (mongoc_async_get_pollfds (async, fds, 1) == 1);
+   assert (mongoc_async_get_timeout (async) >= 0);
+
+   while (mongoc_async_perform (async, -1)) { }
+
+   assert (n_replies == 3);
+   assert (mongoc_async_get_pollfds (async, fds, 1) == 0);
+
+   bson_destroy (&cmd);
+   mongoc_async_destroy (async);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_write_coalescing (void)
+{
+   mongoc_write_concern_t *wc;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t doc;
+   int64_t count;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   collection = get_test_collection (client, "test_write_coalescing");
+
+   wc = mongoc_write_concern_new ();
+   mongoc_write_concern_set_w (wc, MONGOC_WRITE_CONCERN_W_UNACKNOWLEDGED);
+
+   mongoc_client_set_write_coalescing (client, 1024 * 1024, 0);
+
+   for (i = 0; i < 100; i++) {
+      bson_init (&doc);
+      BSON_APPEND_INT32 (&doc, "_id", i);
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &doc, wc,
+                                    &error);
+      assert (r);
+      bson_destroy (&doc);
+   }
+
+   /* one buffered batch, sent before the count */
+   assert (client->coalesced.len == 1);
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL, 0,
+                                    0, NULL, &error);
+   assert (count == 100);
+   assert (!client->coalesced.len);
+
+   bson_init (&doc);
+   BSON_APPEND_INT32 (&doc, "_id", i);
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &doc, wc,
+                                 &error);
+   assert (r);
+   bson_destroy (&doc);
+
+   r = mongoc_client_flush (client, &error);
+   assert (r);
+   assert (!client->coalesced.len);
+
+   mongoc_client_set_write_coalescing (client, 0, 0);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   mongoc_write_concern_destroy (wc);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static int32_t
+find_x (mongoc_collection_t *collection,
+        const bson_t        *query)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_iter_t iter;
+   int32_t x;
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    query, NULL, NULL);
+   assert (mongoc_cursor_next (cursor, &doc));
+   assert (bson_iter_init_find (&iter, doc, "x"));
+   x = bson_iter_int32 (&iter);
+   assert (!mongoc_cursor_next (cursor, &doc));
+   assert (!mongoc_cursor_error (cursor, NULL));
+   mongoc_cursor_destroy (cursor);
+
+   return x;
+}
+
+
+static void
+test_query_cache (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_collection_t *other_collection;
+   mongoc_client_t *client;
+   mongoc_client_t *other;
+   bson_error_t error;
+   bson_t *doc;
+   bson_t *query;
+   bson_t *update;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   other = test_framework_client_new (NULL);
+   collection = get_test_collection (client, "test_query_cache");
+   other_collection = mongoc_client_get_collection (
+      other, "test", mongoc_collection_get_name (collection));
+
+   mongoc_client_set_query_cache (client, 16, 0);
+
+   doc = BCON_NEW ("_id", BCON_INT32 (1), "x", BCON_INT32 (1));
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, doc, NULL,
+                                 &error);
+   assert (r);
+
+   query = BCON_NEW ("_id", BCON_INT32 (1));
+   assert (find_x (collection, query) == 1);
+   assert (client->query_cache.n_entries == 1);
+
+   /* a change the client did not make is only seen once invalidated */
+   update = BCON_NEW ("$set", "{", "x", BCON_INT32 (2), "}");
+   r = mongoc_collection_update (other_collection, MONGOC_UPDATE_NONE, query,
+                                 update, NULL, &error);
+   assert (r);
+   assert (find_x (collection, query) == 1);
+
+   mongoc_client_invalidate_query_cache (client, "test", NULL);
+   assert (!client->query_cache.n_entries);
+   assert (find_x (collection, query) == 2);
+
+   /* writes through the client invalidate their collection */
+   bson_destroy (update);
+   update = BCON_NEW ("$set", "{", "x", BCON_INT32 (3), "}");
+   r = mongoc_collection_update (collection, MONGOC_UPDATE_NONE, query,
+                                 update, NULL, &error);
+   assert (r);
+   assert (!client->query_cache.n_entries);
+   assert (find_x (collection, query) == 3);
+
+   mongoc_client_set_query_cache (client, 0, 0);
+   assert (!client->query_cache.n_entries);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   bson_destroy (doc);
+   bson_destroy (query);
+   bson_destroy (update);
+   mongoc_collection_destroy (collection);
+   mongoc_collection_destroy (other_collection);
+   mongoc_client_destroy (client);
+   mongoc_client_destroy (other);
+}
+
+
+typedef struct
+{
+   int  n_started;
+   int  n_succeeded;
+   int  n_failed;
+   char command_name [32];
+} apm_counts_t;
+
+
+static void
+apm_started_cb (const mongoc_apm_command_started_t *event)
+{
+   apm_counts_t *counts = event->context;
+
+   counts->n_started++;
+   bson_strncpy (counts->command_name, event->command_name,
+                 sizeof counts->command_name);
+   assert (event->host);
+   assert (event->request_id);
+}
+
+
+static void
+apm_succeeded_cb (const mongoc_apm_command_succeeded_t *event)
+{
+   apm_counts_t *counts = event->context;
+
+   counts->n_succeeded++;
+   assert (event->duration_usec >= 0);
+   assert (event->reply_len > 0);
+}
+
+
+static void
+apm_failed_cb (const mongoc_apm_command_failed_t *event)
+{
+   apm_counts_t *counts = event->context;
+
+   counts->n_failed++;
+}
+
+
+static void
+test_apm_callbacks (void)
+{
+   mongoc_apm_callbacks_t callbacks = { 0 };
+   mongoc_client_t *client;
+   apm_counts_t counts = { 0 };
+   bson_error_t error;
+   bson_t cmd;
+   bson_t reply;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+
+   callbacks.started = apm_started_cb;
+   callbacks.succeeded = apm_succeeded_cb;
+   callbacks.failed = apm_failed_cb;
+   mongoc_client_set_apm_callbacks (client, &callbacks, &counts);
+
+   /* connect first, so that only the ping is counted */
+   r = mongoc_client_get_server_status (client, NULL, &reply, &error);
+   assert (r);
+   bson_destroy (&reply);
+
+   memset (&counts, 0, sizeof counts);
+
+   bson_init (&cmd);
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, &reply,
+                                     &error);
+   assert (r);
+   bson_destroy (&reply);
+
+   assert (counts.n_started == 1);
+   assert (counts.n_succeeded == 1);
+   assert (counts.n_failed == 0);
+   assert (!strcmp (counts.command_name, "ping"));
+
+   mongoc_client_set_apm_callbacks (client, NULL, NULL);
+
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, &reply,
+                                     &error);
+   assert (r);
+   bson_destroy (&reply);
+   assert (counts.n_started == 1);
+
+   bson_destroy (&cmd);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_flight_records (void)
+{
+   mongoc_apm_flight_record_t records[70];
+   mongoc_apm_flight_record_t *last;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t cmd;
+   bson_t reply;
+   size_t n;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+
+   assert (mongoc_client_get_flight_records (client, records, 70) == 0);
+
+   bson_init (&cmd);
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, &reply,
+                                     &error);
+   assert (r);
+   bson_destroy (&reply);
+
+   n = mongoc_client_get_flight_records (client, records, 70);
+   assert (n > 0);
+   last = &records[n - 1];
+   assert (last->opcode == MONGOC_OPCODE_QUERY);
+   ASSERT_CMPSTR (last->ns, "admin.$cmd");
+   assert (*last->host);
+   assert (last->request_id);
+   assert (last->started_usec <= last->sent_usec);
+   assert (last->sent_usec <= last->replied_usec);
+   assert (last->bytes_sent > 0);
+   assert (last->bytes_received > 0);
+   assert (!last->error_code);
+
+   /* the records are kept, and the ring holds the last 64 */
+   assert (mongoc_client_get_flight_records (client, records, 70) == n);
+
+   for (i = 0; i < 70; i++) {
+      r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                        &error);
+      assert (r);
+   }
+
+   assert (mongoc_client_get_flight_records (client, records, 70) == 64);
+   assert (records[63].request_id > records[0].request_id);
+
+   bson_destroy (&cmd);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_commands_pipelined (void)
+{
+   mongoc_client_t *client;
+   const bson_t *cmds[3];
+   bson_t replies[3];
+   bson_error_t errors[3];
+   bson_t ping;
+   bson_t bogus;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+
+   bson_init (&ping);
+   BSON_APPEND_INT32 (&ping, "ping", 1);
+   bson_init (&bogus);
+   BSON_APPEND_INT32 (&bogus, "notARealCommand", 1);
+
+   cmds[0] = &ping;
+   cmds[1] = &bogus;
+   cmds[2] = &ping;
+
+   /* the failed command only fails its own reply */
+   r = mongoc_client_commands_pipelined (client, "admin", cmds, 3, NULL,
+                                         replies, errors);
+   assert (!r);
+   assert (bson_has_field (&replies[0], "ok"));
+   assert (errors[1].domain == MONGOC_ERROR_QUERY);
+   assert (bson_has_field (&replies[2], "ok"));
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (&replies[i]);
+   }
+
+   cmds[1] = &ping;
+   r = mongoc_client_commands_pipelined (client, "admin", cmds, 3, NULL,
+                                         NULL, NULL);
+   assert (r);
+
+   bson_destroy (&ping);
+   bson_destroy (&bogus);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_borrow_handles (void)
+{
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+   mongoc_database_t *database;
+   mongoc_read_prefs_t *read_prefs;
+
+   client = mongoc_client_new ("mongodb://localhost/");
+
+   database = mongoc_client_borrow_database (client, "test");
+   assert (database == mongoc_client_borrow_database (client, "test"));
+   assert (database != mongoc_client_borrow_database (client, "test2"));
+
+   collection = mongoc_client_borrow_collection (client, "test", "test");
+   assert (collection == mongoc_client_borrow_collection (client, "test",
+                                                          "test"));
+   assert (collection != mongoc_client_borrow_collection (client, "test2",
+                                                          "test"));
+   assert (collection != mongoc_client_borrow_collection (client, "test",
+                                                          "test2"));
+
+   /* handles are rebuilt with the new read preferences */
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+   mongoc_client_set_read_prefs (client, read_prefs);
+
+   collection = mongoc_client_borrow_collection (client, "test", "test");
+   assert (mongoc_read_prefs_get_mode (
+              mongoc_collection_get_read_prefs (collection)) ==
+           MONGOC_READ_SECONDARY);
+
+   mongoc_read_prefs_destroy (read_prefs);
+   mongoc_client_destroy (client);
+}
+
+
+typedef struct
+{
+   int allocs;
+   int live;
+} counting_alloc_t;
+
+
+static void *
+counting_realloc (void   *mem,
+                  size_t  num_bytes,
+                  void   *ctx)
+{
+   counting_alloc_t *counts = ctx;
+
+   if (!mem && num_bytes) {
+      counts->allocs++;
+      counts->live++;
+   } else if (mem && !num_bytes) {
+      counts->live--;
+   }
+
+   return bson_realloc (mem, num_bytes);
+}
+
+
+static void
+test_realloc_func (void)
+{
+   counting_alloc_t counts = { 0 };
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_t *doc;
+   int allocs;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   mongoc_client_set_realloc_func (client, counting_realloc, &counts);
+   collection = get_test_collection (client, "test_realloc_func");
+
+   doc = BCON_NEW ("_id", BCON_INT32 (1), "x", BCON_INT32 (1));
+   assert (mongoc_collection_insert (collection, MONGOC_INSERT_NONE, doc,
+                                     NULL, NULL));
+   bson_destroy (doc);
+
+   doc = BCON_NEW ("_id", BCON_INT32 (1));
+   assert (find_x (collection, doc) == 1);
+   assert (counts.allocs);
+
+   /* reply buffers are reused once warmed up */
+   allocs = counts.allocs;
+   for (i = 0; i < 10; i++) {
+      assert (find_x (collection, doc) == 1);
+   }
+   assert (counts.allocs == allocs);
+
+   bson_destroy (doc);
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+
+   mongoc_client_destroy (client);
+   assert (!counts.live);
+}
+
+
+typedef enum
+{
+   NOT_MASTER_COMMAND,
+   NOT_MASTER_QUERY_FAILURE,
+   NOT_MASTER_USER_DOCUMENT,
+} not_master_reply_t;
+
+
+/*
+ * Answers commands and queries on "test.test" as @user_data says: with a
+ * "not master" command error or query failure, or with a user document
+ * that only looks like one.
+ */
+static void
+not_master_handler (mock_server_t   *server,
+                    mongoc_stream_t *stream,
+                    mongoc_rpc_t    *rpc,
+                    void            *user_data)
+{
+   not_master_reply_t *kind = user_data;
+   mongoc_reply_flags_t flags = MONGOC_REPLY_NONE;
+   bson_t reply = BSON_INITIALIZER;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY) {
+      return;
+   }
+
+   switch (*kind) {
+   case NOT_MASTER_COMMAND:
+      BSON_APPEND_DOUBLE (&reply, "ok", 0.0);
+      BSON_APPEND_UTF8 (&reply, "errmsg", "not master");
+      BSON_APPEND_INT32 (&reply, "code", 10107);
+      break;
+   case NOT_MASTER_QUERY_FAILURE:
+      flags = MONGOC_REPLY_QUERY_FAILURE;
+      BSON_APPEND_UTF8 (&reply, "$err", "not master and slaveOk=false");
+      BSON_APPEND_INT32 (&reply, "code", 13435);
+      break;
+   case NOT_MASTER_USER_DOCUMENT:
+   default:
+      BSON_APPEND_INT32 (&reply, "_id", 1);
+      BSON_APPEND_INT32 (&reply, "code", 10107);
+      BSON_APPEND_UTF8 (&reply, "errmsg", "not master");
+      break;
+   }
+
+   mock_server_reply_simple (server, stream, rpc, flags, &reply);
+   bson_destroy (&reply);
+}
+
+
+static void
+_test_not_master (not_master_reply_t kind)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t cmd = BSON_INITIALIZER;
+   bson_t q = BSON_INITIALIZER;
+   uint16_t port;
+   char *uristr;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, not_master_handler, &kind);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/", port);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   /* stepdowns are only tracked for replica set members */
+   client->cluster.mode = MONGOC_CLUSTER_REPLICA_SET;
+   assert (client->cluster.nodes [0].primary);
+
+   if (kind == NOT_MASTER_COMMAND) {
+      BSON_APPEND_INT32 (&cmd, "foo", 1);
+      r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                        &error);
+      assert (!r);
+   } else {
+      collection = mongoc_client_get_collection (client, "test", "test");
+      cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                       &q, NULL, NULL);
+      r = mongoc_cursor_next (cursor, &doc);
+      assert (r == (kind == NOT_MASTER_USER_DOCUMENT));
+      mongoc_cursor_destroy (cursor);
+      mongoc_collection_destroy (collection);
+   }
+
+   if (kind == NOT_MASTER_USER_DOCUMENT) {
+      assert (client->cluster.nodes [0].primary);
+      assert (!client->cluster.needs_primary_probe);
+   } else {
+      assert (!client->cluster.nodes [0].primary);
+      assert (client->cluster.needs_primary_probe);
+   }
+
+   client->cluster.mode = MONGOC_CLUSTER_DIRECT;
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_destroy (&q);
+   bson_free (uristr);
+}
+
+
+static void
+test_not_master_command (void)
+{
+   _test_not_master (NOT_MASTER_COMMAND);
+}
+
+
+static void
+test_not_master_query_failure (void)
+{
+   _test_not_master (NOT_MASTER_QUERY_FAILURE);
+}
+
+
+static void
+test_not_master_user_document (void)
+{
+   _test_not_master (NOT_MASTER_USER_DOCUMENT);
+}
+
+
+/*
+ * Wait for @monitor to publish a topology newer than @generation, and a
+ * healthy one if @healthy. Returns the generation it published.
+ */
+static uint32_t
+wait_for_standby (mongoc_cluster_monitor_t *monitor,
+                  uint32_t                  generation,
+                  bool                      healthy)
+{
+   uint32_t published = 0;
+   int i;
+
+   for (i = 0; i < 5000 && !published; i++) {
+      mongoc_mutex_lock (&monitor->mutex);
+      if (monitor->standby && (monitor->generation > generation) &&
+          (!healthy ||
+           (monitor->standby->state == MONGOC_CLUSTER_STATE_HEALTHY))) {
+         published = monitor->generation;
+      }
+      mongoc_mutex_unlock (&monitor->mutex);
+
+      if (!published) {
+         usleep (1000);
+      }
+   }
+
+   ASSERT (published);
+
+   return published;
+}
+
+
+static void
+test_monitor_adopt (void)
+{
+   mongoc_cluster_monitor_t *monitor;
+   mongoc_stream_t *standby_stream;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   bson_error_t error;
+   int64_t standby_reconnect;
+   uint32_t generation;
+   uint16_t port;
+   char *uristr;
+   bson_t cmd = BSON_INITIALIZER;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   /* the monitor only refreshes early, when it is asked to */
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/"
+                                "?heartbeatFrequencyMS=60000", port);
+   client = mongoc_client_new (uristr);
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   ASSERT (r);
+
+   monitor = client->cluster.monitor;
+   ASSERT (monitor);
+   ASSERT (!monitor->shared);
+   ASSERT_CMPINT (client->cluster.state, ==, MONGOC_CLUSTER_STATE_HEALTHY);
+   ASSERT (client->cluster.nodes [0].stream);
+
+   /* the nodes the client gave up in exchange are reconnected */
+   generation = wait_for_standby (monitor, client->cluster.monitor_generation,
+                                  true);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   standby_stream = monitor->standby->nodes [0].stream;
+   standby_reconnect = monitor->standby->last_reconnect;
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   ASSERT (standby_stream);
+   ASSERT (standby_stream != client->cluster.nodes [0].stream);
+
+   /* a client that lost its node takes the standby's, it doesn't rescan */
+   _mongoc_cluster_disconnect_node (&client->cluster,
+                                    &client->cluster.nodes [0]);
+   ASSERT_CMPINT (client->cluster.state, ==, MONGOC_CLUSTER_STATE_DEAD);
+
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   ASSERT (r);
+   ASSERT (client->cluster.nodes [0].stream == standby_stream);
+   ASSERT (client->cluster.last_reconnect == standby_reconnect);
+   ASSERT_CMPINT (client->cluster.monitor_generation, ==, generation);
+
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_free (uristr);
+}
+
+
+static void
+test_monitor_destroy (void)
+{
+   mongoc_client_t *client;
+   mock_server_t *server;
+   bson_error_t error;
+   int64_t started;
+   uint16_t port;
+   char *uristr;
+   bson_t cmd = BSON_INITIALIZER;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/"
+                                "?heartbeatFrequencyMS=60000", port);
+   client = mongoc_client_new (uristr);
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   ASSERT (r);
+   ASSERT (client->cluster.monitor);
+
+   /* let the monitor go back to sleep for the heartbeat interval */
+   wait_for_standby (client->cluster.monitor,
+                     client->cluster.monitor_generation, true);
+   usleep (10 * 1000);
+
+   /* the thread is woken and joined, not waited out */
+   started = bson_get_monotonic_time ();
+   mongoc_client_destroy (client);
+   ASSERT ((bson_get_monotonic_time () - started) < 1000 * 1000);
+
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_free (uristr);
+}
+
+
+/*
+ * Ask @monitor to refresh every millisecond for @msec, and return the
+ * generation it has published by then.
+ */
+static uint32_t
+wake_monitor_for (mongoc_cluster_monitor_t *monitor,
+                  int64_t                   msec)
+{
+   uint32_t generation;
+   int64_t expire_at;
+
+   expire_at = bson_get_monotonic_time () + (msec * 1000L);
+
+   while (bson_get_monotonic_time () < expire_at) {
+      _mongoc_cluster_monitor_wakeup (monitor);
+      usleep (1000);
+   }
+
+   mongoc_mutex_lock (&monitor->mutex);
+   generation = monitor->generation;
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   return generation;
+}
+
+
+static void
+test_monitor_backoff (void)
+{
+   mongoc_cluster_monitor_t *monitor;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   bson_error_t error;
+   uint32_t generation;
+   uint32_t failures;
+   uint16_t port;
+   char *uristr;
+   bson_t cmd = BSON_INITIALIZER;
+   bool healthy = false;
+   bool r;
+   int i;
+
+   /* the mock servers of the other tests listen below 21000 */
+   port = 21000 + (rand () % 1000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/"
+                                "?heartbeatFrequencyMS=60000"
+                                "&connectTimeoutMS=1000", port);
+   client = mongoc_client_new (uristr);
+
+   BSON_APPEND_INT32 (&cmd, "ping", 1);
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   ASSERT (!r);
+
+   monitor = client->cluster.monitor;
+   ASSERT (monitor);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   generation = monitor->generation;
+   failures = monitor->failures;
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   ASSERT_CMPINT (generation, ==, 1);
+   ASSERT_CMPINT (failures, ==, 1);
+
+   /*
+    * With MIN_REFRESH_BACKOFF_MSEC at 100, wakeups are ignored for 50 to
+    * 100ms after the first failure, and twice as long after each of the
+    * next ones.
+    */
+   ASSERT_CMPINT (wake_monitor_for (monitor, 40), ==, 1);
+   generation = wait_for_standby (monitor, 1, false);
+   ASSERT_CMPINT (generation, ==, 2);
+
+   ASSERT_CMPINT (wake_monitor_for (monitor, 80), ==, 2);
+   generation = wait_for_standby (monitor, 2, false);
+   ASSERT_CMPINT (generation, ==, 3);
+
+   ASSERT_CMPINT (wake_monitor_for (monitor, 160), ==, 3);
+
+   mongoc_mutex_lock (&monitor->mutex);
+   ASSERT_CMPINT (monitor->failures, ==, 3);
+   mongoc_mutex_unlock (&monitor->mutex);
+
+   /* once the server is back, a refresh finds it and the count resets */
+   server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+   mock_server_run_in_thread (server);
+
+   for (i = 0; i < 5000 && !healthy; i++) {
+      _mongoc_cluster_monitor_wakeup (monitor);
+
+      mongoc_mutex_lock (&monitor->mutex);
+      healthy = (monitor->standby &&
+                 (monitor->standby->state == MONGOC_CLUSTER_STATE_HEALTHY));
+      failures = monitor->failures;
+      mongoc_mutex_unlock (&monitor->mutex);
+
+      if (!healthy) {
+         usleep (1000);
+      }
+   }
+
+   ASSERT (healthy);
+   ASSERT_CMPINT (failures, ==, 0);
+
+   r = mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                     &error);
+   ASSERT (r);
+
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&cmd);
+   bson_free (uristr);
+}
+
+
+/*
+ * The node of @cluster for the mock server listening on @port, or NULL.
+ */
+static mongoc_cluster_node_t *
+find_node (mongoc_cluster_t *cluster,
+           uint16_t          port)
+{
+   char host_and_port [32];
+   uint32_t i;
+
+   bson_snprintf (host_and_port, sizeof host_and_port, "127.0.0.1:%hu",
+                  port);
+
+   for (i = 0; i < cluster->nodes_len; i++) {
+      if (!strcmp (cluster->nodes [i].host.host_and_port, host_and_port)) {
+         return &cluster->nodes [i];
+      }
+   }
+
+   return NULL;
+}
+
+
+typedef struct
+{
+   bool hang_up;
+   int  queries;
+} breaker_member_t;
+
+
+/*
+ * Counts the queries on "test.test" and answers them, or hangs up on
+ * them if the member is told to.
+ */
+static void
+breaker_handler (mock_server_t   *server,
+                 mongoc_stream_t *stream,
+                 mongoc_rpc_t    *rpc,
+                 void            *user_data)
+{
+   breaker_member_t *member = user_data;
+   bson_t reply = BSON_INITIALIZER;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       strcmp (rpc->query.collection, "test.test")) {
+      return;
+   }
+
+   bson_atomic_int_add (&member->queries, 1);
+
+   if (member->hang_up) {
+      mongoc_stream_close (stream);
+      return;
+   }
+
+   BSON_APPEND_INT32 (&reply, "_id", 1);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+/*
+ * Read a document from @collection, on the node @hint if non-zero.
+ */
+static bool
+find_one (mongoc_collection_t       *collection,
+          const mongoc_read_prefs_t *read_prefs,
+          uint32_t                   hint)
+{
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_t q = BSON_INITIALIZER;
+   bool r;
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &q, NULL, read_prefs);
+   cursor->hint = hint;
+   r = mongoc_cursor_next (cursor, &doc);
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&q);
+
+   return r;
+}
+
+
+static void
+test_node_breaker (void)
+{
+   breaker_member_t members [3] = {{ 0 }};
+   mongoc_collection_t *collection;
+   mongoc_cluster_node_t *node;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_client_t *client;
+   mock_server_t *servers [3];
+   bson_error_t error;
+   int64_t open_until;
+   uint16_t port;
+   char *hosts;
+   char *uristr;
+   int queries;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu",
+                               port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2));
+
+   for (i = 0; i < 3; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i, breaker_handler,
+                                     &members [i]);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs&retryReads=false",
+                                hosts);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   collection = mongoc_client_get_collection (client, "test", "test");
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   /* failures short of the threshold are forgotten after a success */
+   members [1].hang_up = true;
+   node = find_node (&client->cluster, port + 1);
+   ASSERT (node && node->stream);
+   ASSERT (!find_one (collection, read_prefs, node->index + 1));
+   ASSERT (_mongoc_cluster_reconnect (&client->cluster, &error));
+
+   node = find_node (&client->cluster, port + 1);
+   ASSERT (node && node->stream);
+   ASSERT_CMPINT (node->breaker.consecutive_failures, ==, 1);
+   ASSERT (!node->breaker.half_open);
+
+   members [1].hang_up = false;
+   ASSERT (find_one (collection, read_prefs, node->index + 1));
+   ASSERT_CMPINT (node->breaker.consecutive_failures, ==, 0);
+
+   /* BREAKER_FAILURE_THRESHOLD, 3, failures in a row open the breaker */
+   members [1].hang_up = true;
+
+   for (i = 0; i < 3; i++) {
+      node = find_node (&client->cluster, port + 1);
+      ASSERT (node && node->stream);
+      ASSERT (!node->breaker.half_open);
+      ASSERT (!find_one (collection, read_prefs, node->index + 1));
+      ASSERT (_mongoc_cluster_reconnect (&client->cluster, &error));
+   }
+
+   node = find_node (&client->cluster, port + 1);
+   ASSERT (node && node->stream);
+   ASSERT (node->breaker.half_open);
+   ASSERT_CMPINT (node->breaker.trips, ==, 1);
+   ASSERT (node->breaker.open_until > bson_get_monotonic_time ());
+
+   /* while it is open, the other secondary gets all of the reads */
+   members [1].hang_up = false;
+   queries = bson_atomic_int_add (&members [1].queries, 0);
+
+   for (i = 0; i < 20; i++) {
+      ASSERT (find_one (collection, read_prefs, 0));
+   }
+
+   ASSERT (node->breaker.open_until > bson_get_monotonic_time ());
+   ASSERT_CMPINT (bson_atomic_int_add (&members [1].queries, 0), ==, queries);
+
+   /* once BREAKER_BACKOFF_USEC is up the node is tried again */
+   open_until = node->breaker.open_until;
+   while (bson_get_monotonic_time () <= open_until) {
+      usleep (10 * 1000);
+   }
+
+   for (i = 0; i < 200; i++) {
+      if (bson_atomic_int_add (&members [1].queries, 0) != queries) {
+         break;
+      }
+      ASSERT (find_one (collection, read_prefs, 0));
+   }
+
+   ASSERT_CMPINT (bson_atomic_int_add (&members [1].queries, 0), ==,
+                  queries + 1);
+
+   /* and the one read it answered closed the breaker */
+   node = find_node (&client->cluster, port + 1);
+   ASSERT (node && node->stream);
+   ASSERT (!node->breaker.half_open);
+   ASSERT_CMPINT (node->breaker.trips, ==, 0);
+   ASSERT_CMPINT (node->breaker.consecutive_failures, ==, 0);
+   ASSERT (!node->breaker.open_until);
+
+   mongoc_read_prefs_destroy (read_prefs);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 3; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (uristr);
+}
+
+
+/*
+ * Answers queries on "test.test", and then hangs up if the int
+ * @user_data points to is set.
+ */
+static void
+reply_and_hang_up_handler (mock_server_t   *server,
+                           mongoc_stream_t *stream,
+                           mongoc_rpc_t    *rpc,
+                           void            *user_data)
+{
+   int *hang_up = user_data;
+   bson_t reply = BSON_INITIALIZER;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       strcmp (rpc->query.collection, "test.test")) {
+      return;
+   }
+
+   BSON_APPEND_INT32 (&reply, "_id", 1);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+
+   if (*hang_up) {
+      mongoc_stream_close (stream);
+   }
+}
+
+
+static void
+test_reconnect_dropped_node (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_cluster_node_t *node;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_stream_t *streams [3];
+   mongoc_client_t *client;
+   mock_server_t *servers [3];
+   bson_error_t error;
+   int64_t last_reconnect;
+   uint32_t stamps [3];
+   uint16_t port;
+   char *hosts;
+   char *uristr;
+   int hang_up [3] = { 0 };
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu",
+                               port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2));
+
+   for (i = 0; i < 3; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i,
+                                     reply_and_hang_up_handler, &hang_up [i]);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs", hosts);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 3);
+
+   for (i = 0; i < 3; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node && node->stream);
+      streams [i] = node->stream;
+      stamps [i] = node->stamp;
+   }
+
+   last_reconnect = client->cluster.last_reconnect;
+
+   collection = mongoc_client_get_collection (client, "test", "test");
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+
+   /* the secondary answers and then drops the connection */
+   hang_up [1] = 1;
+   node = find_node (&client->cluster, port + 1);
+   ASSERT (find_one (collection, read_prefs, node->index + 1));
+   hang_up [1] = 0;
+   usleep (10 * 1000);
+
+   ASSERT (node->stream == streams [1]);
+
+   /* have the next operation on it check whether it is still connected */
+   node->last_read_msec = 0;
+   ASSERT (find_one (collection, read_prefs, node->index + 1));
+
+   /* only the dropped node was connected again */
+   ASSERT (node->stream);
+   ASSERT (node->stamp != stamps [1]);
+   ASSERT (!node->lazy);
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 3);
+   ASSERT (client->cluster.last_reconnect == last_reconnect);
+   ASSERT_CMPINT (client->cluster.state, ==, MONGOC_CLUSTER_STATE_HEALTHY);
+
+   for (i = 0; i < 3; i += 2) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node);
+      ASSERT (node->stream == streams [i]);
+      ASSERT_CMPINT (node->stamp, ==, stamps [i]);
+   }
+
+   mongoc_read_prefs_destroy (read_prefs);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 3; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (uristr);
+}
+
+
+static void
+test_rediscovery_keeps_streams (void)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_stream_t *streams [3];
+   mongoc_client_t *client;
+   mock_server_t *servers [3];
+   bson_error_t error;
+   uint16_t port;
+   char *hosts;
+   char *new_hosts;
+   char *uristr;
+   bool r;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu",
+                               port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2));
+   new_hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu",
+                                   port, (uint16_t)(port + 1));
+
+   for (i = 0; i < 3; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i, NULL, NULL);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs", hosts);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 3);
+
+   for (i = 0; i < 3; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node && node->stream);
+      streams [i] = node->stream;
+   }
+
+   /* the connections opened only for discovery are gone */
+   for (i = 0; i < 200; i++) {
+      if (mock_server_get_n_connections (servers [0]) == 1 &&
+          mock_server_get_n_connections (servers [1]) == 1 &&
+          mock_server_get_n_connections (servers [2]) == 1) {
+         break;
+      }
+      usleep (5000);
+   }
+
+   for (i = 0; i < 3; i++) {
+      ASSERT_CMPINT (mock_server_get_n_connections (servers [i]), ==, 1);
+   }
+
+   /* the last member is removed from the set */
+   for (i = 0; i < 3; i++) {
+      mock_server_set_replset (servers [i], "rs", i == 0, new_hosts);
+   }
+
+   r = _mongoc_cluster_reconnect (&client->cluster, &error);
+   ASSERT (r);
+
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 2);
+   ASSERT (!find_node (&client->cluster, port + 2));
+
+   /* the members still in the set kept their connections... */
+   for (i = 0; i < 2; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node);
+      ASSERT (node->stream == streams [i]);
+      ASSERT_CMPINT (mock_server_get_n_connections (servers [i]), ==, 1);
+   }
+
+   ASSERT (find_node (&client->cluster, port)->primary);
+
+   /* ...and the one of the removed member was closed */
+   for (i = 0; i < 200; i++) {
+      if (!mock_server_get_n_connections (servers [2])) {
+         break;
+      }
+      usleep (5000);
+   }
+
+   ASSERT_CMPINT (mock_server_get_n_connections (servers [2]), ==, 0);
+
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 3; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (new_hosts);
+   bson_free (uristr);
+}
+
+
+static void
+test_reconnect_silent_member (void)
+{
+   mongoc_client_t *client;
+   mock_server_t *servers [4];
+   bson_error_t error;
+   int64_t started;
+   int64_t elapsed;
+   uint16_t port;
+   char *hosts;
+   char *uristr;
+   char *silent;
+   bool r;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu,"
+                               "127.0.0.1:%hu", port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2), (uint16_t)(port + 3));
+   silent = bson_strdup_printf ("127.0.0.1:%hu", (uint16_t)(port + 2));
+
+   for (i = 0; i < 4; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i, NULL, NULL);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_set_silent (servers [i], i == 2);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs"
+                                "&connectTimeoutMS=300", hosts);
+   client = mongoc_client_new (uristr);
+
+   memset (&error, 0, sizeof error);
+   started = bson_get_monotonic_time ();
+   r = _mongoc_cluster_reconnect (&client->cluster, &error);
+   elapsed = bson_get_monotonic_time () - started;
+
+   /* the members that answered are connected */
+   ASSERT (r);
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 3);
+   ASSERT_CMPINT (client->cluster.state, ==, MONGOC_CLUSTER_STATE_HEALTHY);
+   ASSERT (!find_node (&client->cluster, port + 2));
+
+   for (i = 0; i < 4; i += (i == 1) ? 2 : 1) {
+      ASSERT (find_node (&client->cluster, port + i));
+      ASSERT (find_node (&client->cluster, port + i)->stream);
+   }
+
+   ASSERT (find_node (&client->cluster, port)->primary);
+
+   /* the one that didn't is reported, after waiting for it once */
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_STREAM);
+   ASSERT (strstr (error.message, silent));
+   ASSERT (elapsed >= 250 * 1000);
+   ASSERT (elapsed < 600 * 1000);
+
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 4; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (silent);
+   bson_free (uristr);
+}
+
+
+static void
+test_ping_silent_members (void)
+{
+   mongoc_cluster_node_t *node;
+   mongoc_client_t *client;
+   mock_server_t *servers [4];
+   bson_error_t error;
+   int64_t started;
+   int64_t elapsed;
+   uint16_t port;
+   bson_t cmd;
+   char *hosts;
+   char *uristr;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu,"
+                               "127.0.0.1:%hu", port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2), (uint16_t)(port + 3));
+
+   for (i = 0; i < 4; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i, NULL, NULL);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs"
+                                "&socketTimeoutMS=300", hosts);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   ASSERT_CMPINT (client->cluster.nodes_len, ==, 4);
+
+   /* two of the secondaries hang, the next command pings every node */
+   mock_server_set_silent (servers [2], true);
+   mock_server_set_silent (servers [3], true);
+
+   for (i = 0; i < 4; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node && node->stream);
+      node->ping_avg_msec = -1;
+      node->rtt_msec = -1;
+   }
+
+   client->cluster.last_ping = 0;
+   client->cluster.last_reconnect = 0;
+
+   bson_init (&cmd);
+   bson_append_int32 (&cmd, "ping", 4, 1);
+
+   started = bson_get_monotonic_time ();
+   ASSERT (mongoc_client_command_simple (client, "admin", &cmd, NULL, NULL,
+                                         &error));
+   elapsed = bson_get_monotonic_time () - started;
+
+   ASSERT (client->cluster.last_ping >= started);
+
+   /* the members that answered have fresh ping times */
+   for (i = 0; i < 2; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (node->stream);
+      ASSERT_CMPINT (node->ping_avg_msec, >=, 0);
+      ASSERT (node->rtt_msec >= 0);
+   }
+
+   /* the hung ones were dropped without being timed */
+   for (i = 2; i < 4; i++) {
+      node = find_node (&client->cluster, port + i);
+      ASSERT (!node->stream);
+      ASSERT_CMPINT (node->ping_avg_msec, ==, -1);
+   }
+
+   /* and were waited for together, one socket timeout rather than two */
+   ASSERT (elapsed >= 250 * 1000);
+   ASSERT (elapsed < 550 * 1000);
+
+   bson_destroy (&cmd);
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 4; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (uristr);
+}
+
+
+/*
+ * The current select cache entry of @cluster for reads with @read_mode.
+ */
+static const mongoc_cluster_select_cache_t *
+find_select_cache (const mongoc_cluster_t *cluster,
+                   mongoc_read_mode_t      read_mode)
+{
+   const mongoc_cluster_select_cache_t *entry;
+   int i;
+
+   for (i = 0; i < MONGOC_CLUSTER_SELECT_CACHE_SIZE; i++) {
+      entry = &cluster->select_cache [i];
+
+      if ((entry->topology_version == cluster->topology_version) &&
+          entry->has_read_prefs &&
+          (entry->read_mode == read_mode)) {
+         return entry;
+      }
+   }
+
+   return NULL;
+}
+
+
+static void
+test_select_cache (void)
+{
+   const mongoc_cluster_select_cache_t *entry;
+   const mongoc_cluster_select_cache_t *nearest;
+   mongoc_collection_t *collection;
+   mongoc_read_prefs_t *secondary;
+   mongoc_read_prefs_t *nearby;
+   mongoc_client_t *client;
+   mongoc_cluster_t *cluster;
+   mock_server_t *servers [3];
+   bson_error_t error;
+   uint32_t topology_version;
+   uint32_t next;
+   uint16_t port;
+   char *hosts;
+   char *new_hosts;
+   char *uristr;
+   int hang_up = 0;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu,127.0.0.1:%hu",
+                               port, (uint16_t)(port + 1),
+                               (uint16_t)(port + 2));
+   new_hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu",
+                                   port, (uint16_t)(port + 1));
+
+   for (i = 0; i < 3; i++) {
+      servers [i] = mock_server_new ("127.0.0.1", port + i,
+                                     reply_and_hang_up_handler, &hang_up);
+      mock_server_set_replset (servers [i], "rs", i == 0, hosts);
+      mock_server_run_in_thread (servers [i]);
+   }
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs", hosts);
+   client = mongoc_client_new (uristr);
+   cluster = &client->cluster;
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   ASSERT_CMPINT (cluster->nodes_len, ==, 3);
+
+   collection = mongoc_client_get_collection (client, "test", "test");
+   secondary = mongoc_read_prefs_new (MONGOC_READ_SECONDARY);
+   nearby = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   ASSERT (find_one (collection, secondary, 0));
+
+   topology_version = cluster->topology_version;
+   entry = find_select_cache (cluster, MONGOC_READ_SECONDARY);
+   ASSERT (entry);
+   ASSERT_CMPINT (entry->eligible_len, ==, 2);
+
+   /* nothing changed, the entry is reused rather than rebuilt */
+   next = cluster->select_cache_next;
+   ASSERT (find_one (collection, secondary, 0));
+   ASSERT_CMPINT (cluster->topology_version, ==, topology_version);
+   ASSERT (find_select_cache (cluster, MONGOC_READ_SECONDARY) == entry);
+   ASSERT_CMPINT (cluster->select_cache_next, ==, next);
+
+   /* another read preference gets an entry of its own... */
+   ASSERT (find_one (collection, nearby, 0));
+   nearest = find_select_cache (cluster, MONGOC_READ_NEAREST);
+   ASSERT (nearest && nearest != entry);
+   ASSERT_CMPINT (nearest->eligible_len, ==, 3);
+   ASSERT_CMPINT (cluster->select_cache_next, ==,
+                  (next + 1) % MONGOC_CLUSTER_SELECT_CACHE_SIZE);
+
+   /* ...and the first one is still used when switching back */
+   next = cluster->select_cache_next;
+   ASSERT (find_one (collection, secondary, 0));
+   ASSERT (find_select_cache (cluster, MONGOC_READ_SECONDARY) == entry);
+   ASSERT_CMPINT (cluster->select_cache_next, ==, next);
+
+   /* a member is removed from the set */
+   for (i = 0; i < 3; i++) {
+      mock_server_set_replset (servers [i], "rs", i == 0, new_hosts);
+   }
+
+   ASSERT (_mongoc_cluster_reconnect (cluster, &error));
+   ASSERT_CMPINT (cluster->nodes_len, ==, 2);
+   ASSERT_CMPINT (cluster->topology_version, !=, topology_version);
+   ASSERT (!find_select_cache (cluster, MONGOC_READ_SECONDARY));
+   ASSERT (!find_select_cache (cluster, MONGOC_READ_NEAREST));
+
+   ASSERT (find_one (collection, secondary, 0));
+   entry = find_select_cache (cluster, MONGOC_READ_SECONDARY);
+   ASSERT (entry);
+   ASSERT_CMPINT (entry->eligible_len, ==, 1);
+   ASSERT_CMPINT (cluster->nodes [entry->eligible [0]].host.port, ==,
+                  port + 1);
+
+   /* the primary changes */
+   topology_version = cluster->topology_version;
+
+   for (i = 0; i < 2; i++) {
+      mock_server_set_replset (servers [i], "rs", i == 1, new_hosts);
+   }
+
+   ASSERT (_mongoc_cluster_reconnect (cluster, &error));
+   ASSERT (find_node (cluster, port + 1)->primary);
+   ASSERT_CMPINT (cluster->topology_version, !=, topology_version);
+   ASSERT (!find_select_cache (cluster, MONGOC_READ_SECONDARY));
+
+   ASSERT (find_one (collection, secondary, 0));
+   entry = find_select_cache (cluster, MONGOC_READ_SECONDARY);
+   ASSERT (entry);
+   ASSERT_CMPINT (entry->eligible_len, ==, 1);
+   ASSERT_CMPINT (cluster->nodes [entry->eligible [0]].host.port, ==, port);
+
+   mongoc_read_prefs_destroy (nearby);
+   mongoc_read_prefs_destroy (secondary);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+
+   for (i = 0; i < 3; i++) {
+      mock_server_quit (servers [i], 0);
+   }
+
+   bson_free (hosts);
+   bson_free (new_hosts);
+   bson_free (uristr);
+}
+
+
 void
 test_client_install (TestSuite *suite)
 {
@@ -695,4 +2467,32 @@ test_client_install (TestSuite *suite)
    TestSuite_Add (suite, "/Client/preselect", test_mongoc_client_preselect);
    TestSuite_Add (suite, "/Client/exhaust_cursor", test_exhaust_cursor);
    TestSuite_Add (suite, "/Client/server_status", test_server_status);
+   TestSuite_Add (suite, "/Client/node_connections", test_node_connections);
+   TestSuite_Add (suite, "/Client/pipelined_replies", test_pipelined_replies);
+   TestSuite_Add (suite, "/Client/async_command", test_async_command);
+   TestSuite_Add (suite, "/Client/write_coalescing", test_write_coalescing);
+   TestSuite_Add (suite, "/Client/query_cache", test_query_cache);
+   TestSuite_Add (suite, "/Client/apm_callbacks", test_apm_callbacks);
+   TestSuite_Add (suite, "/Client/flight_records", test_flight_records);
+   TestSuite_Add (suite, "/Client/commands_pipelined", test_commands_pipelined);
+   TestSuite_Add (suite, "/Client/borrow_handles", test_borrow_handles);
+   TestSuite_Add (suite, "/Client/realloc_func", test_realloc_func);
+   TestSuite_Add (suite, "/Client/not_master_command", test_not_master_command);
+   TestSuite_Add (suite, "/Client/not_master_query_failure",
+                  test_not_master_query_failure);
+   TestSuite_Add (suite, "/Client/not_master_user_document",
+                  test_not_master_user_document);
+   TestSuite_Add (suite, "/Client/monitor_adopt", test_monitor_adopt);
+   TestSuite_Add (suite, "/Client/monitor_destroy", test_monitor_destroy);
+   TestSuite_Add (suite, "/Client/monitor_backoff", test_monitor_backoff);
+   TestSuite_Add (suite, "/Client/node_breaker", test_node_breaker);
+   TestSuite_Add (suite, "/Client/reconnect_dropped_node",
+                  test_reconnect_dropped_node);
+   TestSuite_Add (suite, "/Client/rediscovery_keeps_streams",
+                  test_rediscovery_keeps_streams);
+   TestSuite_Add (suite, "/Client/reconnect_silent_member",
+                  test_reconnect_silent_member);
+   TestSuite_Add (suite, "/Client/ping_silent_members",
+                  test_ping_silent_members);
+   TestSuite_Add (suite, "/Client/select_cache", test_select_cache);
 }
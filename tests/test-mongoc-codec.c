@@ -0,0 +1,217 @@
+#include <bcon.h>
+#include <mongoc.h>
+#include <mongoc-codec-private.h>
+
+#include "TestSuite.h"
+
+#include "test-libmongoc.h"
+#include "mongoc-tests.h"
+
+
+typedef struct
+{
+   bson_oid_t   id;
+   int32_t      n;
+   int64_t      big;
+   double       price;
+   bool         ok;
+   int64_t      when;
+   char         name [8];
+   const char  *ref;
+} item_t;
+
+
+static const mongoc_codec_field_t gItemFields [] = {
+   MONGOC_CODEC_FIELD_NAMED (item_t, id, "_id", MONGOC_CODEC_OID),
+   MONGOC_CODEC_FIELD (item_t, n, MONGOC_CODEC_INT32),
+   MONGOC_CODEC_FIELD (item_t, big, MONGOC_CODEC_INT64),
+   MONGOC_CODEC_FIELD (item_t, price, MONGOC_CODEC_DOUBLE),
+   MONGOC_CODEC_FIELD (item_t, ok, MONGOC_CODEC_BOOL),
+   MONGOC_CODEC_FIELD (item_t, when, MONGOC_CODEC_DATE_TIME),
+   MONGOC_CODEC_FIELD (item_t, name, MONGOC_CODEC_UTF8),
+   MONGOC_CODEC_FIELD (item_t, ref, MONGOC_CODEC_UTF8_REF),
+};
+
+
+static void
+test_codec_new (void)
+{
+   mongoc_codec_field_t bad [2];
+   mongoc_codec_t *codec;
+   bson_error_t error;
+
+   codec = mongoc_codec_new (gItemFields, 8, sizeof (item_t), &error);
+   assert (codec);
+   mongoc_codec_destroy (codec);
+
+   /* size of the member does not match the type */
+   bad [0] = gItemFields [1];
+   bad [0].type = MONGOC_CODEC_INT64;
+   assert (!mongoc_codec_new (bad, 1, sizeof (item_t), &error));
+   assert (error.domain == MONGOC_ERROR_BSON);
+
+   /* a name with a dot, and a name given twice */
+   bad [0] = gItemFields [1];
+   bad [0].name = "a.b";
+   assert (!mongoc_codec_new (bad, 1, sizeof (item_t), &error));
+
+   bad [0] = gItemFields [1];
+   bad [1] = gItemFields [2];
+   bad [1].name = "n";
+   assert (!mongoc_codec_new (bad, 2, sizeof (item_t), &error));
+
+   /* past the end of the struct */
+   assert (!mongoc_codec_new (gItemFields, 8, sizeof (int32_t), &error));
+}
+
+
+static void
+test_codec_encode_decode (void)
+{
+   mongoc_codec_t *codec;
+   bson_error_t error;
+   item_t in;
+   item_t out;
+   uint8_t *buf;
+   size_t len;
+   bson_t *expected;
+   bson_t b;
+
+   codec = mongoc_codec_new (gItemFields, 8, sizeof (item_t), NULL);
+   assert (codec);
+
+   memset (&in, 0, sizeof in);
+   bson_oid_init_from_string (&in.id, "0123456789abcdef01234567");
+   in.n = -3;
+   in.big = 1LL << 40;
+   in.price = 9.75;
+   in.ok = true;
+   in.when = 1234567890123LL;
+   strcpy (in.name, "widget");
+   in.ref = NULL;
+
+   len = _mongoc_codec_encoded_len (codec, &in);
+   buf = bson_malloc (len);
+   assert (_mongoc_codec_encode (codec, &in, buf) == len);
+
+   expected = BCON_NEW ("_id", BCON_OID (&in.id),
+                        "n", BCON_INT32 (-3),
+                        "big", BCON_INT64 (1LL << 40),
+                        "price", BCON_DOUBLE (9.75),
+                        "ok", BCON_BOOL (true),
+                        "when", BCON_DATE_TIME (1234567890123LL),
+                        "name", BCON_UTF8 ("widget"),
+                        "ref", BCON_NULL);
+   assert (bson_init_static (&b, buf, len));
+   assert (bson_equal (&b, expected));
+   bson_destroy (expected);
+
+   memset (&out, 0xff, sizeof out);
+   assert (_mongoc_codec_decode (codec, buf, (uint32_t)len, &out, &error));
+   assert (bson_oid_equal (&out.id, &in.id));
+   assert (out.n == -3);
+   assert (out.big == in.big);
+   assert (out.price == 9.75);
+   assert (out.ok);
+   assert (out.when == in.when);
+   assert (!strcmp (out.name, "widget"));
+   assert (!out.ref);
+   bson_free (buf);
+
+   /* fields out of order, a missing one, widening and an unknown key */
+   expected = BCON_NEW ("ref", BCON_UTF8 ("in the reply"),
+                        "price", BCON_INT32 (4),
+                        "extra", BCON_UTF8 ("ignored"),
+                        "big", BCON_INT32 (7));
+   assert (_mongoc_codec_decode (codec, bson_get_data (expected),
+                                 expected->len, &out, &error));
+   assert (out.price == 4.0);
+   assert (out.big == 7);
+   assert (out.n == 0);
+   assert (!out.name [0]);
+   assert (!strcmp (out.ref, "in the reply"));
+   bson_destroy (expected);
+
+   /* a string too long for its char array, and a type mismatch */
+   expected = BCON_NEW ("name", BCON_UTF8 ("too long a name"));
+   assert (!_mongoc_codec_decode (codec, bson_get_data (expected),
+                                  expected->len, &out, &error));
+   bson_destroy (expected);
+
+   expected = BCON_NEW ("n", BCON_UTF8 ("one"));
+   assert (!_mongoc_codec_decode (codec, bson_get_data (expected),
+                                  expected->len, &out, &error));
+   assert (error.domain == MONGOC_ERROR_BSON);
+   bson_destroy (expected);
+
+   mongoc_codec_destroy (codec);
+}
+
+
+static void
+test_codec_insert_find (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   mongoc_codec_t *codec;
+   bson_error_t error;
+   bson_t query = BSON_INITIALIZER;
+   item_t items [3];
+   item_t out;
+   char *name;
+   int i;
+
+   /* no "_id" field, the driver generates them */
+   codec = mongoc_codec_new (gItemFields + 1, 7, sizeof (item_t), NULL);
+   assert (codec);
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   name = gen_collection_name ("test_codec_insert_find");
+   collection = mongoc_client_get_collection (client, "test", name);
+   bson_free (name);
+
+   memset (items, 0, sizeof items);
+
+   for (i = 0; i < 3; i++) {
+      items [i].n = i;
+      items [i].price = i * 1.5;
+      bson_snprintf (items [i].name, sizeof items [i].name, "item%d", i);
+      items [i].ref = "ref";
+   }
+
+   assert (mongoc_collection_insert_struct (collection, MONGOC_INSERT_NONE,
+                                            codec, items, 3, NULL, &error));
+
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0, 0,
+                                    &query, NULL, NULL);
+   i = 0;
+
+   while (mongoc_cursor_next_struct (cursor, codec, &out)) {
+      assert (out.n == i);
+      assert (out.price == i * 1.5);
+      assert (!strcmp (out.name, items [i].name));
+      assert (!strcmp (out.ref, "ref"));
+      i++;
+   }
+
+   assert (!mongoc_cursor_error (cursor, &error));
+   assert (i == 3);
+
+   mongoc_cursor_destroy (cursor);
+   assert (mongoc_collection_drop (collection, &error));
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mongoc_codec_destroy (codec);
+}
+
+
+void
+test_codec_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Codec/new", test_codec_new);
+   TestSuite_Add (suite, "/Codec/encode_decode", test_codec_encode_decode);
+   TestSuite_Add (suite, "/Codec/insert_find", test_codec_insert_find);
+}
@@ -30,6 +30,72 @@ get_test_collection (mongoc_client_t *client,
 }
 
 
+static void
+test_insert_raw (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   uint8_t buf [512];
+   size_t len = 0;
+   bson_t b;
+   bool r;
+   unsigned i;
+   int64_t count;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_insert_raw");
+   ASSERT (collection);
+
+   mongoc_collection_drop (collection, &error);
+
+   /* concatenated documents, half of them without an _id */
+   for (i = 0; i < 10; i++) {
+      bson_init (&b);
+      if (i % 2) {
+         BSON_APPEND_INT32 (&b, "_id", i);
+      }
+      BSON_APPEND_INT32 (&b, "n", i);
+      ASSERT (len + b.len <= sizeof buf);
+      memcpy (buf + len, bson_get_data (&b), b.len);
+      len += b.len;
+      bson_destroy (&b);
+   }
+
+   r = mongoc_collection_insert_raw (collection, MONGOC_INSERT_NONE,
+                                     buf, len,
+                                     NULL, &error);
+   if (!r) {
+      MONGOC_WARNING ("%s\n", error.message);
+   }
+   ASSERT (r);
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL,
+                                    0, 0, NULL, &error);
+   ASSERT (count == 10);
+
+   /* a truncated buffer is rejected before anything is sent */
+   r = mongoc_collection_insert_raw (collection, MONGOC_INSERT_NONE,
+                                     buf, len - 1,
+                                     NULL, &error);
+   ASSERT (!r);
+   ASSERT (error.domain == MONGOC_ERROR_BSON);
+   ASSERT (error.code == MONGOC_ERROR_BSON_INVALID);
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL,
+                                    0, 0, NULL, &error);
+   ASSERT (count == 10);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_insert (void)
 {
@@ -218,6 +284,88 @@ test_insert_bulk (void)
 }
 
 
+static void
+test_insert_async (void)
+{
+   mongoc_write_future_t *futures[10];
+   mongoc_write_future_t *future;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t reply;
+   unsigned i;
+   bool r;
+   bson_t b;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_insert_async");
+   ASSERT (collection);
+
+   mongoc_collection_drop (collection, &error);
+
+   for (i = 0; i < 10; i++) {
+      bson_init (&b);
+      BSON_APPEND_INT32 (&b, "_id", i % 9);
+      futures[i] = mongoc_collection_insert_async (collection,
+                                                   MONGOC_INSERT_NONE, &b,
+                                                   NULL, &error);
+      ASSERT (futures[i]);
+      bson_destroy (&b);
+   }
+
+   /* waited on out of order */
+   r = mongoc_write_future_wait (futures[9], &reply, &error);
+   ASSERT (!r);
+   ASSERT (error.domain == MONGOC_ERROR_COMMAND);
+   ASSERT (error.code == 11000);
+   bson_destroy (&reply);
+
+   for (i = 0; i < 9; i++) {
+      r = mongoc_write_future_wait (futures[i], &reply, &error);
+      if (!r) {
+         MONGOC_WARNING ("%s\n", error.message);
+      }
+      ASSERT (r);
+      ASSERT (bson_iter_init_find (&iter, &reply, "nInserted"));
+      ASSERT (bson_iter_int32 (&iter) == 1);
+      bson_destroy (&reply);
+   }
+
+   for (i = 0; i < 10; i++) {
+      mongoc_write_future_destroy (futures[i]);
+   }
+
+   /* acknowledged before the count is sent */
+   bson_init (&b);
+   BSON_APPEND_INT32 (&b, "_id", 9);
+   future = mongoc_collection_insert_async (collection, MONGOC_INSERT_NONE,
+                                            &b, NULL, &error);
+   ASSERT (future);
+   bson_destroy (&b);
+
+   ASSERT (10 == mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL,
+                                          0, 0, NULL, &error));
+   ASSERT (mongoc_write_future_wait (future, NULL, &error));
+   mongoc_write_future_destroy (future);
+
+   bson_init (&b);
+   BSON_APPEND_INT32 (&b, "$hello", 1);
+   ASSERT (!mongoc_collection_insert_async (collection, MONGOC_INSERT_NONE,
+                                            &b, NULL, &error));
+   ASSERT (error.domain == MONGOC_ERROR_BSON);
+   ASSERT (error.code == MONGOC_ERROR_BSON_INVALID);
+   bson_destroy (&b);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
 static void
 test_save (void)
 {
@@ -519,6 +667,59 @@ test_index (void)
    mongoc_client_destroy(client);
 }
 
+static void
+test_create_indexes (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_index_opt_t opt;
+   const mongoc_index_opt_t *opts[2];
+   const bson_t *keys[2];
+   bson_error_t error;
+   bson_t keys1;
+   bson_t keys2;
+   bool r;
+
+   mongoc_index_opt_init (&opt);
+   opt.unique = true;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_create_indexes");
+   ASSERT (collection);
+
+   bson_init (&keys1);
+   BSON_APPEND_INT32 (&keys1, "hello", 1);
+   bson_init (&keys2);
+   BSON_APPEND_INT32 (&keys2, "world", -1);
+
+   keys[0] = &keys1;
+   keys[1] = &keys2;
+   opts[0] = NULL;
+   opts[1] = &opt;
+
+   r = mongoc_collection_create_indexes (collection, keys, opts, 2, &error);
+   ASSERT (r);
+
+   r = mongoc_collection_drop_index (collection, "hello_1", &error);
+   ASSERT (r);
+
+   r = mongoc_collection_drop_index (collection, "world_-1", &error);
+   ASSERT (r);
+
+   r = mongoc_collection_create_indexes (collection, keys, NULL, 2, &error);
+   ASSERT (r);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   bson_destroy (&keys1);
+   bson_destroy (&keys2);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
 static void
 test_index_compound (void)
 {
@@ -742,6 +943,53 @@ test_count (void)
 }
 
 
+static void
+test_estimated_count (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t b;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_estimated_count");
+   ASSERT (collection);
+
+   mongoc_collection_drop (collection, &error);
+
+   bson_init (&b);
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &b, NULL,
+                                 &error);
+   ASSERT (r);
+
+   ASSERT (1 == mongoc_collection_estimated_count (collection, NULL, &error));
+
+   /* a cached count does not see the second insert */
+   mongoc_client_set_estimated_count_ttl (client, 60 * 1000);
+   ASSERT (1 == mongoc_collection_estimated_count (collection, NULL, &error));
+
+   bson_reinit (&b);
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &b, NULL,
+                                 &error);
+   ASSERT (r);
+   ASSERT (1 == mongoc_collection_estimated_count (collection, NULL, &error));
+
+   mongoc_client_set_estimated_count_ttl (client, 0);
+   ASSERT (2 == mongoc_collection_estimated_count (collection, NULL, &error));
+
+   bson_destroy (&b);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_count_with_opts (void)
 {
@@ -916,6 +1164,70 @@ again:
 }
 
 
+static void
+test_aggregate_prefetch (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t *pipeline;
+   bson_t *opts;
+   bson_t b;
+   bool r;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_aggregate_prefetch");
+   ASSERT (collection);
+
+   mongoc_collection_drop (collection, &error);
+
+   for (i = 0; i < 20; i++) {
+      bson_init (&b);
+      BSON_APPEND_INT32 (&b, "i", i);
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (&b);
+   }
+
+   pipeline = BCON_NEW ("pipeline", "[", "{", "$sort", "{", "i", BCON_INT32 (1), "}", "}", "]");
+   opts = BCON_NEW ("initialBatchSize", BCON_INT32 (2),
+                    "batchSize", BCON_INT32 (3),
+                    "allowDiskUse", BCON_BOOL (true),
+                    "prefetch", BCON_BOOL (true));
+
+   cursor = mongoc_collection_aggregate (collection, MONGOC_QUERY_NONE, pipeline, opts, NULL);
+   ASSERT (cursor);
+   ASSERT (mongoc_cursor_get_prefetch (cursor));
+
+   i = 0;
+   while (mongoc_cursor_next (cursor, &doc)) {
+      i++;
+   }
+
+   if (mongoc_cursor_error (cursor, &error)) {
+      /* 2.4 and earlier do not return a cursor from aggregate */
+      ASSERT (error.domain == MONGOC_ERROR_QUERY);
+   } else {
+      ASSERT_CMPINT (i, ==, 20);
+   }
+
+   mongoc_cursor_destroy (cursor);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   bson_destroy (pipeline);
+   bson_destroy (opts);
+}
+
+
 static void
 test_validate (void)
 {
@@ -1393,13 +1705,271 @@ test_get_index_info (void)
    mongoc_client_destroy (client);
 }
 
+
+static void
+test_parallel_scan (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_client_t *other;
+   mongoc_cursor_t **cursors;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t *b;
+   int n = 0;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   other = test_framework_client_new (NULL);
+   ASSERT (other);
+
+   collection = get_test_collection (client, "test_parallel_scan");
+   ASSERT (collection);
+
+   for (i = 0; i < 100; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursors = mongoc_collection_parallel_scan (collection, 4, NULL, &error);
+   if (!cursors) {
+      MONGOC_ERROR ("%s", error.message);
+      abort ();
+   }
+
+   ASSERT (cursors[0]);
+
+   /* iterate the first cursor through another client */
+   r = mongoc_cursor_set_client (cursors[0], other, &error);
+   ASSERT (r);
+
+   for (i = 0; cursors[i]; i++) {
+      while (mongoc_cursor_next (cursors[i], &doc)) {
+         n++;
+      }
+      ASSERT (!mongoc_cursor_error (cursors[i], &error));
+      mongoc_cursor_destroy (cursors[i]);
+   }
+
+   bson_free (cursors);
+
+   ASSERT_CMPINT (n, ==, 100);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (other);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_validate_documents (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t *b;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_validate_documents");
+   ASSERT (collection);
+
+   ASSERT (mongoc_collection_get_validate_documents (collection));
+
+   b = BCON_NEW ("a.b", BCON_INT32 (1));
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                 &error);
+   ASSERT (!r);
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_BSON);
+
+   /* left to the server, which may or may not accept it */
+   mongoc_collection_set_validate_documents (collection, false);
+   ASSERT (!mongoc_collection_get_validate_documents (collection));
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                 &error);
+   ASSERT (r || error.domain != MONGOC_ERROR_BSON);
+   bson_destroy (b);
+
+   b = BCON_NEW ("a", BCON_INT32 (1));
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                 &error);
+   ASSERT (r);
+   bson_destroy (b);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_find_many (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursors[21];
+   const bson_t *queries[21];
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t *b;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_find_many");
+   ASSERT (collection);
+
+   for (i = 0; i < 20; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   for (i = 0; i < 20; i++) {
+      queries[i] = BCON_NEW ("i", BCON_INT32 (19 - i));
+   }
+
+   /* a failed query only fails its own cursor */
+   queries[20] = BCON_NEW ("i", "{", "$bad", BCON_INT32 (1), "}");
+
+   r = mongoc_collection_find_many (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    queries, 21, NULL, NULL, cursors, &error);
+   ASSERT (r);
+
+   for (i = 0; i < 20; i++) {
+      ASSERT (mongoc_cursor_next (cursors[i], &doc));
+      ASSERT (bson_iter_init_find (&iter, doc, "i"));
+      ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 19 - i);
+      ASSERT (!mongoc_cursor_next (cursors[i], &doc));
+      ASSERT (!mongoc_cursor_error (cursors[i], &error));
+   }
+
+   ASSERT (!mongoc_cursor_next (cursors[20], &doc));
+   ASSERT (mongoc_cursor_error (cursors[20], &error));
+
+   for (i = 0; i < 21; i++) {
+      mongoc_cursor_destroy (cursors[i]);
+      bson_destroy ((bson_t *)queries[i]);
+   }
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_find_one (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_cursor_t *cursor;
+   mongoc_cursor_t *reused;
+   const bson_t *found;
+   bson_error_t error;
+   bson_iter_t iter;
+   uint32_t n_free;
+   bson_t doc;
+   bson_t *q;
+   bson_t *b;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   ASSERT (client);
+
+   collection = get_test_collection (client, "test_find_one");
+   ASSERT (collection);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, b, NULL,
+                                    &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   q = BCON_NEW ("i", BCON_INT32 (7));
+   r = mongoc_collection_find_one (collection, q, NULL, NULL, &doc, &error);
+   ASSERT (r);
+   ASSERT (bson_iter_init_find (&iter, &doc, "i"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 7);
+   bson_destroy (&doc);
+
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+   r = mongoc_collection_find_one (collection, q, NULL, read_prefs, &doc,
+                                   &error);
+   ASSERT (r);
+   ASSERT (bson_has_field (&doc, "i"));
+   bson_destroy (&doc);
+   mongoc_read_prefs_destroy (read_prefs);
+   bson_destroy (q);
+
+   /* no match */
+   q = BCON_NEW ("i", BCON_INT32 (100));
+   r = mongoc_collection_find_one (collection, q, NULL, NULL, &doc, &error);
+   ASSERT (r);
+   ASSERT (bson_empty (&doc));
+   bson_destroy (&doc);
+   bson_destroy (q);
+
+   /* a destroyed cursor is reused by the next one */
+   q = BCON_NEW ("i", BCON_INT32 (3));
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    q, NULL, NULL);
+   n_free = client->free_cursors_len;
+   mongoc_cursor_destroy (cursor);
+   ASSERT_CMPINT (client->free_cursors_len, ==, n_free + 1);
+
+   reused = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    q, NULL, NULL);
+   ASSERT (reused == cursor);
+   ASSERT_CMPINT (client->free_cursors_len, ==, n_free);
+   ASSERT (mongoc_cursor_next (reused, &found));
+   ASSERT (bson_iter_init_find (&iter, found, "i"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 3);
+   mongoc_cursor_destroy (reused);
+   bson_destroy (q);
+
+   r = mongoc_collection_drop (collection, &error);
+   ASSERT (r);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 void
 test_collection_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Collection/insert_bulk", test_insert_bulk);
+   TestSuite_Add (suite, "/Collection/insert_raw", test_insert_raw);
    TestSuite_Add (suite, "/Collection/insert", test_insert);
+   TestSuite_Add (suite, "/Collection/insert_async", test_insert_async);
    TestSuite_Add (suite, "/Collection/save", test_save);
    TestSuite_Add (suite, "/Collection/index", test_index);
+   TestSuite_Add (suite, "/Collection/create_indexes", test_create_indexes);
    TestSuite_Add (suite, "/Collection/index_compound", test_index_compound);
    TestSuite_Add (suite, "/Collection/index_geo", test_index_geo);
    TestSuite_Add (suite, "/Collection/index_storage", test_index_storage);
@@ -1408,8 +1978,10 @@ test_collection_install (TestSuite *suite)
    TestSuite_Add (suite, "/Collection/remove", test_remove);
    TestSuite_Add (suite, "/Collection/count", test_count);
    TestSuite_Add (suite, "/Collection/count_with_opts", test_count_with_opts);
+   TestSuite_Add (suite, "/Collection/estimated_count", test_estimated_count);
    TestSuite_Add (suite, "/Collection/drop", test_drop);
    TestSuite_Add (suite, "/Collection/aggregate", test_aggregate);
+   TestSuite_Add (suite, "/Collection/aggregate_prefetch", test_aggregate_prefetch);
    TestSuite_Add (suite, "/Collection/validate", test_validate);
    TestSuite_Add (suite, "/Collection/rename", test_rename);
    TestSuite_Add (suite, "/Collection/stats", test_stats);
@@ -1418,4 +1990,9 @@ test_collection_install (TestSuite *suite)
    TestSuite_Add (suite, "/Collection/many_return", test_many_return);
    TestSuite_Add (suite, "/Collection/command_fully_qualified", test_command_fq);
    TestSuite_Add (suite, "/Collection/get_index_info", test_get_index_info);
+   TestSuite_Add (suite, "/Collection/parallel_scan", test_parallel_scan);
+   TestSuite_Add (suite, "/Collection/find_one", test_find_one);
+   TestSuite_Add (suite, "/Collection/find_many", test_find_many);
+   TestSuite_Add (suite, "/Collection/validate_documents",
+                  test_validate_documents);
 }
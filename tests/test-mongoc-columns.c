@@ -0,0 +1,159 @@
+#include <bcon.h>
+#include <mongoc.h>
+#include <mongoc-columns-private.h>
+
+#include "TestSuite.h"
+
+
+static bool
+bit_is_set (const void *bitmap,
+            uint32_t    i)
+{
+   return !!(((const uint8_t *)bitmap) [i >> 3] & (1 << (i & 7)));
+}
+
+
+static void
+test_columns_schema (void)
+{
+   mongoc_columns_t *columns;
+   struct ArrowSchema schema;
+
+   columns = mongoc_columns_new ();
+
+   assert (mongoc_columns_add (columns, "a", MONGOC_COLUMN_INT32));
+   assert (mongoc_columns_add (columns, "b.c", MONGOC_COLUMN_DATE_TIME));
+   assert (!mongoc_columns_add (columns, "a", MONGOC_COLUMN_INT64));
+   assert (!mongoc_columns_add (columns, "", MONGOC_COLUMN_INT64));
+   assert (!mongoc_columns_add (columns, "b..c", MONGOC_COLUMN_INT64));
+   assert (!mongoc_columns_add (columns, "b.", MONGOC_COLUMN_INT64));
+
+   mongoc_columns_get_schema (columns, &schema);
+   mongoc_columns_destroy (columns);
+
+   assert (!strcmp (schema.format, "+s"));
+   assert (schema.n_children == 2);
+   assert (!strcmp (schema.children [0]->format, "i"));
+   assert (!strcmp (schema.children [0]->name, "a"));
+   assert (schema.children [0]->flags & ARROW_FLAG_NULLABLE);
+   assert (!strcmp (schema.children [1]->format, "tsm:UTC"));
+   assert (!strcmp (schema.children [1]->name, "b.c"));
+
+   schema.release (&schema);
+   assert (!schema.release);
+}
+
+
+static void
+test_columns_decode (void)
+{
+   mongoc_columns_t *columns;
+   struct ArrowArray batch;
+   struct ArrowArray *col;
+   bson_error_t error;
+   bson_oid_t oid;
+   bson_t *docs [3];
+   uint8_t *data;
+   uint32_t data_len = 0;
+   const int32_t *offsets;
+   const int64_t *i64;
+   const double *d;
+   int i;
+
+   bson_oid_init_from_string (&oid, "0123456789abcdef01234567");
+
+   docs [0] = BCON_NEW ("_id", BCON_OID (&oid),
+                        "n", BCON_INT32 (1),
+                        "s", BCON_UTF8 ("one"),
+                        "x", "{", "y", BCON_DOUBLE (1.5), "}",
+                        "ok", BCON_BOOL (true));
+   /* missing "n", a string of the wrong type and an int64 for a double */
+   docs [1] = BCON_NEW ("s", BCON_INT32 (2),
+                        "x", "{", "y", BCON_INT64 (2), "}",
+                        "ok", BCON_BOOL (false));
+   /* the first value wins */
+   docs [2] = BCON_NEW ("n", BCON_INT64 (3),
+                        "n", BCON_INT32 (4),
+                        "s", BCON_UTF8 ("three"),
+                        "x", BCON_INT32 (5));
+
+   for (i = 0; i < 3; i++) {
+      data_len += docs [i]->len;
+   }
+
+   data = bson_malloc (data_len);
+
+   for (i = 0, data_len = 0; i < 3; i++) {
+      memcpy (data + data_len, bson_get_data (docs [i]), docs [i]->len);
+      data_len += docs [i]->len;
+   }
+
+   columns = mongoc_columns_new ();
+   mongoc_columns_add (columns, "_id", MONGOC_COLUMN_OID);
+   mongoc_columns_add (columns, "n", MONGOC_COLUMN_INT64);
+   mongoc_columns_add (columns, "s", MONGOC_COLUMN_UTF8);
+   mongoc_columns_add (columns, "x.y", MONGOC_COLUMN_DOUBLE);
+   mongoc_columns_add (columns, "ok", MONGOC_COLUMN_BOOL);
+
+   assert (_mongoc_columns_decode (columns, data, data_len, 3, &batch,
+                                   &error));
+
+   assert (batch.length == 3);
+   assert (batch.n_children == 5);
+
+   col = batch.children [0];
+   assert (col->null_count == 2);
+   assert (bit_is_set (col->buffers [0], 0));
+   assert (!bit_is_set (col->buffers [0], 1));
+   assert (!memcmp (col->buffers [1], oid.bytes, 12));
+
+   col = batch.children [1];
+   i64 = col->buffers [1];
+   assert (col->null_count == 1);
+   assert (!bit_is_set (col->buffers [0], 1));
+   assert (i64 [0] == 1);
+   assert (i64 [2] == 3);
+
+   col = batch.children [2];
+   offsets = col->buffers [1];
+   assert (col->n_buffers == 3);
+   assert (col->null_count == 1);
+   assert (offsets [0] == 0 && offsets [1] == 3);
+   assert (offsets [2] == 3 && offsets [3] == 8);
+   assert (!memcmp (col->buffers [2], "onethree", 8));
+
+   col = batch.children [3];
+   d = col->buffers [1];
+   assert (col->null_count == 1);
+   assert (d [0] == 1.5 && d [1] == 2.0);
+   assert (!bit_is_set (col->buffers [0], 2));
+
+   col = batch.children [4];
+   assert (col->null_count == 1);
+   assert (bit_is_set (col->buffers [1], 0));
+   assert (!bit_is_set (col->buffers [1], 1));
+   assert (bit_is_set (col->buffers [0], 1));
+
+   batch.release (&batch);
+   assert (!batch.release);
+
+   /* a truncated batch */
+   assert (!_mongoc_columns_decode (columns, data, data_len - 1, 3, &batch,
+                                    &error));
+   assert (error.domain == MONGOC_ERROR_CURSOR);
+
+   mongoc_columns_destroy (columns);
+   bson_free (data);
+
+   for (i = 0; i < 3; i++) {
+      bson_destroy (docs [i]);
+   }
+}
+
+
+void
+test_columns_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Columns/schema", test_columns_schema);
+   TestSuite_Add (suite, "/Columns/decode", test_columns_decode);
+}
@@ -0,0 +1,57 @@
+#include <mongoc.h>
+
+#include "TestSuite.h"
+
+
+static void
+test_counters_snapshot (void)
+{
+   mongoc_counters_iter_t iter;
+   mongoc_client_t *client;
+   int64_t *before;
+   int64_t *after;
+   uint32_t active = UINT32_MAX;
+   uint32_t n;
+   uint32_t i = 0;
+
+   n = mongoc_counters_snapshot (NULL, 0);
+   assert (n);
+
+   mongoc_counters_iter_init (&iter);
+
+   while (mongoc_counters_iter_next (&iter)) {
+      assert (iter.index == i++);
+      assert (iter.category && iter.name && iter.description);
+
+      if (!strcmp (iter.category, "Clients") && !strcmp (iter.name, "Active")) {
+         active = iter.index;
+      }
+   }
+
+   assert (i == n);
+   assert (!mongoc_counters_iter_next (&iter));
+   assert (active < n);
+
+   before = bson_malloc0 (n * sizeof *before);
+   after = bson_malloc0 (n * sizeof *after);
+
+   assert (mongoc_counters_snapshot (before, n) == n);
+   client = mongoc_client_new ("mongodb://localhost/");
+   assert (mongoc_counters_snapshot (after, n) == n);
+   ASSERT_CMPINT ((int)(after [active] - before [active]), ==, 1);
+
+   mongoc_client_destroy (client);
+   assert (mongoc_counters_snapshot (after, 1) == n);
+   assert (mongoc_counters_snapshot (after, n) == n);
+   ASSERT_CMPINT ((int)(after [active] - before [active]), ==, 0);
+
+   bson_free (before);
+   bson_free (after);
+}
+
+
+void
+test_counters_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/Counters/snapshot", test_counters_snapshot);
+}
@@ -1,7 +1,10 @@
 #include <mongoc.h>
+#include <mongoc-client-private.h>
 #include <mongoc-cursor-private.h>
+#include <mongoc-thread-private.h>
 
 #include "TestSuite.h"
+#include "mock-server.h"
 #include "test-libmongoc.h"
 
 static void
@@ -130,10 +133,918 @@ test_invalid_query (void)
 }
 
 
+static void
+test_prefetch (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int64_t count;
+   int n = 0;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_prefetch");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursor = _mongoc_cursor_new (client, "test.test_prefetch",
+                                MONGOC_QUERY_NONE, 0, 0, 3, false, &q, NULL,
+                                NULL);
+   mongoc_cursor_set_prefetch (cursor, true);
+   ASSERT (mongoc_cursor_get_prefetch (cursor));
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+
+      if (n == 5) {
+         /* another request while a batch is prefetched */
+         count = mongoc_collection_count (col, MONGOC_QUERY_NONE, NULL, 0, 0,
+                                          NULL, &error);
+         ASSERT_CMPINT ((int)count, ==, 10);
+      }
+   }
+
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (n, ==, 10);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_incremental (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   char pad [1024];
+   int64_t count;
+   int n = 0;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_incremental");
+   mongoc_collection_drop (col, NULL);
+
+   memset (pad, 'x', sizeof pad - 1);
+   pad [sizeof pad - 1] = '\0';
+
+   for (i = 0; i < 50; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i), "pad", BCON_UTF8 (pad));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursor = mongoc_collection_find (col, MONGOC_QUERY_NONE, 0, 0, 0, &q,
+                                    NULL, NULL);
+   mongoc_cursor_set_incremental_threshold (cursor, 4096);
+   ASSERT_CMPINT (mongoc_cursor_get_incremental_threshold (cursor), ==, 4096);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+
+      if (n == 25) {
+         /* the rest of the reply is still on the connection */
+         count = mongoc_collection_count (col, MONGOC_QUERY_NONE, NULL, 0, 0,
+                                          NULL, &error);
+         ASSERT_CMPINT ((int)count, ==, -1);
+         ASSERT_CMPINT (error.code, ==, MONGOC_ERROR_CLIENT_IN_EXHAUST);
+      }
+   }
+
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (n, ==, 50);
+   mongoc_cursor_destroy (cursor);
+
+   count = mongoc_collection_count (col, MONGOC_QUERY_NONE, NULL, 0, 0,
+                                    NULL, &error);
+   ASSERT_CMPINT ((int)count, ==, 50);
+
+   /* destroyed in the middle of a reply */
+   cursor = mongoc_collection_find (col, MONGOC_QUERY_NONE, 0, 0, 0, &q,
+                                    NULL, NULL);
+   mongoc_cursor_set_incremental_threshold (cursor, 4096);
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (r);
+   mongoc_cursor_destroy (cursor);
+
+   count = mongoc_collection_count (col, MONGOC_QUERY_NONE, NULL, 0, 0,
+                                    NULL, &error);
+   ASSERT_CMPINT ((int)count, ==, 50);
+
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_adaptive_batch_size (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int n = 0;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_adaptive");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 50; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursor = _mongoc_cursor_new (client, "test.test_adaptive",
+                                MONGOC_QUERY_NONE, 0, 0, 2, false, &q, NULL,
+                                NULL);
+   mongoc_cursor_set_adaptive_batch_size (cursor, 1024 * 1024);
+   ASSERT_CMPINT (mongoc_cursor_get_adaptive_batch_size (cursor), ==,
+                  1024 * 1024);
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      n++;
+   }
+
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (n, ==, 50);
+   ASSERT_CMPINT (cursor->adaptive_n_return, >=, 4);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_next_batch (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const uint32_t *offsets;
+   const uint8_t *data;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   bson_t inline_doc;
+   uint32_t data_len;
+   uint32_t n_docs;
+   uint32_t expected[] = { 3, 4, 3 };
+   int n = 0;
+   int i;
+   uint32_t j;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_next_batch");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 11; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursor = _mongoc_cursor_new (client, "test.test_next_batch",
+                                MONGOC_QUERY_NONE, 0, 0, 4, false, &q, NULL,
+                                NULL);
+
+   /* the rest of a batch partially read by mongoc_cursor_next() */
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (r);
+   n++;
+
+   for (i = 0; mongoc_cursor_next_batch (cursor, &data, &data_len, &n_docs,
+                                         &offsets); i++) {
+      ASSERT (i < 3);
+      ASSERT_CMPINT (n_docs, ==, expected[i]);
+
+      for (j = 0; j < n_docs; j++) {
+         r = bson_init_static (&inline_doc, data + offsets[j],
+                               (j + 1 < n_docs ? offsets[j + 1]
+                                               : data_len) - offsets[j]);
+         ASSERT (r);
+         ASSERT (bson_iter_init_find (&iter, &inline_doc, "i"));
+         ASSERT_CMPINT (bson_iter_int32 (&iter), ==, n);
+         n++;
+      }
+   }
+
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (n, ==, 11);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static bool
+stream_cb (const bson_t *doc,
+           void         *data)
+{
+   bson_iter_t iter;
+   int *n = data;
+
+   ASSERT (bson_iter_init_find (&iter, doc, "i"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, *n);
+
+   return ++(*n) != 150;
+}
+
+
+static void
+test_stream (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int n;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_stream");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 200; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   /* stopped by the callback while the server is still sending */
+   n = 0;
+   cursor = _mongoc_cursor_new (client, "test.test_stream",
+                                MONGOC_QUERY_EXHAUST, 0, 0, 10, false, &q,
+                                NULL, NULL);
+   r = mongoc_cursor_stream (cursor, stream_cb, &n);
+   ASSERT (r);
+   ASSERT_CMPINT (n, ==, 150);
+   ASSERT (!mongoc_cursor_more (cursor));
+   mongoc_cursor_destroy (cursor);
+
+   /* the client is usable again, stream to the end */
+   n = 160;
+   cursor = _mongoc_cursor_new (client, "test.test_stream",
+                                MONGOC_QUERY_EXHAUST, 160, 0, 10, false, &q,
+                                NULL, NULL);
+   r = mongoc_cursor_stream (cursor, stream_cb, &n);
+   ASSERT (r);
+   ASSERT_CMPINT (n, ==, 200);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   mongoc_cursor_destroy (cursor);
+
+   /* a cursor without exhaust */
+   n = 0;
+   cursor = _mongoc_cursor_new (client, "test.test_stream",
+                                MONGOC_QUERY_NONE, 0, 0, 10, false, &q,
+                                NULL, NULL);
+   r = mongoc_cursor_stream (cursor, stream_cb, &n);
+   ASSERT (r);
+   ASSERT_CMPINT (n, ==, 150);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_kill_deferred (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_kill_deferred");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   /* abandoned cursors are queued rather than killed one at a time */
+   for (i = 0; i < 3; i++) {
+      cursor = _mongoc_cursor_new (client, "test.test_kill_deferred",
+                                   MONGOC_QUERY_NONE, 0, 0, 2, false, &q,
+                                   NULL, NULL);
+      r = mongoc_cursor_next (cursor, &doc);
+      ASSERT (r);
+      ASSERT (mongoc_cursor_get_id (cursor));
+      mongoc_cursor_destroy (cursor);
+   }
+
+   ASSERT_CMPINT ((int)client->cluster.dead_cursors.len, ==, 3);
+
+   /* and sent ahead of the next request to their node */
+   ASSERT_CMPINT ((int)mongoc_collection_count (col, MONGOC_QUERY_NONE, NULL,
+                                                0, 0, NULL, &error), ==, 10);
+   ASSERT_CMPINT ((int)client->cluster.dead_cursors.len, ==, 0);
+
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_limit_batches (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_limit_batches");
+   mongoc_collection_drop (col, NULL);
+
+   for (i = 0; i < 10; i++) {
+      b = BCON_NEW ("i", BCON_INT32 (i));
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   /* no more than the limit is fetched, with or without a batch size */
+   cursor = _mongoc_cursor_new (client, "test.test_limit_batches",
+                                MONGOC_QUERY_NONE, 0, 3, 0, false, &q,
+                                NULL, NULL);
+   ASSERT (mongoc_cursor_next (cursor, &doc));
+   ASSERT_CMPINT (cursor->rpc.reply.n_returned, ==, 3);
+   mongoc_cursor_destroy (cursor);
+
+   cursor = _mongoc_cursor_new (client, "test.test_limit_batches",
+                                MONGOC_QUERY_NONE, 0, 5, 2, false, &q,
+                                NULL, NULL);
+   for (i = 0; mongoc_cursor_next (cursor, &doc); i++) {
+      ASSERT_CMPINT (cursor->rpc.reply.n_returned, <=, 2);
+   }
+   ASSERT_CMPINT (i, ==, 5);
+   mongoc_cursor_destroy (cursor);
+
+   /*
+    * a single batch closes the cursor, there is nothing left to kill, and
+    * its query sends the kills queued above
+    */
+   cursor = _mongoc_cursor_new (client, "test.test_limit_batches",
+                                MONGOC_QUERY_NONE, 0, 5, 0, false, &q,
+                                NULL, NULL);
+   mongoc_cursor_set_single_batch (cursor, true);
+   ASSERT (mongoc_cursor_get_single_batch (cursor));
+   for (i = 0; mongoc_cursor_next (cursor, &doc); i++) {
+      ASSERT (!mongoc_cursor_get_id (cursor));
+   }
+   ASSERT_CMPINT (i, ==, 5);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   mongoc_cursor_destroy (cursor);
+
+   ASSERT_CMPINT ((int)client->cluster.dead_cursors.len, ==, 0);
+
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_field_index (void)
+{
+   mongoc_collection_t *col;
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t q = BSON_INITIALIZER;
+   bson_t *b;
+   int n = 0;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   col = mongoc_client_get_collection (client, "test", "test_field_index");
+   mongoc_collection_drop (col, NULL);
+
+   /* two shapes, the second with a field more and a longer string */
+   for (i = 0; i < 10; i++) {
+      if (i < 5) {
+         b = BCON_NEW ("i", BCON_INT32 (i), "s", BCON_UTF8 ("x"));
+      } else {
+         b = BCON_NEW ("i", BCON_INT32 (i), "s", BCON_UTF8 ("xyz"),
+                       "t", BCON_BOOL (true));
+      }
+      r = mongoc_collection_insert (col, MONGOC_INSERT_NONE, b, NULL, &error);
+      ASSERT (r);
+      bson_destroy (b);
+   }
+
+   cursor = _mongoc_cursor_new (client, "test.test_field_index",
+                                MONGOC_QUERY_NONE, 0, 0, 0, false, &q, NULL,
+                                NULL);
+   ASSERT (!mongoc_cursor_get_field_index (cursor));
+   mongoc_cursor_set_field_index (cursor, true);
+   ASSERT (mongoc_cursor_get_field_index (cursor));
+
+   ASSERT (!mongoc_cursor_get_field (cursor, "i", &iter));
+
+   while (mongoc_cursor_next (cursor, &doc)) {
+      ASSERT (mongoc_cursor_get_field (cursor, "_id", &iter));
+      ASSERT (BSON_ITER_HOLDS_OID (&iter));
+      ASSERT (mongoc_cursor_get_field (cursor, "s", &iter));
+      ASSERT_CMPSTR (bson_iter_utf8 (&iter, NULL), n < 5 ? "x" : "xyz");
+      ASSERT (mongoc_cursor_get_field (cursor, "i", &iter));
+      ASSERT_CMPINT (bson_iter_int32 (&iter), ==, n);
+      ASSERT (mongoc_cursor_get_field (cursor, "t", &iter) == (n >= 5));
+      ASSERT (!mongoc_cursor_get_field (cursor, "missing", &iter));
+      n++;
+   }
+
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (n, ==, 10);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_collection_drop (col, NULL);
+   mongoc_collection_destroy (col);
+   mongoc_client_destroy (client);
+}
+
+
+/*
+ * Hangs up on the first query on "test.test" and answers the next with a
+ * single document, counting the queries in @user_data.
+ */
+static void
+hangup_once_handler (mock_server_t   *server,
+                     mongoc_stream_t *stream,
+                     mongoc_rpc_t    *rpc,
+                     void            *user_data)
+{
+   int *n_queries = user_data;
+   bson_t reply = BSON_INITIALIZER;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       strcmp (rpc->query.collection, "test.test")) {
+      return;
+   }
+
+   if (!(*n_queries)++) {
+      mongoc_stream_close (stream);
+      return;
+   }
+
+   BSON_APPEND_INT32 (&reply, "_id", 1);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+static void
+test_retry_read (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t q = BSON_INITIALIZER;
+   uint16_t port;
+   char *uristr;
+   int n_queries = 0;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, hangup_once_handler,
+                             &n_queries);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/", port);
+   client = mongoc_client_new (uristr);
+   collection = mongoc_client_get_collection (client, "test", "test");
+
+   /* the query is sent again on a new connection, once */
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &q, NULL, NULL);
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (r);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   ASSERT (bson_iter_init_find (&iter, doc, "_id"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 1);
+   ASSERT_CMPINT (n_queries, ==, 2);
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&q);
+   bson_free (uristr);
+}
+
+
+/*
+ * Leaves queries on "test.test" unanswered while @user_data is true, as a
+ * server too slow for the operation timeout would.
+ */
+static void
+slow_query_handler (mock_server_t   *server,
+                    mongoc_stream_t *stream,
+                    mongoc_rpc_t    *rpc,
+                    void            *user_data)
+{
+   bool *slow = user_data;
+   bson_t reply = BSON_INITIALIZER;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       strcmp (rpc->query.collection, "test.test") ||
+       *slow) {
+      return;
+   }
+
+   BSON_APPEND_INT32 (&reply, "_id", 1);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+static void
+test_operation_timeout (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   const bson_t *doc;
+   bson_error_t error;
+   bson_t q = BSON_INITIALIZER;
+   uint16_t port;
+   char *uristr;
+   int64_t started;
+   bool slow = true;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, slow_query_handler, &slow);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/", port);
+   client = mongoc_client_new (uristr);
+   collection = mongoc_client_get_collection (client, "test", "test");
+
+   mongoc_collection_set_operation_timeout (collection, 200);
+   ASSERT_CMPINT (mongoc_collection_get_operation_timeout (collection), ==,
+                  200);
+
+   /* well within socketTimeoutMS, which is minutes */
+   started = bson_get_monotonic_time ();
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &q, NULL, NULL);
+   ASSERT_CMPINT (mongoc_cursor_get_operation_timeout (cursor), ==, 200);
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (!r);
+   ASSERT (mongoc_cursor_error (cursor, &error));
+   ASSERT_CMPINT (error.domain, ==, MONGOC_ERROR_STREAM);
+   ASSERT_CMPINT (error.code, ==, MONGOC_ERROR_STREAM_SOCKET);
+   ASSERT ((bson_get_monotonic_time () - started) < 2000 * 1000);
+   mongoc_cursor_destroy (cursor);
+
+   /* the connection given up on is replaced for the next operation */
+   slow = false;
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &q, NULL, NULL);
+   mongoc_cursor_set_operation_timeout (cursor, 1000);
+   ASSERT_CMPINT (mongoc_cursor_get_operation_timeout (cursor), ==, 1000);
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (r);
+   ASSERT (!mongoc_cursor_error (cursor, &error));
+   mongoc_cursor_destroy (cursor);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&q);
+   bson_free (uristr);
+}
+
+
+typedef struct
+{
+   mongoc_mutex_t mutex;
+   int            n_first;
+   int64_t        first_at [2];
+} hedge_test_t;
+
+
+/*
+ * Echoes the "n" of queries on "test.test". The first copy of the query
+ * with n: 1 to reach either member is answered 300ms late, so that the
+ * hedge sent to the other member wins.
+ */
+static void
+hedge_handler (mock_server_t   *server,
+               mongoc_stream_t *stream,
+               mongoc_rpc_t    *rpc,
+               void            *user_data)
+{
+   hedge_test_t *test = user_data;
+   bson_iter_t iter;
+   bson_iter_t child;
+   bson_t reply = BSON_INITIALIZER;
+   bson_t doc;
+   int32_t len;
+   int32_t n = 0;
+   int idx;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       strcmp (rpc->query.collection, "test.test")) {
+      return;
+   }
+
+   memcpy (&len, rpc->query.query, 4);
+   len = BSON_UINT32_FROM_LE (len);
+
+   if (bson_init_static (&doc, rpc->query.query, len)) {
+      if (bson_iter_init_find (&iter, &doc, "$query") &&
+          BSON_ITER_HOLDS_DOCUMENT (&iter) &&
+          bson_iter_recurse (&iter, &child) &&
+          bson_iter_find (&child, "n")) {
+         n = bson_iter_int32 (&child);
+      } else if (bson_iter_init_find (&iter, &doc, "n")) {
+         n = bson_iter_int32 (&iter);
+      }
+   }
+
+   if (n == 1) {
+      mongoc_mutex_lock (&test->mutex);
+      idx = test->n_first++;
+      if (idx < 2) {
+         test->first_at [idx] = bson_get_monotonic_time ();
+      }
+      mongoc_mutex_unlock (&test->mutex);
+
+      if (!idx) {
+         usleep (300 * 1000);
+      }
+   }
+
+   BSON_APPEND_INT32 (&reply, "n", n);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+static void
+test_hedged_read (void)
+{
+   mongoc_collection_t *collection;
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   mock_server_t *primary;
+   mock_server_t *secondary;
+   hedge_test_t test = { 0 };
+   const bson_t *doc;
+   bson_error_t error;
+   bson_iter_t iter;
+   uint16_t port;
+   char *hosts;
+   char *uristr;
+   int64_t started;
+   bson_t q;
+   bool r;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+   hosts = bson_strdup_printf ("127.0.0.1:%hu,127.0.0.1:%hu", port,
+                               (uint16_t)(port + 1));
+
+   mongoc_mutex_init (&test.mutex);
+
+   primary = mock_server_new ("127.0.0.1", port, hedge_handler, &test);
+   mock_server_set_replset (primary, "rs", true, hosts);
+   mock_server_run_in_thread (primary);
+
+   secondary = mock_server_new ("127.0.0.1", port + 1, hedge_handler, &test);
+   mock_server_set_replset (secondary, "rs", false, hosts);
+   mock_server_run_in_thread (secondary);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://%s/?replicaSet=rs&hedgedReads=true"
+                                "&hedgeDelayMS=50&maxConnectionsPerNode=2",
+                                hosts);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   collection = mongoc_client_get_collection (client, "test", "test");
+   read_prefs = mongoc_read_prefs_new (MONGOC_READ_NEAREST);
+
+   /* the hedge goes out after hedgeDelayMS and beats the slow member */
+   bson_init (&q);
+   BSON_APPEND_INT32 (&q, "n", 1);
+   started = bson_get_monotonic_time ();
+   cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                    &q, NULL, read_prefs);
+   r = mongoc_cursor_next (cursor, &doc);
+   ASSERT (r);
+   ASSERT (bson_iter_init_find (&iter, doc, "n"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 1);
+   ASSERT ((bson_get_monotonic_time () - started) < 300 * 1000);
+   mongoc_cursor_destroy (cursor);
+   bson_destroy (&q);
+
+   ASSERT_CMPINT (test.n_first, ==, 2);
+   ASSERT ((test.first_at [1] - test.first_at [0]) >= 40 * 1000);
+
+   /* let the losing reply arrive, it must be read and dropped */
+   usleep (500 * 1000);
+
+   for (i = 2; i < 6; i++) {
+      bson_init (&q);
+      BSON_APPEND_INT32 (&q, "n", i);
+      cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 1, 0,
+                                       &q, NULL, read_prefs);
+      r = mongoc_cursor_next (cursor, &doc);
+      ASSERT (r);
+      ASSERT (bson_iter_init_find (&iter, doc, "n"));
+      ASSERT_CMPINT (bson_iter_int32 (&iter), ==, i);
+      ASSERT (!mongoc_cursor_error (cursor, &error));
+      mongoc_cursor_destroy (cursor);
+      bson_destroy (&q);
+   }
+
+   ASSERT_CMPINT (test.n_first, ==, 2);
+
+   mongoc_read_prefs_destroy (read_prefs);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_quit (primary, 0);
+   mock_server_quit (secondary, 0);
+   mongoc_mutex_destroy (&test.mutex);
+   bson_free (uristr);
+   bson_free (hosts);
+}
+
+
+/*
+ * Iterate a cursor of 10 batches of 100 documents of 100 bytes, served
+ * by a mock server with canned replies.
+ */
+static void
+bench_iterate (Bench *bench)
+{
+   static uint16_t port;
+   mongoc_collection_t *collection;
+   mongoc_cursor_t *cursor;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   const bson_t *doc;
+   bson_error_t error;
+   uint64_t i;
+   char *uristr;
+   bson_t q = BSON_INITIALIZER;
+   bson_t reply;
+   bool r;
+   int n;
+
+   if (!port) {
+      port = 22000 + (rand () % 1000);
+      server = mock_server_new ("127.0.0.1", port, NULL, NULL);
+      mock_server_set_wire_version (server, 0, 3);
+      mock_server_set_canned_reply (server, 100, 100, 10);
+      mock_server_run_in_thread (server);
+   }
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/", port);
+   client = mongoc_client_new (uristr);
+   collection = mongoc_client_get_collection (client, "test", "test");
+
+   /* Connect before the timer starts. */
+   r = mongoc_client_get_server_status (client, NULL, &reply, &error);
+   ASSERT (r);
+   bson_destroy (&reply);
+   Bench_ResetTimer (bench);
+
+   for (i = 0; i < bench->iterations; i++) {
+      cursor = mongoc_collection_find (collection, MONGOC_QUERY_NONE, 0, 0,
+                                       0, &q, NULL, NULL);
+      n = 0;
+      while (mongoc_cursor_next (cursor, &doc)) {
+         n++;
+      }
+      ASSERT (!mongoc_cursor_error (cursor, &error));
+      ASSERT_CMPINT (n, ==, 1000);
+      mongoc_cursor_destroy (cursor);
+   }
+
+   Bench_StopTimer (bench);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   bson_free (uristr);
+}
+
+
 void
 test_cursor_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Cursor/get_host", test_get_host);
    TestSuite_Add (suite, "/Cursor/clone", test_clone);
    TestSuite_Add (suite, "/Cursor/invalid_query", test_invalid_query);
+   TestSuite_Add (suite, "/Cursor/prefetch", test_prefetch);
+   TestSuite_Add (suite, "/Cursor/incremental", test_incremental);
+   TestSuite_Add (suite, "/Cursor/adaptive_batch_size",
+                  test_adaptive_batch_size);
+   TestSuite_Add (suite, "/Cursor/next_batch", test_next_batch);
+   TestSuite_Add (suite, "/Cursor/stream", test_stream);
+   TestSuite_Add (suite, "/Cursor/kill_deferred", test_kill_deferred);
+   TestSuite_Add (suite, "/Cursor/limit_batches", test_limit_batches);
+   TestSuite_Add (suite, "/Cursor/field_index", test_field_index);
+   TestSuite_Add (suite, "/Cursor/retry_read", test_retry_read);
+   TestSuite_Add (suite, "/Cursor/operation_timeout", test_operation_timeout);
+   TestSuite_Add (suite, "/Cursor/hedged_read", test_hedged_read);
+   TestSuite_AddBench (suite, "/Cursor/iterate", bench_iterate, 5, 1);
 }
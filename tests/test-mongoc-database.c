@@ -446,6 +446,81 @@ test_get_collection_names_error (void)
    bson_free (uristr);
 }
 
+
+static bool
+_has_name (char **names,
+           const char *name)
+{
+   char **p;
+   bool found = false;
+
+   for (p = names; *p; p++) {
+      if (!strcmp (*p, name)) {
+         found = true;
+      }
+   }
+
+   bson_strfreev (names);
+
+   return found;
+}
+
+static void
+test_metadata_cache (void)
+{
+   mongoc_database_t *database;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t cmd = BSON_INITIALIZER;
+   char **names;
+   char *dbname;
+   char *name;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+   mongoc_client_set_metadata_cache_ttl (client, 60 * 1000);
+
+   dbname = gen_collection_name ("dbtest");
+   database = mongoc_client_get_database (client, dbname);
+   name = gen_collection_name ("cached");
+
+   collection = mongoc_database_create_collection (database, name, NULL,
+                                                   &error);
+   assert (collection);
+
+   names = mongoc_database_get_collection_names (database, &error);
+   assert (names);
+   assert (_has_name (names, name));
+
+   /* dropped behind the cache's back, the listing is still cached */
+   BSON_APPEND_UTF8 (&cmd, "drop", name);
+   assert (mongoc_database_command_simple (database, &cmd, NULL, NULL,
+                                           &error));
+   names = mongoc_database_get_collection_names (database, &error);
+   assert (names);
+   assert (_has_name (names, name));
+
+   /* created again and dropped through the driver, it is not */
+   mongoc_collection_destroy (collection);
+   collection = mongoc_database_create_collection (database, name, NULL,
+                                                   &error);
+   assert (collection);
+   assert (mongoc_collection_drop (collection, &error));
+   names = mongoc_database_get_collection_names (database, &error);
+   assert (names);
+   assert (!_has_name (names, name));
+
+   assert (mongoc_database_drop (database, &error));
+
+   bson_destroy (&cmd);
+   bson_free (name);
+   bson_free (dbname);
+   mongoc_collection_destroy (collection);
+   mongoc_database_destroy (database);
+   mongoc_client_destroy (client);
+}
+
 void
 test_database_install (TestSuite *suite)
 {
@@ -459,4 +534,5 @@ test_database_install (TestSuite *suite)
                   test_get_collection_names);
    TestSuite_Add (suite, "/Database/get_collection_names_error",
                   test_get_collection_names_error);
+   TestSuite_Add (suite, "/Database/metadata_cache", test_metadata_cache);
 }
@@ -115,7 +115,8 @@ test_list (void)
    bson_error_t error;
    mongoc_gridfs_file_list_t *list;
    mongoc_gridfs_file_opt_t opt = { 0 };
-   bson_t query, child;
+   bson_t query, child, fields;
+   const uint8_t *data;
    char buf[100];
    int i = 0;
 
@@ -158,6 +159,34 @@ test_list (void)
    assert(i == 3);
    mongoc_gridfs_file_list_destroy (list);
 
+   /* only the filename, a file per batch, and the handles are partial */
+   bson_init (&query);
+   bson_init (&fields);
+   bson_append_int32 (&fields, "filename", -1, 1);
+   bson_append_int32 (&fields, "_id", -1, 0);
+
+   list = mongoc_gridfs_find_with_fields (gridfs, &query, &fields, 1);
+
+   bson_destroy (&query);
+   bson_destroy (&fields);
+
+   i = 0;
+   while ((file = mongoc_gridfs_file_list_next (list))) {
+      i++;
+      assert (mongoc_gridfs_file_get_filename (file));
+      assert (!strncmp (mongoc_gridfs_file_get_filename (file), "file.", 5));
+      assert (!mongoc_gridfs_file_get_id (file)->value_type);
+      assert (!mongoc_gridfs_file_get_upload_date (file));
+      assert (mongoc_gridfs_file_read_view (file, &data, 1) == -1);
+      assert (mongoc_gridfs_file_error (file, &error));
+      assert (error.code == MONGOC_ERROR_GRIDFS_PARTIAL_FILE);
+
+      mongoc_gridfs_file_destroy (file);
+   }
+   assert (i == 3);
+   assert (!mongoc_gridfs_file_list_error (list, &error));
+   mongoc_gridfs_file_list_destroy (list);
+
    bson_init (&query);
    bson_append_utf8 (&query, "filename", -1, "file.1", -1);
    file = mongoc_gridfs_find_one (gridfs, &query, &error);
@@ -185,6 +214,9 @@ test_create_from_stream (void)
    mongoc_stream_t *stream;
    mongoc_client_t *client;
    bson_error_t error;
+   mongoc_iovec_t riov;
+   char buf[6];
+   int64_t length;
 
    client = test_framework_client_new (NULL);
    assert (client);
@@ -200,6 +232,25 @@ test_create_from_stream (void)
    file = mongoc_gridfs_create_file_from_stream (gridfs, stream, NULL);
    assert (file);
    assert (mongoc_gridfs_file_save (file));
+   length = mongoc_gridfs_file_get_length (file);
+   assert (length > 6);
+
+   mongoc_gridfs_file_destroy (file);
+
+   /* only the rest of a stream already read from is stored */
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/gridfs.dat", O_RDONLY, 0);
+   assert (stream);
+   assert (mongoc_stream_read (stream, buf, 6, 6, 0) == 6);
+
+   file = mongoc_gridfs_create_file_from_stream (gridfs, stream, NULL);
+   assert (file);
+   assert (mongoc_gridfs_file_save (file));
+   assert (mongoc_gridfs_file_get_length (file) == length - 6);
+
+   riov.iov_base = buf;
+   riov.iov_len = 5;
+   assert (mongoc_gridfs_file_readv (file, &riov, 1, 5, 0) == 5);
+   assert (memcmp (buf, "ipsum", 5) == 0);
 
    mongoc_gridfs_file_destroy (file);
 
@@ -263,6 +314,491 @@ test_read (void)
 }
 
 
+static void
+test_read_ahead (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   ssize_t r;
+   char buf[] = "foo bar baz quux";
+   char buf2[100];
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov;
+   mongoc_iovec_t riov;
+   int len = sizeof buf - 1;
+
+   iov.iov_base = buf;
+   iov.iov_len = len;
+
+   riov.iov_base = buf2;
+   riov.iov_len = sizeof buf2;
+
+   opt.chunk_size = 2;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "read_ahead", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   assert (mongoc_gridfs_file_get_read_ahead (file) == 0);
+
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len);
+   assert (mongoc_gridfs_file_save (file));
+
+   /* the 8 chunks are fetched 3 at a time */
+   mongoc_gridfs_file_set_read_ahead (file, 3);
+   assert (mongoc_gridfs_file_get_read_ahead (file) == 3);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_readv (file, &riov, 1, len, 0);
+   assert (r == len);
+   assert (memcmp (buf2, buf, len) == 0);
+
+   /* skipping ahead within the window, then back before it */
+   assert (!mongoc_gridfs_file_seek (file, 4, SEEK_SET));
+   riov.iov_len = 3;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 3, 0);
+   assert (r == 3);
+   assert (memcmp (buf2, "bar", 3) == 0);
+
+   assert (!mongoc_gridfs_file_seek (file, 12, SEEK_SET));
+   riov.iov_len = 4;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 4, 0);
+   assert (r == 4);
+   assert (memcmp (buf2, "quux", 4) == 0);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   riov.iov_len = 3;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 3, 0);
+   assert (r == 3);
+   assert (memcmp (buf2, "foo", 3) == 0);
+
+   /* a range is fetched on its own, and reading on past it still works */
+   mongoc_gridfs_file_set_read_range (file, 5, 6);
+   assert (!mongoc_gridfs_file_seek (file, 5, SEEK_SET));
+   riov.iov_len = 6;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 6, 0);
+   assert (r == 6);
+   assert (memcmp (buf2, "ar baz", 6) == 0);
+
+   riov.iov_len = 5;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 5, 0);
+   assert (r == 5);
+   assert (memcmp (buf2, " quux", 5) == 0);
+
+   assert (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_bulk_upload (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   ssize_t r;
+   char buf[] = "foo bar baz quux";
+   char buf2[100];
+   char buf3[] = "BAR";
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov;
+   mongoc_iovec_t riov;
+   int len = sizeof buf - 1;
+   int64_t count;
+
+   iov.iov_base = buf;
+   iov.iov_len = len;
+
+   riov.iov_base = buf2;
+   riov.iov_len = sizeof buf2;
+
+   opt.chunk_size = 2;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "bulk_upload", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   assert (!mongoc_gridfs_file_get_bulk_upload (file));
+   mongoc_gridfs_file_set_bulk_upload (file, true);
+   assert (mongoc_gridfs_file_get_bulk_upload (file));
+
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len);
+   assert (mongoc_gridfs_file_save (file));
+
+   count = mongoc_collection_count (mongoc_gridfs_get_chunks (gridfs),
+                                    MONGOC_QUERY_NONE, NULL, 0, 0, NULL,
+                                    &error);
+   assert (count == 8);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_readv (file, &riov, 1, len, 0);
+   assert (r == len);
+   assert (memcmp (buf2, buf, len) == 0);
+
+   /* overwritten chunks replace the stored ones */
+   assert (!mongoc_gridfs_file_seek (file, 4, SEEK_SET));
+   iov.iov_base = buf3;
+   iov.iov_len = 3;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == 3);
+   assert (mongoc_gridfs_file_save (file));
+
+   count = mongoc_collection_count (mongoc_gridfs_get_chunks (gridfs),
+                                    MONGOC_QUERY_NONE, NULL, 0, 0, NULL,
+                                    &error);
+   assert (count == 8);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_readv (file, &riov, 1, len, 0);
+   assert (r == len);
+   assert (memcmp (buf2, "foo BAR baz quux", len) == 0);
+
+   assert (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_cache (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   ssize_t r;
+   char buf[] = "foo bar baz quux";
+   char buf2[100];
+   char buf3[] = "BAZ";
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov;
+   mongoc_iovec_t riov;
+   int len = sizeof buf - 1;
+
+   iov.iov_base = buf;
+   iov.iov_len = len;
+
+   riov.iov_base = buf2;
+   riov.iov_len = sizeof buf2;
+
+   opt.chunk_size = 2;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "cache", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   assert (mongoc_gridfs_file_get_cache_size (file) == 0);
+
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len);
+   assert (mongoc_gridfs_file_save (file));
+
+   mongoc_gridfs_file_set_cache_size (file, 4);
+   assert (mongoc_gridfs_file_get_cache_size (file) == 4);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_readv (file, &riov, 1, len, 0);
+   assert (r == len);
+   assert (memcmp (buf2, buf, len) == 0);
+
+   /* the last 4 chunks read are served without the server */
+   assert (mongoc_collection_drop (mongoc_gridfs_get_chunks (gridfs), &error));
+
+   assert (!mongoc_gridfs_file_seek (file, 12, SEEK_SET));
+   riov.iov_len = 4;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 4, 0);
+   assert (r == 4);
+   assert (memcmp (buf2, "quux", 4) == 0);
+
+   assert (!mongoc_gridfs_file_seek (file, 8, SEEK_SET));
+   riov.iov_len = 3;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 3, 0);
+   assert (r == 3);
+   assert (memcmp (buf2, "baz", 3) == 0);
+
+   /* chunks written are cached as well */
+   assert (!mongoc_gridfs_file_seek (file, 8, SEEK_SET));
+   iov.iov_base = buf3;
+   iov.iov_len = 3;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == 3);
+   assert (!mongoc_gridfs_file_seek (file, 12, SEEK_SET));
+
+   assert (!mongoc_gridfs_file_seek (file, 8, SEEK_SET));
+   riov.iov_len = 3;
+   r = mongoc_gridfs_file_readv (file, &riov, 1, 3, 0);
+   assert (r == 3);
+   assert (memcmp (buf2, "BAZ", 3) == 0);
+
+   assert (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_md5 (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   ssize_t r;
+   char buf[] = "foo bar";
+   char buf2[] = " baz";
+   char buf3[] = " quux";
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov[2];
+
+   iov [0].iov_base = buf;
+   iov [0].iov_len = sizeof (buf) - 1;
+   iov [1].iov_base = buf2;
+   iov [1].iov_len = sizeof (buf2) - 1;
+
+   opt.chunk_size = 2;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "md5", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   assert (mongoc_gridfs_file_save (file));
+   assert (!strcmp (mongoc_gridfs_file_get_md5 (file),
+                    "d41d8cd98f00b204e9800998ecf8427e"));
+
+   r = mongoc_gridfs_file_writev (file, iov, 2, 0);
+   assert (r == 11);
+   assert (mongoc_gridfs_file_save (file));
+   assert (!strcmp (mongoc_gridfs_file_get_md5 (file),
+                    "ab07acbb1e496801937adfa772424bf7"));
+
+   /* appending carries on from the saved digest */
+   iov [0].iov_base = buf3;
+   iov [0].iov_len = sizeof (buf3) - 1;
+   r = mongoc_gridfs_file_writev (file, iov, 1, 0);
+   assert (r == 5);
+   assert (mongoc_gridfs_file_save (file));
+   assert (!strcmp (mongoc_gridfs_file_get_md5 (file),
+                    "20b93e21c17615286d9e5472d2de58e6"));
+
+   /* rewriting the start gives it up */
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_writev (file, iov, 1, 0);
+   assert (r == 5);
+   assert (mongoc_gridfs_file_save (file));
+   assert (!mongoc_gridfs_file_get_md5 (file));
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_read_view (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   ssize_t r;
+   char buf[] = "foo bar baz quux";
+   char buf2[100];
+   const uint8_t *data;
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov;
+   int len = sizeof buf - 1;
+   int pos = 0;
+
+   iov.iov_base = buf;
+   iov.iov_len = len;
+
+   opt.chunk_size = 3;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "read_view", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len);
+   assert (mongoc_gridfs_file_save (file));
+
+   /* a view ends with its chunk, or with max_bytes */
+   assert (!mongoc_gridfs_file_seek (file, 1, SEEK_SET));
+   r = mongoc_gridfs_file_read_view (file, &data, 100);
+   assert (r == 2);
+   assert (memcmp (data, "oo", 2) == 0);
+
+   r = mongoc_gridfs_file_read_view (file, &data, 1);
+   assert (r == 1);
+   assert (memcmp (data, " ", 1) == 0);
+   assert (mongoc_gridfs_file_tell (file) == 4);
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+
+   while ((r = mongoc_gridfs_file_read_view (file, &data, 100)) > 0) {
+      assert (r <= 3);
+      memcpy (buf2 + pos, data, r);
+      pos += (int)r;
+   }
+
+   assert (r == 0);
+   assert (pos == len);
+   assert (memcmp (buf2, buf, len) == 0);
+
+   assert (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_resume (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_value_t id;
+   bson_t sel = BSON_INITIALIZER;
+   ssize_t r;
+   char buf[] = "foo bar baz quux";
+   char buf2[100];
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_iovec_t iov;
+   mongoc_iovec_t riov;
+   int len = sizeof buf - 1;
+
+   riov.iov_base = buf2;
+   riov.iov_len = sizeof buf2;
+
+   opt.chunk_size = 2;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "resume", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   /* the upload stops with chunk 3 still unsent */
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   bson_value_copy (mongoc_gridfs_file_get_id (file), &id);
+
+   iov.iov_base = buf;
+   iov.iov_len = 8;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == 8);
+   mongoc_gridfs_file_destroy (file);
+
+   file = mongoc_gridfs_resume_file (gridfs, &id, &opt, &error);
+   assert (file);
+   assert (mongoc_gridfs_file_tell (file) == 6);
+
+   iov.iov_base = buf + 6;
+   iov.iov_len = len - 6;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len - 6);
+   assert (mongoc_gridfs_file_save (file));
+   mongoc_gridfs_file_destroy (file);
+
+   /* chunks past a missing one are written again */
+   BSON_APPEND_VALUE (&sel, "files_id", &id);
+   BSON_APPEND_INT32 (&sel, "n", 2);
+   assert (mongoc_collection_remove (mongoc_gridfs_get_chunks (gridfs),
+                                     MONGOC_REMOVE_NONE, &sel, NULL, &error));
+
+   file = mongoc_gridfs_resume_file (gridfs, &id, NULL, &error);
+   assert (file);
+   assert (mongoc_gridfs_file_tell (file) == 4);
+   assert (mongoc_gridfs_file_get_length (file) == 4);
+
+   iov.iov_base = buf + 4;
+   iov.iov_len = len - 4;
+   r = mongoc_gridfs_file_writev (file, &iov, 1, 0);
+   assert (r == len - 4);
+   assert (mongoc_gridfs_file_save (file));
+
+   assert (!mongoc_gridfs_file_seek (file, 0, SEEK_SET));
+   r = mongoc_gridfs_file_readv (file, &riov, 1, len, 0);
+   assert (r == len);
+   assert (memcmp (buf2, buf, len) == 0);
+
+   assert (!mongoc_gridfs_file_error (file, &error));
+
+   mongoc_gridfs_file_destroy (file);
+
+   bson_value_destroy (&id);
+   bson_destroy (&sel);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_write (void)
 {
@@ -370,6 +906,175 @@ test_stream (void)
 }
 
 
+static void
+test_auto_chunk_size (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_stream_t *stream;
+   mongoc_client_t *client;
+   bson_error_t error;
+   mongoc_iovec_t iov;
+   char buf[] = "foo";
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "auto_chunk_size", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   opt.chunk_size = MONGOC_GRIDFS_CHUNK_SIZE_AUTO;
+
+   /* small files are stored in one chunk of their own size */
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+   assert (mongoc_gridfs_file_get_chunk_size (file) ==
+           MONGOC_GRIDFS_DEFAULT_CHUNK_SIZE);
+   mongoc_gridfs_file_set_length_hint (file, 1000);
+   assert (mongoc_gridfs_file_get_chunk_size (file) == 1000);
+
+   /* large ones in fewer chunks than the default, of a power of two less 1kb */
+   mongoc_gridfs_file_set_length_hint (file, 64 * 1024 * 1024);
+   assert (mongoc_gridfs_file_get_chunk_size (file) == 2 * 1024 * 1024 - 1024);
+
+   /* capped well under the largest document */
+   mongoc_gridfs_file_set_length_hint (file, (uint64_t)1 << 40);
+   assert (mongoc_gridfs_file_get_chunk_size (file) ==
+           mongoc_client_get_max_bson_size (client) / 4 - 1024);
+
+   /* the chunk size is kept once something was written */
+   iov.iov_base = buf;
+   iov.iov_len = 3;
+   assert (mongoc_gridfs_file_writev (file, &iov, 1, 0) == 3);
+   mongoc_gridfs_file_set_length_hint (file, 1000);
+   assert (mongoc_gridfs_file_get_chunk_size (file) ==
+           mongoc_client_get_max_bson_size (client) / 4 - 1024);
+   mongoc_gridfs_file_destroy (file);
+
+   /* a hint does not change an explicit chunk size */
+   opt.chunk_size = 100;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   mongoc_gridfs_file_set_length_hint (file, 1000);
+   assert (mongoc_gridfs_file_get_chunk_size (file) == 100);
+   mongoc_gridfs_file_destroy (file);
+
+   /* regular files give their length */
+   opt.chunk_size = MONGOC_GRIDFS_CHUNK_SIZE_AUTO;
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/gridfs.dat", O_RDONLY, 0);
+   assert (stream);
+
+   file = mongoc_gridfs_create_file_from_stream (gridfs, stream, &opt);
+   assert (file);
+   assert (mongoc_gridfs_file_save (file));
+   assert (mongoc_gridfs_file_get_chunk_size (file) ==
+           mongoc_gridfs_file_get_length (file));
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
+
+static void
+test_compression (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_client_t *client;
+   mongoc_cursor_t *cursor;
+   const bson_t *chunk;
+   const uint8_t *data;
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t query = BSON_INITIALIZER;
+   mongoc_iovec_t iov;
+   char *buf;
+   char *buf2;
+   uint32_t len;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "compression", &error);
+   assert (gridfs);
+
+   assert (!mongoc_gridfs_set_compressor (gridfs, "unknown"));
+
+   if (!mongoc_gridfs_set_compressor (gridfs, "zlib")) {
+      /* built without zlib */
+      mongoc_gridfs_destroy (gridfs);
+      mongoc_client_destroy (client);
+      return;
+   }
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   buf = bson_malloc (100000);
+   buf2 = bson_malloc (100000);
+
+   for (i = 0; i < 100000; i++) {
+      buf[i] = "{\"level\": \"info\"}\n"[i % 19];
+   }
+
+   opt.filename = "compressed";
+   opt.chunk_size = 30000;
+   file = mongoc_gridfs_create_file (gridfs, &opt);
+   assert (file);
+
+   iov.iov_base = buf;
+   iov.iov_len = 100000;
+   assert (mongoc_gridfs_file_writev (file, &iov, 1, 0) == 100000);
+   assert (mongoc_gridfs_file_save (file));
+
+   /* the chunks are stored compressed */
+   BSON_APPEND_VALUE (&query, "files_id", mongoc_gridfs_file_get_id (file));
+   cursor = mongoc_collection_find (mongoc_gridfs_get_chunks (gridfs),
+                                    MONGOC_QUERY_NONE, 0, 0, 0, &query,
+                                    NULL, NULL);
+
+   for (i = 0; mongoc_cursor_next (cursor, &chunk); i++) {
+      assert (bson_iter_init_find (&iter, chunk, "data"));
+      bson_iter_binary (&iter, NULL, &len, &data);
+      assert (len < 30000 / 5);
+   }
+
+   assert (!mongoc_cursor_error (cursor, &error));
+   assert (i == 4);
+
+   mongoc_cursor_destroy (cursor);
+   mongoc_gridfs_file_destroy (file);
+
+   /* and read back with the compressor they were written with */
+   assert (mongoc_gridfs_set_compressor (gridfs, NULL));
+
+   file = mongoc_gridfs_find_one_by_filename (gridfs, "compressed", &error);
+   assert (file);
+   assert (mongoc_gridfs_file_get_length (file) == 100000);
+
+   iov.iov_base = buf2;
+   assert (mongoc_gridfs_file_readv (file, &iov, 1, 100000, 0) == 100000);
+   assert (memcmp (buf, buf2, 100000) == 0);
+
+   mongoc_gridfs_file_destroy (file);
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   bson_destroy (&query);
+   bson_free (buf);
+   bson_free (buf2);
+
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_remove_by_filename (void)
 {
@@ -417,15 +1122,93 @@ test_remove_by_filename (void)
    mongoc_client_destroy (client);
 }
 
+
+static void
+test_remove_many (void)
+{
+   mongoc_gridfs_t *gridfs;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_client_t *client;
+   bson_error_t error;
+   char name [32];
+   bson_t *selector;
+   bson_t query = BSON_INITIALIZER;
+   mongoc_iovec_t iov;
+   int i;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   gridfs = get_test_gridfs (client, "fs_remove_many", &error);
+   assert (gridfs);
+
+   mongoc_gridfs_drop (gridfs, &error);
+
+   iov.iov_base = (void *)"abc";
+   iov.iov_len = 3;
+
+   for (i = 0; i < 7; i++) {
+      bson_snprintf (name, sizeof name, "%s_%d", i < 5 ? "old" : "new", i);
+      opt.filename = name;
+      file = mongoc_gridfs_create_file (gridfs, &opt);
+      assert (file);
+      assert (mongoc_gridfs_file_writev (file, &iov, 1, 0) == 3);
+      assert (mongoc_gridfs_file_save (file));
+      mongoc_gridfs_file_destroy (file);
+   }
+
+   /* five matching files removed two at a time */
+   selector = BCON_NEW ("filename", "{", "$regex", BCON_UTF8 ("^old_"), "}");
+   assert (mongoc_gridfs_remove_many (gridfs, selector, 2, 1, &error));
+
+   assert (2 == mongoc_collection_count (mongoc_gridfs_get_files (gridfs),
+                                         MONGOC_QUERY_NONE, &query, 0, 0,
+                                         NULL, &error));
+   assert (2 == mongoc_collection_count (mongoc_gridfs_get_chunks (gridfs),
+                                         MONGOC_QUERY_NONE, &query, 0, 0,
+                                         NULL, &error));
+
+   /* nothing left to match */
+   assert (mongoc_gridfs_remove_many (gridfs, selector, 0, 0, &error));
+   assert (2 == mongoc_collection_count (mongoc_gridfs_get_files (gridfs),
+                                         MONGOC_QUERY_NONE, &query, 0, 0,
+                                         NULL, &error));
+
+   bson_destroy (selector);
+
+   assert (mongoc_gridfs_remove_many (gridfs, &query, 0, 0, &error));
+   assert (0 == mongoc_collection_count (mongoc_gridfs_get_files (gridfs),
+                                         MONGOC_QUERY_NONE, &query, 0, 0,
+                                         NULL, &error));
+   assert (0 == mongoc_collection_count (mongoc_gridfs_get_chunks (gridfs),
+                                         MONGOC_QUERY_NONE, &query, 0, 0,
+                                         NULL, &error));
+
+   drop_collections (gridfs, &error);
+   mongoc_gridfs_destroy (gridfs);
+
+   mongoc_client_destroy (client);
+}
+
 void
 test_gridfs_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/GridFS/create", test_create);
    TestSuite_Add (suite, "/GridFS/create_from_stream", test_create_from_stream);
+   TestSuite_Add (suite, "/GridFS/auto_chunk_size", test_auto_chunk_size);
    TestSuite_Add (suite, "/GridFS/list", test_list);
    TestSuite_Add (suite, "/GridFS/read", test_read);
+   TestSuite_Add (suite, "/GridFS/read_ahead", test_read_ahead);
+   TestSuite_Add (suite, "/GridFS/bulk_upload", test_bulk_upload);
+   TestSuite_Add (suite, "/GridFS/cache", test_cache);
+   TestSuite_Add (suite, "/GridFS/md5", test_md5);
+   TestSuite_Add (suite, "/GridFS/read_view", test_read_view);
+   TestSuite_Add (suite, "/GridFS/resume", test_resume);
    TestSuite_Add (suite, "/GridFS/stream", test_stream);
    TestSuite_Add (suite, "/GridFS/remove", test_remove);
    TestSuite_Add (suite, "/GridFS/write", test_write);
+   TestSuite_Add (suite, "/GridFS/compression", test_compression);
    TestSuite_Add (suite, "/GridFS/remove_by_filename", test_remove_by_filename);
+   TestSuite_Add (suite, "/GridFS/remove_many", test_remove_many);
 }
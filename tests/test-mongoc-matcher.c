@@ -285,6 +285,196 @@ test_mongoc_matcher_logic_ops (void)
 }
 
 
+/* check the program of each matcher and its optree agree on the answer */
+static void
+_test_matcher_programs (logic_op_test_t *tests,
+                        int              n_tests)
+{
+   int i;
+   logic_op_test_t test;
+   bson_t *spec;
+   bson_error_t error;
+   mongoc_matcher_t *matcher;
+   bson_t *doc;
+   bool r;
+
+   for (i = 0; i < n_tests; i++) {
+      test = tests[i];
+      spec = bson_new_from_json ((uint8_t * )test.spec, -1, &error);
+      BSON_ASSERT (spec);
+
+      matcher = mongoc_matcher_new (spec, &error);
+      BSON_ASSERT (matcher);
+
+      doc = bson_new_from_json ((uint8_t * )test.doc, -1, &error);
+      BSON_ASSERT (doc);
+
+      r = mongoc_matcher_match (matcher, doc);
+      if (test.match != r ||
+          r != _mongoc_matcher_op_match (matcher->optree, doc)) {
+         fprintf (stderr,
+                  "query:\n\n%s\n\nshould %shave matched:\n\n%s\n",
+                  test.match ? "" : "not ",
+                  test.spec, test.doc);
+         abort ();
+      }
+
+      mongoc_matcher_destroy (matcher);
+      bson_destroy (doc);
+      bson_destroy (spec);
+   }
+}
+
+
+
+static void
+test_mongoc_matcher_program (void)
+{
+   /* nested logical operators are compiled into jumps, check that they
+    * short-circuit to the same result the optree evaluates to */
+   logic_op_test_t tests[] = {
+         {
+               "{\"$and\": [{\"a\": 1}, {\"$or\": [{\"b\": 2}, {\"c\": 3}]}]}",
+               "{\"a\": 1, \"c\": 3}",
+               true
+         },
+         {
+               "{\"$and\": [{\"a\": 1}, {\"$or\": [{\"b\": 2}, {\"c\": 3}]}]}",
+               "{\"a\": 1, \"c\": 4}",
+               false
+         },
+         {
+               "{\"$or\": [{\"$and\": [{\"a\": 1}, {\"b\": 2}]}, {\"c\": 3}]}",
+               "{\"a\": 1, \"c\": 3}",
+               true
+         },
+         {
+               "{\"$or\": [{\"$and\": [{\"a\": 1}, {\"b\": 2}]}, {\"c\": 3}]}",
+               "{\"a\": 1, \"b\": 3}",
+               false
+         },
+         {"{\"$nor\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 2, \"b\": 1}", true},
+         {"{\"$nor\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 2, \"b\": 2}", false},
+         {"{\"a\": {\"$not\": {\"$gt\": 1}}}", "{\"a\": 0}", true},
+         {"{\"a\": {\"$not\": {\"$gt\": 1}}}", "{\"a\": 2}", false},
+         {"{\"a\": {\"$not\": {\"$gt\": 1}}}", "{\"b\": 2}", true},
+         {"{\"a.b.c\": 1, \"d\": {\"$exists\": false}}", "{\"a\": {\"b\": {\"c\": 1}}}", true},
+         {"{\"a.b.c\": 1, \"d\": {\"$exists\": false}}", "{\"a\": {\"b\": {\"c\": 1}}, \"d\": 0}", false},
+         {"{\"a.b.c\": 1}", "{\"a\": {\"b\": 1}}", false},
+         {"{\"a.b\": 1}", "{\"a\": {\"bb\": 1, \"b\": 1}}", true},
+         {"{\"a.1\": 5}", "{\"a\": [4, 5]}", true},
+         /* fields that share a path are found in a single pass */
+         {
+               "{\"a.b\": 1, \"a.c\": 2, \"a\": {\"$exists\": true}}",
+               "{\"a\": {\"c\": 2, \"b\": 1}}",
+               true
+         },
+         {
+               "{\"a.b\": 1, \"a.c\": 2}",
+               "{\"a\": {\"c\": 3, \"b\": 1}}",
+               false
+         },
+         /* only the first of duplicate keys is looked into */
+         {"{\"a.b\": 1}", "{\"a\": 1, \"a\": {\"b\": 1}}", false},
+         {"{\"a\": 1}", "{\"a\": 1, \"a\": 2}", true},
+   };
+
+   _test_matcher_programs (tests, sizeof tests / sizeof (logic_op_test_t));
+}
+
+static void
+test_mongoc_matcher_array_traversal (void)
+{
+   logic_op_test_t tests[] = {
+         /* a field that is an array matches if any element does */
+         {"{\"a\": 2}", "{\"a\": [1, 2, 3]}", true},
+         {"{\"a\": 4}", "{\"a\": [1, 2, 3]}", false},
+         {"{\"a\": {\"$gt\": 2}}", "{\"a\": [1, 3]}", true},
+         {"{\"a\": {\"$in\": [5, 3]}}", "{\"a\": [1, 3]}", true},
+         {"{\"a\": [1, 2]}", "{\"a\": [[1, 2], 3]}", true},
+         {"{\"a\": 1}", "{\"a\": [[1]]}", false},
+         /* and $ne or $nin only if every element differs */
+         {"{\"a\": {\"$ne\": 2}}", "{\"a\": [1, 2]}", false},
+         {"{\"a\": {\"$ne\": 4}}", "{\"a\": [1, 2]}", true},
+         {"{\"a\": {\"$nin\": [2, 9]}}", "{\"a\": [1, 2]}", false},
+         {"{\"a\": {\"$not\": {\"$gt\": 2}}}", "{\"a\": [1, 3]}", false},
+         /* dotted paths look into each document of an array */
+         {"{\"a.b\": 2}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", true},
+         {"{\"a.b\": 3}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", false},
+         {"{\"a.b.c\": 1}", "{\"a\": [{\"b\": [{\"c\": 1}]}]}", true},
+         {"{\"a.b\": {\"$ne\": 1}}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", false},
+         {"{\"a.b\": {\"$exists\": true}}", "{\"a\": [{\"c\": 1}, {\"b\": 2}]}", true},
+         {"{\"a.b\": {\"$exists\": false}}", "{\"a\": [{\"c\": 1}]}", true},
+         {"{\"a.1.b\": 2}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", true},
+         {"{\"a.0.b\": 2}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", false},
+         {"{\"a.b\": 1, \"c\": 1}", "{\"a\": [{\"b\": 1}], \"c\": 1}", true},
+         /* $elemMatch needs one element to match the whole query */
+         {
+               "{\"a\": {\"$elemMatch\": {\"b\": 1, \"c\": 2}}}",
+               "{\"a\": [{\"b\": 1, \"c\": 1}, {\"b\": 2, \"c\": 2}]}",
+               false
+         },
+         {
+               "{\"a\": {\"$elemMatch\": {\"b\": 1, \"c\": 2}}}",
+               "{\"a\": [{\"b\": 2}, {\"b\": 1, \"c\": 2}]}",
+               true
+         },
+         {"{\"a\": {\"$elemMatch\": {\"$gt\": 1, \"$lt\": 3}}}", "{\"a\": [0, 2]}", true},
+         {"{\"a\": {\"$elemMatch\": {\"$gt\": 1, \"$lt\": 3}}}", "{\"a\": [0, 4]}", false},
+         {"{\"a\": {\"$elemMatch\": {\"$gt\": 1}}}", "{\"a\": 2}", false},
+         {
+               "{\"a.b\": {\"$elemMatch\": {\"$in\": [7]}}}",
+               "{\"a\": [{\"b\": [1]}, {\"b\": [6, 7]}]}",
+               true
+         },
+         {
+               "{\"a\": {\"$elemMatch\": {\"$or\": [{\"b\": 1}, {\"c\": 1}]}}}",
+               "{\"a\": [{\"c\": 1}]}",
+               true
+         },
+   };
+
+   _test_matcher_programs (tests, sizeof tests / sizeof (logic_op_test_t));
+}
+
+
+static void
+test_mongoc_matcher_many_fields (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t spec = BSON_INITIALIZER;
+   bson_t doc = BSON_INITIALIZER;
+   char key [16];
+   int i;
+
+   /* more fields than are kept on the stack while matching */
+   for (i = 0; i < 40; i++) {
+      bson_snprintf (key, sizeof key, "f%d", i);
+      bson_append_int32 (&spec, key, -1, i);
+      bson_append_int32 (&doc, key, -1, i);
+   }
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT (matcher);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_append_int32 (&doc, "f40", -1, 40);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   for (i = 0; i < 40; i++) {
+      bson_snprintf (key, sizeof key, "f%d", i);
+      bson_append_int32 (&doc, key, -1, (i == 39) ? 0 : i);
+   }
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   bson_destroy (&doc);
+   bson_destroy (&spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
 static void
 test_mongoc_matcher_bad_spec (void)
 {
@@ -534,6 +724,367 @@ test_mongoc_matcher_in_basic (void)
 }
 
 
+static void
+test_mongoc_matcher_in_large (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t spec = BSON_INITIALIZER;
+   bson_t doc = BSON_INITIALIZER;
+   bson_t in;
+   bson_t nin;
+   bson_t child;
+   char key [16];
+   int i;
+
+   /* enough values to be hashed: even numbers, strings and a document */
+   bson_append_document_begin (&spec, "key", -1, &child);
+   bson_append_array_begin (&child, "$in", -1, &in);
+   for (i = 0; i < 100; i++) {
+      bson_snprintf (key, sizeof key, "%d", i);
+      bson_append_int32 (&in, key, -1, i * 2);
+   }
+   bson_append_utf8 (&in, "100", -1, "abc", -1);
+   bson_append_null (&in, "101", -1);
+   BSON_APPEND_DOCUMENT (&in, "102", &doc);
+   bson_append_array_end (&child, &in);
+   bson_append_document_end (&spec, &child);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT (matcher);
+
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   bson_append_int32 (&doc, "key", -1, 42);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_int32 (&doc, "key", -1, 43);
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   /* numbers of other types compare by value */
+   bson_reinit (&doc);
+   bson_append_int64 (&doc, "key", -1, 198);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_double (&doc, "key", -1, 4.0);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_double (&doc, "key", -1, -0.0);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_double (&doc, "key", -1, 4.5);
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_utf8 (&doc, "key", -1, "abc", -1);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_utf8 (&doc, "key", -1, "abd", -1);
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_null (&doc, "key", -1);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_document_begin (&doc, "key", -1, &child);
+   bson_append_document_end (&doc, &child);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   mongoc_matcher_destroy (matcher);
+   bson_reinit (&spec);
+
+   bson_append_document_begin (&spec, "key", -1, &child);
+   bson_append_array_begin (&child, "$nin", -1, &nin);
+   for (i = 0; i < 100; i++) {
+      bson_snprintf (key, sizeof key, "%d", i);
+      bson_append_int32 (&nin, key, -1, i * 2);
+   }
+   bson_append_array_end (&child, &nin);
+   bson_append_document_end (&spec, &child);
+
+   matcher = mongoc_matcher_new (&spec, &error);
+   ASSERT (matcher);
+
+   bson_reinit (&doc);
+   bson_append_int32 (&doc, "key", -1, 42);
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+
+   bson_reinit (&doc);
+   bson_append_int32 (&doc, "key", -1, 43);
+   ASSERT (mongoc_matcher_match (matcher, &doc));
+
+   bson_destroy (&doc);
+   bson_destroy (&spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_match_batch (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   uint8_t docs [1024];
+   uint8_t bitmap [4];
+   size_t len = 0;
+   bson_t *spec;
+   bson_t doc;
+   int i;
+
+   spec = BCON_NEW ("key", "{", "$gte", BCON_INT32 (10), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT (matcher);
+
+   for (i = 0; i < 20; i++) {
+      bson_init (&doc);
+      bson_append_int32 (&doc, "key", -1, i);
+      ASSERT (len + doc.len <= sizeof docs);
+      memcpy (docs + len, bson_get_data (&doc), doc.len);
+      len += doc.len;
+      bson_destroy (&doc);
+   }
+
+   memset (bitmap, 0xff, sizeof bitmap);
+   ASSERT (mongoc_matcher_match_batch (matcher, docs, len, bitmap) == 20);
+   ASSERT (bitmap [0] == 0x00);
+   ASSERT (bitmap [1] == 0xfc);
+   ASSERT (bitmap [2] == 0x0f);
+
+   /* a truncated buffer is reported */
+   ASSERT (mongoc_matcher_match_batch (matcher, docs, len - 1, bitmap) == -1);
+
+   ASSERT (mongoc_matcher_match_batch (matcher, docs, 0, bitmap) == 0);
+
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_match_project (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *projection;
+   bson_t *expected;
+   bson_t *spec;
+   bson_t *doc;
+   bson_t out;
+
+   spec = BCON_NEW ("a", "{", "$gt", BCON_INT32 (1), "}");
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT (matcher);
+
+   doc = BCON_NEW ("_id", BCON_INT32 (7),
+                   "a", BCON_INT32 (2),
+                   "b", "{", "c", BCON_UTF8 ("x"), "d", BCON_INT32 (4),
+                             "e", "{", "f", BCON_INT32 (5), "g", BCON_INT32 (6), "}",
+                        "}",
+                   "h", BCON_INT32 (8));
+
+   /* fields in document order, dotted paths and the implicit "_id" */
+   projection = BCON_NEW ("h", BCON_INT32 (1),
+                          "b.c", BCON_INT32 (1),
+                          "b.e.g", BCON_BOOL (true));
+   expected = BCON_NEW ("_id", BCON_INT32 (7),
+                        "b", "{", "c", BCON_UTF8 ("x"),
+                                  "e", "{", "g", BCON_INT32 (6), "}",
+                             "}",
+                        "h", BCON_INT32 (8));
+   bson_init (&out);
+   ASSERT (mongoc_matcher_match_project (matcher, doc, projection, &out));
+   ASSERT (bson_equal (&out, expected));
+   bson_destroy (&out);
+   bson_destroy (expected);
+   bson_destroy (projection);
+
+   /* "_id" excluded, a whole subdocument, and a missing field */
+   projection = BCON_NEW ("_id", BCON_INT32 (0),
+                          "b.e", BCON_INT32 (1),
+                          "z", BCON_INT32 (1));
+   expected = BCON_NEW ("b", "{",
+                           "e", "{", "f", BCON_INT32 (5), "g", BCON_INT32 (6), "}",
+                        "}");
+   bson_init (&out);
+   ASSERT (mongoc_matcher_match_project (matcher, doc, projection, &out));
+   ASSERT (bson_equal (&out, expected));
+   bson_destroy (&out);
+   bson_destroy (expected);
+   bson_destroy (doc);
+
+   /* nothing is projected from a document that does not match */
+   doc = BCON_NEW ("a", BCON_INT32 (1), "b", "{", "e", BCON_INT32 (1), "}");
+   bson_init (&out);
+   ASSERT (!mongoc_matcher_match_project (matcher, doc, projection, &out));
+   ASSERT (out.len == 5);
+   bson_destroy (&out);
+   bson_destroy (doc);
+   bson_destroy (projection);
+
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static void
+test_mongoc_matcher_adaptive (void)
+{
+   mongoc_matcher_t *adaptive;
+   mongoc_matcher_t *matcher;
+   mongoc_matcher_insn_t *insn;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t doc;
+   int i;
+
+   /* "a" is the cheaper test but "b" is rarely true, so once that is
+    * seen "b" should be tested first */
+   spec = BCON_NEW ("$and", "[",
+                       "{", "a", BCON_INT32 (1), "}",
+                       "{", "b", BCON_UTF8 ("x"), "}",
+                    "]");
+
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT (matcher);
+   adaptive = mongoc_matcher_new (spec, &error);
+   ASSERT (adaptive);
+   mongoc_matcher_set_adaptive (adaptive, true);
+
+   insn = &_mongoc_array_index (&adaptive->program.insns,
+                                mongoc_matcher_insn_t, 0);
+   ASSERT (!strcmp (insn->op->compare.path, "a"));
+
+   for (i = 0; i < 5000; i++) {
+      bson_init (&doc);
+      bson_append_int32 (&doc, "a", -1, (i % 10) ? 1 : 0);
+      bson_append_utf8 (&doc, "b", -1, (i % 7) ? "y" : "x", -1);
+      ASSERT (mongoc_matcher_match (matcher, &doc) ==
+              mongoc_matcher_match (adaptive, &doc));
+      bson_destroy (&doc);
+   }
+
+   insn = &_mongoc_array_index (&adaptive->program.insns,
+                                mongoc_matcher_insn_t, 0);
+   ASSERT (!strcmp (insn->op->compare.path, "b"));
+
+   insn = &_mongoc_array_index (&matcher->program.insns,
+                                mongoc_matcher_insn_t, 0);
+   ASSERT (!strcmp (insn->op->compare.path, "a"));
+
+   bson_destroy (spec);
+   mongoc_matcher_destroy (adaptive);
+   mongoc_matcher_destroy (matcher);
+}
+
+
+static bool
+_regex_match (bson_t     *spec,
+              const char *value)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t doc = BSON_INITIALIZER;
+   bool ret;
+
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT (matcher);
+
+   bson_append_utf8 (&doc, "name", -1, value, -1);
+   ret = mongoc_matcher_match (matcher, &doc);
+
+   /* the optree must agree with the compiled program */
+   ASSERT (ret == _mongoc_matcher_op_match (matcher->optree, &doc));
+
+   bson_destroy (&doc);
+   bson_destroy (spec);
+   mongoc_matcher_destroy (matcher);
+
+   return ret;
+}
+
+
+static void
+test_mongoc_matcher_regex (void)
+{
+   mongoc_matcher_t *matcher;
+   bson_error_t error;
+   bson_t *spec;
+   bson_t doc = BSON_INITIALIZER;
+
+#ifdef MONGOC_MATCHER_HAVE_REGEX
+   /* a literal prefix alone decides the match */
+   ASSERT (_regex_match (BCON_NEW ("name", BCON_REGEX ("^ab", "")), "abc"));
+   ASSERT (!_regex_match (BCON_NEW ("name", BCON_REGEX ("^ab", "")), "xab"));
+   ASSERT (_regex_match (BCON_NEW ("name", BCON_REGEX ("b", "")), "abc"));
+   ASSERT (!_regex_match (BCON_NEW ("name", BCON_REGEX ("d", "")), "abc"));
+
+   /* a prefix checked before the regex is run */
+   ASSERT (_regex_match (BCON_NEW ("name", "{", "$regex", "^ab+c$", "}"),
+                         "abbbc"));
+   ASSERT (!_regex_match (BCON_NEW ("name", "{", "$regex", "^ab+c$", "}"),
+                          "abd"));
+   ASSERT (!_regex_match (BCON_NEW ("name", "{", "$regex", "^ab+c$", "}"),
+                          "ac"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{", "$regex", "^ab?c", "}"),
+                         "ac"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{", "$regex", "b.d", "}"),
+                         "abcd"));
+   ASSERT (!_regex_match (BCON_NEW ("name", "{", "$regex", "b.d", "}"),
+                          "acd"));
+
+   /* no prefix can be used for these */
+   ASSERT (_regex_match (BCON_NEW ("name", "{", "$regex", "^a|b", "}"), "b"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{", "$regex", "x*y", "}"), "y"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{",
+                                   "$options", "i",
+                                   "$regex", "^AB",
+                                   "}"), "abc"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{",
+                                   "$regex", BCON_REGEX ("^AB", "i"),
+                                   "}"), "abc"));
+   ASSERT (_regex_match (BCON_NEW ("name", "{",
+                                   "$not", BCON_REGEX ("^a", ""),
+                                   "}"), "ba"));
+
+   /* only strings match */
+   spec = BCON_NEW ("name", BCON_REGEX ("1", ""));
+   matcher = mongoc_matcher_new (spec, &error);
+   ASSERT (matcher);
+   bson_append_int32 (&doc, "name", -1, 1);
+   ASSERT (!mongoc_matcher_match (matcher, &doc));
+   mongoc_matcher_destroy (matcher);
+   bson_destroy (spec);
+
+   spec = BCON_NEW ("name", "{", "$regex", "(", "}");
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   ASSERT (error.domain == MONGOC_ERROR_MATCHER);
+   ASSERT (error.code == MONGOC_ERROR_MATCHER_INVALID);
+   bson_destroy (spec);
+
+   spec = BCON_NEW ("name", "{", "$regex", "a", "$options", "q", "}");
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   bson_destroy (spec);
+#else
+   spec = BCON_NEW ("name", BCON_REGEX ("^ab", ""));
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   ASSERT (error.domain == MONGOC_ERROR_MATCHER);
+   bson_destroy (spec);
+#endif
+
+   spec = BCON_NEW ("name", "{", "$options", "i", "}");
+   ASSERT (!mongoc_matcher_new (spec, &error));
+   bson_destroy (spec);
+
+   bson_destroy (&doc);
+}
+
+
 void
 test_matcher_install (TestSuite *suite)
 {
@@ -541,10 +1092,18 @@ test_matcher_install (TestSuite *suite)
    TestSuite_Add (suite, "/Matcher/array", test_mongoc_matcher_array);
    TestSuite_Add (suite, "/Matcher/compare", test_mongoc_matcher_compare);
    TestSuite_Add (suite, "/Matcher/logic", test_mongoc_matcher_logic_ops);
+   TestSuite_Add (suite, "/Matcher/program", test_mongoc_matcher_program);
+   TestSuite_Add (suite, "/Matcher/array_traversal", test_mongoc_matcher_array_traversal);
+   TestSuite_Add (suite, "/Matcher/many_fields", test_mongoc_matcher_many_fields);
    TestSuite_Add (suite, "/Matcher/bad_spec", test_mongoc_matcher_bad_spec);
    TestSuite_Add (suite, "/Matcher/eq/utf8", test_mongoc_matcher_eq_utf8);
    TestSuite_Add (suite, "/Matcher/eq/int32", test_mongoc_matcher_eq_int32);
    TestSuite_Add (suite, "/Matcher/eq/int64", test_mongoc_matcher_eq_int64);
    TestSuite_Add (suite, "/Matcher/eq/doc", test_mongoc_matcher_eq_doc);
    TestSuite_Add (suite, "/Matcher/in/basic", test_mongoc_matcher_in_basic);
+   TestSuite_Add (suite, "/Matcher/in/large", test_mongoc_matcher_in_large);
+   TestSuite_Add (suite, "/Matcher/match_batch", test_mongoc_matcher_match_batch);
+   TestSuite_Add (suite, "/Matcher/match_project", test_mongoc_matcher_match_project);
+   TestSuite_Add (suite, "/Matcher/adaptive", test_mongoc_matcher_adaptive);
+   TestSuite_Add (suite, "/Matcher/regex", test_mongoc_matcher_regex);
 }
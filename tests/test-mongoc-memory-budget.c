@@ -0,0 +1,40 @@
+#include <mongoc.h>
+#include <mongoc-memory-budget-private.h>
+
+#include "TestSuite.h"
+
+
+static void
+test_memory_budget_reserve (void)
+{
+   int64_t max_bytes;
+
+   max_bytes = mongoc_memory_budget_get ();
+
+   /* no limit by default */
+   mongoc_memory_budget_set (0);
+   assert (_mongoc_memory_budget_reserve (1 << 30));
+   _mongoc_memory_budget_release (1 << 30);
+
+   mongoc_memory_budget_set (1000);
+   ASSERT_CMPINT ((int)mongoc_memory_budget_get (), ==, 1000);
+   assert (_mongoc_memory_budget_reserve (0));
+   assert (_mongoc_memory_budget_reserve (600));
+   assert (!_mongoc_memory_budget_reserve (600));
+   assert (_mongoc_memory_budget_reserve (400));
+   assert (!_mongoc_memory_budget_reserve (1));
+
+   _mongoc_memory_budget_release (600);
+   assert (_mongoc_memory_budget_reserve (600));
+   _mongoc_memory_budget_release (600);
+   _mongoc_memory_budget_release (400);
+
+   mongoc_memory_budget_set (max_bytes);
+}
+
+
+void
+test_memory_budget_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/MemoryBudget/reserve", test_memory_budget_reserve);
+}
@@ -0,0 +1,46 @@
+#include <mongoc.h>
+#include <mongoc-oid-gen-private.h>
+
+#include "TestSuite.h"
+
+
+static void
+test_mongoc_oid_gen_unique (void)
+{
+   mongoc_oid_gen_t a;
+   mongoc_oid_gen_t b;
+   bson_oid_t oid_a;
+   bson_oid_t oid_b;
+   bson_oid_t prev;
+   bson_oid_t def;
+   int i;
+
+   _mongoc_oid_gen_init (&a);
+   _mongoc_oid_gen_init (&b);
+
+   bson_oid_init (&def, NULL);
+   _mongoc_oid_gen_next (&a, &prev);
+
+   /* machine and process bytes match the default context's */
+   ASSERT (!memcmp (&prev.bytes [4], &def.bytes [4], 5));
+
+   /* interleave the generators past a block boundary */
+   for (i = 0; i < 3 * MONGOC_OID_GEN_BLOCK_SIZE; i++) {
+      _mongoc_oid_gen_next (&a, &oid_a);
+      _mongoc_oid_gen_next (&b, &oid_b);
+
+      ASSERT (!bson_oid_equal (&oid_a, &oid_b));
+      ASSERT (!bson_oid_equal (&oid_a, &prev));
+      bson_oid_copy (&oid_a, &prev);
+   }
+
+   _mongoc_oid_gen_next (NULL, &oid_a);
+   ASSERT (!memcmp (&oid_a.bytes [4], &def.bytes [4], 5));
+}
+
+
+void
+test_oid_gen_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/OidGen/unique", test_mongoc_oid_gen_unique);
+}
@@ -26,8 +26,35 @@ test_mongoc_queue_basic (void)
 }
 
 
+static void
+test_mongoc_queue_items (void)
+{
+   mongoc_queue_t q = MONGOC_QUEUE_INITIALIZER;
+   mongoc_queue_item_t items[3];
+
+   _mongoc_queue_push_tail_item(&q, &items[0], (void *)1);
+   _mongoc_queue_push_tail_item(&q, &items[1], (void *)2);
+   _mongoc_queue_push_head_item(&q, &items[2], (void *)3);
+
+   ASSERT_CMPINT(_mongoc_queue_get_length(&q), ==, 3);
+
+   ASSERT(_mongoc_queue_pop_head_item(&q) == (void *)3);
+   ASSERT(_mongoc_queue_pop_head_item(&q) == (void *)1);
+
+   /* an item may be queued again once it has been popped */
+   _mongoc_queue_push_tail_item(&q, &items[0], (void *)1);
+   ASSERT_CMPINT(_mongoc_queue_get_length(&q), ==, 2);
+
+   ASSERT(_mongoc_queue_pop_head_item(&q) == (void *)2);
+   ASSERT(_mongoc_queue_pop_head_item(&q) == (void *)1);
+   ASSERT(!_mongoc_queue_pop_head_item(&q));
+   ASSERT_CMPINT(_mongoc_queue_get_length(&q), ==, 0);
+}
+
+
 void
 test_queue_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Queue/basic", test_mongoc_queue_basic);
+   TestSuite_Add (suite, "/Queue/items", test_mongoc_queue_items);
 }
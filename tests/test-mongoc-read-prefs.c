@@ -1,3 +1,4 @@
+#include <bcon.h>
 #include <limits.h>
 #include <mongoc.h>
 #include <mongoc-cluster-private.h>
@@ -52,8 +53,160 @@ test_mongoc_read_prefs_score (void)
 }
 
 
+static void
+test_mongoc_read_prefs_max_staleness (void)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_prefs_t *copy;
+   mongoc_cluster_node_t node = { 0 };
+   int score;
+
+   read_prefs = mongoc_read_prefs_new(MONGOC_READ_PRIMARY);
+   mongoc_read_prefs_set_max_staleness_ms(read_prefs, 90000);
+   ASSERT(!mongoc_read_prefs_is_valid(read_prefs));
+
+   mongoc_read_prefs_set_mode(read_prefs, MONGOC_READ_SECONDARY);
+   ASSERT(mongoc_read_prefs_is_valid(read_prefs));
+
+   copy = mongoc_read_prefs_copy(read_prefs);
+   ASSERT_CMPINT((int)mongoc_read_prefs_get_max_staleness_ms(copy), ==, 90000);
+   mongoc_read_prefs_destroy(copy);
+
+   node.staleness_msec = -1;
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, 1);
+
+   node.staleness_msec = 90000;
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, 1);
+
+   node.staleness_msec = 90001;
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, -1);
+
+   mongoc_read_prefs_set_mode(read_prefs, MONGOC_READ_SECONDARY_PREFERRED);
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, -1);
+
+   node.primary = true;
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, 0);
+
+   mongoc_read_prefs_destroy(read_prefs);
+}
+
+
+static void
+test_mongoc_read_prefs_affinity (void)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_prefs_t *shared;
+   uint64_t key = 1;
+
+   read_prefs = mongoc_read_prefs_new(MONGOC_READ_NEAREST);
+   ASSERT_CMPINT(mongoc_read_prefs_get_affinity(read_prefs, &key), ==,
+                 MONGOC_READ_AFFINITY_NONE);
+   ASSERT(key == 0);
+
+   mongoc_read_prefs_set_affinity(read_prefs, MONGOC_READ_AFFINITY_KEY, 42);
+   ASSERT(mongoc_read_prefs_is_valid(read_prefs));
+
+   /* the affinity is kept by the frozen copy a client or cursor holds */
+   shared = _mongoc_read_prefs_share(read_prefs);
+   ASSERT_CMPINT(mongoc_read_prefs_get_affinity(shared, &key), ==,
+                 MONGOC_READ_AFFINITY_KEY);
+   ASSERT(key == 42);
+
+   mongoc_read_prefs_set_affinity(shared, MONGOC_READ_AFFINITY_THREAD, 0);
+   ASSERT_CMPINT(mongoc_read_prefs_get_affinity(shared, NULL), ==,
+                 MONGOC_READ_AFFINITY_KEY);
+
+   mongoc_read_prefs_destroy(shared);
+   mongoc_read_prefs_destroy(read_prefs);
+}
+
+
+static void
+test_mongoc_read_prefs_tag_sets (void)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_cluster_node_t node = { 0 };
+   bson_t *read_tags;
+   bson_t *sf;
+   bson_t *ny;
+   int score;
+
+   bson_init(&node.tags);
+   BSON_APPEND_UTF8(&node.tags, "dc", "ny");
+   BSON_APPEND_UTF8(&node.tags, "rack", "1");
+
+   sf = BCON_NEW("dc", "sf");
+   ny = BCON_NEW("dc", "ny", "rack", "1");
+   ASSERT(!_mongoc_read_prefs_tag_set_matches(sf, &node.tags));
+   ASSERT(_mongoc_read_prefs_tag_set_matches(ny, &node.tags));
+
+   read_tags = BCON_NEW("0", "{", "dc", "sf", "}",
+                        "1", "{", "dc", "ny", "rack", "1", "}");
+   read_prefs = mongoc_read_prefs_new(MONGOC_READ_SECONDARY);
+   mongoc_read_prefs_set_tags(read_prefs, read_tags);
+
+   /* the second of two tag sets matched */
+   score = _mongoc_read_prefs_score(read_prefs, &node);
+   ASSERT_CMPINT(score, ==, 1);
+   ASSERT_CMPINT(_mongoc_read_prefs_score_matched(read_prefs, &node, 1), ==, 1);
+
+   node.primary = true;
+   ASSERT_CMPINT(_mongoc_read_prefs_score_matched(read_prefs, &node, 1), ==, -1);
+
+   mongoc_read_prefs_set_mode(read_prefs, MONGOC_READ_NEAREST);
+   ASSERT_CMPINT(_mongoc_read_prefs_score(read_prefs, &node), ==, 1);
+   ASSERT_CMPINT(_mongoc_read_prefs_score_matched(read_prefs, &node, -1), ==, -1);
+
+   mongoc_read_prefs_destroy(read_prefs);
+   bson_destroy(read_tags);
+   bson_destroy(ny);
+   bson_destroy(sf);
+   bson_destroy(&node.tags);
+}
+
+
+static void
+test_mongoc_read_prefs_share (void)
+{
+   mongoc_read_prefs_t *read_prefs;
+   mongoc_read_prefs_t *shared;
+   mongoc_read_prefs_t *again;
+
+   read_prefs = mongoc_read_prefs_new(MONGOC_READ_SECONDARY);
+
+   /* an unfrozen read preference is copied once, the copy is frozen */
+   shared = _mongoc_read_prefs_share(read_prefs);
+   ASSERT(shared != read_prefs);
+   ASSERT(shared->frozen);
+
+   again = _mongoc_read_prefs_share(shared);
+   ASSERT(again == shared);
+
+   mongoc_read_prefs_set_mode(again, MONGOC_READ_NEAREST);
+   ASSERT_CMPINT(mongoc_read_prefs_get_mode(shared), ==, MONGOC_READ_SECONDARY);
+
+   /* the original is still mutable and the shared copy is unaffected */
+   mongoc_read_prefs_set_mode(read_prefs, MONGOC_READ_NEAREST);
+   ASSERT_CMPINT(mongoc_read_prefs_get_mode(read_prefs), ==, MONGOC_READ_NEAREST);
+
+   mongoc_read_prefs_destroy(again);
+   ASSERT_CMPINT(mongoc_read_prefs_get_mode(shared), ==, MONGOC_READ_SECONDARY);
+   mongoc_read_prefs_destroy(shared);
+   mongoc_read_prefs_destroy(read_prefs);
+}
+
+
 void
 test_read_prefs_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/ReadPrefs/score", test_mongoc_read_prefs_score);
+   TestSuite_Add (suite, "/ReadPrefs/max_staleness", test_mongoc_read_prefs_max_staleness);
+   TestSuite_Add (suite, "/ReadPrefs/affinity", test_mongoc_read_prefs_affinity);
+   TestSuite_Add (suite, "/ReadPrefs/tag_sets", test_mongoc_read_prefs_tag_sets);
+   TestSuite_Add (suite, "/ReadPrefs/share", test_mongoc_read_prefs_share);
 }
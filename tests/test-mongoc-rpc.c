@@ -396,6 +396,60 @@ test_mongoc_rpc_query_gather (void)
 }
 
 
+static void
+test_mongoc_rpc_query_gather_inline (void)
+{
+   mongoc_rpc_t rpc;
+   mongoc_array_t ar;
+   mongoc_iovec_t *iov;
+   char big_str[2000];
+   bson_t small = BSON_INITIALIZER;
+   bson_t big = BSON_INITIALIZER;
+   size_t len = 0;
+   int i;
+
+   memset (big_str, 'a', sizeof big_str - 1);
+   big_str[sizeof big_str - 1] = '\0';
+   bson_append_utf8 (&big, "a", -1, big_str, -1);
+
+   memset (&rpc, 0, sizeof rpc);
+   rpc.query.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.collection = "test.test";
+   rpc.query.n_return = 1;
+   rpc.query.query = bson_get_data (&small);
+
+   /* a small query is gathered into one iovec */
+   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
+   _mongoc_rpc_gather (&rpc, &ar);
+   assert (ar.len == 1);
+   iov = &_mongoc_array_index (&ar, mongoc_iovec_t, 0);
+   assert (iov->iov_len == (size_t)rpc.query.msg_len);
+   assert (iov->iov_len == 16 + 4 + 10 + 8 + small.len);
+   _mongoc_array_destroy (&ar);
+
+   /* a large document keeps an iovec of its own, and what follows it goes
+    * on in the inline buffer */
+   rpc.query.query = bson_get_data (&big);
+   rpc.query.fields = bson_get_data (&small);
+   _mongoc_array_init (&ar, sizeof (mongoc_iovec_t));
+   _mongoc_rpc_gather (&rpc, &ar);
+   assert (ar.len == 3);
+   iov = &_mongoc_array_index (&ar, mongoc_iovec_t, 1);
+   assert (iov->iov_base == (void *)bson_get_data (&big));
+   assert (iov->iov_len == big.len);
+
+   for (i = 0; i < ar.len; i++) {
+      len += _mongoc_array_index (&ar, mongoc_iovec_t, i).iov_len;
+   }
+
+   assert (len == (size_t)rpc.query.msg_len);
+   _mongoc_array_destroy (&ar);
+
+   bson_destroy (&small);
+   bson_destroy (&big);
+}
+
+
 static void
 test_mongoc_rpc_query_scatter (void)
 {
@@ -631,6 +685,60 @@ test_mongoc_rpc_update_scatter (void)
 }
 
 
+static void
+bench_mongoc_rpc_reply_scatter (Bench *bench)
+{
+   static uint8_t *data;
+   static size_t length;
+   mongoc_rpc_t rpc;
+   uint64_t i;
+   bool r = true;
+
+   if (!data) {
+      data = get_test_file("reply1.dat", &length);
+   }
+
+   for (i = 0; i < bench->iterations; i++) {
+      r = _mongoc_rpc_scatter(&rpc, data, length) && r;
+   }
+
+   ASSERT(r);
+}
+
+
+static void
+bench_mongoc_rpc_query_gather (Bench *bench)
+{
+   mongoc_array_t ar;
+   mongoc_rpc_t rpc;
+   uint64_t i;
+   bson_t b;
+
+   memset(&rpc, 0, sizeof rpc);
+   bson_init(&b);
+
+   rpc.query.request_id = 1234;
+   rpc.query.response_to = -1;
+   rpc.query.opcode = MONGOC_OPCODE_QUERY;
+   rpc.query.flags = MONGOC_QUERY_SLAVE_OK;
+   rpc.query.collection = "test.test";
+   rpc.query.n_return = 1;
+   rpc.query.query = bson_get_data(&b);
+   rpc.query.fields = bson_get_data(&b);
+
+   _mongoc_array_init(&ar, sizeof(mongoc_iovec_t));
+   Bench_ResetTimer(bench);
+
+   for (i = 0; i < bench->iterations; i++) {
+      _mongoc_array_clear(&ar);
+      _mongoc_rpc_gather(&rpc, &ar);
+   }
+
+   Bench_StopTimer(bench);
+   _mongoc_array_destroy(&ar);
+}
+
+
 void
 test_rpc_install (TestSuite *suite)
 {
@@ -645,10 +753,15 @@ test_rpc_install (TestSuite *suite)
    TestSuite_Add (suite, "/Rpc/msg/gather", test_mongoc_rpc_msg_gather);
    TestSuite_Add (suite, "/Rpc/msg/scatter", test_mongoc_rpc_msg_scatter);
    TestSuite_Add (suite, "/Rpc/query/gather", test_mongoc_rpc_query_gather);
+   TestSuite_Add (suite, "/Rpc/query/gather_inline", test_mongoc_rpc_query_gather_inline);
    TestSuite_Add (suite, "/Rpc/query/scatter", test_mongoc_rpc_query_scatter);
    TestSuite_Add (suite, "/Rpc/reply/gather", test_mongoc_rpc_reply_gather);
    TestSuite_Add (suite, "/Rpc/reply/scatter", test_mongoc_rpc_reply_scatter);
    TestSuite_Add (suite, "/Rpc/reply/scatter2", test_mongoc_rpc_reply_scatter2);
    TestSuite_Add (suite, "/Rpc/update/gather", test_mongoc_rpc_update_gather);
    TestSuite_Add (suite, "/Rpc/update/scatter", test_mongoc_rpc_update_scatter);
+   TestSuite_AddBench (suite, "/Rpc/reply/scatter",
+                       bench_mongoc_rpc_reply_scatter, 5, 1);
+   TestSuite_AddBench (suite, "/Rpc/query/gather",
+                       bench_mongoc_rpc_query_gather, 5, 1);
 }
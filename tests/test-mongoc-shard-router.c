@@ -0,0 +1,188 @@
+#include <bcon.h>
+#include <mongoc.h>
+#include <mongoc-shard-router-private.h>
+
+#include "TestSuite.h"
+
+
+static void
+test_shard_router_uri_string (void)
+{
+   char *str;
+
+   str = _mongoc_shard_router_uri_string ("mongodb://a:27017,b:27017",
+                                          "rs0/c:27018,d:27018");
+   ASSERT_CMPSTR (str, "mongodb://c:27018,d:27018/?replicaSet=rs0");
+   bson_free (str);
+
+   str = _mongoc_shard_router_uri_string (
+      "mongodb://user:p%40ss@a:27017/db?ssl=true", "rs0/c:27018");
+   ASSERT_CMPSTR (str,
+                  "mongodb://user:p%40ss@c:27018/db?ssl=true&replicaSet=rs0");
+   bson_free (str);
+
+   str = _mongoc_shard_router_uri_string ("mongodb://a/?", "c:27018");
+   ASSERT_CMPSTR (str, "mongodb://c:27018/?");
+   bson_free (str);
+}
+
+
+static void
+test_shard_router_extract_key (void)
+{
+   bson_t *pattern;
+   bson_t *doc;
+   bson_t *expected;
+   bson_t key;
+
+   pattern = BCON_NEW ("a", BCON_INT32 (1), "b.c", BCON_INT32 (1));
+
+   /* a dotted field in the query, or found in a subdocument */
+   doc = BCON_NEW ("$query", "{", "b.c", BCON_UTF8 ("x"),
+                   "a", BCON_INT64 (5), "}");
+   expected = BCON_NEW ("a", BCON_INT64 (5), "b.c", BCON_UTF8 ("x"));
+   bson_init (&key);
+   assert (_mongoc_shard_router_extract_key (pattern, doc, true, &key));
+   assert (bson_equal (&key, expected));
+   bson_destroy (&key);
+   bson_destroy (doc);
+
+   doc = BCON_NEW ("a", BCON_INT64 (5), "b", "{", "c", BCON_UTF8 ("x"), "}");
+   bson_init (&key);
+   assert (_mongoc_shard_router_extract_key (pattern, doc, false, &key));
+   assert (bson_equal (&key, expected));
+   bson_destroy (&key);
+   bson_destroy (doc);
+   bson_destroy (expected);
+
+   /* missing field, an operator, and a null */
+   doc = BCON_NEW ("a", BCON_INT32 (5));
+   bson_init (&key);
+   assert (!_mongoc_shard_router_extract_key (pattern, doc, true, &key));
+   bson_destroy (&key);
+   bson_destroy (doc);
+
+   doc = BCON_NEW ("a", "{", "$gt", BCON_INT32 (5), "}", "b.c", BCON_INT32 (1));
+   bson_init (&key);
+   assert (!_mongoc_shard_router_extract_key (pattern, doc, true, &key));
+   bson_destroy (&key);
+   bson_destroy (doc);
+
+   doc = BCON_NEW ("a", BCON_NULL, "b.c", BCON_INT32 (1));
+   bson_init (&key);
+   assert (!_mongoc_shard_router_extract_key (pattern, doc, true, &key));
+   bson_destroy (&key);
+   bson_destroy (doc);
+
+   bson_destroy (pattern);
+}
+
+
+static void
+test_shard_router_compare (void)
+{
+   bson_t *key;
+   bson_t *min;
+   bson_t *max;
+   bson_t *bound;
+
+   min = BCON_NEW ("a", BCON_MINKEY);
+   max = BCON_NEW ("a", BCON_MAXKEY);
+
+   key = BCON_NEW ("a", BCON_UTF8 ("m"));
+   assert (_mongoc_shard_router_compare (key, min) > 0);
+   assert (_mongoc_shard_router_compare (key, max) < 0);
+
+   /* numbers sort before strings, strings by bytes then length */
+   bound = BCON_NEW ("a", BCON_DOUBLE (1e10));
+   assert (_mongoc_shard_router_compare (key, bound) > 0);
+   bson_destroy (bound);
+
+   bound = BCON_NEW ("a", BCON_UTF8 ("ma"));
+   assert (_mongoc_shard_router_compare (key, bound) < 0);
+   bson_destroy (bound);
+
+   bound = BCON_NEW ("a", BCON_UTF8 ("m"));
+   assert (_mongoc_shard_router_compare (key, bound) == 0);
+   bson_destroy (bound);
+   bson_destroy (key);
+
+   /* int32, int64 and double compare by value */
+   key = BCON_NEW ("a", BCON_INT32 (3));
+   bound = BCON_NEW ("a", BCON_DOUBLE (2.5));
+   assert (_mongoc_shard_router_compare (key, bound) > 0);
+   bson_destroy (bound);
+
+   bound = BCON_NEW ("a", BCON_INT64 (3));
+   assert (_mongoc_shard_router_compare (key, bound) == 0);
+   bson_destroy (bound);
+   bson_destroy (key);
+
+   /* compound keys compare field by field */
+   key = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_INT32 (7));
+   bound = BCON_NEW ("a", BCON_INT32 (1), "b", BCON_MINKEY);
+   assert (_mongoc_shard_router_compare (key, bound) > 0);
+   bson_destroy (bound);
+
+   bound = BCON_NEW ("a", BCON_INT32 (2), "b", BCON_MINKEY);
+   assert (_mongoc_shard_router_compare (key, bound) < 0);
+   bson_destroy (bound);
+   bson_destroy (key);
+
+   bson_destroy (min);
+   bson_destroy (max);
+
+   assert (_mongoc_shard_router_is_stale (13388));
+   assert (!_mongoc_shard_router_is_stale (11000));
+}
+
+
+static void
+test_shard_router_compare_sort (void)
+{
+   bson_t *sort;
+   bson_t *a;
+   bson_t *b;
+
+   sort = BCON_NEW ("a", BCON_INT32 (1), "b.c", BCON_INT32 (-1));
+
+   /* the first field decides, the second is descending */
+   a = BCON_NEW ("a", BCON_INT32 (1), "b", "{", "c", BCON_INT32 (1), "}");
+   b = BCON_NEW ("a", BCON_DOUBLE (1.5), "b", "{", "c", BCON_INT32 (9), "}");
+   assert (_mongoc_shard_router_compare_sort (sort, a, b) < 0);
+   assert (_mongoc_shard_router_compare_sort (sort, b, a) > 0);
+   bson_destroy (b);
+
+   b = BCON_NEW ("a", BCON_INT64 (1), "b", "{", "c", BCON_INT32 (9), "}");
+   assert (_mongoc_shard_router_compare_sort (sort, a, b) > 0);
+   bson_destroy (b);
+
+   b = BCON_NEW ("a", BCON_INT32 (1), "b", "{", "c", BCON_INT32 (1), "}");
+   assert (_mongoc_shard_router_compare_sort (sort, a, b) == 0);
+   bson_destroy (b);
+
+   /* a missing field sorts as null, before numbers */
+   b = BCON_NEW ("b", "{", "c", BCON_INT32 (1), "}");
+   assert (_mongoc_shard_router_compare_sort (sort, b, a) < 0);
+   bson_destroy (b);
+
+   b = BCON_NEW ("a", BCON_NULL, "b", "{", "c", BCON_INT32 (1), "}");
+   assert (_mongoc_shard_router_compare_sort (sort, b, a) < 0);
+   bson_destroy (b);
+
+   bson_destroy (a);
+   bson_destroy (sort);
+}
+
+
+void
+test_shard_router_install (TestSuite *suite)
+{
+   TestSuite_Add (suite, "/ShardRouter/uri_string",
+                  test_shard_router_uri_string);
+   TestSuite_Add (suite, "/ShardRouter/extract_key",
+                  test_shard_router_extract_key);
+   TestSuite_Add (suite, "/ShardRouter/compare", test_shard_router_compare);
+   TestSuite_Add (suite, "/ShardRouter/compare_sort",
+                  test_shard_router_compare_sort);
+}
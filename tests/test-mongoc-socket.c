@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <mongoc.h>
 
+#include "mongoc-dns-cache-private.h"
 #include "mongoc-tests.h"
 #include "mongoc-thread-private.h"
 #include "TestSuite.h"
@@ -178,8 +179,54 @@ test_mongoc_socket_check_closed (void)
    mongoc_cond_destroy (&data.cond);
 }
 
+
+static void
+test_mongoc_dns_cache (void)
+{
+   struct addrinfo hints = { 0 };
+   struct addrinfo *first;
+   struct addrinfo *second;
+   struct addrinfo *a;
+   struct addrinfo *b;
+   int r;
+
+   hints.ai_family = AF_INET;
+   hints.ai_socktype = SOCK_STREAM;
+
+   r = _mongoc_dns_cache_getaddrinfo ("localhost", "27017", &hints,
+                                      60000, 1000, &first);
+   assert (r == 0);
+   assert (first);
+
+   /* the cached answer is an identical, independent copy */
+   r = _mongoc_dns_cache_getaddrinfo ("LOCALHOST", "27017", &hints,
+                                      60000, 1000, &second);
+   assert (r == 0);
+   assert (second);
+   assert (second != first);
+
+   for (a = first, b = second; a && b; a = a->ai_next, b = b->ai_next) {
+      assert (a->ai_family == b->ai_family);
+      assert (a->ai_addrlen == b->ai_addrlen);
+      assert (!memcmp (a->ai_addr, b->ai_addr, a->ai_addrlen));
+   }
+   assert (!a && !b);
+
+   _mongoc_dns_cache_freeaddrinfo (first);
+   _mongoc_dns_cache_freeaddrinfo (second);
+
+   /* caching can be disabled */
+   r = _mongoc_dns_cache_getaddrinfo ("localhost", "27017", &hints,
+                                      0, 0, &first);
+   assert (r == 0);
+   assert (first);
+   _mongoc_dns_cache_freeaddrinfo (first);
+}
+
+
 void
 test_socket_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Socket/check_closed", test_mongoc_socket_check_closed);
+   TestSuite_Add (suite, "/Socket/dns_cache", test_mongoc_dns_cache);
 }
@@ -134,6 +134,36 @@ test_mongoc_tls_basic (void)
 }
 
 
+static void
+test_mongoc_tls_cached_cert (void)
+{
+   mongoc_ssl_opt_t sopt = { 0 };
+   mongoc_ssl_opt_t copt = { 0 };
+   ssl_test_result_t sr;
+   ssl_test_result_t cr;
+
+   sopt.pem_file = PEMFILE_NOPASS;
+   sopt.ca_file = CAFILE;
+
+   copt.ca_file = CAFILE;
+
+   ssl_test (&copt, &sopt, HOST, &cr, &sr);
+
+   ASSERT (cr.result == SSL_TEST_SUCCESS);
+   ASSERT (sr.result == SSL_TEST_SUCCESS);
+
+   /* a certificate checked for one host is not trusted for another */
+   ssl_test (&copt, &sopt, "other.mongodb.org", &cr, &sr);
+
+   ASSERT (cr.result == SSL_TEST_SSL_VERIFY);
+
+   ssl_test (&copt, &sopt, HOST, &cr, &sr);
+
+   ASSERT (cr.result == SSL_TEST_SUCCESS);
+   ASSERT (sr.result == SSL_TEST_SUCCESS);
+}
+
+
 static void
 test_mongoc_tls_crl (void)
 {
@@ -244,6 +274,7 @@ test_stream_tls_install (TestSuite *suite)
    TestSuite_Add (suite, "/TLS/bad_password", test_mongoc_tls_bad_password);
    TestSuite_Add (suite, "/TLS/bad_verify", test_mongoc_tls_bad_verify);
    TestSuite_Add (suite, "/TLS/basic", test_mongoc_tls_basic);
+   TestSuite_Add (suite, "/TLS/cached_cert", test_mongoc_tls_cached_cert);
    TestSuite_Add (suite, "/TLS/crl", test_mongoc_tls_crl);
    TestSuite_Add (suite, "/TLS/ip", test_mongoc_tls_ip);
    TestSuite_Add (suite, "/TLS/no_certs", test_mongoc_tls_no_certs);
@@ -1,5 +1,6 @@
 #include "mongoc-tests.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <mongoc.h>
 #include <stdlib.h>
@@ -59,9 +60,252 @@ test_buffered_oversized (void)
 }
 
 
+static void
+test_buffered_bypass (void)
+{
+   mongoc_stream_t *stream;
+   mongoc_stream_t *buffered;
+   mongoc_iovec_t iov;
+   ssize_t r;
+   char expected[16236];
+   char buf[16236];
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   assert (stream);
+   iov.iov_len = sizeof expected;
+   iov.iov_base = expected;
+   r = mongoc_stream_readv(stream, &iov, 1, iov.iov_len, -1);
+   BSON_ASSERT(r == iov.iov_len);
+   mongoc_stream_destroy(stream);
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   assert (stream);
+
+   /* buffered assumes ownership of stream */
+   buffered = mongoc_stream_buffered_new(stream, 1024);
+
+   /* a small read fills the buffer ahead of what we ask for. */
+   iov.iov_len = 16;
+   iov.iov_base = buf;
+   r = mongoc_stream_readv(buffered, &iov, 1, iov.iov_len, -1);
+   BSON_ASSERT(r == iov.iov_len);
+
+   /* the rest is drained from the buffer, then read directly. */
+   iov.iov_len = sizeof buf - 16;
+   iov.iov_base = buf + 16;
+   r = mongoc_stream_readv(buffered, &iov, 1, iov.iov_len, -1);
+   BSON_ASSERT(r == iov.iov_len);
+
+   BSON_ASSERT(0 == memcmp (buf, expected, sizeof buf));
+
+   /* cleanup */
+   mongoc_stream_destroy(buffered);
+}
+
+
+static void
+test_buffered_write (void)
+{
+   const char *path = "test-stream-buffered.dat";
+   mongoc_stream_t *stream;
+   mongoc_stream_t *buffered;
+   mongoc_stream_t *reader;
+   mongoc_iovec_t iov[2];
+   ssize_t r;
+   char big[2048];
+   char buf[4096];
+
+   memset (big, 'x', sizeof big);
+
+   stream = mongoc_stream_file_new_for_path (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   assert (stream);
+
+   buffered = mongoc_stream_buffered_new(stream, 1024);
+   assert (mongoc_stream_buffered_set_write_buffer(buffered, 1024));
+   assert (!mongoc_stream_buffered_set_write_buffer(stream, 1024));
+
+   /* small writes are held */
+   r = mongoc_stream_write(buffered, "foo", 3, -1);
+   BSON_ASSERT(r == 3);
+   iov[0].iov_base = " bar";
+   iov[0].iov_len = 4;
+   iov[1].iov_base = " baz";
+   iov[1].iov_len = 4;
+   r = mongoc_stream_writev(buffered, iov, 2, -1);
+   BSON_ASSERT(r == 8);
+
+   reader = mongoc_stream_file_new_for_path (path, O_RDONLY, 0);
+   assert (reader);
+   r = mongoc_stream_read(reader, buf, sizeof buf, 0, -1);
+   BSON_ASSERT(r == 0);
+
+   BSON_ASSERT(0 == mongoc_stream_flush(buffered));
+   r = mongoc_stream_read(reader, buf, sizeof buf, 0, -1);
+   BSON_ASSERT(r == 11);
+   BSON_ASSERT(0 == memcmp (buf, "foo bar baz", 11));
+
+   /* a write larger than the buffer goes out with what it holds */
+   r = mongoc_stream_write(buffered, "foo", 3, -1);
+   BSON_ASSERT(r == 3);
+   r = mongoc_stream_write(buffered, big, sizeof big, -1);
+   BSON_ASSERT(r == sizeof big);
+   r = mongoc_stream_read(reader, buf, sizeof buf, 0, -1);
+   BSON_ASSERT(r == 3 + sizeof big);
+
+   /* destroying sends the rest */
+   r = mongoc_stream_write(buffered, "qux", 3, -1);
+   BSON_ASSERT(r == 3);
+   mongoc_stream_destroy(buffered);
+   r = mongoc_stream_read(reader, buf, sizeof buf, 0, -1);
+   BSON_ASSERT(r == 3);
+   BSON_ASSERT(0 == memcmp (buf, "qux", 3));
+
+   mongoc_stream_destroy(reader);
+   remove (path);
+}
+
+
+static void
+test_compressed_unsupported (void)
+{
+   mongoc_stream_t *stream;
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   assert (stream);
+
+   /* the base stream is not taken on failure. */
+   BSON_ASSERT(!mongoc_stream_compressed_new(stream, "unknown"));
+
+   mongoc_stream_destroy(stream);
+}
+
+
+#ifdef MONGOC_ENABLE_ZLIB
+static void
+test_compressed_zlib (void)
+{
+   const char *path = "test-stream-compressed.dat";
+   mongoc_stream_t *stream;
+   mongoc_stream_t *compressed;
+   mongoc_iovec_t iov[2];
+   ssize_t r;
+   char expected[16236];
+   char buf[16236];
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   assert (stream);
+   iov[0].iov_len = sizeof expected;
+   iov[0].iov_base = expected;
+   r = mongoc_stream_readv(stream, iov, 1, iov[0].iov_len, -1);
+   BSON_ASSERT(r == iov[0].iov_len);
+   mongoc_stream_destroy(stream);
+
+   stream = mongoc_stream_file_new_for_path (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   assert (stream);
+   compressed = mongoc_stream_compressed_new(stream, "zlib");
+   assert (compressed);
+
+   iov[0].iov_len = 100;
+   iov[0].iov_base = expected;
+   iov[1].iov_len = sizeof expected - 100;
+   iov[1].iov_base = expected + 100;
+   r = mongoc_stream_writev(compressed, iov, 2, -1);
+   BSON_ASSERT(r == sizeof expected);
+
+   /* destroying terminates the compressed data. */
+   mongoc_stream_destroy(compressed);
+
+   stream = mongoc_stream_file_new_for_path (path, O_RDONLY, 0);
+   assert (stream);
+   compressed = mongoc_stream_compressed_new(stream, "zlib");
+   assert (compressed);
+
+   iov[0].iov_len = 16;
+   iov[0].iov_base = buf;
+   iov[1].iov_len = sizeof buf - 16;
+   iov[1].iov_base = buf + 16;
+   r = mongoc_stream_readv(compressed, iov, 2, sizeof buf, -1);
+   BSON_ASSERT(r == sizeof buf);
+   BSON_ASSERT(0 == memcmp (buf, expected, sizeof buf));
+
+   r = mongoc_stream_read(compressed, buf, sizeof buf, 1, -1);
+   BSON_ASSERT(r == 0);
+
+   mongoc_stream_destroy(compressed);
+   remove (path);
+}
+#endif
+
+
+static void
+test_simulated_bandwidth (void)
+{
+   mongoc_stream_simulated_opts_t opts = { 0 };
+   mongoc_stream_t *stream;
+   mongoc_stream_t *simulated;
+   int64_t started;
+   ssize_t r;
+   char buf[16236];
+
+   stream = mongoc_stream_file_new_for_path (BINARY_DIR"/reply2.dat", O_RDONLY, 0);
+   assert (stream);
+
+   opts.bytes_per_sec = 1000 * 1000;
+   simulated = mongoc_stream_simulated_new(stream, &opts);
+   assert (simulated);
+
+   started = bson_get_monotonic_time ();
+   r = mongoc_stream_read(simulated, buf, sizeof buf, sizeof buf, -1);
+   BSON_ASSERT(r == sizeof buf);
+
+   /* 16236 bytes at a megabyte per second. */
+   BSON_ASSERT(bson_get_monotonic_time () - started >= 16000);
+
+   mongoc_stream_destroy(simulated);
+}
+
+
+static void
+test_simulated_timeout (void)
+{
+   const char *path = "test-stream-simulated.dat";
+   mongoc_stream_simulated_opts_t opts = { 0 };
+   mongoc_stream_t *stream;
+   mongoc_stream_t *simulated;
+   ssize_t r;
+   char buf[1];
+
+   stream = mongoc_stream_file_new_for_path (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   assert (stream);
+
+   opts.latency_usec = 100 * 1000;
+   simulated = mongoc_stream_simulated_new(stream, &opts);
+   assert (simulated);
+
+   r = mongoc_stream_write(simulated, "x", 1, -1);
+   BSON_ASSERT(r == 1);
+
+   /* the reply cannot arrive within 10 milliseconds. */
+   r = mongoc_stream_read(simulated, buf, sizeof buf, 1, 10);
+   BSON_ASSERT(r == -1);
+   BSON_ASSERT(errno == ETIMEDOUT);
+
+   mongoc_stream_destroy(simulated);
+   remove (path);
+}
+
+
 void
 test_stream_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Stream/buffered/basic", test_buffered_basic);
    TestSuite_Add (suite, "/Stream/buffered/oversized", test_buffered_oversized);
+   TestSuite_Add (suite, "/Stream/buffered/bypass", test_buffered_bypass);
+   TestSuite_Add (suite, "/Stream/buffered/write", test_buffered_write);
+   TestSuite_Add (suite, "/Stream/compressed/unsupported", test_compressed_unsupported);
+   TestSuite_Add (suite, "/Stream/simulated/bandwidth", test_simulated_bandwidth);
+   TestSuite_Add (suite, "/Stream/simulated/timeout", test_simulated_timeout);
+#ifdef MONGOC_ENABLE_ZLIB
+   TestSuite_Add (suite, "/Stream/compressed/zlib", test_compressed_zlib);
+#endif
 }
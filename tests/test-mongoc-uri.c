@@ -148,6 +148,114 @@ test_mongoc_uri_new (void)
    ASSERT(!bson_iter_next(&iter));
    mongoc_uri_destroy(uri);
 
+   uri = mongoc_uri_new("mongodb://localhost/?localThresholdMS=20&trackOperationLatency=true");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init(&iter, options));
+   ASSERT(bson_iter_find_case(&iter, "localthresholdms"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 20);
+   ASSERT(bson_iter_find_case(&iter, "trackoperationlatency"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?connectTimeoutMS=500&serverSelectionTimeoutMS=2000");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init(&iter, options));
+   ASSERT(bson_iter_find_case(&iter, "connecttimeoutms"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 500);
+   ASSERT(bson_iter_find_case(&iter, "serverselectiontimeoutms"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 2000);
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?replicaSet=rs0&lazyConnect=true&standbyConnections=true");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "lazyconnect"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   ASSERT(bson_iter_init_find_case(&iter, options, "standbyconnections"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?replicaSet=rs0&hedgedReads=true&hedgeDelayMS=20");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "hedgedreads"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   ASSERT(bson_iter_init_find_case(&iter, options, "hedgedelayms"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 20);
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?replicaSet=rs0&retryReads=false&retryWrites=true");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "retryreads"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(!bson_iter_bool(&iter));
+   ASSERT(bson_iter_init_find_case(&iter, options, "retrywrites"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?replicaSet=rs0&slaveOk=true&maxStalenessMS=120000");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "maxstalenessms"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 120000);
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?compressors=zlib&zlibCompressionLevel=6");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "compressors"));
+   ASSERT(BSON_ITER_HOLDS_UTF8(&iter));
+   ASSERT_CMPSTR(bson_iter_utf8(&iter, NULL), "zlib");
+   ASSERT(bson_iter_init_find_case(&iter, options, "zlibcompressionlevel"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 6);
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?socketSendBufferSize=1048576&"
+                        "keepAlive=true&keepAliveIdleMS=30000&busyPollUS=50");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "socketsendbuffersize"));
+   ASSERT(BSON_ITER_HOLDS_INT32(&iter));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 1048576);
+   ASSERT(bson_iter_init_find_case(&iter, options, "keepalive"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   ASSERT(bson_iter_init_find_case(&iter, options, "keepaliveidlems"));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 30000);
+   ASSERT(bson_iter_init_find_case(&iter, options, "busypollus"));
+   ASSERT_CMPINT(bson_iter_int32(&iter), ==, 50);
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?zeroCopySend=true");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "zerocopysend"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   mongoc_uri_destroy(uri);
+
+   uri = mongoc_uri_new("mongodb://localhost/?preferUnixSocket=true");
+   options = mongoc_uri_get_options(uri);
+   ASSERT(options);
+   ASSERT(bson_iter_init_find_case(&iter, options, "preferunixsocket"));
+   ASSERT(BSON_ITER_HOLDS_BOOL(&iter));
+   ASSERT(bson_iter_bool(&iter));
+   mongoc_uri_destroy(uri);
+
    uri = mongoc_uri_new("mongodb:///tmp/mongodb-27017.sock/?ssl=false");
    ASSERT(uri);
    ASSERT_CMPSTR(mongoc_uri_get_hosts(uri)->host, "/tmp/mongodb-27017.sock");
@@ -476,10 +584,39 @@ test_mongoc_uri_write_concern (void)
 }
 
 
+static void
+test_mongoc_uri_copy (void)
+{
+   const mongoc_host_list_t *hosts;
+   mongoc_uri_t *uri;
+   mongoc_uri_t *copy;
+
+   uri = mongoc_uri_new ("mongodb://a,b:27018/db?replicaSet=rs&w=2");
+   copy = mongoc_uri_copy (uri);
+   assert (copy);
+
+   /* the copy outlives the original */
+   mongoc_uri_destroy (uri);
+
+   assert (!strcmp (mongoc_uri_get_string (copy),
+                    "mongodb://a,b:27018/db?replicaSet=rs&w=2"));
+   assert (!strcmp (mongoc_uri_get_database (copy), "db"));
+   assert (!strcmp (mongoc_uri_get_replica_set (copy), "rs"));
+   assert (mongoc_write_concern_get_w (mongoc_uri_get_write_concern (copy)) == 2);
+
+   hosts = mongoc_uri_get_hosts (copy);
+   assert (hosts && hosts->next && !hosts->next->next);
+   assert (!strcmp (hosts->next->host_and_port, "b:27018"));
+
+   mongoc_uri_destroy (copy);
+}
+
+
 void
 test_uri_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/Uri/new", test_mongoc_uri_new);
+   TestSuite_Add (suite, "/Uri/copy", test_mongoc_uri_copy);
    TestSuite_Add (suite, "/Uri/new_for_host_port", test_mongoc_uri_new_for_host_port);
    TestSuite_Add (suite, "/Uri/unescape", test_mongoc_uri_unescape);
    TestSuite_Add (suite, "/Uri/write_concern", test_mongoc_uri_write_concern);
@@ -208,6 +208,42 @@ test_write_concern_fsync_and_journal_gle_and_validity (void)
 }
 
 
+static void
+test_write_concern_share (void)
+{
+   mongoc_write_concern_t *write_concern;
+   mongoc_write_concern_t *shared;
+   mongoc_client_t *client;
+   mongoc_collection_t *collection;
+
+   client = mongoc_client_new("mongodb://localhost/?w=2");
+   ASSERT(client);
+
+   /* handles share the client's write concern rather than copying it */
+   collection = mongoc_client_get_collection(client, "test", "test");
+   ASSERT(mongoc_collection_get_write_concern(collection) ==
+          mongoc_client_get_write_concern(client));
+   ASSERT(mongoc_collection_get_read_prefs(collection) ==
+          mongoc_client_get_read_prefs(client));
+   mongoc_collection_destroy(collection);
+
+   write_concern = mongoc_write_concern_new();
+   mongoc_write_concern_set_w(write_concern, 3);
+   shared = _mongoc_write_concern_share(write_concern);
+   ASSERT(shared != write_concern);
+   ASSERT(_mongoc_write_concern_share(shared) == shared);
+   mongoc_write_concern_destroy(shared);
+
+   /* frozen, so the setter is refused */
+   mongoc_write_concern_set_w(shared, 1);
+   ASSERT_CMPINT(mongoc_write_concern_get_w(shared), ==, 3);
+
+   mongoc_write_concern_destroy(shared);
+   mongoc_write_concern_destroy(write_concern);
+   mongoc_client_destroy(client);
+}
+
+
 void
 test_write_concern_install (TestSuite *suite)
 {
@@ -215,4 +251,5 @@ test_write_concern_install (TestSuite *suite)
    TestSuite_Add (suite, "/WriteConcern/bson_omits_defaults", test_write_concern_bson_omits_defaults);
    TestSuite_Add (suite, "/WriteConcern/bson_includes_false_fsync_and_journal", test_write_concern_bson_includes_false_fsync_and_journal);
    TestSuite_Add (suite, "/WriteConcern/fsync_and_journal_gle_and_validity", test_write_concern_fsync_and_journal_gle_and_validity);
+   TestSuite_Add (suite, "/WriteConcern/share", test_write_concern_share);
 }
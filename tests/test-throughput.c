@@ -0,0 +1,610 @@
+#include <mongoc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/resource.h>
+# include <sys/time.h>
+#endif
+
+
+/*
+ * Throughput benchmarks against a server: GridFS upload and download over
+ * a range of file and chunk sizes, and bulk inserts and updates, ordered
+ * and unordered, over a range of batch and document sizes.
+ *
+ * Each case repeats its operation for at least the given duration and
+ * prints MB/s, documents per second (GridFS chunks for GridFS) and the
+ * CPU time the client spent per MB, user and system together.
+ */
+
+
+#define KB 1024
+#define MB (1024 * 1024)
+
+
+typedef struct
+{
+   const char      *db;
+   mongoc_client_t *client;
+   int64_t          min_usec;
+} tp_t;
+
+
+typedef struct
+{
+   uint64_t n_bytes;
+   uint64_t n_docs;
+} tp_result_t;
+
+
+typedef bool (*tp_func_t) (tp_t        *tp,
+                           const void  *data,
+                           tp_result_t *result);
+
+
+typedef struct
+{
+   const char *name;
+   tp_func_t   func;
+   const void *data;
+} tp_entry_t;
+
+
+typedef struct
+{
+   uint32_t file_size;
+   uint32_t chunk_size;
+   bool     tuned;
+} tp_gridfs_case_t;
+
+
+typedef struct
+{
+   bool     ordered;
+   bool     update;
+   uint32_t batch_size;
+   uint32_t doc_size;
+} tp_bulk_case_t;
+
+
+static int64_t
+tp_cpu_usec (void)
+{
+#ifdef _WIN32
+   FILETIME creation;
+   FILETIME exit_time;
+   FILETIME kernel;
+   FILETIME user;
+   ULARGE_INTEGER k;
+   ULARGE_INTEGER u;
+
+   GetProcessTimes (GetCurrentProcess (), &creation, &exit_time, &kernel,
+                    &user);
+   k.LowPart = kernel.dwLowDateTime;
+   k.HighPart = kernel.dwHighDateTime;
+   u.LowPart = user.dwLowDateTime;
+   u.HighPart = user.dwHighDateTime;
+
+   /* FILETIME is in units of 100 nanoseconds. */
+   return (int64_t)((k.QuadPart + u.QuadPart) / 10);
+#else
+   struct rusage usage;
+
+   getrusage (RUSAGE_SELF, &usage);
+
+   return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * (int64_t)1000000 +
+          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+
+/*
+ * A stream of @len bytes of a pattern, the source of an upload.
+ */
+typedef struct
+{
+   mongoc_stream_t vtable;
+   size_t          len;
+   size_t          pos;
+} tp_stream_t;
+
+
+static void
+tp_stream_destroy (mongoc_stream_t *stream)
+{
+   bson_free (stream);
+}
+
+
+static int
+tp_stream_close (mongoc_stream_t *stream)
+{
+   return 0;
+}
+
+
+static ssize_t
+tp_stream_readv (mongoc_stream_t *stream,
+                 mongoc_iovec_t  *iov,
+                 size_t           iovcnt,
+                 size_t           min_bytes,
+                 int32_t          timeout_msec)
+{
+   tp_stream_t *tstream = (tp_stream_t *)stream;
+   size_t ret = 0;
+   size_t n;
+   size_t i;
+
+   for (i = 0; i < iovcnt && tstream->pos < tstream->len; i++) {
+      n = BSON_MIN (iov[i].iov_len, tstream->len - tstream->pos);
+      memset (iov[i].iov_base, 'x', n);
+      tstream->pos += n;
+      ret += n;
+   }
+
+   return ret;
+}
+
+
+static bool
+tp_stream_check_closed (mongoc_stream_t *stream)
+{
+   return false;
+}
+
+
+static mongoc_stream_t *
+tp_stream_new (size_t len)
+{
+   tp_stream_t *stream;
+
+   stream = bson_malloc0 (sizeof *stream);
+   stream->vtable.destroy = tp_stream_destroy;
+   stream->vtable.close = tp_stream_close;
+   stream->vtable.readv = tp_stream_readv;
+   stream->vtable.check_closed = tp_stream_check_closed;
+   stream->len = len;
+
+   return (mongoc_stream_t *)stream;
+}
+
+
+static mongoc_gridfs_t *
+tp_gridfs_new (tp_t *tp)
+{
+   mongoc_gridfs_t *gridfs;
+   bson_error_t error;
+
+   if (!(gridfs = mongoc_client_get_gridfs (tp->client, tp->db, "tp",
+                                            &error))) {
+      fprintf (stderr, "Failed to open GridFS: %s\n", error.message);
+   }
+
+   return gridfs;
+}
+
+
+/*
+ * Upload with mongoc_gridfs_create_file_from_stream(), or for the tuned
+ * cases write the stream to a bulk upload, which has to be enabled before
+ * the first chunk is written.
+ */
+static bool
+tp_gridfs_upload_one (mongoc_gridfs_t        *gridfs,
+                      const tp_gridfs_case_t *gridfs_case,
+                      const char             *filename)
+{
+   mongoc_gridfs_file_opt_t opt = { 0 };
+   mongoc_gridfs_file_t *file;
+   mongoc_stream_t *stream;
+   bson_error_t error;
+   mongoc_iovec_t iov;
+   ssize_t r;
+   bool ret;
+
+   opt.filename = filename;
+   opt.chunk_size = gridfs_case->chunk_size;
+   stream = tp_stream_new (gridfs_case->file_size);
+
+   if (!gridfs_case->tuned) {
+      file = mongoc_gridfs_create_file_from_stream (gridfs, stream, &opt);
+      if (!file) {
+         fprintf (stderr, "Failed to read the upload stream.\n");
+         return false;
+      }
+   } else {
+      file = mongoc_gridfs_create_file (gridfs, &opt);
+      mongoc_gridfs_file_set_bulk_upload (file, true);
+      iov.iov_base = bson_malloc (gridfs_case->chunk_size);
+
+      while ((r = mongoc_stream_read (stream, iov.iov_base,
+                                      gridfs_case->chunk_size, 0, 0)) > 0) {
+         iov.iov_len = r;
+         mongoc_gridfs_file_writev (file, &iov, 1, 0);
+      }
+
+      bson_free (iov.iov_base);
+      mongoc_stream_destroy (stream);
+   }
+
+   if (!(ret = mongoc_gridfs_file_save (file))) {
+      mongoc_gridfs_file_error (file, &error);
+      fprintf (stderr, "Failed to save file: %s\n", error.message);
+   }
+
+   mongoc_gridfs_file_destroy (file);
+
+   return ret;
+}
+
+
+static bool
+tp_gridfs_upload (tp_t        *tp,
+                  const void  *data,
+                  tp_result_t *result)
+{
+   const tp_gridfs_case_t *gridfs_case = data;
+   mongoc_gridfs_t *gridfs;
+   bson_error_t error;
+   int64_t deadline;
+   bool ret = true;
+   char filename[32];
+   uint64_t i;
+
+   if (!(gridfs = tp_gridfs_new (tp))) {
+      return false;
+   }
+
+   deadline = bson_get_monotonic_time () + tp->min_usec;
+
+   for (i = 0; ret && bson_get_monotonic_time () < deadline; i++) {
+      bson_snprintf (filename, sizeof filename, "upload%llu",
+                     (unsigned long long)i);
+      ret = tp_gridfs_upload_one (gridfs, gridfs_case, filename);
+      result->n_bytes += gridfs_case->file_size;
+      result->n_docs += (gridfs_case->file_size + gridfs_case->chunk_size - 1) /
+                        gridfs_case->chunk_size;
+   }
+
+   if (!mongoc_gridfs_drop (gridfs, &error)) {
+      fprintf (stderr, "Failed to drop GridFS: %s\n", error.message);
+   }
+
+   mongoc_gridfs_destroy (gridfs);
+
+   return ret;
+}
+
+
+static bool
+tp_gridfs_download (tp_t        *tp,
+                    const void  *data,
+                    tp_result_t *result)
+{
+   const tp_gridfs_case_t *gridfs_case = data;
+   mongoc_gridfs_file_t *file;
+   mongoc_gridfs_t *gridfs;
+   mongoc_stream_t *stream;
+   bson_error_t error;
+   int64_t deadline;
+   mongoc_iovec_t iov;
+   uint64_t n_read;
+   ssize_t r;
+   bool ret;
+   char *buf;
+
+   if (!(gridfs = tp_gridfs_new (tp))) {
+      return false;
+   }
+
+   ret = tp_gridfs_upload_one (gridfs, gridfs_case, "download");
+   buf = bson_malloc (64 * KB);
+   deadline = bson_get_monotonic_time () + tp->min_usec;
+
+   while (ret && bson_get_monotonic_time () < deadline) {
+      if (!(file = mongoc_gridfs_find_one_by_filename (gridfs, "download",
+                                                       &error))) {
+         fprintf (stderr, "Failed to find file: %s\n", error.message);
+         ret = false;
+         break;
+      }
+
+      if (gridfs_case->tuned) {
+         mongoc_gridfs_file_set_read_ahead (file, 4);
+      }
+
+      stream = mongoc_stream_gridfs_new (file);
+      n_read = 0;
+
+      for (;;) {
+         iov.iov_base = buf;
+         iov.iov_len = 64 * KB;
+         r = mongoc_stream_readv (stream, &iov, 1, 0, 0);
+         if (r <= 0) {
+            break;
+         }
+         n_read += r;
+      }
+
+      if (r < 0 || n_read != gridfs_case->file_size) {
+         fprintf (stderr, "Read %llu of %u bytes.\n",
+                  (unsigned long long)n_read, gridfs_case->file_size);
+         ret = false;
+      }
+
+      mongoc_stream_destroy (stream);
+      mongoc_gridfs_file_destroy (file);
+
+      result->n_bytes += n_read;
+      result->n_docs += (n_read + gridfs_case->chunk_size - 1) /
+                        gridfs_case->chunk_size;
+   }
+
+   if (!mongoc_gridfs_drop (gridfs, &error)) {
+      fprintf (stderr, "Failed to drop GridFS: %s\n", error.message);
+   }
+
+   bson_free (buf);
+   mongoc_gridfs_destroy (gridfs);
+
+   return ret;
+}
+
+
+static bool
+tp_bulk (tp_t        *tp,
+         const void  *data,
+         tp_result_t *result)
+{
+   const tp_bulk_case_t *bulk_case = data;
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   bson_error_t error;
+   int64_t deadline;
+   uint32_t payload_len;
+   uint32_t i;
+   uint64_t n = 0;
+   bool ret = true;
+   char *payload;
+   bson_t selector;
+   bson_t update;
+   bson_t child;
+   bson_t reply;
+   bson_t doc;
+
+   /* The _id, the payload string and the document headers take 40 bytes. */
+   payload_len = bulk_case->doc_size > 40 ? bulk_case->doc_size - 40 : 0;
+   payload = bson_malloc (payload_len + 1);
+   memset (payload, 'x', payload_len);
+   payload[payload_len] = '\0';
+
+   collection = mongoc_client_get_collection (tp->client, tp->db, "bulk");
+   mongoc_collection_drop (collection, NULL);
+   deadline = bson_get_monotonic_time () + tp->min_usec;
+
+   do {
+      bulk = mongoc_collection_create_bulk_operation (collection,
+                                                      bulk_case->ordered,
+                                                      NULL);
+
+      for (i = 0; i < bulk_case->batch_size; i++) {
+         if (bulk_case->update) {
+            bson_init (&selector);
+            BSON_APPEND_INT32 (&selector, "_id", (int32_t)i);
+            bson_init (&update);
+            BSON_APPEND_DOCUMENT_BEGIN (&update, "$set", &child);
+            BSON_APPEND_UTF8 (&child, "payload", payload);
+            bson_append_document_end (&update, &child);
+            mongoc_bulk_operation_update (bulk, &selector, &update, true);
+            bson_destroy (&update);
+            bson_destroy (&selector);
+         } else {
+            bson_init (&doc);
+            BSON_APPEND_INT64 (&doc, "_id", (int64_t)n + i);
+            BSON_APPEND_UTF8 (&doc, "payload", payload);
+            mongoc_bulk_operation_insert (bulk, &doc);
+            bson_destroy (&doc);
+         }
+      }
+
+      if (!mongoc_bulk_operation_execute (bulk, &reply, &error)) {
+         fprintf (stderr, "Bulk operation failed: %s\n", error.message);
+         ret = false;
+      }
+
+      bson_destroy (&reply);
+      mongoc_bulk_operation_destroy (bulk);
+
+      n += bulk_case->batch_size;
+   } while (ret && bson_get_monotonic_time () < deadline);
+
+   result->n_docs = n;
+   result->n_bytes = n * bulk_case->doc_size;
+
+   mongoc_collection_drop (collection, NULL);
+   mongoc_collection_destroy (collection);
+   bson_free (payload);
+
+   return ret;
+}
+
+
+#define GRIDFS_CASE(name, file_size, chunk_size) \
+   static const tp_gridfs_case_t name = { file_size, chunk_size, false }; \
+   static const tp_gridfs_case_t name##_tuned = { file_size, chunk_size, true }
+
+GRIDFS_CASE (gGridFS64K, 64 * KB, 255 * KB);
+GRIDFS_CASE (gGridFS1M, 1 * MB, 255 * KB);
+GRIDFS_CASE (gGridFS16M, 16 * MB, 255 * KB);
+GRIDFS_CASE (gGridFS16M1M, 16 * MB, 1 * MB);
+GRIDFS_CASE (gGridFS16M64K, 16 * MB, 64 * KB);
+
+
+#define GRIDFS_BENCH(size, var) \
+   { "gridfs/upload/" size, tp_gridfs_upload, &var }, \
+   { "gridfs/upload_bulk/" size, tp_gridfs_upload, &var##_tuned }, \
+   { "gridfs/download/" size, tp_gridfs_download, &var }, \
+   { "gridfs/download_readahead/" size, tp_gridfs_download, &var##_tuned }
+
+
+#define BULK_CASE(name, batch_size, doc_size) \
+   static const tp_bulk_case_t name##_oi = { true, false, batch_size, doc_size }; \
+   static const tp_bulk_case_t name##_ui = { false, false, batch_size, doc_size }; \
+   static const tp_bulk_case_t name##_ou = { true, true, batch_size, doc_size }; \
+   static const tp_bulk_case_t name##_uu = { false, true, batch_size, doc_size }
+
+BULK_CASE (gBulk10x100, 10, 100);
+BULK_CASE (gBulk1000x100, 1000, 100);
+BULK_CASE (gBulk1000x10K, 1000, 10 * KB);
+BULK_CASE (gBulk100x100K, 100, 100 * KB);
+
+
+#define BULK_BENCH(size, var) \
+   { "bulk/ordered_insert/" size, tp_bulk, &var##_oi }, \
+   { "bulk/unordered_insert/" size, tp_bulk, &var##_ui }, \
+   { "bulk/ordered_update/" size, tp_bulk, &var##_ou }, \
+   { "bulk/unordered_update/" size, tp_bulk, &var##_uu }
+
+
+static const tp_entry_t gBenchmarks[] = {
+   GRIDFS_BENCH ("64KB/255KB", gGridFS64K),
+   GRIDFS_BENCH ("1MB/255KB", gGridFS1M),
+   GRIDFS_BENCH ("16MB/255KB", gGridFS16M),
+   GRIDFS_BENCH ("16MB/1MB", gGridFS16M1M),
+   GRIDFS_BENCH ("16MB/64KB", gGridFS16M64K),
+   BULK_BENCH ("10x100B", gBulk10x100),
+   BULK_BENCH ("1000x100B", gBulk1000x100),
+   BULK_BENCH ("1000x10KB", gBulk1000x10K),
+   BULK_BENCH ("100x100KB", gBulk100x100K),
+};
+
+
+static bool
+tp_run (tp_t             *tp,
+        const tp_entry_t *entry)
+{
+   tp_result_t result = { 0 };
+   int64_t started;
+   int64_t cpu_started;
+   double secs;
+   double mb;
+   double cpu_msec;
+
+   started = bson_get_monotonic_time ();
+   cpu_started = tp_cpu_usec ();
+
+   if (!entry->func (tp, entry->data, &result)) {
+      printf ("%-36s failed\n", entry->name);
+      return false;
+   }
+
+   secs = (bson_get_monotonic_time () - started) / 1000000.0;
+   cpu_msec = (tp_cpu_usec () - cpu_started) / 1000.0;
+   mb = (double)result.n_bytes / MB;
+
+   printf ("%-36s %10.1f %12.1f %12.2f\n", entry->name,
+           secs > 0 ? mb / secs : 0.0,
+           secs > 0 ? result.n_docs / secs : 0.0,
+           mb > 0 ? cpu_msec / mb : 0.0);
+   fflush (stdout);
+
+   return true;
+}
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [-l] [-d SECONDS] [-c DB] [-u URI] [PATTERN...]\n"
+            "\n"
+            "  -l          List the benchmarks.\n"
+            "  -d SECONDS  Run each benchmark for at least SECONDS (2).\n"
+            "  -c DB       Database to use (test_throughput). Its GridFS\n"
+            "              and collections are dropped.\n"
+            "  -u URI      Server to use (mongodb://127.0.0.1/).\n"
+            "\n"
+            "Only the benchmarks whose name contains one of the PATTERNs "
+            "are run.\n",
+            prog);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   const char *uri = "mongodb://127.0.0.1/";
+   bool list = false;
+   bool selected;
+   bool ok = true;
+   tp_t tp;
+   size_t i;
+   int first;
+   int j;
+
+   tp.db = "test_throughput";
+   tp.min_usec = 2 * 1000000;
+
+   for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+      if (!strcmp (argv[first], "-l")) {
+         list = true;
+      } else if (!strcmp (argv[first], "-d") && first + 1 < argc) {
+         tp.min_usec = (int64_t)(atof (argv[++first]) * 1000000);
+      } else if (!strcmp (argv[first], "-c") && first + 1 < argc) {
+         tp.db = argv[++first];
+      } else if (!strcmp (argv[first], "-u") && first + 1 < argc) {
+         uri = argv[++first];
+      } else {
+         usage (argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (tp.min_usec <= 0) {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   if (!list) {
+      if (!(tp.client = mongoc_client_new (uri))) {
+         fprintf (stderr, "Failed to parse uri: %s\n", uri);
+         return EXIT_FAILURE;
+      }
+
+      printf ("%-36s %10s %12s %12s\n",
+              "benchmark", "MB/s", "docs/s", "CPU ms/MB");
+   }
+
+   for (i = 0; i < sizeof gBenchmarks / sizeof gBenchmarks[0]; i++) {
+      selected = (first == argc);
+
+      for (j = first; j < argc && !selected; j++) {
+         selected = !!strstr (gBenchmarks[i].name, argv[j]);
+      }
+
+      if (!selected) {
+         continue;
+      }
+
+      if (list) {
+         printf ("%s\n", gBenchmarks[i].name);
+      } else {
+         ok = tp_run (&tp, &gBenchmarks[i]) && ok;
+      }
+   }
+
+   if (!list) {
+      mongoc_client_destroy (tp.client);
+   }
+
+   mongoc_cleanup ();
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,417 @@
+#include <mongoc.h>
+#include <mongoc-client-private.h>
+#include <mongoc-stream-tls-private.h>
+
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/resource.h>
+# include <sys/time.h>
+#endif
+
+#include "ssl-test.h"
+
+
+/*
+ * Connection setup benchmarks over TLS: how many connections per second
+ * a client sets up, how long each takes and how much CPU each costs.
+ *
+ * The loopback cases run the TLS handshake against a server thread in
+ * this process with the certificates of tests/trust_dir, so they need no
+ * server, and their CPU time includes that of the server side. The
+ * server cases connect, handshake, run isMaster and authenticate with a
+ * new client for each connection, then ping and destroy it. Clients with
+ * a shared context use one SSL_CTX like the clients of a pool, the others
+ * each load the certificates into a context of their own. All of them
+ * share the TLS session cache and the SCRAM cache of the process, as
+ * clients do.
+ *
+ * Run from the top of the source tree, like test-libmongoc.
+ */
+
+
+#define TRUST_DIR "tests/trust_dir"
+#define CAFILE TRUST_DIR "/verify/mongo_root.pem"
+#define PEMFILE_NOPASS TRUST_DIR "/keys/mongodb.com.pem"
+#define HOST "mongodb.com"
+
+/* connections made at least, however long they take */
+#define TC_MIN_CONNECTS 10
+
+
+typedef struct
+{
+   mongoc_uri_t *uri;
+   mongoc_uri_t *auth_uri;
+   const char   *ca_file;
+   const char   *pem_file;
+   int64_t       min_usec;
+} tc_t;
+
+
+typedef struct
+{
+   bool loopback;
+   bool shared_ctx;
+   bool client_cert;
+   bool scram;
+} tc_case_t;
+
+
+typedef struct
+{
+   const char      *name;
+   const tc_case_t *tc_case;
+} tc_entry_t;
+
+
+static int64_t
+tc_cpu_usec (void)
+{
+#ifdef _WIN32
+   FILETIME creation;
+   FILETIME exit_time;
+   FILETIME kernel;
+   FILETIME user;
+   ULARGE_INTEGER k;
+   ULARGE_INTEGER u;
+
+   GetProcessTimes (GetCurrentProcess (), &creation, &exit_time, &kernel,
+                    &user);
+   k.LowPart = kernel.dwLowDateTime;
+   k.HighPart = kernel.dwHighDateTime;
+   u.LowPart = user.dwLowDateTime;
+   u.HighPart = user.dwHighDateTime;
+
+   /* FILETIME is in units of 100 nanoseconds. */
+   return (int64_t)((k.QuadPart + u.QuadPart) / 10);
+#else
+   struct rusage usage;
+
+   getrusage (RUSAGE_SELF, &usage);
+
+   return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * (int64_t)1000000 +
+          usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+
+static bool
+tc_connect_loopback (const tc_case_t *tc_case)
+{
+   mongoc_ssl_opt_t sopt = { 0 };
+   mongoc_ssl_opt_t copt = { 0 };
+   ssl_test_result_t sr;
+   ssl_test_result_t cr;
+
+   sopt.pem_file = PEMFILE_NOPASS;
+   sopt.ca_file = CAFILE;
+
+   copt.ca_file = CAFILE;
+
+   if (tc_case->client_cert) {
+      copt.pem_file = PEMFILE_NOPASS;
+   }
+
+   ssl_test (&copt, &sopt, HOST, &cr, &sr);
+
+   if (cr.result != SSL_TEST_SUCCESS || sr.result != SSL_TEST_SUCCESS) {
+      fprintf (stderr, "Loopback handshake failed: client %d, server %d\n",
+               cr.result, sr.result);
+      return false;
+   }
+
+   return true;
+}
+
+
+static bool
+tc_connect_server (tc_t                   *tc,
+                   const tc_case_t        *tc_case,
+                   const mongoc_ssl_opt_t *opts,
+                   SSL_CTX                *ssl_ctx)
+{
+   mongoc_client_t *client;
+   bson_error_t error;
+   bson_t ping = BSON_INITIALIZER;
+   bool ret;
+
+   client = mongoc_client_new_from_uri (tc_case->scram ? tc->auth_uri
+                                                       : tc->uri);
+
+   if (tc_case->shared_ctx) {
+      _mongoc_client_set_ssl_opts_with_ctx (client, opts, ssl_ctx);
+   } else {
+      mongoc_client_set_ssl_opts (client, opts);
+   }
+
+   BSON_APPEND_INT32 (&ping, "ping", 1);
+
+   if (!(ret = mongoc_client_command_simple (client, "admin", &ping, NULL,
+                                             NULL, &error))) {
+      fprintf (stderr, "Connecting failed: %s\n", error.message);
+   }
+
+   bson_destroy (&ping);
+   mongoc_client_destroy (client);
+
+   return ret;
+}
+
+
+static int
+tc_compare_int64 (const void *a,
+                  const void *b)
+{
+   int64_t x = *(const int64_t *)a;
+   int64_t y = *(const int64_t *)b;
+
+   return (x > y) - (x < y);
+}
+
+
+static bool
+tc_run (tc_t             *tc,
+        const tc_entry_t *entry)
+{
+   const tc_case_t *tc_case = entry->tc_case;
+   mongoc_ssl_opt_t opts = { 0 };
+   SSL_CTX *ssl_ctx = NULL;
+   int64_t *latencies = NULL;
+   size_t n_allocated = 0;
+   size_t n = 0;
+   int64_t started;
+   int64_t cpu_started;
+   int64_t t;
+   double secs;
+   double cpu_msec;
+   bool ok = true;
+
+   if (!tc_case->loopback &&
+       (!tc->uri ||
+        (tc_case->client_cert && !tc->pem_file) ||
+        (tc_case->scram && !tc->auth_uri))) {
+      printf ("%-36s skipped\n", entry->name);
+      return true;
+   }
+
+   if (!tc_case->loopback) {
+      opts.ca_file = tc->ca_file;
+      opts.weak_cert_validation = !tc->ca_file;
+
+      if (tc_case->client_cert) {
+         opts.pem_file = tc->pem_file;
+      }
+
+      if (tc_case->shared_ctx) {
+         ssl_ctx = _mongoc_stream_tls_ctx_new (&opts);
+      }
+   }
+
+   started = bson_get_monotonic_time ();
+   cpu_started = tc_cpu_usec ();
+
+   while (n < TC_MIN_CONNECTS ||
+          (bson_get_monotonic_time () - started) < tc->min_usec) {
+      t = bson_get_monotonic_time ();
+
+      if (tc_case->loopback) {
+         ok = tc_connect_loopback (tc_case);
+      } else {
+         ok = tc_connect_server (tc, tc_case, &opts, ssl_ctx);
+      }
+
+      if (!ok) {
+         break;
+      }
+
+      if (n == n_allocated) {
+         n_allocated = n_allocated ? n_allocated * 2 : 256;
+         latencies = bson_realloc (latencies,
+                                   n_allocated * sizeof *latencies);
+      }
+
+      latencies[n++] = bson_get_monotonic_time () - t;
+   }
+
+   secs = (bson_get_monotonic_time () - started) / 1000000.0;
+   cpu_msec = (tc_cpu_usec () - cpu_started) / 1000.0;
+
+   if (ok) {
+      qsort (latencies, n, sizeof *latencies, tc_compare_int64);
+
+      printf ("%-36s %10.1f %10.2f %10.2f %12.2f\n", entry->name,
+              secs > 0 ? n / secs : 0.0,
+              latencies[n / 2] / 1000.0,
+              latencies[(n * 99) / 100] / 1000.0,
+              cpu_msec / n);
+   } else {
+      printf ("%-36s failed\n", entry->name);
+   }
+
+   fflush (stdout);
+
+   if (ssl_ctx) {
+      SSL_CTX_free (ssl_ctx);
+   }
+
+   bson_free (latencies);
+
+   return ok;
+}
+
+
+static const tc_case_t gLoopback = { true, false, false, false };
+static const tc_case_t gLoopbackCert = { true, false, true, false };
+static const tc_case_t gNewCtx = { false, false, false, false };
+static const tc_case_t gNewCtxCert = { false, false, true, false };
+static const tc_case_t gNewCtxScram = { false, false, false, true };
+static const tc_case_t gSharedCtx = { false, true, false, false };
+static const tc_case_t gSharedCtxCert = { false, true, true, false };
+static const tc_case_t gSharedCtxScram = { false, true, false, true };
+static const tc_case_t gSharedCtxCertScram = { false, true, true, true };
+
+
+static const tc_entry_t gBenchmarks[] = {
+   { "loopback/handshake", &gLoopback },
+   { "loopback/handshake_client_cert", &gLoopbackCert },
+   { "server/new_ctx", &gNewCtx },
+   { "server/new_ctx_client_cert", &gNewCtxCert },
+   { "server/new_ctx_scram", &gNewCtxScram },
+   { "server/shared_ctx", &gSharedCtx },
+   { "server/shared_ctx_client_cert", &gSharedCtxCert },
+   { "server/shared_ctx_scram", &gSharedCtxScram },
+   { "server/shared_ctx_client_cert_scram", &gSharedCtxCertScram },
+};
+
+
+static void
+usage (const char *prog)
+{
+   fprintf (stderr,
+            "usage: %s [-l] [-d SECONDS] [-u URI] [-a USER:PASSWORD]\n"
+            "          [-C CAFILE] [-P PEMFILE] [PATTERN...]\n"
+            "\n"
+            "  -l               List the benchmarks.\n"
+            "  -d SECONDS       Run each benchmark for at least SECONDS (2).\n"
+            "  -u URI           Server to connect to, with ssl=true and no\n"
+            "                   credentials. The server benchmarks are\n"
+            "                   skipped without one.\n"
+            "  -a USER:PASSWORD Credentials for the SCRAM benchmarks.\n"
+            "  -C CAFILE        CA to verify the server with. Without one\n"
+            "                   the server certificate is not verified.\n"
+            "  -P PEMFILE       Client certificate for the client_cert\n"
+            "                   benchmarks.\n"
+            "\n"
+            "Only the benchmarks whose name contains one of the PATTERNs "
+            "are run.\n",
+            prog);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+   const char *uri_str = NULL;
+   const char *credentials = NULL;
+   char *auth_uri_str;
+   bool list = false;
+   bool selected;
+   bool ok = true;
+   tc_t tc = { 0 };
+   size_t i;
+   int first;
+   int j;
+
+   tc.min_usec = 2 * 1000000;
+
+   for (first = 1; first < argc && argv[first][0] == '-'; first++) {
+      if (!strcmp (argv[first], "-l")) {
+         list = true;
+      } else if (!strcmp (argv[first], "-d") && first + 1 < argc) {
+         tc.min_usec = (int64_t)(atof (argv[++first]) * 1000000);
+      } else if (!strcmp (argv[first], "-u") && first + 1 < argc) {
+         uri_str = argv[++first];
+      } else if (!strcmp (argv[first], "-a") && first + 1 < argc) {
+         credentials = argv[++first];
+      } else if (!strcmp (argv[first], "-C") && first + 1 < argc) {
+         tc.ca_file = argv[++first];
+      } else if (!strcmp (argv[first], "-P") && first + 1 < argc) {
+         tc.pem_file = argv[++first];
+      } else {
+         usage (argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (tc.min_usec <= 0 ||
+       (uri_str && strncmp (uri_str, "mongodb://", 10))) {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   mongoc_init ();
+
+   if (uri_str) {
+      if (!(tc.uri = mongoc_uri_new (uri_str)) ||
+          !mongoc_uri_get_ssl (tc.uri) ||
+          mongoc_uri_get_username (tc.uri)) {
+         fprintf (stderr, "Need a uri with ssl=true and no credentials: %s\n",
+                  uri_str);
+         return EXIT_FAILURE;
+      }
+
+      if (credentials) {
+         auth_uri_str = bson_strdup_printf ("mongodb://%s@%s", credentials,
+                                            uri_str + 10);
+         tc.auth_uri = mongoc_uri_new (auth_uri_str);
+         bson_free (auth_uri_str);
+
+         if (!tc.auth_uri) {
+            fprintf (stderr, "Failed to parse credentials: %s\n",
+                     credentials);
+            return EXIT_FAILURE;
+         }
+      }
+   }
+
+   if (!list) {
+      printf ("%-36s %10s %10s %10s %12s\n",
+              "benchmark", "conns/s", "p50 ms", "p99 ms", "CPU ms/conn");
+   }
+
+   for (i = 0; i < sizeof gBenchmarks / sizeof gBenchmarks[0]; i++) {
+      selected = (first == argc);
+
+      for (j = first; j < argc && !selected; j++) {
+         selected = !!strstr (gBenchmarks[i].name, argv[j]);
+      }
+
+      if (!selected) {
+         continue;
+      }
+
+      if (list) {
+         printf ("%s\n", gBenchmarks[i].name);
+      } else {
+         ok = tc_run (&tc, &gBenchmarks[i]) && ok;
+      }
+   }
+
+   if (tc.uri) {
+      mongoc_uri_destroy (tc.uri);
+   }
+
+   if (tc.auth_uri) {
+      mongoc_uri_destroy (tc.auth_uri);
+   }
+
+   mongoc_cleanup ();
+
+   return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
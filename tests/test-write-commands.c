@@ -1,6 +1,7 @@
 #include <bcon.h>
 #include <mongoc.h>
 
+#include "mongoc-client-private.h"
 #include "mongoc-collection-private.h"
 #include "mongoc-write-command-private.h"
 #include "mongoc-write-concern.h"
@@ -8,6 +9,8 @@
 
 #include "TestSuite.h"
 
+#include "mock-server.h"
+
 #include "test-libmongoc.h"
 #include "mongoc-tests.h"
 
@@ -86,6 +89,90 @@ test_split_insert (void)
 }
 
 
+static void
+test_borrowed_insert (void)
+{
+   mongoc_write_command_t command;
+   mongoc_write_result_t result;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   bson_oid_t oid;
+   bson_iter_t iter;
+   bson_t **docs;
+   bson_t reply = BSON_INITIALIZER;
+   bson_t *query;
+   bson_t doc;
+   bson_error_t error;
+   int64_t count;
+   int i;
+   bool r;
+
+   client = test_framework_client_new (NULL);
+   assert (client);
+
+   collection = get_test_collection (client, "test_borrowed_insert");
+   assert (collection);
+
+   docs = bson_malloc (sizeof(bson_t*) * 3000);
+
+   /* every other document gets its "_id" from the driver */
+   for (i = 0; i < 3000; i++) {
+      docs [i] = bson_new ();
+      if (i % 2) {
+         bson_oid_init (&oid, NULL);
+         BSON_APPEND_OID (docs [i], "_id", &oid);
+      }
+      BSON_APPEND_INT32 (docs [i], "x", i);
+   }
+
+   _mongoc_write_result_init (&result);
+
+   _mongoc_write_command_init_insert_borrowed (&command,
+                                               (const bson_t * const *)docs,
+                                               3000, true, true, NULL);
+
+   _mongoc_write_command_execute (&command, client, 0, collection->db,
+                                  collection->collection, NULL, 0, &result);
+
+   r = _mongoc_write_result_complete (&result, &reply, &error);
+
+   assert (r);
+   assert (result.nInserted == 3000);
+
+   _mongoc_write_command_destroy (&command);
+   _mongoc_write_result_destroy (&result);
+
+   /* the caller's documents are left untouched */
+   assert (!bson_has_field (docs [0], "_id"));
+
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, NULL,
+                                    0, 0, NULL, &error);
+   assert (count == 3000);
+
+   query = BCON_NEW ("x", BCON_INT32 (2));
+   r = mongoc_collection_find_one (collection, query, NULL, NULL, &doc, &error);
+   assert (r);
+   assert (bson_iter_init_find (&iter, &doc, "_id") &&
+           BSON_ITER_HOLDS_OID (&iter));
+   assert (bson_iter_init_find (&iter, &doc, "x") &&
+           bson_iter_int32 (&iter) == 2);
+   bson_destroy (&doc);
+   bson_destroy (query);
+
+   r = mongoc_collection_drop (collection, &error);
+   assert (r);
+
+   for (i = 0; i < 3000; i++) {
+      bson_destroy (docs [i]);
+   }
+
+   bson_free (docs);
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+}
+
+
 static void
 test_invalid_write_concern (void)
 {
@@ -138,9 +225,382 @@ test_invalid_write_concern (void)
    mongoc_write_concern_destroy(write_concern);
 }
 
+static void
+test_batch_len (void)
+{
+   mongoc_write_command_t command;
+   const bson_t *docs [12];
+   bson_t *q;
+   bson_t *u;
+   bson_t ar;
+   bson_t child;
+   char str [16];
+   const char *key;
+   int i;
+
+   q = BCON_NEW ("x", BCON_INT32 (1));
+   u = BCON_NEW ("$set", "{", "y", BCON_UTF8 ("abc"), "}");
+
+   for (i = 0; i < 12; i++) {
+      docs [i] = q;
+   }
+
+   /* two appends, so that index keys run past one digit */
+   _mongoc_write_command_init_insert (&command, docs, 7, true, true);
+   _mongoc_write_command_insert_append (&command, docs, 5);
+   assert (command.n_documents == 12);
+   assert (command.batch_len == command.documents->len);
+   _mongoc_write_command_destroy (&command);
+
+   _mongoc_write_command_init_update (&command, q, u, false, false, true);
+
+   for (i = 1; i < 12; i++) {
+      _mongoc_write_command_update_append (&command, q, u, true, false);
+   }
+
+   assert (command.batch_len == command.documents->len);
+   _mongoc_write_command_destroy (&command);
+
+   _mongoc_write_command_init_delete (&command, q, false, true);
+   bson_init (&ar);
+
+   for (i = 0; i < 12; i++) {
+      if (i) {
+         _mongoc_write_command_delete_append (&command, q);
+      }
+
+      bson_uint32_to_string (i, &key, str, sizeof str);
+      bson_append_document_begin (&ar, key, -1, &child);
+      BSON_APPEND_DOCUMENT (&child, "q", q);
+      BSON_APPEND_INT32 (&child, "limit", 1);
+      bson_append_document_end (&ar, &child);
+   }
+
+   assert (command.batch_len == ar.len);
+   bson_destroy (&ar);
+   _mongoc_write_command_destroy (&command);
+
+   bson_destroy (q);
+   bson_destroy (u);
+}
+
+
+/*
+ * Returns the name of the command in the OP_QUERY @rpc, or NULL if it is
+ * not a command.
+ */
+static const char *
+command_name (const mongoc_rpc_t *rpc,
+              bson_t             *doc)
+{
+   const char *dot;
+   bson_iter_t iter;
+   int32_t len;
+
+   if (rpc->header.opcode != MONGOC_OPCODE_QUERY ||
+       !(dot = strchr (rpc->query.collection, '.')) ||
+       strcmp (dot, ".$cmd")) {
+      return NULL;
+   }
+
+   memcpy (&len, rpc->query.query, 4);
+   len = BSON_UINT32_FROM_LE (len);
+
+   if (!bson_init_static (doc, rpc->query.query, len) ||
+       !bson_iter_init (&iter, doc) ||
+       !bson_iter_next (&iter)) {
+      return NULL;
+   }
+
+   return bson_iter_key (&iter);
+}
+
+
+/*
+ * Acknowledges every write, legacy or command, as affecting one document,
+ * and counts 42 documents. Pings are answered by the mock server itself.
+ */
+static void
+pipelined_write_handler (mock_server_t   *server,
+                         mongoc_stream_t *stream,
+                         mongoc_rpc_t    *rpc,
+                         void            *user_data)
+{
+   const char *name;
+   bson_t reply = BSON_INITIALIZER;
+   bson_t doc;
+
+   if (!(name = command_name (rpc, &doc))) {
+      return;
+   }
+
+   if (!strcmp (name, "getlasterror")) {
+      BSON_APPEND_NULL (&reply, "err");
+      BSON_APPEND_INT32 (&reply, "n", 1);
+   } else if (!strcmp (name, "count")) {
+      BSON_APPEND_INT32 (&reply, "n", 42);
+   } else if (!strcmp (name, "delete") ||
+              !strcmp (name, "insert") ||
+              !strcmp (name, "update")) {
+      BSON_APPEND_INT32 (&reply, "n", 1);
+   }
+
+   BSON_APPEND_DOUBLE (&reply, "ok", 1.0);
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+typedef struct
+{
+   mongoc_client_t *client;
+   bool             armed;
+} ping_due_t;
+
+
+/*
+ * Once the first "delete" is on the wire, make a ping of the nodes due
+ * before the next operation, as if the last one were long ago.
+ */
+static void
+ping_due_started_cb (const mongoc_apm_command_started_t *event)
+{
+   ping_due_t *due = event->context;
+
+   if (due->armed && !strcmp (event->command_name, "delete")) {
+      due->armed = false;
+      due->client->cluster.mode = MONGOC_CLUSTER_SHARDED_CLUSTER;
+      due->client->cluster.last_ping = 0;
+      due->client->cluster.last_reconnect = 0;
+   }
+}
+
+
+/*
+ * Remove three documents with an unordered bulk operation while a ping
+ * of the nodes falls due after the first: the ping must not be written
+ * behind replies still in flight, or it reads one of them as its own and
+ * every later reply is matched to the wrong request.
+ */
+static void
+_test_pipelined_ping (int32_t max_wire_version)
+{
+   mongoc_apm_callbacks_t callbacks = { 0 };
+   mongoc_bulk_operation_t *bulk;
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   ping_due_t due = { 0 };
+   bson_error_t error;
+   bson_iter_t iter;
+   bson_t reply;
+   bson_t q = BSON_INITIALIZER;
+   uint16_t port;
+   char *uristr;
+   int64_t count;
+   uint32_t r;
+   int i;
+
+   port = 20000 + (rand () % 1000);
+
+   server = mock_server_new ("127.0.0.1", port, pipelined_write_handler,
+                             NULL);
+   mock_server_set_wire_version (server, 0, max_wire_version);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf (
+      "mongodb://127.0.0.1:%hu/?sockettimeoutms=5000", port);
+   client = mongoc_client_new (uristr);
+
+   if (!_mongoc_client_warm_up (client, &error)) {
+      assert (false);
+   }
+
+   /* one document per write command, so that they are pipelined */
+   client->cluster.max_write_batch_size = 1;
+
+   due.client = client;
+   due.armed = true;
+   callbacks.started = ping_due_started_cb;
+   mongoc_client_set_apm_callbacks (client, &callbacks, &due);
+
+   collection = mongoc_client_get_collection (client, "test", "test");
+   bulk = mongoc_collection_create_bulk_operation (collection, false, NULL);
+
+   for (i = 0; i < 3; i++) {
+      mongoc_bulk_operation_remove_one (bulk, &q);
+   }
+
+   r = mongoc_bulk_operation_execute (bulk, &reply, &error);
+   assert (r);
+   assert (!due.armed);
+
+   assert (bson_iter_init_find (&iter, &reply, "nRemoved"));
+   ASSERT_CMPINT (bson_iter_int32 (&iter), ==, 3);
+   bson_destroy (&reply);
+
+   /* nothing may be left unread on the stream */
+   client->cluster.mode = MONGOC_CLUSTER_DIRECT;
+   count = mongoc_collection_count (collection, MONGOC_QUERY_NONE, &q, 0, 0,
+                                    NULL, &error);
+   ASSERT_CMPINT ((int)count, ==, 42);
+
+   mongoc_bulk_operation_destroy (bulk);
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&q);
+   bson_free (uristr);
+}
+
+
+static void
+test_legacy_pipelined_ping (void)
+{
+   _test_pipelined_ping (0);
+}
+
+
+static void
+test_command_pipelined_ping (void)
+{
+   _test_pipelined_ping (3);
+}
+
+
+typedef struct
+{
+   int         n_inserts;
+   const char *errmsg;
+} retry_insert_t;
+
+
+/*
+ * Hangs up on the first insert command. The next is refused with a
+ * duplicate key error, as if the first had been applied.
+ */
+static void
+retry_insert_handler (mock_server_t   *server,
+                      mongoc_stream_t *stream,
+                      mongoc_rpc_t    *rpc,
+                      void            *user_data)
+{
+   retry_insert_t *retry = user_data;
+   const char *name;
+   bson_t reply = BSON_INITIALIZER;
+   bson_t doc;
+   bson_t ar;
+   bson_t child;
+
+   if (!(name = command_name (rpc, &doc)) || strcmp (name, "insert")) {
+      return;
+   }
+
+   if (!retry->n_inserts++) {
+      mongoc_stream_close (stream);
+      return;
+   }
+
+   BSON_APPEND_DOUBLE (&reply, "ok", 1.0);
+   BSON_APPEND_INT32 (&reply, "n", 0);
+   BSON_APPEND_ARRAY_BEGIN (&reply, "writeErrors", &ar);
+   BSON_APPEND_DOCUMENT_BEGIN (&ar, "0", &child);
+   BSON_APPEND_INT32 (&child, "index", 0);
+   BSON_APPEND_INT32 (&child, "code", 11000);
+   BSON_APPEND_UTF8 (&child, "errmsg", retry->errmsg);
+   bson_append_document_end (&ar, &child);
+   bson_append_array_end (&reply, &ar);
+
+   mock_server_reply_simple (server, stream, rpc, MONGOC_REPLY_NONE, &reply);
+   bson_destroy (&reply);
+}
+
+
+/*
+ * Insert a document whose connection is lost before the reply. The
+ * insert is sent again, and its duplicate key error is forgiven only if
+ * it is on the "_id" index, the one whose key the driver generated.
+ */
+static void
+_test_retry_insert (const char *errmsg,
+                    bool        forgiven)
+{
+   mongoc_collection_t *collection;
+   mongoc_client_t *client;
+   mock_server_t *server;
+   retry_insert_t retry = { 0 };
+   bson_error_t error;
+   bson_t doc = BSON_INITIALIZER;
+   uint16_t port;
+   char *uristr;
+   bool r;
+
+   port = 20000 + (rand () % 1000);
+
+   retry.errmsg = errmsg;
+   server = mock_server_new ("127.0.0.1", port, retry_insert_handler, &retry);
+   mock_server_set_wire_version (server, 0, 3);
+   mock_server_run_in_thread (server);
+
+   usleep (5000);
+
+   uristr = bson_strdup_printf ("mongodb://127.0.0.1:%hu/", port);
+   client = mongoc_client_new (uristr);
+   collection = mongoc_client_get_collection (client, "test", "test");
+
+   BSON_APPEND_UTF8 (&doc, "name", "a");
+   r = mongoc_collection_insert (collection, MONGOC_INSERT_NONE, &doc, NULL,
+                                 &error);
+   ASSERT_CMPINT (retry.n_inserts, ==, 2);
+
+   if (forgiven) {
+      ASSERT (r);
+   } else {
+      ASSERT (!r);
+      ASSERT_CMPINT (error.code, ==, 11000);
+   }
+
+   mongoc_collection_destroy (collection);
+   mongoc_client_destroy (client);
+   mock_server_quit (server, 0);
+   bson_destroy (&doc);
+   bson_free (uristr);
+}
+
+
+static void
+test_retry_insert_forgiven (void)
+{
+   _test_retry_insert ("E11000 duplicate key error index: test.test.$_id_ "
+                       "dup key: { : ObjectId('55b8f4d4e1382316a7b7d8d1') }",
+                       true);
+}
+
+
+static void
+test_retry_insert_unique_index (void)
+{
+   _test_retry_insert ("E11000 duplicate key error index: test.test.$name_1 "
+                       "dup key: { : \"a\" }",
+                       false);
+}
+
+
 void
 test_write_command_install (TestSuite *suite)
 {
    TestSuite_Add (suite, "/WriteCommand/split_insert", test_split_insert);
+   TestSuite_Add (suite, "/WriteCommand/borrowed_insert", test_borrowed_insert);
    TestSuite_Add (suite, "/WriteCommand/invalid_write_concern", test_invalid_write_concern);
+   TestSuite_Add (suite, "/WriteCommand/batch_len", test_batch_len);
+   TestSuite_Add (suite, "/WriteCommand/legacy_pipelined_ping",
+                  test_legacy_pipelined_ping);
+   TestSuite_Add (suite, "/WriteCommand/command_pipelined_ping",
+                  test_command_pipelined_ping);
+   TestSuite_Add (suite, "/WriteCommand/retry_insert_forgiven",
+                  test_retry_insert_forgiven);
+   TestSuite_Add (suite, "/WriteCommand/retry_insert_unique_index",
+                  test_retry_insert_unique_index);
 }